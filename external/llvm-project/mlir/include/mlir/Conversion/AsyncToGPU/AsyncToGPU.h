@@ -9,6 +9,9 @@
 #ifndef MLIR_CONVERSION_ASYNCTOGPU_ASYNCTOGPU_H
 #define MLIR_CONVERSION_ASYNCTOGPU_ASYNCTOGPU_H
 
+#include "llvm/ADT/StringRef.h"
+
+#include <cstdint>
 #include <memory>
 
 namespace mlir {
@@ -18,6 +21,11 @@ class Pass;
 /// Create a pass to convert Async operations to the GPU dialect.
 std::unique_ptr<Pass> createConvertAsyncToGPUPass();
 
+/// Hash of the chip that an AMDGPU arch such as "gfx90a:xnack-" names, as
+/// the runtime wrappers compute it for the current device in
+/// mgpuGetDeviceArchHash.
+uint64_t hashGPUChip(llvm::StringRef arch);
+
 } // namespace mlir
 
 #endif // MLIR_CONVERSION_ASYNCTOGPU_ASYNCTOGPU_H
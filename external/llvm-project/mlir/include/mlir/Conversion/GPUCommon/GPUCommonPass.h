@@ -44,6 +44,17 @@ using BlobGenerator =
 using LoweringCallback = std::function<std::unique_ptr<llvm::Module>(
     Operation *, llvm::LLVMContext &, StringRef)>;
 
+/// Unit attribute that makes the lowering of a `gpu.wait async` continue the
+/// stream of its first dependency, made to wait for the others, instead of
+/// creating a new stream. No other op may continue that stream from the same
+/// token.
+constexpr StringLiteral kGpuContinueStreamAttrName = "gpu.continue_stream";
+
+/// Unit attribute on a GPU module whose kernels take their memref arguments
+/// as bare pointers to the data, their statically known sizes and strides
+/// folded in, so that launches pass only those pointers.
+constexpr StringLiteral kGpuBarePtrCallConvAttrName = "gpu.bare_ptr_call_conv";
+
 /// Creates a pass to convert a GPU operations into a sequence of GPU runtime
 /// calls.
 ///
@@ -67,6 +67,20 @@ public:
 
   void runOnOperation() final;
 
+  /// Where the time of a run went, in microseconds, and the sizes of what it
+  /// produced.
+  struct Profile {
+    int64_t translateUs = 0;
+    int64_t optimizeUs = 0;
+    int64_t codegenUs = 0;
+    int64_t serializeUs = 0;
+    size_t isaSize = 0;
+    size_t binarySize = 0;
+  };
+
+  /// Returns the profile of the last run of this pass instance.
+  const Profile &getLastProfile() const { return lastProfile; }
+
 protected:
   void getDependentDialects(DialectRegistry &registry) const override;
 
@@ -91,6 +105,8 @@ private:
   virtual std::unique_ptr<std::vector<char>>
   serializeISA(const std::string &isa) = 0;
 
+  Profile lastProfile;
+
 protected:
   Option<std::string> triple{*this, "triple",
                              ::llvm::cl::desc("Target triple")};
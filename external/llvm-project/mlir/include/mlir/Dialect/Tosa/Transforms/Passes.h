@@ -36,6 +36,19 @@ std::unique_ptr<Pass> createTosaMakeBroadcastablePass();
 std::unique_ptr<Pass> createTosaTestQuantUtilAPIPass();
 std::unique_ptr<Pass> createTosaOptionalDecompositions();
 std::unique_ptr<Pass> createTosaPartitionPass();
+std::unique_ptr<Pass> createTosaPartitionPass(bool fusePooling);
+
+/// Tell if `op` is elementwise, a transpose or a reshape, which tosa-partition
+/// fuses around its anchors.
+bool isFuseableOp(Operation *op);
+
+/// Tell if `op` is an f32 average pooling whose windows tile its input
+/// exactly, without padding, which tosa-partition can fuse after an anchor.
+bool isNonOverlappingAvgPool(Operation *op);
+
+/// Tell if `op` is a tosa.custom op standing for a kernel of its own, such as
+/// a "miopen.layernorm", which tosa-partition outlines alone.
+bool isStandaloneKernelOp(Operation *op);
 
 class TosaPartitionPass : public TosaPartitionBase<TosaPartitionPass> {
   // Special case:  TransposeOp's second operand must be a
@@ -43,12 +56,19 @@ class TosaPartitionPass : public TosaPartitionBase<TosaPartitionPass> {
   // the TransposeOp.  "ops" here may be either leadingOps or trailingOps.
   void specialCaseForTranspose(Operation *op, SetVector<Operation *> &ops);
 
+  // Ops fused and inputs added around the current anchor op, to be kept
+  // within the fusion budget.
+  unsigned fusedOps = 0;
+  unsigned fusedInputs = 0;
+
 public:
   TosaPartitionPass() = default;
   virtual bool isAnchorOp(Operation *op);
   virtual bool isLeadingOp(Operation *op);
   virtual bool isTrailingOp(Operation *op);
   virtual StringRef partitionTag();
+  bool admitFusion(Operation *op, ValueRange connections,
+                   const SetVector<Value> &inputNodes, unsigned replacedInputs);
   void traceInputs(Operation *op, SetVector<Operation *> &predecessors,
                    SetVector<Value> &inputNodes);
   void runOnOperation() override;
@@ -58,10 +78,12 @@ class TosaPartitionPassWithOptions : public TosaPartitionPass {
 public:
   TosaPartitionPassWithOptions() = default;
   TosaPartitionPassWithOptions(ArrayRef<std::string> anchorOps_,
-                               const std::string &attrName, bool trailingOnly_);
+                               const std::string &attrName, bool trailingOnly_,
+                               bool fusePooling_ = false);
 
   bool isAnchorOp(Operation *op) override;
   bool isLeadingOp(Operation *op) override;
+  bool isTrailingOp(Operation *op) override;
   StringRef partitionTag() override;
 };
 
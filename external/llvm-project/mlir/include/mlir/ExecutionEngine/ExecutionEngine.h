@@ -107,6 +107,13 @@ public:
   static llvm::Expected<std::unique_ptr<ExecutionEngine>>
   create(ModuleOp m, const ExecutionEngineOptions &options = {});
 
+  /// Creates an execution engine for an object previously dumped by an engine
+  /// for this host, skipping the translation and compilation of a module.
+  /// Only the linking related options apply.
+  static llvm::Expected<std::unique_ptr<ExecutionEngine>>
+  create(std::unique_ptr<llvm::MemoryBuffer> object,
+         const ExecutionEngineOptions &options = {});
+
   /// Looks up a packed-argument function wrapping the function with the given
   /// name and returns a pointer to it. Propagates errors in case of failure.
   llvm::Expected<void (*)(void **)> lookupPacked(StringRef name) const;
@@ -190,6 +197,12 @@ public:
           symbolMap);
 
 private:
+  /// Creates the underlying LLJIT, linking against `options.sharedLibPaths`
+  /// and the current process.
+  void setupJIT(const ExecutionEngineOptions &options,
+                const llvm::DataLayout &dataLayout,
+                const llvm::Triple &targetTriple);
+
   /// Ordering of llvmContext and jit is important for destruction purposes: the
   /// jit must be destroyed before the context.
   llvm::LLVMContext llvmContext;
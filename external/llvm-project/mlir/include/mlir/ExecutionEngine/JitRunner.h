@@ -24,6 +24,7 @@
 namespace llvm {
 class Module;
 class LLVMContext;
+class SourceMgr;
 
 namespace orc {
 class MangleAndInterner;
@@ -33,10 +34,18 @@ class MangleAndInterner;
 namespace mlir {
 
 class DialectRegistry;
+class MLIRContext;
 class ModuleOp;
+template <typename OpTy>
+class OwningOpRef;
 struct LogicalResult;
 
 struct JitRunnerConfig {
+  /// A custom function that parses the input held by the source manager into
+  /// MLIR IR, for runners that accept other input formats.
+  llvm::function_ref<OwningOpRef<ModuleOp>(llvm::SourceMgr &, MLIRContext *)>
+      mlirParser = nullptr;
+
   /// MLIR transformer applied after parsing the input into MLIR IR and before
   /// passing the MLIR module to the ExecutionEngine.
   llvm::function_ref<LogicalResult(mlir::ModuleOp)> mlirTransformer = nullptr;
@@ -50,6 +59,11 @@ struct JitRunnerConfig {
   /// A callback to register symbols with ExecutionEngine at runtime.
   llvm::function_ref<llvm::orc::SymbolMap(llvm::orc::MangleAndInterner)>
       runtimesymbolMap = nullptr;
+
+  /// What the compiled object depends on besides the input and the command
+  /// line, such as the target a runner detects, which the keys of the JIT
+  /// cache include.
+  llvm::function_ref<std::string()> cacheKey = nullptr;
 };
 
 /// Entry point for all CPU runners. Expects the common argc/argv arguments for
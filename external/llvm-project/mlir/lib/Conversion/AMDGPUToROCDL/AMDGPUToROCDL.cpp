@@ -14,6 +14,7 @@
 #include "mlir/Dialect/LLVMIR/LLVMDialect.h"
 #include "mlir/Dialect/LLVMIR/ROCDLDialect.h"
 #include "mlir/IR/TypeRange.h"
+#include "mlir/IR/TypeUtilities.h"
 #include "llvm/ADT/STLExtras.h"
 
 using namespace mlir;
@@ -27,87 +28,41 @@ static Value createI32Constant(ConversionPatternRewriter &rewriter,
 }
 
 namespace {
-/// Define lowering patterns for raw buffer ops
-template <typename GpuOp, typename Intrinsic>
-struct RawBufferOpLowering : public ConvertOpToLLVMPattern<GpuOp> {
-  RawBufferOpLowering(LLVMTypeConverter &converter, Chipset chipset)
-      : ConvertOpToLLVMPattern<GpuOp>(converter), chipset(chipset) {}
+/// Buffer resources built during one conversion, per converted memref and
+/// bounds checking, shared by the lowerings of all the raw buffer ops.
+using BufferResourceCache = DenseMap<std::pair<Value, bool>, Value>;
+
+/// Common lowering of the raw buffer ops: the buffer resource built from the
+/// memref and the voffset and soffset computed from the indices.
+template <typename GpuOp>
+struct RawBufferOpLoweringBase : public ConvertOpToLLVMPattern<GpuOp> {
+  RawBufferOpLoweringBase(LLVMTypeConverter &converter, Chipset chipset,
+                          std::shared_ptr<BufferResourceCache> resources)
+      : ConvertOpToLLVMPattern<GpuOp>(converter), chipset(chipset),
+        resources(std::move(resources)) {}
 
   Chipset chipset;
-  static constexpr uint32_t maxVectorOpWidth = 128;
-
-  LogicalResult
-  matchAndRewrite(GpuOp gpuOp, typename GpuOp::Adaptor adaptor,
-                  ConversionPatternRewriter &rewriter) const override {
-    Location loc = gpuOp.getLoc();
-    Value memref = adaptor.getMemref();
-    Value unconvertedMemref = gpuOp.getMemref();
-    MemRefType memrefType = unconvertedMemref.getType().cast<MemRefType>();
-
-    if (chipset.majorVersion < 9)
-      return gpuOp.emitOpError("Raw buffer ops require GCN or higher");
-
-    Value storeData = adaptor.getODSOperands(0)[0];
-    if (storeData == memref) // no write component to this op
-      storeData = Value();
-    Type wantedDataType;
-    if (storeData)
-      wantedDataType = storeData.getType();
+  std::shared_ptr<BufferResourceCache> resources;
+
+  /// Return the buffer resource of `memref`, built once right after the
+  /// memref is defined, at the entry of the kernel for kernel arguments, so
+  /// that all the accesses to it share it instead of each building its own.
+  Value getBufferResource(Location loc, Value memref, MemRefType memrefType,
+                          bool boundsCheck,
+                          ConversionPatternRewriter &rewriter) const {
+    Value &resource = (*resources)[{memref, boundsCheck}];
+    if (resource)
+      return resource;
+
+    OpBuilder::InsertionGuard guard(rewriter);
+    if (Operation *def = memref.getDefiningOp())
+      rewriter.setInsertionPointAfter(def);
     else
-      wantedDataType = gpuOp.getODSResults(0)[0].getType();
-
-    Type llvmWantedDataType = this->typeConverter->convertType(wantedDataType);
+      rewriter.setInsertionPointToStart(
+          memref.cast<BlockArgument>().getOwner());
 
     Type i32 = rewriter.getI32Type();
-    Type llvmI32 = this->typeConverter->convertType(i32);
-
     int64_t elementByteWidth = memrefType.getElementTypeBitWidth() / 8;
-    Value byteWidthConst = createI32Constant(rewriter, loc, elementByteWidth);
-
-    // If we want to load a vector<NxT> with total size <= 32
-    // bits, use a scalar load and bitcast it. Similarly, if bitsize(T) < 32
-    // and the total load size is >= 32, use a vector load of N / (bitsize(T) /
-    // 32) x i32 and bitcast.
-    Type llvmBufferValType = llvmWantedDataType;
-    if (auto dataVector = wantedDataType.dyn_cast<VectorType>()) {
-      uint32_t elemBits = dataVector.getElementTypeBitWidth();
-      uint32_t totalBits = elemBits * dataVector.getNumElements();
-      if (totalBits > maxVectorOpWidth)
-        return gpuOp.emitOpError(
-            "Total width of loads or stores must be no more than " +
-            Twine(maxVectorOpWidth) + " bits, but we call for " +
-            Twine(totalBits) +
-            " bits. This should've been caught in validation");
-      if (elemBits < 32) {
-        if (totalBits > 32) {
-          if (totalBits % 32 != 0)
-            return gpuOp.emitOpError("Load or store of more than 32-bits that "
-                                     "doesn't fit into words. Can't happen\n");
-          llvmBufferValType = this->typeConverter->convertType(
-              VectorType::get(totalBits / 32, i32));
-        } else {
-          llvmBufferValType = this->typeConverter->convertType(
-              rewriter.getIntegerType(totalBits));
-        }
-      }
-    }
-
-    SmallVector<Value, 6> args;
-    if (storeData) {
-      if (llvmBufferValType != llvmWantedDataType) {
-        Value castForStore =
-            rewriter.create<LLVM::BitcastOp>(loc, llvmBufferValType, storeData);
-        args.push_back(castForStore);
-      } else {
-        args.push_back(storeData);
-      }
-    }
-
-    // Construct buffer descriptor from memref, attributes
-    int64_t offset = 0;
-    SmallVector<int64_t, 5> strides;
-    if (failed(getStridesAndOffset(memrefType, strides, offset)))
-      return gpuOp.emitOpError("Can't lower non-stride-offset memrefs");
 
     // Resource descriptor
     // bits 0-47: base address
@@ -122,7 +77,7 @@ struct RawBufferOpLowering : public ConvertOpToLLVMPattern<GpuOp> {
     Type llvmI64 = this->typeConverter->convertType(rewriter.getI64Type());
     Type llvm2xI32 = this->typeConverter->convertType(VectorType::get(2, i32));
 
-    Value resource = rewriter.create<LLVM::UndefOp>(loc, llvm4xI32);
+    resource = rewriter.create<LLVM::UndefOp>(loc, llvm4xI32);
 
     Value ptr = memrefDescriptor.alignedPtr(rewriter, loc);
     Value ptrAsInt = rewriter.create<LLVM::PtrToIntOp>(loc, llvmI64, ptr);
@@ -142,6 +97,8 @@ struct RawBufferOpLowering : public ConvertOpToLLVMPattern<GpuOp> {
           rewriter, loc,
           static_cast<int32_t>(memrefType.getNumElements() * elementByteWidth));
     } else {
+      Value byteWidthConst = this->createIndexConstant(
+          rewriter, loc, static_cast<uint64_t>(elementByteWidth));
       Value maxIndex;
       for (uint32_t i = 0, e = memrefType.getRank(); i < e; ++i) {
         Value size = memrefDescriptor.size(rewriter, loc, i);
@@ -152,7 +109,7 @@ struct RawBufferOpLowering : public ConvertOpToLLVMPattern<GpuOp> {
                                                                maxThisDim)
                             : maxThisDim;
       }
-      numRecords = rewriter.create<LLVM::TruncOp>(loc, llvmI32, maxIndex);
+      numRecords = truncToI32(rewriter, loc, maxIndex);
     }
     resource = rewriter.create<LLVM::InsertElementOp>(
         loc, llvm4xI32, resource, numRecords,
@@ -175,14 +132,48 @@ struct RawBufferOpLowering : public ConvertOpToLLVMPattern<GpuOp> {
     uint32_t word3 = (7 << 12) | (4 << 15);
     if (chipset.majorVersion == 10) {
       word3 |= (1 << 24);
-      uint32_t oob = adaptor.getBoundsCheck() ? 3 : 2;
+      uint32_t oob = boundsCheck ? 3 : 2;
       word3 |= (oob << 28);
     }
     Value word3Const = createI32Constant(rewriter, loc, word3);
     resource = rewriter.create<LLVM::InsertElementOp>(
         loc, llvm4xI32, resource, word3Const,
         this->createIndexConstant(rewriter, loc, 3));
-    args.push_back(resource);
+    return resource;
+  }
+
+  /// Truncate the index `value` to the 32 bits of buffer offsets, with
+  /// which all the offset arithmetic is done whatever the index bitwidth.
+  static Value truncToI32(ConversionPatternRewriter &rewriter, Location loc,
+                          Value value) {
+    Type i32 = rewriter.getI32Type();
+    if (value.getType() == i32)
+      return value;
+    return rewriter.create<LLVM::TruncOp>(loc, i32, value);
+  }
+
+  /// Append the resource descriptor, voffset and soffset of the access of
+  /// `gpuOp` to `args`.
+  LogicalResult appendBufferArgs(GpuOp gpuOp, typename GpuOp::Adaptor adaptor,
+                                 ConversionPatternRewriter &rewriter,
+                                 SmallVectorImpl<Value> &args) const {
+    Location loc = gpuOp.getLoc();
+    Value memref = adaptor.getMemref();
+    MemRefType memrefType =
+        gpuOp.getMemref().getType().template cast<MemRefType>();
+
+    int64_t elementByteWidth = memrefType.getElementTypeBitWidth() / 8;
+    Value byteWidthConst = createI32Constant(rewriter, loc, elementByteWidth);
+
+    // Strides and offset of the memref, in elements
+    int64_t offset = 0;
+    SmallVector<int64_t, 5> strides;
+    if (failed(getStridesAndOffset(memrefType, strides, offset)))
+      return gpuOp.emitOpError("Can't lower non-stride-offset memrefs");
+
+    MemRefDescriptor memrefDescriptor(memref);
+    args.push_back(getBufferResource(loc, memref, memrefType,
+                                     adaptor.getBoundsCheck(), rewriter));
 
     // Indexing (voffset)
     Value voffset;
@@ -192,7 +183,9 @@ struct RawBufferOpLowering : public ConvertOpToLLVMPattern<GpuOp> {
       Value strideOp;
       if (ShapedType::isDynamicStrideOrOffset(strides[i])) {
         strideOp = rewriter.create<LLVM::MulOp>(
-            loc, memrefDescriptor.stride(rewriter, loc, i), byteWidthConst);
+            loc, truncToI32(rewriter, loc,
+                            memrefDescriptor.stride(rewriter, loc, i)),
+            byteWidthConst);
       } else {
         strideOp =
             createI32Constant(rewriter, loc, strides[i] * elementByteWidth);
@@ -210,21 +203,118 @@ struct RawBufferOpLowering : public ConvertOpToLLVMPattern<GpuOp> {
     }
     args.push_back(voffset);
 
+    // soffset, in bytes like voffset.
     Value sgprOffset = adaptor.getSgprOffset();
-    if (!sgprOffset)
+    if (ShapedType::isDynamicStrideOrOffset(offset)) {
+      Value memrefOffset =
+          truncToI32(rewriter, loc, memrefDescriptor.offset(rewriter, loc));
+      sgprOffset = sgprOffset ? rewriter.create<LLVM::AddOp>(
+                                    loc, memrefOffset, sgprOffset)
+                              : memrefOffset;
+    } else if (offset > 0) {
+      Value offsetConst = createI32Constant(rewriter, loc, offset);
+      sgprOffset = sgprOffset ? rewriter.create<LLVM::AddOp>(loc, sgprOffset,
+                                                             offsetConst)
+                              : offsetConst;
+    }
+    if (sgprOffset)
+      sgprOffset = rewriter.create<LLVM::MulOp>(loc, sgprOffset,
+                                                byteWidthConst);
+    else
       sgprOffset = createI32Constant(rewriter, loc, 0);
-    if (ShapedType::isDynamicStrideOrOffset(offset))
-      sgprOffset = rewriter.create<LLVM::AddOp>(
-          loc, memrefDescriptor.offset(rewriter, loc), sgprOffset);
-    else if (offset > 0)
-      sgprOffset = rewriter.create<LLVM::AddOp>(
-          loc, sgprOffset, createI32Constant(rewriter, loc, offset));
     args.push_back(sgprOffset);
+    return success();
+  }
+};
+
+/// Define lowering patterns for raw buffer ops
+template <typename GpuOp, typename Intrinsic>
+struct RawBufferOpLowering : public RawBufferOpLoweringBase<GpuOp> {
+  using RawBufferOpLoweringBase<GpuOp>::RawBufferOpLoweringBase;
 
-    // bit 0: GLC = 0 (atomics drop value, less coherency)
-    // bits 1-2: SLC, DLC = 0 (similarly)
+  static constexpr uint32_t maxVectorOpWidth = 128;
+
+  LogicalResult
+  matchAndRewrite(GpuOp gpuOp, typename GpuOp::Adaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    Location loc = gpuOp.getLoc();
+    Value memref = adaptor.getMemref();
+
+    if (this->chipset.majorVersion < 9)
+      return gpuOp.emitOpError("Raw buffer ops require GCN or higher");
+
+    Value storeData = adaptor.getODSOperands(0)[0];
+    if (storeData == memref) // no write component to this op
+      storeData = Value();
+    Type wantedDataType;
+    if (storeData)
+      wantedDataType = storeData.getType();
+    else
+      wantedDataType = gpuOp.getODSResults(0)[0].getType();
+
+    Type llvmWantedDataType = this->typeConverter->convertType(wantedDataType);
+
+    Type i32 = rewriter.getI32Type();
+
+    // If we want to load a vector<NxT> with total size <= 32
+    // bits, use a scalar load and bitcast it. Similarly, if bitsize(T) < 32
+    // and the total load size is >= 32, use a vector load of N / (bitsize(T) /
+    // 32) x i32 and bitcast.
+    Type llvmBufferValType = llvmWantedDataType;
+    // Packed atomics, however, take their <2 x half> as is.
+    constexpr bool isAtomic = std::is_same<GpuOp, RawBufferAtomicFaddOp>::value;
+    if (isAtomic && wantedDataType.isa<VectorType>() &&
+        (this->chipset.majorVersion != 9 || this->chipset.minorVersion < 0x0a))
+      return gpuOp.emitOpError("packed atomic adds require gfx90a or higher");
+    auto dataVector = wantedDataType.dyn_cast<VectorType>();
+    if (dataVector && !isAtomic) {
+      uint32_t elemBits = dataVector.getElementTypeBitWidth();
+      uint32_t totalBits = elemBits * dataVector.getNumElements();
+      if (totalBits > maxVectorOpWidth)
+        return gpuOp.emitOpError(
+            "Total width of loads or stores must be no more than " +
+            Twine(maxVectorOpWidth) + " bits, but we call for " +
+            Twine(totalBits) +
+            " bits. This should've been caught in validation");
+      if (elemBits < 32) {
+        if (totalBits > 32) {
+          if (totalBits % 32 != 0)
+            return gpuOp.emitOpError("Load or store of more than 32-bits that "
+                                     "doesn't fit into words. Can't happen\n");
+          llvmBufferValType = this->typeConverter->convertType(
+              VectorType::get(totalBits / 32, i32));
+        } else {
+          llvmBufferValType = this->typeConverter->convertType(
+              rewriter.getIntegerType(totalBits));
+        }
+      }
+    }
+    // 64-bit values move as pairs of dwords.
+    if (!isAtomic &&
+        getElementTypeOrSelf(wantedDataType).getIntOrFloatBitWidth() == 64) {
+      int64_t numElements = dataVector ? dataVector.getNumElements() : 1;
+      llvmBufferValType = this->typeConverter->convertType(
+          VectorType::get(2 * numElements, i32));
+    }
+
+    SmallVector<Value, 6> args;
+    if (storeData) {
+      if (llvmBufferValType != llvmWantedDataType) {
+        Value castForStore =
+            rewriter.create<LLVM::BitcastOp>(loc, llvmBufferValType, storeData);
+        args.push_back(castForStore);
+      } else {
+        args.push_back(storeData);
+      }
+    }
+
+    if (failed(this->appendBufferArgs(gpuOp, adaptor, rewriter, args)))
+      return failure();
+
+    // bit 0: GLC (0 for atomics, which then drop their value)
+    // bits 1-2: SLC, DLC
     // bit 3: swizzled (0 for raw)
-    args.push_back(createI32Constant(rewriter, loc, 0));
+    args.push_back(createI32Constant(rewriter, loc, gpuOp.getCachePolicy()));
 
     llvm::SmallVector<Type, 1> resultTypes(gpuOp->getNumResults(),
                                            llvmBufferValType);
@@ -244,6 +334,43 @@ struct RawBufferOpLowering : public ConvertOpToLLVMPattern<GpuOp> {
   }
 };
 
+struct RawBufferLoadLdsOpLowering
+    : public RawBufferOpLoweringBase<RawBufferLoadLdsOp> {
+  using RawBufferOpLoweringBase<RawBufferLoadLdsOp>::RawBufferOpLoweringBase;
+
+  LogicalResult
+  matchAndRewrite(RawBufferLoadLdsOp gpuOp, RawBufferLoadLdsOp::Adaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    Location loc = gpuOp.getLoc();
+    if (chipset.majorVersion != 9)
+      return gpuOp.emitOpError("Buffer loads to LDS are only lowered for gfx9");
+
+    // The LDS address the hardware adds the lane offsets to, which it takes
+    // from M0.
+    auto ldsType = gpuOp.getLds().getType().cast<MemRefType>();
+    Value ldsAddr = getStridedElementPtr(loc, ldsType, adaptor.getLds(),
+                                         adaptor.getLdsIndices(), rewriter);
+    Type llvmI8Lds = LLVM::LLVMPointerType::get(rewriter.getI8Type(),
+                                                ldsType.getMemorySpaceAsInt());
+    ldsAddr = rewriter.create<LLVM::BitcastOp>(loc, llvmI8Lds, ldsAddr);
+
+    SmallVector<Value, 7> args;
+    if (failed(appendBufferArgs(gpuOp, adaptor, rewriter, args)))
+      return failure();
+    // The intrinsic takes the LDS address and the size of the load, in
+    // bytes, between the resource and the offsets.
+    args.insert(args.begin() + 1,
+                {ldsAddr, createI32Constant(rewriter, loc, 4)});
+    // Immediate offset and cache policy bits, see RawBufferOpLowering.
+    args.push_back(createI32Constant(rewriter, loc, 0));
+    args.push_back(createI32Constant(rewriter, loc, 0));
+    rewriter.create<ROCDL::RawBufferLoadLdsOp>(loc, TypeRange(), args,
+                                               ArrayRef<NamedAttribute>());
+    rewriter.eraseOp(gpuOp);
+    return success();
+  }
+};
+
 struct LDSBarrierOpLowering : public ConvertOpToLLVMPattern<LDSBarrierOp> {
   using ConvertOpToLLVMPattern<LDSBarrierOp>::ConvertOpToLLVMPattern;
 
@@ -337,6 +464,10 @@ static StringRef mfmaInstrToIntrinsicName(MFMAInstr instr) {
     LOWERING_CASE(i32_32x32x16_i8)
     LOWERING_CASE(f32_16x16x8_xf32)
     LOWERING_CASE(f32_32x32x4_xf32)
+    LOWERING_CASE(f32_16x16x32_fp8_fp8)
+    LOWERING_CASE(f32_16x16x32_bf8_bf8)
+    LOWERING_CASE(f32_32x32x16_fp8_fp8)
+    LOWERING_CASE(f32_32x32x16_bf8_bf8)
   }
 #undef LOWERING_CASE
 }
@@ -370,6 +501,244 @@ struct MFMAOpLowering : public ConvertOpToLLVMPattern<MFMAOp> {
   }
 };
 
+struct WMMAOpLowering : public ConvertOpToLLVMPattern<WMMAOp> {
+  WMMAOpLowering(LLVMTypeConverter &converter, Chipset chipset)
+      : ConvertOpToLLVMPattern<WMMAOp>(converter), chipset(chipset) {}
+
+  Chipset chipset;
+
+  LogicalResult
+  matchAndRewrite(WMMAOp op, WMMAOpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    Location loc = op.getLoc();
+    Type outType = typeConverter->convertType(op.destD().getType());
+    Type inElemType =
+        op.sourceA().getType().cast<VectorType>().getElementType();
+
+    if (chipset.majorVersion != 11)
+      return op->emitOpError("WMMA only supported on gfx11");
+
+    if (inElemType.isF16()) {
+      rewriter.replaceOpWithNewOp<ROCDL::wmma_f32_16x16x16_f16>(
+          op, outType,
+          ValueRange{adaptor.sourceA(), adaptor.sourceB(), adaptor.destC()});
+      return success();
+    }
+    // The intrinsics take bf16 inputs as i16s and i8 ones as packed i32s.
+    if (inElemType.isBF16()) {
+      Type i16Vector = VectorType::get(16, rewriter.getI16Type());
+      Value a = rewriter.create<LLVM::BitcastOp>(loc, i16Vector,
+                                                 adaptor.sourceA());
+      Value b = rewriter.create<LLVM::BitcastOp>(loc, i16Vector,
+                                                 adaptor.sourceB());
+      rewriter.replaceOpWithNewOp<ROCDL::wmma_f32_16x16x16_bf16>(
+          op, outType, ValueRange{a, b, adaptor.destC()});
+      return success();
+    }
+    Type i32Vector = VectorType::get(4, rewriter.getI32Type());
+    Value a =
+        rewriter.create<LLVM::BitcastOp>(loc, i32Vector, adaptor.sourceA());
+    Value b =
+        rewriter.create<LLVM::BitcastOp>(loc, i32Vector, adaptor.sourceB());
+    auto i1Constant = [&](bool value) -> Value {
+      return rewriter.create<LLVM::ConstantOp>(
+          loc, rewriter.getI1Type(), rewriter.getBoolAttr(value));
+    };
+    rewriter.replaceOpWithNewOp<ROCDL::wmma_i32_16x16x16_iu8>(
+        op, outType,
+        ValueRange{i1Constant(!op.unsignedA()), a, i1Constant(!op.unsignedB()),
+                   b, adaptor.destC(), i1Constant(op.clamp())});
+    return success();
+  }
+};
+
+struct SparseMFMAOpLowering : public ConvertOpToLLVMPattern<SparseMFMAOp> {
+  SparseMFMAOpLowering(LLVMTypeConverter &converter, Chipset chipset)
+      : ConvertOpToLLVMPattern<SparseMFMAOp>(converter), chipset(chipset) {}
+
+  Chipset chipset;
+
+  LogicalResult
+  matchAndRewrite(SparseMFMAOp op, SparseMFMAOpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    Location loc = op.getLoc();
+    Type outType = typeConverter->convertType(op.destD().getType());
+    auto aType = op.sourceA().getType().cast<VectorType>();
+    Type inElemType = aType.getElementType();
+    auto outVectorType = op.destC().getType().cast<VectorType>();
+    bool is32x32 = outVectorType.getNumElements() == 16;
+
+    if (chipset.majorVersion != 9 || chipset.minorVersion < 0x40)
+      return op->emitOpError("sparse MFMA only supported on gfx940+");
+
+    // The intrinsics take bf16 inputs as i16s and i8 ones as packed i32s.
+    Value a = adaptor.sourceA();
+    Value b = adaptor.sourceB();
+    int64_t numA = aType.getNumElements();
+    if (inElemType.isBF16() || inElemType.isInteger(8)) {
+      Type elemType = inElemType.isBF16() ? rewriter.getI16Type()
+                                          : rewriter.getI32Type();
+      int64_t perElem = inElemType.isBF16() ? 1 : 4;
+      a = rewriter.create<LLVM::BitcastOp>(
+          loc, VectorType::get(numA / perElem, elemType), a);
+      b = rewriter.create<LLVM::BitcastOp>(
+          loc, VectorType::get(2 * numA / perElem, elemType), b);
+    }
+
+    StringRef intrinsic;
+    if (inElemType.isF16())
+      intrinsic = is32x32 ? ROCDL::smfmac_f32_32x32x16_f16::getOperationName()
+                          : ROCDL::smfmac_f32_16x16x32_f16::getOperationName();
+    else if (inElemType.isBF16())
+      intrinsic = is32x32
+                      ? ROCDL::smfmac_f32_32x32x16_bf16::getOperationName()
+                      : ROCDL::smfmac_f32_16x16x32_bf16::getOperationName();
+    else
+      intrinsic = is32x32 ? ROCDL::smfmac_i32_32x32x32_i8::getOperationName()
+                          : ROCDL::smfmac_i32_16x16x64_i8::getOperationName();
+
+    OperationState loweredOp(loc, intrinsic);
+    loweredOp.addTypes(outType);
+    loweredOp.addOperands({a, b, adaptor.destC(), adaptor.sparseIdx(),
+                           createI32Constant(rewriter, loc, op.cbsz()),
+                           createI32Constant(rewriter, loc, op.abid())});
+    Operation *lowered = rewriter.create(loweredOp);
+    rewriter.replaceOp(op, lowered->getResults());
+    return success();
+  }
+};
+
+struct DotOpLowering : public ConvertOpToLLVMPattern<DotOp> {
+  DotOpLowering(LLVMTypeConverter &converter, Chipset chipset)
+      : ConvertOpToLLVMPattern<DotOp>(converter), chipset(chipset) {}
+
+  Chipset chipset;
+
+  LogicalResult
+  matchAndRewrite(DotOp op, DotOpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    Location loc = op.getLoc();
+    Type outType = typeConverter->convertType(op.destD().getType());
+    bool isF16 = op.sourceA()
+                     .getType()
+                     .cast<VectorType>()
+                     .getElementType()
+                     .isF16();
+
+    bool hasDotInsts = (chipset.majorVersion == 9 &&
+                        (chipset.minorVersion == 0x06 ||
+                         chipset.minorVersion == 0x08 ||
+                         chipset.minorVersion == 0x0a ||
+                         (isF16 && chipset.minorVersion >= 0x40))) ||
+                       (chipset.majorVersion == 10 &&
+                        chipset.minorVersion >= 0x11) ||
+                       chipset.majorVersion == 11;
+    if (!hasDotInsts)
+      return op->emitOpError("dot products not supported on this chipset");
+
+    Value clamp = rewriter.create<LLVM::ConstantOp>(
+        loc, rewriter.getI1Type(), rewriter.getBoolAttr(op.clamp()));
+    if (isF16) {
+      rewriter.replaceOpWithNewOp<ROCDL::fdot2>(
+          op, outType,
+          ValueRange{adaptor.sourceA(), adaptor.sourceB(), adaptor.destC(),
+                     clamp});
+      return success();
+    }
+
+    Value a = mfmaConcatIfNeeded(rewriter, loc, adaptor.sourceA());
+    Value b = mfmaConcatIfNeeded(rewriter, loc, adaptor.sourceB());
+    // gfx11 dropped v_dot4_i32_i8 in favor of the mixed-sign form.
+    if (chipset.majorVersion == 11) {
+      Value isSigned = rewriter.create<LLVM::ConstantOp>(
+          loc, rewriter.getI1Type(), rewriter.getBoolAttr(true));
+      rewriter.replaceOpWithNewOp<ROCDL::sudot4>(
+          op, outType,
+          ValueRange{isSigned, a, isSigned, b, adaptor.destC(), clamp});
+      return success();
+    }
+    rewriter.replaceOpWithNewOp<ROCDL::sdot4>(
+        op, outType, ValueRange{a, b, adaptor.destC(), clamp});
+    return success();
+  }
+};
+
+struct DsSwizzleOpLowering : public ConvertOpToLLVMPattern<DsSwizzleOp> {
+  using ConvertOpToLLVMPattern<DsSwizzleOp>::ConvertOpToLLVMPattern;
+
+  LogicalResult
+  matchAndRewrite(DsSwizzleOp op, DsSwizzleOpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    Value offset = rewriter.create<LLVM::ConstantOp>(
+        op.getLoc(), rewriter.getI32Type(), op.offsetAttr());
+    rewriter.replaceOpWithNewOp<ROCDL::DsSwizzleOp>(
+        op, rewriter.getI32Type(), adaptor.src(), offset);
+    return success();
+  }
+};
+
+struct ReadlaneOpLowering : public ConvertOpToLLVMPattern<ReadlaneOp> {
+  using ConvertOpToLLVMPattern<ReadlaneOp>::ConvertOpToLLVMPattern;
+
+  LogicalResult
+  matchAndRewrite(ReadlaneOp op, ReadlaneOpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    Value lane = rewriter.create<LLVM::ConstantOp>(
+        op.getLoc(), rewriter.getI32Type(), op.laneAttr());
+    rewriter.replaceOpWithNewOp<ROCDL::ReadlaneOp>(op, rewriter.getI32Type(),
+                                                   adaptor.src(), lane);
+    return success();
+  }
+};
+
+struct SchedBarrierOpLowering
+    : public ConvertOpToLLVMPattern<SchedBarrierOp> {
+  using ConvertOpToLLVMPattern<SchedBarrierOp>::ConvertOpToLLVMPattern;
+
+  LogicalResult
+  matchAndRewrite(SchedBarrierOp op, SchedBarrierOpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    Value mask = rewriter.create<LLVM::ConstantOp>(
+        op.getLoc(), rewriter.getI32Type(), op.maskAttr());
+    rewriter.replaceOpWithNewOp<ROCDL::SchedBarrierOp>(op, mask);
+    return success();
+  }
+};
+
+struct SetPrioOpLowering : public ConvertOpToLLVMPattern<SetPrioOp> {
+  using ConvertOpToLLVMPattern<SetPrioOp>::ConvertOpToLLVMPattern;
+
+  LogicalResult
+  matchAndRewrite(SetPrioOp op, SetPrioOpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    Type i16 = rewriter.getI16Type();
+    Value priority = rewriter.create<LLVM::ConstantOp>(
+        op.getLoc(), i16, rewriter.getIntegerAttr(i16, op.priority()));
+    rewriter.replaceOpWithNewOp<ROCDL::SetPrioOp>(op, priority);
+    return success();
+  }
+};
+
+struct MemtimeOpLowering : public ConvertOpToLLVMPattern<MemtimeOp> {
+  MemtimeOpLowering(LLVMTypeConverter &converter, Chipset chipset)
+      : ConvertOpToLLVMPattern<MemtimeOp>(converter), chipset(chipset) {}
+
+  Chipset chipset;
+
+  LogicalResult
+  matchAndRewrite(MemtimeOp op, MemtimeOpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    if (chipset.majorVersion < 9 || chipset.majorVersion > 10)
+      return op->emitOpError("s_memtime only supported on gfx9 and gfx10");
+    Type i64 = rewriter.getI64Type();
+    if (op.realtime())
+      rewriter.replaceOpWithNewOp<ROCDL::SMemRealTimeOp>(op, i64);
+    else
+      rewriter.replaceOpWithNewOp<ROCDL::SMemTimeOp>(op, i64);
+    return success();
+  }
+};
+
 struct ConvertAMDGPUToROCDLPass
     : public ConvertAMDGPUToROCDLBase<ConvertAMDGPUToROCDLPass> {
   ConvertAMDGPUToROCDLPass() = default;
@@ -400,11 +769,16 @@ void mlir::populateAMDGPUToROCDLConversionPatterns(LLVMTypeConverter &converter,
                                                    RewritePatternSet &patterns,
                                                    Chipset chipset) {
   patterns.add<LDSBarrierOpLowering>(converter);
+  auto resources = std::make_shared<BufferResourceCache>();
   patterns.add<
       RawBufferOpLowering<RawBufferLoadOp, ROCDL::RawBufferLoadOp>,
       RawBufferOpLowering<RawBufferStoreOp, ROCDL::RawBufferStoreOp>,
       RawBufferOpLowering<RawBufferAtomicFaddOp, ROCDL::RawBufferAtomicFAddOp>,
-      MFMAOpLowering>(converter, chipset);
+      RawBufferLoadLdsOpLowering>(converter, chipset, resources);
+  patterns.add<MFMAOpLowering, SparseMFMAOpLowering, WMMAOpLowering,
+               DotOpLowering, MemtimeOpLowering>(converter, chipset);
+  patterns.add<DsSwizzleOpLowering, ReadlaneOpLowering, SchedBarrierOpLowering,
+               SetPrioOpLowering>(converter);
 }
 
 std::unique_ptr<Pass> mlir::createConvertAMDGPUToROCDLPass() {
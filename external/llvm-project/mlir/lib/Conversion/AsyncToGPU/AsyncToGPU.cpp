@@ -9,6 +9,7 @@
 #include "mlir/Conversion/AsyncToGPU/AsyncToGPU.h"
 
 #include "../PassDetail.h"
+#include "mlir/Conversion/GPUCommon/GPUCommonPass.h"
 #include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
 #include "mlir/Dialect/Async/IR/Async.h"
 #include "mlir/Dialect/Func/IR/FuncOps.h"
@@ -19,6 +20,10 @@
 #include "mlir/Pass/Pass.h"
 #include "mlir/Transforms/DialectConversion.h"
 
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/MathExtras.h"
+
 #define DEBUG_TYPE "convert-async-to-gpu"
 
 using namespace mlir;
@@ -53,23 +58,109 @@ static Optional<func::FuncOp> getCalledFunc(async::LaunchOp op) {
   return llvm::None;
 }
 
-// Get target{gpu} attribute from called func
-static Optional<DictionaryAttr> getGPUTarget(async::LaunchOp op) {
+// Get the target{gpu} attributes from called func, one per chip, that name
+// the kernel in their binaries alike
+static SmallVector<DictionaryAttr, 2> getGPUTargets(async::LaunchOp op) {
+  SmallVector<DictionaryAttr, 2> targets;
   auto func = getCalledFunc(op);
   if (!func.hasValue() || func->getNumResults() != 0)
-    return llvm::None;
+    return targets;
 
   auto attr = (*func)->template getAttrOfType<ArrayAttr>("targets");
   if (!attr)
-    return llvm::None;
+    return targets;
 
+  llvm::SmallDenseSet<uint64_t, 2> chips;
   for (auto targetAttr : attr.getValue()) {
     auto dictAttr = targetAttr.cast<DictionaryAttr>();
     auto type = dictAttr.get("type");
-    if (type && type.template cast<StringAttr>() == "gpu")
-      return dictAttr;
+    if (!type || type.template cast<StringAttr>() != "gpu")
+      continue;
+    auto arch = dictAttr.getAs<StringAttr>("arch");
+    if (targets.empty()) {
+      if (arch)
+        chips.insert(hashGPUChip(arch.getValue()));
+    } else if (chips.empty() || !arch ||
+               dictAttr.get("kernel") != targets.front().get("kernel") ||
+               !chips.insert(hashGPUChip(arch.getValue())).second) {
+      continue;
+    }
+    targets.push_back(dictAttr);
   }
-  return llvm::None;
+  return targets;
+}
+
+// Get the first target{gpu} attribute from called func
+static Optional<DictionaryAttr> getGPUTarget(async::LaunchOp op) {
+  auto targets = getGPUTargets(op);
+  if (targets.empty())
+    return llvm::None;
+  return targets.front();
+}
+
+// The chip of an arch such as "amdgcn-amd-amdhsa:gfx90a:xnack-"
+static StringRef getChip(StringRef arch) {
+  size_t pos = arch.find("gfx");
+  if (pos != StringRef::npos)
+    arch = arch.drop_front(pos);
+  return arch.take_until([](char c) { return c == ':'; });
+}
+
+uint64_t mlir::hashGPUChip(StringRef arch) {
+  // 64-bit FNV-1a
+  uint64_t result = 14695981039346656037ULL;
+  for (char c : getChip(arch)) {
+    result ^= static_cast<unsigned char>(c);
+    result *= 1099511628211ULL;
+  }
+  return result;
+}
+
+// Pack the binaries of `targets` into a clang offload bundle, from which the
+// HIP runtime loads the one for the chip of the device.
+static std::string makeOffloadBundle(ArrayRef<DictionaryAttr> targets) {
+  constexpr StringLiteral kMagic = "__CLANG_OFFLOAD_BUNDLE__";
+  constexpr uint64_t kAlignment = 4096;
+  auto appendU64 = [](std::string &bytes, uint64_t value) {
+    for (unsigned i = 0; i < 8; ++i)
+      bytes.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  };
+
+  SmallVector<std::string, 2> ids;
+  uint64_t headerSize = kMagic.size() + 8;
+  for (DictionaryAttr target : targets) {
+    StringRef arch = target.getAs<StringAttr>("arch").getValue();
+    ids.push_back(("hipv4-amdgcn-amd-amdhsa--" + getChip(arch)).str());
+    headerSize += 3 * 8 + ids.back().size();
+  }
+
+  std::string header(kMagic);
+  std::string body;
+  appendU64(header, targets.size());
+  for (auto pair : llvm::zip(targets, ids)) {
+    StringRef binary =
+        std::get<0>(pair).getAs<StringAttr>("binary").getValue();
+    uint64_t offset = llvm::alignTo(headerSize + body.size(), kAlignment);
+    body.resize(offset - headerSize, '\0');
+    body.append(binary.begin(), binary.end());
+    appendU64(header, offset);
+    appendU64(header, binary.size());
+    appendU64(header, std::get<1>(pair).size());
+    header += std::get<1>(pair);
+  }
+  return header + body;
+}
+
+// Get the func through which launches query the chip of the device
+static func::FuncOp getArchHashFunc(ModuleOp module) {
+  constexpr StringLiteral kName = "mgpuGetDeviceArchHash";
+  if (auto func = module.lookupSymbol<func::FuncOp>(kName))
+    return func;
+  OpBuilder b = OpBuilder::atBlockEnd(module.getBody());
+  auto func = b.create<func::FuncOp>(
+      module.getLoc(), kName, b.getFunctionType({}, b.getI64Type()));
+  func.setPrivate();
+  return func;
 }
 
 //===----------------------------------------------------------------------===//
@@ -132,14 +223,19 @@ public:
 
     // 1. get target{gpu} attribute from func
 
-    auto gpuAttr = getGPUTarget(op);
-    if (!gpuAttr.hasValue())
+    auto targets = getGPUTargets(op);
+    if (targets.empty())
       return op.emitOpError("requires a gpu target");
 
-    auto arch = gpuAttr->get("arch");
-    auto binary = gpuAttr->get("binary");
-    auto blockSize = gpuAttr->get("block_size").cast<IntegerAttr>();
-    auto gridSize = gpuAttr->get("grid_size").cast<IntegerAttr>();
+    Attribute arch = targets.front().get("arch");
+    Attribute binary = targets.front().get("binary");
+    if (targets.size() > 1) {
+      SmallVector<StringRef, 2> chips;
+      for (DictionaryAttr target : targets)
+        chips.push_back(getChip(target.getAs<StringAttr>("arch").getValue()));
+      arch = rw.getStringAttr(llvm::join(chips, ","));
+      binary = rw.getStringAttr(makeOffloadBundle(targets));
+    }
 
     auto func = *getCalledFunc(op);
     Location floc = func.getLoc();
@@ -162,6 +258,11 @@ public:
       gpuModule = b.create<gpu::GPUModuleOp>(floc, gpuModuleName.str());
       gpuModule->setAttr("arch", arch);
       gpuModule->setAttr("gpu.binary", binary);
+      // Kernels take bare pointers only if every chip's code was built so
+      if (llvm::all_of(targets, [](DictionaryAttr target) {
+            return target.get(kGpuBarePtrCallConvAttrName) != nullptr;
+          }))
+        gpuModule->setAttr(kGpuBarePtrCallConvAttrName, b.getUnitAttr());
 
       SymbolTable symbolTable(module);
       symbolTable.insert(gpuModule);
@@ -172,8 +273,8 @@ public:
       OpBuilder b(gpuModule.getContext());
       gpuFunc =
           b.create<gpu::GPUFuncOp>(floc, funcName, func.getFunctionType());
-      gpuFunc->setAttr("block_size", blockSize);
-      gpuFunc->setAttr("grid_size", gridSize);
+      gpuFunc->setAttr("block_size", targets.front().get("block_size"));
+      gpuFunc->setAttr("grid_size", targets.front().get("grid_size"));
       gpuFunc->setAttr(gpu::GPUDialect::getKernelFuncAttrName(),
                        b.getUnitAttr());
 
@@ -196,10 +297,33 @@ public:
     auto tokenType = rw.getType<gpu::AsyncTokenType>();
 
     Value zeroIdx = rw.createOrFold<arith::ConstantIndexOp>(loc, 0);
-    Value blockSizeIdx = rw.createOrFold<arith::ConstantIndexOp>(
-        loc, blockSize.getValue().getLimitedValue());
-    Value gridSizeIdx = rw.createOrFold<arith::ConstantIndexOp>(
-        loc, gridSize.getValue().getLimitedValue());
+    // Each chip may have been tuned to its own launch dimensions
+    Value archHash;
+    auto getLaunchSize = [&](StringRef name) -> Value {
+      auto sizeOf = [&](DictionaryAttr target) {
+        return target.getAs<IntegerAttr>(name).getValue().getLimitedValue();
+      };
+      Value size = rw.createOrFold<arith::ConstantIndexOp>(
+          loc, sizeOf(targets.back()));
+      for (DictionaryAttr target : llvm::drop_begin(llvm::reverse(targets))) {
+        if (sizeOf(target) == sizeOf(targets.back()))
+          continue;
+        if (!archHash)
+          archHash = rw.create<func::CallOp>(loc, getArchHashFunc(module))
+                         .getResult(0);
+        Value chip = rw.createOrFold<arith::ConstantIntOp>(
+            loc, hashGPUChip(target.getAs<StringAttr>("arch").getValue()), 64);
+        Value isChip = rw.create<arith::CmpIOp>(loc, arith::CmpIPredicate::eq,
+                                                archHash, chip);
+        size = rw.create<arith::SelectOp>(
+            loc, isChip,
+            rw.createOrFold<arith::ConstantIndexOp>(loc, sizeOf(target)),
+            size);
+      }
+      return size;
+    };
+    Value blockSizeIdx = getLaunchSize("block_size");
+    Value gridSizeIdx = getLaunchSize("grid_size");
     Value dynamicSharedMemorySize;
 
     // async dependencies
@@ -209,8 +333,15 @@ public:
     size_t diff = operands.size() - func.getNumArguments();
     size_t i = 0;
     if (diff > 0) {
-      for (; i < diff; ++i)
-        asyncDeps.push_back(operands[i]);
+      for (; i < diff; ++i) {
+        // The host waits for the host launches the kernel depends on, see
+        // convertHostLaunches.
+        Value dependency = op.dependencies()[i];
+        if (dependency.getDefiningOp<async::ExecuteOp>())
+          rw.create<async::AwaitOp>(loc, dependency);
+        else
+          asyncDeps.push_back(operands[i]);
+      }
     } else
       assert(diff == 0);
 
@@ -287,6 +418,23 @@ public:
   LogicalResult matchAndRewrite(async::AwaitOp op, OpAdaptor adaptor,
                                 ConversionPatternRewriter &rw) const override {
     auto tokenType = rw.getType<gpu::AsyncTokenType>();
+    // A host launch waits for its GPU dependencies on a worker thread. As
+    // synchronizing with a stream destroys it, while the host may still use
+    // the dependency's, it synchronizes with a stream of its own that waits
+    // for the dependency's on events.
+    if (auto execute = op->getParentOfType<async::ExecuteOp>()) {
+      Value bridge;
+      {
+        OpBuilder::InsertionGuard guard(rw);
+        rw.setInsertionPoint(execute);
+        bridge = rw.create<gpu::WaitOp>(op.getLoc(), tokenType,
+                                        adaptor.getOperands())
+                     .asyncToken();
+      }
+      rw.create<gpu::WaitOp>(op.getLoc(), Type(), bridge);
+      rw.eraseOp(op);
+      return success();
+    }
     rw.create<gpu::WaitOp>(op.getLoc(), tokenType, adaptor.getOperands());
     rw.eraseOp(op);
 
@@ -295,6 +443,49 @@ public:
 };
 } // namespace
 
+//===----------------------------------------------------------------------===//
+// Run async.launch ops of kernels without a 'gpu' target, compiled for the
+// host, on the worker threads of the async runtime.
+//===----------------------------------------------------------------------===//
+
+// Turns each launch of a host kernel into an async.execute that calls it,
+// which the async runtime starts on one of its worker threads once the host
+// launches it depends on are done, so that the host goes on launching GPU
+// kernels meanwhile. Its GPU dependencies become async.await ops in its body,
+// which AwaitOpConversion bridges with events.
+static void convertHostLaunches(ModuleOp module) {
+  SmallVector<async::LaunchOp, 4> launches;
+  module.walk([&](async::LaunchOp op) {
+    if (op.results().empty() && !getGPUTarget(op).hasValue() &&
+        getCalledFunc(op).hasValue())
+      launches.push_back(op);
+  });
+
+  for (async::LaunchOp op : launches) {
+    func::FuncOp func = *getCalledFunc(op);
+    SmallVector<Value, 4> hostDeps, gpuDeps;
+    for (Value dependency : op.dependencies()) {
+      auto producer = dependency.getDefiningOp<async::LaunchOp>();
+      if (producer && getGPUTarget(producer).hasValue())
+        gpuDeps.push_back(dependency);
+      else
+        hostDeps.push_back(dependency);
+    }
+
+    OpBuilder b(op);
+    auto execute = b.create<async::ExecuteOp>(
+        op.getLoc(), TypeRange{}, hostDeps, ValueRange{},
+        [&](OpBuilder &nested, Location loc, ValueRange) {
+          for (Value dependency : gpuDeps)
+            nested.create<async::AwaitOp>(loc, dependency);
+          nested.create<func::CallOp>(loc, func, op.operands());
+          nested.create<async::YieldOp>(loc, ValueRange{});
+        });
+    op.token().replaceAllUsesWith(execute.token());
+    op.erase();
+  }
+}
+
 //===----------------------------------------------------------------------===//
 
 namespace {
@@ -308,6 +499,8 @@ void ConvertAsyncToGPUPass::runOnOperation() {
   ModuleOp module = getOperation();
   MLIRContext *ctx = module->getContext();
 
+  convertHostLaunches(module);
+
   // Convert async dialect types and operations to LLVM dialect.
   AsyncGPUTypeConverter converter;
   RewritePatternSet patterns(ctx);
@@ -325,6 +518,11 @@ void ConvertAsyncToGPUPass::runOnOperation() {
   // Except when async.launch has no GPU target.
   target.addDynamicallyLegalOp<async::LaunchOp>(
       [&](async::LaunchOp op) { return !getGPUTarget(op).hasValue(); });
+  // And for the host launches and their awaits on the host.
+  target.addLegalOp<async::ExecuteOp, async::YieldOp>();
+  target.addDynamicallyLegalOp<async::AwaitOp>([&](async::AwaitOp op) {
+    return op.operand().getDefiningOp<async::ExecuteOp>() != nullptr;
+  });
   // TODO(sjw): Make async.token universal
   // target.addDynamicallyLegalOp<async::AwaitOp>([&](async::AwaitOp op) {
   //     return true;
@@ -17,6 +17,7 @@
 #include "mlir/Conversion/AMDGPUToROCDL/AMDGPUToROCDL.h"
 #include "mlir/Conversion/ArithmeticToLLVM/ArithmeticToLLVM.h"
 #include "mlir/Conversion/FuncToLLVM/ConvertFuncToLLVM.h"
+#include "mlir/Conversion/GPUCommon/GPUCommonPass.h"
 #include "mlir/Conversion/GPUToROCDL/Runtimes.h"
 #include "mlir/Conversion/LLVMCommon/ConversionTarget.h"
 #include "mlir/Conversion/LLVMCommon/LoweringOptions.h"
@@ -70,10 +71,32 @@ struct LowerGpuOpsToROCDLOpsPass
     : public ConvertGpuOpsToROCDLOpsBase<LowerGpuOpsToROCDLOpsPass> {
   LowerGpuOpsToROCDLOpsPass() = default;
   LowerGpuOpsToROCDLOpsPass(const std::string &chipset, unsigned indexBitwidth,
-                            gpu::amd::Runtime runtime) {
+                            gpu::amd::Runtime runtime,
+                            bool useBarePtrCallConv) {
     this->chipset = chipset;
     this->indexBitwidth = indexBitwidth;
     this->runtime = runtime;
+    this->useBarePtrCallConv = useBarePtrCallConv;
+  }
+
+  /// Whether every memref argument of the functions of `m` can be a bare
+  /// pointer.
+  static bool canUseBarePtrCallConv(gpu::GPUModuleOp m) {
+    auto canConvert = [](Type type) {
+      auto memrefType = type.dyn_cast<BaseMemRefType>();
+      return !memrefType || LLVMTypeConverter::canConvertToBarePtr(memrefType);
+    };
+    auto allArgsConvert = [&](FunctionType type) {
+      return llvm::all_of(type.getInputs(), canConvert) &&
+             llvm::all_of(type.getResults(), canConvert);
+    };
+    for (auto func : m.getOps<gpu::GPUFuncOp>())
+      if (!allArgsConvert(func.getFunctionType()))
+        return false;
+    for (auto func : m.getOps<func::FuncOp>())
+      if (!allArgsConvert(func.getFunctionType()))
+        return false;
+    return true;
   }
 
   void runOnOperation() override {
@@ -97,6 +120,12 @@ struct LowerGpuOpsToROCDLOpsPass
         ctx, DataLayout(cast<DataLayoutOpInterface>(m.getOperation())));
     if (indexBitwidth != kDeriveIndexBitwidthFromDataLayout)
       options.overrideIndexBitwidth(indexBitwidth);
+    // The launches of the module follow the attribute, so the convention
+    // holds for all of its functions or none
+    if (useBarePtrCallConv && canUseBarePtrCallConv(m)) {
+      options.useBarePtrCallConv = true;
+      m->setAttr(kGpuBarePtrCallConvAttrName, UnitAttr::get(ctx));
+    }
     
     LLVMTypeConverter converter(ctx, options);
 
@@ -255,7 +284,8 @@ void mlir::populateGpuToROCDLConversionPatterns(
 std::unique_ptr<OperationPass<gpu::GPUModuleOp>>
 mlir::createLowerGpuOpsToROCDLOpsPass(const std::string &chipset,
                                       unsigned indexBitwidth,
-                                      gpu::amd::Runtime runtime) {
-  return std::make_unique<LowerGpuOpsToROCDLOpsPass>(chipset, indexBitwidth,
-                                                     runtime);
+                                      gpu::amd::Runtime runtime,
+                                      bool useBarePtrCallConv) {
+  return std::make_unique<LowerGpuOpsToROCDLOpsPass>(
+      chipset, indexBitwidth, runtime, useBarePtrCallConv);
 }
@@ -54,6 +54,18 @@ static LogicalResult verifyRawBufferOp(T &op) {
 
 LogicalResult RawBufferLoadOp::verify() { return verifyRawBufferOp(*this); }
 
+LogicalResult RawBufferLoadLdsOp::verify() {
+  MemRefType ldsType = getLds().getType().cast<MemRefType>();
+  if (ldsType.getMemorySpaceAsInt() != 3)
+    return emitOpError("Loads to LDS must write to workgroup memory");
+  if (static_cast<int64_t>(getLdsIndices().size()) != ldsType.getRank())
+    return emitOpError("Expected " + Twine(ldsType.getRank()) +
+                       " indices to the LDS memref");
+  if (ldsType.getElementTypeBitWidth() > 32)
+    return emitOpError("Loads to LDS move 32 bits per lane");
+  return verifyRawBufferOp(*this);
+}
+
 LogicalResult RawBufferStoreOp::verify() { return verifyRawBufferOp(*this); }
 
 LogicalResult RawBufferAtomicFaddOp::verify() {
@@ -116,6 +128,10 @@ LogicalResult MFMAOp::verify() {
     break;
   case MFMAInstr::i32_16x16x32_i8:
   case MFMAInstr::i32_32x32x16_i8:
+  case MFMAInstr::f32_16x16x32_fp8_fp8:
+  case MFMAInstr::f32_16x16x32_bf8_bf8:
+  case MFMAInstr::f32_32x32x16_fp8_fp8:
+  case MFMAInstr::f32_32x32x16_bf8_bf8:
     if (inType != b.getI64Type() && inType != VectorType::get(8, b.getI8Type()))
       return emitOpError(instrName + " requires i64 or vector<8xi8> inputs");
     break;
@@ -144,6 +160,8 @@ LogicalResult MFMAOp::verify() {
   case MFMAInstr::f32_16x16x4bf16_1k:
   case MFMAInstr::f32_32x32x8bf16_1k:
   case MFMAInstr::f32_32x32x4_xf32:
+  case MFMAInstr::f32_32x32x16_fp8_fp8:
+  case MFMAInstr::f32_32x32x16_bf8_bf8:
     if (outType != VectorType::get(16, b.getF32Type()))
       return emitOpError(instrName + " must have vector<16xf32> outputs");
     break;
@@ -156,6 +174,8 @@ LogicalResult MFMAOp::verify() {
   case MFMAInstr::f32_4x4x4bf16_1k:
   case MFMAInstr::f32_16x16x16bf16_1k:
   case MFMAInstr::f32_16x16x8_xf32:
+  case MFMAInstr::f32_16x16x32_fp8_fp8:
+  case MFMAInstr::f32_16x16x32_bf8_bf8:
     if (outType != VectorType::get(4, b.getF32Type()))
       return emitOpError(instrName + " must have vector<4xf32> outputs");
     break;
@@ -187,6 +207,45 @@ LogicalResult MFMAOp::verify() {
   return success();
 }
 
+//===----------------------------------------------------------------------===//
+// DotOp
+//===----------------------------------------------------------------------===//
+LogicalResult DotOp::verify() {
+  Type inElemType = sourceA().getType().cast<VectorType>().getElementType();
+  Type outType = destC().getType();
+  if (inElemType.isF16() && !outType.isF32())
+    return emitOpError("f16 dot products must accumulate to f32");
+  if (inElemType.isInteger(8) && !outType.isInteger(32))
+    return emitOpError("i8 dot products must accumulate to i32");
+  return success();
+}
+
+LogicalResult WMMAOp::verify() {
+  Type inElemType = sourceA().getType().cast<VectorType>().getElementType();
+  Type outElemType = destC().getType().cast<VectorType>().getElementType();
+  if (inElemType.isInteger(8) != outElemType.isInteger(32))
+    return emitOpError("i8 inputs, and only them, accumulate to i32");
+  if (!inElemType.isInteger(8) && (unsignedA() || unsignedB() || clamp()))
+    return emitOpError("signedness and clamping only apply to i8 inputs");
+  return success();
+}
+
+//===----------------------------------------------------------------------===//
+// SparseMFMAOp
+//===----------------------------------------------------------------------===//
+LogicalResult SparseMFMAOp::verify() {
+  auto aType = sourceA().getType().cast<VectorType>();
+  auto bType = sourceB().getType().cast<VectorType>();
+  Type outElemType = destC().getType().cast<VectorType>().getElementType();
+  if (aType.getElementType() != bType.getElementType())
+    return emitOpError("sourceA and sourceB must have the same element type");
+  if (bType.getNumElements() != 2 * aType.getNumElements())
+    return emitOpError("sourceB must have twice as many elements as sourceA");
+  if (aType.getElementType().isInteger(8) != outElemType.isInteger(32))
+    return emitOpError("i8 inputs, and only them, accumulate to i32");
+  return success();
+}
+
 #include "mlir/Dialect/AMDGPU/AMDGPUEnums.cpp.inc"
 
 #define GET_ATTRDEF_CLASSES
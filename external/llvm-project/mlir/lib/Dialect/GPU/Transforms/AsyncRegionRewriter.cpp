@@ -40,6 +40,15 @@ static bool isTerminator(Operation *op) {
 static bool hasSideEffects(Operation *op) {
   return !MemoryEffectOpInterface::hasNoEffect(op);
 }
+// Whether `op` is part of a chain of asynchronous GPU ops the input built.
+static bool isInAsyncChain(Operation *op) {
+  auto asyncOp = dyn_cast<gpu::AsyncOpInterface>(op);
+  if (!asyncOp || !asyncOp.getAsyncToken())
+    return false;
+  if (isa<gpu::WaitOp>(op))
+    return asyncOp.getAsyncDependencies().empty();
+  return !asyncOp.getAsyncDependencies().empty();
+}
 
 // Region walk callback which makes GPU ops implementing the AsyncOpInterface
 // execute asynchronously.
@@ -63,9 +72,15 @@ private:
   // host-synchronize execution. A `!gpu.async.token` will therefore only be
   // used inside of its block and GPU execution will always synchronize with
   // the host at block boundaries.
+  //
+  // Chains of ops that are asynchronous already, starting at a `gpu.wait
+  // async` without dependencies, are left as they are. A blocking `gpu.wait`
+  // on such a chain still synchronizes the current token too.
   LogicalResult visit(Operation *op) {
     if (isa<gpu::LaunchOp>(op))
       return op->emitOpError("replace with gpu.launch_func first");
+    if (isInAsyncChain(op))
+      return success();
     if (auto waitOp = llvm::dyn_cast<gpu::WaitOp>(op)) {
       if (currentToken)
         waitOp.addAsyncDependency(currentToken);
@@ -329,7 +344,7 @@ struct GpuAsyncRegionPass::SingleTokenUseCallback {
 
 // Replaces synchronous GPU ops in the op's region with asynchronous ones and
 // inserts the necessary synchronization (as gpu.wait ops). Assumes sequential
-// execution semantics and that no GPU ops are asynchronous yet.
+// execution semantics, other than for GPU ops that are asynchronous already.
 void GpuAsyncRegionPass::runOnOperation() {
   if (getOperation()->walk(ThreadTokenCallback(getContext())).wasInterrupted())
     return signalPassFailure();
@@ -21,12 +21,25 @@
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
 
+#include <chrono>
 #include <string>
 
 #define DEBUG_TYPE "serialize-to-blob"
 
 using namespace mlir;
 
+using Clock = std::chrono::steady_clock;
+
+/// Returns the microseconds since `start`, and moves `start` to now.
+static int64_t lap(Clock::time_point &start) {
+  Clock::time_point now = Clock::now();
+  int64_t us =
+      std::chrono::duration_cast<std::chrono::microseconds>(now - start)
+          .count();
+  start = now;
+  return us;
+}
+
 std::string gpu::getDefaultGpuBinaryAnnotation() { return "gpu.binary"; }
 
 gpu::SerializeToBlobPass::SerializeToBlobPass(TypeID passID)
@@ -40,8 +53,10 @@ gpu::SerializeToBlobPass::translateToISA(llvm::Module &llvmModule,
                                          llvm::TargetMachine &targetMachine) {
   llvmModule.setDataLayout(targetMachine.createDataLayout());
 
+  Clock::time_point start = Clock::now();
   if (failed(optimizeLlvm(llvmModule, targetMachine)))
     return llvm::None;
+  lastProfile.optimizeUs = lap(start);
 
   std::string targetISA;
   llvm::raw_string_ostream stream(targetISA);
@@ -56,16 +71,20 @@ gpu::SerializeToBlobPass::translateToISA(llvm::Module &llvmModule,
 
     codegenPasses.run(llvmModule);
   }
+  lastProfile.codegenUs = lap(start);
   return stream.str();
 }
 
 void gpu::SerializeToBlobPass::runOnOperation() {
   // Lower the module to an LLVM IR module using a separate context to enable
   // multi-threaded processing.
+  lastProfile = Profile();
+  Clock::time_point start = Clock::now();
   llvm::LLVMContext llvmContext;
   std::unique_ptr<llvm::Module> llvmModule = translateToLLVMIR(llvmContext);
   if (!llvmModule)
     return signalPassFailure();
+  lastProfile.translateUs = lap(start);
 
   // Lower the LLVM IR module to target ISA.
   std::unique_ptr<llvm::TargetMachine> targetMachine = createTargetMachine();
@@ -79,6 +98,7 @@ void gpu::SerializeToBlobPass::runOnOperation() {
     return signalPassFailure();
 
   std::string targetISA = std::move(maybeTargetISA.getValue());
+  lastProfile.isaSize = targetISA.size();
 
   LLVM_DEBUG({
     llvm::dbgs() << "ISA for module: " << getOperation().getNameAttr() << "\n";
@@ -87,9 +107,12 @@ void gpu::SerializeToBlobPass::runOnOperation() {
   });
 
   // Serialize the target ISA.
+  start = Clock::now();
   std::unique_ptr<std::vector<char>> blob = serializeISA(targetISA);
   if (!blob)
     return signalPassFailure();
+  lastProfile.serializeUs = lap(start);
+  lastProfile.binarySize = blob->size();
 
   // Add the blob as module attribute.
   auto attr =
@@ -69,6 +69,12 @@
 
 #include "llvm/Transforms/IPO/Internalize.h"
 
+#ifdef MLIR_GPU_TO_HSACO_LLD_LIBRARY
+#include "lld/Common/CommonLinkerContext.h"
+#include "lld/Common/Driver.h"
+#include "llvm/Support/CrashRecoveryContext.h"
+#endif
+
 #include <mutex>
 #include <string>
 
@@ -274,7 +280,6 @@ SerializeToHsacoPass::translateToLLVMIR(llvm::LLVMContext &llvmContext) {
     addControlConstant("__oclc_unsafe_math_opt", 0, 8);
   }
   if (needOcml || needOckl) {
-    addControlConstant("__oclc_wavefrontsize64", 1, 8);
     StringRef chipSet = this->chip.getValue();
     if (chipSet.startswith("gfx"))
       chipSet = chipSet.substr(3);
@@ -282,6 +287,11 @@ SerializeToHsacoPass::translateToLLVMIR(llvm::LLVMContext &llvmContext) {
         llvm::APInt(32, chipSet.substr(chipSet.size() - 2), 16).getZExtValue();
     uint32_t major = llvm::APInt(32, chipSet.substr(0, chipSet.size() - 2), 10)
                          .getZExtValue();
+    // gfx10 and later run in wave32 unless asked for wave64.
+    bool isWave64 =
+        major < 10 ||
+        StringRef(this->features.getValue()).contains("+wavefrontsize64");
+    addControlConstant("__oclc_wavefrontsize64", isWave64, 8);
     uint32_t isaNumber = minor + 1000 * major;
     addControlConstant("__oclc_ISA_version", isaNumber, 32);
 
@@ -468,6 +478,30 @@ SerializeToHsacoPass::createHsaco(const SmallVectorImpl<char> &isaBinary) {
   }
   llvm::FileRemover cleanupHsaco(tempHsacoFilename);
 
+#ifdef MLIR_GPU_TO_HSACO_LLD_LIBRARY
+  // lld keeps its state in globals, so links run one at a time. A fatal lld
+  // error unwinds to the recovery context instead of exiting the process.
+  {
+    static std::mutex lldMutex;
+    const std::lock_guard<std::mutex> lock(lldMutex);
+    std::string lldErrors;
+    llvm::raw_string_ostream lldErrorOs(lldErrors);
+    bool linked = false;
+    llvm::CrashRecoveryContext crc;
+    bool ranSafely = crc.RunSafely([&]() {
+      linked = lld::elf::link({"ld.lld", "-shared",
+                               tempIsaBinaryFilename.c_str(), "-o",
+                               tempHsacoFilename.c_str()},
+                              llvm::nulls(), lldErrorOs, /*exitEarly=*/false,
+                              /*disableOutput=*/false);
+    });
+    lld::CommonLinkerContext::destroy();
+    if (!ranSafely || !linked) {
+      emitError(loc, "lld invocation error: ") << lldErrorOs.str();
+      return {};
+    }
+  }
+#else
   std::string theRocmPath = getRocmPath();
   llvm::SmallString<32> lldPath(theRocmPath);
   llvm::sys::path::append(lldPath, "llvm", "bin", "ld.lld");
@@ -478,6 +512,7 @@ SerializeToHsacoPass::createHsaco(const SmallVectorImpl<char> &isaBinary) {
     emitError(loc, "lld invocation error");
     return {};
   }
+#endif
 
   // Load the HSA code object.
   auto hsacoFile = openInputFile(tempHsacoFilename);
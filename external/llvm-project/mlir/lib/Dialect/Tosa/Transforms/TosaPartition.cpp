@@ -35,8 +35,8 @@
 #include "llvm/ADT/SetVector.h"
 #include "llvm/ADT/SmallVector.h"
 #include <algorithm>
-#include <deque>
 #include <iostream>
+#include <limits>
 
 using llvm::SmallVector;
 
@@ -54,7 +54,9 @@ bool isElementwiseOp(Operation *op) {
   return op->hasTrait<OpTrait::Elementwise>() ||
          op->hasTrait<OpTrait::ResultsBroadcastableShape>() ||
          // clang-format off
-    isa<tosa::ClampOp,
+    isa<tosa::CastOp,
+        tosa::ClampOp,
+        tosa::RescaleOp,
         tosa::ReluNOp,
         tosa::SigmoidOp,
         tosa::TanhOp,
@@ -94,10 +96,6 @@ bool isElementwiseOp(Operation *op) {
   // clang-format on
 }
 
-bool isFuseableOp(Operation *op) {
-  return isElementwiseOp(op) || isa<tosa::TransposeOp, tosa::ReshapeOp>(op);
-}
-
 bool isZeroAttribute(Attribute value) {
   if (auto intValue = value.dyn_cast<IntegerAttr>())
     return intValue.getValue().isNullValue();
@@ -120,6 +118,31 @@ bool isConstantZero(Operation *op) {
   return false;
 }
 
+// Bytes of memory traffic, a write and a read back, that keeping `v` inside
+// a kernel saves.  Returns -1 if `v` isn't statically shaped.
+int64_t roundTripBytes(Value v) {
+  auto type = v.getType().dyn_cast<ShapedType>();
+  if (!type || !type.hasStaticShape() || !type.getElementType().isIntOrFloat())
+    return -1;
+  int64_t elementBytes =
+      llvm::divideCeil(type.getElementType().getIntOrFloatBitWidth(), 8);
+  return 2 * type.getNumElements() * elementBytes;
+}
+
+// Memory traffic saved by fusing an op connected to a partition through the
+// values `connections` into it.  Unknown sizes count as a large saving, so
+// dynamically shaped ops are still fused.
+int64_t fusionSavings(ValueRange connections) {
+  int64_t saved = 0;
+  for (Value v : connections) {
+    int64_t bytes = roundTripBytes(v);
+    if (bytes < 0)
+      return std::numeric_limits<int64_t>::max();
+    saved += bytes;
+  }
+  return saved;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 // Inspired by / adapted from outlineIfOp() in SCF/Transforms/Utils.cpp
@@ -451,7 +474,9 @@ void TosaPartitionPass::specialCaseForTranspose(Operation *op,
 }
 
 bool TosaPartitionPass::isAnchorOp(Operation *op) {
-  return isa<tosa::Conv2DOp, tosa::MatMulOp, tosa::DepthwiseConv2DOp>(op);
+  return isa<tosa::Conv2DOp, tosa::MatMulOp, tosa::DepthwiseConv2DOp,
+             tosa::TransposeConv2DOp>(op) ||
+         isStandaloneKernelOp(op);
 }
 
 bool TosaPartitionPass::isLeadingOp(Operation *op) {
@@ -460,8 +485,68 @@ bool TosaPartitionPass::isLeadingOp(Operation *op) {
 
 bool TosaPartitionPass::isTrailingOp(Operation *op) { return isFuseableOp(op); }
 
+bool mlir::tosa::isFuseableOp(Operation *op) {
+  return isElementwiseOp(op) || isa<tosa::TransposeOp, tosa::ReshapeOp>(op);
+}
+
+bool mlir::tosa::isNonOverlappingAvgPool(Operation *op) {
+  auto pool = dyn_cast<tosa::AvgPool2dOp>(op);
+  if (!pool)
+    return false;
+  auto inputType = pool.input().getType().cast<ShapedType>();
+  if (!inputType.hasStaticShape() || !inputType.getElementType().isF32())
+    return false;
+  if (!isZeroAttribute(pool.pad()))
+    return false;
+  // NHWC: the windows tile H and W.
+  for (unsigned i = 0; i < 2; ++i) {
+    int64_t kernel = pool.kernel()[i].cast<IntegerAttr>().getInt();
+    int64_t stride = pool.stride()[i].cast<IntegerAttr>().getInt();
+    if (kernel != stride || inputType.getDimSize(i + 1) % kernel != 0)
+      return false;
+  }
+  return true;
+}
+
+bool mlir::tosa::isStandaloneKernelOp(Operation *op) {
+  auto custom = dyn_cast<tosa::CustomOp>(op);
+  return custom && custom.identifier() == "miopen.layernorm";
+}
+
 StringRef TosaPartitionPass::partitionTag() { return "kernel"; }
 
+// Decide whether fusing `op`, connected to the partition through
+// `connections`, pays off and fits in what's left of the fusion budget, and
+// if so charge it to the budget.  Fusing `op` adds its operands from outside
+// the partition to `inputNodes`, minus the `replacedInputs` it stops needing.
+bool TosaPartitionPass::admitFusion(Operation *op, ValueRange connections,
+                                    const SetVector<Value> &inputNodes,
+                                    unsigned replacedInputs) {
+  // Constants cost nothing to fuse.
+  if (mlir::detail::isConstantLike(op))
+    return true;
+  if (fusedOps >= maxFusedOps || fusionSavings(connections) <= 0)
+    return false;
+
+  unsigned newInputs = 0;
+  for (Value opnd : op->getOperands()) {
+    if (llvm::is_contained(connections, opnd) || inputNodes.contains(opnd))
+      continue;
+    Operation *definingOp = opnd.getDefiningOp();
+    if (definingOp && mlir::detail::isConstantLike(definingOp))
+      continue;
+    ++newInputs;
+  }
+  if (newInputs > replacedInputs &&
+      fusedInputs + newInputs - replacedInputs > maxFusedInputs)
+    return false;
+
+  ++fusedOps;
+  if (newInputs > replacedInputs)
+    fusedInputs += newInputs - replacedInputs;
+  return true;
+}
+
 void TosaPartitionPass::traceInputs(Operation *op,
                                     SetVector<Operation *> &predecessors,
                                     SetVector<Value> &inputNodes) {
@@ -469,7 +554,9 @@ void TosaPartitionPass::traceInputs(Operation *op,
     if (isa<tosa::TransposeOp>(op))
       specialCaseForTranspose(op, predecessors);
     Operation *usedOp = opnd.getDefiningOp();
-    if (usedOp && isLeadingOp(usedOp)) {
+    if (usedOp && isLeadingOp(usedOp) &&
+        (predecessors.contains(usedOp) ||
+         admitFusion(usedOp, opnd, inputNodes, /*replacedInputs=*/1))) {
       predecessors.insert(usedOp);
       if (!mlir::detail::isConstantLike(usedOp)) {
         // depth first
@@ -527,59 +614,102 @@ void TosaPartitionPass::runOnOperation() {
 
       // Grab a useful set of leading ops, like we do for trailing.
       SetVector<Operation *> leadingOps;
-      traceInputs(anchorOp, leadingOps, inputNodes);
+      fusedOps = 0;
+      fusedInputs = 0;
+      // Standalone kernels have no epilogue or prologue to fuse into.
+      bool standalone = isStandaloneKernelOp(anchorOp);
+      if (standalone)
+        inputNodes.insert(anchorOp->operand_begin(), anchorOp->operand_end());
+      else
+        traceInputs(anchorOp, leadingOps, inputNodes);
 
       DominanceInfo domInfo(func);
-      std::deque<Operation *> worklist; // cuz I want to pull from the front.
-
-      worklist.push_back(anchorOp);
-      while (!worklist.empty()) {
-        Operation *op = worklist.front();
-        worklist.pop_front();
-        for (auto *userOp : op->getUsers()) {
-          if (isTrailingOp(userOp)) {
-            bool skip = false;
-            // First criterion is that the op is element-wise.  Second
-            // criterion is that the op dominates all the users of the
-            // accumulated results of the outlined function.  In other words,
-            // we can't take an op that comes "after" a user of the result
-            // from the eventual call, because the call needs to dominate all
-            // its users.
-            for (const Value &val : resultNodes) {
-              for (auto *user : val.getDefiningOp()->getUsers()) {
-                if (user != userOp &&
-                    !domInfo.properlyDominates(userOp, user)) {
-                  skip = true;
-                }
-              }
-            }
 
-            // userOp is acceptable.  Keep it as a trailingOp, put it on the
-            // worklist.  Add its operands to inputNodes unless they come
-            // from other trailingOps (indicated by being in resultNodes).
-            // If all the users of any resultNode are in trailingOps, there's
-            // no need to return it so remove from resultNodes.  Finally,
-            // add all userOp's results to resultNodes.
-            if (!skip) {
-              if (isa<tosa::TransposeOp>(userOp)) {
-                specialCaseForTranspose(userOp, trailingOps);
-              }
-              // General case.
-              trailingOps.insert(userOp);
-              worklist.push_back(userOp);
-              for (Value opnd : userOp->getOperands())
-                if (!resultNodes.contains(opnd))
-                  inputNodes.insert(opnd);
-              for (const Value &val : resultNodes)
-                if (llvm::all_of(val.getUsers(), [&](Operation *u) {
-                      return trailingOps.contains(u);
-                    }))
-                  resultNodes.remove(val);
-              for (auto res : userOp->getResults())
-                resultNodes.insert(res);
+      // Candidate trailing ops, users of the ops taken so far.  The one
+      // saving the most memory traffic is considered first, so the budget
+      // goes to the fusions that pay the most.
+      SetVector<Operation *> frontier;
+      auto addUsers = [&](Operation *op) {
+        for (auto *userOp : op->getUsers())
+          if (isTrailingOp(userOp) && !trailingOps.contains(userOp))
+            frontier.insert(userOp);
+      };
+      auto connectionsOf = [&](Operation *userOp) {
+        SmallVector<Value> connections;
+        for (Value opnd : userOp->getOperands())
+          if (resultNodes.contains(opnd))
+            connections.push_back(opnd);
+        return connections;
+      };
+
+      if (!standalone)
+        addUsers(anchorOp);
+      while (!frontier.empty()) {
+        // Only ops none of whose operands are still to be decided are
+        // ready, which keeps trailingOps in an order they can be cloned in.
+        Operation *userOp = nullptr;
+        int64_t bestSavings = -1;
+        for (Operation *candidate : frontier) {
+          if (llvm::any_of(candidate->getOperands(), [&](Value opnd) {
+                return frontier.contains(opnd.getDefiningOp());
+              }))
+            continue;
+          int64_t candidateSavings = fusionSavings(connectionsOf(candidate));
+          if (!userOp || candidateSavings > bestSavings) {
+            userOp = candidate;
+            bestSavings = candidateSavings;
+          }
+        }
+        frontier.remove(userOp);
+        if (trailingOps.contains(userOp))
+          continue;
+
+        bool skip = false;
+        // First criterion is that the op is element-wise.  Second
+        // criterion is that the op dominates all the users of the
+        // accumulated results of the outlined function.  In other words,
+        // we can't take an op that comes "after" a user of the result
+        // from the eventual call, because the call needs to dominate all
+        // its users.
+        for (const Value &val : resultNodes) {
+          for (auto *user : val.getDefiningOp()->getUsers()) {
+            if (user != userOp && !domInfo.properlyDominates(userOp, user)) {
+              skip = true;
             }
           }
         }
+
+        // Third criterion is that fusing it pays and fits the budget.
+        if (!skip && !admitFusion(userOp, connectionsOf(userOp), inputNodes,
+                                  /*replacedInputs=*/0))
+          skip = true;
+
+        // userOp is acceptable.  Keep it as a trailingOp, and consider its
+        // users next.  Add its operands to inputNodes unless they come
+        // from other trailingOps (indicated by being in resultNodes).
+        // If all the users of any resultNode are in trailingOps, there's
+        // no need to return it so remove from resultNodes.  Finally,
+        // add all userOp's results to resultNodes.
+        if (!skip) {
+          if (isa<tosa::TransposeOp>(userOp)) {
+            specialCaseForTranspose(userOp, trailingOps);
+          }
+          // General case.
+          trailingOps.insert(userOp);
+          // Pooling reduces the epilogue, so nothing can follow it.
+          if (!isNonOverlappingAvgPool(userOp))
+            addUsers(userOp);
+          for (Value opnd : userOp->getOperands())
+            if (!resultNodes.contains(opnd))
+              inputNodes.insert(opnd);
+          for (const Value &val : resultNodes)
+            if (llvm::all_of(val.getUsers(), [&](Operation *u) {
+                  return trailingOps.contains(u);
+                }))
+              resultNodes.remove(val);
+          for (auto res : userOp->getResults())
+            resultNodes.insert(res);
+        }
       }
 
       // Make the outlined function from the ops we've gathered.
@@ -601,23 +731,30 @@ void TosaPartitionPass::runOnOperation() {
 
 TosaPartitionPassWithOptions::TosaPartitionPassWithOptions(
     ArrayRef<std::string> anchorOps_, const std::string &attrName,
-    bool trailingOnly_) {
+    bool trailingOnly_, bool fusePooling_) {
   anchorOps = anchorOps_;
   partitionTagOpt = attrName;
   trailingOnly = trailingOnly_;
+  fusePooling = fusePooling_;
 }
 
 bool TosaPartitionPassWithOptions::isAnchorOp(Operation *op) {
   if (anchorOps.empty()) // ListOption doesn't have a default value.
     anchorOps = {"tosa.conv2d", "tosa.matmul", "tosa.depthwise_conv2d"};
 
-  return llvm::is_contained(anchorOps, op->getName().getIdentifier().str());
+  return llvm::is_contained(anchorOps, op->getName().getIdentifier().str()) ||
+         isStandaloneKernelOp(op);
 }
 
 bool TosaPartitionPassWithOptions::isLeadingOp(Operation *op) {
   return !trailingOnly && (isConstantZero(op) || isFuseableOp(op));
 }
 
+bool TosaPartitionPassWithOptions::isTrailingOp(Operation *op) {
+  return TosaPartitionPass::isTrailingOp(op) ||
+         (fusePooling && isNonOverlappingAvgPool(op));
+}
+
 StringRef TosaPartitionPassWithOptions::partitionTag() {
   return partitionTagOpt;
 }
@@ -625,3 +762,8 @@ StringRef TosaPartitionPassWithOptions::partitionTag() {
 std::unique_ptr<Pass> mlir::tosa::createTosaPartitionPass() {
   return std::make_unique<TosaPartitionPassWithOptions>();
 }
+
+std::unique_ptr<Pass> mlir::tosa::createTosaPartitionPass(bool fusePooling) {
+  return std::make_unique<TosaPartitionPassWithOptions>(
+      ArrayRef<std::string>{}, "kernel", /*trailingOnly=*/false, fusePooling);
+}
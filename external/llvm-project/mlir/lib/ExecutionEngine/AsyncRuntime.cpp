@@ -18,6 +18,7 @@
 #include <atomic>
 #include <cassert>
 #include <condition_variable>
+#include <cstdlib>
 #include <functional>
 #include <iostream>
 #include <mutex>
@@ -45,9 +46,21 @@ class RefCounted;
 // on top of the default runtime instance.
 // -------------------------------------------------------------------------- //
 
+// The thread pool has MLIR_ASYNC_RUNTIME_NUM_THREADS workers when that is set,
+// and one per hardware thread otherwise.
+static llvm::ThreadPoolStrategy getThreadPoolStrategy() {
+  if (const char *env = std::getenv("MLIR_ASYNC_RUNTIME_NUM_THREADS")) {
+    int numThreads = std::atoi(env);
+    if (numThreads > 0)
+      return llvm::hardware_concurrency(numThreads);
+  }
+  return llvm::hardware_concurrency();
+}
+
 class AsyncRuntime {
 public:
-  AsyncRuntime() : numRefCountedObjects(0) {}
+  AsyncRuntime()
+      : numRefCountedObjects(0), threadPool(getThreadPoolStrategy()) {}
 
   ~AsyncRuntime() {
     threadPool.wait(); // wait for the completion of all async tasks
@@ -249,8 +249,43 @@ ExecutionEngine::create(ModuleOp m, const ExecutionEngineOptions &options) {
   setupTargetTriple(llvmModule.get());
   packFunctionArguments(llvmModule.get());
 
-  auto dataLayout = llvmModule->getDataLayout();
+  engine->setupJIT(options, llvmModule->getDataLayout(),
+                   Triple(llvmModule->getTargetTriple()));
 
+  // Add a ThreadSafemodule to the engine and return.
+  ThreadSafeModule tsm(std::move(llvmModule), std::move(ctx));
+  if (options.transformer)
+    cantFail(tsm.withModuleDo(
+        [&](llvm::Module &module) { return options.transformer(&module); }));
+  cantFail(engine->jit->addIRModule(std::move(tsm)));
+  return std::move(engine);
+}
+
+Expected<std::unique_ptr<ExecutionEngine>>
+ExecutionEngine::create(std::unique_ptr<MemoryBuffer> object,
+                        const ExecutionEngineOptions &options) {
+  auto engine = std::make_unique<ExecutionEngine>(
+      /*enableObjectCache=*/false, options.enableGDBNotificationListener,
+      options.enablePerfNotificationListener);
+
+  // The object was compiled for the host by a previous engine, see
+  // setupTargetTriple.
+  auto jtmb = JITTargetMachineBuilder::detectHost();
+  if (!jtmb)
+    return jtmb.takeError();
+  auto dataLayout = jtmb->getDefaultDataLayoutForTarget();
+  if (!dataLayout)
+    return dataLayout.takeError();
+  engine->setupJIT(options, *dataLayout, jtmb->getTargetTriple());
+
+  if (Error error = engine->jit->addObjectFile(std::move(object)))
+    return std::move(error);
+  return std::move(engine);
+}
+
+void ExecutionEngine::setupJIT(const ExecutionEngineOptions &options,
+                               const llvm::DataLayout &dataLayout,
+                               const Triple &targetTriple) {
   // Callback to create the object layer with symbol resolution to current
   // process and dynamically linked libraries.
   auto objectLinkingLayerCreator = [&](ExecutionSession &session,
@@ -261,15 +296,14 @@ ExecutionEngine::create(ModuleOp m, const ExecutionEngineOptions &options) {
         });
 
     // Register JIT event listeners if they are enabled.
-    if (engine->gdbListener)
-      objectLayer->registerJITEventListener(*engine->gdbListener);
-    if (engine->perfListener)
-      objectLayer->registerJITEventListener(*engine->perfListener);
+    if (gdbListener)
+      objectLayer->registerJITEventListener(*gdbListener);
+    if (perfListener)
+      objectLayer->registerJITEventListener(*perfListener);
 
     // COFF format binaries (Windows) need special handling to deal with
     // exported symbol visibility.
     // cf llvm/lib/ExecutionEngine/Orc/LLJIT.cpp LLJIT::createObjectLinkingLayer
-    llvm::Triple targetTriple(llvm::Twine(llvmModule->getTargetTriple()));
     if (targetTriple.isOSBinFormatCOFF()) {
       objectLayer->setOverrideObjectFlagsWithResponsibilityFlags(true);
       objectLayer->setAutoClaimResponsibilityForObjectSymbols(true);
@@ -308,31 +342,20 @@ ExecutionEngine::create(ModuleOp m, const ExecutionEngineOptions &options) {
     if (!tm)
       return tm.takeError();
     return std::make_unique<TMOwningSimpleCompiler>(std::move(*tm),
-                                                    engine->cache.get());
+                                                    cache.get());
   };
 
   // Create the LLJIT by calling the LLJITBuilder with 2 callbacks.
-  auto jit =
-      cantFail(llvm::orc::LLJITBuilder()
-                   .setCompileFunctionCreator(compileFunctionCreator)
-                   .setObjectLinkingLayerCreator(objectLinkingLayerCreator)
-                   .create());
-
-  // Add a ThreadSafemodule to the engine and return.
-  ThreadSafeModule tsm(std::move(llvmModule), std::move(ctx));
-  if (options.transformer)
-    cantFail(tsm.withModuleDo(
-        [&](llvm::Module &module) { return options.transformer(&module); }));
-  cantFail(jit->addIRModule(std::move(tsm)));
-  engine->jit = std::move(jit);
+  jit = cantFail(llvm::orc::LLJITBuilder()
+                     .setCompileFunctionCreator(compileFunctionCreator)
+                     .setObjectLinkingLayerCreator(objectLinkingLayerCreator)
+                     .create());
 
   // Resolve symbols that are statically linked in the current process.
-  llvm::orc::JITDylib &mainJD = engine->jit->getMainJITDylib();
+  llvm::orc::JITDylib &mainJD = jit->getMainJITDylib();
   mainJD.addGenerator(
       cantFail(DynamicLibrarySearchGenerator::GetForCurrentProcess(
           dataLayout.getGlobalPrefix())));
-
-  return std::move(engine);
 }
 
 Expected<void (*)(void **)>
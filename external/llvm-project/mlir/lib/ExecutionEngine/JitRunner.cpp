@@ -25,16 +25,22 @@
 #include "mlir/Support/FileUtilities.h"
 
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/LegacyPassNameParser.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/StringSaver.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include <cstdint>
+#include <cstdlib>
 #include <numeric>
 #include <utility>
 
@@ -86,6 +92,14 @@ struct Options {
   llvm::cl::opt<std::string> objectFilename{
       "object-filename",
       llvm::cl::desc("Dump JITted-compiled object to file <input file>.o")};
+
+  llvm::cl::opt<std::string> jitCacheDir{
+      "jit-cache-dir",
+      llvm::cl::desc("Reuse the object compiled by an earlier run with the "
+                     "same input and options from this directory, skipping "
+                     "the MLIR and LLVM pipelines (default: "
+                     "$MLIR_JIT_CACHE_DIR, if set)"),
+      llvm::cl::init("")};
 };
 
 struct CompileAndExecuteConfig {
@@ -102,12 +116,19 @@ struct CompileAndExecuteConfig {
   /// runtime.
   llvm::function_ref<llvm::orc::SymbolMap(llvm::orc::MangleAndInterner)>
       runtimeSymbolMap;
+
+  /// An object compiled by an earlier run, which replaces the module if set.
+  std::unique_ptr<llvm::MemoryBuffer> cachedObject;
+
+  /// Where the compiled object is stored for later runs, if not empty.
+  std::string cachePath;
 };
 
 } // namespace
 
 static OwningOpRef<ModuleOp> parseMLIRInput(StringRef inputFilename,
-                                            MLIRContext *context) {
+                                            MLIRContext *context,
+                                            JitRunnerConfig config) {
   // Set up the input file.
   std::string errorMessage;
   auto file = openInputFile(inputFilename, &errorMessage);
@@ -118,6 +139,8 @@ static OwningOpRef<ModuleOp> parseMLIRInput(StringRef inputFilename,
 
   llvm::SourceMgr sourceMgr;
   sourceMgr.AddNewSourceBuffer(std::move(file), SMLoc());
+  if (config.mlirParser)
+    return config.mlirParser(sourceMgr, context);
   return parseSourceFile<ModuleOp>(sourceMgr, context);
 }
 
@@ -126,6 +149,94 @@ static inline Error makeStringError(const Twine &message) {
                                              llvm::inconvertibleErrorCode());
 }
 
+static std::string getJitCacheDir(Options &options) {
+  if (!options.jitCacheDir.empty())
+    return options.jitCacheDir;
+  if (const char *env = std::getenv("MLIR_JIT_CACHE_DIR"))
+    return env;
+  return "";
+}
+
+/// The cache entry of a run hashes the input, the command line other than the
+/// input file name, the runner executable, the contents of the shared
+/// libraries linked in, the host CPU and what the runner adds through
+/// `config`, so that rebuilding the runner or a library, changing any of the
+/// options or moving to another machine compiles anew.
+static Optional<std::string> getJitCachePath(Options &options, int argc,
+                                             char **argv,
+                                             const JitRunnerConfig &config) {
+  // Standard input can only be read once, by the parser
+  std::string dir = getJitCacheDir(options);
+  if (dir.empty() || options.inputFilename == "-")
+    return llvm::None;
+  auto input = llvm::MemoryBuffer::getFile(options.inputFilename);
+  if (!input)
+    return llvm::None;
+
+  llvm::SHA1 hasher;
+  hasher.update((*input)->getBuffer());
+  for (int i = 1; i < argc; ++i) {
+    if (StringRef(argv[i]) == options.inputFilename)
+      continue;
+    hasher.update(StringRef("\0", 1));
+    hasher.update(argv[i]);
+  }
+  std::string executable = llvm::sys::fs::getMainExecutable(
+      argv[0], reinterpret_cast<void *>(&JitRunnerMain));
+  llvm::sys::fs::file_status status;
+  if (llvm::sys::fs::status(executable, status))
+    return llvm::None;
+  hasher.update(StringRef("\0", 1));
+  hasher.update(executable);
+  hasher.update(std::to_string(
+      status.getLastModificationTime().time_since_epoch().count()));
+  for (const std::string &lib : options.clSharedLibs) {
+    auto contents = llvm::MemoryBuffer::getFile(lib, /*IsText=*/false);
+    if (!contents)
+      return llvm::None;
+    hasher.update(StringRef("\0", 1));
+    hasher.update((*contents)->getBuffer());
+  }
+  hasher.update(StringRef("\0", 1));
+  hasher.update(llvm::sys::getHostCPUName());
+  llvm::StringMap<bool> hostFeatures;
+  if (llvm::sys::getHostCPUFeatures(hostFeatures)) {
+    std::vector<std::string> enabled;
+    for (const auto &feature : hostFeatures)
+      if (feature.getValue())
+        enabled.push_back(feature.getKey().str());
+    llvm::sort(enabled);
+    for (const std::string &feature : enabled) {
+      hasher.update(StringRef("\0", 1));
+      hasher.update(feature);
+    }
+  }
+  if (config.cacheKey) {
+    hasher.update(StringRef("\0", 1));
+    hasher.update(config.cacheKey());
+  }
+
+  SmallString<128> path(dir);
+  llvm::sys::path::append(
+      path, llvm::toHex(hasher.final(), /*LowerCase=*/true) + ".o");
+  return std::string(path);
+}
+
+/// Persists the object of `engine` for later runs. Failing to only costs a
+/// recompilation later.
+static void storeJitCacheEntry(ExecutionEngine &engine, StringRef path) {
+  // Write through a temporary so that concurrent runs never load a partial
+  // object
+  if (llvm::sys::fs::create_directories(llvm::sys::path::parent_path(path)))
+    return;
+  SmallString<128> tmpPath;
+  llvm::sys::fs::createUniquePath(path + ".tmp-%%%%%%%%", tmpPath,
+                                  /*MakeAbsolute=*/false);
+  engine.dumpToObjectFile(tmpPath);
+  if (llvm::sys::fs::rename(tmpPath, path))
+    llvm::sys::fs::remove(tmpPath);
+}
+
 static Optional<unsigned> getCommandLineOptLevel(Options &options) {
   Optional<unsigned> optLevel;
   SmallVector<std::reference_wrapper<llvm::cl::opt<bool>>, 4> optFlags{
@@ -209,7 +320,12 @@ static Error compileAndExecute(Options &options, ModuleOp module,
   engineOptions.jitCodeGenOptLevel = jitCodeGenOptLevel;
   engineOptions.sharedLibPaths = executionEngineLibs;
   engineOptions.enableObjectCache = true;
-  auto expectedEngine = mlir::ExecutionEngine::create(module, engineOptions);
+  bool isCached = config.cachedObject != nullptr;
+  auto expectedEngine =
+      isCached
+          ? mlir::ExecutionEngine::create(std::move(config.cachedObject),
+                                          engineOptions)
+          : mlir::ExecutionEngine::create(module, engineOptions);
   if (!expectedEngine)
     return expectedEngine.takeError();
 
@@ -220,10 +336,18 @@ static Error compileAndExecute(Options &options, ModuleOp module,
   if (!expectedFPtr)
     return expectedFPtr.takeError();
 
-  if (options.dumpObjectFile)
-    engine->dumpToObjectFile(options.objectFilename.empty()
-                                 ? options.inputFilename + ".o"
-                                 : options.objectFilename);
+  std::string objectFilename = options.objectFilename.empty()
+                                   ? options.inputFilename + ".o"
+                                   : options.objectFilename;
+  if (isCached) {
+    if (options.dumpObjectFile)
+      (void)llvm::sys::fs::copy_file(config.cachePath, objectFilename);
+  } else {
+    if (options.dumpObjectFile)
+      engine->dumpToObjectFile(objectFilename);
+    if (!config.cachePath.empty())
+      storeJitCacheEntry(*engine, config.cachePath);
+  }
 
   void (*fptr)(void **) = *expectedFPtr;
   (*fptr)(args);
@@ -237,9 +361,12 @@ static Error compileAndExecute(Options &options, ModuleOp module,
 static Error compileAndExecuteVoidFunction(Options &options, ModuleOp module,
                                            StringRef entryPoint,
                                            CompileAndExecuteConfig config) {
-  auto mainFunction = module.lookupSymbol<LLVM::LLVMFuncOp>(entryPoint);
-  if (!mainFunction || mainFunction.empty())
-    return makeStringError("entry point not found");
+  // A cached object passed these checks when it was compiled
+  if (!config.cachedObject) {
+    auto mainFunction = module.lookupSymbol<LLVM::LLVMFuncOp>(entryPoint);
+    if (!mainFunction || mainFunction.empty())
+      return makeStringError("entry point not found");
+  }
   void *empty = nullptr;
   return compileAndExecute(options, module, entryPoint, std::move(config),
                            &empty);
@@ -280,17 +407,20 @@ template <typename Type>
 Error compileAndExecuteSingleReturnFunction(Options &options, ModuleOp module,
                                             StringRef entryPoint,
                                             CompileAndExecuteConfig config) {
-  auto mainFunction = module.lookupSymbol<LLVM::LLVMFuncOp>(entryPoint);
-  if (!mainFunction || mainFunction.isExternal())
-    return makeStringError("entry point not found");
-
-  if (mainFunction.getFunctionType()
-          .cast<LLVM::LLVMFunctionType>()
-          .getNumParams() != 0)
-    return makeStringError("function inputs not supported");
-
-  if (Error error = checkCompatibleReturnType<Type>(mainFunction))
-    return error;
+  // A cached object passed these checks when it was compiled
+  if (!config.cachedObject) {
+    auto mainFunction = module.lookupSymbol<LLVM::LLVMFuncOp>(entryPoint);
+    if (!mainFunction || mainFunction.isExternal())
+      return makeStringError("entry point not found");
+
+    if (mainFunction.getFunctionType()
+            .cast<LLVM::LLVMFunctionType>()
+            .getNumParams() != 0)
+      return makeStringError("function inputs not supported");
+
+    if (Error error = checkCompatibleReturnType<Type>(mainFunction))
+      return error;
+  }
 
   Type res;
   struct {
@@ -322,15 +452,29 @@ int mlir::JitRunnerMain(int argc, char **argv, const DialectRegistry &registry,
 
   MLIRContext context(registry);
 
-  auto m = parseMLIRInput(options.inputFilename, &context);
-  if (!m) {
-    llvm::errs() << "could not parse the input IR\n";
-    return 1;
+  // A run with the same input and options as an earlier one reuses its
+  // object as is.
+  CompileAndExecuteConfig compileAndExecuteConfig;
+  if (Optional<std::string> cachePath =
+          getJitCachePath(options, argc, argv, config)) {
+    auto object = llvm::MemoryBuffer::getFile(*cachePath, /*IsText=*/false);
+    if (object)
+      compileAndExecuteConfig.cachedObject = std::move(*object);
+    compileAndExecuteConfig.cachePath = *cachePath;
   }
 
-  if (config.mlirTransformer)
-    if (failed(config.mlirTransformer(m.get())))
-      return EXIT_FAILURE;
+  OwningOpRef<ModuleOp> m;
+  if (!compileAndExecuteConfig.cachedObject) {
+    m = parseMLIRInput(options.inputFilename, &context, config);
+    if (!m) {
+      llvm::errs() << "could not parse the input IR\n";
+      return 1;
+    }
+
+    if (config.mlirTransformer)
+      if (failed(config.mlirTransformer(m.get())))
+        return EXIT_FAILURE;
+  }
 
   auto tmBuilderOrError = llvm::orc::JITTargetMachineBuilder::detectHost();
   if (!tmBuilderOrError) {
@@ -343,7 +487,6 @@ int mlir::JitRunnerMain(int argc, char **argv, const DialectRegistry &registry,
     return EXIT_FAILURE;
   }
 
-  CompileAndExecuteConfig compileAndExecuteConfig;
   if (optLevel) {
     compileAndExecuteConfig.transformer = mlir::makeOptimizingTransformer(
         *optLevel, /*sizeLevel=*/0, /*targetMachine=*/tmOrError->get());
@@ -365,7 +508,7 @@ int mlir::JitRunnerMain(int argc, char **argv, const DialectRegistry &registry,
   Error error = compileAndExecuteFn
                     ? compileAndExecuteFn(options, m.get(),
                                           options.mainFuncName.getValue(),
-                                          compileAndExecuteConfig)
+                                          std::move(compileAndExecuteConfig))
                     : makeStringError("unsupported function type");
 
   int exitCode = EXIT_SUCCESS;
@@ -12,14 +12,31 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "mlir/ExecutionEngine/CRunnerUtils.h"
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/BinaryFormat/ELF.h"
+#include "llvm/Support/MathExtras.h"
 
 #include "hip/hip_runtime.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #define HIP_REPORT_IF_ERROR(expr)                                              \
   [](hipError_t result) {                                                      \
     if (!result)                                                               \
@@ -32,23 +49,1314 @@
 
 thread_local static int32_t defaultDevice = 0;
 
-extern "C" hipModule_t mgpuModuleLoad(void *data) {
+namespace {
+/// Caches device allocations for reuse by later allocations, in stream order.
+/// A block freed on a stream goes to that stream's free list for its device
+/// and size class, with an event recorded after the work queued on the
+/// stream so far. Allocations on the same stream reuse it right away, since
+/// their work is queued after that use; allocations on other streams only
+/// once the event has completed. Blocks are only returned to HIP when an
+/// allocation fails or the pool is trimmed.
+class StreamOrderedPool {
+public:
+  static StreamOrderedPool &get() {
+    // Never destroyed, as the HIP runtime may be gone by then
+    static StreamOrderedPool *pool = new StreamOrderedPool;
+    return *pool;
+  }
+
+  void *allocate(uint64_t sizeBytes, hipStream_t stream);
+  void deallocate(void *ptr, hipStream_t stream);
+  /// Returns cached blocks to HIP until at most `keepBytes` remain cached.
+  void trim(uint64_t keepBytes);
+  /// Blocks freed on `stream` can no longer be reused in its order, as a new
+  /// stream may take over its handle.
+  void forgetStream(hipStream_t stream);
+
+private:
+  struct FreeBlock {
+    void *ptr;
+    hipEvent_t event;
+  };
+  using FreeLists = std::map<uint64_t, std::vector<FreeBlock>>;
+  // The null stream is shared by all devices.
+  using StreamKey = std::pair<int, hipStream_t>;
+  struct LiveBlock {
+    uint64_t sizeClass;
+    int device;
+  };
+
+  StreamOrderedPool() : enabled(!std::getenv("MGPU_DISABLE_MEMORY_POOL")) {}
+
+  static uint64_t getSizeClass(uint64_t sizeBytes) {
+    // Powers of two up to 1 MiB, multiples of 2 MiB above that
+    constexpr uint64_t kLargeSize = 1 << 20;
+    if (sizeBytes <= kLargeSize)
+      return std::max<uint64_t>(256, llvm::PowerOf2Ceil(sizeBytes));
+    return llvm::alignTo(sizeBytes, 2 * kLargeSize);
+  }
+
+  /// Takes a block of `sizeClass` freed on another stream whose work on it
+  /// has completed, or returns nullptr.
+  void *takeCompleted(FreeLists &lists, uint64_t sizeClass);
+  void releaseEvent(hipEvent_t event) { spareEvents.push_back(event); }
+  void releaseAll(FreeLists &lists, uint64_t keepBytes);
+
+  const bool enabled;
+  std::mutex mutex;
+  std::map<StreamKey, FreeLists> freeByStream;
+  /// Blocks freed on streams that have since been destroyed, per device.
+  std::map<int, FreeLists> orphaned;
+  std::unordered_map<void *, LiveBlock> live;
+  std::vector<hipEvent_t> spareEvents;
+  uint64_t cachedBytes = 0;
+};
+} // namespace
+
+void *StreamOrderedPool::takeCompleted(FreeLists &lists, uint64_t sizeClass) {
+  auto it = lists.find(sizeClass);
+  if (it == lists.end())
+    return nullptr;
+  std::vector<FreeBlock> &blocks = it->second;
+  for (auto block = blocks.begin(); block != blocks.end(); ++block) {
+    if (hipEventQuery(block->event) != hipSuccess)
+      continue;
+    void *ptr = block->ptr;
+    releaseEvent(block->event);
+    blocks.erase(block);
+    return ptr;
+  }
+  return nullptr;
+}
+
+void *StreamOrderedPool::allocate(uint64_t sizeBytes, hipStream_t stream) {
+  void *ptr = nullptr;
+  if (!enabled) {
+    HIP_REPORT_IF_ERROR(hipMalloc(&ptr, sizeBytes));
+    return ptr;
+  }
+
+  uint64_t sizeClass = getSizeClass(sizeBytes);
+  int device = 0;
+  HIP_REPORT_IF_ERROR(hipGetDevice(&device));
+  std::lock_guard<std::mutex> lock(mutex);
+  FreeLists &own = freeByStream[{device, stream}];
+  auto it = own.find(sizeClass);
+  if (it != own.end() && !it->second.empty()) {
+    // Work queued on `stream` from here on runs after the previous use
+    FreeBlock block = it->second.back();
+    it->second.pop_back();
+    releaseEvent(block.event);
+    ptr = block.ptr;
+  }
+  if (!ptr) {
+    ptr = takeCompleted(orphaned[device], sizeClass);
+    for (auto &entry : freeByStream) {
+      if (ptr)
+        break;
+      if (entry.first.first == device && entry.first.second != stream)
+        ptr = takeCompleted(entry.second, sizeClass);
+    }
+  }
+  if (ptr) {
+    cachedBytes -= sizeClass;
+  } else if (hipMalloc(&ptr, sizeClass) != hipSuccess) {
+    // Give the cache back and retry before reporting the failure
+    for (auto &entry : freeByStream)
+      releaseAll(entry.second, /*keepBytes=*/0);
+    for (auto &entry : orphaned)
+      releaseAll(entry.second, /*keepBytes=*/0);
+    HIP_REPORT_IF_ERROR(hipMalloc(&ptr, sizeClass));
+  }
+  if (ptr)
+    live[ptr] = {sizeClass, device};
+  return ptr;
+}
+
+void StreamOrderedPool::deallocate(void *ptr, hipStream_t stream) {
+  if (!enabled) {
+    HIP_REPORT_IF_ERROR(hipFree(ptr));
+    return;
+  }
+  if (!ptr)
+    return;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = live.find(ptr);
+  if (it == live.end()) {
+    // Not allocated through the pool
+    HIP_REPORT_IF_ERROR(hipFree(ptr));
+    return;
+  }
+  LiveBlock block = it->second;
+  live.erase(it);
+
+  hipEvent_t event = nullptr;
+  if (!spareEvents.empty()) {
+    event = spareEvents.back();
+    spareEvents.pop_back();
+  } else {
+    HIP_REPORT_IF_ERROR(
+        hipEventCreateWithFlags(&event, hipEventDisableTiming));
+  }
+  HIP_REPORT_IF_ERROR(hipEventRecord(event, stream));
+  freeByStream[{block.device, stream}][block.sizeClass].push_back({ptr, event});
+  cachedBytes += block.sizeClass;
+}
+
+void StreamOrderedPool::releaseAll(FreeLists &lists, uint64_t keepBytes) {
+  for (auto &entry : lists) {
+    std::vector<FreeBlock> &blocks = entry.second;
+    while (!blocks.empty() && cachedBytes > keepBytes) {
+      FreeBlock block = blocks.back();
+      blocks.pop_back();
+      // hipFree does not wait for work queued on other streams
+      HIP_REPORT_IF_ERROR(hipEventSynchronize(block.event));
+      HIP_REPORT_IF_ERROR(hipFree(block.ptr));
+      releaseEvent(block.event);
+      cachedBytes -= entry.first;
+    }
+  }
+}
+
+void StreamOrderedPool::trim(uint64_t keepBytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto &entry : orphaned)
+    releaseAll(entry.second, keepBytes);
+  for (auto &entry : freeByStream)
+    releaseAll(entry.second, keepBytes);
+  if (cachedBytes == 0) {
+    for (hipEvent_t event : spareEvents)
+      HIP_REPORT_IF_ERROR(hipEventDestroy(event));
+    spareEvents.clear();
+  }
+}
+
+void StreamOrderedPool::forgetStream(hipStream_t stream) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto it = freeByStream.begin(); it != freeByStream.end();) {
+    if (it->first.second != stream) {
+      ++it;
+      continue;
+    }
+    FreeLists &lists = orphaned[it->first.first];
+    for (auto &entry : it->second)
+      lists[entry.first].insert(lists[entry.first].end(), entry.second.begin(),
+                                entry.second.end());
+    it = freeByStream.erase(it);
+  }
+}
+
+namespace {
+/// Keeps code objects loaded after their last mgpuModuleUnload, so that
+/// loading the same binary again, as every run of a compiled model does,
+/// returns the module and kernel handles from the first load. Modules are
+/// keyed on the content of the binary and the device they are loaded on, and
+/// reference-counted by their loads; unreferenced ones stay loaded until
+/// evicted. A binary can be replaced by another with the same kernels, such
+/// as a build at full optimization of one compiled fast to start sooner:
+/// loads of it then load the replacement, while the modules already loaded
+/// keep running until unloaded.
+class ModuleCache {
+public:
+  static ModuleCache &get() {
+    // Never destroyed, as the HIP runtime may be gone by then
+    static ModuleCache *cache = new ModuleCache;
+    return *cache;
+  }
+
+  hipModule_t load(const void *data);
+  void unload(hipModule_t module);
+  hipFunction_t getFunction(hipModule_t module, const char *name);
+  /// Unloads the modules nothing references, returning how many there were.
+  int64_t evict();
+  /// Has later loads of the binary at `data` load the one at `replacement`
+  /// instead. Returns false if the cache is disabled or either is no code
+  /// object.
+  bool replace(const void *data, const void *replacement);
+
+private:
+  struct Entry {
+    std::string binary;
+    int device;
+    hipModule_t module;
+    int64_t references;
+    std::unordered_map<std::string, hipFunction_t> functions;
+  };
+
+  ModuleCache() : enabled(!std::getenv("MGPU_DISABLE_MODULE_CACHE")) {}
+
+  /// The size of the ELF code object at `data`, or 0 when it is not one.
+  static size_t getBinarySize(const void *data);
+  /// 64-bit FNV-1a.
+  static uint64_t hash(const std::string &binary);
+
+  const bool enabled;
+  std::mutex mutex;
+  std::unordered_multimap<uint64_t, Entry *> byHash;
+  std::unordered_map<hipModule_t, std::unique_ptr<Entry>> byModule;
+  /// The binaries loaded in place of others, by the binaries they replace.
+  std::unordered_map<std::string, std::string> replacements;
+};
+} // namespace
+
+size_t ModuleCache::getBinarySize(const void *data) {
+  // An offload bundle, holding the code objects of several arches, ends with
+  // the last of them
+  static constexpr char kBundleMagic[] = "__CLANG_OFFLOAD_BUNDLE__";
+  constexpr size_t kBundleMagicSize = sizeof(kBundleMagic) - 1;
+  const char *bytes = static_cast<const char *>(data);
+  if (std::memcmp(bytes, kBundleMagic, kBundleMagicSize) == 0) {
+    uint64_t numEntries = 0;
+    std::memcpy(&numEntries, bytes + kBundleMagicSize, sizeof(numEntries));
+    const char *entry = bytes + kBundleMagicSize + sizeof(numEntries);
+    uint64_t size = entry - bytes;
+    for (uint64_t i = 0; i < numEntries; ++i) {
+      uint64_t fields[3]; // offset, size, length of the entry id
+      std::memcpy(fields, entry, sizeof(fields));
+      entry += sizeof(fields) + fields[2];
+      size = std::max<uint64_t>({size, uint64_t(entry - bytes),
+                                 fields[0] + fields[1]});
+    }
+    return size;
+  }
+
+  llvm::ELF::Elf64_Ehdr header;
+  std::memcpy(&header, data, sizeof(header));
+  if (!header.checkMagic() || header.getFileClass() != llvm::ELF::ELFCLASS64)
+    return 0;
+  // The file ends with the last of its header tables and sections
+  uint64_t size = std::max<uint64_t>(
+      {sizeof(header),
+       header.e_phoff + uint64_t(header.e_phnum) * header.e_phentsize,
+       header.e_shoff + uint64_t(header.e_shnum) * header.e_shentsize});
+  const char *sections = static_cast<const char *>(data) + header.e_shoff;
+  for (unsigned i = 0; i < header.e_shnum; ++i) {
+    llvm::ELF::Elf64_Shdr section;
+    std::memcpy(&section, sections + i * header.e_shentsize, sizeof(section));
+    if (section.sh_type != llvm::ELF::SHT_NOBITS)
+      size = std::max<uint64_t>(size, section.sh_offset + section.sh_size);
+  }
+  return size;
+}
+
+uint64_t ModuleCache::hash(const std::string &binary) {
+  uint64_t result = 14695981039346656037ULL;
+  for (char c : binary) {
+    result ^= static_cast<unsigned char>(c);
+    result *= 1099511628211ULL;
+  }
+  return result;
+}
+
+hipModule_t ModuleCache::load(const void *data) {
   hipModule_t module = nullptr;
-  HIP_REPORT_IF_ERROR(hipModuleLoadData(&module, data));
+  size_t size = enabled ? getBinarySize(data) : 0;
+  if (size == 0) {
+    HIP_REPORT_IF_ERROR(hipModuleLoadData(&module, data));
+    return module;
+  }
+
+  std::string binary(static_cast<const char *>(data), size);
+  int device = 0;
+  HIP_REPORT_IF_ERROR(hipGetDevice(&device));
+  std::lock_guard<std::mutex> lock(mutex);
+  auto replaced = replacements.find(binary);
+  if (replaced != replacements.end())
+    binary = replaced->second;
+  uint64_t key = hash(binary);
+  auto range = byHash.equal_range(key);
+  for (auto it = range.first; it != range.second; ++it) {
+    Entry *entry = it->second;
+    if (entry->device == device && entry->binary == binary) {
+      ++entry->references;
+      return entry->module;
+    }
+  }
+
+  HIP_REPORT_IF_ERROR(hipModuleLoadData(&module, binary.data()));
+  if (!module)
+    return module;
+  auto entry = std::make_unique<Entry>();
+  entry->binary = std::move(binary);
+  entry->device = device;
+  entry->module = module;
+  entry->references = 1;
+  byHash.emplace(key, entry.get());
+  byModule.emplace(module, std::move(entry));
   return module;
 }
 
+void ModuleCache::unload(hipModule_t module) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = byModule.find(module);
+  if (it == byModule.end()) {
+    HIP_REPORT_IF_ERROR(hipModuleUnload(module));
+    return;
+  }
+  if (it->second->references > 0)
+    --it->second->references;
+}
+
+hipFunction_t ModuleCache::getFunction(hipModule_t module, const char *name) {
+  hipFunction_t function = nullptr;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = byModule.find(module);
+  if (it == byModule.end()) {
+    HIP_REPORT_IF_ERROR(hipModuleGetFunction(&function, module, name));
+    return function;
+  }
+  auto &functions = it->second->functions;
+  auto cached = functions.find(name);
+  if (cached != functions.end())
+    return cached->second;
+  HIP_REPORT_IF_ERROR(hipModuleGetFunction(&function, module, name));
+  if (function)
+    functions.emplace(name, function);
+  return function;
+}
+
+bool ModuleCache::replace(const void *data, const void *replacement) {
+  size_t size = enabled ? getBinarySize(data) : 0;
+  size_t replacementSize = enabled ? getBinarySize(replacement) : 0;
+  if (size == 0 || replacementSize == 0)
+    return false;
+  std::string binary(static_cast<const char *>(data), size);
+  std::string replacementBinary(static_cast<const char *>(replacement),
+                                replacementSize);
+  std::lock_guard<std::mutex> lock(mutex);
+  // Binaries replaced before by this one are replaced by its replacement.
+  for (auto &entry : replacements)
+    if (entry.second == binary)
+      entry.second = replacementBinary;
+  replacements[std::move(binary)] = std::move(replacementBinary);
+  return true;
+}
+
+int64_t ModuleCache::evict() {
+  std::lock_guard<std::mutex> lock(mutex);
+  int64_t evicted = 0;
+  for (auto it = byHash.begin(); it != byHash.end();) {
+    Entry *entry = it->second;
+    if (entry->references > 0) {
+      ++it;
+      continue;
+    }
+    HIP_REPORT_IF_ERROR(hipModuleUnload(entry->module));
+    it = byHash.erase(it);
+    byModule.erase(entry->module);
+    ++evicted;
+  }
+  return evicted;
+}
+
+namespace {
+/// The priority the streams created by the calling thread get: 0 for the
+/// default one, higher for more urgent work. Host functions push their own
+/// with mgpuStreamPriorityPushDefault, which gives way to one their caller
+/// pushed with mgpuStreamPriorityPush.
+class StreamPriority {
+public:
+  static void push(int32_t priority, bool isExplicit) {
+    std::vector<Entry> &entries = stack();
+    if (!isExplicit && !entries.empty() && entries.back().isExplicit)
+      entries.push_back(entries.back());
+    else
+      entries.push_back({priority, isExplicit});
+  }
+  static void pop() {
+    std::vector<Entry> &entries = stack();
+    if (!entries.empty())
+      entries.pop_back();
+  }
+
+  /// The HIP priority of the streams to create on the current device, where
+  /// lower is more urgent and the least urgent is the default.
+  static int current() {
+    std::vector<Entry> &entries = stack();
+    if (entries.empty() || entries.back().priority == 0)
+      return 0;
+    int least = 0, greatest = 0;
+    HIP_REPORT_IF_ERROR(hipDeviceGetStreamPriorityRange(&least, &greatest));
+    int64_t priority = int64_t(least) - entries.back().priority;
+    return int(std::min<int64_t>(least, std::max<int64_t>(greatest, priority)));
+  }
+
+private:
+  struct Entry {
+    int32_t priority;
+    bool isExplicit;
+  };
+  static std::vector<Entry> &stack() {
+    thread_local static std::vector<Entry> entries;
+    return entries;
+  }
+};
+
+/// Creates a stream at the HIP priority `priority`.
+static hipStream_t createStreamWithPriority(int priority) {
+  hipStream_t stream = nullptr;
+  if (priority == 0)
+    HIP_REPORT_IF_ERROR(hipStreamCreate(&stream));
+  else
+    HIP_REPORT_IF_ERROR(
+        hipStreamCreateWithPriority(&stream, hipStreamDefault, priority));
+  return stream;
+}
+
+/// Keeps the streams and events that the code of host functions creates and
+/// destroys on every call for later calls, as creating them takes longer than
+/// launching a small kernel. They are kept per device, the only one they can
+/// be used on, and streams also per priority. A stream may still have work
+/// queued when it is given back, which the work of its next user then runs
+/// after.
+///
+/// A thread uses the context it last pushed with mgpuContextPush, or else one
+/// shared by the process. Destroying a context destroys what it kept.
+class RuntimeContext {
+public:
+  RuntimeContext() : enabled(!std::getenv("MGPU_DISABLE_RUNTIME_CONTEXT")) {}
+  ~RuntimeContext();
+
+  static RuntimeContext &current() {
+    std::vector<RuntimeContext *> &stack = pushed();
+    if (!stack.empty() && stack.back())
+      return *stack.back();
+    // Never destroyed, as the HIP runtime may be gone by then
+    static RuntimeContext *context = new RuntimeContext;
+    return *context;
+  }
+  /// The contexts the calling thread pushed, innermost last.
+  static std::vector<RuntimeContext *> &pushed() {
+    thread_local static std::vector<RuntimeContext *> stack;
+    return stack;
+  }
+
+  hipStream_t createStream();
+  void destroyStream(hipStream_t stream);
+  hipEvent_t createEvent();
+  void destroyEvent(hipEvent_t event);
+
+private:
+  const bool enabled;
+  std::mutex mutex;
+  /// Streams by device and HIP priority.
+  std::map<std::pair<int, int>, std::vector<hipStream_t>> spareStreams;
+  std::map<int, std::vector<hipEvent_t>> spareEvents;
+  /// The device and priority of each stream handed out.
+  std::unordered_map<hipStream_t, std::pair<int, int>> streamKeys;
+  /// The device of each event handed out.
+  std::unordered_map<hipEvent_t, int> devices;
+};
+} // namespace
+
+RuntimeContext::~RuntimeContext() {
+  for (auto &entry : spareStreams) {
+    for (hipStream_t stream : entry.second) {
+      StreamOrderedPool::get().forgetStream(stream);
+      HIP_REPORT_IF_ERROR(hipStreamDestroy(stream));
+    }
+  }
+  for (auto &entry : spareEvents)
+    for (hipEvent_t event : entry.second)
+      HIP_REPORT_IF_ERROR(hipEventDestroy(event));
+}
+
+hipStream_t RuntimeContext::createStream() {
+  int priority = StreamPriority::current();
+  if (!enabled)
+    return createStreamWithPriority(priority);
+  int device = 0;
+  HIP_REPORT_IF_ERROR(hipGetDevice(&device));
+  std::pair<int, int> key(device, priority);
+  hipStream_t stream = nullptr;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<hipStream_t> &spares = spareStreams[key];
+  if (!spares.empty()) {
+    stream = spares.back();
+    spares.pop_back();
+  } else {
+    stream = createStreamWithPriority(priority);
+  }
+  streamKeys[stream] = key;
+  return stream;
+}
+
+void RuntimeContext::destroyStream(hipStream_t stream) {
+  if (enabled) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = streamKeys.find(stream);
+    if (it != streamKeys.end()) {
+      spareStreams[it->second].push_back(stream);
+      streamKeys.erase(it);
+      return;
+    }
+  }
+  StreamOrderedPool::get().forgetStream(stream);
+  HIP_REPORT_IF_ERROR(hipStreamDestroy(stream));
+}
+
+hipEvent_t RuntimeContext::createEvent() {
+  hipEvent_t event = nullptr;
+  if (!enabled) {
+    HIP_REPORT_IF_ERROR(hipEventCreateWithFlags(&event, hipEventDisableTiming));
+    return event;
+  }
+  int device = 0;
+  HIP_REPORT_IF_ERROR(hipGetDevice(&device));
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<hipEvent_t> &spares = spareEvents[device];
+  if (!spares.empty()) {
+    event = spares.back();
+    spares.pop_back();
+  } else {
+    HIP_REPORT_IF_ERROR(hipEventCreateWithFlags(&event, hipEventDisableTiming));
+  }
+  devices[event] = device;
+  return event;
+}
+
+void RuntimeContext::destroyEvent(hipEvent_t event) {
+  if (enabled) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = devices.find(event);
+    if (it != devices.end()) {
+      spareEvents[it->second].push_back(event);
+      devices.erase(it);
+      return;
+    }
+  }
+  HIP_REPORT_IF_ERROR(hipEventDestroy(event));
+}
+
+namespace {
+/// Runs the kernels a host function queues between mgpuGraphCaptureBegin and
+/// mgpuGraphCaptureEnd as one HIP graph. The streams the function creates in
+/// between fork from an origin stream kept for its key and are joined back to
+/// it where the function would synchronize, so that stream capture on the
+/// origin records its launches, copies and the order among them instead of
+/// running them. The first call instantiates the captured graph. Later calls
+/// capture again, which only costs host time, and update the instantiated
+/// graph with their kernel arguments before launching it in one go.
+///
+/// Work is not run before mgpuGraphCaptureEnd, so host code must not read
+/// what kernels write before then. Frees and event and stream destructions
+/// are held back until the graph has completed.
+class GraphCapture {
+public:
+  static GraphCapture &get() {
+    // Never destroyed, as the HIP runtime may be gone by then
+    static GraphCapture *capture = new GraphCapture;
+    return *capture;
+  }
+
+  void begin(int64_t key);
+  void end();
+
+  /// The following return false when the calling thread is not capturing,
+  /// leaving the call to be made directly.
+  bool createStream(hipStream_t &stream);
+  bool destroyStream(hipStream_t stream);
+  bool synchronizeStream(hipStream_t stream);
+  bool synchronizeEvent(hipEvent_t event);
+  bool destroyEvent(hipEvent_t event);
+  bool deallocate(void *ptr);
+
+private:
+  struct Graph {
+    hipStream_t origin = nullptr;
+    hipGraphExec_t exec = nullptr;
+    /// Events that join streams to the origin, reused by every capture.
+    std::vector<hipEvent_t> events;
+    /// Streams of previous calls, for the next one to fork.
+    std::vector<hipStream_t> spareStreams;
+    bool busy = false;
+    bool failed = false;
+  };
+  /// The capture of the calling thread.
+  struct Active {
+    Graph *graph = nullptr;
+    int64_t key = 0;
+    /// Begins not yet ended, including nested ones.
+    unsigned depth = 0;
+    unsigned numEvents = 0;
+    std::vector<hipStream_t> streams;
+    std::vector<hipEvent_t> destroyedEvents;
+    std::vector<void *> frees;
+  };
+
+  GraphCapture() : enabled(!std::getenv("MGPU_DISABLE_GRAPH_CAPTURE")) {}
+
+  static Active &active() {
+    thread_local static Active state;
+    return state;
+  }
+  /// Makes the origin wait for the work queued on `stream` so far.
+  void join(Active &state, hipStream_t stream);
+  hipEvent_t nextEvent(Active &state);
+
+  const bool enabled;
+  std::mutex mutex;
+  std::map<std::pair<int, int64_t>, Graph> graphs;
+};
+} // namespace
+
+hipEvent_t GraphCapture::nextEvent(Active &state) {
+  std::vector<hipEvent_t> &events = state.graph->events;
+  if (state.numEvents == events.size()) {
+    hipEvent_t event = nullptr;
+    HIP_REPORT_IF_ERROR(
+        hipEventCreateWithFlags(&event, hipEventDisableTiming));
+    events.push_back(event);
+  }
+  return events[state.numEvents++];
+}
+
+void GraphCapture::join(Active &state, hipStream_t stream) {
+  hipEvent_t event = nextEvent(state);
+  HIP_REPORT_IF_ERROR(hipEventRecord(event, stream));
+  HIP_REPORT_IF_ERROR(
+      hipStreamWaitEvent(state.graph->origin, event, /*flags=*/0));
+}
+
+void GraphCapture::begin(int64_t key) {
+  Active &state = active();
+  if (state.depth++ > 0 || !enabled)
+    return;
+
+  int device = 0;
+  HIP_REPORT_IF_ERROR(hipGetDevice(&device));
+  Graph *graph = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    graph = &graphs[{device, key}];
+    // Another thread running the same function runs it directly
+    if (graph->busy || graph->failed)
+      return;
+    graph->busy = true;
+  }
+  if (!graph->origin)
+    HIP_REPORT_IF_ERROR(
+        hipStreamCreateWithFlags(&graph->origin, hipStreamNonBlocking));
+  // Relaxed, as allocating device memory is not otherwise allowed
+  if (hipStreamBeginCapture(graph->origin, hipStreamCaptureModeRelaxed) !=
+      hipSuccess) {
+    fprintf(stderr, "cannot capture a graph for %llx, running it directly\n",
+            static_cast<unsigned long long>(key));
+    std::lock_guard<std::mutex> lock(mutex);
+    graph->busy = false;
+    graph->failed = true;
+    return;
+  }
+  state.graph = graph;
+  state.key = key;
+}
+
+void GraphCapture::end() {
+  Active &state = active();
+  if (state.depth == 0 || --state.depth > 0 || !state.graph)
+    return;
+
+  Graph &graph = *state.graph;
+  for (hipStream_t stream : state.streams)
+    join(state, stream);
+  hipGraph_t captured = nullptr;
+  bool ok = hipStreamEndCapture(graph.origin, &captured) == hipSuccess;
+  if (ok && graph.exec) {
+    // Fails when the kernels or the order among them changed
+    hipGraphNode_t errorNode = nullptr;
+    hipGraphExecUpdateResult updateResult;
+    if (hipGraphExecUpdate(graph.exec, captured, &errorNode, &updateResult) !=
+        hipSuccess) {
+      HIP_REPORT_IF_ERROR(hipGraphExecDestroy(graph.exec));
+      graph.exec = nullptr;
+    }
+  }
+  if (ok && !graph.exec)
+    ok = hipGraphInstantiate(&graph.exec, captured, nullptr, nullptr, 0) ==
+         hipSuccess;
+  if (ok)
+    ok = hipGraphLaunch(graph.exec, graph.origin) == hipSuccess;
+  if (captured)
+    HIP_REPORT_IF_ERROR(hipGraphDestroy(captured));
+  if (!ok)
+    fprintf(stderr,
+            "graph capture for %llx failed, its kernels did not run; later "
+            "calls run them directly\n",
+            static_cast<unsigned long long>(state.key));
+  HIP_REPORT_IF_ERROR(hipStreamSynchronize(graph.origin));
+
+  for (hipEvent_t event : state.destroyedEvents)
+    RuntimeContext::current().destroyEvent(event);
+  for (void *ptr : state.frees)
+    StreamOrderedPool::get().deallocate(ptr, graph.origin);
+  graph.spareStreams.insert(graph.spareStreams.end(), state.streams.begin(),
+                            state.streams.end());
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    graph.busy = false;
+    graph.failed = !ok;
+  }
+  state = Active();
+}
+
+bool GraphCapture::createStream(hipStream_t &stream) {
+  Active &state = active();
+  if (!state.graph)
+    return false;
+  std::vector<hipStream_t> &spares = state.graph->spareStreams;
+  if (!spares.empty()) {
+    stream = spares.back();
+    spares.pop_back();
+  } else {
+    HIP_REPORT_IF_ERROR(
+        hipStreamCreateWithFlags(&stream, hipStreamNonBlocking));
+  }
+  // Waiting on an event of the origin makes the stream part of the capture
+  hipEvent_t event = nextEvent(state);
+  HIP_REPORT_IF_ERROR(hipEventRecord(event, state.graph->origin));
+  HIP_REPORT_IF_ERROR(hipStreamWaitEvent(stream, event, /*flags=*/0));
+  state.streams.push_back(stream);
+  return true;
+}
+
+bool GraphCapture::destroyStream(hipStream_t stream) {
+  // Streams are joined and kept for the next call when the capture ends
+  Active &state = active();
+  return state.graph && std::find(state.streams.begin(), state.streams.end(),
+                                  stream) != state.streams.end();
+}
+
+bool GraphCapture::synchronizeStream(hipStream_t stream) {
+  Active &state = active();
+  if (!state.graph)
+    return false;
+  join(state, stream);
+  return true;
+}
+
+bool GraphCapture::synchronizeEvent(hipEvent_t event) {
+  Active &state = active();
+  if (!state.graph)
+    return false;
+  HIP_REPORT_IF_ERROR(
+      hipStreamWaitEvent(state.graph->origin, event, /*flags=*/0));
+  return true;
+}
+
+bool GraphCapture::destroyEvent(hipEvent_t event) {
+  Active &state = active();
+  if (!state.graph)
+    return false;
+  state.destroyedEvents.push_back(event);
+  return true;
+}
+
+bool GraphCapture::deallocate(void *ptr) {
+  Active &state = active();
+  if (!state.graph)
+    return false;
+  state.frees.push_back(ptr);
+  return true;
+}
+
+namespace {
+/// Submits the kernels the calling thread launches back to back on one
+/// stream as one HIP graph, rather than paying for a launch each, which after
+/// partitioning is often more than small kernels take to run. The launches
+/// are captured on the stream until the thread does anything else with the
+/// runtime, such as waiting for the stream, copying or launching on another
+/// stream, when the batch is launched. Graphs are kept per sequence of
+/// kernels and updated with the arguments of later batches, so only the
+/// first batch of each sequence pays for instantiating one.
+///
+/// Unlike mgpuGraphCaptureBegin, this needs nothing of the host code and so
+/// also covers functions whose work varies from call to call. Launches are
+/// not batched under graph capture, timing or tracing. Set
+/// MGPU_DISABLE_LAUNCH_BATCHING to launch every kernel directly.
+class LaunchBatcher {
+public:
+  static LaunchBatcher &get() {
+    thread_local static LaunchBatcher batcher;
+    return batcher;
+  }
+
+  ~LaunchBatcher() {
+    flush();
+    for (auto &entry : execs)
+      HIP_REPORT_IF_ERROR(hipGraphExecDestroy(entry.second));
+  }
+
+  /// Adds the launch to the batch of `stream`, or returns false leaving it
+  /// to be made directly.
+  bool launch(hipFunction_t function, intptr_t gridX, intptr_t gridY,
+              intptr_t gridZ, intptr_t blockX, intptr_t blockY,
+              intptr_t blockZ, int32_t smem, hipStream_t stream,
+              void **params, void **extra);
+  /// Launches the batch, if any.
+  void flush();
+
+private:
+  LaunchBatcher() : enabled(!std::getenv("MGPU_DISABLE_LAUNCH_BATCHING")) {}
+
+  bool enabled;
+  /// The stream being captured, null between batches.
+  hipStream_t stream = nullptr;
+  /// The kernels of the batch, in order.
+  std::vector<hipFunction_t> functions;
+  std::map<std::vector<hipFunction_t>, hipGraphExec_t> execs;
+};
+} // namespace
+
+bool LaunchBatcher::launch(hipFunction_t function, intptr_t gridX,
+                           intptr_t gridY, intptr_t gridZ, intptr_t blockX,
+                           intptr_t blockY, intptr_t blockZ, int32_t smem,
+                           hipStream_t launchStream, void **params,
+                           void **extra) {
+  if (!enabled)
+    return false;
+  if (stream != launchStream)
+    flush();
+  if (!stream) {
+    // Streams under graph capture are left to it
+    hipStreamCaptureStatus status = hipStreamCaptureStatusNone;
+    HIP_REPORT_IF_ERROR(hipStreamIsCapturing(launchStream, &status));
+    if (status != hipStreamCaptureStatusNone ||
+        hipStreamBeginCapture(launchStream, hipStreamCaptureModeRelaxed) !=
+            hipSuccess)
+      return false;
+    stream = launchStream;
+  }
+  // Capture copies the arguments, so the caller may reuse `params`
+  HIP_REPORT_IF_ERROR(hipModuleLaunchKernel(function, gridX, gridY, gridZ,
+                                            blockX, blockY, blockZ, smem,
+                                            stream, params, extra));
+  functions.push_back(function);
+  return true;
+}
+
+void LaunchBatcher::flush() {
+  if (!stream)
+    return;
+  hipGraph_t captured = nullptr;
+  bool ok = hipStreamEndCapture(stream, &captured) == hipSuccess;
+  hipGraphExec_t &exec = execs[functions];
+  if (ok && exec) {
+    hipGraphNode_t errorNode = nullptr;
+    hipGraphExecUpdateResult updateResult;
+    if (hipGraphExecUpdate(exec, captured, &errorNode, &updateResult) !=
+        hipSuccess) {
+      HIP_REPORT_IF_ERROR(hipGraphExecDestroy(exec));
+      exec = nullptr;
+    }
+  }
+  if (ok && !exec)
+    ok = hipGraphInstantiate(&exec, captured, nullptr, nullptr, 0) ==
+         hipSuccess;
+  if (ok)
+    ok = hipGraphLaunch(exec, stream) == hipSuccess;
+  if (captured)
+    HIP_REPORT_IF_ERROR(hipGraphDestroy(captured));
+  if (!ok) {
+    fprintf(stderr,
+            "batching %zu launches failed, they did not run; launching "
+            "directly from now on\n",
+            functions.size());
+    if (!exec)
+      execs.erase(functions);
+    enabled = false;
+  }
+  stream = nullptr;
+  functions.clear();
+}
+
+namespace {
+/// Times the kernels the calling thread launches between mgpuTimerStart and
+/// mgpuTimerStop, with events recorded on their streams right before the
+/// first of them and right after each one, so that the time spent queueing
+/// them on the host is not counted. Launches under graph capture are not
+/// timed, as they do not run before the capture ends.
+class KernelTimer {
+public:
+  static KernelTimer &get() {
+    thread_local static KernelTimer timer;
+    return timer;
+  }
+
+  ~KernelTimer() {
+    if (start)
+      HIP_REPORT_IF_ERROR(hipEventDestroy(start));
+    if (stop)
+      HIP_REPORT_IF_ERROR(hipEventDestroy(stop));
+  }
+
+  void arm() {
+    armed = true;
+    started = false;
+  }
+  bool isArmed() const { return armed; }
+  void beforeLaunch(hipStream_t stream);
+  void afterLaunch(hipStream_t stream);
+  /// Returns the milliseconds between the start of the first timed launch
+  /// and the end of the last one, 0 if there were none.
+  float disarm();
+
+private:
+  bool isTimed(hipStream_t stream) const;
+
+  bool armed = false;
+  bool started = false;
+  hipEvent_t start = nullptr;
+  hipEvent_t stop = nullptr;
+};
+} // namespace
+
+bool KernelTimer::isTimed(hipStream_t stream) const {
+  if (!armed)
+    return false;
+  hipStreamCaptureStatus status = hipStreamCaptureStatusNone;
+  HIP_REPORT_IF_ERROR(hipStreamIsCapturing(stream, &status));
+  return status == hipStreamCaptureStatusNone;
+}
+
+void KernelTimer::beforeLaunch(hipStream_t stream) {
+  if (started || !isTimed(stream))
+    return;
+  // Timing events are kept apart from the pooled ones, which are created
+  // with timing disabled.
+  if (!start) {
+    HIP_REPORT_IF_ERROR(hipEventCreate(&start));
+    HIP_REPORT_IF_ERROR(hipEventCreate(&stop));
+  }
+  HIP_REPORT_IF_ERROR(hipEventRecord(start, stream));
+  started = true;
+}
+
+void KernelTimer::afterLaunch(hipStream_t stream) {
+  if (started && isTimed(stream))
+    HIP_REPORT_IF_ERROR(hipEventRecord(stop, stream));
+}
+
+float KernelTimer::disarm() {
+  armed = false;
+  if (!started)
+    return 0.0f;
+  started = false;
+  float ms = 0.0f;
+  HIP_REPORT_IF_ERROR(hipEventSynchronize(stop));
+  HIP_REPORT_IF_ERROR(hipEventElapsedTime(&ms, start, stop));
+  return ms;
+}
+
+namespace {
+/// Records when the kernels of host functions are launched and run, and how
+/// long the host blocks waiting for them, when MGPU_TRACE names the file to
+/// write the trace to. The last MGPU_TRACE_EVENTS of them, 65536 by default,
+/// are kept in a ring buffer and written out as a Chrome trace, which
+/// chrome://tracing and Perfetto open, by mgpuTraceFlush or at exit. Kernels
+/// run between events recorded on their streams around each launch, whose
+/// times are resolved when the trace is written. Launches under graph
+/// capture are only traced on the host.
+class ExecutionTracer {
+public:
+  static ExecutionTracer &get() {
+    // Never destroyed, as the HIP runtime may be gone by then
+    static ExecutionTracer *tracer = new ExecutionTracer;
+    return *tracer;
+  }
+
+  bool isEnabled() const { return enabled; }
+  /// The time since the tracer was created, in microseconds.
+  double now() const;
+
+  void nameFunction(hipFunction_t function, const char *name);
+  /// Returns the slot the launch is recorded in, whose device events are
+  /// recorded around it on `stream` unless it is being captured.
+  size_t beginLaunch(hipFunction_t function, hipStream_t stream);
+  void endLaunch(size_t slot, double begin);
+  void recordWait(const char *name, void *handle, double begin);
+  /// Writes the events in the ring buffer to the trace file.
+  void flush();
+
+private:
+  enum class Kind { Launch, Wait };
+  struct Event {
+    Kind kind;
+    std::string name;
+    /// The stream launched on or the stream or event waited for.
+    void *handle;
+    int device = 0;
+    uint32_t thread;
+    double begin, end;
+    /// Recorded on the stream around the kernel, if it was.
+    hipEvent_t start = nullptr, stop = nullptr;
+    bool timed = false;
+  };
+
+  ExecutionTracer();
+  Event &push();
+  static uint32_t threadId();
+  /// The host time at which the device reached an event recorded by the
+  /// tracer when it first saw `device`, and that event.
+  std::pair<double, hipEvent_t> getOrigin(int device, hipStream_t stream);
+
+  const bool enabled;
+  std::string path;
+  std::chrono::steady_clock::time_point epoch;
+  std::mutex mutex;
+  std::vector<Event> ring;
+  uint64_t count = 0;
+  std::unordered_map<hipFunction_t, std::string> names;
+  std::map<int, std::pair<double, hipEvent_t>> origins;
+};
+} // namespace
+
+ExecutionTracer::ExecutionTracer()
+    : enabled(std::getenv("MGPU_TRACE") != nullptr),
+      epoch(std::chrono::steady_clock::now()) {
+  if (!enabled)
+    return;
+  path = std::getenv("MGPU_TRACE");
+  size_t capacity = 65536;
+  if (const char *events = std::getenv("MGPU_TRACE_EVENTS"))
+    capacity = std::max<long long>(1, std::atoll(events));
+  ring.resize(capacity);
+  // The tracer is first used once HIP is initialized, so this runs before the
+  // HIP runtime is torn down.
+  std::atexit([] { ExecutionTracer::get().flush(); });
+}
+
+double ExecutionTracer::now() const {
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - epoch)
+      .count();
+}
+
+uint32_t ExecutionTracer::threadId() {
+  static std::atomic<uint32_t> next{0};
+  thread_local static uint32_t id = next++;
+  return id;
+}
+
+ExecutionTracer::Event &ExecutionTracer::push() {
+  Event &event = ring[count++ % ring.size()];
+  event.timed = false;
+  return event;
+}
+
+std::pair<double, hipEvent_t> ExecutionTracer::getOrigin(int device,
+                                                         hipStream_t stream) {
+  auto it = origins.find(device);
+  if (it != origins.end())
+    return it->second;
+  hipEvent_t origin = nullptr;
+  HIP_REPORT_IF_ERROR(hipEventCreate(&origin));
+  HIP_REPORT_IF_ERROR(hipEventRecord(origin, stream));
+  HIP_REPORT_IF_ERROR(hipEventSynchronize(origin));
+  return origins[device] = {now(), origin};
+}
+
+void ExecutionTracer::nameFunction(hipFunction_t function, const char *name) {
+  std::lock_guard<std::mutex> lock(mutex);
+  names[function] = name;
+}
+
+size_t ExecutionTracer::beginLaunch(hipFunction_t function,
+                                    hipStream_t stream) {
+  hipStreamCaptureStatus status = hipStreamCaptureStatusNone;
+  HIP_REPORT_IF_ERROR(hipStreamIsCapturing(stream, &status));
+  int device = 0;
+  HIP_REPORT_IF_ERROR(hipGetDevice(&device));
+
+  std::lock_guard<std::mutex> lock(mutex);
+  size_t slot = count % ring.size();
+  Event &event = push();
+  event.kind = Kind::Launch;
+  auto name = names.find(function);
+  event.name = name != names.end() ? name->second : "kernel";
+  event.handle = stream;
+  event.thread = threadId();
+  // A slot reused on another device needs events of that device.
+  if (event.start && event.device != device) {
+    HIP_REPORT_IF_ERROR(hipEventDestroy(event.start));
+    HIP_REPORT_IF_ERROR(hipEventDestroy(event.stop));
+    event.start = event.stop = nullptr;
+  }
+  event.device = device;
+  if (status == hipStreamCaptureStatusNone) {
+    getOrigin(device, stream);
+    if (!event.start) {
+      HIP_REPORT_IF_ERROR(hipEventCreate(&event.start));
+      HIP_REPORT_IF_ERROR(hipEventCreate(&event.stop));
+    }
+    HIP_REPORT_IF_ERROR(hipEventRecord(event.start, stream));
+    event.timed = true;
+  }
+  return slot;
+}
+
+void ExecutionTracer::endLaunch(size_t slot, double begin) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Event &event = ring[slot];
+  if (event.timed)
+    HIP_REPORT_IF_ERROR(
+        hipEventRecord(event.stop, static_cast<hipStream_t>(event.handle)));
+  event.begin = begin;
+  event.end = now();
+}
+
+void ExecutionTracer::recordWait(const char *name, void *handle,
+                                 double begin) {
+  double end = now();
+  std::lock_guard<std::mutex> lock(mutex);
+  Event &event = push();
+  event.kind = Kind::Wait;
+  event.name = name;
+  event.handle = handle;
+  event.thread = threadId();
+  event.begin = begin;
+  event.end = end;
+}
+
+void ExecutionTracer::flush() {
+  if (!enabled)
+    return;
+  std::lock_guard<std::mutex> lock(mutex);
+  FILE *file = fopen(path.c_str(), "w");
+  if (!file) {
+    fprintf(stderr, "Could not write the trace to '%s'\n", path.c_str());
+    return;
+  }
+  // Host events go to process 0, one track per thread, and kernels to one
+  // process per device, one track per stream.
+  std::unordered_map<void *, int> streamIds;
+  fprintf(file, "{\"traceEvents\":[\n");
+  bool first = true;
+  auto emit = [&](const std::string &name, int pid, uint64_t tid, double ts,
+                  double dur, void *handle) {
+    fprintf(file,
+            "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%llu,"
+            "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"stream\":\"%p\"}}",
+            first ? "" : ",\n", name.c_str(), pid,
+            static_cast<unsigned long long>(tid), ts, dur, handle);
+    first = false;
+  };
+  uint64_t size = std::min<uint64_t>(count, ring.size());
+  for (uint64_t i = count - size; i < count; ++i) {
+    Event &event = ring[i % ring.size()];
+    bool isLaunch = event.kind == Kind::Launch;
+    emit(isLaunch ? "launch " + event.name : event.name, 0, event.thread,
+         event.begin, event.end - event.begin, event.handle);
+    if (!isLaunch || !event.timed)
+      continue;
+    auto origin = origins.find(event.device);
+    if (origin == origins.end())
+      continue;
+    float start = 0.0f, stop = 0.0f;
+    if (hipEventSynchronize(event.stop) != hipSuccess ||
+        hipEventElapsedTime(&start, origin->second.second, event.start) !=
+            hipSuccess ||
+        hipEventElapsedTime(&stop, origin->second.second, event.stop) !=
+            hipSuccess)
+      continue;
+    int stream =
+        streamIds.emplace(event.handle, streamIds.size()).first->second;
+    emit(event.name, 1 + event.device, stream,
+         origin->second.first + start * 1000.0, (stop - start) * 1000.0,
+         event.handle);
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+}
+
+extern "C" hipModule_t mgpuModuleLoad(void *data) {
+  return ModuleCache::get().load(data);
+}
+
 extern "C" void mgpuModuleUnload(hipModule_t module) {
-  HIP_REPORT_IF_ERROR(hipModuleUnload(module));
+  LaunchBatcher::get().flush();
+  ModuleCache::get().unload(module);
 }
 
 extern "C" hipFunction_t mgpuModuleGetFunction(hipModule_t module,
                                                const char *name) {
-  hipFunction_t function = nullptr;
-  HIP_REPORT_IF_ERROR(hipModuleGetFunction(&function, module, name));
+  hipFunction_t function = ModuleCache::get().getFunction(module, name);
+  ExecutionTracer &tracer = ExecutionTracer::get();
+  if (tracer.isEnabled() && function)
+    tracer.nameFunction(function, name);
   return function;
 }
 
+/// Unloads the code objects that mgpuModuleLoad keeps loaded once no longer
+/// used, returning how many were unloaded. Set MGPU_DISABLE_MODULE_CACHE to
+/// unload modules as soon as they are released instead.
+extern "C" int64_t mgpuModuleCacheEvict() {
+  return ModuleCache::get().evict();
+}
+
+/// Has mgpuModuleLoad load the code object at `replacement` whenever it is
+/// given the one at `data`, from then on. The replacement must define the
+/// same kernels; it is typically a build at full optimization, compiled in
+/// the background, of a binary built with fast-compile. Modules loaded
+/// before keep running until unloaded, and once unreferenced are evicted
+/// like any other. Returns false, replacing nothing, if the module cache is
+/// disabled or either is no code object.
+extern "C" bool mgpuModuleCacheReplace(void *data, void *replacement) {
+  return ModuleCache::get().replace(data, replacement);
+}
+
+/// Creates a context that keeps the streams and events of host functions for
+/// their later calls, for as long as it lives. Set
+/// MGPU_DISABLE_RUNTIME_CONTEXT to create and destroy them on every call.
+extern "C" void *mgpuContextCreate() { return new RuntimeContext; }
+
+/// Destroys a context made by mgpuContextCreate. No thread may have it pushed.
+extern "C" void mgpuContextDestroy(void *context) {
+  delete static_cast<RuntimeContext *>(context);
+}
+
+/// Makes the calling thread use `context`, or the context shared by the
+/// process for null, until the matching mgpuContextPop.
+extern "C" void mgpuContextPush(void *context) {
+  RuntimeContext::pushed().push_back(static_cast<RuntimeContext *>(context));
+}
+
+extern "C" void mgpuContextPop() {
+  std::vector<RuntimeContext *> &stack = RuntimeContext::pushed();
+  if (!stack.empty())
+    stack.pop_back();
+}
+
+/// Makes the streams the calling thread creates, including those of the host
+/// functions it calls, get `priority` until the matching
+/// mgpuStreamPriorityPop: 0 for the default one, higher for more urgent work,
+/// clamped to the range of the device.
+extern "C" void mgpuStreamPriorityPush(int32_t priority) {
+  StreamPriority::push(priority, /*isExplicit=*/true);
+}
+
+/// Like mgpuStreamPriorityPush, unless the caller pushed a priority with it.
+/// Host functions with an xmir.priority attribute push theirs with this.
+extern "C" void mgpuStreamPriorityPushDefault(int32_t priority) {
+  StreamPriority::push(priority, /*isExplicit=*/false);
+}
+
+extern "C" void mgpuStreamPriorityPop() { StreamPriority::pop(); }
+
+/// Starts capturing the work the calling thread queues into the HIP graph
+/// kept for `key`, to be launched by the matching mgpuGraphCaptureEnd. Set
+/// MGPU_DISABLE_GRAPH_CAPTURE to run the work directly instead.
+extern "C" void mgpuGraphCaptureBegin(int64_t key) {
+  LaunchBatcher::get().flush();
+  GraphCapture::get().begin(key);
+}
+
+/// Launches the graph captured since mgpuGraphCaptureBegin and waits for it.
+extern "C" void mgpuGraphCaptureEnd() {
+  LaunchBatcher::get().flush();
+  GraphCapture::get().end();
+}
+
 // The wrapper uses intptr_t instead of ROCM's unsigned int to match
 // the type of MLIR's index type. This avoids the need for casts in the
 // generated MLIR code.
@@ -58,69 +1366,168 @@ extern "C" void mgpuLaunchKernel(hipFunction_t function, intptr_t gridX,
                                  intptr_t blockZ, int32_t smem,
                                  hipStream_t stream, void **params,
                                  void **extra) {
+  KernelTimer &timer = KernelTimer::get();
+  ExecutionTracer &tracer = ExecutionTracer::get();
+  if (!timer.isArmed() && !tracer.isEnabled() &&
+      LaunchBatcher::get().launch(function, gridX, gridY, gridZ, blockX,
+                                  blockY, blockZ, smem, stream, params, extra))
+    return;
+  double begin = 0.0;
+  size_t slot = 0;
+  if (tracer.isEnabled()) {
+    begin = tracer.now();
+    slot = tracer.beginLaunch(function, stream);
+  }
+  timer.beforeLaunch(stream);
   HIP_REPORT_IF_ERROR(hipModuleLaunchKernel(function, gridX, gridY, gridZ,
                                             blockX, blockY, blockZ, smem,
                                             stream, params, extra));
+  timer.afterLaunch(stream);
+  if (tracer.isEnabled())
+    tracer.endLaunch(slot, begin);
 }
 
+/// Writes the launches and waits traced so far to the file MGPU_TRACE names,
+/// as a Chrome trace. This also happens at exit.
+extern "C" void mgpuTraceFlush() { ExecutionTracer::get().flush(); }
+
+/// Starts timing the kernels the calling thread launches, until the matching
+/// mgpuTimerStop.
+extern "C" void mgpuTimerStart() {
+  LaunchBatcher::get().flush();
+  KernelTimer::get().arm();
+}
+
+/// Waits for the kernels launched since mgpuTimerStart and returns the
+/// milliseconds from the start of the first to the end of the last.
+extern "C" float mgpuTimerStop() { return KernelTimer::get().disarm(); }
+
 extern "C" hipStream_t mgpuStreamCreate() {
   hipStream_t stream = nullptr;
-  HIP_REPORT_IF_ERROR(hipStreamCreate(&stream));
-  return stream;
+  if (GraphCapture::get().createStream(stream))
+    return stream;
+  return RuntimeContext::current().createStream();
 }
 
 extern "C" void mgpuStreamDestroy(hipStream_t stream) {
-  HIP_REPORT_IF_ERROR(hipStreamDestroy(stream));
+  LaunchBatcher::get().flush();
+  if (GraphCapture::get().destroyStream(stream))
+    return;
+  RuntimeContext::current().destroyStream(stream);
 }
 
 extern "C" void mgpuStreamSynchronize(hipStream_t stream) {
-  return HIP_REPORT_IF_ERROR(hipStreamSynchronize(stream));
+  LaunchBatcher::get().flush();
+  if (GraphCapture::get().synchronizeStream(stream))
+    return;
+  ExecutionTracer &tracer = ExecutionTracer::get();
+  double begin = tracer.isEnabled() ? tracer.now() : 0.0;
+  HIP_REPORT_IF_ERROR(hipStreamSynchronize(stream));
+  if (tracer.isEnabled())
+    tracer.recordWait("wait stream", stream, begin);
 }
 
 extern "C" void mgpuStreamWaitEvent(hipStream_t stream, hipEvent_t event) {
+  LaunchBatcher::get().flush();
   HIP_REPORT_IF_ERROR(hipStreamWaitEvent(stream, event, /*flags=*/0));
 }
 
 extern "C" hipEvent_t mgpuEventCreate() {
-  hipEvent_t event = nullptr;
-  HIP_REPORT_IF_ERROR(hipEventCreateWithFlags(&event, hipEventDisableTiming));
-  return event;
+  return RuntimeContext::current().createEvent();
 }
 
 extern "C" void mgpuEventDestroy(hipEvent_t event) {
-  HIP_REPORT_IF_ERROR(hipEventDestroy(event));
+  if (GraphCapture::get().destroyEvent(event))
+    return;
+  RuntimeContext::current().destroyEvent(event);
 }
 
 extern "C" void mgpuEventSynchronize(hipEvent_t event) {
+  LaunchBatcher::get().flush();
+  if (GraphCapture::get().synchronizeEvent(event))
+    return;
+  ExecutionTracer &tracer = ExecutionTracer::get();
+  double begin = tracer.isEnabled() ? tracer.now() : 0.0;
   HIP_REPORT_IF_ERROR(hipEventSynchronize(event));
+  if (tracer.isEnabled())
+    tracer.recordWait("wait event", event, begin);
 }
 
 extern "C" void mgpuEventRecord(hipEvent_t event, hipStream_t stream) {
+  LaunchBatcher::get().flush();
   HIP_REPORT_IF_ERROR(hipEventRecord(event, stream));
 }
 
-extern "C" void *mgpuMemAlloc(uint64_t sizeBytes, hipStream_t /*stream*/) {
-  void *ptr;
-  HIP_REPORT_IF_ERROR(hipMalloc(&ptr, sizeBytes));
-  return ptr;
+extern "C" void *mgpuMemAlloc(uint64_t sizeBytes, hipStream_t stream) {
+  LaunchBatcher::get().flush();
+  return StreamOrderedPool::get().allocate(sizeBytes, stream);
 }
 
-extern "C" void mgpuMemFree(void *ptr, hipStream_t /*stream*/) {
-  HIP_REPORT_IF_ERROR(hipFree(ptr));
+extern "C" void mgpuMemFree(void *ptr, hipStream_t stream) {
+  LaunchBatcher::get().flush();
+  if (GraphCapture::get().deallocate(ptr))
+    return;
+  StreamOrderedPool::get().deallocate(ptr, stream);
+}
+
+/// Returns device memory cached for reuse to HIP, keeping at most
+/// `keepBytes` of it. Set MGPU_DISABLE_MEMORY_POOL to not cache at all.
+extern "C" void mgpuMemPoolTrim(uint64_t keepBytes) {
+  StreamOrderedPool::get().trim(keepBytes);
 }
 
 extern "C" void mgpuMemcpy(void *dst, void *src, size_t sizeBytes,
                            hipStream_t stream) {
+  LaunchBatcher::get().flush();
   HIP_REPORT_IF_ERROR(
       hipMemcpyAsync(dst, src, sizeBytes, hipMemcpyDefault, stream));
 }
 
 extern "C" void mgpuMemset32(void *dst, int value, size_t count,
                              hipStream_t stream) {
+  LaunchBatcher::get().flush();
   HIP_REPORT_IF_ERROR(hipMemsetD32Async(reinterpret_cast<hipDeviceptr_t>(dst),
                                         value, count, stream));
 }
 
+/// Uploads the `sizeBytes` bytes of the file at `path` from byte `offset` on
+/// to device memory allocated as by mgpuMemAlloc, and returns it, or null if
+/// the file cannot be mapped. The bytes are copied from a read-only mapping
+/// of the file, so that weights too large to hold twice, such as those of
+/// migraphx.constant ops with a file, are never read into host memory of
+/// their own.
+extern "C" void *mgpuMemLoadFile(const char *path, int64_t offset,
+                                 uint64_t sizeBytes, hipStream_t stream) {
+  LaunchBatcher::get().flush();
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Could not open '%s'\n", path);
+    return nullptr;
+  }
+  // Mappings start on a page boundary.
+  int64_t pageSize = sysconf(_SC_PAGESIZE);
+  int64_t start = offset - offset % pageSize;
+  size_t length = sizeBytes + (offset - start);
+  void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, start);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "Could not map %llu bytes of '%s' at %lld\n",
+            static_cast<unsigned long long>(sizeBytes), path,
+            static_cast<long long>(offset));
+    return nullptr;
+  }
+  madvise(mapping, length, MADV_SEQUENTIAL);
+
+  void *data = StreamOrderedPool::get().allocate(sizeBytes, stream);
+  HIP_REPORT_IF_ERROR(hipMemcpyAsync(
+      data, static_cast<char *>(mapping) + (offset - start), sizeBytes,
+      hipMemcpyHostToDevice, stream));
+  // The mapping must outlive the copy.
+  HIP_REPORT_IF_ERROR(hipStreamSynchronize(stream));
+  munmap(mapping, length);
+  return data;
+}
+
 /// Helper functions for writing mlir example code
 
 // Allows to register byte array with the ROCM runtime. Helpful until we have
@@ -153,6 +1560,19 @@ mgpuMemHostRegisterMemRef(int64_t rank, StridedMemRefType<char, 1> *descriptor,
   mgpuMemHostRegister(ptr, sizeBytes);
 }
 
+extern "C" void mgpuMemHostUnregister(void *ptr) {
+  HIP_REPORT_IF_ERROR(hipHostUnregister(ptr));
+}
+
+// Unregisters a MemRef registered by mgpuMemHostRegisterMemRef.
+extern "C" void
+mgpuMemHostUnregisterMemRef(int64_t rank,
+                            StridedMemRefType<char, 1> *descriptor,
+                            int64_t elementSizeBytes) {
+  auto ptr = descriptor->data + descriptor->offset * elementSizeBytes;
+  mgpuMemHostUnregister(ptr);
+}
+
 template <typename T>
 void mgpuMemGetDevicePointer(T *hostPtr, T **devicePtr) {
   HIP_REPORT_IF_ERROR(hipSetDevice(0));
@@ -177,22 +1597,150 @@ mgpuMemGetDeviceMemRef1dInt32(int32_t *allocated, int32_t *aligned,
 }
 
 extern "C" void mgpuSetDefaultDevice(int32_t device) {
+  LaunchBatcher::get().flush();
   defaultDevice = device;
   HIP_REPORT_IF_ERROR(hipSetDevice(device));
 }
 
+namespace {
+/// Spreads the calls of host functions over the devices of the process. A
+/// call runs on the device with the fewest calls in flight among those
+/// whose chip is in the arch mask of the function, a set of chips by their
+/// hash modulo 64. Nested calls stay on the device of the outermost one.
+class DeviceDispatcher {
+public:
+  static DeviceDispatcher &get() {
+    // Never destroyed, as the HIP runtime may be gone by then
+    static DeviceDispatcher *dispatcher = new DeviceDispatcher;
+    return *dispatcher;
+  }
+
+  /// FNV-1a hash of the chip `arch` names, such as gfx90a for
+  /// "gfx90a:sramecc+:xnack-", as the compiler hashes the arches of kernels.
+  static uint64_t hashChip(const char *arch);
+
+  uint64_t getArchHash(int device) const {
+    return device >= 0 && size_t(device) < archHashes.size()
+               ? archHashes[device]
+               : 0;
+  }
+  void acquire(uint64_t archMask);
+  void release();
+
+private:
+  /// The outermost call of the calling thread.
+  struct Call {
+    unsigned depth = 0;
+    int device = -1;
+    int previousDevice = 0;
+  };
+
+  DeviceDispatcher();
+
+  static Call &current() {
+    thread_local static Call call;
+    return call;
+  }
+
+  const bool enabled;
+  std::vector<uint64_t> archHashes;
+  std::mutex mutex;
+  std::vector<int64_t> callsInFlight;
+};
+} // namespace
+
+uint64_t DeviceDispatcher::hashChip(const char *arch) {
+  uint64_t result = 14695981039346656037ULL;
+  for (; *arch && *arch != ':'; ++arch) {
+    result ^= static_cast<unsigned char>(*arch);
+    result *= 1099511628211ULL;
+  }
+  return result;
+}
+
+DeviceDispatcher::DeviceDispatcher()
+    : enabled(!std::getenv("MGPU_DISABLE_DEVICE_DISPATCH")) {
+  int count = 0;
+  HIP_REPORT_IF_ERROR(hipGetDeviceCount(&count));
+  for (int device = 0; device < count; ++device) {
+    hipDeviceProp_t props;
+    HIP_REPORT_IF_ERROR(hipGetDeviceProperties(&props, device));
+    archHashes.push_back(hashChip(props.gcnArchName));
+  }
+  callsInFlight.resize(count, 0);
+}
+
+void DeviceDispatcher::acquire(uint64_t archMask) {
+  Call &call = current();
+  if (call.depth++ > 0 || !enabled)
+    return;
+
+  int device = -1;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int candidate = 0, e = archHashes.size(); candidate < e;
+         ++candidate) {
+      uint64_t bit = uint64_t(1) << (archHashes[candidate] % 64);
+      if (archMask && !(archMask & bit))
+        continue;
+      if (device < 0 || callsInFlight[candidate] < callsInFlight[device])
+        device = candidate;
+    }
+    if (device < 0)
+      return;
+    ++callsInFlight[device];
+  }
+  call.device = device;
+  call.previousDevice = defaultDevice;
+  mgpuSetDefaultDevice(device);
+}
+
+void DeviceDispatcher::release() {
+  Call &call = current();
+  if (call.depth == 0 || --call.depth > 0 || call.device < 0)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    --callsInFlight[call.device];
+  }
+  mgpuSetDefaultDevice(call.previousDevice);
+  call = Call();
+}
+
+/// Runs the calling thread's work on the least busy device whose chip is in
+/// `archMask`, or on any device for a mask of 0, until the matching
+/// mgpuDeviceRelease. Set MGPU_DISABLE_DEVICE_DISPATCH to stay on the
+/// default device instead.
+extern "C" void mgpuDeviceAcquire(int64_t archMask) {
+  LaunchBatcher::get().flush();
+  DeviceDispatcher::get().acquire(archMask);
+}
+
+extern "C" void mgpuDeviceRelease() {
+  LaunchBatcher::get().flush();
+  DeviceDispatcher::get().release();
+}
+
+/// The hash of the chip of the current device, for picking the launch
+/// dimensions compiled for it.
+extern "C" int64_t mgpuGetDeviceArchHash() {
+  int device = 0;
+  HIP_REPORT_IF_ERROR(hipGetDevice(&device));
+  return DeviceDispatcher::get().getArchHash(device);
+}
+
 extern "C" StridedMemRefType<int32_t, 1>
 mgpuMemAllocInt32(int32_t *allocated, int32_t *aligned, int64_t offset,
                   int64_t size, int64_t stride) {
-  int32_t *gpuPtr;
-  HIP_REPORT_IF_ERROR(hipMalloc((void **)&gpuPtr, size * sizeof(int32_t)));
+  auto *gpuPtr = static_cast<int32_t *>(StreamOrderedPool::get().allocate(
+      size * sizeof(int32_t), /*stream=*/nullptr));
   return {gpuPtr, gpuPtr, offset, {size}, {stride}};
 }
 
 extern "C" void mgpuMemDeallocInt32(int32_t *allocated, int32_t *aligned,
                                     int64_t offset, int64_t size,
                                     int64_t stride) {
-  HIP_REPORT_IF_ERROR(hipFree(aligned));
+  StreamOrderedPool::get().deallocate(aligned, /*stream=*/nullptr);
 }
 
 extern "C" void mgpuMemSetInt32(int32_t *allocated, int32_t *aligned,
@@ -30,6 +30,12 @@ MLIR_CAPI_EXPORTED void mlirGetKernelInfo(MlirModule module, int *size,
 // Returns block_size and grid_size as uint32_t[2]
 MLIR_CAPI_EXPORTED void mlirGetKernelAttrs(MlirModule module, uint32_t *attrs);
 
+// Returns the VGPR, AGPR and SGPR counts, the LDS and scratch bytes and the
+// waves per SIMD of the compiled kernel as uint32_t[6], all 0 when its binary
+// carries no metadata
+MLIR_CAPI_EXPORTED void mlirGetKernelResources(MlirModule module,
+                                               uint32_t *resources);
+
 // Returns the size of compiled binary if called with null ptr
 // and return the compiled binary when buffer is provided
 MLIR_CAPI_EXPORTED bool mlirGetBinary(MlirModule module, int *size, char *bin);
@@ -42,6 +48,88 @@ MLIR_CAPI_EXPORTED void mlirMIGraphXAddBackendPipeline(MlirPassManager pm,
                                                        const char *chip,
                                                        const char *triple,
                                                        const char *features);
+
+// Phase 1 functions : compiling all the functions of a module at once
+
+// The kernel compiled from one function of the module. binary is null if the
+// function failed to compile. argInfo holds argInfoSize ints, laid out as the
+// data of mlirGetKernelInfo without the kernel name. The strings and arrays
+// belong to the compilation, except for the binary, which belongs to the
+// context and is never copied.
+typedef struct {
+  MlirStringRef funcName;
+  MlirStringRef kernelName;
+  const char *binary;
+  size_t binarySize;
+  uint32_t blockSize;
+  uint32_t gridSize;
+  const int *argInfo;
+  size_t argInfoSize;
+  // As returned by mlirGetKernelResources
+  uint32_t vgprCount;
+  uint32_t agprCount;
+  uint32_t sgprCount;
+  uint32_t ldsSize;
+  uint32_t scratchSize;
+  uint32_t wavesPerSimd;
+} MlirMIGraphXKernel;
+
+typedef struct {
+  void *ptr;
+} MlirMIGraphXCompilation;
+
+// Compiles each function of the module through both pipelines, in parallel
+// on the threads of the context, into one kernel each, in the order of the
+// functions. The module itself is left as it is.
+MLIR_CAPI_EXPORTED MlirMIGraphXCompilation
+mlirMIGraphXCompileModule(MlirModule module, const char *chip,
+                          const char *triple, const char *features);
+
+// Collects what mlirGetKernelInfo, mlirGetKernelAttrs, mlirGetKernelResources
+// and mlirGetBinary return for a module that went through both pipelines, in
+// one walk, as a compilation of one kernel. funcName is left empty.
+MLIR_CAPI_EXPORTED MlirMIGraphXCompilation
+mlirMIGraphXFinalize(MlirModule module);
+
+MLIR_CAPI_EXPORTED intptr_t
+mlirMIGraphXCompilationGetNumKernels(MlirMIGraphXCompilation compilation);
+
+MLIR_CAPI_EXPORTED MlirMIGraphXKernel mlirMIGraphXCompilationGetKernel(
+    MlirMIGraphXCompilation compilation, intptr_t pos);
+
+MLIR_CAPI_EXPORTED void
+mlirMIGraphXCompilationDestroy(MlirMIGraphXCompilation compilation);
+
+// Phase 2 functions : kernels specialized to the sizes of dynamic shapes
+
+typedef struct {
+  void *ptr;
+} MlirMIGraphXSpecializationCache;
+
+// Creates a cache of the kernels compiled from the first function of the
+// module, whose dynamic dimensions all stand for one size, such as the batch
+// size. The module is copied. The context is made multithreaded, and must
+// stay so while the cache lives.
+MLIR_CAPI_EXPORTED MlirMIGraphXSpecializationCache
+mlirMIGraphXSpecializationCacheCreate(MlirModule module, const char *chip,
+                                      const char *triple,
+                                      const char *features);
+
+// Returns a kernel serving `size`, and the size it was compiled for in
+// servedSize, to which the caller pads the tensors when it is larger. That is
+// the kernel of the exact size once it is compiled. Until then, it is the
+// smallest larger kernel while the exact one is compiled in the background,
+// or, when there is none, the kernel of the next power of two, compiled
+// before returning. Padding is only used when the dynamic dimensions are
+// outermost and no op works across them, as reductions over them do;
+// otherwise every size is compiled before returning. Requests for a kernel
+// being compiled wait for that compile. Kernels belong to the cache.
+MLIR_CAPI_EXPORTED MlirMIGraphXKernel mlirMIGraphXSpecializationCacheLookup(
+    MlirMIGraphXSpecializationCache cache, int64_t size, int64_t *servedSize);
+
+// Waits for the kernels compiled in the background, then destroys the cache.
+MLIR_CAPI_EXPORTED void
+mlirMIGraphXSpecializationCacheDestroy(MlirMIGraphXSpecializationCache cache);
 #ifdef __cplusplus
 }
 #endif
@@ -25,6 +25,11 @@
 namespace mlir {
 namespace migraphx {
 
+/// The argument attribute telling where the data of a migraphx.constant with
+/// a `file` lies, once the conversion made it an argument of its function: a
+/// dictionary of its `file` and `offset`.
+constexpr llvm::StringLiteral kExternalDataAttrName = "migraphx.external_data";
+
 std::unique_ptr<Pass> createMIGraphXToTosaPass();
 void addMIGraphXToTosaPasses(OpPassManager &pm);
 
@@ -32,6 +37,11 @@ void addMIGraphXToTosaPasses(OpPassManager &pm);
 void populateMIGraphXToTosaConversionPatterns(MLIRContext *context,
                                               RewritePatternSet &patterns);
 
+/// Returns true if `op` has a TOSA equivalent: max pooling, or average
+/// pooling without padding, both rounding the output size down.
+bool isTosaCompatiblePooling(PoolingOp op);
+bool isTosaCompatiblePad(PadOp op);
+
 } // namespace migraphx
 } // namespace mlir
 
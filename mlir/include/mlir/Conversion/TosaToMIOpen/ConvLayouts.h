@@ -0,0 +1,58 @@
+//===- ConvLayouts.h - Layouts of TOSA convolutions -------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the layout attributes of tosa.conv2d shared by the
+// conversions into and out of TOSA, which keep them in a library of their own
+// so that producing them does not pull in the lowering to MIOpen.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_CONVERSION_TOSATOMIOPEN_CONVLAYOUTS_H
+#define MLIR_CONVERSION_TOSATOMIOPEN_CONVLAYOUTS_H
+
+#include "mlir/Dialect/Tosa/IR/TosaOps.h"
+
+#include <string>
+
+namespace mlir {
+namespace tosa {
+
+/// The expected layout of a tosa convolution tensor, such as "nchw", which
+/// may be followed by a channel block, as in "nchw4c" for the NCHW4c layout
+/// that stores the tensor as [n, c / 4, h, w, 4].
+struct ExpectedLayout {
+  StringRef dims;
+  char channel = 0;
+  int64_t block = 1;
+};
+
+/// The expected layout `name` of `op`, such as "expected_filter_layout". A
+/// block that cannot be parsed is returned as 0.
+ExpectedLayout getExpectedLayout(Conv2DOp op, StringRef name);
+
+/// Tell if `op` expects its filter, input and output in the KCYX, NCHW and
+/// NKHW layouts.
+bool expectsNCHWLayouts(Conv2DOp op);
+
+/// The layouts a tosa.conv2d holds its filter, input and output in, as
+/// orderings of "kcyx", "nchw" and "nkhw". These are given by its
+/// filter_layout, input_layout and output_layout attributes once transposes
+/// have been folded into it or when it is created in other layouts, as
+/// MIGraphXToTosa does for NCHW, and by its expected layouts otherwise.
+struct ConvLayouts {
+  std::string filter;
+  std::string input;
+  std::string output;
+};
+ConvLayouts getConvLayouts(Conv2DOp op);
+void setConvLayouts(Conv2DOp op, const ConvLayouts &layouts);
+
+} // namespace tosa
+} // namespace mlir
+
+#endif // MLIR_CONVERSION_TOSATOMIOPEN_CONVLAYOUTS_H
@@ -15,13 +15,16 @@
 #define MLIR_CONVERSION_TOSATOMIOPEN_TOSATOMIOPEN_H
 
 #include "mlir/Dialect/Bufferization/Transforms/Bufferize.h"
+#include "mlir/Dialect/Tosa/IR/TosaOps.h"
 #include "mlir/Pass/Pass.h"
 
 namespace mlir {
 namespace tosa {
 
 /// Create a pass to convert Tosa conv2d operations to MIOpen operations.
-std::unique_ptr<Pass> createTosaToMIOpenPass();
+/// With `fusePooling`, non-overlapping average pooling becomes a reduction
+/// that is fused into the writeback of the convolution before it.
+std::unique_ptr<Pass> createTosaToMIOpenPass(bool fusePooling = false);
 
 /// Populates passes to convert from TOSA to MIOpen on buffers. At the end of
 /// the pass, the function will only contain MIOpen ops or standard ops if the
@@ -33,8 +36,31 @@ void populateTosaToMIOpenConversionPatterns(
     bufferization::BufferizeTypeConverter &typeConverter, MLIRContext *context,
     RewritePatternSet &patterns);
 
+/// Tell if the given i8 convolution is rewritten together with the rescale of
+/// its output into i8, which it then requantizes into in its epilogue.
+bool isRequantizedConv(Conv2DOp op);
+
+/// Tell if the given rescale is the requantization of a convolution, which
+/// it is rewritten together with.
+bool isConvRequantization(RescaleOp op);
+
+/// Tell if the given depthwise convolution is lowered to a grouped MIOpen
+/// convolution, which takes static shapes and no quantization.
+bool canConvertToMIOpen(DepthwiseConv2DOp op);
+
+/// Tell if the given transposed convolution is lowered to an MIOpen backward
+/// data convolution, which in addition needs no negative padding and strides
+/// no longer than the filter, for every output to be written.
+bool canConvertToMIOpen(TransposeConv2DOp op);
+
 void populateTosaToMIOpenTensorConversionPatterns(MLIRContext *context,
-                                                  RewritePatternSet &patterns);
+                                                  RewritePatternSet &patterns,
+                                                  bool fusePooling = false);
+
+/// Populates patterns that move transposes through elementwise ops and fold
+/// them into the layouts of convolutions.
+void populateTosaLayoutPropagationPatterns(MLIRContext *context,
+                                           RewritePatternSet &patterns);
 
 } // namespace tosa
 
@@ -0,0 +1,114 @@
+//===- CompileProfile.h - Compile-time profile of pipelines -----*- C++ -*-===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines a profile of where the compile time of the MIOpen
+// pipelines goes. Once attached to the pass managers running the pipelines,
+// every pass run is recorded with the phase it belongs to, the op it ran on,
+// its wall time and the number of ops nested in that op before and after it.
+// Runs of the serialization pass further record the time spent translating
+// to LLVM IR, optimizing, generating code and linking, and the sizes of the
+// ISA and binary produced. Runs on different threads are recorded together.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_DIALECT_MIOPEN_COMPILEPROFILE_H
+#define MLIR_DIALECT_MIOPEN_COMPILEPROFILE_H
+
+#include "mlir/Dialect/GPU/Transforms/Passes.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mlir {
+class Operation;
+class Pass;
+class PassManager;
+
+namespace miopen {
+
+class CompileProfile {
+public:
+  enum class Format {
+    /// Totals per phase, pass and kernel, followed by every pass run.
+    JSON,
+    /// Every pass run as a Chrome trace event, for chrome://tracing or
+    /// Perfetto.
+    ChromeTrace,
+  };
+
+  struct PassRun {
+    std::string phase;
+    /// The pass argument, or its name when it has none.
+    std::string pass;
+    /// Name and symbol name, if any, of the op the pass ran on.
+    std::string opName;
+    std::string symbol;
+    /// Small index of the thread the pass ran on, in order of first use.
+    unsigned thread = 0;
+    /// Start since the profile was created and wall time, in microseconds.
+    int64_t startUs = 0;
+    int64_t durationUs = 0;
+    /// Ops nested in the op the pass ran on, itself included.
+    int64_t opsBefore = 0;
+    int64_t opsAfter = 0;
+    bool failed = false;
+    /// Set for runs of a pass serializing a gpu.module to a binary.
+    llvm::Optional<gpu::SerializeToBlobPass::Profile> serialize;
+  };
+
+  CompileProfile();
+  ~CompileProfile();
+
+  /// Records the passes `pm` runs as belonging to `phase`. The profile must
+  /// outlive the runs of `pm`.
+  void attach(PassManager &pm, llvm::StringRef phase);
+
+  /// Returns the pass runs recorded so far, in order of completion.
+  std::vector<PassRun> getRuns() const;
+
+  void print(llvm::raw_ostream &os, Format format) const;
+  void printJSON(llvm::raw_ostream &os) const;
+  void printChromeTrace(llvm::raw_ostream &os) const;
+
+  /// Forgets the pass runs recorded so far.
+  void clear();
+
+  /// Parses "json" or "trace".
+  static llvm::Optional<Format> parseFormat(llvm::StringRef name);
+
+private:
+  class Instrumentation;
+
+  struct Pending {
+    std::chrono::steady_clock::time_point start;
+    int64_t opsBefore;
+  };
+
+  void begin(Pass *pass, Operation *op);
+  void end(llvm::StringRef phase, Pass *pass, Operation *op, bool failed);
+  unsigned getThreadIndex();
+
+  const std::chrono::steady_clock::time_point created;
+  mutable std::mutex mutex;
+  std::vector<PassRun> runs;
+  llvm::DenseMap<std::pair<Pass *, Operation *>, Pending> pending;
+  std::vector<std::thread::id> threads;
+};
+
+} // namespace miopen
+} // namespace mlir
+
+#endif // MLIR_DIALECT_MIOPEN_COMPILEPROFILE_H
@@ -14,6 +14,7 @@
 #define MLIR_DIALECT_MIOPEN_CONV2DGENERATOR_H_
 
 #include "mlir/Dialect/MIOpen/MIOpen.h"
+#include "mlir/Dialect/MIOpen/Tuning/ConvSolvers.h"
 #include "mlir/IR/BuiltinOps.h"
 #include "mlir/Support/LogicalResult.h"
 
@@ -48,12 +49,72 @@ public:
 
     int kernelId;
 
-    SmallVector<int64_t, 5> filterDimension;
-    SmallVector<int64_t, 5> inputDimension;
-    SmallVector<int64_t, 5> outputDimension;
+    SmallVector<int64_t, 6> filterDimension;
+    SmallVector<int64_t, 6> inputDimension;
+    SmallVector<int64_t, 6> outputDimension;
 
     int filterHeight;
     int filterWidth;
+
+    // Split the reduction of forward convolutions across workgroups.
+    bool splitK = false;
+
+    // Avoid the atomic accumulations for results that do not depend on the
+    // order in which workgroups run: backward weight convolutions reduce
+    // their KBlocks as with reduceKBlocks or, when they cannot, the whole
+    // GemmK of a tile within one workgroup, and forward ones do not split K.
+    bool deterministic = false;
+
+    // Reduce the KBlocks of XDLOPS backward weight convolutions through a
+    // workspace of partial filters and a second kernel instead of atomics.
+    bool reduceKBlocks = false;
+
+    // Reduce them in the same kernel instead: the last workgroup to write
+    // the partials of a filter tile sums them into the filter.
+    bool fusedReduction = false;
+
+    // The partial filters the workspace of a KBlock reduction has room for,
+    // or 0 for as many as the tuning parameters of the problem split GemmK
+    // into. See getReductionKBlocks().
+    int64_t reductionKBlocks = 0;
+
+    // Compute all the GEMMs of a strided backward data convolution in one
+    // kernel instead of one kernel each.
+    bool singleLaunch = false;
+
+    // Compute a dilated forward convolution as the dense convolutions of the
+    // phases of its output, folded into one GEMM kernel.
+    bool dilationPhases = false;
+
+    // Output tile size m of the Winograd F(m x m, 3 x 3) lowering to use
+    // instead of an implicit GEMM, or 0 for none.
+    int winogradTile = 0;
+
+    // Choose the solver of forward convolutions without a perf_config with
+    // the cost model of ConvSolvers.h, in place of the splitK, winogradTile
+    // and dilationPhases settings. See selectSolver().
+    bool autoSolver = false;
+
+    // Scale applied to the f32 results of fp8 and bf8 convolutions.
+    float fp8Scale = 1.0f;
+
+    // Multiply the operands of XDLOPS fp32 convolutions with the xf32
+    // instructions of gfx940, which round them to 19 bits for twice the
+    // throughput.
+    bool xf32 = false;
+
+    // Give the kernels a phase times buffer argument, which their gridwise
+    // gemms write the clock at their phase boundaries to. See
+    // kPhaseTimesAttrName.
+    bool phaseTiming = false;
+
+    // Depth parameters, which only matter for 3D convolutions: those whose
+    // layouts have 6 dimensions, including the filter depth `z` and the
+    // input and output depth `d`.
+    int dilationDepth = 1;
+    int strideDepth = 1;
+    int paddingDepthLeft = 0, paddingDepthRight = 0;
+    int filterDepth = 1;
   };
 
   Conv2dGenerator(const std::string &chip = "", const std::string &triple = "",
@@ -84,8 +145,75 @@ public:
 
   void flipXdlops();
 
+  void setSplitK(bool splitK);
+
+  void setWinogradTile(int winogradTile);
+
+  void setSingleLaunch(bool singleLaunch);
+
+  void setDilationPhases(bool dilationPhases);
+
+  void setAutoSolver(bool autoSolver);
+
+  void setDeterministic(bool deterministic);
+
+  void setReduceKBlocks(bool reduceKBlocks);
+
+  void setFusedReduction(bool fusedReduction);
+
+  void setFp8Scale(float fp8Scale);
+
+  void setXf32(bool xf32);
+
+  void setPhaseTiming(bool phaseTiming);
+
+  void setDepthParams(int dilationDepth, int strideDepth, int paddingDepthLeft,
+                      int paddingDepthRight);
+
   ConvolutionDims getConvolutionDims() const;
 
+  // The 8-bit float format of fp8 (E4M3) and bf8 (E5M2) convolutions, whose
+  // tensors hold the bytes of their values as i8 and whose output is f32.
+  Optional<Fp8Format> getFp8Format() const;
+
+  // Whether the convolution is a 3D one, which only exists in the forward
+  // direction.
+  bool isConv3D() const { return config.filterLayout.size() == 6; }
+
+  // Whether the convolution may be lowered with Winograd: a forward 2D fp32
+  // or fp16 convolution with a 3x3 filter and unit strides and dilations.
+  bool supportsWinograd(OpBuilder &builder) const;
+
+  // The output tile size of the Winograd lowering the convolution uses, or 0
+  // if it uses an implicit GEMM. Winograd is asked for either through the
+  // winogradTile setting or through the perf_config returned by
+  // getWinogradPerfConfig(), which lets the tuners pick it.
+  int getWinogradTile(OpBuilder &builder) const;
+
+  // The solver the convolution is lowered with, as the settings select it.
+  ConvSolver getSolver(OpBuilder &builder) const;
+
+  // With autoSolver, set the splitK, winogradTile and dilationPhases settings
+  // to those of the applicable solver of the lowest estimated cost. Must be
+  // called before the kernel count and the workspace are asked for, which
+  // depend on the solver. A perf_config, which the tuners and the perf db
+  // give, chooses the solver itself and is left alone. The KBlocks of a
+  // KBlock reduction are then worked out once, for reductionKBlocks.
+  void selectSolver(OpBuilder &builder);
+
+  // The KBlocks the workspace of a KBlock reduction holds the partial
+  // filters of: reductionKBlocks when set, else those of the tuning
+  // parameters that the tuning passes pick for the GEMM kernel, with the
+  // workspace not standing in their way. The tuning passes never pick more
+  // than the workspace of the kernels they tune has room for.
+  int64_t getReductionKBlocks(OpBuilder &builder) const;
+
+  // The output tile sizes the Winograd lowering supports.
+  static ArrayRef<int> getWinogradTiles();
+
+  // The perf_config selecting the Winograd lowering with output tile `tile`.
+  static std::string getWinogradPerfConfig(int tile);
+
   static inline constexpr int64_t outputDim(int64_t inputLen, int64_t filLen,
                                             int64_t leftPadLen,
                                             int64_t rightPadLen,
@@ -97,11 +225,25 @@ public:
 
   LogicalResult parseConvConfig(const char *arguments);
 
+  // Set the chip, triple and features from an --arch string.
+  LogicalResult parseArch(const std::string &arch);
+
+  // Set the layouts from MIOpen's layout strings, such as NGCHW, or NGCDHW
+  // for 3D convolutions, which name the dimensions of all three tensors
+  // after those of the input.
+  LogicalResult parseLayouts(const std::string &inLayout,
+                             const std::string &filLayout,
+                             const std::string &outLayout);
+
+  void setKernelId(int kernelId);
+
   LogicalResult parseConvDims(int64_t batchSize, int64_t groupSize,
                               int64_t inputChannel, int64_t inputHeight,
                               int64_t inputWidth, int64_t outputChannel,
                               int64_t outputHeight, int64_t outputWidth,
-                              int64_t filterHeight, int64_t filterWidth);
+                              int64_t filterHeight, int64_t filterWidth,
+                              int64_t inputDepth = 1, int64_t outputDepth = 1,
+                              int64_t filterDepth = 1);
 
   LogicalResult genConvModule(ModuleOp &module, int kernel_id = -1,
                               bool is_verifier = false,
@@ -125,9 +267,21 @@ public:
   // Utility function to query if a config requires additional workspace.
   bool hasWorkspace(OpBuilder &builder) const;
 
+  // Utility function to query if the workspace keeps state from one launch
+  // of the kernels to the next, which it then must not share with others.
+  bool hasPersistentWorkspace(OpBuilder &builder) const;
+
   // Utility function to fetch the size of workspace.
   int getWorkspaceSize(ModuleOp &module) const;
 
+  // Utility function to fetch the dimensions of the workspace: those of the
+  // filter for backward weight and of the output for forward convolutions,
+  // except for Winograd ones, whose workspace holds the transformed filter.
+  // Backward weight convolutions that reduce their KBlocks stack the
+  // getReductionKBlocks() partial filters along the outermost dimension,
+  // and one more filter-sized slab of counters when they do so in one kernel.
+  SmallVector<int64_t, 6> getWorkspaceDimension(OpBuilder &builder) const;
+
 private:
   template <typename Vector>
   std::vector<int64_t> layoutPermutation(const Vector &src,
@@ -141,8 +295,18 @@ private:
     return permutation;
   }
   int getBwdDataKernelCount() const;
+  SmallVector<int64_t> getBwdDataGemmIds() const;
+  bool usesSingleLaunch() const;
   int getBwdWeightKernelCount(OpBuilder &builder) const;
-  bool needExtraPadBwdWeight(OpBuilder &builder) const;
+  bool needExtraPad(OpBuilder &builder) const;
+  bool usesSplitK(OpBuilder &builder) const;
+  bool usesKBlockReduction(OpBuilder &builder) const;
+  bool usesFusedReduction(OpBuilder &builder) const;
+  // The autoSolver part of selectSolver().
+  void selectForwardSolver(OpBuilder &builder);
+  bool usesDilationPhases(OpBuilder &builder) const;
+  bool usesDirectConv() const;
+  bool usesPackedAtomics(OpBuilder &builder) const;
   LogicalResult hasValidDimension() const;
   LogicalResult hasValidChip() const;
 
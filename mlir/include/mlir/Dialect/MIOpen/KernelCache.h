@@ -0,0 +1,79 @@
+//===- KernelCache.h - Compiled kernel cache --------------------*- C++ -*-===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines a process-wide cache of compiled GPU kernels. Entries are
+// keyed on the lowered gpu.module of a kernel, printed with its symbol names
+// and host-side bookkeeping attributes stripped, together with the backend
+// target it is compiled for and the version of the compiler. Kernels that only
+// differ in name therefore share one binary, across every module compiled by
+// the process and, when a cache directory is configured, across processes.
+// The cache is opt-in: pipelines only consult it when asked to. Its copy in
+// memory holds at most kMaxBytes of binaries, the oldest going first.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_DIALECT_MIOPEN_KERNELCACHE_H
+#define MLIR_DIALECT_MIOPEN_KERNELCACHE_H
+
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/RWMutex.h"
+
+#include <deque>
+#include <string>
+
+namespace mlir {
+namespace miopen {
+
+class KernelCache {
+public:
+  struct Entry {
+    /// The serialized code object, as found in the gpu.binary attribute.
+    std::string binary;
+    /// Name of the kernel symbol within `binary`.
+    std::string symbol;
+  };
+
+  /// Bytes of binaries the cache keeps in memory.
+  static constexpr size_t kMaxBytes = 256 * 1024 * 1024;
+
+  /// The cache shared by all pipelines of this process.
+  static KernelCache &get();
+
+  /// Cache key of `gpuMod` compiled for `target` by this compiler.
+  static std::string makeKey(gpu::GPUModuleOp gpuMod, llvm::StringRef target);
+
+  /// Look `key` up in memory and then in `directory`, if one is given or set
+  /// through MIIR_KERNEL_CACHE_DIR.
+  llvm::Optional<Entry> lookup(llvm::StringRef key, llvm::StringRef directory);
+
+  /// Record `entry` under `key`, persisting it to `directory` as above.
+  void insert(llvm::StringRef key, Entry entry, llvm::StringRef directory);
+
+  size_t size() const;
+
+private:
+  KernelCache() = default;
+
+  /// Keep `entry` in memory, evicting the oldest entries past kMaxBytes.
+  /// Requires the writer lock.
+  void remember(llvm::StringRef key, Entry entry);
+
+  mutable llvm::sys::SmartRWMutex<true> mutex;
+  llvm::StringMap<Entry> entries;
+  /// Keys of `entries` from the oldest to the newest.
+  std::deque<std::string> order;
+  size_t bytes = 0;
+};
+
+} // namespace miopen
+} // namespace mlir
+
+#endif // MLIR_DIALECT_MIOPEN_KERNELCACHE_H
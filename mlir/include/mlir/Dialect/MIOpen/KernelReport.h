@@ -0,0 +1,46 @@
+//===- KernelReport.h - Report of the kernels compiled ----------*- C++ -*-===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines the report of how each kernel of a module was compiled:
+// the chip it targets, the solver it implements, the perf config and tuning
+// source of its parameters, its launch sizes and the registers, LDS and
+// occupancy of its binary, along with the revision of the compiler. The
+// benchmark results of utils/performance join it with the times of the
+// kernels, in the order of the report, so that a change of time can be traced
+// to a change of config or of code generation.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_DIALECT_MIOPEN_KERNELREPORT_H
+#define MLIR_DIALECT_MIOPEN_KERNELREPORT_H
+
+#include "mlir/IR/BuiltinOps.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace mlir {
+namespace miopen {
+
+/// Version of the layout of kernel reports, raised whenever a field changes
+/// meaning or goes away, so that tools comparing reports do not compare
+/// unlike ones.
+constexpr int64_t kKernelReportSchema = 1;
+
+/// Returns the revision of the source tree the compiler was built from, or
+/// an empty string if the build did not record one.
+llvm::StringRef getCompilerRevision();
+
+/// Writes the report of the kernels of `module` compiled to binaries, either
+/// in gpu.modules or as the targets of the functions they were applied to,
+/// as JSON.
+void printKernelReport(ModuleOp module, llvm::raw_ostream &os);
+
+} // namespace miopen
+} // namespace mlir
+
+#endif // MLIR_DIALECT_MIOPEN_KERNELREPORT_H
@@ -48,6 +48,13 @@ namespace miopen {
 ArrayAttr noTransformsArray(Builder &b, size_t n);
 
 ArrayAttr getIndexArrayAttr(Builder &b, ArrayRef<int64_t> values);
+
+/// Returns a copy of the dimension name `name` that lives as long as the
+/// process and is shared by every transform naming that dimension, in any
+/// context. Transform attributes store their names this way: the names come
+/// from a small vocabulary, so the pool stays small while the attributes no
+/// longer each carry a copy.
+StringRef internDimensionName(StringRef name);
 } // end namespace miopen
 } // end namespace mlir
 
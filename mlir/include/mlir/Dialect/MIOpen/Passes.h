@@ -23,9 +23,41 @@ namespace miopen {
 /// Create a pass to clone kernel funcs into MIOpen module
 std::unique_ptr<Pass> createMIOpenCloneKernelsPass();
 
+/// Create a pass to keep one of each set of identical kernel funcs
+std::unique_ptr<Pass> createMIOpenFoldDuplicateKernelsPass();
+
+/// Create a pass to clone folded kernel funcs back under their names
+std::unique_ptr<Pass> createMIOpenUnfoldDuplicateKernelsPass();
+
 /// Create a pass to apply target implementation to host kernel funcs
 std::unique_ptr<Pass> createMIOpenApplyImplPass();
 
+/// Create a pass to look gpu.modules up in the compiled kernel cache
+std::unique_ptr<Pass>
+createMIOpenKernelCacheLookupPass(StringRef target = "",
+                                  StringRef directory = "");
+
+/// Create a pass to attach cached binaries and record new ones
+std::unique_ptr<Pass>
+createMIOpenKernelCacheStorePass(StringRef target = "",
+                                 StringRef directory = "");
+
+/// Create a pass to record the resources of compiled kernels
+std::unique_ptr<Pass> createMIOpenKernelResourcesPass();
+
+/// Create a pass to reduce serialized gpu.modules to their binary and kernels
+std::unique_ptr<Pass> createMIOpenStripKernelsPass();
+
+/// Create a pass to merge calls to independent small kernels
+std::unique_ptr<Pass> createMIOpenHorizontalFusionPass();
+
+/// Create a pass to move small ops left in host functions into kernels
+std::unique_ptr<Pass> createMIOpenAbsorbHostOpsPass();
+
+/// Create a pass to split the workgroups of a horizontally fused kernel
+/// among its gemms
+std::unique_ptr<Pass> createMIOpenHorizontalDispatchPass();
+
 /// Create a pass to
 std::unique_ptr<Pass> createMIOpenAsyncLaunchPass();
 
@@ -44,6 +76,43 @@ std::unique_ptr<Pass> createMIOpenLinalgAlignPass();
 /// Create a pass to optimize out global copies.
 std::unique_ptr<Pass> createMIOpenCopyOptPass();
 
+/// Create a pass to fold the layout changes, padding and casts applied to
+/// constant weights of TOSA graphs, and with `sparseWeights` to compress the
+/// 2:4 structured-sparse ones of convolutions for the sparse XDLOPS.
+std::unique_ptr<Pass>
+createMIOpenFoldConstantWeightsPass(bool sparseWeights = false);
+
+/// Create a pass to run the f32 convolutions and matmuls of TOSA graphs in
+/// `precision`, f16 or bf16.
+std::unique_ptr<Pass>
+createMIOpenMixedPrecisionPass(StringRef precision = "f16");
+
+/// Create a pass to strength-reduce powers with constant exponents, and with
+/// `fastMath` to approximate f32 square roots.
+std::unique_ptr<Pass> createMIOpenMathSimplifyPass(bool fastMath = false);
+
+/// Create a pass to place intermediate buffers of host functions in one
+/// arena, reusing space between kernels that cannot run concurrently.
+std::unique_ptr<Pass> createMIOpenMemoryPlanPass();
+
+/// Create a pass to assign the async GPU ops of host functions to at most
+/// `numStreams` streams.
+std::unique_ptr<Pass> createMIOpenAssignStreamsPass(unsigned numStreams = 4);
+
+/// Create a pass to run the kernel launches of host functions as HIP graphs
+/// captured on their first call.
+std::unique_ptr<Pass> createMIOpenGraphCapturePass();
+
+/// Create a pass that has host functions acquire a device on entry and release
+/// it on return.
+std::unique_ptr<Pass> createMIOpenDeviceDispatchPass();
+
+/// Create a pass to create the streams of host functions at their priority
+std::unique_ptr<Pass> createMIOpenStreamPriorityPass();
+
+/// Create a pass that passes a runtime context into host entry points.
+std::unique_ptr<Pass> createMIOpenRuntimeContextPass();
+
 /// Create a pass to convert MIOpen blockwise operations to threadwise
 /// operations.
 std::unique_ptr<Pass> createMIOpenBlockwiseGemmToThreadwisePass();
@@ -52,17 +121,38 @@ std::unique_ptr<Pass> createMIOpenBlockwiseGemmToThreadwisePass();
 std::unique_ptr<Pass> createMIOpenThreadwiseGemmLoweringPass();
 
 /// Create a pass to expand transforming_for and other MIOpen shorthand to other
-/// dialects.
-std::unique_ptr<Pass> createMIOpenSugarToLoopsPass();
+/// dialects. Loops are only unrolled in full up to `maxUnrolledOps` ops, if
+/// not 0.
+std::unique_ptr<Pass> createMIOpenSugarToLoopsPass(int64_t maxUnrolledOps = 0);
+
+/// Create a pass to remove LDS and workgroup barriers that separate no
+/// conflicting accesses.
+std::unique_ptr<Pass> createMIOpenEliminateBarriersPass();
+
+/// Create a pass to lower the generics of kernels with nothing but linalg
+/// ops to vectorized grid-stride loops, and give the kernels a launch size.
+std::unique_ptr<Pass> createMIOpenLinalgToGpuPass();
 
 /// Create a pass to convert affine / loop to cf dialect.
 std::unique_ptr<Pass> createMIOpenLoopsToCfPass();
 
+/// Create a pass to move the wave-uniform parts of the index arithmetic of
+/// kernels to scalar registers.
+std::unique_ptr<Pass> createMIOpenUniformValuesPass();
+
 /// Create a pass to affix tuning parameters to gridwise gemm ops.
 std::unique_ptr<Pass>
 createAffixTuningParametersPass(int64_t blockSizeOverride = 0,
                                 int64_t gridSizeOverride = 0,
-                                bool fallBackNoConfig = false);
+                                bool fallBackNoConfig = false,
+                                int64_t minWavesPerSimd = 1,
+                                int64_t ldsStages = 1,
+                                bool directToLds = false,
+                                bool ldsEpilogue = false,
+                                int64_t schedHints = 0,
+                                int64_t gridGroupM = 0,
+                                bool persistent = false,
+                                int64_t skipHeuristicConfigs = 0);
 
 #define GEN_PASS_REGISTRATION
 #include "mlir/Dialect/MIOpen/Passes.h.inc"
@@ -13,6 +13,7 @@
 #ifndef MLIR_DIALECT_MIOPEN_PIPELINES_H_
 #define MLIR_DIALECT_MIOPEN_PIPELINES_H_
 
+#include "mlir/IR/BuiltinOps.h"
 #include "mlir/Pass/PassManager.h"
 #include "mlir/Pass/PassOptions.h"
 
@@ -32,6 +33,27 @@ struct PartitionOptions : public PassPipelineOptions<PartitionOptions> {
   PassOptions::Option<bool> cloneToMIOpenModule{
       *this, "clone-to-miopen",
       desc("Clone all kernel funcs into __miopen module"), init(true)};
+  PassOptions::Option<bool> horizontalFusion{
+      *this, "horizontal-fusion",
+      desc("Merge independent small kernels into one launch"), init(false)};
+  PassOptions::Option<bool> absorbHostOps{
+      *this, "absorb-host-ops",
+      desc("Move small ops left in host functions into adjacent kernels"),
+      init(false)};
+  PassOptions::Option<bool> fusePooling{
+      *this, "fuse-pooling",
+      desc("Fuse non-overlapping average pooling into convolution kernels, "
+           "whose pooled results must then be zeroed by the caller"),
+      init(false)};
+  PassOptions::Option<std::string> mixedPrecision{
+      *this, "mixed-precision",
+      desc("Run f32 convolutions and matmuls in f16 or bf16, if given"),
+      init("")};
+  PassOptions::Option<bool> sparseWeights{
+      *this, "sparse-weights",
+      desc("Compress 2:4 structured-sparse constant convolution filters for "
+           "the sparse XDLOPS of gfx940"),
+      init(false)};
 };
 
 /// Adds the "partition" pipeline to the `OpPassManager`.
@@ -44,6 +66,23 @@ struct BufferizeOptions : public PassPipelineOptions<BufferizeOptions> {
   PassOptions::Option<bool> disableMIOpen{
       *this, "disable-miopen",
       desc("Disable MIOpen dialect targeting when bufferizing"), init(false)};
+  PassOptions::Option<bool> memoryPlanning{
+      *this, "memory-planning",
+      desc("Share one arena among intermediate buffers of kernel launches"),
+      init(true)};
+  PassOptions::Option<bool> fastMath{
+      *this, "fast-math",
+      desc("Approximate f32 square roots of elementwise ops"), init(false)};
+  PassOptions::Option<bool> foldDuplicateKernels{
+      *this, "fold-duplicate-kernels",
+      desc("Bufferize one of each set of identical kernel funcs and clone "
+           "it for the others"),
+      init(true)};
+  PassOptions::Option<bool> fusePooling{
+      *this, "fuse-pooling",
+      desc("Fuse the non-overlapping average pooling partitioned into "
+           "convolution kernels into their writeback"),
+      init(false)};
 };
 
 /// Adds the `bufferize` pipeline to the `OpPassManager`.
@@ -63,11 +102,68 @@ struct KernelOptions : public PassPipelineOptions<KernelOptions> {
   PassOptions::Option<bool> tuningFallback{
       *this, "tuningFallback",
       desc("Falls back default if invalid config is given"), init(false)};
+  PassOptions::Option<int32_t> minWavesPerSimd{
+      *this, "min-waves-per-simd",
+      desc("Reject XDLOPS configs estimated to fit fewer waves per SIMD"),
+      init(1)};
+  PassOptions::Option<int32_t> ldsStages{
+      *this, "lds-stages",
+      desc("LDS buffers the XDLOPS main loop is pipelined over"),
+      init(1)};
+  PassOptions::Option<bool> directToLds{
+      *this, "direct-to-lds",
+      desc("Load XDLOPS A and B tiles from global memory straight into LDS "
+           "where their layout allows it"),
+      init(false)};
+  PassOptions::Option<bool> ldsEpilogue{
+      *this, "lds-epilogue",
+      desc("Transpose the XDLOPS C tile through LDS so that the output is "
+           "written with full-width vector stores"),
+      init(false)};
+  PassOptions::Option<int32_t> schedHints{
+      *this, "sched-hints",
+      desc("Scheduling hints of the XDLOPS main loop: 1 raises the priority "
+           "of the waves issuing MFMAs, 2 keeps the global loads and LDS "
+           "stores of each step out of its MFMAs, 3 does both"),
+      init(0)};
+  PassOptions::Option<int32_t> gridGroupM{
+      *this, "grid-group-m",
+      desc("Walk the block grid of gemms in bands of this many M blocks, "
+           "which go through all the N blocks in turn, for L2 reuse (1: "
+           "row-major, 0: picked per gemm)"),
+      init(0)};
+  PassOptions::Option<bool> persistent{
+      *this, "persistent",
+      desc("Launch XDLOPS gemms with as many workgroups as fit on the GPU at "
+           "once, each looping over the tiles of the grid they stand for"),
+      init(false)};
+  PassOptions::Option<int64_t> maxUnrolledOps{
+      *this, "max-unrolled-ops",
+      desc("Keep loops rolled, or unroll them in part, where unrolling them "
+           "in full gives more ops than this, to compile faster (0: no "
+           "limit)"),
+      init(0)};
+  PassOptions::Option<int32_t> skipHeuristicConfigs{
+      *this, "skip-heuristic-configs",
+      desc("Pass over this many of the best XDLOPS default configs, after "
+           "they spilled to scratch"),
+      init(0)};
+  PassOptions::Option<bool> fastCompile{
+      *this, "fast-compile",
+      desc("Lower for compile time over kernel speed: unroll little and "
+           "skip the optimizations that are not needed for correctness"),
+      init(false)};
 };
 
 /// Adds the `kernel` pipeline to the `OpPassManager`.
 void buildKernelPipeline(OpPassManager &pm, const KernelOptions &options = {});
 
+/// Adds the passes the `kernel` pipeline starts with, which pick the tuning
+/// parameters of the kernels and set their launch dimensions, to the
+/// `OpPassManager`. Running them alone tells the launch dimensions of a build
+/// with the same options without lowering anything.
+void buildTuningPipeline(OpPassManager &pm, const KernelOptions &options = {});
+
 //===--- Backend Pipeline -------------------------------------------------===//
 struct BackendOptions : public PassPipelineOptions<BackendOptions> {
 
@@ -82,12 +178,51 @@ struct BackendOptions : public PassPipelineOptions<BackendOptions> {
       *this, "opt-level", desc("GPU compiler optimization level"), init(3)};
   PassOptions::Option<int32_t> indexBitwidth{*this, "index-bitwidth",
                                              desc("Index bit-width"), init(32)};
+  PassOptions::Option<bool> kernelCache{
+      *this, "kernel-cache",
+      desc("Reuse binaries of identical kernels compiled earlier by this "
+           "process"),
+      init(false)};
+  PassOptions::Option<std::string> kernelCacheDir{
+      *this, "kernel-cache-dir",
+      desc("Directory the kernel cache is persisted to (default: "
+           "$MIIR_KERNEL_CACHE_DIR, if set)"),
+      init("")};
+  PassOptions::Option<bool> barePtrCallConv{
+      *this, "bare-ptr-call-conv",
+      desc("Pass statically shaped memrefs to kernels as bare pointers"),
+      init(false)};
+  PassOptions::Option<bool> fastCompile{
+      *this, "fast-compile",
+      desc("Compile at opt-level 1 at most, for compile time over kernel "
+           "speed"),
+      init(false)};
+  PassOptions::Option<bool> stripKernels{
+      *this, "strip-kernels",
+      desc("Reduce each gpu.module to its binary and kernel declarations once "
+           "compiled, to bound the memory of large modules"),
+      init(true)};
 };
 
 /// Adds the `kernel` pipeline to the `OpPassManager`.
 void buildBackendPipeline(OpPassManager &pm,
                           const BackendOptions &options = {});
 
+/// The unrolling limit and GPU optimization level of fast-compile builds,
+/// meant for kernels needed soon and rebuilt at full optimization later, in
+/// the background, to replace them with mgpuModuleCacheReplace.
+constexpr int64_t kFastCompileMaxUnrolledOps = 256;
+constexpr int32_t kFastCompileOptLevel = 1;
+
+/// Rebuilds of a kernel with lesser default configs that the drivers try when
+/// the one picked by the heuristics spills to scratch.
+constexpr int kMaxSpillRetries = 3;
+
+/// Whether a kernel of the serialized `module`, tuned by the heuristics,
+/// spills to scratch, so that it is worth rebuilding with the next default
+/// config by bumping `KernelOptions::skipHeuristicConfigs`.
+bool hasHeuristicSpills(ModuleOp module);
+
 /// Registers all pipelines for the `miopen` dialect.
 void registerPipelines();
 
@@ -105,11 +105,15 @@ protected:
   mlir::Location loc;
 
 private:
-  llvm::StringMap<uint32_t> startIndices;
+  // Names are looked up by a linear scan of these: a transform has a handful
+  // of dimensions, for which that beats hashing and saves copying builders
+  // the allocations of a string map, as ConvToGemm does for every conv.
+  Optional<uint32_t> findStart(StringRef name) const;
+  Optional<uint32_t> findEnd(StringRef name) const;
+
   llvm::SmallVector<SmallString<8>, 8> startNames;
   llvm::SmallVector<int64_t, 8> startShape;
 
-  llvm::StringMap<uint32_t> endIndices;
   llvm::SmallMapVector<uint32_t, SmallString<8>, 8> endNames;
   llvm::SmallVector<int64_t, 8> endShape;
 
@@ -181,7 +185,7 @@ struct TopDownTMBottomDimsWrapper {
 
   TopDownTMBottomDimsWrapper(TopDownTMBuilder &b,
                              llvm::StringMap<uint32_t> bottomDims)
-      : b(b), bottomDims(bottomDims) {}
+      : b(b), bottomDims(std::move(bottomDims)) {}
   void passThrough(StringRef name);
   void passThrough(ArrayRef<StringRef> names);
 
@@ -268,7 +272,7 @@ struct BottomUpTMTopDimsWrapper {
 
   BottomUpTMTopDimsWrapper(BottomUpTMBuilder &b,
                            llvm::StringMap<uint32_t> topDims)
-      : b(b), topDims(topDims) {}
+      : b(b), topDims(std::move(topDims)) {}
   void passThrough(StringRef name);
   void passThrough(ArrayRef<StringRef> names);
 
@@ -296,10 +300,39 @@ struct BottomUpTMTopDimsWrapper {
 /// will return the mapping {"a": 0, "x": 1, "y": 2, "c": 3}
 llvm::StringMap<uint32_t>
 expandNamesInPlace(ArrayRef<StringRef> original,
-                   const llvm::StringMap<SmallVector<StringRef, 2>> expansion);
+                   const llvm::StringMap<SmallVector<StringRef, 2>> &expansion);
 llvm::StringMap<uint32_t>
 expandNamesInPlace(TransformMapBuilder &builder,
-                   const llvm::StringMap<SmallVector<StringRef, 2>> expansion);
+                   const llvm::StringMap<SmallVector<StringRef, 2>> &expansion);
+
+/// Build the map that presents a tensor stored in a channel-blocked layout,
+/// such as NCHW4c, as an unblocked tensor with the dimensions `upperNames`.
+/// Among the stored dimensions `lowerNames`, `channel` holds the outer part of
+/// the channel dimension of the same name and `blockName` its inner block of
+/// consecutive channels. Upper dimensions that aren't stored, such as the group
+/// dimension of a convolution, are added with length 1.
+TransformMapAttr unblockChannels(Builder &b, ArrayRef<StringRef> lowerNames,
+                                 ArrayRef<int64_t> lowerShape,
+                                 StringRef channel, StringRef blockName,
+                                 ArrayRef<StringRef> upperNames, Location loc);
+
+/// Fuse two consecutive transform maps, `upper` followed by `lower`, into one
+/// map from the upper dimensions of `upper` to the lower dimensions of
+/// `lower`. Passthroughs on either side are absorbed, a merge followed by an
+/// unmerge with the same lengths becomes a passthrough, and chains of
+/// embeds/unmerges are folded into a single embed. Fails if the two maps
+/// can't be combined without changing their meaning.
+FailureOr<TransformMapAttr> fuseTransformMaps(Builder &b,
+                                              TransformMapAttr upper,
+                                              TransformMapAttr lower);
+
+/// Simplify a chain of transform maps by dropping identity maps and fusing
+/// adjacent maps where possible. Before that, unit dimensions of merges are
+/// dropped between adjacent maps, and dimensions of a merge that are read
+/// with contiguous coefficients are collapsed into one. This reduces the
+/// number of intermediate coordinates that need to be computed when the
+/// chain is lowered.
+ArrayAttr simplifyTransformChain(Builder &b, ArrayAttr transforms);
 } // namespace miopen
 } // namespace mlir
 #endif
@@ -0,0 +1,154 @@
+//===------- BinaryPerfDb.h - MLIR sqlite-free perf db ----------===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines a compact, read-only perf db format that needs no SQLite
+// at runtime. The file holds the entries of one or more MIOpen perf_db tables
+// sorted by problem key, so a lookup is a binary search over a memory-mapped
+// buffer:
+//
+//   char     magic[8]      "MIIRPDB1"
+//   uint32_t numEntries
+//   uint32_t blobSize
+//   Entry    entries[numEntries]   sorted by (key, solver)
+//   char     blob[blobSize]
+//
+// where an Entry is six little-endian uint32_t: the offset and size of the
+// key, solver and params strings within the blob.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_DIALECT_MIOPEN_BINARYPERFDB_H
+#define MLIR_DIALECT_MIOPEN_BINARYPERFDB_H
+
+#include "mlir/Support/LogicalResult.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mlir {
+namespace miopen {
+
+class BinaryPerfDb {
+public:
+  /// Open a binary perf db. Returns nullptr if the file cannot be read or is
+  /// not in the expected format.
+  static std::unique_ptr<BinaryPerfDb> open(llvm::StringRef path);
+
+  /// The perf db shipped with the library, if one was configured at build
+  /// time and could be opened. Loaded once, safe to query concurrently.
+  static const BinaryPerfDb *getSystemDb();
+
+  /// Map the binary perf db at `path` read-only as a shared layer, such as
+  /// one merged from the results of many tuning nodes and served from a
+  /// network file system. Fails if the file cannot be read or is not a
+  /// binary perf db; adding the same path again has no effect. Layers live
+  /// until the process exits.
+  static LogicalResult addSharedDb(llvm::StringRef path);
+
+  /// The perf dbs lookups go through, in order of precedence: the shared
+  /// layers in the order they were added, then the system db. Safe to call
+  /// concurrently with addSharedDb.
+  static std::vector<const BinaryPerfDb *> getLayers();
+
+  /// Canonical key of a problem: the target followed by the name=value pairs
+  /// of its perf db columns, with SQL quoting removed.
+  static std::string makeKey(llvm::StringRef arch, size_t numCu,
+                             llvm::ArrayRef<std::string> names,
+                             llvm::ArrayRef<std::string> values);
+
+  /// Params string tuned for `solver` on the problem `key`, if any.
+  llvm::Optional<llvm::StringRef> find(llvm::StringRef key,
+                                       llvm::StringRef solver) const;
+
+  /// Deserialize the params of `solver` for `problemConfig` into `values`.
+  /// T shall be a SQLiteSerializable and V a Serializable.
+  template <class T, class V>
+  bool load(llvm::StringRef arch, size_t numCu, const T &problemConfig,
+            llvm::StringRef solver, V &values) const {
+    llvm::Optional<llvm::StringRef> params =
+        find(makeKey(arch, numCu, problemConfig.fieldNames(),
+                     problemConfig.fieldValues()),
+             solver);
+    if (!params)
+      return false;
+    return values.deserialize(params->str());
+  }
+
+  /// The num_cu values `arch` has entries for, in increasing order.
+  llvm::ArrayRef<size_t> getNumCus(llvm::StringRef arch) const;
+
+  /// The file the db was read from.
+  llvm::StringRef getPath() const { return buffer->getBufferIdentifier(); }
+
+  size_t size() const { return numEntries; }
+
+private:
+  BinaryPerfDb(std::unique_ptr<llvm::MemoryBuffer> buffer, size_t numEntries,
+               const char *entries, llvm::StringRef blob)
+      : buffer(std::move(buffer)), numEntries(numEntries), entries(entries),
+        blob(blob) {}
+
+  llvm::StringRef getString(size_t entry, size_t field) const;
+  /// Fill `numCus` from the keys of the entries.
+  void indexNumCus();
+
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  size_t numEntries;
+  const char *entries;
+  llvm::StringRef blob;
+  /// The num_cu values of each arch.
+  llvm::StringMap<std::vector<size_t>> numCus;
+};
+
+/// Accumulates perf db entries and serializes them in the binary format.
+/// Of the entries of the same (key, solver) pair, the one with the lowest
+/// measured time is kept, or else the first added.
+class BinaryPerfDbWriter {
+public:
+  void add(std::string key, std::string solver, std::string params,
+           llvm::Optional<double> timeMs = llvm::None);
+  void write(llvm::raw_ostream &os);
+  size_t size() const { return records.size(); }
+
+private:
+  struct Record {
+    std::string key;
+    std::string solver;
+    std::string params;
+    llvm::Optional<double> timeMs;
+  };
+  std::vector<Record> records;
+};
+
+/// Convert the MIOpen SQLite perf db at `sqlitePath` to the binary format.
+/// Fails when SQLite support is not compiled in or the database cannot be
+/// read.
+LogicalResult convertSQLitePerfDb(llvm::StringRef sqlitePath,
+                                  llvm::raw_ostream &os,
+                                  llvm::raw_ostream &errs);
+
+/// Merge the SQLite perf dbs at `sqlitePaths`, such as the user perf dbs of
+/// several tuning nodes, into one binary perf db. Of the entries of the same
+/// problem and solver, the one whose measured time, recorded by the tuners,
+/// is the lowest wins, and entries without one lose to those with one; ties
+/// go to the first db listed.
+LogicalResult mergeSQLitePerfDbs(llvm::ArrayRef<std::string> sqlitePaths,
+                                 llvm::raw_ostream &os,
+                                 llvm::raw_ostream &errs);
+
+} // namespace miopen
+} // namespace mlir
+
+#endif // MLIR_DIALECT_MIOPEN_BINARYPERFDB_H
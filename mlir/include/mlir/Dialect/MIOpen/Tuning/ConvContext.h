@@ -39,10 +39,16 @@ struct ConvolutionDims {
   int64_t c;
   int64_t n;
   int64_t g;
+  // The filter, output and input depths, which are 1 in 2D convolutions.
+  int64_t z;
+  int64_t dout;
+  int64_t din;
 
   ConvolutionDims(int64_t y, int64_t x, int64_t ho, int64_t wo, int64_t hi,
-                  int64_t wi, int64_t k, int64_t c, int64_t n, int64_t g)
-      : y(y), x(x), ho(ho), wo(wo), hi(hi), wi(wi), k(k), c(c), n(n), g(g) {}
+                  int64_t wi, int64_t k, int64_t c, int64_t n, int64_t g,
+                  int64_t z = 1, int64_t dout = 1, int64_t din = 1)
+      : y(y), x(x), ho(ho), wo(wo), hi(hi), wi(wi), k(k), c(c), n(n), g(g),
+        z(z), dout(dout), din(din) {}
 };
 
 struct ConvolutionContext : SQLiteSerializable<ConvolutionContext> {
@@ -50,26 +56,67 @@ struct ConvolutionContext : SQLiteSerializable<ConvolutionContext> {
   int num_cu;
   ConvOpType opType;
   llvm::StringMap<DimIndexAndSize> dimIndexAndSize;
+  // The sizes of dimIndexAndSize, read out once so that they need no string
+  // lookups.
+  ConvolutionDims convDims;
   llvm::SmallVector<int64_t, 2> strideVal;
   llvm::SmallVector<int64_t, 2> dilationVal;
   llvm::SmallVector<int64_t, 4> paddingVal;
   int gemmId;
   Type dataType;
+  // Whether a forward convolution splits GemmK across workgroups and
+  // accumulates its output with atomic adds.
+  bool splitK = false;
+  // Whether a strided backward data convolution computes the GEMMs of all its
+  // phases in one kernel, folded into GemmG.
+  bool singleLaunch = false;
+  // Whether a dilated forward convolution computes each phase of its output,
+  // the pixels whose position is the same modulo the dilation, as a dense
+  // convolution, the phases being folded into GemmG.
+  bool dilationPhases = false;
+  // Whether a backward weight convolution avoids summing KBlocks with
+  // atomics: it reduces them in a workspace or, without reduceKBlocks, all of
+  // GemmK within each workgroup.
+  bool deterministic = false;
+  // Whether a backward weight convolution writes the partial results of its
+  // KBlocks to a workspace, reduced by a second kernel, instead of adding
+  // them with atomics.
+  bool reduceKBlocks = false;
+  // The partial filters the workspace of such a convolution has room for,
+  // which bounds its KBlocks.
+  int64_t reductionKBlocks = 0;
+  // The channel blocks of channel-blocked tensors, such as NCHW4c ones, keyed
+  // by their channel dimension ("c", "ci" or "ko"). Only runs of a block's
+  // consecutive channels are contiguous in memory.
+  llvm::StringMap<int64_t> channelBlocks;
+  // Whether the context describes a miopen.gemm, as the 1x1 forward
+  // convolution computing the same GEMM, rather than a convolution.
+  bool isGemm = false;
+  // The 8-bit float format of i8 data that holds fp8 rather than integers.
+  Optional<Fp8Format> fp8Format;
+  // Whether f32 data is multiplied with the reduced-precision xf32 XDLOPS.
+  bool xf32 = false;
+  // Whether the filter holds compressed 2:4 sparse weights, multiplied with
+  // the sparse XDLOPS.
+  bool sparse = false;
 
   ConvolutionContext(const llvm::SmallString<8> &architecture, int numCu,
                      ConvOpType op, llvm::StringMap<DimIndexAndSize> dim,
                      ArrayRef<int64_t> stride, ArrayRef<int64_t> dilation,
                      ArrayRef<int64_t> padding, int gemmid, Type type)
       : arch(architecture), num_cu(numCu), opType(op), dimIndexAndSize(dim),
+        convDims(computeConvDims(dimIndexAndSize)),
         strideVal(stride.begin(), stride.end()),
         dilationVal(dilation.begin(), dilation.end()),
         paddingVal(padding.begin(), padding.end()), gemmId(gemmid),
         dataType(type) {}
 
-  llvm::StringMap<DimIndexAndSize> getDimIndexAndSize() const {
+  const llvm::StringMap<DimIndexAndSize> &getDimIndexAndSize() const {
     return dimIndexAndSize;
   }
-  ConvolutionDims getConvDims();
+  ConvolutionDims getConvDims() const { return convDims; }
+  static ConvolutionDims
+  computeConvDims(const llvm::StringMap<DimIndexAndSize> &dimIndexAndSize);
 
   ArrayRef<int64_t> getPaddingVal() const { return paddingVal; }
   ArrayRef<int64_t> getStrideVal() const { return strideVal; }
@@ -81,40 +128,68 @@ struct ConvolutionContext : SQLiteSerializable<ConvolutionContext> {
 
   // Note: Keep it in sync with miopen/conv/problem_description
   template <class Self, class F> static void visit(Self &&self, F f) {
+    ConvolutionDims dims = self.getConvDims();
+    // Only 3D problems have depth columns, which the config tables of perf
+    // dbs built for 2D problems lack.
+    bool is3D = self.getStrideVal().size() > 2;
     // Input tensor dimensions
-    f(std::to_string(self.getDimIndexAndSize()["ni"].size), "batchsize");
-    f(std::to_string(self.getDimIndexAndSize()["ci"].size), "in_channels");
-    f(std::to_string(self.getDimIndexAndSize()["hi"].size), "in_h");
-    f(std::to_string(self.getDimIndexAndSize()["wi"].size), "in_w");
+    f(std::to_string(dims.n), "batchsize");
+    f(std::to_string(dims.c), "in_channels");
+    f(std::to_string(dims.hi), "in_h");
+    f(std::to_string(dims.wi), "in_w");
+    if (is3D)
+      f(std::to_string(dims.din), "in_d");
     // Filter tensor dimensions
-    f(std::to_string(self.getDimIndexAndSize()["y"].size), "fil_h");
-    f(std::to_string(self.getDimIndexAndSize()["x"].size), "fil_w");
+    f(std::to_string(dims.y), "fil_h");
+    f(std::to_string(dims.x), "fil_w");
+    if (is3D)
+      f(std::to_string(dims.z), "fil_d");
     // Output tensor dimensions
-    f(std::to_string(self.getDimIndexAndSize()["ko"].size), "out_channels");
-    // Padding
-    f(std::to_string(self.getPaddingVal()[0]), "pad_h_l");
-    f(std::to_string(self.getPaddingVal()[1]), "pad_h_r");
-    f(std::to_string(self.getPaddingVal()[2]), "pad_w_l");
-    f(std::to_string(self.getPaddingVal()[3]), "pad_w_r");
+    f(std::to_string(dims.k), "out_channels");
+    if (is3D)
+      f(std::to_string(dims.dout), "out_d");
+    // Padding, of which 3D convolutions append the depth to the 2D one
+    ArrayRef<int64_t> padding = self.getPaddingVal();
+    f(std::to_string(padding[0]), "pad_h_l");
+    f(std::to_string(padding[1]), "pad_h_r");
+    f(std::to_string(padding[2]), "pad_w_l");
+    f(std::to_string(padding[3]), "pad_w_r");
+    if (is3D) {
+      f(std::to_string(padding.size() > 4 ? padding[4] : 0), "pad_d_l");
+      f(std::to_string(padding.size() > 5 ? padding[5] : 0), "pad_d_r");
+    }
     // Strides
     f(std::to_string(self.getStrideVal()[0]), "conv_stride_h");
     f(std::to_string(self.getStrideVal()[1]), "conv_stride_w");
-    f(std::to_string(0), "conv_stride_d");
+    f(std::to_string(self.getStrideVal().size() > 2 ? self.getStrideVal()[2]
+                                                     : 0),
+      "conv_stride_d");
     f(std::to_string(self.getDilationVal()[0]), "dilation_h");
     f(std::to_string(self.getDilationVal()[1]), "dilation_w");
-    f(std::to_string(0), "dilation_d");
+    f(std::to_string(self.getDilationVal().size() > 2
+                         ? self.getDilationVal()[2]
+                         : 0),
+      "dilation_d");
     f(std::to_string(0), "bias");
     f(std::to_string(1), "group_count");
     // TODO use dimIndexAndSize to generate layout
     f("'" + std::string("NCHW") + "'", "layout");
 
     Type dataType = self.getDataType();
-    if (dataType.isF32()) {
-      f("'" + std::string("FP32") + "'", "data_type");
+    if (dataType.isF64()) {
+      f("'" + std::string("FP64") + "'", "data_type");
+    } else if (dataType.isF32()) {
+      f("'" + std::string(self.xf32 ? "XF32" : "FP32") + "'", "data_type");
     } else if (dataType.isF16()) {
-      f("'" + std::string("FP16") + "'", "data_type");
+      f("'" + std::string(self.sparse ? "FP16_SP" : "FP16") + "'",
+        "data_type");
     } else if (dataType.isBF16()) {
-      f("'" + std::string("BF16") + "'", "data_type");
+      f("'" + std::string(self.sparse ? "BF16_SP" : "BF16") + "'",
+        "data_type");
+    } else if (self.fp8Format == Fp8Format::E4M3) {
+      f("'" + std::string("FP8") + "'", "data_type");
+    } else if (self.fp8Format == Fp8Format::E5M2) {
+      f("'" + std::string("BF8") + "'", "data_type");
     }
 
     switch (self.getOpType()) {
@@ -135,6 +210,21 @@ struct ConvolutionContext : SQLiteSerializable<ConvolutionContext> {
 // TODO(whchung): adopt ConvolutionOp OpTrait check after supporting PR is in.
 ConvolutionContext populateConvContext(Operation *op);
 
+// The convolution context of a convolution or gemm op, populated once and
+// shared through the analysis manager by the passes that tune and lower the
+// op. Passes that change the attributes or operand types it is read from
+// must not preserve it.
+class ConvolutionContextAnalysis {
+public:
+  explicit ConvolutionContextAnalysis(Operation *op)
+      : ctx(populateConvContext(op)) {}
+
+  const ConvolutionContext &getContext() const { return ctx; }
+
+private:
+  ConvolutionContext ctx;
+};
+
 } // namespace miopen
 } // namespace mlir
 #endif // MLIR_DIALECT_MIOPEN_CONVCONTEXT_H
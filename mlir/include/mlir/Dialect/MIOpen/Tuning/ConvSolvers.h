@@ -0,0 +1,81 @@
+//===- ConvSolvers.h - The algorithms convolutions are lowered with -------===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// The registry of the solvers, in MIOpen's terms, a convolution may be lowered
+// with: the implicit GEMM and the variants that replace it for some shapes.
+// The attributes of a convolution select its solver, which ConvToGemm and
+// AffixTuningParameters dispatch on; Conv2dGenerator sets those attributes,
+// either from the options it is given or, with auto_solver, for the applicable
+// solver of the lowest estimated cost below. AffixTuningParameters records
+// the solver of each kernel in its conv_solver attribute, next to
+// tuning_source.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_DIALECT_MIOPEN_TUNING_CONVSOLVERS_H
+#define MLIR_DIALECT_MIOPEN_TUNING_CONVSOLVERS_H
+
+#include "mlir/Dialect/MIOpen/MIOpen.h"
+#include "mlir/Dialect/MIOpen/Tuning/ConvContext.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace mlir {
+namespace miopen {
+enum class ConvSolver : uint32_t {
+  /// A gridwise GEMM over the implicit GEMM view of the tensors.
+  ImplicitGemm,
+  /// The implicit GEMM with its reduction split across workgroups that
+  /// accumulate with atomics, for forward convolutions of few output tiles.
+  SplitK,
+  /// Winograd F(m x m, 3 x 3), for 3x3 stride-1 forward convolutions.
+  Winograd,
+  /// The dense convolutions of the dilation phases of the output, for
+  /// dilated stride-1 forward convolutions.
+  DilationPhases,
+  /// One thread per output element, for grouped convolutions of a handful of
+  /// channels per group.
+  DirectGrouped,
+  /// A matrix-vector style kernel, for gemms with a very small side.
+  SkinnyGemm,
+};
+
+/// Name of the conv_solver attribute recording the solver of a kernel.
+constexpr llvm::StringLiteral kConvSolverAttrName = "conv_solver";
+
+/// Name of `solver` in the conv_solver attribute.
+llvm::StringRef getNameForConvSolver(ConvSolver solver);
+
+/// The solvers a forward convolution may be lowered with, in the order they
+/// are preferred in when their costs tie.
+llvm::ArrayRef<ConvSolver> getConvSolvers();
+
+/// What the cost estimates need to know of a convolution.
+struct ConvSolverProblem {
+  ConvOpType dir;
+  ConvolutionDims dims;
+  int64_t elementBytes;
+  int64_t numCu;
+  int64_t dilationHeight = 1;
+  int64_t dilationWidth = 1;
+};
+
+/// An analytic estimate of the time `solver` takes on `problem`, in
+/// arbitrary units only meant to be compared with each other: the larger of
+/// the time of its arithmetic, derated for the padding of its tiles and for
+/// the compute units left idle, and the time of its memory traffic, plus a
+/// fixed cost per kernel launched. `winogradTile` is the output tile size m
+/// of the Winograd solver.
+double estimateConvSolverCost(ConvSolver solver,
+                              const ConvSolverProblem &problem,
+                              int64_t winogradTile = 0);
+} // namespace miopen
+} // namespace mlir
+
+#endif // MLIR_DIALECT_MIOPEN_TUNING_CONVSOLVERS_H
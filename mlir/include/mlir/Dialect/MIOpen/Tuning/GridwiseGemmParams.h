@@ -16,16 +16,47 @@
 #include "mlir/Dialect/MIOpen/MIOpen.h"
 #include "mlir/Dialect/MIOpen/Tuning/GemmContext.h"
 #include "mlir/Dialect/MIOpen/Tuning/Serializable.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/iterator.h"
+
+#include <memory>
 
 namespace mlir {
 class Type;
 namespace miopen {
 struct ConvolutionContext;
+template <typename Params> class TuningSpace;
 // 0 : gemmG dimension.
 // 1 : gemmK dimension.
 // 2 : gemmM or gemmN dimension.
 enum GemmDimensions { GemmG = 0, GemmK = 1, GemmMorN = 2 };
 
+// Where the tuning parameters of a gridwise gemm come from.
+enum class TuningSource {
+  PerfConfig,     // an explicit perf_config
+  PerfDb,         // an exact perf db entry
+  PerfDbNeighbor, // the adapted perf db entry of a nearby problem
+  PerfDbOtherCu,  // the perf db entry of the problem on another num_cu
+  Heuristic,      // the default configs
+  Padding,        // the universal config of the padding kernel
+  Fallback,       // the heuristics after an invalid perf_config
+  SpillFallback,  // a lesser default config after better ones spilled
+};
+constexpr size_t kNumTuningSources = 8;
+
+// The scheduling hints of the XDLOPS main loop, bits of its `sched_hints`.
+enum SchedHints : int64_t {
+  // Raise the priority of the waves while they issue their MFMAs, so that
+  // the SIMD switches to the waves behind them in the pipeline, which issue
+  // loads, rather than to those at the same point.
+  kSchedHintPriority = 1,
+  // Keep the global loads of each step of the loop ahead of its MFMAs and
+  // LDS reads, and its LDS stores after them, so that the loads are in
+  // flight during the whole of the MFMA section.
+  kSchedHintFence = 2,
+  kSchedHintsAll = kSchedHintPriority | kSchedHintFence
+};
+
 constexpr int64_t gemmCDimG = 0;
 constexpr int64_t gemmCDimM = 1;
 constexpr int64_t gemmCDimN = 2;
@@ -62,7 +93,12 @@ struct DerivedOutParams {
   int64_t gemmVectorDim;
   int64_t destVectorDim;
   int64_t dataPerCopy;
-  DerivedOutParams() : gemmVectorDim(-1), destVectorDim(-1), dataPerCopy(1) {}
+  // Widest vector the output tensor allows along gemmVectorDim, whatever the
+  // thread's share of the C tile is.
+  int64_t maxDataPerCopy;
+  DerivedOutParams()
+      : gemmVectorDim(-1), destVectorDim(-1), dataPerCopy(1),
+        maxDataPerCopy(1) {}
 };
 
 struct InitParamsNonXDL : InitParams, Serializable<InitParamsNonXDL> {
@@ -106,6 +142,10 @@ struct InitParamsXDL : InitParams, Serializable<InitParamsXDL> {
   int64_t gemmKPack;
   bool gemmAThreadCopyMoreGemmK;
   bool gemmBThreadCopyMoreGemmKPack;
+  // LDS buffers the main loop is pipelined over, or 0 for the lds-stages
+  // option of the pipeline. It is an optional ninth perf_config field, left
+  // out when 0, so that perf_configs without it still parse.
+  int64_t ldsStages = 0;
 
   template <class Self, class F> static void visit(Self &&self, F f) {
     f(self.gemmMPerBlock);
@@ -117,6 +157,9 @@ struct InitParamsXDL : InitParams, Serializable<InitParamsXDL> {
     f(self.gemmAThreadCopyMoreGemmK);
     f(self.gemmBThreadCopyMoreGemmKPack);
   }
+
+  void serialize(std::ostream &stream) const;
+  bool deserialize(const std::string &s);
 };
 
 template <typename T> std::string genDebugForParams(T params) {
@@ -146,50 +189,75 @@ private:
 
   LogicalResult
   calculateGemmABlockCopyPerformanceParameters(const InitParamsNonXDL &param,
-                                               ConvolutionContext &ctx,
+                                               const ConvolutionContext &ctx,
                                                DerivedParams &derived);
 
   LogicalResult
   calculateGemmBBlockCopyPerformanceParameters(const InitParamsNonXDL &param,
-                                               ConvolutionContext &ctx,
+                                               const ConvolutionContext &ctx,
                                                DerivedParams &derived);
   LogicalResult
   calculateGemmCBlockwiseCopyParams(const InitParamsNonXDL &params,
-                                    ConvolutionContext &ctx,
+                                    const ConvolutionContext &ctx,
                                     DerivedOutParams &out);
   LogicalResult
   calculateBlockGemmPerformanceParameters(const InitParamsNonXDL &param,
                                           const ConvolutionContext &ctx,
                                           DerivedBlockGemmParams &derived);
 
-  LogicalResult
-  populateDerived(ConvolutionContext &ctx, const InitParamsNonXDL &validParams,
-                  GemmSize &gemmSize, DerivedParams &gemmADerivedParam,
-                  DerivedParams &gemmBDerivedParam,
-                  DerivedBlockGemmParams &blockGemmDerivedParam,
-                  DerivedOutParams &gemmCDerivedParam, int64_t &gridSize);
+  LogicalResult populateDerived(const ConvolutionContext &ctx,
+                                const InitParamsNonXDL &validParams,
+                                GemmSize &gemmSize,
+                                DerivedParams &gemmADerivedParam,
+                                DerivedParams &gemmBDerivedParam,
+                                DerivedBlockGemmParams &blockGemmDerivedParam,
+                                DerivedOutParams &gemmCDerivedParam,
+                                int64_t &gridSize);
 
   LogicalResult populatePaddingKernelDerived(
-      ConvolutionContext &ctx, const InitParamsNonXDL &validParams,
+      const ConvolutionContext &ctx, const InitParamsNonXDL &validParams,
       GemmSize &gemmSize, DerivedParams &gemmADerivedParam,
       DerivedParams &gemmBDerivedParam,
       DerivedBlockGemmParams &blockGemmDerivedParam,
       DerivedOutParams &gemmCDerivedParam, int64_t &gridSize);
 
+  // Borrow the parameters tuned for the closest perf db neighbor of `ctx`,
+  // a problem differing only in batch or image size, shrinking the tile when
+  // it no longer divides `gemmSize`.
+  LogicalResult loadNeighborFromPerfDb(const ConvolutionContext &ctx,
+                                       const GemmSize &gemmSize,
+                                       const std::string &solverId,
+                                       InitParamsNonXDL &validParams);
+
+  TuningSource tuningSource = TuningSource::Heuristic;
+
 public:
   LogicalResult obtainTuningParameters(
-      Operation *op, int64_t blockSizeOverride, const std::string &perfConfig,
-      InitParamsNonXDL &validParams, DerivedParams &gemmADerivedParam,
-      DerivedParams &gemmBDerivedParam,
+      const ConvolutionContext &ctx, int64_t blockSizeOverride,
+      const std::string &perfConfig, InitParamsNonXDL &validParams,
+      DerivedParams &gemmADerivedParam, DerivedParams &gemmBDerivedParam,
       DerivedBlockGemmParams &blockGemmDerivedParam,
       DerivedOutParams &gemmCDerivedParam, int64_t &gridSize);
 
-  ArrayRef<InitParamsNonXDL> getTuningParameters(ConvOpType dir,
-                                                 Type dataType) const;
+  // Where the parameters of the last obtainTuningParameters() came from.
+  TuningSource getTuningSource() const { return tuningSource; }
+
+  ArrayRef<InitParamsNonXDL> getTuningParameters(ConvOpType dir, Type dataType,
+                                                 bool isGemm = false) const;
+
+  // The points of the exhaustive tuning space that are valid for `op`. Each
+  // of them is a valid perf_config.
+  TuningSpace<InitParamsNonXDL> getTuningSpace(Operation *op) const;
+
+  // The first `limit` default configs that are valid for `op`, in order of
+  // preference.
+  std::vector<InitParamsNonXDL> rankTuningSpace(Operation *op, size_t limit);
 
   const InitParams &getUniversalParameters() const;
 
   LogicalResult isValidGemm(const InitParamsNonXDL &param, GemmSize &gemmSize);
+
+  friend class TuningSpace<InitParamsNonXDL>;
 };
 
 class PopulateParamsXDL {
@@ -203,25 +271,70 @@ private:
   // Tuning parameters for i8 convolutions.
   static const InitParamsXDL initParametersForwardI8[nInitParametersForwardI8];
 
-  static constexpr int64_t waveSize = 64;
+  static constexpr size_t nInitParametersGemm = 10;
+  // Tuning parameters for non-i8 miopen.gemm ops.
+  static const InitParamsXDL initParametersGemm[nInitParametersGemm];
+
+  static constexpr size_t nInitParametersWmma = 6;
+  // Tuning parameters for the WMMA of gfx11, whose operands take whole
+  // KPACK = 16 vectors.
+  static const InitParamsXDL initParametersWmma[nInitParametersWmma];
+
+  static constexpr size_t nInitParametersFp8 = 8;
+  // Tuning parameters for the fp8 MFMAs of gfx940, which reduce K within
+  // 32x32 and 16x16 wave tiles from operands of 8 values.
+  static const InitParamsXDL initParametersFp8[nInitParametersFp8];
+
+  static constexpr size_t nInitParametersXf32 = 9;
+  // Tuning parameters for the xf32 MFMAs of gfx940, which only cover 32x32
+  // and 16x16 wave tiles and take operands of 2 values.
+  static const InitParamsXDL initParametersXf32[nInitParametersXf32];
+
+  static constexpr size_t nInitParametersSparse = 9;
+  // Tuning parameters for the sparse MFMAs of gfx940, which reduce K within
+  // 32x32 and 16x16 wave tiles and decompress whole KPACK vectors of 8 f16 or
+  // bf16 or 16 i8 values.
+  static const InitParamsXDL initParametersSparse[nInitParametersSparse];
+
+  static constexpr size_t nInitParametersF64 = 6;
+  // Tuning parameters for the f64 MFMA of gfx90a and gfx940, which only
+  // covers 16x16 wave tiles, reducing K over its four input blocks.
+  static const InitParamsXDL initParametersF64[nInitParametersF64];
 
   // if can't select config from above , use this config to do
   // padding kernel for example , GEMMK/block is 16 , if your gemmK is  13 , we
   // add more 3 gemmk.
   static const InitParams universalParameters;
 
+  // Configurations whose estimated register usage leaves fewer waves per
+  // SIMD than this are rejected. Spilling ones always are.
+  int64_t minWavesPerSimd;
+
+  // LDS buffers the main loop is pipelined over; each holds the A and B
+  // block tiles.
+  int64_t ldsStages;
+
+  // Default configs the cost model ranks best that are passed over, because
+  // they spilled to scratch when compiled.
+  int64_t skipHeuristicConfigs;
+
   int64_t obtainBlockSize(const InitParamsXDL &params, int64_t waveSize);
 
-  LogicalResult getKBlocks(ConvolutionContext &ctx, const InitParamsXDL &params,
-                           int64_t &gemmKBlocks);
+  // LDS buffers the main loop of `params` is pipelined over.
+  int64_t getLdsStages(const InitParamsXDL &params) const {
+    return params.ldsStages > 0 ? params.ldsStages : ldsStages;
+  }
+
+  LogicalResult getKBlocks(const ConvolutionContext &ctx,
+                           const InitParamsXDL &params, int64_t &gemmKBlocks);
 
   LogicalResult
   calculateGemmABlockCopyPerformanceParameters(const InitParamsXDL &param,
-                                               ConvolutionContext &ctx,
+                                               const ConvolutionContext &ctx,
                                                DerivedParams &derived);
   LogicalResult
   calculateGemmBBlockCopyPerformanceParameters(const InitParamsXDL &param,
-                                               ConvolutionContext &ctx,
+                                               const ConvolutionContext &ctx,
                                                DerivedParams &derived);
 
   LogicalResult calculateLdsNumberOfByte(const InitParamsXDL &param,
@@ -231,39 +344,218 @@ private:
                                          size_t &ldsSize);
 
   LogicalResult isValidBlockwiseGemmXDLOPS(const InitParamsXDL &param,
-                                           ConvolutionContext &ctx,
+                                           const ConvolutionContext &ctx,
                                            int64_t blockSize);
 
-  LogicalResult
-  populateDerived(ConvolutionContext &ctx, const InitParamsXDL &validParams,
-                  GemmSize &gemmSize, DerivedParams &gemmADerivedParam,
-                  DerivedParams &gemmBDerivedParam,
-                  DerivedOutParams &gemmCDerivedParam, int64_t &blockSize,
-                  int64_t &gridSize, int64_t &gemmKBlocks);
+  // Cheap resource checks that need no derived parameters: a lower bound on
+  // the LDS the block tiles take and an estimate of the accumulator and copy
+  // buffer registers of a thread. Run before the block copies are derived so
+  // hopeless candidates are rejected early.
+  LogicalResult isFeasibleXDLOPS(const InitParamsXDL &param,
+                                 const ConvolutionContext &ctx,
+                                 int64_t blockSize);
+
+  LogicalResult populateDerived(const ConvolutionContext &ctx,
+                                const InitParamsXDL &validParams,
+                                GemmSize &gemmSize,
+                                DerivedParams &gemmADerivedParam,
+                                DerivedParams &gemmBDerivedParam,
+                                DerivedOutParams &gemmCDerivedParam,
+                                int64_t &blockSize, int64_t &gridSize,
+                                int64_t &gemmKBlocks);
 
   LogicalResult populatePaddingKernelDerived(
-      ConvolutionContext &ctx, const InitParamsXDL &validParams,
+      const ConvolutionContext &ctx, const InitParamsXDL &validParams,
       GemmSize &gemmSize, DerivedParams &gemmADerivedParam,
       DerivedParams &gemmBDerivedParam, DerivedOutParams &gemmCDerivedParam,
       int64_t &blockSize, int64_t &gridSize);
 
-  LogicalResult isValidGridGemmXdlops(GemmSize &gemmSize);
+  LogicalResult isValidGridGemmXdlops(const ConvolutionContext &ctx,
+                                      GemmSize &gemmSize);
+
+  // Borrow the parameters tuned for the closest perf db neighbor of `ctx`,
+  // a problem differing only in batch or image size, shrinking the tile when
+  // it no longer divides `gemmSize`.
+  LogicalResult loadNeighborFromPerfDb(const ConvolutionContext &ctx,
+                                       const GemmSize &gemmSize,
+                                       const std::string &solverId,
+                                       InitParamsXDL &validParams);
+
+  // Estimate the efficiency, in (0, 1], of a candidate that populateDerived()
+  // accepted, so candidates can be ranked when the perf db has no entry.
+  // `gemmSize` is the gemm before padding, so that candidates which only fit
+  // it once padded are charged for the padded part of their tiles. Fails,
+  // rejecting the candidate, when the chip has no XDLOPS instruction for its
+  // wave tile.
+  FailureOr<double> estimateEfficiency(const ConvolutionContext &ctx,
+                                       const InitParamsXDL &params,
+                                       const GemmSize &gemmSize,
+                                       const DerivedParams &gemmADerivedParam,
+                                       const DerivedParams &gemmBDerivedParam,
+                                       int64_t blockSize, int64_t gridSize);
+
+  TuningSource tuningSource = TuningSource::Heuristic;
 
 public:
-  LogicalResult obtainTuningParameters(
-      Operation *op, int64_t blockSizeOverride, const std::string &perfConfig,
-      InitParamsXDL &validParams, DerivedParams &gemmADerivedParam,
-      DerivedParams &gemmBDerivedParam, DerivedOutParams &gemmCDerivedParam,
-      int64_t &blockSize, int64_t &gridSize, int64_t &gemmKBlocks);
+  explicit PopulateParamsXDL(int64_t minWavesPerSimd = 1,
+                             int64_t ldsStages = 1,
+                             int64_t skipHeuristicConfigs = 0)
+      : minWavesPerSimd(minWavesPerSimd), ldsStages(ldsStages),
+        skipHeuristicConfigs(skipHeuristicConfigs) {}
 
-  llvm::ArrayRef<InitParamsXDL> getTuningParameters(ConvOpType dir,
-                                                    Type dataType) const;
+  LogicalResult obtainTuningParameters(
+      const ConvolutionContext &ctx, int64_t blockSizeOverride,
+      const std::string &perfConfig, InitParamsXDL &validParams,
+      DerivedParams &gemmADerivedParam, DerivedParams &gemmBDerivedParam,
+      DerivedOutParams &gemmCDerivedParam, int64_t &blockSize,
+      int64_t &gridSize, int64_t &gemmKBlocks);
+
+  // The workgroups of the problem of `ctx` with the given parameters that can
+  // be resident on the GPU at once, num_cu times the occupancy of a CU, which
+  // is the grid of its persistent kernels.
+  int64_t obtainResidentGridSize(const ConvolutionContext &ctx,
+                                 const InitParamsXDL &params,
+                                 const DerivedParams &gemmADerivedParam,
+                                 const DerivedParams &gemmBDerivedParam,
+                                 int64_t blockSize);
+
+  // Where the parameters of the last obtainTuningParameters() came from.
+  TuningSource getTuningSource() const { return tuningSource; }
+
+  llvm::ArrayRef<InitParamsXDL>
+  getTuningParameters(ConvOpType dir, Type dataType, bool isGemm = false,
+                      StringRef arch = "",
+                      Optional<Fp8Format> fp8Format = None,
+                      bool xf32 = false, bool sparse = false) const;
+
+  // The points of the exhaustive tuning space that are valid for `op`. Each
+  // of them is a valid perf_config.
+  TuningSpace<InitParamsXDL> getTuningSpace(Operation *op) const;
+
+  // The `limit` points of the tuning space of `op` that the cost model ranks
+  // highest, best first.
+  std::vector<InitParamsXDL> rankTuningSpace(Operation *op, size_t limit);
   const InitParams &getUniversalParameters() const;
 
   LogicalResult isValidGemm(const InitParamsXDL &param,
                             GemmSize &gemmSize) const;
+
+  friend class TuningSpace<InitParamsXDL>;
 };
 
+/// Forward range over the exhaustive tuning space of one convolution. Points
+/// are decoded from a mixed-radix index over the parameter ranges and checked
+/// in stages, cheapest first, so only configs that populateDerived() accepts
+/// are visited and most of the space is rejected before any derived
+/// parameter is computed.
+template <typename Params> class TuningSpace {
+public:
+  class iterator
+      : public llvm::iterator_facade_base<iterator, std::forward_iterator_tag,
+                                          const Params> {
+  public:
+    iterator(const TuningSpace *space, size_t index)
+        : space(space), index(index) {
+      settle();
+    }
+    bool operator==(const iterator &other) const {
+      return index == other.index;
+    }
+    const Params &operator*() const { return current; }
+    iterator &operator++() {
+      ++index;
+      settle();
+      return *this;
+    }
+
+  private:
+    // Advance to the first valid point at or after `index`.
+    void settle() {
+      while (index < space->rawSize() && !space->accept(index, current))
+        ++index;
+    }
+
+    const TuningSpace *space;
+    size_t index;
+    Params current;
+  };
+
+  explicit TuningSpace(Operation *op);
+
+  iterator begin() const { return iterator(this, 0); }
+  iterator end() const { return iterator(this, rawSize()); }
+
+  /// Number of points in the unpruned space.
+  size_t rawSize() const;
+
+private:
+  /// Decode point `index` into `params` and check it.
+  bool accept(size_t index, Params &params) const;
+
+  std::shared_ptr<ConvolutionContext> ctx;
+  GemmSize gemmSize;
+};
+
+template <>
+TuningSpace<InitParamsNonXDL>::TuningSpace(Operation *op);
+template <> size_t TuningSpace<InitParamsNonXDL>::rawSize() const;
+template <>
+bool TuningSpace<InitParamsNonXDL>::accept(size_t index,
+                                           InitParamsNonXDL &params) const;
+template <> TuningSpace<InitParamsXDL>::TuningSpace(Operation *op);
+template <> size_t TuningSpace<InitParamsXDL>::rawSize() const;
+template <>
+bool TuningSpace<InitParamsXDL>::accept(size_t index,
+                                        InitParamsXDL &params) const;
+
+// Look up the perf db records of all `convOps`, whose contexts `getContext`
+// gives, with one batched query so that the obtainTuningParameters() calls
+// that follow are served from the perf db cache. Does nothing when SQLite
+// support is disabled.
+void preloadTuningParameters(
+    ArrayRef<Operation *> convOps,
+    llvm::function_ref<const ConvolutionContext &(Operation *)> getContext);
+
+// The perf db solver whose entries hold the tuning parameters of `op`.
+// Kernels built in a mode that changes their code, such as split-K, have a
+// solver of their own. The kernels of a strided backward data convolution,
+// each computing some of its GEMMs, have entries of their own, which lookups
+// prefer to the ones shared by all the kernels of their solver.
+std::string getPerfDbSolverId(Operation *op);
+
+// A string that changes whenever a perf db of this build changes, from the
+// size and modification time of each, for keying results that depend on the
+// tuning parameters.
+std::string getPerfDbVersion();
+
+// Name of `source` in the tuning_source attribute of a kernel.
+StringRef getTuningSourceName(TuningSource source);
+
+// Process-wide count of the kernels whose parameters came from each source.
+// Safe to call concurrently.
+void recordTuningSource(TuningSource source);
+uint64_t getTuningSourceCount(TuningSource source);
+void resetTuningSourceCounts();
+
+// Record `perfConfig` as the tuned parameters of `op` in the user perf db at
+// `dbPath`, using the schema SQLitePerfDb reads, with the time measured for
+// it in milliseconds, if any, by which merged perf dbs pick their entries.
+// Fails when SQLite support is disabled, the perf_config does not parse, or
+// the db cannot be written.
+LogicalResult storeTuningParameters(StringRef dbPath, Operation *op,
+                                    StringRef perfConfig,
+                                    Optional<double> timeMs = llvm::None);
+
+// The perf_config stored for `op` in the user perf db at `dbPath`, if any,
+// from the entries of its own first.
+// Always None when SQLite support is disabled.
+Optional<std::string> lookupTuningParameters(StringRef dbPath, Operation *op);
+
+// The perf_configs of the `limit` candidates most likely to be fastest for
+// `op`, best first: ranked by the cost model for XDLOPS, in the order of the
+// default configs otherwise.
+std::vector<std::string> getRankedPerfConfigs(Operation *op, size_t limit);
+
 // The function is used to compute extra padding sizes.
 // For example, if gemmM size is 3 and gemmMPerBlock is 64,
 // we set gemmMExtra be 64 so (gemmM+gemmMExtra)%gemmMPerBlock=0.
@@ -271,15 +563,23 @@ public:
 // If padding is needed, returns a GemmContext containing the number of elements
 // needed to pad the M, N, and K dimensions (**not** the new gemm size).
 // Otherwise, returns None
+//
+// Tuning may tile a padded gemm with any config, so the padding is to the
+// m/n/k_per_block tiles affixed to `tiledOp` when it is given. The universal
+// parameters stand in for the tiles `tiledOp` doesn't have, or for all of
+// them without `tiledOp`, which only matters when asking whether padding
+// is needed.
 template <typename T>
-Optional<GemmContext> calculatePaddingKernelSize(GemmContext gemmSize,
-                                                 ConvOpType dir, Type dataType,
-                                                 T populateParams) {
+Optional<GemmContext>
+calculatePaddingKernelSize(GemmContext gemmSize, ConvOpType dir, Type dataType,
+                           T populateParams, bool isGemm = false,
+                           Operation *tiledOp = nullptr) {
   bool needExtraPad = false;
   int64_t gemmMExtra, gemmNExtra, gemmKExtra;
   gemmMExtra = gemmNExtra = gemmKExtra = 0;
 
-  auto configParams = populateParams.getTuningParameters(dir, dataType);
+  auto configParams =
+      populateParams.getTuningParameters(dir, dataType, isGemm);
   size_t numOfFailedConfigs = 0;
   for (auto &params : configParams) {
     if (gemmSize.m % params.gemmMPerBlock == 0 &&
@@ -290,7 +590,15 @@ Optional<GemmContext> calculatePaddingKernelSize(GemmContext gemmSize,
     numOfFailedConfigs++;
   }
 
-  auto extraParams = populateParams.getUniversalParameters();
+  InitParams extraParams = populateParams.getUniversalParameters();
+  if (tiledOp) {
+    if (auto mPerBlock = tiledOp->getAttrOfType<IntegerAttr>("m_per_block"))
+      extraParams.gemmMPerBlock = mPerBlock.getInt();
+    if (auto nPerBlock = tiledOp->getAttrOfType<IntegerAttr>("n_per_block"))
+      extraParams.gemmNPerBlock = nPerBlock.getInt();
+    if (auto kPerBlock = tiledOp->getAttrOfType<IntegerAttr>("k_per_block"))
+      extraParams.gemmKPerBlock = kPerBlock.getInt();
+  }
   if (numOfFailedConfigs == configParams.size()) {
     needExtraPad = true;
     int64_t gemmMRemain, gemmKRemain, gemmNRemain;
@@ -0,0 +1,56 @@
+//===- RegisterPressure.h - MLIR register pressure estimate -----*- C++ -*-===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file estimates the per-thread registers of an XDLOPS gridwise gemm
+// from its tuning parameters. The estimate follows the buffers that the
+// gridwise gemm V2 lowering allocates, so configurations that would spill or
+// run at too low an occupancy can be rejected before the kernel is lowered
+// and serialized.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_DIALECT_MIOPEN_REGISTERPRESSURE_H
+#define MLIR_DIALECT_MIOPEN_REGISTERPRESSURE_H
+
+#include "mlir/Support/LogicalResult.h"
+
+#include <cstdint>
+
+namespace mlir {
+namespace miopen {
+struct ConvolutionContext;
+struct InitParamsXDL;
+
+/// 32-bit registers a thread of an XDLOPS gridwise gemm keeps live in its
+/// main loop.
+struct RegisterUsage {
+  /// Architectural VGPRs: blockwise copy buffers, the XDLOPS A and B operand
+  /// arrays and a fixed reserve for addresses and loop state.
+  int64_t vgprs = 0;
+  /// Accumulation registers holding the C tile of the thread.
+  int64_t agprs = 0;
+
+  /// Bytes of private memory a thread needs for the registers that do not
+  /// fit in the register files.
+  int64_t spilledBytes() const;
+
+  /// Waves that fit on one SIMD at once.
+  int64_t wavesPerSimd() const;
+};
+
+/// Estimate the registers of the gridwise gemm of `ctx` lowered from
+/// `params`, running with `blockSize` threads per block. Fails when the chip
+/// of `ctx` has no XDLOPS instruction for the wave tile of `params`.
+FailureOr<RegisterUsage> estimateRegisterUsage(const InitParamsXDL &params,
+                                               const ConvolutionContext &ctx,
+                                               int64_t blockSize);
+
+} // namespace miopen
+} // namespace mlir
+
+#endif // MLIR_DIALECT_MIOPEN_REGISTERPRESSURE_H
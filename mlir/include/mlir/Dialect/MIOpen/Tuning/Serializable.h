@@ -110,6 +110,21 @@ template <class Derived> struct SQLiteSerializable {
     std::string clause = joinStrings(clauses, " AND ");
     return clause;
   }
+  // Field values in visit order with SQL string quotes stripped, suitable for
+  // binding to the parameters of a prepared statement.
+  std::vector<std::string> fieldValues() const {
+    std::vector<std::string> values;
+    Derived::visit(static_cast<const Derived &>(*this),
+                   [&](const std::string &value, const std::string &name) {
+                     std::ignore = name;
+                     if (value.size() >= 2 && value.front() == '\'' &&
+                         value.back() == '\'')
+                       values.push_back(value.substr(1, value.size() - 2));
+                     else
+                       values.push_back(value);
+                   });
+    return values;
+  }
 };
 
 #endif // MLIR_DIALECT_MIOPEN_SERIALIZABLE_H
@@ -17,11 +17,19 @@
 
 #include "sqlite3.h"
 #include "llvm/ADT/Any.h"
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/Optional.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/RWMutex.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <memory>
 #include <numeric>
+#include <sstream>
 #include <unordered_map>
 #include <vector>
 
@@ -47,41 +55,51 @@ public:
   int retry(std::function<int()>) const;
   static int retry(std::function<int()> f, std::string filename);
   std::string errorMessage() const;
-};
-
-class DbRecord {
-#define DEBUG_TYPE "miopen-sqlite-dbrecord"
 
-public:
-  bool getValues(const std::string &id, std::string &values) const;
-  bool setValues(const std::string &id, const std::string &values);
-  auto getSize() const { return map.size(); }
-
-  /// Get VALUES associated with ID under the current KEY and delivers those to
-  /// a member function of a class T object. T shall have the "bool
-  /// deserialize(const std::string& str)" member function available.
-  ///
-  /// Returns false if there is none ID:VALUES in the record or in case of any
-  /// error, e.g. if VALUES cannot be deserialized due to incorrect format.
-  template <class T> bool getValues(const std::string &id, T &values) const {
-    std::string s;
-    if (!getValues(id, s))
-      return false;
+  /// A prepared statement owned by this connection. Statements are parsed and
+  /// planned once, then reset and rebound for every execution.
+  class Statement {
+  public:
+    Statement() : stmt(nullptr) {}
+    Statement(const SQLite &db, const std::string &query);
+    ~Statement();
+    Statement(Statement &&) noexcept;
+    Statement &operator=(Statement &&) noexcept;
+    Statement(const Statement &) = delete;
+    Statement &operator=(const Statement &) = delete;
 
-    const bool ok = values.deserialize(s);
-    if (!ok)
+    bool valid() const { return stmt != nullptr; }
+    /// Bind `value` as text to the 1-based parameter `index`.
+    bool bind(int index, const std::string &value);
+    /// Advance to the next row. Returns SQLITE_ROW, SQLITE_DONE or an error.
+    int step();
+    /// Reset the statement and clear its bindings so it can be reused.
+    void reset();
+    llvm::StringRef getColumnText(int column) const;
+    int64_t getColumnInt(int column) const;
 
-      LLVM_DEBUG(llvm::dbgs() << "Perf db record is obsolete or corrupt: " << s
-                              << ". Performance may degrade.\n");
-    return ok;
-  }
+  private:
+    sqlite3_stmt *stmt;
+  };
 
-private:
-  std::string key;
-  std::unordered_map<std::string, std::string> map;
+  Statement prepare(const std::string &query) const;
+  /// Maximum number of parameters a single statement may bind.
+  int maxVariables() const;
+};
 
+#define DEBUG_TYPE "miopen-sqlite-perfdb"
+/// Deserialize the params of a perf db record into `values`, which shall have
+/// a "bool deserialize(const std::string &str)" member function. Returns false
+/// if the params are in an obsolete or corrupt format.
+template <class V>
+bool deserializeRecord(llvm::StringRef params, V &values) {
+  if (values.deserialize(params.str()))
+    return true;
+  LLVM_DEBUG(llvm::dbgs() << "Perf db record is obsolete or corrupt: "
+                          << params << ". Performance may degrade.\n");
+  return false;
+}
 #undef DEBUG_TYPE
-};
 
 template <class Vector, class T> void printVector(Vector v) {
   std::for_each(v.begin(), v.end(),
@@ -102,54 +120,225 @@ public:
   SQLitePerfDb(const std::string &filename_, bool is_system,
                const std::string &arch_, std::size_t num_cu_);
 
+  /// Column names and values of one problem, as visited by
+  /// SQLiteSerializable.
+  struct ProblemFields {
+    std::vector<std::string> names;
+    std::vector<std::string> values;
+  };
+
+  /// Invoked for every (solver, params) row found by findRecords, together
+  /// with the index of the problem the row belongs to.
+  using RowCallback = llvm::function_ref<void(
+      size_t problem, llvm::StringRef solver, llvm::StringRef params)>;
+
+  /// Look up the records of all `problems` with as few prepared queries as the
+  /// SQLite parameter limit allows. When `solverId` is non-empty, only rows of
+  /// that solver are reported.
   template <typename T>
-  inline llvm::Optional<DbRecord> findRecord(const T &problemConfig) {
+  void findRecords(llvm::ArrayRef<T> problems, llvm::StringRef solverId,
+                   RowCallback callback) {
+    if (dbInvalid || problems.empty())
+      return;
+    std::vector<ProblemFields> fields;
+    fields.reserve(problems.size());
+    for (const T &problem : problems)
+      fields.push_back({problem.fieldNames(), problem.fieldValues()});
+    findRecordsImpl(T::tableName(), fields, solverId, callback);
+  }
+
+  /// Deserialize the `id` entry of `problemConfig`, if any, directly into
+  /// `values`.
+  template <class T, class V>
+  inline bool load(const T &problemConfig, const std::string &id, V &values) {
+    bool found = false;
+    findRecords(llvm::makeArrayRef(problemConfig), id,
+                [&](size_t, llvm::StringRef, llvm::StringRef params) {
+                  found = found || deserializeRecord(params, values);
+                });
+    return found;
+  }
+
+  /// Invoked for every row found by findNeighbors with the values of the free
+  /// columns, in the order they were requested, and the params.
+  using NeighborCallback =
+      llvm::function_ref<void(llvm::ArrayRef<std::string> freeValues,
+                              llvm::StringRef params)>;
+
+  /// Look up the `solverId` records of the problems that match
+  /// `problemConfig` on every column except `freeColumns`.
+  template <typename T>
+  void findNeighbors(const T &problemConfig, llvm::StringRef solverId,
+                     llvm::ArrayRef<std::string> freeColumns,
+                     NeighborCallback callback) {
     if (dbInvalid)
-      return {};
-
-    std::string query = problemConfig.queryClause();
-    // clang-format off
-    auto select_query =
-        "SELECT solver, params "
-        "FROM perf_db "
-        "INNER JOIN " + problemConfig.tableName() + " "
-        "ON perf_db.config = " + problemConfig.tableName() +".id "
-        "WHERE "
-        "( " + query + " )"
-        "AND (arch = '" + arch + "' ) "
-        "AND (num_cu = '" + std::to_string(num_cu) + "');";
-      LLVM_DEBUG(llvm::dbgs() << "SQLite Query: " << select_query << "\n");
-      
-      SQLite::ResultType execRes = sql.exec(select_query);
-      DbRecord rec;
-      std::for_each(execRes.begin(), execRes.end(), 
-              [&rec, &execRes](auto row){
-              rec.setValues(row["solver"], row["params"]);
-              if (row == execRes.back()) LLVM_DEBUG(llvm::dbgs() << "\n");
-              });
-
-      if (rec.getSize() == 0)
-        return {};
-      else
-        return llvm::Optional<DbRecord>(rec);
-    }
-
-    template <class T, class V>
-    inline bool load(const T& problemConfig, const std::string& id, V& values)
-    {
-        if(dbInvalid)
-            return false;
-        const auto record = findRecord(problemConfig);
-
-        if(!record)
-            return false;
-        return record->getValues(id, values);
-    }
+      return;
+    findNeighborsImpl(T::tableName(),
+                      {problemConfig.fieldNames(), problemConfig.fieldValues()},
+                      solverId, freeColumns, callback);
+  }
+
+  /// The num_cu values the records of `arch` were tuned for.
+  std::vector<size_t> getNumCus();
+
+  /// Record `values` as the `id` entry of `problemConfig`, replacing any
+  /// previous entry, together with the time measured for them, if any, in
+  /// milliseconds, which mergeSQLitePerfDbs picks the best entries by. The
+  /// config, perf_db and perf_db_time tables are created on first use, so
+  /// this requires a user (writable) database.
+  template <class T, class V>
+  inline bool store(const T &problemConfig, const std::string &id,
+                    const V &values,
+                    llvm::Optional<double> timeMs = llvm::None) {
+    if (dbInvalid)
+      return false;
+    ProblemFields fields{problemConfig.fieldNames(),
+                         problemConfig.fieldValues()};
+    // String columns are the ones visit() quotes.
+    std::vector<bool> isText;
+    T::visit(problemConfig,
+             [&](const std::string &value, const std::string &name) {
+               std::ignore = name;
+               isText.push_back(!value.empty() && value.front() == '\'');
+             });
+    std::ostringstream params;
+    values.serialize(params);
+    return storeImpl(T::tableName(), fields, isText, id, params.str(),
+                     timeMs);
+  }
+
+private:
+  void findRecordsImpl(const std::string &tableName,
+                       llvm::ArrayRef<ProblemFields> problems,
+                       llvm::StringRef solverId, RowCallback callback);
+  void findNeighborsImpl(const std::string &tableName,
+                         const ProblemFields &problem,
+                         llvm::StringRef solverId,
+                         llvm::ArrayRef<std::string> freeColumns,
+                         NeighborCallback callback);
+  bool storeImpl(const std::string &tableName, const ProblemFields &problem,
+                 llvm::ArrayRef<bool> isText, const std::string &solverId,
+                 const std::string &params, llvm::Optional<double> timeMs);
+  SQLite::Statement &getStatement(const std::string &query);
+
+  /// Prepared statements, keyed on their query text.
+  llvm::StringMap<SQLite::Statement> statements;
 
 #undef DEBUG_TYPE
 };
 
 SQLitePerfDb getDb(const llvm::SmallString<8> &arch, size_t num_cu);
+
+/// Process-wide cache in front of SQLitePerfDb. A database connection is
+/// opened once per (arch, num_cu) pair and the params found for each problem
+/// and solver are memoized, deserialized, including misses, so repeated
+/// lookups never touch SQLite. Lookups may be issued concurrently from
+/// several compiler threads.
+class SQLitePerfDbCache {
+public:
+  static SQLitePerfDbCache &instance();
+
+  /// Same contract as SQLitePerfDb::load, but served from the cache.
+  template <class T, class V>
+  bool load(const llvm::SmallString<8> &arch, size_t num_cu,
+            const T &problemConfig, const std::string &id, V &values) {
+    std::string problemKey =
+        problemConfig.tableName() + ":" + problemConfig.queryClause();
+    llvm::Optional<llvm::Any> record = lookup(
+        arch, num_cu, problemKey, id,
+        [&](SQLitePerfDb &db) -> llvm::Optional<llvm::Any> {
+          V found;
+          if (!db.load(problemConfig, id, found))
+            return llvm::None;
+          return llvm::Any(found);
+        });
+    const V *cached = record ? llvm::any_cast<V>(&*record) : nullptr;
+    if (!cached)
+      return false;
+    values = *cached;
+    return true;
+  }
+
+  /// Resolve the entries of all `problems` with one batched lookup so later
+  /// load() calls for them are cache hits. Only the entries of the solvers
+  /// solverIds[i] lists for problems[i] are kept, deserialized as `V`.
+  template <class T, class V>
+  void preload(const llvm::SmallString<8> &arch, size_t num_cu,
+               llvm::ArrayRef<T> problems,
+               llvm::ArrayRef<std::vector<std::string>> solverIds) {
+    assert(problems.size() == solverIds.size() && "solvers of each problem");
+    std::vector<std::string> problemKeys;
+    problemKeys.reserve(problems.size());
+    for (const T &problem : problems)
+      problemKeys.push_back(problem.tableName() + ":" + problem.queryClause());
+    fill(arch, num_cu, problemKeys, solverIds,
+         [&](SQLitePerfDb &db, llvm::ArrayRef<size_t> missing,
+             RecordCallback found) {
+           std::vector<T> pending;
+           pending.reserve(missing.size());
+           for (size_t i : missing)
+             pending.push_back(problems[i]);
+           db.findRecords(llvm::makeArrayRef(pending), "",
+                          [&](size_t problem, llvm::StringRef solver,
+                              llvm::StringRef params) {
+                            V values;
+                            if (deserializeRecord(params, values))
+                              found(problem, solver, llvm::Any(values));
+                          });
+         });
+  }
+
+  /// Same contract as SQLitePerfDb::findNeighbors, on the cached connection.
+  /// Neighbors are only consulted after a miss, so they are not memoized.
+  template <class T>
+  void findNeighbors(const llvm::SmallString<8> &arch, size_t num_cu,
+                     const T &problemConfig, llvm::StringRef solverId,
+                     llvm::ArrayRef<std::string> freeColumns,
+                     SQLitePerfDb::NeighborCallback callback) {
+    withDatabase(arch, num_cu, [&](SQLitePerfDb &db) {
+      db.findNeighbors(problemConfig, solverId, freeColumns, callback);
+    });
+  }
+
+  /// Same as SQLitePerfDb::getNumCus for `arch`, memoized.
+  std::vector<size_t> getNumCus(const llvm::SmallString<8> &arch);
+
+  /// Drop all cached records and close the cached connections.
+  void clear();
+
+private:
+  using RecordFinder =
+      llvm::function_ref<llvm::Optional<llvm::Any>(SQLitePerfDb &)>;
+
+  /// Invoked with the index of a problem among the missing ones, a solver
+  /// and the params found for them.
+  using RecordCallback = llvm::function_ref<void(
+      size_t problem, llvm::StringRef solver, llvm::Any params)>;
+
+  using BatchFinder = llvm::function_ref<void(
+      SQLitePerfDb &, llvm::ArrayRef<size_t>, RecordCallback)>;
+
+  llvm::Optional<llvm::Any> lookup(const llvm::SmallString<8> &arch,
+                                   size_t num_cu,
+                                   const std::string &problemKey,
+                                   const std::string &solverId,
+                                   RecordFinder finder);
+  void fill(const llvm::SmallString<8> &arch, size_t num_cu,
+            llvm::ArrayRef<std::string> problemKeys,
+            llvm::ArrayRef<std::vector<std::string>> solverIds,
+            BatchFinder finder);
+  void withDatabase(const llvm::SmallString<8> &arch, size_t num_cu,
+                    llvm::function_ref<void(SQLitePerfDb &)> fn);
+  /// Must be called with `mutex` held for writing.
+  SQLitePerfDb &getDatabase(const std::string &dbKey,
+                            const llvm::SmallString<8> &arch, size_t num_cu);
+
+  llvm::sys::SmartRWMutex<true> mutex;
+  llvm::StringMap<std::unique_ptr<SQLitePerfDb>> databases;
+  /// Deserialized params, keyed on the database, problem and solver.
+  llvm::StringMap<llvm::Optional<llvm::Any>> records;
+  llvm::StringMap<std::vector<size_t>> numCus;
+};
 } // namespace MLIR
 
 #endif // MLIR_ENABLE_SQLITE
@@ -23,6 +23,50 @@ constexpr int64_t kUtilityKernelBlockSize = 64;
 /// Default number of elements each utility kernel workitem should handle.
 constexpr int64_t kUtilityKernelElemsPerThread = 512;
 
+/// Block size for direct grouped convolution kernels.
+constexpr int64_t kDirectConvBlockSize = 256;
+/// Number of consecutive output pixels of a row each direct grouped
+/// convolution workitem computes.
+constexpr int64_t kDirectConvWoPerThread = 4;
+/// Grouped convolutions with at most this many input and output channels per
+/// group are lowered to a direct convolution instead of an implicit GEMM.
+constexpr int64_t kDirectConvMaxChannelsPerGroup = 4;
+
+/// Block size for skinny gemm kernels, each of whose waves computes one row
+/// of the long side of the output.
+constexpr int64_t kSkinnyGemmBlockSize = 256;
+/// Gemms with at most this many rows or columns are lowered to a skinny gemm
+/// instead of a gridwise gemm.
+constexpr int64_t kSkinnyGemmMaxN = 4;
+
+/// XDLOPS gemms whose M, N and K are all at most this size load their
+/// operands straight into registers instead of staging them in LDS.
+constexpr int64_t kRegisterGemmMaxSize = 64;
+
+/// Block size for the kernels of Winograd convolutions.
+constexpr int64_t kWinogradBlockSize = 256;
+
+/// Block size for layer normalization kernels, whose workgroups each
+/// normalize one row. It must be a power of 2 for their LDS reductions.
+constexpr int64_t kLayerNormBlockSize = 256;
+
+/// Largest block size for kernels made only of linalg generics, which
+/// miopen-linalg-to-gpu shrinks down to kElementwiseMinBlockSize, a wave,
+/// for small tensors.
+constexpr int64_t kElementwiseBlockSize = 256;
+constexpr int64_t kElementwiseMinBlockSize = 64;
+/// Most workgroups per CU the grid-stride loops of those kernels launch.
+constexpr int64_t kElementwiseMaxBlocksPerCu = 8;
+/// Most consecutive points a workitem of those kernels computes at a time.
+constexpr int64_t kElementwiseMaxVectorLen = 8;
+
+/// Side of the square tiles transposing copies go through LDS in, the block
+/// size of their kernels, and the fewest rows and cols of the 2D transposes
+/// they reduce to worth a tile, below which the elementwise loops are used.
+constexpr int64_t kTransposeTileSize = 32;
+constexpr int64_t kTransposeBlockSize = 256;
+constexpr int64_t kTransposeMinTileExtent = 4;
+
 } // end namespace miopen
 } // end namespace mlir
 #endif // MLIR_DIALECT_MIOPEN_UTILITY_PARAMS_H
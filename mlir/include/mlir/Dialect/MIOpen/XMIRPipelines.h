@@ -37,6 +37,49 @@ struct RunnerOptions : public PassPipelineOptions<RunnerOptions> {
 
   PassOptions::Option<bool> cpuOnly{
       *this, "cpu-only", desc("Generate CPU-only code "), init(false)};
+
+  PassOptions::Option<bool> parallelCPULoops{
+      *this, "parallel-cpu-loops",
+      desc("Run the parallel loops of CPU-only code on the async runtime's "
+           "worker threads"),
+      init(false)};
+
+  PassOptions::Option<bool> optimizeCPULoops{
+      *this, "optimize-cpu-loops",
+      desc("Tile the loop nests of CPU-only code for the cache and vectorize "
+           "their innermost loops"),
+      init(false)};
+
+  PassOptions::Option<unsigned> cpuCacheSize{
+      *this, "cpu-cache-size",
+      desc("KiB of cache the tiles of CPU-only loop nests are sized for"),
+      init(512)};
+
+  PassOptions::Option<unsigned> cpuVectorWidth{
+      *this, "cpu-vector-width",
+      desc("Elements of the vectors the innermost CPU-only loops are "
+           "vectorized with"),
+      init(8)};
+
+  PassOptions::Option<unsigned> numStreams{
+      *this, "num-streams",
+      desc("Maximum number of streams the kernels of a function run on"),
+      init(4)};
+
+  PassOptions::Option<bool> graphCapture{
+      *this, "graph-capture",
+      desc("Run the kernels of each host function as one HIP graph"),
+      init(false)};
+
+  PassOptions::Option<bool> multiDevice{
+      *this, "multi-device",
+      desc("Run each host function call on the least busy capable GPU"),
+      init(false)};
+
+  PassOptions::Option<bool> runtimeContext{
+      *this, "runtime-context",
+      desc("Pass a runtime context handle into host entry points"),
+      init(false)};
 };
 
 /// Build the XMIR Runner Pipeline.
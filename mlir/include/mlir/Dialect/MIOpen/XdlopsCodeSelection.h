@@ -9,15 +9,33 @@
 //
 // This file implements code selection logic for XDLOPS instructions.
 //
+// The MFMA instructions of each chip are described by a table. A wave tile
+// (MPerWave x NPerWave) determines the shape of the instructions that can
+// cover it and how they are issued; among the instructions of that shape the
+// chip supports for the data type, the one with the highest throughput is
+// selected.
+//
+// The fp8 and bf8 MFMAs of gfx940 are selected for i8 data given the 8-bit
+// float format its bytes hold, and its xf32 MFMAs, which round their f32
+// inputs to 19 bits for twice the throughput, for f32 data when asked for.
+// Its sparse MFMAs (smfmac), which skip the zeros of a 2:4 structured-sparse
+// A, are selected for f16, bf16 and i8 data the same way.
+//
+// gfx11 chips have WMMA instead, which compute 16x16x16 tiles in wave32 and
+// are selected the same way from their own table; the fields below describe
+// them with the same layout terms.
+//
 //===----------------------------------------------------------------------===//
 
 #ifndef MLIR_XDLOPS_CODE_SELECTION_H
 #define MLIR_XDLOPS_CODE_SELECTION_H
 
 #include "mlir/Dialect/AMDGPU/AMDGPUDialect.h"
-#include "mlir/IR/Builders.h"
+#include "mlir/Dialect/MIOpen/MIOpen.h"
 #include "mlir/IR/BuiltinTypes.h"
-#include "llvm/Support/ErrorHandling.h"
+#include "mlir/Support/LogicalResult.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
 #include <cstdint>
 
 using namespace mlir;
@@ -27,6 +45,14 @@ using namespace mlir;
 //===----------------------------------------------------------------------===//
 struct XdlopsCodeSelection {
   amdgpu::MFMAInstr instr;
+  // The code is a WMMA rather than a MFMA, in which case `instr` and `imms`
+  // are unused.
+  bool isWmma;
+  // The code is a sparse MFMA, in which case `instr` is the dense MFMA of
+  // the same shape. Each lane passes `argType` of B, and the kept half of its
+  // values of A with their indices.
+  bool isSparse;
+  int64_t waveSize;
   int64_t MPerXdlops;
   int64_t NPerXdlops;
   int64_t MRepeats;
@@ -48,690 +74,26 @@ struct XdlopsCodeSelection {
   int64_t k;
   int64_t cycles;
   int64_t k_base;
+  // The input blocks hold different slices of K rather than copies of the
+  // same A and B values.
+  bool isKReduction;
 
-  static void dumpUnsupported(const mlir::Type &dataType, int64_t MPerWave,
-                              int64_t NPerWave) {
-    llvm::errs() << "Unsupported case:\n";
-    llvm::errs() << "MPerWave: " << MPerWave << "\n";
-    llvm::errs() << "NPerWave: " << NPerWave << "\n";
-    llvm::errs() << "dataType: ";
-    dataType.dump();
-    llvm::errs() << "\n";
-  }
-
-  static XdlopsCodeSelection get(mlir::Type &dataType, int64_t MPerWave,
-                                 int64_t NPerWave, OpBuilder &b) {
-    // Determine which XDLOPS be used.
-    int64_t MPerXdlops = 0, NPerXdlops = 0, MRepeats = 0, NRepeats = 0;
-    amdgpu::MFMAInstr instr;
-    VectorType vectorType;
-    int64_t vectorNumber;
-    SmallVector<SmallVector<unsigned, 3>, 2> imms;
-    Type argType;
-
-    if (dataType == b.getF32Type()) {
-      if (MPerWave == 128 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_32x32x1f32;
-        MPerXdlops = 64;
-        NPerXdlops = 64;
-        MRepeats = 2;
-        NRepeats = 1;
-        vectorType = VectorType::get({32}, b.getF32Type());
-        vectorNumber = 4;
-        imms.push_back({1, 0, 0});
-        imms.push_back({1, 1, 0});
-        imms.push_back({1, 0, 0});
-        imms.push_back({1, 1, 0});
-        argType = b.getF32Type();
-      } else if (MPerWave == 64 && NPerWave == 128) {
-        instr = amdgpu::MFMAInstr::f32_32x32x1f32;
-        MPerXdlops = 64;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 2;
-        vectorType = VectorType::get({32}, b.getF32Type());
-        vectorNumber = 4;
-        imms.push_back({1, 0, 0});
-        imms.push_back({1, 1, 0});
-        imms.push_back({1, 0, 0});
-        imms.push_back({1, 1, 0});
-        argType = b.getF32Type();
-      } else if (MPerWave == 64 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_32x32x1f32;
-        MPerXdlops = 64;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({32}, b.getF32Type());
-        vectorNumber = 2;
-        imms.push_back({1, 0, 0});
-        imms.push_back({1, 1, 0});
-        argType = b.getF32Type();
-      } else if (MPerWave == 64 && NPerWave == 32) {
-        instr = amdgpu::MFMAInstr::f32_32x32x1f32;
-        MPerXdlops = 64;
-        NPerXdlops = 32;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({32}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({0, 0, 1});
-        argType = b.getF32Type();
-      } else if (MPerWave == 32 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_32x32x1f32;
-        MPerXdlops = 32;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({32}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({1, 0, 0});
-        argType = b.getF32Type();
-      } else if (MPerWave == 64 && NPerWave == 16) {
-        instr = amdgpu::MFMAInstr::f32_16x16x1f32;
-        MPerXdlops = 64;
-        NPerXdlops = 16;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({16}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({0, 0, 4});
-        argType = b.getF32Type();
-      } else if (MPerWave == 16 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_16x16x1f32;
-        MPerXdlops = 16;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({16}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({2, 0, 0});
-        argType = b.getF32Type();
-      } else if (MPerWave == 8 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_4x4x1f32;
-        MPerXdlops = 8;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({4}, b.getF32Type());
-        vectorNumber = 2;
-        imms.push_back({4, 0, 0});
-        imms.push_back({4, 1, 0});
-        argType = b.getF32Type();
-      } else if (MPerWave == 4 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_4x4x1f32;
-        MPerXdlops = 4;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({4}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({4, 0, 0});
-        argType = b.getF32Type();
-      } else if (MPerWave == 32 && NPerWave == 32) {
-        instr = amdgpu::MFMAInstr::f32_32x32x2f32;
-        MPerXdlops = 32;
-        NPerXdlops = 32;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({16}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({0, 0, 0});
-        argType = b.getF32Type();
-      } else if (MPerWave == 16 && NPerWave == 16) {
-        instr = amdgpu::MFMAInstr::f32_16x16x4f32;
-        MPerXdlops = 16;
-        NPerXdlops = 16;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({4}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({0, 0, 0});
-        argType = b.getF32Type();
-      } else {
-        dumpUnsupported(dataType, MPerWave, NPerWave);
-        llvm_unreachable("Can't meaningfully continue xdlop generation");
-      }
-    } else if (dataType == b.getF16Type()) {
-      if (MPerWave == 128 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_32x32x4f16;
-        MPerXdlops = 64;
-        NPerXdlops = 64;
-        MRepeats = 2;
-        NRepeats = 1;
-        vectorType = VectorType::get({32}, b.getF32Type());
-        vectorNumber = 4;
-        imms.push_back({1, 0, 0});
-        imms.push_back({1, 1, 0});
-        imms.push_back({1, 0, 0});
-        imms.push_back({1, 1, 0});
-        argType = VectorType::get({4}, b.getF16Type());
-      } else if (MPerWave == 64 && NPerWave == 128) {
-        instr = amdgpu::MFMAInstr::f32_32x32x4f16;
-        MPerXdlops = 64;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 2;
-        vectorType = VectorType::get({32}, b.getF32Type());
-        vectorNumber = 4;
-        imms.push_back({1, 0, 0});
-        imms.push_back({1, 1, 0});
-        imms.push_back({1, 0, 0});
-        imms.push_back({1, 1, 0});
-        argType = VectorType::get({4}, b.getF16Type());
-      } else if (MPerWave == 64 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_32x32x4f16;
-        MPerXdlops = 64;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({32}, b.getF32Type());
-        vectorNumber = 2;
-        imms.push_back({1, 0, 0});
-        imms.push_back({1, 1, 0});
-        argType = VectorType::get({4}, b.getF16Type());
-      } else if (MPerWave == 64 && NPerWave == 32) {
-        instr = amdgpu::MFMAInstr::f32_32x32x4f16;
-        MPerXdlops = 64;
-        NPerXdlops = 32;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({32}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({0, 0, 1});
-        argType = VectorType::get({4}, b.getF16Type());
-      } else if (MPerWave == 64 && NPerWave == 16) {
-        instr = amdgpu::MFMAInstr::f32_16x16x4f16;
-        MPerXdlops = 64;
-        NPerXdlops = 16;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({16}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({0, 0, 4});
-        argType = VectorType::get({4}, b.getF16Type());
-      } else if (MPerWave == 16 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_16x16x4f16;
-        MPerXdlops = 16;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({16}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({2, 0, 0});
-        argType = VectorType::get({4}, b.getF16Type());
-      } else if (MPerWave == 8 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_4x4x4f16;
-        MPerXdlops = 8;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({4}, b.getF32Type());
-        vectorNumber = 2;
-        imms.push_back({4, 0, 0});
-        imms.push_back({4, 1, 0});
-        argType = VectorType::get({4}, b.getF16Type());
-      } else if (MPerWave == 4 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_4x4x4f16;
-        MPerXdlops = 4;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({4}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({4, 0, 0});
-        argType = VectorType::get({4}, b.getF16Type());
-      } else if (MPerWave == 32 && NPerWave == 32) {
-        instr = amdgpu::MFMAInstr::f32_32x32x8f16;
-        MPerXdlops = 32;
-        NPerXdlops = 32;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({16}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({0, 0, 0});
-        argType = VectorType::get({4}, b.getF16Type());
-      } else if (MPerWave == 32 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_32x32x4f16;
-        MPerXdlops = 32;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({32}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({1, 0, 0});
-        argType = VectorType::get({4}, b.getF16Type());
-      } else if (MPerWave == 16 && NPerWave == 16) {
-        instr = amdgpu::MFMAInstr::f32_16x16x16f16;
-        MPerXdlops = 16;
-        NPerXdlops = 16;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({4}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({0, 0, 0});
-        argType = VectorType::get({4}, b.getF16Type());
-      } else {
-        dumpUnsupported(dataType, MPerWave, NPerWave);
-        llvm_unreachable("Can't meaningfully continue xdlop generation");
-      }
-    } else if (dataType == b.getBF16Type()) {
-      if (MPerWave == 128 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_32x32x2bf16;
-        MPerXdlops = 64;
-        NPerXdlops = 64;
-        MRepeats = 2;
-        NRepeats = 1;
-        vectorType = VectorType::get({32}, b.getF32Type());
-        vectorNumber = 4;
-        imms.push_back({1, 0, 0});
-        imms.push_back({1, 1, 0});
-        imms.push_back({1, 0, 0});
-        imms.push_back({1, 1, 0});
-        argType = VectorType::get({2}, b.getBF16Type());
-      } else if (MPerWave == 64 && NPerWave == 128) {
-        instr = amdgpu::MFMAInstr::f32_32x32x2bf16;
-        MPerXdlops = 64;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 2;
-        vectorType = VectorType::get({32}, b.getF32Type());
-        vectorNumber = 4;
-        imms.push_back({1, 0, 0});
-        imms.push_back({1, 1, 0});
-        imms.push_back({1, 0, 0});
-        imms.push_back({1, 1, 0});
-        argType = VectorType::get({2}, b.getBF16Type());
-      } else if (MPerWave == 64 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_32x32x2bf16;
-        MPerXdlops = 64;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({32}, b.getF32Type());
-        vectorNumber = 2;
-        imms.push_back({1, 0, 0});
-        imms.push_back({1, 1, 0});
-        argType = VectorType::get({2}, b.getBF16Type());
-      } else if (MPerWave == 64 && NPerWave == 32) {
-        instr = amdgpu::MFMAInstr::f32_32x32x2bf16;
-        MPerXdlops = 64;
-        NPerXdlops = 32;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({32}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({0, 0, 1});
-        argType = VectorType::get({2}, b.getBF16Type());
-      } else if (MPerWave == 32 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_32x32x2bf16;
-        MPerXdlops = 32;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({32}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({1, 0, 0});
-        argType = VectorType::get({2}, b.getBF16Type());
-      } else if (MPerWave == 64 && NPerWave == 16) {
-        instr = amdgpu::MFMAInstr::f32_16x16x2bf16;
-        MPerXdlops = 64;
-        NPerXdlops = 16;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({16}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({0, 0, 4});
-        argType = VectorType::get({2}, b.getBF16Type());
-      } else if (MPerWave == 16 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_16x16x2bf16;
-        MPerXdlops = 16;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({16}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({2, 0, 0});
-        argType = VectorType::get({2}, b.getBF16Type());
-      } else if (MPerWave == 8 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_4x4x2bf16;
-        MPerXdlops = 8;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({4}, b.getF32Type());
-        vectorNumber = 2;
-        imms.push_back({4, 0, 0});
-        imms.push_back({4, 1, 0});
-        argType = VectorType::get({2}, b.getBF16Type());
-      } else if (MPerWave == 4 && NPerWave == 64) {
-        instr = amdgpu::MFMAInstr::f32_4x4x2bf16;
-        MPerXdlops = 4;
-        NPerXdlops = 64;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({4}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({4, 0, 0});
-        argType = VectorType::get({2}, b.getBF16Type());
-      } else if (MPerWave == 32 && NPerWave == 32) {
-        instr = amdgpu::MFMAInstr::f32_32x32x4bf16;
-        MPerXdlops = 32;
-        NPerXdlops = 32;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({16}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({0, 0, 0});
-        argType = VectorType::get({2}, b.getBF16Type());
-      } else if (MPerWave == 16 && NPerWave == 16) {
-        instr = amdgpu::MFMAInstr::f32_16x16x8bf16;
-        MPerXdlops = 16;
-        NPerXdlops = 16;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({4}, b.getF32Type());
-        vectorNumber = 1;
-        imms.push_back({0, 0, 0});
-        argType = VectorType::get({2}, b.getBF16Type());
-      } else {
-        dumpUnsupported(dataType, MPerWave, NPerWave);
-        llvm_unreachable("Can't meaningfully continue xdlop generation");
-      }
-    } else if (dataType == b.getIntegerType(8)) {
-      if (MPerWave == 32 && NPerWave == 32) {
-        instr = amdgpu::MFMAInstr::i32_32x32x8i8;
-        MPerXdlops = 32;
-        NPerXdlops = 32;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({16}, b.getI32Type());
-        vectorNumber = 1;
-        imms.push_back({0, 0, 0});
-        argType = VectorType::get({4}, b.getIntegerType(8));
-      } else if (MPerWave == 16 && NPerWave == 16) {
-        instr = amdgpu::MFMAInstr::i32_16x16x16i8;
-        MPerXdlops = 16;
-        NPerXdlops = 16;
-        MRepeats = 1;
-        NRepeats = 1;
-        vectorType = VectorType::get({4}, b.getI32Type());
-        vectorNumber = 1;
-        imms.push_back({0, 0, 0});
-        argType = VectorType::get({4}, b.getIntegerType(8));
-      } else {
-        dumpUnsupported(dataType, MPerWave, NPerWave);
-        llvm_unreachable("Can't meaningfully continue xdlop generation");
-      }
-    } else {
-      llvm_unreachable("XDLOPs for unsupported data types should be rejected");
-    }
-
-    // Obtain properties of MFMA instructions.
-    int64_t group_size, num_groups_blk, num_regs_blk, num_threads_blk,
-        num_output_blks, num_regs_xdlops, m, n, k, cycles, k_base;
-    if (instr == amdgpu::MFMAInstr::f32_32x32x1f32) {
-      group_size = 4;
-      num_groups_blk = 4;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 32;
-      num_output_blks = 2;
-      num_regs_xdlops = num_regs_blk * num_output_blks;
-      m = 32;
-      n = 32;
-      k = 1;
-      cycles = 64;
-      k_base = 1;
-    } else if (instr == amdgpu::MFMAInstr::f32_32x32x2f32) {
-      group_size = 4;
-      num_groups_blk = 4;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 32;
-      num_output_blks = 1;
-      num_regs_xdlops = num_regs_blk * num_output_blks;
-      m = 32;
-      n = 32;
-      k = 2;
-      cycles = 64;
-      k_base = 1;
-    } else if (instr == amdgpu::MFMAInstr::f32_16x16x4f32) {
-      group_size = 4;
-      num_groups_blk = 1;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 16;
-      num_output_blks = 1;
-      num_regs_xdlops = num_regs_blk * num_output_blks;
-      m = 16;
-      n = 16;
-      k = 4;
-      cycles = 32;
-      k_base = 1;
-    } else if (instr == amdgpu::MFMAInstr::f32_16x16x1f32) {
-      group_size = 4;
-      num_groups_blk = 1;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 16;
-      num_output_blks = 4;
-      num_regs_xdlops = num_regs_blk * num_output_blks;
-      m = 16;
-      n = 16;
-      k = 1;
-      cycles = 32;
-      k_base = 1;
-    } else if (instr == amdgpu::MFMAInstr::f32_4x4x1f32) {
-      group_size = 4;
-      num_groups_blk = 1;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 64;
-      num_output_blks = 1;
-      num_regs_xdlops = 4;
-      m = 4;
-      n = 64;
-      k = 1;
-      cycles = 8;
-      k_base = 1;
-    } else if (instr == amdgpu::MFMAInstr::f32_32x32x4f16) {
-      group_size = 4;
-      num_groups_blk = 4;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 32;
-      num_output_blks = 2;
-      num_regs_xdlops = num_regs_blk * num_output_blks;
-      m = 32;
-      n = 32;
-      k = 4;
-      cycles = 64;
-      k_base = 4;
-    } else if (instr == amdgpu::MFMAInstr::f32_32x32x8f16) {
-      group_size = 4;
-      num_groups_blk = 4;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 32;
-      num_output_blks = 1;
-      num_regs_xdlops = num_regs_blk * num_output_blks;
-      m = 32;
-      n = 32;
-      k = 8;
-      cycles = 64;
-      k_base = 4;
-    } else if (instr == amdgpu::MFMAInstr::f32_16x16x16f16) {
-      group_size = 4;
-      num_groups_blk = 1;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 16;
-      num_output_blks = 1;
-      num_regs_xdlops = num_regs_blk * num_output_blks;
-      m = 16;
-      n = 16;
-      k = 16;
-      cycles = 32;
-      k_base = 4;
-    } else if (instr == amdgpu::MFMAInstr::f32_16x16x4f16) {
-      group_size = 4;
-      num_groups_blk = 1;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 16;
-      num_output_blks = 4;
-      num_regs_xdlops = num_regs_blk * num_output_blks;
-      m = 16;
-      n = 16;
-      k = 4;
-      cycles = 32;
-      k_base = 4;
-    } else if (instr == amdgpu::MFMAInstr::f32_4x4x4f16) {
-      group_size = 4;
-      num_groups_blk = 1;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 64;
-      num_output_blks = 1;
-      num_regs_xdlops = 4;
-      m = 4;
-      n = 64;
-      k = 4;
-      cycles = 8;
-      k_base = 4;
-    } else if (instr == amdgpu::MFMAInstr::f32_32x32x2bf16) {
-      group_size = 4;
-      num_groups_blk = 4;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 32;
-      num_output_blks = 2;
-      num_regs_xdlops = num_regs_blk * num_output_blks;
-      m = 32;
-      n = 32;
-      k = 2;
-      cycles = 64;
-      k_base = 2;
-    } else if (instr == amdgpu::MFMAInstr::f32_32x32x4bf16) {
-      group_size = 4;
-      num_groups_blk = 4;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 32;
-      num_output_blks = 1;
-      num_regs_xdlops = num_regs_blk * num_output_blks;
-      m = 32;
-      n = 32;
-      k = 4;
-      cycles = 64;
-      k_base = 2;
-    } else if (instr == amdgpu::MFMAInstr::f32_16x16x8bf16) {
-      group_size = 4;
-      num_groups_blk = 1;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 16;
-      num_output_blks = 1;
-      num_regs_xdlops = num_regs_blk * num_output_blks;
-      m = 16;
-      n = 16;
-      k = 8;
-      cycles = 32;
-      k_base = 2;
-    } else if (instr == amdgpu::MFMAInstr::f32_32x32x2f32) {
-      group_size = 4;
-      num_groups_blk = 1;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 16;
-      num_output_blks = 4;
-      num_regs_xdlops = num_regs_blk * num_output_blks;
-      m = 16;
-      n = 16;
-      k = 2;
-      cycles = 32;
-      k_base = 2;
-    } else if (instr == amdgpu::MFMAInstr::f32_4x4x2bf16) {
-      group_size = 4;
-      num_groups_blk = 1;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 64;
-      num_output_blks = 1;
-      num_regs_xdlops = 4;
-      m = 4;
-      n = 64;
-      k = 2;
-      cycles = 8;
-      k_base = 2;
-    } else if (instr == amdgpu::MFMAInstr::i32_32x32x8i8) {
-      group_size = 4;
-      num_groups_blk = 4;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 32;
-      num_output_blks = 1;
-      num_regs_xdlops = num_regs_blk * num_output_blks;
-      m = 32;
-      n = 32;
-      k = 8;
-      cycles = 64;
-      k_base = 4;
-    } else if (instr == amdgpu::MFMAInstr::i32_16x16x16i8) {
-      group_size = 4;
-      num_groups_blk = 1;
-      num_regs_blk = group_size * num_groups_blk;
-      num_threads_blk = 16;
-      num_output_blks = 1;
-      num_regs_xdlops = num_regs_blk * num_output_blks;
-      m = 16;
-      n = 16;
-      k = 16;
-      cycles = 32;
-      k_base = 4;
-    } else {
-      llvm_unreachable("Unsupported case as mfmaInstr not selected!\n");
-    }
-
-    constexpr int64_t wave_size = 64;
-    // Populate result.
-    XdlopsCodeSelection result;
-    result.instr = instr;
-    result.MPerXdlops = MPerXdlops;
-    result.NPerXdlops = NPerXdlops;
-    result.MRepeats = MRepeats;
-    result.NRepeats = NRepeats;
-    result.vectorType = vectorType;
-    result.vectorNumber = vectorNumber;
-    result.imms = imms;
-    result.argType = argType;
-
-    result.group_size = group_size;
-    result.num_groups_blk = num_groups_blk;
-    result.num_regs_blk = num_regs_blk;
-    result.num_threads_blk = num_threads_blk;
-    result.num_input_blks = wave_size / num_threads_blk;
-    result.num_output_blks = num_output_blks;
-    result.num_regs_xdlops = num_regs_xdlops;
-    result.m = m;
-    result.n = n;
-    result.k = k;
-    result.cycles = cycles;
-    result.k_base = k_base;
-
-    // llvm::errs() << "XDLOPS code selection result:\n";
-    // llvm::errs() << "mfmaInstr: " << mfmaInstr << "\n";
-    // llvm::errs() << "MPerXdlops: " << MPerXdlops << "\n";
-    // llvm::errs() << "NPerXdlops: " << NPerXdlops << "\n";
-    // llvm::errs() << "MRepeats: " << MRepeats << "\n";
-    // llvm::errs() << "NRepeats: " << NRepeats << "\n";
-    // llvm::errs() << "vectorType: " << vectorType << "\n";
-    // llvm::errs() << "vectorNumber: " << vectorNumber << "\n";
-    // llvm::errs() << "imms:\n";
-    // for (auto imm : imms) {
-    //         llvm::errs() << imm[0] << " " << imm[1] << " " << imm[2] << "\n";
-    // }
-    // llvm::errs() << "argType: " << argType << "\n";
+  /// Select the XDLOPS code for a MPerWave x NPerWave wave tile of
+  /// `dataType` on `arch`, which is a chip name optionally followed by
+  /// target features or preceded by a triple. An empty or unknown `arch` is
+  /// treated as gfx908. i8 data holds 8-bit floats of `fp8Format` when it is
+  /// given, and f32 data is multiplied with the xf32 instructions if `xf32`
+  /// is set, and A with the sparse ones if `sparse` is. Fails when the chip
+  /// has no instruction for the tile.
+  static FailureOr<XdlopsCodeSelection>
+  get(Type dataType, int64_t MPerWave, int64_t NPerWave, StringRef arch,
+      Optional<miopen::Fp8Format> fp8Format = None, bool xf32 = false,
+      bool sparse = false);
 
-    // llvm::errs() << "group_size: " << group_size << "\n";
-    // llvm::errs() << "num_groups_blk: " << num_groups_blk << "\n";
-    // llvm::errs() << "num_regs_blk: " << num_regs_blk << "\n";
-    // llvm::errs() << "num_threads_blk: " << num_threads_blk << "\n";
-    // llvm::errs() << "num_input_blks: " << num_input_blks << "\n";
-    // llvm::errs() << "num_output_blks: " << num_output_blks << "\n";
-    // llvm::errs() << "num_regs_xdlops: " << num_regs_xdlops << "\n";
-    // llvm::errs() << "m: " << m << "\n";
-    // llvm::errs() << "n: " << n << "\n";
-    // llvm::errs() << "k: " << k << "\n";
-    // llvm::errs() << "cycles: " << cycles << "\n";
-    // llvm::errs() << "k_base: " << k_base << "\n";
+  /// Tell if `arch` has WMMA instructions rather than MFMA ones.
+  static bool hasWmma(StringRef arch);
 
-    return result;
-  }
+  /// The size of the waves the XDLOPS code of `arch` runs in.
+  static int64_t getWaveSize(StringRef arch);
 };
 #endif
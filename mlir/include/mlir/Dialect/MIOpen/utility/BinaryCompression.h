@@ -0,0 +1,40 @@
+//===- BinaryCompression.h - Compression of stored code objects -----------===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the compression of the code objects kept on disk by the
+// kernel cache, the binary cache and the kernel library. Code objects are
+// mostly padding, tables and repeated instruction encodings, and shrink
+// severalfold with zlib. A compressed binary is framed with a magic and its
+// uncompressed size. Bare ELF code objects are passed through, so entries
+// written before compression, or by builds without zlib, still read back.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_DIALECT_MIOPEN_UTILITY_BINARYCOMPRESSION_H_
+#define MLIR_DIALECT_MIOPEN_UTILITY_BINARYCOMPRESSION_H_
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <string>
+
+namespace mlir {
+namespace miopen {
+
+/// `binary` as it is stored: compressed and framed when zlib is available
+/// and compression saves space, `binary` itself otherwise.
+std::string compressBinary(llvm::StringRef binary);
+
+/// The code object stored as `stored` by compressBinary, or None if it is
+/// framed but does not decompress.
+llvm::Optional<std::string> decompressBinary(llvm::StringRef stored);
+
+} // namespace miopen
+} // namespace mlir
+
+#endif // MLIR_DIALECT_MIOPEN_UTILITY_BINARYCOMPRESSION_H_
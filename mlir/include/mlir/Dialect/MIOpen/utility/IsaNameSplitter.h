@@ -14,6 +14,7 @@
 #define MLIR_DIALECT_MIOPEN_UTILITY_ISANAMESPLITTER_H_
 
 #include "mlir/Support/LogicalResult.h"
+#include "llvm/ADT/StringRef.h"
 
 #include <string>
 
@@ -25,6 +26,9 @@ public:
                              std::string &features);
   static LogicalResult parseArchName(const std::string &archName,
                                      std::string &chip, std::string &features);
+  /// The chip name of `arch`, which is either an isa name or an arch name.
+  /// Malformed target features are ignored.
+  static std::string getChip(llvm::StringRef arch);
 
 private:
   std::string isaName;
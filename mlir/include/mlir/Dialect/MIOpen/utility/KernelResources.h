@@ -0,0 +1,60 @@
+//===- KernelResources.h - Resources of compiled kernels ------------------===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the reading of the registers and memory a compiled kernel
+// uses from the metadata of its HSA code object, and the occupancy they allow.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_DIALECT_MIOPEN_UTILITY_KERNELRESOURCES_H_
+#define MLIR_DIALECT_MIOPEN_UTILITY_KERNELRESOURCES_H_
+
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/BuiltinAttributes.h"
+#include "mlir/Support/LogicalResult.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <cstdint>
+
+namespace mlir {
+namespace miopen {
+
+/// Name of the dictionary attribute holding the resources of a kernel, on its
+/// function and in its entry of the `targets` of the host function.
+constexpr llvm::StringLiteral kKernelResourcesAttrName = "resources";
+
+struct KernelResources {
+  uint32_t vgprCount = 0;
+  uint32_t agprCount = 0;
+  uint32_t sgprCount = 0;
+  /// Static LDS, in bytes
+  uint32_t ldsSize = 0;
+  /// Private memory of each lane, in bytes
+  uint32_t scratchSize = 0;
+  uint32_t waveSize = 64;
+  /// How many waves of the kernel can be resident on a SIMD at once, as
+  /// limited by its registers and LDS.
+  uint32_t wavesPerSimd = 0;
+
+  DictionaryAttr getAttr(Builder &b) const;
+  static llvm::Optional<KernelResources> fromAttr(Attribute attr);
+};
+
+/// Reads the resources of `kernel` from the AMDGPU metadata note of the code
+/// object `hsaco`, or those of its first kernel when `kernel` is empty, and
+/// computes the occupancy of blocks of `blockSize` threads on `chip`.
+FailureOr<KernelResources> readKernelResources(llvm::StringRef hsaco,
+                                               llvm::StringRef kernel,
+                                               llvm::StringRef chip,
+                                               uint32_t blockSize);
+
+} // namespace miopen
+} // namespace mlir
+
+#endif // MLIR_DIALECT_MIOPEN_UTILITY_KERNELRESOURCES_H_
@@ -0,0 +1,36 @@
+//===- OrderedRewrite.h - One-shot application of lowering patterns -------===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares a driver that applies expansion patterns to each op they
+// are rooted on exactly once, for lowerings that don't need the fixpoint
+// iteration of the greedy driver.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_DIALECT_MIOPEN_UTILITY_ORDEREDREWRITE_H_
+#define MLIR_DIALECT_MIOPEN_UTILITY_ORDEREDREWRITE_H_
+
+#include "mlir/IR/Operation.h"
+#include "mlir/Rewrite/FrozenRewritePatternSet.h"
+#include "mlir/Support/LogicalResult.h"
+
+namespace mlir {
+namespace miopen {
+
+/// Rewrites every op nested in `root` that one of `patterns` is rooted on,
+/// outer ops before inner ones and each op once, along with the ops of those
+/// kinds the rewrites create. Nothing is folded and the users of rewritten
+/// ops aren't revisited, so the patterns must fold what they build through
+/// `createOrFold`. Fails with an error on the first op no pattern rewrites.
+LogicalResult applyPatternsInOrder(Operation *root,
+                                   const FrozenRewritePatternSet &patterns);
+
+} // namespace miopen
+} // namespace mlir
+
+#endif // MLIR_DIALECT_MIOPEN_UTILITY_ORDEREDREWRITE_H_
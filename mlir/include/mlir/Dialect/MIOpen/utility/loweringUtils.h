@@ -14,17 +14,21 @@
 #include "mlir/Dialect/MIOpen/MIOpen.h"
 #include "mlir/IR/Attributes.h"
 #include "mlir/IR/BuiltinAttributes.h"
+#include "mlir/IR/BuiltinOps.h"
 #include "mlir/Support/LogicalResult.h"
 
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallVector.h"
 
+#include <cstdint>
+
 namespace mlir {
 namespace miopen {
 struct ConvolutionDims;
 
-// Heuristic logic to compute KBlock for backward weight atomic add kernel.
-// The logic is adopted from MIOpen.
+// Heuristic logic to compute KBlock for the atomic add kernels that split
+// GemmK across workgroups: backward weight, and forward convolutions when
+// split-K is enabled. The logic is adopted from MIOpen.
 //
 // The logic searches within the range of [1, 20 * number of CUs / gridSize],
 // where gridSize is the original number of workgroups required for the
@@ -32,16 +36,21 @@ struct ConvolutionDims;
 // contraints:
 // - GemmK (before splitting) = KBlock * KPerBlock * KPack * GemmK (after
 // splitting).
-// - n (batch size) is divisible by KBlock.
+// - The split dimension, n (batch size) for backward weight and c (input
+// channels) for forward, is divisible by KBlock.
 //
 // 20 is a magic number obtained in MIOpen after empirical testing. It offers a
 // reasonable reduction of GemmK after splitting, without incurring too much
 // overheads on atomic adds. One potential future work is to make this value be
 // tunable.
-LogicalResult calculateKBlockNum(ConvolutionDims convDims, int64_t MPerBlock,
-                                 int64_t NPerBlock, int64_t KPerBlock,
-                                 int64_t KPack, int64_t num_cu,
-                                 int64_t &nKBlock);
+//
+// KBlock is also kept at most `maxKBlocks`, the number of partial results
+// there is room for when they are reduced through a workspace.
+LogicalResult calculateKBlockNum(ConvOpType opType, ConvolutionDims convDims,
+                                 int64_t MPerBlock, int64_t NPerBlock,
+                                 int64_t KPerBlock, int64_t KPack,
+                                 int64_t num_cu, int64_t &nKBlock,
+                                 int64_t maxKBlocks = INT64_MAX);
 
 /// Unwrap a value from the transforms surrounding it, gathering up the
 /// transforms.
@@ -68,32 +77,163 @@ std::tuple<ArrayAttr, ArrayAttr> computeOobFromTransforms(
     Builder &b, ArrayAttr transforms,
     Optional<std::tuple<ArrayAttr, ArrayAttr>> initialOob = llvm::None);
 
+/// The longest power-of-two vector, of at most `maxLen` elements, that can be
+/// loaded along the upper dimension `dim` of the chain of `transforms` over
+/// the memref of type `memType`, for runs of indices along `dim` that start
+/// at multiples of the vector length. The analysis follows each run through
+/// all the views down to memory, so a run may be split between the
+/// dimensions of a merge as long as later views put it back together, as
+/// with the channels and filter columns of an NHWC input. Vectors must be
+/// aligned to their length and may not straddle the boundaries of padding.
+/// Returns 1 if no vector is possible.
+int64_t getMaxVectorization(ArrayAttr transforms, uint32_t dim,
+                            int64_t maxLen, MemRefType memType);
+
 /// Populate a vector of gemm IDs to be used by a backward data convolution
 /// algorithm. In the current v4r1 algorithm, several kernels may be needed to
 /// realize a complete backward data convolution.
 ///
 /// The values of gemm IDs would be 0, or a positive integer to denote the IDs
 /// of the actual implicit GEMM kernels to partipate the backward data
-/// convolution, or it could be -1 in case a zero initialization utility kernel
-/// is needed. The zero initialization kernel, if needed, would be placed in the
-/// front of the vector.
+/// convolution. Gemm ID 0 always comes first, and its kernel also zeroes the
+/// pixels none of the GEMMs write.
 SmallVector<int64_t>
 populateBackwardDataGemmIds(int64_t strideHeight, int64_t strideWidth,
                             int64_t dilationHeight, int64_t dilationWidth,
                             int64_t filterHeight, int64_t filterWidth);
 
+/// Whether the GEMMs of a backward data convolution write every pixel of its
+/// output, leaving none for the kernel of gemm ID 0 to zero.
+bool backwardDataWritesEveryPixel(int64_t strideHeight, int64_t strideWidth,
+                                  int64_t dilationHeight,
+                                  int64_t dilationWidth, int64_t filterHeight,
+                                  int64_t filterWidth);
+
 /// Obtain convolution direction given a Convolution Op.
 /// TODO(whchung): apply ConvolutionOp OpTrait check after supporting PR is in.
 ConvOpType obtainConvDirection(Operation *op);
 
-/// Obtain convolution input data type given a Convolution Op.
+/// Obtain convolution input data type given a Convolution Op. Gemms of int4
+/// weights, with an `int4_group_size`, multiply in the type of their A.
 /// TODO(whchung): apply ConvolutionOp OpTrait check after supporting PR is in.
 Type obtainConvDataType(Operation *op);
 
+/// The 8-bit float format of the i8 operands of a convolution or gemm, given
+/// by its `fp8_format` attribute, or None if they are integers.
+Optional<Fp8Format> obtainFp8Format(Operation *op);
+
+/// Whether the convolution `op`, of dimensions `dims`, is lowered to a direct
+/// grouped convolution rather than an implicit GEMM. This is the case for
+/// forward 2D convolutions with several groups of at most
+/// kDirectConvMaxChannelsPerGroup input and output channels each, such as
+/// depthwise convolutions, whose GEMMs would be too small to fill a tile.
+/// Convolutions that split K, use Winograd or carry an explicit perf_config
+/// keep their lowering.
+bool usesDirectGroupedConv(Operation *op, const ConvolutionDims &dims);
+
+/// Whether the gemm `op` is lowered to a skinny gemm rather than a gridwise
+/// gemm. This is the case for gemms whose output has at most kSkinnyGemmMaxN
+/// rows or columns, such as the matrix-vector products of batch-1 inference,
+/// which are bound by reading their long operand and would mostly compute
+/// padding in a gemm tile. Gemms of 8-bit floats or int4 weights, of f64,
+/// which the 32-bit wave sums of the skinny gemm cannot accumulate, or with
+/// an explicit perf_config keep their lowering.
+bool usesSkinnyGemm(Operation *op);
+
+/// The transforms of Winograd F(m x m, 3 x 3), which computes an m x m output
+/// tile Y from an alpha x alpha input tile d, with alpha = m + 2, and a 3x3
+/// filter g as Y = A^T [(G g G^T) * (B^T d B)] A, where * is the elementwise
+/// product (Lavin and Gray, "Fast Algorithms for Convolutional Neural
+/// Networks"). The matrices are stored row-major.
+struct WinogradMatrices {
+  int64_t m;
+  int64_t alpha;
+  /// alpha x 3 filter transform G.
+  ArrayRef<float> g;
+  /// alpha x alpha input transform B^T.
+  ArrayRef<float> bt;
+  /// m x alpha output transform A^T.
+  ArrayRef<float> at;
+
+  /// The matrices for output tiles of size `m`, 2 or 4.
+  static FailureOr<WinogradMatrices> get(int64_t m);
+};
+
 /// Return a `miopen.transform` op that reshapes a given 1D buffer `buffer`
 /// into `shape`, using `names` as the names of the reshaped dimensions.
 TransformOp reshapeBuffer(OpBuilder &b, Location loc, Value buffer,
                           ArrayRef<StringRef> names, ArrayRef<int64_t> shape);
+
+/// The number of `dataType` elements the packed dot product instruction of
+/// `arch` reduces into one accumulator: 2 for f16 (v_dot2_f32_f16), 4 for i8
+/// (v_dot4_i32_i8). Returns 1 if the chip has no such instruction.
+int64_t getDotProductWidth(Type dataType, StringRef arch);
+
+/// The most bytes a tensor of a kernel may span, as kernels index with 32
+/// bits and address buffers with 32-bit offsets.
+constexpr int64_t kMaxKernelTensorBytes = (int64_t(1) << 31) - 1;
+
+/// The fewest launches, a divisor of `batchSize`, that a problem whose batch
+/// is outermost in tensors of `tensorBytes` bytes must be split into for the
+/// slice of every tensor a launch covers to fit in kMaxKernelTensorBytes:
+/// 1 if the tensors fit whole, 0 if not even a single image does.
+int64_t getMinBatchLaunches(int64_t batchSize, ArrayRef<int64_t> tensorBytes);
+
+/// Name of the attribute marking the kernel argument of a kernel instrumented
+/// for phase timing, a memref<kPhaseTimingWorkgroups x kNumPhaseStamps x i64>.
+/// The first wave of each of the first kPhaseTimingWorkgroups workgroups of
+/// an XDLOPS gridwise gemm writes in its row the s_memtime clock at the start
+/// of the gemm, once it issued the global loads of the first K tile, once it
+/// stored that tile to LDS, after the main loop and after the epilogue.
+/// Kernels without such an argument have no timing code at all.
+constexpr llvm::StringLiteral kPhaseTimesAttrName = "miopen.phase_times";
+constexpr int64_t kPhaseTimingWorkgroups = 4096;
+constexpr int64_t kNumPhaseStamps = 5;
+
+/// Name of the unit argument attribute of the buffers whose contents must be
+/// zero before the first launch of a kernel, which then leaves them so for
+/// the next one: the workspaces holding the arrival counters of a fused
+/// KBlock reduction.
+constexpr llvm::StringLiteral kZeroInitAttrName = "miopen.zero_init";
+
+/// Name of the unit argument attribute of the outputs that kernels sum into
+/// with atomics, which must be zeroed before every launch: the reductions
+/// fused into the writeback of a gemm.
+constexpr llvm::StringLiteral kZeroBeforeLaunchAttrName =
+    "miopen.zero_before_launch";
+
+/// The phase timing argument of the kernel `op` is in, or null if the kernel
+/// is not instrumented.
+Value getPhaseTimesBuffer(Operation *op);
+
+/// Declares the runtime function `name`, which takes `argTypes` and returns
+/// nothing, in `mod` unless it already is.
+func::FuncOp getRuntimeFunc(ModuleOp mod, StringRef name, TypeRange argTypes);
+
+/// An XOR swizzle of the columns of a row-major tile in LDS, used to avoid
+/// bank conflicts between threads that access the same column of different
+/// rows. Columns are permuted in granules of `granule` elements, which stay
+/// contiguous: granule `c` of row `r` is stored at granule
+/// `c ^ (r % period)`. A period of 1 leaves the tile unchanged.
+struct LdsSwizzle {
+  int64_t rowLength = 1;
+  int64_t granule = 1;
+  int64_t period = 1;
+
+  /// The swizzle spreading `granule`-element accesses to one column of
+  /// consecutive rows of `rowLength` elements of `elementBytes` bytes over
+  /// all LDS banks, or the identity swizzle if rows are too short or the
+  /// lengths are not powers of two.
+  static LdsSwizzle get(int64_t rowLength, int64_t granule,
+                        int64_t elementBytes);
+
+  bool isIdentity() const { return period <= 1; }
+
+  /// Permute `index`, an element index into a buffer holding the tile at
+  /// `tileOffset`.
+  Value apply(OpBuilder &b, Location loc, Value index,
+              int64_t tileOffset) const;
+};
 } // end namespace miopen
 } // end namespace mlir
 #endif
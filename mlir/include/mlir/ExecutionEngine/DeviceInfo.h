@@ -0,0 +1,59 @@
+//===- DeviceInfo.h - Cached properties of the HIP devices ------*- C++ -*-===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// The properties of the GPUs of the machine the tools compile for and run on,
+// queried from the HIP driver the first time a process asks for them and
+// cached from then on. Querying every device property for each kernel run
+// costs driver handles, which run out when many tools run concurrently, so
+// the runners, the tuner and miopen-gen go through this cache instead of
+// calling hipGetDeviceProperties themselves. Only built with
+// MLIR_ENABLE_ROCM_RUNNER, as the MLIRMIOpenDeviceInfo library.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_EXECUTIONENGINE_DEVICEINFO_H_
+#define MLIR_EXECUTIONENGINE_DEVICEINFO_H_
+
+#include <cstdint>
+#include <string>
+
+namespace mlir {
+namespace miopen {
+/// The properties of a HIP device.
+struct DeviceInfo {
+  int device = 0;
+  /// The arch name reported by the driver, such as gfx908:sramecc+:xnack-,
+  /// and its chip and target features, as IsaNameSplitter splits it.
+  std::string archName;
+  std::string chip;
+  std::string features;
+  int64_t numCu = 0;
+  /// The LDS available to a workgroup, in bytes.
+  int64_t ldsSize = 0;
+  int64_t waveSize = 0;
+  /// The peak clocks of the compute units and of the memory, in kHz.
+  int64_t clockRateKHz = 0;
+  int64_t memoryClockRateKHz = 0;
+
+  /// The isa name of the device, amdgcn-amd-amdhsa:<arch name>, in the form
+  /// -arch and the arch attributes take.
+  std::string getIsaName() const;
+};
+
+/// The number of HIP devices, 0 if there are none or the driver failed.
+int getDeviceCount();
+
+/// The properties of HIP device `device`, or null if there is no such device
+/// or the driver failed, which is reported once. Only the first call for a
+/// device queries the driver; the properties live until the process exits.
+/// Thread-safe.
+const DeviceInfo *getDeviceInfo(int device);
+} // namespace miopen
+} // namespace mlir
+
+#endif // MLIR_EXECUTIONENGINE_DEVICEINFO_H_
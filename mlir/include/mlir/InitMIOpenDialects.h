@@ -18,6 +18,31 @@
 #include "mlir/Dialect/MIGraphX/MIGraphXOps.h"
 #include "mlir/Dialect/MIOpen/MIOpen.h"
 
+#include "mlir/Dialect/AMDGPU/AMDGPUDialect.h"
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/Arithmetic/Transforms/BufferizableOpInterfaceImpl.h"
+#include "mlir/Dialect/Async/IR/Async.h"
+#include "mlir/Dialect/Bufferization/IR/Bufferization.h"
+#include "mlir/Dialect/Bufferization/Transforms/FuncBufferizableOpInterfaceImpl.h"
+#include "mlir/Dialect/ControlFlow/IR/ControlFlow.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
+#include "mlir/Dialect/LLVMIR/ROCDLDialect.h"
+#include "mlir/Dialect/Linalg/IR/Linalg.h"
+#include "mlir/Dialect/Linalg/Transforms/BufferizableOpInterfaceImpl.h"
+#include "mlir/Dialect/Math/IR/Math.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/Dialect/SCF/Transforms/BufferizableOpInterfaceImpl.h"
+#include "mlir/Dialect/Tensor/IR/Tensor.h"
+#include "mlir/Dialect/Tensor/IR/TensorInferTypeOpInterfaceImpl.h"
+#include "mlir/Dialect/Tensor/IR/TensorTilingInterfaceImpl.h"
+#include "mlir/Dialect/Tensor/Transforms/BufferizableOpInterfaceImpl.h"
+#include "mlir/Dialect/Tosa/IR/TosaOps.h"
+#include "mlir/Dialect/Vector/IR/VectorOps.h"
+#include "mlir/Dialect/Vector/Transforms/BufferizableOpInterfaceImpl.h"
 #include "mlir/IR/Dialect.h"
 
 namespace mlir {
@@ -30,6 +55,44 @@ inline void registerMIOpenDialects(DialectRegistry &registry) {
   // clang-format on
 }
 
+// Add our dialects and only the upstream dialects the MIOpen flow goes
+// through, from TOSA or generated kernels down to ROCDL and LLVM, together
+// with the external models its passes need. Tools and libraries that do not
+// take arbitrary IR use this rather than registerAllDialects, which costs
+// them startup time and, in the MIOpen library, first-handle latency.
+inline void registerMIOpenFlowDialects(DialectRegistry &registry) {
+  registerMIOpenDialects(registry);
+  // clang-format off
+  registry.insert<AffineDialect,
+                  amdgpu::AMDGPUDialect,
+                  arith::ArithmeticDialect,
+                  async::AsyncDialect,
+                  bufferization::BufferizationDialect,
+                  cf::ControlFlowDialect,
+                  func::FuncDialect,
+                  gpu::GPUDialect,
+                  LLVM::LLVMDialect,
+                  linalg::LinalgDialect,
+                  math::MathDialect,
+                  memref::MemRefDialect,
+                  ROCDL::ROCDLDialect,
+                  scf::SCFDialect,
+                  tensor::TensorDialect,
+                  tosa::TosaDialect,
+                  vector::VectorDialect>();
+  // clang-format on
+
+  arith::registerBufferizableOpInterfaceExternalModels(registry);
+  bufferization::func_ext::registerBufferizableOpInterfaceExternalModels(
+      registry);
+  linalg::registerBufferizableOpInterfaceExternalModels(registry);
+  scf::registerBufferizableOpInterfaceExternalModels(registry);
+  tensor::registerBufferizableOpInterfaceExternalModels(registry);
+  tensor::registerInferTypeOpInterfaceExternalModels(registry);
+  tensor::registerTilingOpInterfaceExternalModels(registry);
+  vector::registerBufferizableOpInterfaceExternalModels(registry);
+}
+
 } // namespace mlir
 
 #endif // MLIR_INITMIOPENDIALECTS_H_
\ No newline at end of file
@@ -0,0 +1,43 @@
+//===- InitMIOpenTargets.h - MLIR MIOpen LLVM Targets Initialization ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines helpers to initialize the LLVM targets the MIOpen flow
+// compiles for: the AMDGPU backend for kernels and, for tools that JIT host
+// code, the native target. Unlike InitializeAllTargets and friends, they
+// leave every other backend alone.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_INITMIOPENTARGETS_H_
+#define MLIR_INITMIOPENTARGETS_H_
+
+#include "llvm/Support/TargetSelect.h"
+
+namespace mlir {
+
+// Initialize the AMDGPU backend the kernels are compiled with.
+inline void initializeMIOpenTargets() {
+  LLVMInitializeAMDGPUTarget();
+  LLVMInitializeAMDGPUTargetInfo();
+  LLVMInitializeAMDGPUTargetMC();
+  LLVMInitializeAMDGPUAsmParser();
+  LLVMInitializeAMDGPUAsmPrinter();
+}
+
+// Initialize the AMDGPU backend and the target of the host, for tools that
+// also run host code.
+inline void initializeMIOpenHostTargets() {
+  initializeMIOpenTargets();
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  llvm::InitializeNativeTargetAsmParser();
+}
+
+} // namespace mlir
+
+#endif // MLIR_INITMIOPENTARGETS_H_
@@ -15,6 +15,7 @@
 #define MLIR_INITMIOPENTRANSLATIONS_H
 
 #include "mlir/Translation/GpuModuleToRocdir.h"
+#include "mlir/Translation/ModuleArchive.h"
 
 namespace mlir {
 namespace miopen {
@@ -25,6 +26,7 @@ namespace miopen {
 inline void registerMIOpenTranslations() {
   static bool initOnce = []() {
     registerGpuModuleToROCDLIRTranslation();
+    registerModuleArchiveTranslations();
     return true;
   }();
   (void)initOnce;
@@ -0,0 +1,87 @@
+//===- ModuleArchive.h - Binary container of MLIR modules -------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This provides a binary container for the modules passed between the stages
+// of the MIOpen flow, such as partitioned modules handed to tuning workers.
+// Every op of a module, and of the modules nested in it, is stored on its own
+// behind an index of symbol names, so that a reader parses only the ops it
+// asks for instead of the whole module.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TRANSLATION_MODULEARCHIVE_H
+#define MLIR_TRANSLATION_MODULEARCHIVE_H
+
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/OwningOpRef.h"
+#include "mlir/Support/LogicalResult.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <string>
+#include <vector>
+
+namespace llvm {
+class SourceMgr;
+} // namespace llvm
+
+namespace mlir {
+namespace miopen {
+
+/// Writes `module` to `os` as a module archive.
+LogicalResult writeModuleArchive(ModuleOp module, llvm::raw_ostream &os);
+
+/// Returns whether `buffer` holds a module archive.
+bool isModuleArchive(llvm::StringRef buffer);
+
+/// A module archive read from a buffer, which must outlive it.
+class ModuleArchive {
+public:
+  struct Entry {
+    /// Index of the entry of the module holding this one, -1 for the
+    /// archived module itself.
+    int32_t parent;
+    /// Whether this is the header of a module whose ops follow.
+    bool isModule;
+    /// Symbol name of the op, empty if it has none.
+    llvm::StringRef symbol;
+    llvm::StringRef text;
+  };
+
+  /// Reads the index of the archive in `buffer`, or fails if `buffer` is not
+  /// a well-formed archive.
+  static FailureOr<ModuleArchive> read(llvm::StringRef buffer);
+
+  llvm::ArrayRef<Entry> getEntries() const { return entries; }
+
+  /// Parses the archived module into `context`. If `filter` is given, only
+  /// the ops with a symbol name it accepts are parsed, along with the ops
+  /// without one and the modules holding them.
+  OwningOpRef<ModuleOp>
+  load(MLIRContext *context,
+       llvm::function_ref<bool(llvm::StringRef)> filter = nullptr) const;
+
+private:
+  std::vector<Entry> entries;
+};
+
+/// Parses the main buffer of `sourceMgr` into `context`, as a module archive
+/// if it holds one and as MLIR otherwise.
+OwningOpRef<ModuleOp> parseModuleOrArchive(llvm::SourceMgr &sourceMgr,
+                                           MLIRContext *context);
+
+/// Registers the mlir-to-module-archive and module-archive-to-mlir
+/// translations.
+void registerModuleArchiveTranslations();
+
+} // namespace miopen
+} // namespace mlir
+
+#endif // MLIR_TRANSLATION_MODULEARCHIVE_H
@@ -17,49 +17,82 @@
 #include "mlir/Dialect/MIGraphX/Pipeline.h"
 #include "mlir/Dialect/MIOpen/MIOpen.h"
 #include "mlir/Dialect/MIOpen/Pipelines.h"
+#include "mlir/Dialect/MIOpen/utility/KernelResources.h"
 #include "mlir/ExecutionEngine/OptUtils.h"
+#include "mlir/IR/Threading.h"
+#include "mlir/Pass/PassManager.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/ThreadPool.h"
+#include <cstdlib>
+#include <future>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
 MLIR_DEFINE_CAPI_DIALECT_REGISTRATION(MIGraphX, migraphx,
                                       mlir::migraphx::MIGraphXDialect)
 
-// Returns the required buffer size if called with null buffer
-// and fill information in the passed ptr when provided.
-MLIR_CAPI_EXPORTED
-void mlirGetKernelInfo(MlirModule module, int *size, void *data) {
-  auto mod = unwrap(module);
-  int argNum = 0;
-  int argIdx = 0;
-  llvm::StringRef kernelName;
-
-  // Either of pointers should be provided.
-  assert((size != nullptr || data != nullptr) &&
-         "Either size or data pointer should be provided");
-  std::vector<int> info;
+// Returns the number of arguments of the functions of `mod` followed by the
+// rank and dimensions of each, and sets `kernelName` to the name of the last
+// function.
+static std::vector<int> collectKernelInfo(mlir::ModuleOp mod,
+                                          llvm::StringRef &kernelName) {
+  std::vector<int> info(1, 0);
   mod.walk([&](mlir::func::FuncOp f) {
     auto args = f.getArguments();
     for (auto arg : args) {
-      argNum++;
+      info[0]++;
       auto sType = arg.getType().template cast<mlir::ShapedType>();
       auto rank = sType.getRank();
       info.push_back(rank);
       for (int i = 0; i < rank; i++)
         info.push_back(sType.getDimSize(i));
-      argIdx += rank;
     }
     kernelName = f.getName();
   });
+  return info;
+}
+
+static void collectKernelAttrs(mlir::ModuleOp mod, uint32_t *attrs) {
+  mod.walk([&](mlir::LLVM::LLVMFuncOp llvmFunc) {
+    attrs[0] =
+        llvmFunc->getAttrOfType<mlir::IntegerAttr>("block_size").getInt();
+    attrs[1] = llvmFunc->getAttrOfType<mlir::IntegerAttr>("grid_size").getInt();
+  });
+}
+
+// The resources of the last kernel of `mod`, all 0 when unknown.
+static mlir::miopen::KernelResources
+collectKernelResources(mlir::ModuleOp mod) {
+  mlir::miopen::KernelResources resources;
+  mod.walk([&](mlir::LLVM::LLVMFuncOp llvmFunc) {
+    if (auto found = mlir::miopen::KernelResources::fromAttr(
+            llvmFunc->getAttr(mlir::miopen::kKernelResourcesAttrName)))
+      resources = *found;
+  });
+  return resources;
+}
+
+// Returns the required buffer size if called with null buffer
+// and fill information in the passed ptr when provided.
+MLIR_CAPI_EXPORTED
+void mlirGetKernelInfo(MlirModule module, int *size, void *data) {
+  auto mod = unwrap(module);
+  llvm::StringRef kernelName;
+
+  // Either of pointers should be provided.
+  assert((size != nullptr || data != nullptr) &&
+         "Either size or data pointer should be provided");
+  std::vector<int> info = collectKernelInfo(mod, kernelName);
   if (data == nullptr && size != nullptr) {
-    *size = (1 + argNum + argIdx) * sizeof(int) + kernelName.size();
+    *size = info.size() * sizeof(int) + kernelName.size();
   } else if (data != nullptr) {
-    int argSize = argNum + argIdx;
     int *argData = (int *)data;
-    argData[0] = argNum;
-    for (int i = 0; i < argSize; i++)
-      argData[i + 1] = info[i];
-    char *nameData = (char *)(argData + argSize + 1);
+    std::copy(info.begin(), info.end(), argData);
+    char *nameData = (char *)(argData + info.size());
     for (size_t i = 0, e = kernelName.size(); i < e; ++i) {
       nameData[i] = kernelName[i];
     }
@@ -68,12 +101,18 @@ void mlirGetKernelInfo(MlirModule module, int *size, void *data) {
 
 // Returns block_size and grid_size as uint32_t[2]
 MLIR_CAPI_EXPORTED void mlirGetKernelAttrs(MlirModule module, uint32_t *attrs) {
-  auto mod = unwrap(module);
-  mod.walk([&](mlir::LLVM::LLVMFuncOp llvmFunc) {
-    attrs[0] =
-        llvmFunc->getAttrOfType<mlir::IntegerAttr>("block_size").getInt();
-    attrs[1] = llvmFunc->getAttrOfType<mlir::IntegerAttr>("grid_size").getInt();
-  });
+  collectKernelAttrs(unwrap(module), attrs);
+}
+
+MLIR_CAPI_EXPORTED void mlirGetKernelResources(MlirModule module,
+                                               uint32_t *resources) {
+  mlir::miopen::KernelResources found = collectKernelResources(unwrap(module));
+  resources[0] = found.vgprCount;
+  resources[1] = found.agprCount;
+  resources[2] = found.sgprCount;
+  resources[3] = found.ldsSize;
+  resources[4] = found.scratchSize;
+  resources[5] = found.wavesPerSimd;
 }
 
 // Returns the size of compiled binary if called with null ptr
@@ -101,36 +140,446 @@ MLIR_CAPI_EXPORTED bool mlirGetBinary(MlirModule module, int *size, char *bin) {
 
 // pipelines
 
-MLIR_CAPI_EXPORTED
-void mlirMIGraphXAddHighLevelPipeline(MlirPassManager pm) {
-  auto passMan = unwrap(pm);
-  // FIXME : WA for the multithreading issue, potentially fixed in upstream.
-  passMan->getContext()->disableMultithreading();
-  passMan->setNesting(mlir::PassManager::Nesting::Implicit);
-  mlir::migraphx::addHighLevelPipeline(*passMan);
-  mlir::miopen::buildBufferizePipeline(*passMan);
+static void addHighLevelPipeline(mlir::PassManager &passMan) {
+  passMan.setNesting(mlir::PassManager::Nesting::Implicit);
+  mlir::migraphx::addHighLevelPipeline(passMan);
+  mlir::miopen::buildBufferizePipeline(passMan);
 }
 
-MLIR_CAPI_EXPORTED void mlirMIGraphXAddBackendPipeline(MlirPassManager pm,
-                                                       const char *chip,
-                                                       const char *triple,
-                                                       const char *features) {
+static void addBackendPipeline(mlir::PassManager &passMan, const char *chip,
+                               const char *triple, const char *features) {
   static std::mutex target_mutex;
   target_mutex.lock();
   // Some calls included in regiserGpuSerializeToHsacoPass() are not thread safe
   // and user may call this pipeline from different threads.
   mlir::registerGpuSerializeToHsacoPass();
   target_mutex.unlock();
-  auto passMan = unwrap(pm);
-  passMan->setNesting(mlir::PassManager::Nesting::Implicit);
+  passMan.setNesting(mlir::PassManager::Nesting::Implicit);
   mlir::miopen::KernelOptions kOpts;
   kOpts.tuningFallback = true;
-  mlir::miopen::buildKernelPipeline(*passMan, kOpts);
+  mlir::miopen::buildKernelPipeline(passMan, kOpts);
   mlir::miopen::BackendOptions opts;
   opts.triple = triple;
   opts.chip = chip;
   opts.features = features;
   opts.optLevel = 3;
-  opts.indexBitwidth = 64;
-  mlir::miopen::buildBackendPipeline(*passMan, opts);
+  // The kernel cache is opt-in, by naming the directory it persists to
+  opts.kernelCache = std::getenv("MIIR_KERNEL_CACHE_DIR") != nullptr;
+  mlir::miopen::buildBackendPipeline(passMan, opts);
+}
+
+MLIR_CAPI_EXPORTED
+void mlirMIGraphXAddHighLevelPipeline(MlirPassManager pm) {
+  auto passMan = unwrap(pm);
+  // FIXME : WA for the multithreading issue, potentially fixed in upstream.
+  passMan->getContext()->disableMultithreading();
+  addHighLevelPipeline(*passMan);
+}
+
+MLIR_CAPI_EXPORTED void mlirMIGraphXAddBackendPipeline(MlirPassManager pm,
+                                                       const char *chip,
+                                                       const char *triple,
+                                                       const char *features) {
+  addBackendPipeline(*unwrap(pm), chip, triple, features);
+}
+
+// Phase 1: compiling all the functions of a module at once
+
+namespace {
+// A function of the module being compiled on its own, and its results.
+struct CompiledKernel {
+  mlir::OwningOpRef<mlir::ModuleOp> module;
+  std::unique_ptr<mlir::PassManager> highLevel;
+  std::unique_ptr<mlir::PassManager> backend;
+  std::string funcName;
+  std::string kernelName;
+  // Attributes are never freed, so the binary is used in place for as long
+  // as the context lives.
+  llvm::StringRef binary;
+  std::vector<int> argInfo;
+  uint32_t attrs[2] = {0, 0};
+  mlir::miopen::KernelResources resources;
+  bool succeeded = false;
+};
+
+struct Compilation {
+  std::vector<CompiledKernel> kernels;
+};
+} // namespace
+
+// Collects the block and grid sizes, the resources and the binary of the
+// kernel of `mod` into `kernel`, and its argument info if `withArgInfo`, all
+// in one walk.
+static void collectKernel(mlir::ModuleOp mod, CompiledKernel &kernel,
+                          bool withArgInfo) {
+  if (withArgInfo)
+    kernel.argInfo.assign(1, 0);
+  mod.walk([&](mlir::Operation *op) {
+    if (auto f = llvm::dyn_cast<mlir::func::FuncOp>(op)) {
+      if (!withArgInfo)
+        return;
+      for (auto arg : f.getArguments()) {
+        kernel.argInfo[0]++;
+        auto sType = arg.getType().template cast<mlir::ShapedType>();
+        kernel.argInfo.push_back(sType.getRank());
+        for (int64_t size : sType.getShape())
+          kernel.argInfo.push_back(size);
+      }
+      kernel.kernelName = f.getName().str();
+    } else if (auto llvmFunc = llvm::dyn_cast<mlir::LLVM::LLVMFuncOp>(op)) {
+      if (auto blockSize =
+              llvmFunc->getAttrOfType<mlir::IntegerAttr>("block_size"))
+        kernel.attrs[0] = blockSize.getInt();
+      if (auto gridSize =
+              llvmFunc->getAttrOfType<mlir::IntegerAttr>("grid_size"))
+        kernel.attrs[1] = gridSize.getInt();
+      if (auto resources = mlir::miopen::KernelResources::fromAttr(
+              llvmFunc->getAttr(mlir::miopen::kKernelResourcesAttrName)))
+        kernel.resources = *resources;
+    } else if (auto gpuModule = llvm::dyn_cast<mlir::gpu::GPUModuleOp>(op)) {
+      if (auto hsacoAttr = gpuModule->getAttrOfType<mlir::StringAttr>(
+              mlir::gpu::getDefaultGpuBinaryAnnotation()))
+        kernel.binary = hsacoAttr.getValue();
+    }
+  });
+  kernel.succeeded = !kernel.binary.empty();
+}
+
+// Runs both pipelines on the module of `kernel`, collecting what the Phase 0
+// functions would return between and after them.
+static void compileKernel(CompiledKernel &kernel) {
+  if (mlir::failed(kernel.highLevel->run(*kernel.module)))
+    return;
+  llvm::StringRef kernelName;
+  kernel.argInfo = collectKernelInfo(*kernel.module, kernelName);
+  kernel.kernelName = kernelName.str();
+  if (mlir::failed(kernel.backend->run(*kernel.module)))
+    return;
+  collectKernel(*kernel.module, kernel, /*withArgInfo=*/false);
+  // Only the results are kept.
+  kernel.module = nullptr;
+  kernel.highLevel = nullptr;
+  kernel.backend = nullptr;
+}
+
+// Gives `kernel` a module holding a clone of `func` with the attributes of
+// `mod`, and the pipelines compiling it.
+static void prepareKernel(CompiledKernel &kernel, mlir::ModuleOp mod,
+                          mlir::func::FuncOp func, const char *chip,
+                          const char *triple, const char *features) {
+  mlir::MLIRContext *ctx = mod.getContext();
+  kernel.funcName = func.getName().str();
+  kernel.module = mlir::ModuleOp::create(mod.getLoc());
+  (*kernel.module)->setAttrs(mod->getAttrDictionary());
+  kernel.module->push_back(func.clone());
+  kernel.highLevel = std::make_unique<mlir::PassManager>(ctx);
+  addHighLevelPipeline(*kernel.highLevel);
+  kernel.backend = std::make_unique<mlir::PassManager>(ctx);
+  addBackendPipeline(*kernel.backend, chip, triple, features);
+}
+
+MLIR_CAPI_EXPORTED MlirMIGraphXCompilation
+mlirMIGraphXCompileModule(MlirModule module, const char *chip,
+                          const char *triple, const char *features) {
+  mlir::ModuleOp mod = unwrap(module);
+  mlir::MLIRContext *ctx = mod.getContext();
+  auto compilation = std::make_unique<Compilation>();
+
+  // Every function gets a module and pipelines of its own, built up front so
+  // that only running them happens in parallel.
+  for (auto func : mod.getOps<mlir::func::FuncOp>()) {
+    compilation->kernels.emplace_back();
+    prepareKernel(compilation->kernels.back(), mod, func, chip, triple,
+                  features);
+  }
+
+  // The functions are compiled across the threads of the context, which
+  // mlirMIGraphXAddHighLevelPipeline may have made single-threaded, and
+  // which is left as it was found.
+  bool wasMultithreaded = ctx->isMultithreadingEnabled();
+  ctx->enableMultithreading();
+  mlir::parallelForEach(ctx, compilation->kernels, compileKernel);
+  if (!wasMultithreaded)
+    ctx->disableMultithreading();
+  return {compilation.release()};
+}
+
+MLIR_CAPI_EXPORTED MlirMIGraphXCompilation
+mlirMIGraphXFinalize(MlirModule module) {
+  auto compilation = std::make_unique<Compilation>();
+  compilation->kernels.emplace_back();
+  collectKernel(unwrap(module), compilation->kernels.back(),
+                /*withArgInfo=*/true);
+  return {compilation.release()};
+}
+
+MLIR_CAPI_EXPORTED intptr_t
+mlirMIGraphXCompilationGetNumKernels(MlirMIGraphXCompilation compilation) {
+  return static_cast<Compilation *>(compilation.ptr)->kernels.size();
+}
+
+static MlirMIGraphXKernel wrap(const CompiledKernel &kernel) {
+  MlirMIGraphXKernel result;
+  result.funcName = {kernel.funcName.data(), kernel.funcName.size()};
+  result.kernelName = {kernel.kernelName.data(), kernel.kernelName.size()};
+  result.binary = kernel.succeeded ? kernel.binary.data() : nullptr;
+  result.binarySize = kernel.succeeded ? kernel.binary.size() : 0;
+  result.blockSize = kernel.attrs[0];
+  result.gridSize = kernel.attrs[1];
+  result.argInfo = kernel.argInfo.data();
+  result.argInfoSize = kernel.argInfo.size();
+  result.vgprCount = kernel.resources.vgprCount;
+  result.agprCount = kernel.resources.agprCount;
+  result.sgprCount = kernel.resources.sgprCount;
+  result.ldsSize = kernel.resources.ldsSize;
+  result.scratchSize = kernel.resources.scratchSize;
+  result.wavesPerSimd = kernel.resources.wavesPerSimd;
+  return result;
+}
+
+MLIR_CAPI_EXPORTED MlirMIGraphXKernel mlirMIGraphXCompilationGetKernel(
+    MlirMIGraphXCompilation compilation, intptr_t pos) {
+  return wrap(static_cast<Compilation *>(compilation.ptr)->kernels[pos]);
+}
+
+MLIR_CAPI_EXPORTED void
+mlirMIGraphXCompilationDestroy(MlirMIGraphXCompilation compilation) {
+  delete static_cast<Compilation *>(compilation.ptr);
+}
+
+// Phase 2: kernels specialized to the sizes of dynamic shapes
+
+namespace {
+// The kernels compiled from a function with dynamic dimensions, by size.
+struct SpecializationCache {
+  mlir::OwningOpRef<mlir::ModuleOp> module;
+  std::string chip;
+  std::string triple;
+  std::string features;
+  // Whether a kernel may serve sizes smaller than its own, padded.
+  bool paddable = false;
+  std::mutex mutex;
+  // Kernels are never evicted, so that the ones handed out stay valid.
+  std::map<int64_t, std::unique_ptr<CompiledKernel>> kernels;
+  // The compile of every size asked for, done or not, which later requests
+  // for the size wait on instead of compiling it again.
+  std::map<int64_t, std::shared_future<CompiledKernel *>> compiles;
+};
+} // namespace
+
+// Tell if `type` has no dynamic dimension but its outermost one.
+static bool isDynamicOutermostOnly(mlir::Type type) {
+  auto tensorType = type.dyn_cast<mlir::RankedTensorType>();
+  if (!tensorType)
+    return true;
+  for (int64_t dim = 1, e = tensorType.getRank(); dim < e; ++dim)
+    if (tensorType.isDynamicDim(dim))
+      return false;
+  return true;
+}
+
+static bool isDynamic(mlir::Type type) {
+  auto tensorType = type.dyn_cast<mlir::RankedTensorType>();
+  return tensorType && !tensorType.hasStaticShape();
+}
+
+// Tell if padding the dynamic dimensions of `func` leaves its results at the
+// original size as they were. They have to be the outermost dimensions of
+// every tensor, along which every op works on each index on its own: nothing
+// reduces over them, normalizes along them, or moves or reshapes them.
+static bool isPaddable(mlir::func::FuncOp func) {
+  using namespace mlir::migraphx;
+  auto isRowwise = [](mlir::Operation *op) {
+    if (llvm::isa<mlir::func::ReturnOp, AddOp, SubOp, MulOp, PowOp, TanhOp,
+                  RecipOp, SqrtOp, RsqrtOp, CeilOp, FloorOp, ReluOp,
+                  ConvolutionOp, BatchNormOp, PoolingOp, MultiBroadcastOp>(op))
+      return true;
+    auto rank = [](mlir::Value value) {
+      return value.getType().cast<mlir::RankedTensorType>().getRank();
+    };
+    if (auto dot = llvm::dyn_cast<DotOp>(op))
+      // The outermost dimension of a vector, or of the second matrix, is
+      // the one multiplied over.
+      return (!isDynamic(dot.in_a().getType()) || rank(dot.in_a()) > 1) &&
+             (!isDynamic(dot.in_b().getType()) || rank(dot.in_b()) > 2);
+    if (auto norm = llvm::dyn_cast<LayerNormOp>(op))
+      return rank(norm.input()) > 1;
+    if (auto pad = llvm::dyn_cast<PadOp>(op)) {
+      auto pads = pad.pads().getValue();
+      return pads.size() == static_cast<size_t>(2 * rank(pad.input())) &&
+             pads[0].cast<mlir::IntegerAttr>().getInt() == 0 &&
+             pads[pads.size() / 2].cast<mlir::IntegerAttr>().getInt() == 0;
+    }
+    if (auto transpose = llvm::dyn_cast<TransposeOp>(op))
+      return !transpose.dims().empty() &&
+             transpose.dims()[0].cast<mlir::IntegerAttr>().getInt() == 0;
+    if (auto softmax = llvm::dyn_cast<SoftmaxOp>(op))
+      return softmax.axis() != 0;
+    if (auto reduce = llvm::dyn_cast<ReduceMeanOp>(op))
+      return reduce.axis() != 0;
+    if (auto flatten = llvm::dyn_cast<FlattenOp>(op))
+      return flatten.axis() != 0;
+    if (auto broadcast = llvm::dyn_cast<BroadcastOp>(op))
+      return broadcast.axis() != 0;
+    return false;
+  };
+
+  mlir::FunctionType type = func.getFunctionType();
+  if (!llvm::all_of(type.getInputs(), isDynamicOutermostOnly) ||
+      !llvm::all_of(type.getResults(), isDynamicOutermostOnly))
+    return false;
+  mlir::WalkResult result = func.walk([&](mlir::Operation *op) {
+    bool dynamicOperands = llvm::any_of(op->getOperandTypes(), isDynamic);
+    bool dynamicResults = llvm::any_of(op->getResultTypes(), isDynamic);
+    if (!dynamicOperands && !dynamicResults)
+      return mlir::WalkResult::advance();
+    // An op taking dynamic operands to static results reduces over them.
+    if (!llvm::all_of(op->getOperandTypes(), isDynamicOutermostOnly) ||
+        !llvm::all_of(op->getResultTypes(), isDynamicOutermostOnly) ||
+        (dynamicOperands && !dynamicResults && op->getNumResults() > 0) ||
+        !isRowwise(op))
+      return mlir::WalkResult::interrupt();
+    return mlir::WalkResult::advance();
+  });
+  return !result.wasInterrupted();
+}
+
+// Replaces the dynamic dimensions of `type` by `size`.
+static mlir::Type specializeType(mlir::Type type, int64_t size) {
+  auto tensorType = type.dyn_cast<mlir::RankedTensorType>();
+  if (!tensorType || tensorType.hasStaticShape())
+    return type;
+  llvm::SmallVector<int64_t, 4> shape(tensorType.getShape());
+  for (int64_t &dim : shape)
+    if (mlir::ShapedType::isDynamic(dim))
+      dim = size;
+  return tensorType.clone(shape);
+}
+
+// Returns a kernel ready to compile the function of `cache` with its dynamic
+// dimensions set to `size`. The caller holds the mutex of the cache.
+static std::unique_ptr<CompiledKernel>
+prepareSpecialization(SpecializationCache &cache, int64_t size) {
+  auto kernel = std::make_unique<CompiledKernel>();
+  auto func = *cache.module->getOps<mlir::func::FuncOp>().begin();
+  prepareKernel(*kernel, *cache.module, func, cache.chip.c_str(),
+                cache.triple.c_str(), cache.features.c_str());
+  kernel->module->walk([&](mlir::Operation *op) {
+    for (mlir::Region &region : op->getRegions())
+      for (mlir::Block &block : region)
+        for (mlir::BlockArgument arg : block.getArguments())
+          arg.setType(specializeType(arg.getType(), size));
+    for (mlir::OpResult result : op->getResults())
+      result.setType(specializeType(result.getType(), size));
+    if (auto f = llvm::dyn_cast<mlir::func::FuncOp>(op)) {
+      llvm::SmallVector<mlir::Type, 4> inputs, results;
+      for (mlir::Type type : f.getFunctionType().getInputs())
+        inputs.push_back(specializeType(type, size));
+      for (mlir::Type type : f.getFunctionType().getResults())
+        results.push_back(specializeType(type, size));
+      f.setType(mlir::FunctionType::get(f.getContext(), inputs, results));
+    }
+  });
+  return kernel;
+}
+
+// Compiles the kernel of `cache` for `size`, makes it available and hands it
+// to the requests waiting on `done`.
+static void compileSpecialization(SpecializationCache &cache, int64_t size,
+                                  std::promise<CompiledKernel *> &done) {
+  std::unique_ptr<CompiledKernel> kernel;
+  {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    kernel = prepareSpecialization(cache, size);
+  }
+  compileKernel(*kernel);
+  CompiledKernel *compiled = kernel.get();
+  {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.kernels[size] = std::move(kernel);
+  }
+  done.set_value(compiled);
+}
+
+// The compile of the kernel of `cache` for `size`. When it was not asked for
+// before, `done` is set, and the caller compiles it to `done`. The caller
+// holds the mutex of the cache.
+using SpecializationPromise = std::shared_ptr<std::promise<CompiledKernel *>>;
+static std::shared_future<CompiledKernel *>
+claimSpecialization(SpecializationCache &cache, int64_t size,
+                    SpecializationPromise &done) {
+  auto it = cache.compiles.find(size);
+  if (it != cache.compiles.end())
+    return it->second;
+  done = std::make_shared<std::promise<CompiledKernel *>>();
+  std::shared_future<CompiledKernel *> compile = done->get_future().share();
+  cache.compiles.emplace(size, compile);
+  return compile;
+}
+
+MLIR_CAPI_EXPORTED MlirMIGraphXSpecializationCache
+mlirMIGraphXSpecializationCacheCreate(MlirModule module, const char *chip,
+                                      const char *triple,
+                                      const char *features) {
+  mlir::ModuleOp mod = unwrap(module);
+  auto cache = std::make_unique<SpecializationCache>();
+  cache->module = mod.clone();
+  cache->chip = chip;
+  cache->triple = triple;
+  cache->features = features;
+  cache->paddable =
+      isPaddable(*cache->module->getOps<mlir::func::FuncOp>().begin());
+  // Kernels are compiled in the background on the threads of the context.
+  mod.getContext()->enableMultithreading();
+  return {cache.release()};
+}
+
+MLIR_CAPI_EXPORTED MlirMIGraphXKernel mlirMIGraphXSpecializationCacheLookup(
+    MlirMIGraphXSpecializationCache cache, int64_t size, int64_t *servedSize) {
+  auto &c = *static_cast<SpecializationCache *>(cache.ptr);
+  CompiledKernel *kernel = nullptr;
+  // Without padding, only the kernel of the exact size serves.
+  int64_t bucket = c.paddable ? int64_t(llvm::PowerOf2Ceil(size)) : size;
+  SpecializationPromise done;
+  std::shared_future<CompiledKernel *> compile;
+  {
+    std::lock_guard<std::mutex> lock(c.mutex);
+    // The exact kernel, or else the smallest larger one, for which the caller
+    // pads the request.
+    auto it = c.paddable ? c.kernels.lower_bound(size) : c.kernels.find(size);
+    if (it != c.kernels.end()) {
+      kernel = it->second.get();
+      *servedSize = it->first;
+    }
+    // Without a kernel for the exact size, it is compiled in the background,
+    // while the larger kernel or the bucket compiled below serves.
+    if ((!kernel || *servedSize != size) && (kernel || bucket != size)) {
+      SpecializationPromise exact;
+      claimSpecialization(c, size, exact);
+      if (exact) {
+        mlir::MLIRContext *ctx = c.module->getContext();
+        ctx->getThreadPool().async(
+            [&c, size, exact]() { compileSpecialization(c, size, *exact); });
+      }
+    }
+    if (!kernel)
+      compile = claimSpecialization(c, bucket, done);
+  }
+  if (kernel)
+    return wrap(*kernel);
+
+  // Nothing can serve the request yet: compile its bucket now, unless another
+  // request is compiling it already.
+  if (done)
+    compileSpecialization(c, bucket, *done);
+  *servedSize = bucket;
+  return wrap(*compile.get());
+}
+
+MLIR_CAPI_EXPORTED void
+mlirMIGraphXSpecializationCacheDestroy(MlirMIGraphXSpecializationCache cache) {
+  auto *c = static_cast<SpecializationCache *>(cache.ptr);
+  for (auto &compile : c->compiles)
+    compile.second.wait();
+  delete c;
 }
@@ -38,9 +38,12 @@ class FuncToCOBJPattern : public OpConversionPattern<func::CallOp> {
     SmallVector<Value, 8> mrOperands(op.getOperands());
     SmallVector<Value, 8> cobjArgs;
 
-    SmallVector<IntegerAttr, 5> globalSizeAttr;
-    SmallVector<IntegerAttr, 5> localSizeAttr;
-    SymbolRefAttr kernelRefAttr;
+    SmallVector<Attribute, 3> globalSizeAttr;
+    SmallVector<Attribute, 3> localSizeAttr;
+    // The launch schedule: the kernels in launch order and the number of
+    // arguments of each.
+    SmallVector<Attribute, 1> kernelRefAttrs;
+    SmallVector<int64_t, 1> kernelArgCounts;
     auto fusedFuncOp =
         op->getParentOfType<ModuleOp>().lookupSymbol<func::FuncOp>(
             fnAttr.getValue());
@@ -75,7 +78,8 @@ class FuncToCOBJPattern : public OpConversionPattern<func::CallOp> {
           (((blockSize.x.getDefiningOp())->getAttrOfType<IntegerAttr>("value")))
               .getInt()));
 
-      kernelRefAttr = Lop->getAttrOfType<SymbolRefAttr>("kernel");
+      kernelRefAttrs.push_back(Lop->getAttrOfType<SymbolRefAttr>("kernel"));
+      size_t firstArg = cobjArgs.size();
 
       // Lowering memref structure
       for (auto arg : mrOperands) {
@@ -124,16 +128,23 @@ class FuncToCOBJPattern : public OpConversionPattern<func::CallOp> {
 
       // insert the result buffer at the end again to specify the output buffer
       cobjArgs.push_back(mrOperands.back());
+      kernelArgCounts.push_back(cobjArgs.size() - firstArg);
     });
+    if (kernelRefAttrs.empty())
+      return failure();
 
+    // All the launches of the call go into one code object, so that they are
+    // issued back to back from one binary.
     auto cop =
         rewriter.create<mlir::migraphx::CodeObjOp>(loc, resultType, cobjArgs);
-    cop->setAttr("kernel", kernelRefAttr);
-    cop->setAttr("globalSize",
-                 rewriter.getArrayAttr(ArrayRef<Attribute>(
-                     globalSizeAttr.begin(), globalSizeAttr.end())));
-    cop->setAttr("localSize", rewriter.getArrayAttr(ArrayRef<Attribute>(
-                                  localSizeAttr.begin(), localSizeAttr.end())));
+    cop->setAttr("kernel", kernelRefAttrs.front());
+    cop->setAttr("globalSize", rewriter.getArrayAttr(globalSizeAttr));
+    cop->setAttr("localSize", rewriter.getArrayAttr(localSizeAttr));
+    if (kernelRefAttrs.size() > 1) {
+      cop->setAttr("kernels", rewriter.getArrayAttr(kernelRefAttrs));
+      cop->setAttr("kernelArgCounts",
+                   rewriter.getI64ArrayAttr(kernelArgCounts));
+    }
 
     rewriter.replaceOp(op, cop->getResults());
     return success();
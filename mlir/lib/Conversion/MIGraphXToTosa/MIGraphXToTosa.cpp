@@ -12,6 +12,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "mlir/Conversion/MIGraphXToTosa/MIGraphXToTosa.h"
+#include "mlir/Conversion/TosaToMIOpen/ConvLayouts.h"
 #include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
 #include "mlir/Dialect/Func/IR/FuncOps.h"
 #include "mlir/Dialect/MIGraphX/MIGraphXOps.h"
@@ -25,16 +26,47 @@ using namespace mlir;
 
 namespace {
 
-static bool isBroadcastable(Operation *op, Operation *operand) {
-  // tosa only broadcast implicitly on the second input of the binary operators.
-  if (op->getNumOperands() != 2)
-    return false;
-  if (op->getOperand(1) != operand->getResult(0)) {
-    // swap, if possible
-    op->setOperand(0, op->getOperand(1));
-    op->setOperand(1, operand->getResult(0));
-  }
-  return true;
+// TOSA broadcasts either operand of its binary ops along their dimensions of
+// size 1, so that a broadcast before one only needs to reshape its input to
+// the rank of the result. TosaToLinalg then indexes the input with a
+// broadcasting map, which MIOpenLinalgAlign turns into a broadcast transform
+// of the input: fused kernels read the input itself, such as a per-channel
+// bias, and never a materialized broadcast. Operands are not swapped, as
+// subtractions and powers don't commute.
+static bool isBroadcastable(Operation *op) {
+  return op->getNumOperands() == 2;
+}
+
+static tosa::TransposeOp
+getRank4TransposeOp(Location loc, Value input,
+                    ConversionPatternRewriter &rewriter,
+                    SmallVector<int64_t> &permutation, bool bRoot) {
+  auto permutationAttr = DenseIntElementsAttr::get(
+      RankedTensorType::get({4}, rewriter.getI64Type()), permutation);
+  Value permutationValue =
+      rewriter.create<arith::ConstantOp>(loc, permutationAttr);
+  ShapedType inputTy = input.getType().cast<ShapedType>();
+  auto inputShape = inputTy.getShape();
+  SmallVector<int64_t> newShape{
+      inputShape[permutation[0]], inputShape[permutation[1]],
+      inputShape[permutation[2]], inputShape[permutation[3]]};
+  Type newTy = RankedTensorType::get(newShape, inputTy.getElementType());
+
+  auto newOp =
+      rewriter.create<tosa::TransposeOp>(loc, newTy, input, permutationValue);
+  newOp->setAttr("changing_layout_root", rewriter.getBoolAttr(bRoot));
+  return newOp;
+}
+
+// Returns a constant of `value` of rank `rank`, which TOSA broadcasts along
+// every dimension of a tensor of that rank.
+static Value getSplatConstant(Location loc, Type elemType, int64_t rank,
+                              double value,
+                              ConversionPatternRewriter &rewriter) {
+  auto type = RankedTensorType::get(SmallVector<int64_t>(rank, 1), elemType);
+  auto attr =
+      DenseElementsAttr::get(type, rewriter.getFloatAttr(elemType, value));
+  return rewriter.create<arith::ConstantOp>(loc, attr);
 }
 
 class ConvConverter final
@@ -50,27 +82,6 @@ public:
     return rewriter.create<arith::ConstantOp>(loc, zeroAttr);
   }
 
-  tosa::TransposeOp getRank4TransposeOp(Location loc, Value input,
-                                        ConversionPatternRewriter &rewriter,
-                                        SmallVector<int64_t> &permutation,
-                                        bool bRoot) const {
-    auto permutationAttr = DenseIntElementsAttr::get(
-        RankedTensorType::get({4}, rewriter.getI64Type()), permutation);
-    Value permutationValue =
-        rewriter.create<arith::ConstantOp>(loc, permutationAttr);
-    ShapedType inputTy = input.getType().cast<ShapedType>();
-    auto inputShape = inputTy.getShape();
-    SmallVector<int64_t> newShape{
-        inputShape[permutation[0]], inputShape[permutation[1]],
-        inputShape[permutation[2]], inputShape[permutation[3]]};
-    Type newTy = RankedTensorType::get(newShape, inputTy.getElementType());
-
-    auto newOp =
-        rewriter.create<tosa::TransposeOp>(loc, newTy, input, permutationValue);
-    newOp->setAttr("changing_layout_root", rewriter.getBoolAttr(bRoot));
-    return newOp;
-  }
-
   LogicalResult
   matchAndRewrite(migraphx::ConvolutionOp op, OpAdaptor adaptor,
                   ConversionPatternRewriter &rewriter) const final {
@@ -82,23 +93,14 @@ public:
     auto elementTy =
         op->getOperand(0).getType().cast<ShapedType>().getElementType();
     auto outputTy = results[0].getType().cast<ShapedType>();
-    SmallVector<int64_t> NCHW2NHWC{0, 2, 3, 1};
-    SmallVector<int64_t> NHWC2NCHW{0, 3, 1, 2};
-
-    // insert transpose to input and filter tensors
-    input_t = getRank4TransposeOp(loc, input_t, rewriter, NCHW2NHWC, false);
-    filter_t = getRank4TransposeOp(loc, filter_t, rewriter, NCHW2NHWC, false);
-    auto outShape = outputTy.getShape();
-
-    // original output shape was NCHW, change it into NHWC
-    SmallVector<int64_t> newShape{outShape[0], outShape[2], outShape[3],
-                                  outShape[1]};
-    Type newOutTy = RankedTensorType::get(newShape, outputTy.getElementType());
 
-    // Construct a new Conv2DOp.
+    // Construct a new Conv2DOp on the NCHW tensors as they are, carrying
+    // their layouts instead of transposing them into the NHWC layout of TOSA
+    // and relying on TosaToMIOpen to fold the transposes back.
     auto cop = rewriter.create<tosa::Conv2DOp>(
-        loc, newOutTy,
+        loc, outputTy,
         ValueRange{input_t, filter_t, getZero(loc, elementTy, rewriter)});
+    tosa::setConvLayouts(cop, {"kcyx", "nchw", "nkhw"});
 
     // translate attributes
     auto padAttr = op->getAttr("padding").cast<ArrayAttr>();
@@ -140,10 +142,7 @@ public:
     if (auto attr = op->getAttrOfType<StringAttr>("perf_config"))
       cop->setAttr("perf_config", attr);
 
-    // transpose the output back to NCHW so that it can match following
-    // operators.
-    auto top = getRank4TransposeOp(loc, cop, rewriter, NHWC2NCHW, true);
-    rewriter.replaceOp(op, {top});
+    rewriter.replaceOp(op, cop->getResults());
     return success();
   }
 };
@@ -173,13 +172,15 @@ public:
       SmallVector<int64_t, 5> newShape;
       SmallVector<Attribute, 5> newShapeAttr;
 
-      // align the dimensions - by the given axis
+      // align the dimensions - the input starts at the given axis
       for (uint32_t i = 0; i < outRank; i++) {
-        newShapeAttr.push_back(rewriter.getI64IntegerAttr(1));
-        newShape.push_back(1);
+        int64_t inDim = i - axis;
+        int64_t size = 1;
+        if (inDim >= 0 && inDim < static_cast<int64_t>(inShape.size()))
+          size = inShape[inDim];
+        newShapeAttr.push_back(rewriter.getI64IntegerAttr(size));
+        newShape.push_back(size);
       }
-      newShapeAttr[axis] = rewriter.getI64IntegerAttr(inShape[0]);
-      newShape[axis] = inShape[0];
 
       // reshape
       auto outType = RankedTensorType::get(newShape, outElemType);
@@ -190,7 +191,7 @@ public:
     for (auto &use : op->getResult(0).getUses()) {
       auto expandedOp = use.getOwner();
       // isa binary operation,
-      if (isBroadcastable(expandedOp, op)) {
+      if (isBroadcastable(expandedOp)) {
         // replace the uses
         for (auto &operand : expandedOp->getOpOperands()) {
           if (operand.get() == op) {
@@ -227,7 +228,7 @@ public:
       if (expandedOp == op)
         continue;
       // isa binary operation,
-      if (isBroadcastable(expandedOp, op)) {
+      if (isBroadcastable(expandedOp)) {
         // get shape of the use
         auto outShape =
             expandedOp->getResultTypes()[0].cast<ShapedType>().getShape();
@@ -240,16 +241,18 @@ public:
           SmallVector<int64_t, 5> newShape;
           SmallVector<Attribute, 5> newShapeAttr;
 
-          // align the dimensions - by the given in/out shape
+          // align the dimensions - the input is aligned with the trailing
+          // dimensions of the output, as in numpy
           uint32_t i = 0;
           for (; i < outRank - inRank; i++) {
-            newShapeAttr.push_back(rewriter.getI64IntegerAttr(inShape[i]));
-            newShape.push_back(inShape[i]);
-          }
-          for (; i < outRank; i++) {
             newShapeAttr.push_back(rewriter.getI64IntegerAttr(1));
             newShape.push_back(1);
           }
+          for (; i < outRank; i++) {
+            int64_t size = inShape[i - (outRank - inRank)];
+            newShapeAttr.push_back(rewriter.getI64IntegerAttr(size));
+            newShape.push_back(size);
+          }
 
           // reshape
           auto outType = RankedTensorType::get(newShape, outElemType);
@@ -333,10 +336,323 @@ public:
     return success();
   }
 };
+
+// TOSA has no square root, but pow(x, 0.5) becomes a math.powf that the
+// math simplification of the bufferize pipeline turns back into a sqrt.
+class SqrtConverter final : public OpConversionPattern<migraphx::SqrtOp> {
+public:
+  using OpConversionPattern<migraphx::SqrtOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(migraphx::SqrtOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    Value input = adaptor.getOperands()[0];
+    auto inputTy = input.getType().cast<RankedTensorType>();
+    if (!inputTy.getElementType().isa<FloatType>())
+      return rewriter.notifyMatchFailure(op, "integer sqrt");
+    Value half = getSplatConstant(op->getLoc(), inputTy.getElementType(),
+                                  inputTy.getRank(), 0.5, rewriter);
+    rewriter.replaceOpWithNewOp<tosa::PowOp>(op, inputTy, input, half);
+    return success();
+  }
+};
+
+// softmax(x) = exp(x - max(x)) / sum(exp(x - max(x))) along the axis.
+class SoftmaxConverter final : public OpConversionPattern<migraphx::SoftmaxOp> {
+public:
+  using OpConversionPattern<migraphx::SoftmaxOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(migraphx::SoftmaxOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    Location loc = op->getLoc();
+    Value input = adaptor.getOperands()[0];
+    auto inputTy = input.getType().cast<RankedTensorType>();
+    int64_t axis = op.axis();
+    if (axis < 0)
+      axis += inputTy.getRank();
+    if (axis < 0 || axis >= inputTy.getRank())
+      return rewriter.notifyMatchFailure(op, "softmax axis out of range");
+
+    SmallVector<int64_t, 4> reducedShape(inputTy.getShape().begin(),
+                                         inputTy.getShape().end());
+    reducedShape[axis] = 1;
+    auto reducedTy =
+        RankedTensorType::get(reducedShape, inputTy.getElementType());
+    IntegerAttr axisAttr = rewriter.getI64IntegerAttr(axis);
+
+    Value max =
+        rewriter.create<tosa::ReduceMaxOp>(loc, reducedTy, input, axisAttr);
+    Value shifted = rewriter.create<tosa::SubOp>(loc, inputTy, input, max);
+    Value exp = rewriter.create<tosa::ExpOp>(loc, inputTy, shifted);
+    Value sum =
+        rewriter.create<tosa::ReduceSumOp>(loc, reducedTy, exp, axisAttr);
+    Value recip = rewriter.create<tosa::ReciprocalOp>(loc, reducedTy, sum);
+    rewriter.replaceOpWithNewOp<tosa::MulOp>(op, inputTy, exp, recip,
+                                             rewriter.getI32IntegerAttr(0));
+    return success();
+  }
+};
+// MIGraphX pools NCHW tensors and TOSA NHWC ones, so the pooling is wrapped
+// in transposes. Unlike those of a convolution, they aren't layout roots:
+// TosaToMIOpen folds them into the pooling instead.
+class PoolingConverter final
+    : public OpConversionPattern<migraphx::PoolingOp> {
+public:
+  using OpConversionPattern<migraphx::PoolingOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(migraphx::PoolingOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    if (!migraphx::isTosaCompatiblePooling(op))
+      return rewriter.notifyMatchFailure(op, "pooling has no TOSA equivalent");
+    Location loc = op->getLoc();
+    Value input = adaptor.getOperands()[0];
+    auto outputTy = op.getType().cast<ShapedType>();
+    SmallVector<int64_t> NCHW2NHWC{0, 2, 3, 1};
+    SmallVector<int64_t> NHWC2NCHW{0, 3, 1, 2};
+
+    input = getRank4TransposeOp(loc, input, rewriter, NCHW2NHWC, false);
+    ArrayRef<int64_t> outShape = outputTy.getShape();
+    Type newOutTy = RankedTensorType::get(
+        {outShape[0], outShape[2], outShape[3], outShape[1]},
+        outputTy.getElementType());
+
+    // MIGraphX pads as {top, left, bottom, right} or symmetrically as
+    // {height, width}, TOSA as {top, bottom, left, right}.
+    SmallVector<int64_t, 4> pads;
+    for (Attribute attr : op.padding())
+      pads.push_back(attr.cast<IntegerAttr>().getInt());
+    if (pads.size() == 2)
+      pads = {pads[0], pads[0], pads[1], pads[1]};
+    else
+      pads = {pads[0], pads[2], pads[1], pads[3]};
+    ArrayAttr kernel = op.length();
+    ArrayAttr stride = op.stride();
+    ArrayAttr pad = rewriter.getI64ArrayAttr(pads);
+
+    Value pool;
+    if (op.mode() == "max")
+      pool = rewriter.create<tosa::MaxPool2dOp>(loc, newOutTy, input, kernel,
+                                                stride, pad);
+    else
+      pool = rewriter.create<tosa::AvgPool2dOp>(loc, newOutTy, input, kernel,
+                                                stride, pad);
+
+    auto top = getRank4TransposeOp(loc, pool, rewriter, NHWC2NCHW, false);
+    rewriter.replaceOp(op, {top});
+    return success();
+  }
+};
+
+// mean(x) = sum(x) * (1 / n) along the axis, as TOSA has no mean.
+class ReduceMeanConverter final
+    : public OpConversionPattern<migraphx::ReduceMeanOp> {
+public:
+  using OpConversionPattern<migraphx::ReduceMeanOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(migraphx::ReduceMeanOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    Location loc = op->getLoc();
+    Value input = adaptor.getOperands()[0];
+    auto inputTy = input.getType().cast<RankedTensorType>();
+    Type elemType = inputTy.getElementType();
+    if (!elemType.isa<FloatType>())
+      return rewriter.notifyMatchFailure(op, "integer mean needs rounding");
+    int64_t axis = op.axis();
+    if (axis < 0)
+      axis += inputTy.getRank();
+    if (axis < 0 || axis >= inputTy.getRank() || inputTy.isDynamicDim(axis))
+      return rewriter.notifyMatchFailure(op, "reduce_mean axis out of range");
+
+    SmallVector<int64_t, 4> reducedShape(inputTy.getShape().begin(),
+                                         inputTy.getShape().end());
+    reducedShape[axis] = 1;
+    auto reducedTy = RankedTensorType::get(reducedShape, elemType);
+    Value sum = rewriter.create<tosa::ReduceSumOp>(
+        loc, reducedTy, input, rewriter.getI64IntegerAttr(axis));
+    Value scale = getSplatConstant(loc, elemType, inputTy.getRank(),
+                                   1.0 / inputTy.getDimSize(axis), rewriter);
+    Value mean = rewriter.create<tosa::MulOp>(loc, reducedTy, sum, scale,
+                                              rewriter.getI32IntegerAttr(0));
+
+    // The result may drop the reduced dimension.
+    auto outputTy = op.getType().cast<RankedTensorType>();
+    if (outputTy != reducedTy)
+      mean = rewriter.create<tosa::ReshapeOp>(
+          loc, outputTy, mean, rewriter.getI64ArrayAttr(outputTy.getShape()));
+    rewriter.replaceOp(op, {mean});
+    return success();
+  }
+};
+
+// y = (x - mean) * (rsqrt(variance + epsilon) * scale) + bias, with the
+// operands x, scale, bias, mean and variance in this order. The parameters
+// are reshaped to broadcast along the batch, and in spatial mode along the
+// spatial dimensions too. The factor only depends on the parameters, which
+// are constants of inference graphs, and so folds away.
+class BatchNormConverter final
+    : public OpConversionPattern<migraphx::BatchNormOp> {
+public:
+  using OpConversionPattern<migraphx::BatchNormOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(migraphx::BatchNormOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    Location loc = op->getLoc();
+    auto operands = adaptor.getOperands();
+    Value input = operands[0];
+    auto inputTy = input.getType().cast<RankedTensorType>();
+    Type elemType = inputTy.getElementType();
+    int64_t rank = inputTy.getRank();
+    if (!elemType.isa<FloatType>() || rank < 2 || !inputTy.hasStaticShape())
+      return rewriter.notifyMatchFailure(op, "unsupported batch_norm input");
+
+    // bn_mode 1 is spatial, with one parameter per channel; 0 has one per
+    // element of an image.
+    SmallVector<int64_t> paramShape(rank, 1);
+    for (int64_t d = 1; d < rank; ++d)
+      if (d == 1 || op.bn_mode() == 0)
+        paramShape[d] = inputTy.getDimSize(d);
+    auto paramTy = RankedTensorType::get(paramShape, elemType);
+
+    SmallVector<Value, 4> params;
+    for (Value param : operands.drop_front()) {
+      auto type = param.getType().cast<RankedTensorType>();
+      if (!type.hasStaticShape() ||
+          type.getNumElements() != paramTy.getNumElements() ||
+          type.getElementType() != elemType)
+        return rewriter.notifyMatchFailure(op, "unsupported batch_norm param");
+      if (type != paramTy)
+        param = rewriter.create<tosa::ReshapeOp>(
+            loc, paramTy, param, rewriter.getI64ArrayAttr(paramShape));
+      params.push_back(param);
+    }
+    Value scale = params[0], bias = params[1], mean = params[2],
+          variance = params[3];
+
+    Value epsilon = getSplatConstant(
+        loc, elemType, rank, op.epsilon().convertToDouble(), rewriter);
+    Value shifted =
+        rewriter.create<tosa::AddOp>(loc, paramTy, variance, epsilon);
+    Value invStddev = rewriter.create<tosa::RsqrtOp>(loc, paramTy, shifted);
+    Value factor = rewriter.create<tosa::MulOp>(
+        loc, paramTy, invStddev, scale, rewriter.getI32IntegerAttr(0));
+    Value centered = rewriter.create<tosa::SubOp>(loc, inputTy, input, mean);
+    Value scaled = rewriter.create<tosa::MulOp>(
+        loc, inputTy, centered, factor, rewriter.getI32IntegerAttr(0));
+    rewriter.replaceOpWithNewOp<tosa::AddOp>(op, inputTy, scaled, bias);
+    return success();
+  }
+};
+
+// TOSA has no normalization op, and spelling one out would split it back
+// into the reductions and elementwise ops it was fused from, so it reaches
+// TosaToMIOpen as a tosa.custom op that becomes a kernel of its own. The
+// scale and bias, when present, follow the input in that order.
+class LayerNormConverter final
+    : public OpConversionPattern<migraphx::LayerNormOp> {
+public:
+  using OpConversionPattern<migraphx::LayerNormOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(migraphx::LayerNormOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    SmallVector<Value, 3> inputs{adaptor.input()};
+    if (adaptor.scale())
+      inputs.push_back(adaptor.scale());
+    if (adaptor.bias())
+      inputs.push_back(adaptor.bias());
+    auto norm = rewriter.create<tosa::CustomOp>(
+        op->getLoc(), TypeRange{op.getType()},
+        rewriter.getStringAttr("miopen.layernorm"), inputs);
+    norm->setAttr("epsilon", op.epsilonAttr());
+    norm->setAttr("rms", rewriter.getBoolAttr(op.rms()));
+    norm->setAttr("has_scale", rewriter.getBoolAttr(!!adaptor.scale()));
+    norm->setAttr("has_bias", rewriter.getBoolAttr(!!adaptor.bias()));
+    rewriter.replaceOp(op, norm->getResults());
+    return success();
+  }
+};
+
+// MIGraphX lists the padding before every dimension, then the padding after
+// them, and TOSA both paddings of each dimension in turn.
+class PadConverter final : public OpConversionPattern<migraphx::PadOp> {
+public:
+  using OpConversionPattern<migraphx::PadOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(migraphx::PadOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    if (!migraphx::isTosaCompatiblePad(op))
+      return rewriter.notifyMatchFailure(op, "pad has no TOSA equivalent");
+    Location loc = op->getLoc();
+    Value input = adaptor.getOperands()[0];
+    auto inputTy = input.getType().cast<RankedTensorType>();
+    int64_t rank = inputTy.getRank();
+
+    SmallVector<int64_t> pads;
+    for (Attribute attr : op.pads())
+      pads.push_back(attr.cast<IntegerAttr>().getInt());
+    SmallVector<int64_t> padding;
+    for (int64_t d = 0; d < rank; ++d) {
+      padding.push_back(pads[d]);
+      padding.push_back(pads[d + rank]);
+    }
+    auto paddingAttr = DenseIntElementsAttr::get(
+        RankedTensorType::get({rank, 2}, rewriter.getI64Type()), padding);
+    Value paddingValue = rewriter.create<arith::ConstantOp>(loc, paddingAttr);
+
+    Type elemType = inputTy.getElementType();
+    double value = op.value().convertToDouble();
+    Attribute valueAttr =
+        elemType.isa<FloatType>()
+            ? static_cast<Attribute>(rewriter.getFloatAttr(elemType, value))
+            : rewriter.getIntegerAttr(elemType, static_cast<int64_t>(value));
+    auto padConstAttr = DenseElementsAttr::get(
+        RankedTensorType::get({}, elemType), valueAttr);
+    Value padConst = rewriter.create<arith::ConstantOp>(loc, padConstAttr);
+    rewriter.replaceOpWithNewOp<tosa::PadOp>(op, op.getType(), input,
+                                             paddingValue, padConst);
+    return success();
+  }
+};
 } // namespace
 
+bool migraphx::isTosaCompatiblePad(migraphx::PadOp op) {
+  auto type = op.input().getType().cast<RankedTensorType>();
+  if (op.mode() != migraphx::pad_op_mode_t::constant_pad ||
+      !type.getElementType().isIntOrFloat() ||
+      op.pads().size() != static_cast<size_t>(2 * type.getRank()))
+    return false;
+  // Negative pads crop, which tosa.pad doesn't.
+  return llvm::all_of(op.pads(), [](Attribute attr) {
+    return attr.cast<IntegerAttr>().getInt() >= 0;
+  });
+}
+
+bool migraphx::isTosaCompatiblePooling(migraphx::PoolingOp op) {
+  if (op.ceil_mode() != 0 || op.length().size() != 2 ||
+      op.stride().size() != 2 ||
+      op.getType().cast<ShapedType>().getRank() != 4)
+    return false;
+  size_t numPads = op.padding().size();
+  if (numPads != 2 && numPads != 4)
+    return false;
+  if (op.mode() == "max")
+    return true;
+  // TOSA leaves the padding out of the average, MIGraphX counts it in.
+  return op.mode() == "average" &&
+         llvm::all_of(op.padding(), [](Attribute attr) {
+           return attr.cast<IntegerAttr>().getInt() == 0;
+         });
+}
+
 void migraphx::populateMIGraphXToTosaConversionPatterns(
     MLIRContext *context, RewritePatternSet &patterns) {
   patterns.add<ConvConverter, BroadcastConverter, MultiBroadcastConverter,
-               DotConverter>(context);
+               DotConverter, SqrtConverter, SoftmaxConverter, PoolingConverter,
+               ReduceMeanConverter, BatchNormConverter, LayerNormConverter,
+               PadConverter>(context);
 }
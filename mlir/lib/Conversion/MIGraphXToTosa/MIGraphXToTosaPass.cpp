@@ -29,6 +29,36 @@ namespace {
 // import tablegen'ed populate function
 #include "MIGraphXToTosa.cpp.inc"
 
+// Make the constants of `func` whose data lies in a file new arguments of
+// it, recording where the data lies, so that the caller passes the data
+// mapped from the file and the compiler never reads it.
+static LogicalResult externalizeConstants(func::FuncOp func) {
+  SmallVector<migraphx::ConstantOp, 4> constants;
+  func.walk([&](migraphx::ConstantOp op) {
+    if (op.fileAttr())
+      constants.push_back(op);
+  });
+
+  Builder b(func.getContext());
+  for (migraphx::ConstantOp op : constants) {
+    if (op.valueAttr())
+      return op.emitOpError("has both a value and a file");
+    IntegerAttr offset = op.offsetAttr();
+    DictionaryAttr location = b.getDictionaryAttr(
+        {b.getNamedAttr("file", op.fileAttr()),
+         b.getNamedAttr("offset", offset ? offset : b.getI64IntegerAttr(0))});
+    unsigned index = func.getNumArguments();
+    func.insertArgument(
+        index, op.getType(),
+        b.getDictionaryAttr(
+            b.getNamedAttr(migraphx::kExternalDataAttrName, location)),
+        op.getLoc());
+    op.output().replaceAllUsesWith(func.getArgument(index));
+    op.erase();
+  }
+  return success();
+}
+
 struct MIGraphXToTosa : public MIGraphXToTosaBase<MIGraphXToTosa> {
 public:
   void getDependentDialects(DialectRegistry &registry) const override {
@@ -46,11 +76,30 @@ public:
         migraphx::AddOp, migraphx::ConstantOp, migraphx::ConvolutionOp,
         migraphx::RsqrtOp, migraphx::ReluOp, migraphx::TransposeOp,
         migraphx::BroadcastOp, migraphx::MultiBroadcastOp, migraphx::ReshapeOp,
-        migraphx::DotOp, migraphx::PowOp, migraphx::RecipOp>();
+        migraphx::DotOp, migraphx::PowOp, migraphx::RecipOp,
+        migraphx::SoftmaxOp>();
+    target.addDynamicallyLegalOp<migraphx::PoolingOp>(
+        [](migraphx::PoolingOp op) {
+          return !migraphx::isTosaCompatiblePooling(op);
+        });
+    target.addDynamicallyLegalOp<migraphx::PadOp>(
+        [](migraphx::PadOp op) { return !migraphx::isTosaCompatiblePad(op); });
+    // Integer means, normalizations and square roots are left to MIGraphX,
+    // as their TOSA forms only hold for floats.
+    target.addDynamicallyLegalOp<migraphx::ReduceMeanOp, migraphx::BatchNormOp,
+                                 migraphx::LayerNormOp,
+                                 migraphx::SqrtOp>([](Operation *op) {
+      return !op->getResultTypes()[0]
+                  .cast<ShapedType>()
+                  .getElementType()
+                  .isa<FloatType>();
+    });
 
     target.markUnknownOpDynamicallyLegal([](Operation *) { return true; });
 
     func::FuncOp func = getOperation();
+    if (failed(externalizeConstants(func)))
+      return signalPassFailure();
     populateWithGenerated(patterns);
     migraphx::populateMIGraphXToTosaConversionPatterns(func.getContext(),
                                                        patterns);
@@ -176,6 +176,11 @@ void LowerMIOpenOpsToGPUPass::runOnOperation() {
     if (auto attr = theFunc->getAttrOfType<SymbolRefAttr>(attrName)) {
       gpuFunc->setAttr(attrName, attr);
     }
+    // copy tuning_source, perf_config and conv_solver attributes
+    for (StringRef name : {"tuning_source", "perf_config", "conv_solver"}) {
+      if (auto attr = theFunc->getAttrOfType<StringAttr>(name))
+        gpuFunc->setAttr(name, attr);
+    }
 
     // convert all calls to gpu.launch_func
     SmallVector<func::CallOp, 4> calls;
@@ -0,0 +1,53 @@
+//===- ConvLayouts.cpp - Layouts of TOSA convolutions ---------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Conversion/TosaToMIOpen/ConvLayouts.h"
+#include "mlir/IR/Builders.h"
+
+using namespace mlir;
+
+tosa::ExpectedLayout tosa::getExpectedLayout(tosa::Conv2DOp op,
+                                             StringRef name) {
+  ExpectedLayout layout;
+  if (auto attr = op->getAttrOfType<StringAttr>(name)) {
+    layout.dims = attr.getValue().take_front(4);
+    StringRef blockSpec = attr.getValue().drop_front(4);
+    if (!blockSpec.empty()) {
+      layout.channel = blockSpec.back();
+      // An unparsable block is rejected along with other invalid blocks
+      if (blockSpec.drop_back().getAsInteger(10, layout.block))
+        layout.block = 0;
+    }
+  }
+  return layout;
+}
+
+bool tosa::expectsNCHWLayouts(tosa::Conv2DOp op) {
+  return getExpectedLayout(op, "expected_filter_layout").dims == "kcyx" &&
+         getExpectedLayout(op, "expected_input_layout").dims == "nchw" &&
+         getExpectedLayout(op, "expected_output_layout").dims == "nkhw";
+}
+
+tosa::ConvLayouts tosa::getConvLayouts(tosa::Conv2DOp op) {
+  auto filter = op->getAttrOfType<StringAttr>("filter_layout");
+  auto input = op->getAttrOfType<StringAttr>("input_layout");
+  auto output = op->getAttrOfType<StringAttr>("output_layout");
+  if (filter && input && output)
+    return {filter.getValue().str(), input.getValue().str(),
+            output.getValue().str()};
+  if (expectsNCHWLayouts(op))
+    return {"kcyx", "nchw", "nkhw"};
+  return {"kyxc", "nhwc", "nhwk"};
+}
+
+void tosa::setConvLayouts(tosa::Conv2DOp op, const ConvLayouts &layouts) {
+  Builder b(op->getContext());
+  op->setAttr("filter_layout", b.getStringAttr(layouts.filter));
+  op->setAttr("input_layout", b.getStringAttr(layouts.input));
+  op->setAttr("output_layout", b.getStringAttr(layouts.output));
+}
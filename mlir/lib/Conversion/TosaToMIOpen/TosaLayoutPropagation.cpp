@@ -0,0 +1,382 @@
+//===- TosaLayoutPropagation.cpp - Fold transposes into conv layouts ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// These rewriters move tosa.transpose ops through elementwise ops towards the
+// convolutions of a kernel, and fold the transposes reaching a convolution
+// into the layouts it holds its input, filter and output in. Every rewrite
+// keeps or lowers the number of transposes that have to be materialized, so
+// applying them to a fixed point leaves a kernel with no more transposes than
+// it started with. Transposes of constants and of tensors with at most one
+// non-unit dimension are free, as they become constants and reshapes.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Conversion/TosaToMIOpen/ConvLayouts.h"
+#include "mlir/Conversion/TosaToMIOpen/TosaToMIOpen.h"
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/Tosa/IR/TosaOps.h"
+#include "mlir/IR/Matchers.h"
+#include "mlir/IR/PatternMatch.h"
+
+using namespace mlir;
+
+namespace {
+
+static Optional<SmallVector<int64_t, 4>> getPermutation(tosa::TransposeOp op) {
+  DenseIntElementsAttr permAttr;
+  if (!matchPattern(op.perms(), m_Constant(&permAttr)))
+    return llvm::None;
+  return llvm::to_vector<4>(permAttr.getValues<int64_t>());
+}
+
+/// Returns `values` transposed by `perm`, as tosa.transpose does with the
+/// dimensions of its input.
+template <typename T>
+static SmallVector<T, 4> permute(ArrayRef<T> values, ArrayRef<int64_t> perm) {
+  SmallVector<T, 4> result;
+  for (int64_t dim : perm)
+    result.push_back(values[dim]);
+  return result;
+}
+
+static std::string permuteLayout(StringRef layout, ArrayRef<int64_t> perm) {
+  std::string result;
+  for (int64_t dim : perm)
+    result.push_back(layout[dim]);
+  return result;
+}
+
+static SmallVector<int64_t, 4> invertPermutation(ArrayRef<int64_t> perm) {
+  SmallVector<int64_t, 4> inverse(perm.size());
+  for (size_t i = 0, e = perm.size(); i < e; ++i)
+    inverse[perm[i]] = i;
+  return inverse;
+}
+
+static RankedTensorType permuteType(Type type, ArrayRef<int64_t> perm) {
+  auto tensorType = type.cast<RankedTensorType>();
+  return RankedTensorType::get(permute(tensorType.getShape(), perm),
+                               tensorType.getElementType());
+}
+
+static DenseElementsAttr getConstantAttr(Value value) {
+  DenseElementsAttr attr;
+  if (matchPattern(value, m_Constant(&attr)))
+    return attr;
+  return {};
+}
+
+/// Whether transposing `value` does not move any data, because it is a
+/// constant or holds at most one element along all but one dimension.
+static bool isFreeToTranspose(Value value) {
+  if (getConstantAttr(value))
+    return true;
+  auto type = value.getType().dyn_cast<RankedTensorType>();
+  return type && type.hasStaticShape() &&
+         llvm::count_if(type.getShape(), [](int64_t size) {
+           return size != 1;
+         }) <= 1;
+}
+
+/// Transposes the constant `attr` by `perm`.
+static DenseElementsAttr permuteConstant(DenseElementsAttr attr,
+                                         ArrayRef<int64_t> perm) {
+  RankedTensorType type = permuteType(attr.getType(), perm);
+  if (attr.isSplat())
+    return attr.reshape(type);
+  ArrayRef<int64_t> shape = attr.getType().getShape();
+  SmallVector<Attribute> values(attr.getValues<Attribute>());
+  SmallVector<Attribute> permuted;
+  permuted.reserve(values.size());
+  SmallVector<int64_t, 4> index(perm.size(), 0);
+  for (int64_t i = 0, e = values.size(); i < e; ++i) {
+    // `index` walks the result in order; read the matching source element
+    int64_t source = 0;
+    SmallVector<int64_t, 4> sourceIndex(perm.size());
+    for (size_t d = 0, r = perm.size(); d < r; ++d)
+      sourceIndex[perm[d]] = index[d];
+    for (size_t d = 0, r = perm.size(); d < r; ++d)
+      source = source * shape[d] + sourceIndex[d];
+    permuted.push_back(values[source]);
+    for (int64_t d = perm.size() - 1; d >= 0; --d) {
+      if (++index[d] < type.getDimSize(d))
+        break;
+      index[d] = 0;
+    }
+  }
+  return DenseElementsAttr::get(type, permuted);
+}
+
+/// Builds `input` transposed by `perm`, as a constant or reshape when that
+/// is free.
+static Value createTranspose(PatternRewriter &b, Location loc, Value input,
+                             ArrayRef<int64_t> perm) {
+  RankedTensorType type = permuteType(input.getType(), perm);
+  if (DenseElementsAttr attr = getConstantAttr(input))
+    return b.create<arith::ConstantOp>(loc, permuteConstant(attr, perm));
+  if (isFreeToTranspose(input))
+    return b.create<tosa::ReshapeOp>(loc, type, input,
+                                     b.getI64ArrayAttr(type.getShape()));
+  auto permAttr = DenseIntElementsAttr::get(
+      RankedTensorType::get({static_cast<int64_t>(perm.size())},
+                            b.getI64Type()),
+      perm);
+  Value permValue = b.create<arith::ConstantOp>(loc, permAttr);
+  return b.create<tosa::TransposeOp>(loc, type, input, permValue);
+}
+
+static bool isElementwise(Operation *op) {
+  if (op->getNumResults() != 1)
+    return false;
+  if (!op->hasTrait<OpTrait::Elementwise>() &&
+      !op->hasTrait<OpTrait::ResultsBroadcastableShape>() &&
+      !isa<tosa::AbsOp, tosa::CastOp, tosa::CeilOp, tosa::ClampOp, tosa::ExpOp,
+           tosa::FloorOp, tosa::LogOp, tosa::NegateOp, tosa::ReciprocalOp,
+           tosa::ReluNOp, tosa::RsqrtOp, tosa::SelectOp, tosa::SigmoidOp,
+           tosa::TanhOp>(op))
+    return false;
+  auto resultType = op->getResult(0).getType().dyn_cast<RankedTensorType>();
+  return resultType &&
+         llvm::all_of(op->getOperandTypes(), [&](Type type) {
+           auto operandType = type.dyn_cast<RankedTensorType>();
+           return operandType &&
+                  operandType.getRank() == resultType.getRank();
+         });
+}
+
+/// Channel-blocked convolutions keep the layouts they were given.
+static bool hasFixedLayouts(tosa::Conv2DOp op) {
+  for (StringRef name : {"expected_filter_layout", "expected_input_layout",
+                         "expected_output_layout"})
+    if (auto attr = op->getAttrOfType<StringAttr>(name))
+      if (attr.getValue().size() > 4)
+        return true;
+  return false;
+}
+
+/// MIOpen convolutions need the two spatial dimensions of a tensor next to
+/// each other, in order.
+static bool hasAdjacentSpatialDims(StringRef layout, char height, char width) {
+  size_t pos = layout.find(height);
+  return pos != StringRef::npos && pos + 1 < layout.size() &&
+         layout[pos + 1] == width;
+}
+
+/// Creates `op` with `operands` and a result of type `resultType`.
+static Operation *cloneElementwise(PatternRewriter &b, Operation *op,
+                                   ValueRange operands, Type resultType) {
+  OperationState state(op->getLoc(), op->getName(), operands, resultType,
+                       op->getAttrs());
+  return b.create(state);
+}
+
+// transpose(transpose(x, p1), p2) -> transpose(x, p1 . p2)
+struct ComposeTransposes : public OpRewritePattern<tosa::TransposeOp> {
+  using OpRewritePattern<tosa::TransposeOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(tosa::TransposeOp op,
+                                PatternRewriter &b) const override {
+    auto inner = op.input1().getDefiningOp<tosa::TransposeOp>();
+    if (!inner)
+      return failure();
+    Optional<SmallVector<int64_t, 4>> outerPerm = getPermutation(op);
+    Optional<SmallVector<int64_t, 4>> innerPerm = getPermutation(inner);
+    if (!outerPerm || !innerPerm)
+      return failure();
+    SmallVector<int64_t, 4> perm =
+        permute(ArrayRef<int64_t>(*innerPerm), *outerPerm);
+    Value input = inner.input1();
+    if (llvm::equal(perm, llvm::seq<int64_t>(0, perm.size())))
+      b.replaceOp(op, input);
+    else
+      b.replaceOp(op, createTranspose(b, op.getLoc(), input, perm));
+    return success();
+  }
+};
+
+// conv(transpose(x, p), transpose(w, q)) -> conv(x, w) with the input and
+// filter layouts permuted accordingly
+struct FoldTransposedConvOperands : public OpRewritePattern<tosa::Conv2DOp> {
+  using OpRewritePattern<tosa::Conv2DOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(tosa::Conv2DOp op,
+                                PatternRewriter &b) const override {
+    if (hasFixedLayouts(op))
+      return failure();
+    tosa::ConvLayouts layouts = tosa::getConvLayouts(op);
+    static constexpr char spatialDims[2][2] = {{'h', 'w'}, {'y', 'x'}};
+    bool changed = false;
+    auto fold = [&](unsigned operandIdx, std::string &layout) {
+      auto transpose =
+          op->getOperand(operandIdx).getDefiningOp<tosa::TransposeOp>();
+      if (!transpose)
+        return;
+      Optional<SmallVector<int64_t, 4>> perm = getPermutation(transpose);
+      if (!perm)
+        return;
+      std::string newLayout = permuteLayout(layout, invertPermutation(*perm));
+      if (!hasAdjacentSpatialDims(newLayout, spatialDims[operandIdx][0],
+                                  spatialDims[operandIdx][1]))
+        return;
+      layout = newLayout;
+      op->setOperand(operandIdx, transpose.input1());
+      changed = true;
+    };
+    b.startRootUpdate(op);
+    fold(0, layouts.input);
+    fold(1, layouts.filter);
+    if (!changed) {
+      b.cancelRootUpdate(op);
+      return failure();
+    }
+    tosa::setConvLayouts(op, layouts);
+    b.finalizeRootUpdate(op);
+    return success();
+  }
+};
+
+// transpose(conv(x, w), p) -> conv(x, w) with the output layout permuted
+struct FoldConvResultTranspose : public OpRewritePattern<tosa::TransposeOp> {
+  using OpRewritePattern<tosa::TransposeOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(tosa::TransposeOp op,
+                                PatternRewriter &b) const override {
+    auto conv = op.input1().getDefiningOp<tosa::Conv2DOp>();
+    if (!conv || !conv->hasOneUse() || hasFixedLayouts(conv))
+      return failure();
+    Optional<SmallVector<int64_t, 4>> perm = getPermutation(op);
+    if (!perm)
+      return failure();
+
+    tosa::ConvLayouts layouts = tosa::getConvLayouts(conv);
+    layouts.output = permuteLayout(layouts.output, *perm);
+    if (!hasAdjacentSpatialDims(layouts.output, 'h', 'w'))
+      return failure();
+    auto newConv = b.create<tosa::Conv2DOp>(conv.getLoc(), op.getType(),
+                                            conv->getOperands(),
+                                            conv->getAttrs());
+    tosa::setConvLayouts(newConv, layouts);
+    b.replaceOp(op, newConv->getResults());
+    b.eraseOp(conv);
+    return success();
+  }
+};
+
+// elementwise(transpose(a, p), transpose(b, p)) ->
+//   transpose(elementwise(a, b), p)
+// Applies when it removes transposes, or moves one closer to a convolution
+// or another transpose it can fold into.
+struct SinkTransposeThroughElementwise : public RewritePattern {
+  SinkTransposeThroughElementwise(MLIRContext *context)
+      : RewritePattern(MatchAnyOpTypeTag(), /*benefit=*/1, context) {}
+
+  LogicalResult matchAndRewrite(Operation *op,
+                                PatternRewriter &b) const override {
+    if (!isElementwise(op))
+      return failure();
+    Optional<SmallVector<int64_t, 4>> perm;
+    SmallPtrSet<Operation *, 4> removed;
+    for (Value operand : op->getOperands()) {
+      auto transpose = operand.getDefiningOp<tosa::TransposeOp>();
+      if (!transpose) {
+        if (!isFreeToTranspose(operand))
+          return failure();
+        continue;
+      }
+      // Leave transposes of convolution results to fold into the convolution
+      auto conv = transpose.input1().getDefiningOp<tosa::Conv2DOp>();
+      if (conv && conv->hasOneUse() && !hasFixedLayouts(conv))
+        return failure();
+      Optional<SmallVector<int64_t, 4>> operandPerm =
+          getPermutation(transpose);
+      if (!operandPerm || (perm && *perm != *operandPerm))
+        return failure();
+      perm = operandPerm;
+      if (llvm::all_of(transpose->getUsers(),
+                       [&](Operation *user) { return user == op; }))
+        removed.insert(transpose);
+    }
+    if (!perm || removed.empty())
+      return failure();
+    if (removed.size() == 1 &&
+        !llvm::all_of(op->getUsers(), [](Operation *user) {
+          return isa<tosa::TransposeOp, tosa::Conv2DOp>(user) ||
+                 isElementwise(user);
+        }))
+      return failure();
+
+    SmallVector<int64_t, 4> inverse = invertPermutation(*perm);
+    SmallVector<Value, 3> operands;
+    for (Value operand : op->getOperands()) {
+      if (auto transpose = operand.getDefiningOp<tosa::TransposeOp>())
+        operands.push_back(transpose.input1());
+      else
+        operands.push_back(createTranspose(b, op->getLoc(), operand, inverse));
+    }
+    Operation *newOp = cloneElementwise(
+        b, op, operands, permuteType(op->getResult(0).getType(), inverse));
+    b.replaceOp(op, createTranspose(b, op->getLoc(), newOp->getResult(0),
+                                    *perm));
+    return success();
+  }
+};
+
+// transpose(elementwise(conv(x, w), c), p) ->
+//   elementwise(transpose(conv(x, w), p), transpose(c, p))
+// Applies when every transpose this creates folds away again.
+struct HoistTransposeThroughElementwise
+    : public OpRewritePattern<tosa::TransposeOp> {
+  using OpRewritePattern<tosa::TransposeOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(tosa::TransposeOp op,
+                                PatternRewriter &b) const override {
+    Operation *elementwise = op.input1().getDefiningOp();
+    if (!elementwise || !elementwise->hasOneUse() ||
+        !isElementwise(elementwise))
+      return failure();
+    Optional<SmallVector<int64_t, 4>> perm = getPermutation(op);
+    if (!perm)
+      return failure();
+    bool reachesConv = false;
+    for (Value operand : elementwise->getOperands()) {
+      if (isFreeToTranspose(operand))
+        continue;
+      Operation *def = operand.getDefiningOp();
+      if (!def || !operand.hasOneUse())
+        return failure();
+      if (auto conv = dyn_cast<tosa::Conv2DOp>(def)) {
+        std::string output =
+            permuteLayout(tosa::getConvLayouts(conv).output, *perm);
+        if (hasFixedLayouts(conv) || !hasAdjacentSpatialDims(output, 'h', 'w'))
+          return failure();
+        reachesConv = true;
+      } else if (!isa<tosa::TransposeOp>(def)) {
+        return failure();
+      }
+    }
+    if (!reachesConv)
+      return failure();
+
+    SmallVector<Value, 3> operands;
+    for (Value operand : elementwise->getOperands())
+      operands.push_back(createTranspose(b, op.getLoc(), operand, *perm));
+    Operation *newOp = cloneElementwise(b, elementwise, operands, op.getType());
+    b.replaceOp(op, newOp->getResults());
+    b.eraseOp(elementwise);
+    return success();
+  }
+};
+
+} // namespace
+
+void tosa::populateTosaLayoutPropagationPatterns(MLIRContext *context,
+                                                 RewritePatternSet &patterns) {
+  patterns.add<ComposeTransposes, FoldTransposedConvOperands,
+               FoldConvResultTranspose, SinkTransposeThroughElementwise,
+               HoistTransposeThroughElementwise>(context);
+}
@@ -11,6 +11,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "mlir/Conversion/TosaToMIOpen/TosaToMIOpen.h"
+#include "mlir/Conversion/TosaToMIOpen/ConvLayouts.h"
 #include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
 #include "mlir/Dialect/Bufferization/IR/Bufferization.h"
 #include "mlir/Dialect/Bufferization/Transforms/Bufferize.h"
@@ -18,36 +19,25 @@
 #include "mlir/Dialect/Linalg/IR/Linalg.h"
 #include "mlir/Dialect/MIOpen/MIOpen.h"
 #include "mlir/Dialect/MIOpen/TransformMapBuilder.h"
+#include "mlir/Dialect/MIOpen/Tuning/UtilityParams.h"
 #include "mlir/Dialect/MIOpen/utility/builderUtils.h"
 #include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
 #include "mlir/Dialect/MemRef/IR/MemRef.h"
 #include "mlir/Dialect/Tosa/IR/TosaOps.h"
+#include "mlir/Dialect/Tosa/Transforms/Passes.h"
+#include "mlir/Dialect/Utils/StructuredOpsUtils.h"
+#include "mlir/IR/Matchers.h"
 #include "mlir/IR/PatternMatch.h"
 #include "mlir/Transforms/DialectConversion.h"
 #include "mlir/Transforms/GreedyPatternRewriteDriver.h"
 
+#include <cmath>
+#include <limits>
+
 using namespace mlir;
 
 namespace {
 
-// Tell if the given tosa conv2d is supposed to have NCHW layout
-static bool checkNCHW(tosa::Conv2DOp &convOp) {
-  // Check if the convolution has expected layout
-  auto fLayout = convOp->getAttr("expected_filter_layout");
-  auto iLayout = convOp->getAttr("expected_input_layout");
-  auto oLayout = convOp->getAttr("expected_output_layout");
-  if (!fLayout || !iLayout || !oLayout) {
-    return false;
-  }
-  // Test if all match
-  if (!(fLayout.dyn_cast<StringAttr>().getValue().equals("kcyx") &&
-        iLayout.dyn_cast<StringAttr>().getValue().equals("nchw") &&
-        oLayout.dyn_cast<StringAttr>().getValue().equals("nkhw"))) {
-    return false;
-  }
-  return true;
-}
-
 static bool isZeroAttribute(Attribute value) {
   if (auto intValue = value.dyn_cast<IntegerAttr>())
     return intValue.getValue().isNullValue();
@@ -66,6 +56,10 @@ static bool isConstantZero(Value v) {
   if (auto cst = v.getDefiningOp<arith::ConstantOp>()) {
     return isZeroAttribute(cst.getValue());
   }
+  // Such as the biases MIOpenMixedPrecision casts and
+  // MIOpenFoldConstantWeights folds
+  if (auto cst = v.getDefiningOp<tosa::ConstOp>())
+    return isZeroAttribute(cst.value());
   return false;
 }
 
@@ -93,24 +87,94 @@ static Value expandMemRef(ConversionPatternRewriter &rw, Operation *op,
   return rw.create<miopen::TransformOp>(loc, operand, transform.get());
 }
 
-static LogicalResult
-makeMIOpenConv2D(ConversionPatternRewriter &rw, Operation *op, Value input,
-                 const char *inputLayout, Value filter,
-                 const char *filterLayout, Value output,
-                 const char *outputLayout, const ArrayAttr &pad,
-                 const ArrayAttr &stride, const ArrayAttr &dilation) {
+// Present a tensor whose buffer holds it in the channel-blocked layout
+// `layout` as the rank-5 tensor laid out as `logicalLayout`.
+static Value unblockMemRef(ConversionPatternRewriter &rw, Operation *op,
+                           Value operand, const tosa::ExpectedLayout &layout,
+                           StringRef logicalLayout) {
   auto loc = op->getLoc();
-  auto func = op->getParentOfType<func::FuncOp>();
+  auto oprType = operand.getType().template cast<MemRefType>();
+  ArrayRef<int64_t> shape = oprType.getShape();
+  size_t channelDim = layout.dims.find(layout.channel);
+  if (!oprType.hasStaticShape() || layout.block <= 1 ||
+      channelDim == StringRef::npos || shape[channelDim] % layout.block != 0) {
+    (void)rw.notifyMatchFailure(
+        op, "channel block has to evenly divide statically shaped channels");
+    return Value();
+  }
 
-  // expand tensors from rank 4 (NHWC) to rank 5 (NHWCG)
-  auto inputExp = expandMemRef(rw, op, input);
-  auto filterExp = expandMemRef(rw, op, filter);
-  auto outputExp = expandMemRef(rw, op, output);
+  // Reinterpret the buffer in the blocked shape, with the channel block as
+  // the innermost dimension
+  SmallVector<int64_t, 5> blockedShape(shape.begin(), shape.end());
+  blockedShape[channelDim] /= layout.block;
+  blockedShape.push_back(layout.block);
+  ReassociationIndices collapsed, expanded;
+  for (int64_t i = 0, e = shape.size(); i < e; ++i)
+    collapsed.push_back(i);
+  expanded = collapsed;
+  expanded.push_back(shape.size());
+  Value flat = rw.create<memref::CollapseShapeOp>(
+      loc, operand, ArrayRef<ReassociationIndices>{collapsed});
+  Value blocked = rw.create<memref::ExpandShapeOp>(
+      loc, MemRefType::get(blockedShape, oprType.getElementType()), flat,
+      ArrayRef<ReassociationIndices>{expanded});
+
+  SmallVector<StringRef, 5> blockedNames, logicalNames;
+  for (size_t i = 0, e = layout.dims.size(); i < e; ++i)
+    blockedNames.push_back(layout.dims.substr(i, 1));
+  blockedNames.push_back("block");
+  for (size_t i = 0, e = logicalLayout.size(); i < e; ++i)
+    logicalNames.push_back(logicalLayout.substr(i, 1));
+
+  TransformMapAttr unblock = miopen::unblockChannels(
+      rw, blockedNames, blockedShape, blockedNames[channelDim], "block",
+      logicalNames, loc);
+  return rw.create<miopen::TransformOp>(loc, blocked, unblock);
+}
 
-  // Construct a new Conv2DOp.
-  TypeRange resultTypes;
-  auto cop = rw.create<miopen::Conv2DOp>(
-      loc, resultTypes, ValueRange{filterExp, inputExp, outputExp});
+// If the tensor `operand`, expected to have the dimensions `dims`, is stored
+// with its `channel` dimension blocked, replace it by its unblocked rank-5
+// view, whose layout is returned in `layout`, and record its channel block.
+static LogicalResult unblockOperand(ConversionPatternRewriter &rw,
+                                    Operation *op,
+                                    const tosa::ExpectedLayout &expected,
+                                    StringRef dims, char channel,
+                                    bool groupFirst, Value &operand,
+                                    std::string &layout, int64_t &block) {
+  if (expected.block == 1)
+    return success();
+  if (expected.dims != dims || expected.channel != channel)
+    return rw.notifyMatchFailure(op, "unsupported channel-blocked layout");
+
+  // Only the channels within a block are contiguous, so the channel becomes
+  // the fastest changing dimension, for loads along it to be vectorized
+  std::string logical;
+  for (char dim : dims)
+    if (dim != channel)
+      logical.push_back(dim);
+  logical = groupFirst ? "g" + logical + channel : logical + "g" + channel;
+
+  operand = unblockMemRef(rw, op, operand, expected, logical);
+  if (!operand)
+    return failure();
+  layout = logical;
+  block = expected.block;
+  return success();
+}
+
+// The channel blocks of the tensors of a convolution, which are 1 for tensors
+// that aren't channel-blocked.
+struct ChannelBlocks {
+  int64_t filter = 1;
+  int64_t input = 1;
+  int64_t output = 1;
+};
+
+// Give `miopenOp`, which replaces `op`, the target attributes of `op` or of
+// its function.
+static void affixTargetAttributes(ConversionPatternRewriter &rw, Operation *op,
+                                  Operation *miopenOp) {
+  auto func = op->getParentOfType<func::FuncOp>();
 
   // TODO(sjw): get these from options
   StringRef arch = "gfx906";
@@ -132,6 +196,35 @@ makeMIOpenConv2D(ConversionPatternRewriter &rw, Operation *op, Value input,
   else if (auto attr = func->getAttrOfType<BoolAttr>("xdlopsV2"))
     xdlopsV2 = attr.getValue();
 
+  // arch-specific attributes
+  // TODO: remove these
+  miopenOp->setAttr("arch", rw.getStringAttr(arch));
+  miopenOp->setAttr("num_cu", rw.getI32IntegerAttr(num_cu));
+  miopenOp->setAttr("xdlopsV2", rw.getBoolAttr(xdlopsV2));
+  if (auto attr = op->getAttrOfType<StringAttr>("perf_config"))
+    miopenOp->setAttr("perf_config", attr);
+  // i8 tensors holding fp8 data say so on the ops that consume them.
+  if (auto attr = op->getAttrOfType<StringAttr>("fp8_format"))
+    miopenOp->setAttr("fp8_format", attr);
+  if (auto attr = op->getAttrOfType<FloatAttr>("fp8_scale"))
+    miopenOp->setAttr("fp8_scale", attr);
+  // So do f32 tensors whose products may use the xf32 XDLOPS.
+  if (op->hasAttr("xf32") && xdlopsV2)
+    miopenOp->setAttr("xf32", rw.getUnitAttr());
+  // And convolutions whose filters -miopen-fold-constant-weights compressed.
+  if (op->hasAttr("sparse"))
+    miopenOp->setAttr("sparse", rw.getUnitAttr());
+}
+
+// Give `cop`, the MIOpen convolution replacing `op`, the layouts of its
+// tensors and its convolution parameters.
+static void affixConvAttributes(ConversionPatternRewriter &rw, Operation *op,
+                                Operation *cop, const char *inputLayout,
+                                const char *filterLayout,
+                                const char *outputLayout, const ArrayAttr &pad,
+                                const ArrayAttr &stride,
+                                const ArrayAttr &dilation,
+                                const ChannelBlocks &blocks) {
   // translate attributes
   int32_t padTop = pad[0].dyn_cast<IntegerAttr>().getInt();
   int32_t padBottom = pad[1].dyn_cast<IntegerAttr>().getInt();
@@ -155,13 +248,7 @@ makeMIOpenConv2D(ConversionPatternRewriter &rw, Operation *op, Value input,
         rw.getStringAttr((StringRef(&outputLayout[i], 1) + "o").str()));
   }
 
-  // arch-specific attributes
-  // TODO: remove these
-  cop->setAttr("arch", rw.getStringAttr(arch));
-  cop->setAttr("num_cu", rw.getI32IntegerAttr(num_cu));
-  cop->setAttr("xdlopsV2", rw.getBoolAttr(xdlopsV2));
-  if (auto attr = op->getAttrOfType<StringAttr>("perf_config"))
-    cop->setAttr("perf_config", attr);
+  affixTargetAttributes(rw, op, cop);
 
   // convolution config attributes
   cop->setAttr("filter_layout",
@@ -174,6 +261,13 @@ makeMIOpenConv2D(ConversionPatternRewriter &rw, Operation *op, Value input,
                rw.getArrayAttr(ArrayRef<Attribute>(outputLayoutSpec.begin(),
                                                    outputLayoutSpec.end())));
 
+  if (blocks.filter > 1)
+    cop->setAttr("filter_channel_block", rw.getI32IntegerAttr(blocks.filter));
+  if (blocks.input > 1)
+    cop->setAttr("input_channel_block", rw.getI32IntegerAttr(blocks.input));
+  if (blocks.output > 1)
+    cop->setAttr("output_channel_block", rw.getI32IntegerAttr(blocks.output));
+
   cop->setAttr("dilations", rw.getArrayAttr({
                                 rw.getI32IntegerAttr(dilationHeight),
                                 rw.getI32IntegerAttr(dilationWidth),
@@ -188,10 +282,123 @@ makeMIOpenConv2D(ConversionPatternRewriter &rw, Operation *op, Value input,
                               rw.getI32IntegerAttr(padLeft),
                               rw.getI32IntegerAttr(padRight),
                           }));
+}
 
+static LogicalResult
+makeMIOpenConv2D(ConversionPatternRewriter &rw, Operation *op, Value input,
+                 const char *inputLayout, Value filter,
+                 const char *filterLayout, Value output,
+                 const char *outputLayout, const ArrayAttr &pad,
+                 const ArrayAttr &stride, const ArrayAttr &dilation,
+                 const ChannelBlocks &blocks = {},
+                 Value requantScales = Value(),
+                 IntegerAttr requantZeroPoint = {}) {
+  auto loc = op->getLoc();
+
+  // expand tensors from rank 4 (NHWC) to rank 5 (NHWCG), which the views of
+  // channel-blocked tensors already are
+  auto expand = [&](Value operand) {
+    if (operand.getType().template cast<ShapedType>().getRank() == 5)
+      return operand;
+    return expandMemRef(rw, op, operand);
+  };
+  auto inputExp = expand(input);
+  auto filterExp = expand(filter);
+  auto outputExp = expand(output);
+
+  // Construct a new Conv2DOp.
+  TypeRange resultTypes;
+  auto cop = rw.create<miopen::Conv2DOp>(loc, resultTypes, filterExp, inputExp,
+                                         outputExp, /*workspace=*/Value(),
+                                         requantScales);
+  affixConvAttributes(rw, op, cop, inputLayout, filterLayout, outputLayout,
+                      pad, stride, dilation, blocks);
+  if (requantZeroPoint && requantZeroPoint.getInt() != 0)
+    cop->setAttr("requant_zero_point", requantZeroPoint);
   return success();
 }
 
+// Add the bias of `op`, its third operand, which `bias` holds, to `output`
+// along its `channelDim` dimension, unless it is zero. Returns the sum, or
+// `output` itself for a zero bias.
+static FailureOr<Value> addConvBias(ConversionPatternRewriter &rw,
+                                    Operation *op, Value output, Value bias,
+                                    size_t channelDim) {
+  // test for zero bias, and ignore
+  if (isConstantZero(op->getOperand(2)))
+    return output;
+
+  // non-zero bias, replace with tosa.add w/ broadcast
+  Location loc = op->getLoc();
+  MLIRContext *context = op->getContext();
+  auto conv_output_t = rw.create<bufferization::ToTensorOp>(loc, output);
+
+  auto biasType = bias.getType().template cast<ShapedType>();
+  if (!biasType.hasStaticShape())
+    return failure();
+
+  // broadcast the bias along every output dimension but the channel
+  SmallVector<int64_t, 4> bias_s(4, 1);
+  bias_s[channelDim] = biasType.getShape()[0];
+  auto newType = MemRefType::get(bias_s, biasType.getElementType());
+
+  SmallVector<ReassociationExprs, 1> reassociations;
+
+  // [[0, 1, 2, 3]]
+  reassociations.push_back(
+      {getAffineDimExpr(0, context), getAffineDimExpr(1, context),
+       getAffineDimExpr(2, context), getAffineDimExpr(3, context)});
+
+  auto bias_expand_mr =
+      rw.create<memref::ExpandShapeOp>(loc, newType, bias, reassociations);
+
+  auto bias_t = rw.create<bufferization::ToTensorOp>(loc, bias_expand_mr);
+  return rw
+      .create<tosa::AddOp>(loc, op->getResult(0).getType(),
+                           ValueRange{conv_output_t, bias_t})
+      .getResult();
+}
+
+// Lower `op`, whose converted operands are `operands`, to a miopen.conv2d
+// writing `output`, which requantizes its results with `requantScales` and
+// `requantZeroPoint` if they are given.
+static LogicalResult convertConv(ConversionPatternRewriter &rw,
+                                 tosa::Conv2DOp op, ValueRange operands,
+                                 Value output, Value requantScales = Value(),
+                                 IntegerAttr requantZeroPoint = {}) {
+  Value input = operands[0];
+  Value filter = operands[1];
+  tosa::ConvLayouts layouts = tosa::getConvLayouts(op);
+
+  std::string filterLayout = layouts.filter + "g";
+  std::string inputLayout = layouts.input + "g";
+  std::string outputLayout = layouts.output + "g";
+
+  // Channel-blocked tensors, such as NCHW4c ones, are given as their
+  // unblocked views
+  ChannelBlocks blocks;
+  Value filterView = filter, inputView = input, outputView = output;
+  if (failed(unblockOperand(
+          rw, op, tosa::getExpectedLayout(op, "expected_filter_layout"),
+          layouts.filter, 'c', /*groupFirst=*/true, filterView, filterLayout,
+          blocks.filter)) ||
+      failed(unblockOperand(
+          rw, op, tosa::getExpectedLayout(op, "expected_input_layout"),
+          layouts.input, 'c', /*groupFirst=*/false, inputView, inputLayout,
+          blocks.input)) ||
+      failed(unblockOperand(
+          rw, op, tosa::getExpectedLayout(op, "expected_output_layout"),
+          layouts.output, 'k', /*groupFirst=*/false, outputView,
+          outputLayout, blocks.output)))
+    return failure();
+
+  return makeMIOpenConv2D(rw, op, inputView, inputLayout.c_str(), filterView,
+                          filterLayout.c_str(), outputView,
+                          outputLayout.c_str(), op.pad(), op.stride(),
+                          op.dilation(), blocks, requantScales,
+                          requantZeroPoint);
+}
+
 class ConvConverter final : public OpConversionPattern<tosa::Conv2DOp> {
 public:
   using OpConversionPattern<tosa::Conv2DOp>::OpConversionPattern;
@@ -201,9 +408,6 @@ public:
                                 ConversionPatternRewriter &rw) const final {
     auto operands = adaptor.getOperands();
     auto loc = op->getLoc();
-    auto context = op->getContext();
-    auto input = operands[0];
-    auto filter = operands[1];
     auto bias_mr = operands[2];
     auto resultType = op.getType();
 
@@ -211,48 +415,288 @@ public:
         getTypeConverter()->convertType(resultType).cast<MemRefType>();
     Value output = rw.create<memref::AllocOp>(loc, outputType);
 
-    bool isNCHW = checkNCHW(op);
+    if (failed(convertConv(rw, op, operands, output)))
+      return failure();
+
+    FailureOr<Value> result = addConvBias(
+        rw, op, output, bias_mr, tosa::getConvLayouts(op).output.find('k'));
+    if (failed(result))
+      return failure();
+    rw.replaceOp(op, *result);
+
+    return success();
+  }
+};
 
-    const char *filterLayout = isNCHW ? "kcyxg" : "kyxcg";
-    const char *inputLayout = isNCHW ? "nchwg" : "nhwcg";
-    const char *outputLayout = isNCHW ? "nkhwg" : "nhwkg";
+// The i8 convolution whose i32 output `op` rescales into i8, if the
+// convolution can write the i8 output itself. That takes no zero points but
+// the output one, no bias and scales applied with a single rounding, one
+// per output channel or one for all of them.
+static tosa::Conv2DOp getRequantizedConv(tosa::RescaleOp op) {
+  auto conv = op.input().getDefiningOp<tosa::Conv2DOp>();
+  if (!conv || !conv->hasOneUse())
+    return {};
+  auto hasType = [](Value value, unsigned width) {
+    auto type = value.getType().cast<ShapedType>();
+    return type.hasStaticShape() && type.getElementType().isInteger(width);
+  };
+  if (!hasType(conv.input(), 8) || !hasType(conv.weight(), 8) ||
+      !hasType(conv.output(), 32) || !hasType(op.output(), 8) ||
+      !isConstantZero(conv.bias()))
+    return {};
+  if (auto info = conv.quantization_info())
+    if (info->getInputZp() != 0 || info->getWeightZp() != 0)
+      return {};
+
+  auto outputZeroPoint = static_cast<int32_t>(op.output_zp());
+  if (op.input_zp() != 0 || !op.scale32() || op.double_round() ||
+      outputZeroPoint < -128 || outputZeroPoint > 127)
+    return {};
+  // Per-channel scales go along the last dimension, which has to be the
+  // unblocked output channels
+  tosa::ConvLayouts layouts = tosa::getConvLayouts(conv);
+  int64_t channels = conv.output().getType().cast<ShapedType>().getDimSize(
+      layouts.output.find('k'));
+  if (tosa::getExpectedLayout(conv, "expected_output_layout").block > 1 ||
+      (op.per_channel() && layouts.output.back() != 'k'))
+    return {};
+  size_t scales = op.per_channel() ? channels : 1;
+  if (op.multiplier().size() != scales || op.shift().size() != scales)
+    return {};
+  return conv;
+}
 
-    if (failed(makeMIOpenConv2D(rw, op, input, inputLayout, filter,
-                                filterLayout, output, outputLayout, op.pad(),
-                                op.stride(), op.dilation()))) {
+// Rewrites the rescale of an i8 convolution into i8 into one miopen.conv2d,
+// which requantizes its results in the epilogue of its gemm.
+class RequantizedConvConverter final
+    : public OpConversionPattern<tosa::RescaleOp> {
+public:
+  using OpConversionPattern<tosa::RescaleOp>::OpConversionPattern;
+
+  LogicalResult matchAndRewrite(tosa::RescaleOp op,
+                                tosa::RescaleOp::Adaptor adaptor,
+                                ConversionPatternRewriter &rw) const final {
+    tosa::Conv2DOp conv = getRequantizedConv(op);
+    if (!conv)
+      return rw.notifyMatchFailure(op, "not the requantization of a conv");
+
+    SmallVector<Value, 3> operands;
+    if (failed(rw.getRemappedValues(conv->getOperands(), operands)))
       return failure();
+    auto loc = op->getLoc();
+    auto outputType =
+        getTypeConverter()->convertType(op.getType()).cast<MemRefType>();
+    Value output = rw.create<memref::AllocOp>(loc, outputType);
+
+    // scale = multiplier * 2^-shift
+    int64_t channels = outputType.getDimSize(
+        tosa::getConvLayouts(conv).output.find('k'));
+    SmallVector<float, 64> scales;
+    for (int64_t i = 0; i < channels; ++i) {
+      size_t j = op.per_channel() ? i : 0;
+      int64_t multiplier = op.multiplier()[j].cast<IntegerAttr>().getInt();
+      int64_t shift = op.shift()[j].cast<IntegerAttr>().getInt();
+      scales.push_back(static_cast<float>(
+          std::ldexp(static_cast<double>(multiplier), -shift)));
     }
+    auto scalesType = RankedTensorType::get({channels}, rw.getF32Type());
+    Value scalesTensor = rw.create<arith::ConstantOp>(
+        loc, DenseElementsAttr::get(scalesType, ArrayRef<float>(scales)));
+    Value scalesMemRef = rw.create<bufferization::ToMemrefOp>(
+        loc, MemRefType::get({channels}, rw.getF32Type()), scalesTensor);
+
+    if (failed(convertConv(
+            rw, conv, operands, output, scalesMemRef,
+            rw.getI32IntegerAttr(static_cast<int32_t>(op.output_zp())))))
+      return failure();
+    rw.replaceOp(op, output);
+    rw.eraseOp(conv);
+    return success();
+  }
+};
 
-    // test for zero bias, and ignore
-    if (!isConstantZero(op.getOperand(2))) {
-      // non-zero bias, replace with tosa.add w/ broadcast
-      auto conv_output_t = rw.create<bufferization::ToTensorOp>(loc, output);
+// Whether the tensors of `op` have static shapes and an f32, f16 or bf16
+// type, which the MIOpen convolutions other than the forward one are limited
+// to.
+static bool hasStaticFloatTensors(Operation *op) {
+  auto resultType = op->getResult(0).getType().cast<ShapedType>();
+  Type elementType = resultType.getElementType();
+  return resultType.hasStaticShape() &&
+         (elementType.isF32() || elementType.isF16() || elementType.isBF16()) &&
+         llvm::all_of(op->getOperandTypes(), [](Type type) {
+           auto shaped = type.dyn_cast<ShapedType>();
+           return shaped && shaped.hasStaticShape();
+         });
+}
 
-      auto biasType = bias_mr.getType().template cast<ShapedType>();
-      if (!biasType.hasStaticShape())
-        return failure();
+static SmallVector<int64_t, 4> getIntValues(ArrayAttr attr) {
+  SmallVector<int64_t, 4> values;
+  for (Attribute value : attr)
+    values.push_back(value.cast<IntegerAttr>().getInt());
+  return values;
+}
 
-      SmallVector<int64_t, 4> bias_s{1, 1, 1};
-      bias_s.push_back(biasType.getShape()[0]);
-      auto newType = MemRefType::get(bias_s, biasType.getElementType());
+// The GEMMs of the backward data convolution computing `op`.
+static SmallVector<int64_t>
+getBackwardDataGemmIds(tosa::TransposeConv2DOp op) {
+  SmallVector<int64_t, 4> stride = getIntValues(op.stride());
+  ArrayRef<int64_t> filterShape =
+      op.filter().getType().cast<ShapedType>().getShape();
+  return miopen::populateBackwardDataGemmIds(
+      stride[0], stride[1], /*dilationHeight=*/1, /*dilationWidth=*/1,
+      filterShape[1], filterShape[2]);
+}
+
+// Lowers a depthwise convolution, whose [kh, kw, c, m] weights make each of
+// the c input channels the m output channels c * m to c * m + m - 1, to the
+// grouped convolution with c groups of one input and m output channels.
+class DepthwiseConvConverter final
+    : public OpConversionPattern<tosa::DepthwiseConv2DOp> {
+public:
+  using OpConversionPattern<tosa::DepthwiseConv2DOp>::OpConversionPattern;
 
-      SmallVector<ReassociationExprs, 1> reassociations;
+  LogicalResult matchAndRewrite(tosa::DepthwiseConv2DOp op,
+                                tosa::DepthwiseConv2DOp::Adaptor adaptor,
+                                ConversionPatternRewriter &rw) const final {
+    if (!tosa::canConvertToMIOpen(op))
+      return rw.notifyMatchFailure(op, "unsupported depthwise convolution");
+    Location loc = op->getLoc();
+    auto outputType =
+        getTypeConverter()->convertType(op.getType()).cast<MemRefType>();
+    Value output = rw.create<memref::AllocOp>(loc, outputType);
 
-      // [[0, 1, 2, 3]]
-      reassociations.push_back(
-          {getAffineDimExpr(0, context), getAffineDimExpr(1, context),
-           getAffineDimExpr(2, context), getAffineDimExpr(3, context)});
+    // The channels of the input and weights are the groups, each of one
+    // input channel
+    Value input = expandMemRef(rw, op, adaptor.input());
+    Value filter = expandMemRef(rw, op, adaptor.weight());
+    if (!input || !filter)
+      return failure();
 
-      auto bias_expand_mr = rw.create<memref::ExpandShapeOp>(
-          loc, newType, bias_mr, reassociations);
+    // The output channel c * m + i is output channel i of group c
+    ArrayRef<int64_t> weightShape =
+        op.weight().getType().cast<ShapedType>().getShape();
+    miopen::BottomUpTMBuilder splitChannels(rw, {"n", "h", "w", "channel"},
+                                            outputType.getShape(), loc);
+    splitChannels.passThrough({"n", "h", "w"});
+    splitChannels.unmerge({"g", "k"}, {3, 4}, "channel",
+                          {weightShape[2], weightShape[3]});
+    Value outputView =
+        rw.create<miopen::TransformOp>(loc, output, splitChannels.get());
+
+    if (failed(makeMIOpenConv2D(rw, op, input, "nhwgc", filter, "yxgkc",
+                                outputView, "nhwgk", op.pad(), op.stride(),
+                                op.dilation())))
+      return failure();
 
-      auto bias_t = rw.create<bufferization::ToTensorOp>(loc, bias_expand_mr);
-      output = rw.create<tosa::AddOp>(loc, op.getType(),
-                                      ValueRange{conv_output_t, bias_t});
-    }
+    FailureOr<Value> result =
+        addConvBias(rw, op, output, adaptor.bias(), /*channelDim=*/3);
+    if (failed(result))
+      return failure();
+    rw.replaceOp(op, *result);
+    return success();
+  }
+};
 
-    rw.replaceOp(op, output);
+// Lowers a transposed convolution, which is the backward data convolution of
+// the forward one with its stride and out_pad as padding: the input is that
+// convolution's output gradient, [oc, kh, kw, ic] weights its filter in
+// "cyxk" layout, and the output its input gradient.
+class TransposeConvConverter final
+    : public OpConversionPattern<tosa::TransposeConv2DOp> {
+public:
+  using OpConversionPattern<tosa::TransposeConv2DOp>::OpConversionPattern;
+
+  LogicalResult matchAndRewrite(tosa::TransposeConv2DOp op,
+                                tosa::TransposeConv2DOp::Adaptor adaptor,
+                                ConversionPatternRewriter &rw) const final {
+    if (!tosa::canConvertToMIOpen(op))
+      return rw.notifyMatchFailure(op, "unsupported transposed convolution");
+    Location loc = op->getLoc();
+    auto outputType =
+        getTypeConverter()->convertType(op.getType()).cast<MemRefType>();
+    Value output = rw.create<memref::AllocOp>(loc, outputType);
+
+    Value filter = expandMemRef(rw, op, adaptor.filter());
+    Value outputGrad = expandMemRef(rw, op, adaptor.input());
+    Value inputGrad = expandMemRef(rw, op, output);
+    if (!filter || !outputGrad || !inputGrad)
+      return failure();
+
+    auto cop = rw.create<miopen::Conv2DBwdDataOp>(loc, TypeRange{}, filter,
+                                                  inputGrad, outputGrad);
+    affixConvAttributes(rw, op, cop, "nhwcg", "cyxkg", "nhwkg", op.out_pad(),
+                        op.stride(), rw.getI64ArrayAttr({1, 1}), {});
+
+    // The kernel computes the GEMMs of every filter phase in one launch
+    cop->setAttr("gemm_id", rw.getI32IntegerAttr(0));
+    if (getBackwardDataGemmIds(op).size() > 1)
+      cop->setAttr("single_launch", rw.getUnitAttr());
+
+    FailureOr<Value> result =
+        addConvBias(rw, op, output, adaptor.bias(), /*channelDim=*/3);
+    if (failed(result))
+      return failure();
+    rw.replaceOp(op, *result);
+    return success();
+  }
+};
+
+/// View the buffer `value` as the [rows, n] matrix of its rows along its last
+/// dimension.
+static Value collapseToRows(ConversionPatternRewriter &rw, Location loc,
+                            Value value) {
+  int64_t rank = value.getType().cast<MemRefType>().getRank();
+  if (rank == 2)
+    return value;
+  ReassociationIndices rows;
+  for (int64_t i = 0; i < rank - 1; ++i)
+    rows.push_back(i);
+  return rw.create<memref::CollapseShapeOp>(
+      loc, value, ArrayRef<ReassociationIndices>{rows, {rank - 1}});
+}
+
+// Rewrites the "miopen.layernorm" tosa.custom ops MIGraphX normalizations
+// lower to into miopen.layernorm, on the rows of their last dimension.
+class LayerNormConverter final : public OpConversionPattern<tosa::CustomOp> {
+public:
+  using OpConversionPattern<tosa::CustomOp>::OpConversionPattern;
 
+  LogicalResult matchAndRewrite(tosa::CustomOp op,
+                                tosa::CustomOp::Adaptor adaptor,
+                                ConversionPatternRewriter &rw) const final {
+    if (!tosa::isStandaloneKernelOp(op))
+      return failure();
+    auto loc = op->getLoc();
+    ValueRange inputs = adaptor.inputs();
+    for (Value operand : inputs)
+      if (!operand.getType().cast<ShapedType>().hasStaticShape())
+        return rw.notifyMatchFailure(
+            op, "tosa to miopen conversion expects statically shaped tensors");
+    auto getFlag = [&](StringRef name) {
+      auto attr = op->getAttrOfType<BoolAttr>(name);
+      return attr && attr.getValue();
+    };
+    Value scale, bias;
+    unsigned next = 1;
+    if (getFlag("has_scale"))
+      scale = inputs[next++];
+    if (getFlag("has_bias"))
+      bias = inputs[next++];
+    if (next != inputs.size())
+      return rw.notifyMatchFailure(op, "unexpected layernorm operands");
+
+    auto outputType = getTypeConverter()
+                          ->convertType(op.getResult(0).getType())
+                          .cast<MemRefType>();
+    Value output = rw.create<memref::AllocOp>(loc, outputType);
+    auto lop = rw.create<miopen::LayerNormOp>(
+        loc, collapseToRows(rw, loc, inputs[0]), scale, bias,
+        collapseToRows(rw, loc, output),
+        op->getAttrOfType<FloatAttr>("epsilon"),
+        getFlag("rms") ? rw.getUnitAttr() : UnitAttr());
+    affixTargetAttributes(rw, op, lop);
+
+    rw.replaceOp(op, output);
     return success();
   }
 };
@@ -264,32 +708,22 @@ public:
   LogicalResult matchAndRewrite(tosa::MatMulOp op,
                                 tosa::MatMulOp::Adaptor adaptor,
                                 ConversionPatternRewriter &rw) const final {
-    // BS must equal 1
+    // A(BS,M,K) * B(BS,K,N) -> C(BS,M,N), batched over BS
     auto operands = adaptor.getOperands();
     auto loc = op->getLoc();
-    // A(BS,M,K) -> A(BS,1,M,K)
-    auto A = expandMemRef(rw, op, operands[0], 1);
-    const char *ALayout = "ghwcn";
-    // B(BS,K,N) -> B(BS,K,N,1)
-    auto B = expandMemRef(rw, op, operands[1], 3);
-    const char *BLayout = "gckyx";
-
-    // C(BS,M,N) -> C(BS,1,M,N)
+    for (Value operand : operands)
+      if (!operand.getType().cast<ShapedType>().hasStaticShape())
+        return rw.notifyMatchFailure(
+            op, "tosa to miopen conversion expects statically shaped tensors");
+
     auto outputType =
         getTypeConverter()->convertType(op.getType()).cast<MemRefType>();
     Value output = rw.create<memref::AllocOp>(loc, outputType);
-    auto C = expandMemRef(rw, op, output, 1);
-    const char *CLayout = "ghwkn";
 
-    auto zero = rw.getIndexAttr(0);
-    auto pad = rw.getArrayAttr({zero, zero, zero, zero});
-    auto one = rw.getIndexAttr(1);
-    auto ones = rw.getArrayAttr({one, one});
-
-    if (failed(makeMIOpenConv2D(rw, op, A, ALayout, B, BLayout, C, CLayout, pad,
-                                ones, ones))) {
-      return failure();
-    }
+    TypeRange resultTypes;
+    auto gop = rw.create<miopen::GemmOp>(
+        loc, resultTypes, ValueRange{operands[0], operands[1], output});
+    affixTargetAttributes(rw, op, gop);
 
     rw.replaceOp(op, output);
 
@@ -348,7 +782,7 @@ public:
       });
     }
 
-    if (!checkNCHW(convOp)) {
+    if (!tosa::expectsNCHWLayouts(convOp)) {
       return rewriter.notifyMatchFailure(convOp, [&](::mlir::Diagnostic &diag) {
         diag << "Convolution doesn't expect NHWC->NCHW conversion";
       });
@@ -443,15 +877,140 @@ public:
   }
 };
 
+/// Tell if `op` transposes with the constant permutation `perm`.
+static bool hasPermutation(tosa::TransposeOp op, ArrayRef<int64_t> perm) {
+  DenseIntElementsAttr permAttr;
+  if (!matchPattern(op.perms(), m_Constant(&permAttr)))
+    return false;
+  return llvm::equal(permAttr.getValues<int64_t>(), perm);
+}
+
+// Average pooling whose windows tile its input, which tosa-partition fuses
+// after convolutions on request, becomes a sum reduction of the scaled input
+// into the zeroed pooled result, indexed by floor divisions by the window
+// size. MIOpenLinalgAlign fuses such a reduction into the gemm writeback as
+// atomic adds, leaving the zeroing of the pooled result to the caller.
+class AlignedAvgPoolConverter final
+    : public OpConversionPattern<tosa::AvgPool2dOp> {
+public:
+  using OpConversionPattern<tosa::AvgPool2dOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(tosa::AvgPool2dOp op, tosa::AvgPool2dOp::Adaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    if (!tosa::isNonOverlappingAvgPool(op))
+      return rewriter.notifyMatchFailure(op, "pooling windows overlap");
+    Location loc = op->getLoc();
+    Value input = adaptor.input();
+    Operation *pooling = op;
+    uint32_t hDim = 1, wDim = 2;
+
+    // Pool the NCHW tensor MIGraphX transposes around the pooling in place,
+    // so that the reduction reads the convolution output as it is written.
+    SmallVector<int64_t> NCHW2NHWC{0, 2, 3, 1};
+    SmallVector<int64_t> NHWC2NCHW{0, 3, 1, 2};
+    auto inputTp = input.getDefiningOp<tosa::TransposeOp>();
+    if (inputTp && hasPermutation(inputTp, NCHW2NHWC) && op->hasOneUse()) {
+      auto outputTp = dyn_cast<tosa::TransposeOp>(*op->user_begin());
+      if (outputTp && hasPermutation(outputTp, NHWC2NCHW)) {
+        input = inputTp.input1();
+        pooling = outputTp;
+        hDim = 2;
+        wDim = 3;
+      }
+    }
+
+    auto resultType =
+        pooling->getResult(0).getType().cast<RankedTensorType>();
+    int64_t kernelH = op.kernel()[0].cast<IntegerAttr>().getInt();
+    int64_t kernelW = op.kernel()[1].cast<IntegerAttr>().getInt();
+    SmallVector<AffineExpr, 4> resultExprs;
+    SmallVector<StringRef, 4> iterators;
+    for (uint32_t i = 0; i < 4; ++i) {
+      AffineExpr dim = rewriter.getAffineDimExpr(i);
+      if (i == hDim)
+        dim = dim.floorDiv(kernelH);
+      else if (i == wDim)
+        dim = dim.floorDiv(kernelW);
+      resultExprs.push_back(dim);
+      iterators.push_back(i == hDim || i == wDim
+                              ? getReductionIteratorTypeName()
+                              : getParallelIteratorTypeName());
+    }
+    SmallVector<AffineMap, 2> indexingMaps{
+        rewriter.getMultiDimIdentityMap(4),
+        AffineMap::get(4, 0, resultExprs, rewriter.getContext())};
+
+    Value init = rewriter.create<linalg::InitTensorOp>(
+        loc, resultType.getShape(), resultType.getElementType());
+    Value zero = rewriter.create<arith::ConstantOp>(
+        loc, rewriter.getF32FloatAttr(0.0f));
+    init = rewriter.create<linalg::FillOp>(loc, ValueRange{zero},
+                                           ValueRange{init})
+               .result();
+    Value scale = rewriter.create<arith::ConstantOp>(
+        loc, rewriter.getF32FloatAttr(1.0f / (kernelH * kernelW)));
+    auto reduction = rewriter.create<linalg::GenericOp>(
+        loc, resultType, input, init, indexingMaps, iterators,
+        [&](OpBuilder &b, Location loc, ValueRange args) {
+          Value scaled = b.create<arith::MulFOp>(loc, args[0], scale);
+          Value sum = b.create<arith::AddFOp>(loc, scaled, args[1]);
+          b.create<linalg::YieldOp>(loc, sum);
+        });
+
+    rewriter.replaceOp(pooling, reduction.getResults());
+    if (pooling != op)
+      rewriter.eraseOp(op);
+    return success();
+  }
+};
+
 } // namespace
 
+bool tosa::canConvertToMIOpen(DepthwiseConv2DOp op) {
+  return !op.quantization_info() && hasStaticFloatTensors(op);
+}
+
+bool tosa::canConvertToMIOpen(TransposeConv2DOp op) {
+  if (op.quantization_info() || !hasStaticFloatTensors(op) ||
+      llvm::any_of(getIntValues(op.out_pad()),
+                   [](int64_t pad) { return pad < 0; }))
+    return false;
+  // Every output must be written by the GEMMs of the backward data
+  // convolution, as the epilogue fused into the kernel would skip the pixels
+  // it zeroes
+  SmallVector<int64_t, 4> stride = getIntValues(op.stride());
+  ArrayRef<int64_t> filterShape =
+      op.filter().getType().cast<ShapedType>().getShape();
+  return miopen::backwardDataWritesEveryPixel(
+      stride[0], stride[1], /*dilationHeight=*/1, /*dilationWidth=*/1,
+      filterShape[1], filterShape[2]);
+}
+
+bool tosa::isRequantizedConv(tosa::Conv2DOp op) {
+  if (!op->hasOneUse())
+    return false;
+  auto rescale = dyn_cast<tosa::RescaleOp>(*op->user_begin());
+  return rescale && getRequantizedConv(rescale) == op;
+}
+
+bool tosa::isConvRequantization(tosa::RescaleOp op) {
+  return getRequantizedConv(op) != nullptr;
+}
+
 void tosa::populateTosaToMIOpenConversionPatterns(
     bufferization::BufferizeTypeConverter &typeConverter, MLIRContext *context,
     RewritePatternSet &patterns) {
-  patterns.insert<ConvConverter>(typeConverter, context);
+  patterns.insert<ConvConverter, RequantizedConvConverter>(typeConverter,
+                                                          context);
+  patterns.insert<DepthwiseConvConverter, TransposeConvConverter>(
+      typeConverter, context);
   patterns.insert<MatMulConverter>(typeConverter, context);
+  patterns.insert<LayerNormConverter>(typeConverter, context);
 }
 void tosa::populateTosaToMIOpenTensorConversionPatterns(
-    MLIRContext *context, RewritePatternSet &patterns) {
+    MLIRContext *context, RewritePatternSet &patterns, bool fusePooling) {
   patterns.insert<TransposeConverter>(context);
+  if (fusePooling)
+    patterns.insert<AlignedAvgPoolConverter>(context);
 }
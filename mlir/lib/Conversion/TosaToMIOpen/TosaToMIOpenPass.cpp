@@ -32,6 +32,11 @@ using namespace mlir;
 namespace {
 struct TosaToMIOpen : public TosaToMIOpenBase<TosaToMIOpen> {
 public:
+  TosaToMIOpen() = default;
+  TosaToMIOpen(bool fusePooling) {
+    this->fusePooling = fusePooling;
+  }
+
   void getDependentDialects(DialectRegistry &registry) const override {
     registry.insert<miopen::MIOpenDialect, linalg::LinalgDialect,
                     bufferization::BufferizationDialect, func::FuncDialect>();
@@ -52,7 +57,7 @@ public:
     tensor_target.addLegalDialect<
         miopen::MIOpenDialect, tosa::TosaDialect, memref::MemRefDialect,
         mlir::func::FuncDialect, BuiltinDialect, arith::ArithmeticDialect,
-        bufferization::BufferizationDialect>();
+        bufferization::BufferizationDialect, linalg::LinalgDialect>();
     tensor_target.addDynamicallyLegalOp<tosa::TransposeOp>(
         [&](tosa::TransposeOp op) {
           auto attrDeletable = op->getAttr("changing_layout_root");
@@ -61,17 +66,43 @@ public:
             return !attrDeletable.dyn_cast<BoolAttr>().getValue();
           return true;
         });
-    mlir::tosa::populateTosaToMIOpenTensorConversionPatterns(func.getContext(),
-                                                             tensor_patterns);
+    tensor_target.addDynamicallyLegalOp<tosa::AvgPool2dOp>(
+        [&](tosa::AvgPool2dOp op) {
+          return !fusePooling || !tosa::isNonOverlappingAvgPool(op);
+        });
+    mlir::tosa::populateTosaToMIOpenTensorConversionPatterns(
+        func.getContext(), tensor_patterns, fusePooling);
     if (failed(applyFullConversion(func, tensor_target,
                                    std::move(tensor_patterns))))
       signalPassFailure();
 
+    // Fold the transposes left around convolutions into their layouts
+    if (layoutPropagation) {
+      RewritePatternSet layout_patterns(&ctx);
+      mlir::tosa::populateTosaLayoutPropagationPatterns(&ctx, layout_patterns);
+      (void)applyPatternsAndFoldGreedily(func, std::move(layout_patterns));
+    }
+
     target.addLegalDialect<miopen::MIOpenDialect, linalg::LinalgDialect,
                            memref::MemRefDialect, tosa::TosaDialect,
                            bufferization::BufferizationDialect,
                            mlir::func::FuncDialect>();
-    target.addIllegalOp<tosa::Conv2DOp, tosa::MatMulOp>();
+    // Requantized convolutions go away with the rescales of their outputs
+    target.addDynamicallyLegalOp<tosa::Conv2DOp>(
+        [](tosa::Conv2DOp op) { return tosa::isRequantizedConv(op); });
+    target.addDynamicallyLegalOp<tosa::RescaleOp>(
+        [](tosa::RescaleOp op) { return !tosa::isConvRequantization(op); });
+    // The others are left to the decompositions into tosa.conv2d or linalg
+    target.addDynamicallyLegalOp<tosa::DepthwiseConv2DOp>(
+        [](tosa::DepthwiseConv2DOp op) {
+          return !tosa::canConvertToMIOpen(op);
+        });
+    target.addDynamicallyLegalOp<tosa::TransposeConv2DOp>(
+        [](tosa::TransposeConv2DOp op) {
+          return !tosa::canConvertToMIOpen(op);
+        });
+    target.addDynamicallyLegalOp<tosa::CustomOp>(
+        [](tosa::CustomOp op) { return !tosa::isStandaloneKernelOp(op); });
     target.markUnknownOpDynamicallyLegal([](Operation *) { return true; });
 
     bufferization::BufferizeTypeConverter typeConverter;
@@ -83,8 +114,8 @@ public:
 };
 } // namespace
 
-std::unique_ptr<Pass> mlir::tosa::createTosaToMIOpenPass() {
-  return std::make_unique<TosaToMIOpen>();
+std::unique_ptr<Pass> mlir::tosa::createTosaToMIOpenPass(bool fusePooling) {
+  return std::make_unique<TosaToMIOpen>(fusePooling);
 }
 
 void mlir::tosa::addTosaToMIOpenPasses(OpPassManager &pm) {
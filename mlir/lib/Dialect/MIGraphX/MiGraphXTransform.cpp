@@ -21,47 +21,435 @@
 #include "mlir/Transforms/DialectConversion.h"
 #include "mlir/Transforms/GreedyPatternRewriteDriver.h"
 
+#include <cmath>
+#include <cstring>
+
 using namespace mlir;
 using namespace migraphx;
 
 namespace {
 
-class SqrtDecompose final : public OpConversionPattern<migraphx::SqrtOp> {
-public:
-  using OpConversionPattern<migraphx::SqrtOp>::OpConversionPattern;
+//===----------------------------------------------------------------------===//
+// Algebraic simplification
+//===----------------------------------------------------------------------===//
+
+/// The value `value` broadcasts, if it is a broadcast, or `value` itself.
+static Value skipBroadcasts(Value value) {
+  while (isa_and_nonnull<migraphx::BroadcastOp, migraphx::MultiBroadcastOp>(
+      value.getDefiningOp()))
+    value = value.getDefiningOp()->getOperand(0);
+  return value;
+}
+
+/// The value of the elements of `value` if it is a splat float
+/// migraphx.constant, or a broadcast of one.
+static Optional<double> getSplatValue(Value value) {
+  auto cst = skipBroadcasts(value).getDefiningOp<migraphx::ConstantOp>();
+  if (!cst || !cst.value())
+    return llvm::None;
+  auto attr = cst.value()->dyn_cast<DenseFPElementsAttr>();
+  if (!attr || !attr.isSplat())
+    return llvm::None;
+  return attr.getSplatValue<APFloat>().convertToDouble();
+}
+
+/// x * 1 = x, when the multiplication doesn't broadcast x.
+struct MulByOne final : public OpRewritePattern<migraphx::MulOp> {
+  using OpRewritePattern<migraphx::MulOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(migraphx::MulOp op,
+                                PatternRewriter &rewriter) const override {
+    for (auto pair : {std::make_pair(op.inA(), op.inB()),
+                      std::make_pair(op.inB(), op.inA())}) {
+      if (pair.first.getType() == op.getType() &&
+          getSplatValue(pair.second) == 1.0) {
+        rewriter.replaceOp(op, pair.first);
+        return success();
+      }
+    }
+    return failure();
+  }
+};
+
+/// pow(x, 1) = x, pow(x, 2) = x * x, pow(x, -1) = recip(x),
+/// pow(x, 0.5) = sqrt(x) and pow(x, -0.5) = rsqrt(x), none of which need the
+/// exp and log of a general power.
+struct PowStrengthReduction final : public OpRewritePattern<migraphx::PowOp> {
+  using OpRewritePattern<migraphx::PowOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(migraphx::PowOp op,
+                                PatternRewriter &rewriter) const override {
+    Value x = op.inA();
+    Type type = op.getType();
+    Optional<double> exponent = getSplatValue(op.inB());
+    if (!exponent || x.getType() != type)
+      return failure();
+    if (*exponent == 1.0)
+      rewriter.replaceOp(op, x);
+    else if (*exponent == 2.0)
+      rewriter.replaceOpWithNewOp<migraphx::MulOp>(op, type, x, x);
+    else if (*exponent == -1.0)
+      rewriter.replaceOpWithNewOp<migraphx::RecipOp>(op, type, x);
+    else if (*exponent == 0.5)
+      rewriter.replaceOpWithNewOp<migraphx::SqrtOp>(op, type, x);
+    else if (*exponent == -0.5)
+      rewriter.replaceOpWithNewOp<migraphx::RsqrtOp>(op, type, x);
+    else
+      return failure();
+    return success();
+  }
+};
 
-  LogicalResult
-  matchAndRewrite(SqrtOp op, OpAdaptor adaptor,
-                  ConversionPatternRewriter &rewriter) const final {
-    Location loc = op->getLoc();
-    auto inA = op->getOperand(0);
-    auto outputTy = op->getResults()[0].getType().cast<ShapedType>();
-    auto rSop = rewriter.create<migraphx::RsqrtOp>(loc, outputTy, inA);
-    auto rCop = rewriter.create<migraphx::RecipOp>(loc, outputTy, rSop);
+/// recip(sqrt(x)) = rsqrt(x) and recip(rsqrt(x)) = sqrt(x), one
+/// instruction instead of two.
+struct RecipOfSqrt final : public OpRewritePattern<migraphx::RecipOp> {
+  using OpRewritePattern<migraphx::RecipOp>::OpRewritePattern;
 
-    rewriter.replaceOp(op, rCop->getResults()[0]);
+  LogicalResult matchAndRewrite(migraphx::RecipOp op,
+                                PatternRewriter &rewriter) const override {
+    Operation *input = op.inA().getDefiningOp();
+    if (!input || input->getResult(0).getType() != op.getType())
+      return failure();
+    if (auto sqrt = dyn_cast<migraphx::SqrtOp>(input))
+      rewriter.replaceOpWithNewOp<migraphx::RsqrtOp>(op, op.getType(),
+                                                     sqrt.inA());
+    else if (auto rsqrt = dyn_cast<migraphx::RsqrtOp>(input))
+      rewriter.replaceOpWithNewOp<migraphx::SqrtOp>(op, op.getType(),
+                                                    rsqrt.inA());
+    else
+      return failure();
     return success();
   }
 };
 
-void populateMIGraphXSqrt(MLIRContext *context, RewritePatternSet &patterns) {
-  patterns.add<SqrtDecompose>(context);
+void populateMIGraphXSimplification(MLIRContext *context,
+                                    RewritePatternSet &patterns) {
+  patterns.add<MulByOne, PowStrengthReduction, RecipOfSqrt>(context);
+}
+
+//===----------------------------------------------------------------------===//
+// Folding per-channel affine ops into constant convolution filters
+//===----------------------------------------------------------------------===//
+
+/// The f32 values of `value` if it is a migraphx.constant, none otherwise.
+static Optional<SmallVector<float>> getConstantValues(Value value) {
+  auto cst = value.getDefiningOp<migraphx::ConstantOp>();
+  if (!cst || !cst.value())
+    return llvm::None;
+  auto attr = cst.value()->dyn_cast<DenseFPElementsAttr>();
+  if (!attr || !attr.getElementType().isF32())
+    return llvm::None;
+  SmallVector<float> values(attr.getNumElements());
+  if (attr.isSplat()) {
+    std::fill(values.begin(), values.end(), attr.getSplatValue<float>());
+  } else {
+    ArrayRef<char> raw = attr.getRawData();
+    std::memcpy(values.data(), raw.data(), raw.size());
+  }
+  return values;
+}
+
+/// The convolution producing `value` if nothing else reads its result and
+/// its filter is an f32 constant, whose values are returned in `filter`.
+static migraphx::ConvolutionOp
+getFoldableConvolution(Value value, SmallVectorImpl<float> &filter) {
+  auto conv = value.getDefiningOp<migraphx::ConvolutionOp>();
+  if (!conv || !conv->hasOneUse())
+    return {};
+  Optional<SmallVector<float>> values = getConstantValues(conv.filter());
+  if (!values)
+    return {};
+  filter.assign(values->begin(), values->end());
+  return conv;
+}
+
+/// Scale output channel k of the convolution `conv`, whose constant filter
+/// holds `filter`, by scale[k]. The filter is laid out as [K, C, Y, X], so
+/// each channel is one contiguous run that the inner loop scales with a
+/// vectorizable multiply.
+static void scaleFilter(PatternRewriter &rewriter,
+                        migraphx::ConvolutionOp conv,
+                        MutableArrayRef<float> filter,
+                        ArrayRef<float> scale) {
+  int64_t channelSize = filter.size() / scale.size();
+  for (size_t k = 0, e = scale.size(); k < e; ++k) {
+    float *channel = filter.data() + k * channelSize;
+    float factor = scale[k];
+    for (int64_t i = 0; i < channelSize; ++i)
+      channel[i] *= factor;
+  }
+
+  auto filterType = conv.filter().getType().cast<RankedTensorType>();
+  auto attr = DenseElementsAttr::get(filterType, ArrayRef<float>(filter));
+  Value scaled = rewriter.create<migraphx::ConstantOp>(
+      conv.filter().getLoc(), filterType, attr, ArrayAttr(), TypeAttr(),
+      StringAttr(), IntegerAttr());
+  rewriter.updateRootInPlace(conv, [&]() { conv->setOperand(1, scaled); });
+}
+
+/// Add the per-channel `bias` to the result of `conv` in place of `op`.
+static void replaceWithBiasAdd(PatternRewriter &rewriter, Operation *op,
+                               migraphx::ConvolutionOp conv,
+                               ArrayRef<float> bias) {
+  Location loc = op->getLoc();
+  auto outputType = conv.getType().cast<RankedTensorType>();
+  auto biasType = RankedTensorType::get({static_cast<int64_t>(bias.size())},
+                                        outputType.getElementType());
+  Value biasCst = rewriter.create<migraphx::ConstantOp>(
+      loc, biasType, DenseElementsAttr::get(biasType, bias), ArrayAttr(),
+      TypeAttr(), StringAttr(), IntegerAttr());
+  Value broadcast = rewriter.create<migraphx::BroadcastOp>(
+      loc, outputType, biasCst, rewriter.getI64IntegerAttr(1),
+      rewriter.getI64ArrayAttr(outputType.getShape()));
+  rewriter.replaceOpWithNewOp<migraphx::AddOp>(op, outputType, conv,
+                                               broadcast);
+}
+
+/// Fold an inference batch norm of the output of a convolution with a
+/// constant filter into that filter and a per-channel bias:
+///   bn(x) = (x - mean) * scale / sqrt(variance + epsilon) + bias
+/// scales output channel k of the filter by
+/// s[k] = scale[k] / sqrt(variance[k] + epsilon) and adds
+/// bias[k] - mean[k] * s[k] to it.
+struct FoldBatchNormIntoConv final
+    : public OpRewritePattern<migraphx::BatchNormOp> {
+  using OpRewritePattern<migraphx::BatchNormOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(migraphx::BatchNormOp op,
+                                PatternRewriter &rewriter) const override {
+    SmallVector<float> filter;
+    migraphx::ConvolutionOp conv = getFoldableConvolution(op.input(), filter);
+    if (!conv)
+      return failure();
+    auto outputType = conv.getType().cast<RankedTensorType>();
+    if (outputType.getRank() != 4 || !outputType.hasStaticShape())
+      return failure();
+    size_t channels = outputType.getDimSize(1);
+
+    Optional<SmallVector<float>> scale = getConstantValues(op.a());
+    Optional<SmallVector<float>> bias = getConstantValues(op.b());
+    Optional<SmallVector<float>> mean = getConstantValues(op.c());
+    Optional<SmallVector<float>> variance = getConstantValues(op.d());
+    if (!scale || !bias || !mean || !variance)
+      return failure();
+    // Only per-channel (spatial) batch norms fold into the filter.
+    if (scale->size() != channels || bias->size() != channels ||
+        mean->size() != channels || variance->size() != channels)
+      return failure();
+
+    float epsilon = op.epsilon().convertToFloat();
+    SmallVector<float> factors(channels), shifts(channels);
+    for (size_t k = 0; k < channels; ++k) {
+      factors[k] = (*scale)[k] / std::sqrt((*variance)[k] + epsilon);
+      shifts[k] = (*bias)[k] - (*mean)[k] * factors[k];
+    }
+    scaleFilter(rewriter, conv, filter, factors);
+    replaceWithBiasAdd(rewriter, op, conv, shifts);
+    return success();
+  }
+};
+
+/// Fold the multiplication of the output of a convolution with a constant
+/// filter by a per-channel constant, broadcast along the channels, into the
+/// filter.
+struct FoldScaleIntoConv final : public OpRewritePattern<migraphx::MulOp> {
+  using OpRewritePattern<migraphx::MulOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(migraphx::MulOp op,
+                                PatternRewriter &rewriter) const override {
+    for (auto pair : {std::make_pair(op.inA(), op.inB()),
+                      std::make_pair(op.inB(), op.inA())}) {
+      SmallVector<float> filter;
+      migraphx::ConvolutionOp conv =
+          getFoldableConvolution(pair.first, filter);
+      auto broadcast = pair.second.getDefiningOp<migraphx::BroadcastOp>();
+      if (!conv || !broadcast || broadcast.axis() != 1 ||
+          broadcast.getType() != op.getType())
+        continue;
+      Optional<SmallVector<float>> scale =
+          getConstantValues(broadcast.input());
+      auto outputType = conv.getType().cast<RankedTensorType>();
+      if (!scale || outputType.getRank() != 4 ||
+          scale->size() != static_cast<size_t>(outputType.getDimSize(1)))
+        continue;
+
+      scaleFilter(rewriter, conv, filter, *scale);
+      rewriter.replaceOp(op, conv->getResults());
+      return success();
+    }
+    return failure();
+  }
+};
+
+void populateMIGraphXConvFolding(MLIRContext *context,
+                                 RewritePatternSet &patterns) {
+  patterns.add<FoldBatchNormIntoConv, FoldScaleIntoConv>(context);
+}
+
+//===----------------------------------------------------------------------===//
+// Recognizing layer and RMS normalizations
+//===----------------------------------------------------------------------===//
+
+/// The tensor `value` averages along its last dimension, if it is such a
+/// mean, or a broadcast of one.
+static Value matchRowMean(Value value) {
+  auto mean = skipBroadcasts(value).getDefiningOp<migraphx::ReduceMeanOp>();
+  if (!mean)
+    return {};
+  int64_t rank = mean.input().getType().cast<RankedTensorType>().getRank();
+  if (static_cast<int64_t>(mean.axis()) != rank - 1)
+    return {};
+  return mean.input();
+}
+
+/// x if `value` is x * x, which pow(x, 2) simplifies to.
+static Value matchSquare(Value value) {
+  auto mul = value.getDefiningOp<migraphx::MulOp>();
+  if (!mul || mul.inA() != mul.inB())
+    return {};
+  return mul.inA();
+}
+
+/// The one-row tensor of a parameter `value` broadcasts along the rows of
+/// `type`, such as the scale and bias of a layer normalization.
+static Value matchRowParam(Value value, RankedTensorType type) {
+  Value param = skipBroadcasts(value);
+  auto paramType = param.getType().cast<RankedTensorType>();
+  int64_t rank = type.getRank();
+  if (paramType.getRank() != 1 ||
+      paramType.getDimSize(0) != type.getDimSize(rank - 1) ||
+      paramType.getElementType() != type.getElementType())
+    return {};
+  // Multibroadcasts align the row with the last dimension by themselves.
+  if (auto broadcast = value.getDefiningOp<migraphx::BroadcastOp>())
+    if (static_cast<int64_t>(broadcast.axis()) != rank - 1)
+      return {};
+  return param;
+}
+
+/// Rewrite the normalizations MIGraphX spells out along the last dimension,
+///   layernorm(x) = d * rsqrt(mean(d * d) + epsilon), d = x - mean(x)
+///   rmsnorm(x) = x * rsqrt(mean(x * x) + epsilon)
+/// into migraphx.layernorm, with the means broadcast back along the rows.
+/// Each of them would otherwise be a kernel of its own reading the tensor.
+struct FuseNormalization final : public OpRewritePattern<migraphx::MulOp> {
+  using OpRewritePattern<migraphx::MulOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(migraphx::MulOp op,
+                                PatternRewriter &rewriter) const override {
+    auto type = op.getType().cast<RankedTensorType>();
+    if (!type.getElementType().isa<FloatType>() || !type.hasStaticShape() ||
+        type.getRank() < 2)
+      return failure();
+    for (auto pair : {std::make_pair(op.inA(), op.inB()),
+                      std::make_pair(op.inB(), op.inA())}) {
+      Value x = pair.first;
+      auto rsqrt =
+          skipBroadcasts(pair.second).getDefiningOp<migraphx::RsqrtOp>();
+      if (x.getType() != type || !rsqrt)
+        continue;
+      auto add = rsqrt.inA().getDefiningOp<migraphx::AddOp>();
+      if (!add)
+        continue;
+      Value meanSquare = add.inA();
+      Optional<double> epsilon = getSplatValue(add.inB());
+      if (!epsilon) {
+        meanSquare = add.inB();
+        epsilon = getSplatValue(add.inA());
+      }
+      Value squared = matchRowMean(meanSquare);
+      if (!epsilon || !squared || matchSquare(squared) != x)
+        continue;
+
+      // Centering x first makes it a layer normalization.
+      Value input = x;
+      bool rms = true;
+      if (auto sub = x.getDefiningOp<migraphx::SubOp>()) {
+        if (sub.inA().getType() == type &&
+            matchRowMean(sub.inB()) == sub.inA()) {
+          input = sub.inA();
+          rms = false;
+        }
+      }
+      rewriter.replaceOpWithNewOp<migraphx::LayerNormOp>(
+          op, type, input, /*scale=*/Value(), /*bias=*/Value(),
+          rewriter.getF32FloatAttr(*epsilon),
+          rms ? rewriter.getUnitAttr() : UnitAttr());
+      return success();
+    }
+    return failure();
+  }
+};
+
+/// layernorm(x) * scale = layernorm(x) with scale, for a scale broadcast along
+/// the rows, so that the kernel applies it as it writes the result.
+struct FuseNormalizationScale final
+    : public OpRewritePattern<migraphx::MulOp> {
+  using OpRewritePattern<migraphx::MulOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(migraphx::MulOp op,
+                                PatternRewriter &rewriter) const override {
+    auto type = op.getType().cast<RankedTensorType>();
+    for (auto pair : {std::make_pair(op.inA(), op.inB()),
+                      std::make_pair(op.inB(), op.inA())}) {
+      auto norm = pair.first.getDefiningOp<migraphx::LayerNormOp>();
+      if (!norm || norm.scale() || norm.bias() || !norm->hasOneUse() ||
+          norm.getType() != type)
+        continue;
+      Value scale = matchRowParam(pair.second, type);
+      if (!scale)
+        continue;
+      rewriter.replaceOpWithNewOp<migraphx::LayerNormOp>(
+          op, type, norm.input(), scale, /*bias=*/Value(), norm.epsilonAttr(),
+          norm.rmsAttr());
+      return success();
+    }
+    return failure();
+  }
+};
+
+/// layernorm(x) + bias = layernorm(x) with bias, for a bias broadcast along
+/// the rows.
+struct FuseNormalizationBias final : public OpRewritePattern<migraphx::AddOp> {
+  using OpRewritePattern<migraphx::AddOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(migraphx::AddOp op,
+                                PatternRewriter &rewriter) const override {
+    auto type = op.getType().cast<RankedTensorType>();
+    for (auto pair : {std::make_pair(op.inA(), op.inB()),
+                      std::make_pair(op.inB(), op.inA())}) {
+      auto norm = pair.first.getDefiningOp<migraphx::LayerNormOp>();
+      if (!norm || norm.bias() || !norm->hasOneUse() || norm.getType() != type)
+        continue;
+      Value bias = matchRowParam(pair.second, type);
+      if (!bias)
+        continue;
+      rewriter.replaceOpWithNewOp<migraphx::LayerNormOp>(
+          op, type, norm.input(), norm.scale(), bias, norm.epsilonAttr(),
+          norm.rmsAttr());
+      return success();
+    }
+    return failure();
+  }
+};
+
+void populateMIGraphXNormalizationFusion(MLIRContext *context,
+                                         RewritePatternSet &patterns) {
+  patterns.add<FuseNormalization, FuseNormalizationScale,
+               FuseNormalizationBias>(context);
 }
 
 struct MIGraphXTransforms
     : public MIGraphXTransformPassBase<MIGraphXTransforms> {
   void runOnOperation() override {
     auto &ctx = getContext();
-    RewritePatternSet patterns(&ctx);
-    ConversionTarget target(ctx);
-    target.addLegalDialect<migraphx::MIGraphXDialect, func::FuncDialect>();
-    target.addIllegalOp<migraphx::SqrtOp>();
     auto func = getOperation();
 
-    populateMIGraphXSqrt(&ctx, patterns);
-    if (failed(applyFullConversion(func, target, std::move(patterns)))) {
-      signalPassFailure();
-    }
+    RewritePatternSet patterns(&ctx);
+    populateMIGraphXSimplification(&ctx, patterns);
+    populateMIGraphXConvFolding(&ctx, patterns);
+    populateMIGraphXNormalizationFusion(&ctx, patterns);
+    (void)applyPatternsAndFoldGreedily(func, std::move(patterns));
   }
 };
 
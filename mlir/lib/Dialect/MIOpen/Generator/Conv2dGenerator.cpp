@@ -4,6 +4,7 @@
 #include "mlir/Dialect/MIOpen/Tuning/ConvContext.h"
 #include "mlir/Dialect/MIOpen/Tuning/GemmContext.h"
 #include "mlir/Dialect/MIOpen/Tuning/GridwiseGemmParams.h"
+#include "mlir/Dialect/MIOpen/Tuning/UtilityParams.h"
 #include "mlir/Dialect/MIOpen/utility/IsaNameSplitter.h"
 #include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
 #include "mlir/Dialect/MIOpen/utility/math.h"
@@ -12,6 +13,7 @@
 #include "mlir/IR/Builders.h"
 #include "mlir/IR/BuiltinOps.h"
 #include "mlir/IR/Location.h"
+#include "mlir/IR/OwningOpRef.h"
 #include "mlir/IR/Types.h"
 #include "mlir/Pass/PassManager.h"
 #include "mlir/Support/LogicalResult.h"
@@ -138,9 +140,9 @@ LogicalResult Conv2dGenerator::isApplicable() const {
 }
 
 LogicalResult Conv2dGenerator::hasValidDimension() const {
-  static const SmallVector<int64_t, 4> strictlyPositiveParams{
-      config.dilationHeight, config.dilationWidth, config.strideHeight,
-      config.strideWidth};
+  const SmallVector<int64_t, 6> strictlyPositiveParams{
+      config.dilationHeight, config.dilationWidth, config.dilationDepth,
+      config.strideHeight,   config.strideWidth,   config.strideDepth};
   if (std::any_of(strictlyPositiveParams.begin(), strictlyPositiveParams.end(),
                   [](const int64_t &a) { return a <= 0; })) {
     LLVM_DEBUG(llvm::dbgs()
@@ -148,9 +150,10 @@ LogicalResult Conv2dGenerator::hasValidDimension() const {
     return failure();
   }
 
-  static const SmallVector<int64_t, 4> nonNegativeParams{
+  const SmallVector<int64_t, 6> nonNegativeParams{
       config.paddingHeightLeft, config.paddingHeightRight,
-      config.paddingWidthLeft, config.paddingWidthRight};
+      config.paddingWidthLeft,  config.paddingWidthRight,
+      config.paddingDepthLeft,  config.paddingDepthRight};
   if (std::any_of(nonNegativeParams.begin(), nonNegativeParams.end(),
                   [](const int64_t &a) { return a < 0; })) {
     LLVM_DEBUG(llvm::dbgs() << "Padding values cannot be negative\n");
@@ -158,11 +161,13 @@ LogicalResult Conv2dGenerator::hasValidDimension() const {
   }
 
   static const llvm::StringMap<size_t> typeWidths{
+      {"f64", sizeof(double)},    {"fp64", sizeof(double)},
       {"f32", sizeof(float)},     {"fp32", sizeof(float)},
       {"fp16", sizeof(uint16_t)}, {"f16", sizeof(uint16_t)},
-      {"bf16", sizeof(uint16_t)}, {"i8", sizeof(int8_t)}};
+      {"bf16", sizeof(uint16_t)}, {"i8", sizeof(int8_t)},
+      {"fp8", sizeof(int8_t)},    {"bf8", sizeof(int8_t)}};
 
-  auto checkDimSizes = [](const SmallVector<int64_t, 5> &dims) -> bool {
+  auto checkDimSizes = [](const SmallVector<int64_t, 6> &dims) -> bool {
     return std::all_of(dims.begin(), dims.end(),
                        [](const int64_t &a) { return a > 0; });
   };
@@ -193,9 +198,15 @@ LogicalResult Conv2dGenerator::hasValidDimension() const {
   auto outDim = canonicalizeDims(config.outputDimension, config.outputLayout);
 
   // Note: hasDimensions() prints error messages
-  if (failed(hasDimensions(inDim, "ngchw", "input")) ||
-      failed(hasDimensions(filDim, "gkcyx", "filter")) ||
-      failed(hasDimensions(outDim, "ngkhw", "output"))) {
+  bool is3D = isConv3D();
+  if (failed(hasDimensions(inDim, is3D ? "ngcdhw" : "ngchw", "input")) ||
+      failed(hasDimensions(filDim, is3D ? "gkczyx" : "gkcyx", "filter")) ||
+      failed(hasDimensions(outDim, is3D ? "ngkdhw" : "ngkhw", "output"))) {
+    return failure();
+  }
+  if (is3D && config.operation.hasValue() &&
+      config.operation.getValue() != ConvOpType::Fwd) {
+    LLVM_DEBUG(llvm::dbgs() << "3D convolutions are only supported forward\n");
     return failure();
   }
 
@@ -240,6 +251,24 @@ LogicalResult Conv2dGenerator::hasValidDimension() const {
     return failure();
   }
 
+  if (is3D) {
+    int64_t expectedOutDepth = outputDim(
+        inDim["d"], filDim["z"], config.paddingDepthLeft,
+        config.paddingDepthRight, config.strideDepth, config.dilationDepth);
+    if (outDim["d"] != expectedOutDepth) {
+      LLVM_DEBUG(llvm::dbgs()
+                 << "Output depth " << outDim["d"] << " doesn't match depth "
+                 << expectedOutDepth << " computed from other parameters\n");
+      return failure();
+    }
+    if (inDim["d"] + config.paddingDepthLeft + config.paddingDepthRight <
+        filDim["z"]) {
+      LLVM_DEBUG(llvm::dbgs()
+                 << "Input, including padding, is shallower than the filter\n");
+      return failure();
+    }
+  }
+
   if (inDim["h"] + config.paddingHeightLeft + config.paddingHeightRight <
       filDim["y"]) {
     LLVM_DEBUG(llvm::dbgs()
@@ -270,6 +299,11 @@ LogicalResult Conv2dGenerator::hasValidChip() const {
   if (sscanf(config.chip.c_str(), "gfx%x", &chipHexNumber) != 1)
     return failure();
 
+  // RDNA3 (gfx11) is supported through its WMMA instructions, which take the
+  // XDLOPS path
+  if (chipHexNumber >= 0x1100 && chipHexNumber <= 0x11ff)
+    return success(config.xdlops);
+
   if ((chipHexNumber > 0x90a) || (chipHexNumber < 0x900))
     return failure();
 
@@ -288,6 +322,19 @@ int Conv2dGenerator::getKernelCount(OpBuilder &builder) const {
   case ConvOpType::BwdData:
     return getBwdDataKernelCount();
   case ConvOpType::Fwd:
+    if (getWinogradTile(builder) > 0) {
+      // The first kernel transforms the filter into the workspace, where it
+      // can be kept for constant weights, and the second one transforms the
+      // input, multiplies and transforms the result into the output.
+      return 2;
+    }
+    if (usesSplitK(builder)) {
+      // Split-K forward convolutions follow the backward weight scheme: the
+      // first kernel 0-initializes the output (workspace for fp16 without
+      // packed atomics), the second accumulates into it with atomic adds
+      // and, with a workspace, the third converts it to the output.
+      return hasWorkspace(builder) ? 3 : 2;
+    }
     return 1;
   case ConvOpType::BwdWeight:
     return getBwdWeightKernelCount(builder);
@@ -298,9 +345,17 @@ int Conv2dGenerator::getKernelCount(OpBuilder &builder) const {
 int Conv2dGenerator::getBwdWeightKernelCount(OpBuilder &builder) const {
   assert(config.operation.getValue() == ConvOpType::BwdWeight);
 
-  if (config.xdlops) {
+  // The first kernel writes the partial filter of each KBlock into the
+  // workspace and the second one sums them into the filter, unless the first
+  // one does both.
+  if (usesKBlockReduction(builder))
+    return usesFusedReduction(builder) ? 1 : 2;
+
+  // Deterministic backward weight convolutions that cannot reduce their
+  // KBlocks write the filter directly.
+  if (config.xdlops && !config.deterministic) {
     Type dataType = getDataType(builder);
-    if (!needExtraPadBwdWeight(builder)) {
+    if (!needExtraPad(builder)) {
       if (dataType == builder.getF32Type()) {
         // For the following case, use 2 kernels:
         // - backward weight
@@ -312,7 +367,10 @@ int Conv2dGenerator::getBwdWeightKernelCount(OpBuilder &builder) const {
         // convolution, using atomic add instructions.
         return 2;
       } else if (dataType == builder.getF16Type()) {
-        // For the following case, use 3 kernels:
+        // Packed fp16 atomics add into the filter itself, as for fp32.
+        if (usesPackedAtomics(builder))
+          return 2;
+        // Otherwise, for the following case, use 3 kernels:
         // - backward weight
         // - XDLOPS
         // - fp16
@@ -330,31 +388,68 @@ int Conv2dGenerator::getBwdWeightKernelCount(OpBuilder &builder) const {
 }
 
 int Conv2dGenerator::getBwdDataKernelCount() const {
+  return static_cast<int>(getBwdDataGemmIds().size());
+}
+
+SmallVector<int64_t> Conv2dGenerator::getBwdDataGemmIds() const {
   llvm::SmallVector<int64_t> gemmIds = populateBackwardDataGemmIds(
       config.strideHeight, config.strideWidth, config.dilationHeight,
       config.dilationWidth, config.filterHeight, config.filterWidth);
-  return static_cast<int>(gemmIds.size());
+  // A single launch keeps gemm ID 0, which then computes every GEMM.
+  if (usesSingleLaunch())
+    gemmIds.resize(1);
+  return gemmIds;
+}
+
+bool Conv2dGenerator::usesSingleLaunch() const {
+  if (!config.singleLaunch || !config.operation.hasValue() ||
+      config.operation.getValue() != ConvOpType::BwdData)
+    return false;
+  llvm::SmallVector<int64_t> gemmIds = populateBackwardDataGemmIds(
+      config.strideHeight, config.strideWidth, config.dilationHeight,
+      config.dilationWidth, config.filterHeight, config.filterWidth);
+  return gemmIds.size() > 1;
+}
+
+bool Conv2dGenerator::usesDilationPhases(OpBuilder &builder) const {
+  // Only the output pixels of stride-1 convolutions fall into phases that
+  // each read their own subsampling of the input.
+  if (!config.dilationPhases || !config.operation.hasValue() ||
+      config.operation.getValue() != ConvOpType::Fwd || isConv3D() ||
+      config.strideHeight != 1 || config.strideWidth != 1 ||
+      usesSplitK(builder))
+    return false;
+  return (config.dilationHeight > 1 && config.filterHeight > 1) ||
+         (config.dilationWidth > 1 && config.filterWidth > 1);
 }
 
 Type Conv2dGenerator::getDataType(OpBuilder &builder) const {
   Type dataType;
-  if (config.dataTypeStr == "f32" || config.dataTypeStr == "fp32") {
+  if (config.dataTypeStr == "f64" || config.dataTypeStr == "fp64") {
+    dataType = builder.getF64Type();
+  } else if (config.dataTypeStr == "f32" || config.dataTypeStr == "fp32") {
     dataType = builder.getF32Type();
   } else if (config.dataTypeStr == "f16" || config.dataTypeStr == "fp16") {
     dataType = builder.getF16Type();
   } else if (config.dataTypeStr == "bf16") {
     dataType = builder.getBF16Type();
-  } else if (config.dataTypeStr == "i8") {
+  } else if (config.dataTypeStr == "i8" || getFp8Format().hasValue()) {
     dataType = builder.getI8Type();
   }
   return dataType;
 }
 
-bool Conv2dGenerator::needExtraPadBwdWeight(OpBuilder &builder) const {
+Optional<Fp8Format> Conv2dGenerator::getFp8Format() const {
+  if (config.dataTypeStr == "fp8")
+    return Fp8Format::E4M3;
+  if (config.dataTypeStr == "bf8")
+    return Fp8Format::E5M2;
+  return llvm::None;
+}
+
+bool Conv2dGenerator::needExtraPad(OpBuilder &builder) const {
   Type dataType = getDataType(builder);
   ConvOpType dir = config.operation.getValue();
-  assert(dir == ConvOpType::BwdWeight &&
-         "This method should only be called for wrw ops");
 
   ConvolutionDims convDims = getConvolutionDims();
   GemmContext gemmSize = GemmContext::fromConvolution(dir, convDims);
@@ -374,39 +469,284 @@ bool Conv2dGenerator::needExtraPadBwdWeight(OpBuilder &builder) const {
   return needExtraPad;
 }
 
+bool Conv2dGenerator::usesSplitK(OpBuilder &builder) const {
+  // Forward convolutions split their reduction when asked to and when:
+  // - use XDLOPS.
+  // - data type: fp32 or fp16.
+  // - No need to pad along Gemm M/N/K dimension.
+  if (!config.splitK || config.deterministic || !config.operation.hasValue() ||
+      config.operation.getValue() != ConvOpType::Fwd || !config.xdlops ||
+      isConv3D() || getWinogradTile(builder) > 0)
+    return false;
+  Type dataType = getDataType(builder);
+  if (dataType != builder.getF32Type() && dataType != builder.getF16Type())
+    return false;
+  return !needExtraPad(builder);
+}
+
+bool Conv2dGenerator::usesKBlockReduction(OpBuilder &builder) const {
+  // Backward weight convolutions reduce their KBlocks through a workspace
+  // when asked to, or to be deterministic, and when they would otherwise add
+  // them with atomics. Both reductions sum the partials in a fixed order.
+  if (!(config.reduceKBlocks || config.deterministic) || !config.xdlops ||
+      !config.operation.hasValue() ||
+      config.operation.getValue() != ConvOpType::BwdWeight)
+    return false;
+  Type dataType = getDataType(builder);
+  if (dataType != builder.getF32Type() && dataType != builder.getF16Type())
+    return false;
+  return !needExtraPad(builder);
+}
+
+bool Conv2dGenerator::usesFusedReduction(OpBuilder &builder) const {
+  return config.fusedReduction && usesKBlockReduction(builder);
+}
+
+bool Conv2dGenerator::usesPackedAtomics(OpBuilder &builder) const {
+  // fp16 atomic adds can accumulate into the fp16 result instead of an fp32
+  // workspace on the chips with packed fp16 buffer atomics, which add pairs
+  // of halves and so need the result to have an even number of elements.
+  if (!getDataType(builder).isF16() || !config.operation.hasValue())
+    return false;
+  StringRef chip = config.chip;
+  if (chip != "gfx90a" && !chip.startswith("gfx94"))
+    return false;
+  const SmallVector<int64_t, 6> &dims =
+      config.operation.getValue() == ConvOpType::BwdWeight
+          ? config.filterDimension
+          : config.outputDimension;
+  int64_t numElements = std::accumulate(dims.begin(), dims.end(), int64_t(1),
+                                        std::multiplies<int64_t>());
+  return numElements % 2 == 0;
+}
+
+bool Conv2dGenerator::supportsWinograd(OpBuilder &builder) const {
+  if (!config.operation.hasValue() ||
+      config.operation.getValue() != ConvOpType::Fwd || isConv3D())
+    return false;
+  Type dataType = getDataType(builder);
+  if (dataType != builder.getF32Type() && dataType != builder.getF16Type())
+    return false;
+  return config.filterHeight == 3 && config.filterWidth == 3 &&
+         config.strideHeight == 1 && config.strideWidth == 1 &&
+         config.dilationHeight == 1 && config.dilationWidth == 1;
+}
+
+ArrayRef<int> Conv2dGenerator::getWinogradTiles() {
+  static const int tiles[] = {2, 4};
+  return tiles;
+}
+
+std::string Conv2dGenerator::getWinogradPerfConfig(int tile) {
+  return "winograd:" + std::to_string(tile);
+}
+
+int Conv2dGenerator::getWinogradTile(OpBuilder &builder) const {
+  int tile = config.winogradTile;
+  for (int candidate : getWinogradTiles())
+    if (config.perfConfig == getWinogradPerfConfig(candidate))
+      tile = candidate;
+  if (!llvm::is_contained(getWinogradTiles(), tile) ||
+      !supportsWinograd(builder))
+    return 0;
+  return tile;
+}
+
+bool Conv2dGenerator::usesDirectConv() const {
+  // The conditions of usesDirectGroupedConv(), which the convolution will
+  // meet once generated.
+  if (!config.operation.hasValue() ||
+      config.operation.getValue() != ConvOpType::Fwd || isConv3D() ||
+      !config.perfConfig.empty())
+    return false;
+  ConvolutionDims dims = getConvolutionDims();
+  return dims.g > 1 && dims.c <= kDirectConvMaxChannelsPerGroup &&
+         dims.k <= kDirectConvMaxChannelsPerGroup;
+}
+
+ConvSolver Conv2dGenerator::getSolver(OpBuilder &builder) const {
+  if (getWinogradTile(builder) > 0)
+    return ConvSolver::Winograd;
+  if (usesSplitK(builder))
+    return ConvSolver::SplitK;
+  if (usesDilationPhases(builder))
+    return ConvSolver::DilationPhases;
+  if (usesDirectConv())
+    return ConvSolver::DirectGrouped;
+  return ConvSolver::ImplicitGemm;
+}
+
+void Conv2dGenerator::selectSolver(OpBuilder &builder) {
+  selectForwardSolver(builder);
+  if (usesKBlockReduction(builder) && config.reductionKBlocks == 0)
+    config.reductionKBlocks = getReductionKBlocks(builder);
+}
+
+int64_t Conv2dGenerator::getReductionKBlocks(OpBuilder &builder) const {
+  if (config.reductionKBlocks > 0)
+    return config.reductionKBlocks;
+
+  // Tune the GEMM kernel as AffixTuningParameters does, with room for as many
+  // KBlocks as the batch splits into.
+  Config unbounded = config;
+  unbounded.reductionKBlocks = getConvolutionDims().n;
+  Conv2dGenerator generator(unbounded);
+  OwningOpRef<ModuleOp> module = ModuleOp::create(builder.getUnknownLoc());
+  ModuleOp moduleOp = module.get();
+  if (failed(generator.genConvModule(moduleOp, /*kernel_id=*/0)))
+    return 1;
+  int64_t kBlocks = 1;
+  moduleOp.walk([&](Conv2DBwdWeightOp op) {
+    ConvolutionContext ctx = populateConvContext(op);
+    PopulateParamsXDL populateParamsXDL;
+    InitParamsXDL params;
+    DerivedParams gemmADerivedParam, gemmBDerivedParam;
+    DerivedOutParams gemmCDerivedParam;
+    int64_t blockSize = 0, gridSize = 0;
+    for (const std::string &perfConfig : {config.perfConfig, std::string()})
+      if (succeeded(populateParamsXDL.obtainTuningParameters(
+              ctx, /*blockSizeOverride=*/0, perfConfig, params,
+              gemmADerivedParam, gemmBDerivedParam, gemmCDerivedParam,
+              blockSize, gridSize, kBlocks)))
+        return;
+    kBlocks = 1;
+  });
+  LLVM_DEBUG(llvm::dbgs() << "Workspace for " << kBlocks
+                          << " partial filters\n");
+  return kBlocks;
+}
+
+void Conv2dGenerator::selectForwardSolver(OpBuilder &builder) {
+  if (!config.autoSolver || !config.perfConfig.empty() ||
+      !config.operation.hasValue() ||
+      config.operation.getValue() != ConvOpType::Fwd)
+    return;
+
+  Config base = config;
+  base.splitK = false;
+  base.winogradTile = 0;
+  base.dilationPhases = false;
+  // Without any setting, the shape chooses between the implicit GEMM and the
+  // direct kernels.
+  SmallVector<Config, 4> candidates = {base};
+  for (ConvSolver solver : getConvSolvers()) {
+    switch (solver) {
+    case ConvSolver::ImplicitGemm:
+    case ConvSolver::DirectGrouped:
+    case ConvSolver::SkinnyGemm:
+      break;
+    case ConvSolver::Winograd:
+      for (int tile : getWinogradTiles()) {
+        candidates.push_back(base);
+        candidates.back().winogradTile = tile;
+      }
+      break;
+    case ConvSolver::SplitK:
+      candidates.push_back(base);
+      candidates.back().splitK = true;
+      break;
+    case ConvSolver::DilationPhases:
+      candidates.push_back(base);
+      candidates.back().dilationPhases = true;
+      break;
+    }
+  }
+
+  Type dataType = getDataType(builder);
+  if (!dataType)
+    return;
+  ConvSolverProblem problem{ConvOpType::Fwd, getConvolutionDims(),
+                            dataType.getIntOrFloatBitWidth() / 8,
+                            config.num_cu, config.dilationHeight,
+                            config.dilationWidth};
+  // Candidates whose solver does not apply fall back to another one, which
+  // is then costed as such.
+  Optional<double> bestCost;
+  for (const Config &candidate : candidates) {
+    Conv2dGenerator generator(candidate);
+    ConvSolver solver = generator.getSolver(builder);
+    double cost = estimateConvSolverCost(solver, problem,
+                                         generator.getWinogradTile(builder));
+    LLVM_DEBUG(llvm::dbgs() << "Solver " << getNameForConvSolver(solver)
+                            << " costs " << cost << "\n");
+    if (!bestCost || cost < *bestCost) {
+      bestCost = cost;
+      config = candidate;
+    }
+  }
+}
+
 bool Conv2dGenerator::hasWorkspace(OpBuilder &builder) const {
   // Decide if a workspace is needed.
   // Preconditions:
   // - data type: fp16
-  // - operation: backward weight conv2d.
+  // - operation: backward weight conv2d, or split-K forward conv2d.
   // - use XDLOPS.
   // - No need to pad along Gemm M/N/K dimension.
+  // - Not deterministic.
+  // - No packed fp16 atomics to accumulate into the result directly.
+  // Winograd forward convolutions always need one for the transformed filter.
   bool result = false;
 
   if (config.operation.hasValue()) {
     Type dataType = getDataType(builder);
     ConvOpType dir = config.operation.getValue();
     if ((dir == ConvOpType::BwdWeight) && config.xdlops &&
-        (dataType == builder.getF16Type())) {
+        !config.deterministic && (dataType == builder.getF16Type())) {
       // In case we need extra padding, do not use workspace.
-      result = (needExtraPadBwdWeight(builder) == false);
+      result = usesKBlockReduction(builder) ||
+               (!needExtraPad(builder) && !usesPackedAtomics(builder));
+    } else if (dir == ConvOpType::BwdWeight) {
+      result = usesKBlockReduction(builder);
+    } else if (dir == ConvOpType::Fwd) {
+      result = getWinogradTile(builder) > 0 ||
+               (dataType == builder.getF16Type() && usesSplitK(builder) &&
+                !usesPackedAtomics(builder));
     }
   }
   return result;
 }
 
+bool Conv2dGenerator::hasPersistentWorkspace(OpBuilder &builder) const {
+  // The counters of a fused KBlock reduction.
+  return usesFusedReduction(builder);
+}
+
+SmallVector<int64_t, 6>
+Conv2dGenerator::getWorkspaceDimension(OpBuilder &builder) const {
+  if (!config.operation.hasValue())
+    return config.filterDimension;
+  if (config.operation.getValue() == ConvOpType::BwdWeight) {
+    SmallVector<int64_t, 6> dims = config.filterDimension;
+    if (usesKBlockReduction(builder))
+      dims[0] *=
+          getReductionKBlocks(builder) + (usesFusedReduction(builder) ? 1 : 0);
+    return dims;
+  }
+  if (config.operation.getValue() != ConvOpType::Fwd)
+    return config.filterDimension;
+  // The Winograd filter transform of each (g, k, c) is an alpha x alpha tile.
+  if (int tile = getWinogradTile(builder)) {
+    ConvolutionDims dims = getConvolutionDims();
+    int64_t alpha = tile + config.filterHeight - 1;
+    return {dims.g, dims.k, dims.c, alpha, alpha};
+  }
+  return config.outputDimension;
+}
+
 int Conv2dGenerator::getWorkspaceSize(ModuleOp &module) const {
-  // Currently onlt in the following condition would a workspace is needed.
+  // Currently only in the following condition would a workspace is needed.
   // - data type: fp16
-  // - operation: backward weight conv2d.
+  // - operation: backward weight conv2d, or split-K forward conv2d.
   // - use XDLOPS.
   // - No need to pad along Gemm M/N/K dimension.
-  // Workspace size is the same as the filter dimension, with fp32 type.
+  // or for Winograd forward convolutions. Workspace size is that of
+  // getWorkspaceDimension(), with fp32 type.
   int result = 0;
   OpBuilder builder(module.getContext());
   if (hasWorkspace(builder)) {
-    result = std::accumulate(config.filterDimension.begin(),
-                             config.filterDimension.end(), 1,
+    SmallVector<int64_t, 6> dims = getWorkspaceDimension(builder);
+    result = std::accumulate(dims.begin(), dims.end(), 1,
                              std::multiplies<int>()) *
              builder.getF32Type().getWidth() / 8;
   }
@@ -432,18 +772,32 @@ LogicalResult Conv2dGenerator::parseConvConfig(const char *arguments) {
     static const std::vector<std::string> layoutArgs = {
         "fil_layout", "in_layout", "out_layout"};
 
-    if (!std::all_of(layoutArgs.cbegin(), layoutArgs.cend(),
-                     [&argMap](const std::string &key) {
-                       return argMap[key].length() == 5;
+    // 3D convolutions have 6-dimensional layouts and depth sizes.
+    size_t layoutLen = argMap["in_layout"].length();
+    if ((layoutLen != 5 && layoutLen != 6) ||
+        !std::all_of(layoutArgs.cbegin(), layoutArgs.cend(),
+                     [&](const std::string &key) {
+                       return argMap[key].length() == layoutLen;
                      })) {
       return false;
     }
+    static const std::vector<std::string> depthKeys = {"in_d", "out_d",
+                                                       "fil_d"};
+    if (layoutLen == 6 &&
+        !std::all_of(
+            depthKeys.cbegin(), depthKeys.cend(),
+            [&argMap](const std::string &key) { return argMap.count(key); })) {
+      return false;
+    }
 
     bool noMixedTypes =
         (argMap["in_type"] == argMap["fil_type"] &&
          argMap["out_type"] == argMap["in_type"]) ||
         (argMap["in_type"] == "i8" && argMap["fil_type"] == "i8" &&
-         argMap["out_type"] == "i32");
+         argMap["out_type"] == "i32") ||
+        ((argMap["in_type"] == "fp8" || argMap["in_type"] == "bf8") &&
+         argMap["fil_type"] == argMap["in_type"] &&
+         argMap["out_type"] == "fp32");
     return noMixedTypes;
   };
 
@@ -468,17 +822,23 @@ LogicalResult Conv2dGenerator::parseConvConfig(const char *arguments) {
     }
   };
 
-  std::string arch;
-  strToStr("arch", arch);
-  IsaNameSplitter splitter(arch);
-  if (failed(
-          splitter.parseIsaName(config.chip, config.triple, config.features))) {
+  if (failed(parseArch(argMap["arch"]))) {
     return failure();
   }
 
   strToStr("perf_config", config.perfConfig);
   strToInt("num_cu", config.num_cu);
   strToInt("x2", config.xdlops);
+  strToInt("split_k", config.splitK);
+  strToInt("winograd", config.winogradTile);
+  strToInt("single_launch", config.singleLaunch);
+  strToInt("dilation_phases", config.dilationPhases);
+  strToInt("auto_solver", config.autoSolver);
+  strToInt("deterministic", config.deterministic);
+  strToInt("reduce_kblocks", config.reduceKBlocks);
+  strToInt("fused_reduction", config.fusedReduction);
+  strToInt("xf32", config.xf32);
+  strToInt("phase_timing", config.phaseTiming);
 
   // conv settings
   auto const op = getConvOpTypeForName(argMap["operation"]);
@@ -487,7 +847,9 @@ LogicalResult Conv2dGenerator::parseConvConfig(const char *arguments) {
   }
 
   auto canonicalizeDataType = [](const std::string type) {
-    if (type == "fp32")
+    if (type == "fp64")
+      return std::string("f64");
+    else if (type == "fp32")
       return std::string("f32");
     else if (type == "fp16")
       return std::string("f16");
@@ -505,29 +867,40 @@ LogicalResult Conv2dGenerator::parseConvConfig(const char *arguments) {
   strToInt("padding_h", config.paddingHeightRight);
   strToInt("padding_w", config.paddingWidthLeft);
   strToInt("padding_w", config.paddingWidthRight);
+  strToInt("dilation_d", config.dilationDepth);
+  strToInt("conv_stride_d", config.strideDepth);
+  strToInt("padding_d", config.paddingDepthLeft);
+  strToInt("padding_d", config.paddingDepthRight);
 
   strToStr("kernel_name", config.kernelBaseName);
 
-  // Allow only fwd direction for int8. Reject other directions.
+  // Allow only fwd direction for int8 and fp8. Reject other directions.
   if (config.operation.getValue() != ConvOpType::Fwd &&
-      config.dataTypeStr == "i8") {
+      (config.dataTypeStr == "i8" || getFp8Format().hasValue())) {
     return failure();
   }
+  // fp8 convolutions only exist as XDLOPS gemms, and so do xf32 ones, of
+  // fp32 data.
+  if (getFp8Format().hasValue() && !config.xdlops)
+    return failure();
+  if (config.xf32 && (config.dataTypeStr != "f32" || !config.xdlops))
+    return failure();
 
-  // MIOpen has NCHW as layout string for all three tensors
-  config.inputLayout = translateLayout(
-      argMap["in_layout"], std::string("NGCHW"), std::string("ngchw"));
-  config.filterLayout = translateLayout(
-      argMap["fil_layout"], std::string("GNCHW"), std::string("gkcyx"));
-  config.outputLayout = translateLayout(
-      argMap["out_layout"], std::string("NGCHW"), std::string("ngkhw"));
+  if (failed(parseLayouts(argMap["in_layout"], argMap["fil_layout"],
+                          argMap["out_layout"]))) {
+    return failure();
+  }
+
+  auto depth = [&](const std::string &key) -> int64_t {
+    return isConv3D() ? strToLong(key) : 1;
+  };
 
   // Determine tensor dimensions.
-  auto status = parseConvDims(strToLong("batchsize"), strToLong("groupsize"),
-                              strToLong("in_channels"), strToLong("in_h"),
-                              strToLong("in_w"), strToLong("out_channels"),
-                              strToLong("out_h"), strToLong("out_w"),
-                              strToLong("fil_w"), strToLong("fil_h"));
+  auto status = parseConvDims(
+      strToLong("batchsize"), strToLong("groupsize"), strToLong("in_channels"),
+      strToLong("in_h"), strToLong("in_w"), strToLong("out_channels"),
+      strToLong("out_h"), strToLong("out_w"), strToLong("fil_w"),
+      strToLong("fil_h"), depth("in_d"), depth("out_d"), depth("fil_d"));
 
   if (status.failed()) {
     return failure();
@@ -536,32 +909,75 @@ LogicalResult Conv2dGenerator::parseConvConfig(const char *arguments) {
   return success();
 }
 
+LogicalResult Conv2dGenerator::parseArch(const std::string &arch) {
+  IsaNameSplitter splitter(arch);
+  return splitter.parseIsaName(config.chip, config.triple, config.features);
+}
+
+LogicalResult Conv2dGenerator::parseLayouts(const std::string &inLayout,
+                                            const std::string &filLayout,
+                                            const std::string &outLayout) {
+  size_t layoutLen = inLayout.length();
+  if ((layoutLen != 5 && layoutLen != 6) || filLayout.length() != layoutLen ||
+      outLayout.length() != layoutLen) {
+    return failure();
+  }
+
+  // MIOpen has NCHW as layout string for all three tensors, and NCDHW for
+  // those of 3D convolutions
+  if (layoutLen == 6) {
+    config.inputLayout = translateLayout(inLayout, std::string("NGCDHW"),
+                                         std::string("ngcdhw"));
+    config.filterLayout = translateLayout(filLayout, std::string("GNCDHW"),
+                                          std::string("gkczyx"));
+    config.outputLayout = translateLayout(outLayout, std::string("NGCDHW"),
+                                          std::string("ngkdhw"));
+    if (config.operation.getValue() != ConvOpType::Fwd)
+      return failure();
+  } else {
+    config.inputLayout = translateLayout(inLayout, std::string("NGCHW"),
+                                         std::string("ngchw"));
+    config.filterLayout = translateLayout(filLayout, std::string("GNCHW"),
+                                          std::string("gkcyx"));
+    config.outputLayout = translateLayout(outLayout, std::string("NGCHW"),
+                                          std::string("ngkhw"));
+  }
+  return success();
+}
+
 LogicalResult
 Conv2dGenerator::parseConvDims(int64_t batchSize, int64_t groupSize,
                                int64_t inputChannel, int64_t inputHeight,
                                int64_t inputWidth, int64_t outputChannel,
                                int64_t outputHeight, int64_t outputWidth,
-                               int64_t filterHeight, int64_t filterWidth) {
+                               int64_t filterHeight, int64_t filterWidth,
+                               int64_t inputDepth, int64_t outputDepth,
+                               int64_t filterDepth) {
   config.filterHeight = filterHeight;
   config.filterWidth = filterWidth;
-  static const std::string filterKeys = "kgcyx";
-  int64_t filterVals[] = {outputChannel / groupSize, groupSize,
-                          inputChannel / groupSize, filterHeight, filterWidth};
-
-  static const std::string inputKeys = "ngchw";
-  int64_t inputVals[] = {batchSize, groupSize, inputChannel / groupSize,
-                         inputHeight, inputWidth};
-
-  static const std::string outputKeys = "ngkhw";
-  int64_t outputVals[] = {batchSize, groupSize, outputChannel / groupSize,
-                          outputHeight, outputWidth};
+  config.filterDepth = filterDepth;
+  static const std::string filterKeys = "kgcyxz";
+  int64_t filterVals[] = {outputChannel / groupSize,
+                          groupSize,
+                          inputChannel / groupSize,
+                          filterHeight,
+                          filterWidth,
+                          filterDepth};
+
+  static const std::string inputKeys = "ngchwd";
+  int64_t inputVals[] = {batchSize,   groupSize,  inputChannel / groupSize,
+                         inputHeight, inputWidth, inputDepth};
+
+  static const std::string outputKeys = "ngkhwd";
+  int64_t outputVals[] = {batchSize,    groupSize,   outputChannel / groupSize,
+                          outputHeight, outputWidth, outputDepth};
 
   auto convertLayout = [](char &key, const std::string &kmap, int64_t vals[],
                           auto &dims) {
     auto keyl = std::tolower(key);
     auto ii = kmap.find(keyl);
     if (ii == std::string::npos) {
-      static std::string nchw = "ngchw";
+      static const std::string nchw = "ngchwd";
       ii = nchw.find(keyl);
       if (ii == std::string::npos)
         return false;
@@ -592,8 +1008,9 @@ Conv2dGenerator::parseConvDims(int64_t batchSize, int64_t groupSize,
   if (config.kernelBaseName.empty()) {
     assert(config.operation.hasValue());
     auto opType = config.operation.getValue();
-    config.kernelBaseName = std::string("miopen_") +
-                            getNameForConvOpType(opType).str() + "_" +
+    std::string opName =
+        isConv3D() ? "conv3d" : getNameForConvOpType(opType).str();
+    config.kernelBaseName = std::string("miopen_") + opName + "_" +
                             config.filterLayout + "_" + config.inputLayout +
                             "_" + config.outputLayout;
   }
@@ -611,10 +1028,66 @@ void Conv2dGenerator::setDataType(std::string newType) {
 
 void Conv2dGenerator::flipXdlops() { config.xdlops = !config.xdlops; }
 
+void Conv2dGenerator::setSplitK(bool splitK) { config.splitK = splitK; }
+
+void Conv2dGenerator::setKernelId(int kernelId) { config.kernelId = kernelId; }
+
+void Conv2dGenerator::setDeterministic(bool deterministic) {
+  config.deterministic = deterministic;
+}
+
+void Conv2dGenerator::setReduceKBlocks(bool reduceKBlocks) {
+  config.reduceKBlocks = reduceKBlocks;
+}
+
+void Conv2dGenerator::setFusedReduction(bool fusedReduction) {
+  config.fusedReduction = fusedReduction;
+}
+
+void Conv2dGenerator::setFp8Scale(float fp8Scale) {
+  config.fp8Scale = fp8Scale;
+}
+
+void Conv2dGenerator::setXf32(bool xf32) { config.xf32 = xf32; }
+
+void Conv2dGenerator::setSingleLaunch(bool singleLaunch) {
+  config.singleLaunch = singleLaunch;
+}
+
+void Conv2dGenerator::setDilationPhases(bool dilationPhases) {
+  config.dilationPhases = dilationPhases;
+}
+
+void Conv2dGenerator::setWinogradTile(int winogradTile) {
+  config.winogradTile = winogradTile;
+}
+
+void Conv2dGenerator::setAutoSolver(bool autoSolver) {
+  config.autoSolver = autoSolver;
+}
+
+void Conv2dGenerator::setPhaseTiming(bool phaseTiming) {
+  config.phaseTiming = phaseTiming;
+}
+
+void Conv2dGenerator::setDepthParams(int dilationDepth, int strideDepth,
+                                     int paddingDepthLeft,
+                                     int paddingDepthRight) {
+  config.dilationDepth = dilationDepth;
+  config.strideDepth = strideDepth;
+  config.paddingDepthLeft = paddingDepthLeft;
+  config.paddingDepthRight = paddingDepthRight;
+}
+
 ConvolutionDims Conv2dGenerator::getConvolutionDims() const {
   auto inDim = canonicalizeDims(config.inputDimension, config.inputLayout);
   auto filDim = canonicalizeDims(config.filterDimension, config.filterLayout);
   auto outDim = canonicalizeDims(config.outputDimension, config.outputLayout);
+  if (isConv3D())
+    return ConvolutionDims(filDim["y"], filDim["x"], outDim["h"], outDim["w"],
+                           inDim["h"], inDim["w"], filDim["k"], filDim["c"],
+                           inDim["n"], inDim["g"], filDim["z"], outDim["d"],
+                           inDim["d"]);
   return ConvolutionDims(filDim["y"], filDim["x"], outDim["h"], outDim["w"],
                          inDim["h"], inDim["w"], filDim["k"], filDim["c"],
                          inDim["n"], inDim["g"]);
@@ -630,8 +1103,11 @@ LogicalResult Conv2dGenerator::genConvModule(ModuleOp &module, int kernel_id,
     return failure();
   }
 
+  Optional<Fp8Format> fp8Format = getFp8Format();
   Type outputDataType = dataType;
-  if (dataType.isInteger(8)) {
+  if (fp8Format.hasValue()) {
+    outputDataType = builder.getF32Type();
+  } else if (dataType.isInteger(8)) {
     outputDataType = builder.getIntegerType(32);
   }
   // Construct a new FuncOp.
@@ -652,9 +1128,7 @@ LogicalResult Conv2dGenerator::genConvModule(ModuleOp &module, int kernel_id,
   Type workspaceArgType;
   if (hasWorkspace) {
     workspaceArgType =
-        MemRefType::get(ArrayRef<int64_t>(config.filterDimension.begin(),
-                                          config.filterDimension.end()),
-                        builder.getF32Type());
+        MemRefType::get(getWorkspaceDimension(builder), builder.getF32Type());
   }
 
   SmallVector<Type, 3> funcArgTypes = {filterArgType, inputArgType,
@@ -663,6 +1137,10 @@ LogicalResult Conv2dGenerator::genConvModule(ModuleOp &module, int kernel_id,
     funcArgTypes = {filterArgType, inputArgType, outputArgType,
                     workspaceArgType};
   }
+  bool hasPhaseTimes = config.phaseTiming && !is_verifier;
+  if (hasPhaseTimes)
+    funcArgTypes.push_back(MemRefType::get(
+        {kPhaseTimingWorkgroups, kNumPhaseStamps}, builder.getI64Type()));
   auto funcType = builder.getFunctionType(funcArgTypes, {});
 
   std::string kernelName = config.kernelBaseName;
@@ -695,15 +1173,20 @@ LogicalResult Conv2dGenerator::genConvModule(ModuleOp &module, int kernel_id,
     return failure();
   }
   kernelFunc = func;
+  if (hasPhaseTimes)
+    func.setArgAttr(funcArgTypes.size() - 1, kPhaseTimesAttrName,
+                    builder.getUnitAttr());
+  if (usesFusedReduction(builder))
+    func.setArgAttr(3, kZeroInitAttrName, builder.getUnitAttr());
 
   // Construct a new Block.
   Block *block = func.addEntryBlock();
 
   // Construct a new Conv2DOp.
-  SmallVector<StringAttr, 5> filterLayoutSpec;
-  SmallVector<StringAttr, 5> inputLayoutSpec;
-  SmallVector<StringAttr, 5> outputLayoutSpec;
-  for (size_t i = 0; i < 5; ++i) {
+  SmallVector<StringAttr, 6> filterLayoutSpec;
+  SmallVector<StringAttr, 6> inputLayoutSpec;
+  SmallVector<StringAttr, 6> outputLayoutSpec;
+  for (size_t i = 0, e = config.filterLayout.size(); i < e; ++i) {
     filterLayoutSpec.push_back(
         builder.getStringAttr(StringRef(&config.filterLayout[i], 1)));
     inputLayoutSpec.push_back(builder.getStringAttr(
@@ -718,13 +1201,30 @@ LogicalResult Conv2dGenerator::genConvModule(ModuleOp &module, int kernel_id,
 
   // Obtain gemm ID from kernel_id for backward data convolution.
   if (config.operation.getValue() == ConvOpType::BwdData) {
-    llvm::SmallVector<int64_t> gemmIds = populateBackwardDataGemmIds(
-        config.strideHeight, config.strideWidth, config.dilationHeight,
-        config.dilationWidth, config.filterHeight, config.filterWidth);
+    llvm::SmallVector<int64_t> gemmIds = getBwdDataGemmIds();
     assert(gemmIds.size() > static_cast<size_t>(kernel_id));
     gemmId = gemmIds[kernel_id];
   }
 
+  SmallVector<Attribute, 3> dilations = {
+      builder.getI32IntegerAttr(config.dilationHeight),
+      builder.getI32IntegerAttr(config.dilationWidth)};
+  SmallVector<Attribute, 3> strides = {
+      builder.getI32IntegerAttr(config.strideHeight),
+      builder.getI32IntegerAttr(config.strideWidth)};
+  SmallVector<Attribute, 6> padding = {
+      builder.getI32IntegerAttr(config.paddingHeightLeft),
+      builder.getI32IntegerAttr(config.paddingHeightRight),
+      builder.getI32IntegerAttr(config.paddingWidthLeft),
+      builder.getI32IntegerAttr(config.paddingWidthRight)};
+  // 3D convolutions append their depth parameters to the 2D ones.
+  if (isConv3D()) {
+    dilations.push_back(builder.getI32IntegerAttr(config.dilationDepth));
+    strides.push_back(builder.getI32IntegerAttr(config.strideDepth));
+    padding.push_back(builder.getI32IntegerAttr(config.paddingDepthLeft));
+    padding.push_back(builder.getI32IntegerAttr(config.paddingDepthRight));
+  }
+
   std::vector<NamedAttribute> attributes{
       builder.getNamedAttr("gemm_id", builder.getI32IntegerAttr(gemmId)),
       builder.getNamedAttr("arch", builder.getStringAttr(config.chip)),
@@ -742,23 +1242,9 @@ LogicalResult Conv2dGenerator::genConvModule(ModuleOp &module, int kernel_id,
           builder.getArrayAttr(ArrayRef<Attribute>(outputLayoutSpec.begin(),
                                                    outputLayoutSpec.end()))),
 
-      builder.getNamedAttr("dilations",
-                           builder.getArrayAttr({
-                               builder.getI32IntegerAttr(config.dilationHeight),
-                               builder.getI32IntegerAttr(config.dilationWidth),
-                           })),
-      builder.getNamedAttr("strides",
-                           builder.getArrayAttr({
-                               builder.getI32IntegerAttr(config.strideHeight),
-                               builder.getI32IntegerAttr(config.strideWidth),
-                           })),
-      builder.getNamedAttr(
-          "padding", builder.getArrayAttr({
-                         builder.getI32IntegerAttr(config.paddingHeightLeft),
-                         builder.getI32IntegerAttr(config.paddingHeightRight),
-                         builder.getI32IntegerAttr(config.paddingWidthLeft),
-                         builder.getI32IntegerAttr(config.paddingWidthRight),
-                     })),
+      builder.getNamedAttr("dilations", builder.getArrayAttr(dilations)),
+      builder.getNamedAttr("strides", builder.getArrayAttr(strides)),
+      builder.getNamedAttr("padding", builder.getArrayAttr(padding)),
   };
 
   // xdlops v2.
@@ -767,8 +1253,66 @@ LogicalResult Conv2dGenerator::genConvModule(ModuleOp &module, int kernel_id,
         builder.getNamedAttr("xdlopsV2", builder.getBoolAttr(true)));
   }
 
+  // fp8 and bf8 convolutions, whose i8 tensors hold 8-bit floats.
+  if (fp8Format.hasValue()) {
+    attributes.push_back(builder.getNamedAttr(
+        "fp8_format",
+        builder.getStringAttr(getNameForFp8Format(fp8Format.getValue()))));
+    if (config.fp8Scale != 1.0f)
+      attributes.push_back(builder.getNamedAttr(
+          "fp8_scale", builder.getF32FloatAttr(config.fp8Scale)));
+  }
+
+  // fp32 convolutions multiplied with the xf32 XDLOPS.
+  if (config.xf32) {
+    attributes.push_back(builder.getNamedAttr("xf32", builder.getUnitAttr()));
+  }
+
+  // split-K forward convolutions.
+  if (usesSplitK(builder)) {
+    attributes.push_back(
+        builder.getNamedAttr("split_k", builder.getUnitAttr()));
+  }
+
+  // Backward weight convolutions that do not accumulate with atomics.
+  if (config.deterministic &&
+      config.operation.getValue() == ConvOpType::BwdWeight) {
+    attributes.push_back(
+        builder.getNamedAttr("deterministic", builder.getUnitAttr()));
+  }
+
+  // Backward weight convolutions that reduce their KBlocks in a workspace.
+  if (usesKBlockReduction(builder)) {
+    attributes.push_back(
+        builder.getNamedAttr("reduce_kblocks", builder.getUnitAttr()));
+  }
+  if (usesFusedReduction(builder)) {
+    attributes.push_back(
+        builder.getNamedAttr("fused_reduction", builder.getUnitAttr()));
+  }
+
+  // Strided backward data convolutions computed in one GEMM kernel.
+  if (usesSingleLaunch()) {
+    attributes.push_back(
+        builder.getNamedAttr("single_launch", builder.getUnitAttr()));
+  }
+
+  // Dilated forward convolutions computed phase by phase.
+  if (usesDilationPhases(builder)) {
+    attributes.push_back(
+        builder.getNamedAttr("dilation_phases", builder.getUnitAttr()));
+  }
+
+  // Winograd forward convolutions, whose perf_config is not meant for the
+  // GEMM tuning.
+  int winogradTile = getWinogradTile(builder);
+  if (winogradTile > 0) {
+    attributes.push_back(builder.getNamedAttr(
+        "winograd_tile", builder.getI32IntegerAttr(winogradTile)));
+  }
+
   // perf_config
-  if (!ignoreTuning && !config.perfConfig.empty()) {
+  if (!ignoreTuning && !config.perfConfig.empty() && winogradTile == 0) {
     attributes.push_back(builder.getNamedAttr(
         "perf_config", builder.getStringAttr(config.perfConfig)));
   }
@@ -779,8 +1323,19 @@ LogicalResult Conv2dGenerator::genConvModule(ModuleOp &module, int kernel_id,
     args = {func.getArgument(0), func.getArgument(1), func.getArgument(2),
             func.getArgument(3)};
   }
+  if (isConv3D() && config.operation.getValue() != ConvOpType::Fwd)
+    return failure();
   switch (config.operation.getValue()) {
   case ConvOpType::Fwd: {
+    if (isConv3D()) {
+      auto convOp = builder.create<Conv3DOp>(
+          builder.getUnknownLoc(), ArrayRef<Type>{}, args, attributes);
+      block->push_front(convOp);
+      break;
+    }
+    attributes.push_back(builder.getNamedAttr(
+        Conv2DOp::getOperandSegmentSizeAttr(),
+        builder.getI32VectorAttr({1, 1, 1, hasWorkspace ? 1 : 0, 0})));
     auto convOp = builder.create<Conv2DOp>(builder.getUnknownLoc(),
                                            ArrayRef<Type>{}, args, attributes);
     block->push_front(convOp);
@@ -7,8 +7,10 @@
 //===----------------------------------------------------------------------===//
 
 #include "mlir/Dialect/MIOpen/MIOpen.h"
+#include "mlir/Dialect/MIOpen/TransformMapBuilder.h"
 
 #include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
 #include "mlir/IR/AffineMap.h"
 #include "mlir/IR/Builders.h"
 #include "mlir/IR/BuiltinAttributes.h"
@@ -34,12 +36,14 @@
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/ADT/TypeSwitch.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/MathExtras.h"
 #include "llvm/Support/SMLoc.h"
 #include <algorithm>
 #include <iterator>
+#include <mutex>
 
 using namespace mlir;
 using namespace mlir::miopen;
@@ -82,6 +86,14 @@ ArrayAttr noTransformsArray(Builder &b, size_t n) {
   return b.getArrayAttr(ret);
 }
 
+StringRef internDimensionName(StringRef name) {
+  // Leaked, as attributes may outlive static destruction
+  static auto *names = new llvm::StringSet<>();
+  static auto *mutex = new std::mutex();
+  const std::lock_guard<std::mutex> lock(*mutex);
+  return names->insert(name).first->getKey();
+}
+
 //===---------------------------------------------------------
 // TransformAttr
 //===---------------------------------------------------------
@@ -360,6 +372,43 @@ void MIOpenDialect::initialize() {
 //===----------------------------------------------------------------------===//
 // Convolution operations
 //===----------------------------------------------------------------------===//
+
+/// Verify the `xf32` attribute of a convolution or gemm, which multiplies its
+/// f32 operands with the reduced-precision xf32 XDLOPS.
+static LogicalResult verifyXf32Attribute(Operation *op, Type inType) {
+  if (!op->hasAttr("xf32"))
+    return success();
+  if (!inType.isF32())
+    return op->emitOpError("expects f32 operands for xf32");
+  auto xdlopsV2 = op->getAttrOfType<BoolAttr>("xdlopsV2");
+  if (!xdlopsV2 || !xdlopsV2.getValue())
+    return op->emitOpError("needs XDLOPS for xf32");
+  return success();
+}
+
+/// Verify the `sparse` attribute of a convolution, whose filter holds 2:4
+/// structured-sparse weights in the layout -miopen-fold-constant-weights
+/// compresses them to, and is multiplied with the sparse XDLOPS. The groups
+/// of 4 weights run along the gemm K of a forward convolution, which the
+/// Winograd, dilation phase and split-K rewrites would reorder.
+static LogicalResult verifySparseAttribute(Operation *op, Type inType) {
+  if (!op->hasAttr("sparse"))
+    return success();
+  if (!isa<Conv2DOp, Conv3DOp>(op))
+    return op->emitOpError("has sparse weights only in forward convolutions");
+  if (!(inType.isF16() || inType.isBF16() || inType.isInteger(8)) ||
+      op->hasAttr("fp8_format"))
+    return op->emitOpError("expects f16, bf16 or i8 operands for sparse "
+                           "weights");
+  auto xdlopsV2 = op->getAttrOfType<BoolAttr>("xdlopsV2");
+  if (!xdlopsV2 || !xdlopsV2.getValue())
+    return op->emitOpError("needs XDLOPS for sparse weights");
+  if (op->hasAttr("winograd_tile") || op->hasAttr("dilation_phases") ||
+      op->hasAttr("split_k"))
+    return op->emitOpError("can't reorder the gemm K of sparse weights");
+  return success();
+}
+
 template <typename T> static LogicalResult verifyConvOp(T op) {
   auto isDisjointed = [&](llvm::StringRef tensor, llvm::StringRef dim1,
                           llvm::StringRef dim2) {
@@ -379,15 +428,246 @@ template <typename T> static LogicalResult verifyConvOp(T op) {
       isDisjointed("input_layout", "hi", "wi"))
     return op.emitError("Disjointed yx or hw!");
 
+  // The channel block of a channel-blocked tensor has to evenly divide its
+  // channels
+  auto checkChannelBlock = [&](StringRef blockName, StringRef layoutName,
+                               StringRef dim,
+                               unsigned operand) -> LogicalResult {
+    auto blockAttr = op->template getAttrOfType<IntegerAttr>(blockName);
+    if (!blockAttr)
+      return success();
+    auto layout =
+        op->template getAttrOfType<ArrayAttr>(layoutName).getValue();
+    auto shape = op->getOperand(operand)
+                     .getType()
+                     .template cast<MemRefType>()
+                     .getShape();
+    int64_t block = blockAttr.getInt();
+    for (auto pair : llvm::zip(layout, shape))
+      if (std::get<0>(pair).template cast<StringAttr>().getValue() == dim &&
+          block > 0 && std::get<1>(pair) % block == 0)
+        return success();
+    return op.emitOpError(Twine(blockName) + " " + Twine(block) +
+                          " doesn't divide the channel dimension " + dim);
+  };
+  if (failed(checkChannelBlock("filter_channel_block", "filter_layout", "c",
+                               0)) ||
+      failed(checkChannelBlock("input_channel_block", "input_layout", "ci",
+                               1)) ||
+      failed(checkChannelBlock("output_channel_block", "output_layout", "ko",
+                               2)))
+    return failure();
+
+  Type inType =
+      op.input().getType().template cast<MemRefType>().getElementType();
+  if (failed(verifyXf32Attribute(op, inType)))
+    return failure();
+  return verifySparseAttribute(op, inType);
+}
+
+/// Verify the `fp8_format` and `fp8_scale` attributes of a convolution or
+/// gemm, whose i8 operands then hold 8-bit floats. Their f32 products are
+/// multiplied by `fp8_scale` and stored as f32 or f16.
+static LogicalResult verifyFp8Attributes(Operation *op, Type inType,
+                                         Type outType) {
+  auto format = op->getAttrOfType<StringAttr>("fp8_format");
+  if (!format) {
+    if (op->hasAttr("fp8_scale"))
+      return op->emitOpError("has an fp8_scale without an fp8_format");
+    return success();
+  }
+  if (!getFp8FormatForName(format.getValue()))
+    return op->emitOpError("unknown fp8_format ") << format;
+  if (!inType.isInteger(8) || !(outType.isF32() || outType.isF16()))
+    return op->emitOpError("expects fp8 operands stored as i8 and an f32 or "
+                           "f16 result");
+  if (Attribute scale = op->getAttr("fp8_scale"))
+    if (!scale.isa<FloatAttr>())
+      return op->emitOpError("expects a float fp8_scale");
+  auto xdlopsV2 = op->getAttrOfType<BoolAttr>("xdlopsV2");
+  if (!xdlopsV2 || !xdlopsV2.getValue())
+    return op->emitOpError("needs XDLOPS for fp8 operands");
   return success();
 }
 
-LogicalResult Conv2DOp::verify() { return verifyConvOp(*this); }
+LogicalResult Conv2DOp::verify() {
+  Type inType = input().getType().cast<MemRefType>().getElementType();
+  Type outType = output().getType().cast<MemRefType>().getElementType();
+  Value scales = requantScales();
+  if (!scales) {
+    if (outType.isInteger(8))
+      return emitOpError("needs requantScales to write an i8 output");
+    if (failed(verifyFp8Attributes(*this, inType, outType)))
+      return failure();
+    if ((*this)->hasAttr("fp8_format") &&
+        (workspace() || (*this)->hasAttr("split_k") ||
+         (*this)->hasAttr("winograd_tile")))
+      return emitOpError("can't scale split-K or Winograd fp8 convolutions");
+    return verifyConvOp(*this);
+  }
+
+  if ((*this)->hasAttr("fp8_format"))
+    return emitOpError("can't requantize fp8 convolutions");
+  if (!inType.isInteger(8) || !outType.isInteger(8))
+    return emitOpError("requantizes i8 convolutions into i8 outputs only");
+  if (workspace() || (*this)->hasAttr("split_k") ||
+      (*this)->hasAttr("winograd_tile"))
+    return emitOpError("can't requantize split-K or Winograd convolutions");
+
+  // One scale per output channel
+  int64_t channels = 1;
+  auto filterLayout = (*this)->getAttrOfType<ArrayAttr>("filter_layout");
+  ArrayRef<int64_t> filterShape =
+      filter().getType().cast<MemRefType>().getShape();
+  if (filterLayout)
+    for (auto pair : llvm::zip(filterLayout, filterShape)) {
+      StringRef dim = std::get<0>(pair).cast<StringAttr>().getValue();
+      if (dim == "g" || dim == "k")
+        channels *= std::get<1>(pair);
+    }
+  int64_t numScales = scales.getType().cast<MemRefType>().getNumElements();
+  if (numScales != channels)
+    return emitOpError("expects ")
+           << channels << " requantization scales, got " << numScales;
+  if (auto zeroPoint =
+          (*this)->getAttrOfType<IntegerAttr>("requant_zero_point"))
+    if (zeroPoint.getInt() < -128 || zeroPoint.getInt() > 127)
+      return emitOpError("requant_zero_point has to fit in i8");
+  return verifyConvOp(*this);
+}
+
+LogicalResult Conv3DOp::verify() {
+  auto hasSize = [&](StringRef name, size_t size) {
+    auto attr = (*this)->getAttrOfType<ArrayAttr>(name);
+    return attr && attr.size() == size;
+  };
+  if (!hasSize("padding", 6) || !hasSize("strides", 3) ||
+      !hasSize("dilations", 3))
+    return emitOpError("expects 6 padding values and 3 strides and dilations");
+  return verifyConvOp(*this);
+}
 
 LogicalResult Conv2DBwdDataOp::verify() { return verifyConvOp(*this); }
 
 LogicalResult Conv2DBwdWeightOp::verify() { return verifyConvOp(*this); }
 
+//===----------------------------------------------------------------------===//
+// GemmOp
+//===----------------------------------------------------------------------===//
+/// Verifies the operands of a gemm of fp16 by int4 weights of K x N.
+static LogicalResult verifyInt4Attributes(GemmOp op, int64_t k, int64_t n) {
+  auto groupSizeAttr = op->getAttrOfType<IntegerAttr>("int4_group_size");
+  if (!op.scales() || !groupSizeAttr)
+    return op.emitOpError("int4 weights need both scales and an ")
+           << "int4_group_size";
+  auto elementType = [](Value v) {
+    return v.getType().cast<MemRefType>().getElementType();
+  };
+  if (!elementType(op.a()).isF16() || !elementType(op.b()).isInteger(8))
+    return op.emitOpError("int4 weights multiply fp16 a by i8 b");
+  if (elementType(op.c()).isInteger(32))
+    return op.emitOpError("can't store fp16 products into i32");
+  for (StringRef name : {"fp8_format", "xf32", "sparse"})
+    if (op->hasAttr(name))
+      return op.emitOpError("int4 weights don't support ") << name;
+
+  int64_t groupSize = groupSizeAttr.getInt();
+  if (groupSize <= 0 || k % groupSize != 0)
+    return op.emitOpError("int4_group_size ")
+           << groupSize << " must divide K = " << k;
+  ArrayRef<int64_t> shape =
+      op.scales().getType().cast<MemRefType>().getShape();
+  int64_t g = op.c().getType().cast<MemRefType>().getShape()[0];
+  if (shape[0] != g || shape[1] != k / groupSize || shape[2] != n)
+    return op.emitOpError("scales must be [")
+           << g << ", " << k / groupSize << ", " << n << "]";
+  return success();
+}
+
+LogicalResult GemmOp::verify() {
+  ArrayRef<int64_t> aShape = a().getType().cast<MemRefType>().getShape(),
+                    bShape = b().getType().cast<MemRefType>().getShape(),
+                    cShape = c().getType().cast<MemRefType>().getShape();
+
+  int64_t aM = transposeA() ? aShape[2] : aShape[1];
+  int64_t aK = transposeA() ? aShape[1] : aShape[2];
+  int64_t bK = transposeB() ? bShape[2] : bShape[1];
+  int64_t bN = transposeB() ? bShape[1] : bShape[2];
+  // Packed int4 weights hold two values of K per byte.
+  if (scales())
+    bK *= 2;
+  if (aShape[0] != cShape[0] || bShape[0] != cShape[0])
+    return emitOpError("batch dimensions don't match");
+  if (aK != bK)
+    return emitOpError("K dimensions don't match");
+  if (aM != cShape[1])
+    return emitOpError("M dimensions don't match");
+  if (bN != cShape[2])
+    return emitOpError("N dimensions don't match");
+
+  Type inType = a().getType().cast<MemRefType>().getElementType();
+  Type outType = c().getType().cast<MemRefType>().getElementType();
+  if (scales() || (*this)->hasAttr("int4_group_size"))
+    return verifyInt4Attributes(*this, aK, bN);
+  if (inType != b().getType().cast<MemRefType>().getElementType())
+    return emitOpError("expects a and b to have the same element type");
+  if (failed(verifyXf32Attribute(*this, inType)))
+    return failure();
+  if ((*this)->hasAttr("fp8_format"))
+    return verifyFp8Attributes(*this, inType, outType);
+  if (inType.isInteger(8) ? !outType.isInteger(32) : outType.isInteger(32))
+    return emitOpError("can't store ")
+           << inType << " products into " << outType;
+  return success();
+}
+
+//===-----------------------------------------------------===//
+// LayerNormOp
+//===-----------------------------------------------------===//
+LogicalResult LayerNormOp::verify() {
+  auto inputType = input().getType().cast<MemRefType>();
+  if (inputType != output().getType())
+    return emitOpError("input and output types don't match");
+  int64_t n = inputType.getDimSize(1);
+  for (Value param : {scale(), bias()}) {
+    if (!param)
+      continue;
+    auto paramType = param.getType().cast<MemRefType>();
+    if (paramType.getDimSize(0) != n)
+      return emitOpError("scale and bias must have the length of the rows");
+    if (paramType.getElementType() != inputType.getElementType())
+      return emitOpError("expects all operands to have the same element type");
+  }
+  return success();
+}
+
+//===-----------------------------------------------------===//
+// TransformOp
+//===-----------------------------------------------------===//
+LogicalResult TransformOp::canonicalize(TransformOp op, PatternRewriter &b) {
+  // Fold a view of a view into one view of the underlying memref whenever
+  // their maps simplify, so that the coordinates that only existed between
+  // them are never computed.
+  SmallVector<Attribute, 4> chain(op.transforms().begin(),
+                                  op.transforms().end());
+  Value input = op.input();
+  if (auto source = input.getDefiningOp<TransformOp>()) {
+    llvm::append_range(chain, source.transforms());
+    input = source.input();
+  }
+  ArrayAttr simplified = simplifyTransformChain(b, b.getArrayAttr(chain));
+  if (simplified.getValue() == makeArrayRef(chain))
+    return failure();
+  if (simplified.empty()) {
+    if (input.getType() != op.getType())
+      return failure();
+    b.replaceOp(op, input);
+    return success();
+  }
+  b.replaceOpWithNewOp<TransformOp>(op, op.getType(), input, simplified);
+  return success();
+}
+
 //===-----------------------------------------------------===//
 // ExtractSliceOp
 //===-----------------------------------------------------===//
@@ -907,6 +1187,41 @@ LogicalResult BufferLoadOp::verify() {
   return success();
 }
 
+//===-----------------------------------------------------===//
+// BufferLoadToLdsOp
+//===-----------------------------------------------------===//
+LogicalResult BufferLoadToLdsOp::verify() {
+  auto sourceType = source().getType().cast<MemRefType>();
+  auto destType = dest().getType().cast<MemRefType>();
+  size_t nDims = sourceType.getRank();
+  for (ArrayAttr oobDims : {leftOobDims(), rightOobDims()}) {
+    for (llvm::APInt dimVal : oobDims.getAsValueRange<IntegerAttr>()) {
+      int32_t dim = dimVal.getSExtValue();
+      if (dim < 0 || static_cast<uint32_t>(dim) >= nDims)
+        return emitOpError("OOB dims must refer to one of the " +
+                           Twine(nDims) +
+                           " dimensions of the memref but got dimension " +
+                           Twine(dim));
+    }
+  }
+
+  if (coords().size() != nDims)
+    return emitOpError("Expected " + Twine(nDims) + " coordinates for load");
+  if (destCoords().size() != static_cast<size_t>(destType.getRank()))
+    return emitOpError("Expected " + Twine(destType.getRank()) +
+                       " coordinates for the LDS destination");
+  if (sourceType.getMemorySpaceAsInt() != 0)
+    return emitOpError("Source memref must live in global memory");
+  if (destType.getMemorySpaceAsInt() !=
+      gpu::GPUDialect::getWorkgroupAddressSpace())
+    return emitOpError("Destination memref must live in workgroup memory");
+  if (sourceType.getElementType() != destType.getElementType())
+    return emitOpError("Source and destination element types must match");
+  if (sourceType.getElementTypeBitWidth() > 32)
+    return emitOpError("Elements wider than a dword can't be loaded to LDS");
+  return success();
+}
+
 //===-----------------------------------------------------===//
 // BufferStoreOp
 //===-----------------------------------------------------===//
@@ -989,6 +1304,14 @@ LogicalResult ThreadwiseGemmOp::verify() {
     return emitOpError("N dimensions don't match");
   if (aShape[2] != bShape[2])
     return emitOpError("KPack dimensions don't match");
+
+  Type inType = matrixA().getType().cast<MemRefType>().getElementType();
+  Type accType = matrixC().getType().cast<MemRefType>().getElementType();
+  bool isWidening = ((inType.isF16() || inType.isBF16()) && accType.isF32()) ||
+                    (inType.isInteger(8) && accType.isInteger(32));
+  if (inType != accType && !isWidening)
+    return emitOpError("can't accumulate ")
+           << inType << " products into " << accType;
   return success();
 }
 
@@ -1040,6 +1363,44 @@ LogicalResult InWarpTransposeOp::verify() {
   return success();
 }
 
+//===-----------------------------------------------------===//
+// WarpReduceOp
+//===-----------------------------------------------------===//
+static LogicalResult verifyWaveSize(Operation *op, uint32_t waveSize) {
+  if (waveSize != 32 && waveSize != 64)
+    return op->emitOpError("wave size must be 32 or 64, not ") << waveSize;
+  return success();
+}
+
+LogicalResult WarpReduceOp::verify() {
+  return verifyWaveSize(*this, waveSize());
+}
+
+//===-----------------------------------------------------===//
+// BlockwiseReduceOp
+//===-----------------------------------------------------===//
+LogicalResult BlockwiseReduceOp::verify() {
+  if (failed(verifyWaveSize(*this, waveSize())))
+    return failure();
+  uint32_t blockSize = this->blockSize();
+  if (blockSize == 0 || blockSize % waveSize() != 0)
+    return emitOpError("block size ")
+           << blockSize << " must be a multiple of the wave size";
+
+  auto workspaceType = workspace().getType().cast<MemRefType>();
+  if (workspaceType.getMemorySpaceAsInt() !=
+      gpu::GPUDialect::getWorkgroupAddressSpace())
+    return emitOpError("workspace must live in workgroup memory");
+  if (workspaceType.getElementType() != input().getType())
+    return emitOpError("workspace and input element types must match");
+  if (workspaceType.getRank() != 1 || !workspaceType.hasStaticShape() ||
+      workspaceType.getNumElements() < blockSize / waveSize())
+    return emitOpError("workspace must be a 1-D buffer with an element for "
+                       "each of the ")
+           << blockSize / waveSize() << " waves";
+  return success();
+}
+
 //===----------------------------------------------------------------------===//
 // TableGen'd op method definitions
 //===----------------------------------------------------------------------===//
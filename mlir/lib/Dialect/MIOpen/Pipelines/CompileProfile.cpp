@@ -0,0 +1,305 @@
+//===- CompileProfile.cpp - Compile-time profile of pipelines -------------===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/MIOpen/CompileProfile.h"
+
+#include "mlir/IR/Operation.h"
+#include "mlir/IR/SymbolTable.h"
+#include "mlir/Pass/Pass.h"
+#include "mlir/Pass/PassInstrumentation.h"
+#include "mlir/Pass/PassManager.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/JSON.h"
+
+#include <algorithm>
+
+using namespace mlir;
+using namespace mlir::miopen;
+
+using Clock = std::chrono::steady_clock;
+
+static int64_t toUs(Clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+      .count();
+}
+
+static int64_t countOps(Operation *op) {
+  int64_t count = 0;
+  op->walk([&](Operation *) { ++count; });
+  return count;
+}
+
+/// Forwards the pass runs of one pass manager to the profile, under the
+/// phase it was attached as.
+class CompileProfile::Instrumentation : public PassInstrumentation {
+public:
+  Instrumentation(CompileProfile &profile, StringRef phase)
+      : profile(profile), phase(phase.str()) {}
+
+  void runBeforePass(Pass *pass, Operation *op) override {
+    profile.begin(pass, op);
+  }
+  void runAfterPass(Pass *pass, Operation *op) override {
+    profile.end(phase, pass, op, /*failed=*/false);
+  }
+  void runAfterPassFailed(Pass *pass, Operation *op) override {
+    profile.end(phase, pass, op, /*failed=*/true);
+  }
+
+private:
+  CompileProfile &profile;
+  std::string phase;
+};
+
+CompileProfile::CompileProfile() : created(Clock::now()) {}
+
+CompileProfile::~CompileProfile() = default;
+
+void CompileProfile::attach(PassManager &pm, StringRef phase) {
+  pm.addInstrumentation(std::make_unique<Instrumentation>(*this, phase));
+}
+
+unsigned CompileProfile::getThreadIndex() {
+  std::thread::id id = std::this_thread::get_id();
+  auto it = std::find(threads.begin(), threads.end(), id);
+  if (it != threads.end())
+    return it - threads.begin();
+  threads.push_back(id);
+  return threads.size() - 1;
+}
+
+void CompileProfile::begin(Pass *pass, Operation *op) {
+  // The ops are counted outside of the timed interval, and outside of the
+  // lock, as nothing else touches `op` while a pass runs on it.
+  int64_t opsBefore = countOps(op);
+  std::lock_guard<std::mutex> lock(mutex);
+  pending[{pass, op}] = Pending{Clock::now(), opsBefore};
+}
+
+void CompileProfile::end(StringRef phase, Pass *pass, Operation *op,
+                         bool failed) {
+  Clock::time_point now = Clock::now();
+
+  PassRun run;
+  run.phase = phase.str();
+  run.pass = pass->getArgument().empty() ? pass->getName().str()
+                                         : pass->getArgument().str();
+  run.opName = op->getName().getStringRef().str();
+  if (auto symbol =
+          op->getAttrOfType<StringAttr>(SymbolTable::getSymbolAttrName()))
+    run.symbol = symbol.getValue().str();
+  run.opsAfter = countOps(op);
+  run.failed = failed;
+  // The serialization passes are recognized by argument, as there is no RTTI
+  // to find a gpu::SerializeToBlobPass with. Its profile belongs to this run,
+  // as pass instances are not shared between threads.
+  StringRef argument = pass->getArgument();
+  if (!failed && (argument == "gpu-to-hsaco" || argument == "gpu-to-cubin"))
+    run.serialize =
+        static_cast<gpu::SerializeToBlobPass *>(pass)->getLastProfile();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = pending.find({pass, op});
+  if (it == pending.end())
+    return;
+  run.startUs = toUs(it->second.start - created);
+  run.durationUs = toUs(now - it->second.start);
+  run.opsBefore = it->second.opsBefore;
+  run.thread = getThreadIndex();
+  pending.erase(it);
+  runs.push_back(std::move(run));
+}
+
+std::vector<CompileProfile::PassRun> CompileProfile::getRuns() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return runs;
+}
+
+void CompileProfile::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  runs.clear();
+}
+
+Optional<CompileProfile::Format> CompileProfile::parseFormat(StringRef name) {
+  return llvm::StringSwitch<Optional<Format>>(name)
+      .Case("json", Format::JSON)
+      .Case("trace", Format::ChromeTrace)
+      .Default(llvm::None);
+}
+
+void CompileProfile::print(raw_ostream &os, Format format) const {
+  if (format == Format::JSON)
+    printJSON(os);
+  else
+    printChromeTrace(os);
+}
+
+static void
+printSerializeProfile(llvm::json::OStream &json,
+                      const gpu::SerializeToBlobPass::Profile &profile) {
+  json.attribute("translateUs", profile.translateUs);
+  json.attribute("optimizeUs", profile.optimizeUs);
+  json.attribute("codegenUs", profile.codegenUs);
+  json.attribute("serializeUs", profile.serializeUs);
+  json.attribute("isaBytes", static_cast<int64_t>(profile.isaSize));
+  json.attribute("binaryBytes", static_cast<int64_t>(profile.binarySize));
+}
+
+void CompileProfile::printJSON(raw_ostream &os) const {
+  std::vector<PassRun> passRuns = getRuns();
+
+  struct PhaseTotal {
+    int64_t startUs = INT64_MAX;
+    int64_t endUs = 0;
+    int64_t runs = 0;
+  };
+  struct PassTotal {
+    int64_t us = 0;
+    int64_t runs = 0;
+    int64_t opsBefore = 0;
+    int64_t opsAfter = 0;
+  };
+  struct KernelTotal {
+    int64_t us = 0;
+    Optional<gpu::SerializeToBlobPass::Profile> serialize;
+  };
+  llvm::MapVector<StringRef, PhaseTotal> phases;
+  llvm::MapVector<std::pair<StringRef, StringRef>, PassTotal> passes;
+  llvm::MapVector<StringRef, KernelTotal> kernels;
+  for (const PassRun &run : passRuns) {
+    PhaseTotal &phase = phases[run.phase];
+    phase.startUs = std::min(phase.startUs, run.startUs);
+    phase.endUs = std::max(phase.endUs, run.startUs + run.durationUs);
+    ++phase.runs;
+
+    PassTotal &pass = passes[{run.phase, run.pass}];
+    pass.us += run.durationUs;
+    ++pass.runs;
+    pass.opsBefore += run.opsBefore;
+    pass.opsAfter += run.opsAfter;
+
+    // Kernels are compiled one gpu.module each.
+    if (run.opName != "gpu.module")
+      continue;
+    KernelTotal &kernel = kernels[run.symbol];
+    kernel.us += run.durationUs;
+    if (run.serialize)
+      kernel.serialize = run.serialize;
+  }
+
+  llvm::json::OStream json(os, /*IndentSize=*/2);
+  json.object([&] {
+    json.attributeArray("phases", [&] {
+      for (const auto &phase : phases)
+        json.object([&] {
+          json.attribute("phase", phase.first);
+          json.attribute("us", phase.second.endUs - phase.second.startUs);
+          json.attribute("runs", phase.second.runs);
+        });
+    });
+    json.attributeArray("passes", [&] {
+      for (const auto &pass : passes)
+        json.object([&] {
+          json.attribute("phase", pass.first.first);
+          json.attribute("pass", pass.first.second);
+          json.attribute("us", pass.second.us);
+          json.attribute("runs", pass.second.runs);
+          json.attribute("opsBefore", pass.second.opsBefore);
+          json.attribute("opsAfter", pass.second.opsAfter);
+        });
+    });
+    json.attributeArray("kernels", [&] {
+      for (const auto &kernel : kernels)
+        json.object([&] {
+          json.attribute("kernel", kernel.first);
+          json.attribute("us", kernel.second.us);
+          if (kernel.second.serialize)
+            printSerializeProfile(json, *kernel.second.serialize);
+        });
+    });
+    json.attributeArray("runs", [&] {
+      for (const PassRun &run : passRuns)
+        json.object([&] {
+          json.attribute("phase", run.phase);
+          json.attribute("pass", run.pass);
+          json.attribute("op", run.opName);
+          if (!run.symbol.empty())
+            json.attribute("symbol", run.symbol);
+          json.attribute("thread", static_cast<int64_t>(run.thread));
+          json.attribute("startUs", run.startUs);
+          json.attribute("us", run.durationUs);
+          json.attribute("opsBefore", run.opsBefore);
+          json.attribute("opsAfter", run.opsAfter);
+          if (run.failed)
+            json.attribute("failed", true);
+          if (run.serialize)
+            printSerializeProfile(json, *run.serialize);
+        });
+    });
+  });
+  os << "\n";
+}
+
+void CompileProfile::printChromeTrace(raw_ostream &os) const {
+  std::vector<PassRun> passRuns = getRuns();
+
+  llvm::json::OStream json(os);
+  auto printEvent = [&](StringRef name, StringRef category, int64_t startUs,
+                        int64_t durationUs, unsigned thread,
+                        llvm::function_ref<void()> args) {
+    json.object([&] {
+      json.attribute("name", name);
+      json.attribute("cat", category);
+      json.attribute("ph", "X");
+      json.attribute("ts", startUs);
+      json.attribute("dur", durationUs);
+      json.attribute("pid", 1);
+      json.attribute("tid", static_cast<int64_t>(thread));
+      json.attributeObject("args", args);
+    });
+  };
+
+  json.object([&] {
+    json.attributeArray("traceEvents", [&] {
+      for (const PassRun &run : passRuns) {
+        printEvent(run.pass, run.phase, run.startUs, run.durationUs,
+                   run.thread, [&] {
+                     json.attribute("op", run.opName);
+                     if (!run.symbol.empty())
+                       json.attribute("symbol", run.symbol);
+                     json.attribute("opsBefore", run.opsBefore);
+                     json.attribute("opsAfter", run.opsAfter);
+                     if (run.failed)
+                       json.attribute("failed", true);
+                     if (run.serialize)
+                       printSerializeProfile(json, *run.serialize);
+                   });
+        if (!run.serialize)
+          continue;
+
+        // The steps of the serialization run back to back from its start,
+        // up to the time taken creating the target machine.
+        const gpu::SerializeToBlobPass::Profile &serialize = *run.serialize;
+        std::pair<StringRef, int64_t> steps[] = {
+            {"translate", serialize.translateUs},
+            {"optimize", serialize.optimizeUs},
+            {"codegen", serialize.codegenUs},
+            {"serialize", serialize.serializeUs}};
+        int64_t startUs = run.startUs;
+        for (const auto &step : steps) {
+          printEvent(step.first, run.phase, startUs, step.second, run.thread,
+                     [&] { json.attribute("symbol", run.symbol); });
+          startUs += step.second;
+        }
+      }
+    });
+    json.attribute("displayTimeUnit", "ms");
+  });
+  os << "\n";
+}
@@ -0,0 +1,139 @@
+//===- KernelReport.cpp - Report of the kernels compiled ------------------===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/MIOpen/KernelReport.h"
+
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
+#include "mlir/Dialect/MIOpen/utility/KernelResources.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/VCSRevision.h"
+
+using namespace mlir;
+using namespace mlir::miopen;
+
+StringRef miopen::getCompilerRevision() {
+#ifdef LLVM_REVISION
+  return LLVM_REVISION;
+#else
+  return "";
+#endif
+}
+
+namespace {
+/// What the report tells of one kernel, read from the attributes of its
+/// function or of its target.
+struct KernelEntry {
+  StringRef name;
+  StringRef arch;
+  StringRef perfConfig;
+  StringRef tuningSource;
+  StringRef convSolver;
+  int64_t blockSize = 0;
+  int64_t gridSize = 0;
+  Optional<KernelResources> resources;
+};
+} // end anonymous namespace
+
+static StringRef getString(Attribute attr) {
+  auto str = attr.dyn_cast_or_null<StringAttr>();
+  return str ? str.getValue() : StringRef();
+}
+
+static int64_t getInt(Attribute attr) {
+  auto value = attr.dyn_cast_or_null<IntegerAttr>();
+  return value ? value.getInt() : 0;
+}
+
+static void printEntry(llvm::json::OStream &json, const KernelEntry &entry) {
+  json.object([&] {
+    json.attribute("name", entry.name);
+    json.attribute("arch", entry.arch);
+    json.attribute("perf_config", entry.perfConfig);
+    json.attribute("tuning_source", entry.tuningSource);
+    json.attribute("conv_solver", entry.convSolver);
+    json.attribute("block_size", entry.blockSize);
+    json.attribute("grid_size", entry.gridSize);
+    if (!entry.resources)
+      return;
+    const KernelResources &resources = *entry.resources;
+    json.attributeObject("resources", [&] {
+      json.attribute("vgpr_count", resources.vgprCount);
+      json.attribute("agpr_count", resources.agprCount);
+      json.attribute("sgpr_count", resources.sgprCount);
+      json.attribute("lds_size", resources.ldsSize);
+      json.attribute("scratch_size", resources.scratchSize);
+      json.attribute("wave_size", resources.waveSize);
+      json.attribute("waves_per_simd", resources.wavesPerSimd);
+    });
+  });
+}
+
+void miopen::printKernelReport(ModuleOp module, raw_ostream &os) {
+  SmallVector<KernelEntry, 4> entries;
+  module.walk<WalkOrder::PreOrder>([&](Operation *op) {
+    if (auto gpuMod = dyn_cast<gpu::GPUModuleOp>(op)) {
+      if (!gpuMod->hasAttr(gpu::getDefaultGpuBinaryAnnotation()))
+        return WalkResult::skip();
+      // A binary shared from the kernel cache names its kernel differently.
+      StringRef symbol = getString(gpuMod->getAttr("miopen.kernel_symbol"));
+      gpuMod.walk([&](LLVM::LLVMFuncOp func) {
+        if (!func->hasAttr("block_size"))
+          return;
+        KernelEntry entry;
+        entry.name = symbol.empty() ? func.getName() : symbol;
+        entry.arch = getString(gpuMod->getAttr("arch"));
+        entry.perfConfig = getString(func->getAttr("perf_config"));
+        entry.tuningSource = getString(func->getAttr("tuning_source"));
+        entry.convSolver = getString(func->getAttr("conv_solver"));
+        entry.blockSize = getInt(func->getAttr("block_size"));
+        entry.gridSize = getInt(func->getAttr("grid_size"));
+        entry.resources =
+            KernelResources::fromAttr(func->getAttr(kKernelResourcesAttrName));
+        entries.push_back(entry);
+      });
+      return WalkResult::skip();
+    }
+
+    // Kernels applied to the functions they implement, see ApplyImpl.cpp.
+    auto func = dyn_cast<func::FuncOp>(op);
+    auto targets = func ? func->getAttrOfType<ArrayAttr>("targets") : nullptr;
+    if (!targets)
+      return WalkResult::advance();
+    for (auto target : targets.getAsRange<DictionaryAttr>()) {
+      if (getString(target.get("type")) != "gpu")
+        continue;
+      KernelEntry entry;
+      entry.name = getString(target.get("kernel"));
+      if (entry.name.empty())
+        entry.name = func.getName();
+      entry.arch = getString(target.get("arch"));
+      entry.perfConfig = getString(target.get("perf_config"));
+      entry.tuningSource = getString(target.get("tuning_source"));
+      entry.convSolver = getString(target.get("conv_solver"));
+      entry.blockSize = getInt(target.get("block_size"));
+      entry.gridSize = getInt(target.get("grid_size"));
+      entry.resources =
+          KernelResources::fromAttr(target.get(kKernelResourcesAttrName));
+      entries.push_back(entry);
+    }
+    return WalkResult::skip();
+  });
+
+  llvm::json::OStream json(os, /*IndentSize=*/2);
+  json.object([&] {
+    json.attribute("schema", kKernelReportSchema);
+    json.attribute("compiler", getCompilerRevision());
+    json.attributeArray("kernels", [&] {
+      for (const KernelEntry &entry : entries)
+        printEntry(json, entry);
+    });
+  });
+  os << "\n";
+}
@@ -28,7 +28,11 @@
 #include "mlir/Dialect/Arithmetic/Transforms/Passes.h"
 #include "mlir/Dialect/Async/Passes.h"
 #include "mlir/Dialect/Bufferization/Transforms/OneShotAnalysis.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
 #include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/MIOpen/Tuning/GridwiseGemmParams.h"
+#include "mlir/Dialect/MIOpen/utility/KernelResources.h"
 #include "mlir/Dialect/Tensor/Transforms/Passes.h"
 #include "mlir/IR/Builders.h"
 #include "mlir/IR/BuiltinOps.h"
@@ -44,17 +48,49 @@
 #include "mlir/Transforms/Passes.h"
 #include "llvm/Support/TargetSelect.h"
 
+#include <algorithm>
+
 using namespace mlir;
 
 //===- Consolidate the MIOpen Pipelines here ---------------------===//
 
 void miopen::buildPartitionPipeline(OpPassManager &pm,
                                     const miopen::PartitionOptions &options) {
+  if (!options.mixedPrecision.empty()) {
+    // lower the precision of convolutions and matmuls
+    /* miopen-opt --miopen-mixed-precision
+     */
+    pm.addNestedPass<func::FuncOp>(
+        miopen::createMIOpenMixedPrecisionPass(options.mixedPrecision));
+  }
+
+  // fold the transforms of constant weights, which partitioning would
+  // otherwise fuse into the kernels, and compress the sparse ones if asked to
+  /* miopen-opt --miopen-fold-constant-weights
+   */
+  pm.addNestedPass<func::FuncOp>(
+      miopen::createMIOpenFoldConstantWeightsPass(options.sparseWeights));
+
   // TOSA partitioning pass
   // make 'kernel' funcs with tosa dataflow
   /* miopen-opt --tosa-partition
    */
-  pm.addPass(tosa::createTosaPartitionPass());
+  pm.addPass(tosa::createTosaPartitionPass(options.fusePooling));
+
+  if (options.absorbHostOps) {
+    // move the small ops partitioning left outside into the kernels next to
+    // them, before merging kernels changes what is next to what
+    /* miopen-opt --miopen-absorb-host-ops
+     */
+    pm.addPass(miopen::createMIOpenAbsorbHostOpsPass());
+  }
+
+  if (options.horizontalFusion) {
+    // merge calls to independent small kernels
+    /* miopen-opt --miopen-horizontal-fusion
+     */
+    pm.addPass(miopen::createMIOpenHorizontalFusionPass());
+  }
 
   if (options.cloneToMIOpenModule) {
     // clone 'kernel' funcs into __miopen module
@@ -68,12 +104,19 @@ void miopen::buildBufferizePipeline(OpPassManager &pm,
                                     const miopen::BufferizeOptions &options) {
   bool noMIOpen = options.disableMIOpen;
 
+  // lower each of the kernels repeated blocks partition into once
+  /* miopen-opt --miopen-fold-duplicate-kernels
+   */
+  if (options.foldDuplicateKernels)
+    pm.addPass(miopen::createMIOpenFoldDuplicateKernelsPass());
+
   // TOSA conversion to miopen and/or linalg with async.launch's
   if (!noMIOpen) {
     // convert tosa.conv2d/matmul to miopen.conv2d
     /* miopen-opt --tosa-to-miopen
      */
-    pm.addNestedPass<func::FuncOp>(tosa::createTosaToMIOpenPass());
+    pm.addNestedPass<func::FuncOp>(
+        tosa::createTosaToMIOpenPass(options.fusePooling));
   }
   // use tosa conversion pipeline
   // (see mlir/lib/Conversion/TosaToLinalg/TosaToLinalgPass.cpp)
@@ -84,6 +127,12 @@ void miopen::buildBufferizePipeline(OpPassManager &pm,
    */
   pm.addNestedPass<func::FuncOp>(createLinalgElementwiseOpFusionPass());
 
+  // strength-reduce the powers with exponents fusion made constant
+  /* miopen-opt --miopen-math-simplify
+   */
+  pm.addNestedPass<func::FuncOp>(
+      miopen::createMIOpenMathSimplifyPass(options.fastMath));
+
   // make async kernel launch's
   /* miopen-opt --miopen-async-launch
    */
@@ -130,28 +179,63 @@ void miopen::buildBufferizePipeline(OpPassManager &pm,
   /* miopen-opt --miopen-copy-opt
    */
   pm.addNestedPass<func::FuncOp>(miopen::createMIOpenCopyOptPass());
+
+  // reuse intermediate buffers across kernel launches
+  /* miopen-opt --miopen-memory-plan
+   */
+  if (!noMIOpen && options.memoryPlanning)
+    pm.addNestedPass<func::FuncOp>(miopen::createMIOpenMemoryPlanPass());
+
+  // give back each folded kernel its own lowered func
+  /* miopen-opt --miopen-unfold-duplicate-kernels
+   */
+  if (options.foldDuplicateKernels)
+    pm.addPass(miopen::createMIOpenUnfoldDuplicateKernelsPass());
+}
+
+static void addTuningPasses(OpPassManager &funcPm,
+                            const miopen::KernelOptions &options) {
+  funcPm.addPass(miopen::createAffixTuningParametersPass(
+      0, 0, options.tuningFallback, options.minWavesPerSimd,
+      options.ldsStages, options.directToLds, options.ldsEpilogue,
+      options.schedHints, options.gridGroupM, options.persistent,
+      options.skipHeuristicConfigs));
+}
+
+void miopen::buildTuningPipeline(OpPassManager &pm,
+                                 const miopen::KernelOptions &options) {
+  addTuningPasses(pm.nest<func::FuncOp>(), options);
 }
 
 void miopen::buildKernelPipeline(OpPassManager &pm,
                                  const miopen::KernelOptions &options) {
+  // Everything up to the conversion to GPU works on one kernel at a time, so
+  // it all goes through a single func pipeline that the pass manager runs on
+  // the kernels of a module in parallel on the context's thread pool.
+  auto &funcPm = pm.nest<func::FuncOp>();
+
   // miopen lowering (tuning, global to block)
   /* miopen-opt --miopen-affix-params --miopen-conv-to-gemm
-   * --miopen-gridwise-gemm-to-blockwise
+   * --miopen-horizontal-dispatch --miopen-gridwise-gemm-to-blockwise
    */
-  pm.addPass(
-      miopen::createAffixTuningParametersPass(0, 0, options.tuningFallback));
-  pm.addNestedPass<func::FuncOp>(miopen::createMIOpenConvToGemmPass());
-  pm.addNestedPass<func::FuncOp>(miopen::createMIOpenGridwiseGemmToBlockwisePass());
+  addTuningPasses(funcPm, options);
+  funcPm.addPass(miopen::createMIOpenConvToGemmPass());
+  funcPm.addPass(miopen::createMIOpenHorizontalDispatchPass());
+  funcPm.addPass(miopen::createMIOpenGridwiseGemmToBlockwisePass());
 
   if (!options.enableApplicability) {
+    // spread the loops of kernels without gemms over the grid
+    /* miopen-opt --miopen-linalg-to-gpu
+     */
+    funcPm.addPass(miopen::createMIOpenLinalgToGpuPass());
     if (options.enableFusion) {
       // align linalg tiling
       /* miopen-opt --miopen-linalg-align
        * --convert-linalg-to-affine-loops
        */
       // We need a canonicalize in order to eliminate dead code
-      pm.addPass(miopen::createMIOpenLinalgAlignPass());
-      pm.addPass(createConvertLinalgToAffineLoopsPass());
+      funcPm.addPass(miopen::createMIOpenLinalgAlignPass());
+      funcPm.addPass(createConvertLinalgToAffineLoopsPass());
     }
 
     // miopen lowering (block to thread)
@@ -159,19 +243,41 @@ void miopen::buildKernelPipeline(OpPassManager &pm,
        --miopen-threadwise-gemm-lowering
           --miopen-sugar-to-loops --miopen-loops-to-cf --convert-miopen-to-gpu
      */
-    pm.addPass(miopen::createMIOpenBlockwiseGemmToThreadwisePass());
-    pm.addPass(miopen::createMIOpenThreadwiseGemmLoweringPass());
-    pm.addPass(miopen::createMIOpenSugarToLoopsPass());
-    pm.addPass(miopen::createMIOpenLoopsToCfPass());
+    funcPm.addPass(miopen::createMIOpenBlockwiseGemmToThreadwisePass());
+    funcPm.addPass(miopen::createMIOpenThreadwiseGemmLoweringPass());
+    int64_t maxUnrolledOps = options.maxUnrolledOps;
+    if (options.fastCompile &&
+        (maxUnrolledOps == 0 || maxUnrolledOps > kFastCompileMaxUnrolledOps))
+      maxUnrolledOps = kFastCompileMaxUnrolledOps;
+    funcPm.addPass(miopen::createMIOpenSugarToLoopsPass(maxUnrolledOps));
+    // drop the barriers that order no conflicting LDS or global accesses
+    /* miopen-opt --miopen-eliminate-barriers
+     */
+    if (!options.fastCompile)
+      funcPm.addPass(miopen::createMIOpenEliminateBarriersPass());
+    funcPm.addPass(miopen::createMIOpenLoopsToCfPass());
     pm.addPass(createLowerMIOpenOpsToGPUPass());
 
     // lowering linalg to cf
     /* miopen-opt --convert-linalg-to-affine-loops --lower-affine
      * --convert-scf-to-cf
      */
-    pm.addPass(createConvertLinalgToAffineLoopsPass());
-    pm.addPass(createLowerAffinePass());
-    pm.addPass(createConvertSCFToCFPass());
+    // The kernels now live in gpu.modules, which are lowered in parallel
+    // like the host functions left at the top level.
+    auto &hostPm = pm.nest<func::FuncOp>();
+    hostPm.addPass(createConvertLinalgToAffineLoopsPass());
+    hostPm.addPass(createLowerAffinePass());
+    hostPm.addPass(createConvertSCFToCFPass());
+    auto &gpuPm = pm.nest<gpu::GPUModuleOp>();
+    gpuPm.addPass(createLowerAffinePass());
+    gpuPm.addPass(createConvertSCFToCFPass());
+
+    // keep wave-uniform index math on the scalar unit, which fast builds
+    // leave to the backend
+    /* miopen-opt --miopen-uniform-values
+     */
+    if (!options.fastCompile)
+      gpuPm.addPass(miopen::createMIOpenUniformValuesPass());
   }
 }
 
@@ -183,10 +289,70 @@ void miopen::buildBackendPipeline(OpPassManager &pm,
    *   "--gpu-to-hsaco=triple=$triple chip=$chip features=$features opt-level=3"
    */
   pm.addPass(createStripDebugInfoPass());
-  pm.addPass(
-      createLowerGpuOpsToROCDLOpsPass(options.chip, options.indexBitwidth));
-  pm.addPass(createGpuSerializeToHsacoPass(options.triple, options.chip,
-                                           options.features, options.optLevel));
+
+  // Every gpu.module goes through the rest on its own, so that the kernels of
+  // a module are lowered, compiled and linked in parallel on the context's
+  // thread pool, with the ROCDL IR and LLVM module of at most one kernel per
+  // thread alive at a time.
+  auto &kernelPm = pm.nest<gpu::GPUModuleOp>();
+
+  // Kernels compiled before with the same backend configuration only get a
+  // stub compiled here; the cached binary replaces it afterwards.
+  /* miopen-opt --miopen-kernel-cache-lookup ... --miopen-kernel-cache-store
+   */
+  int32_t optLevel = options.optLevel;
+  if (options.fastCompile)
+    optLevel = std::min(optLevel, kFastCompileOptLevel);
+  std::string cacheTarget;
+  if (options.kernelCache) {
+    llvm::raw_string_ostream os(cacheTarget);
+    os << options.triple << ":" << options.chip << ":" << options.features
+       << ":O" << optLevel << ":i" << options.indexBitwidth;
+    if (options.barePtrCallConv)
+      os << ":bare";
+    os.flush();
+    kernelPm.addPass(miopen::createMIOpenKernelCacheLookupPass(
+        cacheTarget, options.kernelCacheDir));
+  }
+
+  kernelPm.addPass(createLowerGpuOpsToROCDLOpsPass(
+      options.chip, options.indexBitwidth, gpu::amd::Runtime::Unknown,
+      options.barePtrCallConv));
+  kernelPm.addPass(createGpuSerializeToHsacoPass(
+      options.triple, options.chip, options.features, optLevel));
+
+  if (options.kernelCache)
+    kernelPm.addPass(miopen::createMIOpenKernelCacheStorePass(
+        cacheTarget, options.kernelCacheDir));
+
+  // record the registers, LDS and occupancy of the final binaries
+  /* miopen-opt --miopen-kernel-resources
+   */
+  kernelPm.addPass(miopen::createMIOpenKernelResourcesPass());
+
+  // free the IR of each kernel once it is compiled, rather than holding that
+  // of all the kernels of the module until miopen-apply-impl
+  /* miopen-opt --miopen-strip-kernels
+   */
+  if (options.stripKernels)
+    kernelPm.addPass(miopen::createMIOpenStripKernelsPass());
+}
+
+bool miopen::hasHeuristicSpills(ModuleOp module) {
+  StringRef heuristic = getTuningSourceName(TuningSource::Heuristic);
+  StringRef spillFallback = getTuningSourceName(TuningSource::SpillFallback);
+  WalkResult spills = module.walk([&](LLVM::LLVMFuncOp func) {
+    auto source = func->getAttrOfType<StringAttr>("tuning_source");
+    if (!source ||
+        (source.getValue() != heuristic && source.getValue() != spillFallback))
+      return WalkResult::advance();
+    Optional<KernelResources> resources = KernelResources::fromAttr(
+        func->getAttr(kKernelResourcesAttrName));
+    if (resources && resources->scratchSize > 0)
+      return WalkResult::interrupt();
+    return WalkResult::advance();
+  });
+  return spills.wasInterrupted();
 }
 
 //===----------------------------------------------------------------------===//
@@ -25,6 +25,8 @@
 
 #include "mlir/Conversion/MIOpenPasses.h"
 #include "mlir/Conversion/SCFToControlFlow/SCFToControlFlow.h"
+#include "mlir/Conversion/VectorToLLVM/ConvertVectorToLLVM.h"
+#include "mlir/Conversion/VectorToSCF/VectorToSCF.h"
 #include "mlir/Dialect/Arithmetic/Transforms/Passes.h"
 #include "mlir/Dialect/Async/Passes.h"
 #include "mlir/Dialect/MIOpen/Passes.h"
@@ -53,13 +55,54 @@ void xmir::buildModelPipeline(OpPassManager &pm,
 
 void xmir::buildRunnerPipeline(OpPassManager &pm,
                                const xmir::RunnerOptions &options) {
+  bool parallelLoops = options.cpuOnly && options.parallelCPULoops;
+  bool optimizeLoops = options.cpuOnly && options.optimizeCPULoops;
+  // The linalg ops of the kernels CPU-only code keeps on the host
+  if (options.cpuOnly)
+    pm.addNestedPass<func::FuncOp>(createConvertLinalgToAffineLoopsPass());
+  // Block the loop nests so that the data of a tile stays in the cache
+  if (optimizeLoops)
+    pm.addNestedPass<func::FuncOp>(
+        createLoopTilingPass(uint64_t(options.cpuCacheSize) * 1024));
+  // Only the outermost parallel loops, the tile loops after tiling, so that
+  // the innermost ones are left to the vectorizer
+  if (parallelLoops) {
+    std::unique_ptr<Pass> parallelize = createAffineParallelizePass();
+    if (optimizeLoops)
+      (void)parallelize->initializeOptions("max-nested=1");
+    pm.addNestedPass<func::FuncOp>(std::move(parallelize));
+  }
+  if (optimizeLoops) {
+    int64_t vectorWidth = options.cpuVectorWidth;
+    pm.addNestedPass<func::FuncOp>(createSuperVectorizePass({vectorWidth}));
+  }
   pm.addPass(createLowerAffinePass());
+  // Split among as many tasks as the runtime has worker threads
+  if (parallelLoops)
+    pm.addPass(createAsyncParallelForPass(/*asyncDispatch=*/true,
+                                          /*numWorkerThreads=*/-1,
+                                          /*minTaskSize=*/1000));
+  if (optimizeLoops)
+    pm.addNestedPass<func::FuncOp>(createConvertVectorToSCFPass());
   pm.addPass(createConvertSCFToCFPass());
   if (!options.cpuOnly) {
     pm.addPass(createConvertAsyncToGPUPass());
     pm.addPass(createSymbolDCEPass());
+    pm.addNestedPass<func::FuncOp>(
+        miopen::createMIOpenAssignStreamsPass(options.numStreams));
+    if (options.graphCapture)
+      pm.addPass(miopen::createMIOpenGraphCapturePass());
+    // After graph capture, so that a call captures on the device it acquired
+    if (options.multiDevice)
+      pm.addPass(miopen::createMIOpenDeviceDispatchPass());
+    pm.addPass(miopen::createMIOpenStreamPriorityPass());
+    // Last, so that the context is current around everything else
+    if (options.runtimeContext)
+      pm.addPass(miopen::createMIOpenRuntimeContextPass());
   }
   pm.addNestedPass<func::FuncOp>(createConvertMathToLLVMPass());
+  if (optimizeLoops)
+    pm.addPass(createConvertVectorToLLVMPass());
   pm.addPass(createGpuToLLVMConversionPass());
   pm.addPass(createAsyncToAsyncRuntimePass());
   pm.addPass(createConvertAsyncToLLVMPass());
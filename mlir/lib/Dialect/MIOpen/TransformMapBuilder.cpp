@@ -146,39 +146,42 @@ TransformMapBuilder::TransformMapBuilder(mlir::Builder &builder,
                                          ArrayRef<StringRef> startNamesArg,
                                          ArrayRef<int64_t> startShapeArg,
                                          mlir::Location loc)
-    : b(builder), result(), loc(loc), startIndices(), startNames(),
-      startShape(), endIndices(), endNames(), endShape() {
+    : b(builder), result(), loc(loc), startNames(), startShape(),
+      endNames(), endShape() {
   assert(startNamesArg.size() == startShapeArg.size() &&
          "Start names and shape must have the same size");
-  for (auto pair : llvm::enumerate(startNamesArg)) {
-    uint32_t index = pair.index();
-    StringRef value = pair.value();
-
-    startNames.push_back(value);
-    startIndices.insert_or_assign(value, index);
-    startShape.push_back(startShapeArg[index]);
-  }
+  startNames.append(startNamesArg.begin(), startNamesArg.end());
+  startShape.append(startShapeArg.begin(), startShapeArg.end());
 }
 
 TransformMapBuilder::TransformMapBuilder(mlir::Builder &builder,
                                          ArrayRef<int64_t> startShapeArg,
                                          mlir::Location loc)
-    : b(builder), result(), loc(loc), startIndices(), startNames(),
-      startShape(), endIndices(), endNames(), endShape() {
+    : b(builder), result(), loc(loc), startNames(), startShape(),
+      endNames(), endShape() {
   for (auto pair : llvm::enumerate(startShapeArg)) {
-    uint32_t index = pair.index();
-    int64_t value = pair.value();
-
     SmallString<8> name;
-    ("dim" + Twine(index)).toVector(name);
-
+    ("dim" + Twine(pair.index())).toVector(name);
     startNames.push_back(name);
-    startIndices.insert_or_assign(startNames.back(), index);
-
-    startShape.push_back(value);
+    startShape.push_back(pair.value());
   }
 }
 
+Optional<uint32_t> TransformMapBuilder::findStart(StringRef name) const {
+  // The last of repeated names wins
+  for (uint32_t i = startNames.size(); i > 0; --i)
+    if (startNames[i - 1] == name)
+      return i - 1;
+  return llvm::None;
+}
+
+Optional<uint32_t> TransformMapBuilder::findEnd(StringRef name) const {
+  for (const auto &entry : endNames)
+    if (entry.second == name)
+      return entry.first;
+  return llvm::None;
+}
+
 TransformMapAttr TransformMapBuilder::get() {
   SmallVector<int64_t, 8> upperBounds, lowerBounds;
   extractBounds(upperBounds, lowerBounds);
@@ -215,24 +218,25 @@ SmallString<8> TransformMapBuilder::endName(uint32_t dim) {
 }
 
 uint32_t TransformMapBuilder::startIndex(StringRef name) {
-  assert(startIndices.count(name) == 1 && "Key not in starting set of names");
-  return startIndices[name];
+  Optional<uint32_t> index = findStart(name);
+  assert(index && "Key not in starting set of names");
+  return index.getValueOr(0);
 }
 
 uint32_t TransformMapBuilder::endIndex(StringRef name) {
-  assert(endIndices.count(name) == 1 &&
-         "Key has not yet been defined in the ending set of names");
-  return endIndices[name];
+  Optional<uint32_t> index = findEnd(name);
+  assert(index && "Key has not yet been defined in the ending set of names");
+  return index.getValueOr(0);
 }
 
 int64_t TransformMapBuilder::startSize(StringRef name) {
-  return startShape[startIndices[name]];
+  return startShape[startIndex(name)];
 }
 
 int64_t TransformMapBuilder::startSize(uint32_t dim) { return startShape[dim]; }
 
 int64_t TransformMapBuilder::endSize(StringRef name) {
-  return endShape[endIndices[name]];
+  return endShape[endIndex(name)];
 }
 
 uint32_t TransformMapBuilder::nStartDims() { return startShape.size(); }
@@ -245,8 +249,7 @@ void TransformMapBuilder::defineDim(StringRef name, uint32_t dim,
                                     int64_t size) {
   assert(!frozen && "It's a bug to add to a coordinate transform after "
                     "fetching the attribute");
-  bool nameInsertResult = endIndices.insert({name, dim}).second;
-  assert(nameInsertResult &&
+  assert(!findEnd(name) &&
          "Trying to redife a result name in a coordinate transformation");
   SmallString<8> nameCopy = name;
   bool dimInsertResult = endNames.insert({dim, nameCopy}).second;
@@ -376,10 +379,8 @@ TransformMapBuilder::operator=(const TransformMapBuilder &other) {
     result = other.result;
     loc = other.loc;
 
-    startIndices = other.startIndices;
     startNames = other.startNames;
     startShape = other.startShape;
-    endIndices = other.endIndices;
     endNames = other.endNames;
     endShape = other.endShape;
     frozen = other.frozen;
@@ -774,7 +775,7 @@ BottomUpTMTopDimsWrapper::toTopDims(ArrayRef<StringRef> names) {
 
 llvm::StringMap<uint32_t> mlir::miopen::expandNamesInPlace(
     ArrayRef<StringRef> original,
-    const llvm::StringMap<SmallVector<StringRef, 2>> expansion) {
+    const llvm::StringMap<SmallVector<StringRef, 2>> &expansion) {
   uint32_t offset = 0;
   llvm::StringMap<uint32_t> ret;
   for (auto pair : llvm::enumerate(original)) {
@@ -797,8 +798,440 @@ llvm::StringMap<uint32_t> mlir::miopen::expandNamesInPlace(
 
 llvm::StringMap<uint32_t> mlir::miopen::expandNamesInPlace(
     TransformMapBuilder &builder,
-    const llvm::StringMap<SmallVector<StringRef, 2>> expansion) {
+    const llvm::StringMap<SmallVector<StringRef, 2>> &expansion) {
   SmallVector<StringRef, 8> names;
   builder.getEndNames(names);
   return expandNamesInPlace(names, expansion);
 }
+
+TransformMapAttr mlir::miopen::unblockChannels(Builder &b,
+                                               ArrayRef<StringRef> lowerNames,
+                                               ArrayRef<int64_t> lowerShape,
+                                               StringRef channel,
+                                               StringRef blockName,
+                                               ArrayRef<StringRef> upperNames,
+                                               Location loc) {
+  BottomUpTMBuilder transform(b, lowerNames, lowerShape, loc);
+  for (auto pair : llvm::enumerate(upperNames)) {
+    uint32_t dim = pair.index();
+    StringRef name = pair.value();
+    if (name == channel)
+      transform.merge(name, dim, {channel, blockName});
+    else if (llvm::is_contained(lowerNames, name))
+      transform.passThrough({name}, {dim}, {name});
+    else
+      transform.addDim(name, dim, 1);
+  }
+  return transform.get();
+}
+
+/// Transform map fusion
+
+namespace {
+// The op within a transform map that reads or writes a given dimension, along
+// with that dimension's position within the op's dimension list.
+struct DimUse {
+  int64_t op = -1;
+  uint32_t pos = 0;
+};
+} // namespace
+
+// For a transform with an affine relationship between its inputs and its one
+// output, return the coefficient applied to the given input.
+static int64_t linearCoefficient(TransformAttr t, uint32_t pos) {
+  ArrayRef<int64_t> params = t.getParams();
+  if (t.getType() == TransformType::PassThrough)
+    return 1;
+  if (t.getType() == TransformType::Embed)
+    return params[pos];
+  assert(t.getType() == TransformType::Unmerge && "Not a linear transform");
+  int64_t stride = 1;
+  for (int64_t length : params.drop_front(pos + 1))
+    stride *= length;
+  return stride;
+}
+
+FailureOr<TransformMapAttr>
+mlir::miopen::fuseTransformMaps(Builder &b, TransformMapAttr upper,
+                                TransformMapAttr lower) {
+  ArrayRef<TransformAttr> upperOps = upper.getOps();
+  ArrayRef<TransformAttr> lowerOps = lower.getOps();
+  ArrayRef<int64_t> midBounds = upper.getLowerBounds();
+  if (midBounds != lower.getUpperBounds())
+    return failure();
+
+  SmallVector<DimUse, 8> producers(midBounds.size()),
+      consumers(midBounds.size());
+  for (auto pair : llvm::enumerate(upperOps))
+    for (auto dim : llvm::enumerate(pair.value().getLowerDims()))
+      producers[dim.value()] = {static_cast<int64_t>(pair.index()),
+                                static_cast<uint32_t>(dim.index())};
+  for (auto pair : llvm::enumerate(lowerOps))
+    for (auto dim : llvm::enumerate(pair.value().getUpperDims()))
+      consumers[dim.value()] = {static_cast<int64_t>(pair.index()),
+                                static_cast<uint32_t>(dim.index())};
+  if (llvm::any_of(producers, [](const DimUse &u) { return u.op < 0; }) ||
+      llvm::any_of(consumers, [](const DimUse &u) { return u.op < 0; }))
+    return failure();
+
+  auto isPassThrough = [](TransformAttr t) {
+    return t.getType() == TransformType::PassThrough;
+  };
+  auto isLinear = [](TransformAttr t) {
+    TransformType type = t.getType();
+    return type == TransformType::PassThrough ||
+           type == TransformType::Embed || type == TransformType::Unmerge;
+  };
+
+  MLIRContext *ctx = b.getContext();
+  SmallVector<TransformAttr, 8> fused;
+  SmallVector<bool, 8> upperFused(upperOps.size(), false);
+  SmallVector<uint32_t, 8> ptUpperDims, ptLowerDims;
+  SmallVector<StringRef, 8> ptUpperNames, ptLowerNames;
+
+  for (TransformAttr l : lowerOps) {
+    ArrayRef<uint32_t> mids = l.getUpperDims();
+    // PassThrough dimensions are resolved against their producers below.
+    if (isPassThrough(l))
+      continue;
+
+    // Everything this op reads is passed through from the upper space, so
+    // it only needs its inputs renamed.
+    if (llvm::all_of(mids, [&](uint32_t m) {
+          return isPassThrough(upperOps[producers[m].op]);
+        })) {
+      SmallVector<uint32_t, 4> dims;
+      SmallVector<StringRef, 4> names;
+      for (uint32_t m : mids) {
+        TransformAttr u = upperOps[producers[m].op];
+        dims.push_back(u.getUpperDims()[producers[m].pos]);
+        names.push_back(u.getUpperNames()[producers[m].pos]);
+      }
+      fused.push_back(TransformAttr::get(ctx, l.getType(), l.getParams(),
+                                         names, dims, l.getLowerNames(),
+                                         l.getLowerDims()));
+      continue;
+    }
+
+    // A merge that is immediately unmerged with the same lengths is the
+    // identity, even when the merged coordinate is out of bounds.
+    int64_t producer = producers[mids.front()].op;
+    TransformAttr u = upperOps[producer];
+    if (l.getType() == TransformType::Unmerge &&
+        (u.getType() == TransformType::Merge ||
+         u.getType() == TransformType::Unfold) &&
+        u.getLowerDims() == mids && u.getParams() == l.getParams()) {
+      fused.push_back(TransformAttr::get(
+          ctx, TransformType::PassThrough, {}, u.getUpperNames(),
+          u.getUpperDims(), l.getLowerNames(), l.getLowerDims()));
+      upperFused[producer] = true;
+      continue;
+    }
+
+    // Compositions of linear functions are linear, so fold them into one
+    // embed.
+    if (isLinear(l) && llvm::all_of(mids, [&](uint32_t m) {
+          return isLinear(upperOps[producers[m].op]);
+        })) {
+      SmallVector<uint32_t, 4> dims;
+      SmallVector<StringRef, 4> names;
+      SmallVector<int64_t, 4> coefficients;
+      for (auto pair : llvm::enumerate(mids)) {
+        int64_t outer = linearCoefficient(l, pair.index());
+        const DimUse &use = producers[pair.value()];
+        TransformAttr u = upperOps[use.op];
+        if (isPassThrough(u)) {
+          dims.push_back(u.getUpperDims()[use.pos]);
+          names.push_back(u.getUpperNames()[use.pos]);
+          coefficients.push_back(outer);
+          continue;
+        }
+        for (uint32_t i = 0, e = u.getUpperDims().size(); i < e; ++i) {
+          dims.push_back(u.getUpperDims()[i]);
+          names.push_back(u.getUpperNames()[i]);
+          coefficients.push_back(outer * linearCoefficient(u, i));
+        }
+        upperFused[use.op] = true;
+      }
+      fused.push_back(TransformAttr::get(ctx, TransformType::Embed,
+                                         coefficients, names, dims,
+                                         l.getLowerNames(), l.getLowerDims()));
+      continue;
+    }
+    return failure();
+  }
+
+  for (auto pair : llvm::enumerate(upperOps)) {
+    TransformAttr u = pair.value();
+    if (upperFused[pair.index()])
+      continue;
+    if (isPassThrough(u)) {
+      // Non-passthrough consumers have already been rewritten to read the
+      // upper dimensions directly.
+      for (auto dim : llvm::enumerate(u.getLowerDims())) {
+        TransformAttr l = lowerOps[consumers[dim.value()].op];
+        if (!isPassThrough(l))
+          continue;
+        uint32_t pos = consumers[dim.value()].pos;
+        ptUpperDims.push_back(u.getUpperDims()[dim.index()]);
+        ptUpperNames.push_back(u.getUpperNames()[dim.index()]);
+        ptLowerDims.push_back(l.getLowerDims()[pos]);
+        ptLowerNames.push_back(l.getLowerNames()[pos]);
+      }
+      continue;
+    }
+
+    // Any other op can only survive fusion if its results pass straight
+    // through the lower map.
+    SmallVector<uint32_t, 4> dims;
+    SmallVector<StringRef, 4> names;
+    for (uint32_t m : u.getLowerDims()) {
+      TransformAttr l = lowerOps[consumers[m].op];
+      if (!isPassThrough(l))
+        return failure();
+      dims.push_back(l.getLowerDims()[consumers[m].pos]);
+      names.push_back(l.getLowerNames()[consumers[m].pos]);
+    }
+    fused.push_back(TransformAttr::get(ctx, u.getType(), u.getParams(),
+                                       u.getUpperNames(), u.getUpperDims(),
+                                       names, dims));
+  }
+  if (!ptUpperDims.empty())
+    fused.insert(fused.begin(),
+                 TransformAttr::get(ctx, TransformType::PassThrough, {},
+                                    ptUpperNames, ptUpperDims, ptLowerNames,
+                                    ptLowerDims));
+
+  ArrayRef<int64_t> upperBounds = upper.getUpperBounds();
+  ArrayRef<int64_t> lowerBounds = lower.getLowerBounds();
+  AffineMapAttr map = assembleMapFor(b, fused, upperBounds, lowerBounds);
+  return TransformMapAttr::get(ctx, fused, map, upperBounds, lowerBounds);
+}
+
+static bool isLinearTransform(TransformAttr t) {
+  return t.getType() == TransformType::Embed ||
+         t.getType() == TransformType::Unmerge;
+}
+
+/// Shrink the space between `upper` and `lower`, in place. Unit dimensions
+/// that a merge produces below its outermost position are always 0, so an
+/// embed or unmerge reading them can drop them, and dimensions of a merge
+/// that one embed or unmerge reads with contiguous coefficients can be
+/// merged as one. Returns false if there is nothing to shrink.
+static bool collapseMidDims(Builder &b, TransformMapAttr &upper,
+                            TransformMapAttr &lower) {
+  ArrayRef<TransformAttr> upperOps = upper.getOps();
+  ArrayRef<TransformAttr> lowerOps = lower.getOps();
+  ArrayRef<int64_t> midBounds = upper.getLowerBounds();
+  if (midBounds != lower.getUpperBounds())
+    return false;
+  size_t nMid = midBounds.size();
+  SmallVector<DimUse, 8> consumers(nMid);
+  SmallVector<int64_t, 8> inputsLeft;
+  for (auto pair : llvm::enumerate(lowerOps)) {
+    for (auto dim : llvm::enumerate(pair.value().getUpperDims()))
+      consumers[dim.value()] = {static_cast<int64_t>(pair.index()),
+                                static_cast<uint32_t>(dim.index())};
+    inputsLeft.push_back(pair.value().getUpperDims().size());
+  }
+  if (llvm::any_of(consumers, [](const DimUse &u) { return u.op < 0; }))
+    return false;
+
+  // The first dimension of the group each dimension is collapsed into, or -1
+  // for dropped dimensions, and the length and coefficient of each group.
+  SmallVector<int64_t, 8> leader(nMid);
+  SmallVector<int64_t, 8> groupBounds(midBounds.begin(), midBounds.end());
+  SmallVector<int64_t, 8> groupCoefficients(nMid, 1);
+  for (uint32_t m = 0; m < nMid; ++m) {
+    leader[m] = m;
+    TransformAttr l = lowerOps[consumers[m].op];
+    if (isLinearTransform(l))
+      groupCoefficients[m] = linearCoefficient(l, consumers[m].pos);
+  }
+
+  bool changed = false;
+  for (TransformAttr u : upperOps) {
+    if (u.getType() != TransformType::Merge &&
+        u.getType() != TransformType::Unfold)
+      continue;
+    ArrayRef<uint32_t> mids = u.getLowerDims();
+    ArrayRef<int64_t> lengths = u.getParams();
+    int64_t prev = -1;
+    for (uint32_t i = 0, e = mids.size(); i < e; ++i) {
+      uint32_t m = mids[i];
+      const DimUse &use = consumers[m];
+      TransformAttr l = lowerOps[use.op];
+      if (!isLinearTransform(l)) {
+        prev = -1;
+        continue;
+      }
+      if (i > 0 && lengths[i] == 1 && inputsLeft[use.op] > 1) {
+        leader[m] = -1;
+        --inputsLeft[use.op];
+        changed = true;
+        continue;
+      }
+      if (prev >= 0 && consumers[prev].op == use.op &&
+          groupCoefficients[leader[prev]] ==
+              groupCoefficients[m] * lengths[i]) {
+        int64_t head = leader[prev];
+        leader[m] = head;
+        groupBounds[head] *= lengths[i];
+        groupCoefficients[head] = groupCoefficients[m];
+        --inputsLeft[use.op];
+        changed = true;
+      }
+      prev = m;
+    }
+  }
+  if (!changed)
+    return false;
+
+  SmallVector<uint32_t, 8> newIndex(nMid, 0);
+  SmallVector<int64_t, 8> newBounds;
+  for (uint32_t m = 0; m < nMid; ++m) {
+    if (leader[m] != m)
+      continue;
+    newIndex[m] = newBounds.size();
+    newBounds.push_back(groupBounds[m]);
+  }
+
+  // Collapsed dimensions are named after all their parts, on either side.
+  std::vector<std::string> upperNames(nMid), lowerNames(nMid);
+  auto addName = [&](std::vector<std::string> &names, uint32_t m,
+                     StringRef name) {
+    if (leader[m] < 0)
+      return;
+    std::string &groupName = names[leader[m]];
+    if (!groupName.empty())
+      groupName += "_";
+    groupName += name.str();
+  };
+  for (TransformAttr u : upperOps)
+    for (auto pair : llvm::zip(u.getLowerDims(), u.getLowerNames()))
+      addName(upperNames, std::get<0>(pair), std::get<1>(pair));
+  for (TransformAttr l : lowerOps)
+    for (auto pair : llvm::zip(l.getUpperDims(), l.getUpperNames()))
+      addName(lowerNames, std::get<0>(pair), std::get<1>(pair));
+
+  MLIRContext *ctx = b.getContext();
+  SmallVector<TransformAttr, 8> newUpperOps;
+  for (TransformAttr u : upperOps) {
+    TransformType type = u.getType();
+    bool isMerge =
+        type == TransformType::Merge || type == TransformType::Unfold;
+    SmallVector<int64_t, 4> params;
+    if (!isMerge)
+      params.assign(u.getParams().begin(), u.getParams().end());
+    SmallVector<uint32_t, 4> dims;
+    SmallVector<StringRef, 4> names;
+    for (uint32_t m : u.getLowerDims()) {
+      if (leader[m] != m)
+        continue;
+      dims.push_back(newIndex[m]);
+      names.push_back(upperNames[m]);
+      if (isMerge)
+        params.push_back(groupBounds[m]);
+    }
+    // A merge into one dimension is the identity.
+    if (isMerge && dims.size() == 1) {
+      type = TransformType::PassThrough;
+      params.clear();
+    }
+    newUpperOps.push_back(TransformAttr::get(ctx, type, params,
+                                             u.getUpperNames(),
+                                             u.getUpperDims(), names, dims));
+  }
+
+  SmallVector<TransformAttr, 8> newLowerOps;
+  for (TransformAttr l : lowerOps) {
+    TransformType type = l.getType();
+    SmallVector<int64_t, 4> params(l.getParams().begin(), l.getParams().end());
+    SmallVector<uint32_t, 4> dims;
+    SmallVector<StringRef, 4> names;
+    SmallVector<int64_t, 4> coefficients;
+    for (uint32_t m : l.getUpperDims()) {
+      if (leader[m] != m)
+        continue;
+      dims.push_back(newIndex[m]);
+      names.push_back(lowerNames[m]);
+      coefficients.push_back(groupCoefficients[m]);
+    }
+    if (isLinearTransform(l)) {
+      type = TransformType::Embed;
+      params = coefficients;
+      // Unmerges stay unmerges when the groups keep their strides.
+      if (l.getType() == TransformType::Unmerge) {
+        SmallVector<int64_t, 4> lengths;
+        for (uint32_t d : dims)
+          lengths.push_back(newBounds[d]);
+        int64_t stride = 1;
+        bool isUnmerge = true;
+        for (size_t i = dims.size(); i-- > 0;) {
+          isUnmerge &= coefficients[i] == stride;
+          stride *= lengths[i];
+        }
+        if (isUnmerge) {
+          type = TransformType::Unmerge;
+          params = lengths;
+        }
+      }
+    }
+    newLowerOps.push_back(TransformAttr::get(ctx, type, params, names, dims,
+                                             l.getLowerNames(),
+                                             l.getLowerDims()));
+  }
+
+  ArrayRef<int64_t> upperBounds = upper.getUpperBounds();
+  ArrayRef<int64_t> lowerBounds = lower.getLowerBounds();
+  TransformMapAttr newUpper = TransformMapAttr::get(
+      ctx, newUpperOps,
+      assembleMapFor(b, newUpperOps, upperBounds, newBounds), upperBounds,
+      newBounds);
+  TransformMapAttr newLower = TransformMapAttr::get(
+      ctx, newLowerOps,
+      assembleMapFor(b, newLowerOps, newBounds, lowerBounds), newBounds,
+      lowerBounds);
+  upper = newUpper;
+  lower = newLower;
+  return true;
+}
+
+static bool isIdentityTransformMap(TransformMapAttr map) {
+  return map.getUpperBounds() == map.getLowerBounds() &&
+         llvm::all_of(map.getOps(), [](TransformAttr t) {
+           return t.getType() == TransformType::PassThrough &&
+                  t.getUpperDims() == t.getLowerDims();
+         });
+}
+
+ArrayAttr mlir::miopen::simplifyTransformChain(Builder &b,
+                                               ArrayAttr transforms) {
+  SmallVector<Attribute, 4> result;
+  for (auto t : transforms.getAsRange<TransformMapAttr>()) {
+    if (isIdentityTransformMap(t))
+      continue;
+    if (!result.empty()) {
+      auto last = result.back().cast<TransformMapAttr>();
+      if (collapseMidDims(b, last, t)) {
+        if (isIdentityTransformMap(last))
+          result.pop_back();
+        else
+          result.back() = last;
+      }
+    }
+    if (!result.empty()) {
+      FailureOr<TransformMapAttr> fused = fuseTransformMaps(
+          b, result.back().cast<TransformMapAttr>(), t);
+      if (succeeded(fused)) {
+        if (isIdentityTransformMap(*fused))
+          result.pop_back();
+        else
+          result.back() = *fused;
+        continue;
+      }
+    }
+    result.push_back(t);
+  }
+  return b.getArrayAttr(result);
+}
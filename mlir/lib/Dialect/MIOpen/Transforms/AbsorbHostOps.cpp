@@ -0,0 +1,274 @@
+//===- AbsorbHostOps.cpp --------------------------------------------------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// tosa-partition only fuses the ops around an anchor that save enough memory
+// traffic and fit its budget, and leaves the rest in the host function, where
+// each becomes a launch of its own or runs on the host between two kernels.
+// For small ops the launch costs more than the traffic, so this pass moves
+// each one into the kernel call next to it:
+//
+// - into the prologue of the only call using its results, the op's operands
+//   taking the place of its results among the call's operands;
+// - else into the epilogue of the call producing one of its operands, its
+//   results becoming more results of the call.
+//
+// A kernel that other calls share is first cloned for the call, which
+// miopen-fold-duplicate-kernels folds back if every call absorbs the same ops.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/Tosa/IR/TosaOps.h"
+#include "mlir/Dialect/Tosa/Transforms/Passes.h"
+#include "mlir/IR/BlockAndValueMapping.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/Dominance.h"
+#include "mlir/IR/SymbolTable.h"
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "miopen-absorb-host-ops"
+
+using namespace mlir;
+
+namespace {
+
+struct MIOpenAbsorbHostOpsPass
+    : public MIOpenAbsorbHostOpsPassBase<MIOpenAbsorbHostOpsPass> {
+  void runOnOperation() override;
+
+private:
+  bool isSmallOp(Operation *op);
+  func::FuncOp getKernel(func::CallOp call, bool epilogue);
+  func::FuncOp getPrivateKernel(func::CallOp call);
+  void mapOperands(Operation *op, func::FuncOp kernel, OpBuilder &b,
+                   BlockAndValueMapping &map,
+                   SmallVectorImpl<Value> &operands);
+  bool absorbIntoPrologue(Operation *op);
+  bool absorbIntoEpilogue(Operation *op, DominanceInfo &dom);
+
+  SymbolTable *symbols = nullptr;
+};
+
+} // end anonymous namespace
+
+// Whether `op` is one of the ops tosa-partition fuses into kernels and
+// produces few enough elements for its launch to outweigh its work.
+bool MIOpenAbsorbHostOpsPass::isSmallOp(Operation *op) {
+  if (!tosa::isFuseableOp(op) || op->getNumRegions() != 0 ||
+      op->getNumResults() == 0)
+    return false;
+  return llvm::all_of(op->getResultTypes(), [&](Type type) {
+    auto shaped = type.dyn_cast<RankedTensorType>();
+    return shaped && shaped.hasStaticShape() &&
+           shaped.getNumElements() <= maxElements;
+  });
+}
+
+// The kernel `call` calls, if it can take more ops in its prologue, or in its
+// epilogue when `epilogue` is set. Standalone kernels take neither, and
+// nothing can follow a fused pooling.
+func::FuncOp MIOpenAbsorbHostOpsPass::getKernel(func::CallOp call,
+                                                bool epilogue) {
+  if (!call)
+    return {};
+  auto kernel = symbols->lookup<func::FuncOp>(call.getCallee());
+  if (!kernel || !kernel->hasAttr("kernel") || kernel.isExternal() ||
+      !llvm::hasSingleElement(kernel.getBody()))
+    return {};
+  for (Operation &op : kernel.getBody().front()) {
+    if (tosa::isStandaloneKernelOp(&op) ||
+        (epilogue && tosa::isNonOverlappingAvgPool(&op)))
+      return {};
+  }
+  return kernel;
+}
+
+// The kernel of `call`, cloned under a new name if other calls share it.
+func::FuncOp MIOpenAbsorbHostOpsPass::getPrivateKernel(func::CallOp call) {
+  auto kernel = symbols->lookup<func::FuncOp>(call.getCallee());
+  Optional<SymbolTable::UseRange> uses =
+      SymbolTable::getSymbolUses(kernel, getOperation());
+  if (uses && llvm::hasSingleElement(*uses))
+    return kernel;
+  auto copy = cast<func::FuncOp>(kernel->clone());
+  symbols->insert(copy, Block::iterator(kernel));
+  call.setCalleeAttr(FlatSymbolRefAttr::get(copy.getNameAttr()));
+  return copy;
+}
+
+// Maps the operands of `op` into `kernel`, whose call passes it `operands`:
+// constants are cloned with `b`, values already in `operands` map to their
+// arguments, and the others to new arguments, appended to `operands`.
+void MIOpenAbsorbHostOpsPass::mapOperands(Operation *op, func::FuncOp kernel,
+                                          OpBuilder &b,
+                                          BlockAndValueMapping &map,
+                                          SmallVectorImpl<Value> &operands) {
+  Block &body = kernel.getBody().front();
+  auto readAccess = b.getDictionaryAttr(b.getNamedAttr(
+      func::FuncOp::getReadAccessAttrName(), b.getUnitAttr()));
+  for (Value operand : op->getOperands()) {
+    if (map.contains(operand))
+      continue;
+    Operation *definingOp = operand.getDefiningOp();
+    if (definingOp && mlir::detail::isConstantLike(definingOp)) {
+      map.map(operand, b.clone(*definingOp)->getResult(0));
+      continue;
+    }
+    auto it = llvm::find(operands, operand);
+    if (it != operands.end()) {
+      map.map(operand, body.getArgument(it - operands.begin()));
+      continue;
+    }
+    kernel.insertArgument(body.getNumArguments(), operand.getType(),
+                          readAccess, op->getLoc());
+    map.map(operand, body.getArguments().back());
+    operands.push_back(operand);
+  }
+}
+
+bool MIOpenAbsorbHostOpsPass::absorbIntoPrologue(Operation *op) {
+  auto call = dyn_cast<func::CallOp>(*op->user_begin());
+  if (!call || call->getBlock() != op->getBlock() ||
+      llvm::any_of(op->getUsers(),
+                   [&](Operation *user) { return user != call; }) ||
+      !getKernel(call, /*epilogue=*/false))
+    return false;
+
+  func::FuncOp kernel = getPrivateKernel(call);
+  LLVM_DEBUG(llvm::dbgs() << "Absorbing " << op->getName()
+                          << " into the prologue of " << kernel.getName()
+                          << "\n");
+  Block &body = kernel.getBody().front();
+  OpBuilder b = OpBuilder::atBlockBegin(&body);
+  BlockAndValueMapping map;
+  SmallVector<Value, 8> operands(call.getOperands());
+  mapOperands(op, kernel, b, map, operands);
+  Operation *clone = b.clone(*op, map);
+
+  // The arguments the op fed now take its clone's results instead.
+  llvm::BitVector erased(body.getNumArguments());
+  for (OpOperand &operand : call->getOpOperands()) {
+    auto result = operand.get().dyn_cast<OpResult>();
+    if (!result || result.getOwner() != op)
+      continue;
+    unsigned index = operand.getOperandNumber();
+    body.getArgument(index).replaceAllUsesWith(
+        clone->getResult(result.getResultNumber()));
+    erased.set(index);
+  }
+  kernel.eraseArguments(erased);
+  SmallVector<Value, 8> remaining;
+  for (auto &en : llvm::enumerate(operands))
+    if (!erased.test(en.index()))
+      remaining.push_back(en.value());
+  call->setOperands(remaining);
+  op->erase();
+  return true;
+}
+
+bool MIOpenAbsorbHostOpsPass::absorbIntoEpilogue(Operation *op,
+                                                 DominanceInfo &dom) {
+  func::CallOp call;
+  for (Value operand : op->getOperands()) {
+    auto producer = operand.getDefiningOp<func::CallOp>();
+    if (producer && producer->getBlock() == op->getBlock() &&
+        getKernel(producer, /*epilogue=*/true)) {
+      call = producer;
+      break;
+    }
+  }
+  // The call must be able to take the op's other operands.
+  if (!call || llvm::any_of(op->getOperands(), [&](Value operand) {
+        Operation *definingOp = operand.getDefiningOp();
+        return definingOp != call &&
+               !(definingOp && mlir::detail::isConstantLike(definingOp)) &&
+               !dom.properlyDominates(operand, call);
+      }))
+    return false;
+
+  func::FuncOp kernel = getPrivateKernel(call);
+  LLVM_DEBUG(llvm::dbgs() << "Absorbing " << op->getName()
+                          << " into the epilogue of " << kernel.getName()
+                          << "\n");
+  Block &body = kernel.getBody().front();
+  Operation *ret = body.getTerminator();
+  OpBuilder b(ret);
+  BlockAndValueMapping map;
+  for (OpResult result : call->getResults())
+    map.map(result, ret->getOperand(result.getResultNumber()));
+  SmallVector<Value, 8> operands(call.getOperands());
+  mapOperands(op, kernel, b, map, operands);
+  Operation *clone = b.clone(*op, map);
+
+  auto writeAccess = b.getDictionaryAttr(b.getNamedAttr(
+      func::FuncOp::getWriteAccessAttrName(), b.getUnitAttr()));
+  for (Value result : clone->getResults()) {
+    kernel.insertResult(ret->getNumOperands(), result.getType(), writeAccess);
+    ret->insertOperands(ret->getNumOperands(), result);
+  }
+
+  b.setInsertionPoint(call);
+  auto newCall = b.create<func::CallOp>(call.getLoc(), kernel, operands);
+  unsigned numResults = call.getNumResults();
+  call->replaceAllUsesWith(newCall.getResults().take_front(numResults));
+  op->replaceAllUsesWith(newCall.getResults().drop_front(numResults));
+  op->erase();
+  call.erase();
+  return true;
+}
+
+void MIOpenAbsorbHostOpsPass::runOnOperation() {
+  ModuleOp mod = getOperation();
+  SymbolTable symbolTable(mod);
+  symbols = &symbolTable;
+
+  SmallVector<func::FuncOp, 4> hostFuncs;
+  for (auto func : mod.getOps<func::FuncOp>())
+    if (!func->hasAttr("kernel") && !func.isExternal())
+      hostFuncs.push_back(func);
+
+  for (func::FuncOp func : hostFuncs) {
+    DominanceInfo dom(func);
+    // Absorbing an op can make its neighbours adjacent to a call, so repeat
+    // until nothing moves. Every round empties the host of at least one op.
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      SmallVector<Operation *, 16> ops;
+      func.walk([&](Operation *op) {
+        if (isSmallOp(op) && !op->use_empty())
+          ops.push_back(op);
+      });
+      for (Operation *op : ops)
+        if (absorbIntoPrologue(op) || absorbIntoEpilogue(op, dom))
+          changed = true;
+    }
+  }
+}
+
+//===- Passes -------------------------------------------------------------===//
+//
+
+std::unique_ptr<Pass> mlir::miopen::createMIOpenAbsorbHostOpsPass() {
+  return std::make_unique<MIOpenAbsorbHostOpsPass>();
+}
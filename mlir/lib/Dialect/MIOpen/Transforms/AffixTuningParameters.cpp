@@ -3,9 +3,11 @@
 #include "mlir/Dialect/MIOpen/MIOpen.h"
 #include "mlir/Dialect/MIOpen/Passes.h"
 #include "mlir/Dialect/MIOpen/Tuning/ConvContext.h"
+#include "mlir/Dialect/MIOpen/Tuning/ConvSolvers.h"
 #include "mlir/Dialect/MIOpen/Tuning/GemmContext.h"
 #include "mlir/Dialect/MIOpen/Tuning/GridwiseGemmParams.h"
 #include "mlir/Dialect/MIOpen/Tuning/UtilityParams.h"
+#include "mlir/Dialect/MIOpen/XdlopsCodeSelection.h"
 #include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
 #include "mlir/Dialect/MIOpen/utility/math.h"
 #include "mlir/IR/BuiltinOps.h"
@@ -15,6 +17,8 @@
 
 #include "llvm/Support/raw_ostream.h"
 
+#include <sstream>
+
 using namespace mlir;
 using namespace mlir::miopen;
 
@@ -23,10 +27,17 @@ struct AffixTuningParameters
     : public MIOpenOpsAffixTuningParametersPassBase<AffixTuningParameters> {
 public:
   AffixTuningParameters(int64_t blockSizeOverride, int64_t gridSizeOverride,
-                        bool fallBackNoConfig)
+                        bool fallBackNoConfig, int64_t minWavesPerSimd,
+                        int64_t ldsStages, bool directToLds,
+                        bool ldsEpilogue, int64_t schedHints,
+                        int64_t gridGroupM, bool persistent,
+                        int64_t skipHeuristicConfigs)
       : blockSizeOverride(blockSizeOverride),
-        gridSizeOverride(gridSizeOverride), fallBackNoConfig(fallBackNoConfig) {
-  }
+        gridSizeOverride(gridSizeOverride), fallBackNoConfig(fallBackNoConfig),
+        minWavesPerSimd(minWavesPerSimd), ldsStages(ldsStages),
+        directToLds(directToLds), ldsEpilogue(ldsEpilogue),
+        schedHints(schedHints), gridGroupM(gridGroupM), persistent(persistent),
+        skipHeuristicConfigs(skipHeuristicConfigs) {}
   void runOnOperation() override;
 
 private:
@@ -44,83 +55,170 @@ private:
   int64_t blockSizeOverride;
   int64_t gridSizeOverride;
   bool fallBackNoConfig;
+  // XDLOPS configurations estimated to spill, or to leave fewer waves per
+  // SIMD than this, are rejected, whether they come from perf_config, the
+  // perf db or the heuristics.
+  int64_t minWavesPerSimd;
+  // LDS buffers the XDLOPS main loop is pipelined over. Configurations whose
+  // block tiles do not fit that many times in LDS are rejected.
+  int64_t ldsStages;
+  // Let the XDLOPS gridwise gemm load its A and B tiles straight into LDS
+  // where the copy layout allows it.
+  bool directToLds;
+  // Let the XDLOPS gridwise gemm transpose its C tile through LDS before
+  // writing it out.
+  bool ldsEpilogue;
+  // The scheduling hints the XDLOPS gridwise gemm gives its main loop, a mask
+  // of the SchedHints bits.
+  int64_t schedHints;
+  // M blocks per band of the raster order of the gridwise gemm workgroups, 1
+  // for the row-major one, or 0 to let the lowering pick it.
+  int64_t gridGroupM;
+  // Launch the XDLOPS gridwise gemm with the workgroups that fit on the GPU
+  // at once, when there are fewer of them than tiles, and let each loop over
+  // the tiles.
+  bool persistent;
+  // The best XDLOPS default configurations to pass over, after they spilled
+  // to scratch in an earlier build of the same kernel.
+  int64_t skipHeuristicConfigs;
+
+  // The convolution context of `op`, shared with the later passes.
+  const ConvolutionContext &getConvContext(Operation *op) {
+    return getChildAnalysis<ConvolutionContextAnalysis>(op).getContext();
+  }
+  ConvolutionDims obtainConvDims(Operation *op) {
+    return getConvContext(op).getConvDims();
+  }
+
+  // Record the solver `op` is lowered with, as its attributes select it, on
+  // the op and on the kernel, next to its tuning_source.
+  void affixConvSolver(Operation *op, ConvSolver solver) {
+    StringAttr solverAttr =
+        StringAttr::get(op->getContext(), getNameForConvSolver(solver));
+    op->setAttr(kConvSolverAttrName, solverAttr);
+    getOperation()->setAttr(kConvSolverAttrName, solverAttr);
+  }
 
   // Actual implementation.
   template <typename T> void affixTuningParametersImpl(T &op);
 
+  void affixForwardUtilityKernels(Conv2DOp &op);
+  void affixDirectGroupedConv(Conv2DOp &op);
+  void affixWinogradConv(Conv2DOp &op);
+  void affixLayerNorm(LayerNormOp &op);
+  void affixSkinnyGemm(GemmOp &op);
   void affixBackwardWeightUtilityKernels(Conv2DBwdWeightOp &op);
-  void affixBackwardDataUtilityKernels(Conv2DBwdDataOp &op);
+  void alignFusedBlockSizes();
 };
 } // anonymous namespace
 
-static ConvolutionDims obtainConvDims(Operation *op) {
-  auto filterLayoutAttr = op->getAttrOfType<ArrayAttr>("filter_layout");
-  auto inputLayoutAttr = op->getAttrOfType<ArrayAttr>("input_layout");
-  auto outputLayoutAttr =
-      op->template getAttrOfType<ArrayAttr>("output_layout");
-
-  // Get shape of filter tensor.
-  auto filterType = op->getOperand(0).getType().template cast<MemRefType>();
-  ArrayRef<int64_t> filterShape = filterType.getShape();
-
-  // Get shape of input tensor.
-  auto inputType = op->getOperand(1).getType().template cast<MemRefType>();
-  ArrayRef<int64_t> inputShape = inputType.getShape();
-
-  // Get shape of output tensor.
-  auto outputType = op->getOperand(2).getType().template cast<MemRefType>();
-  ArrayRef<int64_t> outputShape = outputType.getShape();
-
-  int64_t y, x, ho, wo, hi, wi, k, c, n, g;
-  y = x = ho = wo = hi = wi = k = c = n = g = 0;
-
-  for (unsigned i = 0; i < filterLayoutAttr.size(); ++i) {
-    auto filterAttr = filterLayoutAttr.getValue()[i].cast<StringAttr>();
-    auto inputAttr = inputLayoutAttr.getValue()[i].cast<StringAttr>();
-    auto outputAttr = outputLayoutAttr.getValue()[i].cast<StringAttr>();
-
-    if (filterAttr.getValue() == "y") {
-      y = filterShape[i];
-    } else if (filterAttr.getValue() == "x") {
-      x = filterShape[i];
-    } else if (filterAttr.getValue() == "k") {
-      k = filterShape[i];
-    } else if (filterAttr.getValue() == "c") {
-      c = filterShape[i];
-    } else if (filterAttr.getValue() == "g") {
-      g = filterShape[i];
-    }
-
-    if (inputAttr.getValue() == "hi") {
-      hi = inputShape[i];
-    } else if (inputAttr.getValue() == "wi") {
-      wi = inputShape[i];
-    } else if (inputAttr.getValue() == "ni") {
-      n = inputShape[i];
-    }
-
-    if (outputAttr.getValue() == "ho") {
-      ho = outputShape[i];
-    } else if (outputAttr.getValue() == "wo") {
-      wo = outputShape[i];
-    }
-  }
-
-  return ConvolutionDims(y, x, ho, wo, hi, wi, k, c, n, g);
-}
-
 void AffixTuningParameters::runOnOperation() {
   func::FuncOp func = getOperation();
+  if (ldsStages < 1) {
+    func.emitError("lds-stages must be at least 1");
+    return signalPassFailure();
+  }
+  if (schedHints < 0 || schedHints > kSchedHintsAll) {
+    func.emitError("sched-hints must be between 0 and ") << kSchedHintsAll;
+    return signalPassFailure();
+  }
+  if (gridGroupM < 0) {
+    func.emitError("grid-group-m must not be negative");
+    return signalPassFailure();
+  }
 
-  func.walk([&](Conv2DOp op) { affixTuningParametersImpl(op); });
+  // Resolve the perf db records of every convolution up front so the
+  // per-op searches below do not each issue their own query.
+  SmallVector<Operation *, 4> convOps;
+  func.walk([&](Operation *op) {
+    if (isa<Conv2DOp, Conv3DOp, Conv2DBwdDataOp, Conv2DBwdWeightOp, GemmOp>(
+            op))
+      convOps.push_back(op);
+  });
+  preloadTuningParameters(
+      convOps, [&](Operation *op) -> const ConvolutionContext & {
+        return getConvContext(op);
+      });
+
+  func.walk([&](Conv2DOp op) {
+    if (op->hasAttr("winograd_tile")) {
+      affixConvSolver(op, ConvSolver::Winograd);
+      affixWinogradConv(op);
+      return;
+    }
+    if (usesDirectGroupedConv(op, obtainConvDims(op))) {
+      affixConvSolver(op, ConvSolver::DirectGrouped);
+      affixDirectGroupedConv(op);
+      return;
+    }
+    if (op->hasAttr("split_k"))
+      affixConvSolver(op, ConvSolver::SplitK);
+    else if (op->hasAttr("dilation_phases"))
+      affixConvSolver(op, ConvSolver::DilationPhases);
+    else
+      affixConvSolver(op, ConvSolver::ImplicitGemm);
+    affixTuningParametersImpl(op);
+    affixForwardUtilityKernels(op);
+  });
+  func.walk([&](Conv3DOp op) {
+    affixConvSolver(op, ConvSolver::ImplicitGemm);
+    affixTuningParametersImpl(op);
+  });
+  func.walk([&](GemmOp op) {
+    if (usesSkinnyGemm(op)) {
+      affixConvSolver(op, ConvSolver::SkinnyGemm);
+      affixSkinnyGemm(op);
+      return;
+    }
+    affixConvSolver(op, ConvSolver::ImplicitGemm);
+    affixTuningParametersImpl(op);
+  });
+  func.walk([&](LayerNormOp op) { affixLayerNorm(op); });
   func.walk([&](Conv2DBwdDataOp op) {
+    affixConvSolver(op, ConvSolver::ImplicitGemm);
     affixTuningParametersImpl(op);
-    affixBackwardDataUtilityKernels(op);
   });
   func.walk([&](Conv2DBwdWeightOp op) {
+    affixConvSolver(op, ConvSolver::ImplicitGemm);
     affixTuningParametersImpl(op);
     affixBackwardWeightUtilityKernels(op);
   });
+  alignFusedBlockSizes();
+
+  // Only tuning attributes were added, which the contexts don't read.
+  markAnalysesPreserved<ConvolutionContextAnalysis>();
+}
+
+void AffixTuningParameters::alignFusedBlockSizes() {
+  // The gemms of a horizontally fused kernel all run with the kernel's block
+  // size. Retune those that chose another one with the first one's forced.
+  SmallVector<Operation *, 4> gemmOps;
+  getOperation().walk([&](Operation *op) {
+    if (auto conv = dyn_cast<Conv2DOp>(op)) {
+      if (!op->hasAttr("winograd_tile") && !op->hasAttr("split_k") &&
+          !usesDirectGroupedConv(conv, obtainConvDims(conv)))
+        gemmOps.push_back(op);
+    } else if (isa<GemmOp>(op) && !usesSkinnyGemm(op)) {
+      gemmOps.push_back(op);
+    }
+  });
+  if (gemmOps.size() < 2 || blockSizeOverride != 0)
+    return;
+
+  auto getBlockSize = [](Operation *op) {
+    return op->getAttrOfType<IntegerAttr>("block_size").getInt();
+  };
+  int64_t commonBlockSize = getBlockSize(gemmOps.front());
+  blockSizeOverride = commonBlockSize;
+  for (Operation *op : llvm::drop_begin(gemmOps)) {
+    if (getBlockSize(op) == commonBlockSize)
+      continue;
+    if (auto conv = dyn_cast<Conv2DOp>(op))
+      affixTuningParametersImpl(conv);
+    else if (auto gemm = dyn_cast<GemmOp>(op))
+      affixTuningParametersImpl(gemm);
+  }
+  blockSizeOverride = 0;
 }
 
 static void setUtilityKernelSizes(OpBuilder &b, Value arg, Operation *convOp,
@@ -138,24 +236,116 @@ static void setUtilityKernelSizes(OpBuilder &b, Value arg, Operation *convOp,
   }
 }
 
-void AffixTuningParameters::affixBackwardDataUtilityKernels(
-    Conv2DBwdDataOp &op) {
-  auto gemmIdAttr = op->template getAttrOfType<IntegerAttr>("gemm_id");
-
-  // In case the gemm ID is -1, override grid_size and block_size for the
-  // utility kernel.
-  if (gemmIdAttr.getInt() < 0) {
+void AffixTuningParameters::affixForwardUtilityKernels(Conv2DOp &op) {
+  // Only split-K forward convolutions have utility kernels: gemm ID 0
+  // zero-initializes the output or workspace and gemm ID 2 converts the
+  // workspace to the output.
+  if (!op->hasAttr("split_k"))
+    return;
+  int64_t gemmId = op->getAttrOfType<IntegerAttr>("gemm_id").getInt();
+  assert((gemmId >= 0) && (gemmId < 3));
+  if (gemmId != 1) {
     OpBuilder b(op.getContext());
-    setUtilityKernelSizes(b, op.input(), op, getOperation());
+    setUtilityKernelSizes(b, op.output(), op, getOperation());
   }
 }
 
+void AffixTuningParameters::affixDirectGroupedConv(Conv2DOp &op) {
+  ConvolutionDims dims = obtainConvDims(op);
+  // Each workitem computes kDirectConvWoPerThread output pixels of one row of
+  // one output channel.
+  int64_t blockSize = blockSizeOverride ? blockSizeOverride
+                                        : kDirectConvBlockSize;
+  int64_t numThreads =
+      dims.g * dims.n * dims.k * dims.ho *
+      math_util::integer_divide_ceil(dims.wo, kDirectConvWoPerThread);
+  int64_t gridSize = math_util::integer_divide_ceil(numThreads, blockSize);
+
+  OpBuilder b(op.getContext());
+  op->setAttr("block_size", b.getI32IntegerAttr(blockSize));
+  getOperation()->setAttr("block_size", b.getI32IntegerAttr(blockSize));
+  getOperation()->setAttr(
+      "grid_size",
+      b.getI32IntegerAttr(gridSizeOverride ? gridSizeOverride : gridSize));
+}
+
+void AffixTuningParameters::affixWinogradConv(Conv2DOp &op) {
+  ConvolutionDims dims = obtainConvDims(op);
+  int64_t tile = op->getAttrOfType<IntegerAttr>("winograd_tile").getInt();
+  int64_t gemmId = op->getAttrOfType<IntegerAttr>("gemm_id").getInt();
+  // Kernel 0 has a workitem per filter tile to transform. Kernel 1 has one
+  // per output tile of each output channel.
+  int64_t numThreads = dims.g * dims.k * dims.c;
+  if (gemmId != 0)
+    numThreads = dims.g * dims.n * dims.k *
+                 math_util::integer_divide_ceil(dims.ho, tile) *
+                 math_util::integer_divide_ceil(dims.wo, tile);
+  int64_t blockSize = blockSizeOverride ? blockSizeOverride
+                                        : kWinogradBlockSize;
+  int64_t gridSize = math_util::integer_divide_ceil(numThreads, blockSize);
+
+  OpBuilder b(op.getContext());
+  op->setAttr("block_size", b.getI32IntegerAttr(blockSize));
+  getOperation()->setAttr("block_size", b.getI32IntegerAttr(blockSize));
+  getOperation()->setAttr(
+      "grid_size",
+      b.getI32IntegerAttr(gridSizeOverride ? gridSizeOverride : gridSize));
+}
+
+void AffixTuningParameters::affixLayerNorm(LayerNormOp &op) {
+  // Each workgroup normalizes one row, and its reductions take a block size
+  // of a power of 2, so the overrides don't apply.
+  int64_t gridSize =
+      op.output().getType().cast<MemRefType>().getDimSize(0);
+
+  OpBuilder b(op.getContext());
+  op->setAttr("block_size", b.getI32IntegerAttr(kLayerNormBlockSize));
+  getOperation()->setAttr("block_size",
+                          b.getI32IntegerAttr(kLayerNormBlockSize));
+  getOperation()->setAttr("grid_size", b.getI32IntegerAttr(gridSize));
+}
+
+void AffixTuningParameters::affixSkinnyGemm(GemmOp &op) {
+  // Each wave computes one row of the long side of the output.
+  ArrayRef<int64_t> shape = op.c().getType().cast<MemRefType>().getShape();
+  int64_t blockSize = blockSizeOverride ? blockSizeOverride
+                                        : kSkinnyGemmBlockSize;
+  int64_t waveSize = XdlopsCodeSelection::getWaveSize(
+      op->getAttrOfType<StringAttr>("arch").getValue());
+  int64_t rowsPerBlock = std::max<int64_t>(1, blockSize / waveSize);
+  int64_t gridSize =
+      shape[0] * math_util::integer_divide_ceil(std::max(shape[1], shape[2]),
+                                                rowsPerBlock);
+
+  OpBuilder b(op.getContext());
+  op->setAttr("block_size", b.getI32IntegerAttr(blockSize));
+  getOperation()->setAttr("block_size", b.getI32IntegerAttr(blockSize));
+  getOperation()->setAttr(
+      "grid_size",
+      b.getI32IntegerAttr(gridSizeOverride ? gridSizeOverride : gridSize));
+}
+
 void AffixTuningParameters::affixBackwardWeightUtilityKernels(
     Conv2DBwdWeightOp &op) {
   auto gemmIdAttr = op->template getAttrOfType<IntegerAttr>("gemm_id");
   assert(gemmIdAttr);
   int64_t gemmId = gemmIdAttr.getInt();
 
+  // The second kernel of a KBlock reduction sums the partial filters. It keeps
+  // the tuning parameters, and so the number of KBlocks, of the first one.
+  if (op->hasAttr("reduce_kblocks")) {
+    if (gemmId == 1) {
+      OpBuilder b(op.getContext());
+      setUtilityKernelSizes(b, op.filter(), op, getOperation());
+    }
+    return;
+  }
+
+  // Other deterministic convolutions are a single kernel without utility
+  // kernels.
+  if (op->hasAttr("deterministic"))
+    return;
+
   auto xdlopsV2Attr = op->template getAttrOfType<BoolAttr>("xdlopsV2");
   if (xdlopsV2Attr && xdlopsV2Attr.getValue() == true) {
     OpBuilder b(op.getContext());
@@ -186,13 +376,45 @@ void AffixTuningParameters::affixBackwardWeightUtilityKernels(
   }
 }
 
+// Record where the parameters of `op` came from, on the op and on the kernel
+// so that it is carried into the targets of the kernel, and in the
+// process-wide counters. The kernel also records `params` as the perf_config
+// that builds it again, for the reports of its times to name it.
+template <typename Params>
+static void affixTuningSource(OpBuilder &b, Operation *op, Operation *funcOp,
+                              TuningSource source, const Params &params) {
+  StringAttr sourceAttr = b.getStringAttr(getTuningSourceName(source));
+  op->setAttr("tuning_source", sourceAttr);
+  funcOp->setAttr("tuning_source", sourceAttr);
+  recordTuningSource(source);
+
+  std::ostringstream os;
+  params.serialize(os);
+  funcOp->setAttr("perf_config", b.getStringAttr(os.str()));
+}
+
+// Whether the XDLOPS gemm of `op`, of size `gemmSize`, loads its operands
+// straight from global memory into the registers of its waves. Gemms as small
+// as the per-group convolutions and the small heads of detection networks
+// spend longer staging their operands in LDS, barriers included, than on the
+// arithmetic. Int4 weights, which are dequantized in LDS order, and sparse
+// operands keep the LDS lowering.
+static bool usesRegisterOnlyGemm(Operation *op, const GemmContext &gemmSize) {
+  if (op->hasAttr("int4_group_size") || op->hasAttr("sparse"))
+    return false;
+  return gemmSize.m <= kRegisterGemmMaxSize &&
+         gemmSize.n <= kRegisterGemmMaxSize &&
+         gemmSize.k <= kRegisterGemmMaxSize;
+}
+
 template <typename T>
 void AffixTuningParameters::affixTuningParametersImpl(T &op) {
   OpBuilder b(op.getContext());
 
-  ConvolutionDims dims = obtainConvDims(op);
+  const ConvolutionContext &ctx = getConvContext(op);
   ConvOpType opType = obtainConvDirection(op);
-  GemmContext gemmSize = GemmContext::fromConvolution(opType, dims);
+  GemmContext gemmSize =
+      GemmContext::fromConvolution(opType, ctx.getConvDims());
 
   std::string perfConfig;
   if (auto perfConfigAttr =
@@ -201,7 +423,8 @@ void AffixTuningParameters::affixTuningParametersImpl(T &op) {
   }
   auto xdlopsV2Attr = op->template getAttrOfType<BoolAttr>("xdlopsV2");
   if (xdlopsV2Attr && xdlopsV2Attr.getValue() == true) {
-    PopulateParamsXDL populateParamsXDL;
+    PopulateParamsXDL populateParamsXDL(minWavesPerSimd, ldsStages,
+                                        skipHeuristicConfigs);
     InitParamsXDL validParams;
     DerivedParams gemmADerivedParam;
     DerivedParams gemmBDerivedParam;
@@ -211,42 +434,76 @@ void AffixTuningParameters::affixTuningParametersImpl(T &op) {
     int64_t gemmKBlocks = 1;
 
     LogicalResult status = populateParamsXDL.obtainTuningParameters(
-        op, blockSizeOverride, perfConfig, validParams, gemmADerivedParam,
+        ctx, blockSizeOverride, perfConfig, validParams, gemmADerivedParam,
         gemmBDerivedParam, gemmCDerivedParam, blockSize, gridSize, gemmKBlocks);
+    TuningSource source = populateParamsXDL.getTuningSource();
 
     if (failed(status)) {
       // Try again if allowed.
       if (fallBackNoConfig) {
         perfConfig.clear();
         status = populateParamsXDL.obtainTuningParameters(
-            op, blockSizeOverride, perfConfig, validParams, gemmADerivedParam,
+            ctx, blockSizeOverride, perfConfig, validParams, gemmADerivedParam,
             gemmBDerivedParam, gemmCDerivedParam, blockSize, gridSize,
             gemmKBlocks);
+        source = TuningSource::Fallback;
       }
       if (failed(status))
         signalPassFailure();
     }
+    if (succeeded(status))
+      affixTuningSource(b, op, getOperation(), source, validParams);
 
     op->setAttr("m_per_wave", b.getI32IntegerAttr(validParams.gemmMPerWave));
     op->setAttr("n_per_wave", b.getI32IntegerAttr(validParams.gemmNPerWave));
     op->setAttr("block_size", b.getI32IntegerAttr(blockSize));
+    if (gridGroupM > 0)
+      op->setAttr("grid_group_m", b.getI32IntegerAttr(gridGroupM));
 
     ConvOpType dir = obtainConvDirection(op);
     Type dataType = obtainConvDataType(op);
 
     // Disable kpack in case we need padding kernel.
     Optional<GemmContext> gemmExtraPad =
-        calculatePaddingKernelSize(gemmSize, dir, dataType, populateParamsXDL);
+        calculatePaddingKernelSize(gemmSize, dir, dataType, populateParamsXDL,
+                                   isa<GemmOp>(op.getOperation()));
     if (gemmExtraPad.hasValue()) {
       validParams.gemmKPack = 1;
     }
 
     op->setAttr("kpack", b.getI32IntegerAttr(validParams.gemmKPack));
-    // Set kblocks attribute only for backward weight convolutions.
-    if (dir == ConvOpType::BwdWeight) {
+    // A tuned perf_config may pick its own number of stages.
+    op->setAttr("lds_stages",
+                b.getI32IntegerAttr(validParams.ldsStages > 0
+                                        ? validParams.ldsStages
+                                        : ldsStages));
+    if (directToLds)
+      op->setAttr("direct_to_lds", b.getUnitAttr());
+    if (ldsEpilogue)
+      op->setAttr("lds_epilogue", b.getUnitAttr());
+    if (schedHints)
+      op->setAttr("sched_hints", b.getI32IntegerAttr(schedHints));
+    // Set kblocks attribute only for the convolutions that split GemmK.
+    if (dir == ConvOpType::BwdWeight ||
+        (dir == ConvOpType::Fwd && op->hasAttr("split_k"))) {
       op->setAttr("kblocks", b.getI32IntegerAttr(gemmKBlocks));
     }
 
+    // A persistent kernel is launched with the workgroups that fit on the GPU
+    // at once, which the gridwise gemm lowering loops over the tiles.
+    // Register-only gemms have too few tiles for that to pay off.
+    bool registerOnly = usesRegisterOnlyGemm(op, gemmSize);
+    if (registerOnly)
+      op->setAttr("register_only", b.getUnitAttr());
+    if (persistent && !registerOnly && succeeded(status)) {
+      int64_t residentGridSize = populateParamsXDL.obtainResidentGridSize(
+          ctx, validParams, gemmADerivedParam, gemmBDerivedParam, blockSize);
+      if (residentGridSize < gridSize) {
+        op->setAttr("persistent", b.getUnitAttr());
+        gridSize = residentGridSize;
+      }
+    }
+
     // Set attributes on the function.
     getOperation()->setAttr("block_size", b.getI32IntegerAttr(blockSize));
     getOperation()->setAttr(
@@ -275,6 +532,8 @@ void AffixTuningParameters::affixTuningParametersImpl(T &op) {
 
     op->setAttr("matrix_c_data_per_copy",
                 b.getI32IntegerAttr(gemmCDerivedParam.dataPerCopy));
+    op->setAttr("matrix_c_max_data_per_copy",
+                b.getI32IntegerAttr(gemmCDerivedParam.maxDataPerCopy));
     op->setAttr("matrix_c_source_vector_read_dim",
                 b.getI32IntegerAttr(gemmCDerivedParam.gemmVectorDim));
     op->setAttr("matrix_c_dest_vector_write_dim",
@@ -289,11 +548,14 @@ void AffixTuningParameters::affixTuningParametersImpl(T &op) {
 
     PopulateParams populateParams;
     LogicalResult status = populateParams.obtainTuningParameters(
-        op, blockSizeOverride, perfConfig, validParams, gemmADerivedParam,
+        ctx, blockSizeOverride, perfConfig, validParams, gemmADerivedParam,
         gemmBDerivedParam, blockGemmDerivedParam, gemmCDerivedParam, gridSize);
 
     if (failed(status)) {
       signalPassFailure();
+    } else {
+      affixTuningSource(b, op, getOperation(),
+                        populateParams.getTuningSource(), validParams);
     }
 
     op->setAttr("m_per_thread",
@@ -301,6 +563,8 @@ void AffixTuningParameters::affixTuningParametersImpl(T &op) {
     op->setAttr("n_per_thread",
                 b.getI32IntegerAttr(validParams.gemmNPerThread));
     op->setAttr("block_size", b.getI32IntegerAttr(validParams.blockSize));
+    if (gridGroupM > 0)
+      op->setAttr("grid_group_m", b.getI32IntegerAttr(gridGroupM));
     // For non-XDLOPS path, do not use KPack for now.
     op->setAttr("kpack", b.getI32IntegerAttr(1));
 
@@ -331,9 +595,17 @@ void AffixTuningParameters::affixTuningParametersImpl(T &op) {
     op->setAttr("matrix_b_source_vector_read_dim",
                 b.getI32IntegerAttr(gemmBDerivedParam.srcVectorReadDim));
 
-    // Hard coded parameters, will change in a different pass. Please visit
-    // gridwise_convolution_implicit_gemm_v4r4_nchw_kcyx_nkhw for details
-    op->setAttr("k_per_thread", b.getI32IntegerAttr(1));
+    // Threads step through GemmK one element at a time, unless the chip has
+    // packed dot instructions, in which case each step covers as many
+    // elements as one of them reduces.
+    int64_t kPerThread = 1;
+    if (auto archAttr = op->getAttrOfType<StringAttr>("arch")) {
+      int64_t dotWidth =
+          getDotProductWidth(obtainConvDataType(op), archAttr.getValue());
+      if (validParams.gemmKPerBlock % dotWidth == 0)
+        kPerThread = dotWidth;
+    }
+    op->setAttr("k_per_thread", b.getI32IntegerAttr(kPerThread));
     op->setAttr("m_level0_cluster",
                 b.getI32IntegerAttr(blockGemmDerivedParam.gemmMLevel0Cluster));
     op->setAttr("n_level0_cluster",
@@ -355,7 +627,17 @@ void AffixTuningParameters::affixTuningParametersImpl(T &op) {
 std::unique_ptr<Pass>
 mlir::miopen::createAffixTuningParametersPass(int64_t blockSizeOverride,
                                               int64_t gridSizeOverride,
-                                              bool fallBackNoConfig) {
+                                              bool fallBackNoConfig,
+                                              int64_t minWavesPerSimd,
+                                              int64_t ldsStages,
+                                              bool directToLds,
+                                              bool ldsEpilogue,
+                                              int64_t schedHints,
+                                              int64_t gridGroupM,
+                                              bool persistent,
+                                              int64_t skipHeuristicConfigs) {
   return std::make_unique<AffixTuningParameters>(
-      blockSizeOverride, gridSizeOverride, fallBackNoConfig);
+      blockSizeOverride, gridSizeOverride, fallBackNoConfig, minWavesPerSimd,
+      ldsStages, directToLds, ldsEpilogue, schedHints, gridGroupM, persistent,
+      skipHeuristicConfigs);
 }
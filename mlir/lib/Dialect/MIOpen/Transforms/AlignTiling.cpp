@@ -17,25 +17,33 @@
 // =============================================================================
 //
 // This pass refactors linalg.generic ops from global scope to tiled scope
-// based on miopen lowering step2.
+// based on miopen lowering step2. Generics consuming the gemm output are
+// applied before its writeback, and elementwise generics producing a gemm
+// operand are applied as that operand is loaded from global memory.
 //
 //===----------------------------------------------------------------------===//
 
 #include "PassDetail.h"
 
 #include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
 #include "mlir/Dialect/Linalg/IR/Linalg.h"
 #include "mlir/Dialect/MIOpen/MIOpen.h"
 #include "mlir/Dialect/MIOpen/Passes.h"
 #include "mlir/Dialect/MIOpen/TransformMapBuilder.h"
+#include "mlir/Dialect/MIOpen/utility/builderUtils.h"
 #include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
 #include "mlir/Dialect/MemRef/IR/MemRef.h"
 #include "mlir/Dialect/Utils/ReshapeOpsUtils.h"
 #include "mlir/Dialect/Vector/IR/VectorOps.h"
+#include "mlir/IR/BlockAndValueMapping.h"
 #include "mlir/IR/BuiltinTypes.h"
+#include "mlir/IR/Matchers.h"
 #include "mlir/IR/PatternMatch.h"
+#include "mlir/IR/TypeUtilities.h"
 #include "mlir/Transforms/GreedyPatternRewriteDriver.h"
 
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/Debug.h"
@@ -59,6 +67,16 @@ struct MILARewritePattern : public OpRewritePattern<linalg::GenericOp> {
   LogicalResult matchAndRewrite(linalg::GenericOp laGeneric,
                                 PatternRewriter &b) const override;
 };
+
+/// Fuses an elementwise linalg.generic whose output is only read by the
+/// global loads of a gemm into those loads.
+struct MILAPrologueRewritePattern
+    : public OpRewritePattern<linalg::GenericOp> {
+  using OpRewritePattern<linalg::GenericOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(linalg::GenericOp laGeneric,
+                                PatternRewriter &b) const override;
+};
 } // end anonymous namespace
 
 /// If `inpMap` is a map of the form
@@ -167,9 +185,13 @@ static Value makeBroadcast(PatternRewriter &b, MemRefType outType, Value inp,
   return inp;
 }
 
+/// Load the elements of the extra argument `srcOp` that correspond to those
+/// `op` writes into `dest`. When `splatsVector`, the argument is broadcast
+/// along the dimension `op` vectorizes, as a per-channel bias is along the
+/// width, so one element is loaded and splat instead of a vector.
 static void insertCopyFromOtherArg(PatternRewriter &b, Location loc,
                                    ThreadwiseCopyV2Op op, Value srcOp,
-                                   Value dest) {
+                                   Value dest, bool splatsVector) {
   LLVM_DEBUG(llvm::dbgs() << "Src type: " << srcOp.getType()
                           << " dest type: " << op.dest().getType() << "\n");
   assert(srcOp.getType().cast<ShapedType>().getShape() ==
@@ -185,24 +207,36 @@ static void insertCopyFromOtherArg(PatternRewriter &b, Location loc,
   std::tie(source, sourceTransformsFromOp) = untransform(b, srcOp);
 
   int64_t copyLength = op.length().getSExtValue();
-  Type typeToLoad = dest.getType().cast<MemRefType>().getElementType();
-  if (copyLength > 1)
-    typeToLoad = VectorType::get({copyLength}, typeToLoad);
+  Type elementType = dest.getType().cast<MemRefType>().getElementType();
+  Type typeToLoad = elementType;
+  if (copyLength > 1 && !splatsVector)
+    typeToLoad = VectorType::get({copyLength}, elementType);
 
   ArrayAttr sourceLeftOob = op.leftOobDims();
   ArrayAttr sourceRightOob = op.rightOobDims();
   Value zero = b.createOrFold<arith::ConstantIndexOp>(loc, 0);
+  auto storeLoaded = [&](Value loaded) {
+    if (copyLength > 1 && splatsVector)
+      loaded = b.create<vector::BroadcastOp>(
+          loc, VectorType::get({copyLength}, elementType), loaded);
+    b.create<InBoundsStoreOp>(loc, loaded, dest, zero);
+  };
 
   // In general, note that keeping the vectorization of the writeback is safe
   // on account of the fact that vectorization means that the maps for the
   // gemm output (and thus the extra argument) are contiguous in the
-  // underlying memory.
+  // underlying memory, unless the argument is broadcast along them, where
+  // all the elements are the same one.
 
-  // If there are no broadcasts, re-use the coordianes for the writeback
+  // If there are no broadcasts, re-use the coordianes for the writeback.
+  // Each element is then read once, by the thread writing the corresponding
+  // gemm output, so keep it out of the way of the gemm's data in the caches.
   if (sourceTransformsFromOp.empty()) {
-    Value loaded = b.create<BufferLoadOp>(
-        loc, typeToLoad, source, sourceLeftOob, sourceRightOob, op.destCoord());
-    b.create<InBoundsStoreOp>(loc, loaded, dest, zero);
+    Value loaded =
+        b.create<BufferLoadOp>(loc, typeToLoad, source, sourceLeftOob,
+                               sourceRightOob, op.destCoord(),
+                               CachePolicy::Streaming);
+    storeLoaded(loaded);
   } else {
     // Note: this is a hack around the fact that we don't have a good way
     // to add a domain to the enclosing loop currently.
@@ -222,13 +256,14 @@ static void insertCopyFromOtherArg(PatternRewriter &b, Location loc,
       Value loaded = b.create<BufferLoadOp>(
           loc, typeToLoad, source, sourceLeftOob, sourceRightOob,
           copyLoop.getLowerCoords(/*domain=*/0));
-      b.create<InBoundsStoreOp>(loc, loaded, dest, zero);
+      storeLoaded(loaded);
     }
   }
 }
 
 static Value makeTransformingCopyLoop(PatternRewriter &b,
-                                      ThreadwiseCopyV2Op miTwCopy, Value inp) {
+                                      ThreadwiseCopyV2Op miTwCopy, Value inp,
+                                      bool splatsVector) {
   // 0. capture the memref containing the outputs being written
   Location loc = miTwCopy.getLoc();
   Value gemmOuts = miTwCopy.source();
@@ -240,7 +275,7 @@ static Value makeTransformingCopyLoop(PatternRewriter &b,
   Value alloc = b.create<GpuAllocOp>(loc, sliceLengthType);
 
   // 2. clone twcopy for <addend> -> regs as transforming_for
-  insertCopyFromOtherArg(b, loc, miTwCopy, inp, alloc);
+  insertCopyFromOtherArg(b, loc, miTwCopy, inp, alloc, splatsVector);
   return alloc;
 }
 
@@ -258,13 +293,14 @@ Value applyTransforms(PatternRewriter &b, ThreadwiseCopyV2Op miTWCopy,
 
   // 1. insert broadcast op if necessary
   MemRefType outType = miTWCopy.dest().getType().cast<MemRefType>();
+  bool splatsVector = !inpMap.isFunctionOfDim(outType.getRank() - 1);
   std::tie(ret, inpMap) = makeTransposeTransform(b, ret, inpMap);
   ret = makeBroadcast(b, outType, ret, inpMap);
 
   // 2. also create threadwise_copy_v2 from global to regs
   //    TODO(sjw): make sure output buffer writes (means these inputs will be
   //    buffer reads)
-  return makeTransformingCopyLoop(b, miTWCopy, ret);
+  return makeTransformingCopyLoop(b, miTWCopy, ret, splatsVector);
 }
 
 static ThreadwiseCopyV2Op traceToThreadwiseCopy(Value inp) {
@@ -297,16 +333,16 @@ static ThreadwiseCopyV2Op traceToThreadwiseCopy(Value inp) {
   return allValidUses ? result : ThreadwiseCopyV2Op();
 }
 
-// Returns the value of the buffer that's meant to be the new writeback.
-static Value reconfigureLAGeneric(PatternRewriter &b,
-                                  linalg::GenericOp laGeneric, Value laIn,
-                                  ArrayRef<AffineMap> idxMaps,
-                                  ThreadwiseCopyV2Op twcopy) {
+// Returns the values of the buffers that are meant to be the new writebacks,
+// one per output of the generic.
+static SmallVector<Value, 2>
+reconfigureLAGeneric(PatternRewriter &b, linalg::GenericOp laGeneric,
+                     Value laIn, ArrayRef<AffineMap> idxMaps,
+                     ThreadwiseCopyV2Op twcopy) {
   MLIRContext *ctx = laGeneric.getContext();
   Location loc = laGeneric.getLoc();
   Value twout = twcopy.dest();
   auto regType = laIn.getType().template cast<MemRefType>();
-  auto laOut = b.create<GpuAllocOp>(loc, regType);
 
   SmallVector<AffineMap, 5> laGenericAMaps;
   SmallVector<Value, 5> newInputs;
@@ -325,11 +361,19 @@ static Value reconfigureLAGeneric(PatternRewriter &b,
           newInput.getType().template cast<MemRefType>().getRank(), ctx));
     }
   }
-  laGenericAMaps.push_back(
-      AffineMap::getMultiDimIdentityMap(regType.getRank(), ctx));
+
+  SmallVector<Value, 2> laOuts;
+  for (Value out : laGeneric.outputs()) {
+    Type outElementType =
+        out.getType().template cast<MemRefType>().getElementType();
+    laOuts.push_back(b.create<GpuAllocOp>(
+        loc, regType.clone(outElementType).template cast<MemRefType>()));
+    laGenericAMaps.push_back(
+        AffineMap::getMultiDimIdentityMap(regType.getRank(), ctx));
+  }
 
   laGeneric.inputsMutable().assign(newInputs);
-  laGeneric.outputsMutable().assign(laOut);
+  laGeneric.outputsMutable().assign(laOuts);
 
   // 2.2. Reset affine maps
   laGeneric.indexing_mapsAttr(b.getAffineMapArrayAttr(laGenericAMaps));
@@ -339,7 +383,221 @@ static Value reconfigureLAGeneric(PatternRewriter &b,
                                                   b.getStringAttr("parallel"));
   laGeneric.iterator_typesAttr(b.getArrayAttr(ArrayRef<Attribute>(
       laGenericIteratorArr.begin(), laGenericIteratorArr.end())));
-  return laOut;
+  return laOuts;
+}
+
+/// If output `idx` of `laGeneric` is a sum reduction, that is, its body only
+/// adds a value to the accumulator of that output, return that addition.
+static arith::AddFOp getSumReduction(linalg::GenericOp laGeneric,
+                                     unsigned idx) {
+  Block &body = laGeneric.getRegion().front();
+  BlockArgument acc = body.getArgument(laGeneric.inputs().size() + idx);
+  auto add =
+      body.getTerminator()->getOperand(idx).getDefiningOp<arith::AddFOp>();
+  if (!add || !add->hasOneUse() || !acc.hasOneUse())
+    return arith::AddFOp();
+  if (add.getLhs() != acc && add.getRhs() != acc)
+    return arith::AddFOp();
+  return add;
+}
+
+/// If `map` indexes the result of a pooling whose windows tile its input,
+/// that is, is of the form (d0, ..., dk) -> (d0 floordiv c0, ..., dk floordiv
+/// ck) where some divisions may be missing, return the window sizes c0, ...,
+/// ck, with 1 where there is no division.
+static Optional<SmallVector<int64_t, 5>> getPoolingWindow(AffineMap map) {
+  if (map.getNumResults() != map.getNumDims() || map.getNumSymbols() != 0)
+    return llvm::None;
+  SmallVector<int64_t, 5> window;
+  for (auto pair : llvm::enumerate(map.getResults())) {
+    AffineExpr expr = pair.value();
+    int64_t size = 1;
+    if (expr.getKind() == AffineExprKind::FloorDiv) {
+      auto div = expr.cast<AffineBinaryOpExpr>();
+      auto divisor = div.getRHS().dyn_cast<AffineConstantExpr>();
+      if (!divisor || divisor.getValue() <= 0)
+        return llvm::None;
+      expr = div.getLHS();
+      size = divisor.getValue();
+    }
+    auto dim = expr.dyn_cast<AffineDimExpr>();
+    if (!dim || dim.getPosition() != pair.index())
+      return llvm::None;
+    window.push_back(size);
+  }
+  return window;
+}
+
+/// The transforms that view a buffer of type `outType`, the result of a
+/// pooling with the tiling windows `window`, in the shape of the pooled
+/// input, each coordinate landing on the element of the window holding it.
+static SmallVector<Attribute, 2>
+makePoolingWindowTransforms(PatternRewriter &b, Location loc,
+                            MemRefType outType, ArrayRef<int64_t> window) {
+  ArrayRef<int64_t> outShape = outType.getShape();
+  SmallVector<int64_t, 5> inShape;
+  for (auto pair : llvm::zip(outShape, window))
+    inShape.push_back(std::get<0>(pair) * std::get<1>(pair));
+
+  // Split each windowed dimension into the window and the offset in it.
+  TopDownTMBuilder split(b, inShape, loc);
+  SmallVector<std::string, 5> offsetNames;
+  offsetNames.reserve(window.size());
+  uint32_t lowerDim = 0;
+  for (uint32_t i = 0, e = window.size(); i < e; ++i) {
+    if (window[i] == 1) {
+      split.passThrough({lowerDim++}, {i});
+      continue;
+    }
+    SmallString<8> name = split.startName(i);
+    offsetNames.push_back((name + "_offset").str());
+    split.merge({name, offsetNames.back()}, {lowerDim, lowerDim + 1}, name,
+                {outShape[i], window[i]});
+    lowerDim += 2;
+  }
+  TransformMapAttr splitAttr = split.get();
+
+  // And drop the offsets.
+  TopDownTMBuilder drop = TopDownTMBuilder::below(split, splitAttr);
+  lowerDim = 0;
+  for (uint32_t i = 0, e = splitAttr.getLowerBounds().size(); i < e; ++i) {
+    SmallString<8> name = drop.startName(i);
+    if (llvm::is_contained(offsetNames, name.str()))
+      drop.ignore(name);
+    else
+      drop.passThrough({lowerDim++}, {i});
+  }
+  return {splitAttr, drop.get()};
+}
+
+/// The kernel argument that `out` is, up to reshapes, or null if it is
+/// anything else.
+static BlockArgument getKernelArgument(Value out) {
+  while (isa_and_nonnull<memref::CollapseShapeOp, memref::ExpandShapeOp>(
+      out.getDefiningOp()))
+    out = out.getDefiningOp()->getOperand(0);
+  auto arg = out.dyn_cast<BlockArgument>();
+  if (!arg)
+    return {};
+  auto func = dyn_cast<func::FuncOp>(arg.getOwner()->getParentOp());
+  if (!func || !func->hasAttr("kernel"))
+    return {};
+  return arg;
+}
+
+/// Zero the `length` values of `regs` that a thread writes back along the
+/// last dimension from `coords` into a buffer of shape `shape` and that fall
+/// outside of it along the dimensions `leftOob` and `rightOob`, which the
+/// writeback of the gemm output skips. Reductions over those dimensions
+/// would otherwise add up the padding of the gemm, since views of the output
+/// that broadcast or merge them cannot tell it apart.
+static void zeroOutOfBounds(PatternRewriter &b, Location loc, Value regs,
+                            ValueRange coords, ArrayRef<int64_t> shape,
+                            ArrayAttr leftOob, ArrayAttr rightOob,
+                            int64_t length) {
+  if (leftOob.empty() && rightOob.empty())
+    return;
+  Type elementType = regs.getType().cast<MemRefType>().getElementType();
+  Value zero = b.create<arith::ConstantOp>(loc, b.getZeroAttr(elementType));
+  Value indexZero = b.createOrFold<arith::ConstantIndexOp>(loc, 0);
+  size_t last = shape.size() - 1;
+  for (int64_t i = 0; i < length; ++i) {
+    Value offset = b.createOrFold<arith::ConstantIndexOp>(loc, i);
+    auto getCoord = [&](Attribute dimAttr) -> Value {
+      size_t dim = dimAttr.cast<IntegerAttr>().getInt();
+      if (dim != last || i == 0)
+        return coords[dim];
+      return b.create<arith::AddIOp>(loc, coords[dim], offset);
+    };
+    Value inBounds = b.create<arith::ConstantIntOp>(loc, 1, 1);
+    for (Attribute dim : leftOob)
+      inBounds = b.create<arith::AndIOp>(
+          loc, inBounds,
+          b.create<arith::CmpIOp>(loc, arith::CmpIPredicate::sge,
+                                  getCoord(dim), indexZero));
+    for (Attribute dim : rightOob) {
+      Value bound = b.createOrFold<arith::ConstantIndexOp>(
+          loc, shape[dim.cast<IntegerAttr>().getInt()]);
+      inBounds = b.create<arith::AndIOp>(
+          loc, inBounds,
+          b.create<arith::CmpIOp>(loc, arith::CmpIPredicate::slt,
+                                  getCoord(dim), bound));
+    }
+    Value value = b.create<InBoundsLoadOp>(loc, elementType, regs, offset);
+    b.create<InBoundsStoreOp>(
+        loc, b.create<arith::SelectOp>(loc, inBounds, value, zero), regs,
+        offset);
+  }
+}
+
+/// Atomically add the contributions to `out`, a sum reduction output of a
+/// generic indexed by `outIdxMap`, that a thread holds in `regs` into `out`
+/// at the coordinates `twcopy` writes. When the elements of the vector of
+/// `twcopy` all land in the same element of `out`, the thread adds them up
+/// first and issues one atomic for them. Pooling outputs are reached through
+/// a view of their windows instead of a broadcast. Contributions from outside
+/// the bounds of the gemm output are zeroed first.
+static void insertReductionWriteback(PatternRewriter &b,
+                                     ThreadwiseCopyV2Op twcopy, Value regs,
+                                     Value out, AffineMap outIdxMap) {
+  Location loc = twcopy.getLoc();
+  auto fullType = twcopy.dest().getType().cast<MemRefType>();
+  int64_t rank = fullType.getRank();
+  int64_t length = twcopy.length().getSExtValue();
+  bool sumsVector = length > 1 && !outIdxMap.isFunctionOfDim(rank - 1);
+  zeroOutOfBounds(b, loc, regs, twcopy.destCoord(), fullType.getShape(),
+                  twcopy.leftOobDims(), twcopy.rightOobDims(), length);
+
+  // View the output in the shape of the full writeback.
+  Value dest;
+  ArrayAttr transforms;
+  if (Optional<SmallVector<int64_t, 5>> window = getPoolingWindow(outIdxMap)) {
+    std::tie(dest, transforms) = untransform(
+        b, out,
+        makePoolingWindowTransforms(b, loc, out.getType().cast<MemRefType>(),
+                                    *window));
+  } else {
+    Value view;
+    std::tie(view, outIdxMap) = makeTransposeTransform(b, out, outIdxMap);
+    view = makeBroadcast(b, fullType, view, outIdxMap);
+    std::tie(dest, transforms) = untransform(b, view);
+  }
+  ArrayAttr leftOob, rightOob;
+  std::tie(leftOob, rightOob) = computeOobFromTransforms(
+      b, transforms, {{twcopy.leftOobDims(), twcopy.rightOobDims()}});
+
+  Value zero = b.createOrFold<arith::ConstantIndexOp>(loc, 0);
+  Value source = regs;
+  if (sumsVector) {
+    auto regsType = regs.getType().cast<MemRefType>();
+    Type elementType = regsType.getElementType();
+    Value sum = b.create<InBoundsLoadOp>(loc, elementType, regs, zero);
+    for (int64_t i = 1; i < length; ++i)
+      sum = b.create<arith::AddFOp>(
+          loc, sum,
+          b.create<InBoundsLoadOp>(
+              loc, elementType, regs,
+              b.createOrFold<arith::ConstantIndexOp>(loc, i)));
+    int64_t one = 1;
+    source = b.create<GpuAllocOp>(loc, regsType.clone(one).cast<MemRefType>());
+    b.create<InBoundsStoreOp>(loc, sum, source, zero);
+    length = 1;
+  }
+
+  SmallVector<int64_t, 5> bounds(rank, 1);
+  bounds.back() = length;
+  SmallVector<Value, 5> linearInit(rank, zero);
+  auto loop = b.create<TransformingForOp>(
+      loc, ArrayRef<ValueRange>{twcopy.destCoord(), linearInit},
+      ArrayRef<Attribute>{transforms, b.getArrayAttr({})}, bounds,
+      /*strides=*/llvm::None, /*forceUnroll=*/true, /*useIndexDiffs=*/true);
+  OpBuilder::InsertionGuard guard(b);
+  b.setInsertionPointToStart(loop.getBody());
+  b.create<ThreadwiseCopyV2Op>(
+      loc, source, dest, b.getIndexAttr(1),
+      StoreMethodAttr::get(b.getContext(), StoreMethod::AtomicAdd), leftOob,
+      rightOob, loop.getLowerCoords(/*domain=*/1).back(),
+      loop.getLowerCoords(/*domain=*/0));
 }
 
 static bool checkCompatibleTypes(AffineMap inpMap, AffineMap outMap) {
@@ -360,18 +618,17 @@ LogicalResult MILARewritePattern::matchAndRewrite(linalg::GenericOp laGeneric,
   Location loc = laGeneric.getLoc();
 
   // 0. Test compatibility
-  // 0.0. Only fully parallel for now
+  // 0.0. Only parallel iterators, unless all the outputs are sum reductions
+  bool hasReduction = false;
   for (StringRef iterType :
-       laGeneric.iterator_types().getAsValueRange<StringAttr>())
-    if (iterType != "parallel")
+       laGeneric.iterator_types().getAsValueRange<StringAttr>()) {
+    if (iterType == "reduction")
+      hasReduction = true;
+    else if (iterType != "parallel")
       return failure();
+  }
 
-  Value out = *laGeneric.outputs().begin(); // may be another arg
-  // 0.1. Test compatibility,  Only 1 output supported
-  if (laGeneric.outputs().size() > 1)
-    return failure();
-
-  // 0.2. Sanity check, skip already fused.
+  // 0.1. Sanity check, skip already fused.
   for (auto inp : laGeneric.inputs()) {
     if (auto fusedAlloc = inp.getDefiningOp<GpuAllocOp>()) {
       LLVM_DEBUG(llvm::dbgs() << "Found existing fusion, bailing\n");
@@ -379,11 +636,55 @@ LogicalResult MILARewritePattern::matchAndRewrite(linalg::GenericOp laGeneric,
     }
   }
 
+  // 0.2. Outputs are either indexed by the identity map and written as the
+  // gemm output is, or are f32 sum reductions over some of the dimensions or
+  // over pooling windows, accumulated with atomics into whatever the output
+  // holds.
   SmallVector<AffineMap> idxMaps = laGeneric.getIndexingMaps();
-  // Output must be indexed by identity map for this to work
-  AffineMap outIdxMap = idxMaps.back();
-  if (!outIdxMap.isIdentity())
-    return failure();
+  size_t numInputs = laGeneric.inputs().size();
+  ArrayRef<AffineMap> outIdxMaps =
+      ArrayRef<AffineMap>(idxMaps).drop_front(numInputs);
+  AffineMap domainMap = AffineMap::getMultiDimIdentityMap(
+      laGeneric.getNumLoops(), laGeneric.getContext());
+  SmallVector<arith::AddFOp, 2> reductions;
+  SmallVector<linalg::FillOp, 2> reductionFills;
+  for (auto pair : llvm::enumerate(laGeneric.outputs())) {
+    unsigned idx = pair.index();
+    Value out = pair.value();
+    AffineMap outIdxMap = outIdxMaps[idx];
+    if (outIdxMap.isIdentity()) {
+      if (hasReduction || laGeneric.payloadUsesValueFromOperand(
+                              laGeneric.getOutputOperand(idx)))
+        return failure();
+      reductions.push_back(arith::AddFOp());
+      reductionFills.push_back(linalg::FillOp());
+      continue;
+    }
+    arith::AddFOp reduction = getSumReduction(laGeneric, idx);
+    if (!hasReduction || !reduction ||
+        !out.getType().cast<MemRefType>().getElementType().isF32() ||
+        !(outIdxMap.isProjectedPermutation() || getPoolingWindow(outIdxMap)))
+      return failure();
+    // Nothing else in the kernel may touch what the atomics accumulate into,
+    // but for zeroing it beforehand, which is left to the caller as the
+    // kernel has no way to do it before all of its workgroups add to it
+    linalg::FillOp fill;
+    for (Operation *user : out.getUsers()) {
+      if (user == laGeneric || isa<memref::DeallocOp>(user))
+        continue;
+      auto userFill = dyn_cast<linalg::FillOp>(user);
+      if (!userFill || fill ||
+          !matchPattern(userFill.inputs()[0], m_AnyZeroFloat()) ||
+          userFill->getBlock() != laGeneric->getBlock() ||
+          !userFill->isBeforeInBlock(laGeneric))
+        return failure();
+      fill = userFill;
+    }
+    if (!getKernelArgument(out))
+      return failure();
+    reductions.push_back(reduction);
+    reductionFills.push_back(fill);
+  }
 
   // 1. Trace input to threadwise_copy. Collect transforms (to be applied to
   // other inputs).
@@ -408,10 +709,10 @@ LogicalResult MILARewritePattern::matchAndRewrite(linalg::GenericOp laGeneric,
     } else {
       // Other inputs must have access maps compatible with current fusion
       // rewrites
-      if (!checkCompatibleTypes(inpIdxMap, outIdxMap)) {
+      if (!checkCompatibleTypes(inpIdxMap, domainMap)) {
         LLVM_DEBUG(llvm::dbgs() << "Input index map " << inpIdxMap
-                                << " incompatible with output index map "
-                                << outIdxMap << "\n");
+                                << " incompatible with iteration domain "
+                                << domainMap << "\n");
         return failure();
       }
     }
@@ -443,24 +744,56 @@ LogicalResult MILARewritePattern::matchAndRewrite(linalg::GenericOp laGeneric,
                                                copyOp.sourceCoord());
     b.create<InBoundsStoreOp>(loc, sliceVals, fusionSlice, zero);
 
-    // 2.2. Tile linalg.generic with vgpr as input, return output vgprs
-    Value laOutRegs =
+    // 2.2. Tile linalg.generic with vgpr as input, return output vgprs.
+    // Reductions compute only what they add to the accumulator in there.
+    SmallVector<Value, 2> outs(laGeneric.outputs());
+    Block &body = laGeneric.getRegion().front();
+    for (auto pair : llvm::enumerate(reductions)) {
+      arith::AddFOp reduction = pair.value();
+      if (!reduction)
+        continue;
+      Value acc = body.getArgument(numInputs + pair.index());
+      b.replaceOp(reduction, reduction.getLhs() == acc ? reduction.getRhs()
+                                                       : reduction.getLhs());
+    }
+    SmallVector<Value, 2> laOutRegs =
         reconfigureLAGeneric(b, laGeneric, fusionSlice, idxMaps, copyOp);
     // 2.2.0. Move the generic before the write-back. This'll put all
     // the copy loops for other inputs before the generic due to insertion
     // order.
     laGeneric->moveBefore(copyOp);
 
-    // 2.3. Replace twcopy inputs with la.generic result vgprs
+    // 2.3. Write back the la.generic result vgprs, the first full output
+    // taking over the gemm's copy
 
     // Since the threadwise copy arg has gone through untransform()
     // its expected output type is the same as the output type of the
     // linalg.generic.
-    copyOp.sourceMutable().assign(laOutRegs);
-    // The indexing has been moved into slice creation, reset source
-    // coord.
-    copyOp.sourceCoordMutable().assign(zero);
-    copyOp.destMutable().assign(out);
+    ThreadwiseCopyV2Op fullCopy;
+    for (size_t idx = 0, e = outs.size(); idx < e; ++idx) {
+      if (reductions[idx]) {
+        insertReductionWriteback(b, copyOp, laOutRegs[idx], outs[idx],
+                                 outIdxMaps[idx]);
+        BlockArgument arg = getKernelArgument(outs[idx]);
+        cast<func::FuncOp>(arg.getOwner()->getParentOp())
+            .setArgAttr(arg.getArgNumber(), kZeroBeforeLaunchAttrName,
+                        b.getUnitAttr());
+        if (reductionFills[idx])
+          b.eraseOp(reductionFills[idx]);
+        continue;
+      }
+      ThreadwiseCopyV2Op writeback =
+          fullCopy ? cast<ThreadwiseCopyV2Op>(b.clone(*copyOp)) : copyOp;
+      writeback.sourceMutable().assign(laOutRegs[idx]);
+      // The indexing has been moved into slice creation, reset source
+      // coord.
+      writeback.sourceCoordMutable().assign(zero);
+      writeback.destMutable().assign(outs[idx]);
+      fullCopy = writeback;
+    }
+    // Only reductions: the gemm result itself isn't needed.
+    if (!fullCopy)
+      b.eraseOp(copyOp);
 
     return success();
   }
@@ -468,10 +801,235 @@ LogicalResult MILARewritePattern::matchAndRewrite(linalg::GenericOp laGeneric,
   return failure();
 }
 
+//===----------------------------------------------------------------------===//
+// Prologue fusion
+//===----------------------------------------------------------------------===//
+
+/// Returns true if `op` is a chain of miopen.transform ops whose end result
+/// is never used, such as those left behind by the gridwise gemm lowering.
+static bool isUnusedView(Operation *op) {
+  if (!isa<TransformOp>(op))
+    return false;
+  return llvm::all_of(op->getUsers(), isUnusedView);
+}
+
+/// Collect into `loads` the global loads that read `out`, the buffer written
+/// by `laGeneric`. Fails if anything else uses `out` or if a load could run
+/// before the generic.
+static LogicalResult collectPrologueLoads(linalg::GenericOp laGeneric,
+                                          Value out,
+                                          SmallVectorImpl<BufferLoadOp> &loads) {
+  Block *block = laGeneric->getBlock();
+  for (Operation *use : out.getUsers()) {
+    if (use == laGeneric || isa<memref::DeallocOp>(use) || isUnusedView(use))
+      continue;
+    auto load = dyn_cast<BufferLoadOp>(use);
+    if (!load) {
+      LLVM_DEBUG(llvm::dbgs() << "Prologue: output has non-load use " << *use
+                              << "\n");
+      return failure();
+    }
+    Operation *ancestor = block->findAncestorOpInBlock(*load);
+    if (!ancestor || !laGeneric->isBeforeInBlock(ancestor))
+      return failure();
+    loads.push_back(load);
+  }
+  return success(!loads.empty());
+}
+
+/// Load the elements of `inp`, a view of a generic input with the shape of
+/// the source of `load`, that `load` reads, as a value of the shape of the
+/// result of `load` with the element type of `inp`. Inputs that are
+/// broadcast, transposed or of another type are loaded an element at a time.
+static Value loadPrologueInput(PatternRewriter &b, BufferLoadOp load,
+                               Value inp) {
+  Location loc = load.getLoc();
+  Type loadType = load.result().getType();
+  Type elementType = inp.getType().cast<MemRefType>().getElementType();
+
+  Value source;
+  ArrayAttr transforms;
+  std::tie(source, transforms) = untransform(b, inp);
+  ArrayAttr leftOob = load.leftOobDims();
+  ArrayAttr rightOob = load.rightOobDims();
+  if (transforms.empty() && elementType == getElementTypeOrSelf(loadType))
+    return b.create<BufferLoadOp>(loc, loadType, source, leftOob, rightOob,
+                                  load.coords());
+
+  std::tie(leftOob, rightOob) =
+      computeOobFromTransforms(b, transforms, {{leftOob, rightOob}});
+  auto vectorType = loadType.dyn_cast<VectorType>();
+  Type resultType = vectorType ? vectorType.clone(elementType) : elementType;
+
+  // Vector loads read consecutive elements of the last dimension.
+  size_t rank = load.coords().size();
+  SmallVector<int64_t, 5> bounds(rank, 1);
+  if (vectorType)
+    bounds.back() = vectorType.getNumElements();
+  Value zero = b.createOrFold<arith::ConstantIndexOp>(loc, 0);
+  SmallVector<Value, 5> linearInit(rank, zero);
+
+  auto loop = b.create<TransformingForOp>(
+      loc, ArrayRef<ValueRange>{load.coords(), linearInit},
+      ArrayRef<Attribute>{transforms, b.getArrayAttr({})}, bounds,
+      /*strides=*/llvm::None, /*forceUnroll=*/true, /*useIndexDiffs=*/true,
+      createZeroConstantOp(b, loc, resultType));
+  {
+    OpBuilder::InsertionGuard guard(b);
+    b.setInsertionPointToStart(loop.getBody());
+    Value toYield =
+        b.create<BufferLoadOp>(loc, elementType, source, leftOob, rightOob,
+                               loop.getLowerCoords(/*domain=*/0));
+    if (vectorType)
+      toYield = b.create<vector::InsertElementOp>(
+          loc, toYield, loop.getIterArgs()[0],
+          loop.getLowerCoords(/*domain=*/1).back());
+    b.create<miopen::YieldOp>(loc, toYield);
+  }
+  return loop.getResults()[0];
+}
+
+/// Apply the scalar body of `laGeneric` to each element of `inputs`, values
+/// shaped like `resultType`, returning the results as a `resultType`.
+static Value applyGenericBody(PatternRewriter &b, Location loc,
+                              linalg::GenericOp laGeneric, ValueRange inputs,
+                              Type resultType) {
+  Block &body = laGeneric.getRegion().front();
+  auto vectorType = resultType.dyn_cast<VectorType>();
+  int64_t length = vectorType ? vectorType.getNumElements() : 1;
+
+  Value result = createZeroConstantOp(b, loc, resultType);
+  for (int64_t i = 0; i < length; ++i) {
+    Value pos;
+    if (vectorType)
+      pos = b.createOrFold<arith::ConstantIndexOp>(loc, i);
+    BlockAndValueMapping mapping;
+    for (auto pair : llvm::zip(inputs, body.getArguments())) {
+      Value element = std::get<0>(pair);
+      if (vectorType)
+        element = b.create<vector::ExtractElementOp>(loc, element, pos);
+      mapping.map(std::get<1>(pair), element);
+    }
+    for (Operation &op : body.without_terminator())
+      b.clone(op, mapping);
+    Value computed =
+        mapping.lookupOrDefault(body.getTerminator()->getOperand(0));
+    result = vectorType
+                 ? b.create<vector::InsertElementOp>(loc, computed, result, pos)
+                 : computed;
+  }
+  return result;
+}
+
+/// Returns whether the coordinates of `load` are within the bounds of its
+/// source along the dimensions it checks, or a null value if it checks none.
+static Value isLoadInBounds(PatternRewriter &b, BufferLoadOp load) {
+  Location loc = load.getLoc();
+  ArrayRef<int64_t> shape =
+      load.source().getType().cast<MemRefType>().getShape();
+  llvm::SmallDenseSet<uint32_t> oobDims;
+  for (llvm::APInt dim : load.leftOobDims().getAsValueRange<IntegerAttr>())
+    oobDims.insert(dim.getZExtValue());
+  for (llvm::APInt dim : load.rightOobDims().getAsValueRange<IntegerAttr>())
+    oobDims.insert(dim.getZExtValue());
+
+  Value inBounds;
+  for (uint32_t dim = 0, e = shape.size(); dim < e; ++dim) {
+    if (!oobDims.contains(dim))
+      continue;
+    // Negative coordinates are out of bounds as unsigned ones too.
+    Value test = b.create<arith::CmpIOp>(
+        loc, arith::CmpIPredicate::ult, load.coords()[dim],
+        b.createOrFold<arith::ConstantIndexOp>(loc, shape[dim]));
+    inBounds = inBounds ? b.create<arith::AndIOp>(loc, inBounds, test) : test;
+  }
+  return inBounds;
+}
+
+LogicalResult
+MILAPrologueRewritePattern::matchAndRewrite(linalg::GenericOp laGeneric,
+                                            PatternRewriter &b) const {
+  // 0. Only elementwise generics with one identity-indexed output, which
+  // they don't read, whose other inputs can be viewed in its shape.
+  for (StringRef iterType :
+       laGeneric.iterator_types().getAsValueRange<StringAttr>())
+    if (iterType != "parallel")
+      return failure();
+  if (laGeneric.outputs().size() != 1 || laGeneric.hasIndexSemantics())
+    return failure();
+  if (laGeneric.payloadUsesValueFromOperand(laGeneric.getOutputOperand(0)))
+    return failure();
+
+  SmallVector<AffineMap> idxMaps = laGeneric.getIndexingMaps();
+  AffineMap outIdxMap = idxMaps.back();
+  if (!outIdxMap.isIdentity())
+    return failure();
+  for (AffineMap inpIdxMap : ArrayRef<AffineMap>(idxMaps).drop_back())
+    if (!checkCompatibleTypes(inpIdxMap, outIdxMap))
+      return failure();
+  // The inputs are read with buffer loads.
+  for (Value inp : laGeneric.inputs()) {
+    Type type = inp.getType().cast<MemRefType>().getElementType();
+    if (!type.isF32() && !type.isF16() && !type.isBF16() &&
+        !type.isInteger(8) && !type.isInteger(32))
+      return failure();
+  }
+
+  // 1. The output has to be a buffer that only the gemm's global loads read.
+  Value out = *laGeneric.outputs().begin();
+  if (!out.getDefiningOp<memref::AllocOp>())
+    return failure();
+  SmallVector<BufferLoadOp, 4> loads;
+  if (failed(collectPrologueLoads(laGeneric, out, loads)))
+    return failure();
+
+  // 2. View the inputs in the shape of the output before the generic, which
+  // all the loads come after.
+  auto outType = out.getType().cast<MemRefType>();
+  SmallVector<Value, 4> views;
+  {
+    PatternRewriter::InsertionGuard guard(b);
+    b.setInsertionPoint(laGeneric);
+    for (auto pair : llvm::zip(laGeneric.inputs(), idxMaps)) {
+      Value view;
+      AffineMap inpIdxMap;
+      std::tie(view, inpIdxMap) =
+          makeTransposeTransform(b, std::get<0>(pair), std::get<1>(pair));
+      views.push_back(makeBroadcast(b, outType, view, inpIdxMap));
+    }
+  }
+
+  // 3. Compute each loaded value from the inputs in place of the load,
+  // keeping the zeroes out-of-bounds loads return for padding.
+  for (BufferLoadOp load : loads) {
+    PatternRewriter::InsertionGuard guard(b);
+    b.setInsertionPoint(load);
+    Location loc = load.getLoc();
+    Type loadType = load.result().getType();
+
+    SmallVector<Value, 4> inputs;
+    for (Value view : views)
+      inputs.push_back(loadPrologueInput(b, load, view));
+    Value computed = applyGenericBody(b, loc, laGeneric, inputs, loadType);
+    if (Value inBounds = isLoadInBounds(b, load))
+      computed = b.create<arith::SelectOp>(
+          loc, inBounds, computed, createZeroConstantOp(b, loc, loadType));
+    b.replaceOp(load, computed);
+  }
+
+  // 4. Nothing reads the output buffer anymore, which leaves it and its views
+  // dead once the generic and the deallocation are gone.
+  for (Operation *user : llvm::make_early_inc_range(out.getUsers()))
+    if (isa<memref::DeallocOp>(user))
+      b.eraseOp(user);
+  b.eraseOp(laGeneric);
+  return success();
+}
+
 void MIOpenLinalgAlignPass::runOnOperation() {
   MLIRContext *ctx = &getContext();
   RewritePatternSet patterns(ctx);
-  patterns.add<MILARewritePattern>(ctx);
+  patterns.add<MILARewritePattern, MILAPrologueRewritePattern>(ctx);
   if (failed(applyPatternsAndFoldGreedily(getOperation(), std::move(patterns))))
     signalPassFailure();
 }
@@ -21,11 +21,14 @@
 
 #include "PassDetail.h"
 
+#include "mlir/Conversion/GPUCommon/GPUCommonPass.h"
 #include "mlir/Dialect/GPU/Transforms/Passes.h"
 #include "mlir/Dialect/LLVMIR/LLVMDialect.h"
 #include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/MIOpen/utility/KernelResources.h"
 #include "mlir/Transforms/GreedyPatternRewriteDriver.h"
 
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallVector.h"
 
 using namespace mlir;
@@ -67,9 +70,35 @@ struct MIOpenApplyImplPass
                   b.getNamedAttr("grid_size", func->getAttr("grid_size")),
                   b.getNamedAttr("block_size", func->getAttr("block_size")),
                   b.getNamedAttr("binary", binaryAttr)};
-
-              miopenFunc->setAttr(
-                  "targets", b.getArrayAttr({b.getDictionaryAttr(attributes)}));
+              if (auto resourcesAttr =
+                      func->getAttr(miopen::kKernelResourcesAttrName))
+                attributes.push_back(b.getNamedAttr(
+                    miopen::kKernelResourcesAttrName, resourcesAttr));
+              for (StringRef name :
+                   {"tuning_source", "perf_config", "conv_solver"})
+                if (auto attr = func->getAttr(name))
+                  attributes.push_back(b.getNamedAttr(name, attr));
+              // The binary was shared with an identical kernel of another
+              // name, see KernelCache.cpp.
+              if (auto symbolAttr = gpuMod->getAttr("miopen.kernel_symbol"))
+                attributes.push_back(b.getNamedAttr("kernel", symbolAttr));
+              if (gpuMod->hasAttr(kGpuBarePtrCallConvAttrName))
+                attributes.push_back(b.getNamedAttr(
+                    kGpuBarePtrCallConvAttrName, b.getUnitAttr()));
+
+              // Kernels compiled for several chips add a target each
+              SmallVector<Attribute, 2> targets;
+              if (auto targetsAttr =
+                      miopenFunc->getAttrOfType<ArrayAttr>("targets"))
+                llvm::copy_if(
+                    targetsAttr, std::back_inserter(targets),
+                    [&](Attribute target) {
+                      auto dict = target.dyn_cast<DictionaryAttr>();
+                      return !dict ||
+                             dict.get("arch") != gpuMod->getAttr("arch");
+                    });
+              targets.push_back(b.getDictionaryAttr(attributes));
+              miopenFunc->setAttr("targets", b.getArrayAttr(targets));
             }
           }
         });
@@ -0,0 +1,278 @@
+//===- AssignStreams.cpp - Map async kernel chains onto streams -----------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// This pass decides which stream each asynchronous GPU op of a host function
+// runs on. Left alone, the GPU to LLVM lowering runs an op on the stream of
+// its only dependency, so that ops depending on the same token serialize on
+// one stream, and gives every op with no or several dependencies a stream of
+// its own. Here, an op continues the stream of one of its dependencies when
+// that stream has not moved on since, and otherwise takes one of a bounded
+// number of streams, preferring streams whose work it already depends on.
+// Its other dependencies become events the stream waits for.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Conversion/GPUCommon/GPUCommonPass.h"
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/IR/Builders.h"
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "miopen-assign-streams"
+
+using namespace mlir;
+
+namespace {
+struct Stream {
+  /// The token of the last op on the stream.
+  gpu::AsyncOpInterface tail;
+  /// When the stream was last given an op, for picking the least recently
+  /// used one.
+  unsigned lastUse;
+  /// Set once the stream was synchronized with, which destroys it, or its
+  /// tokens were used in ways this pass does not follow.
+  bool retired = false;
+  bool synchronized = false;
+};
+
+/// Assigns the streams of the asynchronous ops of one block.
+class StreamAssignment {
+public:
+  StreamAssignment(Block &block, unsigned numStreams)
+      : block(block), numStreams(numStreams) {}
+
+  void run();
+
+private:
+  /// The tokens of ops and of values from elsewhere that `token` stands for,
+  /// looking through the gpu.wait async ops of the block.
+  void resolve(Value token, llvm::SetVector<Value> &tokens) const;
+  /// Whether a token of the block is used other than by the async ops and
+  /// waits of the block.
+  bool escapes(Value token) const;
+  gpu::AsyncOpInterface getNode(Value token) const {
+    auto node = token.getDefiningOp<gpu::AsyncOpInterface>();
+    return node && indices.count(node) ? node : gpu::AsyncOpInterface();
+  }
+  bool isAncestor(gpu::AsyncOpInterface ancestor,
+                  gpu::AsyncOpInterface node) const {
+    return ancestor == node ||
+           ancestors.find(node)->second.test(indices.lookup(ancestor));
+  }
+
+  void assign(gpu::AsyncOpInterface node);
+  void synchronize(gpu::WaitOp wait);
+  Stream &pickStream(gpu::AsyncOpInterface node,
+                     const llvm::SetVector<Value> &deps);
+
+  Block &block;
+  unsigned numStreams;
+  DenseMap<Operation *, unsigned> indices;
+  DenseMap<Operation *, llvm::BitVector> ancestors;
+  DenseMap<Operation *, Stream *> streamOf;
+  // Held by pointer, as streamOf points at them
+  SmallVector<std::unique_ptr<Stream>> streams;
+  unsigned numUses = 0;
+};
+
+struct MIOpenAssignStreamsPass
+    : public MIOpenAssignStreamsPassBase<MIOpenAssignStreamsPass> {
+  MIOpenAssignStreamsPass() = default;
+  MIOpenAssignStreamsPass(unsigned numStreams) {
+    this->numStreams = numStreams;
+  }
+  void runOnOperation() override;
+};
+} // end anonymous namespace
+
+void StreamAssignment::resolve(Value token,
+                               llvm::SetVector<Value> &tokens) const {
+  auto wait = token.getDefiningOp<gpu::WaitOp>();
+  if (!wait || wait->getBlock() != &block) {
+    tokens.insert(token);
+    return;
+  }
+  for (Value dependency : wait.asyncDependencies())
+    resolve(dependency, tokens);
+}
+
+bool StreamAssignment::escapes(Value token) const {
+  return llvm::any_of(token.getUsers(), [&](Operation *user) {
+    if (user->getBlock() != &block)
+      return true;
+    if (auto wait = dyn_cast<gpu::WaitOp>(user))
+      return wait.asyncToken() && escapes(wait.asyncToken());
+    return !indices.count(user);
+  });
+}
+
+Stream &StreamAssignment::pickStream(gpu::AsyncOpInterface node,
+                                     const llvm::SetVector<Value> &deps) {
+  // A stream that last ran a dependency, or else work the op depends on
+  // anyway, orders the op after no more than it has to be
+  for (Value dep : deps)
+    if (gpu::AsyncOpInterface depNode = getNode(dep)) {
+      Stream *stream = streamOf.lookup(depNode);
+      if (stream && !stream->retired && stream->tail == depNode)
+        return *stream;
+    }
+  Stream *leastRecent = nullptr;
+  unsigned numLive = 0;
+  for (std::unique_ptr<Stream> &stream : streams) {
+    if (stream->retired)
+      continue;
+    if (isAncestor(stream->tail, node))
+      return *stream;
+    ++numLive;
+    if (!leastRecent || stream->lastUse < leastRecent->lastUse)
+      leastRecent = stream.get();
+  }
+  if (leastRecent && numLive >= numStreams)
+    return *leastRecent;
+  streams.push_back(std::make_unique<Stream>());
+  return *streams.back();
+}
+
+void StreamAssignment::assign(gpu::AsyncOpInterface node) {
+  llvm::SetVector<Value> deps;
+  for (Value dependency : node.getAsyncDependencies())
+    resolve(dependency, deps);
+  llvm::BitVector &nodeAncestors = ancestors[node];
+  nodeAncestors.resize(indices.size());
+  for (Value dep : deps)
+    if (gpu::AsyncOpInterface depNode = getNode(dep)) {
+      nodeAncestors |= ancestors.find(depNode)->second;
+      nodeAncestors.set(indices.lookup(depNode));
+    }
+
+  Stream &stream = pickStream(node, deps);
+  gpu::AsyncOpInterface tail = stream.tail;
+  // Drop the dependencies that the stream or another dependency orders the
+  // op after already
+  SmallVector<Value, 4> events;
+  for (Value dep : deps) {
+    gpu::AsyncOpInterface depNode = getNode(dep);
+    if (depNode && tail && isAncestor(depNode, tail))
+      continue;
+    bool isImplied = depNode && llvm::any_of(deps, [&](Value other) {
+      gpu::AsyncOpInterface otherNode = getNode(other);
+      return otherNode && otherNode != depNode &&
+             isAncestor(depNode, otherNode);
+    });
+    if (!isImplied)
+      events.push_back(dep);
+  }
+
+  OpBuilder b(node);
+  Location loc = node.getLoc();
+  Type tokenType = b.getType<gpu::AsyncTokenType>();
+  Value dependency;
+  if (tail && events.empty()) {
+    dependency = tail.getAsyncToken();
+  } else if (tail) {
+    SmallVector<Value, 4> operands{tail.getAsyncToken()};
+    operands.append(events.begin(), events.end());
+    auto wait = b.create<gpu::WaitOp>(loc, tokenType, operands);
+    wait->setAttr(kGpuContinueStreamAttrName, b.getUnitAttr());
+    dependency = wait.asyncToken();
+  } else {
+    dependency = b.create<gpu::WaitOp>(loc, tokenType, events).asyncToken();
+  }
+  node->setOperand(node.getAsyncDependencies().getBeginOperandIndex(),
+                   dependency);
+
+  stream.tail = node;
+  stream.lastUse = numUses++;
+  streamOf[node] = &stream;
+  if (escapes(node.getAsyncToken()))
+    stream.retired = true;
+}
+
+void StreamAssignment::synchronize(gpu::WaitOp wait) {
+  llvm::SetVector<Value> deps;
+  for (Value dependency : wait.asyncDependencies())
+    resolve(dependency, deps);
+  // Waiting for a stream destroys it, so wait for all of its work, once
+  llvm::SetVector<Value> operands;
+  for (Value dep : deps) {
+    gpu::AsyncOpInterface depNode = getNode(dep);
+    if (!depNode) {
+      operands.insert(dep);
+      continue;
+    }
+    Stream *stream = streamOf.lookup(depNode);
+    if (stream->synchronized)
+      continue;
+    operands.insert(stream->tail.getAsyncToken());
+    stream->retired = stream->synchronized = true;
+  }
+  wait->setOperands(operands.getArrayRef());
+}
+
+void StreamAssignment::run() {
+  // Only ops with the single dependency the lowering expects are assigned.
+  // Others keep theirs, and their tokens count as coming from elsewhere.
+  SmallVector<Operation *> ops;
+  for (Operation &op : block) {
+    auto async = dyn_cast<gpu::AsyncOpInterface>(op);
+    if (!async || isa<gpu::WaitOp>(op))
+      continue;
+    if (async.getAsyncToken() && async.getAsyncDependencies().size() == 1)
+      indices.try_emplace(&op, indices.size());
+  }
+  if (indices.size() < 2)
+    return;
+
+  SmallVector<gpu::WaitOp> oldWaits;
+  for (Operation &op : llvm::make_early_inc_range(block)) {
+    if (indices.count(&op)) {
+      assign(cast<gpu::AsyncOpInterface>(op));
+    } else if (auto wait = dyn_cast<gpu::WaitOp>(op)) {
+      if (wait.asyncToken())
+        oldWaits.push_back(wait);
+      else
+        synchronize(wait);
+    }
+  }
+  for (gpu::WaitOp wait : llvm::reverse(oldWaits))
+    if (wait.asyncToken().use_empty())
+      wait.erase();
+
+  LLVM_DEBUG(llvm::dbgs() << "Assigned " << indices.size() << " ops to "
+                          << streams.size() << " streams\n");
+}
+
+void MIOpenAssignStreamsPass::runOnOperation() {
+  func::FuncOp func = getOperation();
+  if (func->hasAttr("kernel") || numStreams == 0)
+    return;
+  for (Block &block : func.getBody())
+    StreamAssignment(block, numStreams).run();
+}
+
+//===- Passes -------------------------------------------------------------===//
+//
+
+std::unique_ptr<Pass>
+mlir::miopen::createMIOpenAssignStreamsPass(unsigned numStreams) {
+  return std::make_unique<MIOpenAssignStreamsPass>(numStreams);
+}
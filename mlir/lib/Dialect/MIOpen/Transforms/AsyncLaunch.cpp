@@ -8,17 +8,21 @@
 //
 // This file implements the async.launch pattern rewriter that converts kernel
 // call ops to async.launch ops with inferred data-dependency converted to
-// explicit async.token based dependence graph.
+// explicit async.token based dependence graph. Kernels may take tensors or,
+// once bufferized, memrefs, whose launches are ordered by the reads and
+// writes of buffers that may alias.
 //
 //===----------------------------------------------------------------------===//
 
 #include "PassDetail.h"
+#include "mlir/Analysis/AliasAnalysis.h"
 #include "mlir/Dialect/Async/IR/Async.h"
 #include "mlir/Dialect/MIOpen/Passes.h"
 #include "mlir/IR/BlockAndValueMapping.h"
 #include "mlir/IR/Builders.h"
 #include "mlir/IR/PatternMatch.h"
 #include "mlir/IR/SymbolTable.h"
+#include "mlir/Interfaces/ViewLikeInterface.h"
 #include "mlir/Support/LLVM.h"
 #include "mlir/Transforms/RegionUtils.h"
 #include "llvm/ADT/TypeSwitch.h"
@@ -31,21 +35,109 @@ class MIOpenAsyncLaunchPass
   static bool isTerminator(Operation *op) {
     return op->mightHaveTrait<OpTrait::IsTerminator>();
   }
-  static bool hasSideEffects(Operation *op) {
-    return !MemoryEffectOpInterface::hasNoEffect(op);
+  // Collect the effects of `op` and of the ops nested in it. Fails when some
+  // of them aren't on values, such as those of calls to unknown functions,
+  // which could observe any kernel still in flight. The others only concern
+  // the kernels whose buffers alias their values.
+  static LogicalResult
+  collectEffects(Operation *op,
+                 SmallVectorImpl<MemoryEffects::EffectInstance> &effects) {
+    if (auto effectIf = dyn_cast<MemoryEffectOpInterface>(op)) {
+      size_t first = effects.size();
+      effectIf.getEffects(effects);
+      if (llvm::any_of(llvm::drop_begin(effects, first),
+                       [](MemoryEffects::EffectInstance &effect) {
+                         return !effect.getValue();
+                       }))
+        return failure();
+      if (!op->hasTrait<OpTrait::HasRecursiveSideEffects>())
+        return success();
+    } else if (!op->hasTrait<OpTrait::HasRecursiveSideEffects>()) {
+      return failure();
+    }
+    for (Region &region : op->getRegions())
+      for (Block &block : region)
+        for (Operation &nested : block)
+          if (!isTerminator(&nested) &&
+              failed(collectEffects(&nested, effects)))
+            return failure();
+    return success();
+  }
+
+  // Tell if the kernel `func` may write its memref argument `index`, through
+  // the views of it as well. Ops that don't tell their effects may write it.
+  static bool mayWriteArgument(func::FuncOp func, unsigned index) {
+    if (func.isExternal())
+      return true;
+    SmallVector<Value, 4> worklist{func.getArgument(index)};
+    while (!worklist.empty()) {
+      Value value = worklist.pop_back_val();
+      for (Operation *user : value.getUsers()) {
+        if (auto view = dyn_cast<ViewLikeOpInterface>(user)) {
+          if (view.getViewSource() == value) {
+            llvm::append_range(worklist, user->getResults());
+            continue;
+          }
+        }
+        if (isTerminator(user))
+          continue;
+        auto effectIf = dyn_cast<MemoryEffectOpInterface>(user);
+        if (!effectIf)
+          return true;
+        SmallVector<MemoryEffects::EffectInstance, 2> effects;
+        effectIf.getEffectsOnValue(value, effects);
+        if (llvm::any_of(effects, [](MemoryEffects::EffectInstance &effect) {
+              return !isa<MemoryEffects::Read>(effect.getEffect());
+            }))
+          return true;
+      }
+    }
+    return false;
   }
 
+  // A buffer a launch that hasn't been awaited yet reads or writes.
+  struct BufferUse {
+    Value buffer;
+    Value token;
+    bool written;
+  };
+
+  AliasAnalysis *aliasAnalysis = nullptr;
   llvm::SmallDenseMap<Value, Value> res2tokens;
   llvm::SmallDenseSet<Value> currentTokens;
+  SmallVector<BufferUse, 8> bufferUses;
+
+  // The tokens of the launches using buffers that alias `buffer`, among
+  // those that write them unless `written`.
+  SmallVector<Value, 4> getConflictingTokens(Value buffer, bool written) {
+    SmallVector<Value, 4> tokens;
+    for (BufferUse &use : bufferUses)
+      if ((written || use.written) &&
+          !aliasAnalysis->alias(buffer, use.buffer).isNo() &&
+          !llvm::is_contained(tokens, use.token))
+        tokens.push_back(use.token);
+    return tokens;
+  }
+
+  // Host-synchronize with the launch of `token` before `op`.
+  void await(Operation *op, Value token) {
+    createWaitOp(op, token);
+    currentTokens.erase(token);
+    llvm::erase_if(bufferUses,
+                   [&](BufferUse &use) { return use.token == token; });
+  }
 
   // If `op` implements the AsyncOpInterface, insert a `gpu.wait async` to
   // create a current token (unless it already exists), and 'thread' that token
   // through the `op` so that it executes asynchronously.
   //
-  // If `op` is a terminator or an op with side-effects, insert a `gpu.wait` to
-  // host-synchronize execution. A `!gpu.async.token` will therefore only be
-  // used inside of its block and GPU execution will always synchronize with
-  // the host at block boundaries.
+  // If `op` is a terminator or an op with side-effects that aren't limited to
+  // values of its own, insert a `gpu.wait` to host-synchronize execution. A
+  // `!gpu.async.token` will therefore only be used inside of its block and GPU
+  // execution will always synchronize with the host at block boundaries.
+  // Allocations, stores to other buffers and the like leave the launches in
+  // flight, while reads and writes of the buffers of launches wait for the
+  // launches they conflict with.
   LogicalResult visit(Operation *op) {
     if (auto call = dyn_cast<func::CallOp>(op)) {
       CallOpInterface callIf(call);
@@ -60,17 +152,24 @@ class MIOpenAsyncLaunchPass
     }
     // Insert host sync before operation that reads an async::value
     for (auto operand : op->getOperands()) {
-      if (auto itoken = res2tokens.lookup(operand)) {
-        createWaitOp(op, itoken);
-        currentTokens.erase(itoken);
-      }
+      if (auto itoken = res2tokens.lookup(operand))
+        await(op, itoken);
     }
-    // Insert host synchronization before terminator or op with side effects.
-    if (isTerminator(op) || hasSideEffects(op)) {
+    // Insert host synchronization before terminator or op with side effects
+    // that could observe the kernels.
+    SmallVector<MemoryEffects::EffectInstance, 4> effects;
+    if (isTerminator(op) || failed(collectEffects(op, effects))) {
       for (auto token : currentTokens) {
         createWaitOp(op, token);
       }
       currentTokens.clear();
+      bufferUses.clear();
+      return success();
+    }
+    for (MemoryEffects::EffectInstance &effect : effects) {
+      bool written = !isa<MemoryEffects::Read>(effect.getEffect());
+      for (Value token : getConflictingTokens(effect.getValue(), written))
+        await(op, token);
     }
 
     return success();
@@ -82,17 +181,26 @@ class MIOpenAsyncLaunchPass
     // builder.setInsertionPoint(op);
     // Find tokens related to inputs
     SmallVector<Value, 4> tokens;
-    for (auto operand : op.getOperands()) {
-      // Disallow memrefs to avoid aliasing
-      if (operand.getType().isa<MemRefType>())
-        return op.emitOpError("unsupported MemRefTypes");
-
-      if (auto itoken = res2tokens.lookup(operand)) {
-        tokens.push_back(itoken);
-
-        // remove tokens that are consumed, the chain will satisfy the
-        // final block await
-        currentTokens.erase(itoken);
+    auto addDependency = [&](Value token) {
+      if (llvm::is_contained(tokens, token))
+        return;
+      tokens.push_back(token);
+      // remove tokens that are consumed, the chain will satisfy the
+      // final block await
+      currentTokens.erase(token);
+    };
+    SmallVector<BufferUse, 4> uses;
+    for (auto &operand : op->getOpOperands()) {
+      Value value = operand.get();
+      if (auto itoken = res2tokens.lookup(value))
+        addDependency(itoken);
+      // Reads of a buffer follow its last writes, and writes follow its
+      // reads and writes (RAW, WAR, WAW).
+      if (value.getType().isa<MemRefType>()) {
+        bool written = mayWriteArgument(func, operand.getOperandNumber());
+        for (Value token : getConflictingTokens(value, written))
+          addDependency(token);
+        uses.push_back({value, Value(), written});
       }
     }
 
@@ -106,8 +214,15 @@ class MIOpenAsyncLaunchPass
     results = results.drop_front();
 
     // associate all results with the result token
-    for (auto res : results)
+    for (auto res : results) {
       res2tokens.insert({res, token});
+      if (res.getType().isa<MemRefType>())
+        uses.push_back({res, Value(), /*written=*/true});
+    }
+    for (BufferUse &use : uses) {
+      use.token = token;
+      bufferUses.push_back(use);
+    }
 
     currentTokens.insert(token);
 
@@ -133,6 +248,7 @@ public:
   // inserts the necessary synchronization (as gpu.wait ops). Assumes sequential
   // execution semantics and that no GPU ops are asynchronous yet.
   void runOnOperation() override {
+    aliasAnalysis = &getAnalysis<AliasAnalysis>();
     auto walker = [this](Block *block) {
       for (Operation &op : make_early_inc_range(*block)) {
         if (failed(visit(&op)))
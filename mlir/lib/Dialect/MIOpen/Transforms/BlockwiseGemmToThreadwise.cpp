@@ -25,13 +25,14 @@
 #include "mlir/Dialect/MIOpen/MIOpen.h"
 #include "mlir/Dialect/MIOpen/Passes.h"
 #include "mlir/Dialect/MIOpen/TransformMapBuilder.h"
+#include "mlir/Dialect/MIOpen/utility/OrderedRewrite.h"
 #include "mlir/Dialect/MIOpen/utility/builderUtils.h"
 #include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
 
 #include "mlir/Dialect/Affine/IR/AffineOps.h"
 #include "mlir/Dialect/MIOpen/XdlopsCodeSelection.h"
 #include "mlir/Dialect/MemRef/IR/MemRef.h"
-#include "mlir/Transforms/DialectConversion.h"
+#include "mlir/IR/PatternMatch.h"
 
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/Debug.h"
@@ -53,11 +54,10 @@ struct MIOpenLowerBlockwiseGemmToThreadwisePass
 // Fill lowering.
 //===----------------------------------------------------------------------===//
 
-struct FillRewritePattern : public OpConversionPattern<FillOp> {
-  using OpConversionPattern<FillOp>::OpConversionPattern;
+struct FillRewritePattern : public OpRewritePattern<FillOp> {
+  using OpRewritePattern<FillOp>::OpRewritePattern;
 
-  LogicalResult matchAndRewrite(FillOp op, FillOpAdaptor adaptor,
-                                ConversionPatternRewriter &b) const override {
+  LogicalResult matchAndRewrite(FillOp op, PatternRewriter &b) const override {
     Location loc = op.getLoc();
     auto inputType = op.input().getType().cast<MemRefType>();
     ArrayRef<int64_t> inputShape = inputType.getShape();
@@ -65,7 +65,7 @@ struct FillRewritePattern : public OpConversionPattern<FillOp> {
     llvm::SmallVector<int64_t> strides(inputShape.size(), 1);
 
     buildAffineLoopNest(b, loc, lbs, inputShape, strides,
-                        [value = adaptor.value(), input = adaptor.input()](
+                        [value = op.value(), input = op.input()](
                             OpBuilder &b, Location loc, ValueRange ivs) {
                           b.create<memref::StoreOp>(loc, value, input, ivs);
                         });
@@ -80,12 +80,11 @@ struct FillRewritePattern : public OpConversionPattern<FillOp> {
 //===----------------------------------------------------------------------===//
 
 struct BlockwiseGemmRewritePattern
-    : public OpConversionPattern<BlockwiseGemmOp> {
-  using OpConversionPattern<BlockwiseGemmOp>::OpConversionPattern;
+    : public OpRewritePattern<BlockwiseGemmOp> {
+  using OpRewritePattern<BlockwiseGemmOp>::OpRewritePattern;
 
   LogicalResult matchAndRewrite(BlockwiseGemmOp op,
-                                BlockwiseGemmOpAdaptor adaptor,
-                                ConversionPatternRewriter &b) const override {
+                                PatternRewriter &b) const override {
     Location loc = op.getLoc();
 
     // Prepare some useful constants.
@@ -143,21 +142,34 @@ struct BlockwiseGemmRewritePattern
     Value matrixA, matrixB;
     ArrayAttr transformsA, transformsB;
     std::tie(matrixA, transformsA) = untransform(
-        b, adaptor.matrixA(), b.getArrayAttr({strideLDSBufferAAttr}));
+        b, op.matrixA(), b.getArrayAttr({strideLDSBufferAAttr}));
     std::tie(matrixB, transformsB) = untransform(
-        b, adaptor.matrixB(), b.getArrayAttr({strideLDSBufferBAttr}));
+        b, op.matrixB(), b.getArrayAttr({strideLDSBufferBAttr}));
 
     int64_t threadANumRegisters = kPerThread * mC * kPack;
     int64_t threadBNumRegisters = kPerThread * nC * kPack;
 
+    // The thread tiles are converted to the accumulator type as they are
+    // copied, unless the chip has a packed dot instruction that multiplies
+    // them as they are and accumulates in the wider type.
+    Type ldsElementType = blockAType.getElementType();
+    Type registerType = elementType;
+    StringRef arch;
+    if (auto archAttr = op->getAttrOfType<StringAttr>("arch"))
+      arch = archAttr.getValue();
+    int64_t dotWidth = getDotProductWidth(ldsElementType, arch);
+    if (ldsElementType != elementType && dotWidth > 1 &&
+        (kPerThread * kPack) % dotWidth == 0)
+      registerType = ldsElementType;
+
     // Alloc register for thread_a and thread_b.
     auto threadARegisterMemRefType =
-        MemRefType::get(threadANumRegisters, elementType, {},
+        MemRefType::get(threadANumRegisters, registerType, {},
                         gpu::GPUDialect::getPrivateAddressSpace());
     auto threadAAllocOp = b.create<GpuAllocOp>(loc, threadARegisterMemRefType);
 
     auto threadBRegisterMemRefType =
-        MemRefType::get(threadBNumRegisters, elementType, {},
+        MemRefType::get(threadBNumRegisters, registerType, {},
                         gpu::GPUDialect::getPrivateAddressSpace());
     auto threadBAllocOp = b.create<GpuAllocOp>(loc, threadBRegisterMemRefType);
 
@@ -176,7 +188,7 @@ struct BlockwiseGemmRewritePattern
     LLVM_DEBUG(llvm::dbgs() << "Outer loop:\n "
                             << "k =  " << k << "\n"
                             << " kPerThread = " << kPerThread << "\n");
-    auto loopOp = b.replaceOpWithNewOp<AffineForOp>(op, 0, k, kPerThread);
+    auto loopOp = b.create<AffineForOp>(loc, 0, k, kPerThread);
     OpBuilder::InsertionGuard guard(b);
     b.setInsertionPointToStart(loopOp.getBody());
     Value kOffset = loopOp.getInductionVar();
@@ -194,7 +206,7 @@ struct BlockwiseGemmRewritePattern
       b.setInsertionPointToStart(copyALoop.getBody());
       Value aCopy = b.create<memref::LoadOp>(
           loc, matrixA, copyALoop.getLowerCoords(/*domain=*/0));
-      Value aCast = createTypeConversionOp(b, loc, aCopy, elementType);
+      Value aCast = createTypeConversionOp(b, loc, aCopy, registerType);
       b.create<memref::StoreOp>(loc, aCast, threadAAllocOp,
                                 copyALoop.getLowerCoords(/*domain=*/1));
     }
@@ -211,7 +223,7 @@ struct BlockwiseGemmRewritePattern
       b.setInsertionPointToStart(copyBLoop.getBody());
       Value bCopy = b.create<memref::LoadOp>(
           loc, matrixB, copyBLoop.getLowerCoords(/*domain=*/0));
-      Value bCast = createTypeConversionOp(b, loc, bCopy, elementType);
+      Value bCast = createTypeConversionOp(b, loc, bCopy, registerType);
       b.create<memref::StoreOp>(loc, bCast, threadBAllocOp,
                                 copyBLoop.getLowerCoords(/*domain=*/1));
     }
@@ -221,9 +233,13 @@ struct BlockwiseGemmRewritePattern
     Value reshapedBRegisters = reshapeBuffer(
         b, loc, threadBAllocOp, {"k", "n", "kpack"}, {kPerThread, nC, kPack});
     // Actually do the gemm - this goes inside the look over kOffset
-    b.create<ThreadwiseGemmOp>(loc, reshapedARegisters, reshapedBRegisters,
-                               op.matrixC());
+    auto threadwiseGemmOp = b.create<ThreadwiseGemmOp>(
+        loc, reshapedARegisters, reshapedBRegisters, op.matrixC());
+    if (!arch.empty())
+      threadwiseGemmOp->setAttr("arch", op->getAttr("arch"));
 
+    // The op is only erased now that nothing reads its operands anymore.
+    b.eraseOp(op);
     return success();
   }
 };
@@ -233,12 +249,11 @@ struct BlockwiseGemmRewritePattern
 //===----------------------------------------------------------------------===//
 
 struct BlockwiseGemmV2RewritePattern
-    : public OpConversionPattern<BlockwiseGemmV2Op> {
-  using OpConversionPattern<BlockwiseGemmV2Op>::OpConversionPattern;
+    : public OpRewritePattern<BlockwiseGemmV2Op> {
+  using OpRewritePattern<BlockwiseGemmV2Op>::OpRewritePattern;
 
   LogicalResult matchAndRewrite(BlockwiseGemmV2Op op,
-                                BlockwiseGemmV2OpAdaptor adaptor,
-                                ConversionPatternRewriter &b) const override {
+                                PatternRewriter &b) const override {
     Location loc = op.getLoc();
 
     int64_t M = op->getAttr("m").template cast<IntegerAttr>().getInt();
@@ -253,18 +268,6 @@ struct BlockwiseGemmV2RewritePattern
             ? op->getAttr("kpack").template cast<IntegerAttr>().getInt()
             : 1;
 
-    // Original C++ logic.
-    // static constexpr index_t MRepeats = (GemmMPerWave > 64) ? (GemmMPerWave /
-    // 64) : 1; static constexpr index_t NRepeats = (GemmNPerWave > 64) ?
-    // (GemmNPerWave / 64) : 1; static constexpr index_t MPerXdlops =
-    // (GemmMPerWave > 64) ? 64 : GemmMPerWave; static constexpr index_t
-    // NPerXdlops = (GemmNPerWave > 64) ? 64 : GemmNPerWave;
-
-    int64_t MRepeats = (MPerWave > 64) ? (MPerWave / 64) : 1;
-    int64_t NRepeats = (NPerWave > 64) ? (NPerWave / 64) : 1;
-    int64_t MPerXdlops = (MPerWave > 64) ? 64 : MPerWave;
-    int64_t NPerXdlops = (NPerWave > 64) ? 64 : NPerWave;
-
     int64_t ldsOffsetA = op.ldsBufferOffsetA().getSExtValue();
     int64_t ldsOffsetB = op.ldsBufferOffsetB().getSExtValue();
 
@@ -272,7 +275,7 @@ struct BlockwiseGemmV2RewritePattern
            "LDS buffer segment for A is kpack-aligned");
     assert(ldsOffsetB % KPack == 0 &&
            "LDS buffer segment for B is kpack-aligned");
-    auto dataType = adaptor.matrixA()
+    auto dataType = op.matrixA()
                         .getType()
                         .template cast<MemRefType>()
                         .getElementType();
@@ -286,28 +289,58 @@ struct BlockwiseGemmV2RewritePattern
     // end) we must divide it by KPack here. Fortunately, this offset will be
     // KPack-alligned and so this is safe
     Value aBase =
-        b.create<AddIOp>(loc, adaptor.waveOffsetA(),
+        b.create<AddIOp>(loc, op.waveOffsetA(),
                          b.create<ConstantIndexOp>(loc, ldsOffsetA / KPack));
     Value bBase =
-        b.create<AddIOp>(loc, adaptor.waveOffsetB(),
+        b.create<AddIOp>(loc, op.waveOffsetB(),
                          b.create<ConstantIndexOp>(loc, ldsOffsetB / KPack));
 
-    XdlopsCodeSelection xcs =
-        XdlopsCodeSelection::get(dataType, MPerWave, NPerWave, b);
+    // The tiles may have been stored with an XOR swizzle of their rows of
+    // M (or N) * KPack elements, which the reads undo.
+    auto getSwizzle = [&](StringRef attrName, int64_t rowLength) {
+      LdsSwizzle swizzle;
+      swizzle.rowLength = rowLength;
+      if (auto params = op->getAttrOfType<ArrayAttr>(attrName)) {
+        swizzle.granule = params[0].cast<IntegerAttr>().getInt();
+        swizzle.period = params[1].cast<IntegerAttr>().getInt();
+      }
+      return swizzle;
+    };
+    LdsSwizzle swizzleA = getSwizzle("lds_swizzle_a", M * KPack);
+    LdsSwizzle swizzleB = getSwizzle("lds_swizzle_b", N * KPack);
+
+    StringRef arch;
+    if (auto archAttr = op->getAttrOfType<StringAttr>("arch"))
+      arch = archAttr.getValue();
+    FailureOr<XdlopsCodeSelection> maybeXcs = XdlopsCodeSelection::get(
+        dataType, MPerWave, NPerWave, arch, obtainFp8Format(op),
+        op->hasAttr("xf32"), op->hasAttr("sparse"));
+    if (failed(maybeXcs))
+      return op.emitOpError("no XDLOPS instruction for a ")
+             << MPerWave << "x" << NPerWave << " wave tile of " << dataType;
+    XdlopsCodeSelection xcs = *maybeXcs;
 
     // Extract values from XdlopsCodeSelection.
     amdgpu::MFMAInstr mfmaInstr = xcs.instr;
     LLVM_DEBUG(llvm::dbgs() << "Selected xdlop: "
-                            << amdgpu::stringifyMFMAInstr(mfmaInstr) << "\n");
-    SmallVector<SmallVector<unsigned, 3>, 2> imms = xcs.imms;
+                            << (xcs.isWmma
+                                    ? StringRef("wmma")
+                                    : amdgpu::stringifyMFMAInstr(mfmaInstr))
+                            << "\n");
     Type argType = xcs.argType;
 
+    // Each xdlops_gemm_v2 handles a MPerXdlops x NPerXdlops part of the wave
+    // tile, which repeats MRepeats x NRepeats times.
+    int64_t MRepeats = xcs.MRepeats;
+    int64_t NRepeats = xcs.NRepeats;
+    int64_t MPerXdlops = xcs.MPerXdlops;
+    int64_t NPerXdlops = xcs.NPerXdlops;
+
     int64_t num_threads_blk = xcs.num_threads_blk;
     int64_t num_input_blks = xcs.num_input_blks;
-    int64_t num_output_blks = xcs.num_output_blks;
     int64_t k_base = xcs.k_base;
 
-    bool IsKReduction = (num_output_blks == 1) && (num_input_blks > 1);
+    bool IsKReduction = xcs.isKReduction;
 
     if (KPack > 1 && (KPack < k_base || KPack % k_base != 0)) {
       llvm_unreachable(
@@ -325,16 +358,21 @@ struct BlockwiseGemmV2RewritePattern
     // constexpr index_t BStride = KPerThread * KRepeats;
 
     auto tid = b.create<WorkitemIdOp>(loc, b.getIndexType());
-    constexpr int64_t waveSize = 64;
-    auto laneId =
-        b.create<RemUIOp>(loc, tid, b.create<ConstantIndexOp>(loc, waveSize));
+    Value laneId = b.create<RemUIOp>(
+        loc, tid, b.create<ConstantIndexOp>(loc, xcs.waveSize));
+    // The input blocks of WMMA are copies of the same rows of A and columns
+    // of B, which every block of lanes loads.
+    Value inputLaneId = laneId;
+    if (xcs.isWmma)
+      inputLaneId = b.create<RemUIOp>(
+          loc, laneId, b.create<ConstantIndexOp>(loc, num_threads_blk));
 
     LLVM_DEBUG(llvm::dbgs()
                << "argVectorType: " << argType << "\n"
                << "k_base: " << k_base << "\n"
                << "K: " << K << "\n"
-               << "bufferA type: " << adaptor.bufferA().getType() << "\n"
-               << "bufferB type: " << adaptor.bufferB().getType() << "\n");
+               << "bufferA type: " << op.bufferA().getType() << "\n"
+               << "bufferB type: " << op.bufferB().getType() << "\n");
 
     auto MConstantOp = b.create<ConstantIndexOp>(loc, M);
     auto NConstantOp = b.create<ConstantIndexOp>(loc, N);
@@ -343,16 +381,14 @@ struct BlockwiseGemmV2RewritePattern
     auto MPerXdlopsConstantOp = b.create<ConstantIndexOp>(loc, MPerXdlops);
     auto NPerXdlopsConstantOp = b.create<ConstantIndexOp>(loc, NPerXdlops);
 
-    Value bufferA = adaptor.bufferA();
-    Value bufferB = adaptor.bufferB();
-    auto bufferAType = adaptor.bufferA().getType().cast<MemRefType>();
-    auto bufferBType = adaptor.bufferB().getType().cast<MemRefType>();
+    Value bufferA = op.bufferA();
+    Value bufferB = op.bufferB();
+    auto bufferAType = op.bufferA().getType().cast<MemRefType>();
+    auto bufferBType = op.bufferB().getType().cast<MemRefType>();
     Type bufferAElementType = bufferAType.getElementType();
     Type bufferBElementType = bufferBType.getElementType();
 
     int64_t KPerThread = IsKReduction ? K / num_input_blks : K;
-    Value zeroConstantOp = b.createOrFold<ConstantIndexOp>(loc, 0);
-    auto KPerBlockConstantOp = b.create<ConstantIndexOp>(loc, KPerThread);
 
     if (!IsKReduction) {
 
@@ -363,22 +399,23 @@ struct BlockwiseGemmV2RewritePattern
       // Note: p_a_wave need to be offseted by waveOffsetA.
 
       auto outerLoopM = b.create<AffineForOp>(loc, 0, MRepeats);
-      auto olmb = ConversionPatternRewriter::atBlockBegin(outerLoopM.getBody(),
-                                                          b.getListener());
+      auto olmb =
+          OpBuilder::atBlockBegin(outerLoopM.getBody(), b.getListener());
       auto olmiv = outerLoopM.getInductionVar();
       auto mOffset = olmb.create<AddIOp>(
           loc, aBase, olmb.create<MulIOp>(loc, MPerXdlopsConstantOp, olmiv));
       auto kOffsetA = olmb.create<MulIOp>(loc, olmiv, KConstantOp);
 
       auto innerLoopMK = olmb.create<AffineForOp>(loc, 0, KPerThread);
-      auto ilmkb = ConversionPatternRewriter::atBlockBegin(
-          innerLoopMK.getBody(), olmb.getListener());
+      auto ilmkb =
+          OpBuilder::atBlockBegin(innerLoopMK.getBody(), olmb.getListener());
       auto ilmkiv = innerLoopMK.getInductionVar();
 
       Value sourceOffsetA = ilmkb.create<AddIOp>(
           loc,
           ilmkb.create<AddIOp>(
-              loc, ilmkb.create<MulIOp>(loc, ilmkiv, MConstantOp), laneId),
+              loc, ilmkb.create<MulIOp>(loc, ilmkiv, MConstantOp),
+              inputLaneId),
           mOffset);
 
       if (KPack > 1)
@@ -387,6 +424,7 @@ struct BlockwiseGemmV2RewritePattern
 
       auto destOffsetA = ilmkb.create<AddIOp>(loc, ilmkiv, kOffsetA);
 
+      sourceOffsetA = swizzleA.apply(ilmkb, loc, sourceOffsetA, ldsOffsetA);
       Value valueA = ilmkb.create<InBoundsLoadOp>(loc, bufferAElementType,
                                                   op.matrixA(), sourceOffsetA);
       ilmkb.create<memref::StoreOp>(loc, valueA, bufferA,
@@ -400,22 +438,23 @@ struct BlockwiseGemmV2RewritePattern
       // Note: p_b_wave need to be offseted by waveOffsetB.
 
       auto outerLoopN = b.create<AffineForOp>(loc, 0, NRepeats);
-      auto olnb = ConversionPatternRewriter::atBlockBegin(outerLoopN.getBody(),
-                                                          b.getListener());
+      auto olnb =
+          OpBuilder::atBlockBegin(outerLoopN.getBody(), b.getListener());
       auto olniv = outerLoopN.getInductionVar();
       auto nOffset = olnb.create<AddIOp>(
           loc, bBase, olnb.create<MulIOp>(loc, NPerXdlopsConstantOp, olniv));
       auto kOffsetB = olnb.create<MulIOp>(loc, olniv, KConstantOp);
 
       auto innerLoopNK = olnb.create<AffineForOp>(loc, 0, KPerThread);
-      auto ilnkb = ConversionPatternRewriter::atBlockBegin(
-          innerLoopNK.getBody(), olnb.getListener());
+      auto ilnkb =
+          OpBuilder::atBlockBegin(innerLoopNK.getBody(), olnb.getListener());
       auto ilnkiv = innerLoopNK.getInductionVar();
 
       Value sourceOffsetB = ilnkb.create<AddIOp>(
           loc,
           ilnkb.create<AddIOp>(
-              loc, ilnkb.create<MulIOp>(loc, ilnkiv, NConstantOp), laneId),
+              loc, ilnkb.create<MulIOp>(loc, ilnkiv, NConstantOp),
+              inputLaneId),
           nOffset);
 
       if (KPack > 1)
@@ -424,6 +463,7 @@ struct BlockwiseGemmV2RewritePattern
 
       auto destOffsetB = ilnkb.create<AddIOp>(loc, ilnkiv, kOffsetB);
 
+      sourceOffsetB = swizzleB.apply(ilnkb, loc, sourceOffsetB, ldsOffsetB);
       Value valueB = ilnkb.create<InBoundsLoadOp>(loc, bufferBElementType,
                                                   op.matrixB(), sourceOffsetB);
       ilnkb.create<memref::StoreOp>(loc, valueB, bufferB,
@@ -451,8 +491,8 @@ struct BlockwiseGemmV2RewritePattern
           b.create<ConstantIndexOp>(loc, num_input_blks);
 
       auto loopKLoad = b.create<AffineForOp>(loc, 0, KPerThread);
-      auto lklb = ConversionPatternRewriter::atBlockBegin(loopKLoad.getBody(),
-                                                          b.getListener());
+      auto lklb =
+          OpBuilder::atBlockBegin(loopKLoad.getBody(), b.getListener());
       auto lkliv = loopKLoad.getInductionVar();
 
       Value sourceOffsetA = lklb.create<AddIOp>(
@@ -469,6 +509,7 @@ struct BlockwiseGemmV2RewritePattern
         sourceOffsetA = lklb.create<MulIOp>(
             loc, sourceOffsetA, lklb.create<ConstantIndexOp>(loc, KPack));
 
+      sourceOffsetA = swizzleA.apply(lklb, loc, sourceOffsetA, ldsOffsetA);
       Value valueA = lklb.create<InBoundsLoadOp>(loc, bufferAElementType,
                                                  op.matrixA(), sourceOffsetA);
       lklb.create<memref::StoreOp>(loc, valueA, bufferA, ValueRange{lkliv});
@@ -487,133 +528,56 @@ struct BlockwiseGemmV2RewritePattern
         sourceOffsetB = lklb.create<MulIOp>(
             loc, sourceOffsetB, lklb.create<ConstantIndexOp>(loc, KPack));
 
+      sourceOffsetB = swizzleB.apply(lklb, loc, sourceOffsetB, ldsOffsetB);
       Value valueB = lklb.create<InBoundsLoadOp>(loc, bufferBElementType,
                                                  op.matrixB(), sourceOffsetB);
       lklb.create<memref::StoreOp>(loc, valueB, bufferB, ValueRange{lkliv});
     }
 
-    if (MRepeats == 1 && NRepeats == 1) {
-      SmallVector<Type, 2> resultTypes;
-      for (auto result : op.vectorDs()) {
-        resultTypes.push_back(result.getType());
+    // Original C++ logic, for each repeat:
+    // p_c_thread.s.x.l = XdlopsGemm.template Run<M, N, K>(
+    // p_a_block + MPerXdlops * m_i, p_b_block + NPerXdlops * n_i,
+    // p_c_thread.s.x.l);
+    // The operands of the repeats follow each other in the A and B arrays,
+    // and their results in the C vectors.
+    int64_t vectorsPerRepeat = xcs.vectorNumber / (MRepeats * NRepeats);
+    SmallVector<Value, 4> results;
+    for (int64_t m_i = 0; m_i < MRepeats; ++m_i) {
+      for (int64_t n_i = 0; n_i < NRepeats; ++n_i) {
+        int64_t firstVector = (m_i * NRepeats + n_i) * vectorsPerRepeat;
+        ValueRange vectorCs =
+            op.vectorCs().slice(firstVector, vectorsPerRepeat);
+        Value regOffsetA =
+            b.createOrFold<ConstantIndexOp>(loc, m_i * KPerThread);
+        Value regOffsetB =
+            b.createOrFold<ConstantIndexOp>(loc, n_i * KPerThread);
+
+        auto xdlopsGemmV2Op = b.create<XdlopsGemmV2Op>(
+            loc, vectorCs.getTypes(), op.matrixA(), op.matrixB(),
+            op.ldsBufferOffsetA(), op.ldsBufferOffsetB(), regOffsetA,
+            regOffsetB, op.bufferA(), op.bufferB(), vectorCs);
+
+        xdlopsGemmV2Op->setAttr("m", op->getAttr("m"));
+        xdlopsGemmV2Op->setAttr("n", op->getAttr("n"));
+        xdlopsGemmV2Op->setAttr("k", op->getAttr("k"));
+        xdlopsGemmV2Op->setAttr("m_per_wave",
+                                b.getI32IntegerAttr(MPerXdlops));
+        xdlopsGemmV2Op->setAttr("n_per_wave",
+                                b.getI32IntegerAttr(NPerXdlops));
+        if (op->hasAttr("kpack"))
+          xdlopsGemmV2Op->setAttr("kpack", op->getAttr("kpack"));
+        if (Attribute arch = op->getAttr("arch"))
+          xdlopsGemmV2Op->setAttr("arch", arch);
+        if (Attribute fp8Format = op->getAttr("fp8_format"))
+          xdlopsGemmV2Op->setAttr("fp8_format", fp8Format);
+        if (Attribute xf32 = op->getAttr("xf32"))
+          xdlopsGemmV2Op->setAttr("xf32", xf32);
+        if (Attribute sparse = op->getAttr("sparse"))
+          xdlopsGemmV2Op->setAttr("sparse", sparse);
+        llvm::append_range(results, xdlopsGemmV2Op.vectorDs());
       }
-
-      auto xdlopsGemmV2Op = b.replaceOpWithNewOp<XdlopsGemmV2Op>(
-          op, resultTypes, adaptor.matrixA(), adaptor.matrixB(),
-          op.ldsBufferOffsetA(), op.ldsBufferOffsetB(), zeroConstantOp,
-          zeroConstantOp, adaptor.bufferA(), adaptor.bufferB(),
-          adaptor.vectorCs());
-
-      xdlopsGemmV2Op->setAttr("m", op->getAttr("m"));
-      xdlopsGemmV2Op->setAttr("n", op->getAttr("n"));
-      xdlopsGemmV2Op->setAttr("k", op->getAttr("k"));
-      xdlopsGemmV2Op->setAttr("m_per_wave", op->getAttr("m_per_wave"));
-      xdlopsGemmV2Op->setAttr("n_per_wave", op->getAttr("n_per_wave"));
-      if (op->hasAttr("kpack"))
-        xdlopsGemmV2Op->setAttr("kpack", op->getAttr("kpack"));
-    } else if (MRepeats == 2 && NRepeats == 1) {
-      // Original C++ logic.
-      // p_c_thread.s.x.l = XdlopsGemm.template Run<M, N, K>(
-      // p_a_block, p_b_block, p_c_thread.s.x.l);
-      // p_c_thread.s.y.l = XdlopsGemm.templateRun<M, N, K>(
-      // p_a_block + MPerXdlops, p_b_block, p_c_thread.s.y.l);
-
-      SmallVector<Type, 2> resultTypes0;
-      resultTypes0.push_back(op.vectorDs()[0].getType());
-      resultTypes0.push_back(op.vectorDs()[1].getType());
-
-      auto xdlopsGemmV2Op0 = b.create<XdlopsGemmV2Op>(
-          loc, resultTypes0, adaptor.matrixA(), adaptor.matrixB(),
-          op.ldsBufferOffsetA(), op.ldsBufferOffsetB(), zeroConstantOp,
-          zeroConstantOp, adaptor.bufferA(), adaptor.bufferB(),
-          adaptor.vectorCs().take_front(2));
-
-      xdlopsGemmV2Op0->setAttr("m", op->getAttr("m"));
-      xdlopsGemmV2Op0->setAttr("n", op->getAttr("n"));
-      xdlopsGemmV2Op0->setAttr("k", op->getAttr("k"));
-      // Hard-coded m_per_wave/n_per_wave as 64 when MRepeat>1 or NRepeat>1.
-      // So each xdlops_gemm_v2 handles a 64x64 GEMM.
-      xdlopsGemmV2Op0->setAttr("m_per_wave", b.getI32IntegerAttr(64));
-      xdlopsGemmV2Op0->setAttr("n_per_wave", b.getI32IntegerAttr(64));
-      if (op->hasAttr("kpack"))
-        xdlopsGemmV2Op0->setAttr("kpack", op->getAttr("kpack"));
-
-      SmallVector<Type, 2> resultTypes1;
-      resultTypes1.push_back(op.vectorDs()[2].getType());
-      resultTypes1.push_back(op.vectorDs()[3].getType());
-
-      auto xdlopsGemmV2Op1 = b.create<XdlopsGemmV2Op>(
-          loc, resultTypes1, adaptor.matrixA(), adaptor.matrixB(),
-          op.ldsBufferOffsetA(), op.ldsBufferOffsetB(), KPerBlockConstantOp,
-          zeroConstantOp, adaptor.bufferA(), adaptor.bufferB(),
-          adaptor.vectorCs().drop_front(2));
-
-      xdlopsGemmV2Op1->setAttr("m", op->getAttr("m"));
-      xdlopsGemmV2Op1->setAttr("n", op->getAttr("n"));
-      xdlopsGemmV2Op1->setAttr("k", op->getAttr("k"));
-      // Hard-coded m_per_wave/n_per_wave as 64 when MRepeat>1 or NRepeat>1.
-      // So each xdlops_gemm_v2 handles a 64x64 GEMM.
-      xdlopsGemmV2Op1->setAttr("m_per_wave", b.getI32IntegerAttr(64));
-      xdlopsGemmV2Op1->setAttr("n_per_wave", b.getI32IntegerAttr(64));
-      if (op->hasAttr("kpack"))
-        xdlopsGemmV2Op1->setAttr("kpack", op->getAttr("kpack"));
-
-      b.replaceOp(op, ValueRange{xdlopsGemmV2Op0.vectorDs()[0],
-                                 xdlopsGemmV2Op0.vectorDs()[1],
-                                 xdlopsGemmV2Op1.vectorDs()[0],
-                                 xdlopsGemmV2Op1.vectorDs()[1]});
-    } else if (MRepeats == 1 && NRepeats == 2) {
-      // Original C++ logic.
-      // p_c_thread.s.x.l = XdlopsGemm.template Run<M, N, K>(
-      // p_a_block, p_b_block, p_c_thread.s.x.l);
-      // p_c_thread.s.y.l = XdlopsGemm.template Run<M, N, K>(
-      // p_a_block, p_b_block + NPerXdlops, p_c_thread.s.y.l);
-
-      SmallVector<Type, 2> resultTypes0;
-      resultTypes0.push_back(op.vectorDs()[0].getType());
-      resultTypes0.push_back(op.vectorDs()[1].getType());
-
-      auto xdlopsGemmV2Op0 = b.create<XdlopsGemmV2Op>(
-          loc, resultTypes0, adaptor.matrixA(), adaptor.matrixB(),
-          op.ldsBufferOffsetA(), op.ldsBufferOffsetB(), zeroConstantOp,
-          zeroConstantOp, adaptor.bufferA(), adaptor.bufferB(),
-          adaptor.vectorCs().take_front(2));
-
-      xdlopsGemmV2Op0->setAttr("m", op->getAttr("m"));
-      xdlopsGemmV2Op0->setAttr("n", op->getAttr("n"));
-      xdlopsGemmV2Op0->setAttr("k", op->getAttr("k"));
-      // Hard-coded m_per_wave/n_per_wave as 64 when MRepeat>1 or NRepeat>1.
-      // So each xdlops_gemm_v2 handles a 64x64 GEMM.
-      xdlopsGemmV2Op0->setAttr("m_per_wave", b.getI32IntegerAttr(64));
-      xdlopsGemmV2Op0->setAttr("n_per_wave", b.getI32IntegerAttr(64));
-      if (op->hasAttr("kpack"))
-        xdlopsGemmV2Op0->setAttr("kpack", op->getAttr("kpack"));
-
-      SmallVector<Type, 2> resultTypes1;
-      resultTypes1.push_back(op.vectorDs()[2].getType());
-      resultTypes1.push_back(op.vectorDs()[3].getType());
-
-      auto xdlopsGemmV2Op1 = b.create<XdlopsGemmV2Op>(
-          loc, resultTypes1, adaptor.matrixA(), adaptor.matrixB(),
-          op.ldsBufferOffsetA(), op.ldsBufferOffsetB(), zeroConstantOp,
-          KPerBlockConstantOp, adaptor.bufferA(), adaptor.bufferB(),
-          adaptor.vectorCs().drop_front(2));
-
-      xdlopsGemmV2Op1->setAttr("m", op->getAttr("m"));
-      xdlopsGemmV2Op1->setAttr("n", op->getAttr("n"));
-      xdlopsGemmV2Op1->setAttr("k", op->getAttr("k"));
-      // Hard-coded m_per_wave/n_per_wave as 64 when MRepeat>1 or NRepeat>1.
-      // So each xdlops_gemm_v2 handles a 64x64 GEMM.
-      xdlopsGemmV2Op1->setAttr("m_per_wave", b.getI32IntegerAttr(64));
-      xdlopsGemmV2Op1->setAttr("n_per_wave", b.getI32IntegerAttr(64));
-      if (op->hasAttr("kpack"))
-        xdlopsGemmV2Op1->setAttr("kpack", op->getAttr("kpack"));
-
-      b.replaceOp(op, ValueRange{xdlopsGemmV2Op0.vectorDs()[0],
-                                 xdlopsGemmV2Op0.vectorDs()[1],
-                                 xdlopsGemmV2Op1.vectorDs()[0],
-                                 xdlopsGemmV2Op1.vectorDs()[1]});
     }
+    b.replaceOp(op, results);
 
     return success();
   }
@@ -645,26 +609,18 @@ struct ThreadwiseCopyV2RewritePattern
         b.create<InBoundsLoadOp>(loc, typeToLoad, source, sourceCoord);
     b.replaceOpWithNewOp<BufferStoreOp>(op, loaded, op.dest(), op.leftOobDims(),
                                         op.rightOobDims(), op.destCoord(),
-                                        op.storeMethodAttr());
+                                        op.storeMethod());
     return success();
   }
 };
 
 void MIOpenLowerBlockwiseGemmToThreadwisePass::runOnOperation() {
   MLIRContext *ctx = &getContext();
-  ConversionTarget target(*ctx);
-  target.addIllegalOp<FillOp, BlockwiseGemmOp, BlockwiseGemmV2Op,
-                      ThreadwiseCopyV2Op>();
-  target.addLegalDialect<arith::ArithmeticDialect, miopen::MIOpenDialect,
-                         AffineDialect, memref::MemRefDialect,
-                         vector::VectorDialect>();
-
   RewritePatternSet patterns(ctx);
   patterns.add<FillRewritePattern, BlockwiseGemmRewritePattern,
                BlockwiseGemmV2RewritePattern, ThreadwiseCopyV2RewritePattern>(
       ctx);
-  if (failed(
-          applyPartialConversion(getOperation(), target, std::move(patterns))))
+  if (failed(applyPatternsInOrder(getOperation(), std::move(patterns))))
     signalPassFailure();
 }
 } // end anonymous namespace
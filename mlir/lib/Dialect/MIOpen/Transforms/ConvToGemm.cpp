@@ -30,8 +30,11 @@
 #include "mlir/Dialect/MIOpen/Tuning/GemmContext.h"
 #include "mlir/Dialect/MIOpen/Tuning/GridwiseGemmParams.h"
 #include "mlir/Dialect/MIOpen/Tuning/UtilityParams.h"
+#include "mlir/Dialect/MIOpen/XdlopsCodeSelection.h"
 #include "mlir/Dialect/MIOpen/utility/builderUtils.h"
 #include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
+#include "mlir/Dialect/Math/IR/Math.h"
+#include "mlir/Dialect/Vector/IR/VectorOps.h"
 
 #include "mlir/Transforms/DialectConversion.h"
 #include "mlir/Transforms/GreedyPatternRewriteDriver.h"
@@ -39,8 +42,11 @@
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringSwitch.h"
 #include "llvm/Support/Debug.h"
 
+#include <limits>
+
 #define DEBUG_TYPE "miopen-conv-to-gemm"
 
 using namespace mlir;
@@ -63,6 +69,10 @@ struct ArgumentFields {
   StringRef gemmTargetCharName[3];
 };
 
+// Gives the convolution context of an op from the analysis manager.
+using ConvContextGetter =
+    llvm::function_ref<const ConvolutionContext &(Operation *)>;
+
 struct MIOpenConvToGemmPass
     : public MIOpenConvToGemmPassBase<MIOpenConvToGemmPass> {
   void runOnOperation() override;
@@ -89,7 +99,8 @@ LogicalResult checkNames(ArrayRef<StringRef> actual,
 
 /// Get the dimension names for the given `op` into `filterNames`, `inputNames`
 /// and `outputNames`, returning failure if `op`'s layout doesn't contain all of
-/// the expected dimension names.
+/// the expected dimension names. Layouts of length 6 are those of 3D
+/// convolutions, which also have the depth dimensions `z`, `di` and `do`.
 template <typename T>
 LogicalResult getConvDimNames(T op, SmallVectorImpl<StringRef> &filterNames,
                               SmallVectorImpl<StringRef> &inputNames,
@@ -119,12 +130,17 @@ LogicalResult getConvDimNames(T op, SmallVectorImpl<StringRef> &filterNames,
     inputNames.push_back(inputAttr.getValue());
     outputNames.push_back(outputAttr.getValue());
   }
-  if (failed(
-          checkNames(filterNames, {"k", "g", "c", "y", "x"}, "filter", op)) ||
-      failed(checkNames(inputNames, {"ni", "gi", "ci", "hi", "wi"}, "input",
-                        op)) ||
-      failed(checkNames(outputNames, {"no", "go", "ko", "ho", "wo"}, "output",
-                        op))) {
+  SmallVector<StringRef, 6> expectedFilter = {"k", "g", "c", "y", "x"};
+  SmallVector<StringRef, 6> expectedInput = {"ni", "gi", "ci", "hi", "wi"};
+  SmallVector<StringRef, 6> expectedOutput = {"no", "go", "ko", "ho", "wo"};
+  if (size == 6) {
+    expectedFilter.push_back("z");
+    expectedInput.push_back("di");
+    expectedOutput.push_back("do");
+  }
+  if (failed(checkNames(filterNames, expectedFilter, "filter", op)) ||
+      failed(checkNames(inputNames, expectedInput, "input", op)) ||
+      failed(checkNames(outputNames, expectedOutput, "output", op))) {
     return failure();
   }
   return success();
@@ -154,11 +170,28 @@ void affixGridwiseGemmAttributes(Operation *convOp, Operation *gop,
                convOp->getAttr("matrix_c_dest_vector_write_dim"));
   gop->setAttr("matrix_c_source_vector_read_dim",
                convOp->getAttr("matrix_c_source_vector_read_dim"));
+  if (Attribute gridGroupM = convOp->getAttr("grid_group_m"))
+    gop->setAttr("grid_group_m", gridGroupM);
+  if (Attribute persistent = convOp->getAttr("persistent"))
+    gop->setAttr("persistent", persistent);
 
   auto xdlopsV2Attr = convOp->getAttrOfType<BoolAttr>("xdlopsV2");
   if (xdlopsV2Attr && xdlopsV2Attr.getValue() == true) {
     gop->setAttr("m_per_wave", convOp->getAttr("m_per_wave"));
     gop->setAttr("n_per_wave", convOp->getAttr("n_per_wave"));
+    if (Attribute ldsStages = convOp->getAttr("lds_stages"))
+      gop->setAttr("lds_stages", ldsStages);
+    if (Attribute directToLds = convOp->getAttr("direct_to_lds"))
+      gop->setAttr("direct_to_lds", directToLds);
+    if (Attribute registerOnly = convOp->getAttr("register_only"))
+      gop->setAttr("register_only", registerOnly);
+    if (Attribute ldsEpilogue = convOp->getAttr("lds_epilogue"))
+      gop->setAttr("lds_epilogue", ldsEpilogue);
+    if (Attribute schedHints = convOp->getAttr("sched_hints"))
+      gop->setAttr("sched_hints", schedHints);
+    if (Attribute maxDataPerCopy =
+            convOp->getAttr("matrix_c_max_data_per_copy"))
+      gop->setAttr("matrix_c_max_data_per_copy", maxDataPerCopy);
   } else {
     gop->setAttr("m_per_thread", convOp->getAttr("m_per_thread"));
     gop->setAttr("n_per_thread", convOp->getAttr("n_per_thread"));
@@ -170,6 +203,21 @@ void affixGridwiseGemmAttributes(Operation *convOp, Operation *gop,
   }
 }
 
+/// The per-channel requantization scales of `op`, which only forward 2D
+/// convolutions can have.
+static Value getRequantScales(Operation *op) { return Value(); }
+static Value getRequantScales(Conv2DOp op) { return op.requantScales(); }
+
+/// Append the `fp8_format`, `fp8_scale`, `xf32` and `sparse` attributes of
+/// `op`, if any, to the attributes of the gridwise gemm it lowers to.
+static void appendPrecisionAttributes(OpBuilder &b, Operation *op,
+                                      SmallVectorImpl<NamedAttribute> &attrs) {
+  for (StringRef name :
+       {"fp8_format", "fp8_scale", "xf32", "sparse", "int4_group_size"})
+    if (Attribute attr = op->getAttr(name))
+      attrs.push_back(b.getNamedAttr(name, attr));
+}
+
 /// Create an elementwise utility kernel.
 /// The callback has type (builder, location, collapsedBuffers, coordinate).
 /// Note: you are expected to handle out of bounds, such as by using
@@ -247,11 +295,10 @@ Value createKPackLogic(OpBuilder &b, Location loc, Value source,
   return result;
 }
 
-/// 0-initialize the output for a backward data convolution.
-/// The output is the input tensor.
-LogicalResult zeroInit(Conv2DBwdDataOp op, PatternRewriter &b) {
-  auto loc = op.getLoc();
-  Value output = op.input();
+/// 0-initialize `output`, the buffer a convolution accumulates into.
+static LogicalResult zeroInitBuffer(Operation *op, Value output,
+                                    PatternRewriter &b) {
+  Location loc = op->getLoc();
   Type outputType = output.getType().cast<MemRefType>().getElementType();
   constexpr int64_t kZeroInitVecLen = 4;
   Type storeType = VectorType::get(kZeroInitVecLen, outputType);
@@ -262,9 +309,8 @@ LogicalResult zeroInit(Conv2DBwdDataOp op, PatternRewriter &b) {
   auto loopBody = [&zeroOp, &leftOob, &rightOob](OpBuilder &b, Location loc,
                                                  ValueRange collapsed,
                                                  Value index) {
-    b.create<BufferStoreOp>(
-        loc, zeroOp, collapsed[0], leftOob, rightOob, index,
-        StoreMethodAttr::get(b.getContext(), StoreMethod::Set));
+    b.create<BufferStoreOp>(loc, zeroOp, collapsed[0], leftOob, rightOob, index,
+                            StoreMethod::Set);
   };
   LogicalResult res =
       createElementwiseLoop(b, loc, op, output, kZeroInitVecLen, loopBody);
@@ -275,79 +321,139 @@ LogicalResult zeroInit(Conv2DBwdDataOp op, PatternRewriter &b) {
   return success();
 }
 
+/// Element-wise conversion from the fp32 `workspace` a convolution
+/// accumulated into to its actual `result` tensor.
+static LogicalResult convertWorkspace(Operation *op, Value workspace,
+                                      Value result, PatternRewriter &b) {
+  Location loc = op->getLoc();
+  Type resultDataType = result.getType().cast<MemRefType>().getElementType();
+  Type workspaceDataType =
+      workspace.getType().cast<MemRefType>().getElementType();
+
+  int64_t kConversionVectorLen = 4;
+  Type loadType = VectorType::get(kConversionVectorLen, workspaceDataType);
+  Type storeType = VectorType::get(kConversionVectorLen, resultDataType);
+  ArrayAttr leftOob = b.getI32ArrayAttr({});
+  ArrayAttr rightOob = b.getI32ArrayAttr({0});
+
+  auto loopBody = [&loadType, &storeType, &leftOob,
+                   &rightOob](OpBuilder &b, Location loc, ValueRange collapsed,
+                              Value index) {
+    Value loaded = b.create<BufferLoadOp>(loc, loadType, collapsed[0], leftOob,
+                                          rightOob, index,
+                                          CachePolicy::Streaming);
+    Value converted = createTypeConversionOp(b, loc, loaded, storeType);
+    b.create<BufferStoreOp>(loc, converted, collapsed[1], leftOob, rightOob,
+                            index, StoreMethod::Set, CachePolicy::Streaming);
+  };
+  LogicalResult res = createElementwiseLoop(b, loc, op, {workspace, result},
+                                            kConversionVectorLen, loopBody);
+  if (failed(res))
+    return failure();
+
+  b.eraseOp(op);
+  return success();
+}
+
 /// 0-initialize the output for a backward weight convolution which uses
 /// atomic adds.
 /// For f32 type, the output is the filter tensor.
-/// for f16 type, the output is the workspace.
+/// for f16 type, the output is the workspace, if any, or the filter tensor
+/// when packed fp16 atomics add into it directly.
 LogicalResult zeroInit(Conv2DBwdWeightOp op, PatternRewriter &b) {
-  Location loc = op.getLoc();
   Type filterDataType =
       op.filter().getType().cast<MemRefType>().getElementType();
   Value output;
   if (filterDataType == b.getF32Type()) {
     output = op.filter();
   } else if (filterDataType == b.getF16Type()) {
-    if (!op.workspace())
-      return op.emitOpError("op has no workspace");
-    output = op.workspace();
+    output = op.workspace() ? op.workspace() : op.filter();
   } else {
     return op.emitOpError("Unsupported zeroing data type");
   }
+  return zeroInitBuffer(op, output, b);
+}
 
-  Type outputType = output.getType().cast<MemRefType>().getElementType();
-  constexpr int64_t kZeroInitVecLen = 4;
-  Type storeType = VectorType::get(kZeroInitVecLen, outputType);
-  Value zeroOp = createZeroConstantOp(b, loc, storeType);
-  ArrayAttr leftOob = b.getI32ArrayAttr({});
-  ArrayAttr rightOob = b.getI32ArrayAttr({0});
-
-  auto loopBody = [&zeroOp, &leftOob, &rightOob](OpBuilder &b, Location loc,
-                                                 ValueRange collapsed,
-                                                 Value index) {
-    b.create<BufferStoreOp>(
-        loc, zeroOp, collapsed[0], leftOob, rightOob, index,
-        StoreMethodAttr::get(b.getContext(), StoreMethod::Set));
-  };
-
-  LogicalResult res =
-      createElementwiseLoop(b, loc, op, output, kZeroInitVecLen, loopBody);
-  if (failed(res))
-    return failure();
-
-  b.eraseOp(op);
-  return success();
+/// 0-initialize the output for a split-K forward convolution.
+/// For f32 type, the output is the output tensor.
+/// for f16 type, the output is the workspace, if any, or the output tensor
+/// when packed fp16 atomics add into it directly.
+LogicalResult zeroInit(Conv2DOp op, PatternRewriter &b) {
+  Type outputDataType =
+      op.output().getType().cast<MemRefType>().getElementType();
+  Value output;
+  if (outputDataType == b.getF32Type()) {
+    output = op.output();
+  } else if (outputDataType == b.getF16Type()) {
+    output = op.workspace() ? op.workspace() : op.output();
+  } else {
+    return op.emitOpError("Unsupported zeroing data type");
+  }
+  return zeroInitBuffer(op, output, b);
 }
 
 /// Element-wise conversion from the workspace to the output (filter tensor)
 /// for a backward weight convolution which uses atomic adds.
 LogicalResult elementwiseConversion(Conv2DBwdWeightOp op, PatternRewriter &b) {
-  Location loc = op.getLoc();
   if (!op.workspace())
     return op.emitOpError("op has no workspace");
-  Value filter = op.filter();
-  Value workspace = op.workspace();
-  Type filterDataType = filter.getType().cast<MemRefType>().getElementType();
-  Type workspaceDataType =
-      workspace.getType().cast<MemRefType>().getElementType();
+  return convertWorkspace(op, op.workspace(), op.filter(), b);
+}
 
-  int64_t kConversionVectorLen = 4;
-  Type loadType = VectorType::get(kConversionVectorLen, workspaceDataType);
-  Type storeType = VectorType::get(kConversionVectorLen, filterDataType);
+/// Element-wise conversion from the workspace to the output tensor for a
+/// split-K forward convolution.
+LogicalResult elementwiseConversion(Conv2DOp op, PatternRewriter &b) {
+  if (!op.workspace())
+    return op.emitOpError("op has no workspace");
+  return convertWorkspace(op, op.workspace(), op.output(), b);
+}
+
+/// Sum the `kBlocks` partial filters a backward weight convolution wrote one
+/// after the other into its workspace into the filter. Each workitem adds
+/// the partials of its elements two by two, in a fixed order.
+LogicalResult reducePartialFilters(Conv2DBwdWeightOp op, int64_t kBlocks,
+                                   PatternRewriter &b) {
+  if (!op.workspace())
+    return op.emitOpError("op has no workspace");
+  Location loc = op.getLoc();
+  MemRefType filterType = op.filter().getType().cast<MemRefType>();
+  int64_t filterLen = filterType.getNumElements();
+  if (op.workspace().getType().cast<MemRefType>().getNumElements() <
+      kBlocks * filterLen)
+    return op.emitOpError("workspace too small for ") << kBlocks << " KBlocks";
+
+  constexpr int64_t kReductionVectorLen = 4;
+  Type loadType = VectorType::get(kReductionVectorLen, b.getF32Type());
+  Type storeType =
+      VectorType::get(kReductionVectorLen, filterType.getElementType());
   ArrayAttr leftOob = b.getI32ArrayAttr({});
   ArrayAttr rightOob = b.getI32ArrayAttr({0});
-
-  auto loopBody = [&loadType, &storeType, &leftOob,
-                   &rightOob](OpBuilder &b, Location loc, ValueRange collapsed,
-                              Value index) {
-    Value loaded = b.create<BufferLoadOp>(loc, loadType, collapsed[0], leftOob,
-                                          rightOob, index);
-    Value converted = createTypeConversionOp(b, loc, loaded, storeType);
-    b.create<BufferStoreOp>(
-        loc, converted, collapsed[1], leftOob, rightOob, index,
-        StoreMethodAttr::get(b.getContext(), StoreMethod::Set));
+  Value workspace = createCollapseShapeOp(b, loc, op.workspace());
+
+  auto loopBody = [&](OpBuilder &b, Location loc, ValueRange collapsed,
+                      Value index) {
+    SmallVector<Value, 8> partials;
+    for (int64_t i = 0; i < kBlocks; ++i) {
+      Value partialIndex = b.create<AddIOp>(
+          loc, index, b.create<ConstantIndexOp>(loc, i * filterLen));
+      partials.push_back(b.create<BufferLoadOp>(
+          loc, loadType, workspace, leftOob, rightOob, partialIndex,
+          CachePolicy::Streaming));
+    }
+    while (partials.size() > 1) {
+      SmallVector<Value, 8> sums;
+      for (size_t i = 0, e = partials.size(); i + 1 < e; i += 2)
+        sums.push_back(b.create<AddFOp>(loc, partials[i], partials[i + 1]));
+      if (partials.size() % 2 != 0)
+        sums.push_back(partials.back());
+      partials = std::move(sums);
+    }
+    Value result = createTypeConversionOp(b, loc, partials[0], storeType);
+    b.create<BufferStoreOp>(loc, result, collapsed[0], leftOob, rightOob,
+                            index, StoreMethod::Set, CachePolicy::Streaming);
   };
-  LogicalResult res = createElementwiseLoop(b, loc, op, {workspace, filter},
-                                            kConversionVectorLen, loopBody);
+  LogicalResult res = createElementwiseLoop(b, loc, op, op.filter(),
+                                            kReductionVectorLen, loopBody);
   if (failed(res))
     return failure();
 
@@ -356,7 +462,14 @@ LogicalResult elementwiseConversion(Conv2DBwdWeightOp op, PatternRewriter &b) {
 }
 
 /// Lowerings for particular convolution algorithms (TODO, new file?)
+/// Backward weight convolutions that split GemmK into KBlocks either add the
+/// results of all KBlocks into the filter (or the fp32 workspace of fp16 ones
+/// without packed atomics) with atomics or, with `reduce_kblocks`, store them
+/// side by side into the workspace for reducePartialFilters(). With
+/// `fused_reduction` as well, the gridwise gemm sums them into the filter
+/// itself, counting the partials written in the slab after them.
 LogicalResult backwardWeightAtomicAdd(Conv2DBwdWeightOp op,
+                                      const ConvolutionContext &ctx,
                                       PatternRewriter &b) {
   auto loc = op.getLoc();
   auto gemmIdAttr = op->template getAttrOfType<IntegerAttr>("gemm_id");
@@ -369,8 +482,6 @@ LogicalResult backwardWeightAtomicAdd(Conv2DBwdWeightOp op,
   auto KBlocksAttr = op->template getAttrOfType<IntegerAttr>("kblocks");
   int64_t gemmKBlocks = KBlocksAttr.getInt();
 
-  ConvolutionContext ctx = populateConvContext(op);
-
   auto xdlopsV2Attr = op->template getAttrOfType<BoolAttr>("xdlopsV2");
   bool isXdlops = (xdlopsV2Attr && xdlopsV2Attr.getValue() == true);
 
@@ -378,28 +489,44 @@ LogicalResult backwardWeightAtomicAdd(Conv2DBwdWeightOp op,
   auto filterType = op.filter().getType().template cast<MemRefType>();
   auto filterShape = filterType.getShape();
 
-  // Determine whether to use workspace.
+  // Determine whether to use workspace. fp16 filters without one are
+  // accumulated into directly with packed atomics.
+  bool reduceKBlocks = op->hasAttr("reduce_kblocks");
+  if (reduceKBlocks && !op.workspace())
+    return op.emitOpError("op has no workspace");
+  bool fusedReduction = reduceKBlocks && op->hasAttr("fused_reduction");
+  if (reduceKBlocks &&
+      op.workspace().getType().cast<MemRefType>().getNumElements() <
+          (gemmKBlocks + (fusedReduction ? 1 : 0)) *
+              filterType.getNumElements())
+    return op.emitOpError("workspace too small for ")
+           << gemmKBlocks << " KBlocks";
   bool hasWorkspace =
-      (filterType.getElementType() == b.getF16Type() && isXdlops);
-  if (hasWorkspace) {
-    assert(op.workspace() && "Op has no workspace");
-  }
+      reduceKBlocks || (filterType.getElementType() == b.getF16Type() &&
+                        isXdlops && op.workspace());
 
   // Emit utility kernels.
   int64_t gemmId = gemmIdAttr.getInt();
   assert((gemmId >= 0) && (gemmId < 3));
-  switch (gemmId) {
-  case 0:
-    // The 0th kernel will 0-init the output (filter tensor).
-    return zeroInit(op, b);
-  case 2:
-    // The 2nd kernel, if used, will conduct element-wise fp32->fp16 conversion
-    // from the workspace to the output (filter tensor).
-    assert(hasWorkspace);
-    return elementwiseConversion(op, b);
-  case 1:
-  default:
-    break;
+  if (reduceKBlocks) {
+    // The 0th kernel will write the partial filters and the 1st one will sum
+    // them into the output (filter tensor).
+    if (gemmId == 1 && !fusedReduction)
+      return reducePartialFilters(op, gemmKBlocks, b);
+  } else {
+    switch (gemmId) {
+    case 0:
+      // The 0th kernel will 0-init the output (filter tensor).
+      return zeroInit(op, b);
+    case 2:
+      // The 2nd kernel, if used, will conduct element-wise fp32->fp16
+      // conversion from the workspace to the output (filter tensor).
+      assert(hasWorkspace);
+      return elementwiseConversion(op, b);
+    case 1:
+    default:
+      break;
+    }
   }
   // The 1st kernel will conduct the actual backward weight convolution using
   // atomic adds.
@@ -412,204 +539,1586 @@ LogicalResult backwardWeightAtomicAdd(Conv2DBwdWeightOp op,
   auto outputType = op.output().getType().template cast<MemRefType>();
   auto outputShape = outputType.getShape();
 
-  // Obtain convolution parameters: padding / dialtion / stride.
+  // Obtain convolution parameters: padding / dialtion / stride.
+  int64_t leftPadH = ctx.getPaddingVal()[0];
+  int64_t leftPadW = ctx.getPaddingVal()[2];
+  int64_t rightPadH = ctx.getPaddingVal()[1];
+  int64_t rightPadW = ctx.getPaddingVal()[3];
+
+  int64_t dilationH = ctx.getDilationVal()[0];
+  int64_t dilationW = ctx.getDilationVal()[1];
+  int64_t strideH = ctx.getStrideVal()[0];
+  int64_t strideW = ctx.getStrideVal()[1];
+  ConvolutionDims convDims = ctx.getConvDims();
+
+  llvm::SmallVector<StringRef, 5> filterNames, inputNames, outputNames;
+  if (failed(getConvDimNames(op, filterNames, inputNames, outputNames))) {
+    return failure();
+  }
+
+  Value gemmFilter, gemmInput, gemmOutput;
+  Value gemmInputKPack, gemmOutputKPack;
+  // Transform filter tensor.
+  SmallVector<StringRef, 5> nonKDims;
+  for (StringRef name : filterNames)
+    if (name != "g" && name != "k")
+      nonKDims.push_back(name);
+  // Add a dimension, that'll be ignored when writing the output, for KBlock
+  // The existence of this dimension makes the mapping between the C matrix
+  // and the filter tensor uninvertable, hence the need for atomic add
+
+  // When the KBlocks are reduced afterwards, the dimension is instead the
+  // index of the partial filter, those being stacked along the outermost
+  // dimension of the workspace.
+  auto createGemmFilter = [&](Value tensor, bool stacked) -> Value {
+    ArrayRef<int64_t> tensorShape =
+        tensor.getType().cast<MemRefType>().getShape();
+    llvm::StringMap<uint32_t> kBlockDims =
+        expandNamesInPlace(filterNames, {{{"k", {"kBlock", "k"}}}});
+    BottomUpTMBuilder addKBlockTransform(b, filterNames, tensorShape, loc);
+    BottomUpTMTopDimsWrapper addKBlockWrap(addKBlockTransform,
+                                           std::move(kBlockDims));
+    if (stacked) {
+      StringRef outerDim = filterNames[0];
+      for (StringRef name : filterNames)
+        if (name != outerDim)
+          addKBlockWrap.passThrough(name);
+      addKBlockWrap.embed({outerDim, "kBlock"},
+                          {filterShape[0], gemmKBlocks}, outerDim,
+                          {1, filterShape[0]});
+    } else {
+      addKBlockWrap.passThrough("g");
+      addKBlockWrap.addDim("kBlock", gemmKBlocks);
+      addKBlockWrap.passThrough({"k", "c", "y", "x"});
+    }
+
+    TransformMapAttr addKBlockTransformAttr = addKBlockTransform.get();
+    Value withKBlock =
+        b.create<miopen::TransformOp>(loc, tensor, addKBlockTransformAttr);
+
+    // Create GEMM filter tensor
+    // Here, we merge the KBlock dimension into the G dimension
+    // keeping the kBlock dimension as the minor index
+    // and send K to the M dimension and CYX to the N dimension as usual
+    bool isUnfold = (addKBlockTransform.endIndex("c") + 1 ==
+                     addKBlockTransform.endIndex("y")) &&
+                    (addKBlockTransform.endIndex("y") + 1 ==
+                     addKBlockTransform.endIndex("x"));
+    auto gemmTransform =
+        BottomUpTMBuilder::above(addKBlockTransform, addKBlockTransformAttr);
+    gemmTransform.merge("gemmG", 0, {"g", "kBlock"});
+    gemmTransform.passThrough({"gemmM"}, {1}, {"k"});
+    gemmTransform.merge("gemmN", 2, nonKDims, isUnfold);
+
+    TransformMapAttr gemmTransformAttr = gemmTransform.get();
+    return b.create<TransformOp>(loc, withKBlock, gemmTransformAttr);
+  };
+  gemmFilter = createGemmFilter(hasWorkspace ? op.workspace() : op.filter(),
+                                reduceKBlocks);
+  // This kernel is only invoked when there's no need for gemm padding.
+  // The fused reduction writes its sums through the view of the filter that
+  // the atomic adds use.
+  Value reduceDest;
+  if (fusedReduction)
+    reduceDest = createGemmFilter(op.filter(), /*stacked=*/false);
+
+  // Transform input tensor
+  {
+    // Pad H and W and split N into  n0 and n1 where n0 has size kBlocks and n1
+    // is what's left
+    llvm::StringMap<uint32_t> firstTransformOutDims = expandNamesInPlace(
+        inputNames,
+        {{"ni", {"n0", "n1"}}, {"hi", {"hipad"}}, {"wi", {"wipad"}}});
+
+    BottomUpTMBuilder firstTransform(b, inputNames, inputShape, loc);
+    BottomUpTMTopDimsWrapper firstWrap(firstTransform,
+                                       std::move(firstTransformOutDims));
+    firstWrap.passThrough("gi");
+    firstWrap.unmerge({"n0", "n1"}, "ni",
+                      {gemmKBlocks, convDims.n / gemmKBlocks});
+    firstWrap.passThrough("ci");
+    firstWrap.pad({"hipad", "wipad"}, {"hi", "wi"},
+                  {leftPadH, rightPadH, leftPadW, rightPadW});
+
+    TransformMapAttr firstTransformAttr = firstTransform.get();
+    Value firstTransformed =
+        b.create<TransformOp>(loc, op.input(), firstTransformAttr);
+
+    // The usual mapping of input space to dimensions such that filter elements
+    // get multiplied by the right thing
+    llvm::StringMap<uint32_t> embedOutDims = expandNamesInPlace(
+        firstTransform, {{"hipad", {"y", "ho"}}, {"wipad", {"x", "wo"}}});
+    auto embedTransform =
+        BottomUpTMBuilder::above(firstTransform, firstTransformAttr);
+    BottomUpTMTopDimsWrapper embedWrap(embedTransform, std::move(embedOutDims));
+    embedWrap.passThrough({"gi", "n0", "n1", "ci"});
+    embedWrap.embed({"y", "ho"}, {convDims.y, convDims.ho}, "hipad",
+                    {dilationH, strideH});
+    embedWrap.embed({"x", "wo"}, {convDims.x, convDims.wo}, "wipad",
+                    {dilationW, strideW});
+
+    TransformMapAttr embedTransformAttr = embedTransform.get();
+    Value embedded =
+        b.create<TransformOp>(loc, firstTransformed, embedTransformAttr);
+
+    // Merge N1HoWO to gemmK and CYX to gemmN
+    auto gemmInputTransform =
+        BottomUpTMBuilder::above(embedTransform, embedTransformAttr);
+
+    llvm::SmallVector<StringRef, 3> nonNHWDims = {"ci", "y", "x"};
+    std::sort(nonNHWDims.begin(), nonNHWDims.end(),
+              [&gemmInputTransform](const StringRef &v1,
+                                    const StringRef &v2) -> bool {
+                return gemmInputTransform.startIndex(v1) <
+                       gemmInputTransform.startIndex(v2);
+              });
+    // In the gemmG dimension, unlike with gemmN, we don't have the same
+    // traversal order concerns - a step in the G dimension always first visits
+    // kBlock/N0 and then moves on to the next G
+    gemmInputTransform.merge("gemmG", 0, {"gi", "n0"});
+    gemmInputTransform.merge("gemmK", 1, {"n1", "ho", "wo"});
+    gemmInputTransform.merge("gemmN", 2, nonNHWDims);
+
+    TransformMapAttr gemmInputTransformAttr = gemmInputTransform.get();
+    gemmInput = b.create<TransformOp>(loc, embedded, gemmInputTransformAttr);
+
+    // KPack for input tensor.
+    gemmInputKPack = createKPackLogic(b, loc, gemmInput, gemmInputTransform,
+                                      gemmInputTransformAttr, KPack);
+  }
+
+  // Transform output tensor
+  {
+    // First, split the N dimension as in the input
+    llvm::StringMap<uint32_t> outDims =
+        expandNamesInPlace(outputNames, {{"no", {"n0", "n1"}}});
+    BottomUpTMBuilder firstTransform(b, outputNames, outputShape, loc);
+    BottomUpTMTopDimsWrapper firstWrap(firstTransform, std::move(outDims));
+    firstWrap.passThrough("go");
+    firstWrap.unmerge({"n0", "n1"}, "no",
+                      {gemmKBlocks, convDims.n / gemmKBlocks});
+    firstWrap.passThrough({"ko", "ho", "wo"});
+
+    TransformMapAttr firstTransformAttr = firstTransform.get();
+    Value transformed =
+        b.create<TransformOp>(loc, op.output(), firstTransformAttr);
+
+    // Map G and N0 to gemmG, N1HW to gemmK and K to gemmM
+    auto gemmOutputTransform =
+        BottomUpTMBuilder::above(firstTransform, firstTransformAttr);
+    gemmOutputTransform.merge("gemmG", 0, {"go", "n0"});
+    gemmOutputTransform.merge("gemmK", 1, {"n1", "ho", "wo"});
+    gemmOutputTransform.passThrough({"gemmM"}, {2}, {"ko"});
+
+    TransformMapAttr gemmOutputTransformAttr = gemmOutputTransform.get();
+    gemmOutput =
+        b.create<TransformOp>(loc, transformed, gemmOutputTransformAttr);
+
+    // KPack for output tensor.
+    gemmOutputKPack = createKPackLogic(b, loc, gemmOutput, gemmOutputTransform,
+                                       gemmOutputTransformAttr, KPack);
+  }
+
+  // Set attributes for gridwise_gemm op.
+  llvm::SmallVector<NamedAttribute, 8> gridwiseGemmAttrs{
+      b.getNamedAttr("gemm_id", gemmIdAttr), b.getNamedAttr("arch", archAttr),
+      b.getNamedAttr("num_cu", numCuAttr)};
+
+  // Supply KPack information into gridwiseGemmAttrs.
+  if (KPack > 1) {
+    gridwiseGemmAttrs.push_back(
+        b.getNamedAttr("kpack", b.getI32IntegerAttr(KPack)));
+  }
+
+  // xdlopsV2.
+  if (isXdlops)
+    gridwiseGemmAttrs.push_back(
+        b.getNamedAttr("xdlopsV2", b.getBoolAttr(true)));
+
+  // This kernel is not run when there is padding on the GEMM
+  auto paddingInfo = PaddingInfoAttr::get(b.getContext(), 0, 0, 0);
+  auto storeMethod =
+      reduceKBlocks ? StoreMethod::Set : StoreMethod::AtomicAdd;
+
+  // The counters follow the partial filters.
+  if (fusedReduction) {
+    int64_t filterLen = filterType.getNumElements();
+    gridwiseGemmAttrs.push_back(
+        b.getNamedAttr("kblocks", b.getI32IntegerAttr(gemmKBlocks)));
+    gridwiseGemmAttrs.push_back(b.getNamedAttr(
+        "kblock_counters",
+        b.getI64IntegerAttr(gemmKBlocks * filterLen)));
+  }
+
+  Value gemmA = gemmOutputKPack;
+  Value gemmB = gemmInputKPack;
+  Value gemmC = gemmFilter;
+  if (isXdlops) {
+    auto gop = b.create<GridwiseGemmV2Op>(
+        loc, gemmA, gemmB, gemmC, paddingInfo, storeMethod, gridwiseGemmAttrs,
+        /*requantScales=*/Value(), /*dequantScales=*/Value(), reduceDest);
+    affixGridwiseGemmAttributes(op, gop, b);
+  } else {
+    op->emitOpError("Backward weight atomic add kernel requires xdlops and "
+                    "shouldn't have been tried without them");
+  }
+
+  // Finally, erase the original Conv2D op.
+  b.eraseOp(op);
+
+  return success();
+}
+
+/// Split-K forward convolution: the input channels are split into kBlocks
+/// pieces, each of which becomes its own gemm along gemmG, and the partial
+/// results of those gemms are summed into the output with atomic adds.
+LogicalResult forwardAtomicAdd(Conv2DOp op, const ConvolutionContext &ctx,
+                               PatternRewriter &b) {
+  auto loc = op.getLoc();
+  auto archAttr = op->template getAttrOfType<StringAttr>("arch");
+  auto numCuAttr = op->template getAttrOfType<IntegerAttr>("num_cu");
+
+  auto KPackAttr = op->template getAttrOfType<IntegerAttr>("kpack");
+  int64_t KPack = KPackAttr.getInt();
+
+  auto KBlocksAttr = op->template getAttrOfType<IntegerAttr>("kblocks");
+  if (!KBlocksAttr)
+    return op.emitOpError("split-K convolution has no kblocks");
+  int64_t gemmKBlocks = KBlocksAttr.getInt();
+
+  // Get shape of output tensor.
+  auto outputType = op.output().getType().template cast<MemRefType>();
+  auto outputShape = outputType.getShape();
+
+  // Determine whether to use workspace. fp16 outputs without one are
+  // accumulated into directly with packed atomics.
+  bool hasWorkspace =
+      outputType.getElementType() == b.getF16Type() && op.workspace();
+
+  // Emit utility kernels.
+  int64_t gemmId = op->getAttrOfType<IntegerAttr>("gemm_id").getInt();
+  assert((gemmId >= 0) && (gemmId < 3));
+  switch (gemmId) {
+  case 0:
+    // The 0th kernel will 0-init the output (or the workspace).
+    return zeroInit(op, b);
+  case 2:
+    // The 2nd kernel, if used, will conduct element-wise fp32->fp16 conversion
+    // from the workspace to the output.
+    assert(hasWorkspace);
+    return elementwiseConversion(op, b);
+  case 1:
+  default:
+    break;
+  }
+  // The 1st kernel will conduct the actual forward convolution using atomic
+  // adds.
+
+  // Get shape of filter tensor.
+  auto filterType = op.filter().getType().template cast<MemRefType>();
+  auto filterShape = filterType.getShape();
+
+  // Get shape of input tensor.
+  auto inputType = op.input().getType().template cast<MemRefType>();
+  auto inputShape = inputType.getShape();
+
+  // Obtain convolution parameters: padding / dialtion / stride.
+  int64_t leftPadH = ctx.getPaddingVal()[0];
+  int64_t leftPadW = ctx.getPaddingVal()[2];
+  int64_t rightPadH = ctx.getPaddingVal()[1];
+  int64_t rightPadW = ctx.getPaddingVal()[3];
+
+  int64_t dilationH = ctx.getDilationVal()[0];
+  int64_t dilationW = ctx.getDilationVal()[1];
+  int64_t strideH = ctx.getStrideVal()[0];
+  int64_t strideW = ctx.getStrideVal()[1];
+  ConvolutionDims convDims = ctx.getConvDims();
+
+  llvm::SmallVector<StringRef, 5> filterNames, inputNames, outputNames;
+  if (failed(getConvDimNames(op, filterNames, inputNames, outputNames))) {
+    return failure();
+  }
+
+  // Orders the reduction dimensions the way they are laid out in memory.
+  auto sortByStart = [](BottomUpTMBuilder &transform,
+                        SmallVectorImpl<StringRef> &names) {
+    std::sort(names.begin(), names.end(),
+              [&transform](const StringRef &v1, const StringRef &v2) -> bool {
+                return transform.startIndex(v1) < transform.startIndex(v2);
+              });
+  };
+
+  Value gemmFilterKPack, gemmInputKPack, gemmOutput;
+  // Transform filter tensor.
+  {
+    // Split C into c0, of size kBlocks, and c1
+    llvm::StringMap<uint32_t> splitDims =
+        expandNamesInPlace(filterNames, {{"c", {"c0", "c1"}}});
+    BottomUpTMBuilder splitTransform(b, filterNames, filterShape, loc);
+    BottomUpTMTopDimsWrapper splitWrap(splitTransform, std::move(splitDims));
+    splitWrap.passThrough({"g", "k"});
+    splitWrap.unmerge({"c0", "c1"}, "c",
+                      {gemmKBlocks, convDims.c / gemmKBlocks});
+    splitWrap.passThrough({"y", "x"});
+
+    TransformMapAttr splitTransformAttr = splitTransform.get();
+    Value split = b.create<TransformOp>(loc, op.filter(), splitTransformAttr);
+
+    // Merge c0 into the G dimension as its minor index, c1YX into gemmK and
+    // send K to gemmM as usual
+    auto gemmTransform =
+        BottomUpTMBuilder::above(splitTransform, splitTransformAttr);
+    llvm::SmallVector<StringRef, 3> reduceDims = {"c1", "y", "x"};
+    sortByStart(gemmTransform, reduceDims);
+    gemmTransform.merge("gemmG", 0, {"g", "c0"});
+    gemmTransform.merge("gemmK", 1, reduceDims);
+    gemmTransform.passThrough({"gemmM"}, {2}, {"k"});
+
+    TransformMapAttr gemmTransformAttr = gemmTransform.get();
+    Value gemmFilter = b.create<TransformOp>(loc, split, gemmTransformAttr);
+
+    // KPack for filter tensor.
+    gemmFilterKPack = createKPackLogic(b, loc, gemmFilter, gemmTransform,
+                                       gemmTransformAttr, KPack);
+  }
+
+  // Transform input tensor
+  {
+    // Pad H and W and split C into c0 and c1 as in the filter
+    llvm::StringMap<uint32_t> firstTransformOutDims = expandNamesInPlace(
+        inputNames,
+        {{"ci", {"c0", "c1"}}, {"hi", {"hipad"}}, {"wi", {"wipad"}}});
+
+    BottomUpTMBuilder firstTransform(b, inputNames, inputShape, loc);
+    BottomUpTMTopDimsWrapper firstWrap(firstTransform,
+                                       std::move(firstTransformOutDims));
+    firstWrap.passThrough({"gi", "ni"});
+    firstWrap.unmerge({"c0", "c1"}, "ci",
+                      {gemmKBlocks, convDims.c / gemmKBlocks});
+    firstWrap.pad({"hipad", "wipad"}, {"hi", "wi"},
+                  {leftPadH, rightPadH, leftPadW, rightPadW});
+
+    TransformMapAttr firstTransformAttr = firstTransform.get();
+    Value firstTransformed =
+        b.create<TransformOp>(loc, op.input(), firstTransformAttr);
+
+    llvm::StringMap<uint32_t> embedOutDims = expandNamesInPlace(
+        firstTransform, {{"hipad", {"y", "ho"}}, {"wipad", {"x", "wo"}}});
+    auto embedTransform =
+        BottomUpTMBuilder::above(firstTransform, firstTransformAttr);
+    BottomUpTMTopDimsWrapper embedWrap(embedTransform, std::move(embedOutDims));
+    embedWrap.passThrough({"gi", "ni", "c0", "c1"});
+    embedWrap.embed({"y", "ho"}, {convDims.y, convDims.ho}, "hipad",
+                    {dilationH, strideH});
+    embedWrap.embed({"x", "wo"}, {convDims.x, convDims.wo}, "wipad",
+                    {dilationW, strideW});
+
+    TransformMapAttr embedTransformAttr = embedTransform.get();
+    Value embedded =
+        b.create<TransformOp>(loc, firstTransformed, embedTransformAttr);
+
+    // Merge G and c0 to gemmG, c1YX to gemmK and NHoWo to gemmN
+    auto gemmInputTransform =
+        BottomUpTMBuilder::above(embedTransform, embedTransformAttr);
+    llvm::SmallVector<StringRef, 3> reduceDims = {"c1", "y", "x"};
+    sortByStart(gemmInputTransform, reduceDims);
+    gemmInputTransform.merge("gemmG", 0, {"gi", "c0"});
+    gemmInputTransform.merge("gemmK", 1, reduceDims);
+    gemmInputTransform.merge("gemmN", 2, {"ni", "ho", "wo"});
+
+    TransformMapAttr gemmInputTransformAttr = gemmInputTransform.get();
+    Value gemmInput =
+        b.create<TransformOp>(loc, embedded, gemmInputTransformAttr);
+
+    // KPack for input tensor.
+    gemmInputKPack = createKPackLogic(b, loc, gemmInput, gemmInputTransform,
+                                      gemmInputTransformAttr, KPack);
+  }
+
+  // Transform output tensor
+  {
+    // Add a dimension, that'll be ignored when writing the output, for KBlock
+    // The existence of this dimension makes the mapping between the C matrix
+    // and the output tensor uninvertable, hence the need for atomic add
+    llvm::StringMap<uint32_t> kBlockDims =
+        expandNamesInPlace(outputNames, {{"go", {"go", "kBlock"}}});
+    BottomUpTMBuilder addKBlockTransform(b, outputNames, outputShape, loc);
+    BottomUpTMTopDimsWrapper addKBlockWrap(addKBlockTransform,
+                                           std::move(kBlockDims));
+    addKBlockWrap.passThrough("go");
+    addKBlockWrap.addDim("kBlock", gemmKBlocks);
+    addKBlockWrap.passThrough({"no", "ko", "ho", "wo"});
+
+    TransformMapAttr addKBlockTransformAttr = addKBlockTransform.get();
+    Value outputTensorInUse = (hasWorkspace) ? op.workspace() : op.output();
+    Value withKBlock = b.create<TransformOp>(loc, outputTensorInUse,
+                                             addKBlockTransformAttr);
+
+    SmallVector<StringRef, 5> nonKDims;
+    for (StringRef name : outputNames)
+      if (name != "go" && name != "ko")
+        nonKDims.push_back(name);
+
+    // Map G and kBlock to gemmG, K to gemmM and NHoWo to gemmN
+    auto gemmOutputTransform =
+        BottomUpTMBuilder::above(addKBlockTransform, addKBlockTransformAttr);
+    gemmOutputTransform.merge("gemmG", 0, {"go", "kBlock"});
+    gemmOutputTransform.passThrough({"gemmM"}, {1}, {"ko"});
+    gemmOutputTransform.merge("gemmN", 2, nonKDims);
+
+    TransformMapAttr gemmOutputTransformAttr = gemmOutputTransform.get();
+    gemmOutput =
+        b.create<TransformOp>(loc, withKBlock, gemmOutputTransformAttr);
+  }
+
+  // Set attributes for gridwise_gemm op.
+  llvm::SmallVector<NamedAttribute, 8> gridwiseGemmAttrs{
+      b.getNamedAttr("arch", archAttr), b.getNamedAttr("num_cu", numCuAttr),
+      b.getNamedAttr("xdlopsV2", b.getBoolAttr(true)),
+      b.getNamedAttr("kpack", b.getI32IntegerAttr(KPack))};
+
+  // This kernel is not run when there is padding on the GEMM
+  auto paddingInfo = PaddingInfoAttr::get(b.getContext(), 0, 0, 0);
+  auto storeMethod = StoreMethod::AtomicAdd;
+
+  auto gop = b.create<GridwiseGemmV2Op>(loc, gemmFilterKPack, gemmInputKPack,
+                                        gemmOutput, paddingInfo, storeMethod,
+                                        gridwiseGemmAttrs);
+  affixGridwiseGemmAttributes(op, gop, b);
+
+  // Finally, erase the original Conv2D op.
+  b.eraseOp(op);
+
+  return success();
+}
+
+/// Helpers for the convolution kernels that compute coordinates directly
+/// instead of going through a gridwise gemm.
+/// `index * scale + offset`, for constant `scale` and `offset`.
+static Value affineIndex(OpBuilder &b, Location loc, Value index,
+                         int64_t scale, int64_t offset) {
+  Value result = index;
+  if (scale != 1)
+    result = b.create<MulIOp>(loc, result,
+                              b.createOrFold<ConstantIndexOp>(loc, scale));
+  if (offset != 0)
+    result = b.create<AddIOp>(loc, result,
+                              b.createOrFold<ConstantIndexOp>(loc, offset));
+  return result;
+}
+
+/// Split the ID of the workitem across the grid into coordinates along
+/// `dims`, given from the fastest-moving to the slowest-moving one, and a last
+/// coordinate `slowest` holding the rest. That one is unbounded, so workitems
+/// past the end of the problem get an out of bounds coordinate there.
+static llvm::StringMap<Value>
+delinearizeWorkitemId(OpBuilder &b, Location loc, int64_t blockSize,
+                      ArrayRef<std::pair<StringRef, int64_t>> dims,
+                      StringRef slowest) {
+  Value workgroupId = b.create<WorkgroupIdOp>(loc, b.getIndexType());
+  Value workitemId = b.create<WorkitemIdOp>(loc, b.getIndexType());
+  Value rest = b.create<AddIOp>(
+      loc, affineIndex(b, loc, workgroupId, blockSize, 0), workitemId);
+  llvm::StringMap<Value> coords;
+  for (const auto &dim : dims) {
+    Value size = b.createOrFold<ConstantIndexOp>(loc, dim.second);
+    coords[dim.first] = b.create<RemUIOp>(loc, rest, size);
+    rest = b.create<DivUIOp>(loc, rest, size);
+  }
+  coords[slowest] = rest;
+  return coords;
+}
+
+/// The `values` of the dimensions `names` of a layout, in that order.
+static SmallVector<Value, 5>
+gatherCoords(ArrayRef<StringRef> names, const llvm::StringMap<Value> &values) {
+  SmallVector<Value, 5> result;
+  for (StringRef name : names)
+    result.push_back(values.lookup(name));
+  return result;
+}
+
+/// The positions of the dimensions `checked` within the layout `names`, to
+/// check them for out of bounds accesses.
+static ArrayAttr getOobDims(Builder &b, ArrayRef<StringRef> names,
+                            ArrayRef<StringRef> checked) {
+  SmallVector<int32_t, 3> result;
+  for (auto pair : llvm::enumerate(names))
+    if (llvm::is_contained(checked, pair.value()))
+      result.push_back(pair.index());
+  return b.getI32ArrayAttr(result);
+}
+
+/// Direct forward grouped convolution, used instead of the implicit GEMM when
+/// the groups have too few channels for a GEMM tile, as in depthwise
+/// convolutions. Each workitem computes kDirectConvWoPerThread consecutive
+/// output pixels of one output row, accumulating in registers, so that each
+/// filter value it loads is reused across the whole tile. Padding, partial
+/// tiles and the workitems past the end of the grid are all handled by the
+/// range checks of the buffer loads and stores.
+LogicalResult directGroupedConv(Conv2DOp op, const ConvolutionContext &ctx,
+                                PatternRewriter &b) {
+  Location loc = op.getLoc();
+  ConvolutionDims convDims = ctx.getConvDims();
+
+  int64_t leftPadH = ctx.getPaddingVal()[0];
+  int64_t leftPadW = ctx.getPaddingVal()[2];
+  int64_t dilationH = ctx.getDilationVal()[0];
+  int64_t dilationW = ctx.getDilationVal()[1];
+  int64_t strideH = ctx.getStrideVal()[0];
+  int64_t strideW = ctx.getStrideVal()[1];
+
+  SmallVector<StringRef, 5> filterNames, inputNames, outputNames;
+  if (failed(getConvDimNames(op, filterNames, inputNames, outputNames)))
+    return failure();
+
+  int64_t blockSize = op->getAttrOfType<IntegerAttr>("block_size").getInt();
+  constexpr int64_t woPerThread = kDirectConvWoPerThread;
+  int64_t woTiles = math_util::integer_divide_ceil(convDims.wo, woPerThread);
+
+  Type dataType = op.input().getType().cast<MemRefType>().getElementType();
+  Type outputType = op.output().getType().cast<MemRefType>().getElementType();
+  bool isInt = dataType.isa<IntegerType>();
+  Type accType = isInt ? b.getI32Type() : b.getF32Type();
+
+  // Workitems are laid out as (g, n, k, ho, wo tile), with the wo tile
+  // moving fastest. Those past the end of the convolution get an out of
+  // bounds g.
+  llvm::StringMap<Value> coords = delinearizeWorkitemId(
+      b, loc, blockSize,
+      {{"wo", woTiles}, {"ho", convDims.ho}, {"k", convDims.k},
+       {"n", convDims.n}},
+      "g");
+  Value wo0 = affineIndex(b, loc, coords["wo"], woPerThread, 0);
+
+  ArrayAttr noOob = b.getI32ArrayAttr({});
+  ArrayAttr filterRightOob = getOobDims(b, filterNames, {"g"});
+  ArrayAttr inputLeftOob = getOobDims(b, inputNames, {"hi", "wi"});
+  ArrayAttr inputRightOob = getOobDims(b, inputNames, {"gi", "hi", "wi"});
+  ArrayAttr outputRightOob = getOobDims(b, outputNames, {"go", "wo"});
+
+  Value zero = b.createOrFold<ConstantIndexOp>(loc, 0);
+  Value one = b.createOrFold<ConstantIndexOp>(loc, 1);
+  Value cEnd = b.createOrFold<ConstantIndexOp>(loc, convDims.c);
+  Value yEnd = b.createOrFold<ConstantIndexOp>(loc, convDims.y);
+  Value xEnd = b.createOrFold<ConstantIndexOp>(loc, convDims.x);
+  SmallVector<Value, woPerThread> initAccs(
+      woPerThread, createZeroConstantOp(b, loc, accType));
+
+  // for c, y, x: load the filter value once, then accumulate its products
+  // with the inputs under each of the output pixels of the tile.
+  auto cLoop = b.create<scf::ForOp>(loc, zero, cEnd, one, initAccs);
+  {
+    OpBuilder::InsertionGuard guard(b);
+    b.setInsertionPointToStart(cLoop.getBody());
+    auto yLoop = b.create<scf::ForOp>(loc, zero, yEnd, one,
+                                      cLoop.getRegionIterArgs());
+    b.setInsertionPointToStart(yLoop.getBody());
+    auto xLoop = b.create<scf::ForOp>(loc, zero, xEnd, one,
+                                      yLoop.getRegionIterArgs());
+    b.setInsertionPointToStart(xLoop.getBody());
+
+    Value c = cLoop.getInductionVar();
+    Value y = yLoop.getInductionVar();
+    Value x = xLoop.getInductionVar();
+
+    llvm::StringMap<Value> filterCoords;
+    filterCoords["g"] = coords["g"];
+    filterCoords["k"] = coords["k"];
+    filterCoords["c"] = c;
+    filterCoords["y"] = y;
+    filterCoords["x"] = x;
+    Value filterVal = b.create<BufferLoadOp>(
+        loc, dataType, op.filter(), noOob, filterRightOob,
+        gatherCoords(filterNames, filterCoords));
+    filterVal = createTypeConversionOp(b, loc, filterVal, accType);
+
+    llvm::StringMap<Value> inputCoords;
+    inputCoords["gi"] = coords["g"];
+    inputCoords["ni"] = coords["n"];
+    inputCoords["ci"] = c;
+    inputCoords["hi"] = b.create<AddIOp>(
+        loc, affineIndex(b, loc, coords["ho"], strideH, -leftPadH),
+        affineIndex(b, loc, y, dilationH, 0));
+    Value wiBase =
+        b.create<AddIOp>(loc, affineIndex(b, loc, wo0, strideW, -leftPadW),
+                         affineIndex(b, loc, x, dilationW, 0));
+
+    SmallVector<Value, woPerThread> accs;
+    for (int64_t i = 0; i < woPerThread; ++i) {
+      inputCoords["wi"] = affineIndex(b, loc, wiBase, 1, i * strideW);
+      Value inputVal = b.create<BufferLoadOp>(
+          loc, dataType, op.input(), inputLeftOob, inputRightOob,
+          gatherCoords(inputNames, inputCoords));
+      inputVal = createTypeConversionOp(b, loc, inputVal, accType);
+      Value acc = xLoop.getRegionIterArgs()[i];
+      if (isInt)
+        acc = b.create<AddIOp>(loc, acc,
+                               b.create<MulIOp>(loc, inputVal, filterVal));
+      else
+        acc = b.create<AddFOp>(loc, acc,
+                               b.create<MulFOp>(loc, inputVal, filterVal));
+      accs.push_back(acc);
+    }
+    b.create<scf::YieldOp>(loc, accs);
+
+    b.setInsertionPointAfter(xLoop);
+    b.create<scf::YieldOp>(loc, xLoop.getResults());
+    b.setInsertionPointAfter(yLoop);
+    b.create<scf::YieldOp>(loc, yLoop.getResults());
+  }
+
+  llvm::StringMap<Value> outputCoords;
+  outputCoords["go"] = coords["g"];
+  outputCoords["no"] = coords["n"];
+  outputCoords["ko"] = coords["k"];
+  outputCoords["ho"] = coords["ho"];
+  for (int64_t i = 0; i < woPerThread; ++i) {
+    outputCoords["wo"] = affineIndex(b, loc, wo0, 1, i);
+    Value result =
+        createTypeConversionOp(b, loc, cLoop.getResult(i), outputType);
+    b.create<BufferStoreOp>(loc, result, op.output(), noOob, outputRightOob,
+                            gatherCoords(outputNames, outputCoords),
+                            StoreMethod::Set);
+  }
+
+  b.eraseOp(op);
+  return success();
+}
+
+/// Skinny gemm, used instead of a gridwise gemm when c has at most
+/// kSkinnyGemmMaxN rows or columns, as the matrix-vector products of batch-1
+/// inference do. Such gemms are bound by reading their long operand, so each
+/// wave computes one row of the long side of c against the whole short side:
+/// its lanes stride through K with the widest loads of the long operand its
+/// layout allows, accumulate their partial dot products in registers and sum
+/// them with a miopen.warp_reduce, after which the first lane writes the row.
+/// Waves past the last row load zeros and their stores are dropped by the
+/// range checks.
+LogicalResult skinnyGemm(GemmOp op, PatternRewriter &b) {
+  Location loc = op.getLoc();
+  auto cType = op.c().getType().cast<MemRefType>();
+  ArrayRef<int64_t> cShape = cType.getShape();
+  ArrayRef<int64_t> aShape = op.a().getType().cast<MemRefType>().getShape();
+  int64_t k = op.transposeA() ? aShape[1] : aShape[2];
+  Type dataType = op.a().getType().cast<MemRefType>().getElementType();
+  bool isInt = dataType.isa<IntegerType>();
+  // miopen.warp_reduce moves 32-bit values, so f64 gemms are never skinny
+  assert(!dataType.isF64() && "f64 gemms take the gridwise lowering");
+  Type accType = isInt ? b.getI32Type() : b.getF32Type();
+
+  int64_t blockSize = op->getAttrOfType<IntegerAttr>("block_size").getInt();
+  int64_t waveSize = XdlopsCodeSelection::getWaveSize(
+      op->getAttrOfType<StringAttr>("arch").getValue());
+  if (blockSize % waveSize != 0)
+    return op.emitOpError("block size must be a multiple of the wave size");
+  int64_t rowsPerBlock = blockSize / waveSize;
+
+  SmallVector<StringRef, 3> aNames = {"g", "m", "k"};
+  if (op.transposeA())
+    aNames = {"g", "k", "m"};
+  SmallVector<StringRef, 3> bNames = {"g", "k", "n"};
+  if (op.transposeB())
+    bNames = {"g", "n", "k"};
+  SmallVector<StringRef, 3> cNames = {"g", "m", "n"};
+
+  // The long side of c is the one its waves split, and the operand along it
+  // the one whose loads matter.
+  bool longM = cShape[1] >= cShape[2];
+  StringRef longDim = longM ? "m" : "n";
+  StringRef shortDim = longM ? "n" : "m";
+  int64_t longSize = longM ? cShape[1] : cShape[2];
+  int64_t shortSize = longM ? cShape[2] : cShape[1];
+  Value longOperand = longM ? op.a() : op.b();
+  Value shortOperand = longM ? op.b() : op.a();
+  ArrayRef<StringRef> longNames = longM ? aNames : bNames;
+  ArrayRef<StringRef> shortNames = longM ? bNames : aNames;
+
+  // Lanes load runs of K of up to 128 bits dividing K when it is contiguous
+  // in the long operand, and single elements otherwise.
+  int64_t vectorLen = 1;
+  if (longNames.back() == "k") {
+    vectorLen = 128 / dataType.getIntOrFloatBitWidth();
+    while (k % vectorLen != 0)
+      vectorLen /= 2;
+  }
+
+  Value workgroupId = b.create<WorkgroupIdOp>(loc, b.getIndexType());
+  Value tid = b.create<WorkitemIdOp>(loc, b.getIndexType());
+  Value blocksPerBatch = b.createOrFold<ConstantIndexOp>(
+      loc, math_util::integer_divide_ceil(longSize, rowsPerBlock));
+  Value waveSizeOp = b.createOrFold<ConstantIndexOp>(loc, waveSize);
+  Value lane = b.create<RemUIOp>(loc, tid, waveSizeOp);
+  llvm::StringMap<Value> coords;
+  coords["g"] = b.create<DivUIOp>(loc, workgroupId, blocksPerBatch);
+  coords[longDim] = b.create<AddIOp>(
+      loc,
+      affineIndex(b, loc, b.create<RemUIOp>(loc, workgroupId, blocksPerBatch),
+                  rowsPerBlock, 0),
+      b.create<DivUIOp>(loc, tid, waveSizeOp));
+
+  ArrayAttr noOob = b.getI32ArrayAttr({});
+  ArrayAttr longRightOob = getOobDims(b, longNames, {longDim});
+  ArrayAttr outputRightOob = getOobDims(b, cNames, {longDim});
+
+  // The elements of `operand` at k, ..., k + vectorLen - 1, as accumulators.
+  auto loadK = [&](Value operand, ArrayRef<StringRef> names, ArrayAttr oob,
+                   Value kIndex) {
+    SmallVector<Value, 16> values;
+    if (names.back() == "k" && vectorLen > 1) {
+      coords["k"] = kIndex;
+      Value vector = b.create<BufferLoadOp>(
+          loc, VectorType::get({vectorLen}, dataType), operand, noOob, oob,
+          gatherCoords(names, coords));
+      for (int64_t i = 0; i < vectorLen; ++i)
+        values.push_back(createTypeConversionOp(
+            b, loc,
+            b.create<vector::ExtractElementOp>(
+                loc, vector, b.createOrFold<ConstantIndexOp>(loc, i)),
+            accType));
+      return values;
+    }
+    for (int64_t i = 0; i < vectorLen; ++i) {
+      coords["k"] = affineIndex(b, loc, kIndex, 1, i);
+      Value value = b.create<BufferLoadOp>(loc, dataType, operand, noOob, oob,
+                                           gatherCoords(names, coords));
+      values.push_back(createTypeConversionOp(b, loc, value, accType));
+    }
+    return values;
+  };
+
+  SmallVector<Value, kSkinnyGemmMaxN> initAccs(
+      shortSize, createZeroConstantOp(b, loc, accType));
+  auto kLoop = b.create<scf::ForOp>(
+      loc, lane, b.createOrFold<ConstantIndexOp>(loc, k / vectorLen),
+      waveSizeOp, initAccs);
+  {
+    OpBuilder::InsertionGuard guard(b);
+    b.setInsertionPointToStart(kLoop.getBody());
+    Value kIndex = affineIndex(b, loc, kLoop.getInductionVar(), vectorLen, 0);
+    SmallVector<Value, 16> longValues =
+        loadK(longOperand, longNames, longRightOob, kIndex);
+    SmallVector<Value, kSkinnyGemmMaxN> accs;
+    for (int64_t s = 0; s < shortSize; ++s) {
+      coords[shortDim] = b.createOrFold<ConstantIndexOp>(loc, s);
+      SmallVector<Value, 16> shortValues =
+          loadK(shortOperand, shortNames, noOob, kIndex);
+      Value acc = kLoop.getRegionIterArgs()[s];
+      for (int64_t i = 0; i < vectorLen; ++i) {
+        if (isInt)
+          acc = b.create<AddIOp>(
+              loc, acc,
+              b.create<MulIOp>(loc, longValues[i], shortValues[i]));
+        else
+          acc = b.create<AddFOp>(
+              loc, acc,
+              b.create<MulFOp>(loc, longValues[i], shortValues[i]));
+      }
+      accs.push_back(acc);
+    }
+    b.create<scf::YieldOp>(loc, accs);
+  }
+
+  auto method = ReduceMethodAttr::get(b.getContext(), ReduceMethod::Sum);
+  SmallVector<Value, kSkinnyGemmMaxN> sums;
+  for (Value acc : kLoop.getResults())
+    sums.push_back(b.create<WarpReduceOp>(loc, accType, acc, method,
+                                          b.getI32IntegerAttr(waveSize)));
+
+  Value firstLane = b.create<CmpIOp>(loc, CmpIPredicate::eq, lane,
+                                     b.createOrFold<ConstantIndexOp>(loc, 0));
+  auto ifOp = b.create<scf::IfOp>(loc, TypeRange{}, firstLane,
+                                  /*withElseRegion=*/false);
+  {
+    OpBuilder::InsertionGuard guard(b);
+    b.setInsertionPointToStart(ifOp.thenBlock());
+    for (int64_t s = 0; s < shortSize; ++s) {
+      coords[shortDim] = b.createOrFold<ConstantIndexOp>(loc, s);
+      Value result =
+          createTypeConversionOp(b, loc, sums[s], cType.getElementType());
+      b.create<BufferStoreOp>(loc, result, op.c(), noOob, outputRightOob,
+                              gatherCoords(cNames, coords), StoreMethod::Set);
+    }
+  }
+
+  b.eraseOp(op);
+  return success();
+}
+
+/// Layer normalization. Each workgroup normalizes one row, in two passes over
+/// it. In the first, each workitem reads vectors of the row in turn and
+/// keeps the count, mean and sum of squared deviations of their elements, as
+/// in Welford's algorithm, and the workgroup combines them in LDS. The
+/// second reads the row again to write it normalized, scaled and shifted. RMS
+/// normalizations keep a zero mean, which makes the same steps sum squares.
+LogicalResult fusedLayerNorm(LayerNormOp op, PatternRewriter &b) {
+  Location loc = op.getLoc();
+  auto type = op.input().getType().cast<MemRefType>();
+  Type dataType = type.getElementType();
+  Type accType = b.getF32Type();
+  int64_t n = type.getDimSize(1);
+  int64_t blockSize = op->getAttrOfType<IntegerAttr>("block_size").getInt();
+  if (!llvm::isPowerOf2_64(blockSize))
+    return op.emitOpError("block size must be a power of 2");
+
+  // The widest buffer access dividing the row.
+  int64_t vectorLen = dataType.isF32() ? 4 : 8;
+  while (n % vectorLen != 0)
+    vectorLen /= 2;
+  Type loadType = vectorLen == 1 ? dataType
+                                 : VectorType::get({vectorLen}, dataType);
+
+  Value row = b.create<WorkgroupIdOp>(loc, b.getIndexType());
+  Value tid = b.create<WorkitemIdOp>(loc, b.getIndexType());
+  ArrayAttr noOob = b.getI32ArrayAttr({});
+  Value vectorsEnd = b.createOrFold<ConstantIndexOp>(loc, n / vectorLen);
+  Value blockSizeOp = b.createOrFold<ConstantIndexOp>(loc, blockSize);
+  Value accZero = createZeroConstantOp(b, loc, accType);
+  auto accConstant = [&](float value) {
+    return createConstantFloatOp(b, loc, accType, accType, value);
+  };
+  auto getLane = [&](Value vector, int64_t lane) -> Value {
+    Value val = vector;
+    if (vectorLen > 1)
+      val = b.create<vector::ExtractElementOp>(
+          loc, vector, b.createOrFold<ConstantIndexOp>(loc, lane));
+    return createTypeConversionOp(b, loc, val, accType);
+  };
+
+  // Pass 1: the statistics of the elements each workitem reads.
+  auto statsLoop = b.create<scf::ForOp>(loc, tid, vectorsEnd, blockSizeOp,
+                                        ValueRange{accZero, accZero, accZero});
+  {
+    OpBuilder::InsertionGuard guard(b);
+    b.setInsertionPointToStart(statsLoop.getBody());
+    Value col = affineIndex(b, loc, statsLoop.getInductionVar(), vectorLen, 0);
+    Value vector = b.create<BufferLoadOp>(loc, loadType, op.input(), noOob,
+                                          noOob, ValueRange{row, col});
+    Value count = statsLoop.getRegionIterArgs()[0];
+    Value mean = statsLoop.getRegionIterArgs()[1];
+    Value m2 = statsLoop.getRegionIterArgs()[2];
+    for (int64_t lane = 0; lane < vectorLen; ++lane) {
+      Value x = getLane(vector, lane);
+      count = b.create<AddFOp>(loc, count, accConstant(1.0f));
+      if (op.rms()) {
+        m2 = b.create<AddFOp>(loc, m2, b.create<MulFOp>(loc, x, x));
+        continue;
+      }
+      Value delta = b.create<SubFOp>(loc, x, mean);
+      mean = b.create<AddFOp>(loc, mean, b.create<DivFOp>(loc, delta, count));
+      m2 = b.create<AddFOp>(
+          loc, m2,
+          b.create<MulFOp>(loc, delta, b.create<SubFOp>(loc, x, mean)));
+    }
+    b.create<scf::YieldOp>(loc, ValueRange{count, mean, m2});
+  }
+
+  // Combine the statistics of the workitems pairwise, halving the number of
+  // workitems holding some at each step, with the counts, means and squared
+  // deviations laid out one after the other in LDS.
+  Value lds = b.create<GpuAllocOp>(
+      loc, MemRefType::get({3 * blockSize}, accType, {},
+                           gpu::GPUDialect::getWorkgroupAddressSpace()));
+  auto ldsIndex = [&](Value index, int64_t stat) {
+    return affineIndex(b, loc, index, 1, stat * blockSize);
+  };
+  for (int64_t stat = 0; stat < 3; ++stat)
+    b.create<memref::StoreOp>(loc, statsLoop.getResult(stat), lds,
+                              ValueRange{ldsIndex(tid, stat)});
+  b.create<LDSBarrierOp>(loc);
+  for (int64_t stride = blockSize / 2; stride > 0; stride /= 2) {
+    Value strideOp = b.createOrFold<ConstantIndexOp>(loc, stride);
+    Value active = b.create<CmpIOp>(loc, CmpIPredicate::ult, tid, strideOp);
+    auto ifOp = b.create<scf::IfOp>(loc, TypeRange{}, active,
+                                    /*withElseRegion=*/false);
+    {
+      OpBuilder::InsertionGuard guard(b);
+      b.setInsertionPointToStart(ifOp.thenBlock());
+      Value other = b.create<AddIOp>(loc, tid, strideOp);
+      auto load = [&](Value index, int64_t stat) -> Value {
+        return b.create<memref::LoadOp>(loc, lds,
+                                        ValueRange{ldsIndex(index, stat)});
+      };
+      Value countA = load(tid, 0), meanA = load(tid, 1), m2A = load(tid, 2);
+      Value countB = load(other, 0), meanB = load(other, 1),
+            m2B = load(other, 2);
+      // Workitems past the end of short rows have nothing to add.
+      Value count = b.create<AddFOp>(loc, countA, countB);
+      Value weightB = b.create<SelectOp>(
+          loc,
+          b.create<CmpFOp>(loc, CmpFPredicate::OGT, count, accZero),
+          b.create<DivFOp>(loc, countB, count), accZero);
+      Value delta = b.create<SubFOp>(loc, meanB, meanA);
+      Value mean = b.create<AddFOp>(loc, meanA,
+                                    b.create<MulFOp>(loc, delta, weightB));
+      Value m2 = b.create<AddFOp>(
+          loc, b.create<AddFOp>(loc, m2A, m2B),
+          b.create<MulFOp>(
+              loc, b.create<MulFOp>(loc, delta, delta),
+              b.create<MulFOp>(loc, countA, weightB)));
+      for (auto stat : llvm::enumerate(ValueRange{count, mean, m2}))
+        b.create<memref::StoreOp>(loc, stat.value(), lds,
+                                  ValueRange{ldsIndex(tid, stat.index())});
+    }
+    b.create<LDSBarrierOp>(loc);
+  }
+
+  Value mean = b.create<memref::LoadOp>(
+      loc, lds, ValueRange{b.createOrFold<ConstantIndexOp>(loc, blockSize)});
+  Value m2 = b.create<memref::LoadOp>(
+      loc, lds,
+      ValueRange{b.createOrFold<ConstantIndexOp>(loc, 2 * blockSize)});
+  Value variance =
+      b.create<DivFOp>(loc, m2, accConstant(static_cast<float>(n)));
+  Value rstd = b.create<math::RsqrtOp>(
+      loc, b.create<AddFOp>(loc, variance,
+                            accConstant(op.epsilon().convertToFloat())));
+
+  // Pass 2: write out (x - mean) * rstd * scale + bias.
+  Type outputType = op.output().getType().cast<MemRefType>().getElementType();
+  auto writeLoop = b.create<scf::ForOp>(loc, tid, vectorsEnd, blockSizeOp);
+  {
+    OpBuilder::InsertionGuard guard(b);
+    b.setInsertionPointToStart(writeLoop.getBody());
+    Value col = affineIndex(b, loc, writeLoop.getInductionVar(), vectorLen, 0);
+    Value vector = b.create<BufferLoadOp>(loc, loadType, op.input(), noOob,
+                                          noOob, ValueRange{row, col});
+    Value scale, bias;
+    if (op.scale())
+      scale = b.create<BufferLoadOp>(loc, loadType, op.scale(), noOob, noOob,
+                                     ValueRange{col});
+    if (op.bias())
+      bias = b.create<BufferLoadOp>(loc, loadType, op.bias(), noOob, noOob,
+                                    ValueRange{col});
+    Value result = vector;
+    for (int64_t lane = 0; lane < vectorLen; ++lane) {
+      Value y = b.create<MulFOp>(
+          loc, b.create<SubFOp>(loc, getLane(vector, lane), mean), rstd);
+      if (scale)
+        y = b.create<MulFOp>(loc, y, getLane(scale, lane));
+      if (bias)
+        y = b.create<AddFOp>(loc, y, getLane(bias, lane));
+      y = createTypeConversionOp(b, loc, y, outputType);
+      result = vectorLen == 1
+                   ? y
+                   : b.create<vector::InsertElementOp>(
+                         loc, y, result,
+                         b.createOrFold<ConstantIndexOp>(loc, lane));
+    }
+    b.create<BufferStoreOp>(loc, result, op.output(), noOob, noOob,
+                            ValueRange{row, col}, StoreMethod::Set);
+  }
+
+  b.eraseOp(op);
+  return success();
+}
+
+/// Emit `lhs * x * rhs^T`, where `x` is a p x q matrix of f32 values and
+/// `lhs`, of r rows, and `rhs`, of s rows, are constant. All matrices are
+/// row-major. Zero coefficients are skipped and those of 1 and -1 become
+/// additions and subtractions.
+static SmallVector<Value, 36>
+emitWinogradTransform(OpBuilder &b, Location loc, ArrayRef<float> lhs,
+                      ArrayRef<Value> x, int64_t q, ArrayRef<float> rhs) {
+  Type f32 = b.getF32Type();
+  int64_t p = x.size() / q;
+  int64_t r = lhs.size() / p;
+  int64_t s = rhs.size() / q;
+  // The sum over i of coeffs[i] * term(i).
+  auto combine = [&](ArrayRef<float> coeffs,
+                     function_ref<Value(int64_t)> term) -> Value {
+    Value result;
+    for (int64_t i = 0, e = coeffs.size(); i < e; ++i) {
+      float coeff = coeffs[i];
+      if (coeff == 0.0f)
+        continue;
+      Value t = term(i);
+      if (coeff != 1.0f && coeff != -1.0f)
+        t = b.create<MulFOp>(
+            loc, createConstantFloatOp(b, loc, f32, f32, coeff), t);
+      if (!result)
+        result = (coeff == -1.0f) ? b.create<NegFOp>(loc, t) : t;
+      else if (coeff == -1.0f)
+        result = b.create<SubFOp>(loc, result, t);
+      else
+        result = b.create<AddFOp>(loc, result, t);
+    }
+    return result ? result : createZeroConstantOp(b, loc, f32);
+  };
+
+  // tmp = lhs * x, r x q.
+  SmallVector<Value, 36> tmp;
+  for (int64_t i = 0; i < r; ++i)
+    for (int64_t j = 0; j < q; ++j)
+      tmp.push_back(combine(lhs.slice(i * p, p),
+                            [&](int64_t k) { return x[k * q + j]; }));
+  // result = tmp * rhs^T, r x s.
+  SmallVector<Value, 36> result;
+  for (int64_t i = 0; i < r; ++i)
+    for (int64_t j = 0; j < s; ++j)
+      result.push_back(combine(rhs.slice(j * q, q),
+                               [&](int64_t k) { return tmp[i * q + k]; }));
+  return result;
+}
+
+/// Winograd F(m x m, 3 x 3) forward convolution, computed with f32
+/// intermediates in two kernels. Kernel 0 transforms each 3x3 filter into an
+/// alpha x alpha tile of the workspace. As it does not depend on the input,
+/// its result can be kept for constant weights. Kernel 1 has each workitem
+/// compute one m x m output tile of one output channel: for every input
+/// channel, it transforms the alpha x alpha input tile under it and
+/// accumulates its elementwise product with the filter tile in registers,
+/// then transforms the sum into the output. That replaces the 9 m^2
+/// multiplications per channel of the direct computation by alpha^2.
+LogicalResult winogradConv(Conv2DOp op, const ConvolutionContext &ctx,
+                           PatternRewriter &b) {
+  Location loc = op.getLoc();
+  ConvolutionDims convDims = ctx.getConvDims();
+
+  int64_t tile = op->getAttrOfType<IntegerAttr>("winograd_tile").getInt();
+  FailureOr<WinogradMatrices> maybeMatrices = WinogradMatrices::get(tile);
+  if (failed(maybeMatrices))
+    return op.emitOpError("unsupported Winograd tile size ") << tile;
+  const WinogradMatrices &wm = *maybeMatrices;
+  int64_t m = wm.m;
+  int64_t alpha = wm.alpha;
+
+  if (convDims.y != 3 || convDims.x != 3 ||
+      llvm::any_of(ctx.getStrideVal(), [](int64_t v) { return v != 1; }) ||
+      llvm::any_of(ctx.getDilationVal(), [](int64_t v) { return v != 1; }))
+    return op.emitOpError(
+        "Winograd needs a 3x3 filter and unit strides and dilations");
+  Value workspace = op.workspace();
+  if (!workspace)
+    return op.emitOpError("op has no workspace");
+  if (workspace.getType().cast<MemRefType>().getShape() !=
+      makeArrayRef<int64_t>({convDims.g, convDims.k, convDims.c, alpha, alpha}))
+    return op.emitOpError("Winograd workspace must be of shape [g, k, c, ")
+           << alpha << ", " << alpha << "]";
+
+  SmallVector<StringRef, 5> filterNames, inputNames, outputNames;
+  if (failed(getConvDimNames(op, filterNames, inputNames, outputNames)))
+    return failure();
+
+  int64_t blockSize = op->getAttrOfType<IntegerAttr>("block_size").getInt();
+  int64_t gemmId = op->getAttrOfType<IntegerAttr>("gemm_id").getInt();
+  Type dataType = op.input().getType().cast<MemRefType>().getElementType();
+  Type outputType = op.output().getType().cast<MemRefType>().getElementType();
+  Type f32 = b.getF32Type();
+  ArrayAttr noOob = b.getI32ArrayAttr({});
+  // The g coordinate, first in the workspace, is the only one that can be out
+  // of bounds there, and the hardware catches that by itself.
+  ArrayAttr workspaceOob = b.getI32ArrayAttr({0});
+  auto storeMethod = StoreMethod::Set;
+  auto constIndex = [&](int64_t v) -> Value {
+    return b.createOrFold<ConstantIndexOp>(loc, v);
+  };
+
+  if (gemmId == 0) {
+    // Filter transform: U = G g G^T for each (g, k, c).
+    llvm::StringMap<Value> coords = delinearizeWorkitemId(
+        b, loc, blockSize, {{"c", convDims.c}, {"k", convDims.k}}, "g");
+    ArrayAttr filterRightOob = getOobDims(b, filterNames, {"g"});
+    SmallVector<Value, 9> filterTile;
+    for (int64_t i = 0; i < 3; ++i) {
+      for (int64_t j = 0; j < 3; ++j) {
+        coords["y"] = constIndex(i);
+        coords["x"] = constIndex(j);
+        Value v = b.create<BufferLoadOp>(loc, dataType, op.filter(), noOob,
+                                         filterRightOob,
+                                         gatherCoords(filterNames, coords));
+        filterTile.push_back(createTypeConversionOp(b, loc, v, f32));
+      }
+    }
+    SmallVector<Value, 36> transformed =
+        emitWinogradTransform(b, loc, wm.g, filterTile, 3, wm.g);
+    for (int64_t i = 0; i < alpha; ++i)
+      for (int64_t j = 0; j < alpha; ++j)
+        b.create<BufferStoreOp>(
+            loc, transformed[i * alpha + j], workspace, noOob, workspaceOob,
+            ValueRange{coords["g"], coords["k"], coords["c"], constIndex(i),
+                       constIndex(j)},
+            storeMethod);
+    b.eraseOp(op);
+    return success();
+  }
+
+  // Workitems are laid out as (g, n, k, ho tile, wo tile), with the wo tile
+  // moving fastest. Those past the end of the convolution get an out of
+  // bounds g.
+  int64_t hoTiles = math_util::integer_divide_ceil(convDims.ho, m);
+  int64_t woTiles = math_util::integer_divide_ceil(convDims.wo, m);
+  llvm::StringMap<Value> coords = delinearizeWorkitemId(
+      b, loc, blockSize,
+      {{"wo", woTiles}, {"ho", hoTiles}, {"k", convDims.k},
+       {"n", convDims.n}},
+      "g");
+  int64_t leftPadH = ctx.getPaddingVal()[0];
+  int64_t leftPadW = ctx.getPaddingVal()[2];
+  Value hi0 = affineIndex(b, loc, coords["ho"], m, -leftPadH);
+  Value wi0 = affineIndex(b, loc, coords["wo"], m, -leftPadW);
+  ArrayAttr inputLeftOob = getOobDims(b, inputNames, {"hi", "wi"});
+  ArrayAttr inputRightOob = getOobDims(b, inputNames, {"gi", "hi", "wi"});
+  ArrayAttr outputRightOob = getOobDims(b, outputNames, {"go", "ho", "wo"});
+
+  SmallVector<Value, 36> initAccs(alpha * alpha,
+                                  createZeroConstantOp(b, loc, f32));
+  auto cLoop = b.create<scf::ForOp>(loc, constIndex(0),
+                                    constIndex(convDims.c), constIndex(1),
+                                    initAccs);
+  {
+    OpBuilder::InsertionGuard guard(b);
+    b.setInsertionPointToStart(cLoop.getBody());
+    Value c = cLoop.getInductionVar();
+
+    // V = B^T d B for the input tile d under the output tile.
+    llvm::StringMap<Value> inputCoords;
+    inputCoords["gi"] = coords["g"];
+    inputCoords["ni"] = coords["n"];
+    inputCoords["ci"] = c;
+    SmallVector<Value, 36> inputTile;
+    for (int64_t i = 0; i < alpha; ++i) {
+      for (int64_t j = 0; j < alpha; ++j) {
+        inputCoords["hi"] = affineIndex(b, loc, hi0, 1, i);
+        inputCoords["wi"] = affineIndex(b, loc, wi0, 1, j);
+        Value v = b.create<BufferLoadOp>(loc, dataType, op.input(),
+                                         inputLeftOob, inputRightOob,
+                                         gatherCoords(inputNames, inputCoords));
+        inputTile.push_back(createTypeConversionOp(b, loc, v, f32));
+      }
+    }
+    SmallVector<Value, 36> transformed =
+        emitWinogradTransform(b, loc, wm.bt, inputTile, alpha, wm.bt);
+
+    // M += U * V.
+    SmallVector<Value, 36> accs;
+    for (int64_t i = 0; i < alpha; ++i) {
+      for (int64_t j = 0; j < alpha; ++j) {
+        Value u = b.create<BufferLoadOp>(
+            loc, f32, workspace, noOob, workspaceOob,
+            ValueRange{coords["g"], coords["k"], c, constIndex(i),
+                       constIndex(j)});
+        Value product =
+            b.create<MulFOp>(loc, u, transformed[i * alpha + j]);
+        accs.push_back(b.create<AddFOp>(
+            loc, cLoop.getRegionIterArgs()[i * alpha + j], product));
+      }
+    }
+    b.create<scf::YieldOp>(loc, accs);
+  }
+
+  // Y = A^T M A.
+  SmallVector<Value, 36> sums(cLoop.getResults().begin(),
+                              cLoop.getResults().end());
+  SmallVector<Value, 36> outputTile =
+      emitWinogradTransform(b, loc, wm.at, sums, alpha, wm.at);
+  llvm::StringMap<Value> outputCoords;
+  outputCoords["go"] = coords["g"];
+  outputCoords["no"] = coords["n"];
+  outputCoords["ko"] = coords["k"];
+  Value ho0 = affineIndex(b, loc, coords["ho"], m, 0);
+  Value wo0 = affineIndex(b, loc, coords["wo"], m, 0);
+  for (int64_t i = 0; i < m; ++i) {
+    for (int64_t j = 0; j < m; ++j) {
+      outputCoords["ho"] = affineIndex(b, loc, ho0, 1, i);
+      outputCoords["wo"] = affineIndex(b, loc, wo0, 1, j);
+      Value result =
+          createTypeConversionOp(b, loc, outputTile[i * m + j], outputType);
+      b.create<BufferStoreOp>(loc, result, op.output(), noOob, outputRightOob,
+                              gatherCoords(outputNames, outputCoords),
+                              storeMethod);
+    }
+  }
+
+  b.eraseOp(op);
+  return success();
+}
+
+/// Dilated stride-1 forward convolution computed phase by phase. The output
+/// pixels (hq * dilationH + ph, wq * dilationW + pw) of phase (ph, pw) read
+/// the input at ((hq + y) * dilationH + ph, (wq + x) * dilationW + pw), which
+/// makes each phase a dense convolution over the input subsampled by the
+/// dilations. The phases are folded into gemmG, so that one kernel computes
+/// them all while a tile of gemmN covers neighbouring pixels of one phase,
+/// whose filter windows overlap in the subsampled input instead of being
+/// spread over dilation-strided rows and columns.
+LogicalResult dilationPhasedConv(Conv2DOp op, const ConvolutionContext &ctx,
+                                 PatternRewriter &b) {
+  Location loc = op.getLoc();
+  auto archAttr = op->getAttrOfType<StringAttr>("arch");
+  auto numCuAttr = op->getAttrOfType<IntegerAttr>("num_cu");
+  int64_t KPack = op->getAttrOfType<IntegerAttr>("kpack").getInt();
+  bool isXdlops = false;
+  if (auto xdlopsV2Attr = op->getAttrOfType<BoolAttr>("xdlopsV2"))
+    isXdlops = xdlopsV2Attr.getValue();
+
+  if (ctx.getStrideVal().size() > 2 ||
+      llvm::any_of(ctx.getStrideVal(), [](int64_t v) { return v != 1; }))
+    return op.emitOpError(
+        "dilation phases need a 2D convolution with unit strides");
+
+  ArrayRef<int64_t> filterShape =
+      op.filter().getType().cast<MemRefType>().getShape();
+  ArrayRef<int64_t> inputShape =
+      op.input().getType().cast<MemRefType>().getShape();
+  ArrayRef<int64_t> outputShape =
+      op.output().getType().cast<MemRefType>().getShape();
+
   int64_t leftPadH = ctx.getPaddingVal()[0];
   int64_t leftPadW = ctx.getPaddingVal()[2];
   int64_t rightPadH = ctx.getPaddingVal()[1];
   int64_t rightPadW = ctx.getPaddingVal()[3];
-
   int64_t dilationH = ctx.getDilationVal()[0];
   int64_t dilationW = ctx.getDilationVal()[1];
-  int64_t strideH = ctx.getStrideVal()[0];
-  int64_t strideW = ctx.getStrideVal()[1];
   ConvolutionDims convDims = ctx.getConvDims();
 
   llvm::SmallVector<StringRef, 5> filterNames, inputNames, outputNames;
-  if (failed(getConvDimNames(op, filterNames, inputNames, outputNames))) {
+  if (failed(getConvDimNames(op, filterNames, inputNames, outputNames)))
     return failure();
+
+  // Every phase has as many output rows and columns as the longest one, the
+  // others reading the input past its padding and writing past the output.
+  int64_t hoPhase = math_util::integer_divide_ceil(convDims.ho, dilationH);
+  int64_t woPhase = math_util::integer_divide_ceil(convDims.wo, dilationW);
+  int64_t extraPadH = std::max<int64_t>(
+      0, (hoPhase + convDims.y - 1) * dilationH -
+             (convDims.hi + leftPadH + rightPadH));
+  int64_t extraPadW = std::max<int64_t>(
+      0, (woPhase + convDims.x - 1) * dilationW -
+             (convDims.wi + leftPadW + rightPadW));
+
+  GemmContext gemmSize(convDims.k, convDims.c * convDims.y * convDims.x,
+                       convDims.n * hoPhase * woPhase);
+  Optional<GemmContext> maybeGemmExtraPad;
+  if (!isXdlops) {
+    PopulateParams populateParams;
+    maybeGemmExtraPad = calculatePaddingKernelSize(
+        gemmSize, ConvOpType::Fwd, obtainConvDataType(op), populateParams,
+        /*isGemm=*/false, op);
+  } else {
+    PopulateParamsXDL populateParamsXDL;
+    maybeGemmExtraPad = calculatePaddingKernelSize(
+        gemmSize, ConvOpType::Fwd, obtainConvDataType(op), populateParamsXDL,
+        /*isGemm=*/false, op);
   }
+  auto gemmExtraPad = maybeGemmExtraPad.getValueOr(GemmContext(0, 0, 0));
 
-  Value gemmFilter, gemmInput, gemmOutput;
-  Value gemmInputKPack, gemmOutputKPack;
-  // Transform filter tensor.
+  Value gemmFilterKPack, gemmInputKPack, gemmOutput;
+  // Transform filter tensor: every phase uses all of it.
   {
     SmallVector<StringRef, 5> nonKDims;
     for (StringRef name : filterNames)
       if (name != "g" && name != "k")
         nonKDims.push_back(name);
-    // Add a dimension, that'll be ignored when writing the output, for KBlock
-    // The existence of this dimension makes the mapping between the C matrix
-    // and the filter tensor uninvertable, hence the need for atomic add
-
-    llvm::StringMap<uint32_t> kBlockDims =
-        expandNamesInPlace(filterNames, {{{"k", {"kBlock", "k"}}}});
-    BottomUpTMBuilder addKBlockTransform(b, filterNames, filterShape, loc);
-    BottomUpTMTopDimsWrapper addKBlockWrap(addKBlockTransform,
-                                           std::move(kBlockDims));
-    addKBlockWrap.passThrough("g");
-    addKBlockWrap.addDim("kBlock", gemmKBlocks);
-    addKBlockWrap.passThrough({"k", "c", "y", "x"});
 
-    TransformMapAttr addKBlockTransformAttr = addKBlockTransform.get();
-    Value filterTensorInUse = (hasWorkspace) ? op.workspace() : op.filter();
-    Value withKBlock = b.create<miopen::TransformOp>(loc, filterTensorInUse,
-                                                     addKBlockTransformAttr);
+    BottomUpTMBuilder phaseTransform(b, filterNames, filterShape, loc);
+    phaseTransform.passThrough(filterNames);
+    phaseTransform.addDim("ph", filterNames.size(), dilationH);
+    phaseTransform.addDim("pw", filterNames.size() + 1, dilationW);
+    TransformMapAttr phaseTransformAttr = phaseTransform.get();
+    Value phased = b.create<TransformOp>(loc, op.filter(), phaseTransformAttr);
 
-    // Create GEMM filter tensor
-    // Here, we merge the KBlock dimension into the G dimension
-    // keeping the kBlock dimension as the minor index
-    // and send K to the M dimension and CYX to the N dimension as usual
-    bool isUnfold = (addKBlockTransform.endIndex("c") + 1 ==
-                     addKBlockTransform.endIndex("y")) &&
-                    (addKBlockTransform.endIndex("y") + 1 ==
-                     addKBlockTransform.endIndex("x"));
     auto gemmTransform =
-        BottomUpTMBuilder::above(addKBlockTransform, addKBlockTransformAttr);
-    gemmTransform.merge("gemmG", 0, {"g", "kBlock"});
-    gemmTransform.passThrough({"gemmM"}, {1}, {"k"});
-    gemmTransform.merge("gemmN", 2, nonKDims, isUnfold);
-
+        BottomUpTMBuilder::above(phaseTransform, phaseTransformAttr);
+    gemmTransform.merge("gemmG", 0, {"g", "ph", "pw"});
+    gemmTransform.merge("gemmK", 1, nonKDims);
+    gemmTransform.passThrough({"gemmM"}, {2}, {"k"});
     TransformMapAttr gemmTransformAttr = gemmTransform.get();
-    gemmFilter = b.create<TransformOp>(loc, withKBlock, gemmTransformAttr);
-    // This kernel is only invoked when there's no need for gemm padding
-  }
+    Value gemmFilter = b.create<TransformOp>(loc, phased, gemmTransformAttr);
 
-  // Transform input tensor
-  {
-    // Pad H and W and split N into  n0 and n1 where n0 has size kBlocks and n1
-    // is what's left
-    llvm::StringMap<uint32_t> firstTransformOutDims = expandNamesInPlace(
-        inputNames,
-        {{"ni", {"n0", "n1"}}, {"hi", {"hipad"}}, {"wi", {"wipad"}}});
+    if (gemmExtraPad.k > 0 || gemmExtraPad.m > 0) {
+      auto padTransform =
+          BottomUpTMBuilder::above(gemmTransform, gemmTransformAttr);
+      padTransform.passThrough("gemmG");
+      if (gemmExtraPad.k > 0)
+        padTransform.pad("gemmKPad", "gemmK", 0, gemmExtraPad.k);
+      else
+        padTransform.passThrough("gemmK");
+      if (gemmExtraPad.m > 0)
+        padTransform.pad("gemmMPad", "gemmM", 0, gemmExtraPad.m);
+      else
+        padTransform.passThrough("gemmM");
+      gemmTransformAttr = padTransform.get();
+      gemmTransform = padTransform;
+      gemmFilter = b.create<TransformOp>(loc, gemmFilter, gemmTransformAttr);
+    }
 
-    BottomUpTMBuilder firstTransform(b, inputNames, inputShape, loc);
-    BottomUpTMTopDimsWrapper firstWrap(firstTransform,
-                                       std::move(firstTransformOutDims));
-    firstWrap.passThrough("gi");
-    firstWrap.unmerge({"n0", "n1"}, "ni",
-                      {gemmKBlocks, convDims.n / gemmKBlocks});
-    firstWrap.passThrough("ci");
-    firstWrap.pad({"hipad", "wipad"}, {"hi", "wi"},
-                  {leftPadH, rightPadH, leftPadW, rightPadW});
+    gemmFilterKPack = createKPackLogic(b, loc, gemmFilter, gemmTransform,
+                                       gemmTransformAttr, KPack);
+  }
 
-    TransformMapAttr firstTransformAttr = firstTransform.get();
-    Value firstTransformed =
-        b.create<TransformOp>(loc, op.input(), firstTransformAttr);
+  // Transform input tensor: pad it to whole windows of every phase, then
+  // split hipad into (hq + y) * dilationH + ph, and likewise wipad.
+  {
+    BottomUpTMBuilder padTransform(b, inputNames, inputShape, loc);
+    padTransform.passThrough({"ni", "gi", "ci"});
+    padTransform.pad(
+        {"hipad", "wipad"},
+        {padTransform.startIndex("hi"), padTransform.startIndex("wi")},
+        {"hi", "wi"},
+        {leftPadH, rightPadH + extraPadH, leftPadW, rightPadW + extraPadW});
+    TransformMapAttr padTransformAttr = padTransform.get();
+    Value padded = b.create<TransformOp>(loc, op.input(), padTransformAttr);
 
-    // The usual mapping of input space to dimensions such that filter elements
-    // get multiplied by the right thing
-    llvm::StringMap<uint32_t> embedOutDims = expandNamesInPlace(
-        firstTransform, {{"hipad", {"y", "ho"}}, {"wipad", {"x", "wo"}}});
+    llvm::StringMap<uint32_t> embedDims = expandNamesInPlace(
+        padTransform,
+        {{"hipad", {"y", "hq", "ph"}}, {"wipad", {"x", "wq", "pw"}}});
     auto embedTransform =
-        BottomUpTMBuilder::above(firstTransform, firstTransformAttr);
-    BottomUpTMTopDimsWrapper embedWrap(embedTransform, std::move(embedOutDims));
-    embedWrap.passThrough({"gi", "n0", "n1", "ci"});
-    embedWrap.embed({"y", "ho"}, {convDims.y, convDims.ho}, "hipad",
-                    {dilationH, strideH});
-    embedWrap.embed({"x", "wo"}, {convDims.x, convDims.wo}, "wipad",
-                    {dilationW, strideW});
-
+        BottomUpTMBuilder::above(padTransform, padTransformAttr);
+    BottomUpTMTopDimsWrapper embedWrap(embedTransform, std::move(embedDims));
+    embedWrap.passThrough({"ni", "gi", "ci"});
+    embedWrap.embed({"y", "hq", "ph"}, {convDims.y, hoPhase, dilationH},
+                    "hipad", {dilationH, dilationH, 1});
+    embedWrap.embed({"x", "wq", "pw"}, {convDims.x, woPhase, dilationW},
+                    "wipad", {dilationW, dilationW, 1});
     TransformMapAttr embedTransformAttr = embedTransform.get();
-    Value embedded =
-        b.create<TransformOp>(loc, firstTransformed, embedTransformAttr);
+    Value embedded = b.create<TransformOp>(loc, padded, embedTransformAttr);
 
-    // Merge N1HoWO to gemmK and CYX to gemmN
-    auto gemmInputTransform =
+    auto gemmTransform =
         BottomUpTMBuilder::above(embedTransform, embedTransformAttr);
-
     llvm::SmallVector<StringRef, 3> nonNHWDims = {"ci", "y", "x"};
     std::sort(nonNHWDims.begin(), nonNHWDims.end(),
-              [&gemmInputTransform](const StringRef &v1,
-                                    const StringRef &v2) -> bool {
-                return gemmInputTransform.startIndex(v1) <
-                       gemmInputTransform.startIndex(v2);
+              [&gemmTransform](const StringRef &v1, const StringRef &v2) {
+                return gemmTransform.startIndex(v1) <
+                       gemmTransform.startIndex(v2);
               });
-    // In the gemmG dimension, unlike with gemmN, we don't have the same
-    // traversal order concerns - a step in the G dimension always first visits
-    // kBlock/N0 and then moves on to the next G
-    gemmInputTransform.merge("gemmG", 0, {"gi", "n0"});
-    gemmInputTransform.merge("gemmK", 1, {"n1", "ho", "wo"});
-    gemmInputTransform.merge("gemmN", 2, nonNHWDims);
+    gemmTransform.merge("gemmG", 0, {"gi", "ph", "pw"});
+    gemmTransform.merge("gemmK", 1, nonNHWDims);
+    gemmTransform.merge("gemmN", 2, {"ni", "hq", "wq"});
+    TransformMapAttr gemmTransformAttr = gemmTransform.get();
+    Value gemmInput = b.create<TransformOp>(loc, embedded, gemmTransformAttr);
 
-    TransformMapAttr gemmInputTransformAttr = gemmInputTransform.get();
-    gemmInput = b.create<TransformOp>(loc, embedded, gemmInputTransformAttr);
+    if (gemmExtraPad.k > 0 || gemmExtraPad.n > 0) {
+      auto gemmPadTransform =
+          BottomUpTMBuilder::above(gemmTransform, gemmTransformAttr);
+      gemmPadTransform.passThrough("gemmG");
+      if (gemmExtraPad.k > 0)
+        gemmPadTransform.pad("gemmKPad", "gemmK", 0, gemmExtraPad.k);
+      else
+        gemmPadTransform.passThrough("gemmK");
+      if (gemmExtraPad.n > 0)
+        gemmPadTransform.pad("gemmNPad", "gemmN", 0, gemmExtraPad.n);
+      else
+        gemmPadTransform.passThrough("gemmN");
+      gemmTransformAttr = gemmPadTransform.get();
+      gemmTransform = gemmPadTransform;
+      gemmInput = b.create<TransformOp>(loc, gemmInput, gemmTransformAttr);
+    }
 
-    // KPack for input tensor.
-    gemmInputKPack = createKPackLogic(b, loc, gemmInput, gemmInputTransform,
-                                      gemmInputTransformAttr, KPack);
+    gemmInputKPack = createKPackLogic(b, loc, gemmInput, gemmTransform,
+                                      gemmTransformAttr, KPack);
   }
 
-  // Transform output tensor
+  // Transform output tensor: pad it to whole phases, whose extra pixels are
+  // not written, then split hopad into hq * dilationH + ph, and likewise
+  // wopad.
   {
-    // First, split the N dimension as in the input
-    llvm::StringMap<uint32_t> outDims =
-        expandNamesInPlace(outputNames, {{"no", {"n0", "n1"}}});
-    BottomUpTMBuilder firstTransform(b, outputNames, outputShape, loc);
-    BottomUpTMTopDimsWrapper firstWrap(firstTransform, std::move(outDims));
-    firstWrap.passThrough("go");
-    firstWrap.unmerge({"n0", "n1"}, "no",
-                      {gemmKBlocks, convDims.n / gemmKBlocks});
-    firstWrap.passThrough({"ko", "ho", "wo"});
-
-    TransformMapAttr firstTransformAttr = firstTransform.get();
-    Value transformed =
-        b.create<TransformOp>(loc, op.output(), firstTransformAttr);
-
-    // Map G and N0 to gemmG, N1HW to gemmK and K to gemmM
-    auto gemmOutputTransform =
-        BottomUpTMBuilder::above(firstTransform, firstTransformAttr);
-    gemmOutputTransform.merge("gemmG", 0, {"go", "n0"});
-    gemmOutputTransform.merge("gemmK", 1, {"n1", "ho", "wo"});
-    gemmOutputTransform.passThrough({"gemmM"}, {2}, {"ko"});
+    BottomUpTMBuilder padTransform(b, outputNames, outputShape, loc);
+    padTransform.passThrough({"no", "go", "ko"});
+    padTransform.pad(
+        {"hopad", "wopad"},
+        {padTransform.startIndex("ho"), padTransform.startIndex("wo")},
+        {"ho", "wo"},
+        {0, hoPhase * dilationH - convDims.ho, 0,
+         woPhase * dilationW - convDims.wo});
+    TransformMapAttr padTransformAttr = padTransform.get();
+    Value padded = b.create<TransformOp>(loc, op.output(), padTransformAttr);
+
+    llvm::StringMap<uint32_t> unmergeDims = expandNamesInPlace(
+        padTransform, {{"hopad", {"hq", "ph"}}, {"wopad", {"wq", "pw"}}});
+    auto unmergeTransform =
+        BottomUpTMBuilder::above(padTransform, padTransformAttr);
+    BottomUpTMTopDimsWrapper unmergeWrap(unmergeTransform,
+                                         std::move(unmergeDims));
+    unmergeWrap.passThrough({"no", "go", "ko"});
+    unmergeWrap.unmerge({"hq", "ph"}, "hopad", {hoPhase, dilationH});
+    unmergeWrap.unmerge({"wq", "pw"}, "wopad", {woPhase, dilationW});
+    TransformMapAttr unmergeTransformAttr = unmergeTransform.get();
+    Value unmerged = b.create<TransformOp>(loc, padded, unmergeTransformAttr);
 
-    TransformMapAttr gemmOutputTransformAttr = gemmOutputTransform.get();
-    gemmOutput =
-        b.create<TransformOp>(loc, transformed, gemmOutputTransformAttr);
+    auto gemmTransform =
+        BottomUpTMBuilder::above(unmergeTransform, unmergeTransformAttr);
+    gemmTransform.merge("gemmG", 0, {"go", "ph", "pw"});
+    gemmTransform.passThrough({"gemmM"}, {1}, {"ko"});
+    gemmTransform.merge("gemmN", 2, {"no", "hq", "wq"});
+    TransformMapAttr gemmTransformAttr = gemmTransform.get();
+    gemmOutput = b.create<TransformOp>(loc, unmerged, gemmTransformAttr);
 
-    // KPack for output tensor.
-    gemmOutputKPack = createKPackLogic(b, loc, gemmOutput, gemmOutputTransform,
-                                       gemmOutputTransformAttr, KPack);
+    if (gemmExtraPad.m > 0 || gemmExtraPad.n > 0) {
+      auto gemmPadTransform =
+          BottomUpTMBuilder::above(gemmTransform, gemmTransformAttr);
+      gemmPadTransform.passThrough("gemmG");
+      if (gemmExtraPad.m > 0)
+        gemmPadTransform.pad("gemmMPad", "gemmM", 0, gemmExtraPad.m);
+      else
+        gemmPadTransform.passThrough("gemmM");
+      if (gemmExtraPad.n > 0)
+        gemmPadTransform.pad("gemmNPad", "gemmN", 0, gemmExtraPad.n);
+      else
+        gemmPadTransform.passThrough("gemmN");
+      gemmOutput =
+          b.create<TransformOp>(loc, gemmOutput, gemmPadTransform.get());
+    }
   }
 
   // Set attributes for gridwise_gemm op.
   llvm::SmallVector<NamedAttribute, 8> gridwiseGemmAttrs{
-      b.getNamedAttr("gemm_id", gemmIdAttr), b.getNamedAttr("arch", archAttr),
-      b.getNamedAttr("num_cu", numCuAttr)};
-
-  // Supply KPack information into gridwiseGemmAttrs.
-  if (KPack > 1) {
-    gridwiseGemmAttrs.push_back(
-        b.getNamedAttr("kpack", b.getI32IntegerAttr(KPack)));
-  }
-
-  // xdlopsV2.
+      b.getNamedAttr("arch", archAttr), b.getNamedAttr("num_cu", numCuAttr),
+      b.getNamedAttr("kpack", b.getI32IntegerAttr(KPack))};
   if (isXdlops)
     gridwiseGemmAttrs.push_back(
         b.getNamedAttr("xdlopsV2", b.getBoolAttr(true)));
+  Value requantScales = getRequantScales(op);
+  if (Attribute zeroPoint = op->getAttr("requant_zero_point"))
+    gridwiseGemmAttrs.push_back(
+        b.getNamedAttr("requant_zero_point", zeroPoint));
+  appendPrecisionAttributes(b, op, gridwiseGemmAttrs);
 
-  // This kernel is not run when there is padding on the GEMM
-  auto paddingInfo = PaddingInfoAttr::get(b.getContext(), 0, 0, 0);
-  auto storeMethod = StoreMethod::AtomicAdd;
-
-  Value gemmA = gemmOutputKPack;
-  Value gemmB = gemmInputKPack;
-  Value gemmC = gemmFilter;
+  auto paddingInfo = PaddingInfoAttr::get(b.getContext(), gemmExtraPad.m,
+                                          gemmExtraPad.k, gemmExtraPad.n);
   if (isXdlops) {
-    auto gop = b.create<GridwiseGemmV2Op>(loc, gemmA, gemmB, gemmC, paddingInfo,
-                                          storeMethod, gridwiseGemmAttrs);
+    auto gop = b.create<GridwiseGemmV2Op>(
+        loc, gemmFilterKPack, gemmInputKPack, gemmOutput, paddingInfo,
+        StoreMethod::Set, gridwiseGemmAttrs, requantScales);
     affixGridwiseGemmAttributes(op, gop, b);
   } else {
-    op->emitOpError("Backward weight atomic add kernel requires xdlops and "
-                    "shouldn't have been tried without them");
+    auto gop = b.create<GridwiseGemmOp>(loc, gemmFilterKPack, gemmInputKPack,
+                                        gemmOutput, paddingInfo,
+                                        gridwiseGemmAttrs, requantScales);
+    affixGridwiseGemmAttributes(op, gop, b);
   }
 
-  // Finally, erase the original Conv2D op.
   b.eraseOp(op);
-
   return success();
 }
 
-LogicalResult backwardData(Conv2DBwdDataOp op, PatternRewriter &b) {
+/// The input positions along one dimension that the gemms of one filter
+/// phase of a backward data convolution write: every `stride`-th one from
+/// `first` to `last`, both included.
+struct BwdDataPhaseRange {
+  int64_t first;
+  int64_t last;
+  int64_t stride;
+
+  bool contains(int64_t pos) const {
+    return pos >= first && pos <= last &&
+           (pos - first) % stride == 0;
+  }
+};
+
+/// The positions along one dimension written by each filter phase with some
+/// taps of a backward data convolution: phase `t` writes the padded positions
+/// t * dilation + i * stride for i in [tildaLeft, tildaRight).
+static SmallVector<BwdDataPhaseRange, 4>
+getBwdDataPhaseRanges(int64_t filterSize, int64_t tilda, int64_t dilation,
+                      int64_t stride, int64_t leftPad, int64_t tildaLeft,
+                      int64_t tildaRight) {
+  SmallVector<BwdDataPhaseRange, 4> ranges;
+  for (int64_t t = 0, e = std::min(filterSize, tilda); t < e; ++t)
+    ranges.push_back({t * dilation + tildaLeft * stride - leftPad,
+                      t * dilation + (tildaRight - 1) * stride - leftPad,
+                      stride});
+  return ranges;
+}
+
+/// Whether the position `coord` along a dimension of length `size` is in one
+/// of `ranges`, checking only what the bounds of the dimension do not imply.
+static Value emitInBwdDataPhases(OpBuilder &b, Location loc, Value coord,
+                                 int64_t size,
+                                 ArrayRef<BwdDataPhaseRange> ranges) {
+  Value result = b.createOrFold<ConstantIntOp>(loc, 0, 1);
+  for (const BwdDataPhaseRange &range : ranges) {
+    if (range.last < 0 || range.first >= size)
+      continue;
+    Value inRange = b.createOrFold<ConstantIntOp>(loc, 1, 1);
+    auto check = [&](CmpIPredicate pred, int64_t value) {
+      Value cmp = b.create<CmpIOp>(loc, pred, coord,
+                                   b.createOrFold<ConstantIndexOp>(loc, value));
+      inRange = b.createOrFold<AndIOp>(loc, cmp, inRange);
+    };
+    if (range.stride > 1) {
+      int64_t residue =
+          (range.first % range.stride + range.stride) % range.stride;
+      Value cmp = b.create<CmpIOp>(
+          loc, CmpIPredicate::eq,
+          b.create<RemUIOp>(loc, coord,
+                            b.createOrFold<ConstantIndexOp>(loc, range.stride)),
+          b.createOrFold<ConstantIndexOp>(loc, residue));
+      inRange = b.createOrFold<AndIOp>(loc, cmp, inRange);
+    }
+    if (range.first > 0)
+      check(CmpIPredicate::uge, range.first);
+    if (range.last < size - 1)
+      check(CmpIPredicate::ule, range.last);
+    result = b.createOrFold<OrIOp>(loc, inRange, result);
+  }
+  return result;
+}
+
+/// Zero the pixels of the input of a backward data convolution that none of
+/// its gemms write, which strides longer than the filter or dilations leave
+/// between the phases, and padding at the edges. The workitems of the kernel
+/// of gemm ID 0 do so in a grid-stride loop ahead of its gemm: these pixels
+/// are disjoint from those of every gemm, so no kernel has to wait for them,
+/// and the rest of the input is only written once.
+static void zeroUnwrittenInput(OpBuilder &b, Location loc, Conv2DBwdDataOp op,
+                               ArrayRef<StringRef> inputNames,
+                               ArrayRef<BwdDataPhaseRange> hRanges,
+                               ArrayRef<BwdDataPhaseRange> wRanges) {
+  auto inputType = op.input().getType().cast<MemRefType>();
+  ArrayRef<int64_t> inputShape = inputType.getShape();
+  int64_t hi = inputShape[llvm::find(inputNames, "hi") - inputNames.begin()];
+  int64_t wi = inputShape[llvm::find(inputNames, "wi") - inputNames.begin()];
+  auto coversAll = [](int64_t size, ArrayRef<BwdDataPhaseRange> ranges) {
+    for (int64_t pos = 0; pos < size; ++pos)
+      if (llvm::none_of(ranges, [&](const BwdDataPhaseRange &range) {
+            return range.contains(pos);
+          }))
+        return false;
+    return true;
+  };
+  if (coversAll(hi, hRanges) && coversAll(wi, wRanges))
+    return;
+
+  int64_t blockSize = op->getAttrOfType<IntegerAttr>("block_size").getInt();
+  int64_t gridSize = op->getParentOfType<func::FuncOp>()
+                         ->getAttrOfType<IntegerAttr>("grid_size")
+                         .getInt();
+  Value workgroupId = b.create<WorkgroupIdOp>(loc, b.getIndexType());
+  Value workitemId = b.create<WorkitemIdOp>(loc, b.getIndexType());
+  Value start = b.create<AddIOp>(
+      loc, affineIndex(b, loc, workgroupId, blockSize, 0), workitemId);
+  auto loop = b.create<scf::ForOp>(
+      loc, start,
+      b.createOrFold<ConstantIndexOp>(loc, inputType.getNumElements()),
+      b.createOrFold<ConstantIndexOp>(loc, gridSize * blockSize));
+
+  OpBuilder::InsertionGuard guard(b);
+  b.setInsertionPointToStart(loop.getBody());
+  llvm::StringMap<Value> coords;
+  Value rest = loop.getInductionVar();
+  for (int64_t d = inputShape.size() - 1; d > 0; --d) {
+    Value size = b.createOrFold<ConstantIndexOp>(loc, inputShape[d]);
+    coords[inputNames[d]] = b.create<RemUIOp>(loc, rest, size);
+    rest = b.create<DivUIOp>(loc, rest, size);
+  }
+  coords[inputNames[0]] = rest;
+
+  Value written = b.createOrFold<AndIOp>(
+      loc, emitInBwdDataPhases(b, loc, coords["hi"], hi, hRanges),
+      emitInBwdDataPhases(b, loc, coords["wi"], wi, wRanges));
+  auto ifOp = b.create<scf::IfOp>(loc, TypeRange{}, written,
+                                  /*withElseRegion=*/true);
+  b.setInsertionPointToStart(ifOp.elseBlock());
+  ArrayAttr noOob = b.getI32ArrayAttr({});
+  b.create<BufferStoreOp>(
+      loc, createZeroConstantOp(b, loc, inputType.getElementType()),
+      op.input(), noOob, noOob, gatherCoords(inputNames, coords),
+      StoreMethod::Set);
+}
+
+LogicalResult backwardData(Conv2DBwdDataOp op, const ConvolutionContext &ctx,
+                           PatternRewriter &b) {
   auto loc = op.getLoc();
   auto gemmIdAttr = op->template getAttrOfType<IntegerAttr>("gemm_id");
   auto archAttr = op->template getAttrOfType<StringAttr>("arch");
@@ -618,8 +2127,6 @@ LogicalResult backwardData(Conv2DBwdDataOp op, PatternRewriter &b) {
   auto KPackAttr = op->template getAttrOfType<IntegerAttr>("kpack");
   int64_t KPack = KPackAttr.getInt();
 
-  ConvolutionContext ctx = populateConvContext(op);
-
   // Get shape of filter tensor.
   auto filterType = op.filter().getType().template cast<MemRefType>();
   auto filterShape = filterType.getShape();
@@ -678,10 +2185,18 @@ LogicalResult backwardData(Conv2DBwdDataOp op, PatternRewriter &b) {
   int64_t wTildaSlice = iWTildaRight - iWTildaLeft;
 
   int64_t gemmId = gemmIdAttr.getInt();
-  // In case the actual gemm ID is -1, emit the zero initialization kernel.
-  if (gemmId < 0) {
-    return zeroInit(op, b);
-  }
+  if (gemmId < 0)
+    return op.emitOpError("gemm_id must not be negative");
+
+  // The kernel of gemm ID 0 also zeroes the pixels no gemm writes.
+  if (gemmId == 0)
+    zeroUnwrittenInput(b, loc, op, inputNames,
+                       getBwdDataPhaseRanges(convDims.y, yTilda, dilationH,
+                                             strideH, leftPadH, iHTildaLeft,
+                                             iHTildaRight),
+                       getBwdDataPhaseRanges(convDims.x, xTilda, dilationW,
+                                             strideW, leftPadW, iWTildaLeft,
+                                             iWTildaRight));
 
   int64_t iYTilda = gemmId / xTilda;
   int64_t iXTilda = gemmId % xTilda;
@@ -690,6 +2205,20 @@ LogicalResult backwardData(Conv2DBwdDataOp op, PatternRewriter &b) {
   int64_t xDotSlice =
       math_util::integer_divide_ceil(convDims.x - iXTilda, xTilda);
 
+  // In a single launch, the GEMMs of all the {y, x}tilda phases with some
+  // filter taps (gemm IDs with a non-empty K) are computed together by
+  // folding the phases into gemmG. Their K is the one of gemm ID 0, the
+  // longest: the filter taps past the end of shorter phases read as 0.
+  bool singleLaunch = op->hasAttr("single_launch");
+  int64_t iYTildaEnd = iYTilda + 1;
+  int64_t iXTildaEnd = iXTilda + 1;
+  if (singleLaunch) {
+    if (gemmId != 0)
+      return op.emitOpError("single launch must use gemm_id 0");
+    iYTildaEnd = std::min(convDims.y, yTilda);
+    iXTildaEnd = std::min(convDims.x, xTilda);
+  }
+
   // backward data only, it's igemm v4r1 algo
   // c is input chaneels , k is output channels
   // n is batch , yDotSlice,xDotSlice computed in above
@@ -706,14 +2235,14 @@ LogicalResult backwardData(Conv2DBwdDataOp op, PatternRewriter &b) {
 
   if (!isXdlops) {
     PopulateParams populateParams;
-    maybeGemmExtraPad =
-        calculatePaddingKernelSize(gemmSize, obtainConvDirection(op),
-                                   obtainConvDataType(op), populateParams);
+    maybeGemmExtraPad = calculatePaddingKernelSize(
+        gemmSize, obtainConvDirection(op), obtainConvDataType(op),
+        populateParams, /*isGemm=*/false, op);
   } else { // xdlops
     PopulateParamsXDL populateParamsXDL;
-    maybeGemmExtraPad =
-        calculatePaddingKernelSize(gemmSize, obtainConvDirection(op),
-                                   obtainConvDataType(op), populateParamsXDL);
+    maybeGemmExtraPad = calculatePaddingKernelSize(
+        gemmSize, obtainConvDirection(op), obtainConvDataType(op),
+        populateParamsXDL, /*isGemm=*/false, op);
   }
   auto gemmExtraPad = maybeGemmExtraPad.getValueOr(GemmContext(0, 0, 0));
 
@@ -746,7 +2275,7 @@ LogicalResult backwardData(Conv2DBwdDataOp op, PatternRewriter &b) {
     sliceTransform.slice({"ydotslice", "xdotslice"}, {"ydot", "xdot"}, {0, 0},
                          {yDotSlice, xDotSlice});
     sliceTransform.slice({"ytildaslice", "xtildaslice"}, {"ytilda", "xtilda"},
-                         {iYTilda, iXTilda}, {iYTilda + 1, iXTilda + 1});
+                         {iYTilda, iXTilda}, {iYTildaEnd, iXTildaEnd});
 
     TransformMapAttr sliceTransformAttr = sliceTransform.get();
     Value slicedFilter =
@@ -754,12 +2283,20 @@ LogicalResult backwardData(Conv2DBwdDataOp op, PatternRewriter &b) {
 
     // Set up gemm by passing g -> gemmG, merging
     // [k, ydotslice, xdotslice] to gemmK, and [c, ytildaslice, xtildaslice]
-    // to gemmM
+    // to gemmM. In a single launch, the tilda slices go to gemmG instead.
     auto gemmFilterTransform =
         BottomUpTMBuilder::above(sliceTransform, sliceTransformAttr);
-    gemmFilterTransform.passThrough({"gemmG"}, {0}, {"g"});
+    if (singleLaunch)
+      gemmFilterTransform.merge("gemmG", 0,
+                                {"g", "ytildaslice", "xtildaslice"});
+    else
+      gemmFilterTransform.passThrough({"gemmG"}, {0}, {"g"});
     gemmFilterTransform.merge("gemmK", 1, {"k", "ydotslice", "xdotslice"});
-    gemmFilterTransform.merge("gemmM", 2, {"c", "ytildaslice", "xtildaslice"});
+    if (singleLaunch)
+      gemmFilterTransform.passThrough({"gemmM"}, {2}, {"c"});
+    else
+      gemmFilterTransform.merge("gemmM", 2,
+                                {"c", "ytildaslice", "xtildaslice"});
 
     TransformMapAttr gemmFilterTransformAttr = gemmFilterTransform.get();
     gemmFilter =
@@ -834,7 +2371,7 @@ LogicalResult backwardData(Conv2DBwdDataOp op, PatternRewriter &b) {
         BottomUpTMBuilder::above(tildaEmbedTransform, tildaEmbedTransformAttr);
     sliceTransform.passThrough({"gi", "ni", "ci"});
     sliceTransform.slice({"yslice", "xslice"}, {"ytilda", "xtilda"},
-                         {iYTilda, iXTilda}, {iYTilda + 1, iXTilda + 1});
+                         {iYTilda, iXTilda}, {iYTildaEnd, iXTildaEnd});
     sliceTransform.slice({"hslice", "wslice"}, {"htilda", "wtilda"},
                          {iHTildaLeft, iWTildaLeft},
                          {iHTildaRight, iWTildaRight});
@@ -844,11 +2381,17 @@ LogicalResult backwardData(Conv2DBwdDataOp op, PatternRewriter &b) {
         b.create<TransformOp>(loc, tildaEmbedded, sliceTransformAttr);
 
     // C plus the length 1 slices (yslice and xslice) become the gemmM
-    // dimension G, N, and the h and w slices become gemmN
+    // dimension G, N, and the h and w slices become gemmN. In a single
+    // launch, G and the phase slices become gemmG and C alone is gemmM.
     auto gemmTransform =
         BottomUpTMBuilder::above(sliceTransform, sliceTransformAttr);
-    gemmTransform.passThrough({"gemmG"}, {0}, {"gi"});
-    gemmTransform.merge("gemmM", 1, {"ci", "yslice", "xslice"});
+    if (singleLaunch) {
+      gemmTransform.merge("gemmG", 0, {"gi", "yslice", "xslice"});
+      gemmTransform.passThrough({"gemmM"}, {1}, {"ci"});
+    } else {
+      gemmTransform.passThrough({"gemmG"}, {0}, {"gi"});
+      gemmTransform.merge("gemmM", 1, {"ci", "yslice", "xslice"});
+    }
     gemmTransform.merge("gemmN", 2, {"ni", "hslice", "wslice"});
 
     TransformMapAttr gemmTransformAttr = gemmTransform.get();
@@ -905,6 +2448,14 @@ LogicalResult backwardData(Conv2DBwdDataOp op, PatternRewriter &b) {
     sliceTransform.slice({"hslice", "wslice"}, {"htilda", "wtilda"},
                          {iHTildaLeft, iWTildaLeft},
                          {iHTildaRight, iWTildaRight});
+    // The output is shared by all the phases of a single launch
+    if (singleLaunch) {
+      uint32_t nEmbeddedDims = outputNames.size() + 2;
+      sliceTransform.addDim("ytildaslice", nEmbeddedDims,
+                            iYTildaEnd - iYTilda);
+      sliceTransform.addDim("xtildaslice", nEmbeddedDims + 1,
+                            iXTildaEnd - iXTilda);
+    }
 
     TransformMapAttr sliceTransformAttr = sliceTransform.get();
     Value sliced = b.create<TransformOp>(loc, embedded, sliceTransformAttr);
@@ -912,7 +2463,11 @@ LogicalResult backwardData(Conv2DBwdDataOp op, PatternRewriter &b) {
     // Merge k, yslice, and xslice to gemmK and n, hslice, and wslice to gemmN
     auto gemmOutputTransform =
         BottomUpTMBuilder::above(sliceTransform, sliceTransformAttr);
-    gemmOutputTransform.passThrough({"gemmG"}, {0}, {"go"});
+    if (singleLaunch)
+      gemmOutputTransform.merge("gemmG", 0,
+                                {"go", "ytildaslice", "xtildaslice"});
+    else
+      gemmOutputTransform.passThrough({"gemmG"}, {0}, {"go"});
     gemmOutputTransform.merge("gemmK", 1, {"ko", "yslice", "xslice"});
     gemmOutputTransform.merge("gemmN", 2, {"no", "hslice", "wslice"});
 
@@ -989,9 +2544,14 @@ LogicalResult backwardData(Conv2DBwdDataOp op, PatternRewriter &b) {
 template <typename T> struct Conv2DRewritePattern : public OpRewritePattern<T> {
   const static ArgumentFields fields;
   const static ConvOpType convOpType;
-  using OpRewritePattern<T>::OpRewritePattern;
+
+  Conv2DRewritePattern(MLIRContext *context, ConvContextGetter getConvContext)
+      : OpRewritePattern<T>(context), getConvContext(getConvContext) {}
+
+  ConvContextGetter getConvContext;
 
   LogicalResult matchAndRewrite(T op, PatternRewriter &b) const override {
+    const ConvolutionContext &ctx = getConvContext(op);
     bool isXdlops = false;
     auto xdlopsV2Attr = op->template getAttrOfType<BoolAttr>("xdlopsV2");
     if (xdlopsV2Attr && xdlopsV2Attr.getValue() == true)
@@ -999,18 +2559,13 @@ template <typename T> struct Conv2DRewritePattern : public OpRewritePattern<T> {
     auto dataType =
         op.input().getType().template cast<MemRefType>().getElementType();
     if (ConvOpType::BwdData == convOpType) {
-      return backwardData(cast<Conv2DBwdDataOp>(op), b);
+      return backwardData(cast<Conv2DBwdDataOp>(op), ctx, b);
     }
     auto loc = op.getLoc();
 
     auto archAttr = op->template getAttrOfType<StringAttr>("arch");
     auto numCuAttr = op->template getAttrOfType<IntegerAttr>("num_cu");
 
-    auto KPackAttr = op->template getAttrOfType<IntegerAttr>("kpack");
-    int64_t KPack = KPackAttr.getInt();
-
-    ConvolutionContext ctx = populateConvContext(op);
-
     // Get shape of filter tensor.
     auto filterType = op.filter().getType().template cast<MemRefType>();
     auto filterShape = filterType.getShape();
@@ -1035,7 +2590,14 @@ template <typename T> struct Conv2DRewritePattern : public OpRewritePattern<T> {
     int64_t strideW = ctx.getStrideVal()[1];
     ConvolutionDims convDims = ctx.getConvDims();
 
-    llvm::SmallVector<StringRef, 5> filterNames, inputNames, outputNames;
+    // 3D convolutions list their depth parameters after the 2D ones.
+    bool is3D = ctx.getStrideVal().size() > 2;
+    int64_t leftPadD = is3D ? ctx.getPaddingVal()[4] : 0;
+    int64_t rightPadD = is3D ? ctx.getPaddingVal()[5] : 0;
+    int64_t dilationD = is3D ? ctx.getDilationVal()[2] : 1;
+    int64_t strideD = is3D ? ctx.getStrideVal()[2] : 1;
+
+    llvm::SmallVector<StringRef, 6> filterNames, inputNames, outputNames;
     if (failed(getConvDimNames(op, filterNames, inputNames, outputNames))) {
       return failure();
     }
@@ -1047,23 +2609,49 @@ template <typename T> struct Conv2DRewritePattern : public OpRewritePattern<T> {
 
     if (!isXdlops) {
       PopulateParams populateParams;
-      maybeGemmExtraPad = calculatePaddingKernelSize(gemmSize, convOpType,
-                                                     dataType, populateParams);
+      maybeGemmExtraPad =
+          calculatePaddingKernelSize(gemmSize, convOpType, dataType,
+                                     populateParams, /*isGemm=*/false, op);
     } else { // xdlops
       PopulateParamsXDL populateParamsXDL;
-      maybeGemmExtraPad = calculatePaddingKernelSize(
-          gemmSize, convOpType, dataType, populateParamsXDL);
+      maybeGemmExtraPad =
+          calculatePaddingKernelSize(gemmSize, convOpType, dataType,
+                                     populateParamsXDL, /*isGemm=*/false, op);
     }
 
+    if (ConvOpType::Fwd == convOpType && op->hasAttr("winograd_tile"))
+      return winogradConv(cast<Conv2DOp>(op), ctx, b);
+    if (ConvOpType::Fwd == convOpType && op->hasAttr("dilation_phases"))
+      return dilationPhasedConv(cast<Conv2DOp>(op), ctx, b);
+    if (ConvOpType::Fwd == convOpType &&
+        usesDirectGroupedConv(op, convDims))
+      return directGroupedConv(cast<Conv2DOp>(op), ctx, b);
+    if (ConvOpType::Fwd == convOpType && op->hasAttr("split_k")) {
+      // The generator only splits K for xdlops fp32 / fp16 convolutions that
+      // need no padding kernel.
+      if (is3D)
+        return op.emitOpError("split-K is not supported for 3D convolutions");
+      if (!isXdlops || maybeGemmExtraPad.hasValue())
+        return op.emitOpError("split-K needs xdlops and no gemm padding");
+      return forwardAtomicAdd(cast<Conv2DOp>(op), ctx, b);
+    }
     if (ConvOpType::BwdWeight == convOpType && isXdlops &&
         (dataType == b.getF32Type() || dataType == b.getF16Type()) &&
-        !maybeGemmExtraPad.hasValue()) {
+        !maybeGemmExtraPad.hasValue() &&
+        (!op->hasAttr("deterministic") || op->hasAttr("reduce_kblocks"))) {
       // current backward weight with atomic_add can only run under xdlops +
-      // fp32 / fp16.
-      return backwardWeightAtomicAdd(cast<Conv2DBwdWeightOp>(op), b);
+      // fp32 / fp16. Deterministic ones reduce their KBlocks in a workspace
+      // or take the regular path below, which writes the filter, fp16
+      // included, from each workgroup's full GemmK.
+      return backwardWeightAtomicAdd(cast<Conv2DBwdWeightOp>(op), ctx, b);
     }
     auto gemmExtraPad = maybeGemmExtraPad.getValueOr(GemmContext(0, 0, 0));
 
+    // Only the implicit GEMM kernels carry a kpack, so read it after the
+    // dispatch to the other solvers.
+    auto KPackAttr = op->template getAttrOfType<IntegerAttr>("kpack");
+    int64_t KPack = KPackAttr.getInt();
+
     // Transform filter tensor.
 
     // set layout attribute.
@@ -1077,7 +2665,7 @@ template <typename T> struct Conv2DRewritePattern : public OpRewritePattern<T> {
     // - PassThrough G dimension to dimension 0, name it gemmG
     // - PassThrough K dimension to dimension 1, name it as gemmM.
     // - Merge non-K dimensions to dimension 2, name it as gemmN.
-    SmallVector<StringRef, 5> filterNonKDims;
+    SmallVector<StringRef, 6> filterNonKDims;
     for (StringRef name : filterNames)
       if (name != "g" && name != "k")
         filterNonKDims.push_back(name);
@@ -1088,9 +2676,9 @@ template <typename T> struct Conv2DRewritePattern : public OpRewritePattern<T> {
 
     BottomUpTMBuilder filterTransform(b, filterNames, filterShape, loc);
     filterTransform.passThrough({"gemmG"}, {0}, {"g"});
+    uint32_t kIndex = filterTransform.startIndex("k");
     bool isUnfold = filterTransform.startIndex("g") == 0 &&
-                    (filterTransform.startIndex("k") == 1 ||
-                     filterTransform.startIndex("k") == 4) &&
+                    (kIndex == 1 || kIndex == filterNames.size() - 1) &&
                     noNonKPad;
     switch (convOpType) {
     case ConvOpType::Fwd:
@@ -1176,53 +2764,93 @@ template <typename T> struct Conv2DRewritePattern : public OpRewritePattern<T> {
     }
 
     // Transform input tensor.
-    // Input tensor step 1: padded input.
-
-    // set layout attribute.
-    // Padded input tensor transformation:
-    // - Pass through ni, gi, and ci, not renaming them
-    // - Padd hi and wi as specified in padding attributes, renaming them to
-    // hipad and wipad
-    BottomUpTMBuilder padInputTransform(b, inputNames, inputShape, loc);
-    padInputTransform.passThrough("ni");
-    padInputTransform.passThrough("gi");
-    padInputTransform.passThrough("ci");
-
-    llvm::SmallVector<int64_t, 4> padArgs = {leftPadH, rightPadH, leftPadW,
-                                             rightPadW};
-    llvm::SmallVector<uint32_t, 2> padOutDims = {
-        padInputTransform.startIndex("hi"), padInputTransform.startIndex("wi")};
-    padInputTransform.pad({"hipad", "wipad"}, padOutDims, {"hi", "wi"},
-                          padArgs);
-
-    TransformMapAttr padInputTransformAttr = padInputTransform.get();
-
-    Value paddedInput =
-        b.create<TransformOp>(loc, op.input(), padInputTransformAttr);
-
-    // Input tensor step 2 : embedded input.
-    // Embedded input tensor transformation:
-    // - PassThrough gi, ni, and ci
-    // - Embed hipad to y and ho with size filter y by output h and
-    //   coefficients dilationH and strideH
-    // - Embed wipad to x and wo with size filter x by output h and
-    //   coefficients dilationW and strideW
-
-    llvm::StringMap<uint32_t> embeddedInputDims = expandNamesInPlace(
-        padInputTransform, {{"hipad", {"y", "ho"}}, {"wipad", {"x", "wo"}}});
-    BottomUpTMBuilder embedInputTransform =
-        BottomUpTMBuilder::above(padInputTransform, padInputTransformAttr);
-    BottomUpTMTopDimsWrapper embedInputWrap(embedInputTransform,
-                                            std::move(embeddedInputDims));
-    embedInputWrap.passThrough({"ni", "gi", "ci"});
-    embedInputWrap.embed({"y", "ho"}, {convDims.y, convDims.ho}, "hipad",
-                         {dilationH, strideH});
-    embedInputWrap.embed({"x", "wo"}, {convDims.x, convDims.wo}, "wipad",
-                         {dilationW, strideW});
-
-    TransformMapAttr embedInputTransformAttr = embedInputTransform.get();
-    Value embeddedInput =
-        b.create<TransformOp>(loc, paddedInput, embedInputTransformAttr);
+    //
+    // A 1x1 convolution without padding reads the input at (ho * strideH,
+    // wo * strideW) alone, so instead of padding the input and embedding the
+    // filter window in it, it views the input as strided by one embed, which
+    // unit strides make the identity. What remains are the transforms of a
+    // plain gemm, and with unit strides the merge of ni, ho and wo unfolds
+    // when they are adjacent in the input layout.
+    bool isOneByOne = !is3D && convDims.y == 1 && convDims.x == 1 &&
+                      llvm::all_of(ctx.getPaddingVal(),
+                                   [](int64_t pad) { return pad == 0; });
+    BottomUpTMBuilder embedInputTransform(b, inputNames, inputShape, loc);
+    TransformMapAttr embedInputTransformAttr;
+    Value embeddedInput;
+    if (isOneByOne) {
+      embedInputTransform.passThrough({"ni", "gi", "ci"});
+      embedInputTransform.embed({"ho"}, {embedInputTransform.startIndex("hi")},
+                                {convDims.ho}, "hi", {strideH});
+      embedInputTransform.embed({"wo"}, {embedInputTransform.startIndex("wi")},
+                                {convDims.wo}, "wi", {strideW});
+      embedInputTransformAttr = embedInputTransform.get();
+      embeddedInput =
+          b.create<TransformOp>(loc, op.input(), embedInputTransformAttr);
+    } else {
+      // Input tensor step 1: padded input.
+
+      // set layout attribute.
+      // Padded input tensor transformation:
+      // - Pass through ni, gi, and ci, not renaming them
+      // - Padd hi and wi as specified in padding attributes, renaming them to
+      // hipad and wipad, and likewise di to dipad in 3D convolutions
+      BottomUpTMBuilder padInputTransform(b, inputNames, inputShape, loc);
+      padInputTransform.passThrough("ni");
+      padInputTransform.passThrough("gi");
+      padInputTransform.passThrough("ci");
+
+      llvm::SmallVector<int64_t, 6> padArgs = {leftPadH, rightPadH, leftPadW,
+                                               rightPadW};
+      llvm::SmallVector<uint32_t, 3> padOutDims = {
+          padInputTransform.startIndex("hi"),
+          padInputTransform.startIndex("wi")};
+      llvm::SmallVector<StringRef, 3> padOutNames = {"hipad", "wipad"};
+      llvm::SmallVector<StringRef, 3> padInNames = {"hi", "wi"};
+      if (is3D) {
+        padArgs.append({leftPadD, rightPadD});
+        padOutDims.push_back(padInputTransform.startIndex("di"));
+        padOutNames.push_back("dipad");
+        padInNames.push_back("di");
+      }
+      padInputTransform.pad(padOutNames, padOutDims, padInNames, padArgs);
+
+      TransformMapAttr padInputTransformAttr = padInputTransform.get();
+
+      Value paddedInput =
+          b.create<TransformOp>(loc, op.input(), padInputTransformAttr);
+
+      // Input tensor step 2 : embedded input.
+      // Embedded input tensor transformation:
+      // - PassThrough gi, ni, and ci
+      // - Embed hipad to y and ho with size filter y by output h and
+      //   coefficients dilationH and strideH
+      // - Embed wipad to x and wo with size filter x by output h and
+      //   coefficients dilationW and strideW
+      // - Embed dipad to z and do in the same way in 3D convolutions
+
+      llvm::StringMap<SmallVector<StringRef, 2>> embeddedNames = {
+          {"hipad", {"y", "ho"}}, {"wipad", {"x", "wo"}}};
+      if (is3D)
+        embeddedNames.insert({"dipad", {"z", "do"}});
+      llvm::StringMap<uint32_t> embeddedInputDims =
+          expandNamesInPlace(padInputTransform, embeddedNames);
+      embedInputTransform =
+          BottomUpTMBuilder::above(padInputTransform, padInputTransformAttr);
+      BottomUpTMTopDimsWrapper embedInputWrap(embedInputTransform,
+                                              std::move(embeddedInputDims));
+      embedInputWrap.passThrough({"ni", "gi", "ci"});
+      embedInputWrap.embed({"y", "ho"}, {convDims.y, convDims.ho}, "hipad",
+                           {dilationH, strideH});
+      embedInputWrap.embed({"x", "wo"}, {convDims.x, convDims.wo}, "wipad",
+                           {dilationW, strideW});
+      if (is3D)
+        embedInputWrap.embed({"z", "do"}, {convDims.z, convDims.dout}, "dipad",
+                             {dilationD, strideD});
+
+      embedInputTransformAttr = embedInputTransform.get();
+      embeddedInput =
+          b.create<TransformOp>(loc, paddedInput, embedInputTransformAttr);
+    }
 
     // Input tensor step 3: GEMM'd input
     //
@@ -1239,7 +2867,11 @@ template <typename T> struct Conv2DRewritePattern : public OpRewritePattern<T> {
         BottomUpTMBuilder::above(embedInputTransform, embedInputTransformAttr);
     gemmInputTransform.passThrough({"gemmG"}, {0}, {"gi"});
 
-    llvm::SmallVector<StringRef, 3> nonNHWDims = {"ci", "y", "x"};
+    llvm::SmallVector<StringRef, 4> nonNHWDims = {"ci"};
+    if (!isOneByOne)
+      nonNHWDims.append({"y", "x"});
+    if (is3D)
+      nonNHWDims.push_back("z");
     std::sort(nonNHWDims.begin(), nonNHWDims.end(),
               [&gemmInputTransform](const StringRef &v1,
                                     const StringRef &v2) -> bool {
@@ -1247,11 +2879,16 @@ template <typename T> struct Conv2DRewritePattern : public OpRewritePattern<T> {
                        gemmInputTransform.startIndex(v2);
               });
 
-    llvm::SmallVector<StringRef, 3> mergeToK, mergeToN;
+    llvm::SmallVector<StringRef, 4> mergeToK, mergeToN;
     switch (convOpType) {
     case ConvOpType::Fwd:
       mergeToK = std::move(nonNHWDims);
-      mergeToN = {"ni", "ho", "wo"};
+      // The output layouts of 3D convolutions place the depth ahead of the
+      // height and width, as the generator does
+      if (is3D)
+        mergeToN = {"ni", "do", "ho", "wo"};
+      else
+        mergeToN = {"ni", "ho", "wo"};
       break;
     case ConvOpType::BwdWeight:
       mergeToK = {"ni", "ho", "wo"};
@@ -1260,8 +2897,21 @@ template <typename T> struct Conv2DRewritePattern : public OpRewritePattern<T> {
     case ConvOpType::BwdData:
       llvm_unreachable("Backward data is in another function");
     }
-    gemmInputTransform.merge("gemmK", 1, mergeToK);
-    gemmInputTransform.merge("gemmN", 2, mergeToN);
+    // ni, ho and wo are only contiguous in memory without strides, and
+    // unfolding does not survive gemm padding.
+    uint32_t niIndex = gemmInputTransform.startIndex("ni");
+    bool isNHWUnfold = isOneByOne && strideH == 1 && strideW == 1 &&
+                       gemmInputTransform.startIndex("ho") == niIndex + 1 &&
+                       gemmInputTransform.startIndex("wo") == niIndex + 2 &&
+                       ((convOpType == ConvOpType::Fwd &&
+                         gemmExtraPad.n == 0) ||
+                        (convOpType == ConvOpType::BwdWeight &&
+                         gemmExtraPad.k == 0));
+    gemmInputTransform.merge("gemmK", 1, mergeToK,
+                             isNHWUnfold &&
+                                 convOpType == ConvOpType::BwdWeight);
+    gemmInputTransform.merge("gemmN", 2, mergeToN,
+                             isNHWUnfold && convOpType == ConvOpType::Fwd);
 
     TransformMapAttr gemmInputTransformAttr = gemmInputTransform.get();
     Value gemmInput =
@@ -1333,7 +2983,7 @@ template <typename T> struct Conv2DRewritePattern : public OpRewritePattern<T> {
     // Output tensor transformation for backward weight:
     // - Merge non-K dimensions to dimension 1, named gemmK
     // - PassThrough K dimension to dimension 2, name it gemmM
-    SmallVector<StringRef, 5> outputNonKDims;
+    SmallVector<StringRef, 6> outputNonKDims;
     for (StringRef name : outputNames)
       if (name != "go" && name != "ko")
         outputNonKDims.push_back(name);
@@ -1459,14 +3109,23 @@ template <typename T> struct Conv2DRewritePattern : public OpRewritePattern<T> {
           b.getNamedAttr("kpack", b.getI32IntegerAttr(1)));
     }
 
+    // Requantizing convolutions hand their scales and zero point over to the
+    // gemm epilogue.
+    Value requantScales = getRequantScales(op);
+    if (Attribute zeroPoint = op->getAttr("requant_zero_point"))
+      gridwiseGemmAttrs.push_back(
+          b.getNamedAttr("requant_zero_point", zeroPoint));
+    // So do fp8 convolutions with their format and scale.
+    appendPrecisionAttributes(b, op, gridwiseGemmAttrs);
+
     if (xdlopsV2Attr && xdlopsV2Attr.getValue() == true) {
-      auto gop =
-          b.create<GridwiseGemmV2Op>(loc, gemmA, gemmB, gemmC, paddingInfo,
-                                     storeMethod, gridwiseGemmAttrs);
+      auto gop = b.create<GridwiseGemmV2Op>(loc, gemmA, gemmB, gemmC,
+                                            paddingInfo, storeMethod,
+                                            gridwiseGemmAttrs, requantScales);
       affixGridwiseGemmAttributes(op, gop, b);
     } else {
       auto gop = b.create<GridwiseGemmOp>(loc, gemmA, gemmB, gemmC, paddingInfo,
-                                          gridwiseGemmAttrs);
+                                          gridwiseGemmAttrs, requantScales);
       affixGridwiseGemmAttributes(op, gop, b);
     }
 
@@ -1485,6 +3144,14 @@ const ArgumentFields Conv2DRewritePattern<Conv2DOp>::fields = {
 template <>
 const ConvOpType Conv2DRewritePattern<Conv2DOp>::convOpType = ConvOpType::Fwd;
 
+template <>
+const ArgumentFields Conv2DRewritePattern<Conv3DOp>::fields = {
+    {0, 1, 2},
+    {"KM", "KN", "MN"},
+};
+template <>
+const ConvOpType Conv2DRewritePattern<Conv3DOp>::convOpType = ConvOpType::Fwd;
+
 template <>
 const ArgumentFields Conv2DRewritePattern<Conv2DBwdDataOp>::fields = {
     {0, 2, 1},
@@ -1507,9 +3174,168 @@ const ConvOpType Conv2DRewritePattern<Conv2DBwdWeightOp>::convOpType =
 
 // Explicitly instantiate the template to operation type
 template struct Conv2DRewritePattern<Conv2DOp>;
+template struct Conv2DRewritePattern<Conv3DOp>;
 template struct Conv2DRewritePattern<Conv2DBwdDataOp>;
 template struct Conv2DRewritePattern<Conv2DBwdWeightOp>;
 
+/// Present `source`, a matrix of the gemm with the dimensions `names`, as
+/// [gemmG, `first`, `second`], padding `first` and `second` by `firstPad` and
+/// `secondPad` and, when kPack > 1, splitting gemmK, `first`, into kPack long
+/// runs.
+static Value createGemmOperandView(OpBuilder &b, Location loc, Value source,
+                                   ArrayRef<StringRef> names, StringRef first,
+                                   StringRef second, int64_t firstPad,
+                                   int64_t secondPad, int64_t kPack) {
+  ArrayRef<int64_t> shape = source.getType().cast<MemRefType>().getShape();
+  BottomUpTMBuilder transform(b, names, shape, loc);
+  transform.passThrough({"gemmG", first, second}, {0, 1, 2},
+                        {"gemmG", first, second});
+  TransformMapAttr transformAttr = transform.get();
+  Value result = b.create<TransformOp>(loc, source, transformAttr);
+
+  if (firstPad > 0 || secondPad > 0) {
+    BottomUpTMBuilder padTransform =
+        BottomUpTMBuilder::above(transform, transformAttr);
+    padTransform.passThrough("gemmG");
+    auto padName = [](StringRef name) -> StringRef {
+      return llvm::StringSwitch<StringRef>(name)
+          .Case("gemmK", "gemmKPad")
+          .Case("gemmM", "gemmMPad")
+          .Default("gemmNPad");
+    };
+    for (auto pair : {std::make_pair(first, firstPad),
+                      std::make_pair(second, secondPad)}) {
+      if (pair.second > 0)
+        padTransform.pad(padName(pair.first), pair.first, 0, pair.second);
+      else
+        padTransform.passThrough(pair.first);
+    }
+    transform = padTransform;
+    transformAttr = padTransform.get();
+    result = b.create<TransformOp>(loc, result, transformAttr);
+  }
+
+  return createKPackLogic(b, loc, result, transform, transformAttr, kPack);
+}
+
+/// Views the packed int4 weights `packed` of a gemm, [G, K / 2, N] or, if
+/// `transposed`, [G, N, K / 2], as the [G, K, N] matrix of the bytes holding
+/// each weight: the first map splits K into the byte and the nibble and the
+/// second drops the nibble. The gridwise gemm finds the unpacked coordinates
+/// above these two innermost maps of the view.
+static Value unpackInt4Weights(OpBuilder &b, Location loc, Value packed,
+                               bool transposed) {
+  ArrayRef<int64_t> shape = packed.getType().cast<MemRefType>().getShape();
+  uint32_t kDim = transposed ? 2 : 1;
+  uint32_t nDim = transposed ? 1 : 2;
+  int64_t k = 2 * shape[kDim];
+
+  TopDownTMBuilder split(b, {"gemmG", "gemmK", "gemmN"},
+                         {shape[0], k, shape[nDim]}, loc);
+  split.passThrough({"gemmG"}, {0}, {"gemmG"});
+  split.merge({"kByte", "kNibble"}, {1, 2}, "gemmK", {k / 2, 2});
+  split.passThrough({"gemmN"}, {3}, {"gemmN"});
+  TransformMapAttr splitAttr = split.get();
+
+  TopDownTMBuilder drop = TopDownTMBuilder::below(split, splitAttr);
+  drop.passThrough({"gemmG"}, {0}, {"gemmG"});
+  drop.passThrough({"kByte"}, {kDim}, {"kByte"});
+  drop.ignore("kNibble");
+  drop.passThrough({"gemmN"}, {nDim}, {"gemmN"});
+  Value bytes = b.create<TransformOp>(loc, packed, drop.get());
+  return b.create<TransformOp>(loc, bytes, splitAttr);
+}
+
+struct LayerNormRewritePattern : public OpRewritePattern<LayerNormOp> {
+  using OpRewritePattern<LayerNormOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(LayerNormOp op,
+                                PatternRewriter &b) const override {
+    return fusedLayerNorm(op, b);
+  }
+};
+
+/// Lowers miopen.gemm straight to a gridwise gemm, viewing A as [G, K, M], B
+/// as [G, K, N] and C as [G, M, N].
+struct GemmRewritePattern : public OpRewritePattern<GemmOp> {
+  using OpRewritePattern<GemmOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(GemmOp op, PatternRewriter &b) const override {
+    if (usesSkinnyGemm(op))
+      return skinnyGemm(op, b);
+    Location loc = op.getLoc();
+    auto xdlopsV2Attr = op->getAttrOfType<BoolAttr>("xdlopsV2");
+    bool isXdlops = xdlopsV2Attr && xdlopsV2Attr.getValue();
+    Type dataType = obtainConvDataType(op);
+    int64_t kPack = op->getAttrOfType<IntegerAttr>("kpack").getInt();
+
+    ArrayRef<int64_t> cShape = op.c().getType().cast<MemRefType>().getShape();
+    ArrayRef<int64_t> aShape = op.a().getType().cast<MemRefType>().getShape();
+    int64_t k = op.transposeA() ? aShape[1] : aShape[2];
+    GemmContext gemmSize(cShape[1], k, cShape[2]);
+    Optional<GemmContext> maybeGemmExtraPad;
+    if (isXdlops)
+      maybeGemmExtraPad =
+          calculatePaddingKernelSize(gemmSize, ConvOpType::Fwd, dataType,
+                                     PopulateParamsXDL(), /*isGemm=*/true, op);
+    else
+      maybeGemmExtraPad =
+          calculatePaddingKernelSize(gemmSize, ConvOpType::Fwd, dataType,
+                                     PopulateParams(), /*isGemm=*/true, op);
+    GemmContext gemmExtraPad =
+        maybeGemmExtraPad.getValueOr(GemmContext(0, 0, 0));
+
+    SmallVector<StringRef, 3> aNames = {"gemmG", "gemmM", "gemmK"};
+    if (op.transposeA())
+      aNames = {"gemmG", "gemmK", "gemmM"};
+    SmallVector<StringRef, 3> bNames = {"gemmG", "gemmK", "gemmN"};
+    if (op.transposeB())
+      bNames = {"gemmG", "gemmN", "gemmK"};
+    // Packed int4 weights are dequantized as the gridwise gemm loads them,
+    // which only XDLOPS gemms do.
+    Value bMatrix = op.b();
+    if (op.scales()) {
+      if (!isXdlops)
+        return op.emitOpError("int4 weights need XDLOPS");
+      bMatrix = unpackInt4Weights(b, loc, op.b(), op.transposeB());
+      bNames = {"gemmG", "gemmK", "gemmN"};
+    }
+
+    Value gemmA =
+        createGemmOperandView(b, loc, op.a(), aNames, "gemmK", "gemmM",
+                              gemmExtraPad.k, gemmExtraPad.m, kPack);
+    Value gemmB =
+        createGemmOperandView(b, loc, bMatrix, bNames, "gemmK", "gemmN",
+                              gemmExtraPad.k, gemmExtraPad.n, kPack);
+    Value gemmC = createGemmOperandView(
+        b, loc, op.c(), {"gemmG", "gemmM", "gemmN"}, "gemmM", "gemmN",
+        gemmExtraPad.m, gemmExtraPad.n, /*kPack=*/1);
+
+    llvm::SmallVector<NamedAttribute, 4> gridwiseGemmAttrs{
+        b.getNamedAttr("arch", op->getAttr("arch")),
+        b.getNamedAttr("num_cu", op->getAttr("num_cu")),
+        b.getNamedAttr("kpack", b.getI32IntegerAttr(kPack))};
+    appendPrecisionAttributes(b, op, gridwiseGemmAttrs);
+    auto paddingInfo = PaddingInfoAttr::get(b.getContext(), gemmExtraPad.m,
+                                            gemmExtraPad.k, gemmExtraPad.n);
+    if (isXdlops) {
+      gridwiseGemmAttrs.push_back(
+          b.getNamedAttr("xdlopsV2", b.getBoolAttr(true)));
+      auto gop = b.create<GridwiseGemmV2Op>(
+          loc, gemmA, gemmB, gemmC, paddingInfo, StoreMethod::Set,
+          gridwiseGemmAttrs, /*requantScales=*/Value(), op.scales());
+      affixGridwiseGemmAttributes(op, gop, b);
+    } else {
+      auto gop = b.create<GridwiseGemmOp>(loc, gemmA, gemmB, gemmC,
+                                          paddingInfo, gridwiseGemmAttrs);
+      affixGridwiseGemmAttributes(op, gop, b);
+    }
+
+    b.eraseOp(op);
+    return success();
+  }
+};
+
 // MITPRewritePattern
 // Fold linarg.generic and memref.alloc generated by transpose op into
 // miopen.transform
@@ -1591,7 +3417,7 @@ struct RemoveTrivialTransposePattern
 /// a miopen.conv2d* op, return that convolution.
 static Operation *getConvUser(Value v) {
   for (Operation *user : v.getUsers()) {
-    if (isa<Conv2DOp, Conv2DBwdDataOp, Conv2DBwdWeightOp>(user))
+    if (isa<Conv2DOp, Conv3DOp, Conv2DBwdDataOp, Conv2DBwdWeightOp>(user))
       return user;
     if (auto transform = dyn_cast<TransformOp>(user))
       if (Operation *upstream = getConvUser(transform.output()))
@@ -1694,24 +3520,54 @@ struct FoldTransposingConvAccess : OpRewritePattern<linalg::GenericOp> {
       // Correct convolution so it's not vectorized
       // TODO(kdrewnia): Maybe be more intelligent here
       convolution->setAttr("matrix_c_data_per_copy", b.getI32IntegerAttr(1));
+      convolution->setAttr("matrix_c_max_data_per_copy",
+                           b.getI32IntegerAttr(1));
     }
 
     return success(!toReplace.empty());
   }
 };
 
+// Kernels address their tensors with 32 bits, so a convolution with a larger
+// tensor would read and write the wrong elements. The host splits such
+// problems along their batch before they get here, see getMinBatchLaunches.
+static LogicalResult checkAddressable(Operation *op) {
+  for (Value operand : op->getOperands()) {
+    auto type = operand.getType().dyn_cast<MemRefType>();
+    if (!type || !type.hasStaticShape())
+      continue;
+    int64_t bytes =
+        (type.getNumElements() * type.getElementTypeBitWidth() + 7) / 8;
+    if (bytes > kMaxKernelTensorBytes)
+      return op->emitOpError("tensor of ")
+             << bytes << " bytes is too large for 32-bit addressing; split "
+             << "the problem along its batch";
+  }
+  return success();
+}
+
 void MIOpenConvToGemmPass::runOnOperation() {
   MLIRContext *ctx = &getContext();
   ConversionTarget target(*ctx);
 
+  WalkResult tooLarge = getOperation()->walk([](Operation *op) {
+    if (!isa<Conv2DOp, Conv3DOp, Conv2DBwdDataOp, Conv2DBwdWeightOp>(op))
+      return WalkResult::advance();
+    return failed(checkAddressable(op)) ? WalkResult::interrupt()
+                                        : WalkResult::advance();
+  });
+  if (tooLarge.wasInterrupted())
+    return signalPassFailure();
+
   RewritePatternSet patternsTP(ctx);
   patternsTP.add<RemoveTrivialTransposePattern, FoldTransposingConvAccess>(ctx);
   if (failed(
           applyPatternsAndFoldGreedily(getOperation(), std::move(patternsTP))))
     signalPassFailure();
 
-  target.addIllegalOp<miopen::Conv2DOp, miopen::Conv2DBwdDataOp,
-                      miopen::Conv2DBwdWeightOp>();
+  target.addIllegalOp<miopen::Conv2DOp, miopen::Conv3DOp,
+                      miopen::Conv2DBwdDataOp, miopen::Conv2DBwdWeightOp,
+                      miopen::GemmOp, miopen::LayerNormOp>();
   target.addLegalOp<miopen::TransformOp, miopen::GridwiseGemmOp,
                     miopen::GridwiseGemmV2Op, miopen::WorkgroupIdOp,
                     miopen::WorkitemIdOp, miopen::BufferLoadOp,
@@ -1720,10 +3576,16 @@ void MIOpenConvToGemmPass::runOnOperation() {
   target.addLegalDialect<arith::ArithmeticDialect, memref::MemRefDialect,
                          AffineDialect, scf::SCFDialect>();
 
+  // The convolutions reuse the contexts the tuning parameters were picked
+  // with.
+  auto getConvContext = [&](Operation *op) -> const ConvolutionContext & {
+    return getChildAnalysis<ConvolutionContextAnalysis>(op).getContext();
+  };
   RewritePatternSet patterns(ctx);
-  patterns.add<Conv2DRewritePattern<Conv2DOp>,
+  patterns.add<Conv2DRewritePattern<Conv2DOp>, Conv2DRewritePattern<Conv3DOp>,
                Conv2DRewritePattern<Conv2DBwdDataOp>,
-               Conv2DRewritePattern<Conv2DBwdWeightOp>>(ctx);
+               Conv2DRewritePattern<Conv2DBwdWeightOp>>(ctx, getConvContext);
+  patterns.add<GemmRewritePattern, LayerNormRewritePattern>(ctx);
 
   if (failed(applyPartialConversion(getOperation(), target,
                                     std::move(patterns)))) {
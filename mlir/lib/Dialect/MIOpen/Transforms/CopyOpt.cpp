@@ -16,7 +16,8 @@
 // limitations under the License.
 // =============================================================================
 //
-// This pass removes redundant local memories.
+// This pass removes redundant global memories by writing the producers of
+// copied-out buffers directly into the copy destination.
 //
 //===----------------------------------------------------------------------===//
 
@@ -39,86 +40,158 @@ struct MIOpenCopyOptPass : public MIOpenCopyOptPassBase<MIOpenCopyOptPass> {
 } // end anonymous namespace
 
 //===- MICORewritePattern -------------------------------------------------===//
-//===-  ------------------------------------------------===//
-template <typename T> struct MICORewritePattern : public OpRewritePattern<T> {
-  using OpRewritePattern<T>::OpRewritePattern;
+// Forwards `memref.copy %src, %dst` when %src is, up to whole-buffer
+// reshapes, a global allocation: the allocation is replaced by %dst, viewed
+// through the inverse reshapes, so its producers write the destination
+// directly. This is legal when the allocation and its views are dead after
+// the copy and nothing else touches the destination while the allocation is
+// live. Chains of copies collapse as the pattern is reapplied.
+//===----------------------------------------------------------------------===//
+
+/// Appends to `aliases` every value that is `root` or a view of it.
+static void collectAliases(Value root, SmallVectorImpl<Value> &aliases) {
+  aliases.push_back(root);
+  for (size_t i = 0; i < aliases.size(); ++i)
+    for (Operation *user : aliases[i].getUsers())
+      if (auto view = dyn_cast<ViewLikeOpInterface>(user))
+        if (view.getViewSource() == aliases[i])
+          aliases.append(user->result_begin(), user->result_end());
+}
 
-  LogicalResult matchAndRewrite(T op, PatternRewriter &b) const override {
-    LogicalResult fail = failure();
+/// Follows views of `value` up to the memref they are all views of.
+static Value getViewRoot(Value value) {
+  while (auto view = value.getDefiningOp<ViewLikeOpInterface>())
+    value = view.getViewSource();
+  return value;
+}
 
-    // 0. Test compatibility
+/// Collects in `toMove` the view-like ops of `block` that must move before
+/// `point` for `value` to be available there. Fails if any other op would.
+static LogicalResult getOpsToHoist(Value value, Operation *point,
+                                   SmallVectorImpl<Operation *> &toMove) {
+  Block *block = point->getBlock();
+  if (value.getParentRegion()->isProperAncestor(block->getParent()))
+    return success();
+  if (auto arg = value.dyn_cast<BlockArgument>())
+    return success(arg.getOwner() == block);
+  Operation *def = value.getDefiningOp();
+  if (def->getBlock() != block)
+    return failure();
+  if (def->isBeforeInBlock(point) || llvm::is_contained(toMove, def))
+    return success();
+  if (!isa<ViewLikeOpInterface>(def) ||
+      !MemoryEffectOpInterface::hasNoEffect(def))
+    return failure();
+  for (Value operand : def->getOperands())
+    if (failed(getOpsToHoist(operand, point, toMove)))
+      return failure();
+  toMove.push_back(def);
+  return success();
+}
+
+struct MICORewritePattern : public OpRewritePattern<memref::CopyOp> {
+  using OpRewritePattern<memref::CopyOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(memref::CopyOp copy,
+                                PatternRewriter &b) const override {
+    // 0. Find the allocation being copied out, and the reshapes in between
+    SmallVector<Operation *, 2> reshapes;
+    Value src = copy.getSource();
+    while (isa_and_nonnull<memref::CollapseShapeOp, memref::ExpandShapeOp>(
+        src.getDefiningOp())) {
+      reshapes.push_back(src.getDefiningOp());
+      src = src.getDefiningOp()->getOperand(0);
+    }
+    auto alloc = src.getDefiningOp<memref::AllocOp>();
+    if (!alloc || alloc->getBlock() != copy->getBlock())
+      return failure();
     // 0.0 Global Memory Space
-    auto allocType = op.getType().template cast<MemRefType>();
+    auto allocType = alloc.getType();
     auto memSpace = allocType.getMemorySpaceAsInt();
     if (memSpace == gpu::GPUDialect::getWorkgroupAddressSpace() ||
         memSpace == gpu::GPUDialect::getPrivateAddressSpace())
-      return fail;
-
-    Value mem = op->getResult(0);
-
-    // 1. Capture allocation->copy pattern
-    Operation *writer = nullptr;
-    memref::CopyOp reader = nullptr;
-    for (auto &use : mem.getUses()) {
-      if (auto laop = dyn_cast<linalg::GenericOp>(use.getOwner())) {
-        // 1.0 Output of linalg.generic
-        if (writer)
-          return fail;
-        for (auto out : laop.outputs()) {
-          if (out == mem)
-            writer = laop;
-        }
-        if (!writer)
-          return fail;
-      } else if (auto mrop = dyn_cast<miopen::TransformOp>(use.getOwner())) {
-        // 1.1 Input of miopen.transform
-        if (writer)
-          return fail;
-        Value mrval = mrop;
-        // 1.1.0 Confirm output of miopen.conv2d
-        int cnt = 0;
-        for (auto &mruse : mrval.getUses()) {
-          if (auto convop = dyn_cast<miopen::Conv2DOp>(mruse.getOwner())) {
-            if (convop.getOperand(2) != mrval)
-              return fail;
-          }
-          cnt++;
+      return failure();
+
+    Value dst = copy.getTarget();
+    Type dstType = dst.getType();
+    Type srcType = copy.getSource().getType();
+    // 0.1 A destination of another layout can only stand in for the
+    // allocation when the allocation's users accept any layout
+    if (dstType != srcType) {
+      auto dstMemRef = dstType.cast<MemRefType>();
+      if (!reshapes.empty() || dstMemRef.getShape() != allocType.getShape() ||
+          dstMemRef.getElementType() != allocType.getElementType())
+        return failure();
+      for (Operation *user : alloc->getUsers())
+        if (!isa<linalg::LinalgOp, memref::CopyOp, memref::DeallocOp>(user))
+          return failure();
+    }
+
+    // 1. The allocation is only used up to the copy
+    Block *block = copy->getBlock();
+    SmallVector<Value, 4> srcAliases;
+    collectAliases(alloc, srcAliases);
+    SmallVector<Operation *, 2> deallocs;
+    for (Value alias : srcAliases) {
+      for (Operation *user : alias.getUsers()) {
+        if (user == copy.getOperation())
+          continue;
+        if (isa<memref::DeallocOp>(user)) {
+          if (alias != alloc)
+            return failure();
+          deallocs.push_back(user);
+          continue;
         }
-        if (cnt != 1)
-          return fail;
-        writer = mrop;
-      } else if (auto callop = dyn_cast<CallOpInterface>(use.getOwner())) {
-        // 1.3 Assume call is the writer (fails for multiple calls)
-        if (writer)
-          return fail;
-        writer = callop;
-      } else if (auto mrop = dyn_cast<memref::CopyOp>(use.getOwner())) {
-        // 1.2 Only one final memref.copy into interface memref
-        if (reader)
-          return fail;
-        if (mrop.getSource() != mem)
-          return fail;
-        reader = mrop;
-      } else {
-        // unsupported op
-        return fail;
+        Operation *ancestor = block->findAncestorOpInBlock(*user);
+        if (!ancestor || !ancestor->isBeforeInBlock(copy))
+          return failure();
       }
     }
 
-    // 2. do it
-    if (reader && writer) {
-      auto realMem = reader.getTarget();
-
-      if (mem.getType() == realMem.getType()) {
-        mem.replaceAllUsesWith(realMem);
-
-        reader->erase();
-
-        return success();
+    // 2. Nothing else accesses the destination while the allocation is live,
+    // nor may still be running asynchronously when it becomes live
+    SmallVector<Value, 4> dstAliases;
+    collectAliases(getViewRoot(dst), dstAliases);
+    for (Value alias : dstAliases) {
+      for (Operation *user : alias.getUsers()) {
+        if (user == copy.getOperation() || isa<ViewLikeOpInterface>(user))
+          continue;
+        Operation *ancestor = block->findAncestorOpInBlock(*user);
+        if (!ancestor)
+          return failure();
+        if (!ancestor->isBeforeInBlock(copy))
+          continue;
+        if (alloc->isBeforeInBlock(ancestor) || isa<async::LaunchOp>(ancestor))
+          return failure();
       }
     }
 
-    return fail;
+    // 3. The destination must be available where the allocation was made
+    SmallVector<Operation *, 2> toMove;
+    if (failed(getOpsToHoist(dst, alloc, toMove)))
+      return failure();
+
+    // 4. do it
+    for (Operation *op : toMove)
+      b.updateRootInPlace(op, [&]() { op->moveBefore(alloc); });
+    b.setInsertionPoint(alloc);
+    Value realMem = dst;
+    for (Operation *reshape : llvm::reverse(reshapes)) {
+      Value reshapeSrc = reshape->getOperand(0);
+      if (auto collapse = dyn_cast<memref::CollapseShapeOp>(reshape))
+        realMem = b.create<memref::ExpandShapeOp>(
+            collapse.getLoc(), reshapeSrc.getType(), realMem,
+            collapse.getReassociationIndices());
+      else
+        realMem = b.create<memref::CollapseShapeOp>(
+            reshape->getLoc(), reshapeSrc.getType(), realMem,
+            cast<memref::ExpandShapeOp>(reshape).getReassociationIndices());
+    }
+    b.eraseOp(copy);
+    for (Operation *dealloc : deallocs)
+      b.eraseOp(dealloc);
+    b.replaceOp(alloc, realMem);
+    return success();
   }
 };
 
@@ -128,7 +201,7 @@ template <typename T> struct MICORewritePattern : public OpRewritePattern<T> {
 void MIOpenCopyOptPass::runOnOperation() {
   MLIRContext *ctx = &getContext();
   RewritePatternSet patterns(ctx);
-  patterns.add<MICORewritePattern<memref::AllocOp>>(ctx);
+  patterns.add<MICORewritePattern>(ctx);
   if (failed(applyPatternsAndFoldGreedily(getOperation(), std::move(patterns))))
     signalPassFailure();
 }
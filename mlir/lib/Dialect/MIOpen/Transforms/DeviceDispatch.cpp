@@ -0,0 +1,110 @@
+//===- DeviceDispatch.cpp - Spread host function calls over devices -------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// This pass has every call of a host function that launches kernels run on a
+// device the runtime picks, by calling mgpuDeviceAcquire on entry and
+// mgpuDeviceRelease before every return. The function passes the chips all
+// of its kernels have code for, so that only devices it can run on are
+// picked.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Conversion/AsyncToGPU/AsyncToGPU.h"
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/SymbolTable.h"
+
+using namespace mlir;
+
+static constexpr llvm::StringLiteral kAcquireFunc = "mgpuDeviceAcquire";
+static constexpr llvm::StringLiteral kReleaseFunc = "mgpuDeviceRelease";
+
+namespace {
+struct MIOpenDeviceDispatchPass
+    : public MIOpenDeviceDispatchPassBase<MIOpenDeviceDispatchPass> {
+  void runOnOperation() override;
+};
+} // end anonymous namespace
+
+/// The set of chips `gpuMod` has code for, as the runtime tests it: one bit
+/// per chip, at its hash modulo 64.
+static uint64_t getArchMask(gpu::GPUModuleOp gpuMod) {
+  auto arch = gpuMod->getAttrOfType<StringAttr>("arch");
+  if (!arch)
+    return ~uint64_t(0);
+  SmallVector<StringRef, 2> chips;
+  arch.getValue().split(chips, ',', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+  uint64_t mask = 0;
+  for (StringRef chip : chips)
+    mask |= uint64_t(1) << (hashGPUChip(chip) % 64);
+  return mask;
+}
+
+void MIOpenDeviceDispatchPass::runOnOperation() {
+  ModuleOp mod = getOperation();
+  OpBuilder b(&getContext());
+  func::FuncOp acquireFunc, releaseFunc;
+  for (auto func : llvm::make_early_inc_range(mod.getOps<func::FuncOp>())) {
+    if (func.isExternal() || func->hasAttr("kernel"))
+      continue;
+    uint64_t mask = ~uint64_t(0);
+    bool launches = false;
+    func.walk([&](gpu::LaunchFuncOp launch) {
+      launches = true;
+      if (auto gpuMod = mod.lookupSymbol<gpu::GPUModuleOp>(
+              launch.getKernelModuleName()))
+        mask &= getArchMask(gpuMod);
+    });
+    if (!launches)
+      continue;
+    if (mask == 0) {
+      func.emitWarning("kernels have no chip in common, running them on "
+                       "any device");
+    } else if (mask == ~uint64_t(0)) {
+      mask = 0;
+    }
+
+    if (!acquireFunc) {
+      acquireFunc = miopen::getRuntimeFunc(mod, kAcquireFunc, b.getI64Type());
+      releaseFunc = miopen::getRuntimeFunc(mod, kReleaseFunc, {});
+    }
+    Location loc = func.getLoc();
+    b.setInsertionPointToStart(&func.getBody().front());
+    Value maskValue =
+        b.create<arith::ConstantIntOp>(loc, static_cast<int64_t>(mask), 64);
+    b.create<func::CallOp>(loc, acquireFunc, maskValue);
+    for (Block &block : func.getBody()) {
+      auto ret = dyn_cast<func::ReturnOp>(block.getTerminator());
+      if (!ret)
+        continue;
+      b.setInsertionPoint(ret);
+      b.create<func::CallOp>(ret.getLoc(), releaseFunc, ValueRange{});
+    }
+  }
+}
+
+//===- Passes -------------------------------------------------------------===//
+//
+
+std::unique_ptr<Pass> mlir::miopen::createMIOpenDeviceDispatchPass() {
+  return std::make_unique<MIOpenDeviceDispatchPass>();
+}
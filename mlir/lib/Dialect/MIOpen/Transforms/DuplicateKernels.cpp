@@ -0,0 +1,150 @@
+//===- DuplicateKernels.cpp -----------------------------------------------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// Models made of repeated blocks, such as the layers of a transformer, are
+// partitioned into many identical kernel funcs, each of which the bufferize
+// pipeline would lower on its own:
+//
+// - miopen-fold-duplicate-kernels keeps one func of each set of identical
+//   kernels. The calls to the others are redirected to it, and the others
+//   are erased, recording the names of those that nothing calls, such as the
+//   kernels cloned into the __miopen module, on the func that is kept.
+// - miopen-unfold-duplicate-kernels clones the lowered func back under each
+//   recorded name, so that every kernel the host expects is compiled.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/OwningOpRef.h"
+#include "mlir/IR/SymbolTable.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#define DEBUG_TYPE "miopen-duplicate-kernels"
+
+using namespace mlir;
+
+// The attributes telling a folded kernel apart from the one it was folded
+// into, recorded on the latter for each of them.
+static constexpr llvm::StringLiteral kFoldedKernelsAttr =
+    "miopen.folded_kernels";
+static constexpr llvm::StringLiteral kOriginalFuncAttr = "original_func";
+
+namespace {
+
+// The generic form of `func` without its name and the link back to the host
+// func, which two kernels that lower to the same code may differ in.
+static std::string getKernelKey(func::FuncOp func) {
+  OwningOpRef<func::FuncOp> copy(func.clone());
+  SymbolTable::setSymbolName(*copy, "kernel");
+  (*copy)->removeAttr(kOriginalFuncAttr);
+
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  (*copy)->print(os, OpPrintingFlags().printGenericOpForm());
+  return os.str();
+}
+
+// Fold the identical kernels that are direct children of `mod`.
+static void foldDuplicateKernels(ModuleOp mod, Operation *root) {
+  Builder b(mod.getContext());
+  llvm::StringMap<func::FuncOp> kernels;
+  llvm::DenseMap<Operation *, SmallVector<Attribute, 4>> folded;
+  for (auto func : llvm::make_early_inc_range(mod.getOps<func::FuncOp>())) {
+    if (!func->hasAttr("kernel") || func.isExternal())
+      continue;
+    auto inserted = kernels.try_emplace(getKernelKey(func), func);
+    if (inserted.second)
+      continue;
+    func::FuncOp kept = inserted.first->second;
+
+    LLVM_DEBUG(llvm::dbgs() << "Folding kernel " << func.getName() << " into "
+                            << kept.getName() << "\n");
+    if (SymbolTable::symbolKnownUseEmpty(func, root)) {
+      SmallVector<NamedAttribute, 2> attrs{
+          b.getNamedAttr(SymbolTable::getSymbolAttrName(),
+                         func.getNameAttr())};
+      if (Attribute original = func->getAttr(kOriginalFuncAttr))
+        attrs.push_back(b.getNamedAttr(kOriginalFuncAttr, original));
+      folded[kept].push_back(b.getDictionaryAttr(attrs));
+    } else if (failed(SymbolTable::replaceAllSymbolUses(
+                   func, kept.getNameAttr(), root))) {
+      continue;
+    }
+    func.erase();
+  }
+
+  for (auto &entry : folded)
+    entry.first->setAttr(kFoldedKernelsAttr, b.getArrayAttr(entry.second));
+}
+
+struct MIOpenFoldDuplicateKernelsPass
+    : public MIOpenFoldDuplicateKernelsPassBase<
+          MIOpenFoldDuplicateKernelsPass> {
+  void runOnOperation() override {
+    ModuleOp root = getOperation();
+    SmallVector<ModuleOp, 2> mods;
+    root.walk([&](ModuleOp mod) { mods.push_back(mod); });
+    for (ModuleOp mod : mods)
+      foldDuplicateKernels(mod, root);
+  }
+};
+
+struct MIOpenUnfoldDuplicateKernelsPass
+    : public MIOpenUnfoldDuplicateKernelsPassBase<
+          MIOpenUnfoldDuplicateKernelsPass> {
+  void runOnOperation() override {
+    SmallVector<func::FuncOp, 4> kept;
+    getOperation().walk([&](func::FuncOp func) {
+      if (func->hasAttr(kFoldedKernelsAttr))
+        kept.push_back(func);
+    });
+
+    for (func::FuncOp func : kept) {
+      auto folded = func->getAttrOfType<ArrayAttr>(kFoldedKernelsAttr);
+      func->removeAttr(kFoldedKernelsAttr);
+      OpBuilder b(func.getContext());
+      b.setInsertionPointAfter(func);
+      for (auto attrs : folded.getAsRange<DictionaryAttr>()) {
+        auto copy = cast<func::FuncOp>(b.clone(*func));
+        copy->removeAttr(kOriginalFuncAttr);
+        for (NamedAttribute attr : attrs)
+          copy->setAttr(attr.getName(), attr.getValue());
+      }
+    }
+  }
+};
+
+} // end anonymous namespace
+
+//===- Passes -------------------------------------------------------------===//
+//
+
+std::unique_ptr<Pass> mlir::miopen::createMIOpenFoldDuplicateKernelsPass() {
+  return std::make_unique<MIOpenFoldDuplicateKernelsPass>();
+}
+
+std::unique_ptr<Pass> mlir::miopen::createMIOpenUnfoldDuplicateKernelsPass() {
+  return std::make_unique<MIOpenUnfoldDuplicateKernelsPass>();
+}
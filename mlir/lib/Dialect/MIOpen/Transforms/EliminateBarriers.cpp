@@ -0,0 +1,195 @@
+//===- EliminateBarriers.cpp - Remove barriers ordering nothing -----------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// The gridwise gemm lowerings place an LDS barrier around every phase that
+// stores to or reads from LDS, and fused epilogues add their own, so that
+// consecutive phases often end up with several barriers between them, or with
+// barriers separating reads from more reads. This pass removes every
+// miopen.lds_barrier and miopen.workgroup_barrier that does not separate a
+// write of the memory it orders from another access to it:
+//
+// - the accesses that may run before it are those from the previous barrier
+//   at least as strong, going out of the ifs around it and through the tail
+//   of the previous iteration of the loops around it, to the kernel start;
+// - the accesses that may run after it are found the same way forward.
+//
+// An LDS barrier orders LDS, a workgroup barrier all memory but private
+// registers. Ops nested in the ops scanned count in full, even past the
+// barriers in them, and ops without memory effects count as reading and
+// writing all their memref operands, which keeps the analysis conservative.
+// Barriers are removed one at a time, so that each is checked against the
+// barriers left.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/MIOpen/MIOpen.h"
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Interfaces/SideEffectInterfaces.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "miopen-eliminate-barriers"
+
+using namespace mlir;
+using namespace mlir::miopen;
+
+namespace {
+struct MIOpenEliminateBarriersPass
+    : public MIOpenEliminateBarriersPassBase<MIOpenEliminateBarriersPass> {
+  void runOnOperation() override;
+};
+
+/// The accesses to the memory a barrier orders found on one side of it.
+struct Accesses {
+  bool reads = false;
+  bool writes = false;
+
+  void addAll() { reads = writes = true; }
+};
+} // end anonymous namespace
+
+static bool isBarrier(Operation *op) {
+  return isa<LDSBarrierOp, WorkgroupBarrierOp>(op);
+}
+
+/// Whether the barrier `bound` orders everything `barrier` does, so that no
+/// access `barrier` orders can cross it.
+static bool isBound(Operation *bound, Operation *barrier) {
+  return isa<WorkgroupBarrierOp>(bound) ||
+         (isa<LDSBarrierOp>(bound) && isa<LDSBarrierOp>(barrier));
+}
+
+/// Whether `barrier` orders the accesses to the memory of `value`.
+static bool isOrdered(Operation *barrier, Value value) {
+  auto type = value.getType().dyn_cast<BaseMemRefType>();
+  if (!type)
+    return false;
+  unsigned space = type.getMemorySpaceAsInt();
+  if (isa<LDSBarrierOp>(barrier))
+    return space == gpu::GPUDialect::getWorkgroupAddressSpace();
+  return space != gpu::GPUDialect::getPrivateAddressSpace();
+}
+
+/// Adds the accesses of `op`, and of the ops nested in it, to the memory that
+/// `barrier` orders.
+static void addAccesses(Operation *barrier, Operation *op, Accesses &acc) {
+  op->walk([&](Operation *nested) {
+    if (isBarrier(nested))
+      return;
+    if (auto effectOp = dyn_cast<MemoryEffectOpInterface>(nested)) {
+      SmallVector<MemoryEffects::EffectInstance, 4> effects;
+      effectOp.getEffects(effects);
+      for (const MemoryEffects::EffectInstance &effect : effects) {
+        Value value = effect.getValue();
+        if (value && !isOrdered(barrier, value))
+          continue;
+        if (isa<MemoryEffects::Read>(effect.getEffect()))
+          acc.reads = true;
+        else if (isa<MemoryEffects::Write>(effect.getEffect()))
+          acc.writes = true;
+      }
+      return;
+    }
+    if (nested->hasTrait<OpTrait::HasRecursiveSideEffects>())
+      return;
+    if (llvm::any_of(nested->getOperands(), [&](Value operand) {
+          return isOrdered(barrier, operand);
+        }))
+      acc.addAll();
+  });
+}
+
+/// Adds the accesses of `op` and the ops before it in its block up to a
+/// barrier bounding `barrier`. Returns whether there was such a barrier.
+static bool scanBackward(Operation *barrier, Operation *op, Accesses &acc) {
+  for (; op; op = op->getPrevNode()) {
+    if (isBarrier(op) && isBound(op, barrier))
+      return true;
+    addAccesses(barrier, op, acc);
+  }
+  return false;
+}
+
+/// Adds the accesses of `op` and the ops after it in its block up to a
+/// barrier bounding `barrier`. Returns whether there was such a barrier.
+static bool scanForward(Operation *barrier, Operation *op, Accesses &acc) {
+  for (; op; op = op->getNextNode()) {
+    if (isBarrier(op) && isBound(op, barrier))
+      return true;
+    addAccesses(barrier, op, acc);
+  }
+  return false;
+}
+
+/// The accesses that may run between `barrier` and the barriers bounding it
+/// before it, or after it if `forward` is set.
+static Accesses getAccesses(Operation *barrier, bool forward) {
+  Accesses acc;
+  Operation *op = barrier;
+  while (true) {
+    bool bounded = forward ? scanForward(barrier, op->getNextNode(), acc)
+                           : scanBackward(barrier, op->getPrevNode(), acc);
+    if (bounded)
+      return acc;
+    Operation *parent = op->getParentOp();
+    if (isa<func::FuncOp, gpu::GPUFuncOp>(parent))
+      return acc;
+    if (isa<scf::ForOp, AffineForOp>(parent)) {
+      // The accesses of the other iterations, up to the barriers in the
+      // loop, run on this side too.
+      Block *body = op->getBlock();
+      if (forward)
+        scanForward(barrier, &body->front(), acc);
+      else
+        scanBackward(barrier, &body->back(), acc);
+    } else if (!isa<scf::IfOp, AffineIfOp>(parent)) {
+      acc.addAll();
+      return acc;
+    }
+    op = parent;
+  }
+}
+
+void MIOpenEliminateBarriersPass::runOnOperation() {
+  SmallVector<Operation *, 16> barriers;
+  getOperation().walk([&](Operation *op) {
+    if (isBarrier(op))
+      barriers.push_back(op);
+  });
+
+  for (Operation *barrier : barriers) {
+    Accesses before = getAccesses(barrier, /*forward=*/false);
+    Accesses after = getAccesses(barrier, /*forward=*/true);
+    bool conflicts = (before.writes && (after.reads || after.writes)) ||
+                     (before.reads && after.writes);
+    if (conflicts)
+      continue;
+    LLVM_DEBUG(llvm::dbgs() << "Removing " << barrier->getName() << " at "
+                            << barrier->getLoc() << "\n");
+    barrier->erase();
+  }
+}
+
+//===- Passes -------------------------------------------------------------===//
+//
+
+std::unique_ptr<Pass> mlir::miopen::createMIOpenEliminateBarriersPass() {
+  return std::make_unique<MIOpenEliminateBarriersPass>();
+}
@@ -0,0 +1,327 @@
+//===- FoldConstantWeights.cpp - Fold weight-only TOSA subgraphs ---------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// This pass evaluates the layout changes, padding and casts that inference
+// graphs apply to their constant weights, replacing them by the constants
+// they compute. Left in place, they would be fused into the kernels by
+// -tosa-partition and rerun on every call of the host function; folded, the
+// weights reach the kernels in their final form as constants, which end up
+// in the code objects.
+//
+// With sparse-weights, the constant filters of convolutions that are 2:4
+// structured-sparse along the gemm K of the convolution, that is along the
+// YXC weights of each output channel, are then compressed for the sparse
+// XDLOPS of gfx940 and their convolutions marked `sparse`. Each group of 4
+// weights becomes its 2 kept weights, the raw bits of their indices in the
+// group (2 bits each, the first in the lowest ones) and a 0, a layout that
+// keeps the shape of the filter, and so all of the gemm lowering, unchanged.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/Tosa/IR/TosaOps.h"
+#include "mlir/Dialect/Tosa/Transforms/Passes.h"
+#include "mlir/IR/Matchers.h"
+#include "mlir/IR/PatternMatch.h"
+#include "mlir/Transforms/GreedyPatternRewriteDriver.h"
+
+using namespace mlir;
+
+namespace {
+struct MIOpenFoldConstantWeightsPass
+    : public MIOpenFoldConstantWeightsPassBase<MIOpenFoldConstantWeightsPass> {
+  MIOpenFoldConstantWeightsPass() = default;
+  MIOpenFoldConstantWeightsPass(bool sparseWeights) {
+    this->sparseWeights = sparseWeights;
+  }
+  void runOnOperation() override;
+};
+} // end anonymous namespace
+
+/// Returns the value of `value` if it is a constant that may be folded into
+/// its user: one only it uses, so that folding does not keep two copies of
+/// the weights, or a splat.
+static DenseElementsAttr matchFoldableConstant(Value value) {
+  DenseElementsAttr attr;
+  if (!matchPattern(value, m_Constant(&attr)))
+    return {};
+  if (!attr.isSplat() && !value.hasOneUse())
+    return {};
+  return attr;
+}
+
+namespace {
+//===- ReshapeOfConstant --------------------------------------------------===//
+//===----------------------------------------------------------------------===//
+struct ReshapeOfConstant : public OpRewritePattern<tosa::ReshapeOp> {
+  using OpRewritePattern<tosa::ReshapeOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(tosa::ReshapeOp op,
+                                PatternRewriter &rewriter) const override {
+    auto outputType = op.getType().dyn_cast<RankedTensorType>();
+    DenseElementsAttr input = matchFoldableConstant(op.input1());
+    if (!outputType || !outputType.hasStaticShape() || !input)
+      return failure();
+    rewriter.replaceOpWithNewOp<tosa::ConstOp>(op, outputType,
+                                               input.reshape(outputType));
+    return success();
+  }
+};
+
+//===- CastOfConstant -----------------------------------------------------===//
+// Only casts that are exact or round to nearest are folded: float to float,
+// integer to integer and integer to float. Float to integer casts saturate,
+// and are left to the kernels.
+//===----------------------------------------------------------------------===//
+struct CastOfConstant : public OpRewritePattern<tosa::CastOp> {
+  using OpRewritePattern<tosa::CastOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(tosa::CastOp op,
+                                PatternRewriter &rewriter) const override {
+    auto outputType = op.getType().dyn_cast<RankedTensorType>();
+    DenseElementsAttr input = matchFoldableConstant(op.input());
+    if (!outputType || !outputType.hasStaticShape() || !input)
+      return failure();
+    Type inType = input.getElementType();
+    Type outType = outputType.getElementType();
+    if (inType.isInteger(1) || outType.isInteger(1))
+      return failure();
+
+    DenseElementsAttr result;
+    if (auto outFloat = outType.dyn_cast<FloatType>()) {
+      const llvm::fltSemantics &semantics = outFloat.getFloatSemantics();
+      SmallVector<APFloat> values;
+      values.reserve(input.getNumElements());
+      if (inType.isa<FloatType>()) {
+        for (APFloat value : input.getValues<APFloat>()) {
+          bool losesInfo;
+          value.convert(semantics, APFloat::rmNearestTiesToEven, &losesInfo);
+          values.push_back(value);
+        }
+      } else if (inType.isa<IntegerType>()) {
+        for (const APInt &value : input.getValues<APInt>()) {
+          APFloat converted(semantics);
+          converted.convertFromAPInt(value, /*IsSigned=*/true,
+                                     APFloat::rmNearestTiesToEven);
+          values.push_back(converted);
+        }
+      } else {
+        return failure();
+      }
+      result = DenseElementsAttr::get(outputType, values);
+    } else if (outType.isa<IntegerType>() && inType.isa<IntegerType>()) {
+      unsigned width = outType.getIntOrFloatBitWidth();
+      SmallVector<APInt> values;
+      values.reserve(input.getNumElements());
+      for (const APInt &value : input.getValues<APInt>())
+        values.push_back(value.sextOrTrunc(width));
+      result = DenseElementsAttr::get(outputType, values);
+    } else {
+      return failure();
+    }
+    rewriter.replaceOpWithNewOp<tosa::ConstOp>(op, outputType, result);
+    return success();
+  }
+};
+} // end anonymous namespace
+
+//===- PadOfConstant ------------------------------------------------------===//
+//===----------------------------------------------------------------------===//
+
+/// Returns the elements of `input` padded by `lows` in front into `shape`,
+/// with `padValue` everywhere else.
+template <typename T>
+static SmallVector<T> padElements(DenseElementsAttr input,
+                                  ArrayRef<int64_t> lows,
+                                  ArrayRef<int64_t> shape, const T &padValue) {
+  ArrayRef<int64_t> inShape = input.getType().getShape();
+  size_t rank = shape.size();
+  SmallVector<int64_t> strides(rank, 1);
+  for (size_t d = rank - 1; d > 0; --d)
+    strides[d - 1] = strides[d] * shape[d];
+
+  SmallVector<T> result(strides[0] * shape[0], padValue);
+  SmallVector<int64_t> index(rank, 0);
+  for (const T &value : input.getValues<T>()) {
+    int64_t offset = 0;
+    for (size_t d = 0; d < rank; ++d)
+      offset += (index[d] + lows[d]) * strides[d];
+    result[offset] = value;
+    for (size_t d = rank; d > 0; --d) {
+      if (++index[d - 1] < inShape[d - 1])
+        break;
+      index[d - 1] = 0;
+    }
+  }
+  return result;
+}
+
+namespace {
+struct PadOfConstant : public OpRewritePattern<tosa::PadOp> {
+  using OpRewritePattern<tosa::PadOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(tosa::PadOp op,
+                                PatternRewriter &rewriter) const override {
+    auto outputType = op.getType().dyn_cast<RankedTensorType>();
+    DenseElementsAttr input = matchFoldableConstant(op.input1());
+    DenseIntElementsAttr padding;
+    if (!outputType || !outputType.hasStaticShape() ||
+        outputType.getRank() == 0 || !input ||
+        !matchPattern(op.padding(), m_Constant(&padding)) ||
+        op.quantization_info())
+      return failure();
+
+    // The low padding of each dimension comes first in its pair.
+    SmallVector<int64_t> lows;
+    for (auto it : llvm::enumerate(padding.getValues<APInt>()))
+      if (it.index() % 2 == 0)
+        lows.push_back(it.value().getSExtValue());
+    if (lows.size() != static_cast<size_t>(outputType.getRank()))
+      return failure();
+
+    DenseElementsAttr padConst;
+    if (op.pad_const() &&
+        (!matchPattern(op.pad_const(), m_Constant(&padConst)) ||
+         !padConst.isSplat()))
+      return failure();
+
+    Type elementType = input.getElementType();
+    DenseElementsAttr result;
+    if (auto floatType = elementType.dyn_cast<FloatType>()) {
+      APFloat padValue = padConst
+                             ? padConst.getSplatValue<APFloat>()
+                             : APFloat::getZero(floatType.getFloatSemantics());
+      result = DenseElementsAttr::get(
+          outputType,
+          padElements(input, lows, outputType.getShape(), padValue));
+    } else if (elementType.isa<IntegerType>()) {
+      APInt padValue = padConst ? padConst.getSplatValue<APInt>()
+                                : APInt(elementType.getIntOrFloatBitWidth(), 0);
+      result = DenseElementsAttr::get(
+          outputType,
+          padElements(input, lows, outputType.getShape(), padValue));
+    } else {
+      return failure();
+    }
+    rewriter.replaceOpWithNewOp<tosa::ConstOp>(op, outputType, result);
+    return success();
+  }
+};
+} // end anonymous namespace
+
+//===- Sparse weights -----------------------------------------------------===//
+//===----------------------------------------------------------------------===//
+
+/// Compresses `values` into the sparse layout if each of their groups of 4
+/// has at most 2 nonzeros. `encode` gives the value whose bits are its
+/// argument. Returns false, leaving `values` alone, otherwise.
+template <typename T, typename IsZero, typename Encode>
+static bool compressSparseWeights(SmallVectorImpl<T> &values, const T &zero,
+                                  IsZero isZero, Encode encode) {
+  SmallVector<T> compressed;
+  compressed.reserve(values.size());
+  for (size_t group = 0; group < values.size(); group += 4) {
+    SmallVector<unsigned, 2> kept;
+    for (unsigned i = 0; i < 4; ++i) {
+      if (isZero(values[group + i]))
+        continue;
+      if (kept.size() == 2)
+        return false;
+      kept.push_back(i);
+    }
+    // Groups with fewer nonzeros keep zeros too, at distinct indices.
+    for (unsigned i = 0; kept.size() < 2; ++i)
+      if (!llvm::is_contained(kept, i))
+        kept.push_back(i);
+    llvm::sort(kept);
+    compressed.push_back(values[group + kept[0]]);
+    compressed.push_back(values[group + kept[1]]);
+    compressed.push_back(encode(kept[0] | kept[1] << 2));
+    compressed.push_back(zero);
+  }
+  values = std::move(compressed);
+  return true;
+}
+
+/// Compresses the filter of `op` if it is a 2:4 structured-sparse constant
+/// the sparse XDLOPS can multiply, and marks `op` as `sparse`.
+static void sparsifyConvWeights(tosa::Conv2DOp op) {
+  DenseElementsAttr weights = matchFoldableConstant(op.weight());
+  if (!weights || weights.isSplat() || op->hasAttr("sparse") ||
+      (op.quantization_info() && op.quantization_info()->getWeightZp() != 0))
+    return;
+  ShapedType type = weights.getType();
+  Type elementType = type.getElementType();
+  // The groups of 4 run along YXC and must not straddle output channels.
+  if (type.getRank() != 4 || (type.getNumElements() / type.getDimSize(0)) % 4)
+    return;
+
+  DenseElementsAttr compressed;
+  if (elementType.isF16() || elementType.isBF16()) {
+    const llvm::fltSemantics &semantics =
+        elementType.cast<FloatType>().getFloatSemantics();
+    SmallVector<APFloat> values(weights.value_begin<APFloat>(),
+                                weights.value_end<APFloat>());
+    if (!compressSparseWeights(
+            values, APFloat::getZero(semantics),
+            [](const APFloat &value) { return value.isZero(); },
+            [&](unsigned bits) { return APFloat(semantics, APInt(16, bits)); }))
+      return;
+    compressed = DenseElementsAttr::get(type, values);
+  } else if (elementType.isInteger(8)) {
+    SmallVector<APInt> values(weights.value_begin<APInt>(),
+                              weights.value_end<APInt>());
+    if (!compressSparseWeights(
+            values, APInt(8, 0), [](const APInt &value) { return value == 0; },
+            [](unsigned bits) { return APInt(8, bits); }))
+      return;
+    compressed = DenseElementsAttr::get(type, values);
+  } else {
+    return;
+  }
+
+  OpBuilder b(op);
+  Value filter = b.create<tosa::ConstOp>(op.getLoc(), type, compressed);
+  Operation *oldFilter = op.weight().getDefiningOp();
+  op.weightMutable().assign(filter);
+  if (oldFilter->use_empty())
+    oldFilter->erase();
+  op->setAttr("sparse", b.getUnitAttr());
+}
+
+void MIOpenFoldConstantWeightsPass::runOnOperation() {
+  MLIRContext *ctx = &getContext();
+  RewritePatternSet patterns(ctx);
+  tosa::populateTosaFoldConstantTransposePatterns(ctx, patterns);
+  patterns.add<ReshapeOfConstant, CastOfConstant, PadOfConstant>(ctx);
+  if (failed(applyPatternsAndFoldGreedily(getOperation(), std::move(patterns))))
+    return signalPassFailure();
+
+  if (!sparseWeights)
+    return;
+  SmallVector<tosa::Conv2DOp> convs;
+  getOperation().walk([&](tosa::Conv2DOp op) { convs.push_back(op); });
+  for (tosa::Conv2DOp op : convs)
+    sparsifyConvWeights(op);
+}
+
+std::unique_ptr<Pass>
+mlir::miopen::createMIOpenFoldConstantWeightsPass(bool sparseWeights) {
+  return std::make_unique<MIOpenFoldConstantWeightsPass>(sparseWeights);
+}
@@ -0,0 +1,106 @@
+//===- GraphCapture.cpp - Replay kernel launches as HIP graphs ------------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// This pass has the runtime capture the kernels a host function launches into
+// a HIP graph, by calling mgpuGraphCaptureBegin on entry and
+// mgpuGraphCaptureEnd before every return. It runs once async.launch ops have
+// become gpu.launch_func ops.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/SymbolTable.h"
+
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+#define DEBUG_TYPE "miopen-graph-capture"
+
+using namespace mlir;
+
+static constexpr llvm::StringLiteral kBeginFunc = "mgpuGraphCaptureBegin";
+static constexpr llvm::StringLiteral kEndFunc = "mgpuGraphCaptureEnd";
+
+namespace {
+struct MIOpenGraphCapturePass
+    : public MIOpenGraphCapturePassBase<MIOpenGraphCapturePass> {
+  void runOnOperation() override;
+};
+} // end anonymous namespace
+
+/// The graph of a function is kept under a hash of its printed body, so that
+/// recompiling the same model in one process finds it again.
+static int64_t getGraphKey(func::FuncOp func) {
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  func->print(os, OpPrintingFlags().printGenericOpForm());
+  os.flush();
+  return static_cast<int64_t>(llvm::xxHash64(llvm::StringRef(text)));
+}
+
+void MIOpenGraphCapturePass::runOnOperation() {
+  ModuleOp mod = getOperation();
+  SmallVector<func::FuncOp> hostFuncs;
+  for (auto func : mod.getOps<func::FuncOp>()) {
+    if (func.isExternal() || func->hasAttr("kernel"))
+      continue;
+    // Kernels running on worker threads of the host can't join the capture
+    if (func.walk([](async::ExecuteOp) { return WalkResult::interrupt(); })
+            .wasInterrupted())
+      continue;
+    if (func.walk([](gpu::LaunchFuncOp) { return WalkResult::interrupt(); })
+            .wasInterrupted())
+      hostFuncs.push_back(func);
+  }
+  if (hostFuncs.empty())
+    return;
+
+  OpBuilder b(&getContext());
+  func::FuncOp beginFunc =
+      miopen::getRuntimeFunc(mod, kBeginFunc, b.getI64Type());
+  func::FuncOp endFunc = miopen::getRuntimeFunc(mod, kEndFunc, {});
+  for (func::FuncOp func : hostFuncs) {
+    int64_t key = getGraphKey(func);
+    LLVM_DEBUG(llvm::dbgs() << "Capturing " << func.getName()
+                            << " as graph " << key << "\n");
+    Location loc = func.getLoc();
+    b.setInsertionPointToStart(&func.getBody().front());
+    Value keyValue = b.create<arith::ConstantIntOp>(loc, key, 64);
+    b.create<func::CallOp>(loc, beginFunc, keyValue);
+    for (Block &block : func.getBody()) {
+      auto ret = dyn_cast<func::ReturnOp>(block.getTerminator());
+      if (!ret)
+        continue;
+      b.setInsertionPoint(ret);
+      b.create<func::CallOp>(ret.getLoc(), endFunc, ValueRange{});
+    }
+  }
+}
+
+//===- Passes -------------------------------------------------------------===//
+//
+
+std::unique_ptr<Pass> mlir::miopen::createMIOpenGraphCapturePass() {
+  return std::make_unique<MIOpenGraphCapturePass>();
+}
@@ -25,6 +25,7 @@
 #include "mlir/Dialect/MIOpen/TransformMapBuilder.h"
 #include "mlir/Dialect/MIOpen/Tuning/GridwiseGemmParams.h"
 #include "mlir/Dialect/MIOpen/XdlopsCodeSelection.h"
+#include "mlir/Dialect/MIOpen/utility/OrderedRewrite.h"
 #include "mlir/Dialect/MIOpen/utility/builderUtils.h"
 #include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
 
@@ -33,11 +34,13 @@
 #include "mlir/Dialect/MemRef/IR/MemRef.h"
 #include "mlir/Dialect/Vector/IR/VectorOps.h"
 #include "mlir/IR/BlockAndValueMapping.h"
+#include "mlir/IR/PatternMatch.h"
 #include "mlir/Pass/PassManager.h"
-#include "mlir/Transforms/DialectConversion.h"
+#include "mlir/Transforms/GreedyPatternRewriteDriver.h"
 #include "mlir/Transforms/Passes.h"
 
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
 
 #define DEBUG_TYPE "miopen-gridwise-to-blockwise"
 
@@ -117,11 +120,71 @@ ArrayAttr makeLinearDomain(OpBuilder &b, Location loc,
 //===----------------------------------------------------------------------===//
 // Building load/store loops
 //===----------------------------------------------------------------------===//
+/// The dequantization of the packed int4 weights of a gridwise gemm with an
+/// `int4_group_size`, whose B is a view of their bytes.
+struct Int4Dequant {
+  Value scales;
+  int64_t groupSize = 0;
+
+  explicit operator bool() const { return static_cast<bool>(scales); }
+};
+
+/// Dequantizes the bytes `packed` of int4 weights loaded at `coords`, the
+/// unpacked [G, K, N] coordinates of the first of them, into `resultType`.
+/// Vectors of them go along N, and so share their nibble and scale group.
+static Value dequantizeInt4(OpBuilder &b, Location loc, Value packed,
+                            Type resultType, const Int4Dequant &dequant,
+                            ValueRange coords) {
+  Type packedType = packed.getType();
+  Type i8 = b.getI8Type();
+  // Shift the low nibbles of even K up to the sign bit, so that an
+  // arithmetic shift right by 4 sign-extends either nibble.
+  Value one = b.createOrFold<ConstantIndexOp>(loc, 1);
+  Value isOdd = b.create<CmpIOp>(
+      loc, CmpIPredicate::ne, b.create<AndIOp>(loc, coords[1], one),
+      b.createOrFold<ConstantIndexOp>(loc, 0));
+  Value four = createConstantIntOp(b, loc, packedType, i8, 4);
+  Value shift = b.create<SelectOp>(
+      loc, isOdd, createConstantIntOp(b, loc, packedType, i8, 0), four);
+  Value nibbles =
+      b.create<ShRSIOp>(loc, b.create<ShLIOp>(loc, packed, shift), four);
+  Value values = b.create<SIToFPOp>(loc, resultType, nibbles);
+
+  // The scales of the padding are out of bounds, and so zero.
+  Value group = b.create<DivUIOp>(
+      loc, coords[1],
+      b.createOrFold<ConstantIndexOp>(loc, dequant.groupSize));
+  ArrayAttr noOobDims = b.getI32ArrayAttr({});
+  ArrayAttr scaleOobDims = b.getI32ArrayAttr({1, 2});
+  auto vectorType = resultType.dyn_cast<VectorType>();
+  if (!vectorType) {
+    Value scale = b.create<BufferLoadOp>(loc, resultType, dequant.scales,
+                                         noOobDims, scaleOobDims,
+                                         ValueRange{coords[0], group,
+                                                    coords[2]});
+    return b.create<MulFOp>(loc, values, scale);
+  }
+  Value scales = createZeroConstantOp(b, loc, vectorType);
+  for (int64_t i = 0, e = vectorType.getNumElements(); i < e; ++i) {
+    Value n = b.create<AddIOp>(loc, coords[2],
+                               b.createOrFold<ConstantIndexOp>(loc, i));
+    Value scale = b.create<BufferLoadOp>(
+        loc, vectorType.getElementType(), dequant.scales, noOobDims,
+        scaleOobDims, ValueRange{coords[0], group, n});
+    scales = b.create<vector::InsertElementOp>(
+        loc, scale, scales, b.createOrFold<ConstantIndexOp>(loc, i));
+  }
+  return b.create<MulFOp>(loc, values, scales);
+}
+
+/// With a `dequant`, `global` holds packed int4 weights, which the loop
+/// dequantizes into `loadType` as it loads them.
 TransformingForOp createGlobalLoadLoop(OpBuilder &b, Location loc, Value global,
                                        ValueRange globalStart, Type resultType,
                                        Type loadType,
                                        ArrayRef<int64_t> sliceLengths,
-                                       uint32_t vectorDim, bool useIndexDiffs) {
+                                       uint32_t vectorDim, bool useIndexDiffs,
+                                       const Int4Dequant &dequant = {}) {
   bool fullyScalar = !resultType.isa<ShapedType>();
   int64_t loadLength = 1;
   if (auto loadVectorType = loadType.dyn_cast<VectorType>())
@@ -147,20 +210,32 @@ TransformingForOp createGlobalLoadLoop(OpBuilder &b, Location loc, Value global,
   assert(loopBounds[vectorDim] % loadLength == 0 && "Uneven vector load");
   loopBounds[vectorDim] /= loadLength;
 
+  SmallVector<ValueRange, 3> loopStarts = {globalStart, linearInit};
   SmallVector<Attribute> loopTransforms = {globalTransforms, resultIdxMap};
   if (complexVectorLoad)
     loopTransforms[1] = noTransforms;
+  // Packed weights also iterate over their unpacked coordinates, above the
+  // two maps that view each weight as its byte.
+  Type globalLoadType = loadType;
+  if (dequant) {
+    loopStarts.push_back(globalStart);
+    loopTransforms.push_back(
+        b.getArrayAttr(globalTransforms.getValue().drop_back(2)));
+    globalLoadType = vectorTypeOrSelf(b.getI8Type(), loadLength);
+  }
 
   Value dest = createZeroConstantOp(b, loc, resultType);
   auto loop = b.create<TransformingForOp>(
-      loc, ArrayRef<ValueRange>{globalStart, linearInit}, loopTransforms,
-      loopBounds, /*strides=*/llvm::None,
+      loc, loopStarts, loopTransforms, loopBounds, /*strides=*/llvm::None,
       /*forceUnroll=*/true, useIndexDiffs, dest);
   OpBuilder::InsertionGuard guard(b);
   b.setInsertionPointToStart(loop.getBody());
-  Value loaded =
-      b.create<BufferLoadOp>(loc, loadType, global, leftOobDims, rightOobDims,
-                             loop.getLowerCoords(/*domain=*/0));
+  Value loaded = b.create<BufferLoadOp>(loc, globalLoadType, global,
+                                        leftOobDims, rightOobDims,
+                                        loop.getLowerCoords(/*domain=*/0));
+  if (dequant)
+    loaded = dequantizeInt4(b, loc, loaded, loadType, dequant,
+                            loop.getLowerCoords(/*domain=*/2));
   Value toYield = loaded;
   if (!fullyScalar) {
     Value loopArg = loop.getIterArgs()[0];
@@ -201,11 +276,16 @@ TransformingForOp createGlobalLoadLoop(OpBuilder &b, Location loc, Value global,
   return loop;
 }
 
+/// Store `loaded` into the tile `buffer` of LDS. If `swizzle` is not the
+/// identity, `buffer` must be a view of a flat LDS buffer holding the tile at
+/// `tileOffset`, whose addresses are then swizzled.
 TransformingForOp createLdsStoreLoop(OpBuilder &b, Location loc, Value loaded,
                                      Value buffer, ValueRange bufferStart,
                                      Type storingType,
                                      ArrayRef<int64_t> sliceLengths,
-                                     uint32_t vectorDim) {
+                                     uint32_t vectorDim,
+                                     const LdsSwizzle &swizzle = {},
+                                     int64_t tileOffset = 0) {
   Type loadedType = loaded.getType();
   bool fullyScalar = !loadedType.isa<ShapedType>();
 
@@ -239,16 +319,22 @@ TransformingForOp createLdsStoreLoop(OpBuilder &b, Location loc, Value loaded,
   OpBuilder::InsertionGuard guard(b);
   b.setInsertionPointToStart(loop.getBody());
 
+  SmallVector<Value, 5> storeCoords;
+  llvm::copy(loop.getLowerCoords(/*domain=*/1),
+             std::back_inserter(storeCoords));
+  if (!swizzle.isIdentity()) {
+    assert(storeCoords.size() == 1 && "Swizzled LDS tiles must be flat");
+    storeCoords[0] = swizzle.apply(b, loc, storeCoords[0], tileOffset);
+  }
+
   // If the tuning parameters call for a vector write, there's an implicit
   // gather, otherwise we can use in_bounds_store directly.
   if (fullyScalar) {
-    b.create<InBoundsStoreOp>(loc, loaded, buffer,
-                              loop.getLowerCoords(/*domain=*/1));
+    b.create<InBoundsStoreOp>(loc, loaded, buffer, storeCoords);
   } else if (!complexVectorStore) {
     Value toStore = b.create<ExtractSliceOp>(
         loc, storingType, loaded, loop.getLowerCoords(/*domain=*/0)[0]);
-    b.create<InBoundsStoreOp>(loc, toStore, buffer,
-                              loop.getLowerCoords(/*domain=*/1));
+    b.create<InBoundsStoreOp>(loc, toStore, buffer, storeCoords);
   } else {
     SmallVector<int64_t, 4> vectorIdxBounds(nUpper, 1);
     vectorIdxBounds[vectorDim] = storeLength;
@@ -273,13 +359,338 @@ TransformingForOp createLdsStoreLoop(OpBuilder &b, Location loc, Value loaded,
       b.create<miopen::YieldOp>(loc, toYield);
     }
     Value gathered = gatherLoop.getResults()[0];
-    b.create<InBoundsStoreOp>(loc, gathered, buffer,
-                              loop.getLowerCoords(/*domain=*/1));
+    b.create<InBoundsStoreOp>(loc, gathered, buffer, storeCoords);
   }
 
   return loop;
 }
 
+/// The longest loads, of at most 128 bits, for the blockwise copy of the
+/// [G][K][MorN]([KPack]) matrix `matrix` into LDS along `readDim`, starting
+/// from the `dataPerRead` chosen at tuning time. Tuning only sees the
+/// contiguity of the convolution's layouts and caps the loads at 4 elements,
+/// while the views of the matrix often keep longer runs together. A wider
+/// load must also split the tile evenly between the `blockSize` threads,
+/// with the thread slices derived from it below.
+static int64_t widenGlobalLoads(OpBuilder &b, Value matrix,
+                                GemmDimensions readDim, int64_t dataPerRead,
+                                int64_t KPack, int64_t KPerBlock,
+                                int64_t mnPerBlock, int64_t blockSize) {
+  if (readDim == GemmG)
+    return dataPerRead;
+  Value buffer;
+  ArrayAttr transforms;
+  std::tie(buffer, transforms) = untransform(b, matrix);
+  auto bufferType = buffer.getType().cast<MemRefType>();
+  int64_t maxLen = 128 / bufferType.getElementTypeBitWidth();
+  // Loads along K go along KPack instead when there is one.
+  uint32_t vectorDim = (readDim == GemmK && KPack > 1) ? 3 : readDim;
+  int64_t maxVector =
+      getMaxVectorization(transforms, vectorDim, maxLen, bufferType);
+
+  int64_t dataPerThread = mnPerBlock * KPerBlock * KPack / blockSize;
+  for (int64_t len = maxVector; len > dataPerRead; len /= 2) {
+    bool evenSplit;
+    if (readDim == GemmK && KPack > 1)
+      evenSplit = KPack % len == 0 && KPerBlock % (KPack / len) == 0 &&
+                  dataPerThread % KPack == 0 &&
+                  mnPerBlock % (dataPerThread / KPack) == 0;
+    else if (readDim == GemmK)
+      evenSplit = dataPerThread % len == 0 && KPerBlock % len == 0 &&
+                  mnPerBlock % (dataPerThread / len) == 0;
+    else
+      evenSplit = dataPerThread % (len * KPack) == 0 &&
+                  mnPerBlock % len == 0 &&
+                  KPerBlock % (dataPerThread / (len * KPack)) == 0;
+    if (evenSplit)
+      return len;
+  }
+  return dataPerRead;
+}
+
+/// Whether the blockwise copy of a KPack = 1 tile can load straight from
+/// global memory into LDS. Thread `tid` copies a sliceK x sliceMN slice of a
+/// [KPerBlock][mnPerBlock] tile whose K cluster coordinate is `tid % clusterK`
+/// if `kFastest` and `tid / clusterMN` otherwise. A direct load moves one
+/// dword per lane and the hardware writes the dword of each lane 4 bytes past
+/// that of the previous lane of its wave of `waveSize` lanes, so every dword
+/// of the slice must be contiguous in global memory and land there in LDS,
+/// for each of the LDS buffers starting at `ldsOffsets`.
+static bool canLoadDirectToLds(Type elementType, int64_t blockSize,
+                               int64_t sliceK, int64_t sliceMN,
+                               int64_t clusterK, int64_t clusterMN,
+                               bool kFastest, int64_t mnPerBlock,
+                               uint32_t vectorDim, int64_t loadLength,
+                               ArrayRef<int64_t> ldsOffsets,
+                               int64_t waveSize) {
+  int64_t elemBits = elementType.getIntOrFloatBitWidth();
+  if (elemBits > 32 || 32 % elemBits != 0)
+    return false;
+  int64_t elemsPerDword = 32 / elemBits;
+  if (blockSize % waveSize != 0 || clusterK * clusterMN != blockSize ||
+      sliceMN % elemsPerDword != 0)
+    return false;
+  // Elements sharing a dword are consecutive along M or N, which is only
+  // contiguous in global memory if the loads are vectorized along it.
+  if (elemsPerDword > 1 &&
+      (vectorDim != GemmMorN || loadLength % elemsPerDword != 0))
+    return false;
+
+  for (int64_t ldsOffset : ldsOffsets) {
+    for (int64_t k = 0; k < sliceK; ++k) {
+      for (int64_t mn = 0; mn < sliceMN; mn += elemsPerDword) {
+        int64_t waveDest = 0;
+        for (int64_t tid = 0; tid < blockSize; ++tid) {
+          int64_t clusterIdK = kFastest ? tid % clusterK : tid / clusterMN;
+          int64_t clusterIdMN = kFastest ? tid / clusterK : tid % clusterMN;
+          int64_t dest = ldsOffset +
+                         (clusterIdK * sliceK + k) * mnPerBlock +
+                         clusterIdMN * sliceMN + mn;
+          int64_t lane = tid % waveSize;
+          if (lane == 0)
+            waveDest = dest;
+          if (dest % elemsPerDword != 0 ||
+              dest != waveDest + lane * elemsPerDword)
+            return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+/// Load the slice of `global` at `globalStart` with lengths `sliceLengths`
+/// into the LDS `buffer` at `bufferStart` without going through registers,
+/// one dword per iteration. The layout must have been checked with
+/// canLoadDirectToLds(), which makes `vectorDim` the M or N dimension when
+/// a dword holds several elements.
+TransformingForOp createGlobalToLdsLoop(OpBuilder &b, Location loc,
+                                        Value global, ValueRange globalStart,
+                                        Value buffer, ValueRange bufferStart,
+                                        ArrayRef<int64_t> sliceLengths,
+                                        uint32_t vectorDim,
+                                        bool useIndexDiffs) {
+  Type elementType = global.getType().cast<MemRefType>().getElementType();
+  int64_t elemsPerDword = 32 / elementType.getIntOrFloatBitWidth();
+
+  ArrayAttr globalTransforms;
+  std::tie(global, globalTransforms) = untransform(b, global);
+  ArrayAttr leftOobDims, rightOobDims;
+  std::tie(leftOobDims, rightOobDims) =
+      computeOobFromTransforms(b, globalTransforms);
+
+  ArrayAttr bufferTransforms;
+  std::tie(buffer, bufferTransforms) = untransform(b, buffer);
+
+  SmallVector<int64_t, 4> loopStrides(sliceLengths.size(), 1);
+  loopStrides[vectorDim] = elemsPerDword;
+
+  auto loop = b.create<TransformingForOp>(
+      loc, ArrayRef<ValueRange>{globalStart, bufferStart},
+      ArrayRef<Attribute>{globalTransforms, bufferTransforms}, sliceLengths,
+      ArrayRef<int64_t>(loopStrides), /*forceUnroll=*/true, useIndexDiffs);
+  OpBuilder::InsertionGuard guard(b);
+  b.setInsertionPointToStart(loop.getBody());
+  b.create<BufferLoadToLdsOp>(loc, global, leftOobDims, rightOobDims,
+                              loop.getLowerCoords(/*domain=*/0), buffer,
+                              loop.getLowerCoords(/*domain=*/1));
+  return loop;
+}
+
+/// Number of workgroups `op` is lowered for. A gemm that shares its kernel
+/// with others through horizontal fusion carries its own grid size, see
+/// HorizontalFusion.cpp; otherwise it owns the grid of the kernel.
+static int64_t getGemmGridSize(Operation *op, func::FuncOp parentFunc) {
+  if (auto gridSizeAttr = op->getAttrOfType<IntegerAttr>("grid_size"))
+    return gridSizeAttr.getInt();
+  return parentFunc->getAttrOfType<IntegerAttr>("grid_size").getInt();
+}
+
+/// ID of the current workgroup among those of `op`, which start at its
+/// workgroup_offset in horizontally fused kernels.
+static Value createGemmWorkgroupId(OpBuilder &b, Location loc, Operation *op) {
+  Value bid = b.create<WorkgroupIdOp>(loc, b.getIndexType());
+  if (auto offsetAttr = op->getAttrOfType<IntegerAttr>("workgroup_offset"))
+    bid = b.create<SubIOp>(
+        loc, bid, b.create<ConstantIndexOp>(loc, offsetAttr.getInt()));
+  return bid;
+}
+
+/// Number of M blocks in the bands the workgroups of a gemm walk the block
+/// grid by: each band of consecutive M blocks goes through all the N blocks
+/// before the next one starts, so that the workgroups running together share
+/// their B tiles in L2 as well as a few A tiles. The grid_group_m attribute
+/// picks it; otherwise gemms with more blocks than the chip has CUs use bands
+/// of 8, and the others keep `rasterGroupM`, the band of their plain raster.
+/// Bands evenly divide MBlockWork.
+static int64_t getGridGroupM(Operation *op, int64_t MBlockWork,
+                             int64_t NBlockWork, int64_t rasterGroupM) {
+  int64_t groupM = rasterGroupM;
+  if (auto groupMAttr = op->getAttrOfType<IntegerAttr>("grid_group_m"))
+    groupM = groupMAttr.getInt();
+  else if (auto numCuAttr = op->getAttrOfType<IntegerAttr>("num_cu"))
+    if (MBlockWork * NBlockWork > numCuAttr.getInt())
+      groupM = 8;
+  groupM = std::max<int64_t>(1, std::min(groupM, MBlockWork));
+  while (MBlockWork % groupM != 0)
+    --groupM;
+  return groupM;
+}
+
+/// Renumber the workgroup `bid` among the `gridSize` of a gemm so that they
+/// walk its block grid in bands of `groupM` M blocks, M varying fastest within
+/// a band, then N, then the band, for each of the G gemms in turn. The result
+/// is the ID of the same block in the raster the rest of the lowering splits
+/// IDs by: (g, m_block, n_block), n_block varying fastest, or (g, n_block,
+/// m_block) if `mFastest`. The renumbering is expressed as transform maps on
+/// the block ID space and is the identity when the bands match that raster.
+static Value swizzleWorkgroupId(OpBuilder &b, Location loc, Value bid,
+                                int64_t gridSize, int64_t MBlockWork,
+                                int64_t NBlockWork, int64_t groupM,
+                                bool mFastest) {
+  if (groupM == (mFastest ? MBlockWork : 1))
+    return bid;
+  int64_t GStride = MBlockWork * NBlockWork;
+  int64_t numBands = MBlockWork / groupM;
+  TopDownTMBuilder splitId(b, {"bid"}, {gridSize}, loc);
+  splitId.merge({"g", "m_band", "n_block", "m_in_band"}, {0, 1, 2, 3}, "bid",
+                {gridSize / GStride, numBands, NBlockWork, groupM});
+  TransformMapAttr splitIdAttr = splitId.get();
+
+  auto rasterId = TopDownTMBuilder::below(splitId, splitIdAttr);
+  if (mFastest)
+    rasterId.unmerge("bid", 0, {"g", "n_block", "m_band", "m_in_band"},
+                     {gridSize / GStride, NBlockWork, numBands, groupM});
+  else
+    rasterId.unmerge("bid", 0, {"g", "m_band", "m_in_band", "n_block"},
+                     {gridSize / GStride, numBands, groupM, NBlockWork});
+  TransformMapAttr rasterIdAttr = rasterId.get();
+
+  AffineMap swizzle = rasterIdAttr.getMap().getAffineMap().compose(
+      splitIdAttr.getMap().getAffineMap());
+  return b.create<AffineApplyOp>(loc, swizzle, bid);
+}
+
+/// Open the tile loop of a persistent gemm, whose `gridSize` workgroups,
+/// fewer than its `numTiles` tiles, take the tiles `bid`, `bid + gridSize`,
+/// and so on in turn. Later ops go into the loop body, and the ID of the tile
+/// it is at is returned to stand for the workgroup ID.
+static Value beginPersistentTileLoop(OpBuilder &b, Location loc, Value bid,
+                                     int64_t gridSize, int64_t numTiles) {
+  auto tileLoop = b.create<scf::ForOp>(
+      loc, bid, b.create<ConstantIndexOp>(loc, numTiles),
+      b.create<ConstantIndexOp>(loc, gridSize));
+  b.setInsertionPointToStart(tileLoop.getBody());
+  return tileLoop.getInductionVar();
+}
+
+namespace {
+/// The clock readings at the phase boundaries of a gemm whose kernel has a
+/// phase times buffer, see kPhaseTimesAttrName; without one, it emits
+/// nothing.
+struct PhaseTimer {
+  Value buffer;
+  SmallVector<Value, kNumPhaseStamps> stamps;
+
+  explicit PhaseTimer(Operation *op) : buffer(getPhaseTimesBuffer(op)) {}
+
+  void stamp(OpBuilder &b, Location loc) {
+    if (buffer)
+      stamps.push_back(
+          b.create<amdgpu::MemtimeOp>(loc, b.getI64Type(), UnitAttr()));
+  }
+
+  /// Have the first wave of the workgroup write the readings to its row of
+  /// the buffer, for the first kPhaseTimingWorkgroups workgroups.
+  void record(OpBuilder &b, Location loc, Value tid) {
+    if (!buffer)
+      return;
+    assert(stamps.size() == kNumPhaseStamps && "Missing phase stamps");
+    Value wg = b.create<WorkgroupIdOp>(loc, b.getIndexType());
+    Value isFirstThread = b.create<CmpIOp>(
+        loc, CmpIPredicate::eq, tid, b.create<ConstantIndexOp>(loc, 0));
+    Value hasRow = b.create<CmpIOp>(
+        loc, CmpIPredicate::ult, wg,
+        b.create<ConstantIndexOp>(loc, kPhaseTimingWorkgroups));
+    auto ifOp = b.create<scf::IfOp>(
+        loc, b.create<AndIOp>(loc, isFirstThread, hasRow),
+        /*withElseRegion=*/false);
+    OpBuilder thenb = ifOp.getThenBodyBuilder();
+    for (const auto &stamp : llvm::enumerate(stamps))
+      thenb.create<memref::StoreOp>(
+          loc, stamp.value(), buffer,
+          ValueRange{wg, thenb.create<ConstantIndexOp>(loc, stamp.index())});
+  }
+};
+} // end anonymous namespace
+
+/// Requantize the `numRegisters` i32 results a thread holds in `registers`
+/// into a new i8 register buffer, the result x in row m of gemm g becoming
+/// clamp(round(x * scale) + zeroPoint, -128, 127), where `scales` holds the
+/// scales of the rows of each of the G gemms in turn. `idToRegisterMaps` and
+/// `idToMatrixCMaps` take (bid, tid, iter), starting at `startCoords`, to
+/// the registers and to matrix C.
+static Value requantizeResults(OpBuilder &b, Location loc, Value registers,
+                               Value scales, int64_t zeroPoint, int64_t G,
+                               ValueRange startCoords,
+                               ArrayAttr idToRegisterMaps,
+                               ArrayAttr idToMatrixCMaps,
+                               int64_t numRegisters) {
+  Type i8Type = b.getIntegerType(8);
+  Type i32Type = b.getI32Type();
+  Type f32Type = b.getF32Type();
+  auto registersType = registers.getType().cast<MemRefType>();
+  Value requantized = b.create<GpuAllocOp>(
+      loc, registersType.clone(i8Type).cast<MemRefType>());
+
+  int64_t rowsPerGemm =
+      scales.getType().cast<MemRefType>().getNumElements() / G;
+  Value rowsConstantOp = b.create<ConstantIndexOp>(loc, rowsPerGemm);
+  Value zeroConstantOp = createZeroConstantOp(b, loc, f32Type);
+  Value halfConstantOp = createConstantFloatOp(b, loc, f32Type, f32Type, 0.5f);
+  Value minusHalfConstantOp =
+      createConstantFloatOp(b, loc, f32Type, f32Type, -0.5f);
+  Value zeroPointConstantOp =
+      b.create<ConstantIntOp>(loc, zeroPoint, i32Type);
+  Value minConstantOp = b.create<ConstantIntOp>(loc, -128, i32Type);
+  Value maxConstantOp = b.create<ConstantIntOp>(loc, 127, i32Type);
+
+  auto loop = b.create<TransformingForOp>(
+      loc, ArrayRef<ValueRange>{startCoords, startCoords},
+      ArrayRef<Attribute>{idToRegisterMaps, idToMatrixCMaps},
+      ArrayRef<int64_t>{1, 1, numRegisters}, ArrayRef<int64_t>{1, 1, 1},
+      /*forceUnroll=*/true, /*useIndexDiffs=*/true);
+  OpBuilder::InsertionGuard guard(b);
+  b.setInsertionPointToStart(loop.getBody());
+  Value reg = loop.getLowerCoords(/*domain=*/0)[0];
+  ValueRange matrixCoords = loop.getLowerCoords(/*domain=*/1);
+  Value channel = b.create<AddIOp>(
+      loc, b.create<MulIOp>(loc, matrixCoords[0], rowsConstantOp),
+      matrixCoords[1]);
+  // Padding rows past the last channel read a scale of 0, and their results
+  // are never written
+  Value scale = b.create<BufferLoadOp>(loc, f32Type, scales,
+                                       b.getI32ArrayAttr({}),
+                                       b.getI32ArrayAttr({0}), channel);
+
+  Value result = b.create<InBoundsLoadOp>(loc, i32Type, registers, reg);
+  Value scaled =
+      b.create<MulFOp>(loc, b.create<SIToFPOp>(loc, f32Type, result), scale);
+  // Round half away from zero, since fptosi truncates
+  Value isNegative =
+      b.create<CmpFOp>(loc, CmpFPredicate::OLT, scaled, zeroConstantOp);
+  Value halfOp = b.create<SelectOp>(loc, isNegative, minusHalfConstantOp,
+                                    halfConstantOp);
+  Value rounded = b.create<FPToSIOp>(loc, i32Type,
+                                     b.create<AddFOp>(loc, scaled, halfOp));
+  Value shifted = b.create<AddIOp>(loc, rounded, zeroPointConstantOp);
+  Value clamped = b.create<MinSIOp>(
+      loc, b.create<MaxSIOp>(loc, shifted, minConstantOp), maxConstantOp);
+  b.create<InBoundsStoreOp>(loc, b.create<TruncIOp>(loc, i8Type, clamped),
+                            requantized, reg);
+  return requantized;
+}
+
 //===----------------------------------------------------------------------===//
 // GridwiseGemm lowering.
 //===----------------------------------------------------------------------===//
@@ -487,15 +898,18 @@ struct GridwiseGemmRewritePattern : public OpRewritePattern<GridwiseGemmOp> {
     func::FuncOp parentFunc = op->getParentOfType<func::FuncOp>();
     int64_t kernelBlockSize =
         parentFunc->getAttrOfType<IntegerAttr>("block_size").getInt();
-    int64_t kernelGridSize =
-        parentFunc->getAttrOfType<IntegerAttr>("grid_size").getInt();
+    int64_t kernelGridSize = getGemmGridSize(op, parentFunc);
 
     // Get current workgroup ID.
-    auto bid = b.create<WorkgroupIdOp>(loc, b.getIndexType());
+    Value bid = createGemmWorkgroupId(b, loc, op);
 
     int64_t MBlockWork = M / MPerBlock;
     int64_t NBlockWork = N / NPerBlock;
     int64_t GStride = MBlockWork * NBlockWork;
+    int64_t gridGroupM =
+        getGridGroupM(op, MBlockWork, NBlockWork, /*rasterGroupM=*/1);
+    bid = swizzleWorkgroupId(b, loc, bid, kernelGridSize, MBlockWork,
+                             NBlockWork, gridGroupM, /*mFastest=*/false);
 
     LLVM_DEBUG(llvm::dbgs() << "\ngridwise_gemm op:\n");
     LLVM_DEBUG(op.print(llvm::dbgs()));
@@ -514,6 +928,7 @@ struct GridwiseGemmRewritePattern : public OpRewritePattern<GridwiseGemmOp> {
                << "NPerThread: " << NPerThread << "\n"
                << "MBlockWork = M / MPerBlock: " << MBlockWork << "\n"
                << "NBlockWork = N / NPerBlock: " << NBlockWork << "\n"
+               << "GridGroupM: " << gridGroupM << "\n"
                << "MLevel0Cluster: " << MLevel0Cluster << "\n"
                << "MLevel1Cluster: " << MLevel1Cluster << "\n"
                << "NLevel0Cluster: " << NLevel0Cluster << "\n"
@@ -1171,6 +1586,8 @@ struct GridwiseGemmRewritePattern : public OpRewritePattern<GridwiseGemmOp> {
         mMyThreadOffsetA, mMyThreadOffsetB, kPerThreadAttr,
         b.getIndexAttr(MPerThread), b.getIndexAttr(NPerThread),
         b.getIndexAttr(mRepeatLDSStride), b.getIndexAttr(nRepeatLDSStride));
+    if (Attribute arch = op->getAttr("arch"))
+      blockwiseGemmOp->setAttr("arch", arch);
 
     // LDS barrier.
     // This barrier prevents halo part of outputs having weird values.
@@ -1275,13 +1692,25 @@ struct GridwiseGemmRewritePattern : public OpRewritePattern<GridwiseGemmOp> {
     toRegisterC.passThrough({"iter"}, {0}, {"iter"});
     TransformMapAttr toRegisterCAttr = toRegisterC.get();
 
+    ArrayAttr idToMatrixCMaps =
+        b.getArrayAttr({splitMemoryCoordsAttr, toClustersAttr, toTensorCAttr});
+    SmallVector<Value, 3> writeStartCoords = {bid, tid, zeroConstantOp};
+
     Value registerC = registerMatrixCAllocOp;
     // If we need to type-convert the accumulator (currently this is only
     // fp32->f16) then we must do so before the writeback loop in which fusion
     // takes places at this time, since the fusion pass as currently written
     // can't interceps the type conversions.
     Type destType = op.c().getType().cast<MemRefType>().getElementType();
-    if (destType != accumulatorType) {
+    if (Value scales = op.requantScales()) {
+      int64_t zeroPoint = 0;
+      if (auto attr = op->getAttrOfType<IntegerAttr>("requant_zero_point"))
+        zeroPoint = attr.getInt();
+      registerC = requantizeResults(
+          b, loc, registerC, scales, zeroPoint, G, writeStartCoords,
+          b.getArrayAttr({toRegisterCAttr}), idToMatrixCMaps,
+          threadCNumRegisters);
+    } else if (destType != accumulatorType) {
       auto convertedCType =
           threadCRegisterMemRefType.clone(destType).cast<MemRefType>();
       Value convertedC = b.create<miopen::GpuAllocOp>(loc, convertedCType);
@@ -1302,16 +1731,12 @@ struct GridwiseGemmRewritePattern : public OpRewritePattern<GridwiseGemmOp> {
       registerC = convertedC;
     }
 
-    ArrayAttr idToMatrixCMaps =
-        b.getArrayAttr({splitMemoryCoordsAttr, toClustersAttr, toTensorCAttr});
     Value tensorC;
     ArrayAttr idToTensorCMaps;
     std::tie(tensorC, idToTensorCMaps) =
         untransform(b, op.c(), idToMatrixCMaps);
     auto writeOobDims = computeOobFromTransforms(b, idToTensorCMaps);
 
-    SmallVector<Value, 3> writeStartCoords = {bid, tid, zeroConstantOp};
-
     auto outLoop = b.create<TransformingForOp>(
         loc, ArrayRef<ValueRange>{writeStartCoords, writeStartCoords},
         ArrayRef<Attribute>{b.getArrayAttr({toRegisterCAttr}), idToTensorCMaps},
@@ -1339,13 +1764,593 @@ struct GridwiseGemmRewritePattern : public OpRewritePattern<GridwiseGemmOp> {
 // GridwiseGemmV2 lowering.
 //===----------------------------------------------------------------------===//
 
+/// Load a wave's operand registers for one K tile of an XDLOPS gemm straight
+/// from the global `matrix`, [G][K][M] or [G][K][M][KPack]: for each of the
+/// `repeats` rows (or columns) at `mOrN + r * mOrNPerXdlops`, the
+/// `kPerThread` points along K at `kStart + i * kStride`. Points that follow
+/// each other along K are loaded as one run. Returns the runs in the order
+/// of the registers they go to.
+static SmallVector<Value, 8>
+loadXdlopsOperandRuns(OpBuilder &b, Location loc, Value matrix, Value g,
+                      Value kStart, Value mOrN, int64_t repeats,
+                      int64_t mOrNPerXdlops, int64_t kPerThread,
+                      int64_t kStride, int64_t KPack, bool useIndexDiffs) {
+  Type elementType = matrix.getType().cast<MemRefType>().getElementType();
+  int64_t runLength = kStride == 1 ? kPerThread : 1;
+  // Runs go along KPack when there is one.
+  uint32_t vectorDim = KPack > 1 ? 3 : 1;
+  Value buffer;
+  ArrayAttr transforms;
+  std::tie(buffer, transforms) = untransform(b, matrix);
+  auto bufferType = buffer.getType().cast<MemRefType>();
+  int64_t maxLen = std::min<int64_t>(KPack > 1 ? KPack : runLength,
+                                     128 / bufferType.getElementTypeBitWidth());
+  int64_t loadLength =
+      getMaxVectorization(transforms, vectorDim, maxLen, bufferType);
+
+  SmallVector<int64_t, 4> sliceLengths = {1, runLength, 1};
+  if (KPack > 1)
+    sliceLengths.push_back(KPack);
+  Type runType = vectorTypeOrSelf(elementType, runLength * KPack);
+  Type loadType = vectorTypeOrSelf(elementType, loadLength);
+  Value zero = b.createOrFold<ConstantIndexOp>(loc, 0);
+
+  SmallVector<Value, 8> runs;
+  for (int64_t r = 0; r < repeats; ++r) {
+    Value coord = b.createOrFold<AddIOp>(
+        loc, mOrN, b.createOrFold<ConstantIndexOp>(loc, r * mOrNPerXdlops));
+    for (int64_t i = 0; i < kPerThread; i += runLength) {
+      Value k = b.createOrFold<AddIOp>(
+          loc, kStart, b.createOrFold<ConstantIndexOp>(loc, i * kStride));
+      SmallVector<Value, 4> start = {g, k, coord};
+      if (KPack > 1)
+        start.push_back(zero);
+      TransformingForOp load =
+          createGlobalLoadLoop(b, loc, matrix, start, runType, loadType,
+                               sliceLengths, vectorDim, useIndexDiffs);
+      runs.push_back(load.getResult(0));
+    }
+  }
+  return runs;
+}
+
+/// Store the `runs` of loadXdlopsOperandRuns() to the registers `buffer`,
+/// whose elements are vector<KPack x T> or, without a KPack, T.
+static void storeXdlopsOperandRuns(OpBuilder &b, Location loc,
+                                   ArrayRef<Value> runs, Value buffer,
+                                   int64_t KPack) {
+  Type registerType = buffer.getType().cast<MemRefType>().getElementType();
+  int64_t offset = 0;
+  for (Value run : runs) {
+    int64_t runLength = 1;
+    if (auto runType = run.getType().dyn_cast<VectorType>())
+      runLength = runType.getNumElements() / KPack;
+    if (KPack == 1) {
+      b.create<InBoundsStoreOp>(loc, run, buffer,
+                                b.createOrFold<ConstantIndexOp>(loc, offset));
+      offset += runLength;
+      continue;
+    }
+    for (int64_t i = 0; i < runLength; ++i, ++offset) {
+      Value pack = run;
+      if (runLength > 1)
+        pack = b.create<ExtractSliceOp>(
+            loc, registerType, run,
+            b.createOrFold<ConstantIndexOp>(loc, i * KPack));
+      b.create<memref::StoreOp>(
+          loc, pack, buffer,
+          ValueRange{b.createOrFold<ConstantIndexOp>(loc, offset)});
+    }
+  }
+}
+
+/// With a `reduceDest`, count the partial results the wave just wrote to C
+/// and, if they were the last of their tile, sum those of all the KBlocks of
+/// the tile into `reduceDest`. The wave of each KBlock that writes a given
+/// part of a tile is the wave with the same index in the workgroup of the
+/// same tile, so the counters, one per wave of each tile of `reduceDest`,
+/// need no workgroup barrier. `idToMatrixCMaps` and `idToRegisterMaps` take
+/// (bid, tid, item) to matrix C and to the `numElements` results of a thread,
+/// `dataPerCopy` at a time, and the G dimension of C is the gemm index times
+/// `kblocks` plus the KBlock, with `gStride` workgroups each.
+static void emitFusedKBlockReduction(
+    PatternRewriter &b, Location loc, GridwiseGemmV2Op op, Value bid,
+    Value tid, ArrayAttr idToMatrixCMaps, ArrayAttr idToRegisterMaps,
+    int64_t numElements, int64_t dataPerCopy, int64_t gStride,
+    int64_t blockSize, int64_t waveSize, bool useIndexDiffs) {
+  Value reduceDest = op.reduceDest();
+  int64_t kBlocks = op->getAttrOfType<IntegerAttr>("kblocks").getInt();
+  int64_t countersOffset =
+      op->getAttrOfType<IntegerAttr>("kblock_counters").getInt();
+  Type f32 = b.getF32Type();
+  Type i32 = b.getI32Type();
+
+  // The partials must be visible to the other workgroups before the count.
+  b.create<LLVM::FenceOp>(loc, LLVM::AtomicOrdering::release, "agent");
+
+  Value tensorC;
+  ArrayAttr idToTensorCMaps;
+  std::tie(tensorC, idToTensorCMaps) =
+      untransform(b, op.c(), idToMatrixCMaps);
+  Value counters = createCollapseShapeOp(b, loc, tensorC);
+
+  // A tile of `reduceDest` holds at least as many elements as a workgroup
+  // has waves, so the counters fit in the slab of `reduceDest`'s size.
+  Value gStrideOp = b.create<ConstantIndexOp>(loc, gStride);
+  Value kBlocksOp = b.create<ConstantIndexOp>(loc, kBlocks);
+  Value waveSizeOp = b.create<ConstantIndexOp>(loc, waveSize);
+  Value gemmIdx = b.create<DivUIOp>(
+      loc, b.create<DivUIOp>(loc, bid, gStrideOp), kBlocksOp);
+  Value tileInGemm = b.create<RemUIOp>(loc, bid, gStrideOp);
+  Value tileIdx = b.create<AddIOp>(
+      loc, b.create<MulIOp>(loc, gemmIdx, gStrideOp), tileInGemm);
+  Value counterIdx = b.create<AddIOp>(
+      loc,
+      b.create<MulIOp>(
+          loc, tileIdx,
+          b.create<ConstantIndexOp>(loc, blockSize / waveSize)),
+      b.create<DivUIOp>(loc, tid, waveSizeOp));
+  counterIdx = b.create<AddIOp>(
+      loc, counterIdx, b.create<ConstantIndexOp>(loc, countersOffset));
+
+  Value isFirstLane =
+      b.create<CmpIOp>(loc, CmpIPredicate::eq,
+                       b.create<RemUIOp>(loc, tid, waveSizeOp),
+                       b.create<ConstantIndexOp>(loc, 0));
+  auto countIf = b.create<scf::IfOp>(
+      loc, TypeRange{f32}, isFirstLane,
+      [&](OpBuilder &thenb, Location loc) {
+        Value one = createConstantFloatOp(thenb, loc, f32, f32, 1.0);
+        Value arrived = thenb.create<memref::AtomicRMWOp>(
+            loc, f32, arith::AtomicRMWKind::addf, one, counters,
+            ValueRange{counterIdx});
+        thenb.create<scf::YieldOp>(loc, arrived);
+      },
+      [&](OpBuilder &elseb, Location loc) {
+        elseb.create<scf::YieldOp>(
+            loc, createConstantFloatOp(elseb, loc, f32, f32, 0.0));
+      });
+  Value arrived = b.create<amdgpu::ReadlaneOp>(
+      loc, i32, b.create<FPToSIOp>(loc, i32, countIf.getResult(0)),
+      b.getI32IntegerAttr(0));
+  Value isLast = b.create<CmpIOp>(
+      loc, CmpIPredicate::eq, arrived,
+      b.create<ConstantIntOp>(loc, kBlocks - 1, i32));
+  auto lastIf =
+      b.create<scf::IfOp>(loc, isLast, /*withElseRegion=*/false);
+
+  OpBuilder::InsertionGuard guard(b);
+  b.setInsertionPoint(lastIf.thenYield());
+  b.create<LLVM::FenceOp>(loc, LLVM::AtomicOrdering::acquire, "agent");
+  // Leave the counter at 0 for the next launch.
+  auto resetIf =
+      b.create<scf::IfOp>(loc, isFirstLane, /*withElseRegion=*/false);
+  {
+    OpBuilder thenb = resetIf.getThenBodyBuilder();
+    thenb.create<memref::StoreOp>(
+        loc, createConstantFloatOp(thenb, loc, f32, f32, 0.0), counters,
+        ValueRange{counterIdx});
+  }
+
+  // Sum the partials in KBlock order, so that the result does not depend on
+  // which workgroup comes last, and convert the sums on the last one.
+  Type destType = reduceDest.getType().cast<MemRefType>().getElementType();
+  auto privateType = [&](Type type) {
+    return MemRefType::get(numElements, type, {},
+                           gpu::GPUDialect::getPrivateAddressSpace());
+  };
+  Type loadType = f32;
+  Type storeType = destType;
+  if (dataPerCopy > 1) {
+    loadType = VectorType::get({dataPerCopy}, f32);
+    storeType = VectorType::get({dataPerCopy}, destType);
+  }
+  Value sums = b.create<GpuAllocOp>(loc, privateType(f32));
+  Value results = b.create<GpuAllocOp>(loc, privateType(destType));
+  auto readOobDims = computeOobFromTransforms(b, idToTensorCMaps);
+  Value zero = b.create<ConstantIndexOp>(loc, 0);
+  Value firstBid = b.create<AddIOp>(
+      loc,
+      b.create<MulIOp>(loc, b.create<MulIOp>(loc, gemmIdx, kBlocksOp),
+                       gStrideOp),
+      tileInGemm);
+  for (int64_t kBlock = 0; kBlock < kBlocks; ++kBlock) {
+    Value partialBid = b.create<AddIOp>(
+        loc, firstBid, b.create<ConstantIndexOp>(loc, kBlock * gStride));
+    SmallVector<Value, 3> readStartCoords = {partialBid, tid, zero};
+    auto readLoop = b.create<TransformingForOp>(
+        loc, ArrayRef<ValueRange>{readStartCoords, readStartCoords},
+        ArrayRef<Attribute>{idToRegisterMaps, idToTensorCMaps},
+        ArrayRef<int64_t>{1, 1, numElements},
+        ArrayRef<int64_t>{1, 1, dataPerCopy},
+        /*forceUnroll=*/true, /*useIndexDiffs=*/useIndexDiffs);
+    OpBuilder::InsertionGuard loopGuard(b);
+    b.setInsertionPointToStart(readLoop.getBody());
+    Value regIndex = readLoop.getLowerCoords(/*domain=*/0)[0];
+    Value sum = b.create<BufferLoadOp>(
+        loc, loadType, tensorC, std::get<0>(readOobDims),
+        std::get<1>(readOobDims), readLoop.getLowerCoords(/*domain=*/1));
+    if (kBlock > 0)
+      sum = b.create<AddFOp>(
+          loc, b.create<InBoundsLoadOp>(loc, loadType, sums, regIndex), sum);
+    if (kBlock + 1 < kBlocks)
+      b.create<InBoundsStoreOp>(loc, sum, sums, regIndex);
+    else
+      b.create<InBoundsStoreOp>(
+          loc, createTypeConversionOp(b, loc, sum, storeType), results,
+          regIndex);
+  }
+
+  // `reduceDest` ignores the KBlock, so any workgroup of the tile writes it.
+  Value tensorDest;
+  ArrayAttr idToTensorDestMaps;
+  std::tie(tensorDest, idToTensorDestMaps) =
+      untransform(b, reduceDest, idToMatrixCMaps);
+  auto writeOobDims = computeOobFromTransforms(b, idToTensorDestMaps);
+  SmallVector<Value, 3> writeStartCoords = {bid, tid, zero};
+  auto writeLoop = b.create<TransformingForOp>(
+      loc, ArrayRef<ValueRange>{writeStartCoords, writeStartCoords},
+      ArrayRef<Attribute>{idToRegisterMaps, idToTensorDestMaps},
+      ArrayRef<int64_t>{1, 1, numElements},
+      ArrayRef<int64_t>{1, 1, dataPerCopy},
+      /*forceUnroll=*/true, /*useIndexDiffs=*/useIndexDiffs);
+  b.setInsertionPointToStart(writeLoop.getBody());
+  b.create<ThreadwiseCopyV2Op>(
+      loc, results, tensorDest, b.getIndexAttr(dataPerCopy),
+      StoreMethodAttr::get(b.getContext(), StoreMethod::Set),
+      std::get<0>(writeOobDims), std::get<1>(writeOobDims),
+      writeLoop.getLowerCoords(/*domain=*/0)[0],
+      writeLoop.getLowerCoords(/*domain=*/1));
+}
+
+/// Lower a gridwise gemm with `register_only` without LDS: each wave loads
+/// the operands of its XDLOPS tile from global memory straight into its
+/// registers, in the layout the blockwise gemm would read them from LDS in,
+/// so that no workgroup barrier is needed anywhere. The loads of the next K
+/// tile are issued before the XDLOPS of the current one. The results are
+/// written out as in the epilogue of the LDS lowering, without its output
+/// swizzles.
+static LogicalResult lowerRegisterOnlyGemm(GridwiseGemmV2Op op,
+                                           PatternRewriter &b) {
+  Location loc = op.getLoc();
+  Type elementType = obtainConvDataType(op);
+
+  ArrayRef<int64_t> aShape = op.a().getType().cast<MemRefType>().getShape();
+  ArrayRef<int64_t> bShape = op.b().getType().cast<MemRefType>().getShape();
+  int64_t G = aShape[0];
+  int64_t K = aShape[1];
+  int64_t M = aShape[2];
+  int64_t N = bShape[2];
+
+  int64_t KPack = 1;
+  if (auto kpackAttr = op->getAttrOfType<IntegerAttr>("kpack"))
+    KPack = kpackAttr.getInt();
+  int64_t KPerBlock = op->getAttrOfType<IntegerAttr>("k_per_block").getInt();
+  int64_t MPerBlock = op->getAttrOfType<IntegerAttr>("m_per_block").getInt();
+  int64_t NPerBlock = op->getAttrOfType<IntegerAttr>("n_per_block").getInt();
+  int64_t MPerWave = op->getAttrOfType<IntegerAttr>("m_per_wave").getInt();
+  int64_t NPerWave = op->getAttrOfType<IntegerAttr>("n_per_wave").getInt();
+  int64_t NWaves = NPerBlock / NPerWave;
+
+  StringRef arch;
+  if (auto archAttr = op->getAttrOfType<StringAttr>("arch"))
+    arch = archAttr.getValue();
+  FailureOr<XdlopsCodeSelection> maybeXcs = XdlopsCodeSelection::get(
+      elementType, MPerWave, NPerWave, arch, obtainFp8Format(op),
+      op->hasAttr("xf32"), op->hasAttr("sparse"));
+  if (failed(maybeXcs))
+    return op.emitOpError("no XDLOPS instruction for a ")
+           << MPerWave << "x" << NPerWave << " wave tile of " << elementType;
+  XdlopsCodeSelection xcs = *maybeXcs;
+  int64_t MPerXdlops = xcs.MPerXdlops;
+  int64_t NPerXdlops = xcs.NPerXdlops;
+  int64_t MRepeats = xcs.MRepeats;
+  int64_t NRepeats = xcs.NRepeats;
+  int64_t num_threads_blk = xcs.num_threads_blk;
+  int64_t num_input_blks = xcs.num_input_blks;
+  int64_t waveSize = xcs.waveSize;
+  bool IsKReduction = xcs.isKReduction;
+  int64_t KPerThread = IsKReduction ? KPerBlock / num_input_blks : KPerBlock;
+  if (KPack > 1 ? KPack < xcs.k_base : KPerThread < xcs.k_base)
+    return op.emitOpError("register-only gemm needs a K tile of at least ")
+           << xcs.k_base << " values per lane";
+
+  bool useIndexDiffs = true;
+  func::FuncOp parentFunc = op->getParentOfType<func::FuncOp>();
+  int64_t kernelBlockSize =
+      parentFunc->getAttrOfType<IntegerAttr>("block_size").getInt();
+  int64_t kernelGridSize = getGemmGridSize(op, parentFunc);
+
+  // The workgroups take the tiles in order, M fastest.
+  Value bid = createGemmWorkgroupId(b, loc, op);
+  Value tid = b.create<WorkitemIdOp>(loc, b.getIndexType());
+  PhaseTimer phaseTimer(op);
+  phaseTimer.stamp(b, loc);
+
+  int64_t MBlockWork = M / MPerBlock;
+  int64_t NBlockWork = N / NPerBlock;
+  int64_t GStride = MBlockWork * NBlockWork;
+  Value gStrideOp = b.create<ConstantIndexOp>(loc, GStride);
+  Value mBlockWorkOp = b.create<ConstantIndexOp>(loc, MBlockWork);
+  Value blockWorkRem = b.create<RemUIOp>(loc, bid, gStrideOp);
+  Value g = b.create<DivUIOp>(loc, bid, gStrideOp);
+  Value mBlock = b.create<MulIOp>(
+      loc, b.create<RemUIOp>(loc, blockWorkRem, mBlockWorkOp),
+      b.create<ConstantIndexOp>(loc, MPerBlock));
+  Value nBlock = b.create<MulIOp>(
+      loc, b.create<DivUIOp>(loc, blockWorkRem, mBlockWorkOp),
+      b.create<ConstantIndexOp>(loc, NPerBlock));
+
+  // The row and column of each lane in the operands, and the first point
+  // along K of it, as the blockwise gemm reads them.
+  Value waveSizeOp = b.create<ConstantIndexOp>(loc, waveSize);
+  Value nWavesOp = b.create<ConstantIndexOp>(loc, NWaves);
+  Value waveId = b.create<DivUIOp>(loc, tid, waveSizeOp);
+  Value laneId = b.create<RemUIOp>(loc, tid, waveSizeOp);
+  Value numThreadsBlkOp = b.create<ConstantIndexOp>(loc, num_threads_blk);
+  Value inputLaneId = laneId;
+  Value kOffset = b.create<ConstantIndexOp>(loc, 0);
+  if (IsKReduction || xcs.isWmma)
+    inputLaneId = b.create<RemUIOp>(loc, laneId, numThreadsBlkOp);
+  if (IsKReduction)
+    kOffset = b.create<DivUIOp>(loc, laneId, numThreadsBlkOp);
+  Value aRow = b.create<AddIOp>(
+      loc, b.create<AddIOp>(loc, mBlock, inputLaneId),
+      b.create<MulIOp>(loc, b.create<DivUIOp>(loc, waveId, nWavesOp),
+                       b.create<ConstantIndexOp>(loc, MPerWave)));
+  Value bCol = b.create<AddIOp>(
+      loc, b.create<AddIOp>(loc, nBlock, inputLaneId),
+      b.create<MulIOp>(loc, b.create<RemUIOp>(loc, waveId, nWavesOp),
+                       b.create<ConstantIndexOp>(loc, NPerWave)));
+  int64_t kStride = IsKReduction ? num_input_blks : 1;
+
+  Type registerType = KPack > 1 ? VectorType::get({KPack}, elementType)
+                                : elementType;
+  auto arrayAType =
+      MemRefType::get({KPerThread * MRepeats}, registerType, {},
+                      gpu::GPUDialect::getPrivateAddressSpace());
+  auto arrayBType =
+      MemRefType::get({KPerThread * NRepeats}, registerType, {},
+                      gpu::GPUDialect::getPrivateAddressSpace());
+  Value arrayA = b.create<GpuAllocOp>(loc, arrayAType);
+  Value arrayB = b.create<GpuAllocOp>(loc, arrayBType);
+
+  auto loadTile = [&](OpBuilder &lb, Value kStart) {
+    return std::make_pair(
+        loadXdlopsOperandRuns(lb, loc, op.a(), g, kStart, aRow, MRepeats,
+                              MPerXdlops, KPerThread, kStride, KPack,
+                              useIndexDiffs),
+        loadXdlopsOperandRuns(lb, loc, op.b(), g, kStart, bCol, NRepeats,
+                              NPerXdlops, KPerThread, kStride, KPack,
+                              useIndexDiffs));
+  };
+  auto storeTile = [&](OpBuilder &lb,
+                       const std::pair<SmallVector<Value, 8>,
+                                       SmallVector<Value, 8>> &tile) {
+    storeXdlopsOperandRuns(lb, loc, tile.first, arrayA, KPack);
+    storeXdlopsOperandRuns(lb, loc, tile.second, arrayB, KPack);
+  };
+
+  // The XDLOPS of the repeats of the wave tile, as the blockwise gemm emits
+  // them.
+  VectorType vectorType = xcs.vectorType;
+  int64_t vectorsPerRepeat = xcs.vectorNumber / (MRepeats * NRepeats);
+  auto emitXdlopsGemms = [&](OpBuilder &lb, ValueRange cs) {
+    SmallVector<Value, 4> results;
+    for (int64_t m_i = 0; m_i < MRepeats; ++m_i) {
+      for (int64_t n_i = 0; n_i < NRepeats; ++n_i) {
+        ValueRange vectorCs = cs.slice(
+            (m_i * NRepeats + n_i) * vectorsPerRepeat, vectorsPerRepeat);
+        auto gemm = lb.create<XdlopsGemmV2Op>(
+            loc, vectorCs.getTypes(), op.a(), op.b(), lb.getIndexAttr(0),
+            lb.getIndexAttr(0),
+            lb.createOrFold<ConstantIndexOp>(loc, m_i * KPerThread),
+            lb.createOrFold<ConstantIndexOp>(loc, n_i * KPerThread), arrayA,
+            arrayB, vectorCs);
+        gemm->setAttr("m", lb.getI32IntegerAttr(MPerBlock));
+        gemm->setAttr("n", lb.getI32IntegerAttr(NPerBlock));
+        gemm->setAttr("k", lb.getI32IntegerAttr(KPerBlock));
+        gemm->setAttr("m_per_wave", lb.getI32IntegerAttr(MPerXdlops));
+        gemm->setAttr("n_per_wave", lb.getI32IntegerAttr(NPerXdlops));
+        for (StringRef name : {"kpack", "arch", "fp8_format", "xf32"})
+          if (Attribute attr = op->getAttr(name))
+            gemm->setAttr(name, attr);
+        llvm::append_range(results, gemm.vectorDs());
+      }
+    }
+    return results;
+  };
+
+  // Load the first K tile, then, for each further one, issue its loads,
+  // multiply the tile in registers and only then overwrite them.
+  storeTile(b, loadTile(b, kOffset));
+  phaseTimer.stamp(b, loc);
+  // Nothing is staged in LDS.
+  phaseTimer.stamp(b, loc);
+
+  SmallVector<Value, 4> vectorCs(xcs.vectorNumber,
+                                 createZeroConstantOp(b, loc, vectorType));
+  int64_t numKTiles = K / KPerBlock;
+  auto loopOp = b.create<AffineForOp>(loc, 1, numKTiles, 1, vectorCs);
+  {
+    auto lb = OpBuilder::atBlockBegin(loopOp.getBody());
+    Value kStart = lb.create<AddIOp>(
+        loc, kOffset,
+        lb.create<MulIOp>(loc, loopOp.getInductionVar(),
+                          lb.create<ConstantIndexOp>(loc, KPerBlock)));
+    auto tile = loadTile(lb, kStart);
+    SmallVector<Value, 4> results =
+        emitXdlopsGemms(lb, loopOp.getRegionIterArgs());
+    storeTile(lb, tile);
+    lb.create<AffineYieldOp>(loc, results);
+  }
+  SmallVector<Value, 4> tailResults = emitXdlopsGemms(b, loopOp.getResults());
+  phaseTimer.stamp(b, loc);
+
+  // Matrix C write out, with the maps of the LDS lowering.
+  int64_t gemmCVectorizedMatrixDim =
+      op->getAttrOfType<IntegerAttr>("matrix_c_source_vector_read_dim")
+          .getInt();
+  int64_t matrixCDataPerCopy =
+      op->getAttrOfType<IntegerAttr>("matrix_c_data_per_copy").getInt();
+  ArrayAttr cLeftOobCheck, cRightOobCheck;
+  std::tie(cLeftOobCheck, cRightOobCheck) =
+      computeOobFromTransforms(b, std::get<1>(untransform(b, op.c())));
+  // Without the output swizzles, threads hold no runs along N.
+  if (cLeftOobCheck.size() > 0 || cRightOobCheck.size() > 0 ||
+      gemmCVectorizedMatrixDim == gemmCDimN)
+    matrixCDataPerCopy = 1;
+
+  int64_t group_size = xcs.group_size;
+  int64_t num_groups_blk = xcs.num_groups_blk;
+  int64_t num_output_blks = xcs.num_output_blks;
+  int64_t numBlksPerXdlops = (MPerXdlops * NPerXdlops) / (xcs.m * xcs.n);
+  int64_t wavesInKernelBlock = kernelBlockSize / waveSize;
+  int64_t resultCVectorLen = vectorType.getNumElements();
+  int64_t numElements = resultCVectorLen * tailResults.size();
+
+  TopDownTMBuilder splitMemoryCoords(
+      b, {"bid", "tid", "item"},
+      {kernelGridSize, kernelBlockSize, numElements}, loc);
+  splitMemoryCoords.merge(
+      {"g", "n", "m"}, {0, 1, 2}, {"bid"},
+      {kernelGridSize / GStride, GStride / MBlockWork, MBlockWork});
+  splitMemoryCoords.merge({"wave", "block", "tid_group", "tid_item"},
+                          {3, 4, 5, 6}, "tid",
+                          {wavesInKernelBlock, waveSize / num_threads_blk,
+                           num_threads_blk / group_size, group_size});
+  splitMemoryCoords.merge(
+      {"i", "j", "vec_group", "vec_item"}, {7, 8, 9, 10}, "item",
+      {numElements / (numBlksPerXdlops * num_groups_blk * group_size),
+       numBlksPerXdlops, num_groups_blk, group_size});
+  TransformMapAttr splitMemoryCoordsAttr = splitMemoryCoords.get();
+
+  auto toRowsAndCols =
+      TopDownTMBuilder::below(splitMemoryCoords, splitMemoryCoordsAttr);
+  llvm::StringMap<uint32_t> rowsAndColsIdxs = expandNamesInPlace(
+      splitMemoryCoords, {{"wave", {"wave_m", "wave_n"}},
+                          {"i", {"m_i", "n_i"}},
+                          {"j", {"blkMajor", "blkMinor"}}});
+  TopDownTMBottomDimsWrapper rowsAndColsWrap(toRowsAndCols, rowsAndColsIdxs);
+  rowsAndColsWrap.passThrough({"g", "m", "n"});
+  rowsAndColsWrap.merge({"wave_m", "wave_n"}, "wave",
+                        {wavesInKernelBlock / NWaves, NWaves});
+  rowsAndColsWrap.passThrough({"block", "tid_group", "tid_item"});
+  rowsAndColsWrap.merge({"m_i", "n_i"}, "i",
+                        {splitMemoryCoords.endSize("i") / NRepeats, NRepeats});
+  bool isABroadcast = (NPerXdlops >= MPerXdlops);
+  SmallVector<StringRef, 2> rowsFirst = {"blk_row", "blk_col"};
+  SmallVector<StringRef, 2> colsFirst = {"blk_col", "blk_row"};
+  toRowsAndCols.merge(
+      isABroadcast ? rowsFirst : colsFirst,
+      {rowsAndColsIdxs["blkMajor"], rowsAndColsIdxs["blkMinor"]}, "j",
+      {splitMemoryCoords.endSize("j") / num_output_blks, num_output_blks});
+  toRowsAndCols.passThrough(
+      {"vec_group", "vec_item"},
+      {rowsAndColsIdxs["vec_group"], rowsAndColsIdxs["vec_item"]},
+      {"vec_group", "vec_item"});
+  TransformMapAttr toRowsAndColsAttr = toRowsAndCols.get();
+
+  auto toMatrixC = TopDownTMBuilder::below(toRowsAndCols, toRowsAndColsAttr);
+  toMatrixC.passThrough({"gemmG"}, {0}, {"g"});
+  toMatrixC.embed("gemmM", 1, M,
+                  {"m", "wave_m", "block", "m_i", "blk_row", "vec_group",
+                   "vec_item"},
+                  {MPerBlock, MPerWave, group_size, MPerXdlops, xcs.m,
+                   num_input_blks * group_size, 1});
+  toMatrixC.embed("gemmN", 2, N,
+                  {"n", "wave_n", "tid_group", "n_i", "blk_col", "tid_item"},
+                  {NPerBlock, NPerWave, group_size, NPerXdlops, xcs.n, 1});
+  TransformMapAttr toMatrixCAttr = toMatrixC.get();
+
+  TopDownTMBuilder correctVectorCoords(
+      b, {"bid", "tid", "item"},
+      {kernelGridSize, kernelBlockSize, numElements}, loc);
+  correctVectorCoords.ignore("bid");
+  correctVectorCoords.ignore("tid");
+  correctVectorCoords.passThrough({"index"}, {0}, {"item"});
+  TransformMapAttr correctVectorCoordsAttr = correctVectorCoords.get();
+
+  // Convert the results to the output type, scaling the products of 8-bit
+  // floats, or gather them for requantization.
+  Type destType = op.c().getType().cast<MemRefType>().getElementType();
+  Value requantScales = op.requantScales();
+  Type mergedElementType =
+      requantScales ? vectorType.getElementType() : destType;
+  MemRefType mergedType =
+      MemRefType::get(numElements, mergedElementType, {},
+                      gpu::GPUDialect::getPrivateAddressSpace());
+  VectorType castVectorType = vectorType.clone(mergedElementType);
+  Value resultMerged = b.create<GpuAllocOp>(loc, mergedType);
+  Value fp8Scale;
+  if (auto scaleAttr = op->getAttrOfType<FloatAttr>("fp8_scale"))
+    if (!scaleAttr.getValue().isExactlyValue(1.0))
+      fp8Scale = createConstantFloatOp(b, loc, vectorType,
+                                       vectorType.getElementType(),
+                                       scaleAttr.getValueAsDouble());
+  for (const auto &pair : llvm::enumerate(tailResults)) {
+    Value result = pair.value();
+    if (fp8Scale)
+      result = b.create<MulFOp>(loc, result, fp8Scale);
+    Value cast = createTypeConversionOp(b, loc, result, castVectorType);
+    Value offset =
+        b.createOrFold<ConstantIndexOp>(loc, pair.index() * resultCVectorLen);
+    b.create<InBoundsStoreOp>(loc, cast, resultMerged, offset);
+  }
+  Value zeroConstantOp = b.create<ConstantIndexOp>(loc, 0);
+  SmallVector<Value, 3> writeStartCoords = {bid, tid, zeroConstantOp};
+  ArrayAttr idToMatrixCMaps = b.getArrayAttr(
+      {splitMemoryCoordsAttr, toRowsAndColsAttr, toMatrixCAttr});
+  if (requantScales) {
+    int64_t zeroPoint = 0;
+    if (auto attr = op->getAttrOfType<IntegerAttr>("requant_zero_point"))
+      zeroPoint = attr.getInt();
+    resultMerged = requantizeResults(
+        b, loc, resultMerged, requantScales, zeroPoint, G, writeStartCoords,
+        b.getArrayAttr({correctVectorCoordsAttr}), idToMatrixCMaps,
+        numElements);
+  }
+
+  Value tensorC;
+  ArrayAttr idToTensorCMaps;
+  std::tie(tensorC, idToTensorCMaps) =
+      untransform(b, op.c(), idToMatrixCMaps);
+  auto writeOobDims = computeOobFromTransforms(b, idToTensorCMaps);
+  auto outLoop = b.create<TransformingForOp>(
+      loc, ArrayRef<ValueRange>{writeStartCoords, writeStartCoords},
+      ArrayRef<Attribute>{b.getArrayAttr({correctVectorCoordsAttr}),
+                          idToTensorCMaps},
+      ArrayRef<int64_t>{1, 1, numElements},
+      ArrayRef<int64_t>{1, 1, matrixCDataPerCopy},
+      /*forceUnroll=*/true, /*useIndexDiffs=*/useIndexDiffs);
+  {
+    OpBuilder::InsertionGuard guard(b);
+    b.setInsertionPointToStart(outLoop.getBody());
+    b.create<ThreadwiseCopyV2Op>(
+        loc, resultMerged, tensorC, b.getIndexAttr(matrixCDataPerCopy),
+        op.storeMethodAttr(), std::get<0>(writeOobDims),
+        std::get<1>(writeOobDims), outLoop.getLowerCoords(/*domain=*/0)[0],
+        outLoop.getLowerCoords(/*domain=*/1));
+  }
+  if (op.reduceDest())
+    emitFusedKBlockReduction(b, loc, op, bid, tid, idToMatrixCMaps,
+                             b.getArrayAttr({correctVectorCoordsAttr}),
+                             numElements, matrixCDataPerCopy, GStride,
+                             kernelBlockSize, waveSize, useIndexDiffs);
+
+  phaseTimer.stamp(b, loc);
+  phaseTimer.record(b, loc, tid);
+  b.eraseOp(op);
+  return success();
+}
+
 struct GridwiseGemmV2RewritePattern
     : public OpRewritePattern<GridwiseGemmV2Op> {
   using OpRewritePattern<GridwiseGemmV2Op>::OpRewritePattern;
 
   void computeLDSBlockSizes(GridwiseGemmV2Op op, int64_t &a_block_space,
                             int64_t &b_block_space, int64_t &total_block_space,
-                            int64_t KPack = 1) const {
+                            int64_t KPack = 1, int64_t ldsStages = 1) const {
     int64_t ABlockCopyDstDataPerWrite_M =
         op->getAttr("matrix_a_dest_data_per_write_dim_m")
             .template cast<IntegerAttr>()
@@ -1391,19 +2396,28 @@ struct GridwiseGemmV2RewritePattern
                         KPerBlock * AlignedNPerBlock, max_lds_align) *
                     KPack;
 
-    total_block_space = a_block_space + b_block_space;
+    // Every stage of the main loop pipeline has its own A and B tiles.
+    total_block_space = (a_block_space + b_block_space) * ldsStages;
 
     LLVM_DEBUG(llvm::dbgs() << "a_block_space: " << a_block_space << "\n");
     LLVM_DEBUG(llvm::dbgs() << "b_block_space: " << b_block_space << "\n");
+    LLVM_DEBUG(llvm::dbgs() << "ldsStages: " << ldsStages << "\n");
     LLVM_DEBUG(llvm::dbgs()
                << "total_block_space: " << total_block_space << "\n\n");
   }
 
   void affixBlockwiseGemmV2Attributes(BlockwiseGemmV2Op bop,
                                       GridwiseGemmV2Op gop, int64_t m,
-                                      int64_t k, int64_t n,
-                                      OpBuilder &b) const {
+                                      int64_t k, int64_t n, OpBuilder &b,
+                                      const LdsSwizzle &swizzleA = {},
+                                      const LdsSwizzle &swizzleB = {}) const {
     bop->setAttr("block_size", gop->getAttr("block_size"));
+    if (!swizzleA.isIdentity())
+      bop->setAttr("lds_swizzle_a",
+                   b.getI64ArrayAttr({swizzleA.granule, swizzleA.period}));
+    if (!swizzleB.isIdentity())
+      bop->setAttr("lds_swizzle_b",
+                   b.getI64ArrayAttr({swizzleB.granule, swizzleB.period}));
 
     int64_t MPerBlock =
         gop->getAttr("m_per_block").template cast<IntegerAttr>().getInt();
@@ -1427,14 +2441,28 @@ struct GridwiseGemmV2RewritePattern
 
     if (gop->hasAttr("kpack"))
       bop->setAttr("kpack", gop->getAttr("kpack"));
+    if (Attribute arch = gop->getAttr("arch"))
+      bop->setAttr("arch", arch);
+    if (Attribute fp8Format = gop->getAttr("fp8_format"))
+      bop->setAttr("fp8_format", fp8Format);
+    if (Attribute xf32 = gop->getAttr("xf32"))
+      bop->setAttr("xf32", xf32);
+    if (Attribute sparse = gop->getAttr("sparse"))
+      bop->setAttr("sparse", sparse);
   }
 
   LogicalResult matchAndRewrite(GridwiseGemmV2Op op,
                                 PatternRewriter &b) const override {
+    if (op->hasAttr("register_only"))
+      return lowerRegisterOnlyGemm(op, b);
+
     auto loc = op.getLoc();
 
     // Obtain data type.
-    auto elementType = op.b().getType().cast<MemRefType>().getElementType();
+    Type elementType = obtainConvDataType(op);
+    Int4Dequant dequant;
+    if (auto groupSize = op->getAttrOfType<IntegerAttr>("int4_group_size"))
+      dequant = {op.dequantScales(), groupSize.getInt()};
 
     // Prepare some useful constants.
     auto zeroConstantOp = b.create<ConstantIndexOp>(loc, 0);
@@ -1519,7 +2547,10 @@ struct GridwiseGemmV2RewritePattern
     auto NPerWaveConstantOp = b.create<ConstantIndexOp>(loc, NPerWave);
     auto NWavesConstantOp = b.create<ConstantIndexOp>(loc, NWaves);
 
-    constexpr int64_t waveSize = 64;
+    StringRef arch;
+    if (auto archAttr = op->getAttrOfType<StringAttr>("arch"))
+      arch = archAttr.getValue();
+    int64_t waveSize = XdlopsCodeSelection::getWaveSize(arch);
     auto waveSizeConstantOp = b.create<ConstantIndexOp>(loc, waveSize);
 
     bool useIndexDiffs = true;
@@ -1527,11 +2558,10 @@ struct GridwiseGemmV2RewritePattern
     func::FuncOp parentFunc = op->getParentOfType<func::FuncOp>();
     int64_t kernelBlockSize =
         parentFunc->getAttrOfType<IntegerAttr>("block_size").getInt();
-    int64_t kernelGridSize =
-        parentFunc->getAttrOfType<IntegerAttr>("grid_size").getInt();
+    int64_t kernelGridSize = getGemmGridSize(op, parentFunc);
 
     // Get current workgroup ID.
-    auto bid = b.create<WorkgroupIdOp>(loc, b.getIndexType());
+    Value bid = createGemmWorkgroupId(b, loc, op);
 
     // Get current workitem ID.
     auto tid = b.create<WorkitemIdOp>(loc, b.getIndexType());
@@ -1539,6 +2569,21 @@ struct GridwiseGemmV2RewritePattern
     int64_t MBlockWork = M / MPerBlock;
     int64_t NBlockWork = N / NPerBlock;
     int64_t GStride = MBlockWork * NBlockWork;
+    // Persistent kernels run the whole gemm, main loop and epilogue, for each
+    // of the tiles their workgroups take in turn, as if the grid had one
+    // workgroup per tile.
+    bool persistent =
+        op->hasAttr("persistent") && kernelGridSize < G * GStride;
+    if (persistent) {
+      bid = beginPersistentTileLoop(b, loc, bid, kernelGridSize, G * GStride);
+      kernelGridSize = G * GStride;
+    }
+    int64_t gridGroupM =
+        getGridGroupM(op, MBlockWork, NBlockWork, /*rasterGroupM=*/MBlockWork);
+    bid = swizzleWorkgroupId(b, loc, bid, kernelGridSize, MBlockWork,
+                             NBlockWork, gridGroupM, /*mFastest=*/true);
+    PhaseTimer phaseTimer(op);
+    phaseTimer.stamp(b, loc);
 
     LLVM_DEBUG(llvm::dbgs()
                << "M: " << M << "\n"
@@ -1550,6 +2595,7 @@ struct GridwiseGemmV2RewritePattern
                << "KPack: " << KPack << "\n"
                << "MBlockWork = M / MPerBlock: " << MBlockWork << "\n"
                << "NBlockWork = N / NPerBlock: " << NBlockWork << "\n"
+               << "GridGroupM: " << gridGroupM << "\n"
                << "MPerWave: " << MPerWave << "\n"
                << "NPerWave: " << NPerWave << "\n"
                << "matrix_a_source_data_per_read: "
@@ -1597,6 +2643,21 @@ struct GridwiseGemmV2RewritePattern
 
     // Logic to prepare parameters for blockwise_copy.
 
+    matrix_a_source_data_per_read = widenGlobalLoads(
+        b, op.a(), matrix_a_source_vector_read_dim,
+        matrix_a_source_data_per_read, KPack, KPerBlock, MPerBlock, BlockSize);
+    matrix_b_source_data_per_read = widenGlobalLoads(
+        b, op.b(), matrix_b_source_vector_read_dim,
+        matrix_b_source_data_per_read, KPack, KPerBlock, NPerBlock, BlockSize);
+    // Consecutive int4 weights along K share a byte, so their loads only
+    // take vectors along N.
+    if (dequant && matrix_b_source_vector_read_dim != GemmMorN)
+      matrix_b_source_data_per_read = 1;
+    LLVM_DEBUG(llvm::dbgs() << "widened matrix_a_source_data_per_read: "
+                            << matrix_a_source_data_per_read << "\n"
+                            << "widened matrix_b_source_data_per_read: "
+                            << matrix_b_source_data_per_read << "\n");
+
     // Compute ThreadSliceLengths for Matrix A.
     int64_t GemmABlockCopyNumberDataPerThread =
         MPerBlock * KPerBlock * KPack / BlockSize;
@@ -1948,8 +3009,17 @@ struct GridwiseGemmV2RewritePattern
     // Alocate LDS and create subviews.
 
     // Compute required LDS sizes.
+    // The main loop cycles through ldsStages copies of the A and B tiles, no
+    // more than there are K tiles.
+    int64_t numKTiles = K / KPerBlock;
+    int64_t ldsStages = 1;
+    if (auto ldsStagesAttr = op->getAttrOfType<IntegerAttr>("lds_stages"))
+      ldsStages = std::max<int64_t>(
+          std::min<int64_t>(ldsStagesAttr.getInt(), numKTiles), 1);
     int64_t ldsBlockASize, ldsBlockBSize, ldsBlockSize;
-    computeLDSBlockSizes(op, ldsBlockASize, ldsBlockBSize, ldsBlockSize, KPack);
+    computeLDSBlockSizes(op, ldsBlockASize, ldsBlockBSize, ldsBlockSize, KPack,
+                         ldsStages);
+    int64_t ldsStageSize = ldsBlockASize + ldsBlockBSize;
 
     LLVM_DEBUG(llvm::dbgs() << "LDS block size:" << ldsBlockASize << " "
                             << ldsBlockBSize << " " << ldsBlockSize << "\n");
@@ -2068,6 +3138,90 @@ struct GridwiseGemmV2RewritePattern
 
     // -----
 
+    // With direct_to_lds, the copies whose thread layout allows it load
+    // their tiles from global memory into LDS without staging them in
+    // registers, into every LDS buffer the main loop uses.
+    bool directToLds = op->hasAttr("direct_to_lds") && KPack == 1;
+    SmallVector<int64_t, 3> ldsStageOffsetsA, ldsStageOffsetsB;
+    for (int64_t stage = 0; stage < ldsStages; ++stage) {
+      ldsStageOffsetsA.push_back(ldsBlockAOffset + stage * ldsStageSize);
+      ldsStageOffsetsB.push_back(ldsBlockBOffset + stage * ldsStageSize);
+    }
+    bool directA =
+        directToLds &&
+        canLoadDirectToLds(elementType, BlockSize,
+                           GemmABlockCopyThreadSliceLengths_GemmK,
+                           GemmABlockCopyThreadSliceLengths_GemmM,
+                           GemmABlockCopyClusterLengths_GemmK,
+                           MPerBlock / GemmABlockCopyThreadSliceLengths_GemmM,
+                           /*kFastest=*/true, MPerBlock, blockwiseVectorDimA,
+                           blockwiseLoadVectorLenA, ldsStageOffsetsA,
+                           waveSize);
+    bool directB =
+        directToLds && !dequant &&
+        canLoadDirectToLds(elementType, BlockSize,
+                           GemmBBlockCopyThreadSliceLengths_GemmK,
+                           GemmBBlockCopyThreadSliceLengths_GemmN,
+                           GemmBBlockCopyClusterLengths_GemmK,
+                           GemmBBlockCopyClusterLengths_GemmN,
+                           /*kFastest=*/false, NPerBlock, blockwiseVectorDimB,
+                           blockwiseLoadVectorLenB, ldsStageOffsetsB,
+                           waveSize);
+    LLVM_DEBUG(llvm::dbgs() << "Direct to LDS loads: A " << directA << " B "
+                            << directB << "\n");
+
+    // The copies that go through registers store their tiles with an XOR
+    // swizzle, so threads storing the same column of different K rows don't
+    // hit the same banks. Granules cover a store vector.
+    int64_t elementBytes =
+        llvm::divideCeil(elementType.getIntOrFloatBitWidth(), 8);
+    auto getSwizzle = [&](bool direct, int64_t mnPerBlock, uint32_t vectorDim,
+                          int64_t storeLength) {
+      if (direct)
+        return LdsSwizzle();
+      int64_t granule = KPack;
+      if (vectorDim != blockwiseCopyABounds.size() - 1 || KPack == 1)
+        granule *= storeLength;
+      return LdsSwizzle::get(mnPerBlock * KPack, granule, elementBytes);
+    };
+    LdsSwizzle swizzleA = getSwizzle(directA, MPerBlock, blockwiseVectorDimA,
+                                     blockwiseStoreVectorLenA);
+    LdsSwizzle swizzleB = getSwizzle(directB, NPerBlock, blockwiseVectorDimB,
+                                     blockwiseStoreVectorLenB);
+    LLVM_DEBUG(llvm::dbgs() << "LDS swizzle periods: A " << swizzleA.period
+                            << " B " << swizzleB.period << "\n");
+
+    // Direct loads write LDS asynchronously, so the barriers before the LDS
+    // is read must also wait for outstanding global loads.
+    auto emitLdsReadBarrier = [&](OpBuilder &lb) {
+      if (directA || directB)
+        lb.create<WorkgroupBarrierOp>(loc);
+      else
+        lb.create<LDSBarrierOp>(loc);
+    };
+
+    // The scheduling hints around the MFMAs of each step of the main loop.
+    // The fences let the backend move scalar and vector ALU work, the address
+    // arithmetic, across them, but no memory access or MFMA.
+    int64_t schedHints = 0;
+    if (auto schedHintsAttr = op->getAttrOfType<IntegerAttr>("sched_hints"))
+      schedHints = schedHintsAttr.getInt();
+    constexpr uint32_t kSchedFenceMask = 0x2 | 0x4;
+    auto emitMfmaSectionBegin = [&](OpBuilder &lb) {
+      if (schedHints & kSchedHintFence)
+        lb.create<amdgpu::SchedBarrierOp>(loc, kSchedFenceMask);
+      if (schedHints & kSchedHintPriority)
+        lb.create<amdgpu::SetPrioOp>(loc, 1);
+    };
+    auto emitMfmaSectionEnd = [&](OpBuilder &lb) {
+      if (schedHints & kSchedHintPriority)
+        lb.create<amdgpu::SetPrioOp>(loc, 0);
+      if (schedHints & kSchedHintFence)
+        lb.create<amdgpu::SchedBarrierOp>(loc, kSchedFenceMask);
+    };
+
+    // -----
+
     // Blockwise copies before the loop.
     // Blockwise copy from global (generic tensor) to LDS (naive tensor).
 
@@ -2080,10 +3234,25 @@ struct GridwiseGemmV2RewritePattern
       blockwiseLoadACoords = {GemmBlockCoord_G, GemmABlockCopySourceCoord_Y,
                               GemmABlockCopySourceCoord_X};
     }
+    SmallVector<Value, 4> blockwiseStoreACoords;
+    if (KPack > 1) {
+      blockwiseStoreACoords = {zeroConstantOp, GemmABlockCopyDestCoord_Z,
+                               GemmABlockCopyDestCoord_Y,
+                               GemmABlockCopyDestCoord_X};
+    } else {
+      blockwiseStoreACoords = {zeroConstantOp, GemmABlockCopyDestCoord_Y,
+                               GemmABlockCopyDestCoord_X};
+    }
     // Emit blockwise load for matrix A.
-    TransformingForOp blockwiseLoadA = createGlobalLoadLoop(
-        b, loc, op.a(), blockwiseLoadACoords, aLoadIntermediate, aLoadType,
-        blockwiseCopyABounds, blockwiseVectorDimA, useIndexDiffs);
+    TransformingForOp blockwiseLoadA =
+        directA ? createGlobalToLdsLoop(
+                      b, loc, op.a(), blockwiseLoadACoords, ldsMatrixASubviewOp,
+                      blockwiseStoreACoords, blockwiseCopyABounds,
+                      blockwiseVectorDimA, useIndexDiffs)
+                : createGlobalLoadLoop(b, loc, op.a(), blockwiseLoadACoords,
+                                       aLoadIntermediate, aLoadType,
+                                       blockwiseCopyABounds,
+                                       blockwiseVectorDimA, useIndexDiffs);
 
     SmallVector<Value, 4> blockwiseLoadBCoords;
     if (KPack > 1) {
@@ -2094,26 +3263,6 @@ struct GridwiseGemmV2RewritePattern
       blockwiseLoadBCoords = {GemmBlockCoord_G, GemmBBlockCopySourceCoord_Y,
                               GemmBBlockCopySourceCoord_X};
     }
-    // Emit blockwise load for matrix B.
-    TransformingForOp blockwiseLoadB = createGlobalLoadLoop(
-        b, loc, op.b(), blockwiseLoadBCoords, bLoadIntermediate, bLoadType,
-        blockwiseCopyBBounds, blockwiseVectorDimB, useIndexDiffs);
-
-    SmallVector<Value, 4> blockwiseStoreACoords;
-    if (KPack > 1) {
-      blockwiseStoreACoords = {zeroConstantOp, GemmABlockCopyDestCoord_Z,
-                               GemmABlockCopyDestCoord_Y,
-                               GemmABlockCopyDestCoord_X};
-    } else {
-      blockwiseStoreACoords = {zeroConstantOp, GemmABlockCopyDestCoord_Y,
-                               GemmABlockCopyDestCoord_X};
-    }
-    // Emit blockwise store for matrix A.
-    TransformingForOp blockwiseStoreA = createLdsStoreLoop(
-        b, loc, blockwiseLoadA.getResult(0), ldsMatrixASubviewOp,
-        blockwiseStoreACoords, aStoreType, blockwiseCopyABounds,
-        blockwiseVectorDimA);
-
     SmallVector<Value, 4> blockwiseStoreBCoords;
     if (KPack > 1) {
       blockwiseStoreBCoords = {zeroConstantOp, GemmBBlockCopyDestCoord_Z,
@@ -2123,17 +3272,46 @@ struct GridwiseGemmV2RewritePattern
       blockwiseStoreBCoords = {zeroConstantOp, GemmBBlockCopyDestCoord_Y,
                                GemmBBlockCopyDestCoord_X};
     }
+    // Emit blockwise load for matrix B.
+    TransformingForOp blockwiseLoadB =
+        directB ? createGlobalToLdsLoop(
+                      b, loc, op.b(), blockwiseLoadBCoords, ldsMatrixBSubviewOp,
+                      blockwiseStoreBCoords, blockwiseCopyBBounds,
+                      blockwiseVectorDimB, useIndexDiffs)
+                : createGlobalLoadLoop(
+                      b, loc, op.b(), blockwiseLoadBCoords, bLoadIntermediate,
+                      bLoadType, blockwiseCopyBBounds, blockwiseVectorDimB,
+                      useIndexDiffs, dequant);
+    phaseTimer.stamp(b, loc);
+
+    // Emit blockwise store for matrix A.
+    TransformingForOp blockwiseStoreA, blockwiseStoreB;
+    if (!directA)
+      blockwiseStoreA = createLdsStoreLoop(
+          b, loc, blockwiseLoadA.getResult(0), ldsMatrixASubviewOp,
+          blockwiseStoreACoords, aStoreType, blockwiseCopyABounds,
+          blockwiseVectorDimA, swizzleA, ldsBlockAOffset);
+
     // Emit blockwise_store for matrix B.
-    TransformingForOp blockwiseStoreB = createLdsStoreLoop(
-        b, loc, blockwiseLoadB.getResult(0), ldsMatrixBSubviewOp,
-        blockwiseStoreBCoords, bStoreType, blockwiseCopyBBounds,
-        blockwiseVectorDimB);
+    if (!directB)
+      blockwiseStoreB = createLdsStoreLoop(
+          b, loc, blockwiseLoadB.getResult(0), ldsMatrixBSubviewOp,
+          blockwiseStoreBCoords, bStoreType, blockwiseCopyBBounds,
+          blockwiseVectorDimB, swizzleB, ldsBlockBOffset);
+    phaseTimer.stamp(b, loc);
 
     // -----
 
     // Logic to do XDLOPS code selection.
-    XdlopsCodeSelection xcs =
-        XdlopsCodeSelection::get(elementType, MPerWave, NPerWave, b);
+    Optional<Fp8Format> fp8Format = obtainFp8Format(op);
+    FailureOr<XdlopsCodeSelection> maybeXcs = XdlopsCodeSelection::get(
+        elementType, MPerWave, NPerWave, arch, fp8Format, op->hasAttr("xf32"),
+        op->hasAttr("sparse"));
+    if (failed(maybeXcs))
+      return op.emitOpError("no XDLOPS instruction for a ")
+             << MPerWave << "x" << NPerWave << " wave tile of "
+             << elementType;
+    XdlopsCodeSelection xcs = *maybeXcs;
 
     // Extract values from XdlopsCodeSelection.
     int64_t MPerXdlops = xcs.MPerXdlops;
@@ -2175,13 +3353,18 @@ struct GridwiseGemmV2RewritePattern
 
     // Logic to setup buffers for blockwise_gemm_v2.
 
-    bool IsKReduction = (num_output_blks == 1) && (num_input_blks > 1);
+    bool IsKReduction = xcs.isKReduction;
     int64_t arrayASize = (!IsKReduction)
                              ? (KPerBlock * MRepeats)
                              : (KPerBlock / num_input_blks * MRepeats);
     int64_t arrayBSize = (!IsKReduction)
                              ? (KPerBlock * NRepeats)
                              : (KPerBlock / num_input_blks * NRepeats);
+    // WMMA operands are whole rows of k_base values of K, which only
+    // KPack-wide vectors hold.
+    if (xcs.isWmma && KPack < k_base)
+      return op.emitOpError("WMMA needs a kpack of at least ") << k_base;
+
     Type arrayAType, arrayBType;
     if (KPack > 1) {
       // Should pack at least k_base elements and avoid waste xdlopsgemm
@@ -2232,97 +3415,276 @@ struct GridwiseGemmV2RewritePattern
     // -----
 
     // Emit loop.
+    SmallVector<Value, 4> tailResults;
+    if (ldsStages > 1) {
+      // Software-pipelined main loop over ldsStages LDS buffers: iteration i
+      // multiplies the tile in buffer i % ldsStages while the global loads of
+      // tile i + ldsStages - 1 are in flight, then stores that tile into the
+      // buffer iteration i - 1 read. That buffer is free once all threads
+      // pass the barrier of iteration i, so one barrier per iteration
+      // suffices.
+      SmallVector<Value, 3> ldsMatrixASubviews = {ldsMatrixASubviewOp};
+      SmallVector<Value, 3> ldsMatrixBSubviews = {ldsMatrixBSubviewOp};
+      auto getLdsMatrixSubview = [&](int64_t offset, int64_t size,
+                                     int64_t mOrNPerBlock) -> Value {
+        Value block = sliceBufferSubview(b, loc, ldsGpuAllocOp, offset, size);
+        if (KPack > 1)
+          return reshapeBuffer(b, loc, block, {"g", "k", "m", "kpack"},
+                               {1, KPerBlock, mOrNPerBlock, KPack});
+        return reshapeBuffer(b, loc, block, {"g", "k", "m"},
+                             {1, KPerBlock, mOrNPerBlock});
+      };
+      for (int64_t stage = 1; stage < ldsStages; ++stage) {
+        ldsMatrixASubviews.push_back(getLdsMatrixSubview(
+            ldsBlockAOffset + stage * ldsStageSize, ldsBlockASize, MPerBlock));
+        ldsMatrixBSubviews.push_back(getLdsMatrixSubview(
+            ldsBlockBOffset + stage * ldsStageSize, ldsBlockBSize, NPerBlock));
+      }
 
-    int64_t loopIteration = (K - KPerBlock) / KPerBlock;
-
-    // Assign iter args.
-    // 0: blockwise copy A src y coordinate.
-    // 1: blockwise copy B src y coordinate.
-    // 2-x : vectorCs.
-    SmallVector<Value, 6> iterArgs = {blockwiseLoadACoords[1],
-                                      blockwiseLoadBCoords[1]};
-    iterArgs.append(vectorCs);
-
-    auto mfmaLoopOp = b.create<AffineForOp>(loc, 0, loopIteration, 1, iterArgs);
-
-    // inside the loop.
-    auto mfmalb = OpBuilder::atBlockBegin(mfmaLoopOp.getBody());
-
-    const auto &mfmalArgs = mfmaLoopOp.getRegionIterArgs();
-    // get vectorCs for this iteration.
-    std::copy(mfmalArgs.begin() + 2, mfmalArgs.end(), vectorCs.begin());
-
-    // Blockwise copy from global (generic tensor) to register (naive tensor).
-    Value blockwiseCopyASrcUpdated =
-        mfmalb.create<AddIOp>(loc, mfmalArgs[0], KPerBlockConstantOp);
-    BlockAndValueMapping loadAUpdates;
-    loadAUpdates.map(blockwiseLoadACoords[1], blockwiseCopyASrcUpdated);
-    auto blockwiseLoadAClone = cast<TransformingForOp>(
-        mfmalb.clone(*blockwiseLoadA.getOperation(), loadAUpdates));
-
-    // Emit blockwise load for matrix B.
-    BlockAndValueMapping loadBUpdates;
-    Value blockwiseCopyBSrcUpdated =
-        mfmalb.create<AddIOp>(loc, mfmalArgs[1], KPerBlockConstantOp);
-    loadBUpdates.map(blockwiseLoadBCoords[1], blockwiseCopyBSrcUpdated);
-    auto blockwiseLoadBClone = cast<TransformingForOp>(
-        mfmalb.clone(*blockwiseLoadB.getOperation(), loadBUpdates));
-
-    // LDS barrier : guarantees LDS update completion before reading out to
-    // register. requires LDS fence + barrier.
-    mfmalb.create<LDSBarrierOp>(loc);
-
-    // Emit blockwise V2 GEMM.
-    // The xdlops gemms take a 1D buffer because reasons
-    auto blockwiseGemmV2Op = mfmalb.create<BlockwiseGemmV2Op>(
-        loc, vectorCTypes, ldsGpuAllocOp, ldsGpuAllocOp,
-        b.getIndexAttr(ldsBlockAOffset), b.getIndexAttr(ldsBlockBOffset),
-        mMyWaveOffsetA, mMyWaveOffsetB, arrayA, arrayB, vectorCs);
-    affixBlockwiseGemmV2Attributes(blockwiseGemmV2Op, op, MPerBlock, KPerBlock,
-                                   NPerBlock, b);
-
-    // LDS barrier : defer the next LDS update until this round's GEMM
-    // calculation is done. requires barrier only.
-    mfmalb.create<LDSBarrierOp>(loc);
-
-    // Blockwise copy from register (naive tensor) to LDS (naive tensor).
-    // Emit blockwise stores
-    BlockAndValueMapping storeAUpdates, storeBUpdates;
-    storeAUpdates.map(blockwiseLoadA.getResult(0),
-                      blockwiseLoadAClone.getResult(0));
-    storeBUpdates.map(blockwiseLoadB.getResult(0),
-                      blockwiseLoadBClone.getResult(0));
-    mfmalb.clone(*blockwiseStoreA.getOperation(), storeAUpdates);
-    mfmalb.clone(*blockwiseStoreB.getOperation(), storeBUpdates);
-
-    // Update iter args.
-    // blockwiseCopyASrcVector and blockwiseCopyBSrcVector are updated.
-    iterArgs[0] = blockwiseCopyASrcUpdated;
-    iterArgs[1] = blockwiseCopyBSrcUpdated;
-    // blockwise_gemm_v2 updates iter args[4-].
-    std::copy(blockwiseGemmV2Op.getResults().begin(),
-              blockwiseGemmV2Op.getResults().end(), iterArgs.begin() + 2);
-
-    // emit loop yield so iter args can be passed to the next iteration.
-    mfmalb.create<AffineYieldOp>(loc, iterArgs);
-    // outside the loop.
-
-    // Emit loop tail.
-
-    // LDS barrier.
-    b.create<LDSBarrierOp>(loc);
+      // Loads into registers, for the copies that don't load directly.
+      auto emitGlobalLoads = [&](OpBuilder &lb, Value kCoordA, Value kCoordB) {
+        SmallVector<Value, 4> loadACoords = blockwiseLoadACoords;
+        SmallVector<Value, 4> loadBCoords = blockwiseLoadBCoords;
+        loadACoords[1] = kCoordA;
+        loadBCoords[1] = kCoordB;
+        TransformingForOp loadA, loadB;
+        if (!directA)
+          loadA = createGlobalLoadLoop(
+              lb, loc, op.a(), loadACoords, aLoadIntermediate, aLoadType,
+              blockwiseCopyABounds, blockwiseVectorDimA, useIndexDiffs);
+        if (!directB)
+          loadB = createGlobalLoadLoop(
+              lb, loc, op.b(), loadBCoords, bLoadIntermediate, bLoadType,
+              blockwiseCopyBBounds, blockwiseVectorDimB, useIndexDiffs,
+              dequant);
+        return std::make_pair(loadA, loadB);
+      };
+      auto emitDirectLoads = [&](OpBuilder &lb, Value kCoordA, Value kCoordB,
+                                 int64_t stage) {
+        SmallVector<Value, 4> loadACoords = blockwiseLoadACoords;
+        SmallVector<Value, 4> loadBCoords = blockwiseLoadBCoords;
+        loadACoords[1] = kCoordA;
+        loadBCoords[1] = kCoordB;
+        if (directA)
+          createGlobalToLdsLoop(lb, loc, op.a(), loadACoords,
+                                ldsMatrixASubviews[stage],
+                                blockwiseStoreACoords, blockwiseCopyABounds,
+                                blockwiseVectorDimA, useIndexDiffs);
+        if (directB)
+          createGlobalToLdsLoop(lb, loc, op.b(), loadBCoords,
+                                ldsMatrixBSubviews[stage],
+                                blockwiseStoreBCoords, blockwiseCopyBBounds,
+                                blockwiseVectorDimB, useIndexDiffs);
+      };
+      auto emitLdsStores =
+          [&](OpBuilder &lb,
+              std::pair<TransformingForOp, TransformingForOp> loads,
+              int64_t stage) {
+            if (!directA)
+              createLdsStoreLoop(lb, loc, loads.first.getResult(0),
+                                 ldsMatrixASubviews[stage],
+                                 blockwiseStoreACoords, aStoreType,
+                                 blockwiseCopyABounds, blockwiseVectorDimA,
+                                 swizzleA, ldsStageOffsetsA[stage]);
+            if (!directB)
+              createLdsStoreLoop(lb, loc, loads.second.getResult(0),
+                                 ldsMatrixBSubviews[stage],
+                                 blockwiseStoreBCoords, bStoreType,
+                                 blockwiseCopyBBounds, blockwiseVectorDimB,
+                                 swizzleB, ldsStageOffsetsB[stage]);
+          };
+      auto emitBlockwiseGemm = [&](OpBuilder &lb, int64_t stage,
+                                   ValueRange cs) {
+        auto gemm = lb.create<BlockwiseGemmV2Op>(
+            loc, vectorCTypes, ldsGpuAllocOp, ldsGpuAllocOp,
+            b.getIndexAttr(ldsBlockAOffset + stage * ldsStageSize),
+            b.getIndexAttr(ldsBlockBOffset + stage * ldsStageSize),
+            mMyWaveOffsetA, mMyWaveOffsetB, arrayA, arrayB, cs);
+        affixBlockwiseGemmV2Attributes(gemm, op, MPerBlock, KPerBlock,
+                                       NPerBlock, b, swizzleA, swizzleB);
+        return gemm;
+      };
+
+      // Fill all buffers but the last before the loop. The first one was
+      // filled above.
+      Value kCoordA = blockwiseLoadACoords[1];
+      Value kCoordB = blockwiseLoadBCoords[1];
+      for (int64_t stage = 1; stage < ldsStages - 1; ++stage) {
+        kCoordA = b.create<AddIOp>(loc, kCoordA, KPerBlockConstantOp);
+        kCoordB = b.create<AddIOp>(loc, kCoordB, KPerBlockConstantOp);
+        emitLdsStores(b, emitGlobalLoads(b, kCoordA, kCoordB), stage);
+        emitDirectLoads(b, kCoordA, kCoordB, stage);
+      }
 
-    // get vectorCs for loop tail.
-    std::copy(mfmaLoopOp.getResults().begin() + 2,
-              mfmaLoopOp.getResults().end(), vectorCs.begin());
+      // One step of the steady state, multiplying the tile in `stage`.
+      // Direct loads can only be issued once the barrier guarantees that the
+      // buffer they write is no longer read.
+      auto emitPipelineStep = [&](OpBuilder &lb, int64_t stage, Value &kA,
+                                  Value &kB, SmallVectorImpl<Value> &cs) {
+        int64_t nextStage = (stage + ldsStages - 1) % ldsStages;
+        kA = lb.create<AddIOp>(loc, kA, KPerBlockConstantOp);
+        kB = lb.create<AddIOp>(loc, kB, KPerBlockConstantOp);
+        auto loads = emitGlobalLoads(lb, kA, kB);
+        emitLdsReadBarrier(lb);
+        emitDirectLoads(lb, kA, kB, nextStage);
+        emitMfmaSectionBegin(lb);
+        auto gemm = emitBlockwiseGemm(lb, stage, cs);
+        emitMfmaSectionEnd(lb);
+        llvm::copy(gemm.getResults(), cs.begin());
+        emitLdsStores(lb, loads, nextStage);
+      };
+
+      // The steady state runs once per tile still to be loaded. It is
+      // unrolled ldsStages times so every step addresses its buffers
+      // statically; the remainder is peeled after the loop.
+      int64_t numSteadyIterations = numKTiles - (ldsStages - 1);
+      SmallVector<Value, 6> pipelineArgs = {kCoordA, kCoordB};
+      pipelineArgs.append(vectorCs);
+      auto pipelineLoopOp = b.create<AffineForOp>(
+          loc, 0, numSteadyIterations / ldsStages, 1, pipelineArgs);
+      {
+        auto lb = OpBuilder::atBlockBegin(pipelineLoopOp.getBody());
+        const auto &loopArgs = pipelineLoopOp.getRegionIterArgs();
+        Value kA = loopArgs[0], kB = loopArgs[1];
+        SmallVector<Value, 4> cs(loopArgs.begin() + 2, loopArgs.end());
+        for (int64_t stage = 0; stage < ldsStages; ++stage)
+          emitPipelineStep(lb, stage, kA, kB, cs);
+        SmallVector<Value, 6> yielded = {kA, kB};
+        yielded.append(cs);
+        lb.create<AffineYieldOp>(loc, yielded);
+      }
+      kCoordA = pipelineLoopOp.getResult(0);
+      kCoordB = pipelineLoopOp.getResult(1);
+      SmallVector<Value, 4> cs(pipelineLoopOp.getResults().begin() + 2,
+                               pipelineLoopOp.getResults().end());
+      for (int64_t stage = 0; stage < numSteadyIterations % ldsStages; ++stage)
+        emitPipelineStep(b, stage, kCoordA, kCoordB, cs);
+
+      // Drain: multiply the tiles left in LDS. Nothing is stored any more, so
+      // a single barrier covers them all.
+      emitLdsReadBarrier(b);
+      for (int64_t i = numSteadyIterations; i < numKTiles; ++i) {
+        auto gemm = emitBlockwiseGemm(b, i % ldsStages, cs);
+        llvm::copy(gemm.getResults(), cs.begin());
+      }
+      tailResults.assign(cs.begin(), cs.end());
+    } else {
+      // Emit loop.
+
+      int64_t loopIteration = (K - KPerBlock) / KPerBlock;
+
+      // Assign iter args.
+      // 0: blockwise copy A src y coordinate.
+      // 1: blockwise copy B src y coordinate.
+      // 2-x : vectorCs.
+      SmallVector<Value, 6> iterArgs = {blockwiseLoadACoords[1],
+                                        blockwiseLoadBCoords[1]};
+      iterArgs.append(vectorCs);
+
+      auto mfmaLoopOp =
+          b.create<AffineForOp>(loc, 0, loopIteration, 1, iterArgs);
+
+      // inside the loop.
+      auto mfmalb = OpBuilder::atBlockBegin(mfmaLoopOp.getBody());
+
+      const auto &mfmalArgs = mfmaLoopOp.getRegionIterArgs();
+      // get vectorCs for this iteration.
+      std::copy(mfmalArgs.begin() + 2, mfmalArgs.end(), vectorCs.begin());
+
+      // Blockwise copy from global (generic tensor) to register (naive tensor).
+      // Direct loads to LDS are only issued after the GEMM, since they write
+      // the buffer it reads.
+      Value blockwiseCopyASrcUpdated =
+          mfmalb.create<AddIOp>(loc, mfmalArgs[0], KPerBlockConstantOp);
+      BlockAndValueMapping loadAUpdates;
+      loadAUpdates.map(blockwiseLoadACoords[1], blockwiseCopyASrcUpdated);
+      TransformingForOp blockwiseLoadAClone;
+      if (!directA)
+        blockwiseLoadAClone = cast<TransformingForOp>(
+            mfmalb.clone(*blockwiseLoadA.getOperation(), loadAUpdates));
+
+      // Emit blockwise load for matrix B.
+      BlockAndValueMapping loadBUpdates;
+      Value blockwiseCopyBSrcUpdated =
+          mfmalb.create<AddIOp>(loc, mfmalArgs[1], KPerBlockConstantOp);
+      loadBUpdates.map(blockwiseLoadBCoords[1], blockwiseCopyBSrcUpdated);
+      TransformingForOp blockwiseLoadBClone;
+      if (!directB)
+        blockwiseLoadBClone = cast<TransformingForOp>(
+            mfmalb.clone(*blockwiseLoadB.getOperation(), loadBUpdates));
+
+      // LDS barrier : guarantees LDS update completion before reading out to
+      // register. requires LDS fence + barrier.
+      emitLdsReadBarrier(mfmalb);
+      emitMfmaSectionBegin(mfmalb);
+
+      // Emit blockwise V2 GEMM.
+      // The xdlops gemms take a 1D buffer because reasons
+      auto blockwiseGemmV2Op = mfmalb.create<BlockwiseGemmV2Op>(
+          loc, vectorCTypes, ldsGpuAllocOp, ldsGpuAllocOp,
+          b.getIndexAttr(ldsBlockAOffset), b.getIndexAttr(ldsBlockBOffset),
+          mMyWaveOffsetA, mMyWaveOffsetB, arrayA, arrayB, vectorCs);
+      affixBlockwiseGemmV2Attributes(blockwiseGemmV2Op, op, MPerBlock,
+                                     KPerBlock, NPerBlock, b, swizzleA,
+                                     swizzleB);
+      emitMfmaSectionEnd(mfmalb);
+
+      // LDS barrier : defer the next LDS update until this round's GEMM
+      // calculation is done. requires barrier only.
+      mfmalb.create<LDSBarrierOp>(loc);
+
+      // Blockwise copy from register (naive tensor) to LDS (naive tensor).
+      // Emit blockwise stores
+      if (directA) {
+        mfmalb.clone(*blockwiseLoadA.getOperation(), loadAUpdates);
+      } else {
+        BlockAndValueMapping storeAUpdates;
+        storeAUpdates.map(blockwiseLoadA.getResult(0),
+                          blockwiseLoadAClone.getResult(0));
+        mfmalb.clone(*blockwiseStoreA.getOperation(), storeAUpdates);
+      }
+      if (directB) {
+        mfmalb.clone(*blockwiseLoadB.getOperation(), loadBUpdates);
+      } else {
+        BlockAndValueMapping storeBUpdates;
+        storeBUpdates.map(blockwiseLoadB.getResult(0),
+                          blockwiseLoadBClone.getResult(0));
+        mfmalb.clone(*blockwiseStoreB.getOperation(), storeBUpdates);
+      }
 
-    // Emit blockwise GEMM for the loop tail.
-    auto blockwiseGemmV2TailOp = b.create<BlockwiseGemmV2Op>(
-        loc, vectorCTypes, ldsGpuAllocOp, ldsGpuAllocOp,
-        b.getIndexAttr(ldsBlockAOffset), b.getIndexAttr(ldsBlockBOffset),
-        mMyWaveOffsetA, mMyWaveOffsetB, arrayA, arrayB, vectorCs);
-    affixBlockwiseGemmV2Attributes(blockwiseGemmV2TailOp, op, MPerBlock,
-                                   KPerBlock, NPerBlock, b);
+      // Update iter args.
+      // blockwiseCopyASrcVector and blockwiseCopyBSrcVector are updated.
+      iterArgs[0] = blockwiseCopyASrcUpdated;
+      iterArgs[1] = blockwiseCopyBSrcUpdated;
+      // blockwise_gemm_v2 updates iter args[4-].
+      std::copy(blockwiseGemmV2Op.getResults().begin(),
+                blockwiseGemmV2Op.getResults().end(), iterArgs.begin() + 2);
+
+      // emit loop yield so iter args can be passed to the next iteration.
+      mfmalb.create<AffineYieldOp>(loc, iterArgs);
+      // outside the loop.
+
+      // Emit loop tail.
+
+      // LDS barrier.
+      emitLdsReadBarrier(b);
+
+      // get vectorCs for loop tail.
+      std::copy(mfmaLoopOp.getResults().begin() + 2,
+                mfmaLoopOp.getResults().end(), vectorCs.begin());
+
+      // Emit blockwise GEMM for the loop tail.
+      auto blockwiseGemmV2TailOp = b.create<BlockwiseGemmV2Op>(
+          loc, vectorCTypes, ldsGpuAllocOp, ldsGpuAllocOp,
+          b.getIndexAttr(ldsBlockAOffset), b.getIndexAttr(ldsBlockBOffset),
+          mMyWaveOffsetA, mMyWaveOffsetB, arrayA, arrayB, vectorCs);
+      affixBlockwiseGemmV2Attributes(blockwiseGemmV2TailOp, op, MPerBlock,
+                                     KPerBlock, NPerBlock, b, swizzleA,
+                                     swizzleB);
+      tailResults.assign(blockwiseGemmV2TailOp->result_begin(),
+                         blockwiseGemmV2TailOp->result_end());
+    }
+    phaseTimer.stamp(b, loc);
 
     // -----
 
@@ -2365,8 +3727,48 @@ struct GridwiseGemmV2RewritePattern
       matrixCDataPerCopy = 1;
     }
 
+    // With lds_epilogue, the C tile of the block is staged in LDS, laid out
+    // with the dimension of C that is contiguous in memory innermost, so that
+    // consecutive threads write consecutive full-width vectors of it instead
+    // of the short runs the XDLOPS result layout gives each thread. This
+    // takes a second LDS buffer and two passes over the tile, so it is only
+    // used where it widens the stores, and not before a fused reduction,
+    // which reads the results back with the layout of the registers.
+    Type destType = op.c().getType().cast<MemRefType>().getElementType();
+    int64_t destBytes =
+        llvm::divideCeil(destType.getIntOrFloatBitWidth(), 8);
+    int64_t tileElems = MPerBlock * NPerBlock;
+    int64_t epilogueDataPerCopy = 0;
+    if (op->hasAttr("lds_epilogue") && !op.reduceDest() && !canOutOob &&
+        (gemmCVectorizedMatrixDim == gemmCDimM ||
+         gemmCVectorizedMatrixDim == gemmCDimN)) {
+      int64_t maxDataPerCopy = 1;
+      if (auto maxDataPerCopyAttr =
+              op->getAttrOfType<IntegerAttr>("matrix_c_max_data_per_copy"))
+        maxDataPerCopy = maxDataPerCopyAttr.getInt();
+      int64_t tileContiguousLen =
+          gemmCVectorizedMatrixDim == gemmCDimM ? MPerBlock : NPerBlock;
+      int64_t dataPerCopy = std::min<int64_t>(
+          maxDataPerCopy, std::max<int64_t>(16 / destBytes, 1));
+      while (dataPerCopy > 1 &&
+             (tileContiguousLen % dataPerCopy != 0 ||
+              tileElems % (kernelBlockSize * dataPerCopy) != 0))
+        dataPerCopy /= 2;
+      int64_t elementBytes =
+          llvm::divideCeil(elementType.getIntOrFloatBitWidth(), 8);
+      int64_t ldsBytes = ldsBlockSize * elementBytes + tileElems * destBytes;
+      if (dataPerCopy > matrixCDataPerCopy && ldsBytes <= 64 * 1024) {
+        epilogueDataPerCopy = dataPerCopy;
+        enableOutSwizzles = false;
+      }
+      LLVM_DEBUG(llvm::dbgs()
+                 << "LDS epilogue: " << dataPerCopy << " elements per copy, "
+                 << ldsBytes << " bytes of LDS, "
+                 << (epilogueDataPerCopy > 0 ? "enabled" : "disabled")
+                 << "\n");
+    }
+
     int64_t numBlksPerXdlops = (MPerXdlops * NPerXdlops) / (m * n);
-    const auto &tailResults = blockwiseGemmV2TailOp->getResults();
     int64_t wavesInKernelBlock = kernelBlockSize / waveSize;
     int64_t resultCVectorLen = vectorType.getNumElements();
     int64_t numElements = resultCVectorLen * tailResults.size();
@@ -2471,18 +3873,183 @@ struct GridwiseGemmV2RewritePattern
     // operations expecting that type before writeback and store
     // the result vectors into a allocation of registers to maintain uniformity
     // with the non-xdlops gemm. (These "stores" will be optimized out)
-    Type destType = op.c().getType().cast<MemRefType>().getElementType();
+    // Requantized results are gathered as they are, and converted below.
+    Value requantScales = op.requantScales();
+    Type mergedElementType =
+        requantScales ? vectorType.getElementType() : destType;
     MemRefType mergedType = MemRefType::get(
-        numElements, destType, {},
+        numElements, mergedElementType, {},
         /*memorySpace=*/gpu::GPUDialect::getPrivateAddressSpace());
-    VectorType castVectorType = vectorType.clone(destType);
+    VectorType castVectorType = vectorType.clone(mergedElementType);
     Value resultMerged = b.create<miopen::GpuAllocOp>(loc, mergedType);
+    // The f32 results of fp8 products are scaled by the per-tensor scale of
+    // the operands before their conversion.
+    Value fp8Scale;
+    if (auto scaleAttr = op->getAttrOfType<FloatAttr>("fp8_scale"))
+      if (!scaleAttr.getValue().isExactlyValue(1.0))
+        fp8Scale = createConstantFloatOp(
+            b, loc, vectorType, vectorType.getElementType(),
+            scaleAttr.getValueAsDouble());
     for (const auto &pair : llvm::enumerate(transformedTail)) {
-      Value cast = createTypeConversionOp(b, loc, pair.value(), castVectorType);
+      Value result = pair.value();
+      if (fp8Scale)
+        result = b.create<arith::MulFOp>(loc, result, fp8Scale);
+      Value cast = createTypeConversionOp(b, loc, result, castVectorType);
       Value offset = b.createOrFold<arith::ConstantIndexOp>(
           loc, pair.index() * resultCVectorLen);
       b.create<miopen::InBoundsStoreOp>(loc, cast, resultMerged, offset);
     }
+    if (requantScales) {
+      int64_t zeroPoint = 0;
+      if (auto attr = op->getAttrOfType<IntegerAttr>("requant_zero_point"))
+        zeroPoint = attr.getInt();
+      SmallVector<Value, 3> requantStartCoords = {bid, tid, zeroConstantOp};
+      resultMerged = requantizeResults(
+          b, loc, resultMerged, requantScales, zeroPoint, G,
+          requantStartCoords, b.getArrayAttr({correctVectorCoordsAttr}),
+          b.getArrayAttr(
+              {splitMemoryCoordsAttr, toRowsAndColsAttr, toMatrixCAttr}),
+          numElements);
+      mergedType = resultMerged.getType().cast<MemRefType>();
+    }
+
+    if (epilogueDataPerCopy > 0) {
+      bool isMContiguous = gemmCVectorizedMatrixDim == gemmCDimM;
+      auto tileMemRefType =
+          MemRefType::get({tileElems}, destType, {},
+                          gpu::GPUDialect::getWorkgroupAddressSpace());
+      Value tile = b.create<GpuAllocOp>(loc, tileMemRefType);
+
+      // Each thread stores its results at their place in the tile: the maps
+      // to matrix C, evaluated for block 0, give coordinates within the tile.
+      auto toTile = TopDownTMBuilder::below(toMatrixC, toMatrixCAttr);
+      toTile.ignore("gemmG");
+      toTile.embed("offset", 0, tileElems, {"gemmM", "gemmN"},
+                   {isMContiguous ? 1 : NPerBlock,
+                    isMContiguous ? MPerBlock : 1});
+      TransformMapAttr toTileAttr = toTile.get();
+
+      // The results of a thread are consecutive in M for group_size items.
+      int64_t tileWriteLen = isMContiguous ? group_size : 1;
+      Type tileWriteType = destType;
+      if (tileWriteLen > 1)
+        tileWriteType = VectorType::get({tileWriteLen}, destType);
+      SmallVector<Value, 3> tileWriteStartCoords = {zeroConstantOp, tid,
+                                                    zeroConstantOp};
+      auto tileWriteLoop = b.create<TransformingForOp>(
+          loc,
+          ArrayRef<ValueRange>{tileWriteStartCoords, tileWriteStartCoords},
+          ArrayRef<Attribute>{b.getArrayAttr({correctVectorCoordsAttr}),
+                              b.getArrayAttr({splitMemoryCoordsAttr,
+                                              toRowsAndColsAttr, toMatrixCAttr,
+                                              toTileAttr})},
+          ArrayRef<int64_t>{1, 1, numElements},
+          ArrayRef<int64_t>{1, 1, tileWriteLen},
+          /*forceUnroll=*/true, /*useIndexDiffs=*/useIndexDiffs);
+      {
+        OpBuilder::InsertionGuard guard(b);
+        b.setInsertionPointToStart(tileWriteLoop.getBody());
+        Value results = b.create<InBoundsLoadOp>(
+            loc, tileWriteType, resultMerged,
+            tileWriteLoop.getLowerCoords(/*domain=*/0));
+        b.create<InBoundsStoreOp>(loc, results, tile,
+                                  tileWriteLoop.getLowerCoords(/*domain=*/1));
+      }
+      b.create<LDSBarrierOp>(loc);
+
+      // Thread t then reads vectors t, t + BlockSize, ... of the tile back
+      // and writes them out.
+      int64_t numVectors = numElements / epilogueDataPerCopy;
+      TopDownTMBuilder splitTileCoords(
+          b, {"bid", "tid", "iter"},
+          {kernelGridSize, kernelBlockSize, numVectors}, loc);
+      splitTileCoords.merge(
+          {"g", "n", "m"}, {0, 1, 2}, {"bid"},
+          {kernelGridSize / GStride, GStride / MBlockWork, MBlockWork});
+      splitTileCoords.embed("offset", 3, tileElems, {"tid", "iter"},
+                            {epilogueDataPerCopy,
+                             kernelBlockSize * epilogueDataPerCopy});
+      TransformMapAttr splitTileCoordsAttr = splitTileCoords.get();
+
+      auto toTileRowsAndCols =
+          TopDownTMBuilder::below(splitTileCoords, splitTileCoordsAttr);
+      toTileRowsAndCols.passThrough({"g", "n", "m"});
+      if (isMContiguous)
+        toTileRowsAndCols.merge({"tile_n", "tile_m"}, {3, 4}, "offset",
+                                {NPerBlock, MPerBlock});
+      else
+        toTileRowsAndCols.merge({"tile_m", "tile_n"}, {3, 4}, "offset",
+                                {MPerBlock, NPerBlock});
+      TransformMapAttr toTileRowsAndColsAttr = toTileRowsAndCols.get();
+
+      auto tileToMatrixC =
+          TopDownTMBuilder::below(toTileRowsAndCols, toTileRowsAndColsAttr);
+      tileToMatrixC.passThrough({"gemmG"}, {0}, {"g"});
+      tileToMatrixC.embed("gemmM", 1, M, {"m", "tile_m"}, {MPerBlock, 1});
+      tileToMatrixC.embed("gemmN", 2, N, {"n", "tile_n"}, {NPerBlock, 1});
+      TransformMapAttr tileToMatrixCAttr = tileToMatrixC.get();
+
+      TopDownTMBuilder tileReadCoords(
+          b, {"bid", "tid", "iter"},
+          {kernelGridSize, kernelBlockSize, numVectors}, loc);
+      tileReadCoords.ignore("bid");
+      tileReadCoords.embed("offset", 0, tileElems, {"tid", "iter"},
+                           {epilogueDataPerCopy,
+                            kernelBlockSize * epilogueDataPerCopy});
+      TransformMapAttr tileReadCoordsAttr = tileReadCoords.get();
+
+      TopDownTMBuilder tileRegCoords(
+          b, {"bid", "tid", "iter"},
+          {kernelGridSize, kernelBlockSize, numVectors}, loc);
+      tileRegCoords.ignore("bid");
+      tileRegCoords.ignore("tid");
+      tileRegCoords.embed("index", 0, numElements, {"iter"},
+                          {epilogueDataPerCopy});
+      TransformMapAttr tileRegCoordsAttr = tileRegCoords.get();
+
+      ArrayAttr idToMatrixCMaps = b.getArrayAttr(
+          {splitTileCoordsAttr, toTileRowsAndColsAttr, tileToMatrixCAttr});
+      Value tensorC;
+      ArrayAttr idToTensorCMaps;
+      std::tie(tensorC, idToTensorCMaps) =
+          untransform(b, op.c(), idToMatrixCMaps);
+      auto writeOobDims = computeOobFromTransforms(b, idToTensorCMaps);
+
+      Value tileRegs = b.create<GpuAllocOp>(loc, mergedType);
+      VectorType tileReadType =
+          VectorType::get({epilogueDataPerCopy}, destType);
+      SmallVector<Value, 3> writeStartCoords = {bid, tid, zeroConstantOp};
+      auto outLoop = b.create<TransformingForOp>(
+          loc,
+          ArrayRef<ValueRange>{writeStartCoords, writeStartCoords,
+                               writeStartCoords},
+          ArrayRef<Attribute>{b.getArrayAttr({tileRegCoordsAttr}),
+                              b.getArrayAttr({tileReadCoordsAttr}),
+                              idToTensorCMaps},
+          ArrayRef<int64_t>{1, 1, numVectors}, ArrayRef<int64_t>{1, 1, 1},
+          /*forceUnroll=*/true, /*useIndexDiffs=*/useIndexDiffs);
+      {
+        OpBuilder::InsertionGuard guard(b);
+        b.setInsertionPointToStart(outLoop.getBody());
+        Value regIndex = outLoop.getLowerCoords(/*domain=*/0)[0];
+        Value vector = b.create<InBoundsLoadOp>(
+            loc, tileReadType, tile, outLoop.getLowerCoords(/*domain=*/1));
+        b.create<InBoundsStoreOp>(loc, vector, tileRegs, regIndex);
+        b.create<ThreadwiseCopyV2Op>(
+            loc, tileRegs, tensorC, b.getIndexAttr(epilogueDataPerCopy),
+            op.storeMethodAttr(), std::get<0>(writeOobDims),
+            std::get<1>(writeOobDims), regIndex,
+            outLoop.getLowerCoords(/*domain=*/2));
+      }
+
+      phaseTimer.stamp(b, loc);
+      phaseTimer.record(b, loc, tid);
+      // The next tile must not overwrite the LDS other waves still read.
+      if (persistent)
+        b.create<LDSBarrierOp>(loc);
+      b.eraseOp(op);
+      return success();
+    }
 
     ArrayAttr idToMatrixCMaps = b.getArrayAttr(
         {splitMemoryCoordsAttr, toRowsAndColsAttr, toMatrixCAttr});
@@ -2510,7 +4077,16 @@ struct GridwiseGemmV2RewritePattern
           std::get<1>(writeOobDims), outLoop.getLowerCoords(/*domain=*/0)[0],
           outLoop.getLowerCoords(/*domain=*/1));
     }
-
+    if (op.reduceDest())
+      emitFusedKBlockReduction(b, loc, op, bid, tid, idToMatrixCMaps,
+                               b.getArrayAttr({correctVectorCoordsAttr}),
+                               numElements, matrixCDataPerCopy, GStride,
+                               kernelBlockSize, waveSize, useIndexDiffs);
+
+    phaseTimer.stamp(b, loc);
+    phaseTimer.record(b, loc, tid);
+    if (persistent)
+      b.create<LDSBarrierOp>(loc);
     b.eraseOp(op);
     return success();
   }
@@ -2518,17 +4094,16 @@ struct GridwiseGemmV2RewritePattern
 
 void MIOpenGridwiseGemmToBlockwisePass::runOnOperation() {
   MLIRContext *ctx = &getContext();
-  ConversionTarget target(*ctx);
-  target.addIllegalOp<miopen::GridwiseGemmOp, miopen::GridwiseGemmV2Op>();
-  target.addLegalDialect<arith::ArithmeticDialect, miopen::MIOpenDialect,
-                         AffineDialect, vector::VectorDialect>();
+  // Simplify the views of the gemm operands first, so that the copies index
+  // them through as few dimensions as possible.
+  RewritePatternSet viewPatterns(ctx);
+  TransformOp::getCanonicalizationPatterns(viewPatterns, ctx);
+  (void)applyPatternsAndFoldGreedily(getOperation(), std::move(viewPatterns));
 
   RewritePatternSet patterns(ctx);
   patterns.add<GridwiseGemmRewritePattern, GridwiseGemmV2RewritePattern>(ctx);
-  if (failed(applyPartialConversion(getOperation(), target,
-                                    std::move(patterns)))) {
-    signalPassFailure();
-  }
+  if (failed(applyPatternsInOrder(getOperation(), std::move(patterns))))
+    return signalPassFailure();
 
   OpPassManager cleanupPasses("func.func");
   cleanupPasses.addPass(mlir::createCanonicalizerPass());
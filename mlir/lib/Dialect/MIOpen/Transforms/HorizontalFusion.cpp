@@ -0,0 +1,416 @@
+//===- HorizontalFusion.cpp -----------------------------------------------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// Horizontal fusion packs independent small convolutions, which each leave
+// most of the GPU idle, into one kernel launch:
+//
+// - miopen-horizontal-fusion merges calls to independent partitioned kernels
+//   into one call to a kernel holding all of their bodies.
+// - miopen-horizontal-dispatch, once the kernel's convolutions have become
+//   gridwise gemms, gives each gemm a contiguous range of the kernel's
+//   workgroups and guards its ops by that range.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/MIOpen/MIOpen.h"
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/MIOpen/Tuning/UtilityParams.h"
+#include "mlir/Dialect/Tosa/IR/TosaOps.h"
+#include "mlir/IR/BlockAndValueMapping.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/Matchers.h"
+#include "mlir/IR/SymbolTable.h"
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/EquivalenceClasses.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Debug.h"
+
+#include <algorithm>
+
+#define DEBUG_TYPE "miopen-horizontal-fusion"
+
+using namespace mlir;
+using namespace mlir::miopen;
+
+namespace {
+
+//===----------------------------------------------------------------------===//
+// Merging kernel calls
+//===----------------------------------------------------------------------===//
+
+struct MIOpenHorizontalFusionPass
+    : public MIOpenHorizontalFusionPassBase<MIOpenHorizontalFusionPass> {
+  void runOnOperation() override;
+
+private:
+  func::FuncOp getCandidateKernel(func::CallOp call, SymbolTable &symbols);
+  void fuseCalls(Block &block, SymbolTable &symbols);
+  func::FuncOp createFusedKernel(ArrayRef<func::CallOp> calls,
+                                 ArrayRef<func::FuncOp> kernels,
+                                 SymbolTable &symbols);
+};
+
+// The kernel called by `call`, if it is worth merging with others: its only
+// anchor is a convolution or matmul with few enough outputs to under-fill the
+// GPU on its own. Skinny matmuls are left alone, as they get a kernel of
+// their own.
+func::FuncOp
+MIOpenHorizontalFusionPass::getCandidateKernel(func::CallOp call,
+                                               SymbolTable &symbols) {
+  auto kernel = symbols.lookup<func::FuncOp>(call.getCallee());
+  if (!kernel || !kernel->hasAttr("kernel") || kernel.isExternal() ||
+      !llvm::hasSingleElement(kernel.getBody()))
+    return {};
+
+  Operation *anchor = nullptr;
+  for (Operation &op : kernel.getBody().front()) {
+    if (!isa<tosa::Conv2DOp, tosa::DepthwiseConv2DOp, tosa::MatMulOp>(op))
+      continue;
+    if (anchor)
+      return {};
+    anchor = &op;
+  }
+  if (!anchor || isa<tosa::DepthwiseConv2DOp>(anchor))
+    return {};
+
+  auto outputType = anchor->getResult(0).getType().dyn_cast<RankedTensorType>();
+  if (!outputType || !outputType.hasStaticShape() ||
+      outputType.getNumElements() > maxOutputElements)
+    return {};
+  if (isa<tosa::MatMulOp>(anchor) &&
+      std::min(outputType.getDimSize(1), outputType.getDimSize(2)) <=
+          kSkinnyGemmMaxN)
+    return {};
+  return kernel;
+}
+
+func::FuncOp MIOpenHorizontalFusionPass::createFusedKernel(
+    ArrayRef<func::CallOp> calls, ArrayRef<func::FuncOp> kernels,
+    SymbolTable &symbols) {
+  SmallVector<Type, 8> inputTypes, resultTypes;
+  for (func::FuncOp kernel : kernels) {
+    llvm::append_range(inputTypes, kernel.getFunctionType().getInputs());
+    llvm::append_range(resultTypes, kernel.getFunctionType().getResults());
+  }
+
+  OpBuilder b(&getContext());
+  Location loc = b.getFusedLoc(llvm::to_vector<4>(
+      llvm::map_range(calls, [](func::CallOp call) { return call.getLoc(); })));
+  auto fused = func::FuncOp::create(
+      loc, (kernels.front().getName() + "__hfused").str(),
+      b.getFunctionType(inputTypes, resultTypes));
+  fused->setAttr("kernel", kernels.front()->getAttr("kernel"));
+  symbols.insert(fused, Block::iterator(kernels.front()));
+
+  Block *entry = fused.addEntryBlock();
+  b.setInsertionPointToStart(entry);
+  BlockAndValueMapping map;
+  SmallVector<Value, 8> results;
+  unsigned argIndex = 0;
+  for (func::FuncOp kernel : kernels) {
+    Block &body = kernel.getBody().front();
+    for (BlockArgument arg : body.getArguments())
+      map.map(arg, entry->getArgument(argIndex++));
+    for (Operation &op : body.without_terminator())
+      b.clone(op, map);
+    for (Value result : body.getTerminator()->getOperands())
+      results.push_back(map.lookupOrDefault(result));
+  }
+  b.create<func::ReturnOp>(loc, results);
+  return fused;
+}
+
+void MIOpenHorizontalFusionPass::fuseCalls(Block &block,
+                                           SymbolTable &symbols) {
+  SmallVector<func::CallOp, 8> candidates;
+  SmallVector<func::FuncOp, 8> kernels;
+  for (auto call : block.getOps<func::CallOp>()) {
+    if (func::FuncOp kernel = getCandidateKernel(call, symbols)) {
+      candidates.push_back(call);
+      kernels.push_back(kernel);
+    }
+  }
+  if (candidates.size() < 2)
+    return;
+
+  // The candidates each value of the block, and each candidate, depends on.
+  DenseMap<Operation *, unsigned> candidateIndex;
+  for (auto &en : llvm::enumerate(candidates))
+    candidateIndex[en.value()] = en.index();
+  DenseMap<Value, llvm::BitVector> valueDeps;
+  SmallVector<llvm::BitVector, 8> callDeps(candidates.size());
+  for (Operation &op : block) {
+    llvm::BitVector deps(candidates.size());
+    op.walk([&](Operation *nested) {
+      for (Value operand : nested->getOperands()) {
+        auto it = valueDeps.find(operand);
+        if (it != valueDeps.end())
+          deps |= it->second;
+      }
+    });
+    auto it = candidateIndex.find(&op);
+    if (it != candidateIndex.end()) {
+      callDeps[it->second] = deps;
+      deps.set(it->second);
+    }
+    if (deps.any())
+      for (Value result : op.getResults())
+        valueDeps[result] = deps;
+  }
+
+  // Greedily group candidates in block order. The merged call replaces the
+  // last call of its group, so a candidate may only join a group when it
+  // does not depend on any member and no member result is used before it.
+  auto canJoin = [&](ArrayRef<unsigned> group, unsigned index) {
+    if (group.size() >= maxKernels)
+      return false;
+    Operation *call = candidates[index];
+    for (unsigned member : group) {
+      if (callDeps[index].test(member))
+        return false;
+      for (Operation *user : candidates[member]->getUsers()) {
+        Operation *ancestor = block.findAncestorOpInBlock(*user);
+        if (ancestor && ancestor->isBeforeInBlock(call))
+          return false;
+      }
+    }
+    return true;
+  };
+  SmallVector<SmallVector<unsigned, 4>, 4> groups;
+  for (unsigned i = 0, e = candidates.size(); i < e; ++i) {
+    auto it = llvm::find_if(groups, [&](ArrayRef<unsigned> group) {
+      return canJoin(group, i);
+    });
+    if (it != groups.end())
+      it->push_back(i);
+    else
+      groups.push_back({i});
+  }
+
+  for (ArrayRef<unsigned> group : groups) {
+    if (group.size() < 2)
+      continue;
+    SmallVector<func::CallOp, 4> calls;
+    SmallVector<func::FuncOp, 4> callees;
+    SmallVector<Value, 8> operands;
+    for (unsigned member : group) {
+      calls.push_back(candidates[member]);
+      callees.push_back(kernels[member]);
+      llvm::append_range(operands, candidates[member].getOperands());
+    }
+    func::FuncOp fused = createFusedKernel(calls, callees, symbols);
+    LLVM_DEBUG(llvm::dbgs() << "Merging " << calls.size() << " kernels into "
+                            << fused.getName() << "\n");
+
+    OpBuilder b(calls.back());
+    auto fusedCall = b.create<func::CallOp>(fused.getLoc(), fused, operands);
+    unsigned resultIndex = 0;
+    for (func::CallOp call : calls) {
+      call->replaceAllUsesWith(fusedCall.getResults().slice(
+          resultIndex, call.getNumResults()));
+      resultIndex += call.getNumResults();
+      call.erase();
+    }
+  }
+}
+
+void MIOpenHorizontalFusionPass::runOnOperation() {
+  ModuleOp mod = getOperation();
+  if (maxKernels < 2)
+    return;
+  SymbolTable symbols(mod);
+
+  SmallVector<func::FuncOp, 8> kernels;
+  SmallVector<Block *, 8> blocks;
+  for (auto func : mod.getOps<func::FuncOp>()) {
+    if (func->hasAttr("kernel"))
+      kernels.push_back(func);
+    else
+      func.walk([&](Block *block) { blocks.push_back(block); });
+  }
+  for (Block *block : blocks)
+    fuseCalls(*block, symbols);
+
+  // Drop the kernels whose every call was merged.
+  for (func::FuncOp kernel : kernels)
+    if (SymbolTable::symbolKnownUseEmpty(kernel, mod))
+      kernel.erase();
+}
+
+//===----------------------------------------------------------------------===//
+// Dispatching workgroups
+//===----------------------------------------------------------------------===//
+
+struct MIOpenHorizontalDispatchPass
+    : public MIOpenHorizontalDispatchPassBase<MIOpenHorizontalDispatchPass> {
+  void runOnOperation() override;
+};
+
+// Ops of the kernel body connected through the values they define or use,
+// each with the gridwise gemms nested in them.
+struct OpGroup {
+  SmallVector<Operation *, 8> ops;
+  SmallVector<Operation *, 1> gemms;
+};
+
+static int64_t getIntAttr(Operation *op, StringRef name, int64_t dflt = 1) {
+  if (auto attr = op->getAttrOfType<IntegerAttr>(name))
+    return attr.getInt();
+  return dflt;
+}
+
+// Number of workgroups `gemm` is tiled over, as computed by the tuning
+// parameters.
+static int64_t getGemmGridSize(Operation *gemm) {
+  ArrayRef<int64_t> aShape =
+      gemm->getOperand(0).getType().cast<MemRefType>().getShape();
+  ArrayRef<int64_t> bShape =
+      gemm->getOperand(1).getType().cast<MemRefType>().getShape();
+  return aShape[0] * (aShape[2] / getIntAttr(gemm, "m_per_block")) *
+         (bShape[2] / getIntAttr(gemm, "n_per_block"));
+}
+
+// Upper bound of the LDS the lowering of `gemm` allocates for its A and B
+// tiles.
+static int64_t getGemmLdsBytes(Operation *gemm) {
+  Type elementType =
+      gemm->getOperand(0).getType().cast<MemRefType>().getElementType();
+  int64_t elementBytes = std::max<int64_t>(
+      elementType.getIntOrFloatBitWidth() / 8, sizeof(float));
+  return (getIntAttr(gemm, "m_per_block") + getIntAttr(gemm, "n_per_block")) *
+         getIntAttr(gemm, "k_per_block") * getIntAttr(gemm, "kpack") *
+         getIntAttr(gemm, "lds_stages") * elementBytes;
+}
+
+void MIOpenHorizontalDispatchPass::runOnOperation() {
+  func::FuncOp func = getOperation();
+  if (func.isExternal() || !llvm::hasSingleElement(func.getBody()))
+    return;
+  Block &body = func.getBody().front();
+
+  // Partition the body into groups of connected ops. Constants may have been
+  // shared between the merged kernels, so they do not connect anything.
+  llvm::EquivalenceClasses<Operation *> classes;
+  DenseMap<Value, Operation *> argUsers;
+  for (Operation &op : body.without_terminator()) {
+    classes.insert(&op);
+    op.walk([&](Operation *nested) {
+      for (Value operand : nested->getOperands()) {
+        if (auto arg = operand.dyn_cast<BlockArgument>()) {
+          if (arg.getOwner() != &body)
+            continue;
+          auto inserted = argUsers.try_emplace(arg, &op);
+          classes.unionSets(inserted.first->second, &op);
+          continue;
+        }
+        Operation *def = operand.getDefiningOp();
+        if (def && def->getBlock() == &body && !matchPattern(def, m_Constant()))
+          classes.unionSets(def, &op);
+      }
+    });
+  }
+
+  llvm::MapVector<Operation *, OpGroup> groups;
+  for (Operation &op : body.without_terminator()) {
+    if (matchPattern(&op, m_Constant()))
+      continue;
+    OpGroup &group = groups[classes.getLeaderValue(&op)];
+    group.ops.push_back(&op);
+    op.walk([&](Operation *nested) {
+      if (isa<GridwiseGemmOp, GridwiseGemmV2Op>(nested))
+        group.gemms.push_back(nested);
+    });
+  }
+
+  SmallVector<OpGroup *, 4> gemmGroups;
+  for (auto &entry : groups)
+    if (!entry.second.gemms.empty())
+      gemmGroups.push_back(&entry.second);
+  // Kernels with a single data flow, including those that use several gemms
+  // together, are left alone.
+  if (gemmGroups.size() < 2)
+    return;
+
+  int64_t blockSize = getIntAttr(func, "block_size", 0);
+  int64_t ldsBytes = 0;
+  for (OpGroup *group : gemmGroups) {
+    if (group->gemms.size() != 1) {
+      func.emitOpError("cannot dispatch the workgroups of a fused kernel "
+                       "among groups of several gemms");
+      return signalPassFailure();
+    }
+    Operation *gemm = group->gemms.front();
+    if (getIntAttr(gemm, "block_size", 0) != blockSize) {
+      gemm->emitOpError("block size differs from the one of its fused kernel");
+      return signalPassFailure();
+    }
+    ldsBytes += getGemmLdsBytes(gemm);
+  }
+  if (ldsBytes > 64 * 1024) {
+    func.emitOpError("horizontally fused gemms need ")
+        << ldsBytes << " bytes of LDS";
+    return signalPassFailure();
+  }
+
+  // Guard each group by its range of workgroups. The guards go at the end of
+  // the body, after every constant they may use.
+  OpBuilder b = OpBuilder::atBlockBegin(&body);
+  Location loc = func.getLoc();
+  Value bid = b.create<WorkgroupIdOp>(loc, b.getIndexType());
+  b.setInsertionPoint(body.getTerminator());
+  int64_t offset = 0;
+  for (OpGroup *group : gemmGroups) {
+    Operation *gemm = group->gemms.front();
+    int64_t gridSize = getGemmGridSize(gemm);
+    gemm->setAttr("grid_size", b.getI32IntegerAttr(gridSize));
+    gemm->setAttr("workgroup_offset", b.getI32IntegerAttr(offset));
+
+    Value begin = b.create<arith::ConstantIndexOp>(loc, offset);
+    Value end = b.create<arith::ConstantIndexOp>(loc, offset + gridSize);
+    Value inRange = b.create<arith::AndIOp>(
+        loc,
+        b.create<arith::CmpIOp>(loc, arith::CmpIPredicate::uge, bid, begin),
+        b.create<arith::CmpIOp>(loc, arith::CmpIPredicate::ult, bid, end));
+    auto guard = b.create<scf::IfOp>(loc, TypeRange{}, inRange,
+                                     /*withElseRegion=*/false);
+    Operation *yield = guard.thenBlock()->getTerminator();
+    for (Operation *op : group->ops)
+      op->moveBefore(yield);
+    offset += gridSize;
+  }
+  func->setAttr("grid_size", b.getI32IntegerAttr(offset));
+}
+
+} // end anonymous namespace
+
+//===- Passes -------------------------------------------------------------===//
+//
+
+std::unique_ptr<Pass> mlir::miopen::createMIOpenHorizontalFusionPass() {
+  return std::make_unique<MIOpenHorizontalFusionPass>();
+}
+
+std::unique_ptr<Pass> mlir::miopen::createMIOpenHorizontalDispatchPass() {
+  return std::make_unique<MIOpenHorizontalDispatchPass>();
+}
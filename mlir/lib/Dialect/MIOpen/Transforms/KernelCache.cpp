@@ -0,0 +1,325 @@
+//===- KernelCache.cpp ----------------------------------------------------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// This file implements the compiled kernel cache and the passes that consult
+// it around the backend pipeline.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/GPU/Transforms/Passes.h"
+#include "mlir/Dialect/MIOpen/KernelCache.h"
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/MIOpen/utility/BinaryCompression.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/OwningOpRef.h"
+#include "mlir/IR/SymbolTable.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/VCSRevision.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdlib>
+
+#define DEBUG_TYPE "miopen-kernel-cache"
+
+using namespace mlir;
+using namespace mlir::miopen;
+
+// Attributes carried by a gpu.module between the lookup and the store pass.
+static constexpr llvm::StringLiteral kCacheKeyAttr = "miopen.kernel_cache_key";
+static constexpr llvm::StringLiteral kCacheHitAttr = "miopen.kernel_cache_hit";
+// Set when a cached binary names its kernel differently from the module.
+static constexpr llvm::StringLiteral kKernelSymbolAttr = "miopen.kernel_symbol";
+
+//===----------------------------------------------------------------------===//
+// KernelCache
+//===----------------------------------------------------------------------===//
+
+KernelCache &KernelCache::get() {
+  static KernelCache cache;
+  return cache;
+}
+
+std::string KernelCache::makeKey(gpu::GPUModuleOp gpuMod,
+                                 llvm::StringRef target) {
+  // Names and the link back to the host func do not affect the generated
+  // code, so print a copy without them.
+  OwningOpRef<gpu::GPUModuleOp> copy(gpuMod.clone());
+  SymbolTable::setSymbolName(*copy, "kernel_module");
+  for (auto func : copy->getOps<gpu::GPUFuncOp>()) {
+    if (!func.isKernel())
+      continue;
+    SymbolTable::setSymbolName(func, "kernel");
+    func->removeAttr("original_func");
+    func->removeAttr("tuning_source");
+    func->removeAttr("conv_solver");
+  }
+
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  copy->print(os, OpPrintingFlags().printGenericOpForm());
+  os.flush();
+
+  llvm::SHA1 hasher;
+  hasher.update(text);
+  hasher.update(llvm::StringRef("\0", 1));
+  hasher.update(target);
+  // Binaries of another compiler may differ, and persisted ones outlive it.
+  hasher.update(llvm::StringRef("\0", 1));
+  hasher.update(LLVM_VERSION_STRING);
+#ifdef LLVM_REVISION
+  hasher.update(llvm::StringRef("\0", 1));
+  hasher.update(LLVM_REVISION);
+#endif
+  return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+static std::string getCacheDirectory(llvm::StringRef directory) {
+  if (!directory.empty())
+    return directory.str();
+  if (const char *env = std::getenv("MIIR_KERNEL_CACHE_DIR"))
+    return env;
+  return "";
+}
+
+// A cache file holds the kernel symbol on its first line followed by the
+// binary, compressed as compressBinary stores it.
+static llvm::SmallString<128> getCachePath(llvm::StringRef directory,
+                                           llvm::StringRef key) {
+  llvm::SmallString<128> path(directory);
+  llvm::sys::path::append(path, key + ".hsaco");
+  return path;
+}
+
+llvm::Optional<KernelCache::Entry>
+KernelCache::lookup(llvm::StringRef key, llvm::StringRef directory) {
+  {
+    llvm::sys::SmartScopedReader<true> lock(mutex);
+    auto it = entries.find(key);
+    if (it != entries.end())
+      return it->second;
+  }
+
+  std::string dir = getCacheDirectory(directory);
+  if (dir.empty())
+    return llvm::None;
+  auto bufferOrErr = llvm::MemoryBuffer::getFile(getCachePath(dir, key),
+                                                 /*IsText=*/false);
+  if (!bufferOrErr)
+    return llvm::None;
+  llvm::StringRef contents = (*bufferOrErr)->getBuffer();
+  size_t newline = contents.find('\n');
+  if (newline == llvm::StringRef::npos || newline == 0) {
+    LLVM_DEBUG(llvm::dbgs() << "Ignoring corrupt kernel cache entry " << key
+                            << "\n");
+    return llvm::None;
+  }
+  llvm::Optional<std::string> binary =
+      decompressBinary(contents.drop_front(newline + 1));
+  if (!binary) {
+    LLVM_DEBUG(llvm::dbgs() << "Ignoring corrupt kernel cache entry " << key
+                            << "\n");
+    return llvm::None;
+  }
+  Entry entry{std::move(*binary), contents.take_front(newline).str()};
+
+  llvm::sys::SmartScopedWriter<true> lock(mutex);
+  remember(key, entry);
+  return entry;
+}
+
+void KernelCache::insert(llvm::StringRef key, Entry entry,
+                         llvm::StringRef directory) {
+  std::string dir = getCacheDirectory(directory);
+  if (!dir.empty()) {
+    std::string contents = entry.symbol + "\n" + compressBinary(entry.binary);
+    llvm::SmallString<128> path = getCachePath(dir, key);
+    // Write through a temporary so that concurrent processes never observe a
+    // partial entry. Failing to persist only costs a recompilation later.
+    if (llvm::sys::fs::create_directories(dir) ||
+        llvm::writeFileAtomically(path + ".tmp-%%%%%%%%", path, contents))
+      LLVM_DEBUG(llvm::dbgs() << "Could not persist kernel cache entry "
+                              << path << "\n");
+  }
+
+  llvm::sys::SmartScopedWriter<true> lock(mutex);
+  remember(key, std::move(entry));
+}
+
+void KernelCache::remember(llvm::StringRef key, Entry entry) {
+  size_t entryBytes = entry.binary.size() + entry.symbol.size();
+  if (entryBytes > kMaxBytes ||
+      !entries.try_emplace(key, std::move(entry)).second)
+    return;
+  order.push_back(key.str());
+  bytes += entryBytes;
+  while (bytes > kMaxBytes) {
+    auto it = entries.find(order.front());
+    bytes -= it->second.binary.size() + it->second.symbol.size();
+    entries.erase(it);
+    order.pop_front();
+  }
+}
+
+size_t KernelCache::size() const {
+  llvm::sys::SmartScopedReader<true> lock(mutex);
+  return entries.size();
+}
+
+//===----------------------------------------------------------------------===//
+// Passes
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+// The kernel of a gpu.module produced by -convert-miopen-to-gpu.
+template <typename FuncT> static FuncT getKernelFunc(gpu::GPUModuleOp gpuMod) {
+  FuncT kernel;
+  for (auto func : gpuMod.getOps<FuncT>()) {
+    if (!func->hasAttr(gpu::GPUDialect::getKernelFuncAttrName()))
+      continue;
+    if (kernel)
+      return {};
+    kernel = func;
+  }
+  return kernel;
+}
+
+// Kernels of the __miopen module are reported to the host through the
+// targets attribute, which can carry a symbol name that differs from the
+// func's. Everywhere else the caller launches the kernel by its own name.
+// Only the name of the parent is read, which no pass on a gpu.module changes.
+static bool canRenameKernel(gpu::GPUModuleOp gpuMod) {
+  auto parent = gpuMod->getParentOfType<ModuleOp>();
+  return parent && parent.getName() == MIOpenDialect::kKernelModuleName;
+}
+
+// Reduce the body of `func` to a bare return, keeping its signature and
+// workgroup attributions.
+static void stubOut(gpu::GPUFuncOp func) {
+  Region &body = func.getBody();
+  body.dropAllReferences();
+  for (Block &block :
+       llvm::make_early_inc_range(llvm::drop_begin(body.getBlocks())))
+    block.erase();
+  Block &entry = body.front();
+  entry.clear();
+  OpBuilder b = OpBuilder::atBlockEnd(&entry);
+  b.create<gpu::ReturnOp>(func.getLoc());
+}
+
+struct MIOpenKernelCacheLookupPass
+    : public MIOpenKernelCacheLookupPassBase<MIOpenKernelCacheLookupPass> {
+  MIOpenKernelCacheLookupPass() = default;
+  MIOpenKernelCacheLookupPass(StringRef target, StringRef directory) {
+    this->target = target.str();
+    this->directory = directory.str();
+  }
+
+  void runOnOperation() override {
+    gpu::GPUModuleOp gpuMod = getOperation();
+    auto kernel = getKernelFunc<gpu::GPUFuncOp>(gpuMod);
+    if (!kernel)
+      return;
+
+    Builder b(&getContext());
+    std::string key = KernelCache::makeKey(gpuMod, target);
+    gpuMod->setAttr(kCacheKeyAttr, b.getStringAttr(key));
+
+    llvm::Optional<KernelCache::Entry> entry =
+        KernelCache::get().lookup(key, directory);
+    if (!entry)
+      return;
+    if (entry->symbol != kernel.getName() && !canRenameKernel(gpuMod))
+      return;
+
+    LLVM_DEBUG(llvm::dbgs() << "Kernel cache hit for " << kernel.getName()
+                            << " (" << key << ")\n");
+    gpuMod->setAttr(kCacheHitAttr, b.getUnitAttr());
+    stubOut(kernel);
+  }
+};
+
+struct MIOpenKernelCacheStorePass
+    : public MIOpenKernelCacheStorePassBase<MIOpenKernelCacheStorePass> {
+  MIOpenKernelCacheStorePass() = default;
+  MIOpenKernelCacheStorePass(StringRef target, StringRef directory) {
+    this->target = target.str();
+    this->directory = directory.str();
+  }
+
+  void runOnOperation() override {
+    gpu::GPUModuleOp gpuMod = getOperation();
+    auto keyAttr = gpuMod->getAttrOfType<StringAttr>(kCacheKeyAttr);
+    if (!keyAttr)
+      return;
+    gpuMod->removeAttr(kCacheKeyAttr);
+
+    KernelCache &cache = KernelCache::get();
+    Builder b(&getContext());
+    StringAttr binaryName =
+        b.getStringAttr(gpu::getDefaultGpuBinaryAnnotation());
+    if (gpuMod->removeAttr(kCacheHitAttr)) {
+      llvm::Optional<KernelCache::Entry> entry =
+          cache.lookup(keyAttr.getValue(), directory);
+      if (!entry) {
+        gpuMod.emitOpError("kernel cache entry disappeared");
+        return signalPassFailure();
+      }
+      gpuMod->setAttr(binaryName, b.getStringAttr(entry->binary));
+      auto kernel = getKernelFunc<LLVM::LLVMFuncOp>(gpuMod);
+      if (kernel && entry->symbol != kernel.getName())
+        gpuMod->setAttr(kKernelSymbolAttr, b.getStringAttr(entry->symbol));
+      return;
+    }
+
+    auto binary = gpuMod->getAttrOfType<StringAttr>(binaryName);
+    auto kernel = getKernelFunc<LLVM::LLVMFuncOp>(gpuMod);
+    if (binary && kernel)
+      cache.insert(keyAttr.getValue(),
+                   {binary.getValue().str(), kernel.getName().str()},
+                   directory);
+  }
+};
+
+} // end anonymous namespace
+
+//===- Passes -------------------------------------------------------------===//
+//
+
+std::unique_ptr<Pass>
+mlir::miopen::createMIOpenKernelCacheLookupPass(StringRef target,
+                                                StringRef directory) {
+  return std::make_unique<MIOpenKernelCacheLookupPass>(target, directory);
+}
+
+std::unique_ptr<Pass>
+mlir::miopen::createMIOpenKernelCacheStorePass(StringRef target,
+                                               StringRef directory) {
+  return std::make_unique<MIOpenKernelCacheStorePass>(target, directory);
+}
@@ -0,0 +1,73 @@
+//===- KernelResources.cpp ------------------------------------------------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// This pass records the resources of the kernels of serialized gpu.modules on
+// their functions.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/GPU/Transforms/Passes.h"
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/MIOpen/utility/KernelResources.h"
+
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "miopen-kernel-resources"
+
+using namespace mlir;
+
+namespace {
+struct MIOpenKernelResourcesPass
+    : public MIOpenKernelResourcesPassBase<MIOpenKernelResourcesPass> {
+  void runOnOperation() override {
+    gpu::GPUModuleOp gpuMod = getOperation();
+    auto binary = gpuMod->getAttrOfType<StringAttr>(
+        gpu::getDefaultGpuBinaryAnnotation());
+    auto arch = gpuMod->getAttrOfType<StringAttr>("arch");
+    if (!binary || !arch)
+      return;
+    // A binary shared from the kernel cache names its kernel differently.
+    auto symbol = gpuMod->getAttrOfType<StringAttr>("miopen.kernel_symbol");
+
+    Builder b(&getContext());
+    gpuMod.walk([&](LLVM::LLVMFuncOp func) {
+      auto blockSize = func->getAttrOfType<IntegerAttr>("block_size");
+      if (!blockSize)
+        return;
+      StringRef name = symbol ? symbol.getValue() : func.getName();
+      FailureOr<miopen::KernelResources> resources =
+          miopen::readKernelResources(binary.getValue(), name,
+                                      arch.getValue(), blockSize.getInt());
+      // Binaries without metadata are not worth failing the pipeline over.
+      if (failed(resources)) {
+        LLVM_DEBUG(llvm::dbgs() << "No resource metadata for " << name << "\n");
+        return;
+      }
+      func->setAttr(miopen::kKernelResourcesAttrName, resources->getAttr(b));
+    });
+  }
+};
+} // end anonymous namespace
+
+//===- Passes -------------------------------------------------------------===//
+//
+
+std::unique_ptr<Pass> mlir::miopen::createMIOpenKernelResourcesPass() {
+  return std::make_unique<MIOpenKernelResourcesPass>();
+}
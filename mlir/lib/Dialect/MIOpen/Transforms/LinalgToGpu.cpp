@@ -0,0 +1,739 @@
+//===- LinalgToGpu.cpp - Map linalg-only kernels onto the GPU -------------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// The kernels tosa-partition makes of elementwise ops, transposes and
+// reductions with no convolution or gemm to anchor them hold nothing but
+// linalg.generic ops, which no tuning gives a launch size. This pass spreads
+// the parallel loops of each generic over the workitems of the grid:
+//
+// - each workitem computes a vector of consecutive points of the innermost
+//   parallel loop at a time, loading and storing the operands indexed by that
+//   loop in their last dimension with miopen.buffer_load and
+//   miopen.buffer_store of up to 128 bits, and looping over the reduction
+//   loops, if any, itself;
+// - the workitems go through the vectors in a grid-stride loop, so that the
+//   grid can stay a few workgroups per CU however large the tensors;
+// - the block size is the smallest power of 2 from a wave up to
+//   kElementwiseBlockSize that covers the vectors of the largest generic.
+//
+// Kernels that only copy a tensor into a transpose of it whose innermost
+// dimension comes from elsewhere in the input would read or write it an
+// element at a time. Those get a workgroup per square tile instead, which it
+// reads into LDS with vector loads along the input's innermost dimensions and
+// writes back with vector stores along the output's. The permutation is
+// reduced to a batch of 2D transposes by merging, with transform maps, the
+// dimensions that stay next to each other.
+//
+// Without a grid-wide barrier a generic can't wait for another, so kernels
+// whose generics use what an earlier one writes, or that hold other ops, keep
+// the loops of convert-linalg-to-affine-loops.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/Linalg/IR/Linalg.h"
+#include "mlir/Dialect/MIOpen/MIOpen.h"
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/MIOpen/TransformMapBuilder.h"
+#include "mlir/Dialect/MIOpen/Tuning/UtilityParams.h"
+#include "mlir/Dialect/MIOpen/utility/builderUtils.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/Dialect/Vector/IR/VectorOps.h"
+#include "mlir/IR/BlockAndValueMapping.h"
+#include "mlir/IR/TypeUtilities.h"
+#include "mlir/Interfaces/ViewLikeInterface.h"
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+
+#define DEBUG_TYPE "miopen-linalg-to-gpu"
+
+using namespace mlir;
+using namespace mlir::arith;
+using namespace mlir::miopen;
+
+namespace {
+struct MIOpenLinalgToGpuPass
+    : public MIOpenLinalgToGpuPassBase<MIOpenLinalgToGpuPass> {
+  void runOnOperation() override;
+};
+
+/// How a generic indexes one of its operands by its innermost parallel loop.
+enum class Access {
+  Vector,    // in the last dimension
+  Broadcast, // not at all
+  Gather     // in another dimension
+};
+} // end anonymous namespace
+
+static Access getAccess(AffineMap map, unsigned dim) {
+  if (!map.isFunctionOfDim(dim))
+    return Access::Broadcast;
+  if (map.getResult(map.getNumResults() - 1) ==
+      getAffineDimExpr(dim, map.getContext()))
+    return Access::Vector;
+  return Access::Gather;
+}
+
+/// The memref `value` is a view of.
+static Value getBuffer(Value value) {
+  while (auto view = value.getDefiningOp<ViewLikeOpInterface>())
+    value = view.getViewSource();
+  return value;
+}
+
+/// Whether `generic` indexes statically shaped memrefs of the types buffer
+/// loads and stores take with projected permutations, and has a parallel
+/// loop.
+static bool isSupported(linalg::GenericOp generic) {
+  if (!generic.hasBufferSemantics() || generic.getNumParallelLoops() == 0)
+    return false;
+  for (OpOperand *operand : generic.getInputAndOutputOperands()) {
+    auto type = operand->get().getType().dyn_cast<MemRefType>();
+    if (!type || !type.hasStaticShape() || type.getRank() == 0 ||
+        !type.getLayout().isIdentity())
+      return false;
+    Type elementType = type.getElementType();
+    if (!elementType.isa<Float32Type, Float16Type, BFloat16Type>() &&
+        !elementType.isInteger(8) && !elementType.isInteger(32))
+      return false;
+    if (!generic.getTiedIndexingMap(operand).isProjectedPermutation(
+            /*allowZeroInResults=*/true))
+      return false;
+  }
+  // Workitems write their own output elements, which they mustn't read
+  // elsewhere.
+  for (OpOperand *output : generic.getOutputOperands()) {
+    AffineMap map = generic.getTiedIndexingMap(output);
+    for (auto &en : llvm::enumerate(generic.iterator_types()))
+      if (isParallelIterator(en.value()) && !map.isFunctionOfDim(en.index()))
+        return false;
+  }
+  for (OpOperand *input : generic.getInputOperands())
+    for (OpOperand *output : generic.getOutputOperands())
+      if (getBuffer(input->get()) == getBuffer(output->get()))
+        return false;
+  return true;
+}
+
+/// Whether `len` elements of `elementType` can be loaded, or stored if
+/// `store`, as a vector.
+static bool isLegalVector(Type elementType, int64_t len, bool store) {
+  if (store && elementType.isInteger(8))
+    return len == 4;
+  return len * elementType.getIntOrFloatBitWidth() <= 128;
+}
+
+/// The number of consecutive points of the loop `dim`, of `size` iterations,
+/// that a workitem computes at a time: the longest vector every operand
+/// indexed by the loop in its last dimension can be loaded and stored as.
+/// Outputs indexed by it elsewhere can't be stored as vectors.
+static int64_t getVectorLength(linalg::GenericOp generic, unsigned dim,
+                               int64_t size) {
+  for (int64_t len = kElementwiseMaxVectorLen; len > 1; len /= 2) {
+    if (size % len != 0)
+      continue;
+    bool legal = llvm::all_of(
+        generic.getInputAndOutputOperands(), [&](OpOperand *operand) {
+          bool isOutput = generic.isOutputTensor(operand);
+          switch (getAccess(generic.getTiedIndexingMap(operand), dim)) {
+          case Access::Broadcast:
+            return true;
+          case Access::Gather:
+            return !isOutput;
+          case Access::Vector:
+            return isLegalVector(getElementTypeOrSelf(operand->get()), len,
+                                 isOutput);
+          }
+          llvm_unreachable("unknown access");
+        });
+    if (legal)
+      return len;
+  }
+  return 1;
+}
+
+namespace {
+/// Emits the body of the grid-stride loop of a generic, at the loop
+/// coordinates `coords`, the first of a vector of `vectorLen` points along
+/// the innermost parallel loop `innerDim`.
+struct GenericLowering {
+  linalg::GenericOp generic;
+  unsigned innerDim;
+  int64_t vectorLen;
+
+  SmallVector<Value, 4> getIndices(OpBuilder &b, Location loc, AffineMap map,
+                                   ArrayRef<Value> coords) const;
+  Value load(OpBuilder &b, Location loc, OpOperand *operand,
+             ArrayRef<Value> coords) const;
+  void store(OpBuilder &b, Location loc, OpOperand *operand, Value value,
+             ArrayRef<Value> coords) const;
+  SmallVector<Value, 2> applyBody(OpBuilder &b, Location loc,
+                                  ArrayRef<Value> operands,
+                                  ArrayRef<Value> coords) const;
+};
+} // end anonymous namespace
+
+SmallVector<Value, 4>
+GenericLowering::getIndices(OpBuilder &b, Location loc, AffineMap map,
+                            ArrayRef<Value> coords) const {
+  SmallVector<Value, 4> indices;
+  for (AffineExpr expr : map.getResults()) {
+    if (auto dimExpr = expr.dyn_cast<AffineDimExpr>())
+      indices.push_back(coords[dimExpr.getPosition()]);
+    else
+      indices.push_back(b.createOrFold<ConstantIndexOp>(loc, 0));
+  }
+  return indices;
+}
+
+/// Loads `operand` for the vector at `coords`: as a vector if the vector
+/// runs along its last dimension, as a scalar all its lanes share if it
+/// doesn't index it, and an element at a time otherwise.
+Value GenericLowering::load(OpBuilder &b, Location loc, OpOperand *operand,
+                            ArrayRef<Value> coords) const {
+  Value buffer = operand->get();
+  Type elementType = getElementTypeOrSelf(buffer);
+  AffineMap map = generic.getTiedIndexingMap(operand);
+  ArrayAttr noOobDims = b.getI32ArrayAttr({});
+  Access access = getAccess(map, innerDim);
+  if (vectorLen == 1 || access == Access::Broadcast)
+    return b.create<BufferLoadOp>(loc, elementType, buffer, noOobDims,
+                                  noOobDims, getIndices(b, loc, map, coords));
+  auto vectorType = VectorType::get({vectorLen}, elementType);
+  if (access == Access::Vector)
+    return b.create<BufferLoadOp>(loc, vectorType, buffer, noOobDims,
+                                  noOobDims, getIndices(b, loc, map, coords));
+
+  Value result = createZeroConstantOp(b, loc, vectorType);
+  SmallVector<Value, 6> laneCoords(coords.begin(), coords.end());
+  for (int64_t i = 0; i < vectorLen; ++i) {
+    Value pos = b.createOrFold<ConstantIndexOp>(loc, i);
+    laneCoords[innerDim] = b.createOrFold<AddIOp>(loc, coords[innerDim], pos);
+    Value element =
+        b.create<BufferLoadOp>(loc, elementType, buffer, noOobDims, noOobDims,
+                               getIndices(b, loc, map, laneCoords));
+    result = b.create<vector::InsertElementOp>(loc, element, result, pos);
+  }
+  return result;
+}
+
+void GenericLowering::store(OpBuilder &b, Location loc, OpOperand *operand,
+                            Value value, ArrayRef<Value> coords) const {
+  ArrayAttr noOobDims = b.getI32ArrayAttr({});
+  b.create<BufferStoreOp>(
+      loc, value, operand->get(), noOobDims, noOobDims,
+      getIndices(b, loc, generic.getTiedIndexingMap(operand), coords),
+      StoreMethod::Set);
+}
+
+/// Applies the scalar body of the generic to each lane of `operands`, one
+/// per block argument, of which scalars go to every lane and nulls are
+/// unused. Returns the values it yields, as vectors of the lanes.
+SmallVector<Value, 2> GenericLowering::applyBody(OpBuilder &b, Location loc,
+                                                 ArrayRef<Value> operands,
+                                                 ArrayRef<Value> coords) const {
+  Block &body = generic.getRegion().front();
+  Operation *yield = body.getTerminator();
+  SmallVector<Value, 2> results;
+  for (Value yielded : yield->getOperands()) {
+    Type type = yielded.getType();
+    if (vectorLen > 1)
+      type = VectorType::get({vectorLen}, type);
+    results.push_back(createZeroConstantOp(b, loc, type));
+  }
+
+  for (int64_t i = 0; i < vectorLen; ++i) {
+    Value pos = b.createOrFold<ConstantIndexOp>(loc, i);
+    BlockAndValueMapping map;
+    for (auto pair : llvm::zip(operands, body.getArguments())) {
+      Value value = std::get<0>(pair);
+      if (!value)
+        continue;
+      if (value.getType().isa<VectorType>())
+        value = b.create<vector::ExtractElementOp>(loc, value, pos);
+      map.map(std::get<1>(pair), value);
+    }
+    for (Operation &op : body.without_terminator()) {
+      if (auto index = dyn_cast<linalg::IndexOp>(op)) {
+        Value coord = coords[index.dim()];
+        if (index.dim() == innerDim && i > 0)
+          coord = b.create<AddIOp>(loc, coord, pos);
+        map.map(index.getResult(), coord);
+        continue;
+      }
+      b.clone(op, map);
+    }
+    for (auto &en : llvm::enumerate(yield->getOperands())) {
+      Value computed = map.lookupOrDefault(en.value());
+      results[en.index()] =
+          vectorLen > 1 ? b.create<vector::InsertElementOp>(
+                              loc, computed, results[en.index()], pos)
+                        : computed;
+    }
+  }
+  return results;
+}
+
+/// Replaces `generic` by a grid-stride loop of the workitems `threadId` out
+/// of `numThreads` over its parallel points, `vectorLen` at a time.
+static void lowerGeneric(OpBuilder &b, linalg::GenericOp generic,
+                         int64_t vectorLen, Value threadId, Value numThreads) {
+  Location loc = generic.getLoc();
+  SmallVector<int64_t, 4> ranges = generic.getStaticLoopRanges();
+  SmallVector<unsigned, 4> parallelDims, reductionDims;
+  for (auto &en : llvm::enumerate(generic.iterator_types())) {
+    if (isParallelIterator(en.value()))
+      parallelDims.push_back(en.index());
+    else
+      reductionDims.push_back(en.index());
+  }
+  int64_t numPoints = 1;
+  for (unsigned dim : parallelDims)
+    numPoints *= ranges[dim];
+  GenericLowering lowering{generic, parallelDims.back(), vectorLen};
+
+  Value zero = b.createOrFold<ConstantIndexOp>(loc, 0);
+  auto loop = b.create<scf::ForOp>(
+      loc, threadId,
+      b.createOrFold<ConstantIndexOp>(loc, numPoints / vectorLen),
+      numThreads);
+  OpBuilder::InsertionGuard guard(b);
+  b.setInsertionPointToStart(loop.getBody());
+
+  // The first point of the vector, the innermost parallel loop fastest.
+  SmallVector<Value, 6> coords(ranges.size(), zero);
+  Value linear = b.create<MulIOp>(
+      loc, loop.getInductionVar(),
+      b.createOrFold<ConstantIndexOp>(loc, vectorLen));
+  for (unsigned dim : llvm::reverse(parallelDims)) {
+    Value size = b.createOrFold<ConstantIndexOp>(loc, ranges[dim]);
+    coords[dim] = b.create<RemUIOp>(loc, linear, size);
+    linear = b.create<DivUIOp>(loc, linear, size);
+  }
+
+  // Outputs start from what they hold only if the body reads them.
+  SmallVector<Value, 2> outputs;
+  for (OpOperand *output : generic.getOutputOperands()) {
+    bool read = !reductionDims.empty() ||
+                generic.payloadUsesValueFromOperand(output);
+    outputs.push_back(read ? lowering.load(b, loc, output, coords) : Value());
+  }
+  auto computePoint = [&](OpBuilder &nb, Location nloc,
+                          ArrayRef<Value> pointCoords,
+                          ArrayRef<Value> outputValues) {
+    SmallVector<Value, 6> operands;
+    for (OpOperand *input : generic.getInputOperands())
+      operands.push_back(lowering.load(nb, nloc, input, pointCoords));
+    llvm::append_range(operands, outputValues);
+    return lowering.applyBody(nb, nloc, operands, pointCoords);
+  };
+
+  SmallVector<Value, 2> results;
+  if (reductionDims.empty()) {
+    results = computePoint(b, loc, coords, outputs);
+  } else {
+    // The reduction loops run in each workitem, carrying the outputs.
+    SmallVector<Value, 4> lbs, ubs, steps;
+    for (unsigned dim : reductionDims) {
+      lbs.push_back(zero);
+      ubs.push_back(b.createOrFold<ConstantIndexOp>(loc, ranges[dim]));
+      steps.push_back(b.createOrFold<ConstantIndexOp>(loc, 1));
+    }
+    scf::LoopNest nest = scf::buildLoopNest(
+        b, loc, lbs, ubs, steps, outputs,
+        [&](OpBuilder &nb, Location nloc, ValueRange ivs,
+            ValueRange iterArgs) -> scf::ValueVector {
+          SmallVector<Value, 6> pointCoords(coords);
+          for (auto pair : llvm::zip(reductionDims, ivs))
+            pointCoords[std::get<0>(pair)] = std::get<1>(pair);
+          SmallVector<Value, 2> iterValues(iterArgs.begin(), iterArgs.end());
+          SmallVector<Value, 2> computed =
+              computePoint(nb, nloc, pointCoords, iterValues);
+          return scf::ValueVector(computed.begin(), computed.end());
+        });
+    results.assign(nest.getResults().begin(), nest.getResults().end());
+  }
+
+  for (auto pair : llvm::zip(generic.getOutputOperands(), results))
+    lowering.store(b, loc, std::get<0>(pair), std::get<1>(pair), coords);
+}
+
+namespace {
+/// The loops of a transposing copy, split into the tiles of a batch of
+/// [rows, cols] inputs written as [cols, rows] outputs. Each of batch, rows
+/// and cols merges loops consecutive in both operands; cols are innermost in
+/// the input and rows in the output.
+struct TransposeGroups {
+  SmallVector<unsigned, 4> batch, rows, cols;
+};
+} // end anonymous namespace
+
+/// Whether `generic` only copies its input into its output of the same
+/// element type, both indexed by permutations.
+static bool isTransposeCopy(linalg::GenericOp generic) {
+  if (generic.getNumInputs() != 1 || generic.getNumOutputs() != 1 ||
+      generic.getNumReductionLoops() != 0)
+    return false;
+  Block &body = generic.getRegion().front();
+  if (!llvm::hasSingleElement(body) ||
+      body.getTerminator()->getOperand(0) != body.getArgument(0))
+    return false;
+  OpOperand *input = generic.getInputOperands()[0];
+  OpOperand *output = generic.getOutputOperands()[0];
+  return getElementTypeOrSelf(input->get()) ==
+             getElementTypeOrSelf(output->get()) &&
+         generic.getTiedIndexingMap(input).isPermutation() &&
+         generic.getTiedIndexingMap(output).isPermutation();
+}
+
+/// Groups the loops of the transposing copy `generic`. Fails when the
+/// innermost dimensions of its operands index the same loops, so that the
+/// grid-stride loops read and write contiguously already, or when rows or
+/// cols are too short to fill a tile.
+static bool getTransposeGroups(linalg::GenericOp generic,
+                               TransposeGroups &groups) {
+  AffineMap inMap = generic.getTiedIndexingMap(generic.getInputOperands()[0]);
+  AffineMap outMap =
+      generic.getTiedIndexingMap(generic.getOutputOperands()[0]);
+  SmallVector<int64_t, 4> ranges = generic.getStaticLoopRanges();
+  unsigned rank = inMap.getNumResults();
+  SmallVector<unsigned, 6> outPos(rank);
+  for (unsigned i = 0; i < rank; ++i)
+    outPos[outMap.getDimPosition(i)] = i;
+
+  // Runs of loops consecutive in the input that stay so in the output.
+  SmallVector<SmallVector<unsigned, 4>, 4> runs;
+  for (unsigned i = 0; i < rank; ++i) {
+    unsigned dim = inMap.getDimPosition(i);
+    if (runs.empty() || outPos[dim] != outPos[runs.back().back()] + 1)
+      runs.emplace_back();
+    runs.back().push_back(dim);
+  }
+  unsigned outInner = outMap.getDimPosition(rank - 1);
+  if (llvm::is_contained(runs.back(), outInner))
+    return false;
+
+  groups = TransposeGroups();
+  groups.cols = runs.back();
+  for (const SmallVector<unsigned, 4> &run : llvm::drop_end(runs)) {
+    if (llvm::is_contained(run, outInner))
+      groups.rows = run;
+    else
+      llvm::append_range(groups.batch, run);
+  }
+  llvm::sort(groups.batch);
+  auto getSize = [&](ArrayRef<unsigned> dims) {
+    int64_t size = 1;
+    for (unsigned dim : dims)
+      size *= ranges[dim];
+    return size;
+  };
+  return getSize(groups.rows) >= kTransposeMinTileExtent &&
+         getSize(groups.cols) >= kTransposeMinTileExtent;
+}
+
+/// The view of the operand of a transposing copy indexed by `map` as
+/// [batch, rows, cols], each merging the dimensions of its loops.
+static ArrayAttr getTransposeView(OpBuilder &b, Location loc, AffineMap map,
+                                  ArrayRef<int64_t> ranges,
+                                  const TransposeGroups &groups) {
+  unsigned rank = map.getNumResults();
+  SmallVector<unsigned, 6> memrefDims(rank);
+  SmallVector<std::string, 6> names;
+  for (unsigned i = 0; i < rank; ++i) {
+    memrefDims[map.getDimPosition(i)] = i;
+    names.push_back("dim" + std::to_string(i));
+  }
+
+  ArrayRef<unsigned> groupDims[] = {groups.batch, groups.rows, groups.cols};
+  StringRef groupNames[] = {"batch", "rows", "cols"};
+  SmallVector<int64_t, 3> groupSizes;
+  for (ArrayRef<unsigned> dims : groupDims) {
+    int64_t size = 1;
+    for (unsigned dim : dims)
+      size *= ranges[dim];
+    groupSizes.push_back(size);
+  }
+
+  TopDownTMBuilder view(b, groupNames, groupSizes, loc);
+  for (auto pair : llvm::zip(groupNames, groupDims)) {
+    StringRef name = std::get<0>(pair);
+    // Rows and cols are runs ordered alike in both operands, and the batch
+    // merges its loops in their order, so both views agree.
+    SmallVector<unsigned, 4> dims(std::get<1>(pair).begin(),
+                                  std::get<1>(pair).end());
+    llvm::sort(dims, [&](unsigned x, unsigned y) {
+      return name == "batch" ? x < y : memrefDims[x] < memrefDims[y];
+    });
+    if (dims.empty()) {
+      view.ignore(name);
+      continue;
+    }
+    SmallVector<StringRef, 4> lowerNames;
+    SmallVector<uint32_t, 4> lowerDims;
+    SmallVector<int64_t, 4> lowerSizes;
+    for (unsigned dim : dims) {
+      lowerNames.push_back(names[memrefDims[dim]]);
+      lowerDims.push_back(memrefDims[dim]);
+      lowerSizes.push_back(ranges[dim]);
+    }
+    if (dims.size() == 1)
+      view.passThrough(lowerNames, lowerDims, {name});
+    else
+      view.merge(lowerNames, lowerDims, name, lowerSizes);
+  }
+  return b.getArrayAttr({view.get()});
+}
+
+/// The longest vector of at most the elements a workitem holds of a tile
+/// that divides `size` and can be loaded, or stored if `store`.
+static int64_t getTileVectorLength(Type elementType, int64_t size,
+                                   bool store) {
+  int64_t maxLen =
+      kTransposeTileSize * kTransposeTileSize / kTransposeBlockSize;
+  for (int64_t len = maxLen; len > 1; len /= 2)
+    if (size % len == 0 && isLegalVector(elementType, len, store))
+      return len;
+  return 1;
+}
+
+/// Replaces the transposing copy `generic` by a kernel with a workgroup per
+/// kTransposeTileSize square tile of a [rows, cols] matrix of the batch. The
+/// workgroup reads its tile along the cols, contiguous in the input, into
+/// LDS, and writes it along the rows, contiguous in the output. The LDS rows
+/// are padded by an element so that the workitems reading a column of the
+/// tile hit different banks. Returns the number of workgroups.
+static int64_t lowerTranspose(OpBuilder &b, linalg::GenericOp generic,
+                              const TransposeGroups &groups) {
+  Location loc = generic.getLoc();
+  OpOperand *input = generic.getInputOperands()[0];
+  OpOperand *output = generic.getOutputOperands()[0];
+  Type elementType = getElementTypeOrSelf(input->get());
+  SmallVector<int64_t, 4> ranges = generic.getStaticLoopRanges();
+  ArrayAttr inView = getTransposeView(
+      b, loc, generic.getTiedIndexingMap(input), ranges, groups);
+  ArrayAttr outView = getTransposeView(
+      b, loc, generic.getTiedIndexingMap(output), ranges, groups);
+  auto viewMap = inView[0].cast<TransformMapAttr>();
+  ArrayRef<int64_t> sizes = viewMap.getUpperBounds();
+  int64_t numRows = sizes[1], numCols = sizes[2];
+  int64_t tile = kTransposeTileSize;
+  int64_t rowTiles = llvm::divideCeil(numRows, tile);
+  int64_t colTiles = llvm::divideCeil(numCols, tile);
+  int64_t loadLen = getTileVectorLength(elementType, numCols, false);
+  int64_t storeLen = getTileVectorLength(elementType, numRows, true);
+
+  Value bid = b.create<WorkgroupIdOp>(loc, b.getIndexType());
+  Value tid = b.create<WorkitemIdOp>(loc, b.getIndexType());
+  auto constant = [&](int64_t value) -> Value {
+    return b.createOrFold<ConstantIndexOp>(loc, value);
+  };
+  Value colTile = b.create<RemUIOp>(loc, bid, constant(colTiles));
+  Value rest = b.create<DivUIOp>(loc, bid, constant(colTiles));
+  Value rowTile = b.create<RemUIOp>(loc, rest, constant(rowTiles));
+  Value batch = b.create<DivUIOp>(loc, rest, constant(rowTiles));
+  Value rowBase = b.create<MulIOp>(loc, rowTile, constant(tile));
+  Value colBase = b.create<MulIOp>(loc, colTile, constant(tile));
+  Value lds = b.create<GpuAllocOp>(
+      loc, MemRefType::get({tile, tile + 1}, elementType, {},
+                           gpu::GPUDialect::getWorkgroupAddressSpace()));
+  ArrayAttr noOob = b.getI32ArrayAttr({});
+
+  // Calls `body` with the tile coordinates of the vectors of `len` elements
+  // along `vectorDim` that the workitem reads or writes, in the matrix.
+  auto forEachVector = [&](int64_t len, unsigned vectorDim,
+                           function_ref<void(Value, Value, Value, Value)>
+                               body) {
+    int64_t perLine = tile / len;
+    Value inLine = b.create<MulIOp>(
+        loc, b.create<RemUIOp>(loc, tid, constant(perLine)), constant(len));
+    Value firstLine = b.create<DivUIOp>(loc, tid, constant(perLine));
+    auto loop = b.create<scf::ForOp>(loc, firstLine, constant(tile),
+                                     constant(kTransposeBlockSize / perLine));
+    OpBuilder::InsertionGuard guard(b);
+    b.setInsertionPointToStart(loop.getBody());
+    Value row = vectorDim == 1 ? inLine : loop.getInductionVar();
+    Value col = vectorDim == 1 ? loop.getInductionVar() : inLine;
+    Value matrixRow = b.create<AddIOp>(loc, rowBase, row);
+    Value matrixCol = b.create<AddIOp>(loc, colBase, col);
+    Value inBounds = b.create<AndIOp>(
+        loc,
+        b.create<CmpIOp>(loc, CmpIPredicate::ult, matrixRow,
+                         constant(numRows)),
+        b.create<CmpIOp>(loc, CmpIPredicate::ult, matrixCol,
+                         constant(numCols)));
+    auto ifOp = b.create<scf::IfOp>(loc, TypeRange{}, inBounds,
+                                    /*withElseRegion=*/false);
+    b.setInsertionPointToStart(ifOp.thenBlock());
+    body(row, col, matrixRow, matrixCol);
+  };
+
+  // Read the tile along the cols.
+  forEachVector(loadLen, 2, [&](Value row, Value col, Value matrixRow,
+                                Value matrixCol) {
+    Type loadType = loadLen == 1 ? elementType
+                                 : VectorType::get({loadLen}, elementType);
+    auto loop = b.create<TransformingForOp>(
+        loc, ArrayRef<ValueRange>{{batch, matrixRow, matrixCol}},
+        ArrayRef<Attribute>{inView}, ArrayRef<int64_t>{1, 1, 1},
+        /*strides=*/llvm::None, /*forceUnroll=*/true, /*useIndexDiffs=*/true,
+        createZeroConstantOp(b, loc, loadType));
+    {
+      OpBuilder::InsertionGuard guard(b);
+      b.setInsertionPointToStart(loop.getBody());
+      Value loaded =
+          b.create<BufferLoadOp>(loc, loadType, input->get(), noOob, noOob,
+                                 loop.getLowerCoords(/*domain=*/0));
+      b.create<miopen::YieldOp>(loc, loaded);
+    }
+    Value loaded = loop.getResults()[0];
+    for (int64_t i = 0; i < loadLen; ++i) {
+      Value element = loaded;
+      if (loadLen > 1)
+        element =
+            b.create<vector::ExtractElementOp>(loc, loaded, constant(i));
+      Value ldsCol = b.createOrFold<AddIOp>(loc, col, constant(i));
+      b.create<memref::StoreOp>(loc, element, lds, ValueRange{row, ldsCol});
+    }
+  });
+  b.create<LDSBarrierOp>(loc);
+
+  // Write it along the rows.
+  forEachVector(storeLen, 1, [&](Value row, Value col, Value matrixRow,
+                                 Value matrixCol) {
+    Type storeType = storeLen == 1 ? elementType
+                                   : VectorType::get({storeLen}, elementType);
+    Value gathered = createZeroConstantOp(b, loc, storeType);
+    for (int64_t i = 0; i < storeLen; ++i) {
+      Value ldsRow = b.createOrFold<AddIOp>(loc, row, constant(i));
+      Value element =
+          b.create<memref::LoadOp>(loc, lds, ValueRange{ldsRow, col});
+      gathered = storeLen == 1 ? element
+                               : b.create<vector::InsertElementOp>(
+                                     loc, element, gathered, constant(i));
+    }
+    auto loop = b.create<TransformingForOp>(
+        loc, ArrayRef<ValueRange>{{batch, matrixRow, matrixCol}},
+        ArrayRef<Attribute>{outView}, ArrayRef<int64_t>{1, 1, 1},
+        /*strides=*/llvm::None, /*forceUnroll=*/true, /*useIndexDiffs=*/true);
+    OpBuilder::InsertionGuard guard(b);
+    b.setInsertionPointToStart(loop.getBody());
+    b.create<BufferStoreOp>(loc, gathered, output->get(), noOob, noOob,
+                            loop.getLowerCoords(/*domain=*/0),
+                            StoreMethod::Set);
+  });
+  return sizes[0] * rowTiles * colTiles;
+}
+
+void MIOpenLinalgToGpuPass::runOnOperation() {
+  func::FuncOp func = getOperation();
+  // Kernels with convolutions or gemms got their launch size from tuning.
+  if (!func->hasAttr("kernel") || func->hasAttr("block_size") ||
+      !llvm::hasSingleElement(func.getBody()))
+    return;
+
+  Block &body = func.getBody().front();
+  SmallVector<linalg::GenericOp, 4> generics;
+  llvm::SmallDenseSet<Value, 4> written;
+  for (Operation &op : body.without_terminator()) {
+    if (isa<ConstantOp, ViewLikeOpInterface>(op))
+      continue;
+    auto generic = dyn_cast<linalg::GenericOp>(op);
+    if (!generic || !isSupported(generic) ||
+        llvm::any_of(generic->getOperands(), [&](Value operand) {
+          return written.contains(getBuffer(operand));
+        }))
+      return;
+    for (Value output : generic.outputs())
+      written.insert(getBuffer(output));
+    generics.push_back(generic);
+  }
+  if (generics.empty())
+    return;
+
+  TransposeGroups groups;
+  if (generics.size() == 1 && isTransposeCopy(generics[0]) &&
+      getTransposeGroups(generics[0], groups)) {
+    linalg::GenericOp generic = generics[0];
+    OpBuilder b(generic);
+    int64_t gridSize = lowerTranspose(b, generic, groups);
+    generic.erase();
+    func->setAttr("block_size", b.getI32IntegerAttr(kTransposeBlockSize));
+    func->setAttr("grid_size", b.getI32IntegerAttr(gridSize));
+    return;
+  }
+
+  SmallVector<int64_t, 4> vectorLens;
+  int64_t maxVectors = 0;
+  for (linalg::GenericOp generic : generics) {
+    SmallVector<int64_t, 4> ranges = generic.getStaticLoopRanges();
+    int64_t numPoints = 1;
+    unsigned innerDim = 0;
+    for (auto &en : llvm::enumerate(generic.iterator_types())) {
+      if (!isParallelIterator(en.value()))
+        continue;
+      numPoints *= ranges[en.index()];
+      innerDim = en.index();
+    }
+    int64_t vectorLen = getVectorLength(generic, innerDim, ranges[innerDim]);
+    vectorLens.push_back(vectorLen);
+    maxVectors = std::max(maxVectors, numPoints / vectorLen);
+  }
+
+  int64_t blockSize = llvm::PowerOf2Ceil(maxVectors);
+  blockSize = std::max<int64_t>(blockSize, kElementwiseMinBlockSize);
+  blockSize = std::min<int64_t>(blockSize, kElementwiseBlockSize);
+  int64_t gridSize = llvm::divideCeil(maxVectors, blockSize);
+  if (auto numCu = func->getAttrOfType<IntegerAttr>("num_cu"))
+    gridSize = std::min<int64_t>(
+        gridSize, numCu.getInt() * kElementwiseMaxBlocksPerCu);
+  LLVM_DEBUG(llvm::dbgs() << "Launching " << func.getName() << " as "
+                          << gridSize << " blocks of " << blockSize << "\n");
+
+  Location loc = func.getLoc();
+  OpBuilder b = OpBuilder::atBlockBegin(&body);
+  Value workgroupId = b.create<WorkgroupIdOp>(loc, b.getIndexType());
+  Value workitemId = b.create<WorkitemIdOp>(loc, b.getIndexType());
+  Value threadId = b.create<AddIOp>(
+      loc,
+      b.create<MulIOp>(loc, workgroupId,
+                       b.create<ConstantIndexOp>(loc, blockSize)),
+      workitemId);
+  Value numThreads = b.create<ConstantIndexOp>(loc, blockSize * gridSize);
+  for (auto pair : llvm::zip(generics, vectorLens)) {
+    linalg::GenericOp generic = std::get<0>(pair);
+    b.setInsertionPoint(generic);
+    lowerGeneric(b, generic, std::get<1>(pair), threadId, numThreads);
+    generic.erase();
+  }
+  func->setAttr("block_size", b.getI32IntegerAttr(blockSize));
+  func->setAttr("grid_size", b.getI32IntegerAttr(gridSize));
+}
+
+//===- Passes -------------------------------------------------------------===//
+//
+
+std::unique_ptr<Pass> mlir::miopen::createMIOpenLinalgToGpuPass() {
+  return std::make_unique<MIOpenLinalgToGpuPass>();
+}
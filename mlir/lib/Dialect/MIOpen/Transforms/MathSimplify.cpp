@@ -0,0 +1,86 @@
+//===- MathSimplify.cpp - Strength-reduce elementwise math ---------------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// This pass replaces the math.powf ops with constant exponents that
+// TosaToLinalg leaves in elementwise ops by cheaper ops. TOSA has no square
+// root, so the square roots of MIGraphX graphs reach it as powers of 0.5,
+// which become a single math.sqrt again instead of a log and an exp. The
+// exponents are only constants of the linalg.generic bodies after
+// elementwise fusion has folded the splat operands into them.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/Math/Transforms/Passes.h"
+#include "mlir/IR/PatternMatch.h"
+#include "mlir/Transforms/GreedyPatternRewriteDriver.h"
+
+using namespace mlir;
+
+namespace {
+struct MIOpenMathSimplifyPass
+    : public MIOpenMathSimplifyPassBase<MIOpenMathSimplifyPass> {
+  MIOpenMathSimplifyPass() = default;
+  MIOpenMathSimplifyPass(bool fastMath) { this->fastMath = fastMath; }
+  void runOnOperation() override;
+};
+
+//===- ApproximateSqrt ----------------------------------------------------===//
+// With fast math, sqrt(x) = x * rsqrt(x), the hardware reciprocal square
+// root being an approximation that skips the scaling and refinement of an
+// exact f32 square root. Zeros are selected through, as rsqrt(0) is
+// infinite; infinities are assumed not to occur.
+//===----------------------------------------------------------------------===//
+struct ApproximateSqrt : public OpRewritePattern<math::SqrtOp> {
+  using OpRewritePattern<math::SqrtOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(math::SqrtOp op,
+                                PatternRewriter &rewriter) const override {
+    Type type = op.getType();
+    if (!getElementTypeOrSelf(type).isF32())
+      return failure();
+    Location loc = op.getLoc();
+    Value x = op.getOperand();
+    Value rsqrt = rewriter.create<math::RsqrtOp>(loc, x);
+    Value product = rewriter.create<arith::MulFOp>(loc, x, rsqrt);
+    Value zero =
+        rewriter.create<arith::ConstantOp>(loc, rewriter.getZeroAttr(type));
+    Value isZero = rewriter.create<arith::CmpFOp>(
+        loc, arith::CmpFPredicate::OEQ, x, zero);
+    rewriter.replaceOpWithNewOp<arith::SelectOp>(op, isZero, x, product);
+    return success();
+  }
+};
+} // end anonymous namespace
+
+void MIOpenMathSimplifyPass::runOnOperation() {
+  MLIRContext *ctx = &getContext();
+  RewritePatternSet patterns(ctx);
+  populateMathAlgebraicSimplificationPatterns(patterns);
+  if (fastMath)
+    patterns.add<ApproximateSqrt>(ctx);
+  if (failed(applyPatternsAndFoldGreedily(getOperation(), std::move(patterns))))
+    signalPassFailure();
+}
+
+std::unique_ptr<Pass>
+mlir::miopen::createMIOpenMathSimplifyPass(bool fastMath) {
+  return std::make_unique<MIOpenMathSimplifyPass>(fastMath);
+}
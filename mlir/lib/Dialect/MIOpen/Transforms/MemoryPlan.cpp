@@ -0,0 +1,229 @@
+//===- MemoryPlan.cpp - Share one arena among kernel intermediates --------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// This pass places the intermediate buffers a host function passes between
+// kernels in one arena. Buffers share an offset when every kernel using one
+// is known to have completed before any kernel using the other starts, going
+// by the async tokens and awaits -miopen-async-launch inserted.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/IR/Builders.h"
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+
+#define DEBUG_TYPE "miopen-memory-plan"
+
+using namespace mlir;
+
+namespace {
+// Offsets within the arena keep the alignment of device allocations.
+constexpr int64_t kArenaAlignment = 256;
+
+/// The kernel launches and calls of a block, and for each of them, which of
+/// the others are known to have completed by the time it starts.
+class CompletionOrder {
+public:
+  explicit CompletionOrder(Block &block);
+
+  bool contains(Operation *op) const { return indices.count(op); }
+
+  /// Whether `before` has completed when `op` starts.
+  bool completesBefore(Operation *before, Operation *op) const {
+    return done.lookup(op).test(indices.lookup(before));
+  }
+
+private:
+  DenseMap<Operation *, unsigned> indices;
+  DenseMap<Operation *, llvm::BitVector> done;
+};
+
+CompletionOrder::CompletionOrder(Block &block) {
+  for (Operation &op : block)
+    if (isa<async::LaunchOp, func::CallOp>(op))
+      indices.try_emplace(&op, indices.size());
+  unsigned numOps = indices.size();
+
+  // What has completed once a token is ready, and once the host got here.
+  DenseMap<Value, llvm::BitVector> tokenDone;
+  llvm::BitVector hostDone(numOps);
+  for (Operation &op : block) {
+    if (auto launch = dyn_cast<async::LaunchOp>(op)) {
+      llvm::BitVector before = hostDone;
+      for (Value dependency : launch.dependencies())
+        before |= tokenDone.lookup(dependency);
+      llvm::BitVector after = before;
+      after.set(indices.lookup(launch));
+      tokenDone[launch.token()] = std::move(after);
+      done[launch] = std::move(before);
+    } else if (auto await = dyn_cast<async::AwaitOp>(op)) {
+      auto it = tokenDone.find(await.operand());
+      if (it != tokenDone.end())
+        hostDone |= it->second;
+    } else if (auto call = dyn_cast<func::CallOp>(op)) {
+      // Calls run synchronously, after the awaits inserted before them.
+      done[call] = hostDone;
+      hostDone.set(indices.lookup(call));
+    }
+  }
+}
+
+/// An intermediate buffer to place in the arena.
+struct PlannedBuffer {
+  memref::AllocOp alloc;
+  int64_t size;
+  /// The launches and calls reading or writing the buffer.
+  SmallVector<Operation *, 4> users;
+  SmallVector<memref::DeallocOp, 1> deallocs;
+};
+
+/// A range of the arena and the users of all the buffers placed in it.
+struct Slot {
+  int64_t offset;
+  int64_t size;
+  SmallVector<Operation *, 8> users;
+};
+
+struct MIOpenMemoryPlanPass
+    : public MIOpenMemoryPlanPassBase<MIOpenMemoryPlanPass> {
+  void runOnOperation() override;
+};
+} // end anonymous namespace
+
+/// Returns the buffer `alloc` makes if only kernels of its block, known to
+/// `order`, use it and it has a static size.
+static Optional<PlannedBuffer> getPlannedBuffer(memref::AllocOp alloc,
+                                                const CompletionOrder &order) {
+  MemRefType type = alloc.getType();
+  if (!type.hasStaticShape() || !type.getLayout().isIdentity() ||
+      type.getMemorySpaceAsInt() != 0 || !alloc.symbolOperands().empty())
+    return llvm::None;
+  unsigned bitWidth = type.getElementTypeBitWidth();
+  if (bitWidth % 8 != 0)
+    return llvm::None;
+  if (alloc.alignment() && *alloc.alignment() > kArenaAlignment)
+    return llvm::None;
+
+  PlannedBuffer buffer;
+  buffer.alloc = alloc;
+  buffer.size = llvm::alignTo(type.getNumElements() * (bitWidth / 8),
+                              kArenaAlignment);
+  for (Operation *user : alloc->getUsers()) {
+    if (user->getBlock() != alloc->getBlock())
+      return llvm::None;
+    if (auto dealloc = dyn_cast<memref::DeallocOp>(user)) {
+      buffer.deallocs.push_back(dealloc);
+      continue;
+    }
+    if (!order.contains(user))
+      return llvm::None;
+    if (!llvm::is_contained(buffer.users, user))
+      buffer.users.push_back(user);
+  }
+  if (buffer.users.empty())
+    return llvm::None;
+  return buffer;
+}
+
+void MIOpenMemoryPlanPass::runOnOperation() {
+  func::FuncOp func = getOperation();
+  if (func->hasAttr("kernel") || func.isExternal())
+    return;
+  Block &block = func.getBody().front();
+  CompletionOrder order(block);
+
+  SmallVector<PlannedBuffer> buffers;
+  for (auto alloc : block.getOps<memref::AllocOp>())
+    if (Optional<PlannedBuffer> buffer = getPlannedBuffer(alloc, order))
+      buffers.push_back(std::move(*buffer));
+  if (buffers.size() < 2)
+    return;
+
+  // Place buffers in program order, each in the smallest range already in
+  // the arena whose previous buffers are done with by the time any of its
+  // users start, or else at the end of the arena.
+  SmallVector<Slot> slots;
+  SmallVector<int64_t> offsets;
+  int64_t arenaSize = 0;
+  int64_t unplannedSize = 0;
+  for (const PlannedBuffer &buffer : buffers) {
+    Slot *best = nullptr;
+    for (Slot &slot : slots) {
+      if (slot.size < buffer.size || (best && best->size <= slot.size))
+        continue;
+      bool isFree = llvm::all_of(slot.users, [&](Operation *previous) {
+        return llvm::all_of(buffer.users, [&](Operation *user) {
+          return order.completesBefore(previous, user);
+        });
+      });
+      if (isFree)
+        best = &slot;
+    }
+    if (!best) {
+      slots.push_back({arenaSize, buffer.size, {}});
+      best = &slots.back();
+      arenaSize += buffer.size;
+    }
+    offsets.push_back(best->offset);
+    best->users.append(buffer.users.begin(), buffer.users.end());
+    unplannedSize += buffer.size;
+  }
+  LLVM_DEBUG(llvm::dbgs() << "Memory plan for " << func.getName() << ": "
+                          << buffers.size() << " buffers, " << arenaSize
+                          << " bytes instead of " << unplannedSize << "\n");
+  if (arenaSize == unplannedSize)
+    return;
+
+  Location loc = func.getLoc();
+  OpBuilder b(&block, block.begin());
+  Value arena = b.create<memref::AllocOp>(
+      loc, MemRefType::get({arenaSize}, b.getIntegerType(8)),
+      b.getI64IntegerAttr(kArenaAlignment));
+  bool freeArena = false;
+  for (auto pair : llvm::zip(buffers, offsets)) {
+    PlannedBuffer &buffer = std::get<0>(pair);
+    b.setInsertionPoint(buffer.alloc);
+    Location allocLoc = buffer.alloc.getLoc();
+    Value offset = b.create<arith::ConstantIndexOp>(allocLoc, std::get<1>(pair));
+    Value view = b.create<memref::ViewOp>(allocLoc, buffer.alloc.getType(),
+                                          arena, offset, ValueRange{});
+    for (memref::DeallocOp dealloc : buffer.deallocs)
+      dealloc.erase();
+    freeArena |= !buffer.deallocs.empty();
+    buffer.alloc.replaceAllUsesWith(view);
+    buffer.alloc.erase();
+  }
+  // Buffers that were freed leave the arena to be freed on the way out.
+  if (freeArena) {
+    b.setInsertionPoint(block.getTerminator());
+    b.create<memref::DeallocOp>(loc, arena);
+  }
+}
+
+//===- Passes -------------------------------------------------------------===//
+//
+
+std::unique_ptr<Pass> mlir::miopen::createMIOpenMemoryPlanPass() {
+  return std::make_unique<MIOpenMemoryPlanPass>();
+}
@@ -0,0 +1,163 @@
+//===- MixedPrecision.cpp - Run TOSA gemms in lower precision ------------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// This pass rewrites the f32 convolutions and matmuls of TOSA graphs, such as
+// the ones MIGraphX graphs lower to, into f16 or bf16 ones between casts,
+// leaving everything else, reductions and softmax included, in f32. The casts
+// of results back to f32 are elementwise ops that -tosa-partition fuses into
+// the kernels as the rest of their epilogues, and the casts of their inputs
+// cancel out with them or join the kernels producing them, so that no
+// conversion kernel is left once constant weights are folded.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/Tosa/IR/TosaOps.h"
+#include "mlir/IR/PatternMatch.h"
+#include "mlir/Transforms/GreedyPatternRewriteDriver.h"
+
+using namespace mlir;
+
+namespace {
+struct MIOpenMixedPrecisionPass
+    : public MIOpenMixedPrecisionPassBase<MIOpenMixedPrecisionPass> {
+  MIOpenMixedPrecisionPass() = default;
+  MIOpenMixedPrecisionPass(StringRef precision) {
+    this->precision = precision.str();
+  }
+  void runOnOperation() override;
+};
+} // end anonymous namespace
+
+/// Returns `value` with its elements cast to `elemType`.
+static Value castElements(PatternRewriter &rewriter, Location loc, Value value,
+                          Type elemType) {
+  auto type = value.getType().cast<ShapedType>();
+  if (type.getElementType() == elemType)
+    return value;
+  return rewriter.create<tosa::CastOp>(loc, type.clone(elemType), value);
+}
+
+/// Tell if all of `values` are f32 tensors.
+static bool allF32(ValueRange values) {
+  return llvm::all_of(values, [](Value value) {
+    auto type = value.getType().dyn_cast<ShapedType>();
+    return type && type.getElementType().isF32();
+  });
+}
+
+namespace {
+//===- LowerConvPrecision -------------------------------------------------===//
+//===----------------------------------------------------------------------===//
+struct LowerConvPrecision : public OpRewritePattern<tosa::Conv2DOp> {
+  LowerConvPrecision(MLIRContext *ctx, Type elemType)
+      : OpRewritePattern<tosa::Conv2DOp>(ctx), elemType(elemType) {}
+
+  LogicalResult matchAndRewrite(tosa::Conv2DOp op,
+                                PatternRewriter &rewriter) const override {
+    if (!allF32(op->getOperands()) || !allF32(op->getResults()))
+      return failure();
+    Location loc = op->getLoc();
+    SmallVector<Value, 3> operands;
+    for (Value operand : op->getOperands())
+      operands.push_back(castElements(rewriter, loc, operand, elemType));
+    auto conv = rewriter.create<tosa::Conv2DOp>(
+        loc, op.getType().cast<ShapedType>().clone(elemType), operands,
+        op->getAttrs());
+    rewriter.replaceOp(op, castElements(rewriter, loc, conv.output(),
+                                        rewriter.getF32Type()));
+    return success();
+  }
+
+  Type elemType;
+};
+
+//===- LowerMatMulPrecision -----------------------------------------------===//
+//===----------------------------------------------------------------------===//
+struct LowerMatMulPrecision : public OpRewritePattern<tosa::MatMulOp> {
+  LowerMatMulPrecision(MLIRContext *ctx, Type elemType)
+      : OpRewritePattern<tosa::MatMulOp>(ctx), elemType(elemType) {}
+
+  LogicalResult matchAndRewrite(tosa::MatMulOp op,
+                                PatternRewriter &rewriter) const override {
+    if (!allF32(op->getOperands()) || !allF32(op->getResults()))
+      return failure();
+    Location loc = op->getLoc();
+    Value a = castElements(rewriter, loc, op.a(), elemType);
+    Value b = castElements(rewriter, loc, op.b(), elemType);
+    auto matmul = rewriter.create<tosa::MatMulOp>(
+        loc, op.getType().cast<ShapedType>().clone(elemType),
+        ValueRange{a, b}, op->getAttrs());
+    rewriter.replaceOp(op, castElements(rewriter, loc, matmul.c(),
+                                        rewriter.getF32Type()));
+    return success();
+  }
+
+  Type elemType;
+};
+
+//===- CastRoundTrip ------------------------------------------------------===//
+// cast(cast(x : t -> f32) : f32 -> t) -> x, which is exact for the f16 and
+// bf16 values the patterns above widen.
+//===----------------------------------------------------------------------===//
+struct CastRoundTrip : public OpRewritePattern<tosa::CastOp> {
+  using OpRewritePattern<tosa::CastOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(tosa::CastOp op,
+                                PatternRewriter &rewriter) const override {
+    auto widened = op.input().getDefiningOp<tosa::CastOp>();
+    if (!widened || widened.input().getType() != op.getType())
+      return failure();
+    Type narrow = op.getType().cast<ShapedType>().getElementType();
+    Type wide = widened.getType().cast<ShapedType>().getElementType();
+    if (!narrow.isa<FloatType>() || !wide.isa<FloatType>() ||
+        narrow.getIntOrFloatBitWidth() > wide.getIntOrFloatBitWidth())
+      return failure();
+    rewriter.replaceOp(op, widened.input());
+    return success();
+  }
+};
+} // end anonymous namespace
+
+void MIOpenMixedPrecisionPass::runOnOperation() {
+  MLIRContext *ctx = &getContext();
+  Type elemType;
+  if (precision == "f16") {
+    elemType = FloatType::getF16(ctx);
+  } else if (precision == "bf16") {
+    elemType = FloatType::getBF16(ctx);
+  } else {
+    getOperation().emitError("unsupported mixed precision ") << precision;
+    return signalPassFailure();
+  }
+
+  RewritePatternSet patterns(ctx);
+  if (convolutions)
+    patterns.add<LowerConvPrecision>(ctx, elemType);
+  if (matmuls)
+    patterns.add<LowerMatMulPrecision>(ctx, elemType);
+  patterns.add<CastRoundTrip>(ctx);
+  if (failed(applyPatternsAndFoldGreedily(getOperation(), std::move(patterns))))
+    signalPassFailure();
+}
+
+std::unique_ptr<Pass>
+mlir::miopen::createMIOpenMixedPrecisionPass(StringRef precision) {
+  return std::make_unique<MIOpenMixedPrecisionPass>(precision);
+}
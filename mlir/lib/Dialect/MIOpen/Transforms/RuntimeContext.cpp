@@ -0,0 +1,86 @@
+//===- RuntimeContext.cpp - Pass runtime contexts into host functions -----===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// This pass gives every entry point that launches kernels a trailing runtime
+// context argument, a handle from mgpuContextCreate, and has the function use
+// that context for its streams and events by calling mgpuContextPush on entry
+// and mgpuContextPop before every return. Functions the entry points call use
+// the context of the calling thread, so they are left alone.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/SymbolTable.h"
+
+using namespace mlir;
+
+static constexpr llvm::StringLiteral kPushFunc = "mgpuContextPush";
+static constexpr llvm::StringLiteral kPopFunc = "mgpuContextPop";
+
+namespace {
+struct MIOpenRuntimeContextPass
+    : public MIOpenRuntimeContextPassBase<MIOpenRuntimeContextPass> {
+  void runOnOperation() override;
+};
+} // end anonymous namespace
+
+void MIOpenRuntimeContextPass::runOnOperation() {
+  ModuleOp mod = getOperation();
+  SmallVector<func::FuncOp> entryPoints;
+  for (auto func : mod.getOps<func::FuncOp>()) {
+    if (func.isExternal() || func.isPrivate() || func->hasAttr("kernel"))
+      continue;
+    if (!SymbolTable::symbolKnownUseEmpty(func, mod))
+      continue;
+    if (func.walk([](gpu::LaunchFuncOp) { return WalkResult::interrupt(); })
+            .wasInterrupted())
+      entryPoints.push_back(func);
+  }
+  if (entryPoints.empty())
+    return;
+
+  OpBuilder b(&getContext());
+  Type handleType = LLVM::LLVMPointerType::get(b.getIntegerType(8));
+  func::FuncOp pushFunc = miopen::getRuntimeFunc(mod, kPushFunc, handleType);
+  func::FuncOp popFunc = miopen::getRuntimeFunc(mod, kPopFunc, {});
+  for (func::FuncOp func : entryPoints) {
+    Location loc = func.getLoc();
+    func.insertArgument(func.getNumArguments(), handleType, DictionaryAttr(),
+                        loc);
+    b.setInsertionPointToStart(&func.getBody().front());
+    b.create<func::CallOp>(loc, pushFunc, func.getArguments().back());
+    for (Block &block : func.getBody()) {
+      auto ret = dyn_cast<func::ReturnOp>(block.getTerminator());
+      if (!ret)
+        continue;
+      b.setInsertionPoint(ret);
+      b.create<func::CallOp>(ret.getLoc(), popFunc, ValueRange{});
+    }
+  }
+}
+
+//===- Passes -------------------------------------------------------------===//
+//
+
+std::unique_ptr<Pass> mlir::miopen::createMIOpenRuntimeContextPass() {
+  return std::make_unique<MIOpenRuntimeContextPass>();
+}
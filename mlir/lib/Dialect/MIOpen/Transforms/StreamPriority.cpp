@@ -0,0 +1,86 @@
+//===- StreamPriority.cpp - Run host functions on prioritized streams -----===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// This pass makes every host function with an `xmir.priority` attribute
+// create its streams at that priority, by calling mgpuStreamPriorityPushDefault
+// on entry and mgpuStreamPriorityPop before every return. A priority the
+// caller pushed with mgpuStreamPriorityPush takes precedence, so that each
+// call can be given its own.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/BuiltinOps.h"
+
+using namespace mlir;
+
+static constexpr llvm::StringLiteral kPriorityAttr = "xmir.priority";
+static constexpr llvm::StringLiteral kPushFunc =
+    "mgpuStreamPriorityPushDefault";
+static constexpr llvm::StringLiteral kPopFunc = "mgpuStreamPriorityPop";
+
+namespace {
+struct MIOpenStreamPriorityPass
+    : public MIOpenStreamPriorityPassBase<MIOpenStreamPriorityPass> {
+  void runOnOperation() override;
+};
+} // end anonymous namespace
+
+void MIOpenStreamPriorityPass::runOnOperation() {
+  ModuleOp mod = getOperation();
+  SmallVector<func::FuncOp> funcs;
+  for (auto func : mod.getOps<func::FuncOp>())
+    if (!func.isExternal() && func->hasAttr(kPriorityAttr))
+      funcs.push_back(func);
+  if (funcs.empty())
+    return;
+
+  OpBuilder b(&getContext());
+  Type i32 = b.getI32Type();
+  func::FuncOp pushFunc = miopen::getRuntimeFunc(mod, kPushFunc, i32);
+  func::FuncOp popFunc = miopen::getRuntimeFunc(mod, kPopFunc, {});
+  for (func::FuncOp func : funcs) {
+    auto priority = func->getAttrOfType<IntegerAttr>(kPriorityAttr);
+    if (!priority) {
+      func.emitOpError() << kPriorityAttr << " must be an integer";
+      return signalPassFailure();
+    }
+    Location loc = func.getLoc();
+    b.setInsertionPointToStart(&func.getBody().front());
+    Value value = b.create<arith::ConstantIntOp>(loc, priority.getInt(), 32);
+    b.create<func::CallOp>(loc, pushFunc, value);
+    for (Block &block : func.getBody()) {
+      auto ret = dyn_cast<func::ReturnOp>(block.getTerminator());
+      if (!ret)
+        continue;
+      b.setInsertionPoint(ret);
+      b.create<func::CallOp>(ret.getLoc(), popFunc, ValueRange{});
+    }
+  }
+}
+
+//===- Passes -------------------------------------------------------------===//
+//
+
+std::unique_ptr<Pass> mlir::miopen::createMIOpenStreamPriorityPass() {
+  return std::make_unique<MIOpenStreamPriorityPass>();
+}
@@ -0,0 +1,76 @@
+//===- StripKernels.cpp ---------------------------------------------------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// This pass reduces serialized gpu.modules to their binary and the
+// declarations of their kernels, which carry the attributes the host side
+// reads.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/GPU/Transforms/Passes.h"
+#include "mlir/Dialect/LLVMIR/ROCDLDialect.h"
+#include "mlir/Dialect/MIOpen/Passes.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "miopen-strip-kernels"
+
+using namespace mlir;
+
+namespace {
+struct MIOpenStripKernelsPass
+    : public MIOpenStripKernelsPassBase<MIOpenStripKernelsPass> {
+  void runOnOperation() override {
+    gpu::GPUModuleOp gpuMod = getOperation();
+    if (!gpuMod->hasAttr(gpu::getDefaultGpuBinaryAnnotation()))
+      return;
+
+    // Kernels become declarations, which LLVM wants external, and everything
+    // else goes: helper functions, globals and the module terminator aside.
+    Block &body = gpuMod.body().front();
+    for (Operation &op : body.without_terminator())
+      op.dropAllReferences();
+    StringRef kernelAttr = ROCDL::ROCDLDialect::getKernelFuncAttrName();
+    size_t erased = 0;
+    for (Operation &op :
+         llvm::make_early_inc_range(body.without_terminator())) {
+      auto func = dyn_cast<LLVM::LLVMFuncOp>(op);
+      if (func &&
+          (func->hasAttr("block_size") || func->hasAttr(kernelAttr))) {
+        func.getBody().getBlocks().clear();
+        func.setLinkageAttr(LLVM::LinkageAttr::get(&getContext(),
+                                                   LLVM::Linkage::External));
+        continue;
+      }
+      op.erase();
+      ++erased;
+    }
+    LLVM_DEBUG(llvm::dbgs() << "Stripped " << gpuMod.getName() << ", erasing "
+                            << erased << " ops\n");
+  }
+};
+} // end anonymous namespace
+
+//===- Passes -------------------------------------------------------------===//
+//
+
+std::unique_ptr<Pass> mlir::miopen::createMIOpenStripKernelsPass() {
+  return std::make_unique<MIOpenStripKernelsPass>();
+}
@@ -17,11 +17,14 @@
 
 #include "PassDetail.h"
 
+#include "mlir/Dialect/Affine/Analysis/LoopAnalysis.h"
 #include "mlir/Dialect/Affine/LoopUtils.h"
 #include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
 #include "mlir/Dialect/MIOpen/AffineMapHelper.h"
 #include "mlir/Dialect/MIOpen/MIOpen.h"
 #include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/MIOpen/TransformMapBuilder.h"
+#include "mlir/Dialect/MIOpen/utility/OrderedRewrite.h"
 #include "mlir/Dialect/MIOpen/utility/builderUtils.h"
 #include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
 
@@ -36,6 +39,7 @@
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
 #include <numeric>
 
 #define DEBUG_TYPE "miopen-sugar-to-loops"
@@ -44,179 +48,331 @@ using namespace mlir;
 using namespace mlir::arith;
 using namespace mlir::miopen;
 
+//===----------------------------------------------------------------------===//
+// Division by constants.
+//===----------------------------------------------------------------------===//
+// Coordinates are non-negative and fit in 31 bits, so an unsigned division by
+// a constant d can be computed as (x * m) >> s with m = ceil(2^s / d) and
+// s = 31 + ceil(log2(d)). The product fits in 64 bits and, on 32-bit indices,
+// lowers to a single multiply-high and shift, which is cheaper than both the
+// signed floordiv sequence affine lowering produces and the generic 32-bit
+// unsigned division expansion.
+static Value createConstDivUI(OpBuilder &b, Location loc, Value x,
+                              int64_t divisor) {
+  assert(divisor > 0 && "Division by non-positive constant");
+  if (divisor == 1)
+    return x;
+  if (llvm::isPowerOf2_64(divisor))
+    return b.createOrFold<ShRUIOp>(
+        loc, x, b.create<ConstantIndexOp>(loc, llvm::Log2_64(divisor)));
+  if (divisor >= (int64_t(1) << 31))
+    return b.createOrFold<DivUIOp>(loc, x,
+                                   b.create<ConstantIndexOp>(loc, divisor));
+
+  uint64_t shift = 31 + llvm::Log2_64_Ceil(divisor);
+  uint64_t multiplier = ((uint64_t(1) << shift) + divisor - 1) / divisor;
+  Type i32 = b.getI32Type(), i64 = b.getI64Type();
+  Value wide = b.createOrFold<ExtUIOp>(
+      loc, i64, b.createOrFold<IndexCastOp>(loc, i32, x));
+  Value product = b.createOrFold<MulIOp>(
+      loc, wide, b.create<ConstantIntOp>(loc, multiplier, i64));
+  Value quotient = b.createOrFold<ShRUIOp>(
+      loc, product, b.create<ConstantIntOp>(loc, shift, i64));
+  return b.createOrFold<IndexCastOp>(
+      loc, b.getIndexType(), b.createOrFold<TruncIOp>(loc, i32, quotient));
+}
+
+static Value createConstRemUI(OpBuilder &b, Location loc, Value x,
+                              int64_t divisor) {
+  assert(divisor > 0 && "Remainder by non-positive constant");
+  if (llvm::isPowerOf2_64(divisor))
+    return b.createOrFold<AndIOp>(
+        loc, x, b.create<ConstantIndexOp>(loc, divisor - 1));
+  Value quotient = createConstDivUI(b, loc, x, divisor);
+  return b.createOrFold<SubIOp>(
+      loc, x,
+      b.createOrFold<MulIOp>(loc, quotient,
+                             b.create<ConstantIndexOp>(loc, divisor)));
+}
+
+/// Returns true if `expr` can't be negative given non-negative dimensions.
+static bool isNonNegative(AffineExpr expr) {
+  if (auto constExpr = expr.dyn_cast<AffineConstantExpr>())
+    return constExpr.getValue() >= 0;
+  if (expr.isa<AffineDimExpr>())
+    return true;
+  auto binExpr = expr.dyn_cast<AffineBinaryOpExpr>();
+  if (!binExpr)
+    return false;
+  if (expr.getKind() == AffineExprKind::Mod)
+    return isNonNegative(binExpr.getRHS());
+  return isNonNegative(binExpr.getLHS()) && isNonNegative(binExpr.getRHS());
+}
+
+/// Expand an affine expression over coordinates, lowering floordiv and mod by
+/// positive constants of non-negative values to multiply-shift sequences.
+/// Anything else is handed off to the generic affine expansion.
+static Value expandCoordExpr(OpBuilder &b, Location loc, AffineExpr expr,
+                             ValueRange dims) {
+  auto binExpr = expr.dyn_cast<AffineBinaryOpExpr>();
+  if (!binExpr)
+    return expandAffineExpr(b, loc, expr, dims, {});
+  AffineExpr lhs = binExpr.getLHS(), rhs = binExpr.getRHS();
+  switch (expr.getKind()) {
+  case AffineExprKind::Add:
+    return b.create<AddIOp>(loc, expandCoordExpr(b, loc, lhs, dims),
+                            expandCoordExpr(b, loc, rhs, dims));
+  case AffineExprKind::Mul:
+    return b.create<MulIOp>(loc, expandCoordExpr(b, loc, lhs, dims),
+                            expandCoordExpr(b, loc, rhs, dims));
+  case AffineExprKind::FloorDiv:
+  case AffineExprKind::Mod: {
+    auto divisor = rhs.dyn_cast<AffineConstantExpr>();
+    if (!divisor || divisor.getValue() <= 0 || !isNonNegative(lhs))
+      return expandAffineExpr(b, loc, expr, dims, {});
+    Value x = expandCoordExpr(b, loc, lhs, dims);
+    if (expr.getKind() == AffineExprKind::FloorDiv)
+      return createConstDivUI(b, loc, x, divisor.getValue());
+    return createConstRemUI(b, loc, x, divisor.getValue());
+  }
+  default:
+    return expandAffineExpr(b, loc, expr, dims, {});
+  }
+}
+
+/// Like expandAffineMap(), except that division and remainder by constants
+/// are strength-reduced, assuming that all the inputs are valid coordinates.
+static Optional<SmallVector<Value, 8>>
+expandCoordMap(OpBuilder &b, Location loc, AffineMap map, ValueRange dims) {
+  if (map.getNumSymbols() != 0)
+    return expandAffineMap(b, loc, map, dims);
+  SmallVector<Value, 8> results;
+  results.reserve(map.getNumResults());
+  for (AffineExpr expr : map.getResults()) {
+    Value v = expandCoordExpr(b, loc, expr, dims);
+    if (!v)
+      return llvm::None;
+    results.push_back(v);
+  }
+  return results;
+}
+
 namespace {
 struct MIOpenSugarToLoopsPass
     : public MIOpenSugarToLoopsPassBase<MIOpenSugarToLoopsPass> {
+  MIOpenSugarToLoopsPass() = default;
+  MIOpenSugarToLoopsPass(int64_t maxUnrolledOps) {
+    this->maxUnrolledOps = maxUnrolledOps;
+  }
   void runOnOperation() override;
 };
 
 //===----------------------------------------------------------------------===//
 // TransformingFor lowering.
 //===----------------------------------------------------------------------===//
-struct TransformingForRewritePattern
-    : public OpRewritePattern<TransformingForOp> {
-  using OpRewritePattern<TransformingForOp>::OpRewritePattern;
-  LogicalResult matchAndRewrite(TransformingForOp op,
-                                PatternRewriter &b) const override {
-    Location loc = op.getLoc();
-    SmallVector<int64_t> bounds;
-    bounds.reserve(op.bounds().size());
-    for (llvm::APInt v : op.bounds().getAsValueRange<IntegerAttr>()) {
-      int64_t bound = v.getZExtValue();
-      bounds.push_back(bound);
-    }
+/// The lower coordinates of each transform of an iteration domain, which
+/// index diffs update.
+using LowerInits = SmallVector<SmallVector<Value, 8>, 2>;
+
+/// Computes the lower coordinates of each of `transforms` at `upperInits`.
+static Optional<LowerInits> computeLowerInits(OpBuilder &b, Location loc,
+                                              ArrayAttr transforms,
+                                              ValueRange upperInits) {
+  LowerInits lowerInit;
+  // Intermediate coordinates can go negative (ex. after padding), in
+  // which case the following maps need signed division
+  bool inputsNonNegative = true;
+  for (auto t : transforms.getAsRange<TransformMapAttr>()) {
+    AffineMap map = t.getMap().getAffineMap();
+    ValueRange inputs =
+        lowerInit.empty() ? upperInits : ValueRange(lowerInit.back());
+    Optional<SmallVector<Value, 8>> init =
+        inputsNonNegative ? expandCoordMap(b, loc, map, inputs)
+                          : expandAffineMap(b, loc, map, inputs);
+    if (!init)
+      return llvm::None;
+    lowerInit.push_back(std::move(*init));
+    inputsNonNegative &= llvm::all_of(map.getResults(), isNonNegative);
+  }
+  return lowerInit;
+}
 
-    SmallVector<int64_t> strides;
-    strides.reserve(op.strides().size());
-    for (llvm::APInt v : op.strides().getAsValueRange<IntegerAttr>()) {
-      int64_t stride = v.getZExtValue();
-      strides.push_back(stride);
-    }
+/// Lowers `op` to a loop nest. The lower coordinates of the domains that
+/// `hoistedInits` has a value for are taken from there instead of being
+/// computed from the upper inits, which requires index diffs.
+static LogicalResult
+lowerTransformingFor(TransformingForOp op, RewriterBase &b,
+                     ArrayRef<Optional<LowerInits>> hoistedInits = {}) {
+  Location loc = op.getLoc();
+  SmallVector<int64_t> bounds;
+  bounds.reserve(op.bounds().size());
+  for (llvm::APInt v : op.bounds().getAsValueRange<IntegerAttr>()) {
+    int64_t bound = v.getZExtValue();
+    bounds.push_back(bound);
+  }
 
-    bool useDiffs = op.useIndexDiffs().getValueOr(false);
-    bool unroll = op.forceUnroll().getValueOr(false);
-
-    uint32_t nDomains = op.domains();
-    // Compute the initial output values of the lower coordinates.
-    // In the case of an index diff map-based loop, compute all intermediate
-    // results. When there are no index diff maps, use the composed affine map
-    SmallVector<AffineMap, 2> composedMaps;
-    SmallVector<SmallVector<SmallVector<Value, 8>, 2>, 2> lowerInits;
-    for (uint32_t i = 0; i < nDomains; ++i) {
-      SmallVector<SmallVector<Value, 8>, 2> lowerInit;
-      ArrayAttr transforms = op.getTransforms(i);
-      if (transforms.empty()) {
-        SmallVector<Value, 8> init;
-        llvm::copy(op.getUpperInits(i), std::back_inserter(init));
-        lowerInit.push_back(std::move(init));
-        composedMaps.push_back({}); // don't throw off composed maps count
-      } else if (useDiffs) {
-        for (auto t : transforms.getAsRange<TransformMapAttr>()) {
-          AffineMap map = t.getMap().getAffineMap();
-          Optional<SmallVector<Value, 8>> init;
-          if (lowerInit.size() == 0)
-            init = expandAffineMap(b, loc, map, op.getUpperInits(i));
-          else
-            init =
-                expandAffineMap(b, loc, map, lowerInit[lowerInit.size() - 1]);
-          if (!init)
-            return failure();
-          lowerInit.push_back(std::move(*init));
-        }
-      } else {
-        SmallVector<AffineMap, 2> maps;
-        for (auto t : transforms.getAsRange<TransformMapAttr>()) {
-          maps.push_back(t.getMap().getAffineMap());
-        }
-        AffineMap composed = composeTransforms(maps);
-        composedMaps.push_back(composed);
-        Optional<SmallVector<Value, 8>> init =
-            expandAffineMap(b, loc, composed, op.getUpperInits(i));
-        if (!init.hasValue())
-          return failure();
-        lowerInit.push_back(std::move(*init));
+  SmallVector<int64_t> strides;
+  strides.reserve(op.strides().size());
+  for (llvm::APInt v : op.strides().getAsValueRange<IntegerAttr>()) {
+    int64_t stride = v.getZExtValue();
+    strides.push_back(stride);
+  }
+
+  bool useDiffs = op.useIndexDiffs().getValueOr(false);
+  bool unroll = op.forceUnroll().getValueOr(false);
+
+  uint32_t nDomains = op.domains();
+  // Fuse adjacent transformations where we can so that there are fewer
+  // layers of coordinates to compute and update
+  SmallVector<ArrayAttr, 2> simplifiedTransforms;
+  for (uint32_t i = 0; i < nDomains; ++i)
+    simplifiedTransforms.push_back(
+        simplifyTransformChain(b, op.getTransforms(i)));
+
+  // Compute the initial output values of the lower coordinates.
+  // In the case of an index diff map-based loop, compute all intermediate
+  // results. When there are no index diff maps, use the composed affine map
+  SmallVector<AffineMap, 2> composedMaps;
+  SmallVector<SmallVector<SmallVector<Value, 8>, 2>, 2> lowerInits;
+  for (uint32_t i = 0; i < nDomains; ++i) {
+    SmallVector<SmallVector<Value, 8>, 2> lowerInit;
+    ArrayAttr transforms = simplifiedTransforms[i];
+    if (transforms.empty()) {
+      SmallVector<Value, 8> init;
+      llvm::copy(op.getUpperInits(i), std::back_inserter(init));
+      lowerInit.push_back(std::move(init));
+      composedMaps.push_back({}); // don't throw off composed maps count
+    } else if (i < hoistedInits.size() && hoistedInits[i]) {
+      assert(useDiffs && "Hoisted coordinates need index diffs");
+      lowerInit = *hoistedInits[i];
+    } else if (useDiffs) {
+      Optional<LowerInits> init =
+          computeLowerInits(b, loc, transforms, op.getUpperInits(i));
+      if (!init)
+        return failure();
+      lowerInit = std::move(*init);
+    } else {
+      SmallVector<AffineMap, 2> maps;
+      for (auto t : transforms.getAsRange<TransformMapAttr>()) {
+        maps.push_back(t.getMap().getAffineMap());
       }
-      lowerInits.push_back(lowerInit);
+      AffineMap composed = composeTransforms(maps);
+      composedMaps.push_back(composed);
+      Optional<SmallVector<Value, 8>> init =
+          expandCoordMap(b, loc, composed, op.getUpperInits(i));
+      if (!init.hasValue())
+        return failure();
+      lowerInit.push_back(std::move(*init));
     }
+    lowerInits.push_back(lowerInit);
+  }
 
-    // Having done pre-computation, create an affine loop nest over the upper
-    // rectangle. This'll be unrolled as needed.
-    llvm::SmallVector<AffineForOp, 5> loops;
-    llvm::SmallVector<Value, 5> ivs;
-    OpBuilder ilb = b;
-    for (const auto &pair : llvm::zip(bounds, strides)) {
-      int64_t bound, stride;
-      std::tie(bound, stride) = pair;
-      llvm::SmallVector<Value, 3> iterInits;
-      if (loops.empty())
-        llvm::copy(op.iterInits(), std::back_inserter(iterInits));
-      else
-        llvm::copy(loops[loops.size() - 1].getRegionIterArgs(),
-                   std::back_inserter(iterInits));
-      auto loop = ilb.create<AffineForOp>(loc, 0, bound, stride, iterInits);
-      ivs.push_back(loop.getInductionVar());
-      if (iterInits
-              .empty()) // remove default affine.yield for cleaner code later
-        b.eraseOp(loop.getBody()->getTerminator());
-      ilb = OpBuilder::atBlockBegin(loop.getBody(), ilb.getListener());
-      loops.push_back(loop);
-    }
+  // Having done pre-computation, create an affine loop nest over the upper
+  // rectangle. This'll be unrolled as needed.
+  llvm::SmallVector<AffineForOp, 5> loops;
+  llvm::SmallVector<Value, 5> ivs;
+  OpBuilder ilb = b;
+  for (const auto &pair : llvm::zip(bounds, strides)) {
+    int64_t bound, stride;
+    std::tie(bound, stride) = pair;
+    llvm::SmallVector<Value, 3> iterInits;
+    if (loops.empty())
+      llvm::copy(op.iterInits(), std::back_inserter(iterInits));
+    else
+      llvm::copy(loops[loops.size() - 1].getRegionIterArgs(),
+                 std::back_inserter(iterInits));
+    auto loop = ilb.create<AffineForOp>(loc, 0, bound, stride, iterInits);
+    ivs.push_back(loop.getInductionVar());
+    if (iterInits
+            .empty()) // remove default affine.yield for cleaner code later
+      b.eraseOp(loop.getBody()->getTerminator());
+    ilb = OpBuilder::atBlockBegin(loop.getBody(), ilb.getListener());
+    loops.push_back(loop);
+  }
 
-    // Create code to actually transform the coordinates
-    BlockAndValueMapping cloneMap;
-    for (uint32_t i = 0; i < nDomains; ++i) {
-      Block::BlockArgListType lower = op.getLowerCoords(i);
-      ArrayAttr transforms = op.getTransforms(i);
-      if (!useDiffs || transforms.empty()) {
-        llvm::SmallVector<Value, 5> stepped;
-        for (auto p : llvm::zip(op.getUpperInits(i), ivs)) {
-          stepped.push_back(
-              ilb.create<AddIOp>(loc, std::get<0>(p), std::get<1>(p)));
-        }
-        if (!transforms.empty()) {
-          Optional<SmallVector<Value, 8>> transformed =
-              expandAffineMap(ilb, loc, composedMaps[i], stepped);
-          if (!transformed)
-            return failure();
-          stepped.clear();
-          stepped.assign(std::move(*transformed));
-        }
-        for (auto p : llvm::zip(lower, stepped)) {
-          cloneMap.map(std::get<0>(p), std::get<1>(p));
-        }
-      } else { // index diff maps
-        IndexDiffUpdateOp lastDiff;
-        for (auto p : llvm::zip(transforms.getAsRange<TransformMapAttr>(),
-                                lowerInits[i])) {
-          TransformMapAttr t = std::get<0>(p);
-          SmallVector<Value, 8> &lowerInit = std::get<1>(p);
-          if (!lastDiff)
-            lastDiff = ilb.create<IndexDiffUpdateOp>(loc, t, ivs, lowerInit);
-          else
-            lastDiff = ilb.create<IndexDiffUpdateOp>(
-                loc, t, lastDiff.lowerDiff(), lowerInit);
-        }
-        for (auto p : llvm::zip(lower, lastDiff.lowerIndices())) {
-          cloneMap.map(std::get<0>(p), std::get<1>(p));
-        }
+  // Create code to actually transform the coordinates
+  BlockAndValueMapping cloneMap;
+  for (uint32_t i = 0; i < nDomains; ++i) {
+    Block::BlockArgListType lower = op.getLowerCoords(i);
+    ArrayAttr transforms = simplifiedTransforms[i];
+    if (!useDiffs || transforms.empty()) {
+      llvm::SmallVector<Value, 5> stepped;
+      for (auto p : llvm::zip(op.getUpperInits(i), ivs)) {
+        stepped.push_back(
+            ilb.create<AddIOp>(loc, std::get<0>(p), std::get<1>(p)));
+      }
+      if (!transforms.empty()) {
+        Optional<SmallVector<Value, 8>> transformed =
+            expandCoordMap(ilb, loc, composedMaps[i], stepped);
+        if (!transformed)
+          return failure();
+        stepped.clear();
+        stepped.assign(std::move(*transformed));
+      }
+      for (auto p : llvm::zip(lower, stepped)) {
+        cloneMap.map(std::get<0>(p), std::get<1>(p));
+      }
+    } else { // index diff maps
+      IndexDiffUpdateOp lastDiff;
+      for (auto p : llvm::zip(transforms.getAsRange<TransformMapAttr>(),
+                              lowerInits[i])) {
+        TransformMapAttr t = std::get<0>(p);
+        SmallVector<Value, 8> &lowerInit = std::get<1>(p);
+        if (!lastDiff)
+          lastDiff = ilb.create<IndexDiffUpdateOp>(loc, t, ivs, lowerInit);
+        else
+          lastDiff = ilb.create<IndexDiffUpdateOp>(
+              loc, t, lastDiff.lowerDiff(), lowerInit);
+      }
+      for (auto p : llvm::zip(lower, lastDiff.lowerIndices())) {
+        cloneMap.map(std::get<0>(p), std::get<1>(p));
       }
     }
+  }
 
-    // Map loop arguments, clone operations in body
-    AffineForOp il = loops[loops.size() - 1];
-    for (auto p : llvm::zip(op.getIterArgs(), il.getRegionIterArgs())) {
-      cloneMap.map(std::get<0>(p), std::get<1>(p));
-    }
-    for (Operation &bodyOp : op.getBody()->getOperations()) {
-      if (auto yield = dyn_cast<miopen::YieldOp>(bodyOp)) {
-        llvm::SmallVector<Value, 3> terminatorArgs;
-        for (Value v : op.getBody()->getTerminator()->getOperands()) {
-          terminatorArgs.push_back(cloneMap.lookupOrDefault(v));
-        }
-        ilb.create<AffineYieldOp>(loc, terminatorArgs);
-      } else {
-        ilb.clone(bodyOp, cloneMap);
+  // Map loop arguments, clone operations in body
+  AffineForOp il = loops[loops.size() - 1];
+  for (auto p : llvm::zip(op.getIterArgs(), il.getRegionIterArgs())) {
+    cloneMap.map(std::get<0>(p), std::get<1>(p));
+  }
+  for (Operation &bodyOp : op.getBody()->getOperations()) {
+    if (auto yield = dyn_cast<miopen::YieldOp>(bodyOp)) {
+      llvm::SmallVector<Value, 3> terminatorArgs;
+      for (Value v : op.getBody()->getTerminator()->getOperands()) {
+        terminatorArgs.push_back(cloneMap.lookupOrDefault(v));
       }
+      ilb.create<AffineYieldOp>(loc, terminatorArgs);
+    } else {
+      ilb.clone(bodyOp, cloneMap);
     }
+  }
 
-    if (loops.size() > 1) {
-      for (size_t i = 0, e = loops.size() - 1; i < e; ++i) {
-        AffineForOp inner = loops[i + 1];
-        OpBuilder lb =
-            OpBuilder::atBlockEnd(loops[i].getBody(), b.getListener());
-        lb.create<AffineYieldOp>(loc, inner.getResults());
-      }
+  if (loops.size() > 1) {
+    for (size_t i = 0, e = loops.size() - 1; i < e; ++i) {
+      AffineForOp inner = loops[i + 1];
+      OpBuilder lb =
+          OpBuilder::atBlockEnd(loops[i].getBody(), b.getListener());
+      lb.create<AffineYieldOp>(loc, inner.getResults());
     }
+  }
 
-    b.replaceOp(op, loops[0].getResults());
-    // Note: the unrolling process doesn't play nice with pattern rewrites
-    // Therefore, we just mark loops for unrolling and deal with it in a
-    // separate pass
-    if (unroll)
-      for (AffineForOp loop : loops)
-        loop->setAttr("forceUnroll", b.getUnitAttr());
+  b.replaceOp(op, loops[0].getResults());
+  // Note: the unrolling process doesn't play nice with pattern rewrites
+  // Therefore, we just mark loops for unrolling and deal with it in a
+  // separate pass
+  if (unroll)
+    for (AffineForOp loop : loops)
+      loop->setAttr("forceUnroll", b.getUnitAttr());
 
-    return success();
+  return success();
+}
+
+struct TransformingForRewritePattern
+    : public OpRewritePattern<TransformingForOp> {
+  using OpRewritePattern<TransformingForOp>::OpRewritePattern;
+  LogicalResult matchAndRewrite(TransformingForOp op,
+                                PatternRewriter &b) const override {
+    return lowerTransformingFor(op, b);
   }
 };
 
@@ -622,8 +778,8 @@ struct IndexDiffUpdateRewritePattern
             }
 
             Value upperBoundOp = b.create<ConstantIndexOp>(loc, upperBound);
-            Value carry = b.create<DivUIOp>(loc, index, upperBoundOp);
-            Value newIndex = b.create<RemUIOp>(loc, index, upperBoundOp);
+            Value carry = createConstDivUI(b, loc, index, upperBound);
+            Value newIndex = createConstRemUI(b, loc, index, upperBound);
             // If the merge is, as is typical, near the end of the
             // transformations this computation should get hit by the dead code
             // eleminator
@@ -661,7 +817,6 @@ struct IndexDiffUpdateRewritePattern
         // lower broadcast dims, uses map
         for (uint32_t i = 0; i < e.size(); ++i) {
           int64_t lowerLen = e[i];
-          Value lowerLenOp = b.create<ConstantIndexOp>(loc, lowerLen);
           auto mbUpperDiff = isConstantValue(upperIndicesDiff[p[i]]);
           Value wrappedDiff;
           if (mbUpperDiff.hasValue()) {
@@ -669,11 +824,11 @@ struct IndexDiffUpdateRewritePattern
                 b.create<ConstantIndexOp>(loc, *mbUpperDiff % lowerLen);
           } else {
             wrappedDiff =
-                b.create<RemUIOp>(loc, upperIndicesDiff[p[i]], lowerLenOp);
+                createConstRemUI(b, loc, upperIndicesDiff[p[i]], lowerLen);
           }
           Value newLower =
               addToOriginal(lowerIndicesOriginal[q[i]], wrappedDiff);
-          newLower = b.create<RemUIOp>(loc, newLower, lowerLenOp);
+          newLower = createConstRemUI(b, loc, newLower, lowerLen);
           Value lowerDiff =
               b.create<SubIOp>(loc, newLower, lowerIndicesOriginal[q[i]]);
           lowerIndicesDiffMap[q[i]] = lowerDiff;
@@ -768,8 +923,86 @@ struct InsertSliceRewritePattern : public OpRewritePattern<InsertSliceOp> {
 //===----------------------------------------------------------------------===//
 // BufferLoad lowering.
 //===----------------------------------------------------------------------===//
-// TODO(kdrewnia): use "OOB reads = 0" from hardware to remove
-// hardcoded zero value
+/// Compute the i32 coordinates for a buffer access to `sourceType` at
+/// `opCoords`, which may be out of bounds in the dimensions of `leftOobDims`
+/// and `rightOobDims`, such that any out of bounds access lands past the end
+/// of the buffer. The hardware then returns 0 for such loads and drops such
+/// stores.
+///
+/// This only needs code for the cases the hardware can't catch by itself.
+/// Since the buffer offset is an unsigned 32-bit value compared against the
+/// buffer's size, accesses past the end of dimension 0 are already out of
+/// range, and so are accesses before its start when the layout is the
+/// identity and every other coordinate is in bounds, as the offset is then
+/// negative. Each remaining dimension gets one unsigned comparison (negative
+/// coordinates wrap to large values), and the results are combined to redirect
+/// dimension 0 past the end of the buffer with a single select. Coordinates
+/// that could be negative are clamped to 0 first so they can't pull the
+/// redirected offset back into the buffer.
+static LogicalResult computeBufferCoords(PatternRewriter &b, Location loc,
+                                         Operation *op, MemRefType sourceType,
+                                         ValueRange opCoords,
+                                         ArrayAttr leftOobDims,
+                                         ArrayAttr rightOobDims,
+                                         SmallVectorImpl<Value> &coordsI32) {
+  ArrayRef<int64_t> sourceShape = sourceType.getShape();
+  int64_t sourceNumElems = sourceType.getNumElements();
+  SmallVector<int64_t, 5> sourceStrides;
+  int64_t sourceOffset;
+  if (failed(getStridesAndOffset(sourceType, sourceStrides, sourceOffset))) {
+    return op->emitOpError("Somehow we don't have static strides\n");
+  }
+
+  SmallVector<Value, 5> coords;
+  coords.reserve(opCoords.size());
+  llvm::copy(opCoords, std::back_inserter(coords));
+
+  Value zeroConstantOp = b.createOrFold<ConstantIndexOp>(loc, 0);
+  Value falseOp = b.createOrFold<ConstantIntOp>(loc, 0, b.getI1Type());
+
+  llvm::SmallDenseSet<uint32_t> leftOob, rightOob;
+  for (llvm::APInt leftOobDim : leftOobDims.getAsValueRange<IntegerAttr>())
+    leftOob.insert(leftOobDim.getZExtValue());
+  for (llvm::APInt rightOobDim : rightOobDims.getAsValueRange<IntegerAttr>())
+    rightOob.insert(rightOobDim.getZExtValue());
+
+  Value isOob = falseOp;
+  for (uint32_t i = 1, e = coords.size(); i < e; ++i) {
+    if (!leftOob.contains(i) && !rightOob.contains(i))
+      continue;
+    Value test = b.create<CmpIOp>(
+        loc, CmpIPredicate::uge, coords[i],
+        b.createOrFold<ConstantIndexOp>(loc, sourceShape[i]));
+    isOob = b.createOrFold<OrIOp>(loc, test, isOob);
+    if (leftOob.contains(i))
+      coords[i] = b.create<MaxSIOp>(loc, coords[i], zeroConstantOp);
+  }
+  // A negative coordinate in dimension 0 gives a negative offset, which is out
+  // of range, if the rest of the offset is smaller than dimension 0's stride.
+  // That can only be relied on for identity layouts.
+  if (leftOob.contains(0) && !sourceType.getLayout().isIdentity()) {
+    Value test =
+        b.create<CmpIOp>(loc, CmpIPredicate::slt, coords[0], zeroConstantOp);
+    isOob = b.createOrFold<OrIOp>(loc, test, isOob);
+  }
+  if (isOob != falseOp) {
+    Value oobConst =
+        b.create<ConstantIndexOp>(loc, sourceNumElems / sourceStrides[0]);
+    coords[0] = b.create<SelectOp>(loc, isOob, oobConst, coords[0]);
+  }
+
+  for (auto v : coords)
+    coordsI32.push_back(b.create<IndexCastOp>(loc, b.getI32Type(), v));
+  return success();
+}
+
+/// The cache policy bits of the amdgpu buffer ops for `policy`. Streaming
+/// accesses set SLC (NT on gfx940), which keeps their lines from displacing
+/// the rest of the L2.
+static uint32_t getCachePolicyBits(CachePolicy policy) {
+  return policy == CachePolicy::Streaming ? 2 : 0;
+}
+
 struct BufferLoadRewritePattern : public OpRewritePattern<BufferLoadOp> {
   using OpRewritePattern<BufferLoadOp>::OpRewritePattern;
   LogicalResult matchAndRewrite(BufferLoadOp op,
@@ -777,63 +1010,57 @@ struct BufferLoadRewritePattern : public OpRewritePattern<BufferLoadOp> {
     Location loc = op.getLoc();
     Value source = op.source();
     auto sourceType = source.getType().cast<MemRefType>();
-    ArrayRef<int64_t> sourceShape = sourceType.getShape();
-    int64_t sourceNumElems = sourceType.getNumElements();
-    SmallVector<int64_t, 5> sourceStrides;
-    int64_t sourceOffset;
-    if (failed(getStridesAndOffset(sourceType, sourceStrides, sourceOffset))) {
-      return op.emitOpError("Somehow we don't have static strides\n");
-    }
-
     Type loadedType = op.result().getType();
-    SmallVector<Value, 5> coords;
-    coords.reserve(op.coords().size());
-    llvm::copy(op.coords(), std::back_inserter(coords));
-
-    Value zeroConstantOp = b.create<ConstantIndexOp>(loc, 0);
-
-    Value falseOp = b.createOrFold<ConstantIntOp>(loc, 0, b.getI1Type());
-
-    llvm::SmallDenseSet<uint32_t> leftOob, rightOob;
-    for (llvm::APInt leftOobDim :
-         op.leftOobDims().getAsValueRange<IntegerAttr>())
-      leftOob.insert(leftOobDim.getZExtValue());
-    for (llvm::APInt rightOobDim :
-         op.rightOobDims().getAsValueRange<IntegerAttr>())
-      rightOob.insert(rightOobDim.getZExtValue());
-
-    // If a coordinate is out of bounds, set that coordinate to the number of
-    // elements in the buffer over the stride in that dimension, ensuring
-    // we get an out of bounds store
-    for (uint32_t i = 0, e = coords.size(); i < e; ++i) {
-      // oob checks on the right for dimension 0 are already handled by the
-      // buffer intrinsic
-      Value isOob = falseOp;
-      if (rightOob.contains(i) && i != 0) {
-        Value test = b.create<CmpIOp>(
-            loc, CmpIPredicate::sge, coords[i],
-            b.createOrFold<ConstantIndexOp>(loc, sourceShape[i]));
-        isOob = b.createOrFold<OrIOp>(loc, test, isOob);
-      }
-      if (leftOob.contains(i)) {
-        Value test = b.create<CmpIOp>(loc, CmpIPredicate::slt, coords[i],
-                                      zeroConstantOp);
-        isOob = b.createOrFold<OrIOp>(loc, test, isOob);
-      }
-      if (isOob != falseOp) {
-        Value oobConst =
-            b.create<ConstantIndexOp>(loc, sourceNumElems / sourceStrides[i]);
-        coords[i] = b.create<SelectOp>(loc, isOob, oobConst, coords[i]);
-      }
-    }
 
     // Emit load instruction
     // use buffer load since the source memref is on address space 0
     SmallVector<Value, 5> coordsI32;
-    for (auto v : coords)
-      coordsI32.push_back(b.create<IndexCastOp>(loc, b.getI32Type(), v));
+    if (failed(computeBufferCoords(b, loc, op, sourceType, op.coords(),
+                                   op.leftOobDims(), op.rightOobDims(),
+                                   coordsI32)))
+      return failure();
     b.replaceOpWithNewOp<amdgpu::RawBufferLoadOp>(
         op, loadedType, source, coordsI32, /*boundsCheck=*/true,
+        /*indexOffset=*/nullptr, /*sgprOffset=*/nullptr,
+        getCachePolicyBits(op.cachePolicy()));
+    return success();
+  }
+};
+
+//===----------------------------------------------------------------------===//
+// BufferLoadToLds lowering.
+//===----------------------------------------------------------------------===//
+struct BufferLoadToLdsRewritePattern
+    : public OpRewritePattern<BufferLoadToLdsOp> {
+  using OpRewritePattern<BufferLoadToLdsOp>::OpRewritePattern;
+  LogicalResult matchAndRewrite(BufferLoadToLdsOp op,
+                                PatternRewriter &b) const override {
+    Location loc = op.getLoc();
+    Value source = op.source();
+    auto sourceType = source.getType().cast<MemRefType>();
+    auto destType = op.dest().getType().cast<MemRefType>();
+    if (destType.getRank() != 1)
+      return op.emitOpError("LDS destination must be a flat buffer");
+
+    SmallVector<Value, 5> coordsI32;
+    if (failed(computeBufferCoords(b, loc, op, sourceType, op.coords(),
+                                   op.leftOobDims(), op.rightOobDims(),
+                                   coordsI32)))
+      return failure();
+
+    // The hardware adds 4 bytes per lane to the LDS address it is given, so
+    // pass it the destination of the first lane of the wave.
+    constexpr int64_t waveSize = 64;
+    int64_t elemsPerDword = 32 / destType.getElementTypeBitWidth();
+    Value tid = b.create<WorkitemIdOp>(loc, b.getIndexType());
+    Value lane = b.create<RemUIOp>(loc, tid,
+                                   b.create<ConstantIndexOp>(loc, waveSize));
+    Value laneOffset = b.create<MulIOp>(
+        loc, lane, b.create<ConstantIndexOp>(loc, elemsPerDword));
+    Value waveDest =
+        b.create<SubIOp>(loc, op.destCoords().front(), laneOffset);
+    b.replaceOpWithNewOp<amdgpu::RawBufferLoadLdsOp>(
+        op, source, coordsI32, op.dest(), waveDest, /*boundsCheck=*/true,
         /*indexOffset=*/nullptr, /*sgprOffset=*/nullptr);
     return success();
   }
@@ -845,6 +1072,73 @@ struct BufferLoadRewritePattern : public OpRewritePattern<BufferLoadOp> {
 struct BufferStoreRewritePattern : public OpRewritePattern<BufferStoreOp> {
   using OpRewritePattern<BufferStoreOp>::OpRewritePattern;
 
+  /// fp16 atomic adds only exist packed, adding a pair of halves to a dword,
+  /// so split the contiguous elements of `op` into the pairs of the dwords
+  /// they fall into, padding them with 0s. As the parity of the first
+  /// element's offset is only known at runtime, branch on it: the even case,
+  /// the usual one for tiles whose threads own pairs, issues half as many
+  /// atomics as there are elements, and the odd one shifts everything by one.
+  /// As the buffer has an even number of elements, the padding 0s added
+  /// around the elements of a valid store stay within it.
+  static LogicalResult storePackedAtomics(PatternRewriter &b, Location loc,
+                                          BufferStoreOp op,
+                                          ArrayRef<Value> coordsI32) {
+    auto destType = op.dest().getType().cast<MemRefType>();
+    if (!destType.getLayout().isIdentity() ||
+        destType.getNumElements() % 2 != 0)
+      return op.emitOpError("fp16 atomic adds need an identity layout with an "
+                            "even number of elements");
+    SmallVector<int64_t, 5> strides;
+    int64_t offset;
+    if (failed(getStridesAndOffset(destType, strides, offset)))
+      return op.emitOpError("Somehow we don't have static strides\n");
+
+    Type elemType = destType.getElementType();
+    SmallVector<Value, 8> elems;
+    if (auto dataVector = op.data().getType().dyn_cast<VectorType>()) {
+      for (int64_t i = 0, e = dataVector.getNumElements(); i < e; ++i)
+        elems.push_back(b.create<vector::ExtractElementOp>(
+            loc, op.data(), b.create<ConstantIndexOp>(loc, i)));
+    } else {
+      elems.push_back(op.data());
+    }
+
+    // Only the dimensions with odd strides change the parity of the offset.
+    Type i32 = b.getI32Type();
+    Value parity = b.create<ConstantIntOp>(loc, 0, i32);
+    for (auto pair : llvm::zip(coordsI32, strides))
+      if (std::get<1>(pair) % 2 != 0)
+        parity = b.create<AddIOp>(loc, parity, std::get<0>(pair));
+    Value isOdd = b.create<CmpIOp>(
+        loc, CmpIPredicate::ne,
+        b.create<AndIOp>(loc, parity, b.create<ConstantIntOp>(loc, 1, i32)),
+        b.create<ConstantIntOp>(loc, 0, i32));
+
+    auto pairType = VectorType::get({2}, elemType);
+    Value zero = createZeroConstantOp(b, loc, elemType);
+    auto emitPairs = [&](OpBuilder &nb, Location nloc, int64_t shift) {
+      SmallVector<Value, 10> padded(shift, zero);
+      padded.append(elems.begin(), elems.end());
+      if (padded.size() % 2 != 0)
+        padded.push_back(zero);
+      for (int64_t i = 0, e = padded.size(); i < e; i += 2) {
+        Value pair = nb.create<vector::BroadcastOp>(nloc, pairType, padded[i]);
+        pair = nb.create<vector::InsertElementOp>(
+            nloc, padded[i + 1], pair, nb.create<ConstantIndexOp>(nloc, 1));
+        nb.create<amdgpu::RawBufferAtomicFaddOp>(
+            nloc, pair, op.dest(), coordsI32, /*boundsCheck=*/true,
+            /*indexOffset=*/nb.getI32IntegerAttr(i - shift),
+            /*sgprOffset=*/nullptr, getCachePolicyBits(op.cachePolicy()));
+      }
+      nb.create<scf::YieldOp>(nloc);
+    };
+    b.create<scf::IfOp>(
+        loc, isOdd,
+        [&](OpBuilder &nb, Location nloc) { emitPairs(nb, nloc, 1); },
+        [&](OpBuilder &nb, Location nloc) { emitPairs(nb, nloc, 0); });
+    return success();
+  }
+
   LogicalResult matchAndRewrite(BufferStoreOp op,
                                 PatternRewriter &b) const override {
     Location loc = op.getLoc();
@@ -852,80 +1146,41 @@ struct BufferStoreRewritePattern : public OpRewritePattern<BufferStoreOp> {
     Value data = op.data();
     Value dest = op.dest();
     auto destType = dest.getType().cast<MemRefType>();
-    ArrayRef<int64_t> destShape = destType.getShape();
-    int64_t destNumElems = destType.getNumElements();
-    SmallVector<int64_t, 5> destStrides;
-    int64_t destOffset;
-    if (failed(getStridesAndOffset(destType, destStrides, destOffset))) {
-      return op.emitOpError("Somehow we don't have static strides\n");
-    }
-
-    SmallVector<Value, 5> coords;
-    coords.reserve(op.coords().size());
-    llvm::copy(op.coords(), std::back_inserter(coords));
-
-    Value zeroConstantOp = b.createOrFold<ConstantIndexOp>(loc, 0);
-    Value falseOp = b.createOrFold<ConstantIntOp>(loc, 0, b.getI1Type());
-
-    llvm::SmallDenseSet<uint32_t> leftOob, rightOob;
-    for (llvm::APInt leftOobDim :
-         op.leftOobDims().getAsValueRange<IntegerAttr>())
-      leftOob.insert(leftOobDim.getZExtValue());
-    for (llvm::APInt rightOobDim :
-         op.rightOobDims().getAsValueRange<IntegerAttr>())
-      rightOob.insert(rightOobDim.getZExtValue());
-
-    // If a coordinate is out of bounds, set that coordinate to the number of
-    // elements in the buffer over the stride in that dimension, ensuring
-    // we get an out of bounds store
-    for (uint32_t i = 0, e = coords.size(); i < e; ++i) {
-      // oob checks on the right for dimension 0 are already handled by the
-      // buffer intrinsic
-      Value isOob = falseOp;
-      if (rightOob.contains(i) && i != 0) {
-        Value test = b.create<CmpIOp>(
-            loc, CmpIPredicate::sge, coords[i],
-            b.createOrFold<ConstantIndexOp>(loc, destShape[i]));
-        isOob = b.createOrFold<OrIOp>(loc, test, isOob);
-      }
-      if (leftOob.contains(i)) {
-        Value test = b.create<CmpIOp>(loc, CmpIPredicate::slt, coords[i],
-                                      zeroConstantOp);
-        isOob = b.createOrFold<OrIOp>(loc, test, isOob);
-      }
-      if (isOob != falseOp) {
-        Value oobConst =
-            b.create<ConstantIndexOp>(loc, destNumElems / destStrides[i]);
-        coords[i] = b.create<SelectOp>(loc, isOob, oobConst, coords[i]);
-      }
-    }
 
     StoreMethod memoryOp = op.storeMethod();
+    uint32_t cachePolicy = getCachePolicyBits(op.cachePolicy());
     SmallVector<Value, 5> coordsI32;
-    for (Value v : coords)
-      coordsI32.push_back(b.create<IndexCastOp>(loc, b.getI32Type(), v));
+    if (failed(computeBufferCoords(b, loc, op, destType, op.coords(),
+                                   op.leftOobDims(), op.rightOobDims(),
+                                   coordsI32)))
+      return failure();
 
     if (memoryOp == StoreMethod::AtomicAdd) {
       // TODO: test padding in atomic add kernels now that we can oob with them
-      if (auto dataVector = data.getType().dyn_cast<VectorType>()) {
+      if (destType.getElementType().isF16()) {
+        if (failed(storePackedAtomics(b, loc, op, coordsI32)))
+          return failure();
+        b.eraseOp(op);
+      } else if (auto dataVector = data.getType().dyn_cast<VectorType>()) {
         int32_t nAtomics = dataVector.getNumElements();
         for (int32_t i = 0; i < nAtomics; ++i) {
           Value item = b.create<vector::ExtractElementOp>(
               loc, data, b.create<ConstantIndexOp>(loc, i));
           b.create<amdgpu::RawBufferAtomicFaddOp>(
               loc, item, dest, coordsI32, /*boundsCheck=*/true,
-              /*indexOffset=*/b.getI32IntegerAttr(i), /*sgprOffset=*/nullptr);
+              /*indexOffset=*/b.getI32IntegerAttr(i), /*sgprOffset=*/nullptr,
+              cachePolicy);
         }
         b.eraseOp(op);
       } else {
         b.replaceOpWithNewOp<amdgpu::RawBufferAtomicFaddOp>(
             op, data, dest, coordsI32, /*boundsCheck=*/true,
-            /*indexOffset=*/nullptr, /*sgprOffset=*/nullptr);
+            /*indexOffset=*/nullptr, /*sgprOffset=*/nullptr, cachePolicy);
       }
     } else {
       b.replaceOpWithNewOp<amdgpu::RawBufferStoreOp>(
           op, data, dest, coordsI32, /*boundsCheck=*/true,
-          /*indexOffset=*/nullptr, /*sgprOffset=*/nullptr);
+          /*indexOffset=*/nullptr, /*sgprOffset=*/nullptr, cachePolicy);
     }
     return success();
   }
@@ -1277,6 +1532,61 @@ struct InWarpTransposeRewritePattern
     return result;
   }
 
+  // Transpose the `groupSize` x `groupSize` blocks of `vector` with a
+  // butterfly: with d going from groupSize / 2 down to 1, lanes whose ID has
+  // bit d set swap the registers with bit d clear with the registers with bit
+  // d set of the lane d below them, which transposes the d x d blocks of each
+  // 2d x 2d block relative to each other. Each swap is a pair of DPP quad
+  // permutes, which move the registers to and from the partner lane, and a
+  // pair of selects, which keep the registers that stay, for 2 instructions
+  // per register and step instead of the 4 to 5 of the rotations and
+  // swizzles, which only the non-identity in-group permutations need.
+  Value emitButterflies(Location loc, PatternRewriter &b, Value vector,
+                        Value laneId, uint32_t groupSize,
+                        uint32_t totalSize) const {
+    Type i32 = b.getI32Type();
+    Value result = b.create<vector::BitCastOp>(
+        loc,
+        VectorType::get(vector.getType().cast<VectorType>().getShape(), i32),
+        vector);
+    SmallVector<Value, swizzleGroupSize> accessConsts;
+    SmallVector<Value, swizzleGroupSize> registers;
+    for (uint32_t i = 0; i < totalSize; ++i) {
+      accessConsts.push_back(b.create<ConstantIndexOp>(loc, i));
+      registers.push_back(
+          b.create<vector::ExtractElementOp>(loc, result, accessConsts[i]));
+    }
+
+    Value zeroConst = b.create<ConstantIndexOp>(loc, 0);
+    for (uint32_t d = groupSize / 2; d > 0; d /= 2) {
+      // Quad permute that reads the value of the partner lane, t ^ d.
+      SmallVector<int32_t, swizzleGroupSize> partner;
+      for (uint32_t t = 0; t < swizzleGroupSize; ++t)
+        partner.push_back(t ^ d);
+      ArrayAttr partnerSelector = b.getI32ArrayAttr(partner);
+      Value isUpper = b.create<CmpIOp>(
+          loc, CmpIPredicate::ne,
+          b.create<AndIOp>(loc, laneId, b.create<ConstantIndexOp>(loc, d)),
+          zeroConst);
+      for (uint32_t lo = 0; lo < totalSize; ++lo) {
+        if ((lo & d) != 0)
+          continue;
+        uint32_t hi = lo | d;
+        Value fromLo = b.create<gpu::WarpSwizzleOp>(loc, i32, registers[lo],
+                                                    partnerSelector);
+        Value fromHi = b.create<gpu::WarpSwizzleOp>(loc, i32, registers[hi],
+                                                    partnerSelector);
+        registers[lo] = b.create<SelectOp>(loc, isUpper, fromHi, registers[lo]);
+        registers[hi] = b.create<SelectOp>(loc, isUpper, registers[hi], fromLo);
+      }
+    }
+
+    for (uint32_t i = 0; i < totalSize; ++i)
+      result = b.create<vector::InsertElementOp>(loc, registers[i], result,
+                                                 accessConsts[i]);
+    return b.create<vector::BitCastOp>(loc, vector.getType(), result);
+  }
+
   LogicalResult matchAndRewrite(InWarpTransposeOp op,
                                 PatternRewriter &b) const override {
     Location loc = op.getLoc();
@@ -1303,6 +1613,12 @@ struct InWarpTransposeRewritePattern
       maybeInGroupPerm = inGroupPerm;
     }
 
+    if (!maybeInGroupPerm.hasValue()) {
+      b.replaceOp(op, emitButterflies(loc, b, vector, laneId, groupSize,
+                                      totalSize));
+      return success();
+    }
+
     Value rotatedRight = emitRotations(loc, b, vector, laneId, Right, groupSize,
                                        totalSize, llvm::None);
     Value swizzled =
@@ -1310,23 +1626,323 @@ struct InWarpTransposeRewritePattern
     Value rotatedLeft = emitRotations(loc, b, swizzled, laneId, Left, groupSize,
                                       totalSize, maybeInGroupPerm);
 
-    op.replaceAllUsesWith(rotatedLeft);
-    op.erase();
+    b.replaceOp(op, rotatedLeft);
 
     return success();
   }
 };
 
+//===----------------------------------------------------------------------===//
+// WarpReduce and BlockwiseReduce lowering.
+//===----------------------------------------------------------------------===//
+/// Combines `lhs` and `rhs`, which are f32 or i32, with `method`.
+static Value combineReduced(OpBuilder &b, Location loc, ReduceMethod method,
+                            Value lhs, Value rhs) {
+  bool isFloat = lhs.getType().isa<FloatType>();
+  switch (method) {
+  case ReduceMethod::Sum:
+    return isFloat ? b.create<AddFOp>(loc, lhs, rhs).getResult()
+                   : b.create<AddIOp>(loc, lhs, rhs).getResult();
+  case ReduceMethod::Max:
+    return isFloat ? b.create<MaxFOp>(loc, lhs, rhs).getResult()
+                   : b.create<MaxSIOp>(loc, lhs, rhs).getResult();
+  case ReduceMethod::Min:
+    return isFloat ? b.create<MinFOp>(loc, lhs, rhs).getResult()
+                   : b.create<MinSIOp>(loc, lhs, rhs).getResult();
+  }
+  llvm_unreachable("unknown reduction method");
+}
+
+/// Reduces `input` across the `waveSize` lanes of the wave with a butterfly:
+/// at distance d each lane combines its value with the one of lane l ^ d, so
+/// that all lanes hold the result at the end. Distances 1 and 2 stay within
+/// rows of 4 lanes and use DPP quad permutes, 4 to 16 use ds_swizzle in its
+/// bit-mask mode, and the two halves of a wave64 are joined with readlanes.
+static Value emitWarpReduce(OpBuilder &b, Location loc, Value input,
+                            ReduceMethod method, uint32_t waveSize) {
+  Type type = input.getType();
+  Type i32 = b.getI32Type();
+  auto toI32 = [&](Value v) -> Value {
+    return type == i32 ? v : b.create<BitcastOp>(loc, i32, v).getResult();
+  };
+  auto fromI32 = [&](Value v) -> Value {
+    return type == i32 ? v : b.create<BitcastOp>(loc, type, v).getResult();
+  };
+
+  Value acc = input;
+  for (uint32_t d = 1; d < 4; d *= 2) {
+    SmallVector<int32_t, 4> partner;
+    for (uint32_t t = 0; t < 4; ++t)
+      partner.push_back(t ^ d);
+    Value moved = b.create<gpu::WarpSwizzleOp>(loc, i32, toI32(acc),
+                                               b.getI32ArrayAttr(partner));
+    acc = combineReduced(b, loc, method, acc, fromI32(moved));
+  }
+  for (uint32_t d = 4; d < 32; d *= 2) {
+    // and_mask = 0x1f, or_mask = 0, xor_mask = d
+    uint32_t pattern = 0x1f | (d << 10);
+    Value moved = b.create<amdgpu::DsSwizzleOp>(
+        loc, i32, toI32(acc), b.getI32IntegerAttr(pattern));
+    acc = combineReduced(b, loc, method, acc, fromI32(moved));
+  }
+  if (waveSize == 64) {
+    Value low = b.create<amdgpu::ReadlaneOp>(loc, i32, toI32(acc),
+                                             b.getI32IntegerAttr(0));
+    Value high = b.create<amdgpu::ReadlaneOp>(loc, i32, toI32(acc),
+                                              b.getI32IntegerAttr(32));
+    acc = combineReduced(b, loc, method, fromI32(low), fromI32(high));
+  }
+  return acc;
+}
+
+struct WarpReduceRewritePattern : public OpRewritePattern<WarpReduceOp> {
+  using OpRewritePattern<WarpReduceOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(WarpReduceOp op,
+                                PatternRewriter &b) const override {
+    b.replaceOp(op, emitWarpReduce(b, op.getLoc(), op.input(), op.method(),
+                                   op.waveSize()));
+    return success();
+  }
+};
+
+struct BlockwiseReduceRewritePattern
+    : public OpRewritePattern<BlockwiseReduceOp> {
+  using OpRewritePattern<BlockwiseReduceOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(BlockwiseReduceOp op,
+                                PatternRewriter &b) const override {
+    Location loc = op.getLoc();
+    ReduceMethod method = op.method();
+    uint32_t waveSize = op.waveSize();
+    uint32_t numWaves = op.blockSize() / waveSize;
+    Value reduced = emitWarpReduce(b, loc, op.input(), method, waveSize);
+    if (numWaves == 1) {
+      b.replaceOp(op, reduced);
+      return success();
+    }
+
+    // The first lane of each wave publishes the result of its wave.
+    Value tid = b.create<WorkitemIdOp>(loc, b.getIndexType());
+    Value waveSizeConst = b.create<ConstantIndexOp>(loc, waveSize);
+    Value zeroConst = b.create<ConstantIndexOp>(loc, 0);
+    Value lane = b.create<RemUIOp>(loc, tid, waveSizeConst);
+    Value wave = b.create<DivUIOp>(loc, tid, waveSizeConst);
+    Value isFirstLane =
+        b.create<CmpIOp>(loc, CmpIPredicate::eq, lane, zeroConst);
+    b.create<scf::IfOp>(loc, isFirstLane, [&](OpBuilder &nb, Location nloc) {
+      nb.create<memref::StoreOp>(nloc, reduced, op.workspace(), wave);
+      nb.create<scf::YieldOp>(nloc);
+    });
+    b.create<LDSBarrierOp>(loc);
+
+    Value acc = b.create<memref::LoadOp>(loc, op.workspace(), zeroConst);
+    for (uint32_t w = 1; w < numWaves; ++w) {
+      Value partial = b.create<memref::LoadOp>(
+          loc, op.workspace(), ValueRange{b.create<ConstantIndexOp>(loc, w)});
+      acc = combineReduced(b, loc, method, acc, partial);
+    }
+    // Let the workspace be overwritten as soon as the op is done.
+    b.create<LDSBarrierOp>(loc);
+    b.replaceOp(op, acc);
+    return success();
+  }
+};
+
+/// Unrolls `loop`, marked forceUnroll, in full unless that leaves more than
+/// `maxOps` ops in its place, 0 meaning no limit. It is then unrolled by the
+/// largest factor dividing its trip count that stays within the limit, which
+/// may leave it rolled. Inner loops are visited first, so an outer loop is
+/// measured with its inner loops as they end up.
+static LogicalResult unrollLoop(AffineForOp loop, int64_t maxOps) {
+  Optional<uint64_t> tripCount = getConstantTripCount(loop);
+  if (maxOps <= 0 || !tripCount)
+    return loopUnrollFull(loop);
+
+  int64_t bodyOps = 0;
+  loop.getBody()->walk([&](Operation *) { ++bodyOps; });
+  uint64_t factor = *tripCount;
+  while (factor > 1 && (static_cast<int64_t>(factor) * bodyOps > maxOps ||
+                        *tripCount % factor != 0))
+    --factor;
+  if (factor == *tripCount)
+    return loopUnrollFull(loop);
+  loop->removeAttr("forceUnroll");
+  if (factor == 1)
+    return success();
+  return loopUnrollByFactor(loop, factor);
+}
+
+/// If `v` advances by a constant step with each iteration of `loop`, being
+/// either an iteration argument of `loop` that is yielded plus that step or
+/// the sum that is yielded, returns the step and sets `first` to the value of
+/// `v` in the first iteration, which is built with `b`, before `loop`.
+static Optional<int64_t> matchLoopStep(OpBuilder &b, AffineForOp loop, Value v,
+                                       Value &first) {
+  Location loc = loop.getLoc();
+  Operation *yield = loop.getBody()->getTerminator();
+  auto getStep = [](Value sum, Value arg) -> Optional<int64_t> {
+    auto add = sum.getDefiningOp<AddIOp>();
+    if (!add)
+      return llvm::None;
+    if (add.getLhs() == arg)
+      return isConstantValue(add.getRhs());
+    if (add.getRhs() == arg)
+      return isConstantValue(add.getLhs());
+    return llvm::None;
+  };
+  for (auto arg : llvm::enumerate(loop.getRegionIterArgs())) {
+    Value yielded = yield->getOperand(arg.index());
+    if (v != arg.value() && v != yielded)
+      continue;
+    Optional<int64_t> step = getStep(yielded, arg.value());
+    if (!step)
+      continue;
+    first = loop.getIterOperands()[arg.index()];
+    if (v == yielded)
+      first = b.createOrFold<AddIOp>(loc, first,
+                                     b.create<ConstantIndexOp>(loc, *step));
+    return step;
+  }
+  return llvm::None;
+}
+
+/// Hoists the coordinate transforms of the transforming_for loops in the body
+/// of `loop` whose upper coordinates are invariant in `loop` except for some
+/// that advance by constant steps, as the global loads in the K loop of a
+/// gridwise GEMM do. Their lower coordinates are computed once, before `loop`,
+/// and carried through its iterations, each of which advances them with index
+/// diffs: a few additions, and the carries through Merge dimensions, instead
+/// of the whole transform. Those transforming_for loops are lowered here, with
+/// the coordinates carried.
+static LogicalResult hoistLoopCoordinates(AffineForOp loop) {
+  if (loop.getNumIterOperands() == 0)
+    return success();
+  SmallVector<TransformingForOp> candidates;
+  for (auto forOp : loop.getBody()->getOps<TransformingForOp>())
+    if (forOp.useIndexDiffs().getValueOr(false))
+      candidates.push_back(forOp);
+  if (candidates.empty())
+    return success();
+
+  Location loc = loop.getLoc();
+  IRRewriter b(loop.getContext());
+  b.setInsertionPoint(loop);
+
+  // A domain of a candidate whose coordinates are carried, with the steps of
+  // its upper coordinates and its lower coordinates in the first iteration.
+  struct CarriedDomain {
+    TransformingForOp op;
+    uint32_t domain;
+    ArrayAttr transforms;
+    SmallVector<int64_t, 8> steps;
+    LowerInits inits;
+  };
+  SmallVector<CarriedDomain> carriedDomains;
+  SmallVector<Value> carriedInits;
+  for (TransformingForOp forOp : candidates) {
+    for (uint32_t i = 0, e = forOp.domains(); i < e; ++i) {
+      ArrayAttr transforms = simplifyTransformChain(b, forOp.getTransforms(i));
+      if (transforms.empty())
+        continue;
+      SmallVector<Value, 8> firstUpper;
+      SmallVector<int64_t, 8> steps;
+      bool matched = true, advances = false;
+      for (Value upper : forOp.getUpperInits(i)) {
+        Value first = upper;
+        Optional<int64_t> step = 0;
+        if (!loop.isDefinedOutsideOfLoop(upper))
+          step = matchLoopStep(b, loop, upper, first);
+        if (!step) {
+          matched = false;
+          break;
+        }
+        advances |= *step != 0;
+        firstUpper.push_back(first);
+        steps.push_back(*step);
+      }
+      // Loop-invariant coordinates are left to loop invariant code motion
+      if (!matched || !advances)
+        continue;
+      Optional<LowerInits> inits =
+          computeLowerInits(b, loc, transforms, firstUpper);
+      if (!inits)
+        return failure();
+      for (const SmallVector<Value, 8> &layer : *inits)
+        carriedInits.append(layer.begin(), layer.end());
+      carriedDomains.push_back(
+          {forOp, i, transforms, std::move(steps), std::move(*inits)});
+    }
+  }
+  if (carriedDomains.empty())
+    return success();
+
+  // What the carried coordinates advance to is only known once they are
+  // arguments of the loop, so the loop yields their initial values until then.
+  unsigned nOldArgs = loop.getNumIterOperands();
+  AffineForOp newLoop = replaceForOpWithNewYields(
+      b, loop, carriedInits, /*newYieldedValues=*/carriedInits,
+      /*newIterArgs=*/carriedInits);
+  loop.erase();
+  Operation *yield = newLoop.getBody()->getTerminator();
+  ValueRange carried = newLoop.getRegionIterArgs().drop_front(nOldArgs);
+
+  unsigned nextCarried = 0;
+  auto domainIt = carriedDomains.begin();
+  for (TransformingForOp forOp : candidates) {
+    SmallVector<Optional<LowerInits>, 2> hoistedInits(forOp.domains());
+    for (; domainIt != carriedDomains.end() && domainIt->op == forOp;
+         ++domainIt) {
+      b.setInsertionPoint(yield);
+      SmallVector<Value, 8> diffs;
+      for (int64_t step : domainIt->steps)
+        diffs.push_back(b.create<ConstantIndexOp>(loc, step));
+      LowerInits inits;
+      ValueRange upperDiffs = diffs;
+      for (auto p : llvm::zip(
+               domainIt->transforms.getAsRange<TransformMapAttr>(),
+               domainIt->inits)) {
+        ValueRange layer = carried.slice(nextCarried, std::get<1>(p).size());
+        auto update = b.create<IndexDiffUpdateOp>(loc, std::get<0>(p),
+                                                  upperDiffs, layer);
+        for (auto next : llvm::enumerate(update.lowerIndices()))
+          yield->setOperand(nOldArgs + nextCarried + next.index(),
+                            next.value());
+        upperDiffs = update.lowerDiff();
+        nextCarried += layer.size();
+        inits.emplace_back(layer.begin(), layer.end());
+      }
+      hoistedInits[domainIt->domain] = std::move(inits);
+    }
+    b.setInsertionPoint(forOp);
+    if (failed(lowerTransformingFor(forOp, b, hoistedInits)))
+      return failure();
+  }
+  return success();
+}
+
 void MIOpenSugarToLoopsPass::runOnOperation() {
   MLIRContext *ctx = &getContext();
   func::FuncOp op = getOperation();
   RewritePatternSet patterns(ctx);
   patterns.add<TransformingForRewritePattern, ExtractSliceRewritePattern,
                InsertSliceRewritePattern, BufferLoadRewritePattern,
+               BufferLoadToLdsRewritePattern,
                BufferStoreRewritePattern, InBoundsLoadRewritePattern,
-               InBoundsStoreRewritePattern, InWarpTransposeRewritePattern>(ctx);
-  if (failed(applyPatternsAndFoldGreedily(getOperation(), std::move(patterns))))
-    signalPassFailure();
+               InBoundsStoreRewritePattern, InWarpTransposeRewritePattern,
+               WarpReduceRewritePattern, BlockwiseReduceRewritePattern>(ctx);
+  // Carry the coordinates of the loads of K loops through their iterations
+  // before the patterns lower those loads along with everything else
+  SmallVector<AffineForOp> loops;
+  op.walk([&](AffineForOp loop) { loops.push_back(loop); });
+  for (AffineForOp loop : loops)
+    if (failed(hoistLoopCoordinates(loop)))
+      return signalPassFailure();
+
+  // Each of these ops expands once. Folding is left to the greedy rewrite
+  // after unrolling, which has to fold the unrolled loops anyway.
+  if (failed(applyPatternsInOrder(op, std::move(patterns))))
+    return signalPassFailure();
 
   // Apply loop invariant code motion to all loops before unrolling
   WalkResult licmResult =
@@ -1342,13 +1958,13 @@ void MIOpenSugarToLoopsPass::runOnOperation() {
   // 2) If we make it a seperate pass, canonicizers might remove the
   // forceUnroll attribute we've used
   WalkResult unrollResult =
-      op.walk<WalkOrder::PostOrder>([](AffineForOp loop) -> WalkResult {
+      op.walk<WalkOrder::PostOrder>([&](AffineForOp loop) -> WalkResult {
         Attribute forceUnrollAttr = loop->getAttr("forceUnroll");
         if (!forceUnrollAttr)
           return WalkResult::advance();
         // Since this is a post-order walk through a perfect loop nest, the
         // first loop we see is innermost and therefore unrollable
-        if (failed(mlir::loopUnrollFull(loop)))
+        if (failed(unrollLoop(loop, maxUnrolledOps)))
           return WalkResult::interrupt();
         return WalkResult::advance();
       });
@@ -1378,6 +1994,7 @@ void MIOpenSugarToLoopsPass::runOnOperation() {
 }
 } // end anonymous namespace
 
-std::unique_ptr<Pass> mlir::miopen::createMIOpenSugarToLoopsPass() {
-  return std::make_unique<MIOpenSugarToLoopsPass>();
+std::unique_ptr<Pass>
+mlir::miopen::createMIOpenSugarToLoopsPass(int64_t maxUnrolledOps) {
+  return std::make_unique<MIOpenSugarToLoopsPass>(maxUnrolledOps);
 }
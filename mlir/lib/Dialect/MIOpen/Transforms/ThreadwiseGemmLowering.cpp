@@ -72,18 +72,38 @@ struct ThreadwiseGemmRewritePattern
     Value gemmC = adaptor.matrixC();
     auto gemmAType = gemmA.getType().cast<MemRefType>();
     Type dataType = gemmAType.getElementType();
+    Type accType = gemmC.getType().cast<MemRefType>().getElementType();
 
     ArrayRef<int64_t> aShape = gemmAType.getShape();
     int64_t k = aShape[0];
     int64_t m = aShape[1];
     int64_t kPack = aShape[2];
     int64_t n = gemmB.getType().cast<MemRefType>().getShape()[1];
+
+    // When the inputs are narrower than the accumulator and the chip has a
+    // packed dot instruction for them, reduce dotWidth consecutive elements
+    // at once: along kpack if it holds whole dot products, along k if there
+    // is no kpack.
+    int64_t dotWidth = 1;
+    if (dataType != accType) {
+      StringRef arch;
+      if (auto archAttr = op->getAttrOfType<StringAttr>("arch"))
+        arch = archAttr.getValue();
+      dotWidth = getDotProductWidth(dataType, arch);
+      if (kPack % dotWidth != 0 && (kPack != 1 || k % dotWidth != 0))
+        dotWidth = 1;
+    }
+    size_t dotDim = (kPack % dotWidth == 0) ? 3 : 0;
+
     LLVM_DEBUG(llvm::dbgs() << "Threadwise gemm:\n"
                             << "k = " << k << "\n"
                             << "m = " << m << "\n"
                             << "n = " << n << "\n"
-                            << "kPack = " << kPack << "\n");
+                            << "kPack = " << kPack << "\n"
+                            << "dotWidth = " << dotWidth << "\n");
     SmallVector<int64_t> dimensions = {k, m, n, kPack};
+    SmallVector<int64_t> strides = {1, 1, 1, 1};
+    strides[dotDim] = dotWidth;
 
     TopDownTMBuilder aView(b, {"k", "m", "n", "kpack"}, dimensions, loc);
     aView.ignore("n");
@@ -110,35 +130,74 @@ struct ThreadwiseGemmRewritePattern
     std::tie(bufferB, bTransforms) = untransform(b, gemmB, {bViewAttr});
     std::tie(bufferC, cTransforms) = untransform(b, gemmC, {cViewAttr});
 
+    // Element i of the dot products of an iteration is read through domains
+    // i (A) and dotWidth + i (B), which start i elements along dotDim. The
+    // last domain writes C.
+    SmallVector<SmallVector<Value, 5>> inputStartCoords;
+    for (int64_t i = 0; i < dotWidth; ++i) {
+      inputStartCoords.push_back(startCoords);
+      inputStartCoords.back()[dotDim] =
+          b.createOrFold<arith::ConstantIndexOp>(loc, i);
+    }
+    SmallVector<ValueRange> inits;
+    SmallVector<Attribute> transforms;
+    for (ArrayAttr inputTransforms : {aTransforms, bTransforms}) {
+      for (int64_t i = 0; i < dotWidth; ++i) {
+        inits.push_back(inputStartCoords[i]);
+        transforms.push_back(inputTransforms);
+      }
+    }
+    inits.push_back(startCoords);
+    transforms.push_back(cTransforms);
+
     auto gemmLoop = b.replaceOpWithNewOp<TransformingForOp>(
-        op, ArrayRef<ValueRange>{startCoords, startCoords, startCoords},
-        ArrayRef<Attribute>{aTransforms, bTransforms, cTransforms}, dimensions,
-        /*strides=*/llvm::None, /*forceUnroll=*/true, /*useIndexDiffs=*/false);
+        op, inits, transforms, dimensions, ArrayRef<int64_t>(strides),
+        /*forceUnroll=*/true, /*useIndexDiffs=*/false);
 
     {
       OpBuilder::InsertionGuard guard(b);
       b.setInsertionPointToStart(gemmLoop.getBody());
-      Value aVal = b.create<InBoundsLoadOp>(
-          loc, dataType, bufferA, gemmLoop.getLowerCoords(/*domain=*/0));
-      Value bVal = b.create<InBoundsLoadOp>(
-          loc, dataType, bufferB, gemmLoop.getLowerCoords(/*domain=*/1));
-      Value mul;
-      if (dataType.isa<IntegerType>())
-        mul = b.create<MulIOp>(loc, aVal, bVal);
-      else if (dataType.isa<FloatType>())
-        mul = b.create<MulFOp>(loc, aVal, bVal);
-      else
-        llvm_unreachable("Validation should make this ints or floats only");
-
-      ValueRange cCoords = gemmLoop.getLowerCoords(/*domain=*/2);
-      Value cVal = b.create<InBoundsLoadOp>(loc, dataType, bufferC, cCoords);
+      auto loadInput = [&](Value buffer, uint32_t firstDomain) -> Value {
+        if (dotWidth == 1)
+          return b.create<InBoundsLoadOp>(
+              loc, dataType, buffer, gemmLoop.getLowerCoords(firstDomain));
+        auto vectorType = VectorType::get({dotWidth}, dataType);
+        Value ret = createZeroConstantOp(b, loc, vectorType);
+        for (int64_t i = 0; i < dotWidth; ++i) {
+          Value v = b.create<InBoundsLoadOp>(
+              loc, dataType, buffer, gemmLoop.getLowerCoords(firstDomain + i));
+          Value pos = b.createOrFold<arith::ConstantIndexOp>(loc, i);
+          ret = b.create<vector::InsertElementOp>(loc, v, ret, pos);
+        }
+        return ret;
+      };
+      Value aVal = loadInput(bufferA, /*firstDomain=*/0);
+      Value bVal = loadInput(bufferB, /*firstDomain=*/dotWidth);
+
+      ValueRange cCoords = gemmLoop.getLowerCoords(/*domain=*/2 * dotWidth);
+      Value cVal = b.create<InBoundsLoadOp>(loc, accType, bufferC, cCoords);
       Value add;
-      if (dataType.isa<IntegerType>())
-        add = b.create<AddIOp>(loc, mul, cVal);
-      else if (dataType.isa<FloatType>())
-        add = b.create<AddFOp>(loc, mul, cVal);
-      else
-        llvm_unreachable("Very serously can't happen");
+      if (dotWidth > 1) {
+        add = b.create<amdgpu::DotOp>(loc, accType, aVal, bVal, cVal,
+                                      /*clamp=*/UnitAttr());
+      } else {
+        aVal = createTypeConversionOp(b, loc, aVal, accType);
+        bVal = createTypeConversionOp(b, loc, bVal, accType);
+        Value mul;
+        if (accType.isa<IntegerType>())
+          mul = b.create<MulIOp>(loc, aVal, bVal);
+        else if (accType.isa<FloatType>())
+          mul = b.create<MulFOp>(loc, aVal, bVal);
+        else
+          llvm_unreachable("Validation should make this ints or floats only");
+
+        if (accType.isa<IntegerType>())
+          add = b.create<AddIOp>(loc, mul, cVal);
+        else if (accType.isa<FloatType>())
+          add = b.create<AddFOp>(loc, mul, cVal);
+        else
+          llvm_unreachable("Very serously can't happen");
+      }
 
       b.create<InBoundsStoreOp>(loc, add, bufferC, cCoords);
     }
@@ -149,6 +208,34 @@ struct ThreadwiseGemmRewritePattern
 //===----------------------------------------------------------------------===//
 // XdlopsGemmV2 lowering.
 //===----------------------------------------------------------------------===//
+
+// Split `dense`, the K values of A a lane passes to a sparse MFMA, into the
+// operands of the instruction. -miopen-fold-constant-weights stores each
+// group of 4 weights as its 2 kept values, the raw bits of their indices in
+// the group and a 0, so the values are the first half of each group and the
+// indices of group g go to bits 4 * g to 4 * g + 3 of `indices`.
+static void splitSparseOperand(OpBuilder &b, Location loc, Value dense,
+                               Value &values, Value &indices) {
+  auto denseType = dense.getType().cast<VectorType>();
+  Type elementType = denseType.getElementType();
+  Type bitsType = b.getIntegerType(elementType.getIntOrFloatBitWidth());
+  int64_t numGroups = denseType.getNumElements() / 4;
+
+  SmallVector<int64_t, 8> mask;
+  indices = b.create<ConstantIntOp>(loc, 0, 32);
+  for (int64_t g = 0; g < numGroups; ++g) {
+    mask.push_back(4 * g);
+    mask.push_back(4 * g + 1);
+    Value bits = b.create<vector::ExtractOp>(loc, dense, 4 * g + 2);
+    if (bits.getType() != bitsType)
+      bits = b.create<BitcastOp>(loc, bitsType, bits);
+    bits = b.create<ExtUIOp>(loc, b.getI32Type(), bits);
+    bits = b.create<ShLIOp>(loc, bits, b.create<ConstantIntOp>(loc, 4 * g, 32));
+    indices = b.create<OrIOp>(loc, indices, bits);
+  }
+  values = b.create<vector::ShuffleOp>(loc, dense, dense, mask);
+}
+
 struct XdlopsGemmV2RewritePattern : public OpConversionPattern<XdlopsGemmV2Op> {
   using OpConversionPattern<XdlopsGemmV2Op>::OpConversionPattern;
 
@@ -179,13 +266,24 @@ struct XdlopsGemmV2RewritePattern : public OpConversionPattern<XdlopsGemmV2Op> {
                             << "MPerWave: " << MPerWave << "\n"
                             << "NPerWave: " << NPerWave << "\n");
 
-    XdlopsCodeSelection xcs =
-        XdlopsCodeSelection::get(dataType, MPerWave, NPerWave, b);
+    StringRef arch;
+    if (auto archAttr = op->getAttrOfType<StringAttr>("arch"))
+      arch = archAttr.getValue();
+    FailureOr<XdlopsCodeSelection> maybeXcs = XdlopsCodeSelection::get(
+        dataType, MPerWave, NPerWave, arch, obtainFp8Format(op),
+        op->hasAttr("xf32"), op->hasAttr("sparse"));
+    if (failed(maybeXcs))
+      return op.emitOpError("no XDLOPS instruction for a ")
+             << MPerWave << "x" << NPerWave << " wave tile of " << dataType;
+    XdlopsCodeSelection xcs = *maybeXcs;
 
     // Extract values from XdlopsCodeSelection.
     amdgpu::MFMAInstr mfmaInstr = xcs.instr;
     LLVM_DEBUG(llvm::dbgs() << "Selected xdlop: "
-                            << amdgpu::stringifyMFMAInstr(mfmaInstr) << "\n");
+                            << (xcs.isWmma
+                                    ? StringRef("wmma")
+                                    : amdgpu::stringifyMFMAInstr(mfmaInstr))
+                            << "\n");
 
     VectorType vectorType = xcs.vectorType;
     int64_t vectorNumber = xcs.vectorNumber;
@@ -193,10 +291,9 @@ struct XdlopsGemmV2RewritePattern : public OpConversionPattern<XdlopsGemmV2Op> {
     Type argType = xcs.argType;
 
     int64_t num_input_blks = xcs.num_input_blks;
-    int64_t num_output_blks = xcs.num_output_blks;
     int64_t k_base = xcs.k_base;
 
-    bool IsKReduction = (num_output_blks == 1) && (num_input_blks > 1);
+    bool IsKReduction = xcs.isKReduction;
 
     Value bufferA = adaptor.bufferA();
     Value bufferB = adaptor.bufferB();
@@ -294,9 +391,26 @@ struct XdlopsGemmV2RewritePattern : public OpConversionPattern<XdlopsGemmV2Op> {
                                                innerLoopiv);
     }
 
+    // A sparse A only passes its kept values, with their indices.
+    Value sparseIdx;
+    if (xcs.isSparse)
+      splitSparseOperand(innerLoopb, loc, argA, argA, sparseIdx);
+
     SmallVector<Value, 4> mfmas;
     for (int64_t i = 0; i < vectorNumber; ++i) {
       auto vectorC = innerLoop.getRegionIterArgs()[i];
+      if (xcs.isSparse) {
+        mfmas.push_back(innerLoopb.create<amdgpu::SparseMFMAOp>(
+            loc, vectorType, argA, argB, vectorC, sparseIdx,
+            /*cbsz=*/imms[i][0], /*abid=*/imms[i][1]));
+        continue;
+      }
+      if (xcs.isWmma) {
+        mfmas.push_back(innerLoopb.create<amdgpu::WMMAOp>(
+            loc, vectorType, argA, argB, vectorC, /*unsignedA=*/false,
+            /*unsignedB=*/false, /*clamp=*/false));
+        continue;
+      }
       auto mfma = innerLoopb.create<amdgpu::MFMAOp>(
           loc, vectorType, mfmaInstr, argA, argB, vectorC,
           /*cbsz=*/imms[i][0], /*abid=*/imms[i][1], /*blgp=*/imms[i][2]);
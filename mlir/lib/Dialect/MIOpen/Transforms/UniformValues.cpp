@@ -0,0 +1,376 @@
+//===- UniformValues.cpp - Keep wave-uniform address math scalar ---------===//
+//
+// Copyright 2022 The MLIR Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+//
+// This pass finds the values of lowered kernels that are the same for all the
+// workitems of a wave, such as the offsets of a workgroup's tiles, the
+// iteration of the main loop or a bias loaded for the K of a workgroup, and
+// rearranges the index arithmetic mixing them with workitem IDs so that the
+// backend computes them on the scalar unit:
+// - sums of uniform and divergent terms are reassociated so that the uniform
+//   terms are summed first, in SGPRs, and added to the rest by a single VALU
+//   add,
+// - the uniform terms of the indices of buffer loads and stores are moved to
+//   their SGPR offset (soffset), so that the per-lane offset (voffset) only
+//   holds what differs between lanes.
+//
+// The backend keeps values it sees as uniform in SGPRs by itself; what it
+// cannot do is split a per-lane value into its uniform and divergent parts.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetail.h"
+
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/ControlFlow/IR/ControlFlowOps.h"
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/IR/Matchers.h"
+#include "mlir/Interfaces/ControlFlowInterfaces.h"
+#include "mlir/Interfaces/SideEffectInterfaces.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+
+using namespace mlir;
+
+namespace {
+struct MIOpenUniformValuesPass
+    : public MIOpenUniformValuesPassBase<MIOpenUniformValuesPass> {
+  void runOnOperation() override;
+};
+
+/// Which values of a gpu.func are uniform, the same for all the active
+/// workitems of a wave. Divergence starts at workitem IDs, at loads from
+/// private memory and at ops the analysis does not know, and flows to the
+/// users of divergent values and to the block arguments they are passed to.
+/// A branch on a divergent condition makes the block arguments, and the
+/// loads, of every block it reaches divergent, since workitems may get there
+/// along different paths or after different iterations of a loop.
+class UniformityAnalysis {
+public:
+  explicit UniformityAnalysis(gpu::GPUFuncOp func);
+
+  bool isUniform(Value value) const { return !divergent.contains(value); }
+
+  /// Record that `value`, created after the analysis ran, is divergent.
+  void markDivergent(Value value);
+
+private:
+  void markBlockDivergent(Block *block);
+  void propagate();
+
+  llvm::DenseSet<Value> divergent;
+  llvm::DenseSet<Block *> divergentBlocks;
+  SmallVector<Value> worklist;
+};
+} // end anonymous namespace
+
+/// Tell if `op` loads from memory that is not private to each workitem.
+static bool isSharedLoad(Operation *op) {
+  Value memref;
+  if (auto load = dyn_cast<memref::LoadOp>(op))
+    memref = load.memref();
+  else if (auto load = dyn_cast<vector::LoadOp>(op))
+    memref = load.getBase();
+  else if (auto load = dyn_cast<vector::TransferReadOp>(op))
+    memref = load.getSource();
+  else if (auto load = dyn_cast<amdgpu::RawBufferLoadOp>(op))
+    memref = load.getMemref();
+  else
+    return false;
+  auto type = memref.getType().dyn_cast<MemRefType>();
+  return type && type.getMemorySpaceAsInt() !=
+                     gpu::GPUDialect::getPrivateAddressSpace();
+}
+
+/// Tell if the results of `op` are uniform when its operands are.
+static bool preservesUniformity(Operation *op) {
+  if (isa<gpu::ThreadIdOp, gpu::LaneIdOp>(op) || op->getNumRegions() != 0)
+    return false;
+  if (isSharedLoad(op))
+    return true;
+  auto effects = dyn_cast<MemoryEffectOpInterface>(op);
+  return effects && effects.hasNoEffect();
+}
+
+UniformityAnalysis::UniformityAnalysis(gpu::GPUFuncOp func) {
+  func.walk([&](Operation *op) {
+    if (op->getNumResults() != 0 && !preservesUniformity(op))
+      for (Value result : op->getResults())
+        markDivergent(result);
+  });
+  propagate();
+}
+
+void UniformityAnalysis::markDivergent(Value value) {
+  if (divergent.insert(value).second)
+    worklist.push_back(value);
+}
+
+void UniformityAnalysis::markBlockDivergent(Block *block) {
+  SmallVector<Block *> blocks = {block};
+  while (!blocks.empty()) {
+    Block *current = blocks.pop_back_val();
+    if (!divergentBlocks.insert(current).second)
+      continue;
+    for (BlockArgument arg : current->getArguments())
+      markDivergent(arg);
+    for (Operation &op : *current)
+      if (isSharedLoad(&op))
+        for (Value result : op.getResults())
+          markDivergent(result);
+    for (Block *succ : current->getSuccessors())
+      blocks.push_back(succ);
+  }
+}
+
+void UniformityAnalysis::propagate() {
+  while (!worklist.empty()) {
+    Value value = worklist.pop_back_val();
+    for (OpOperand &use : value.getUses()) {
+      Operation *user = use.getOwner();
+      auto branch = dyn_cast<BranchOpInterface>(user);
+      if (!branch) {
+        for (Value result : user->getResults())
+          markDivergent(result);
+        continue;
+      }
+      bool forwarded = false;
+      for (unsigned i = 0, e = user->getNumSuccessors(); i < e; ++i) {
+        SuccessorOperands operands = branch.getSuccessorOperands(i);
+        OperandRange forwardedOperands = operands.getForwardedOperands();
+        if (forwardedOperands.empty())
+          continue;
+        unsigned begin = forwardedOperands.getBeginOperandIndex();
+        unsigned number = use.getOperandNumber();
+        if (number < begin || number >= begin + forwardedOperands.size())
+          continue;
+        markDivergent(user->getSuccessor(i)->getArgument(
+            operands.getProducedOperandCount() + number - begin));
+        forwarded = true;
+      }
+      // Anything else a branch uses decides where it goes.
+      if (!forwarded)
+        for (Block *succ : user->getSuccessors())
+          markBlockDivergent(succ);
+    }
+  }
+}
+
+/// Tell if the index or integer `value` is known to be non-negative, which
+/// holds for IDs, sizes and the sums, products and quotients of such values
+/// in the address arithmetic of lowered kernels. Loop induction variables are
+/// assumed non-negative while their incoming values are checked.
+static bool isNonNegative(Value value, llvm::DenseMap<Value, bool> &known) {
+  APInt constant;
+  if (matchPattern(value, m_ConstantInt(&constant)))
+    return !constant.isNegative();
+  if (auto arg = value.dyn_cast<BlockArgument>()) {
+    auto it = known.find(value);
+    if (it != known.end())
+      return it->second;
+    known[value] = true;
+    auto incomingNonNegative = [&]() {
+      Block *block = arg.getOwner();
+      if (block->isEntryBlock())
+        return false;
+      for (Block *pred : block->getPredecessors()) {
+        auto branch = dyn_cast<BranchOpInterface>(pred->getTerminator());
+        if (!branch)
+          return false;
+        for (unsigned i = 0, e = branch->getNumSuccessors(); i < e; ++i) {
+          if (branch->getSuccessor(i) != block)
+            continue;
+          SuccessorOperands operands = branch.getSuccessorOperands(i);
+          if (arg.getArgNumber() < operands.getProducedOperandCount() ||
+              !isNonNegative(operands[arg.getArgNumber()], known))
+            return false;
+        }
+      }
+      return true;
+    };
+    bool result = incomingNonNegative();
+    known[value] = result;
+    return result;
+  }
+  Operation *op = value.getDefiningOp();
+  if (isa<gpu::ThreadIdOp, gpu::BlockIdOp, gpu::BlockDimOp, gpu::GridDimOp,
+          gpu::LaneIdOp>(op))
+    return true;
+  auto nonNegative = [&](Value operand) {
+    return isNonNegative(operand, known);
+  };
+  if (auto select = dyn_cast<arith::SelectOp>(op))
+    return nonNegative(select.getTrueValue()) &&
+           nonNegative(select.getFalseValue());
+  if (isa<arith::AddIOp, arith::MulIOp, arith::DivUIOp, arith::DivSIOp,
+          arith::RemUIOp, arith::RemSIOp, arith::ShRUIOp, arith::MinSIOp,
+          arith::IndexCastOp>(op))
+    return llvm::all_of(op->getOperands(), nonNegative);
+  if (isa<arith::MaxSIOp, arith::AndIOp>(op))
+    return llvm::any_of(op->getOperands(), nonNegative);
+  return false;
+}
+
+static bool isNonNegative(Value value) {
+  llvm::DenseMap<Value, bool> known;
+  return isNonNegative(value, known);
+}
+
+/// Gather the terms of the sum `add` through the additions of its tree that
+/// have no other use.
+static void collectTerms(arith::AddIOp add, SmallVectorImpl<Value> &terms,
+                         SmallVectorImpl<Operation *> &nodes) {
+  nodes.push_back(add);
+  for (Value operand : add->getOperands()) {
+    auto inner = operand.getDefiningOp<arith::AddIOp>();
+    if (inner && inner->hasOneUse() && inner->getBlock() == add->getBlock())
+      collectTerms(inner, terms, nodes);
+    else
+      terms.push_back(operand);
+  }
+}
+
+/// Rewrite the divergent sum `add` as the sum of its uniform terms, added to
+/// that of its divergent terms.
+static void reassociateSum(arith::AddIOp add, UniformityAnalysis &analysis) {
+  SmallVector<Value> terms;
+  SmallVector<Operation *> nodes;
+  collectTerms(add, terms, nodes);
+  SmallVector<Value> uniform, divergent;
+  for (Value term : terms)
+    (analysis.isUniform(term) ? uniform : divergent).push_back(term);
+  // Nothing to gain unless uniform terms are added to divergent values.
+  if (uniform.empty() || divergent.empty() ||
+      llvm::all_of(uniform, [&](Value term) {
+        return llvm::is_contained(add->getOperands(), term);
+      }))
+    return;
+
+  OpBuilder b(add);
+  Location loc = add.getLoc();
+  auto sum = [&](ArrayRef<Value> values, bool isDivergent) {
+    Value result = values.front();
+    for (Value value : values.drop_front()) {
+      result = b.create<arith::AddIOp>(loc, result, value);
+      if (isDivergent)
+        analysis.markDivergent(result);
+    }
+    return result;
+  };
+  Value uniformSum = sum(uniform, /*isDivergent=*/false);
+  Value divergentSum = sum(divergent, /*isDivergent=*/true);
+  Value result = b.create<arith::AddIOp>(loc, uniformSum, divergentSum);
+  analysis.markDivergent(result);
+  add.getResult().replaceAllUsesWith(result);
+  for (Operation *node : nodes)
+    node->erase();
+}
+
+/// Move the uniform, non-negative terms of the indices of the buffer access
+/// `op` to its SGPR offset. Dimension 0 is left alone, since out of bounds
+/// accesses are sent out of the buffer through it and the SGPR offset is not
+/// part of the bounds checks of every chipset.
+template <typename BufferOp>
+static void moveUniformOffsets(BufferOp op, UniformityAnalysis &analysis) {
+  if (op.getSgprOffset())
+    return;
+  auto type = op.getMemref().getType().template cast<MemRefType>();
+  SmallVector<int64_t> strides;
+  int64_t offset;
+  if (failed(getStridesAndOffset(type, strides, offset)))
+    return;
+
+  OpBuilder b(op);
+  Location loc = op.getLoc();
+  Type i32Type = b.getI32Type();
+  Value sgprOffset;
+  SmallVector<Value> indices(op.getIndices());
+  for (unsigned i = 1, e = indices.size(); i < e; ++i) {
+    if (ShapedType::isDynamicStrideOrOffset(strides[i]))
+      continue;
+    auto cast = indices[i].template getDefiningOp<arith::IndexCastOp>();
+    if (!cast)
+      continue;
+    Value index = cast.getIn();
+    Value uniform, divergent;
+    if (analysis.isUniform(index)) {
+      uniform = index;
+    } else if (auto add = index.getDefiningOp<arith::AddIOp>()) {
+      uniform = add.getLhs();
+      divergent = add.getRhs();
+      if (!analysis.isUniform(uniform))
+        std::swap(uniform, divergent);
+      if (!analysis.isUniform(uniform) || analysis.isUniform(divergent) ||
+          !isNonNegative(divergent))
+        continue;
+    } else {
+      continue;
+    }
+    if (!isNonNegative(uniform))
+      continue;
+
+    Value term = b.create<arith::MulIOp>(
+        loc, b.create<arith::IndexCastOp>(loc, i32Type, uniform),
+        b.create<arith::ConstantIntOp>(loc, strides[i], i32Type));
+    sgprOffset =
+        sgprOffset ? b.create<arith::AddIOp>(loc, sgprOffset, term) : term;
+    if (divergent) {
+      indices[i] = b.create<arith::IndexCastOp>(loc, i32Type, divergent);
+      analysis.markDivergent(indices[i]);
+    } else {
+      indices[i] = b.create<arith::ConstantIntOp>(loc, 0, i32Type);
+    }
+  }
+  if (!sgprOffset)
+    return;
+  op.getIndicesMutable().assign(indices);
+  op.getSgprOffsetMutable().assign(sgprOffset);
+}
+
+void MIOpenUniformValuesPass::runOnOperation() {
+  getOperation().walk([](gpu::GPUFuncOp func) {
+    UniformityAnalysis analysis(func);
+
+    // Only the roots of sum trees are rewritten; the additions inside them
+    // are erased with them.
+    SmallVector<arith::AddIOp> sums;
+    func.walk([&](arith::AddIOp add) {
+      bool isInner = add->hasOneUse() &&
+                     isa<arith::AddIOp>(*add->user_begin()) &&
+                     (*add->user_begin())->getBlock() == add->getBlock();
+      if (!isInner && !analysis.isUniform(add) &&
+          !add.getType().isa<VectorType>())
+        sums.push_back(add);
+    });
+    for (arith::AddIOp add : sums)
+      reassociateSum(add, analysis);
+
+    func.walk([&](Operation *op) {
+      if (auto load = dyn_cast<amdgpu::RawBufferLoadOp>(op))
+        moveUniformOffsets(load, analysis);
+      else if (auto store = dyn_cast<amdgpu::RawBufferStoreOp>(op))
+        moveUniformOffsets(store, analysis);
+      else if (auto atomic = dyn_cast<amdgpu::RawBufferAtomicFaddOp>(op))
+        moveUniformOffsets(atomic, analysis);
+    });
+  });
+}
+
+std::unique_ptr<Pass> mlir::miopen::createMIOpenUniformValuesPass() {
+  return std::make_unique<MIOpenUniformValuesPass>();
+}
@@ -0,0 +1,353 @@
+#include "mlir/Dialect/MIOpen/Tuning/BinaryPerfDb.h"
+#include "mlir/Dialect/MIOpen/Tuning/Serializable.h"
+
+#if __MLIR_ENABLE_SQLITE__
+#include "mlir/Dialect/MIOpen/Tuning/ConvContext.h"
+#include "mlir/Dialect/MIOpen/Tuning/SqliteDb.h"
+#include "mlir/IR/MLIRContext.h"
+#endif // MLIR_ENABLE_SQLITE
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/EndianStream.h"
+
+#include <algorithm>
+#include <mutex>
+#include <tuple>
+
+using namespace mlir;
+using namespace mlir::miopen;
+using llvm::dbgs;
+
+#define DEBUG_TYPE "miopen-binary-perfdb"
+
+static constexpr char kMagic[8] = {'M', 'I', 'I', 'R', 'P', 'D', 'B', '1'};
+static constexpr size_t kHeaderSize = sizeof(kMagic) + 2 * sizeof(uint32_t);
+static constexpr size_t kFieldsPerEntry = 6;
+static constexpr size_t kEntrySize = kFieldsPerEntry * sizeof(uint32_t);
+
+static uint32_t readU32(const char *ptr) {
+  return llvm::support::endian::read32le(ptr);
+}
+
+std::unique_ptr<BinaryPerfDb> BinaryPerfDb::open(llvm::StringRef path) {
+  auto bufferOrErr = llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                                 /*RequiresNullTerminator=*/
+                                                 false);
+  if (!bufferOrErr) {
+    LLVM_DEBUG(dbgs() << "Could not open binary perf db " << path << ": "
+                      << bufferOrErr.getError().message() << "\n");
+    return nullptr;
+  }
+  std::unique_ptr<llvm::MemoryBuffer> buffer = std::move(*bufferOrErr);
+  llvm::StringRef data = buffer->getBuffer();
+  if (data.size() < kHeaderSize ||
+      !data.startswith(llvm::StringRef(kMagic, sizeof(kMagic)))) {
+    LLVM_DEBUG(dbgs() << path << " is not a binary perf db\n");
+    return nullptr;
+  }
+
+  size_t numEntries = readU32(data.data() + sizeof(kMagic));
+  size_t blobSize = readU32(data.data() + sizeof(kMagic) + sizeof(uint32_t));
+  if (data.size() != kHeaderSize + numEntries * kEntrySize + blobSize) {
+    LLVM_DEBUG(dbgs() << "Binary perf db " << path << " is truncated\n");
+    return nullptr;
+  }
+  const char *entries = data.data() + kHeaderSize;
+  llvm::StringRef blob = data.substr(kHeaderSize + numEntries * kEntrySize);
+
+  // Validate every string reference once so lookups need no bounds checks.
+  for (size_t i = 0; i < numEntries * kFieldsPerEntry; i += 2) {
+    uint64_t offset = readU32(entries + i * sizeof(uint32_t));
+    uint64_t size = readU32(entries + (i + 1) * sizeof(uint32_t));
+    if (offset + size > blob.size()) {
+      LLVM_DEBUG(dbgs() << "Binary perf db " << path << " is corrupt\n");
+      return nullptr;
+    }
+  }
+
+  LLVM_DEBUG(dbgs() << "Loaded " << numEntries
+                    << " entries from binary perf db " << path << "\n");
+  std::unique_ptr<BinaryPerfDb> db(
+      new BinaryPerfDb(std::move(buffer), numEntries, entries, blob));
+  db->indexNumCus();
+  return db;
+}
+
+const BinaryPerfDb *BinaryPerfDb::getSystemDb() {
+#ifdef MIOPEN_BINARY_PERF_DB_PATH
+  static std::unique_ptr<BinaryPerfDb> systemDb =
+      BinaryPerfDb::open(MIOPEN_BINARY_PERF_DB_PATH);
+  return systemDb.get();
+#else
+  return nullptr;
+#endif
+}
+
+namespace {
+/// The shared layers added with addSharedDb.
+struct SharedDbs {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<BinaryPerfDb>> dbs;
+};
+} // namespace
+
+// Leaked, as kernels may be tuned during static destruction
+static SharedDbs &getSharedDbs() {
+  static SharedDbs *shared = new SharedDbs();
+  return *shared;
+}
+
+LogicalResult BinaryPerfDb::addSharedDb(llvm::StringRef path) {
+  SharedDbs &shared = getSharedDbs();
+  {
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    for (const std::unique_ptr<BinaryPerfDb> &db : shared.dbs)
+      if (db->getPath() == path)
+        return success();
+  }
+  std::unique_ptr<BinaryPerfDb> db = open(path);
+  if (!db)
+    return failure();
+  std::lock_guard<std::mutex> lock(shared.mutex);
+  for (const std::unique_ptr<BinaryPerfDb> &added : shared.dbs)
+    if (added->getPath() == path)
+      return success();
+  LLVM_DEBUG(dbgs() << "Added shared perf db " << path << "\n");
+  shared.dbs.push_back(std::move(db));
+  return success();
+}
+
+std::vector<const BinaryPerfDb *> BinaryPerfDb::getLayers() {
+  std::vector<const BinaryPerfDb *> layers;
+  {
+    SharedDbs &shared = getSharedDbs();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    for (const std::unique_ptr<BinaryPerfDb> &db : shared.dbs)
+      layers.push_back(db.get());
+  }
+  if (const BinaryPerfDb *db = getSystemDb())
+    layers.push_back(db);
+  return layers;
+}
+
+std::string BinaryPerfDb::makeKey(llvm::StringRef arch, size_t numCu,
+                                  llvm::ArrayRef<std::string> names,
+                                  llvm::ArrayRef<std::string> values) {
+  assert(names.size() == values.size() && "one value per column");
+  std::string key = arch.str() + ";" + std::to_string(numCu);
+  for (size_t i = 0, e = names.size(); i < e; ++i)
+    key += ";" + names[i] + "=" + values[i];
+  return key;
+}
+
+llvm::StringRef BinaryPerfDb::getString(size_t entry, size_t field) const {
+  const char *ptr = entries + entry * kEntrySize + 2 * field * sizeof(uint32_t);
+  return blob.substr(readU32(ptr), readU32(ptr + sizeof(uint32_t)));
+}
+
+llvm::Optional<llvm::StringRef>
+BinaryPerfDb::find(llvm::StringRef key, llvm::StringRef solver) const {
+  // Binary search for the first entry of `key`; entries of the same key are
+  // adjacent and only differ by solver.
+  size_t lo = 0, hi = numEntries;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (getString(mid, 0) < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (size_t i = lo; i < numEntries && getString(i, 0) == key; ++i) {
+    if (getString(i, 1) == solver)
+      return getString(i, 2);
+  }
+  return llvm::None;
+}
+
+void BinaryPerfDb::indexNumCus() {
+  // Keys start with arch;num_cu, so that the entries of a target are
+  // adjacent.
+  llvm::StringRef previous;
+  for (size_t i = 0; i < numEntries; ++i) {
+    llvm::StringRef key = getString(i, 0);
+    llvm::StringRef arch, rest;
+    std::tie(arch, rest) = key.split(';');
+    llvm::StringRef numCuStr = rest.split(';').first;
+    llvm::StringRef target = key.take_front(arch.size() + 1 + numCuStr.size());
+    if (target == previous)
+      continue;
+    previous = target;
+    size_t numCu;
+    if (numCuStr.getAsInteger(10, numCu))
+      continue;
+    std::vector<size_t> &archNumCus = numCus[arch];
+    if (!llvm::is_contained(archNumCus, numCu))
+      archNumCus.push_back(numCu);
+  }
+  for (auto &entry : numCus)
+    llvm::sort(entry.getValue());
+}
+
+llvm::ArrayRef<size_t> BinaryPerfDb::getNumCus(llvm::StringRef arch) const {
+  auto it = numCus.find(arch);
+  if (it == numCus.end())
+    return {};
+  return it->getValue();
+}
+
+void BinaryPerfDbWriter::add(std::string key, std::string solver,
+                             std::string params,
+                             llvm::Optional<double> timeMs) {
+  records.push_back(
+      {std::move(key), std::move(solver), std::move(params), timeMs});
+}
+
+void BinaryPerfDbWriter::write(llvm::raw_ostream &os) {
+  // Measured entries first, fastest first, within each (key, solver) pair.
+  std::stable_sort(records.begin(), records.end(),
+                   [](const Record &lhs, const Record &rhs) {
+                     if (std::tie(lhs.key, lhs.solver) !=
+                         std::tie(rhs.key, rhs.solver))
+                       return std::tie(lhs.key, lhs.solver) <
+                              std::tie(rhs.key, rhs.solver);
+                     if (lhs.timeMs.hasValue() != rhs.timeMs.hasValue())
+                       return lhs.timeMs.hasValue();
+                     return lhs.timeMs && *lhs.timeMs < *rhs.timeMs;
+                   });
+  // Keep the best params recorded for a (key, solver) pair.
+  records.erase(std::unique(records.begin(), records.end(),
+                            [](const Record &lhs, const Record &rhs) {
+                              return lhs.key == rhs.key &&
+                                     lhs.solver == rhs.solver;
+                            }),
+                records.end());
+
+  std::string blob;
+  std::vector<uint32_t> fields;
+  fields.reserve(records.size() * kFieldsPerEntry);
+  auto append = [&](const std::string &str) {
+    fields.push_back(blob.size());
+    fields.push_back(str.size());
+    blob += str;
+  };
+  for (size_t i = 0, e = records.size(); i < e; ++i) {
+    // Consecutive entries of the same problem share the key string.
+    if (i > 0 && records[i].key == records[i - 1].key) {
+      size_t prev = (i - 1) * kFieldsPerEntry;
+      uint32_t keyOffset = fields[prev], keySize = fields[prev + 1];
+      fields.push_back(keyOffset);
+      fields.push_back(keySize);
+    } else {
+      append(records[i].key);
+    }
+    append(records[i].solver);
+    append(records[i].params);
+  }
+
+  os.write(kMagic, sizeof(kMagic));
+  llvm::support::endian::write<uint32_t>(os, records.size(),
+                                         llvm::support::little);
+  llvm::support::endian::write<uint32_t>(os, blob.size(),
+                                         llvm::support::little);
+  for (uint32_t field : fields)
+    llvm::support::endian::write<uint32_t>(os, field, llvm::support::little);
+  os << blob;
+}
+
+#if __MLIR_ENABLE_SQLITE__
+// Add the entries of the SQLite perf db at `sqlitePath` to `writer`, with the
+// times the tuners measured for them, if it has any.
+static LogicalResult addSQLitePerfDb(llvm::StringRef sqlitePath,
+                                     BinaryPerfDbWriter &writer,
+                                     llvm::raw_ostream &errs) {
+  SQLite sql(sqlitePath.str(), /*is_system=*/true);
+  if (!sql.valid()) {
+    errs << "Could not open perf db " << sqlitePath << "\n";
+    return failure();
+  }
+
+  // The perf db columns a lookup keys on are the ones ConvolutionContext
+  // visits; a prototype context is enough to enumerate them.
+  MLIRContext context;
+  ConvolutionContext prototype(llvm::SmallString<8>(), 0, ConvOpType::Fwd, {},
+                               {1, 1}, {1, 1}, {0, 0, 0, 0}, 0,
+                               FloatType::getF32(&context));
+  std::vector<std::string> names = prototype.fieldNames();
+  const std::string table = ConvolutionContext::tableName();
+
+  // Only the user perf dbs the tuners write have times.
+  bool hasTimes = !sql.exec("SELECT name FROM sqlite_master WHERE "
+                            "type = 'table' AND name = 'perf_db_time';")
+                       .empty();
+  // clang-format off
+  std::string query =
+      "SELECT " + table + ".*, perf_db.solver AS solver, "
+      "perf_db.arch AS arch, perf_db.num_cu AS num_cu, "
+      "perf_db.params AS params" +
+      (hasTimes ? ", perf_db_time.time_ms AS time_ms " : " ") +
+      "FROM perf_db INNER JOIN " + table + " "
+      "ON perf_db.config = " + table + ".id";
+  if (hasTimes)
+    query += " LEFT JOIN perf_db_time "
+             "ON perf_db_time.solver = perf_db.solver "
+             "AND perf_db_time.config = perf_db.config "
+             "AND perf_db_time.arch = perf_db.arch "
+             "AND perf_db_time.num_cu = perf_db.num_cu";
+  // clang-format on
+  SQLite::ResultType rows = sql.exec(query + ";");
+  for (auto &row : rows) {
+    std::vector<std::string> values;
+    values.reserve(names.size());
+    for (const std::string &name : names) {
+      auto it = row.find(name);
+      if (it == row.end()) {
+        errs << "Perf db " << sqlitePath << " has no column " << name << "\n";
+        return failure();
+      }
+      values.push_back(it->second);
+    }
+    size_t numCu = 0;
+    if (llvm::StringRef(row["num_cu"]).getAsInteger(10, numCu)) {
+      errs << "Invalid num_cu " << row["num_cu"] << " in " << sqlitePath
+           << "\n";
+      return failure();
+    }
+    llvm::Optional<double> timeMs;
+    double time;
+    if (hasTimes && !llvm::StringRef(row["time_ms"]).getAsDouble(time))
+      timeMs = time;
+    writer.add(BinaryPerfDb::makeKey(row["arch"], numCu, names, values),
+               row["solver"], row["params"], timeMs);
+  }
+  return success();
+}
+#endif // MLIR_ENABLE_SQLITE
+
+LogicalResult mlir::miopen::convertSQLitePerfDb(llvm::StringRef sqlitePath,
+                                                llvm::raw_ostream &os,
+                                                llvm::raw_ostream &errs) {
+  return mergeSQLitePerfDbs(sqlitePath.str(), os, errs);
+}
+
+LogicalResult
+mlir::miopen::mergeSQLitePerfDbs(llvm::ArrayRef<std::string> sqlitePaths,
+                                 llvm::raw_ostream &os,
+                                 llvm::raw_ostream &errs) {
+#if __MLIR_ENABLE_SQLITE__
+  BinaryPerfDbWriter writer;
+  for (const std::string &path : sqlitePaths)
+    if (failed(addSQLitePerfDb(path, writer, errs)))
+      return failure();
+  LLVM_DEBUG(dbgs() << "Converted " << writer.size() << " perf db entries of "
+                    << sqlitePaths.size() << " perf db(s)\n");
+  writer.write(os);
+  return success();
+#else
+  errs << "SQLite support is not enabled, cannot convert "
+       << llvm::join(sqlitePaths, ", ") << "\n";
+  return failure();
+#endif // MLIR_ENABLE_SQLITE
+}
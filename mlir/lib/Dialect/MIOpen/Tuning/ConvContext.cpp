@@ -37,15 +37,71 @@ static void populateSeqVal(const ArrayAttr &seqAttr,
   }
 }
 
-ConvolutionDims ConvolutionContext::getConvDims() {
-  return ConvolutionDims(dimIndexAndSize["y"].size, dimIndexAndSize["x"].size,
-                         dimIndexAndSize["ho"].size, dimIndexAndSize["wo"].size,
-                         dimIndexAndSize["hi"].size, dimIndexAndSize["wi"].size,
-                         dimIndexAndSize["k"].size, dimIndexAndSize["c"].size,
-                         dimIndexAndSize["ni"].size, dimIndexAndSize["g"].size);
+static void populateChannelBlock(Operation *op, StringRef attrName,
+                                 StringRef dim,
+                                 llvm::StringMap<int64_t> &channelBlocks) {
+  if (auto blockAttr = op->getAttrOfType<IntegerAttr>(attrName))
+    channelBlocks[dim] = blockAttr.getInt();
+}
+
+ConvolutionDims ConvolutionContext::computeConvDims(
+    const llvm::StringMap<DimIndexAndSize> &dimIndexAndSize) {
+  auto size = [&](StringRef name) {
+    return dimIndexAndSize.lookup(name).size;
+  };
+  // Only 3D convolutions have depth dimensions
+  auto depth = [&](StringRef name) -> int64_t {
+    auto it = dimIndexAndSize.find(name);
+    return it == dimIndexAndSize.end() ? 1 : it->second.size;
+  };
+  return ConvolutionDims(size("y"), size("x"), size("ho"), size("wo"),
+                         size("hi"), size("wi"), size("k"), size("c"),
+                         size("ni"), size("g"), depth("z"), depth("do"),
+                         depth("di"));
+}
+
+// A gemm of G batches of M x K by K x N is the 1x1 forward convolution of G
+// groups with K input channels, M output channels and a batch of N. The
+// layouts keep the contiguous dimensions of the matrices last.
+static ConvolutionContext populateGemmContext(GemmOp op) {
+  auto shape = [](Value v) {
+    return v.getType().cast<MemRefType>().getShape();
+  };
+  ArrayRef<int64_t> cShape = shape(op.c());
+  int64_t g = cShape[0], m = cShape[1], n = cShape[2];
+  int64_t k = op.transposeA() ? shape(op.a())[1] : shape(op.a())[2];
+
+  llvm::StringMap<DimIndexAndSize> dimIndexAndSize;
+  auto addDims = [&](ArrayRef<StringRef> names, ArrayRef<int64_t> sizes) {
+    for (size_t i = 0; i < names.size(); ++i)
+      dimIndexAndSize[names[i]] = {i, sizes[i]};
+  };
+  if (op.transposeA())
+    addDims({"g", "c", "y", "x", "k"}, {g, k, 1, 1, m});
+  else
+    addDims({"g", "k", "c", "y", "x"}, {g, m, k, 1, 1});
+  if (op.transposeB())
+    addDims({"gi", "ni", "hi", "wi", "ci"}, {g, n, 1, 1, k});
+  else
+    addDims({"gi", "ci", "hi", "wi", "ni"}, {g, k, 1, 1, n});
+  addDims({"go", "ko", "ho", "wo", "no"}, {g, m, 1, 1, n});
+
+  auto archVal = op->getAttrOfType<StringAttr>("arch").getValue();
+  int numCuVal = op->getAttrOfType<IntegerAttr>("num_cu").getInt();
+  ConvolutionContext ctx(archVal, numCuVal, ConvOpType::Fwd, dimIndexAndSize,
+                         {1, 1}, {1, 1}, {0, 0, 0, 0}, /*gemmid=*/0,
+                         obtainConvDataType(op));
+  ctx.isGemm = true;
+  ctx.fp8Format = obtainFp8Format(op);
+  ctx.xf32 = op->hasAttr("xf32");
+  ctx.sparse = op->hasAttr("sparse");
+  return ctx;
 }
 
 ConvolutionContext mlir::miopen::populateConvContext(Operation *op) {
+  if (auto gemmOp = dyn_cast<GemmOp>(op))
+    return populateGemmContext(gemmOp);
+
   ConvOpType opType = obtainConvDirection(op);
 
   auto archVal = op->template getAttrOfType<StringAttr>("arch").getValue();
@@ -91,6 +147,29 @@ ConvolutionContext mlir::miopen::populateConvContext(Operation *op) {
 
   auto dataType = obtainConvDataType(op);
 
-  return {archVal,     numCuVal,   opType, dimIndexAndSize, strideVal,
-          dilationVal, paddingVal, gemmId, dataType};
+  ConvolutionContext ctx(archVal, numCuVal, opType, dimIndexAndSize,
+                         strideVal, dilationVal, paddingVal, gemmId, dataType);
+  ctx.splitK = op->hasAttr("split_k");
+  ctx.singleLaunch = op->hasAttr("single_launch");
+  ctx.dilationPhases = op->hasAttr("dilation_phases");
+  ctx.deterministic = op->hasAttr("deterministic");
+  ctx.reduceKBlocks = op->hasAttr("reduce_kblocks");
+  auto bwdWeightOp = dyn_cast<Conv2DBwdWeightOp>(op);
+  if (ctx.reduceKBlocks && bwdWeightOp && bwdWeightOp.workspace()) {
+    // The partial filters are followed by a filter-sized slab of counters
+    // when they are summed in the same kernel.
+    int64_t filterLen =
+        bwdWeightOp.filter().getType().cast<MemRefType>().getNumElements();
+    int64_t workspaceLen =
+        bwdWeightOp.workspace().getType().cast<MemRefType>().getNumElements();
+    ctx.reductionKBlocks = workspaceLen / filterLen -
+                           (op->hasAttr("fused_reduction") ? 1 : 0);
+  }
+  populateChannelBlock(op, "filter_channel_block", "c", ctx.channelBlocks);
+  populateChannelBlock(op, "input_channel_block", "ci", ctx.channelBlocks);
+  populateChannelBlock(op, "output_channel_block", "ko", ctx.channelBlocks);
+  ctx.fp8Format = obtainFp8Format(op);
+  ctx.xf32 = op->hasAttr("xf32");
+  ctx.sparse = op->hasAttr("sparse");
+  return ctx;
 }
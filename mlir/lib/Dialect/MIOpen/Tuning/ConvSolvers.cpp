@@ -0,0 +1,158 @@
+#include "mlir/Dialect/MIOpen/Tuning/ConvSolvers.h"
+
+#include "mlir/Dialect/MIOpen/Tuning/GemmContext.h"
+#include "mlir/Dialect/MIOpen/utility/math.h"
+
+#include "llvm/Support/ErrorHandling.h"
+
+#include <algorithm>
+
+using namespace mlir;
+using namespace mlir::miopen;
+
+// The rates the estimates assume, per cycle: those of an MI100 for fp32
+// XDLOPS and HBM. Only their ratio matters, as costs are only compared.
+static constexpr double kFlopsPerCuCycle = 256.0;
+static constexpr double kBytesPerCycle = 800.0;
+// What a kernel launch and the drain of its last wave cost, in cycles.
+static constexpr double kLaunchCycles = 5000.0;
+// The tile of the gridwise GEMMs, whose M and N are padded to it.
+static constexpr int64_t kGemmTile = 128;
+// The fraction of the peak the direct kernels reach without XDLOPS.
+static constexpr double kDirectEfficiency = 0.25;
+// The fraction of the peak the batched GEMMs of Winograd reach, whose
+// transforms run on the vector units.
+static constexpr double kWinogradEfficiency = 0.75;
+// The fewest GemmK elements a split of a split-K convolution reduces.
+static constexpr int64_t kMinSplitKLength = 256;
+// How much more of the input the implicit GEMM of a dilated convolution
+// reads, in cache lines, than it uses, at most.
+static constexpr int64_t kMaxDilationReadFactor = 4;
+
+StringRef miopen::getNameForConvSolver(ConvSolver solver) {
+  switch (solver) {
+  case ConvSolver::ImplicitGemm:
+    return "implicit_gemm";
+  case ConvSolver::SplitK:
+    return "split_k";
+  case ConvSolver::Winograd:
+    return "winograd";
+  case ConvSolver::DilationPhases:
+    return "dilation_phases";
+  case ConvSolver::DirectGrouped:
+    return "direct_grouped";
+  case ConvSolver::SkinnyGemm:
+    return "skinny_gemm";
+  }
+  llvm_unreachable("Unknown conv solver");
+}
+
+ArrayRef<ConvSolver> miopen::getConvSolvers() {
+  static const ConvSolver solvers[] = {
+      ConvSolver::ImplicitGemm, ConvSolver::DirectGrouped,
+      ConvSolver::Winograd, ConvSolver::SplitK, ConvSolver::DilationPhases};
+  return solvers;
+}
+
+namespace {
+/// The work of a solver, which the costs are derived from.
+struct SolverWork {
+  double flops = 0.0;
+  double bytes = 0.0;
+  // The fraction of the peak rate the arithmetic runs at.
+  double efficiency = 1.0;
+  // The workgroups, which fill the compute units in waves.
+  int64_t workgroups = 1;
+  int64_t kernels = 1;
+};
+} // end anonymous namespace
+
+static double getCost(const SolverWork &work, int64_t numCu) {
+  numCu = std::max<int64_t>(numCu, 1);
+  int64_t waves = math_util::integer_divide_ceil(work.workgroups, numCu);
+  double occupancy =
+      static_cast<double>(work.workgroups) / static_cast<double>(waves * numCu);
+  double computeCycles =
+      work.flops / (numCu * kFlopsPerCuCycle * work.efficiency * occupancy);
+  double memoryCycles = work.bytes / kBytesPerCycle;
+  return std::max(computeCycles, memoryCycles) + kLaunchCycles * work.kernels;
+}
+
+double miopen::estimateConvSolverCost(ConvSolver solver,
+                                      const ConvSolverProblem &problem,
+                                      int64_t winogradTile) {
+  const ConvolutionDims &dims = problem.dims;
+  GemmContext gemm = GemmContext::fromConvolution(problem.dir, dims);
+  double elementBytes = static_cast<double>(problem.elementBytes);
+  double inputBytes =
+      elementBytes * dims.g * dims.n * dims.c * dims.din * dims.hi * dims.wi;
+  double filterBytes =
+      elementBytes * dims.g * dims.k * dims.c * dims.z * dims.y * dims.x;
+  double outputBytes =
+      elementBytes * dims.g * dims.n * dims.k * dims.dout * dims.ho * dims.wo;
+
+  // The implicit GEMM computes whole tiles, padding included.
+  int64_t tilesM = math_util::integer_divide_ceil(gemm.m, kGemmTile);
+  int64_t tilesN = math_util::integer_divide_ceil(gemm.n, kGemmTile);
+  SolverWork work;
+  work.flops = 2.0 * dims.g * tilesM * tilesN * kGemmTile * kGemmTile * gemm.k;
+  work.bytes = inputBytes + filterBytes + outputBytes;
+  work.workgroups = dims.g * tilesM * tilesN;
+
+  switch (solver) {
+  case ConvSolver::ImplicitGemm: {
+    // Dilations spread the input a GEMM tile reads over more cache lines.
+    int64_t dilation = std::max(problem.dilationHeight, problem.dilationWidth);
+    if (dims.y > 1 || dims.x > 1)
+      work.bytes +=
+          inputBytes * (std::min(dilation, kMaxDilationReadFactor) - 1);
+    break;
+  }
+  case ConvSolver::SplitK: {
+    // Enough splits to fill the compute units, each reducing a useful
+    // length, that accumulate in f32 into an output zeroed beforehand.
+    int64_t splits = std::max<int64_t>(
+        1, std::min(problem.numCu / std::max<int64_t>(work.workgroups, 1),
+                    gemm.k / kMinSplitKLength));
+    work.workgroups *= splits;
+    double accumulatorBytes = outputBytes / elementBytes * 4.0;
+    work.bytes += accumulatorBytes * (splits + 1);
+    work.kernels = 2;
+    break;
+  }
+  case ConvSolver::Winograd: {
+    // alpha x alpha batched GEMMs over the tiles of the output, each doing
+    // the multiplications of an m x m output tile of the 3x3 filter.
+    int64_t m = std::max<int64_t>(winogradTile, 1);
+    int64_t alpha = m + dims.y - 1;
+    work.flops *=
+        static_cast<double>(alpha * alpha) / (m * m * dims.y * dims.x);
+    work.efficiency = kWinogradEfficiency;
+    // The transformed filter goes through a workspace, and the input tiles
+    // overlap by the filter size.
+    double overlap = static_cast<double>(alpha * alpha) / (m * m);
+    work.bytes = inputBytes * overlap + filterBytes + outputBytes +
+                 2.0 * dims.g * dims.k * dims.c * alpha * alpha * 4.0;
+    work.kernels = 2;
+    break;
+  }
+  case ConvSolver::DilationPhases:
+    // Dense reads of the phases of the input, with the GEMM tiles of the
+    // implicit GEMM.
+    break;
+  case ConvSolver::DirectGrouped:
+    // No padded tiles, but no XDLOPS either, with an output element per
+    // thread of workgroups of 256.
+    work.flops = 2.0 * dims.g * gemm.m * gemm.n * gemm.k;
+    work.efficiency = kDirectEfficiency;
+    work.workgroups = math_util::integer_divide_ceil(
+        dims.g * dims.n * dims.k * dims.ho * dims.wo, 256);
+    break;
+  case ConvSolver::SkinnyGemm:
+    // Bound by reading the long operand once.
+    work.flops = 2.0 * dims.g * gemm.m * gemm.n * gemm.k;
+    work.workgroups = problem.numCu;
+    break;
+  }
+  return getCost(work, problem.numCu);
+}
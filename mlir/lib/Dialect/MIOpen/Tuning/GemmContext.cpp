@@ -11,8 +11,8 @@ GemmContext GemmContext::fromConvolution(ConvOpType type,
   switch (type) {
   case ConvOpType::Fwd:
     gemmMSize = sizes.k;
-    gemmKSize = sizes.c * sizes.y * sizes.x;
-    gemmNSize = sizes.n * sizes.ho * sizes.wo;
+    gemmKSize = sizes.c * sizes.z * sizes.y * sizes.x;
+    gemmNSize = sizes.n * sizes.dout * sizes.ho * sizes.wo;
     break;
   case ConvOpType::BwdData:
     gemmMSize = sizes.c;
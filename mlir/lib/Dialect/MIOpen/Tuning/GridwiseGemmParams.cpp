@@ -1,25 +1,61 @@
 #include "mlir/Dialect/MIOpen/Tuning/GridwiseGemmParams.h"
+#include "mlir/Dialect/MIOpen/Tuning/BinaryPerfDb.h"
 #include "mlir/Dialect/MIOpen/Tuning/ConvContext.h"
+#include "mlir/Dialect/MIOpen/Tuning/RegisterPressure.h"
 #include "mlir/Dialect/MIOpen/Tuning/SqliteDb.h"
+#include "mlir/Dialect/MIOpen/Tuning/UtilityParams.h"
+#include "mlir/Dialect/MIOpen/XdlopsCodeSelection.h"
+#include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
+#include "mlir/Dialect/MIOpen/utility/math.h"
 
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <sstream>
 
 #define DEBUG_TYPE "miopen-tuning-parameter"
 
 using namespace mlir;
 using namespace mlir::miopen;
 
-static void
-obtainGemmADimKVectorizable(ConvOpType opType,
-                            llvm::StringMap<DimIndexAndSize> &dimIndexAndSize,
-                            bool &input1GemmKVectorizable) {
+// The position of the fastest changing dimension of the convolution tensors,
+// which have an extra depth dimension in 3D convolutions.
+static size_t
+lastDimIndex(const llvm::StringMap<DimIndexAndSize> &dimIndexAndSize) {
+  return dimIndexAndSize.count("z") ? 5 : 4;
+}
+
+// The product of the sizes of the dimensions among `names` that come after
+// `dim` in their tensor, which are contiguous when `dim` is not the last.
+static int64_t
+trailingSize(const llvm::StringMap<DimIndexAndSize> &dimIndexAndSize,
+             StringRef dim, ArrayRef<StringRef> names) {
+  size_t index = dimIndexAndSize.lookup(dim).index;
+  int64_t size = 1;
+  for (StringRef name : names) {
+    auto it = dimIndexAndSize.find(name);
+    if (it != dimIndexAndSize.end() && it->second.index > index)
+      size *= it->second.size;
+  }
+  return size;
+}
+
+static void obtainGemmADimKVectorizable(
+    ConvOpType opType, const llvm::StringMap<DimIndexAndSize> &dimIndexAndSize,
+    bool &input1GemmKVectorizable) {
   // Vectorizable flag is opposite between forwad and bwd_data
   if (opType == ConvOpType::Fwd) {
     // When K is not the fastest changing dimension,
     // gemmK dimension is vectorizable, gemmM is not, and vice versa.
     // Vectorization width depending on which among C, Y, X be the fastest
     // changing dimension.
-    if (dimIndexAndSize["k"].index == 4) {
+    if (dimIndexAndSize.lookup("k").index == lastDimIndex(dimIndexAndSize)) {
       input1GemmKVectorizable = false;
     } else {
       input1GemmKVectorizable = true;
@@ -32,7 +68,7 @@ obtainGemmADimKVectorizable(ConvOpType opType,
     // gemmM dimension is vectorizable, gemmK is not, and vice versa.
     // Vectorization width depending on which among N, and HoWo be the fastest
     // changing dimension.
-    if (dimIndexAndSize["k"].index == 4) {
+    if (dimIndexAndSize.lookup("k").index == lastDimIndex(dimIndexAndSize)) {
       input1GemmKVectorizable = false;
     } else {
       input1GemmKVectorizable = true;
@@ -40,17 +76,16 @@ obtainGemmADimKVectorizable(ConvOpType opType,
   }
 }
 
-static void
-obtainGemmBDimKVectorizable(ConvOpType opType,
-                            llvm::StringMap<DimIndexAndSize> &dimIndexAndSize,
-                            bool &input2GemmKVectorizable) {
+static void obtainGemmBDimKVectorizable(
+    ConvOpType opType, const llvm::StringMap<DimIndexAndSize> &dimIndexAndSize,
+    bool &input2GemmKVectorizable) {
   // Vectorizable flag is opposite between forwad and bwd_data
   if (opType == ConvOpType::Fwd) {
     // For input tensor.
     // When C is the fastest changing dimension,
     // gemmK dimension is vectorizable, gemmN is not, and vice versa.
     // Vectorization width depending on length of C.
-    if (dimIndexAndSize["ci"].index == 4) {
+    if (dimIndexAndSize.lookup("ci").index == lastDimIndex(dimIndexAndSize)) {
       input2GemmKVectorizable = true;
     } else {
       input2GemmKVectorizable = false;
@@ -60,7 +95,7 @@ obtainGemmBDimKVectorizable(ConvOpType opType,
     // When K is the fastest changing dimension(3),
     // gemmK dimension is vectorizable, gemmN is not, and vice versa.
     // Vectorization width depending on length of K.
-    if (dimIndexAndSize["ko"].index == 4) {
+    if (dimIndexAndSize.lookup("ko").index == lastDimIndex(dimIndexAndSize)) {
       input2GemmKVectorizable = true;
     } else {
       input2GemmKVectorizable = false;
@@ -70,7 +105,7 @@ obtainGemmBDimKVectorizable(ConvOpType opType,
     // When C is the fastest changing dimension,
     // gemmN dimension is vectorizable, gemmK is not, and vice versa.
     // Vectorization width depending on length of C.
-    if (dimIndexAndSize["ci"].index == 4) {
+    if (dimIndexAndSize.lookup("ci").index == lastDimIndex(dimIndexAndSize)) {
       input2GemmKVectorizable = false;
     } else {
       input2GemmKVectorizable = true;
@@ -78,46 +113,28 @@ obtainGemmBDimKVectorizable(ConvOpType opType,
   }
 }
 
-static void obtainFilterVecLen(ConvolutionContext &ctx, int64_t &vecLen) {
-  auto dimIndexAndSize = ctx.dimIndexAndSize;
+static void obtainFilterVecLen(const ConvolutionContext &ctx, int64_t &vecLen) {
+  const auto &dimIndexAndSize = ctx.dimIndexAndSize;
   // Vectorization length logic is the same for forward and bwd_data
-  if (dimIndexAndSize["k"].index == 4) {
-    vecLen = dimIndexAndSize["k"].size;
-  } else if (dimIndexAndSize["k"].index == 1) {
-    // dimKF is the lowest changing dimension, which means dimC/dimY/dimX
-    vecLen = dimIndexAndSize["c"].size * dimIndexAndSize["y"].size *
-             dimIndexAndSize["x"].size;
-  } else if (dimIndexAndSize["k"].index == 2) {
-    // K's position is at 2, vectorization legnth is last two dimension
-    if (dimIndexAndSize["c"].index == 1) {
-      vecLen = dimIndexAndSize["y"].size * dimIndexAndSize["x"].size;
-    } else if (dimIndexAndSize["y"].index == 1) {
-      vecLen = dimIndexAndSize["c"].size * dimIndexAndSize["x"].size;
-    } else {
-      vecLen = dimIndexAndSize["c"].size * dimIndexAndSize["y"].size;
-    }
+  if (dimIndexAndSize.lookup("k").index == lastDimIndex(dimIndexAndSize)) {
+    vecLen = dimIndexAndSize.lookup("k").size;
   } else {
-    // K's position is 3, vectorization legnth is last dimension
-    if (dimIndexAndSize["c"].index == 4) {
-      vecLen = dimIndexAndSize["c"].size;
-    } else if (dimIndexAndSize["y"].index == 4) {
-      vecLen = dimIndexAndSize["y"].size;
-    } else {
-      vecLen = dimIndexAndSize["x"].size;
-    }
+    // The dimensions after K, among C/Y/X and the depth Z of 3D filters,
+    // are the fastest changing ones
+    vecLen = trailingSize(dimIndexAndSize, "k", {"c", "y", "x", "z"});
   }
 }
 
-static void obtainBwdDataFilterVecLen(ConvolutionContext &ctx,
+static void obtainBwdDataFilterVecLen(const ConvolutionContext &ctx,
                                       int64_t &vecLen) {
-  auto dimIndexAndSize = ctx.dimIndexAndSize;
+  const auto &dimIndexAndSize = ctx.dimIndexAndSize;
   // Vectorization length logic is the same for forward and bwd_data
-  if (dimIndexAndSize["c"].index == 4) {
-    vecLen = dimIndexAndSize["c"].size;
-  } else if (dimIndexAndSize["c"].index == 2) {
+  if (dimIndexAndSize.lookup("c").index == 4) {
+    vecLen = dimIndexAndSize.lookup("c").size;
+  } else if (dimIndexAndSize.lookup("c").index == 2) {
     // C's position is at 2, vectorization legnth depend last two dimension
-    if (dimIndexAndSize["y"].size == 1 && dimIndexAndSize["x"].size == 1) {
-      vecLen = dimIndexAndSize["c"].size;
+    if (ctx.convDims.y == 1 && ctx.convDims.x == 1) {
+      vecLen = ctx.convDims.c;
     } else {
       vecLen = 1;
     }
@@ -125,33 +142,40 @@ static void obtainBwdDataFilterVecLen(ConvolutionContext &ctx,
     vecLen = 1;
   }
 }
-static void obtainInputVecLen(ConvolutionContext &ctx, int64_t &vecLen) {
-  auto dimIndexAndSize = ctx.dimIndexAndSize;
-  if (dimIndexAndSize["ni"].index == 4) {
-    vecLen = dimIndexAndSize["ni"].size;
-  } else if (dimIndexAndSize["ci"].index == 4) {
-    vecLen = dimIndexAndSize["ci"].size;
+static void obtainInputVecLen(const ConvolutionContext &ctx, int64_t &vecLen) {
+  const auto &dimIndexAndSize = ctx.dimIndexAndSize;
+  size_t lastDim = lastDimIndex(dimIndexAndSize);
+  if (dimIndexAndSize.lookup("ni").index == lastDim) {
+    vecLen = dimIndexAndSize.lookup("ni").size;
+  } else if (dimIndexAndSize.lookup("ci").index == lastDim) {
+    vecLen = dimIndexAndSize.lookup("ci").size;
   } else {
-    if (dimIndexAndSize["x"].size == 1 && dimIndexAndSize["y"].size == 1 &&
-        ctx.strideVal[0] == 1 && ctx.strideVal[1] == 1 &&
-        ctx.paddingVal[0] == 0 && ctx.paddingVal[1] == 0 &&
-        ctx.paddingVal[2] == 0 && ctx.paddingVal[3] == 0)
-      vecLen = dimIndexAndSize["ho"].size * dimIndexAndSize["wo"].size;
+    // Only a 1x1 filter without strides or padding reads the input images
+    // contiguously
+    bool isPointwise = llvm::all_of(ctx.strideVal,
+                                    [](int64_t s) { return s == 1; }) &&
+                       llvm::all_of(ctx.paddingVal,
+                                    [](int64_t p) { return p == 0; });
+    for (StringRef dim : {"y", "x", "z"})
+      isPointwise &= dimIndexAndSize.lookup(dim).size <= 1;
+    if (isPointwise)
+      vecLen = trailingSize(dimIndexAndSize, "ci", {"di", "hi", "wi"});
     else
       vecLen = 1;
   }
 }
-static void obtainBwdDataOutputVecLen(ConvolutionContext &ctx,
+static void obtainBwdDataOutputVecLen(const ConvolutionContext &ctx,
                                       int64_t &vecLen) {
-  auto dimIndexAndSize = ctx.dimIndexAndSize;
-  if (dimIndexAndSize["ko"].index == 4) {
-    vecLen = dimIndexAndSize["ko"].size;
-  } else if (dimIndexAndSize["no"].index == 4) {
-    vecLen = dimIndexAndSize["no"].size;
-  } else if (dimIndexAndSize["no"].index == 0) {
-    if (dimIndexAndSize["ho"].index == 3 && dimIndexAndSize["wo"].index == 4) {
-      if (dimIndexAndSize["y"].size == 1 && dimIndexAndSize["x"].size == 1)
-        vecLen = dimIndexAndSize["ho"].size * dimIndexAndSize["wo"].size;
+  const auto &dimIndexAndSize = ctx.dimIndexAndSize;
+  if (dimIndexAndSize.lookup("ko").index == 4) {
+    vecLen = dimIndexAndSize.lookup("ko").size;
+  } else if (dimIndexAndSize.lookup("no").index == 4) {
+    vecLen = dimIndexAndSize.lookup("no").size;
+  } else if (dimIndexAndSize.lookup("no").index == 0) {
+    if (dimIndexAndSize.lookup("ho").index == 3 &&
+        dimIndexAndSize.lookup("wo").index == 4) {
+      if (ctx.convDims.y == 1 && ctx.convDims.x == 1)
+        vecLen = ctx.convDims.ho * ctx.convDims.wo;
       else
         vecLen = 1;
     } else
@@ -161,71 +185,75 @@ static void obtainBwdDataOutputVecLen(ConvolutionContext &ctx,
   }
 }
 
-static void obtainOutputVecLen(ConvolutionContext &ctx, int64_t &vecLen) {
-  auto dimIndexAndSize = ctx.dimIndexAndSize;
-  if (dimIndexAndSize["ko"].index == 4) {
-    vecLen = dimIndexAndSize["ko"].size;
-  } else if (dimIndexAndSize["ko"].index == 1) {
-    // dimKO is the lowest changing dimension, which means dimN/dimHo/dimWo
-    vecLen = dimIndexAndSize["no"].size * dimIndexAndSize["ho"].size *
-             dimIndexAndSize["wo"].size;
-  } else if (dimIndexAndSize["ko"].index == 2) {
-    // Ko's position is at 2, vectorization legnth is last two dimensions
-    if (dimIndexAndSize["no"].index == 0) {
-      vecLen = dimIndexAndSize["ho"].size * dimIndexAndSize["wo"].size;
-    } else if (dimIndexAndSize["ho"].index == 0) {
-      vecLen = dimIndexAndSize["no"].size * dimIndexAndSize["wo"].size;
-    } else {
-      vecLen = dimIndexAndSize["no"].size * dimIndexAndSize["ho"].size;
-    }
+static void obtainOutputVecLen(const ConvolutionContext &ctx, int64_t &vecLen) {
+  const auto &dimIndexAndSize = ctx.dimIndexAndSize;
+  if (dimIndexAndSize.lookup("ko").index == lastDimIndex(dimIndexAndSize)) {
+    vecLen = dimIndexAndSize.lookup("ko").size;
+  } else if (ctx.dilationPhases) {
+    // Consecutive pixels of a phase are a dilation apart in the output.
+    vecLen = 1;
   } else {
-    // K's position is 3, vectorization legnth is last dimension
-    if (dimIndexAndSize["no"].index == 4) {
-      vecLen = dimIndexAndSize["no"].size;
-    } else if (dimIndexAndSize["ho"].index == 4) {
-      vecLen = dimIndexAndSize["ho"].size;
-    } else {
-      vecLen = dimIndexAndSize["wo"].size;
-    }
+    // The dimensions after Ko, among N/Ho/Wo and the depth Do of 3D
+    // outputs, are the fastest changing ones
+    vecLen = trailingSize(dimIndexAndSize, "ko", {"no", "do", "ho", "wo"});
   }
 }
 
-static void obtainGemmAVecLen(ConvolutionContext &ctx, int64_t &vecLen) {
+// A channel-blocked tensor, such as an NCHW4c one, only keeps runs of its
+// channel block contiguous, so no vector may cross a block.
+static void capToChannelBlock(const ConvolutionContext &ctx, StringRef dim,
+                              int64_t &vecLen) {
+  auto it = ctx.channelBlocks.find(dim);
+  if (it != ctx.channelBlocks.end() && vecLen > 0)
+    vecLen = math_util::gcd(vecLen, it->second);
+}
+
+static void obtainGemmAVecLen(const ConvolutionContext &ctx, int64_t &vecLen) {
   auto opType = ctx.opType;
   if (opType == ConvOpType::Fwd) {
     obtainFilterVecLen(ctx, vecLen);
+    capToChannelBlock(ctx, "c", vecLen);
   } else if (opType == ConvOpType::BwdData) {
     obtainBwdDataFilterVecLen(ctx, vecLen);
+    capToChannelBlock(ctx, "c", vecLen);
   } else if (opType == ConvOpType::BwdWeight) {
     obtainOutputVecLen(ctx, vecLen);
+    capToChannelBlock(ctx, "ko", vecLen);
   }
 }
 
-static void obtainGemmBVecLen(ConvolutionContext &ctx, int64_t &vecLen) {
+static void obtainGemmBVecLen(const ConvolutionContext &ctx, int64_t &vecLen) {
   auto opType = ctx.opType;
   if (opType == ConvOpType::Fwd) {
     obtainInputVecLen(ctx, vecLen);
+    capToChannelBlock(ctx, "ci", vecLen);
   } else if (opType == ConvOpType::BwdData) {
     obtainBwdDataOutputVecLen(ctx, vecLen);
+    capToChannelBlock(ctx, "ko", vecLen);
   } else if (opType == ConvOpType::BwdWeight) {
     obtainInputVecLen(ctx, vecLen);
+    capToChannelBlock(ctx, "ci", vecLen);
   }
 }
 
-static void obtainGemmCVecLen(ConvolutionContext &ctx, int64_t &vecLen) {
+static void obtainGemmCVecLen(const ConvolutionContext &ctx, int64_t &vecLen) {
   auto opType = ctx.opType;
   if (opType == ConvOpType::Fwd) {
     obtainOutputVecLen(ctx, vecLen);
+    capToChannelBlock(ctx, "ko", vecLen);
   } else if (opType == ConvOpType::BwdData) {
     obtainInputVecLen(ctx, vecLen);
+    capToChannelBlock(ctx, "ci", vecLen);
   } else if (opType == ConvOpType::BwdWeight) {
     obtainFilterVecLen(ctx, vecLen);
+    capToChannelBlock(ctx, "c", vecLen);
   }
 }
 
 LogicalResult calculateInputDerivedParams(const InitParams &param,
                                           int64_t blockSize,
-                                          ConvolutionContext &ctx, bool isGemmA,
+                                          const ConvolutionContext &ctx,
+                                          bool isGemmA,
                                           DerivedParams &derived) {
 
   bool gemmKVectorizable = false;
@@ -260,7 +288,9 @@ LogicalResult calculateInputDerivedParams(const InitParams &param,
   // unsigned dataWidth = dataType.getIntOrFloatBitWidth();
   // const size_t highestPotentialVectorizationLen = 128;
   // vectorizationSize = highestPotentialVectorizationLen / dataWidth;
-  if (dataType.isF32()) {
+  if (dataType.isF64()) {
+    vectorizationSize = 2;
+  } else if (dataType.isF32()) {
     vectorizationSize = 4;
   } else if (dataType.isF16() || dataType.isBF16()) {
     // Nonxdlops on fp16 resnet50 fail for vectorization size > 4
@@ -333,7 +363,7 @@ LogicalResult calculateInputDerivedParams(const InitParams &param,
 
 LogicalResult calculateOutputDerivedParams(const InitParams &params,
                                            int64_t blockSize,
-                                           ConvolutionContext &ctx,
+                                           const ConvolutionContext &ctx,
                                            DerivedOutParams &out) {
   int64_t cVectorLength = 0;
   ConvOpType op = ctx.getOpType();
@@ -360,21 +390,30 @@ LogicalResult calculateOutputDerivedParams(const InitParams &params,
     out.dataPerCopy = 1;
   }
 
-  auto &dimIndexAndSize = ctx.dimIndexAndSize;
+  // The LDS epilogue of the XDLOPS gemm is not bound to the thread's share
+  // of the C tile, only to the contiguity of the output tensor.
+  out.maxDataPerCopy = 1;
+  if (ConvOpType::BwdData != op && cVectorLength > 0) {
+    while (out.maxDataPerCopy < 16 &&
+           cVectorLength % (out.maxDataPerCopy * 2) == 0)
+      out.maxDataPerCopy *= 2;
+  }
+
+  const auto &dimIndexAndSize = ctx.dimIndexAndSize;
   // Find dimensions in which the copy will take place
   switch (op) {
   case ConvOpType::Fwd:
-    if (dimIndexAndSize["ko"].index == 4) {
+    if (dimIndexAndSize.lookup("ko").index == lastDimIndex(dimIndexAndSize)) {
       out.gemmVectorDim = gemmCDimM;
-      out.destVectorDim = 4;
+      out.destVectorDim = lastDimIndex(dimIndexAndSize);
     } else {
       out.gemmVectorDim = gemmCDimN;
       // This relies on assumptions about how we load our data for GEMM
-      out.destVectorDim = dimIndexAndSize["wo"].index;
+      out.destVectorDim = dimIndexAndSize.lookup("wo").index;
     }
     break;
   case ConvOpType::BwdWeight:
-    if (dimIndexAndSize["k"].index == 4) {
+    if (dimIndexAndSize.lookup("k").index == 4) {
       out.gemmVectorDim = gemmCDimM;
       out.destVectorDim = 4;
     } else {
@@ -392,26 +431,28 @@ LogicalResult calculateOutputDerivedParams(const InitParams &params,
   return success();
 }
 
-static void obtainGemmSize(ConvolutionContext &ctx, GemmSize &gemmSize) {
-  gemmSize.gemmG = ctx.dimIndexAndSize["g"].size;
+static void obtainGemmSize(const ConvolutionContext &ctx, GemmSize &gemmSize) {
+  const ConvolutionDims &dims = ctx.convDims;
+  gemmSize.gemmG = dims.g;
 
   if (ctx.opType == ConvOpType::Fwd) {
-    gemmSize.gemmM = ctx.dimIndexAndSize["k"].size;
-    gemmSize.gemmN = ctx.dimIndexAndSize["no"].size *
-                     ctx.dimIndexAndSize["ho"].size *
-                     ctx.dimIndexAndSize["wo"].size;
-    gemmSize.gemmK = ctx.dimIndexAndSize["c"].size *
-                     ctx.dimIndexAndSize["y"].size *
-                     ctx.dimIndexAndSize["x"].size;
+    // 3D convolutions also fold the depth into GemmN and GemmK, which is 1
+    // in 2D ones
+    gemmSize.gemmM = dims.k;
+    gemmSize.gemmN = dims.n * dims.dout * dims.ho * dims.wo;
+    gemmSize.gemmK = dims.c * dims.z * dims.y * dims.x;
+    // Phases of a dilated convolution add the dilations to GemmG, and each
+    // covers the output subsampled by them.
+    if (ctx.dilationPhases) {
+      gemmSize.gemmG *= ctx.dilationVal[0] * ctx.dilationVal[1];
+      gemmSize.gemmN =
+          dims.n *
+          math_util::integer_divide_ceil(dims.ho, ctx.dilationVal[0]) *
+          math_util::integer_divide_ceil(dims.wo, ctx.dilationVal[1]);
+    }
   } else if (ctx.opType == ConvOpType::BwdData) {
-    int64_t y, x, ho, wo, hi, wi;
-    y = x = ho = wo = hi = wi = 0;
-    y = ctx.dimIndexAndSize["y"].size;
-    x = ctx.dimIndexAndSize["x"].size;
-    ho = ctx.dimIndexAndSize["ho"].size;
-    wo = ctx.dimIndexAndSize["wo"].size;
-    hi = ctx.dimIndexAndSize["hi"].size;
-    wi = ctx.dimIndexAndSize["wi"].size;
+    int64_t y = dims.y, x = dims.x, ho = dims.ho, wo = dims.wo, hi = dims.hi,
+            wi = dims.wi;
     auto strideH = ctx.strideVal[0];
     auto strideW = ctx.strideVal[1];
     auto dilationH = ctx.dilationVal[0];
@@ -449,17 +490,17 @@ static void obtainGemmSize(ConvolutionContext &ctx, GemmSize &gemmSize) {
     auto yDotSlice = math_util::integer_divide_ceil(y - iYTilda, yTilda);
     auto xDotSlice = math_util::integer_divide_ceil(x - iXTilda, xTilda);
 
-    gemmSize.gemmM = ctx.dimIndexAndSize["c"].size;
-    gemmSize.gemmN = ctx.dimIndexAndSize["no"].size * hTildaSlice * wTildaSlice;
-    gemmSize.gemmK = ctx.dimIndexAndSize["k"].size * yDotSlice * xDotSlice;
+    gemmSize.gemmM = dims.c;
+    gemmSize.gemmN = dims.n * hTildaSlice * wTildaSlice;
+    gemmSize.gemmK = dims.k * yDotSlice * xDotSlice;
+    // A single launch adds the phases with filter taps to GemmG, at the
+    // GemmK of gemm ID 0.
+    if (ctx.singleLaunch)
+      gemmSize.gemmG *= std::min(y, yTilda) * std::min(x, xTilda);
   } else if (ctx.opType == ConvOpType::BwdWeight) {
-    gemmSize.gemmM = ctx.dimIndexAndSize["k"].size;
-    gemmSize.gemmK = ctx.dimIndexAndSize["no"].size *
-                     ctx.dimIndexAndSize["ho"].size *
-                     ctx.dimIndexAndSize["wo"].size;
-    gemmSize.gemmN = ctx.dimIndexAndSize["c"].size *
-                     ctx.dimIndexAndSize["y"].size *
-                     ctx.dimIndexAndSize["x"].size;
+    gemmSize.gemmM = dims.k;
+    gemmSize.gemmK = dims.n * dims.ho * dims.wo;
+    gemmSize.gemmN = dims.c * dims.y * dims.x;
   }
 }
 
@@ -499,14 +540,14 @@ PopulateParams::initParameters[PopulateParams::nInitParameters] = {
 const InitParams PopulateParams::universalParameters = {64, 64, 16};
 
 LogicalResult PopulateParams::calculateGemmABlockCopyPerformanceParameters(
-    const InitParamsNonXDL &param, ConvolutionContext &ctx,
+    const InitParamsNonXDL &param, const ConvolutionContext &ctx,
     DerivedParams &derived) {
   return calculateInputDerivedParams(param, param.blockSize, ctx, true,
                                      derived);
 }
 
 LogicalResult PopulateParams::calculateGemmBBlockCopyPerformanceParameters(
-    const InitParamsNonXDL &param, ConvolutionContext &ctx,
+    const InitParamsNonXDL &param, const ConvolutionContext &ctx,
     DerivedParams &derived) {
 
   return calculateInputDerivedParams(param, param.blockSize, ctx, false,
@@ -514,7 +555,7 @@ LogicalResult PopulateParams::calculateGemmBBlockCopyPerformanceParameters(
 }
 
 LogicalResult PopulateParams::calculateGemmCBlockwiseCopyParams(
-    const InitParamsNonXDL &params, ConvolutionContext &ctx,
+    const InitParamsNonXDL &params, const ConvolutionContext &ctx,
     DerivedOutParams &out) {
   return calculateOutputDerivedParams(params, params.blockSize, ctx, out);
 }
@@ -580,8 +621,9 @@ LogicalResult PopulateParams::calculateBlockGemmPerformanceParameters(
   return success();
 }
 LogicalResult PopulateParams::populateDerived(
-    ConvolutionContext &ctx, const InitParamsNonXDL &params, GemmSize &gemmSize,
-    DerivedParams &gemmADerivedParam, DerivedParams &gemmBDerivedParam,
+    const ConvolutionContext &ctx, const InitParamsNonXDL &params,
+    GemmSize &gemmSize, DerivedParams &gemmADerivedParam,
+    DerivedParams &gemmBDerivedParam,
     DerivedBlockGemmParams &blockGemmDerivedParam,
     DerivedOutParams &gemmCDerivedParams, int64_t &gridSize) {
 
@@ -639,20 +681,13 @@ LogicalResult PopulateParams::populateDerived(
 }
 
 LogicalResult PopulateParams::populatePaddingKernelDerived(
-    ConvolutionContext &ctx, const InitParamsNonXDL &param, GemmSize &gemmSize,
-    DerivedParams &gemmADerivedParam, DerivedParams &gemmBDerivedParam,
+    const ConvolutionContext &ctx, const InitParamsNonXDL &param,
+    GemmSize &gemmSize, DerivedParams &gemmADerivedParam,
+    DerivedParams &gemmBDerivedParam,
     DerivedBlockGemmParams &blockGemmDerivedParam,
     DerivedOutParams &gemmCDerivedParam, int64_t &gridSize) {
 
   LogicalResult res = failure();
-  InitParams paddingParam = getUniversalParameters();
-
-  // find complete config for paddingParam
-  // if mblock,nblock,kblock is the same with this tuning parameter
-  if (paddingParam.gemmMPerBlock != param.gemmMPerBlock ||
-      paddingParam.gemmNPerBlock != param.gemmNPerBlock ||
-      paddingParam.gemmKPerBlock != param.gemmKPerBlock)
-    return failure();
 
   if (gemmSize.gemmM % param.gemmMPerBlock != 0)
     gemmSize.gemmM = gemmSize.gemmM + (param.gemmMPerBlock -
@@ -701,15 +736,424 @@ LogicalResult PopulateParams::populatePaddingKernelDerived(
   return success();
 }
 
-LogicalResult PopulateParams::obtainTuningParameters(
-    Operation *op, int64_t blockSizeOverride, const std::string &perfConfig,
-    InitParamsNonXDL &validParams, DerivedParams &gemmADerivedParam,
-    DerivedParams &gemmBDerivedParam,
-    DerivedBlockGemmParams &blockGemmDerivedParam,
-    DerivedOutParams &gemmCDerivedParam, int64_t &gridSize) {
+static std::string getSolverId(ConvOpType opType, bool xdlops,
+                               bool isGemm = false) {
+  // miopen.gemm ops have perf db records of their own, apart from those of
+  // the convolutions with the same GEMM
+  if (isGemm)
+    return xdlops ? "MlirGemmXdlops" : "MlirGemm";
+  switch (opType) {
+  case ConvOpType::Fwd:
+    return xdlops ? "ConvHipImplicitGemmForwardV4R4Xdlops"
+                  : "ConvHipImplicitGemmV4R4Fwd";
+  case ConvOpType::BwdData:
+    return xdlops ? "ConvHipImplicitGemmBwdDataV4R1Xdlops"
+                  : "ConvHipImplicitGemmBwdDataV1R1";
+  case ConvOpType::BwdWeight:
+    return xdlops ? "ConvHipImplicitGemmWrwV4R4Xdlops"
+                  : "ConvHipImplicitGemmV4R4WrW";
+  }
+  llvm_unreachable("Unknown convolution direction");
+}
+
+// The perf db solver of the convolution `ctx` describes. Kernels built in a
+// mode that changes their code have records of their own, under a suffixed
+// solver, which never fall back to those of the plain kernels: the tiles
+// tuned for one do not suit the other.
+static std::string getSolverId(const ConvolutionContext &ctx, bool xdlops) {
+  std::string solverId = getSolverId(ctx.opType, xdlops, ctx.isGemm);
+  if (ctx.splitK)
+    solverId += "_SplitK";
+  if (ctx.singleLaunch)
+    solverId += "_SingleLaunch";
+  if (ctx.deterministic)
+    solverId += "_Deterministic";
+  if (ctx.reduceKBlocks)
+    solverId += "_ReduceKBlocks";
+  if (ctx.dilationPhases)
+    solverId += "_DilationPhases";
+  // Channel-blocked layouts, by the block of each channel dimension, such
+  // as _Blocked_c4_ci4_ko4 for NCHW4c tensors.
+  if (!ctx.channelBlocks.empty()) {
+    solverId += "_Blocked";
+    for (StringRef dim : {"c", "ci", "ko"}) {
+      auto it = ctx.channelBlocks.find(dim);
+      if (it != ctx.channelBlocks.end())
+        solverId += "_" + dim.str() + std::to_string(it->second);
+    }
+  }
+  return solverId;
+}
 
+// The perf db solver of the kernel `ctx` describes when it has records of its
+// own, ahead of those it shares with the other kernels of `solverId`: the
+// GEMMs of a strided backward data convolution differ in GemmK, and so in the
+// parameters that suit them. The single kernel computing them all has a
+// solver of its own already.
+static Optional<std::string>
+getKernelSolverId(const ConvolutionContext &ctx, const std::string &solverId) {
+  if (ctx.opType != ConvOpType::BwdData || ctx.isGemm || ctx.singleLaunch)
+    return llvm::None;
+  ArrayRef<int64_t> strides = ctx.getStrideVal();
+  ArrayRef<int64_t> dilations = ctx.getDilationVal();
+  if (populateBackwardDataGemmIds(strides[0], strides[1], dilations[0],
+                                  dilations[1], ctx.convDims.y,
+                                  ctx.convDims.x)
+          .size() < 2)
+    return llvm::None;
+  return solverId + "_Gemm" + std::to_string(ctx.gemmId);
+}
+
+static bool isXdlopsOp(Operation *op) {
+  auto xdlopsV2Attr = op->getAttrOfType<BoolAttr>("xdlopsV2");
+  return xdlopsV2Attr && xdlopsV2Attr.getValue();
+}
+
+std::string mlir::miopen::getPerfDbSolverId(Operation *op) {
+  ConvolutionContext ctx = populateConvContext(op);
+  std::string solverId = getSolverId(ctx, isXdlopsOp(op));
+  return getKernelSolverId(ctx, solverId).getValueOr(solverId);
+}
+
+std::string mlir::miopen::getPerfDbVersion() {
+  std::string version;
+  llvm::raw_string_ostream os(version);
+  auto addDb = [&](llvm::StringRef path) {
+    llvm::sys::fs::file_status status;
+    if (llvm::sys::fs::status(path, status))
+      return;
+    os << path << ":" << status.getSize() << ":"
+       << llvm::sys::toTimeT(status.getLastModificationTime()) << ";";
+  };
+  for (const BinaryPerfDb *db : BinaryPerfDb::getLayers())
+    addDb(db->getPath());
+#if __MLIR_ENABLE_SQLITE__
+  addDb(MIOPEN_SYSTEM_DB_PATH);
+#endif // MLIR_ENABLE_SQLITE
+  os.flush();
+  return version;
+}
+
+StringRef mlir::miopen::getTuningSourceName(TuningSource source) {
+  switch (source) {
+  case TuningSource::PerfConfig:
+    return "perf_config";
+  case TuningSource::PerfDb:
+    return "perf_db";
+  case TuningSource::PerfDbNeighbor:
+    return "perf_db_neighbor";
+  case TuningSource::PerfDbOtherCu:
+    return "perf_db_other_cu";
+  case TuningSource::Heuristic:
+    return "heuristic";
+  case TuningSource::Padding:
+    return "padding";
+  case TuningSource::Fallback:
+    return "fallback";
+  case TuningSource::SpillFallback:
+    return "spill_fallback";
+  }
+  llvm_unreachable("Unknown tuning source");
+}
+
+static std::atomic<uint64_t> tuningSourceCounts[kNumTuningSources];
+
+void mlir::miopen::recordTuningSource(TuningSource source) {
+  tuningSourceCounts[static_cast<size_t>(source)].fetch_add(
+      1, std::memory_order_relaxed);
+}
+
+uint64_t mlir::miopen::getTuningSourceCount(TuningSource source) {
+  return tuningSourceCounts[static_cast<size_t>(source)].load(
+      std::memory_order_relaxed);
+}
+
+void mlir::miopen::resetTuningSourceCounts() {
+  for (std::atomic<uint64_t> &count : tuningSourceCounts)
+    count.store(0, std::memory_order_relaxed);
+}
+
+LogicalResult mlir::miopen::storeTuningParameters(StringRef dbPath,
+                                                  Operation *op,
+                                                  StringRef perfConfig,
+                                                  Optional<double> timeMs) {
+#if __MLIR_ENABLE_SQLITE__
   ConvolutionContext ctx = populateConvContext(op);
+  std::string solverId = getPerfDbSolverId(op);
+  SQLitePerfDb db(dbPath.str(), /*is_system=*/false, std::string(ctx.arch),
+                  ctx.num_cu);
+  bool stored = false;
+  if (isXdlopsOp(op)) {
+    InitParamsXDL params;
+    stored = params.deserialize(perfConfig.str()) &&
+             db.store(ctx, solverId, params, timeMs);
+  } else {
+    InitParamsNonXDL params;
+    stored = params.deserialize(perfConfig.str()) &&
+             db.store(ctx, solverId, params, timeMs);
+  }
+  return success(stored);
+#else
+  LLVM_DEBUG(llvm::dbgs() << "SQLite support is disabled, cannot store "
+                          << perfConfig << " in " << dbPath << "\n");
+  return failure();
+#endif // MLIR_ENABLE_SQLITE
+}
+
+Optional<std::string> mlir::miopen::lookupTuningParameters(StringRef dbPath,
+                                                           Operation *op) {
+#if __MLIR_ENABLE_SQLITE__
+  ConvolutionContext ctx = populateConvContext(op);
+  std::string solverId = getSolverId(ctx, isXdlopsOp(op));
+  SmallVector<std::string, 2> solverIds;
+  if (Optional<std::string> kernelSolverId = getKernelSolverId(ctx, solverId))
+    solverIds.push_back(*kernelSolverId);
+  solverIds.push_back(solverId);
+  SQLitePerfDb db(dbPath.str(), /*is_system=*/false, std::string(ctx.arch),
+                  ctx.num_cu);
+  for (const std::string &id : solverIds) {
+    std::ostringstream os;
+    if (isXdlopsOp(op)) {
+      InitParamsXDL params;
+      if (!db.load(ctx, id, params))
+        continue;
+      params.serialize(os);
+    } else {
+      InitParamsNonXDL params;
+      if (!db.load(ctx, id, params))
+        continue;
+      params.serialize(os);
+    }
+    return os.str();
+  }
+  return llvm::None;
+#else
+  return llvm::None;
+#endif // MLIR_ENABLE_SQLITE
+}
+
+std::vector<std::string> mlir::miopen::getRankedPerfConfigs(Operation *op,
+                                                            size_t limit) {
+  std::vector<std::string> perfConfigs;
+  auto addConfigs = [&](const auto &candidates) {
+    for (const auto &params : candidates) {
+      std::ostringstream os;
+      params.serialize(os);
+      perfConfigs.push_back(os.str());
+    }
+  };
+  if (isXdlopsOp(op))
+    addConfigs(PopulateParamsXDL().rankTuningSpace(op, limit));
+  else
+    addConfigs(PopulateParams().rankTuningSpace(op, limit));
+  return perfConfigs;
+}
+
+// Look up tuned parameters for `ctx` on `numCu` CUs in the perf dbs available
+// in this build: the shared binary perf dbs, then the system binary perf db,
+// since they need no query, then the SQLite one.
+template <typename T>
+static bool loadFromPerfDb(const ConvolutionContext &ctx, size_t numCu,
+                           const std::string &solverId, T &validParams) {
+  SmallVector<std::string, 2> solverIds;
+  if (Optional<std::string> kernelSolverId = getKernelSolverId(ctx, solverId))
+    solverIds.push_back(*kernelSolverId);
+  solverIds.push_back(solverId);
+  for (const std::string &id : solverIds) {
+    for (const BinaryPerfDb *db : BinaryPerfDb::getLayers())
+      if (db->load(ctx.arch, numCu, ctx, id, validParams))
+        return true;
+#if __MLIR_ENABLE_SQLITE__
+    if (SQLitePerfDbCache::instance().load(ctx.arch, numCu, ctx, id,
+                                           validParams))
+      return true;
+#endif // MLIR_ENABLE_SQLITE
+  }
+  return false;
+}
 
+template <typename T>
+static bool loadFromPerfDb(const ConvolutionContext &ctx,
+                           const std::string &solverId, T &validParams) {
+  return loadFromPerfDb(ctx, ctx.num_cu, solverId, validParams);
+}
+
+// The num_cu other than that of `ctx` the perf dbs have entries of its arch
+// for, the nearest on the log scale, larger ones winning ties.
+static Optional<size_t> findNearestNumCu(const ConvolutionContext &ctx) {
+  std::vector<size_t> numCus;
+  for (const BinaryPerfDb *db : BinaryPerfDb::getLayers())
+    llvm::append_range(numCus, db->getNumCus(ctx.arch));
+#if __MLIR_ENABLE_SQLITE__
+  llvm::append_range(numCus, SQLitePerfDbCache::instance().getNumCus(ctx.arch));
+#endif // MLIR_ENABLE_SQLITE
+
+  Optional<size_t> nearest;
+  double nearestDistance = 0.0;
+  for (size_t numCu : numCus) {
+    if (numCu == static_cast<size_t>(ctx.num_cu) || ctx.num_cu <= 0)
+      continue;
+    double distance = std::abs(std::log(static_cast<double>(numCu) /
+                                        static_cast<double>(ctx.num_cu)));
+    if (!nearest || distance < nearestDistance ||
+        (distance == nearestDistance && numCu > *nearest)) {
+      nearest = numCu;
+      nearestDistance = distance;
+    }
+  }
+  return nearest;
+}
+
+// Look up the parameters tuned for `ctx` on the nearest num_cu of its arch
+// the perf dbs have. GPUs in a partitioned mode, and SKUs of a chip with
+// fewer CUs enabled, have no entries of their own, but the tiles tuned for
+// the whole chip carry over: the choices that depend on the size of the grid,
+// such as the KBlocks, are derived from the actual num_cu afterwards.
+template <typename T>
+static bool loadFromOtherCuPerfDb(const ConvolutionContext &ctx,
+                                  const std::string &solverId,
+                                  T &validParams) {
+  Optional<size_t> numCu = findNearestNumCu(ctx);
+  if (!numCu)
+    return false;
+  LLVM_DEBUG(llvm::dbgs() << "Looking up the perf db entries of " << ctx.arch
+                          << " on " << *numCu << " CUs rather than "
+                          << ctx.num_cu << "\n");
+  return loadFromPerfDb(ctx, *numCu, solverId, validParams);
+}
+
+void mlir::miopen::preloadTuningParameters(
+    ArrayRef<Operation *> convOps,
+    llvm::function_ref<const ConvolutionContext &(Operation *)> getContext) {
+#if __MLIR_ENABLE_SQLITE__
+  // The XDLOPS and non-XDLOPS kernels, and the solvers they look up.
+  SmallVector<ConvolutionContext, 8> contexts[2];
+  std::vector<std::vector<std::string>> solverIds[2];
+  llvm::SmallString<8> arch;
+  int numCu = 0;
+  for (Operation *op : convOps) {
+    // Kernels with an explicit perf_config never consult the perf db.
+    auto perfConfigAttr = op->getAttrOfType<StringAttr>("perf_config");
+    if (perfConfigAttr && !perfConfigAttr.getValue().empty())
+      continue;
+    const ConvolutionContext &ctx = getContext(op);
+    // Problems for another target are left to the lazy per-op lookup.
+    if (!arch.empty() && (ctx.arch != arch || ctx.num_cu != numCu))
+      continue;
+    arch = ctx.arch;
+    numCu = ctx.num_cu;
+    bool xdlops = isXdlopsOp(op);
+    std::string solverId = getSolverId(ctx, xdlops);
+    std::vector<std::string> ids;
+    if (Optional<std::string> kernelSolverId = getKernelSolverId(ctx, solverId))
+      ids.push_back(*kernelSolverId);
+    ids.push_back(solverId);
+    contexts[xdlops].push_back(ctx);
+    solverIds[xdlops].push_back(std::move(ids));
+  }
+  if (arch.empty())
+    return;
+  SQLitePerfDbCache &cache = SQLitePerfDbCache::instance();
+  if (!contexts[false].empty())
+    cache.preload<ConvolutionContext, InitParamsNonXDL>(
+        arch, numCu, contexts[false], solverIds[false]);
+  if (!contexts[true].empty())
+    cache.preload<ConvolutionContext, InitParamsXDL>(
+        arch, numCu, contexts[true], solverIds[true]);
+#endif // MLIR_ENABLE_SQLITE
+}
+
+// Params of the `solverId` entries tuned for neighbors of `ctx`, closest
+// first. Neighbors may only differ in batch size and image size; distance is
+// measured on the log scale of both.
+static std::vector<std::string>
+findNeighborParams(const ConvolutionContext &ctx, const std::string &solverId) {
+  std::vector<std::string> result;
+#if __MLIR_ENABLE_SQLITE__
+  std::vector<std::string> freeColumns = {"batchsize", "in_h", "in_w"};
+  const ConvolutionDims &dims = ctx.convDims;
+  double batch = dims.n;
+  double image = dims.hi * dims.wi;
+
+  std::vector<std::pair<double, std::string>> neighbors;
+  SQLitePerfDbCache::instance().findNeighbors(
+      ctx.arch, ctx.num_cu, ctx, solverId, freeColumns,
+      [&](ArrayRef<std::string> freeValues, StringRef params) {
+        int64_t n, h, w;
+        if (StringRef(freeValues[0]).getAsInteger(10, n) ||
+            StringRef(freeValues[1]).getAsInteger(10, h) ||
+            StringRef(freeValues[2]).getAsInteger(10, w) || n <= 0 ||
+            h <= 0 || w <= 0)
+          return;
+        double distance = std::abs(std::log(n / batch)) +
+                          std::abs(std::log(h * w / image));
+        neighbors.emplace_back(distance, params.str());
+      });
+  std::stable_sort(neighbors.begin(), neighbors.end(),
+                   [](const auto &lhs, const auto &rhs) {
+                     return lhs.first < rhs.first;
+                   });
+  for (auto &neighbor : neighbors)
+    result.push_back(std::move(neighbor.second));
+#endif // MLIR_ENABLE_SQLITE
+  return result;
+}
+
+// Halve the block tile of a borrowed config until it divides `gemmSize`.
+// Halving a tile halves the threads computing it.
+static InitParamsNonXDL adaptToGemmSize(InitParamsNonXDL params,
+                                        const GemmSize &gemmSize) {
+  while (gemmSize.gemmM % params.gemmMPerBlock != 0 &&
+         params.gemmMPerBlock > 16) {
+    params.gemmMPerBlock /= 2;
+    params.blockSize = std::max<int64_t>(params.blockSize / 2, 64);
+  }
+  while (gemmSize.gemmN % params.gemmNPerBlock != 0 &&
+         params.gemmNPerBlock > 16) {
+    params.gemmNPerBlock /= 2;
+    params.blockSize = std::max<int64_t>(params.blockSize / 2, 64);
+  }
+  while (gemmSize.gemmK % params.gemmKPerBlock != 0 &&
+         params.gemmKPerBlock > 4)
+    params.gemmKPerBlock /= 2;
+  return params;
+}
+
+LogicalResult PopulateParams::loadNeighborFromPerfDb(
+    const ConvolutionContext &ctx, const GemmSize &gemmSize,
+    const std::string &solverId, InitParamsNonXDL &validParams) {
+  for (const std::string &neighbor : findNeighborParams(ctx, solverId)) {
+    InitParamsNonXDL tuned;
+    if (!tuned.deserialize(neighbor))
+      continue;
+    for (const InitParamsNonXDL &candidate :
+         {tuned, adaptToGemmSize(tuned, gemmSize)}) {
+      GemmSize candidateGemmSize = gemmSize;
+      DerivedParams gemmADerivedParam;
+      DerivedParams gemmBDerivedParam;
+      DerivedBlockGemmParams blockGemmDerivedParam;
+      DerivedOutParams gemmCDerivedParam;
+      int64_t gridSize = 0;
+      if (failed(populateDerived(ctx, candidate, candidateGemmSize,
+                                 gemmADerivedParam, gemmBDerivedParam,
+                                 blockGemmDerivedParam, gemmCDerivedParam,
+                                 gridSize)))
+        continue;
+      LLVM_DEBUG(llvm::dbgs() << "Adapted perf db neighbor " << neighbor
+                              << " to " << genDebugForParams(candidate));
+      validParams = candidate;
+      return success();
+    }
+  }
+  return failure();
+}
+
+LogicalResult PopulateParams::obtainTuningParameters(
+    const ConvolutionContext &ctx, int64_t blockSizeOverride,
+    const std::string &perfConfig, InitParamsNonXDL &validParams,
+    DerivedParams &gemmADerivedParam, DerivedParams &gemmBDerivedParam,
+    DerivedBlockGemmParams &blockGemmDerivedParam,
+    DerivedOutParams &gemmCDerivedParam, int64_t &gridSize) {
   GemmSize gemmSize;
   obtainGemmSize(ctx, gemmSize);
 
@@ -720,6 +1164,7 @@ LogicalResult PopulateParams::obtainTuningParameters(
     bool isValidPerfConfig = validParams.deserialize(perfConfig);
     if (isValidPerfConfig) {
       LLVM_DEBUG(llvm::dbgs() << genDebugForParams(validParams));
+      tuningSource = TuningSource::PerfConfig;
       return populateDerived(ctx, validParams, gemmSize, gemmADerivedParam,
                              gemmBDerivedParam, blockGemmDerivedParam,
                              gemmCDerivedParam, gridSize);
@@ -728,28 +1173,32 @@ LogicalResult PopulateParams::obtainTuningParameters(
     return failure();
   }
 
-#if __MLIR_ENABLE_SQLITE__
-  std::string solverId;
-  if (ctx.opType == ConvOpType::Fwd) {
-    solverId = "ConvHipImplicitGemmV4R4Fwd";
-  } else if (ctx.opType == ConvOpType::BwdData) {
-    solverId = "ConvHipImplicitGemmBwdDataV1R1";
-  } else {
-    solverId = "ConvHipImplicitGemmV4R4WrW";
-  }
-
-  SQLitePerfDb perfDb = getDb(ctx.arch, ctx.num_cu);
-  bool loadRes = perfDb.load(ctx, solverId, validParams);
+  std::string solverId = getSolverId(ctx, /*xdlops=*/false);
+  bool loadRes = loadFromPerfDb(ctx, solverId, validParams);
   if (loadRes) {
     LLVM_DEBUG(llvm::dbgs() << genDebugForParams(validParams));
+    tuningSource = TuningSource::PerfDb;
     return populateDerived(ctx, validParams, gemmSize, gemmADerivedParam,
                            gemmBDerivedParam, blockGemmDerivedParam,
-                           gemmCDstPerWrite, gridSize);
-  } else {
-    LLVM_DEBUG(llvm::dbgs()
-               << "DB load failed, falling back to backup path.\n");
+                           gemmCDerivedParam, gridSize);
   }
-#endif // MLIR_ENABLE_SQLITE
+  if (loadFromOtherCuPerfDb(ctx, solverId, validParams) &&
+      succeeded(populateDerived(ctx, validParams, gemmSize, gemmADerivedParam,
+                                gemmBDerivedParam, blockGemmDerivedParam,
+                                gemmCDerivedParam, gridSize))) {
+    LLVM_DEBUG(llvm::dbgs() << genDebugForParams(validParams));
+    tuningSource = TuningSource::PerfDbOtherCu;
+    return success();
+  }
+  if (succeeded(
+          loadNeighborFromPerfDb(ctx, gemmSize, solverId, validParams))) {
+    tuningSource = TuningSource::PerfDbNeighbor;
+    return populateDerived(ctx, validParams, gemmSize, gemmADerivedParam,
+                           gemmBDerivedParam, blockGemmDerivedParam,
+                           gemmCDerivedParam, gridSize);
+  }
+  LLVM_DEBUG(llvm::dbgs() << "DB load failed, falling back to backup path.\n");
+  tuningSource = TuningSource::Heuristic;
 
   // Backup path: Use the set of default tuning parameters
   LogicalResult res = failure();
@@ -778,18 +1227,35 @@ LogicalResult PopulateParams::obtainTuningParameters(
                             << " PARAMETERS!\n");
 
       LLVM_DEBUG(llvm::dbgs() << "BUT PADDING KERNEL CAN EXECUTE IT\n");
-
-      for (auto &params : initParameters) {
-        res = populatePaddingKernelDerived(
-            ctx, params, gemmSize, gemmADerivedParam, gemmBDerivedParam,
-            blockGemmDerivedParam, gemmCDerivedParam, gridSize);
-
-        if (failed(res)) {
+      tuningSource = TuningSource::Padding;
+
+      // Any config can tile the gemm once it is padded to its tiles, which
+      // masks their last tiles. Without a cost model, take the first config
+      // that pads the least.
+      double leastWork = std::numeric_limits<double>::max();
+      for (const InitParamsNonXDL &params : initParameters) {
+        GemmSize paddedSize = gemmSize;
+        DerivedParams paddedADerivedParam, paddedBDerivedParam;
+        DerivedBlockGemmParams paddedBlockGemmDerivedParam;
+        DerivedOutParams paddedCDerivedParam;
+        int64_t paddedGridSize = 0;
+        if (failed(populatePaddingKernelDerived(
+                ctx, params, paddedSize, paddedADerivedParam,
+                paddedBDerivedParam, paddedBlockGemmDerivedParam,
+                paddedCDerivedParam, paddedGridSize)))
           continue;
-        }
-
+        double paddedWork = static_cast<double>(paddedSize.gemmM) *
+                            paddedSize.gemmN * paddedSize.gemmK;
+        if (paddedWork >= leastWork)
+          continue;
+        leastWork = paddedWork;
+        res = success();
         validParams = params;
-        break;
+        gemmADerivedParam = paddedADerivedParam;
+        gemmBDerivedParam = paddedBDerivedParam;
+        blockGemmDerivedParam = paddedBlockGemmDerivedParam;
+        gemmCDerivedParam = paddedCDerivedParam;
+        gridSize = paddedGridSize;
       }
   } else {
     LLVM_DEBUG(llvm::dbgs() << "Successfully picked tuning params from backup"
@@ -800,10 +1266,102 @@ LogicalResult PopulateParams::obtainTuningParameters(
 }
 
 ArrayRef<InitParamsNonXDL>
-PopulateParams::getTuningParameters(ConvOpType dir, Type dataType) const {
+PopulateParams::getTuningParameters(ConvOpType dir, Type dataType,
+                                    bool isGemm) const {
   return {initParameters, nInitParameters};
 }
 
+// Search space of the exhaustive tuner. The heuristic tables above are
+// subsets of these ranges.
+static constexpr int64_t kBlockSizeRange[] = {64, 128, 256};
+static constexpr int64_t kMPerBlockRange[] = {32, 64, 128};
+static constexpr int64_t kNPerBlockRange[] = {32, 64, 128};
+static constexpr int64_t kKPerBlockRange[] = {4, 8, 16};
+static constexpr int64_t kMPerThreadRange[] = {2, 4};
+static constexpr int64_t kNPerThreadRange[] = {2, 4};
+
+// Take the next digit of the mixed-radix tuning space index `index`.
+template <typename T, size_t N>
+static T takeDigit(const T (&range)[N], size_t &index) {
+  T value = range[index % N];
+  index /= N;
+  return value;
+}
+
+template <>
+TuningSpace<InitParamsNonXDL>::TuningSpace(Operation *op)
+    : ctx(std::make_shared<ConvolutionContext>(populateConvContext(op))) {
+  obtainGemmSize(*ctx, gemmSize);
+}
+
+template <> size_t TuningSpace<InitParamsNonXDL>::rawSize() const {
+  return llvm::array_lengthof(kBlockSizeRange) *
+         llvm::array_lengthof(kMPerBlockRange) *
+         llvm::array_lengthof(kNPerBlockRange) *
+         llvm::array_lengthof(kKPerBlockRange) *
+         llvm::array_lengthof(kMPerThreadRange) *
+         llvm::array_lengthof(kNPerThreadRange);
+}
+
+template <>
+bool TuningSpace<InitParamsNonXDL>::accept(size_t index,
+                                           InitParamsNonXDL &params) const {
+  int64_t nPerThread = takeDigit(kNPerThreadRange, index);
+  int64_t mPerThread = takeDigit(kMPerThreadRange, index);
+  int64_t kPerBlock = takeDigit(kKPerBlockRange, index);
+  int64_t nPerBlock = takeDigit(kNPerBlockRange, index);
+  int64_t mPerBlock = takeDigit(kMPerBlockRange, index);
+  int64_t blockSize = takeDigit(kBlockSizeRange, index);
+  params = InitParamsNonXDL(blockSize, mPerBlock, nPerBlock, kPerBlock,
+                            mPerThread, nPerThread);
+
+  PopulateParams populator;
+  GemmSize candidateGemmSize = gemmSize;
+  // Stage 1: the tile has to divide the gemm.
+  if (failed(populator.isValidGemm(params, candidateGemmSize)))
+    return false;
+
+  // Stage 2: the block copies and the block gemm have to be derivable.
+  DerivedParams gemmADerivedParam;
+  DerivedParams gemmBDerivedParam;
+  DerivedBlockGemmParams blockGemmDerivedParam;
+  DerivedOutParams gemmCDerivedParam;
+  int64_t gridSize = 0;
+  return succeeded(populator.populateDerived(
+      *ctx, params, candidateGemmSize, gemmADerivedParam, gemmBDerivedParam,
+      blockGemmDerivedParam, gemmCDerivedParam, gridSize));
+}
+
+TuningSpace<InitParamsNonXDL>
+PopulateParams::getTuningSpace(Operation *op) const {
+  return TuningSpace<InitParamsNonXDL>(op);
+}
+
+std::vector<InitParamsNonXDL> PopulateParams::rankTuningSpace(Operation *op,
+                                                              size_t limit) {
+  ConvolutionContext ctx = populateConvContext(op);
+  GemmSize gemmSize;
+  obtainGemmSize(ctx, gemmSize);
+
+  std::vector<InitParamsNonXDL> ranked;
+  for (const InitParamsNonXDL &params : initParameters) {
+    if (ranked.size() == limit)
+      break;
+    GemmSize candidateGemmSize = gemmSize;
+    DerivedParams gemmADerivedParam;
+    DerivedParams gemmBDerivedParam;
+    DerivedBlockGemmParams blockGemmDerivedParam;
+    DerivedOutParams gemmCDerivedParam;
+    int64_t gridSize = 0;
+    if (succeeded(populateDerived(ctx, params, candidateGemmSize,
+                                  gemmADerivedParam, gemmBDerivedParam,
+                                  blockGemmDerivedParam, gemmCDerivedParam,
+                                  gridSize)))
+      ranked.push_back(params);
+  }
+  return ranked;
+}
+
 const InitParams &PopulateParams::getUniversalParameters() const {
   return universalParameters;
 }
@@ -856,37 +1414,161 @@ PopulateParamsXDL::initParametersForwardI8[
   {16, 16, 32, 16, 16, 1, false, false},
   {16, 16, 16, 16, 16, 1, false, false},
 };
+
+const InitParamsXDL
+PopulateParamsXDL::initParametersGemm[
+  PopulateParamsXDL::nInitParametersGemm] = {
+  // M/block N/block K/block M/wave N/wave kPack aCopyMore bCopyMore
+  // Plain GEMMs are often large and square, and their contiguous dimensions
+  // are never split by a filter window, so larger tiles come first.
+  {256, 128, 4, 128, 64, 4, false, false},
+  {128, 128, 4, 64, 64, 4, false, false},
+  {128, 128, 8, 64, 64, 1, false, false},
+  {64, 128, 4, 32, 64, 4, false, false},
+  {128, 64, 4, 64, 32, 4, false, false},
+  {64, 64, 4, 32, 32, 4, false, false},
+  {64, 64, 8, 32, 32, 1, false, false},
+  {32, 64, 4, 32, 64, 1, false, false},
+  {16, 16, 16, 16, 16, 1, false, false},
+  {16, 16, 4, 16, 16, 1, false, false},
+};
+
+const InitParamsXDL
+PopulateParamsXDL::initParametersWmma[
+  PopulateParamsXDL::nInitParametersWmma] = {
+  // M/block N/block K/block M/wave N/wave kPack aCopyMore bCopyMore
+  {128, 128, 4, 64, 32, 16, false, false},
+  {128, 64, 4, 64, 32, 16, false, false},
+  {64, 64, 4, 32, 32, 16, false, false},
+  {64, 32, 4, 32, 32, 16, false, false},
+  {32, 32, 4, 16, 16, 16, false, false},
+  {16, 16, 4, 16, 16, 16, false, false},
+};
+
+const InitParamsXDL
+PopulateParamsXDL::initParametersFp8[
+  PopulateParamsXDL::nInitParametersFp8] = {
+  // M/block N/block K/block M/wave N/wave kPack aCopyMore bCopyMore
+  {128, 64, 8, 32, 32, 8, false, false},
+  {64, 128, 8, 32, 32, 8, false, false},
+  {64, 64, 8, 32, 32, 8, false, false},
+  {32, 32, 8, 16, 16, 8, false, false},
+  // Without KPACK, K/block holds whole operands of both input blocks
+  {64, 64, 16, 32, 32, 1, false, false},
+  {32, 32, 16, 32, 32, 1, false, false},
+  {32, 32, 32, 16, 16, 1, false, false},
+  {16, 16, 32, 16, 16, 1, false, false},
+};
+
+const InitParamsXDL
+PopulateParamsXDL::initParametersXf32[
+  PopulateParamsXDL::nInitParametersXf32] = {
+  // M/block N/block K/block M/wave N/wave kPack aCopyMore bCopyMore
+  {128, 128, 8, 32, 32, 4, false, false},
+  {128, 64, 8, 32, 32, 4, false, false},
+  {64, 128, 8, 32, 32, 4, false, false},
+  {64, 64, 8, 32, 32, 4, false, false},
+  {32, 32, 8, 16, 16, 4, false, false},
+  // Without KPACK, K/block holds whole operands of both input blocks
+  {64, 64, 8, 32, 32, 1, false, false},
+  {32, 32, 8, 32, 32, 1, false, false},
+  {32, 32, 16, 16, 16, 1, false, false},
+  {16, 16, 16, 16, 16, 1, false, false},
+};
+
+const InitParamsXDL
+PopulateParamsXDL::initParametersSparse[
+  PopulateParamsXDL::nInitParametersSparse] = {
+  // M/block N/block K/block M/wave N/wave kPack aCopyMore bCopyMore
+  {128, 128, 8, 32, 32, 8, false, false},
+  {128, 64, 8, 32, 32, 8, false, false},
+  {64, 128, 8, 32, 32, 8, false, false},
+  {64, 64, 8, 32, 32, 8, false, false},
+  {32, 32, 8, 16, 16, 8, false, false},
+  // i8 operands take KPACK = 16 vectors
+  {128, 64, 4, 32, 32, 16, false, false},
+  {64, 128, 4, 32, 32, 16, false, false},
+  {64, 64, 4, 32, 32, 16, false, false},
+  {32, 32, 4, 16, 16, 16, false, false},
+};
+
+const InitParamsXDL
+PopulateParamsXDL::initParametersF64[
+  PopulateParamsXDL::nInitParametersF64] = {
+  // M/block N/block K/block M/wave N/wave kPack aCopyMore bCopyMore
+  {32, 32, 16, 16, 16, 1, false, false},
+  {32, 32, 8, 16, 16, 1, false, false},
+  {32, 16, 16, 16, 16, 1, false, false},
+  {16, 32, 16, 16, 16, 1, false, false},
+  {16, 16, 16, 16, 16, 1, false, false},
+  {16, 16, 4, 16, 16, 1, false, false},
+};
 // clang-format on
 
 const InitParams PopulateParamsXDL::universalParameters = {32, 64, 4};
 
+void InitParamsXDL::serialize(std::ostream &stream) const {
+  Serializable<InitParamsXDL>::serialize(stream);
+  if (ldsStages != 0)
+    stream << ',' << ldsStages;
+}
+
+bool InitParamsXDL::deserialize(const std::string &s) {
+  // The stage count, if any, follows the eighth comma.
+  constexpr size_t kNumFields = 8;
+  size_t stagesPos = std::string::npos;
+  size_t commas = 0;
+  for (size_t i = 0, e = s.size(); i < e; ++i) {
+    if (s[i] == ',' && ++commas == kNumFields) {
+      stagesPos = i;
+      break;
+    }
+  }
+  int64_t stages = 0;
+  if (stagesPos != std::string::npos) {
+    std::istringstream ss(s.substr(stagesPos + 1));
+    if (!(ss >> stages) || stages < 1)
+      return false;
+  }
+  if (!Serializable<InitParamsXDL>::deserialize(s.substr(0, stagesPos)))
+    return false;
+  ldsStages = stages;
+  return true;
+}
+
 int64_t PopulateParamsXDL::obtainBlockSize(const InitParamsXDL &params,
                                            int64_t waveSize) {
   return waveSize * params.gemmNPerBlock * params.gemmMPerBlock /
          (params.gemmMPerWave * params.gemmNPerWave);
 }
 
-LogicalResult PopulateParamsXDL::getKBlocks(ConvolutionContext &ctx,
+LogicalResult PopulateParamsXDL::getKBlocks(const ConvolutionContext &ctx,
                                             const InitParamsXDL &params,
                                             int64_t &gemmKBlocks) {
   ConvolutionDims convDims = ctx.getConvDims();
 
-  return calculateKBlockNum(convDims, params.gemmMPerBlock,
+  int64_t maxKBlocks = ctx.reduceKBlocks
+                           ? std::max<int64_t>(ctx.reductionKBlocks, 1)
+                           : INT64_MAX;
+  return calculateKBlockNum(ctx.opType, convDims, params.gemmMPerBlock,
                             params.gemmNPerBlock, params.gemmKPerBlock,
-                            params.gemmKPack, ctx.num_cu, gemmKBlocks);
+                            params.gemmKPack, ctx.num_cu, gemmKBlocks,
+                            maxKBlocks);
 }
 
 LogicalResult PopulateParamsXDL::calculateGemmABlockCopyPerformanceParameters(
-    const InitParamsXDL &param, ConvolutionContext &ctx,
+    const InitParamsXDL &param, const ConvolutionContext &ctx,
     DerivedParams &derived) {
-  int64_t blockSize = obtainBlockSize(param, waveSize);
+  int64_t blockSize =
+      obtainBlockSize(param, XdlopsCodeSelection::getWaveSize(ctx.arch));
   return calculateInputDerivedParams(param, blockSize, ctx, true, derived);
 }
 
 LogicalResult PopulateParamsXDL::calculateGemmBBlockCopyPerformanceParameters(
-    const InitParamsXDL &param, ConvolutionContext &ctx,
+    const InitParamsXDL &param, const ConvolutionContext &ctx,
     DerivedParams &derived) {
-  int64_t blockSize = obtainBlockSize(param, waveSize);
+  int64_t blockSize =
+      obtainBlockSize(param, XdlopsCodeSelection::getWaveSize(ctx.arch));
   return calculateInputDerivedParams(param, blockSize, ctx, false, derived);
 }
 
@@ -910,7 +1592,8 @@ LogicalResult PopulateParamsXDL::calculateLdsNumberOfByte(
       param.gemmKPerBlock *
       math_util::integer_least_multiple(param.gemmNPerBlock, max_lds_align);
 
-  ldsSize = (a_block_space + b_block_space) * sizeof(float);
+  ldsSize =
+      (a_block_space + b_block_space) * sizeof(float) * getLdsStages(param);
 
   if (ldsSize > 64 * 1024) {
     return failure();
@@ -920,13 +1603,25 @@ LogicalResult PopulateParamsXDL::calculateLdsNumberOfByte(
 }
 
 LogicalResult PopulateParamsXDL::isValidBlockwiseGemmXDLOPS(
-    const InitParamsXDL &param, ConvolutionContext &ctx, int64_t blockSize) {
+    const InitParamsXDL &param, const ConvolutionContext &ctx,
+    int64_t blockSize) {
   // TBD: support fp16/bf16
 
   auto dataType = ctx.getDataType();
   std::vector<std::tuple<int, int, int>> validWaveGemmSize;
 
-  if (dataType.isInteger(8)) {
+  if (XdlopsCodeSelection::hasWmma(ctx.arch)) {
+    // WMMA repeats 16x16 tiles over the wave tile.
+    // clang-format off
+    validWaveGemmSize = {
+      std::make_tuple(64, 32, 1),
+      std::make_tuple(32, 64, 1),
+      std::make_tuple(32, 32, 1),
+      std::make_tuple(32, 16, 1),
+      std::make_tuple(16, 32, 1),
+      std::make_tuple(16, 16, 1)};
+    // clang-format on
+  } else if (dataType.isInteger(8)) {
     // Note: we only support two reduction xdlops in i8 therefore the
     // limited selection below
     // clang-format off
@@ -968,9 +1663,46 @@ LogicalResult PopulateParamsXDL::isValidBlockwiseGemmXDLOPS(
                    }))
     return failure();
 
+  // The chip needs an instruction for the wave tile, and KPack and KPerBlock
+  // have to hold whole operands of it.
+  FailureOr<XdlopsCodeSelection> xcs =
+      XdlopsCodeSelection::get(dataType, param.gemmMPerWave,
+                               param.gemmNPerWave, ctx.arch, ctx.fp8Format,
+                               ctx.xf32, ctx.sparse);
+  if (failed(xcs)) {
+    LLVM_DEBUG(llvm::dbgs() << "No XDLOPS instruction for the wave tile.\n");
+    return failure();
+  }
+  bool isKReduction = xcs->isKReduction;
+  if (xcs->isWmma && param.gemmKPack < xcs->k_base) {
+    LLVM_DEBUG(llvm::dbgs() << "WMMA needs a KPACK of at least "
+                            << xcs->k_base << ".\n");
+    return failure();
+  }
+  // The groups of 4 sparse weights are decompressed from whole KPACK vectors.
+  if (xcs->isSparse && param.gemmKPack < xcs->k_base) {
+    LLVM_DEBUG(llvm::dbgs() << "Sparse XDLOPS need a KPACK of at least "
+                            << xcs->k_base << ".\n");
+    return failure();
+  }
+  if (param.gemmKPack > 1 && param.gemmKPack % xcs->k_base != 0) {
+    LLVM_DEBUG(llvm::dbgs() << "KPACK " << param.gemmKPack
+                            << " is not a multiple of k_base " << xcs->k_base
+                            << ".\n");
+    return failure();
+  }
+  if (param.gemmKPack == 1 &&
+      param.gemmKPerBlock <
+          xcs->k_base * (isKReduction ? xcs->num_input_blks : 1)) {
+    LLVM_DEBUG(llvm::dbgs() << "KPerBlock " << param.gemmKPerBlock
+                            << " is too small for k_base " << xcs->k_base
+                            << ".\n");
+    return failure();
+  }
+
   // fail with blockSize >= 512
   /// \todo fix the issue with blockSize >= 512
-  if (blockSize < 64 || blockSize > 256)
+  if (blockSize < xcs->waveSize || blockSize > 256)
     return failure();
 
   if ((param.gemmMPerBlock % param.gemmMPerWave) != 0)
@@ -984,10 +1716,17 @@ LogicalResult PopulateParamsXDL::isValidBlockwiseGemmXDLOPS(
   if ((param.gemmKPerBlock % param.gemmKPack) != 0)
     return failure();
 
+  // The restrictions below are specific to MFMA.
+  if (xcs->isWmma)
+    return success();
+
   // Reject invalid KPACK values.
+  // For all types: reject anything wider than 8.
   // For fp32: reject anything wider than 4.
+  // For fp64: reject anything wider than 2, the 16 bytes of an LDS access.
   // For fp16/bf16: reject anything narrower than 4, or greater than 8.
-  if (dataType.isF32() && param.gemmKPack > 4) {
+  if (param.gemmKPack > 8 || (dataType.isF32() && param.gemmKPack > 4) ||
+      (dataType.isF64() && param.gemmKPack > 2)) {
     LLVM_DEBUG(llvm::dbgs() << "Invalid KPACK tuning parameter: "
                             << param.gemmKPack << "\n");
     return failure();
@@ -1034,11 +1773,55 @@ LogicalResult PopulateParamsXDL::isValidBlockwiseGemmXDLOPS(
   return success();
 }
 
+// Per-thread register budgets of the feasibility estimate. Accumulators live
+// in the 256 AGPRs. Block copy buffers may take half of the 256 VGPRs; the
+// rest is left for addresses and XDLOPS operands.
+static constexpr int64_t kAccumulatorRegisterBudget = 256;
+static constexpr int64_t kCopyRegisterBudget = 128;
+
+LogicalResult PopulateParamsXDL::isFeasibleXDLOPS(const InitParamsXDL &param,
+                                                  const ConvolutionContext &ctx,
+                                                  int64_t blockSize) {
+  // calculateLdsNumberOfByte() pads the tiles for alignment, so the unpadded
+  // size bounds what it computes from below.
+  int64_t ldsLowerBound = param.gemmKPerBlock *
+                          (param.gemmMPerBlock + param.gemmNPerBlock) *
+                          sizeof(float) * getLdsStages(param);
+  if (ldsLowerBound > 64 * 1024) {
+    LLVM_DEBUG(llvm::dbgs() << "LDS size too large.\n");
+    return failure();
+  }
+
+  // Every thread accumulates its share of the C tile in 32-bit registers.
+  int64_t accumulatorRegisters =
+      param.gemmMPerBlock * param.gemmNPerBlock / blockSize;
+  if (accumulatorRegisters > kAccumulatorRegisterBudget) {
+    LLVM_DEBUG(llvm::dbgs() << "Needs " << accumulatorRegisters
+                            << " accumulator registers per thread.\n");
+    return failure();
+  }
+
+  // It also stages its share of the A and B block tiles in registers on the
+  // way from global memory to LDS.
+  int64_t elementBytes =
+      llvm::divideCeil(ctx.getDataType().getIntOrFloatBitWidth(), 8);
+  int64_t copyBytes = param.gemmKPerBlock * param.gemmKPack *
+                      (param.gemmMPerBlock + param.gemmNPerBlock) *
+                      elementBytes;
+  int64_t copyRegisters = llvm::divideCeil(copyBytes, 4 * blockSize);
+  if (copyRegisters > kCopyRegisterBudget) {
+    LLVM_DEBUG(llvm::dbgs() << "Needs " << copyRegisters
+                            << " block copy registers per thread.\n");
+    return failure();
+  }
+  return success();
+}
+
 LogicalResult PopulateParamsXDL::populateDerived(
-    ConvolutionContext &ctx, const InitParamsXDL &params, GemmSize &gemmSize,
-    DerivedParams &gemmADerivedParam, DerivedParams &gemmBDerivedParam,
-    DerivedOutParams &gemmCDerivedParam, int64_t &blockSize, int64_t &gridSize,
-    int64_t &gemmKBlocks) {
+    const ConvolutionContext &ctx, const InitParamsXDL &params,
+    GemmSize &gemmSize, DerivedParams &gemmADerivedParam,
+    DerivedParams &gemmBDerivedParam, DerivedOutParams &gemmCDerivedParam,
+    int64_t &blockSize, int64_t &gridSize, int64_t &gemmKBlocks) {
   LogicalResult res = isValidGemm(params, gemmSize);
   if (failed(res)) {
     LLVM_DEBUG(llvm::dbgs()
@@ -1050,12 +1833,13 @@ LogicalResult PopulateParamsXDL::populateDerived(
   }
 
   if (ctx.opType == ConvOpType::BwdData &&
-      failed(isValidGridGemmXdlops(gemmSize))) {
+      failed(isValidGridGemmXdlops(ctx, gemmSize))) {
     LLVM_DEBUG(llvm::dbgs()
                << "Invalid XDLops gemm sizes for backward data.\n");
     return failure();
   }
-  blockSize = obtainBlockSize(params, waveSize);
+  blockSize =
+      obtainBlockSize(params, XdlopsCodeSelection::getWaveSize(ctx.arch));
 
   res = isValidBlockwiseGemmXDLOPS(params, ctx, blockSize);
   if (failed(res)) {
@@ -1063,6 +1847,10 @@ LogicalResult PopulateParamsXDL::populateDerived(
     return failure();
   }
 
+  res = isFeasibleXDLOPS(params, ctx, blockSize);
+  if (failed(res))
+    return failure();
+
   res = calculateGemmABlockCopyPerformanceParameters(params, ctx,
                                                      gemmADerivedParam);
   if (failed(res)) {
@@ -1088,10 +1876,31 @@ LogicalResult PopulateParamsXDL::populateDerived(
     return failure();
   }
 
+  FailureOr<RegisterUsage> maybeRegisters =
+      estimateRegisterUsage(params, ctx, blockSize);
+  if (failed(maybeRegisters)) {
+    LLVM_DEBUG(llvm::dbgs() << "No XDLOPS instruction for the wave tile.\n");
+    return failure();
+  }
+  const RegisterUsage &registers = *maybeRegisters;
+  if (registers.spilledBytes() > 0) {
+    LLVM_DEBUG(llvm::dbgs() << "Would spill " << registers.spilledBytes()
+                            << " bytes per thread.\n");
+    return failure();
+  }
+  if (registers.wavesPerSimd() < minWavesPerSimd) {
+    LLVM_DEBUG(llvm::dbgs() << "Occupancy of " << registers.wavesPerSimd()
+                            << " waves per SIMD is below the target of "
+                            << minWavesPerSimd << ".\n");
+    return failure();
+  }
+
   // parameters derivable from tunable parameters.
   gemmKBlocks = 1;
-  if (ctx.opType == ConvOpType::BwdWeight &&
-      (ctx.getDataType().isF32() || ctx.getDataType().isF16())) {
+  bool splitsK = (ctx.opType == ConvOpType::BwdWeight &&
+                  (!ctx.deterministic || ctx.reduceKBlocks)) ||
+                 (ctx.opType == ConvOpType::Fwd && ctx.splitK);
+  if (splitsK && (ctx.getDataType().isF32() || ctx.getDataType().isF16())) {
     res = getKBlocks(ctx, params, gemmKBlocks);
     if (failed(res)) {
       LLVM_DEBUG(llvm::dbgs()
@@ -1110,20 +1919,12 @@ LogicalResult PopulateParamsXDL::populateDerived(
 }
 
 LogicalResult PopulateParamsXDL::populatePaddingKernelDerived(
-    ConvolutionContext &ctx, const InitParamsXDL &param, GemmSize &gemmSize,
-    DerivedParams &gemmADerivedParam, DerivedParams &gemmBDerivedParam,
-    DerivedOutParams &gemmCDerivedParam, int64_t &blockSize,
-    int64_t &gridSize) {
+    const ConvolutionContext &ctx, const InitParamsXDL &param,
+    GemmSize &gemmSize, DerivedParams &gemmADerivedParam,
+    DerivedParams &gemmBDerivedParam, DerivedOutParams &gemmCDerivedParam,
+    int64_t &blockSize, int64_t &gridSize) {
 
   LogicalResult res = failure();
-  InitParams paddingParam = getUniversalParameters();
-
-  // find complete config for paddingParam
-  // if mblock,nblock,kblock is the same with this tuning parameter
-  if (paddingParam.gemmMPerBlock != param.gemmMPerBlock ||
-      paddingParam.gemmNPerBlock != param.gemmNPerBlock ||
-      paddingParam.gemmKPerBlock != param.gemmKPerBlock)
-    return failure();
 
   if (gemmSize.gemmM % param.gemmMPerBlock != 0)
     gemmSize.gemmM = gemmSize.gemmM + (param.gemmMPerBlock -
@@ -1137,7 +1938,8 @@ LogicalResult PopulateParamsXDL::populatePaddingKernelDerived(
     gemmSize.gemmK = gemmSize.gemmK + (param.gemmKPerBlock -
                                        gemmSize.gemmK % param.gemmKPerBlock);
 
-  blockSize = obtainBlockSize(param, waveSize);
+  blockSize =
+      obtainBlockSize(param, XdlopsCodeSelection::getWaveSize(ctx.arch));
   res = calculateGemmABlockCopyPerformanceParameters(param, ctx,
                                                      gemmADerivedParam);
 
@@ -1174,10 +1976,134 @@ LogicalResult PopulateParamsXDL::populatePaddingKernelDerived(
   return success();
 }
 
-LogicalResult PopulateParamsXDL::isValidGridGemmXdlops(GemmSize &gemmSize) {
+// Constants of the cost model ranking XDLOPS candidates.
+// Waves per CU needed to hide memory latency.
+static constexpr int64_t kTargetWavesPerCu = 8;
+static constexpr int64_t kMaxWorkgroupsPerCu = 8;
+static constexpr int64_t kLdsBytesPerCu = 64 * 1024;
+// Widest global load (dwordx4).
+static constexpr int64_t kMaxGlobalLoadBytes = 16;
+// Tile edge beyond which data reuse stops paying off.
+static constexpr int64_t kReuseTileSize = 128;
+// Fixed cost of a main loop iteration: barriers and the LDS round trip.
+static constexpr double kLoopOverheadCycles = 256.0;
+
+FailureOr<double> PopulateParamsXDL::estimateEfficiency(
+    const ConvolutionContext &ctx, const InitParamsXDL &params,
+    const GemmSize &gemmSize, const DerivedParams &gemmADerivedParam,
+    const DerivedParams &gemmBDerivedParam, int64_t blockSize,
+    int64_t gridSize) {
+  Type dataType = ctx.getDataType();
+  int64_t elementBytes =
+      std::max<int64_t>(dataType.getIntOrFloatBitWidth() / 8, 1);
+  int64_t wavesPerBlock = std::max<int64_t>(
+      blockSize / XdlopsCodeSelection::getWaveSize(ctx.arch), 1);
+  int64_t numCu = std::max<int64_t>(ctx.num_cu, 1);
+
+  // Occupancy: workgroups resident on a CU are bounded by LDS and by how many
+  // workgroups the grid hands to each CU.
+  std::size_t ldsSize = 0;
+  (void)calculateLdsNumberOfByte(params, ctx, gemmADerivedParam,
+                                 gemmBDerivedParam, ldsSize);
+  int64_t blocksPerCu = std::min<int64_t>(
+      kLdsBytesPerCu / std::max<int64_t>(ldsSize, 1), kMaxWorkgroupsPerCu);
+  blocksPerCu = std::max<int64_t>(
+      std::min(blocksPerCu, math_util::integer_divide_ceil(gridSize, numCu)),
+      1);
+  double occupancy =
+      std::min(1.0, static_cast<double>(blocksPerCu * wavesPerBlock) /
+                        kTargetWavesPerCu);
+
+  // CU utilization: the last round of workgroups may leave CUs idle.
+  int64_t slots = numCu * blocksPerCu;
+  double cuUtilization =
+      static_cast<double>(gridSize) /
+      (math_util::integer_divide_ceil(gridSize, slots) * slots);
+
+  // Global load vector width relative to the widest load.
+  auto loadEfficiency = [&](const DerivedParams &derived) {
+    return std::min(1.0, static_cast<double>(derived.srcDataPerRead *
+                                             elementBytes) /
+                             kMaxGlobalLoadBytes);
+  };
+  double vectorization = std::sqrt(loadEfficiency(gemmADerivedParam) *
+                                   loadEfficiency(gemmBDerivedParam));
+
+  // Tile efficiency: the useful fraction of the work once the problem is
+  // padded to whole tiles.
+  int64_t kPerIteration = params.gemmKPerBlock * params.gemmKPack;
+  double tileEfficiency =
+      (static_cast<double>(gemmSize.gemmM) /
+       math_util::integer_least_multiple(gemmSize.gemmM,
+                                         params.gemmMPerBlock)) *
+      (static_cast<double>(gemmSize.gemmN) /
+       math_util::integer_least_multiple(gemmSize.gemmN,
+                                         params.gemmNPerBlock)) *
+      (static_cast<double>(gemmSize.gemmK) /
+       math_util::integer_least_multiple(gemmSize.gemmK, kPerIteration));
+
+  // Data reuse: larger tiles load fewer bytes per multiply-accumulate.
+  double reuse = std::min(
+      1.0, static_cast<double>(params.gemmMPerBlock * params.gemmNPerBlock) /
+               (params.gemmMPerBlock + params.gemmNPerBlock) /
+               (kReuseTileSize / 2));
+
+  // MFMA: cycles a wave spends in the XDLOPS of one main loop iteration,
+  // against the fixed cost of the iteration.
+  FailureOr<XdlopsCodeSelection> xcs =
+      XdlopsCodeSelection::get(dataType, params.gemmMPerWave,
+                               params.gemmNPerWave, ctx.arch, ctx.fp8Format,
+                               ctx.xf32, ctx.sparse);
+  if (failed(xcs))
+    return failure();
+  double macsPerCycle =
+      static_cast<double>(xcs->m * xcs->n * xcs->k * xcs->num_output_blks) /
+      xcs->cycles;
+  double mfmaCycles = static_cast<double>(params.gemmMPerWave *
+                                          params.gemmNPerWave * kPerIteration) /
+                      macsPerCycle;
+  double mfmaEfficiency = mfmaCycles / (mfmaCycles + kLoopOverheadCycles);
+
+  LLVM_DEBUG(llvm::dbgs() << "Cost model: occupancy " << occupancy
+                          << ", CU utilization " << cuUtilization
+                          << ", vectorization " << vectorization << ", tile "
+                          << tileEfficiency << ", reuse " << reuse
+                          << ", MFMA " << mfmaEfficiency << "\n");
+  return occupancy * cuUtilization * vectorization * tileEfficiency * reuse *
+         mfmaEfficiency;
+}
+
+int64_t PopulateParamsXDL::obtainResidentGridSize(
+    const ConvolutionContext &ctx, const InitParamsXDL &params,
+    const DerivedParams &gemmADerivedParam,
+    const DerivedParams &gemmBDerivedParam, int64_t blockSize) {
+  int64_t wavesPerBlock = std::max<int64_t>(
+      blockSize / XdlopsCodeSelection::getWaveSize(ctx.arch), 1);
+  int64_t numCu = std::max<int64_t>(ctx.num_cu, 1);
+
+  // Workgroups resident on a CU are bounded by LDS, by the waves the
+  // registers of a thread leave room for on the four SIMDs of the CU, and by
+  // the workgroup slots of the CU.
+  std::size_t ldsSize = 0;
+  (void)calculateLdsNumberOfByte(params, ctx, gemmADerivedParam,
+                                 gemmBDerivedParam, ldsSize);
+  // populateDerived() only accepts params whose registers are known
+  FailureOr<RegisterUsage> registers =
+      estimateRegisterUsage(params, ctx, blockSize);
+  int64_t wavesPerSimd = succeeded(registers) ? registers->wavesPerSimd() : 1;
+  int64_t blocksPerCu = std::min<int64_t>(
+      {kLdsBytesPerCu / std::max<int64_t>(ldsSize, 1),
+       wavesPerSimd * 4 / wavesPerBlock, kMaxWorkgroupsPerCu});
+  return numCu * std::max<int64_t>(blocksPerCu, 1);
+}
+
+LogicalResult
+PopulateParamsXDL::isValidGridGemmXdlops(const ConvolutionContext &ctx,
+                                         GemmSize &gemmSize) {
   auto gemmM = gemmSize.gemmM;
   auto gemmN = gemmSize.gemmN;
   auto gemmK = gemmSize.gemmK;
+  int64_t waveSize = XdlopsCodeSelection::getWaveSize(ctx.arch);
 
   // unsupported xdlops-gemm
   if (gemmM % 16 != 0 && gemmN % 64 != 0)
@@ -1190,14 +2116,62 @@ LogicalResult PopulateParamsXDL::isValidGridGemmXdlops(GemmSize &gemmSize) {
   return failure();
 }
 
-LogicalResult PopulateParamsXDL::obtainTuningParameters(
-    Operation *op, int64_t blockSizeOverride, const std::string &perfConfig,
-    InitParamsXDL &validParams, DerivedParams &gemmADerivedParam,
-    DerivedParams &gemmBDerivedParam, DerivedOutParams &gemmCDerivedParam,
-    int64_t &blockSize, int64_t &gridSize, int64_t &gemmKBlocks) {
+// Halve the block tile of a borrowed config until it divides `gemmSize`,
+// keeping the wave tile within the block tile.
+static InitParamsXDL adaptToGemmSize(InitParamsXDL params,
+                                     const GemmSize &gemmSize) {
+  while (gemmSize.gemmM % params.gemmMPerBlock != 0 &&
+         params.gemmMPerBlock > 4) {
+    params.gemmMPerBlock /= 2;
+    params.gemmMPerWave = std::min(params.gemmMPerWave, params.gemmMPerBlock);
+  }
+  while (gemmSize.gemmN % params.gemmNPerBlock != 0 &&
+         params.gemmNPerBlock > 16) {
+    params.gemmNPerBlock /= 2;
+    params.gemmNPerWave = std::min(params.gemmNPerWave, params.gemmNPerBlock);
+  }
+  while (gemmSize.gemmK % (params.gemmKPerBlock * params.gemmKPack) != 0 &&
+         params.gemmKPerBlock > 1)
+    params.gemmKPerBlock /= 2;
+  return params;
+}
 
-  ConvolutionContext ctx = populateConvContext(op);
+LogicalResult PopulateParamsXDL::loadNeighborFromPerfDb(
+    const ConvolutionContext &ctx, const GemmSize &gemmSize,
+    const std::string &solverId, InitParamsXDL &validParams) {
+  for (const std::string &neighbor : findNeighborParams(ctx, solverId)) {
+    InitParamsXDL tuned;
+    if (!tuned.deserialize(neighbor))
+      continue;
+    for (const InitParamsXDL &candidate :
+         {tuned, adaptToGemmSize(tuned, gemmSize)}) {
+      GemmSize candidateGemmSize = gemmSize;
+      DerivedParams gemmADerivedParam;
+      DerivedParams gemmBDerivedParam;
+      DerivedOutParams gemmCDerivedParam;
+      int64_t blockSize = 0;
+      int64_t gridSize = 0;
+      int64_t gemmKBlocks = 1;
+      if (failed(populateDerived(ctx, candidate, candidateGemmSize,
+                                 gemmADerivedParam, gemmBDerivedParam,
+                                 gemmCDerivedParam, blockSize, gridSize,
+                                 gemmKBlocks)))
+        continue;
+      LLVM_DEBUG(llvm::dbgs() << "Adapted perf db neighbor " << neighbor
+                              << " to " << genDebugForParams(candidate));
+      validParams = candidate;
+      return success();
+    }
+  }
+  return failure();
+}
 
+LogicalResult PopulateParamsXDL::obtainTuningParameters(
+    const ConvolutionContext &ctx, int64_t blockSizeOverride,
+    const std::string &perfConfig, InitParamsXDL &validParams,
+    DerivedParams &gemmADerivedParam, DerivedParams &gemmBDerivedParam,
+    DerivedOutParams &gemmCDerivedParam, int64_t &blockSize,
+    int64_t &gridSize, int64_t &gemmKBlocks) {
   GemmSize gemmSize;
   obtainGemmSize(ctx, gemmSize);
 
@@ -1208,6 +2182,7 @@ LogicalResult PopulateParamsXDL::obtainTuningParameters(
     bool isValidPerfConfig = validParams.deserialize(perfConfig);
     if (isValidPerfConfig) {
       LLVM_DEBUG(llvm::dbgs() << genDebugForParams(validParams));
+      tuningSource = TuningSource::PerfConfig;
       return populateDerived(ctx, validParams, gemmSize, gemmADerivedParam,
                              gemmBDerivedParam, gemmCDerivedParam, blockSize,
                              gridSize, gemmKBlocks);
@@ -1216,46 +2191,106 @@ LogicalResult PopulateParamsXDL::obtainTuningParameters(
     return failure();
   }
 
-#if __MLIR_ENABLE_SQLITE__
-  std::string solverId;
-  if (ctx.opType == ConvOpType::Fwd) {
-    solverId = "ConvHipImplicitGemmForwardV4R4Xdlops";
-  } else if (ctx.opType == ConvOpType::BwdData) {
-    solverId = "ConvHipImplicitGemmBwdDataV4R1Xdlops";
-  } else {
-    solverId = "ConvHipImplicitGemmWrwV4R4Xdlops";
-  }
-
-  SQLitePerfDb perfDb = getDb(ctx.arch, ctx.num_cu);
-  bool loadRes = perfDb.load(ctx, solverId, validParams);
+  std::string solverId = getSolverId(ctx, /*xdlops=*/true);
+  bool loadRes = loadFromPerfDb(ctx, solverId, validParams);
   if (loadRes) {
     LLVM_DEBUG(llvm::dbgs() << genDebugForParams(validParams));
+    tuningSource = TuningSource::PerfDb;
     return populateDerived(ctx, validParams, gemmSize, gemmADerivedParam,
-                           gemmBDerivedParam, blockSize, gridSize);
-  } else {
-    LLVM_DEBUG(llvm::dbgs()
-               << "DB load failed, falling back to backup path.\n");
+                           gemmBDerivedParam, gemmCDerivedParam, blockSize,
+                           gridSize, gemmKBlocks);
   }
-#endif // MLIR_ENABLE_SQLITE
-
-  LogicalResult res = failure();
-  for (auto &params : getTuningParameters(ctx.getOpType(), ctx.getDataType())) {
-    blockSize = obtainBlockSize(params, waveSize);
+  if (loadFromOtherCuPerfDb(ctx, solverId, validParams) &&
+      succeeded(populateDerived(ctx, validParams, gemmSize, gemmADerivedParam,
+                                gemmBDerivedParam, gemmCDerivedParam,
+                                blockSize, gridSize, gemmKBlocks))) {
+    LLVM_DEBUG(llvm::dbgs() << genDebugForParams(validParams));
+    tuningSource = TuningSource::PerfDbOtherCu;
+    return success();
+  }
+  if (succeeded(
+          loadNeighborFromPerfDb(ctx, gemmSize, solverId, validParams))) {
+    tuningSource = TuningSource::PerfDbNeighbor;
+    return populateDerived(ctx, validParams, gemmSize, gemmADerivedParam,
+                           gemmBDerivedParam, gemmCDerivedParam, blockSize,
+                           gridSize, gemmKBlocks);
+  }
+  LLVM_DEBUG(llvm::dbgs() << "DB load failed, falling back to backup path.\n");
+  tuningSource = TuningSource::Heuristic;
+
+  // Rank every valid default config with the cost model. Ties keep the
+  // earlier entry of the table.
+  struct Candidate {
+    const InitParamsXDL *params;
+    DerivedParams gemmADerivedParam;
+    DerivedParams gemmBDerivedParam;
+    DerivedOutParams gemmCDerivedParam;
+    int64_t blockSize;
+    int64_t gridSize = 0;
+    int64_t gemmKBlocks = 1;
+    double efficiency = 0.0;
+  };
+  SmallVector<Candidate> candidates;
+  for (auto &params :
+       getTuningParameters(ctx.getOpType(), ctx.getDataType(), ctx.isGemm,
+                           ctx.arch, ctx.fp8Format, ctx.xf32,
+                           ctx.sparse)) {
+    Candidate candidate;
+    candidate.params = &params;
+    candidate.blockSize =
+        obtainBlockSize(params, XdlopsCodeSelection::getWaveSize(ctx.arch));
     // We have an override on the blockSize, only loop through the
     // initParameters with the same blockSize
-    if ((blockSizeOverride != 0) && (blockSizeOverride != blockSize)) {
+    if ((blockSizeOverride != 0) &&
+        (blockSizeOverride != candidate.blockSize)) {
       continue;
     }
 
-    res = populateDerived(ctx, params, gemmSize, gemmADerivedParam,
-                          gemmBDerivedParam, gemmCDerivedParam, blockSize,
-                          gridSize, gemmKBlocks);
-    if (failed(res)) {
+    if (failed(populateDerived(
+            ctx, params, gemmSize, candidate.gemmADerivedParam,
+            candidate.gemmBDerivedParam, candidate.gemmCDerivedParam,
+            candidate.blockSize, candidate.gridSize, candidate.gemmKBlocks))) {
       continue;
     }
 
-    validParams = params;
-    break;
+    FailureOr<double> efficiency = estimateEfficiency(
+        ctx, params, gemmSize, candidate.gemmADerivedParam,
+        candidate.gemmBDerivedParam, candidate.blockSize, candidate.gridSize);
+    if (failed(efficiency))
+      continue;
+    candidate.efficiency = *efficiency;
+    LLVM_DEBUG(llvm::dbgs() << "Estimated efficiency " << candidate.efficiency
+                            << " for " << genDebugForParams(params));
+    candidates.push_back(candidate);
+  }
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [](const Candidate &a, const Candidate &b) {
+                     return a.efficiency > b.efficiency;
+                   });
+
+  // The best configs spilled when compiled before. Running out of configs
+  // fails, rather than going to the padding kernel, so that the caller keeps
+  // its earlier build.
+  if (skipHeuristicConfigs > 0) {
+    if (static_cast<size_t>(skipHeuristicConfigs) >= candidates.size()) {
+      LLVM_DEBUG(llvm::dbgs() << "No default config left after skipping "
+                              << skipHeuristicConfigs << "\n");
+      return failure();
+    }
+    tuningSource = TuningSource::SpillFallback;
+  }
+
+  LogicalResult res = failure();
+  if (!candidates.empty()) {
+    const Candidate &best = candidates[skipHeuristicConfigs];
+    res = success();
+    validParams = *best.params;
+    gemmADerivedParam = best.gemmADerivedParam;
+    gemmBDerivedParam = best.gemmBDerivedParam;
+    gemmCDerivedParam = best.gemmCDerivedParam;
+    blockSize = best.blockSize;
+    gridSize = best.gridSize;
+    gemmKBlocks = best.gemmKBlocks;
   }
 
   if (failed(res)) {
@@ -1264,17 +2299,41 @@ LogicalResult PopulateParamsXDL::obtainTuningParameters(
                             << " PARAMETERS!\n");
 
       LLVM_DEBUG(llvm::dbgs() << "BUT PADDING KERNEL CAN EXECUTE IT\n");
-      for (auto &params :
-           getTuningParameters(ctx.getOpType(), ctx.getDataType())) {
-        res = populatePaddingKernelDerived(
-            ctx, params, gemmSize, gemmADerivedParam, gemmBDerivedParam,
-            gemmCDerivedParam, blockSize, gridSize);
-
-        if (failed(res)) {
+      tuningSource = TuningSource::Padding;
+      // Any config can tile the gemm once it is padded to its tiles, which
+      // masks their last tiles, so rank them all by their efficiency on the
+      // unpadded gemm, whose tile term charges them for the padding. Padding
+      // kernels don't use KPack.
+      double bestEfficiency = -1.0;
+      for (const InitParamsXDL &params :
+           getTuningParameters(ctx.getOpType(), ctx.getDataType(),
+                               ctx.isGemm, ctx.arch, ctx.fp8Format,
+                               ctx.xf32, ctx.sparse)) {
+        InitParamsXDL paddedParams = params;
+        paddedParams.gemmKPack = 1;
+        GemmSize paddedSize = gemmSize;
+        DerivedParams paddedADerivedParam, paddedBDerivedParam;
+        DerivedOutParams paddedCDerivedParam;
+        int64_t paddedBlockSize = 0;
+        int64_t paddedGridSize = 0;
+        if (failed(populatePaddingKernelDerived(
+                ctx, paddedParams, paddedSize, paddedADerivedParam,
+                paddedBDerivedParam, paddedCDerivedParam, paddedBlockSize,
+                paddedGridSize)))
           continue;
-        }
-        validParams = params;
-        break;
+        FailureOr<double> efficiency = estimateEfficiency(
+            ctx, paddedParams, gemmSize, paddedADerivedParam,
+            paddedBDerivedParam, paddedBlockSize, paddedGridSize);
+        if (failed(efficiency) || *efficiency <= bestEfficiency)
+          continue;
+        bestEfficiency = *efficiency;
+        res = success();
+        validParams = paddedParams;
+        gemmADerivedParam = paddedADerivedParam;
+        gemmBDerivedParam = paddedBDerivedParam;
+        gemmCDerivedParam = paddedCDerivedParam;
+        blockSize = paddedBlockSize;
+        gridSize = paddedGridSize;
       }
   } else {
     LLVM_DEBUG(llvm::dbgs() << "Successfully picked tuning params from backup"
@@ -1286,14 +2345,148 @@ LogicalResult PopulateParamsXDL::obtainTuningParameters(
 }
 
 ArrayRef<InitParamsXDL>
-PopulateParamsXDL::getTuningParameters(ConvOpType dir, Type dataType) const {
+PopulateParamsXDL::getTuningParameters(ConvOpType dir, Type dataType,
+                                       bool isGemm, StringRef arch,
+                                       Optional<Fp8Format> fp8Format,
+                                       bool xf32, bool sparse) const {
+  if (XdlopsCodeSelection::hasWmma(arch))
+    return {initParametersWmma, nInitParametersWmma};
+  if (fp8Format)
+    return {initParametersFp8, nInitParametersFp8};
+  if (xf32)
+    return {initParametersXf32, nInitParametersXf32};
+  if (sparse)
+    return {initParametersSparse, nInitParametersSparse};
   if (dataType.isInteger(8)) {
     return {initParametersForwardI8, nInitParametersForwardI8};
   }
+  if (dataType.isF64())
+    return {initParametersF64, nInitParametersF64};
+  if (isGemm)
+    return {initParametersGemm, nInitParametersGemm};
 
   return {initParameters, nInitParameters};
 }
 
+static constexpr int64_t kXdlMPerBlockRange[] = {4, 8, 16, 32, 64, 128, 256};
+static constexpr int64_t kXdlNPerBlockRange[] = {16, 32, 64, 128, 256};
+static constexpr int64_t kXdlKPerBlockRange[] = {4, 8, 16, 32};
+static constexpr int64_t kXdlMPerWaveRange[] = {4, 8, 16, 32, 64, 128};
+static constexpr int64_t kXdlNPerWaveRange[] = {16, 32, 64};
+static constexpr int64_t kXdlKPackRange[] = {1, 4, 8, 16};
+static constexpr bool kXdlThreadCopyMoreRange[] = {false, true};
+static constexpr int64_t kXdlLdsStagesRange[] = {1, 2, 3};
+
+template <>
+TuningSpace<InitParamsXDL>::TuningSpace(Operation *op)
+    : ctx(std::make_shared<ConvolutionContext>(populateConvContext(op))) {
+  obtainGemmSize(*ctx, gemmSize);
+}
+
+template <> size_t TuningSpace<InitParamsXDL>::rawSize() const {
+  return llvm::array_lengthof(kXdlMPerBlockRange) *
+         llvm::array_lengthof(kXdlNPerBlockRange) *
+         llvm::array_lengthof(kXdlKPerBlockRange) *
+         llvm::array_lengthof(kXdlMPerWaveRange) *
+         llvm::array_lengthof(kXdlNPerWaveRange) *
+         llvm::array_lengthof(kXdlKPackRange) *
+         llvm::array_lengthof(kXdlThreadCopyMoreRange) *
+         llvm::array_lengthof(kXdlThreadCopyMoreRange) *
+         llvm::array_lengthof(kXdlLdsStagesRange);
+}
+
+template <>
+bool TuningSpace<InitParamsXDL>::accept(size_t index,
+                                        InitParamsXDL &params) const {
+  bool bCopyMore = takeDigit(kXdlThreadCopyMoreRange, index);
+  bool aCopyMore = takeDigit(kXdlThreadCopyMoreRange, index);
+  int64_t kPack = takeDigit(kXdlKPackRange, index);
+  int64_t nPerWave = takeDigit(kXdlNPerWaveRange, index);
+  int64_t mPerWave = takeDigit(kXdlMPerWaveRange, index);
+  int64_t kPerBlock = takeDigit(kXdlKPerBlockRange, index);
+  int64_t nPerBlock = takeDigit(kXdlNPerBlockRange, index);
+  int64_t mPerBlock = takeDigit(kXdlMPerBlockRange, index);
+  // Most significant, so that all unpipelined points come first.
+  int64_t ldsStages = takeDigit(kXdlLdsStagesRange, index);
+  params = InitParamsXDL(mPerBlock, nPerBlock, kPerBlock, mPerWave, nPerWave,
+                         kPack, aCopyMore, bCopyMore);
+  params.ldsStages = ldsStages;
+
+  // Stage 1: divisibility. The tile has to divide the gemm, and the block a
+  // whole number of waves.
+  PopulateParamsXDL populator;
+  GemmSize candidateGemmSize = gemmSize;
+  if (mPerBlock % mPerWave != 0 || nPerBlock % nPerWave != 0 ||
+      kPerBlock % kPack != 0 ||
+      failed(populator.isValidGemm(params, candidateGemmSize)))
+    return false;
+
+  // Stage 2: the XDLOPS instruction has to exist and the tiles have to fit
+  // in LDS and registers.
+  int64_t blockSize = populator.obtainBlockSize(
+      params, XdlopsCodeSelection::getWaveSize(ctx->arch));
+  if (failed(populator.isValidBlockwiseGemmXDLOPS(params, *ctx, blockSize)) ||
+      failed(populator.isFeasibleXDLOPS(params, *ctx, blockSize)))
+    return false;
+
+  // Stage 3: the block copies have to be derivable.
+  DerivedParams gemmADerivedParam;
+  DerivedParams gemmBDerivedParam;
+  DerivedOutParams gemmCDerivedParam;
+  int64_t gridSize = 0;
+  int64_t gemmKBlocks = 1;
+  return succeeded(populator.populateDerived(
+      *ctx, params, candidateGemmSize, gemmADerivedParam, gemmBDerivedParam,
+      gemmCDerivedParam, blockSize, gridSize, gemmKBlocks));
+}
+
+TuningSpace<InitParamsXDL>
+PopulateParamsXDL::getTuningSpace(Operation *op) const {
+  return TuningSpace<InitParamsXDL>(op);
+}
+
+std::vector<InitParamsXDL> PopulateParamsXDL::rankTuningSpace(Operation *op,
+                                                              size_t limit) {
+  ConvolutionContext ctx = populateConvContext(op);
+  GemmSize gemmSize;
+  obtainGemmSize(ctx, gemmSize);
+
+  std::vector<std::pair<double, InitParamsXDL>> scored;
+  for (const InitParamsXDL &params : getTuningSpace(op)) {
+    GemmSize candidateGemmSize = gemmSize;
+    DerivedParams gemmADerivedParam;
+    DerivedParams gemmBDerivedParam;
+    DerivedOutParams gemmCDerivedParam;
+    int64_t blockSize = 0;
+    int64_t gridSize = 0;
+    int64_t gemmKBlocks = 1;
+    if (failed(populateDerived(ctx, params, candidateGemmSize,
+                               gemmADerivedParam, gemmBDerivedParam,
+                               gemmCDerivedParam, blockSize, gridSize,
+                               gemmKBlocks)))
+      continue;
+    FailureOr<double> efficiency =
+        estimateEfficiency(ctx, params, candidateGemmSize, gemmADerivedParam,
+                           gemmBDerivedParam, blockSize, gridSize);
+    if (failed(efficiency))
+      continue;
+    scored.emplace_back(*efficiency, params);
+  }
+  // Ties keep the order of the tuning space.
+  std::stable_sort(scored.begin(), scored.end(),
+                   [](const auto &lhs, const auto &rhs) {
+                     return lhs.first > rhs.first;
+                   });
+
+  std::vector<InitParamsXDL> ranked;
+  for (const auto &candidate : scored) {
+    if (ranked.size() == limit)
+      break;
+    ranked.push_back(candidate.second);
+  }
+  return ranked;
+}
+
 const InitParams &PopulateParamsXDL::getUniversalParameters() const {
   return universalParameters;
 }
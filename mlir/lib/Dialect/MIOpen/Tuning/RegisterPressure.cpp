@@ -0,0 +1,92 @@
+#include "mlir/Dialect/MIOpen/Tuning/RegisterPressure.h"
+#include "mlir/Dialect/MIOpen/Tuning/ConvContext.h"
+#include "mlir/Dialect/MIOpen/Tuning/GridwiseGemmParams.h"
+#include "mlir/Dialect/MIOpen/XdlopsCodeSelection.h"
+
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+
+#include <algorithm>
+
+using namespace mlir;
+using namespace mlir::miopen;
+
+#define DEBUG_TYPE "miopen-register-pressure"
+
+// Registers a wave can address in each of the VGPR and AGPR files.
+static constexpr int64_t kRegistersPerFile = 256;
+// Registers per lane of a SIMD, shared by all of its waves, and the
+// granularity they are allocated in.
+static constexpr int64_t kRegistersPerSimd = 512;
+static constexpr int64_t kRegisterGranule = 8;
+static constexpr int64_t kMaxWavesPerSimd = 8;
+// VGPRs the gridwise gemm needs besides its buffers: thread and block ids,
+// copy coordinates, LDS offsets and the loop counter.
+static constexpr int64_t kReservedVgprs = 24;
+
+int64_t RegisterUsage::spilledBytes() const {
+  int64_t spilled = std::max<int64_t>(vgprs - kRegistersPerFile, 0) +
+                    std::max<int64_t>(agprs - kRegistersPerFile, 0);
+  return spilled * 4;
+}
+
+int64_t RegisterUsage::wavesPerSimd() const {
+  int64_t perWave = llvm::alignTo(std::min(vgprs, kRegistersPerFile) +
+                                      std::min(agprs, kRegistersPerFile),
+                                  kRegisterGranule);
+  return std::min(kRegistersPerSimd / std::max<int64_t>(perWave, 1),
+                  kMaxWavesPerSimd);
+}
+
+static int64_t registersFor(int64_t elements, int64_t elementBytes) {
+  return llvm::divideCeil(elements * elementBytes, 4);
+}
+
+FailureOr<RegisterUsage>
+mlir::miopen::estimateRegisterUsage(const InitParamsXDL &params,
+                                    const ConvolutionContext &ctx,
+                                    int64_t blockSize) {
+  Type dataType = ctx.getDataType();
+  FailureOr<XdlopsCodeSelection> maybeXcs = XdlopsCodeSelection::get(
+      dataType, params.gemmMPerWave, params.gemmNPerWave, ctx.arch,
+      ctx.fp8Format, ctx.xf32, ctx.sparse);
+  if (failed(maybeXcs))
+    return failure();
+  const XdlopsCodeSelection &xcs = *maybeXcs;
+  int64_t elementBytes =
+      llvm::divideCeil(dataType.getIntOrFloatBitWidth(), 8);
+
+  RegisterUsage usage;
+  // The C tile: vectorNumber accumulator vectors of 32-bit elements, which
+  // WMMA keeps in VGPRs since gfx11 has no AGPRs.
+  int64_t accumulators = xcs.vectorNumber * xcs.vectorType.getNumElements();
+  usage.agprs = xcs.isWmma ? 0 : accumulators;
+
+  // The blockwise copies load a thread's share of the A and B block tiles
+  // into registers and keep it there across the blockwise gemm until it is
+  // stored to LDS.
+  int64_t copyAElements = params.gemmKPerBlock * params.gemmMPerBlock *
+                          params.gemmKPack / blockSize;
+  int64_t copyBElements = params.gemmKPerBlock * params.gemmNPerBlock *
+                          params.gemmKPack / blockSize;
+
+  // The blockwise gemm reads its operands from LDS into arrays of
+  // KPerBlock * M/NRepeats elements, KPack-wide vectors when KPack > 1.
+  // K-reduction instructions split KPerBlock over their input blocks.
+  int64_t kPerInputBlock = xcs.isKReduction
+                               ? params.gemmKPerBlock / xcs.num_input_blks
+                               : params.gemmKPerBlock;
+  int64_t arrayAElements = kPerInputBlock * xcs.MRepeats * params.gemmKPack;
+  int64_t arrayBElements = kPerInputBlock * xcs.NRepeats * params.gemmKPack;
+
+  usage.vgprs = kReservedVgprs + (xcs.isWmma ? accumulators : 0) +
+                registersFor(copyAElements, elementBytes) +
+                registersFor(copyBElements, elementBytes) +
+                registersFor(arrayAElements, elementBytes) +
+                registersFor(arrayBElements, elementBytes);
+
+  LLVM_DEBUG(llvm::dbgs() << "Estimated " << usage.vgprs << " VGPRs and "
+                          << usage.agprs << " AGPRs per thread, "
+                          << usage.wavesPerSimd() << " waves per SIMD\n");
+  return usage;
+}
@@ -1,8 +1,11 @@
 #if __MLIR_ENABLE_SQLITE__
 
 #include "mlir/Dialect/MIOpen/Tuning/SqliteDb.h"
+#include "mlir/Dialect/MIOpen/Tuning/Serializable.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Support/Debug.h"
 
+#include <algorithm>
 #include <thread>
 
 using namespace mlir;
@@ -31,7 +34,9 @@ class SQLite::impl {
       rc = sqlite3_open_v2(filepath.c_str(), &ptr_tmp, SQLITE_OPEN_READONLY,
                            nullptr);
     } else {
-      LLVM_DEBUG(dbgs() << "FATAL ERROR! Does not support user db\n");
+      // User dbs hold locally tuned results and are created on demand.
+      rc = sqlite3_open_v2(filepath.c_str(), &ptr_tmp,
+                           SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr);
     }
     ptrDb = Sqlite3Ptr{ptr_tmp};
     return rc;
@@ -106,33 +111,72 @@ std::string SQLite::errorMessage() const {
 }
 bool SQLite::valid() const { return pImpl->isValid; }
 
-bool DbRecord::setValues(const std::string &id, const std::string &values) {
-  // No need to update the file if values are the same:
-  const auto it = map.find(id);
-  if (it == map.end() || it->second != values) {
-    LLVM_DEBUG(dbgs() << key << ", content "
-                      << (it == map.end() ? "inserted" : "overwritten") << ": "
-                      << id << ':' << values);
-    map[id] = values;
-    return true;
+SQLite::Statement SQLite::prepare(const std::string &query) const {
+  return Statement(*this, query);
+}
+
+int SQLite::maxVariables() const {
+  return sqlite3_limit(pImpl->ptrDb.get(), SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+}
+
+SQLite::Statement::Statement(const SQLite &db, const std::string &query)
+    : stmt(nullptr) {
+  auto rc = db.retry([&]() {
+    return sqlite3_prepare_v2(db.pImpl->ptrDb.get(), query.c_str(), -1, &stmt,
+                              nullptr);
+  });
+  if (rc != SQLITE_OK) {
+    LLVM_DEBUG(dbgs() << "Preparing query[" << query
+                      << "] failed: " << db.errorMessage() << "\n");
+    sqlite3_finalize(stmt);
+    stmt = nullptr;
   }
-  LLVM_DEBUG(dbgs() << ", content is the same, not changed:" << id << ':'
-                    << values);
-  return false;
 }
 
-bool DbRecord::getValues(const std::string &id, std::string &values) const {
-  const auto it = map.find(id);
+SQLite::Statement::~Statement() { sqlite3_finalize(stmt); }
 
-  if (it == map.end()) {
-    LLVM_DEBUG(dbgs() << '=' << id << ':' << "<values not found>"
-                      << "\n");
-    return false;
+SQLite::Statement::Statement(Statement &&other) noexcept : stmt(other.stmt) {
+  other.stmt = nullptr;
+}
+
+SQLite::Statement &SQLite::Statement::operator=(Statement &&other) noexcept {
+  if (this != &other) {
+    sqlite3_finalize(stmt);
+    stmt = other.stmt;
+    other.stmt = nullptr;
   }
+  return *this;
+}
 
-  values = it->second;
-  LLVM_DEBUG(dbgs() << key << '=' << id << ':' << values << "\n");
-  return true;
+bool SQLite::Statement::bind(int index, const std::string &value) {
+  return sqlite3_bind_text(stmt, index, value.data(), value.size(),
+                           SQLITE_TRANSIENT) == SQLITE_OK;
+}
+
+int SQLite::Statement::step() {
+  int rc = sqlite3_step(stmt);
+  if (rc == SQLITE_BUSY) {
+    LLVM_DEBUG(dbgs() << "Timeout while waiting for Database: "
+                      << sqlite3_db_filename(sqlite3_db_handle(stmt), "main"));
+  }
+  return rc;
+}
+
+void SQLite::Statement::reset() {
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+}
+
+llvm::StringRef SQLite::Statement::getColumnText(int column) const {
+  const unsigned char *text = sqlite3_column_text(stmt, column);
+  if (text == nullptr)
+    return "NULL";
+  return llvm::StringRef(reinterpret_cast<const char *>(text),
+                         sqlite3_column_bytes(stmt, column));
+}
+
+int64_t SQLite::Statement::getColumnInt(int column) const {
+  return sqlite3_column_int64(stmt, column);
 }
 
 SQLitePerfDb::SQLitePerfDb(const std::string &filename_, bool isSystem,
@@ -151,9 +195,445 @@ SQLitePerfDb::SQLitePerfDb(const std::string &filename_, bool isSystem,
   }
 }
 
+// Problems matched by a single batched query. Keeps the CASE expression that
+// maps rows back to problems reasonably small.
+static constexpr size_t kMaxProblemsPerQuery = 64;
+
+// Build a query returning (problem, solver, params) rows for `numProblems`
+// problems described by the columns `names`. Parameters are numbered problem
+// by problem, followed by arch, num_cu and, optionally, the solver.
+static std::string buildFindRecordsQuery(const std::string &tableName,
+                                         llvm::ArrayRef<std::string> names,
+                                         size_t numProblems,
+                                         bool filterSolver) {
+  int param = 1;
+  std::string caseExpr = "CASE";
+  std::vector<std::string> problemClauses;
+  for (size_t p = 0; p < numProblems; ++p) {
+    std::vector<std::string> fieldClauses;
+    for (const std::string &name : names)
+      fieldClauses.push_back("(" + name + " = ?" + std::to_string(param++) +
+                             " )");
+    std::string clause = "( " + joinStrings(fieldClauses, " AND ") + " )";
+    caseExpr += " WHEN " + clause + " THEN " + std::to_string(p);
+    problemClauses.push_back(clause);
+  }
+  caseExpr += " END";
+
+  // clang-format off
+  std::string query =
+      "SELECT " + caseExpr + " AS problem, solver, params "
+      "FROM perf_db "
+      "INNER JOIN " + tableName + " "
+      "ON perf_db.config = " + tableName + ".id "
+      "WHERE "
+      "( " + joinStrings(problemClauses, " OR ") + " ) "
+      "AND (arch = ?" + std::to_string(param) + " ) "
+      "AND (num_cu = ?" + std::to_string(param + 1) + " )";
+  // clang-format on
+  if (filterSolver)
+    query += " AND (solver = ?" + std::to_string(param + 2) + " )";
+  return query + ";";
+}
+
+SQLite::Statement &SQLitePerfDb::getStatement(const std::string &query) {
+  auto it = statements.find(query);
+  if (it == statements.end())
+    it = statements.try_emplace(query, sql.prepare(query)).first;
+  return it->second;
+}
+
+void SQLitePerfDb::findRecordsImpl(const std::string &tableName,
+                                   llvm::ArrayRef<ProblemFields> problems,
+                                   llvm::StringRef solverId,
+                                   RowCallback callback) {
+  // Identical problems are queried once and reported for every index that
+  // asked for them. Problems visiting a different set of columns cannot share
+  // a statement, so unique problems are grouped by their column names.
+  llvm::StringMap<llvm::SmallVector<size_t, 1>> sameProblem;
+  std::vector<llvm::SmallVector<size_t, 1> *> reportTo(problems.size());
+  llvm::StringMap<llvm::SmallVector<size_t, 8>> groups;
+  for (size_t i = 0, e = problems.size(); i < e; ++i) {
+    std::string names = joinStrings(problems[i].names, ",");
+    std::string key = names + "=" + joinStrings(problems[i].values, ",");
+    auto &indices = sameProblem[key];
+    if (indices.empty()) {
+      groups[names].push_back(i);
+      reportTo[i] = &indices;
+    }
+    indices.push_back(i);
+  }
+
+  // Leave room for the arch, num_cu and solver parameters.
+  const size_t maxParams = std::max(sql.maxVariables() - 3, 1);
+  for (const auto &group : groups) {
+    llvm::ArrayRef<size_t> members = group.getValue();
+    const std::vector<std::string> &names = problems[members.front()].names;
+    size_t chunkSize =
+        std::max<size_t>(maxParams / std::max<size_t>(names.size(), 1), 1);
+    chunkSize = std::min(chunkSize, kMaxProblemsPerQuery);
+
+    for (size_t begin = 0; begin < members.size(); begin += chunkSize) {
+      llvm::ArrayRef<size_t> chunk =
+          members.slice(begin, std::min(chunkSize, members.size() - begin));
+      std::string query = buildFindRecordsQuery(tableName, names, chunk.size(),
+                                                !solverId.empty());
+      SQLite::Statement &stmt = getStatement(query);
+      if (!stmt.valid())
+        continue;
+
+      int param = 1;
+      for (size_t i : chunk)
+        for (const std::string &value : problems[i].values)
+          stmt.bind(param++, value);
+      stmt.bind(param++, arch);
+      stmt.bind(param++, std::to_string(num_cu));
+      if (!solverId.empty())
+        stmt.bind(param++, solverId.str());
+      LLVM_DEBUG(dbgs() << "SQLite batched query over " << chunk.size()
+                        << " problem(s): " << query << "\n");
+
+      int rc;
+      while ((rc = stmt.step()) == SQLITE_ROW) {
+        int64_t local = stmt.getColumnInt(0);
+        if (local < 0 || static_cast<size_t>(local) >= chunk.size())
+          continue;
+        for (size_t i : *reportTo[chunk[local]])
+          callback(i, stmt.getColumnText(1), stmt.getColumnText(2));
+      }
+      if (rc != SQLITE_DONE) {
+        LLVM_DEBUG(dbgs() << "Query[" << query
+                          << "] failed: " << sql.errorMessage() << "\n");
+      }
+      stmt.reset();
+    }
+  }
+}
+
+void SQLitePerfDb::findNeighborsImpl(const std::string &tableName,
+                                     const ProblemFields &problem,
+                                     llvm::StringRef solverId,
+                                     llvm::ArrayRef<std::string> freeColumns,
+                                     NeighborCallback callback) {
+  int param = 1;
+  std::vector<std::string> clauses;
+  std::vector<const std::string *> boundValues;
+  for (size_t i = 0, e = problem.names.size(); i < e; ++i) {
+    if (llvm::is_contained(freeColumns, problem.names[i]))
+      continue;
+    clauses.push_back("(" + problem.names[i] + " = ?" +
+                      std::to_string(param++) + " )");
+    boundValues.push_back(&problem.values[i]);
+  }
+  clauses.push_back("(arch = ?" + std::to_string(param) + " )");
+  clauses.push_back("(num_cu = ?" + std::to_string(param + 1) + " )");
+  clauses.push_back("(solver = ?" + std::to_string(param + 2) + " )");
+
+  std::vector<std::string> selected;
+  for (const std::string &column : freeColumns)
+    selected.push_back(tableName + "." + column);
+  selected.push_back("params");
+
+  // clang-format off
+  std::string query =
+      "SELECT " + joinStrings(selected, ", ") + " "
+      "FROM perf_db "
+      "INNER JOIN " + tableName + " "
+      "ON perf_db.config = " + tableName + ".id "
+      "WHERE " + joinStrings(clauses, " AND ") + ";";
+  // clang-format on
+  SQLite::Statement &stmt = getStatement(query);
+  if (!stmt.valid())
+    return;
+
+  param = 1;
+  for (const std::string *value : boundValues)
+    stmt.bind(param++, *value);
+  stmt.bind(param++, arch);
+  stmt.bind(param++, std::to_string(num_cu));
+  stmt.bind(param++, solverId.str());
+  LLVM_DEBUG(dbgs() << "SQLite neighbor query: " << query << "\n");
+
+  int rc;
+  std::vector<std::string> freeValues(freeColumns.size());
+  while ((rc = stmt.step()) == SQLITE_ROW) {
+    for (size_t i = 0, e = freeColumns.size(); i < e; ++i)
+      freeValues[i] = stmt.getColumnText(i).str();
+    callback(freeValues, stmt.getColumnText(freeColumns.size()));
+  }
+  if (rc != SQLITE_DONE) {
+    LLVM_DEBUG(dbgs() << "Query[" << query
+                      << "] failed: " << sql.errorMessage() << "\n");
+  }
+  stmt.reset();
+}
+
+std::vector<size_t> SQLitePerfDb::getNumCus() {
+  std::vector<size_t> result;
+  if (dbInvalid)
+    return result;
+  std::string query = "SELECT DISTINCT num_cu FROM perf_db "
+                      "WHERE (arch = ?1 ) ORDER BY num_cu;";
+  SQLite::Statement &stmt = getStatement(query);
+  if (!stmt.valid())
+    return result;
+
+  stmt.bind(1, arch);
+  int rc;
+  while ((rc = stmt.step()) == SQLITE_ROW) {
+    int64_t numCu = stmt.getColumnInt(0);
+    if (numCu > 0)
+      result.push_back(numCu);
+  }
+  if (rc != SQLITE_DONE) {
+    LLVM_DEBUG(dbgs() << "Query[" << query
+                      << "] failed: " << sql.errorMessage() << "\n");
+  }
+  stmt.reset();
+  return result;
+}
+
+bool SQLitePerfDb::storeImpl(const std::string &tableName,
+                             const ProblemFields &problem,
+                             llvm::ArrayRef<bool> isText,
+                             const std::string &solverId,
+                             const std::string &params,
+                             llvm::Optional<double> timeMs) {
+  assert(problem.names.size() == isText.size() && "one type per column");
+  std::vector<std::string> columns;
+  std::vector<std::string> fieldClauses;
+  std::vector<std::string> placeholders;
+  for (size_t i = 0, e = problem.names.size(); i < e; ++i) {
+    std::string param = "?" + std::to_string(i + 1);
+    columns.push_back(problem.names[i] + (isText[i] ? " TEXT" : " INT"));
+    fieldClauses.push_back("(" + problem.names[i] + " = " + param + " )");
+    placeholders.push_back(param);
+  }
+
+  // clang-format off
+  std::string schema =
+      "CREATE TABLE IF NOT EXISTS " + tableName + " ("
+      "id INTEGER PRIMARY KEY ASC, " + joinStrings(columns, ", ") + ");"
+      "CREATE TABLE IF NOT EXISTS perf_db ("
+      "id INTEGER PRIMARY KEY ASC, solver TEXT NOT NULL, "
+      "config INTEGER NOT NULL, arch TEXT NOT NULL, "
+      "num_cu INTEGER NOT NULL, params TEXT NOT NULL);"
+      "CREATE UNIQUE INDEX IF NOT EXISTS idx_perf_db "
+      "ON perf_db(solver, config, arch, num_cu);"
+      "CREATE TABLE IF NOT EXISTS perf_db_time ("
+      "solver TEXT NOT NULL, config INTEGER NOT NULL, arch TEXT NOT NULL, "
+      "num_cu INTEGER NOT NULL, time_ms REAL NOT NULL);"
+      "CREATE UNIQUE INDEX IF NOT EXISTS idx_perf_db_time "
+      "ON perf_db_time(solver, config, arch, num_cu);";
+  std::string insertConfig =
+      "INSERT INTO " + tableName + " (" +
+      joinStrings(problem.names, ", ") + ") "
+      "SELECT " + joinStrings(placeholders, ", ") + " "
+      "WHERE NOT EXISTS (SELECT 1 FROM " + tableName + " WHERE " +
+      joinStrings(fieldClauses, " AND ") + ");";
+  std::string findConfig =
+      "SELECT id FROM " + tableName + " WHERE " +
+      joinStrings(fieldClauses, " AND ") + " LIMIT 1;";
+  std::string insertRecord =
+      "INSERT OR REPLACE INTO perf_db (solver, config, arch, num_cu, params) "
+      "VALUES (?1, ?2, ?3, ?4, ?5);";
+  // A new entry without a time must not keep the time of the one it replaces.
+  std::string recordTime = timeMs
+      ? "INSERT OR REPLACE INTO perf_db_time "
+        "(solver, config, arch, num_cu, time_ms) "
+        "VALUES (?1, ?2, ?3, ?4, ?5);"
+      : "DELETE FROM perf_db_time WHERE (solver = ?1 ) AND (config = ?2 ) "
+        "AND (arch = ?3 ) AND (num_cu = ?4 );";
+  // clang-format on
+
+  auto rc = sql.retry([&]() {
+    return sqlite3_exec(sql.pImpl->ptrDb.get(), schema.c_str(), nullptr,
+                        nullptr, nullptr);
+  });
+  if (rc != SQLITE_OK) {
+    LLVM_DEBUG(dbgs() << "Creating perf db tables failed: "
+                      << sql.errorMessage() << "\n");
+    return false;
+  }
+
+  auto bindProblem = [&](SQLite::Statement &stmt) {
+    for (size_t i = 0, e = problem.values.size(); i < e; ++i)
+      stmt.bind(i + 1, problem.values[i]);
+  };
+
+  SQLite::Statement &insert = getStatement(insertConfig);
+  if (!insert.valid())
+    return false;
+  bindProblem(insert);
+  rc = insert.step();
+  insert.reset();
+  if (rc != SQLITE_DONE) {
+    LLVM_DEBUG(dbgs() << "Query[" << insertConfig
+                      << "] failed: " << sql.errorMessage() << "\n");
+    return false;
+  }
+
+  SQLite::Statement &find = getStatement(findConfig);
+  if (!find.valid())
+    return false;
+  bindProblem(find);
+  rc = find.step();
+  int64_t configId = rc == SQLITE_ROW ? find.getColumnInt(0) : -1;
+  find.reset();
+  if (configId < 0)
+    return false;
+
+  SQLite::Statement &record = getStatement(insertRecord);
+  if (!record.valid())
+    return false;
+  record.bind(1, solverId);
+  record.bind(2, std::to_string(configId));
+  record.bind(3, arch);
+  record.bind(4, std::to_string(num_cu));
+  record.bind(5, params);
+  rc = record.step();
+  record.reset();
+  if (rc != SQLITE_DONE) {
+    LLVM_DEBUG(dbgs() << "Query[" << insertRecord
+                      << "] failed: " << sql.errorMessage() << "\n");
+    return false;
+  }
+
+  SQLite::Statement &time = getStatement(recordTime);
+  if (!time.valid())
+    return false;
+  time.bind(1, solverId);
+  time.bind(2, std::to_string(configId));
+  time.bind(3, arch);
+  time.bind(4, std::to_string(num_cu));
+  if (timeMs)
+    time.bind(5, std::to_string(*timeMs));
+  rc = time.step();
+  time.reset();
+  if (rc != SQLITE_DONE) {
+    LLVM_DEBUG(dbgs() << "Query[" << recordTime
+                      << "] failed: " << sql.errorMessage() << "\n");
+    return false;
+  }
+  LLVM_DEBUG(dbgs() << "Stored " << solverId << ':' << params << " for config "
+                    << configId << "\n");
+  return true;
+}
+
 SQLitePerfDb mlir::getDb(const llvm::SmallString<8> &arch, std::size_t num_cu) {
   // DB path: "/opt/rocm/miopen/share/miopen/db/miopen.db"
   return {MIOPEN_SYSTEM_DB_PATH, true, std::string(arch), num_cu};
 }
 
+SQLitePerfDbCache &SQLitePerfDbCache::instance() {
+  static SQLitePerfDbCache cache;
+  return cache;
+}
+
+void SQLitePerfDbCache::clear() {
+  llvm::sys::SmartScopedWriter<true> guard(mutex);
+  records.clear();
+  numCus.clear();
+  databases.clear();
+}
+
+std::vector<size_t>
+SQLitePerfDbCache::getNumCus(const llvm::SmallString<8> &arch) {
+  llvm::sys::SmartScopedWriter<true> guard(mutex);
+  auto it = numCus.find(arch);
+  if (it != numCus.end())
+    return it->getValue();
+  // The listing does not depend on the num_cu of the connection.
+  std::string dbKey = std::string(arch) + ";0";
+  std::vector<size_t> result = getDatabase(dbKey, arch, 0).getNumCus();
+  numCus[arch] = result;
+  return result;
+}
+
+llvm::Optional<llvm::Any>
+SQLitePerfDbCache::lookup(const llvm::SmallString<8> &arch, size_t num_cu,
+                          const std::string &problemKey,
+                          const std::string &solverId, RecordFinder finder) {
+  std::string dbKey = std::string(arch) + ";" + std::to_string(num_cu);
+  std::string recordKey = dbKey + ";" + problemKey + ";" + solverId;
+  {
+    llvm::sys::SmartScopedReader<true> guard(mutex);
+    auto it = records.find(recordKey);
+    if (it != records.end()) {
+      LLVM_DEBUG(dbgs() << "Perf db cache hit: " << recordKey << "\n");
+      return it->second;
+    }
+  }
+
+  llvm::sys::SmartScopedWriter<true> guard(mutex);
+  // Another thread may have resolved the same problem while we were waiting.
+  auto it = records.find(recordKey);
+  if (it != records.end())
+    return it->second;
+
+  LLVM_DEBUG(dbgs() << "Perf db cache miss: " << recordKey << "\n");
+  llvm::Optional<llvm::Any> record = finder(getDatabase(dbKey, arch, num_cu));
+  records[recordKey] = record;
+  return record;
+}
+
+void SQLitePerfDbCache::fill(const llvm::SmallString<8> &arch, size_t num_cu,
+                             llvm::ArrayRef<std::string> problemKeys,
+                             llvm::ArrayRef<std::vector<std::string>> solverIds,
+                             BatchFinder finder) {
+  std::string dbKey = std::string(arch) + ";" + std::to_string(num_cu);
+  llvm::sys::SmartScopedWriter<true> guard(mutex);
+
+  // Problems some of whose solvers are not cached yet, once each.
+  std::vector<size_t> missing;
+  llvm::StringSet<> pending;
+  for (size_t i = 0, e = problemKeys.size(); i < e; ++i) {
+    std::string problemKey = dbKey + ";" + problemKeys[i];
+    bool cached = llvm::all_of(solverIds[i], [&](const std::string &id) {
+      return records.count(problemKey + ";" + id);
+    });
+    if (cached || !pending.insert(problemKey).second)
+      continue;
+    missing.push_back(i);
+  }
+  if (missing.empty())
+    return;
+
+  std::vector<llvm::StringMap<llvm::Any>> found(missing.size());
+  finder(getDatabase(dbKey, arch, num_cu), missing,
+         [&](size_t problem, llvm::StringRef solver, llvm::Any params) {
+           if (llvm::is_contained(solverIds[missing[problem]], solver))
+             found[problem].try_emplace(solver, std::move(params));
+         });
+  for (size_t j = 0, e = missing.size(); j < e; ++j) {
+    std::string problemKey = dbKey + ";" + problemKeys[missing[j]];
+    for (const std::string &id : solverIds[missing[j]]) {
+      llvm::Optional<llvm::Any> record;
+      auto it = found[j].find(id);
+      if (it != found[j].end())
+        record = it->second;
+      records.try_emplace(problemKey + ";" + id, record);
+    }
+  }
+  LLVM_DEBUG(dbgs() << "Perf db cache preloaded " << missing.size()
+                    << " problem(s)\n");
+}
+
+void SQLitePerfDbCache::withDatabase(
+    const llvm::SmallString<8> &arch, size_t num_cu,
+    llvm::function_ref<void(SQLitePerfDb &)> fn) {
+  std::string dbKey = std::string(arch) + ";" + std::to_string(num_cu);
+  llvm::sys::SmartScopedWriter<true> guard(mutex);
+  fn(getDatabase(dbKey, arch, num_cu));
+}
+
+SQLitePerfDb &SQLitePerfDbCache::getDatabase(const std::string &dbKey,
+                                             const llvm::SmallString<8> &arch,
+                                             size_t num_cu) {
+  std::unique_ptr<SQLitePerfDb> &db = databases[dbKey];
+  if (!db)
+    db = std::make_unique<SQLitePerfDb>(getDb(arch, num_cu));
+  return *db;
+}
+
 #endif // MLIR_ENABLE_SQLITE
@@ -0,0 +1,58 @@
+//===- BinaryCompression.cpp - Compression of stored code objects ---------===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/MIOpen/utility/BinaryCompression.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/Error.h"
+
+#define DEBUG_TYPE "miopen-binary-compression"
+
+using namespace mlir;
+
+// A compressed binary is the magic, its uncompressed size as 8 little-endian
+// bytes, and the zlib stream. Code objects start with "\x7fELF" instead.
+static constexpr llvm::StringLiteral kMagic = "MIIRZ001";
+static constexpr size_t kHeaderSize = 16;
+
+std::string miopen::compressBinary(llvm::StringRef binary) {
+  if (!llvm::zlib::isAvailable())
+    return binary.str();
+  llvm::SmallVector<char, 0> compressed;
+  llvm::zlib::compress(binary, compressed, llvm::zlib::BestSizeCompression);
+  if (compressed.size() + kHeaderSize >= binary.size())
+    return binary.str();
+
+  std::string stored(kHeaderSize, '\0');
+  std::copy(kMagic.begin(), kMagic.end(), stored.begin());
+  llvm::support::endian::write64le(&stored[kMagic.size()], binary.size());
+  stored.append(compressed.begin(), compressed.end());
+  return stored;
+}
+
+llvm::Optional<std::string>
+miopen::decompressBinary(llvm::StringRef stored) {
+  if (!stored.startswith(kMagic))
+    return stored.str();
+  if (stored.size() < kHeaderSize || !llvm::zlib::isAvailable())
+    return llvm::None;
+  size_t size = llvm::support::endian::read64le(stored.data() + kMagic.size());
+
+  llvm::SmallVector<char, 0> binary;
+  if (llvm::Error error = llvm::zlib::uncompress(
+          stored.drop_front(kHeaderSize), binary, size)) {
+    LLVM_DEBUG(llvm::dbgs() << "Could not decompress binary: "
+                            << llvm::toString(std::move(error)) << "\n");
+    llvm::consumeError(std::move(error));
+    return llvm::None;
+  }
+  return std::string(binary.begin(), binary.end());
+}
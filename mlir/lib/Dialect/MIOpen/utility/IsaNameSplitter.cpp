@@ -124,3 +124,16 @@ LogicalResult IsaNameSplitter::parseArchName(const std::string &archName,
 
   return success();
 }
+
+std::string IsaNameSplitter::getChip(llvm::StringRef arch) {
+  std::string chip, triple, features;
+  LogicalResult parsed =
+      arch.startswith("amdgcn")
+          ? IsaNameSplitter(arch.str()).parseIsaName(chip, triple, features)
+          : parseArchName(arch.str(), chip, features);
+  if (failed(parsed))
+    chip = (arch.startswith("amdgcn") ? arch.split(':').second : arch)
+               .split(':')
+               .first.str();
+  return chip;
+}
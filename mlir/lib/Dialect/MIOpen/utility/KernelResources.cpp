@@ -0,0 +1,185 @@
+//===- KernelResources.cpp - Resources of compiled kernels ----------------===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file reads the resources of compiled kernels from the msgpack metadata
+// the AMDGPU backend leaves in a note of each HSA code object, and estimates
+// their occupancy from it.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/MIOpen/utility/KernelResources.h"
+#include "mlir/Dialect/MIOpen/utility/IsaNameSplitter.h"
+
+#include "llvm/BinaryFormat/ELF.h"
+#include "llvm/BinaryFormat/MsgPackDocument.h"
+#include "llvm/Object/ELF.h"
+#include "llvm/Support/MathExtras.h"
+
+#include <algorithm>
+
+using namespace mlir;
+using namespace mlir::miopen;
+
+DictionaryAttr KernelResources::getAttr(Builder &b) const {
+  return b.getDictionaryAttr({
+      b.getNamedAttr("vgpr_count", b.getI32IntegerAttr(vgprCount)),
+      b.getNamedAttr("agpr_count", b.getI32IntegerAttr(agprCount)),
+      b.getNamedAttr("sgpr_count", b.getI32IntegerAttr(sgprCount)),
+      b.getNamedAttr("lds_size", b.getI32IntegerAttr(ldsSize)),
+      b.getNamedAttr("scratch_size", b.getI32IntegerAttr(scratchSize)),
+      b.getNamedAttr("wave_size", b.getI32IntegerAttr(waveSize)),
+      b.getNamedAttr("waves_per_simd", b.getI32IntegerAttr(wavesPerSimd)),
+  });
+}
+
+llvm::Optional<KernelResources> KernelResources::fromAttr(Attribute attr) {
+  auto dict = attr.dyn_cast_or_null<DictionaryAttr>();
+  if (!dict)
+    return llvm::None;
+  KernelResources resources;
+  std::pair<StringRef, uint32_t *> fields[] = {
+      {"vgpr_count", &resources.vgprCount},
+      {"agpr_count", &resources.agprCount},
+      {"sgpr_count", &resources.sgprCount},
+      {"lds_size", &resources.ldsSize},
+      {"scratch_size", &resources.scratchSize},
+      {"wave_size", &resources.waveSize},
+      {"waves_per_simd", &resources.wavesPerSimd}};
+  for (auto &field : fields) {
+    auto value = dict.getAs<IntegerAttr>(field.first);
+    if (!value)
+      return llvm::None;
+    *field.second = value.getInt();
+  }
+  return resources;
+}
+
+/// The waves of a kernel using `resources` that fit on a SIMD of `chip` at
+/// once, in blocks of `blockSize` threads. This follows the register files
+/// and LDS of each generation, but not the limits on the number of
+/// workgroups of a CU, which rarely bind for our block sizes.
+static uint32_t computeWavesPerSimd(StringRef chip,
+                                    const KernelResources &resources,
+                                    uint32_t blockSize) {
+  bool isGfx9 = chip.startswith("gfx9");
+  // gfx90a and gfx94x share one file of 512 registers between VGPRs and
+  // AGPRs, and count both in vgprCount.
+  bool unifiedRegisters = chip.startswith("gfx90a") || chip.startswith("gfx94");
+  bool isWave32 = resources.waveSize == 32;
+
+  uint32_t waves, vgprBudget, vgprGranule, simdsPerCu;
+  if (isGfx9) {
+    waves = unifiedRegisters ? 8 : 10;
+    vgprBudget = unifiedRegisters ? 512 : 256;
+    vgprGranule = unifiedRegisters ? 8 : 4;
+    simdsPerCu = 4;
+  } else {
+    waves = chip.startswith("gfx10") ? 20 : 16;
+    vgprBudget = isWave32 ? 1024 : 512;
+    vgprGranule = isWave32 ? 8 : 4;
+    simdsPerCu = 2;
+  }
+
+  if (resources.vgprCount > 0)
+    waves = std::min<uint32_t>(
+        waves, vgprBudget / llvm::alignTo(resources.vgprCount, vgprGranule));
+  if (isGfx9 && !unifiedRegisters && resources.agprCount > 0)
+    waves = std::min<uint32_t>(waves,
+                               256 / llvm::alignTo(resources.agprCount, 4));
+  // Only gfx9 splits a finite SGPR file between waves.
+  if (isGfx9 && resources.sgprCount > 0)
+    waves =
+        std::min<uint32_t>(waves, 800 / llvm::alignTo(resources.sgprCount, 16));
+
+  constexpr uint32_t ldsPerCu = 64 * 1024;
+  if (resources.ldsSize > 0 && blockSize > 0) {
+    uint32_t wavesPerBlock = llvm::divideCeil(blockSize, resources.waveSize);
+    uint32_t blocksPerCu = ldsPerCu / resources.ldsSize;
+    waves = std::min(waves, blocksPerCu * wavesPerBlock / simdsPerCu);
+  }
+  return waves;
+}
+
+/// The value of the integer `node`, or 0 when it isn't one.
+static uint32_t getUInt(llvm::msgpack::DocNode node) {
+  if (node.getKind() == llvm::msgpack::Type::UInt)
+    return node.getUInt();
+  if (node.getKind() == llvm::msgpack::Type::Int)
+    return node.getInt();
+  return 0;
+}
+
+/// The AMDGPU metadata note of the ELF code object `hsaco`.
+static FailureOr<std::string> getMetadataNote(StringRef hsaco) {
+  auto elfOrErr = llvm::object::ELF64LEFile::create(hsaco);
+  if (!elfOrErr) {
+    llvm::consumeError(elfOrErr.takeError());
+    return failure();
+  }
+  auto headersOrErr = elfOrErr->program_headers();
+  if (!headersOrErr) {
+    llvm::consumeError(headersOrErr.takeError());
+    return failure();
+  }
+  for (const auto &header : *headersOrErr) {
+    if (header.p_type != llvm::ELF::PT_NOTE)
+      continue;
+    llvm::Error error = llvm::Error::success();
+    for (const auto &note : elfOrErr->notes(header, error))
+      if (note.getName() == "AMDGPU" &&
+          note.getType() == llvm::ELF::NT_AMDGPU_METADATA) {
+        std::string blob = note.getDescAsStringRef().str();
+        llvm::consumeError(std::move(error));
+        return blob;
+      }
+    if (error)
+      llvm::consumeError(std::move(error));
+  }
+  return failure();
+}
+
+FailureOr<KernelResources> miopen::readKernelResources(StringRef hsaco,
+                                                       StringRef kernel,
+                                                       StringRef chip,
+                                                       uint32_t blockSize) {
+  FailureOr<std::string> note = getMetadataNote(hsaco);
+  if (failed(note))
+    return failure();
+  llvm::msgpack::Document document;
+  if (!document.readFromBlob(*note, /*Multi=*/false) ||
+      !document.getRoot().isMap())
+    return failure();
+  auto &root = document.getRoot().getMap();
+  auto kernels = root.find("amdhsa.kernels");
+  if (kernels == root.end() || !kernels->second.isArray())
+    return failure();
+
+  for (llvm::msgpack::DocNode &entry : kernels->second.getArray()) {
+    if (!entry.isMap())
+      continue;
+    auto &props = entry.getMap();
+    auto name = props.find(".name");
+    if (!kernel.empty() &&
+        (name == props.end() || !name->second.isString() ||
+         name->second.getString() != kernel))
+      continue;
+
+    KernelResources resources;
+    resources.vgprCount = getUInt(props[".vgpr_count"]);
+    resources.agprCount = getUInt(props[".agpr_count"]);
+    resources.sgprCount = getUInt(props[".sgpr_count"]);
+    resources.ldsSize = getUInt(props[".group_segment_fixed_size"]);
+    resources.scratchSize = getUInt(props[".private_segment_fixed_size"]);
+    if (uint32_t waveSize = getUInt(props[".wavefront_size"]))
+      resources.waveSize = waveSize;
+    resources.wavesPerSimd = computeWavesPerSimd(
+        IsaNameSplitter::getChip(chip), resources, blockSize);
+    return resources;
+  }
+  return failure();
+}
@@ -0,0 +1,96 @@
+//===- OrderedRewrite.cpp - One-shot application of lowering patterns -----===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// The greedy driver keeps every op of a function on its worklist, tries to
+// fold each one and requeues the neighbours of every change until nothing
+// moves. The MIOpen lowerings only expand each of their ops once, so this
+// driver visits just the ops the patterns are rooted on, in order.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/MIOpen/utility/OrderedRewrite.h"
+
+#include "mlir/IR/PatternMatch.h"
+#include "mlir/Rewrite/PatternApplicator.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "miopen-ordered-rewrite"
+
+using namespace mlir;
+
+namespace {
+class OrderedRewriteDriver : public PatternRewriter {
+public:
+  OrderedRewriteDriver(MLIRContext *ctx,
+                       const FrozenRewritePatternSet &patterns)
+      : PatternRewriter(ctx), matcher(patterns),
+        roots(patterns.getOpSpecificNativePatterns()) {
+    matcher.applyDefaultCostModel();
+  }
+
+  LogicalResult run(Operation *root) {
+    root->walk<WalkOrder::PreOrder>([&](Operation *op) {
+      if (op != root)
+        addToWorklist(op);
+    });
+    // Rewrites append the ops they create, which are visited after the ones
+    // already queued.
+    for (size_t i = 0; i < worklist.size(); ++i) {
+      Operation *op = worklist[i];
+      if (!op)
+        continue;
+      worklistMap.erase(op);
+      worklist[i] = nullptr;
+      setInsertionPoint(op);
+      if (failed(matcher.matchAndRewrite(op, *this))) {
+        LLVM_DEBUG(llvm::dbgs() << "No pattern rewrote " << *op << "\n");
+        return op->emitOpError("could not be lowered");
+      }
+    }
+    return success();
+  }
+
+protected:
+  void notifyOperationInserted(Operation *op) override {
+    // Ops built along with their regions don't announce their nested ops.
+    op->walk([&](Operation *nested) { addToWorklist(nested); });
+  }
+
+  void notifyOperationRemoved(Operation *op) override {
+    op->walk([&](Operation *nested) {
+      auto it = worklistMap.find(nested);
+      if (it == worklistMap.end())
+        return;
+      worklist[it->second] = nullptr;
+      worklistMap.erase(it);
+    });
+  }
+
+private:
+  void addToWorklist(Operation *op) {
+    if (!roots.count(op->getName()))
+      return;
+    if (worklistMap.try_emplace(op, worklist.size()).second)
+      worklist.push_back(op);
+  }
+
+  PatternApplicator matcher;
+  const FrozenRewritePatternSet::OpSpecificNativePatternListT &roots;
+  SmallVector<Operation *> worklist;
+  DenseMap<Operation *, size_t> worklistMap;
+};
+} // end anonymous namespace
+
+LogicalResult
+mlir::miopen::applyPatternsInOrder(Operation *root,
+                                   const FrozenRewritePatternSet &patterns) {
+  OrderedRewriteDriver driver(root->getContext(), patterns);
+  return driver.run(root);
+}
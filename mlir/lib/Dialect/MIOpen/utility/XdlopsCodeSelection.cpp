@@ -0,0 +1,367 @@
+//===- XdlopsCodeSelection.cpp - XDLOPS instruction selection -------------===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the MFMA and WMMA instruction databases and the
+// selection of XDLOPS code from them.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/MIOpen/XdlopsCodeSelection.h"
+#include "mlir/Dialect/MIOpen/utility/IsaNameSplitter.h"
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/Debug.h"
+
+#include <string>
+
+using namespace mlir;
+
+#define DEBUG_TYPE "miopen-xdlops-code-selection"
+
+namespace {
+// Chips with MFMA instructions, as a bit mask of the chips an instruction is
+// available on.
+enum MfmaArch : unsigned {
+  kGfx908 = 1 << 0,
+  kGfx90a = 1 << 1,
+  kGfx940 = 1 << 2,
+  kAllArchs = kGfx908 | kGfx90a | kGfx940,
+};
+
+enum class MfmaType { F32, F16, BF16, I8, F64, FP8, BF8, XF32 };
+
+// One MFMA instruction. An instruction computes numOutputBlks blocks of
+// m x n results from k values of A and B per block; each lane supplies
+// kBase values of A and of B.
+struct MfmaInsn {
+  amdgpu::MFMAInstr instr;
+  MfmaType type;
+  int64_t m;
+  int64_t n;
+  int64_t k;
+  int64_t numOutputBlks;
+  int64_t kBase;
+  int64_t cycles;
+  unsigned archs;
+};
+
+// The 4x4 instructions are described as a single 4 x 64 block, which is how
+// the gridwise gemm lays their results out.
+// clang-format off
+constexpr MfmaInsn kMfmaInsns[] = {
+  {amdgpu::MFMAInstr::f32_32x32x1f32, MfmaType::F32, 32, 32, 1, 2, 1, 64, kAllArchs},
+  {amdgpu::MFMAInstr::f32_16x16x1f32, MfmaType::F32, 16, 16, 1, 4, 1, 32, kAllArchs},
+  {amdgpu::MFMAInstr::f32_4x4x1f32, MfmaType::F32, 4, 64, 1, 1, 1, 8, kAllArchs},
+  {amdgpu::MFMAInstr::f32_32x32x2f32, MfmaType::F32, 32, 32, 2, 1, 1, 64, kAllArchs},
+  {amdgpu::MFMAInstr::f32_16x16x4f32, MfmaType::F32, 16, 16, 4, 1, 1, 32, kAllArchs},
+  {amdgpu::MFMAInstr::f32_32x32x4_xf32, MfmaType::XF32, 32, 32, 4, 1, 2, 32, kGfx940},
+  {amdgpu::MFMAInstr::f32_16x16x8_xf32, MfmaType::XF32, 16, 16, 8, 1, 2, 16, kGfx940},
+
+  {amdgpu::MFMAInstr::f32_32x32x4f16, MfmaType::F16, 32, 32, 4, 2, 4, 64, kAllArchs},
+  {amdgpu::MFMAInstr::f32_16x16x4f16, MfmaType::F16, 16, 16, 4, 4, 4, 32, kAllArchs},
+  {amdgpu::MFMAInstr::f32_4x4x4f16, MfmaType::F16, 4, 64, 4, 1, 4, 8, kAllArchs},
+  {amdgpu::MFMAInstr::f32_32x32x8f16, MfmaType::F16, 32, 32, 8, 1, 4, 64, kAllArchs},
+  {amdgpu::MFMAInstr::f32_16x16x16f16, MfmaType::F16, 16, 16, 16, 1, 4, 32, kAllArchs},
+
+  {amdgpu::MFMAInstr::f32_32x32x2bf16, MfmaType::BF16, 32, 32, 2, 2, 2, 64, kGfx908 | kGfx90a},
+  {amdgpu::MFMAInstr::f32_16x16x2bf16, MfmaType::BF16, 16, 16, 2, 4, 2, 32, kGfx908 | kGfx90a},
+  {amdgpu::MFMAInstr::f32_4x4x2bf16, MfmaType::BF16, 4, 64, 2, 1, 2, 8, kGfx908 | kGfx90a},
+  {amdgpu::MFMAInstr::f32_32x32x4bf16, MfmaType::BF16, 32, 32, 4, 1, 2, 64, kGfx908 | kGfx90a},
+  {amdgpu::MFMAInstr::f32_16x16x8bf16, MfmaType::BF16, 16, 16, 8, 1, 2, 32, kGfx908 | kGfx90a},
+  {amdgpu::MFMAInstr::f32_32x32x4bf16_1k, MfmaType::BF16, 32, 32, 4, 2, 4, 64, kGfx90a | kGfx940},
+  {amdgpu::MFMAInstr::f32_16x16x4bf16_1k, MfmaType::BF16, 16, 16, 4, 4, 4, 32, kGfx90a | kGfx940},
+  {amdgpu::MFMAInstr::f32_4x4x4bf16_1k, MfmaType::BF16, 4, 64, 4, 1, 4, 8, kGfx90a | kGfx940},
+  {amdgpu::MFMAInstr::f32_32x32x8bf16_1k, MfmaType::BF16, 32, 32, 8, 1, 4, 64, kGfx90a | kGfx940},
+  {amdgpu::MFMAInstr::f32_16x16x16bf16_1k, MfmaType::BF16, 16, 16, 16, 1, 4, 32, kGfx90a | kGfx940},
+
+  {amdgpu::MFMAInstr::i32_32x32x4i8, MfmaType::I8, 32, 32, 4, 2, 4, 64, kAllArchs},
+  {amdgpu::MFMAInstr::i32_16x16x4i8, MfmaType::I8, 16, 16, 4, 4, 4, 32, kAllArchs},
+  {amdgpu::MFMAInstr::i32_4x4x4i8, MfmaType::I8, 4, 64, 4, 1, 4, 8, kAllArchs},
+  {amdgpu::MFMAInstr::i32_32x32x8i8, MfmaType::I8, 32, 32, 8, 1, 4, 64, kGfx908 | kGfx90a},
+  {amdgpu::MFMAInstr::i32_16x16x16i8, MfmaType::I8, 16, 16, 16, 1, 4, 32, kGfx908 | kGfx90a},
+  {amdgpu::MFMAInstr::i32_32x32x16_i8, MfmaType::I8, 32, 32, 16, 1, 8, 64, kGfx940},
+  {amdgpu::MFMAInstr::i32_16x16x32_i8, MfmaType::I8, 16, 16, 32, 1, 8, 32, kGfx940},
+
+  {amdgpu::MFMAInstr::f64_16x16x4f64, MfmaType::F64, 16, 16, 4, 1, 1, 32, kGfx90a | kGfx940},
+
+  {amdgpu::MFMAInstr::f32_32x32x16_fp8_fp8, MfmaType::FP8, 32, 32, 16, 1, 8, 64, kGfx940},
+  {amdgpu::MFMAInstr::f32_16x16x32_fp8_fp8, MfmaType::FP8, 16, 16, 32, 1, 8, 32, kGfx940},
+  {amdgpu::MFMAInstr::f32_32x32x16_bf8_bf8, MfmaType::BF8, 32, 32, 16, 1, 8, 64, kGfx940},
+  {amdgpu::MFMAInstr::f32_16x16x32_bf8_bf8, MfmaType::BF8, 16, 16, 32, 1, 8, 32, kGfx940},
+};
+
+// The sparse MFMAs of gfx940, as the dense MFMAs of the same shape and their
+// own k and kBase. kBase counts the values of B, of which A passes half.
+constexpr MfmaInsn kSparseMfmaInsns[] = {
+  {amdgpu::MFMAInstr::f32_32x32x8f16, MfmaType::F16, 32, 32, 16, 1, 8, 64, kGfx940},
+  {amdgpu::MFMAInstr::f32_16x16x16f16, MfmaType::F16, 16, 16, 32, 1, 8, 32, kGfx940},
+  {amdgpu::MFMAInstr::f32_32x32x8bf16_1k, MfmaType::BF16, 32, 32, 16, 1, 8, 64, kGfx940},
+  {amdgpu::MFMAInstr::f32_16x16x16bf16_1k, MfmaType::BF16, 16, 16, 32, 1, 8, 32, kGfx940},
+  {amdgpu::MFMAInstr::i32_32x32x16_i8, MfmaType::I8, 32, 32, 32, 1, 16, 64, kGfx940},
+  {amdgpu::MFMAInstr::i32_16x16x32_i8, MfmaType::I8, 16, 16, 64, 1, 16, 32, kGfx940},
+};
+// clang-format on
+
+// How a wave tile is covered by instructions of one shape: the tile of one
+// xdlops_gemm_v2, how often it repeats along M and N, and the cbsz, abid and
+// blgp immediates of each of the vectorNumber instructions issued for it.
+struct WaveLayout {
+  int64_t m;
+  int64_t n;
+  int64_t numOutputBlks;
+  int64_t MPerWave;
+  int64_t NPerWave;
+  int64_t MPerXdlops;
+  int64_t NPerXdlops;
+  int64_t MRepeats;
+  int64_t NRepeats;
+  int64_t vectorNumber;
+  unsigned imms[4][3];
+};
+
+// clang-format off
+constexpr WaveLayout kWaveLayouts[] = {
+  {32, 32, 2, 128, 64, 64, 64, 2, 1, 4, {{1, 0, 0}, {1, 1, 0}, {1, 0, 0}, {1, 1, 0}}},
+  {32, 32, 2, 64, 128, 64, 64, 1, 2, 4, {{1, 0, 0}, {1, 1, 0}, {1, 0, 0}, {1, 1, 0}}},
+  {32, 32, 2, 64, 64, 64, 64, 1, 1, 2, {{1, 0, 0}, {1, 1, 0}}},
+  {32, 32, 2, 64, 32, 64, 32, 1, 1, 1, {{0, 0, 1}}},
+  {32, 32, 2, 32, 64, 32, 64, 1, 1, 1, {{1, 0, 0}}},
+  {16, 16, 4, 64, 16, 64, 16, 1, 1, 1, {{0, 0, 4}}},
+  {16, 16, 4, 16, 64, 16, 64, 1, 1, 1, {{2, 0, 0}}},
+  {4, 64, 1, 8, 64, 8, 64, 1, 1, 2, {{4, 0, 0}, {4, 1, 0}}},
+  {4, 64, 1, 4, 64, 4, 64, 1, 1, 1, {{4, 0, 0}}},
+  {32, 32, 1, 32, 32, 32, 32, 1, 1, 1, {{0, 0, 0}}},
+  {16, 16, 1, 16, 16, 16, 16, 1, 1, 1, {{0, 0, 0}}},
+};
+// clang-format on
+
+// One WMMA instruction of gfx11, which computes a 16 x 16 block of results
+// from 16 values of K. Lanes i and i + 16 of a wave32 both supply the 16
+// values of row (or column) i of A (or B).
+struct WmmaInsn {
+  MfmaType type;
+  int64_t cycles;
+};
+
+constexpr int64_t kWmmaSize = 16;
+constexpr int64_t kWmmaWaveSize = 32;
+
+constexpr WmmaInsn kWmmaInsns[] = {
+    {MfmaType::F16, 32},
+    {MfmaType::BF16, 32},
+    {MfmaType::I8, 16},
+};
+
+// The wave tiles WMMA covers, as repeats of the 16 x 16 block along M and N.
+constexpr int64_t kWmmaWaveTiles[][2] = {
+    {16, 16}, {32, 16}, {16, 32}, {32, 32}, {64, 32}, {32, 64},
+};
+} // namespace
+
+static Optional<MfmaType>
+getMfmaType(Type dataType, Optional<miopen::Fp8Format> fp8Format, bool xf32) {
+  if (fp8Format) {
+    if (!dataType.isInteger(8))
+      return None;
+    return *fp8Format == miopen::Fp8Format::E4M3 ? MfmaType::FP8
+                                                 : MfmaType::BF8;
+  }
+  if (xf32)
+    return dataType.isF32() ? Optional<MfmaType>(MfmaType::XF32) : None;
+  if (dataType.isF32())
+    return MfmaType::F32;
+  if (dataType.isF16())
+    return MfmaType::F16;
+  if (dataType.isBF16())
+    return MfmaType::BF16;
+  if (dataType.isInteger(8))
+    return MfmaType::I8;
+  if (dataType.isF64())
+    return MfmaType::F64;
+  return None;
+}
+
+static unsigned getMfmaArch(StringRef arch) {
+  std::string chip = IsaNameSplitter::getChip(arch);
+  StringRef chipRef(chip);
+  if (chipRef == "gfx90a")
+    return kGfx90a;
+  if (chipRef.startswith("gfx94"))
+    return kGfx940;
+  return kGfx908;
+}
+
+static Type getAccumulatorType(MfmaType type, MLIRContext *ctx) {
+  if (type == MfmaType::I8)
+    return IntegerType::get(ctx, 32);
+  if (type == MfmaType::F64)
+    return FloatType::getF64(ctx);
+  return FloatType::getF32(ctx);
+}
+
+bool XdlopsCodeSelection::hasWmma(StringRef arch) {
+  std::string chip = IsaNameSplitter::getChip(arch);
+  return StringRef(chip).startswith("gfx11");
+}
+
+int64_t XdlopsCodeSelection::getWaveSize(StringRef arch) {
+  return hasWmma(arch) ? kWmmaWaveSize : 64;
+}
+
+static FailureOr<XdlopsCodeSelection>
+getWmmaCodeSelection(Type dataType, int64_t MPerWave, int64_t NPerWave,
+                     StringRef arch) {
+  Optional<MfmaType> type =
+      getMfmaType(dataType, /*fp8Format=*/None, /*xf32=*/false);
+  const WmmaInsn *insn = nullptr;
+  if (type)
+    for (const WmmaInsn &candidate : kWmmaInsns)
+      if (candidate.type == *type)
+        insn = &candidate;
+  bool validTile = llvm::any_of(kWmmaWaveTiles, [&](const auto &tile) {
+    return tile[0] == MPerWave && tile[1] == NPerWave;
+  });
+  if (!insn || !validTile) {
+    LLVM_DEBUG(llvm::dbgs() << "No WMMA for " << dataType << " with "
+                            << "MPerWave " << MPerWave << ", NPerWave "
+                            << NPerWave << " on " << arch << "\n");
+    return failure();
+  }
+
+  XdlopsCodeSelection result;
+  result.instr = amdgpu::MFMAInstr::f32_32x32x1f32;
+  result.isWmma = true;
+  result.isSparse = false;
+  result.waveSize = kWmmaWaveSize;
+  result.MPerXdlops = kWmmaSize;
+  result.NPerXdlops = kWmmaSize;
+  result.MRepeats = MPerWave / kWmmaSize;
+  result.NRepeats = NPerWave / kWmmaSize;
+  result.vectorNumber = result.MRepeats * result.NRepeats;
+  result.argType = VectorType::get({kWmmaSize}, dataType);
+
+  // Lane i holds the results of rows 2 * r + i / 16 of column i % 16, which
+  // is the MFMA layout with groups of a single row and two input blocks.
+  result.group_size = 1;
+  result.num_regs_blk = kWmmaSize * kWmmaSize / kWmmaWaveSize;
+  result.num_groups_blk = result.num_regs_blk;
+  result.num_threads_blk = kWmmaSize;
+  result.num_input_blks = kWmmaWaveSize / kWmmaSize;
+  result.num_output_blks = 1;
+  result.num_regs_xdlops = result.num_regs_blk;
+  result.vectorType =
+      VectorType::get({result.num_regs_xdlops},
+                      getAccumulatorType(*type, dataType.getContext()));
+  result.m = kWmmaSize;
+  result.n = kWmmaSize;
+  result.k = kWmmaSize;
+  result.cycles = insn->cycles;
+  result.k_base = kWmmaSize;
+  result.isKReduction = false;
+
+  LLVM_DEBUG(llvm::dbgs() << "Selected WMMA for " << dataType
+                          << " with MPerWave " << MPerWave << ", NPerWave "
+                          << NPerWave << " on " << arch << "\n");
+  return result;
+}
+
+// Multiply-accumulates per cycle, the throughput per K the selection is
+// ranked by.
+static int64_t getMacsPerCycle(const MfmaInsn &insn) {
+  return insn.m * insn.n * insn.k * insn.numOutputBlks / insn.cycles;
+}
+
+FailureOr<XdlopsCodeSelection>
+XdlopsCodeSelection::get(Type dataType, int64_t MPerWave, int64_t NPerWave,
+                         StringRef arch,
+                         Optional<miopen::Fp8Format> fp8Format, bool xf32,
+                         bool sparse) {
+  if (hasWmma(arch)) {
+    // gfx11 has no fp8, xf32 or sparse WMMA
+    if (fp8Format || xf32 || sparse)
+      return failure();
+    return getWmmaCodeSelection(dataType, MPerWave, NPerWave, arch);
+  }
+
+  Optional<MfmaType> type = getMfmaType(dataType, fp8Format, xf32);
+  unsigned mfmaArch = getMfmaArch(arch);
+  ArrayRef<MfmaInsn> insns = kMfmaInsns;
+  if (sparse)
+    insns = kSparseMfmaInsns;
+
+  const WaveLayout *layout = nullptr;
+  const MfmaInsn *best = nullptr;
+  if (type) {
+    for (const WaveLayout &candidate : kWaveLayouts) {
+      if (candidate.MPerWave != MPerWave || candidate.NPerWave != NPerWave)
+        continue;
+      for (const MfmaInsn &insn : insns) {
+        if (insn.type != *type || !(insn.archs & mfmaArch) ||
+            insn.m != candidate.m || insn.n != candidate.n ||
+            insn.numOutputBlks != candidate.numOutputBlks)
+          continue;
+        if (!best || getMacsPerCycle(insn) > getMacsPerCycle(*best)) {
+          best = &insn;
+          layout = &candidate;
+        }
+      }
+    }
+  }
+  if (!best) {
+    LLVM_DEBUG(llvm::dbgs() << "No XDLOPS for " << dataType << " with "
+                            << "MPerWave " << MPerWave << ", NPerWave "
+                            << NPerWave << " on " << arch << "\n");
+    return failure();
+  }
+
+  constexpr int64_t waveSize = 64;
+  Type accType = getAccumulatorType(*type, dataType.getContext());
+
+  XdlopsCodeSelection result;
+  result.instr = best->instr;
+  result.isWmma = false;
+  result.isSparse = sparse;
+  result.waveSize = waveSize;
+  result.MPerXdlops = layout->MPerXdlops;
+  result.NPerXdlops = layout->NPerXdlops;
+  result.MRepeats = layout->MRepeats;
+  result.NRepeats = layout->NRepeats;
+  result.vectorNumber = layout->vectorNumber;
+  for (int64_t i = 0; i < layout->vectorNumber; ++i)
+    result.imms.push_back(
+        {layout->imms[i][0], layout->imms[i][1], layout->imms[i][2]});
+  result.argType = best->kBase == 1
+                       ? dataType
+                       : VectorType::get({best->kBase}, dataType);
+
+  // The f64 MFMAs write the four results of a lane to consecutive groups of
+  // rows rather than to one group of four consecutive rows.
+  result.group_size = *type == MfmaType::F64 ? 1 : 4;
+  result.num_regs_blk = best->m * best->n / waveSize;
+  result.num_groups_blk = result.num_regs_blk / result.group_size;
+  result.num_threads_blk = best->n;
+  result.num_input_blks = waveSize / result.num_threads_blk;
+  result.num_output_blks = best->numOutputBlks;
+  result.num_regs_xdlops = result.num_regs_blk * result.num_output_blks;
+  result.vectorType = VectorType::get({result.num_regs_xdlops}, accType);
+  result.m = best->m;
+  result.n = best->n;
+  result.k = best->k;
+  result.cycles = best->cycles;
+  result.k_base = best->kBase;
+  result.isKReduction =
+      result.num_output_blks == 1 && result.num_input_blks > 1;
+
+  LLVM_DEBUG(llvm::dbgs() << "Selected " << (sparse ? "sparse " : "")
+                          << amdgpu::stringifyMFMAInstr(result.instr)
+                          << " for " << dataType << " with MPerWave "
+                          << MPerWave << ", NPerWave " << NPerWave << " on "
+                          << arch << "\n");
+  return result;
+}
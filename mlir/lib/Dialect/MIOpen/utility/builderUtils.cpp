@@ -40,7 +40,9 @@ Value createConstantIntOp(OpBuilder &b, Location loc, Type type,
 Value createConstantFloatOp(OpBuilder &b, Location loc, Type type,
                             Type elementType, float value) {
   auto semantics = static_cast<APFloat::Semantics>(-1);
-  if (elementType == b.getF32Type()) {
+  if (elementType == b.getF64Type()) {
+    semantics = APFloat::S_IEEEdouble;
+  } else if (elementType == b.getF32Type()) {
     semantics = APFloat::S_IEEEsingle;
   } else if (elementType == b.getF16Type()) {
     semantics = APFloat::S_IEEEhalf;
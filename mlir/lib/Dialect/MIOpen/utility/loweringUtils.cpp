@@ -8,11 +8,17 @@
 
 #include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
 
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
 #include "mlir/Dialect/MIOpen/MIOpen.h"
 #include "mlir/Dialect/MIOpen/TransformMapBuilder.h"
 #include "mlir/Dialect/MIOpen/Tuning/ConvContext.h"
+#include "mlir/Dialect/MIOpen/Tuning/GemmContext.h"
+#include "mlir/Dialect/MIOpen/Tuning/UtilityParams.h"
+#include "mlir/Dialect/MIOpen/utility/IsaNameSplitter.h"
 #include "mlir/IR/BuiltinAttributes.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/Support/MathExtras.h"
 
 using namespace mlir;
 using namespace mlir::miopen;
@@ -140,15 +146,213 @@ static void propagateTransformOob(TransformMapAttr transformMap,
   }
 }
 
+namespace {
+/// One digit of the position `i` of an element within a run, (i / step) %
+/// length, which moves the coordinate it is attached to by `coefficient` per
+/// unit.
+struct RunPiece {
+  int64_t step;
+  int64_t length;
+  int64_t coefficient;
+};
+
+/// The coordinates of the elements of a run in one space of a chain of
+/// transforms. Each coordinate is the coordinate of the first element of the
+/// run plus the contributions of the pieces attached to its dimension. The
+/// first coordinates are only known through a divisor of each of them, where
+/// 0 stands for a coordinate that is 0 itself.
+struct RunLayout {
+  SmallVector<SmallVector<RunPiece, 2>, 5> pieces;
+  SmallVector<int64_t, 5> align;
+
+  explicit RunLayout(size_t nDims) : pieces(nDims), align(nDims, 1) {}
+};
+} // end anonymous namespace
+
+static int64_t gcdOrZero(int64_t x, int64_t y) {
+  return static_cast<int64_t>(
+      llvm::GreatestCommonDivisor64(std::abs(x), std::abs(y)));
+}
+
+/// Fuse the pieces of one coordinate that are consecutive both in the run
+/// and in the coordinate into one.
+static void fusePieces(SmallVectorImpl<RunPiece> &pieces) {
+  llvm::sort(pieces, [](const RunPiece &x, const RunPiece &y) {
+    return x.step < y.step;
+  });
+  SmallVector<RunPiece, 2> fused;
+  for (const RunPiece &piece : pieces) {
+    if (!fused.empty()) {
+      RunPiece &last = fused.back();
+      if (piece.step == last.step * last.length &&
+          piece.coefficient == last.coefficient * last.length) {
+        last.length *= piece.length;
+        continue;
+      }
+    }
+    fused.push_back(piece);
+  }
+  pieces.assign(fused.begin(), fused.end());
+}
+
+/// Split the run coordinate `piece` of a merged dimension, whose first
+/// coordinate has divisor `align`, between the dimensions `lowerDims` of
+/// lengths `lengths` it is merged from. Fails if the run would carry between
+/// lower coordinates at a position that isn't the start of a piece.
+static LogicalResult splitMergedPiece(Optional<RunPiece> piece, int64_t align,
+                                      ArrayRef<uint32_t> lowerDims,
+                                      ArrayRef<int64_t> lengths,
+                                      RunLayout &lower) {
+  for (size_t k = lowerDims.size(); k-- > 0;) {
+    uint32_t dim = lowerDims[k];
+    int64_t length = lengths[k];
+    // The outermost coordinate takes whatever is left.
+    if (k == 0) {
+      lower.align[dim] = align;
+      if (piece)
+        lower.pieces[dim].push_back(*piece);
+      return success();
+    }
+    if (piece && piece->length == 1)
+      piece = llvm::None;
+    int64_t outerAlign = (align % length == 0) ? align / length : 1;
+    int64_t span = piece ? piece->coefficient * piece->length : 1;
+    if (!piece || piece->coefficient % length == 0) {
+      lower.align[dim] = gcdOrZero(align, length);
+      if (piece)
+        piece->coefficient /= length;
+    } else if (length % span == 0 && align % span == 0) {
+      // The run stays within one row of this coordinate.
+      lower.align[dim] = gcdOrZero(align, length);
+      lower.pieces[dim].push_back(*piece);
+      piece = llvm::None;
+    } else if (length % piece->coefficient == 0 &&
+               piece->length % (length / piece->coefficient) == 0 &&
+               align % length == 0) {
+      // The run fills whole rows of this coordinate, starting at the first.
+      int64_t inner = length / piece->coefficient;
+      lower.align[dim] = 0;
+      lower.pieces[dim].push_back({piece->step, inner, piece->coefficient});
+      piece = RunPiece{piece->step * inner, piece->length / inner, 1};
+    } else {
+      return failure();
+    }
+    align = outerAlign;
+  }
+  return success();
+}
+
+/// Move the coordinates of a run from the upper to the lower space of
+/// `transformMap`.
+static LogicalResult propagateRun(TransformMapAttr transformMap,
+                                  RunLayout &upper, RunLayout &lower) {
+  ArrayRef<int64_t> lowerBounds = transformMap.getLowerBounds();
+  for (TransformAttr transform : transformMap.getOps()) {
+    ArrayRef<uint32_t> upperDims = transform.getUpperDims();
+    ArrayRef<uint32_t> lowerDims = transform.getLowerDims();
+    ArrayRef<int64_t> params = transform.getParams();
+
+    switch (transform.getType()) {
+    case TransformType::PassThrough:
+      for (auto pair : llvm::zip(upperDims, lowerDims)) {
+        uint32_t u = std::get<0>(pair);
+        uint32_t l = std::get<1>(pair);
+        lower.pieces[l] = upper.pieces[u];
+        lower.align[l] = upper.align[u];
+      }
+      break;
+    case TransformType::Slice:
+      for (uint32_t i = 0, e = upperDims.size(); i < e; ++i) {
+        uint32_t u = upperDims[i];
+        uint32_t l = lowerDims[i];
+        lower.pieces[l] = upper.pieces[u];
+        lower.align[l] = gcdOrZero(upper.align[u], params[2 * i]);
+      }
+      break;
+    case TransformType::Pad:
+      for (uint32_t i = 0, e = upperDims.size(); i < e; ++i) {
+        uint32_t u = upperDims[i];
+        uint32_t l = lowerDims[i];
+        int64_t left = params[2 * i];
+        int64_t right = params[2 * i + 1];
+        SmallVector<RunPiece, 2> &pieces = upper.pieces[u];
+        fusePieces(pieces);
+        // A run may only be entirely in the padding or entirely out of it,
+        // since loads are bounds-checked on their first element.
+        if (!pieces.empty() && (left != 0 || right != 0)) {
+          if (pieces.size() != 1 || pieces[0].coefficient <= 0)
+            return failure();
+          int64_t span = pieces[0].coefficient * pieces[0].length;
+          if (upper.align[u] % span != 0 || left % span != 0 ||
+              lowerBounds[l] % span != 0)
+            return failure();
+        }
+        lower.pieces[l] = pieces;
+        lower.align[l] = gcdOrZero(upper.align[u], left);
+      }
+      break;
+    case TransformType::AddDim:
+    case TransformType::Broadcast:
+      // Elements of a run that are repeated aren't contiguous.
+      for (uint32_t u : upperDims)
+        if (!upper.pieces[u].empty())
+          return failure();
+      break;
+    case TransformType::Embed:
+    case TransformType::Unmerge: {
+      uint32_t l = lowerDims[0];
+      int64_t align = 0;
+      int64_t coefficient = 1;
+      for (size_t i = upperDims.size(); i-- > 0;) {
+        uint32_t u = upperDims[i];
+        if (transform.getType() == TransformType::Embed)
+          coefficient = params[i];
+        for (RunPiece piece : upper.pieces[u]) {
+          piece.coefficient *= coefficient;
+          lower.pieces[l].push_back(piece);
+        }
+        align = gcdOrZero(align, upper.align[u] * coefficient);
+        if (transform.getType() == TransformType::Unmerge)
+          coefficient *= params[i];
+      }
+      lower.align[l] = align;
+      break;
+    }
+    case TransformType::Merge:
+    case TransformType::Unfold: {
+      uint32_t u = upperDims[0];
+      SmallVector<RunPiece, 2> &pieces = upper.pieces[u];
+      fusePieces(pieces);
+      if (pieces.size() > 1)
+        return failure();
+      Optional<RunPiece> piece;
+      if (!pieces.empty())
+        piece = pieces[0];
+      if (failed(splitMergedPiece(piece, upper.align[u], lowerDims, params,
+                                  lower)))
+        return failure();
+      break;
+    }
+    }
+  }
+  return success();
+}
+
 namespace mlir {
 namespace miopen {
-LogicalResult calculateKBlockNum(ConvolutionDims convDims, int64_t MPerBlock,
-                                 int64_t NPerBlock, int64_t KPerBlock,
-                                 int64_t KPack, int64_t num_cu,
-                                 int64_t &nKBlock) {
-  const int64_t gemmM = convDims.k;
-  const int64_t gemmN = convDims.c * convDims.y * convDims.x;
-  const int64_t gemmK = convDims.n * convDims.ho * convDims.wo;
+LogicalResult calculateKBlockNum(ConvOpType opType, ConvolutionDims convDims,
+                                 int64_t MPerBlock, int64_t NPerBlock,
+                                 int64_t KPerBlock, int64_t KPack,
+                                 int64_t num_cu, int64_t &nKBlock,
+                                 int64_t maxKBlocks) {
+  GemmContext gemmSize = GemmContext::fromConvolution(opType, convDims);
+  const int64_t gemmM = gemmSize.m;
+  const int64_t gemmN = gemmSize.n;
+  const int64_t gemmK = gemmSize.k;
+  // The tensor dimension that is split into KBlock pieces: the batch for
+  // backward weight and the input channels for forward convolutions.
+  const int64_t splitLen =
+      (opType == ConvOpType::BwdWeight) ? convDims.n : convDims.c;
 
   int64_t gemmKBlock = 1;
 
@@ -161,10 +365,10 @@ LogicalResult calculateKBlockNum(ConvolutionDims convDims, int64_t MPerBlock,
   const int64_t maxGridSize = 20 * num_cu;
 
   gemmKBlock = std::max(maxGridSize / gridSize, static_cast<int64_t>(1));
-  gemmKBlock = std::min(gemmKBlock, convDims.n);
+  gemmKBlock = std::min({gemmKBlock, splitLen, maxKBlocks});
 
   for (; gemmKBlock > 1; --gemmKBlock) {
-    if (convDims.n % gemmKBlock != 0)
+    if (splitLen % gemmKBlock != 0)
       continue;
 
     if (gemmK % (gemmKBlock * KPerBlock * KPack) != 0)
@@ -172,8 +376,8 @@ LogicalResult calculateKBlockNum(ConvolutionDims convDims, int64_t MPerBlock,
 
     break;
   }
-  // not more than n
-  gemmKBlock = std::min(convDims.n, gemmKBlock);
+  // not more than the split dimension
+  gemmKBlock = std::min(splitLen, gemmKBlock);
   // not less than 1
   gemmKBlock = std::max((__int64_t)1, gemmKBlock);
 
@@ -234,6 +438,55 @@ std::tuple<ArrayAttr, ArrayAttr> computeOobFromTransforms(
   return {b.getI32ArrayAttr(leftValues), b.getI32ArrayAttr(rightValues)};
 }
 
+/// Whether the runs of `len` consecutive indices along `dim`, starting at
+/// multiples of `len`, are contiguous and aligned in `memType`.
+static bool isContiguousRun(ArrayAttr transforms, uint32_t dim, int64_t len,
+                            MemRefType memType) {
+  ArrayRef<int64_t> upperBounds =
+      transforms.empty()
+          ? memType.getShape()
+          : transforms[0].cast<TransformMapAttr>().getUpperBounds();
+  if (dim >= upperBounds.size() || upperBounds[dim] % len != 0)
+    return false;
+  RunLayout run(upperBounds.size());
+  run.pieces[dim].push_back({1, len, 1});
+  run.align[dim] = len;
+  for (auto transformMap : transforms.getAsRange<TransformMapAttr>()) {
+    RunLayout lower(transformMap.getLowerBounds().size());
+    if (failed(propagateRun(transformMap, run, lower)))
+      return false;
+    run = std::move(lower);
+  }
+
+  // The memory is a row-major embedding of the coordinates of the memref.
+  ArrayRef<int64_t> shape = memType.getShape();
+  SmallVector<RunPiece, 2> address;
+  int64_t align = 0;
+  int64_t stride = 1;
+  for (size_t d = shape.size(); d-- > 0;) {
+    for (RunPiece piece : run.pieces[d]) {
+      piece.coefficient *= stride;
+      address.push_back(piece);
+    }
+    align = gcdOrZero(align, run.align[d] * stride);
+    stride *= shape[d];
+  }
+  fusePieces(address);
+  return address.size() == 1 && address[0].step == 1 &&
+         address[0].length == len && address[0].coefficient == 1 &&
+         align % len == 0 && stride % len == 0;
+}
+
+int64_t getMaxVectorization(ArrayAttr transforms, uint32_t dim,
+                            int64_t maxLen, MemRefType memType) {
+  if (!memType.hasStaticShape() || !memType.getLayout().isIdentity())
+    return 1;
+  for (int64_t len = llvm::PowerOf2Floor(maxLen); len > 1; len /= 2)
+    if (isContiguousRun(transforms, dim, len, memType))
+      return len;
+  return 1;
+}
+
 SmallVector<int64_t>
 populateBackwardDataGemmIds(int64_t strideHeight, int64_t strideWidth,
                             int64_t dilationHeight, int64_t dilationWidth,
@@ -247,26 +500,7 @@ populateBackwardDataGemmIds(int64_t strideHeight, int64_t strideWidth,
   int64_t y = filterHeight;
   int64_t x = filterWidth;
 
-  // Heuristic to determine if every pixel in the output would be written by the
-  // backward data convolution algorithm.
-  auto isEveryPixelWritten = [&]() -> bool {
-    bool result = true;
-    for (int32_t dim = 0; dim < 2; ++dim) {
-      int64_t convStride = (dim == 0) ? strideHeight : strideWidth;
-      int64_t convDilation = (dim == 0) ? dilationHeight : dilationWidth;
-      int64_t filterSize = (dim == 0) ? filterHeight : filterWidth;
-
-      if (!(convDilation == 1 && convStride <= filterSize))
-        result = false;
-    }
-    return result;
-  };
-  bool needZeroInitKernel = !isEveryPixelWritten();
-
   llvm::SmallVector<int64_t> gemmIds;
-  if (needZeroInitKernel)
-    gemmIds.push_back(-1);
-
   // Populate the gemm IDs according to the current backward data convolution
   // algorithm implementation.
   for (int64_t gemmId = 0; gemmId < yTilda * xTilda; ++gemmId) {
@@ -284,9 +518,17 @@ populateBackwardDataGemmIds(int64_t strideHeight, int64_t strideWidth,
   return gemmIds;
 }
 
+bool backwardDataWritesEveryPixel(int64_t strideHeight, int64_t strideWidth,
+                                  int64_t dilationHeight,
+                                  int64_t dilationWidth, int64_t filterHeight,
+                                  int64_t filterWidth) {
+  return dilationHeight == 1 && strideHeight <= filterHeight &&
+         dilationWidth == 1 && strideWidth <= filterWidth;
+}
+
 miopen::ConvOpType obtainConvDirection(Operation *op) {
   miopen::ConvOpType opType = miopen::ConvOpType::Fwd;
-  if (isa<miopen::Conv2DOp>(*op)) {
+  if (isa<miopen::Conv2DOp, miopen::Conv3DOp>(*op)) {
     opType = miopen::ConvOpType::Fwd;
   } else if (isa<miopen::Conv2DBwdDataOp>(*op)) {
     opType = miopen::ConvOpType::BwdData;
@@ -297,12 +539,91 @@ miopen::ConvOpType obtainConvDirection(Operation *op) {
 }
 
 mlir::Type obtainConvDataType(Operation *op) {
-  return op->getOperand(1)
+  unsigned operand = op->hasAttr("int4_group_size") ? 0 : 1;
+  return op->getOperand(operand)
       .getType()
       .template cast<MemRefType>()
       .getElementType();
 }
 
+Optional<Fp8Format> obtainFp8Format(Operation *op) {
+  if (auto attr = op->getAttrOfType<StringAttr>("fp8_format"))
+    return getFp8FormatForName(attr.getValue());
+  return None;
+}
+
+bool usesDirectGroupedConv(Operation *op, const ConvolutionDims &dims) {
+  if (!isa<Conv2DOp>(op) || op->hasAttr("split_k") ||
+      op->hasAttr("winograd_tile") || op->hasAttr("dilation_phases") ||
+      cast<Conv2DOp>(op).requantScales())
+    return false;
+  if (auto perfConfig = op->getAttrOfType<StringAttr>("perf_config"))
+    if (!perfConfig.getValue().empty())
+      return false;
+  return dims.g > 1 && dims.c <= kDirectConvMaxChannelsPerGroup &&
+         dims.k <= kDirectConvMaxChannelsPerGroup;
+}
+
+bool usesSkinnyGemm(Operation *op) {
+  auto gemm = dyn_cast<GemmOp>(op);
+  if (!gemm || op->hasAttr("fp8_format") || gemm.scales())
+    return false;
+  if (gemm.c().getType().cast<MemRefType>().getElementType().isF64())
+    return false;
+  if (auto perfConfig = op->getAttrOfType<StringAttr>("perf_config"))
+    if (!perfConfig.getValue().empty())
+      return false;
+  ArrayRef<int64_t> cShape = gemm.c().getType().cast<MemRefType>().getShape();
+  return std::min(cShape[1], cShape[2]) <= kSkinnyGemmMaxN;
+}
+
+FailureOr<WinogradMatrices> WinogradMatrices::get(int64_t m) {
+  // clang-format off
+  static const float g2[] = {
+    1.0f,  0.0f, 0.0f,
+    0.5f,  0.5f, 0.5f,
+    0.5f, -0.5f, 0.5f,
+    0.0f,  0.0f, 1.0f};
+  static const float bt2[] = {
+    1,  0, -1,  0,
+    0,  1,  1,  0,
+    0, -1,  1,  0,
+    0,  1,  0, -1};
+  static const float at2[] = {
+    1,  1,  1,  0,
+    0,  1, -1, -1};
+
+  static const float g4[] = {
+     1.0f / 4,   0.0f,       0.0f,
+    -1.0f / 6,  -1.0f / 6,  -1.0f / 6,
+    -1.0f / 6,   1.0f / 6,  -1.0f / 6,
+     1.0f / 24,  1.0f / 12,  1.0f / 6,
+     1.0f / 24, -1.0f / 12,  1.0f / 6,
+     0.0f,       0.0f,       1.0f};
+  static const float bt4[] = {
+    4,  0, -5,  0,  1,  0,
+    0, -4, -4,  1,  1,  0,
+    0,  4, -4, -1,  1,  0,
+    0, -2, -1,  2,  1,  0,
+    0,  2, -1, -2,  1,  0,
+    0,  4,  0, -5,  0,  1};
+  static const float at4[] = {
+    1,  1,  1,  1,  1,  0,
+    0,  1, -1,  2, -2,  0,
+    0,  1,  1,  4,  4,  0,
+    0,  1, -1,  8, -8,  1};
+  // clang-format on
+
+  switch (m) {
+  case 2:
+    return WinogradMatrices{2, 4, g2, bt2, at2};
+  case 4:
+    return WinogradMatrices{4, 6, g4, bt4, at4};
+  default:
+    return failure();
+  }
+}
+
 TransformOp reshapeBuffer(OpBuilder &b, Location loc, Value buffer,
                           ArrayRef<StringRef> names, ArrayRef<int64_t> shape) {
   MemRefType bufferType = buffer.getType().cast<MemRefType>();
@@ -327,5 +648,86 @@ TransformOp reshapeBuffer(OpBuilder &b, Location loc, Value buffer,
                                    bufferType.getMemorySpaceAsInt());
   return ret;
 }
+
+int64_t getDotProductWidth(Type dataType, StringRef arch) {
+  std::string chip = IsaNameSplitter::getChip(arch);
+  StringRef chipRef(chip);
+  bool hasDot4 = chipRef == "gfx906" || chipRef == "gfx908" ||
+                 chipRef == "gfx90a" || chipRef == "gfx1011" ||
+                 chipRef == "gfx1012" || chipRef.startswith("gfx103") ||
+                 chipRef.startswith("gfx11");
+  bool hasDot2 = hasDot4 || chipRef.startswith("gfx94");
+  if (dataType.isF16() && hasDot2)
+    return 2;
+  if (dataType.isInteger(8) && hasDot4)
+    return 4;
+  return 1;
+}
+
+int64_t getMinBatchLaunches(int64_t batchSize,
+                            ArrayRef<int64_t> tensorBytes) {
+  for (int64_t launches = 1; launches <= batchSize; ++launches) {
+    if (batchSize % launches != 0)
+      continue;
+    if (llvm::all_of(tensorBytes, [&](int64_t bytes) {
+          return bytes / launches <= kMaxKernelTensorBytes;
+        }))
+      return launches;
+  }
+  return 0;
+}
+
+LdsSwizzle LdsSwizzle::get(int64_t rowLength, int64_t granule,
+                           int64_t elementBytes) {
+  // 32 banks of 4 bytes.
+  constexpr int64_t ldsBankRowBytes = 128;
+  LdsSwizzle swizzle;
+  swizzle.rowLength = rowLength;
+  swizzle.granule = granule;
+  if (!llvm::isPowerOf2_64(rowLength) || !llvm::isPowerOf2_64(granule) ||
+      granule * elementBytes >= ldsBankRowBytes)
+    return swizzle;
+  swizzle.period = std::min(ldsBankRowBytes / (granule * elementBytes),
+                            rowLength / granule);
+  return swizzle;
+}
+
+Value LdsSwizzle::apply(OpBuilder &b, Location loc, Value index,
+                        int64_t tileOffset) const {
+  if (isIdentity())
+    return index;
+  Value offset = b.createOrFold<arith::ConstantIndexOp>(loc, tileOffset);
+  Value rowLengthOp = b.createOrFold<arith::ConstantIndexOp>(loc, rowLength);
+  Value inTile = b.createOrFold<arith::SubIOp>(loc, index, offset);
+  Value row = b.createOrFold<arith::DivUIOp>(loc, inTile, rowLengthOp);
+  // Multiply before XOR-ing so the permutation moves whole granules.
+  Value mask = b.createOrFold<arith::MulIOp>(
+      loc,
+      b.createOrFold<arith::RemUIOp>(
+          loc, row, b.createOrFold<arith::ConstantIndexOp>(loc, period)),
+      b.createOrFold<arith::ConstantIndexOp>(loc, granule));
+  Value swizzled = b.createOrFold<arith::XOrIOp>(loc, inTile, mask);
+  return b.createOrFold<arith::AddIOp>(loc, swizzled, offset);
+}
+Value getPhaseTimesBuffer(Operation *op) {
+  auto func = op->getParentOfType<func::FuncOp>();
+  if (!func)
+    return nullptr;
+  for (BlockArgument arg : func.getArguments())
+    if (func.getArgAttr(arg.getArgNumber(), kPhaseTimesAttrName))
+      return arg;
+  return nullptr;
+}
+
+func::FuncOp getRuntimeFunc(ModuleOp mod, StringRef name, TypeRange argTypes) {
+  if (auto func = mod.lookupSymbol<func::FuncOp>(name))
+    return func;
+  OpBuilder b = OpBuilder::atBlockEnd(mod.getBody());
+  auto func = b.create<func::FuncOp>(
+      mod.getLoc(), name, b.getFunctionType(argTypes, TypeRange{}));
+  func.setPrivate();
+  return func;
+}
+
 } // namespace miopen
 } // namespace mlir
@@ -0,0 +1,97 @@
+//===- DeviceInfo.cpp - Cached properties of the HIP devices --------------===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/ExecutionEngine/DeviceInfo.h"
+
+#include "mlir/Dialect/MIOpen/utility/IsaNameSplitter.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+#include <mutex>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#include "hip/hip_runtime.h"
+#pragma GCC diagnostic pop
+
+using namespace mlir;
+using namespace mlir::miopen;
+
+static constexpr const char kTargetTriple[] = "amdgcn-amd-amdhsa";
+
+namespace {
+struct DeviceCache {
+  std::mutex mutex;
+  llvm::Optional<int> count;
+  /// The devices queried so far, null for those whose query failed.
+  llvm::DenseMap<int, std::unique_ptr<DeviceInfo>> devices;
+};
+} // end anonymous namespace
+
+static DeviceCache &getCache() {
+  static DeviceCache cache;
+  return cache;
+}
+
+static std::unique_ptr<DeviceInfo> queryDevice(int device) {
+  hipDeviceProp_t props;
+  hipError_t status = hipGetDeviceProperties(&props, device);
+  if (status != hipSuccess) {
+    llvm::errs() << "hipGetDeviceProperties failed for device " << device
+                 << ": " << hipGetErrorString(status) << "\n";
+    return nullptr;
+  }
+
+  auto info = std::make_unique<DeviceInfo>();
+  info->device = device;
+  info->archName = props.gcnArchName;
+  if (failed(IsaNameSplitter::parseArchName(info->archName, info->chip,
+                                            info->features))) {
+    llvm::errs() << "Malformed arch name of device " << device << ": "
+                 << info->archName << "\n";
+    return nullptr;
+  }
+  info->numCu = props.multiProcessorCount;
+  info->ldsSize = props.sharedMemPerBlock;
+  info->waveSize = props.warpSize;
+  info->clockRateKHz = props.clockRate;
+  info->memoryClockRateKHz = props.memoryClockRate;
+  return info;
+}
+
+std::string DeviceInfo::getIsaName() const {
+  return std::string(kTargetTriple) + ":" + archName;
+}
+
+int mlir::miopen::getDeviceCount() {
+  DeviceCache &cache = getCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  if (!cache.count) {
+    int count = 0;
+    hipError_t status = hipGetDeviceCount(&count);
+    if (status != hipSuccess) {
+      llvm::errs() << "hipGetDeviceCount failed: " << hipGetErrorString(status)
+                   << "\n";
+      count = 0;
+    }
+    cache.count = count;
+  }
+  return *cache.count;
+}
+
+const DeviceInfo *mlir::miopen::getDeviceInfo(int device) {
+  DeviceCache &cache = getCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  auto it = cache.devices.find(device);
+  if (it == cache.devices.end())
+    it = cache.devices.try_emplace(device, queryDevice(device)).first;
+  return it->second.get();
+}
@@ -12,15 +12,33 @@
 //===----------------------------------------------------------------------===//
 
 #include <cassert>
+#include <cmath>
+#include <limits>
 #include <mutex>
 #include <numeric>
 
 #include "mlir/ExecutionEngine/CRunnerUtils.h"
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
 #include <array>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
 
 typedef union bf16_fp32_cvt {
   uint u32;
@@ -28,90 +46,166 @@ typedef union bf16_fp32_cvt {
   float f32;
 } bf16_fp32_cvt_t;
 
-static float bfloat16_to_float(ushort src_val) {
+// The bf16 conversions shift whole words rather than pick their halves, so
+// that loops converting elements vectorize.
+static inline float bfloat16_to_float(ushort src_val) {
   bf16_fp32_cvt_t target_val;
-  target_val.ushortvec[1] = src_val;
-  target_val.ushortvec[0] = 0;
+  target_val.u32 = static_cast<uint>(src_val) << 16;
   return target_val.f32;
 }
 
-static unsigned short float_to_bfloat16(float src_val) {
+static inline unsigned short float_to_bfloat16(float src_val) {
   bf16_fp32_cvt_t target_val;
   target_val.f32 = src_val;
-  return target_val.ushortvec[1];
-}
-
-// Generate tables for float-to-fp16 conversion
-// ref. http://www.fox-toolkit.org/ftp/fasthalffloatconversion.pdf
-static int generateTables(unsigned short *basetable,
-                          unsigned char *shifttable) {
-  unsigned int i;
-  int e;
-  for (i = 0; i < 256; ++i) {
-    e = i - 127;
-    if (e < -24) { // Very small numbers map to zero
-      basetable[i | 0x000] = 0x0000;
-      basetable[i | 0x100] = 0x8000;
-      shifttable[i | 0x000] = 24;
-      shifttable[i | 0x100] = 24;
-    } else if (e < -14) { // Small numbers map to denorms
-      basetable[i | 0x000] = (0x0400 >> (-e - 14));
-      basetable[i | 0x100] = (0x0400 >> (-e - 14)) | 0x8000;
-      shifttable[i | 0x000] = -e - 1;
-      shifttable[i | 0x100] = -e - 1;
-    } else if (e <= 15) { // Normal numbers just lose precision
-      basetable[i | 0x000] = ((e + 15) << 10);
-      basetable[i | 0x100] = ((e + 15) << 10) | 0x8000;
-      shifttable[i | 0x000] = 13;
-      shifttable[i | 0x100] = 13;
-    } else if (e < 128) { // Large numbers map to Infinity
-      basetable[i | 0x000] = 0x7C00;
-      basetable[i | 0x100] = 0xFC00;
-      shifttable[i | 0x000] = 24;
-      shifttable[i | 0x100] = 24;
-    } else { // Infinity and NaN's stay Infinity and NaN's
-      basetable[i | 0x000] = 0x7C00;
-      basetable[i | 0x100] = 0xFC00;
-      shifttable[i | 0x000] = 13;
-      shifttable[i | 0x100] = 13;
-    }
-  }
-
-  return 1;
+  return static_cast<unsigned short>(target_val.u32 >> 16);
 }
 
-static unsigned short float_to_fp16(float src_val) {
-  // Generate tables for converting float to fp16
-  static unsigned short basetable[512];
-  static unsigned char shifttable[512];
-  static std::once_flag flag;
-  std::call_once(flag, generateTables, basetable, shifttable);
-
-  // ref. http://www.fox-toolkit.org/ftp/fasthalffloatconversion.pdf
+// Converts to fp16 by truncation, with the table lookups of
+// http://www.fox-toolkit.org/ftp/fasthalffloatconversion.pdf replaced by
+// selects, so that loops converting elements vectorize.
+static inline unsigned short float_to_fp16(float src_val) {
   bf16_fp32_cvt_t target_val;
   target_val.f32 = src_val;
 
   unsigned int b = target_val.u32;
-  unsigned short h = basetable[(b >> 23) & 0x1ff] +
-                     ((b & 0x007fffff) >> shifttable[(b >> 23) & 0x1ff]);
-  return h;
+  unsigned int sign = (b >> 16) & 0x8000;
+  int e = static_cast<int>((b >> 23) & 0xff) - 127;
+  unsigned int mantissa = b & 0x007fffff;
+  // Small numbers map to denorms, for e in [-24, -14)
+  int denormShift = std::min(std::max(-e - 14, 0), 10);
+  bool isZero = e < -24;
+  bool isDenorm = !isZero && e < -14;
+  bool isNormal = !isZero && !isDenorm && e <= 15;
+  bool isNaN = e == 128;
+  // Very small numbers map to zero, large numbers to Infinity, and Infinity
+  // and NaN's stay Infinity and NaN's
+  unsigned int base = isZero     ? 0
+                      : isDenorm ? 0x0400u >> denormShift
+                      : isNormal ? static_cast<unsigned int>(e + 15) << 10
+                                 : 0x7C00;
+  unsigned int shift = isDenorm               ? denormShift + 13
+                       : (isNormal || isNaN) ? 13
+                                             : 24;
+  return (sign | base) + (mantissa >> shift);
 }
 
-short randomIntegerValue(short min, short max) {
-  if (min == max)
+// The 8-bit floats of gfx940, in their format 0 (E4M3, exponent bias 8) or 1
+// (E5M2, exponent bias 16). Both lack infinities and negative zero, and 0x80
+// is their only NaN.
+static inline float fp8_to_float(uint8_t src_val, int32_t format) {
+  if (src_val == 0x80)
+    return std::numeric_limits<float>::quiet_NaN();
+  int mantissaBits = format == 0 ? 3 : 2;
+  int bias = format == 0 ? 8 : 16;
+  int e = (src_val & 0x7f) >> mantissaBits;
+  int mantissa = src_val & ((1 << mantissaBits) - 1);
+  float value =
+      e == 0 ? std::ldexp(static_cast<float>(mantissa), 1 - bias - mantissaBits)
+             : std::ldexp(static_cast<float>(mantissa | (1 << mantissaBits)),
+                          e - bias - mantissaBits);
+  return src_val & 0x80 ? -value : value;
+}
+
+// Rounds to the nearest 8-bit float, saturating to the largest finite one.
+static inline uint8_t float_to_fp8(float src_val, int32_t format) {
+  static const auto magnitudes = [] {
+    std::array<std::array<float, 128>, 2> table;
+    for (int32_t f = 0; f < 2; ++f)
+      for (int i = 0; i < 128; ++i)
+        table[f][i] = fp8_to_float(i, f);
+    return table;
+  }();
+  const std::array<float, 128> &table = magnitudes[format];
+  float magnitude = std::min(std::fabs(src_val), table[127]);
+  auto bits = static_cast<uint8_t>(
+      std::lower_bound(table.begin(), table.end(), magnitude) - table.begin());
+  if (bits > 0 && magnitude - table[bits - 1] < table[bits] - magnitude)
+    --bits;
+  return bits == 0 || !std::signbit(src_val) ? bits : bits | 0x80;
+}
+
+// Random values are counter based: that of an element only depends on the
+// seed and on the index of the element in the tensor, so tensors fill the
+// same whatever the number of threads filling them, and without the lock
+// std::rand takes on every call.
+static inline uint32_t hashBits(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352d;
+  x ^= x >> 15;
+  x *= 0x846ca68b;
+  x ^= x >> 16;
+  return x;
+}
+
+static inline uint32_t randomBits(uint32_t key, uint64_t index) {
+  return hashBits(hashBits(static_cast<uint32_t>(index) ^ key) ^
+                  static_cast<uint32_t>(index >> 32));
+}
+
+// A value in [min, max), or min if the range is empty.
+static inline short randomIntegerValue(uint32_t bits, short min, short max) {
+  if (max <= min)
     return min;
-  return (std::rand() % (max - min)) + min;
+  uint32_t range = max - min;
+  return min + static_cast<short>((static_cast<uint64_t>(bits) * range) >> 32);
 }
 
-float randomFloatValue(short min, short max) {
+static inline float randomFloatValue(uint32_t bits, short min, short max) {
   auto minAsF = static_cast<float>(min);
   if (min == max)
     return minAsF * 0.1f; // avoid inf
-  return static_cast<float>((max - min) * static_cast<double>(std::rand()) /
-                            static_cast<double>(RAND_MAX)) +
-         minAsF;
+  float unit = static_cast<float>(bits >> 8) * (1.0f / (1 << 24));
+  return static_cast<float>(max - min) * unit + minAsF;
 }
 
+// Stores generate(bits) into every element of a 5D tensor, from the random
+// bits of `seed`, or of the current time if it is 0, and of the index of the
+// element. Defined with the executor it runs on.
+template <typename T, typename Generate>
+static void fillRandom5D(T *aligned, int64_t offset,
+                         std::array<int64_t, 5> sizes,
+                         std::array<int64_t, 5> strides, uint32_t seed,
+                         Generate generate);
+
+// The conversions of contiguous spans of elements. x86 builds also get AVX2
+// versions, picked when the library loads, in which the per-element shifts of
+// float_to_fp16 vectorize too.
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define CONVERT_TARGETS __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+#ifndef CONVERT_TARGETS
+#define CONVERT_TARGETS
+#endif
+
+CONVERT_TARGETS static void convertFloatToHalf(const float *from,
+                                               unsigned short *to,
+                                               int64_t size) {
+  for (int64_t i = 0; i < size; ++i)
+    to[i] = float_to_fp16(from[i]);
+}
+
+CONVERT_TARGETS static void convertFloatToBF16(const float *from,
+                                               unsigned short *to,
+                                               int64_t size) {
+  for (int64_t i = 0; i < size; ++i)
+    to[i] = float_to_bfloat16(from[i]);
+}
+
+CONVERT_TARGETS static void convertBF16ToFloat(const unsigned short *from,
+                                               float *to, int64_t size) {
+  for (int64_t i = 0; i < size; ++i)
+    to[i] = bfloat16_to_float(from[i]);
+}
+
+// Converts the `size` elements of contiguous tensors, by spans in parallel.
+// Defined with the executor it runs on.
+template <typename TSrc, typename TDst>
+static void convertElements(const TSrc *source, TDst *dest, int64_t size,
+                            void (*convertSpan)(const TSrc *, TDst *,
+                                                int64_t));
+
 extern "C" void mcpuMemset(float *allocated, float *aligned, int64_t offset,
                            int64_t size, int64_t stride, float value) {
   for (unsigned i = 0; i < size; ++i) {
@@ -125,21 +219,11 @@ mcpuMemset5DInt8RandInt(int8_t *allocated, int8_t *aligned, int64_t offset,
                         int64_t size3, int64_t size4, int64_t stride0,
                         int64_t stride1, int64_t stride2, int64_t stride3,
                         int64_t stride4, short min, short max, uint32_t seed) {
-  if (seed == 0)
-    std::srand(time(0));
-  else
-    std::srand(seed);
-
-  int8_t value;
-  for (unsigned i = 0; i < size0; ++i)
-    for (unsigned j = 0; j < size1; ++j)
-      for (unsigned k = 0; k < size2; ++k)
-        for (unsigned l = 0; l < size3; ++l)
-          for (unsigned m = 0; m < size4; ++m) {
-            value = (int8_t)randomIntegerValue(min, max);
-            aligned[i * stride0 + j * stride1 + k * stride2 + l * stride3 +
-                    m * stride4] = value;
-          }
+  fillRandom5D(aligned, offset, {size0, size1, size2, size3, size4},
+               {stride0, stride1, stride2, stride3, stride4}, seed,
+               [=](uint32_t bits) {
+                 return (int8_t)randomIntegerValue(bits, min, max);
+               });
 }
 
 extern "C" void
@@ -148,21 +232,64 @@ mcpuMemset5DInt32RandInt(int32_t *allocated, int32_t *aligned, int64_t offset,
                          int64_t size3, int64_t size4, int64_t stride0,
                          int64_t stride1, int64_t stride2, int64_t stride3,
                          int64_t stride4, short min, short max, uint32_t seed) {
-  if (seed == 0)
-    std::srand(time(0));
-  else
-    std::srand(seed);
+  fillRandom5D(aligned, offset, {size0, size1, size2, size3, size4},
+               {stride0, stride1, stride2, stride3, stride4}, seed,
+               [=](uint32_t bits) {
+                 return (int32_t)randomIntegerValue(bits, min, max);
+               });
+}
 
-  int32_t value;
-  for (unsigned i = 0; i < size0; ++i)
-    for (unsigned j = 0; j < size1; ++j)
-      for (unsigned k = 0; k < size2; ++k)
-        for (unsigned l = 0; l < size3; ++l)
-          for (unsigned m = 0; m < size4; ++m) {
-            value = (int32_t)randomIntegerValue(min, max);
-            aligned[i * stride0 + j * stride1 + k * stride2 + l * stride3 +
-                    m * stride4] = value;
-          }
+// Fills an fp8 tensor of format `format` with random integers or floats in
+// [min, max), rounded to 8-bit floats.
+static void fillRandomFp8(int8_t *aligned, int64_t offset,
+                          std::array<int64_t, 5> sizes,
+                          std::array<int64_t, 5> strides, short min, short max,
+                          uint32_t seed, int32_t format, bool isFloat) {
+  fillRandom5D(aligned, offset, sizes, strides, seed, [=](uint32_t bits) {
+    float value = isFloat ? randomFloatValue(bits, min, max)
+                          : randomIntegerValue(bits, min, max);
+    return static_cast<int8_t>(float_to_fp8(value, format));
+  });
+}
+
+extern "C" void mcpuMemset5DFp8E4M3RandInt(
+    int8_t *allocated, int8_t *aligned, int64_t offset, int64_t size0,
+    int64_t size1, int64_t size2, int64_t size3, int64_t size4,
+    int64_t stride0, int64_t stride1, int64_t stride2, int64_t stride3,
+    int64_t stride4, short min, short max, uint32_t seed) {
+  fillRandomFp8(aligned, offset, {size0, size1, size2, size3, size4},
+                {stride0, stride1, stride2, stride3, stride4}, min, max, seed,
+                /*format=*/0, /*isFloat=*/false);
+}
+
+extern "C" void mcpuMemset5DFp8E4M3RandFloat(
+    int8_t *allocated, int8_t *aligned, int64_t offset, int64_t size0,
+    int64_t size1, int64_t size2, int64_t size3, int64_t size4,
+    int64_t stride0, int64_t stride1, int64_t stride2, int64_t stride3,
+    int64_t stride4, short min, short max, uint32_t seed) {
+  fillRandomFp8(aligned, offset, {size0, size1, size2, size3, size4},
+                {stride0, stride1, stride2, stride3, stride4}, min, max, seed,
+                /*format=*/0, /*isFloat=*/true);
+}
+
+extern "C" void mcpuMemset5DFp8E5M2RandInt(
+    int8_t *allocated, int8_t *aligned, int64_t offset, int64_t size0,
+    int64_t size1, int64_t size2, int64_t size3, int64_t size4,
+    int64_t stride0, int64_t stride1, int64_t stride2, int64_t stride3,
+    int64_t stride4, short min, short max, uint32_t seed) {
+  fillRandomFp8(aligned, offset, {size0, size1, size2, size3, size4},
+                {stride0, stride1, stride2, stride3, stride4}, min, max, seed,
+                /*format=*/1, /*isFloat=*/false);
+}
+
+extern "C" void mcpuMemset5DFp8E5M2RandFloat(
+    int8_t *allocated, int8_t *aligned, int64_t offset, int64_t size0,
+    int64_t size1, int64_t size2, int64_t size3, int64_t size4,
+    int64_t stride0, int64_t stride1, int64_t stride2, int64_t stride3,
+    int64_t stride4, short min, short max, uint32_t seed) {
+  fillRandomFp8(aligned, offset, {size0, size1, size2, size3, size4},
+                {stride0, stride1, stride2, stride3, stride4}, min, max, seed,
+                /*format=*/1, /*isFloat=*/true);
 }
 
 extern "C" void mcpuMem5DFloatConvertHalf(
@@ -177,9 +304,8 @@ extern "C" void mcpuMem5DFloatConvertHalf(
          size5 * size6 * size7 * size8 * size9);
 
   int64_t dataSize = size0 * size1 * size2 * size3 * size4;
-  for (int64_t i = 0; i < dataSize; i++) {
-    destAligned[i] = float_to_fp16(sourceAligned[i]);
-  }
+  convertElements(sourceAligned + sourceOffset, destAligned + destOffset,
+                  dataSize, convertFloatToHalf);
 }
 
 extern "C" void mcpuMem5DFloatConvertBF16(
@@ -194,9 +320,8 @@ extern "C" void mcpuMem5DFloatConvertBF16(
          size5 * size6 * size7 * size8 * size9);
 
   int64_t dataSize = size0 * size1 * size2 * size3 * size4;
-  for (int64_t i = 0; i < dataSize; i++) {
-    destAligned[i] = float_to_bfloat16(sourceAligned[i]);
-  }
+  convertElements(sourceAligned + sourceOffset, destAligned + destOffset,
+                  dataSize, convertFloatToBF16);
 }
 
 extern "C" void mcpuMem5DBF16ConvertFloat(
@@ -210,9 +335,8 @@ extern "C" void mcpuMem5DBF16ConvertFloat(
   assert(size0 * size1 * size2 * size3 * size4 ==
          size5 * size6 * size7 * size8 * size9);
   int64_t dataSize = size0 * size1 * size2 * size3 * size4;
-  for (int64_t i = 0; i < dataSize; i++) {
-    destAligned[i] = bfloat16_to_float(sourceAligned[i]);
-  }
+  convertElements(sourceAligned + sourceOffset, destAligned + destOffset,
+                  dataSize, convertBF16ToFloat);
 }
 
 extern "C" void mcpuPrintBF16(unsigned short *allocated,
@@ -235,6 +359,162 @@ extern "C" void mcpuPrintInt32(int32_t d1, int32_t d2) {
   printf("Values: %d, %d\n", d1, d2);
 }
 
+// Prints the statistics of the kernel times in milliseconds of a benchmark,
+// as one line of JSON. The rates are those of the median time, from the
+// `flops` operations and `bytes` of tensors of one launch.
+extern "C" void mcpuPrintBenchmark(float *allocated, float *aligned,
+                                   int64_t offset, int64_t size,
+                                   int64_t stride, int32_t kernel,
+                                   int32_t warmup, double flops,
+                                   double bytes) {
+  if (size <= 0)
+    return;
+  std::vector<float> times(size);
+  for (int64_t i = 0; i < size; ++i)
+    times[i] = aligned[offset + i * stride];
+  std::sort(times.begin(), times.end());
+
+  double median = size % 2 ? times[size / 2]
+                           : (times[size / 2 - 1] + times[size / 2]) / 2.0;
+  // Nearest-rank percentile.
+  double p99 = times[(99 * size + 99) / 100 - 1];
+  double mean = std::accumulate(times.begin(), times.end(), 0.0) / size;
+  double seconds = median * 1e-3;
+  double tflops = seconds > 0 ? flops / seconds * 1e-12 : 0.0;
+  double bandwidth = seconds > 0 ? bytes / seconds * 1e-9 : 0.0;
+  printf("{\"kernel\": %d, \"warmup\": %d, \"launches\": %ld, "
+         "\"min_ms\": %.6f, \"median_ms\": %.6f, \"p99_ms\": %.6f, "
+         "\"mean_ms\": %.6f, \"flops\": %.0f, \"bytes\": %.0f, "
+         "\"tflops\": %.4f, \"bandwidth_gbps\": %.2f}\n",
+         kernel, warmup, static_cast<long>(size), times.front(), median, p99,
+         mean, flops, bytes, tflops, bandwidth);
+  fflush(stdout);
+}
+
+// Prints the mean cycles of the phases of the gridwise gemms of a kernel, as
+// one line of JSON, from the clock readings its workgroups wrote to their
+// rows of a phase times buffer: at the start, after the first global loads
+// were issued, after the first LDS stores, after the main loop and after the
+// epilogue. Rows left at 0 are those of workgroups past the grid.
+extern "C" void mcpuPrintPhaseTimes(int64_t *allocated, int64_t *aligned,
+                                    int64_t offset, int64_t size0,
+                                    int64_t size1, int64_t stride0,
+                                    int64_t stride1, int32_t kernel) {
+  constexpr int64_t numStamps = 5;
+  if (size1 != numStamps)
+    return;
+  std::array<double, numStamps> sums = {};
+  int64_t workgroups = 0;
+  for (int64_t row = 0; row < size0; ++row) {
+    const int64_t *stamps = aligned + offset + row * stride0;
+    if (stamps[0] == 0)
+      continue;
+    ++workgroups;
+    for (int64_t i = 1; i < numStamps; ++i)
+      sums[i] += stamps[i * stride1] - stamps[(i - 1) * stride1];
+  }
+  double scale = workgroups > 0 ? 1.0 / workgroups : 0.0;
+  printf("{\"kernel\": %d, \"workgroups\": %ld, \"global_loads\": %.1f, "
+         "\"lds_stores\": %.1f, \"main_loop\": %.1f, \"epilogue\": %.1f}\n",
+         kernel, static_cast<long>(workgroups), sums[1] * scale,
+         sums[2] * scale, sums[3] * scale, sums[4] * scale);
+  fflush(stdout);
+}
+
+//===----------------------------------------------------------------------===//
+// The reference cache keeps the results of the CPU validation of a problem in
+// a file of their own, so that validating it again only loads them. A file
+// holds, in the byte order of the host:
+//
+//   char   magic[8]     "MIIRREF" and the version of the format
+//   uint32 elementBytes
+//   uint32 reserved
+//   uint64 numElements
+//
+// and the elements as they lie in memory, 64 bytes in so that they stay
+// aligned in the mapped file.
+//===----------------------------------------------------------------------===//
+
+static constexpr char kReferenceMagic[8] = {'M', 'I', 'I', 'R',
+                                            'R', 'E', 'F', 1};
+static constexpr size_t kReferenceDataOffset = 64;
+
+namespace {
+struct ReferenceHeader {
+  char magic[8];
+  uint32_t elementBytes;
+  uint32_t reserved;
+  uint64_t numElements;
+};
+} // namespace
+
+// Loads the `size` elements of `elementBytes` of a contiguous result from the
+// cache file at `path`, returning 1, or 0 if the file does not hold them.
+extern "C" int32_t mcpuLoadReference(void *allocated, void *aligned,
+                                     int64_t offset, int64_t size,
+                                     int64_t stride, int32_t elementBytes,
+                                     char *pathAllocated, char *pathAligned,
+                                     int64_t pathOffset, int64_t pathSize,
+                                     int64_t pathStride) {
+  std::string path(pathAligned + pathOffset, pathSize);
+  size_t dataBytes = static_cast<size_t>(size) * elementBytes;
+  auto buffer = llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                            /*RequiresNullTerminator=*/false);
+  if (!buffer || (*buffer)->getBufferSize() != kReferenceDataOffset + dataBytes)
+    return 0;
+  const char *data = (*buffer)->getBufferStart();
+  ReferenceHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kReferenceMagic, sizeof(kReferenceMagic)) ||
+      header.elementBytes != static_cast<uint32_t>(elementBytes) ||
+      header.numElements != static_cast<uint64_t>(size))
+    return 0;
+  std::memcpy(static_cast<char *>(aligned) + offset * elementBytes,
+              data + kReferenceDataOffset, dataBytes);
+  return 1;
+}
+
+// Stores the `size` elements of `elementBytes` of a contiguous result into
+// the cache file at `path`. The file is written under another name and then
+// renamed, so that harnesses validating the same problem at once never load
+// part of it. Failures only leave the result uncached.
+extern "C" void mcpuStoreReference(void *allocated, void *aligned,
+                                   int64_t offset, int64_t size,
+                                   int64_t stride, int32_t elementBytes,
+                                   char *pathAllocated, char *pathAligned,
+                                   int64_t pathOffset, int64_t pathSize,
+                                   int64_t pathStride) {
+  std::string path(pathAligned + pathOffset, pathSize);
+  llvm::StringRef dir = llvm::sys::path::parent_path(path);
+  if (!dir.empty() && llvm::sys::fs::create_directories(dir))
+    return;
+  auto file = llvm::sys::fs::TempFile::create(path + ".tmp-%%%%%%");
+  if (!file) {
+    llvm::consumeError(file.takeError());
+    return;
+  }
+
+  ReferenceHeader header = {};
+  std::memcpy(header.magic, kReferenceMagic, sizeof(kReferenceMagic));
+  header.elementBytes = elementBytes;
+  header.numElements = size;
+  char prefix[kReferenceDataOffset] = {};
+  std::memcpy(prefix, &header, sizeof(header));
+  bool failed;
+  {
+    llvm::raw_fd_ostream os(file->FD, /*shouldClose=*/false);
+    os.write(prefix, sizeof(prefix));
+    os.write(static_cast<const char *>(aligned) + offset * elementBytes,
+             static_cast<size_t>(size) * elementBytes);
+    os.flush();
+    failed = os.has_error();
+    os.clear_error();
+  }
+  llvm::Error error = failed ? file->discard() : file->keep(path);
+  if (error)
+    llvm::consumeError(std::move(error));
+}
+
 // 2D float memref utility routines.
 
 extern "C" void mcpuMemset2DFloat(float *allocated, float *aligned,
@@ -296,21 +576,11 @@ mcpuMemset5DFloatRandInt(float *allocated, float *aligned, int64_t offset,
                          int64_t size3, int64_t size4, int64_t stride0,
                          int64_t stride1, int64_t stride2, int64_t stride3,
                          int64_t stride4, short min, short max, uint32_t seed) {
-  if (seed == 0)
-    std::srand(time(0));
-  else
-    std::srand(seed);
-
-  float value;
-  for (unsigned i = 0; i < size0; ++i)
-    for (unsigned j = 0; j < size1; ++j)
-      for (unsigned k = 0; k < size2; ++k)
-        for (unsigned l = 0; l < size3; ++l)
-          for (unsigned m = 0; m < size4; ++m) {
-            value = (float)randomIntegerValue(min, max);
-            aligned[i * stride0 + j * stride1 + k * stride2 + l * stride3 +
-                    m * stride4] = value;
-          }
+  fillRandom5D(aligned, offset, {size0, size1, size2, size3, size4},
+               {stride0, stride1, stride2, stride3, stride4}, seed,
+               [=](uint32_t bits) {
+                 return (float)randomIntegerValue(bits, min, max);
+               });
 }
 
 extern "C" void mcpuMemset5DFloatRandFloat(
@@ -318,21 +588,35 @@ extern "C" void mcpuMemset5DFloatRandFloat(
     int64_t size1, int64_t size2, int64_t size3, int64_t size4, int64_t stride0,
     int64_t stride1, int64_t stride2, int64_t stride3, int64_t stride4,
     short min, short max, uint32_t seed) {
-  if (seed == 0)
-    std::srand(time(0));
-  else
-    std::srand(seed);
+  fillRandom5D(aligned, offset, {size0, size1, size2, size3, size4},
+               {stride0, stride1, stride2, stride3, stride4}, seed,
+               [=](uint32_t bits) {
+                 return randomFloatValue(bits, min, max);
+               });
+}
 
-  float value;
-  for (unsigned i = 0; i < size0; ++i)
-    for (unsigned j = 0; j < size1; ++j)
-      for (unsigned k = 0; k < size2; ++k)
-        for (unsigned l = 0; l < size3; ++l)
-          for (unsigned m = 0; m < size4; ++m) {
-            value = randomFloatValue(min, max);
-            aligned[i * stride0 + j * stride1 + k * stride2 + l * stride3 +
-                    m * stride4] = value;
-          }
+extern "C" void mcpuMemset5DDoubleRandInt(
+    double *allocated, double *aligned, int64_t offset, int64_t size0,
+    int64_t size1, int64_t size2, int64_t size3, int64_t size4, int64_t stride0,
+    int64_t stride1, int64_t stride2, int64_t stride3, int64_t stride4,
+    short min, short max, uint32_t seed) {
+  fillRandom5D(aligned, offset, {size0, size1, size2, size3, size4},
+               {stride0, stride1, stride2, stride3, stride4}, seed,
+               [=](uint32_t bits) {
+                 return (double)randomIntegerValue(bits, min, max);
+               });
+}
+
+extern "C" void mcpuMemset5DDoubleRandFloat(
+    double *allocated, double *aligned, int64_t offset, int64_t size0,
+    int64_t size1, int64_t size2, int64_t size3, int64_t size4, int64_t stride0,
+    int64_t stride1, int64_t stride2, int64_t stride3, int64_t stride4,
+    short min, short max, uint32_t seed) {
+  fillRandom5D(aligned, offset, {size0, size1, size2, size3, size4},
+               {stride0, stride1, stride2, stride3, stride4}, seed,
+               [=](uint32_t bits) {
+                 return (double)randomFloatValue(bits, min, max);
+               });
 }
 
 // Copy Float to Float
@@ -376,22 +660,12 @@ extern "C" void mcpuMemset5DHalfRandInt(
     int64_t size0, int64_t size1, int64_t size2, int64_t size3, int64_t size4,
     int64_t stride0, int64_t stride1, int64_t stride2, int64_t stride3,
     int64_t stride4, short min, short max, uint32_t seed) {
-
-  if (seed == 0)
-    std::srand(time(0));
-  else
-    std::srand(seed);
-
-  float value;
-  for (unsigned i = 0; i < size0; ++i)
-    for (unsigned j = 0; j < size1; ++j)
-      for (unsigned k = 0; k < size2; ++k)
-        for (unsigned l = 0; l < size3; ++l)
-          for (unsigned m = 0; m < size4; ++m) {
-            value = (float)randomIntegerValue(min, max);
-            aligned[i * stride0 + j * stride1 + k * stride2 + l * stride3 +
-                    m * stride4] = float_to_fp16(value);
-          }
+  fillRandom5D(aligned, offset, {size0, size1, size2, size3, size4},
+               {stride0, stride1, stride2, stride3, stride4}, seed,
+               [=](uint32_t bits) {
+                 return float_to_fp16(
+                     (float)randomIntegerValue(bits, min, max));
+               });
 }
 
 extern "C" void mcpuMemset5DHalfRandFloat(
@@ -399,22 +673,11 @@ extern "C" void mcpuMemset5DHalfRandFloat(
     int64_t size0, int64_t size1, int64_t size2, int64_t size3, int64_t size4,
     int64_t stride0, int64_t stride1, int64_t stride2, int64_t stride3,
     int64_t stride4, short min, short max, uint32_t seed) {
-
-  if (seed == 0)
-    std::srand(time(0));
-  else
-    std::srand(seed);
-
-  float value;
-  for (unsigned i = 0; i < size0; ++i)
-    for (unsigned j = 0; j < size1; ++j)
-      for (unsigned k = 0; k < size2; ++k)
-        for (unsigned l = 0; l < size3; ++l)
-          for (unsigned m = 0; m < size4; ++m) {
-            value = randomFloatValue(min, max);
-            aligned[i * stride0 + j * stride1 + k * stride2 + l * stride3 +
-                    m * stride4] = float_to_fp16(value);
-          }
+  fillRandom5D(aligned, offset, {size0, size1, size2, size3, size4},
+               {stride0, stride1, stride2, stride3, stride4}, seed,
+               [=](uint32_t bits) {
+                 return float_to_fp16(randomFloatValue(bits, min, max));
+               });
 }
 
 extern "C" void mcpuMemset5DHalf(unsigned short *allocated,
@@ -454,22 +717,12 @@ extern "C" void mcpuMemset5DBF16RandInt(
     int64_t size0, int64_t size1, int64_t size2, int64_t size3, int64_t size4,
     int64_t stride0, int64_t stride1, int64_t stride2, int64_t stride3,
     int64_t stride4, short min, short max, uint32_t seed) {
-
-  if (seed == 0)
-    std::srand(time(0));
-  else
-    std::srand(seed);
-
-  unsigned short value;
-  for (unsigned i = 0; i < size0; ++i)
-    for (unsigned j = 0; j < size1; ++j)
-      for (unsigned k = 0; k < size2; ++k)
-        for (unsigned l = 0; l < size3; ++l)
-          for (unsigned m = 0; m < size4; ++m) {
-            value = float_to_bfloat16((float)randomIntegerValue(min, max));
-            aligned[i * stride0 + j * stride1 + k * stride2 + l * stride3 +
-                    m * stride4] = value;
-          }
+  fillRandom5D(aligned, offset, {size0, size1, size2, size3, size4},
+               {stride0, stride1, stride2, stride3, stride4}, seed,
+               [=](uint32_t bits) {
+                 return float_to_bfloat16(
+                     (float)randomIntegerValue(bits, min, max));
+               });
 }
 
 extern "C" void mcpuMemset5DBF16RandFloat(
@@ -477,22 +730,11 @@ extern "C" void mcpuMemset5DBF16RandFloat(
     int64_t size0, int64_t size1, int64_t size2, int64_t size3, int64_t size4,
     int64_t stride0, int64_t stride1, int64_t stride2, int64_t stride3,
     int64_t stride4, short min, short max, uint32_t seed) {
-
-  if (seed == 0)
-    std::srand(time(0));
-  else
-    std::srand(seed);
-
-  unsigned short value;
-  for (unsigned i = 0; i < size0; ++i)
-    for (unsigned j = 0; j < size1; ++j)
-      for (unsigned k = 0; k < size2; ++k)
-        for (unsigned l = 0; l < size3; ++l)
-          for (unsigned m = 0; m < size4; ++m) {
-            value = float_to_bfloat16(randomFloatValue(min, max));
-            aligned[i * stride0 + j * stride1 + k * stride2 + l * stride3 +
-                    m * stride4] = value;
-          }
+  fillRandom5D(aligned, offset, {size0, size1, size2, size3, size4},
+               {stride0, stride1, stride2, stride3, stride4}, seed,
+               [=](uint32_t bits) {
+                 return float_to_bfloat16(randomFloatValue(bits, min, max));
+               });
 }
 
 extern "C" void mcpuMemset5DBF16(unsigned short *allocated,
@@ -592,6 +834,343 @@ static void getSizesAndStrides(int64_t rank1, StridedMemRefType<T1, 5> *filter,
                          oStrides);
 }
 
+//===----------------------------------------------------------------------===//
+// The reference convolutions spread their output elements over the cores of
+// the host. MIIR_CPU_NUM_THREADS sets the number of threads, one per hardware
+// thread by default. MIIR_CPU_PIN_THREADS pins them to cores, "compact" on
+// neighbouring cores and "spread" evenly over all of them, and so over NUMA
+// nodes too.
+//===----------------------------------------------------------------------===//
+
+namespace {
+// The iterations left to a thread. Others steal from its end once done with
+// their own.
+struct WorkRange {
+  std::mutex mutex;
+  int64_t begin = 0;
+  int64_t end = 0;
+};
+
+class CpuExecutor {
+public:
+  // Leaked, so that workers are never joined during static destruction
+  static CpuExecutor &get() {
+    static CpuExecutor *executor = new CpuExecutor();
+    return *executor;
+  }
+
+  // Runs body(begin, end) over disjoint chunks covering [0, size), on the
+  // calling thread and the workers.
+  void parallelFor(int64_t size,
+                   llvm::function_ref<void(int64_t, int64_t)> body);
+
+private:
+  CpuExecutor();
+  void runWorker(unsigned thread, int cpu);
+  void work(unsigned thread);
+  bool next(unsigned thread, int64_t &begin, int64_t &end);
+
+  unsigned numThreads;
+  std::unique_ptr<WorkRange[]> ranges;
+  int64_t grain = 1;
+  llvm::function_ref<void(int64_t, int64_t)> body;
+
+  // Held by parallelFor, which runs one loop at a time
+  std::mutex callMutex;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  uint64_t generation = 0;
+  unsigned numBusy = 0;
+};
+} // namespace
+
+// The CPUs the threads are pinned to, one per thread, or none when they are
+// not pinned.
+static std::vector<int> getPinnedCpus(unsigned numThreads) {
+  std::vector<int> cpus;
+#ifdef __linux__
+  const char *policy = std::getenv("MIIR_CPU_PIN_THREADS");
+  if (!policy || !*policy || !std::strcmp(policy, "0"))
+    return cpus;
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed))
+    return cpus;
+  std::vector<int> allowedCpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    if (CPU_ISSET(cpu, &allowed))
+      allowedCpus.push_back(cpu);
+  if (allowedCpus.empty())
+    return cpus;
+  // CPUs of a NUMA node are numbered consecutively, so striding over them
+  // spreads the threads over the nodes
+  size_t stride = 1;
+  if (!std::strcmp(policy, "spread"))
+    stride = std::max<size_t>(1, allowedCpus.size() / numThreads);
+  for (unsigned i = 0; i < numThreads; ++i)
+    cpus.push_back(allowedCpus[(i * stride) % allowedCpus.size()]);
+#endif
+  return cpus;
+}
+
+static void pinToCpu(int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  (void)sched_setaffinity(0, sizeof(set), &set);
+#endif
+}
+
+CpuExecutor::CpuExecutor() {
+  numThreads = std::max(1u, std::thread::hardware_concurrency());
+  if (const char *env = std::getenv("MIIR_CPU_NUM_THREADS")) {
+    int value = std::atoi(env);
+    if (value > 0)
+      numThreads = value;
+  }
+  ranges.reset(new WorkRange[numThreads]);
+
+  // The calling thread takes part as thread 0, and is left where it runs
+  std::vector<int> cpus = getPinnedCpus(numThreads);
+  for (unsigned thread = 1; thread < numThreads; ++thread)
+    std::thread(&CpuExecutor::runWorker, this, thread,
+                cpus.empty() ? -1 : cpus[thread])
+        .detach();
+}
+
+void CpuExecutor::runWorker(unsigned thread, int cpu) {
+  if (cpu >= 0)
+    pinToCpu(cpu);
+  uint64_t seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return generation != seen; });
+      seen = generation;
+    }
+    work(thread);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--numBusy == 0)
+      done.notify_one();
+  }
+}
+
+bool CpuExecutor::next(unsigned thread, int64_t &begin, int64_t &end) {
+  WorkRange &own = ranges[thread];
+  {
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (own.begin < own.end) {
+      begin = own.begin;
+      end = std::min(own.end, begin + grain);
+      own.begin = end;
+      return true;
+    }
+  }
+
+  // Steal the back half of the largest range left
+  while (true) {
+    unsigned victim = thread;
+    int64_t most = 0;
+    for (unsigned other = 0; other < numThreads; ++other) {
+      std::lock_guard<std::mutex> lock(ranges[other].mutex);
+      int64_t left = ranges[other].end - ranges[other].begin;
+      if (left > most) {
+        most = left;
+        victim = other;
+      }
+    }
+    if (most == 0)
+      return false;
+
+    int64_t stolenBegin, stolenEnd;
+    {
+      std::lock_guard<std::mutex> lock(ranges[victim].mutex);
+      int64_t left = ranges[victim].end - ranges[victim].begin;
+      if (left <= 0)
+        continue;
+      stolenEnd = ranges[victim].end;
+      stolenBegin = stolenEnd - (left + 1) / 2;
+      ranges[victim].end = stolenBegin;
+    }
+    begin = stolenBegin;
+    end = std::min(stolenEnd, begin + grain);
+    std::lock_guard<std::mutex> lock(own.mutex);
+    own.begin = end;
+    own.end = stolenEnd;
+    return true;
+  }
+}
+
+void CpuExecutor::work(unsigned thread) {
+  int64_t begin, end;
+  while (next(thread, begin, end))
+    body(begin, end);
+}
+
+void CpuExecutor::parallelFor(
+    int64_t size, llvm::function_ref<void(int64_t, int64_t)> loopBody) {
+  if (numThreads == 1 || size < 2) {
+    loopBody(0, size);
+    return;
+  }
+
+  std::lock_guard<std::mutex> call(callMutex);
+  int64_t share = size / numThreads;
+  int64_t rest = size % numThreads;
+  int64_t begin = 0;
+  for (unsigned thread = 0; thread < numThreads; ++thread) {
+    int64_t end = begin + share + (thread < rest ? 1 : 0);
+    std::lock_guard<std::mutex> lock(ranges[thread].mutex);
+    ranges[thread].begin = begin;
+    ranges[thread].end = end;
+    begin = end;
+  }
+  // Small enough chunks for stealing to even out the threads
+  grain = std::max<int64_t>(1, size / (numThreads * 16));
+  body = loopBody;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    numBusy = numThreads - 1;
+    ++generation;
+  }
+  wake.notify_all();
+  work(0);
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [&] { return numBusy == 0; });
+}
+
+template <typename T, typename Generate>
+static void fillRandom5D(T *aligned, int64_t offset,
+                         std::array<int64_t, 5> sizes,
+                         std::array<int64_t, 5> strides, uint32_t seed,
+                         Generate generate) {
+  uint32_t key = hashBits(seed ? seed : static_cast<uint32_t>(time(0)));
+  int64_t numRows = sizes[0] * sizes[1] * sizes[2] * sizes[3];
+  CpuExecutor::get().parallelFor(numRows, [&](int64_t rowBegin,
+                                              int64_t rowEnd) {
+    // A copy of its own keeps the captures of `generate` in registers
+    Generate gen = generate;
+    for (int64_t row = rowBegin; row < rowEnd; ++row) {
+      int64_t rowOffset = offset;
+      for (int64_t dim = 3, rest = row; dim >= 0; --dim) {
+        rowOffset += (rest % sizes[dim]) * strides[dim];
+        rest /= sizes[dim];
+      }
+      T *out = aligned + rowOffset;
+      uint64_t first = row * sizes[4];
+      // Contiguous rows get a loop of their own, which vectorizes
+      if (strides[4] == 1) {
+        for (int64_t m = 0; m < sizes[4]; ++m)
+          out[m] = gen(randomBits(key, first + m));
+      } else {
+        for (int64_t m = 0; m < sizes[4]; ++m)
+          out[m * strides[4]] = gen(randomBits(key, first + m));
+      }
+    }
+  });
+}
+
+template <typename TSrc, typename TDst>
+static void convertElements(const TSrc *source, TDst *dest, int64_t size,
+                            void (*convertSpan)(const TSrc *, TDst *,
+                                                int64_t)) {
+  // Spans of several pages, so that threads rarely share a cache line
+  constexpr int64_t kSpanSize = 16384;
+  int64_t numSpans = (size + kSpanSize - 1) / kSpanSize;
+  CpuExecutor::get().parallelFor(numSpans, [&](int64_t spanBegin,
+                                               int64_t spanEnd) {
+    int64_t begin = spanBegin * kSpanSize;
+    int64_t end = std::min(size, spanEnd * kSpanSize);
+    convertSpan(source + begin, dest + begin, end - begin);
+  });
+}
+
+//===----------------------------------------------------------------------===//
+// The reference convolutions compute a block of up to kBlockSize neighbouring
+// elements along the innermost dimension of their result at once, one
+// accumulator each. Every element still sums its terms in the order of the
+// naive loops, rounding after each term as they do without xdlops, so the
+// results do not change; but each filter or output value is loaded once per
+// block instead of once per element, and the accumulators of a block update
+// together in vector registers.
+//===----------------------------------------------------------------------===//
+
+static constexpr int64_t kBlockSize = 16;
+
+// The range [begin, end) of the elements first + j of a block of `size`,
+// j in [0, size), whose index (first + j) * stride + offset falls in
+// [0, bound). Only the terms of those elements are summed, the others being
+// products with padding zeros.
+static void getInBoundsRange(int64_t first, int64_t size, int64_t stride,
+                             int64_t offset, int64_t bound, int64_t &begin,
+                             int64_t &end) {
+  int64_t lo = offset >= 0 ? 0 : (-offset + stride - 1) / stride;
+  int64_t hi = bound - 1 - offset < 0 ? 0 : (bound - 1 - offset) / stride + 1;
+  begin = std::min(std::max<int64_t>(lo - first, 0), size);
+  end = std::max(std::min(hi - first, size), begin);
+}
+
+//===----------------------------------------------------------------------===//
+// The reference convolutions may compute only a sample of the slices of their
+// result they spread over the threads: the rows along its innermost dimension,
+// or the planes of 3D convolutions. Problems too large for the full reference
+// are so validated too. The harness leaves the slices the reference skips
+// holding the results of the GPU kernels, so that they compare equal.
+//===----------------------------------------------------------------------===//
+
+static int64_t pendingSampleSize = 0;
+static uint32_t pendingSampleSeed = 1;
+
+// Asks the next reference convolution to compute `count` of the slices of
+// its result, or all of them if it is 0, picked from the random bits of
+// `seed` like the values of random tensors.
+extern "C" void mcpuSampleSlices(int64_t count, int32_t seed) {
+  pendingSampleSize = count;
+  pendingSampleSeed = static_cast<uint32_t>(seed);
+}
+
+namespace {
+// The slices a reference convolution computes: all of them, or one picked at
+// random in each of the ranges splitting them evenly in as many as asked for.
+class SliceSample {
+public:
+  explicit SliceSample(int64_t numSlices) : numSlices(numSlices) {
+    int64_t asked = std::exchange(pendingSampleSize, 0);
+    count = asked > 0 ? std::min(asked, numSlices) : numSlices;
+    uint32_t seed = pendingSampleSeed;
+    key = hashBits(seed ? seed : static_cast<uint32_t>(time(0)));
+    if (count == numSlices)
+      return;
+    // Without a mismatch in n slices, fewer than 3/n of them mismatch, with
+    // 95% confidence.
+    fprintf(stderr,
+            "Validating %ld of %ld slices of the result: if none mismatches, "
+            "fewer than %.3g%% of them do, with 95%% confidence\n",
+            static_cast<long>(count), static_cast<long>(numSlices),
+            std::min(100.0, 300.0 / count));
+  }
+
+  int64_t size() const { return count; }
+
+  int64_t operator[](int64_t i) const {
+    if (count == numSlices)
+      return i;
+    int64_t share = numSlices / count;
+    int64_t rest = numSlices % count;
+    int64_t length = share + (i < rest ? 1 : 0);
+    return i * share + std::min(i, rest) +
+           static_cast<int64_t>(randomBits(key, i) % length);
+  }
+
+private:
+  int64_t numSlices;
+  int64_t count;
+  uint32_t key;
+};
+} // namespace
+
 template <typename TIn, typename TOut, typename TAcc>
 static void performConv2d(
     TIn *filterAllocated, TIn *inputAllocated, TOut *outputAllocated,
@@ -602,49 +1181,58 @@ static void performConv2d(
     int32_t padding_h_r, int32_t padding_w_l, int32_t padding_w_r,
     int32_t dilation_h, int32_t dilation_w, int32_t xdlops) {
 
-  // Perform forward convolution
-  for (int64_t g = 0; g < outputSizes[0]; g++)
-    for (int64_t n = 0; n < outputSizes[1]; n++)
-      for (int64_t k = 0; k < outputSizes[2]; k++)
-        for (int64_t out_h = 0; out_h < outputSizes[3]; out_h++)
-          for (int64_t out_w = 0; out_w < outputSizes[4]; out_w++) {
-
-            TAcc acc = 0.0;
-            for (int64_t c = 0; c < inputSizes[2]; c++)
-              for (int64_t fil_h = 0; fil_h < filterSizes[3]; fil_h++)
-                for (int64_t fil_w = 0; fil_w < filterSizes[4]; fil_w++) {
-
-                  TIn input;
-                  int64_t in_h =
-                      out_h * stride_h + fil_h * dilation_h - padding_h_l;
-                  int64_t in_w =
-                      out_w * stride_w + fil_w * dilation_w - padding_w_l;
-
-                  if (in_h < 0 || in_h >= inputSizes[3] || in_w < 0 ||
-                      in_w >= inputSizes[4])
-                    input = (TIn)0;
-                  else
-
-                    input = inputAllocated[g * inputStrides[0] +
-                                           n * inputStrides[1] +
-                                           c * inputStrides[2] +
-                                           in_h * inputStrides[3] +
-                                           in_w * inputStrides[4]];
-
-                  acc +=
-                      (TAcc)(input * filterAllocated[g * filterStrides[0] +
-                                                     k * filterStrides[1] +
-                                                     c * filterStrides[2] +
-                                                     fil_h * filterStrides[3] +
-                                                     fil_w * filterStrides[4]]);
-                  if (!xdlops) // || (fil_w + fil_h + c) % 4 == 3)
-                    acc = (TOut)acc;
-                }
-
-            outputAllocated[g * outputStrides[0] + n * outputStrides[1] +
-                            k * outputStrides[2] + out_h * outputStrides[3] +
-                            out_w * outputStrides[4]] = (TOut)acc;
+  // Perform forward convolution, output rows in parallel
+  int64_t numRows =
+      outputSizes[0] * outputSizes[1] * outputSizes[2] * outputSizes[3];
+  SliceSample rows(numRows);
+  CpuExecutor::get().parallelFor(rows.size(), [&](int64_t rowBegin,
+                                                  int64_t rowEnd) {
+    for (int64_t i = rowBegin; i < rowEnd; i++) {
+      int64_t row = rows[i];
+      int64_t out_h = row % outputSizes[3];
+      int64_t k = row / outputSizes[3] % outputSizes[2];
+      int64_t n = row / (outputSizes[3] * outputSizes[2]) % outputSizes[1];
+      int64_t g = row / (outputSizes[3] * outputSizes[2] * outputSizes[1]);
+      for (int64_t w0 = 0; w0 < outputSizes[4]; w0 += kBlockSize) {
+        int64_t width = std::min(kBlockSize, outputSizes[4] - w0);
+
+        TAcc acc[kBlockSize] = {};
+        for (int64_t c = 0; c < inputSizes[2]; c++)
+          for (int64_t fil_h = 0; fil_h < filterSizes[3]; fil_h++) {
+            int64_t in_h = out_h * stride_h + fil_h * dilation_h - padding_h_l;
+            if (in_h < 0 || in_h >= inputSizes[3])
+              continue;
+            const TIn *inputRow = inputAllocated + g * inputStrides[0] +
+                                  n * inputStrides[1] + c * inputStrides[2] +
+                                  in_h * inputStrides[3];
+            for (int64_t fil_w = 0; fil_w < filterSizes[4]; fil_w++) {
+              TIn filter =
+                  filterAllocated[g * filterStrides[0] + k * filterStrides[1] +
+                                  c * filterStrides[2] +
+                                  fil_h * filterStrides[3] +
+                                  fil_w * filterStrides[4]];
+              int64_t offset = fil_w * dilation_w - padding_w_l;
+              int64_t begin, end;
+              getInBoundsRange(w0, width, stride_w, offset, inputSizes[4],
+                               begin, end);
+              for (int64_t j = begin; j < end; j++) {
+                int64_t in_w = (w0 + j) * stride_w + offset;
+                acc[j] += (TAcc)(inputRow[in_w * inputStrides[4]] * filter);
+              }
+              if (!xdlops)
+                for (int64_t j = begin; j < end; j++)
+                  acc[j] = (TOut)acc[j];
+            }
           }
+
+        TOut *outputRow = outputAllocated + g * outputStrides[0] +
+                          n * outputStrides[1] + k * outputStrides[2] +
+                          out_h * outputStrides[3];
+        for (int64_t j = 0; j < width; j++)
+          outputRow[(w0 + j) * outputStrides[4]] = (TOut)acc[j];
+      }
+    }
+  });
 }
 
 // A generic forward convolution function that supports random layouts,
@@ -681,9 +1269,36 @@ mcpuConv2dFloat(int64_t rank1, void *f_ptr, int64_t rank2, void *i_ptr,
       dilation_h, dilation_w, xdlops);
 }
 
+extern "C" void
+mcpuConv2dDouble(int64_t rank1, void *f_ptr, int64_t rank2, void *i_ptr,
+                 int64_t rank3, void *o_ptr, int64_t rank4, void *f_layout,
+                 int64_t rank5, void *i_layout, int64_t rank6, void *o_layout,
+                 int32_t stride_h, int32_t stride_w, int32_t padding_h_l,
+                 int32_t padding_h_r, int32_t padding_w_l, int32_t padding_w_r,
+                 int32_t dilation_h, int32_t dilation_w, int32_t xdlops) {
+  auto *filter = static_cast<StridedMemRefType<double, 5> *>(f_ptr);
+  auto *input = static_cast<StridedMemRefType<double, 5> *>(i_ptr);
+  auto *output = static_cast<StridedMemRefType<double, 5> *>(o_ptr);
+
+  std::array<int64_t, 5> filterSizes, filterStrides;
+  std::array<int64_t, 5> inputSizes, inputStrides;
+  std::array<int64_t, 5> outputSizes, outputStrides;
+  getSizesAndStrides<double, double>(rank1, filter, rank2, input, rank3,
+                                     output, f_layout, i_layout, o_layout,
+                                     filterSizes, filterStrides, inputSizes,
+                                     inputStrides, outputSizes, outputStrides);
+  performConv2d<double, double, double>(
+      filter->data + filter->offset, input->data + input->offset,
+      output->data + output->offset, filterSizes, filterStrides, inputSizes,
+      inputStrides, outputSizes, outputStrides, stride_h, stride_w,
+      padding_h_l, padding_h_r, padding_w_l, padding_w_r, dilation_h,
+      dilation_w, xdlops);
+}
+
 // A generic backward-weight convolution function that supports random layouts,
 // dimensions, strides, paddings, and dilations.
-extern "C" void mcpuConv2dBwdWeightFloat(
+template <typename T>
+static void performConv2dBwdWeight(
     int64_t rank1, void *f_ptr, int64_t rank2, void *i_ptr, int64_t rank3,
     void *o_ptr, int64_t rank4, void *f_layout, int64_t rank5, void *i_layout,
     int64_t rank6, void *o_layout, int32_t stride_h, int32_t stride_w,
@@ -691,63 +1306,107 @@ extern "C" void mcpuConv2dBwdWeightFloat(
     int32_t padding_w_r, int32_t dilation_h, int32_t dilation_w,
     int32_t xdlops) {
 
-  auto *filter = static_cast<StridedMemRefType<float, 5> *>(f_ptr);
+  auto *filter = static_cast<StridedMemRefType<T, 5> *>(f_ptr);
   auto *filterAllocated = filter->data + filter->offset;
 
-  auto *input = static_cast<StridedMemRefType<float, 5> *>(i_ptr);
+  auto *input = static_cast<StridedMemRefType<T, 5> *>(i_ptr);
   auto *inputAllocated = input->data + input->offset;
 
-  auto *output = static_cast<StridedMemRefType<float, 5> *>(o_ptr);
+  auto *output = static_cast<StridedMemRefType<T, 5> *>(o_ptr);
   auto *outputAllocated = output->data + output->offset;
 
   // Extract proper tensor sizes and strides based on layouts
   std::array<int64_t, 5> filterSizes, filterStrides;
   std::array<int64_t, 5> inputSizes, inputStrides;
   std::array<int64_t, 5> outputSizes, outputStrides;
-  getSizesAndStrides<float, float>(rank1, filter, rank2, input, rank3, output,
-                                   f_layout, i_layout, o_layout, filterSizes,
-                                   filterStrides, inputSizes, inputStrides,
-                                   outputSizes, outputStrides);
-
-  // Perform bwd_weight convolution
-  for (int64_t g = 0; g < outputSizes[0]; g++)
-    for (int64_t k = 0; k < filterSizes[1]; k++)
-      for (int64_t c = 0; c < filterSizes[2]; c++)
-        for (int64_t y = 0; y < filterSizes[3]; y++)
-          for (int64_t x = 0; x < filterSizes[4]; x++) {
-
-            double acc = 0.0;
-            for (int64_t n = 0; n < outputSizes[1]; n++)
-              for (int64_t out_h = 0; out_h < outputSizes[3]; out_h++)
-                for (int64_t out_w = 0; out_w < outputSizes[4]; out_w++) {
-                  int64_t in_h =
-                      out_h * stride_h + y * dilation_h - padding_h_l;
-                  int64_t in_w =
-                      out_w * stride_w + x * dilation_w - padding_w_l;
-                  if (in_h >= 0 && in_h < inputSizes[3] && in_w >= 0 &&
-                      in_w < inputSizes[4])
-                    acc += (double)(inputAllocated[g * inputStrides[0] +
-                                                   n * inputStrides[1] +
-                                                   c * inputStrides[2] +
-                                                   in_h * inputStrides[3] +
-                                                   in_w * inputStrides[4]] *
-                                    outputAllocated[g * outputStrides[0] +
-                                                    n * outputStrides[1] +
-                                                    k * outputStrides[2] +
-                                                    out_h * outputStrides[3] +
-                                                    out_w * outputStrides[4]]);
-                  if (!xdlops) // || (out_w + out_h + n) % 4 == 3)
-                    acc = (float)acc;
-                }
-            filterAllocated[g * filterStrides[0] + k * filterStrides[1] +
-                            c * filterStrides[2] + y * filterStrides[3] +
-                            x * filterStrides[4]] = (float)acc;
+  getSizesAndStrides<T, T>(rank1, filter, rank2, input, rank3, output,
+                           f_layout, i_layout, o_layout, filterSizes,
+                           filterStrides, inputSizes, inputStrides,
+                           outputSizes, outputStrides);
+
+  // Perform bwd_weight convolution, filter rows in parallel
+  int64_t numRows =
+      outputSizes[0] * filterSizes[1] * filterSizes[2] * filterSizes[3];
+  SliceSample rows(numRows);
+  CpuExecutor::get().parallelFor(rows.size(), [&](int64_t rowBegin,
+                                                  int64_t rowEnd) {
+    for (int64_t i = rowBegin; i < rowEnd; i++) {
+      int64_t row = rows[i];
+      int64_t y = row % filterSizes[3];
+      int64_t c = row / filterSizes[3] % filterSizes[2];
+      int64_t k = row / (filterSizes[3] * filterSizes[2]) % filterSizes[1];
+      int64_t g = row / (filterSizes[3] * filterSizes[2] * filterSizes[1]);
+      for (int64_t x0 = 0; x0 < filterSizes[4]; x0 += kBlockSize) {
+        int64_t width = std::min(kBlockSize, filterSizes[4] - x0);
+
+        double acc[kBlockSize] = {};
+        for (int64_t n = 0; n < outputSizes[1]; n++)
+          for (int64_t out_h = 0; out_h < outputSizes[3]; out_h++) {
+            int64_t in_h = out_h * stride_h + y * dilation_h - padding_h_l;
+            if (in_h < 0 || in_h >= inputSizes[3])
+              continue;
+            const T *inputRow = inputAllocated + g * inputStrides[0] +
+                                n * inputStrides[1] + c * inputStrides[2] +
+                                in_h * inputStrides[3];
+            const T *outputRow = outputAllocated + g * outputStrides[0] +
+                                 n * outputStrides[1] + k * outputStrides[2] +
+                                 out_h * outputStrides[3];
+            for (int64_t out_w = 0; out_w < outputSizes[4]; out_w++) {
+              T output = outputRow[out_w * outputStrides[4]];
+              int64_t offset = out_w * stride_w - padding_w_l;
+              int64_t begin, end;
+              getInBoundsRange(x0, width, dilation_w, offset, inputSizes[4],
+                               begin, end);
+              for (int64_t j = begin; j < end; j++) {
+                int64_t in_w = (x0 + j) * dilation_w + offset;
+                acc[j] += (double)(inputRow[in_w * inputStrides[4]] * output);
+              }
+              if (!xdlops)
+                for (int64_t j = begin; j < end; j++)
+                  acc[j] = (T)acc[j];
+            }
           }
+
+        T *filterRow = filterAllocated + g * filterStrides[0] +
+                       k * filterStrides[1] + c * filterStrides[2] +
+                       y * filterStrides[3];
+        for (int64_t j = 0; j < width; j++)
+          filterRow[(x0 + j) * filterStrides[4]] = (T)acc[j];
+      }
+    }
+  });
+}
+
+extern "C" void mcpuConv2dBwdWeightFloat(
+    int64_t rank1, void *f_ptr, int64_t rank2, void *i_ptr, int64_t rank3,
+    void *o_ptr, int64_t rank4, void *f_layout, int64_t rank5, void *i_layout,
+    int64_t rank6, void *o_layout, int32_t stride_h, int32_t stride_w,
+    int32_t padding_h_l, int32_t padding_h_r, int32_t padding_w_l,
+    int32_t padding_w_r, int32_t dilation_h, int32_t dilation_w,
+    int32_t xdlops) {
+  performConv2dBwdWeight<float>(
+      rank1, f_ptr, rank2, i_ptr, rank3, o_ptr, rank4, f_layout, rank5,
+      i_layout, rank6, o_layout, stride_h, stride_w, padding_h_l, padding_h_r,
+      padding_w_l, padding_w_r, dilation_h, dilation_w, xdlops);
+}
+
+extern "C" void mcpuConv2dBwdWeightDouble(
+    int64_t rank1, void *f_ptr, int64_t rank2, void *i_ptr, int64_t rank3,
+    void *o_ptr, int64_t rank4, void *f_layout, int64_t rank5, void *i_layout,
+    int64_t rank6, void *o_layout, int32_t stride_h, int32_t stride_w,
+    int32_t padding_h_l, int32_t padding_h_r, int32_t padding_w_l,
+    int32_t padding_w_r, int32_t dilation_h, int32_t dilation_w,
+    int32_t xdlops) {
+  performConv2dBwdWeight<double>(
+      rank1, f_ptr, rank2, i_ptr, rank3, o_ptr, rank4, f_layout, rank5,
+      i_layout, rank6, o_layout, stride_h, stride_w, padding_h_l, padding_h_r,
+      padding_w_l, padding_w_r, dilation_h, dilation_w, xdlops);
 }
 
 // A generic backward-data convolution function that supports random layouts,
 // dimensions, strides, paddings, and dilations.
-extern "C" void mcpuConv2dBwdDataFloat(
+template <typename T>
+static void performConv2dBwdData(
     int64_t rank1, void *f_ptr, int64_t rank2, void *i_ptr, int64_t rank3,
     void *o_ptr, int64_t rank4, void *f_layout, int64_t rank5, void *i_layout,
     int64_t rank6, void *o_layout, int32_t stride_h, int32_t stride_w,
@@ -755,59 +1414,106 @@ extern "C" void mcpuConv2dBwdDataFloat(
     int32_t padding_w_r, int32_t dilation_h, int32_t dilation_w,
     int32_t xdlops) {
 
-  auto *filter = static_cast<StridedMemRefType<float, 5> *>(f_ptr);
+  auto *filter = static_cast<StridedMemRefType<T, 5> *>(f_ptr);
   auto *filterAllocated = filter->data + filter->offset;
 
-  auto *input = static_cast<StridedMemRefType<float, 5> *>(i_ptr);
+  auto *input = static_cast<StridedMemRefType<T, 5> *>(i_ptr);
   auto *inputAllocated = input->data + input->offset;
 
-  auto *output = static_cast<StridedMemRefType<float, 5> *>(o_ptr);
+  auto *output = static_cast<StridedMemRefType<T, 5> *>(o_ptr);
   auto *outputAllocated = output->data + output->offset;
 
   // Extract proper tensor sizes and strides based on layouts
   std::array<int64_t, 5> filterSizes, filterStrides;
   std::array<int64_t, 5> inputSizes, inputStrides;
   std::array<int64_t, 5> outputSizes, outputStrides;
-  getSizesAndStrides<float, float>(rank1, filter, rank2, input, rank3, output,
-                                   f_layout, i_layout, o_layout, filterSizes,
-                                   filterStrides, inputSizes, inputStrides,
-                                   outputSizes, outputStrides);
-
-  // Perform bwd_data convolution
-  for (int64_t g = 0; g < outputSizes[0]; g++)
-    for (int64_t n = 0; n < inputSizes[1]; n++)
-      for (int64_t c = 0; c < inputSizes[2]; c++)
-        for (int64_t in_h = 0; in_h < inputSizes[3]; in_h++)
-          for (int64_t in_w = 0; in_w < inputSizes[4]; in_w++) {
-
-            double acc = 0.0;
-            for (int64_t k = 0; k < filterSizes[1]; k++)
-              for (int64_t y = 0; y < filterSizes[3]; y++)
-                for (int64_t x = 0; x < filterSizes[4]; x++) {
-                  int64_t out_h_tmp = in_h + padding_h_l - y * dilation_h;
-                  int64_t out_w_tmp = in_w + padding_w_l - x * dilation_w;
-                  int64_t out_h = out_h_tmp / stride_h;
-                  int64_t out_w = out_w_tmp / stride_w;
-                  if (out_h_tmp % stride_h == 0 && out_w_tmp % stride_w == 0 &&
-                      out_h >= 0 && out_h < outputSizes[3] && out_w >= 0 &&
-                      out_w < outputSizes[4])
-                    acc += (double)(filterAllocated[g * filterStrides[0] +
-                                                    k * filterStrides[1] +
-                                                    c * filterStrides[2] +
-                                                    y * filterStrides[3] +
-                                                    x * filterStrides[4]] *
-                                    outputAllocated[g * outputStrides[0] +
-                                                    n * outputStrides[1] +
-                                                    k * outputStrides[2] +
-                                                    out_h * outputStrides[3] +
-                                                    out_w * outputStrides[4]]);
-                  if (!xdlops) // || (x + y + k) % 4 == 3)
-                    acc = (float)acc;
-                }
-            inputAllocated[g * inputStrides[0] + n * inputStrides[1] +
-                           c * inputStrides[2] + in_h * inputStrides[3] +
-                           in_w * inputStrides[4]] = acc;
+  getSizesAndStrides<T, T>(rank1, filter, rank2, input, rank3, output,
+                           f_layout, i_layout, o_layout, filterSizes,
+                           filterStrides, inputSizes, inputStrides,
+                           outputSizes, outputStrides);
+
+  // Perform bwd_data convolution, input rows in parallel
+  int64_t numRows =
+      outputSizes[0] * inputSizes[1] * inputSizes[2] * inputSizes[3];
+  SliceSample rows(numRows);
+  CpuExecutor::get().parallelFor(rows.size(), [&](int64_t rowBegin,
+                                                  int64_t rowEnd) {
+    for (int64_t i = rowBegin; i < rowEnd; i++) {
+      int64_t row = rows[i];
+      int64_t in_h = row % inputSizes[3];
+      int64_t c = row / inputSizes[3] % inputSizes[2];
+      int64_t n = row / (inputSizes[3] * inputSizes[2]) % inputSizes[1];
+      int64_t g = row / (inputSizes[3] * inputSizes[2] * inputSizes[1]);
+      for (int64_t w0 = 0; w0 < inputSizes[4]; w0 += kBlockSize) {
+        int64_t width = std::min(kBlockSize, inputSizes[4] - w0);
+
+        double acc[kBlockSize] = {};
+        for (int64_t k = 0; k < filterSizes[1]; k++)
+          for (int64_t y = 0; y < filterSizes[3]; y++) {
+            int64_t out_h_tmp = in_h + padding_h_l - y * dilation_h;
+            int64_t out_h = out_h_tmp / stride_h;
+            if (out_h_tmp % stride_h != 0 || out_h < 0 ||
+                out_h >= outputSizes[3])
+              continue;
+            const T *outputRow = outputAllocated + g * outputStrides[0] +
+                                 n * outputStrides[1] + k * outputStrides[2] +
+                                 out_h * outputStrides[3];
+            for (int64_t x = 0; x < filterSizes[4]; x++) {
+              T filter =
+                  filterAllocated[g * filterStrides[0] + k * filterStrides[1] +
+                                  c * filterStrides[2] + y * filterStrides[3] +
+                                  x * filterStrides[4]];
+              // Only every stride_w-th input element of the block reads an
+              // output element through this filter element, the first one
+              // at out_w_tmp a multiple of stride_w.
+              int64_t out_w_tmp0 = w0 + padding_w_l - x * dilation_w;
+              int64_t first = (stride_w - out_w_tmp0 % stride_w) % stride_w;
+              for (int64_t j = first; j < width; j += stride_w) {
+                int64_t out_w = (out_w_tmp0 + j) / stride_w;
+                if (out_w >= 0 && out_w < outputSizes[4])
+                  acc[j] += (double)(filter *
+                                     outputRow[out_w * outputStrides[4]]);
+              }
+              if (!xdlops)
+                for (int64_t j = first; j < width; j += stride_w)
+                  acc[j] = (T)acc[j];
+            }
           }
+
+        T *inputRow = inputAllocated + g * inputStrides[0] +
+                      n * inputStrides[1] + c * inputStrides[2] +
+                      in_h * inputStrides[3];
+        for (int64_t j = 0; j < width; j++)
+          inputRow[(w0 + j) * inputStrides[4]] = (T)acc[j];
+      }
+    }
+  });
+}
+
+extern "C" void mcpuConv2dBwdDataFloat(
+    int64_t rank1, void *f_ptr, int64_t rank2, void *i_ptr, int64_t rank3,
+    void *o_ptr, int64_t rank4, void *f_layout, int64_t rank5, void *i_layout,
+    int64_t rank6, void *o_layout, int32_t stride_h, int32_t stride_w,
+    int32_t padding_h_l, int32_t padding_h_r, int32_t padding_w_l,
+    int32_t padding_w_r, int32_t dilation_h, int32_t dilation_w,
+    int32_t xdlops) {
+  performConv2dBwdData<float>(
+      rank1, f_ptr, rank2, i_ptr, rank3, o_ptr, rank4, f_layout, rank5,
+      i_layout, rank6, o_layout, stride_h, stride_w, padding_h_l, padding_h_r,
+      padding_w_l, padding_w_r, dilation_h, dilation_w, xdlops);
+}
+
+extern "C" void mcpuConv2dBwdDataDouble(
+    int64_t rank1, void *f_ptr, int64_t rank2, void *i_ptr, int64_t rank3,
+    void *o_ptr, int64_t rank4, void *f_layout, int64_t rank5, void *i_layout,
+    int64_t rank6, void *o_layout, int32_t stride_h, int32_t stride_w,
+    int32_t padding_h_l, int32_t padding_h_r, int32_t padding_w_l,
+    int32_t padding_w_r, int32_t dilation_h, int32_t dilation_w,
+    int32_t xdlops) {
+  performConv2dBwdData<double>(
+      rank1, f_ptr, rank2, i_ptr, rank3, o_ptr, rank4, f_layout, rank5,
+      i_layout, rank6, o_layout, stride_h, stride_w, padding_h_l, padding_h_r,
+      padding_w_l, padding_w_r, dilation_h, dilation_w, xdlops);
 }
 
 extern "C" void
@@ -842,3 +1548,238 @@ mcpuConv2dInt8(int64_t rank1, void *f_ptr, int64_t rank2, void *i_ptr,
       stride_h, stride_w, padding_h_l, padding_h_r, padding_w_l, padding_w_r,
       dilation_h, dilation_w, xdlops);
 }
+
+// Decodes the 8-bit floats of a tensor into doubles, laid out as the bytes
+// are, times `scale`.
+static std::vector<double> decodeFp8(StridedMemRefType<int8_t, 5> *tensor,
+                                     int64_t rank, int32_t format,
+                                     float scale) {
+  int64_t extent = 1;
+  for (int64_t i = 0; i < rank; ++i)
+    extent += (tensor->sizes[i] - 1) * tensor->strides[i];
+  std::vector<double> decoded(extent);
+  const int8_t *bytes = tensor->data + tensor->offset;
+  for (int64_t i = 0; i < extent; ++i)
+    decoded[i] = static_cast<double>(scale) *
+                 fp8_to_float(static_cast<uint8_t>(bytes[i]), format);
+  return decoded;
+}
+
+// The forward convolution of fp8 tensors, whose bytes hold 8-bit floats of
+// format `format`, into an f32 output scaled by `scale`. Products and sums are
+// exact in double, so the output is the exact result rounded once, as the
+// MFMAs compute it for moderate reduction sizes.
+extern "C" void
+mcpuConv2dFp8(int64_t rank1, void *f_ptr, int64_t rank2, void *i_ptr,
+              int64_t rank3, void *o_ptr, int64_t rank4, void *f_layout,
+              int64_t rank5, void *i_layout, int64_t rank6, void *o_layout,
+              int32_t stride_h, int32_t stride_w, int32_t padding_h_l,
+              int32_t padding_h_r, int32_t padding_w_l, int32_t padding_w_r,
+              int32_t dilation_h, int32_t dilation_w, int32_t xdlops,
+              int32_t format, float scale) {
+  auto *filter = static_cast<StridedMemRefType<int8_t, 5> *>(f_ptr);
+  auto *input = static_cast<StridedMemRefType<int8_t, 5> *>(i_ptr);
+  auto *output = static_cast<StridedMemRefType<float, 5> *>(o_ptr);
+  auto *outputAllocated = output->data + output->offset;
+
+  // Extract proper tensor sizes and strides based on layouts
+  std::array<int64_t, 5> filterSizes, filterStrides;
+  std::array<int64_t, 5> inputSizes, inputStrides;
+  std::array<int64_t, 5> outputSizes, outputStrides;
+
+  getSizesAndStrides<int8_t, float>(rank1, filter, rank2, input, rank3, output,
+                                    f_layout, i_layout, o_layout, filterSizes,
+                                    filterStrides, inputSizes, inputStrides,
+                                    outputSizes, outputStrides);
+
+  // The scale goes with the filter, which is exact in double.
+  std::vector<double> filterDecoded = decodeFp8(filter, rank1, format, scale);
+  std::vector<double> inputDecoded = decodeFp8(input, rank2, format, 1.0f);
+  performConv2d<double, float, double>(
+      filterDecoded.data(), inputDecoded.data(), outputAllocated, filterSizes,
+      filterStrides, inputSizes, inputStrides, outputSizes, outputStrides,
+      stride_h, stride_w, padding_h_l, padding_h_r, padding_w_l, padding_w_r,
+      dilation_h, dilation_w, xdlops);
+}
+
+// Extract the sizes and strides of 3D convolution tensors, ordered as
+// g k c z y x for the filter, g n c d h w for the input and g n k d h w for
+// the output.
+template <typename T1, typename T2>
+static void get3dSizesAndStrides(
+    StridedMemRefType<T1, 6> *filter, StridedMemRefType<T1, 6> *input,
+    StridedMemRefType<T2, 6> *output, void *f_layout, void *i_layout,
+    void *o_layout, std::array<int64_t, 6> &fSizes,
+    std::array<int64_t, 6> &fStrides, std::array<int64_t, 6> &iSizes,
+    std::array<int64_t, 6> &iStrides, std::array<int64_t, 6> &oSizes,
+    std::array<int64_t, 6> &oStrides) {
+  auto extract = [](const int64_t *sizes, const int64_t *strides,
+                    void *layoutPtr, const char *order,
+                    std::array<int64_t, 6> &outSizes,
+                    std::array<int64_t, 6> &outStrides) {
+    auto *layoutMemRef = static_cast<StridedMemRefType<char, 1> *>(layoutPtr);
+    auto *layout = layoutMemRef->data + layoutMemRef->offset;
+    std::unordered_map<char, std::pair<int64_t, int64_t>> sizeStride;
+    for (size_t i = 0; i < 6; i++)
+      sizeStride[layout[i]] = std::make_pair(sizes[i], strides[i]);
+    for (size_t i = 0; i < 6; i++) {
+      outSizes[i] = sizeStride[order[i]].first;
+      outStrides[i] = sizeStride[order[i]].second;
+    }
+  };
+  extract(filter->sizes, filter->strides, f_layout, "gkczyx", fSizes,
+          fStrides);
+  extract(input->sizes, input->strides, i_layout, "gncdhw", iSizes, iStrides);
+  extract(output->sizes, output->strides, o_layout, "gnkdhw", oSizes,
+          oStrides);
+}
+
+template <typename TIn, typename TOut, typename TAcc>
+static void performConv3d(
+    TIn *filterAllocated, TIn *inputAllocated, TOut *outputAllocated,
+    llvm::ArrayRef<int64_t> filterSizes, llvm::ArrayRef<int64_t> filterStrides,
+    llvm::ArrayRef<int64_t> inputSizes, llvm::ArrayRef<int64_t> inputStrides,
+    llvm::ArrayRef<int64_t> outputSizes, llvm::ArrayRef<int64_t> outputStrides,
+    int32_t stride_h, int32_t stride_w, int32_t stride_d, int32_t padding_h_l,
+    int32_t padding_w_l, int32_t padding_d_l, int32_t dilation_h,
+    int32_t dilation_w, int32_t dilation_d, int32_t xdlops) {
+
+  // Perform forward convolution, output planes in parallel
+  int64_t numPlanes =
+      outputSizes[0] * outputSizes[1] * outputSizes[2] * outputSizes[3];
+  SliceSample planes(numPlanes);
+  CpuExecutor::get().parallelFor(planes.size(), [&](int64_t planeBegin,
+                                                    int64_t planeEnd) {
+    for (int64_t i = planeBegin; i < planeEnd; i++) {
+      int64_t plane = planes[i];
+      int64_t out_d = plane % outputSizes[3];
+      int64_t k = plane / outputSizes[3] % outputSizes[2];
+      int64_t n = plane / (outputSizes[3] * outputSizes[2]) % outputSizes[1];
+      int64_t g = plane / (outputSizes[3] * outputSizes[2] * outputSizes[1]);
+      for (int64_t out_h = 0; out_h < outputSizes[4]; out_h++)
+        for (int64_t w0 = 0; w0 < outputSizes[5]; w0 += kBlockSize) {
+          int64_t width = std::min(kBlockSize, outputSizes[5] - w0);
+
+          TAcc acc[kBlockSize] = {};
+          for (int64_t c = 0; c < inputSizes[2]; c++)
+            for (int64_t fil_d = 0; fil_d < filterSizes[3]; fil_d++)
+              for (int64_t fil_h = 0; fil_h < filterSizes[4]; fil_h++) {
+                int64_t in_d =
+                    out_d * stride_d + fil_d * dilation_d - padding_d_l;
+                int64_t in_h =
+                    out_h * stride_h + fil_h * dilation_h - padding_h_l;
+                if (in_d < 0 || in_d >= inputSizes[3] || in_h < 0 ||
+                    in_h >= inputSizes[4])
+                  continue;
+                const TIn *inputRow =
+                    inputAllocated + g * inputStrides[0] +
+                    n * inputStrides[1] + c * inputStrides[2] +
+                    in_d * inputStrides[3] + in_h * inputStrides[4];
+                for (int64_t fil_w = 0; fil_w < filterSizes[5]; fil_w++) {
+                  TIn filter = filterAllocated[g * filterStrides[0] +
+                                               k * filterStrides[1] +
+                                               c * filterStrides[2] +
+                                               fil_d * filterStrides[3] +
+                                               fil_h * filterStrides[4] +
+                                               fil_w * filterStrides[5]];
+                  int64_t offset = fil_w * dilation_w - padding_w_l;
+                  int64_t begin, end;
+                  getInBoundsRange(w0, width, stride_w, offset, inputSizes[5],
+                                   begin, end);
+                  for (int64_t j = begin; j < end; j++) {
+                    int64_t in_w = (w0 + j) * stride_w + offset;
+                    acc[j] +=
+                        (TAcc)(inputRow[in_w * inputStrides[5]] * filter);
+                  }
+                  if (!xdlops)
+                    for (int64_t j = begin; j < end; j++)
+                      acc[j] = (TOut)acc[j];
+                }
+              }
+
+          TOut *outputRow = outputAllocated + g * outputStrides[0] +
+                            n * outputStrides[1] + k * outputStrides[2] +
+                            out_d * outputStrides[3] +
+                            out_h * outputStrides[4];
+          for (int64_t j = 0; j < width; j++)
+            outputRow[(w0 + j) * outputStrides[5]] = (TOut)acc[j];
+        }
+    }
+  });
+}
+
+template <typename TIn, typename TOut, typename TAcc>
+static void mcpuConv3d(void *f_ptr, void *i_ptr, void *o_ptr, void *f_layout,
+                       void *i_layout, void *o_layout, int32_t stride_h,
+                       int32_t stride_w, int32_t stride_d, int32_t padding_h_l,
+                       int32_t padding_w_l, int32_t padding_d_l,
+                       int32_t dilation_h, int32_t dilation_w,
+                       int32_t dilation_d, int32_t xdlops) {
+  auto *filter = static_cast<StridedMemRefType<TIn, 6> *>(f_ptr);
+  auto *input = static_cast<StridedMemRefType<TIn, 6> *>(i_ptr);
+  auto *output = static_cast<StridedMemRefType<TOut, 6> *>(o_ptr);
+
+  // Extract proper tensor sizes and strides based on layouts
+  std::array<int64_t, 6> filterSizes, filterStrides;
+  std::array<int64_t, 6> inputSizes, inputStrides;
+  std::array<int64_t, 6> outputSizes, outputStrides;
+  get3dSizesAndStrides<TIn, TOut>(filter, input, output, f_layout, i_layout,
+                                  o_layout, filterSizes, filterStrides,
+                                  inputSizes, inputStrides, outputSizes,
+                                  outputStrides);
+
+  performConv3d<TIn, TOut, TAcc>(
+      filter->data + filter->offset, input->data + input->offset,
+      output->data + output->offset, filterSizes, filterStrides, inputSizes,
+      inputStrides, outputSizes, outputStrides, stride_h, stride_w, stride_d,
+      padding_h_l, padding_w_l, padding_d_l, dilation_h, dilation_w,
+      dilation_d, xdlops);
+}
+
+// A generic 3D forward convolution function that supports random layouts,
+// dimensions, strides, paddings, and dilations. The right paddings are
+// implied by the output sizes.
+extern "C" void mcpuConv3dFloat(
+    int64_t rank1, void *f_ptr, int64_t rank2, void *i_ptr, int64_t rank3,
+    void *o_ptr, int64_t rank4, void *f_layout, int64_t rank5, void *i_layout,
+    int64_t rank6, void *o_layout, int32_t stride_h, int32_t stride_w,
+    int32_t stride_d, int32_t padding_h_l, int32_t padding_h_r,
+    int32_t padding_w_l, int32_t padding_w_r, int32_t padding_d_l,
+    int32_t padding_d_r, int32_t dilation_h, int32_t dilation_w,
+    int32_t dilation_d, int32_t xdlops) {
+  assert(rank1 == 6 && rank2 == 6 && rank3 == 6);
+  mcpuConv3d<float, float, double>(
+      f_ptr, i_ptr, o_ptr, f_layout, i_layout, o_layout, stride_h, stride_w,
+      stride_d, padding_h_l, padding_w_l, padding_d_l, dilation_h, dilation_w,
+      dilation_d, xdlops);
+}
+
+extern "C" void mcpuConv3dDouble(
+    int64_t rank1, void *f_ptr, int64_t rank2, void *i_ptr, int64_t rank3,
+    void *o_ptr, int64_t rank4, void *f_layout, int64_t rank5, void *i_layout,
+    int64_t rank6, void *o_layout, int32_t stride_h, int32_t stride_w,
+    int32_t stride_d, int32_t padding_h_l, int32_t padding_h_r,
+    int32_t padding_w_l, int32_t padding_w_r, int32_t padding_d_l,
+    int32_t padding_d_r, int32_t dilation_h, int32_t dilation_w,
+    int32_t dilation_d, int32_t xdlops) {
+  assert(rank1 == 6 && rank2 == 6 && rank3 == 6);
+  mcpuConv3d<double, double, double>(
+      f_ptr, i_ptr, o_ptr, f_layout, i_layout, o_layout, stride_h, stride_w,
+      stride_d, padding_h_l, padding_w_l, padding_d_l, dilation_h, dilation_w,
+      dilation_d, xdlops);
+}
+
+extern "C" void mcpuConv3dInt8(
+    int64_t rank1, void *f_ptr, int64_t rank2, void *i_ptr, int64_t rank3,
+    void *o_ptr, int64_t rank4, void *f_layout, int64_t rank5, void *i_layout,
+    int64_t rank6, void *o_layout, int32_t stride_h, int32_t stride_w,
+    int32_t stride_d, int32_t padding_h_l, int32_t padding_h_r,
+    int32_t padding_w_l, int32_t padding_w_r, int32_t padding_d_l,
+    int32_t padding_d_r, int32_t dilation_h, int32_t dilation_w,
+    int32_t dilation_d, int32_t xdlops) {
+  assert(rank1 == 6 && rank2 == 6 && rank3 == 6);
+  mcpuConv3d<int8_t, int32_t, int32_t>(
+      f_ptr, i_ptr, o_ptr, f_layout, i_layout, o_layout, stride_h, stride_w,
+      stride_d, padding_h_l, padding_w_l, padding_d_l, dilation_h, dilation_w,
+      dilation_d, xdlops);
+}
@@ -0,0 +1,222 @@
+//===- ModuleArchive.cpp - Binary container of MLIR modules ---------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// An archive starts with a magic number and the number of entries, followed
+// by the index of the entries and by their texts. Every entry of the index
+// holds, in little endian:
+//
+//   int32  parent      index of the entry of the enclosing module, or -1
+//   uint32 isModule    1 for the header of a module, 0 for an op
+//   uint32 symbolSize
+//   uint64 textOffset  from the start of the archive
+//   uint64 textSize
+//   char   symbol[symbolSize]
+//
+// Entries come in the order of the ops in the module, modules before the
+// ops they hold. The text of an op is the op printed on its own. The text of
+// a module is the module printed without its ops; they go before its last
+// closing brace.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Translation/ModuleArchive.h"
+
+#include "mlir/IR/SymbolTable.h"
+#include "mlir/InitMIOpenDialects.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Tools/mlir-translate/Translation.h"
+
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/SourceMgr.h"
+
+#include <functional>
+
+using namespace mlir;
+using namespace mlir::miopen;
+namespace endian = llvm::support::endian;
+
+static constexpr char kMagic[] = {'M', 'I', 'I', 'R', 'A', 'R', 'C', 1};
+static constexpr size_t kHeaderSize = sizeof(kMagic) + 4;
+static constexpr size_t kEntrySize = 4 + 4 + 4 + 8 + 8;
+
+namespace {
+struct PendingEntry {
+  int32_t parent;
+  bool isModule;
+  std::string symbol;
+  std::string text;
+};
+} // namespace
+
+static std::string getSymbol(Operation *op) {
+  if (auto symbol =
+          op->getAttrOfType<StringAttr>(SymbolTable::getSymbolAttrName()))
+    return symbol.getValue().str();
+  return "";
+}
+
+static void collectEntries(ModuleOp module, int32_t parent,
+                           std::vector<PendingEntry> &entries) {
+  // The ops are printed each on their own, with names local to them, so that
+  // printing does not number the whole module for every op.
+  OpPrintingFlags flags;
+  flags.useLocalScope();
+
+  OwningOpRef<ModuleOp> header = ModuleOp::create(module.getLoc());
+  (*header)->setAttrs(module->getAttrDictionary());
+  PendingEntry moduleEntry{parent, /*isModule=*/true, getSymbol(module), ""};
+  llvm::raw_string_ostream headerOs(moduleEntry.text);
+  header->print(headerOs, flags);
+  headerOs.flush();
+
+  auto index = static_cast<int32_t>(entries.size());
+  entries.push_back(std::move(moduleEntry));
+  for (Operation &op : *module.getBody()) {
+    if (auto nested = dyn_cast<ModuleOp>(op)) {
+      collectEntries(nested, index, entries);
+      continue;
+    }
+    PendingEntry entry{index, /*isModule=*/false, getSymbol(&op), ""};
+    llvm::raw_string_ostream os(entry.text);
+    op.print(os, flags);
+    os << "\n";
+    os.flush();
+    entries.push_back(std::move(entry));
+  }
+}
+
+LogicalResult mlir::miopen::writeModuleArchive(ModuleOp module,
+                                               raw_ostream &os) {
+  std::vector<PendingEntry> entries;
+  collectEntries(module, /*parent=*/-1, entries);
+
+  uint64_t offset = kHeaderSize;
+  for (const PendingEntry &entry : entries)
+    offset += kEntrySize + entry.symbol.size();
+
+  os.write(kMagic, sizeof(kMagic));
+  endian::write<uint32_t>(os, entries.size(), llvm::support::little);
+  for (const PendingEntry &entry : entries) {
+    endian::write<int32_t>(os, entry.parent, llvm::support::little);
+    endian::write<uint32_t>(os, entry.isModule, llvm::support::little);
+    endian::write<uint32_t>(os, entry.symbol.size(), llvm::support::little);
+    endian::write<uint64_t>(os, offset, llvm::support::little);
+    endian::write<uint64_t>(os, entry.text.size(), llvm::support::little);
+    os << entry.symbol;
+    offset += entry.text.size();
+  }
+  for (const PendingEntry &entry : entries)
+    os << entry.text;
+  return success();
+}
+
+bool mlir::miopen::isModuleArchive(StringRef buffer) {
+  return buffer.startswith(StringRef(kMagic, sizeof(kMagic)));
+}
+
+FailureOr<ModuleArchive> ModuleArchive::read(StringRef buffer) {
+  if (!isModuleArchive(buffer) || buffer.size() < kHeaderSize)
+    return failure();
+  const char *data = buffer.data();
+  auto count = endian::read32le(data + sizeof(kMagic));
+
+  ModuleArchive archive;
+  archive.entries.reserve(count);
+  size_t pos = kHeaderSize;
+  for (uint32_t i = 0; i < count; ++i) {
+    if (buffer.size() - pos < kEntrySize)
+      return failure();
+    Entry entry;
+    entry.parent = static_cast<int32_t>(endian::read32le(data + pos));
+    entry.isModule = endian::read32le(data + pos + 4) != 0;
+    uint32_t symbolSize = endian::read32le(data + pos + 8);
+    uint64_t textOffset = endian::read64le(data + pos + 12);
+    uint64_t textSize = endian::read64le(data + pos + 20);
+    pos += kEntrySize;
+    if (buffer.size() - pos < symbolSize || textOffset > buffer.size() ||
+        buffer.size() - textOffset < textSize)
+      return failure();
+    entry.symbol = buffer.substr(pos, symbolSize);
+    entry.text = buffer.substr(textOffset, textSize);
+    pos += symbolSize;
+
+    // The archived module comes first, and modules before the entries they
+    // hold.
+    if (i == 0 ? entry.parent != -1 || !entry.isModule
+               : entry.parent < 0 || entry.parent >= static_cast<int32_t>(i) ||
+                     !archive.entries[entry.parent].isModule)
+      return failure();
+    if (entry.isModule && !entry.text.contains('}'))
+      return failure();
+    archive.entries.push_back(entry);
+  }
+  if (archive.entries.empty())
+    return failure();
+  return archive;
+}
+
+OwningOpRef<ModuleOp>
+ModuleArchive::load(MLIRContext *context,
+                    llvm::function_ref<bool(StringRef)> filter) const {
+  // Put the text of the selected ops back together and parse it at once, so
+  // that the module verifies as a whole.
+  std::vector<std::vector<size_t>> children(entries.size());
+  for (size_t i = 1; i < entries.size(); ++i)
+    children[entries[i].parent].push_back(i);
+
+  std::string text;
+  std::function<void(size_t)> append = [&](size_t index) {
+    const Entry &entry = entries[index];
+    if (!entry.isModule) {
+      if (!filter || entry.symbol.empty() || filter(entry.symbol))
+        text += entry.text;
+      return;
+    }
+    size_t close = entry.text.rfind('}');
+    text += entry.text.take_front(close);
+    for (size_t child : children[index])
+      append(child);
+    text += entry.text.drop_front(close);
+  };
+  append(0);
+  return parseSourceString<ModuleOp>(text, context);
+}
+
+OwningOpRef<ModuleOp>
+mlir::miopen::parseModuleOrArchive(llvm::SourceMgr &sourceMgr,
+                                   MLIRContext *context) {
+  const llvm::MemoryBuffer *buffer =
+      sourceMgr.getMemoryBuffer(sourceMgr.getMainFileID());
+  if (!isModuleArchive(buffer->getBuffer()))
+    return parseSourceFile<ModuleOp>(sourceMgr, context);
+  FailureOr<ModuleArchive> archive =
+      ModuleArchive::read(buffer->getBuffer());
+  if (failed(archive)) {
+    emitError(UnknownLoc::get(context), "malformed module archive ")
+        << buffer->getBufferIdentifier();
+    return nullptr;
+  }
+  return archive->load(context);
+}
+
+void mlir::miopen::registerModuleArchiveTranslations() {
+  TranslateFromMLIRRegistration toArchive(
+      "mlir-to-module-archive",
+      [](ModuleOp module, raw_ostream &output) {
+        return writeModuleArchive(module, output);
+      },
+      [](DialectRegistry &registry) { registerMIOpenFlowDialects(registry); });
+  TranslateToMLIRRegistration fromArchive(
+      "module-archive-to-mlir",
+      [](llvm::SourceMgr &sourceMgr, MLIRContext *context) {
+        DialectRegistry registry;
+        registerMIOpenFlowDialects(registry);
+        context->appendDialectRegistry(registry);
+        return parseModuleOrArchive(sourceMgr, context);
+      });
+}
@@ -201,6 +201,13 @@ static bool constructAndTraverseIr(MlirContext ctx) {
   mlirGetKernelAttrs(module, attrs);
   printf("block size : %d, grid size : %d\n", attrs[0], attrs[1]);
 
+  uint32_t resources[6];
+  // returns the registers, LDS and occupancy of the kernel
+  mlirGetKernelResources(module, resources);
+  // CHECK: vgprs : {{[0-9]+}}, lds : {{[0-9]+}}, waves per simd : {{[1-9][0-9]*}}
+  printf("vgprs : %d, lds : %d, waves per simd : %d\n", resources[0],
+         resources[3], resources[5]);
+
   // returns binary size
   int binSize = 0;
   mlirGetBinary(module, &binSize, NULL);
@@ -218,6 +225,33 @@ static bool constructAndTraverseIr(MlirContext ctx) {
     printf("PASSED!\n");
   }
 
+  // collect the same results in one walk, without copying the binary
+  MlirMIGraphXCompilation finalized = mlirMIGraphXFinalize(module);
+  MlirMIGraphXKernel finalKernel =
+      mlirMIGraphXCompilationGetKernel(finalized, 0);
+  // CHECK: finalized: {{[0-9]+}} args, same binary
+  printf("finalized: %d args, %s binary\n",
+         finalKernel.argInfoSize ? finalKernel.argInfo[0] : 0,
+         finalKernel.binarySize == (size_t)binSize ? "same" : "other");
+  mlirMIGraphXCompilationDestroy(finalized);
+
+  // compile all the functions of a module at once
+  MlirModule batchModule = makeAndDumpMIXR(ctx, location1);
+  MlirMIGraphXCompilation compilation = mlirMIGraphXCompileModule(
+      batchModule, deviceName, "amdgcn-amd-amdhsa", "");
+  intptr_t numKernels = mlirMIGraphXCompilationGetNumKernels(compilation);
+  for (intptr_t i = 0; i < numKernels; ++i) {
+    MlirMIGraphXKernel kernel =
+        mlirMIGraphXCompilationGetKernel(compilation, i);
+    // CHECK: main: block size : {{[0-9]+}}, grid size : {{[0-9]+}}, compiled
+    printf("%.*s: block size : %d, grid size : %d, %s\n",
+           (int)kernel.funcName.length, kernel.funcName.data,
+           kernel.blockSize, kernel.gridSize,
+           kernel.binary ? "compiled" : "failed");
+  }
+  mlirMIGraphXCompilationDestroy(compilation);
+  mlirModuleDestroy(batchModule);
+
   mlirPassManagerDestroy(pm);
   mlirPassManagerDestroy(pm1);
   mlirModuleDestroy(module);
@@ -21,8 +21,10 @@
 #include "mlir/Dialect/MIOpen/Passes.h"
 #include "mlir/Dialect/MIOpen/utility/IsaNameSplitter.h"
 #include "mlir/Dialect/MIOpen/utility/builderUtils.h"
+#include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
 #include "mlir/Dialect/MemRef/IR/MemRef.h"
 #include "mlir/Dialect/Vector/IR/VectorOps.h"
+#include "mlir/ExecutionEngine/DeviceInfo.h"
 #include "mlir/IR/AffineExpr.h"
 #include "mlir/IR/Attributes.h"
 #include "mlir/IR/Block.h"
@@ -33,8 +35,8 @@
 #include "mlir/IR/MLIRContext.h"
 #include "mlir/IR/Operation.h"
 #include "mlir/IR/Types.h"
-#include "mlir/InitAllDialects.h"
 #include "mlir/InitAllPasses.h"
+#include "mlir/InitMIOpenDialects.h"
 #include "mlir/Parser/Parser.h"
 #include "mlir/Pass/Pass.h"
 #include "mlir/Pass/PassManager.h"
@@ -42,14 +44,21 @@
 #include "mlir/Support/LogicalResult.h"
 
 #include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
 
 #include "bf16convert.hpp"
+#include <atomic>
 #include <unordered_map>
 
 #include <tuple>
@@ -85,7 +94,8 @@ static cl::opt<mlir::miopen::ConvOpType> operation(
 
 static cl::opt<std::string>
     arch("arch",
-         cl::desc("amdgpu architecture, eg: gfx803, gfx900, gfx906, gfx908"),
+         cl::desc("amdgpu architecture, eg: gfx803, gfx900, gfx906, gfx908, "
+                  "or native for the first GPU of the machine"),
          cl::value_desc("GFX architecture string"), cl::init("gfx906"));
 
 static cl::opt<int>
@@ -213,24 +223,152 @@ static cl::opt<int> paddingWidthRight("padding_w_r",
                                       cl::value_desc("attribute value"),
                                       cl::init(0));
 
+// Depth of 3D convolutions, whose layouts have 6 dimensions, with z the
+// filter depth and d the input and output depth, such as gkczyx, ngcdhw and
+// ngkdhw
+// Di
+static cl::opt<int64_t> inputDepth("in_d", cl::desc("Input depth"),
+                                   cl::value_desc("dimension value"),
+                                   cl::init(1));
+
+// Z
+static cl::opt<int64_t> filterDepth("fil_d", cl::desc("Filter depth"),
+                                    cl::value_desc("dimension value"),
+                                    cl::init(1));
+
+// Do
+static cl::opt<int64_t>
+    outputDepth("out_d", cl::desc("Output depth"),
+                cl::value_desc("ouput dimension value, does not need to set."),
+                cl::init(-1));
+
+// dilation depth
+static cl::opt<int> dilationDepth("dilation_d", cl::desc("Dilation depth"),
+                                  cl::value_desc("attribute value"),
+                                  cl::init(1));
+
+// stride depth
+static cl::opt<int> strideDepth("conv_stride_d", cl::desc("Stride depth"),
+                                cl::value_desc("attribute value"), cl::init(1));
+
+// padding depth
+static cl::opt<int> paddingDepth("padding_d", cl::desc("Padding depth"),
+                                 cl::value_desc("attribute value"),
+                                 cl::init(0));
+
+static cl::opt<int> paddingDepthLeft("padding_d_l",
+                                     cl::desc("Padding depth Left"),
+                                     cl::value_desc("attribute value"),
+                                     cl::init(0));
+
+static cl::opt<int> paddingDepthRight("padding_d_r",
+                                      cl::desc("Padding depth Right"),
+                                      cl::value_desc("attribute value"),
+                                      cl::init(0));
+
 // use XDLOPS
 static cl::opt<bool>
     xdlopsV2("x2", cl::desc("To use XDLOPS V2 lowering pipeline"),
              cl::value_desc("To use XDLOPS V2 lowering pipeline"),
              cl::init(false));
 
+// split-K
+static cl::opt<bool> splitK(
+    "split-k",
+    cl::desc("Split the reduction of XDLOPS forward convolutions across "
+             "workgroups that accumulate with atomic adds"),
+    cl::init(false));
+
+// Winograd
+static cl::opt<int> winogradTile(
+    "winograd",
+    cl::desc("Lower 3x3 stride-1 forward convolutions with Winograd "
+             "F(m x m, 3 x 3) for this output tile size m (2 or 4) instead of "
+             "an implicit GEMM"),
+    cl::init(0));
+
+// deterministic
+static cl::opt<bool> deterministic(
+    "deterministic",
+    cl::desc("Do not accumulate partial results with atomics: backward "
+             "weight convolutions reduce their KBlocks in a workspace or "
+             "write the filter directly and forward ones do not split K"),
+    cl::init(false));
+
+// KBlock reduction for backward weight
+static cl::opt<bool> reduceKBlocks(
+    "reduce-kblocks",
+    cl::desc("Sum the KBlocks of XDLOPS backward weight convolutions through "
+             "a workspace of partial filters instead of with atomics"),
+    cl::init(false));
+
+static cl::opt<bool> fusedReduction(
+    "fused-reduction",
+    cl::desc("With -reduce-kblocks, have the last workgroup to write the "
+             "partials of a filter tile sum them, instead of a second kernel"),
+    cl::init(false));
+
+// single-launch backward data
+static cl::opt<bool> singleLaunch(
+    "single-launch",
+    cl::desc("Compute all the GEMMs of a strided backward data convolution "
+             "in one kernel"),
+    cl::init(false));
+
+// phase-decomposed dilated convolutions
+static cl::opt<bool> dilationPhases(
+    "dilation-phases",
+    cl::desc("Compute a dilated stride-1 forward convolution as dense "
+             "convolutions over the dilation phases of its input, in one "
+             "kernel"),
+    cl::init(false));
+
+// solver selection
+static cl::opt<bool> autoSolver(
+    "auto-solver",
+    cl::desc("Choose the solver of forward convolutions without a "
+             "perf_config, among the implicit GEMM, split-K, Winograd and "
+             "dilation phases, with the cost model instead of the options "
+             "that ask for them"),
+    cl::init(false));
+
 // data type
 static cl::opt<std::string>
     tensorDataType("t", cl::desc("Data type for convolution"),
                    cl::value_desc("Data type for convolution"),
                    cl::init("f32"));
 
+// fp8 scale
+static cl::opt<float>
+    fp8Scale("fp8-scale",
+             cl::desc("Scale applied to the f32 results of fp8 and bf8 "
+                      "convolutions"),
+             cl::init(1.0f));
+
+// xf32 XDLOPS
+static cl::opt<bool>
+    xf32("xf32",
+         cl::desc("Multiply the operands of XDLOPS f32 convolutions with the "
+                  "reduced-precision xf32 instructions of gfx940"),
+         cl::init(false));
+
 // conv-config
 static cl::opt<std::string> populateConvConfig(
     "conv-config",
     cl::desc("Populate full config settings (overrides all specific settings)"),
     cl::value_desc("config settings matching the C-API"), cl::init(""));
 
+// batch mode
+static cl::opt<std::string> convConfigFile(
+    "conv-config-file",
+    cl::desc("File with one --conv-config per line, each generated into "
+             "<n>.mlir in the -o directory, n counting from 0"),
+    cl::value_desc("filename"), cl::init(""));
+
+static cl::opt<unsigned> numThreads(
+    "j", cl::desc("Number of threads of --conv-config-file (0: one per core)"),
+    cl::init(0));
+
 // populate default values
 static cl::opt<bool>
     populateDefaultValues("p", cl::desc("To populate default values"),
@@ -355,6 +493,35 @@ static cl::opt<float> f16Threshold(
     cl::desc("Threshold used for CPU verification function for f16 datatype."),
     cl::value_desc("error"), cl::init(0.25f));
 
+static cl::opt<float> xf32Threshold(
+    "xf32-threshold",
+    cl::desc("Threshold used for verification of f32 convolutions computed "
+             "with xf32 XDLOPS."),
+    cl::value_desc("error"), cl::init(0.01f));
+
+static cl::opt<bool> verifyOnDevice(
+    "verify-on-device",
+    cl::desc("Compare the results of GPU kernels with the validation results "
+             "in a GPU kernel that only copies back a summary, instead of "
+             "element by element on the host"),
+    cl::init(false));
+
+static cl::opt<int64_t> validationSample(
+    "validation-sample",
+    cl::desc("Number of slices of the result, its rows along the innermost "
+             "dimension or the planes of 3D convolutions, that the CPU "
+             "validation computes and compares, picked at random with the "
+             "-rand seed. 0 validates all of them"),
+    cl::value_desc("count"), cl::init(0));
+
+static cl::opt<std::string> referenceCache(
+    "reference-cache",
+    cl::desc("Directory caching the results of the CPU validation: the host "
+             "harness loads them from there when they were computed before "
+             "for the same problem and random data, instead of running the "
+             "reference convolution again"),
+    cl::value_desc("directory"), cl::init(""));
+
 static cl::opt<int> deviceNum(
     "device",
     cl::desc("Device index on which to run the kernel (only with host code)"),
@@ -362,6 +529,44 @@ static cl::opt<int> deviceNum(
                    "Omission leaves current device intact."));
 static cl::alias deviceShort("dev", cl::aliasopt(deviceNum));
 
+static cl::opt<bool> pinHostBuffers(
+    "pin-host-buffers",
+    cl::desc("Page-lock host tensors while GPU kernels of the host harness "
+             "copy them (only with host code)"),
+    cl::init(true));
+
+static cl::opt<int> harnessIterations(
+    "harness-iterations",
+    cl::desc("Number of times the host harness uploads the tensors of each GPU "
+             "kernel and runs it (only with host code)"),
+    cl::value_desc("count"), cl::init(1));
+
+static cl::opt<bool> overlapUpload(
+    "overlap-upload",
+    cl::desc("Upload the tensors of the next harness iteration on a separate "
+             "stream while the current iteration runs"),
+    cl::init(false));
+
+static cl::opt<int> benchmarkLaunches(
+    "benchmark",
+    cl::desc("Time this many launches of each GPU kernel in the host harness "
+             "and print their statistics as JSON, instead of running the "
+             "harness iterations (only with host code)"),
+    cl::value_desc("count"), cl::init(0));
+
+static cl::opt<int> benchmarkWarmup(
+    "benchmark-warmup",
+    cl::desc("Number of untimed launches of each GPU kernel before those "
+             "timed by -benchmark"),
+    cl::value_desc("count"), cl::init(5));
+
+static cl::opt<bool> phaseTiming(
+    "phase-timing",
+    cl::desc("Have the gridwise gemms of the kernels read the clock at their "
+             "phase boundaries, and print the mean cycles of each phase "
+             "after the statistics of -benchmark"),
+    cl::init(false));
+
 ////////////////////////////////////////////////////////////////////////////////
 ////  Struct KernelIF
 ////  - Detected/capture kernel interface
@@ -494,6 +699,27 @@ static void correctParameters() {
   // successfully.
   if (wi_minimum > wi_specified)
     paddingWidthRight.setValue(in_right_pad_w + (wi_minimum - wi_specified));
+
+  // The same for the depth of 3D convolutions
+  if (filterLayout.getValue().size() != 6)
+    return;
+  if (paddingDepth.getValue() > 0 && paddingDepthLeft.getValue() == 0 &&
+      paddingDepthRight.getValue() == 0) {
+    paddingDepthLeft.setValue(paddingDepth.getValue());
+    paddingDepthRight.setValue(paddingDepth.getValue());
+  }
+  int di = inputDepth.getValue();
+  int z = filterDepth.getValue();
+  int in_left_pad_d = paddingDepthLeft.getValue();
+  int in_right_pad_d = paddingDepthRight.getValue();
+  int conv_stride_d = strideDepth.getValue();
+  int conv_dilation_d = dilationDepth.getValue();
+  int dout = getOutputDim(di, z, in_left_pad_d, in_right_pad_d, conv_stride_d,
+                          conv_dilation_d);
+  int di_minimum = 1 + (z - 1) * conv_dilation_d + (dout - 1) * conv_stride_d;
+  int di_specified = di + in_left_pad_d + in_right_pad_d;
+  if (di_minimum > di_specified)
+    paddingDepthRight.setValue(in_right_pad_d + (di_minimum - di_specified));
 }
 
 static void verifyLayout() {
@@ -514,14 +740,37 @@ static void verifyLayout() {
   }
 }
 
+/// Sets -arch to the isa name of the first GPU of the machine, and -num_cu,
+/// unless it is given, to its number of compute units.
+static LogicalResult setNativeArch() {
+#ifdef MLIR_MIOPEN_ENABLE_DEVICE_INFO
+  const miopen::DeviceInfo *device = miopen::getDeviceInfo(0);
+  if (!device)
+    return failure();
+  arch.setValue(device->getIsaName());
+  if (num_cu.getNumOccurrences() == 0)
+    num_cu.setValue(device->numCu);
+  return success();
+#else
+  llvm::errs() << "-arch=native needs a build with MLIR_ENABLE_ROCM_RUNNER\n";
+  return failure();
+#endif
+}
+
 static void populateDefaults() {
   // arch is a required field to make lowering succeed. However,
   // 1. mlir-miopen-lib get it from client
   // 2. mlir-rocm-runner get it from the host machine
   // We don't particularly care about this field in the lowering
   // process unless it is tuning related. Therefore, setting this
-  // field to a default value regardless.
-  arch.setValue("amdgcn-amd-amdhsa:gfx900");
+  // field to a default value regardless, unless -arch=native asks for the
+  // GPU of the machine.
+  if (arch.getValue() == "native") {
+    if (failed(setNativeArch()))
+      exit(1);
+  } else {
+    arch.setValue("amdgcn-amd-amdhsa:gfx900");
+  }
 
   if (populateDefaultValues == true) {
     if (xdlopsV2.getValue() == false) {
@@ -580,6 +829,12 @@ static void populateDefaults() {
         paddingWidthLeft.getValue(), paddingWidthRight.getValue(),
         strideWidth.getValue(), dilationWidth.getValue()));
   }
+  if (outputDepth.getNumOccurrences() == 0) {
+    outputDepth.setValue(miopen::Conv2dGenerator::outputDim(
+        inputDepth.getValue(), filterDepth.getValue(),
+        paddingDepthLeft.getValue(), paddingDepthRight.getValue(),
+        strideDepth.getValue(), dilationDepth.getValue()));
+  }
 }
 
 static LogicalResult detectMissingArguments() {
@@ -671,7 +926,146 @@ static mlir::Value makeNDMemRef(OpBuilder &b, mlir::Value var, uint32_t ndim) {
   return var;
 }
 
-static func::FuncOp createGPUWrapper(ModuleOp &module, const KernelIF &kernel) {
+static SmallVector<mlir::Value, 4> emitGPUAllocs(OpBuilder &b, Location loc,
+                                                ValueRange cpuMem) {
+  SmallVector<mlir::Value, 4> gpuMem;
+  for (mlir::Value arg : cpuMem) {
+    auto gpuAllocOp = b.create<gpu::AllocOp>(
+        loc, arg.getType(), mlir::Type(), /*asyncDependencies=*/ValueRange{},
+        /*dynamicSizes=*/ValueRange{}, /*symbolOperands=*/ValueRange{});
+    gpuMem.push_back(gpuAllocOp.getResult(0));
+  }
+  return gpuMem;
+}
+
+static mlir::Value makeUnranked(OpBuilder &b, Location loc, mlir::Value var) {
+  auto type = var.getType().cast<MemRefType>();
+  auto unrankedType =
+      UnrankedMemRefType::get(type.getElementType(), type.getMemorySpace());
+  return b.create<memref::CastOp>(loc, unrankedType, var);
+}
+
+// What a GPU wrapper needs to benchmark its kernel: its index among the
+// kernels of the harness and the operations one launch performs.
+struct BenchmarkIF {
+  int32_t kernelId;
+  double flops;
+};
+
+// The operations of the convolution of `genConfig`: a multiply and an add
+// for every filter element and every output position of every batch. 0 if
+// the dimensions are unknown, as with kernels read from the input.
+static double getConvFlops(const miopen::Conv2dGenerator::Config &genConfig) {
+  if (genConfig.filterDimension.empty() || genConfig.outputDimension.empty())
+    return 0.0;
+  double flops = 2.0;
+  for (int64_t dim : genConfig.filterDimension)
+    flops *= dim;
+  for (auto pair : llvm::zip(genConfig.outputLayout, genConfig.outputDimension))
+    if (std::get<0>(pair) != 'g' && std::get<0>(pair) != 'k')
+      flops *= std::get<1>(pair);
+  return flops;
+}
+
+// Index of the phase times buffer among the parameters of `kernel`, if it
+// has one. See -phase-timing.
+static Optional<unsigned> getPhaseTimesIndex(const KernelIF &kernel) {
+  for (unsigned i = 0, e = kernel.func.getNumArguments(); i < e; ++i)
+    if (kernel.func.getArgAttr(i, miopen::kPhaseTimesAttrName))
+      return i;
+  return llvm::None;
+}
+
+// Emits in `b` the timed launches of `kernel` on `gpuMem` after untimed
+// warmup ones, and the printing of their statistics. The tensors are
+// uploaded again before every timed launch, outside of the timed interval,
+// so that kernels accumulating into their results start from the same data.
+// The phase times of the last launch are printed after them.
+static void emitBenchmark(OpBuilder &b, ModuleOp module, const KernelIF &kernel,
+                          const BenchmarkIF &benchmark, ValueRange gpuMem,
+                          function_ref<void(OpBuilder &)> emitUpload,
+                          function_ref<void(OpBuilder &)> emitKernelCall) {
+  auto loc = kernel.func->getLoc();
+  auto floatType = b.getF32Type();
+  auto intType = b.getIntegerType(32);
+  auto c0 = b.create<arith::ConstantIndexOp>(loc, 0);
+  auto c1 = b.create<arith::ConstantIndexOp>(loc, 1);
+
+  int warmup = std::max(benchmarkWarmup.getValue(), 0);
+  if (warmup > 0) {
+    auto loop = b.create<scf::ForOp>(
+        loc, c0, b.create<arith::ConstantIndexOp>(loc, warmup), c1);
+    OpBuilder lb = OpBuilder::atBlockTerminator(loop.getBody());
+    emitKernelCall(lb);
+  }
+
+  int launches = benchmarkLaunches.getValue();
+  auto timesType = MemRefType::get({launches}, floatType);
+  auto times = b.create<memref::AllocOp>(loc, timesType);
+  auto startFunc = makeFuncDecl(module, "mgpuTimerStart", {});
+  auto stopFunc = makeFuncDecl(module, "mgpuTimerStop", {}, {floatType});
+  auto loop = b.create<scf::ForOp>(
+      loc, c0, b.create<arith::ConstantIndexOp>(loc, launches), c1);
+  OpBuilder lb = OpBuilder::atBlockTerminator(loop.getBody());
+  emitUpload(lb);
+  lb.create<func::CallOp>(loc, startFunc, ValueRange{});
+  emitKernelCall(lb);
+  mlir::Value time =
+      lb.create<func::CallOp>(loc, stopFunc, ValueRange{}).getResult(0);
+  lb.create<memref::StoreOp>(loc, time, times,
+                             ValueRange{loop.getInductionVar()});
+
+  // The bytes of one launch are those of all its tensors, each read or
+  // written once.
+  Optional<unsigned> phaseTimesIndex = getPhaseTimesIndex(kernel);
+  double bytes = 0.0;
+  for (auto pair : llvm::enumerate(gpuMem)) {
+    if (phaseTimesIndex && pair.index() == *phaseTimesIndex)
+      continue;
+    auto type = pair.value().getType().cast<MemRefType>();
+    bytes += static_cast<double>(type.getNumElements()) *
+             type.getElementTypeBitWidth() / 8;
+  }
+  auto printFunc = makeFuncDecl(
+      module, "mcpuPrintBenchmark",
+      {timesType, intType, intType, b.getF64Type(), b.getF64Type()});
+  b.create<func::CallOp>(
+      loc, printFunc,
+      ValueRange{times,
+                 b.create<arith::ConstantIntOp>(loc, benchmark.kernelId,
+                                                intType),
+                 b.create<arith::ConstantIntOp>(loc, warmup, intType),
+                 b.create<arith::ConstantFloatOp>(
+                     loc, APFloat(benchmark.flops), b.getF64Type()),
+                 b.create<arith::ConstantFloatOp>(loc, APFloat(bytes),
+                                                  b.getF64Type())});
+  b.create<memref::DeallocOp>(loc, times);
+
+  if (!phaseTimesIndex)
+    return;
+  mlir::Value gpuPhaseTimes = gpuMem[*phaseTimesIndex];
+  auto phaseTimesType = gpuPhaseTimes.getType().cast<MemRefType>();
+  auto phaseTimes = b.create<memref::AllocOp>(loc, phaseTimesType);
+  b.create<gpu::MemcpyOp>(loc, TypeRange{},
+                          ValueRange{phaseTimes, gpuPhaseTimes});
+  auto dynamicType = MemRefType::get({-1, -1}, phaseTimesType.getElementType());
+  auto printPhasesFunc =
+      makeFuncDecl(module, "mcpuPrintPhaseTimes", {dynamicType, intType});
+  b.create<func::CallOp>(
+      loc, printPhasesFunc,
+      ValueRange{b.create<memref::CastOp>(loc, dynamicType, phaseTimes),
+                 b.create<arith::ConstantIntOp>(loc, benchmark.kernelId,
+                                                intType)});
+  b.create<memref::DeallocOp>(loc, phaseTimes);
+}
+
+// The first `numReadOnly` parameters of `kernel` are only read by it, and
+// are not copied back once it ran. With `benchmark`, the wrapper times the
+// kernel instead of running the harness iterations.
+static func::FuncOp
+createGPUWrapper(ModuleOp &module, const KernelIF &kernel,
+                 unsigned numReadOnly = 0,
+                 Optional<BenchmarkIF> benchmark = llvm::None) {
   auto context = module.getContext();
   OpBuilder b(context);
   auto loc = kernel.func->getLoc();
@@ -695,32 +1089,95 @@ static func::FuncOp createGPUWrapper(ModuleOp &module, const KernelIF &kernel) {
         loc, b.create<arith::ConstantIntOp>(loc, deviceNum.getValue(),
                                             b.getIntegerType(32)));
 
-  SmallVector<mlir::Value, 4> cpuMem;
-  SmallVector<mlir::Value, 4> gpuMem;
-  for (auto pair : llvm::enumerate(kernel.params)) {
-    mlir::Value arg = block->getArgument(pair.index());
-    cpuMem.push_back(arg);
-
-    // Emit GPU memory allocation function calls.
-    auto gpuAllocOp = b.create<gpu::AllocOp>(
-        loc, arg.getType(), mlir::Type(), /*asyncDependencies=*/ValueRange{},
-        /*dynamicSizes=*/ValueRange{}, /*symbolOperands=*/ValueRange{});
-    mlir::Value gpuAlloc = gpuAllocOp.getResult(0);
-    gpuMem.push_back(gpuAlloc);
-
-    // Emit CPU->GPU memcpy function calls.
-    b.create<gpu::MemcpyOp>(loc, TypeRange{}, ValueRange{gpuAlloc, arg});
+  // Page-locked host memory lets copies run asynchronously to the host, and
+  // at full bandwidth.
+  SmallVector<mlir::Value, 4> cpuMem(block->getArguments());
+  if (pinHostBuffers.getValue())
+    for (mlir::Value arg : cpuMem)
+      b.create<gpu::HostRegisterOp>(loc, makeUnranked(b, loc, arg));
+
+  // Emit GPU memory allocation function calls. Overlapped iterations
+  // alternate between two sets of buffers.
+  int iterations = benchmark ? 1 : std::max(harnessIterations.getValue(), 1);
+  bool overlap = overlapUpload.getValue() && iterations > 1;
+  SmallVector<mlir::Value, 4> gpuMem = emitGPUAllocs(b, loc, cpuMem);
+  SmallVector<mlir::Value, 4> nextGpuMem;
+  if (overlap)
+    nextGpuMem = emitGPUAllocs(b, loc, cpuMem);
+
+  // Emit CPU->GPU memcpy function calls.
+  auto emitUpload = [&](OpBuilder &builder, ValueRange buffers) {
+    for (auto pair : llvm::zip(buffers, cpuMem))
+      builder.create<gpu::MemcpyOp>(
+          loc, TypeRange{}, ValueRange{std::get<0>(pair), std::get<1>(pair)});
+  };
+  auto emitKernelCall = [&](OpBuilder &builder, ValueRange buffers) {
+    auto wrappedCall = builder.create<func::CallOp>(loc, kernel.func, buffers);
+    wrappedCall->setAttr("wrapped_call", builder.getUnitAttr());
+  };
+  emitUpload(b, gpuMem);
+
+  // Every iteration but the last uploads the tensors of the next one, after
+  // running the kernel or, when overlapping, while running it.
+  if (iterations > 1) {
+    auto c0 = b.create<arith::ConstantIndexOp>(loc, 0);
+    auto c1 = b.create<arith::ConstantIndexOp>(loc, 1);
+    auto c2 = b.create<arith::ConstantIndexOp>(loc, 2);
+    auto last = b.create<arith::ConstantIndexOp>(loc, iterations - 1);
+    auto loop = b.create<scf::ForOp>(loc, c0, last, c1);
+    OpBuilder lb = OpBuilder::atBlockTerminator(loop.getBody());
+    if (!overlap) {
+      emitKernelCall(lb, gpuMem);
+      emitUpload(lb, gpuMem);
+    } else {
+      auto parity = lb.create<arith::RemUIOp>(loc, loop.getInductionVar(), c2);
+      auto isEven =
+          lb.create<arith::CmpIOp>(loc, arith::CmpIPredicate::eq, parity, c0);
+      SmallVector<mlir::Value, 4> current, next;
+      for (auto pair : llvm::zip(gpuMem, nextGpuMem)) {
+        current.push_back(lb.create<arith::SelectOp>(
+            loc, isEven, std::get<0>(pair), std::get<1>(pair)));
+        next.push_back(lb.create<arith::SelectOp>(
+            loc, isEven, std::get<1>(pair), std::get<0>(pair)));
+      }
+      // gpu.wait async without dependencies starts a stream of its own.
+      auto tokenType = lb.getType<gpu::AsyncTokenType>();
+      mlir::Value token =
+          lb.create<gpu::WaitOp>(loc, tokenType, ValueRange{}).asyncToken();
+      for (auto pair : llvm::zip(next, cpuMem))
+        token = lb.create<gpu::MemcpyOp>(loc, tokenType, ValueRange{token},
+                                         std::get<0>(pair), std::get<1>(pair))
+                    .asyncToken();
+      emitKernelCall(lb, current);
+      lb.create<gpu::WaitOp>(loc, mlir::Type(), ValueRange{token});
+      if ((iterations - 1) % 2 == 1)
+        std::swap(gpuMem, nextGpuMem);
+    }
   }
 
-  // Emit kernel function call.
-  auto wrappedCall = b.create<func::CallOp>(loc, kernel.func, gpuMem);
-  wrappedCall->setAttr("wrapped_call", b.getUnitAttr());
-
-  for (auto &pair : llvm::enumerate(kernel.params)) {
-    uint32_t i = pair.index();
-    b.create<gpu::MemcpyOp>(loc, TypeRange{}, ValueRange{cpuMem[i], gpuMem[i]});
-    b.create<gpu::DeallocOp>(loc, TypeRange{}, ValueRange{gpuMem[i]});
+  // Emit kernel function call. Benchmarks leave the results of their last
+  // timed launch.
+  if (benchmark)
+    emitBenchmark(
+        b, module, kernel, *benchmark, gpuMem,
+        [&](OpBuilder &builder) { emitUpload(builder, gpuMem); },
+        [&](OpBuilder &builder) { emitKernelCall(builder, gpuMem); });
+  else
+    emitKernelCall(b, gpuMem);
+
+  for (auto pair : llvm::enumerate(llvm::zip(cpuMem, gpuMem))) {
+    mlir::Value cpuBuffer = std::get<0>(pair.value());
+    mlir::Value gpuBuffer = std::get<1>(pair.value());
+    if (pair.index() >= numReadOnly)
+      b.create<gpu::MemcpyOp>(loc, TypeRange{},
+                              ValueRange{cpuBuffer, gpuBuffer});
+    b.create<gpu::DeallocOp>(loc, TypeRange{}, ValueRange{gpuBuffer});
   }
+  for (mlir::Value gpuAlloc : nextGpuMem)
+    b.create<gpu::DeallocOp>(loc, TypeRange{}, ValueRange{gpuAlloc});
+  if (pinHostBuffers.getValue())
+    for (mlir::Value arg : cpuMem)
+      b.create<gpu::HostUnregisterOp>(loc, makeUnranked(b, loc, arg));
 
   b.create<func::ReturnOp>(loc, ValueRange{});
 
@@ -768,9 +1225,17 @@ static std::tuple<short, short, int> getRandomTestData(int idx) {
   return std::make_tuple(min, max, seed);
 }
 
-static std::string getMemsetFuncName(mlir::Type dataType) {
+static std::string
+getMemsetFuncName(mlir::Type dataType,
+                  Optional<miopen::Fp8Format> fp8Format = llvm::None) {
   std::string memsetFuncName;
-  if (dataType.isF32()) {
+  if (fp8Format.hasValue() && dataType.isInteger(8)) {
+    memsetFuncName = fp8Format == miopen::Fp8Format::E4M3
+                         ? "mcpuMemset5DFp8E4M3Rand"
+                         : "mcpuMemset5DFp8E5M2Rand";
+  } else if (dataType.isF64()) {
+    memsetFuncName = "mcpuMemset5DDoubleRand";
+  } else if (dataType.isF32()) {
     memsetFuncName = "mcpuMemset5DFloatRand";
   } else if (dataType.isF16()) {
     memsetFuncName = "mcpuMemset5DHalfRand";
@@ -788,14 +1253,16 @@ static std::string getMemsetFuncName(mlir::Type dataType) {
   return memsetFuncName;
 }
 
-static func::FuncOp getMemsetFunc(ModuleOp module, mlir::Type elemType) {
+static func::FuncOp
+getMemsetFunc(ModuleOp module, mlir::Type elemType,
+              Optional<miopen::Fp8Format> fp8Format = llvm::None) {
   OpBuilder b(module.getContext());
 
   auto int16Type = b.getIntegerType(16);
   auto int32Type = b.getIntegerType(32);
 
   // Emit CPU memset function calls.
-  std::string memsetFuncName = getMemsetFuncName(elemType);
+  std::string memsetFuncName = getMemsetFuncName(elemType, fp8Format);
   auto fiveDimUnknownSizeMemRefType =
       MemRefType::get({-1, -1, -1, -1, -1}, elemType);
   return makeFuncDecl(
@@ -819,12 +1286,23 @@ createCPUConvFunc(ModuleOp module,
   OpBuilder b(module.getContext());
   auto loc = b.getUnknownLoc();
 
+  // Create conv2d_host function
+  miopen::Conv2dGenerator conv2dGenerator(genConfig);
+  Optional<miopen::Fp8Format> fp8Format = conv2dGenerator.getFp8Format();
+
   mlir::Type elemType = b.getF32Type();
   mlir::Type outputElemType = b.getF32Type();
   if (genConfig.dataTypeStr == "i8") {
     elemType = b.getI8Type();
     outputElemType = b.getIntegerType(32);
     assert(genConfig.operation.getValue() == miopen::ConvOpType::Fwd);
+  } else if (fp8Format.hasValue()) {
+    // The inputs hold the bytes of 8-bit floats, which the reference decodes.
+    elemType = b.getI8Type();
+    assert(genConfig.operation.getValue() == miopen::ConvOpType::Fwd);
+  } else if (genConfig.dataTypeStr == "f64") {
+    elemType = b.getF64Type();
+    outputElemType = b.getF64Type();
   }
 
   auto filterDimension = genConfig.filterDimension;
@@ -835,14 +1313,11 @@ createCPUConvFunc(ModuleOp module,
   auto inputType = MemRefType::get(inputDimension, elemType);
   auto outputType = MemRefType::get(outputDimension, outputElemType);
 
-  // Create conv2d_host function
-  miopen::Conv2dGenerator conv2dGenerator(genConfig);
   bool hasWorkspace = conv2dGenerator.hasWorkspace(b);
   mlir::Type workspaceArgType;
   if (hasWorkspace) {
     workspaceArgType = MemRefType::get(
-        ArrayRef<int64_t>(filterDimension.begin(), filterDimension.end()),
-        b.getF32Type());
+        conv2dGenerator.getWorkspaceDimension(b), b.getF32Type());
   }
 
   SmallVector<mlir::Type, 3> funcArgTypes = {filterType, inputType, outputType};
@@ -901,6 +1376,28 @@ createCPUConvFunc(ModuleOp module,
   auto dilationWidthConstantOp =
       b.create<arith::ConstantIntOp>(loc, genConfig.dilationWidth, intType);
 
+  // 3D convolutions also pass their depth parameters, each after the
+  // corresponding 2D ones.
+  bool is3D = conv2dGenerator.isConv3D();
+  SmallVector<mlir::Value, 3> strideOps = {strideHeightConstantOp,
+                                           strideWidthConstantOp};
+  SmallVector<mlir::Value, 6> paddingOps = {
+      paddingHeightLeftConstantOp, paddingHeightRightConstantOp,
+      paddingWidthLeftConstantOp, paddingWidthRightConstantOp};
+  SmallVector<mlir::Value, 3> dilationOps = {dilationHeightConstantOp,
+                                             dilationWidthConstantOp};
+  if (is3D) {
+    strideOps.push_back(
+        b.create<arith::ConstantIntOp>(loc, genConfig.strideDepth, intType));
+    paddingOps.push_back(b.create<arith::ConstantIntOp>(
+        loc, genConfig.paddingDepthLeft, intType));
+    paddingOps.push_back(b.create<arith::ConstantIntOp>(
+        loc, genConfig.paddingDepthRight, intType));
+    dilationOps.push_back(
+        b.create<arith::ConstantIntOp>(loc, genConfig.dilationDepth, intType));
+  }
+  size_t layoutLen = genConfig.filterLayout.size();
+
   // Emit ConstantIndex ops
   // %c_0 = constant 0 : index
   // %c_1 = constant 1 : index
@@ -908,7 +1405,7 @@ createCPUConvFunc(ModuleOp module,
   // %c_3 = constant 3 : index
   // %c_4 = constant 4 : index
   std::vector<arith::ConstantIndexOp> indexOpVec;
-  for (int i = 0; i < 5; i++) {
+  for (size_t i = 0; i < layoutLen; i++) {
     auto indexOp = b.create<arith::ConstantIndexOp>(loc, i);
     indexOpVec.push_back(indexOp);
   }
@@ -932,6 +1429,8 @@ createCPUConvFunc(ModuleOp module,
   auto hConstantOp = b.create<arith::ConstantIntOp>(loc, 'h', charType);
   auto wConstantOp = b.create<arith::ConstantIntOp>(loc, 'w', charType);
   auto gConstantOp = b.create<arith::ConstantIntOp>(loc, 'g', charType);
+  auto zConstantOp = b.create<arith::ConstantIntOp>(loc, 'z', charType);
+  auto dConstantOp = b.create<arith::ConstantIntOp>(loc, 'd', charType);
 
   // reduce precision if !xdlops
   auto xdlopsConstantOp =
@@ -946,11 +1445,13 @@ createCPUConvFunc(ModuleOp module,
   layoutConstOps['n'] = nConstantOp;
   layoutConstOps['h'] = hConstantOp;
   layoutConstOps['w'] = wConstantOp;
+  layoutConstOps['z'] = zConstantOp;
+  layoutConstOps['d'] = dConstantOp;
 
   // %3   = alloca() : memref<5xi8>
   // %4   = alloca() : memref<5xi8>
   // %5   = alloca() : memref<5xi8>
-  SmallVector<int64_t, 5> layoutVector({5});
+  SmallVector<int64_t, 1> layoutVector({static_cast<int64_t>(layoutLen)});
   auto layoutMemRefType = MemRefType::get(
       ArrayRef<int64_t>(layoutVector.begin(), layoutVector.end()), charType);
   auto filLayoutAllocOp = b.create<memref::AllocaOp>(loc, layoutMemRefType);
@@ -962,17 +1463,17 @@ createCPUConvFunc(ModuleOp module,
   std::string fil_layout = genConfig.filterLayout;
   std::string in_layout = genConfig.inputLayout;
   std::string out_layout = genConfig.outputLayout;
-  for (int i = 0; i < 5; i++) {
+  for (size_t i = 0; i < layoutLen; i++) {
     b.create<memref::StoreOp>(loc, layoutConstOps[fil_layout[i]],
                               filLayoutAllocOp, ValueRange{indexOpVec[i]});
   }
 
-  for (int i = 0; i < 5; i++) {
+  for (size_t i = 0; i < layoutLen; i++) {
     b.create<memref::StoreOp>(loc, layoutConstOps[in_layout[i]],
                               inLayoutAllocOp, ValueRange{indexOpVec[i]});
   }
 
-  for (int i = 0; i < 5; i++) {
+  for (size_t i = 0; i < layoutLen; i++) {
     b.create<memref::StoreOp>(loc, layoutConstOps[out_layout[i]],
                               outLayoutAllocOp, ValueRange{indexOpVec[i]});
   }
@@ -993,7 +1494,7 @@ createCPUConvFunc(ModuleOp module,
 
   switch (genConfig.operation.getValue()) {
   case miopen::ConvOpType::Fwd:
-    mcpuFuncName = "mcpuConv2d";
+    mcpuFuncName = is3D ? "mcpuConv3d" : "mcpuConv2d";
     break;
   case miopen::ConvOpType::BwdData:
     mcpuFuncName = "mcpuConv2dBwdData";
@@ -1005,27 +1506,34 @@ createCPUConvFunc(ModuleOp module,
 
   if (elemType.isF32()) {
     mcpuFuncName += "Float";
+  } else if (elemType.isF64()) {
+    mcpuFuncName += "Double";
+  } else if (fp8Format.hasValue()) {
+    mcpuFuncName += "Fp8";
   } else if (elemType.isInteger(8)) {
     mcpuFuncName += "Int8";
   }
 
   // Emit cpu convolution function call op
-  auto mcpuConv2dFuncOp = makeFuncDecl(
-      module, mcpuFuncName,
-      {unrankedMemRefType, unrankedMemRefType, unrankedMemRefOutputType,
-       unrankedLayoutMemRefType, unrankedLayoutMemRefType,
-       unrankedLayoutMemRefType, intType, intType, intType, intType, intType,
-       intType, intType, intType, intType});
+  SmallVector<mlir::Value, 19> mcpuArgs = {
+      filterMemRefCastOp,    inputMemRefCastOp,    outputMemRefCastOp,
+      filLayoutMemRefCastOp, inLayoutMemRefCastOp, outLayoutMemRefCastOp};
+  llvm::append_range(mcpuArgs, strideOps);
+  llvm::append_range(mcpuArgs, paddingOps);
+  llvm::append_range(mcpuArgs, dilationOps);
+  mcpuArgs.push_back(xdlopsConstantOp);
+  // fp8 references also take the format of their inputs and the scale of
+  // their results.
+  if (fp8Format.hasValue()) {
+    mcpuArgs.push_back(b.create<arith::ConstantIntOp>(
+        loc, static_cast<int64_t>(fp8Format.getValue()), intType));
+    mcpuArgs.push_back(b.create<arith::ConstantFloatOp>(
+        loc, APFloat(genConfig.fp8Scale), b.getF32Type()));
+  }
 
-  b.create<func::CallOp>(
-      loc, mcpuConv2dFuncOp,
-      ValueRange{filterMemRefCastOp, inputMemRefCastOp, outputMemRefCastOp,
-                 filLayoutMemRefCastOp, inLayoutMemRefCastOp,
-                 outLayoutMemRefCastOp, strideHeightConstantOp,
-                 strideWidthConstantOp, paddingHeightLeftConstantOp,
-                 paddingHeightRightConstantOp, paddingWidthLeftConstantOp,
-                 paddingWidthRightConstantOp, dilationHeightConstantOp,
-                 dilationWidthConstantOp, xdlopsConstantOp});
+  auto mcpuConv2dFuncOp = makeFuncDecl(module, mcpuFuncName,
+                                       ValueRange(mcpuArgs).getTypes());
+  b.create<func::CallOp>(loc, mcpuConv2dFuncOp, mcpuArgs);
 
   // Emit return op
   b.create<func::ReturnOp>(loc, ValueRange{});
@@ -1034,7 +1542,9 @@ createCPUConvFunc(ModuleOp module,
 }
 
 const char *getTypeStr(const mlir::Type &type) {
-  if (type.isF32())
+  if (type.isF64())
+    return "f64";
+  else if (type.isF32())
     return "f32";
   else if (type.isF16())
     return "f16";
@@ -1154,6 +1664,24 @@ static void emitMemcpy(OpBuilder &b, mlir::Value src, mlir::Value dst) {
                          ValueRange{srcFlat, dstFlat, cstSize});
 }
 
+// Emits in `b` the zeroing of the elements of `buffer`, an integer memref.
+static void emitZeroFill(OpBuilder &b, Location loc, mlir::Value buffer) {
+  auto type = buffer.getType().cast<MemRefType>();
+  OpBuilder::InsertionGuard guard(b);
+  auto c0 = b.create<arith::ConstantIndexOp>(loc, 0);
+  auto c1 = b.create<arith::ConstantIndexOp>(loc, 1);
+  mlir::Value zero =
+      b.create<arith::ConstantIntOp>(loc, 0, type.getElementType());
+  SmallVector<mlir::Value, 4> ivs;
+  for (int64_t dim : type.getShape()) {
+    auto loop = b.create<scf::ForOp>(
+        loc, c0, b.create<arith::ConstantIndexOp>(loc, dim), c1);
+    b.setInsertionPoint(loop.getBody()->getTerminator());
+    ivs.push_back(loop.getInductionVar());
+  }
+  b.create<memref::StoreOp>(loc, zero, buffer, ivs);
+}
+
 static void emitPrintTensor(OpBuilder &b, mlir::Value var) {
   auto loc = b.getUnknownLoc();
   auto varType = var.getType().template dyn_cast<MemRefType>();
@@ -1183,25 +1711,124 @@ static void emitPrintTensor(OpBuilder &b, mlir::Value var) {
   }
 }
 
-static func::FuncOp
-createVerifierFunc(ModuleOp &module, const KernelIF &kernel,
-                   const miopen::Conv2dGenerator::Config &genConfig) {
-  auto kfunc = kernel.func;
-  std::string funcName = kfunc.getName().str() + "_verify";
-  func::FuncOp func = module.lookupSymbol<func::FuncOp>(funcName);
-  if (func) // already exists
-    return func;
+// Bumped whenever the random data or the reference convolutions change, so
+// that older cached results are not used.
+static constexpr int kReferenceCacheVersion = 1;
+
+// The file of -reference-cache holding the results of the CPU validation of
+// the problem, named after a hash of all they depend on, or "" if they are
+// not cached: when there is no cache, only a sample of them is computed, or
+// the random data changes with the time.
+static std::string
+getReferenceCachePath(const miopen::Conv2dGenerator::Config &genConfig) {
+  if (referenceCache.empty() || validationSample.getValue() > 0 ||
+      randomSeed.getValue() == "0")
+    return "";
+
+  std::string key;
+  llvm::raw_string_ostream os(key);
+  os << kReferenceCacheVersion << ' '
+     << miopen::getNameForConvOpType(genConfig.operation.getValue()) << ' '
+     << genConfig.dataTypeStr << ' ' << genConfig.xdlops << ' '
+     << genConfig.filterLayout << ' ' << genConfig.inputLayout << ' '
+     << genConfig.outputLayout;
+  for (const auto *dims : {&genConfig.filterDimension,
+                           &genConfig.inputDimension,
+                           &genConfig.outputDimension}) {
+    os << ' ';
+    llvm::interleave(*dims, os, "x");
+  }
+  for (int param :
+       {genConfig.strideHeight, genConfig.strideWidth, genConfig.strideDepth,
+        genConfig.paddingHeightLeft, genConfig.paddingHeightRight,
+        genConfig.paddingWidthLeft, genConfig.paddingWidthRight,
+        genConfig.paddingDepthLeft, genConfig.paddingDepthRight,
+        genConfig.dilationHeight, genConfig.dilationWidth,
+        genConfig.dilationDepth})
+    os << ' ' << param;
+  os << ' ' << randomSeed.getValue() << ' ' << randomDataType.getValue()
+     << ' ' << randomSide.getValue();
+  if (miopen::Conv2dGenerator(genConfig).getFp8Format().hasValue())
+    os << ' ' << genConfig.fp8Scale;
+  os.flush();
+
+  SmallString<128> path(referenceCache.getValue());
+  llvm::sys::path::append(
+      path, llvm::utohexstr(llvm::xxHash64(key), /*LowerCase=*/true) + ".ref");
+  return std::string(path);
+}
 
-  OpBuilder b(module.getContext());
+// Emits the reference convolution `cpuConvFunc` of `valVars` through the
+// cache file at `path`: the harness loads its result from the file if it
+// holds it, and else computes it and stores it there.
+static void emitCachedReference(OpBuilder &b, ModuleOp module,
+                                func::FuncOp cpuConvFunc,
+                                ArrayRef<mlir::Value> valVars, int32_t outIdx,
+                                StringRef path) {
   auto loc = b.getUnknownLoc();
+  auto charType = b.getIntegerType(8);
+  auto intType = b.getIntegerType(32);
+
+  // The path is a constant of the module
+  auto pathType = MemRefType::get({static_cast<int64_t>(path.size())},
+                                  charType);
+  std::string pathName = (cpuConvFunc.getName() + "_cache_path").str();
+  if (!module.lookupSymbol(pathName)) {
+    SmallVector<int8_t> chars(path.begin(), path.end());
+    OpBuilder globalBuilder = OpBuilder::atBlockBegin(module.getBody());
+    globalBuilder.create<memref::GlobalOp>(
+        loc, pathName, /*sym_visibility=*/b.getStringAttr("private"),
+        pathType,
+        DenseElementsAttr::get(
+            RankedTensorType::get(pathType.getShape(), charType),
+            ArrayRef<int8_t>(chars)),
+        /*constant=*/true, /*alignment=*/nullptr);
+  }
+  mlir::Value pathVal = b.create<memref::CastOp>(
+      loc, MemRefType::get({-1}, charType),
+      b.create<memref::GetGlobalOp>(loc, pathType, pathName));
+
+  mlir::Value result = valVars[outIdx];
+  mlir::Type elemType = result.getType().cast<MemRefType>().getElementType();
+  mlir::Value flatResult =
+      b.create<memref::CastOp>(loc, MemRefType::get({-1}, elemType),
+                               makeNDMemRef(b, result, 1));
+  auto elemBytes = b.create<arith::ConstantIntOp>(
+      loc, elemType.getIntOrFloatBitWidth() / 8, intType);
+  SmallVector<mlir::Value, 3> cacheArgs = {flatResult, elemBytes, pathVal};
+
+  auto loadFunc = makeFuncDecl(module, "mcpuLoadReference",
+                               ValueRange(cacheArgs).getTypes(), {intType});
+  auto storeFunc = makeFuncDecl(module, "mcpuStoreReference",
+                                ValueRange(cacheArgs).getTypes());
+  mlir::Value loaded =
+      b.create<func::CallOp>(loc, loadFunc, cacheArgs).getResult(0);
+  auto missed = b.create<arith::CmpIOp>(
+      loc, arith::CmpIPredicate::eq, loaded,
+      b.create<arith::ConstantIntOp>(loc, 0, intType));
+  auto ifOp = b.create<scf::IfOp>(loc, missed, /*withElseRegion=*/false);
+  auto thenBody = ifOp.getThenBodyBuilder();
+  thenBody.create<func::CallOp>(loc, cpuConvFunc, valVars);
+  thenBody.create<func::CallOp>(loc, storeFunc, cacheArgs);
+}
+
+// The element types of the results and of the validation results the
+// verifier compares, and their dimensions.
+static void
+getVerifiedTypes(OpBuilder &b, const miopen::Conv2dGenerator::Config &genConfig,
+                 mlir::Type &elemType, mlir::Type &cpuElemType,
+                 SmallVectorImpl<int64_t> &dims) {
   auto floatType = b.getF32Type();
   auto intType = b.getIntegerType(32);
 
   assert(genConfig.operation.hasValue());
 
-  mlir::Type elemType = floatType; // @@@@
-  mlir::Type cpuElemType = floatType;
+  elemType = floatType;
+  cpuElemType = floatType;
   if (genConfig.dataTypeStr == "f32") {
+  } else if (genConfig.dataTypeStr == "f64") {
+    elemType = b.getF64Type();
+    cpuElemType = b.getF64Type();
   } else if (genConfig.dataTypeStr == "f16") {
     elemType = b.getF16Type();
   } else if (genConfig.dataTypeStr == "bf16") {
@@ -1215,18 +1842,547 @@ createVerifierFunc(ModuleOp &module, const KernelIF &kernel,
     }
   }
 
-  SmallVector<int64_t, 5> dims;
   switch (genConfig.operation.getValue()) {
   case miopen::ConvOpType::Fwd:
-    dims = genConfig.outputDimension;
+    dims.assign(genConfig.outputDimension.begin(),
+                genConfig.outputDimension.end());
+    break;
+  case miopen::ConvOpType::BwdData:
+    dims.assign(genConfig.inputDimension.begin(),
+                genConfig.inputDimension.end());
+    break;
+  case miopen::ConvOpType::BwdWeight:
+    dims.assign(genConfig.filterDimension.begin(),
+                genConfig.filterDimension.end());
+    break;
+  }
+}
+
+// Whether the results of `elemType` are computed from operands rounded to
+// fewer bits than they have, which f32 ones are with `xf32`.
+static bool usesReducedPrecision(mlir::Type elemType, bool xf32) {
+  return elemType.getIntOrFloatBitWidth() < 32 || (elemType.isF32() && xf32);
+}
+
+// Whether the verifier compares results within a relative tolerance rather
+// than exactly. f64 results always are, as the f64 MFMAs sum in another
+// order than the reference.
+static bool usesTolerance(mlir::Type elemType, bool xf32) {
+  return (randomSeed.getValue() != "none" && randomSeed.getValue() != "fixed" &&
+          randomDataType.getValue() == "float") ||
+         elemType.isF16() || elemType.isBF16() || elemType.isF64() ||
+         (elemType.isF32() && xf32);
+}
+
+// The relative error the verifier tolerates in results of `elemType`.
+static float getMaxRelativeError(mlir::Type elemType, bool xf32) {
+  if (elemType.isF16())
+    return f16Threshold.getValue();
+  if (elemType.isF32() && xf32)
+    return xf32Threshold.getValue();
+  return 0.000001f;
+}
+
+// Creates the direct convolution kernel computing the result of `genConfig`,
+// its last parameter of type `resultType`, from its operands, of types
+// `aType` and `bType` in the order filter, input, output. The tensors follow
+// the layouts of `genConfig`. The kernel computes the validation results of
+// GPU validation for every direction, data type and layout, and shares no
+// code with the kernels it validates: each thread sums the terms of one
+// result element at a time, in f32, or in i32 for integers, as the naive
+// loops of the CPU reference do.
+static func::FuncOp
+createReferenceKernel(ModuleOp &module, const KernelIF &kernel,
+                      const miopen::Conv2dGenerator::Config &genConfig,
+                      MemRefType aType, MemRefType bType,
+                      MemRefType resultType) {
+  std::string funcName = kernel.func.getName().str() + "_reference_kernel";
+  if (auto func = module.lookupSymbol<func::FuncOp>(funcName))
+    return func;
+
+  OpBuilder b(module.getContext());
+  auto loc = b.getUnknownLoc();
+  miopen::ConvOpType opType = genConfig.operation.getValue();
+  bool is3D = genConfig.filterLayout.size() == 6;
+
+  // The tensors, and the letters naming their dimensions: those of the
+  // filter, input and output layouts, where the spatial dimensions of the
+  // filter are z, y and x, and those of the input and output d, h and w
+  StringRef filterLayout = genConfig.filterLayout;
+  StringRef inputLayout = genConfig.inputLayout;
+  StringRef outputLayout = genConfig.outputLayout;
+  StringRef filterSpatial = is3D ? "zyx" : "yx";
+  StringRef dataSpatial = is3D ? "dhw" : "hw";
+  SmallVector<int64_t, 3> strides = {genConfig.strideHeight,
+                                     genConfig.strideWidth};
+  SmallVector<int64_t, 3> paddings = {genConfig.paddingHeightLeft,
+                                      genConfig.paddingWidthLeft};
+  SmallVector<int64_t, 3> dilations = {genConfig.dilationHeight,
+                                       genConfig.dilationWidth};
+  if (is3D) {
+    strides.insert(strides.begin(), genConfig.strideDepth);
+    paddings.insert(paddings.begin(), genConfig.paddingDepthLeft);
+    dilations.insert(dilations.begin(), genConfig.dilationDepth);
+  }
+
+  constexpr int64_t blockSize = 256;
+  constexpr int64_t maxGridSize = 65536;
+  int64_t numElements = resultType.getNumElements();
+  int64_t gridSize = std::min(
+      maxGridSize, std::max<int64_t>(1, (numElements + blockSize - 1) /
+                                            blockSize));
+
+  auto func = func::FuncOp::create(
+      loc, funcName, b.getFunctionType({aType, bType, resultType}, {}));
+  func->setAttr("kernel", b.getUnitAttr());
+  if (auto arch = kernel.func->getAttr("arch"))
+    func->setAttr("arch", arch);
+  func->setAttr("block_size", b.getI32IntegerAttr(blockSize));
+  func->setAttr("grid_size", b.getI32IntegerAttr(gridSize));
+  module.push_back(func);
+
+  Block *block = func.addEntryBlock();
+  b.setInsertionPointToStart(block);
+  mlir::Value filter, input, output;
+  StringRef resultLayout;
+  switch (opType) {
+  case miopen::ConvOpType::Fwd:
+    filter = block->getArgument(0);
+    input = block->getArgument(1);
+    output = block->getArgument(2);
+    resultLayout = outputLayout;
+    break;
+  case miopen::ConvOpType::BwdData:
+    filter = block->getArgument(0);
+    output = block->getArgument(1);
+    input = block->getArgument(2);
+    resultLayout = inputLayout;
+    break;
+  case miopen::ConvOpType::BwdWeight:
+    input = block->getArgument(0);
+    output = block->getArgument(1);
+    filter = block->getArgument(2);
+    resultLayout = filterLayout;
+    break;
+  }
+  mlir::Value result = block->getArgument(2);
+
+  mlir::Type resultElemType = resultType.getElementType();
+  bool isInteger = resultElemType.isa<IntegerType>();
+  mlir::Type accType = isInteger ? b.getIntegerType(32) : b.getF32Type();
+
+  auto bid = b.create<miopen::WorkgroupIdOp>(loc, b.getIndexType());
+  auto tid = b.create<miopen::WorkitemIdOp>(loc, b.getIndexType());
+  mlir::Value start = b.create<arith::AddIOp>(
+      loc, b.create<arith::MulIOp>(
+               loc, bid, b.create<arith::ConstantIndexOp>(loc, blockSize)),
+      tid);
+  auto end = b.create<arith::ConstantIndexOp>(loc, numElements);
+  auto step = b.create<arith::ConstantIndexOp>(loc, blockSize * gridSize);
+  auto loop = b.create<scf::ForOp>(loc, start, end, step);
+  OpBuilder lb = OpBuilder::atBlockTerminator(loop.getBody());
+
+  // Row-major indices of the result element, by letter. The letters of the
+  // reductions are distinct from those of the result.
+  llvm::SmallDenseMap<char, mlir::Value> idxs;
+  ArrayRef<int64_t> shape = resultType.getShape();
+  mlir::Value linear = loop.getInductionVar();
+  for (size_t i = shape.size(); i > 0; --i) {
+    auto size = lb.create<arith::ConstantIndexOp>(loc, shape[i - 1]);
+    idxs[resultLayout[i - 1]] = lb.create<arith::RemUIOp>(loc, linear, size);
+    linear = lb.create<arith::DivUIOp>(loc, linear, size);
+  }
+  SmallVector<mlir::Value, 6> resultIdxs;
+  for (char letter : resultLayout)
+    resultIdxs.push_back(idxs[letter]);
+
+  auto getSize = [&](mlir::Value tensor, StringRef layout, char letter) {
+    return tensor.getType().cast<MemRefType>().getDimSize(layout.find(letter));
+  };
+
+  // The reductions, each over the dimension of a letter
+  SmallVector<std::pair<char, int64_t>, 4> reductions;
+  switch (opType) {
+  case miopen::ConvOpType::Fwd:
+    reductions.push_back({'c', getSize(input, inputLayout, 'c')});
+    for (char letter : filterSpatial)
+      reductions.push_back({letter, getSize(filter, filterLayout, letter)});
+    break;
+  case miopen::ConvOpType::BwdData:
+    reductions.push_back({'k', getSize(output, outputLayout, 'k')});
+    for (char letter : filterSpatial)
+      reductions.push_back({letter, getSize(filter, filterLayout, letter)});
+    break;
+  case miopen::ConvOpType::BwdWeight:
+    reductions.push_back({'n', getSize(output, outputLayout, 'n')});
+    for (char letter : dataSpatial)
+      reductions.push_back({letter, getSize(output, outputLayout, letter)});
+    break;
+  }
+
+  mlir::Value zero;
+  if (isInteger)
+    zero = lb.create<arith::ConstantIntOp>(loc, 0, accType);
+  else
+    zero = lb.create<arith::ConstantFloatOp>(loc, APFloat(0.0f),
+                                             accType.cast<FloatType>());
+  SmallVector<scf::ForOp, 4> loops;
+  OpBuilder rb = lb;
+  mlir::Value acc = zero;
+  for (auto &reduction : reductions) {
+    auto reductionLoop = rb.create<scf::ForOp>(
+        loc, rb.create<arith::ConstantIndexOp>(loc, 0),
+        rb.create<arith::ConstantIndexOp>(loc, reduction.second),
+        rb.create<arith::ConstantIndexOp>(loc, 1), ValueRange{acc});
+    if (!loops.empty())
+      rb.create<scf::YieldOp>(loc, reductionLoop.getResults());
+    loops.push_back(reductionLoop);
+    idxs[reduction.first] = reductionLoop.getInductionVar();
+    acc = reductionLoop.getRegionIterArgs()[0];
+    rb = OpBuilder::atBlockEnd(reductionLoop.getBody());
+  }
+
+  // The spatial indices into the data tensor read through the filter, and
+  // whether they lie in it: the input for forward and backward weight
+  // convolutions, in = out * stride + fil * dilation - padding, and the
+  // output for backward data ones, whose windows cover the input element.
+  auto getIndex = [&](int64_t value) -> mlir::Value {
+    return rb.create<arith::ConstantIndexOp>(loc, value);
+  };
+  auto cmp = [&](arith::CmpIPredicate pred, mlir::Value lhs, int64_t rhs) {
+    return rb.create<arith::CmpIOp>(loc, pred, lhs, getIndex(rhs));
+  };
+  mlir::Value inBounds =
+      rb.create<arith::ConstantIntOp>(loc, 1, rb.getI1Type());
+  auto requireThat = [&](mlir::Value cond) {
+    inBounds = rb.create<arith::AndIOp>(loc, inBounds, cond);
+  };
+  llvm::SmallDenseMap<char, mlir::Value> dataIdxs;
+  for (size_t i = 0; i < dataSpatial.size(); ++i) {
+    char letter = dataSpatial[i];
+    mlir::Value offset = rb.create<arith::SubIOp>(
+        loc,
+        rb.create<arith::MulIOp>(loc, idxs[filterSpatial[i]],
+                                 getIndex(dilations[i])),
+        getIndex(paddings[i]));
+    if (opType == miopen::ConvOpType::BwdData) {
+      mlir::Value scaled = rb.create<arith::SubIOp>(loc, idxs[letter], offset);
+      mlir::Value stride = getIndex(strides[i]);
+      mlir::Value outIdx = rb.create<arith::DivSIOp>(loc, scaled, stride);
+      requireThat(cmp(arith::CmpIPredicate::sge, scaled, 0));
+      requireThat(
+          cmp(arith::CmpIPredicate::eq,
+              rb.create<arith::RemSIOp>(loc, scaled, stride), 0));
+      requireThat(cmp(arith::CmpIPredicate::slt, outIdx,
+                      getSize(output, outputLayout, letter)));
+      dataIdxs[letter] = outIdx;
+    } else {
+      mlir::Value inIdx = rb.create<arith::AddIOp>(
+          loc,
+          rb.create<arith::MulIOp>(loc, idxs[letter], getIndex(strides[i])),
+          offset);
+      requireThat(cmp(arith::CmpIPredicate::sge, inIdx, 0));
+      requireThat(cmp(arith::CmpIPredicate::slt, inIdx,
+                      getSize(input, inputLayout, letter)));
+      dataIdxs[letter] = inIdx;
+    }
+  }
+  mlir::Value readData =
+      opType == miopen::ConvOpType::BwdData ? output : input;
+
+  auto ifOp = rb.create<scf::IfOp>(loc, accType, inBounds,
+                                   /*withElseRegion=*/true);
+  OpBuilder tb = ifOp.getThenBodyBuilder();
+  auto load = [&](mlir::Value tensor, StringRef layout) -> mlir::Value {
+    SmallVector<mlir::Value, 6> indices;
+    for (char letter : layout)
+      indices.push_back(tensor == readData && dataIdxs.count(letter)
+                            ? dataIdxs[letter]
+                            : idxs[letter]);
+    mlir::Value value = tb.create<memref::LoadOp>(loc, tensor, indices);
+    if (value.getType() == accType)
+      return value;
+    if (isInteger)
+      return tb.create<arith::ExtSIOp>(loc, accType, value);
+    return tb.create<arith::ExtFOp>(loc, accType, value);
+  };
+  mlir::Value lhs, rhs;
+  switch (opType) {
+  case miopen::ConvOpType::Fwd:
+    lhs = load(input, inputLayout);
+    rhs = load(filter, filterLayout);
     break;
   case miopen::ConvOpType::BwdData:
-    dims = genConfig.inputDimension;
+    lhs = load(output, outputLayout);
+    rhs = load(filter, filterLayout);
     break;
   case miopen::ConvOpType::BwdWeight:
-    dims = genConfig.filterDimension;
+    lhs = load(input, inputLayout);
+    rhs = load(output, outputLayout);
     break;
   }
+  mlir::Value sum;
+  if (isInteger)
+    sum = tb.create<arith::AddIOp>(loc, acc,
+                                   tb.create<arith::MulIOp>(loc, lhs, rhs));
+  else
+    sum = tb.create<arith::AddFOp>(loc, acc,
+                                   tb.create<arith::MulFOp>(loc, lhs, rhs));
+  tb.create<scf::YieldOp>(loc, sum);
+  ifOp.getElseBodyBuilder().create<scf::YieldOp>(loc, acc);
+  rb.create<scf::YieldOp>(loc, ifOp.getResults());
+
+  mlir::Value total = loops.front().getResult(0);
+  if (resultElemType != accType) {
+    if (isInteger)
+      total = lb.create<arith::TruncIOp>(loc, resultElemType, total);
+    else
+      total = lb.create<arith::TruncFOp>(loc, resultElemType, total);
+  }
+  lb.create<memref::StoreOp>(loc, total, result, resultIdxs);
+
+  b.create<func::ReturnOp>(loc, ValueRange{});
+  return func;
+}
+
+// Creates the GPU kernel comparing results of type `gpuType` with validation
+// results of type `cpuType`. It adds the number of mismatching elements to
+// the first element of its third argument, and raises the second and third
+// elements to the bits of the largest absolute and relative error, as f32.
+// Elements are compared like the host verifier does, in f32.
+static func::FuncOp
+createVerifierKernel(ModuleOp &module, const KernelIF &kernel,
+                     MemRefType gpuType, MemRefType cpuType, bool xf32) {
+  std::string funcName = kernel.func.getName().str() + "_verify_kernel";
+  if (auto func = module.lookupSymbol<func::FuncOp>(funcName))
+    return func;
+
+  OpBuilder b(module.getContext());
+  auto loc = b.getUnknownLoc();
+  auto floatType = b.getF32Type();
+  auto intType = b.getIntegerType(32);
+  auto summaryType = MemRefType::get({3}, intType);
+
+  // Each thread folds the elements it strides over into its own summary,
+  // and adds it to the global one with one atomic per field.
+  constexpr int64_t blockSize = 256;
+  constexpr int64_t maxGridSize = 1024;
+  int64_t numElements = gpuType.getNumElements();
+  int64_t gridSize = std::min(
+      maxGridSize, std::max<int64_t>(1, (numElements + blockSize - 1) /
+                                            blockSize));
+
+  auto func = func::FuncOp::create(
+      loc, funcName, b.getFunctionType({gpuType, cpuType, summaryType}, {}));
+  func->setAttr("kernel", b.getUnitAttr());
+  if (auto arch = kernel.func->getAttr("arch"))
+    func->setAttr("arch", arch);
+  func->setAttr("block_size", b.getI32IntegerAttr(blockSize));
+  func->setAttr("grid_size", b.getI32IntegerAttr(gridSize));
+  module.push_back(func);
+
+  Block *block = func.addEntryBlock();
+  b.setInsertionPointToStart(block);
+  mlir::Value gpuResults = block->getArgument(0);
+  mlir::Value cpuResults = block->getArgument(1);
+  mlir::Value summary = block->getArgument(2);
+
+  mlir::Type elemType = gpuType.getElementType();
+  bool tolerance = usesTolerance(elemType, xf32);
+  float maxPercent = getMaxRelativeError(elemType, xf32);
+
+  auto c0Index = b.create<arith::ConstantIndexOp>(loc, 0);
+  auto c1Index = b.create<arith::ConstantIndexOp>(loc, 1);
+  auto c2Index = b.create<arith::ConstantIndexOp>(loc, 2);
+  auto c0Int = b.create<arith::ConstantIntOp>(loc, 0, intType);
+  auto c0Float = b.create<arith::ConstantFloatOp>(loc, APFloat(0.0f),
+                                                  floatType);
+  auto bid = b.create<miopen::WorkgroupIdOp>(loc, b.getIndexType());
+  auto tid = b.create<miopen::WorkitemIdOp>(loc, b.getIndexType());
+  mlir::Value start = b.create<arith::AddIOp>(
+      loc, b.create<arith::MulIOp>(
+               loc, bid, b.create<arith::ConstantIndexOp>(loc, blockSize)),
+      tid);
+  auto end = b.create<arith::ConstantIndexOp>(loc, numElements);
+  auto step = b.create<arith::ConstantIndexOp>(loc, blockSize * gridSize);
+
+  auto loop = b.create<scf::ForOp>(loc, start, end, step,
+                                   ValueRange{c0Int, c0Float, c0Float});
+  {
+    OpBuilder lb = OpBuilder::atBlockEnd(loop.getBody());
+    mlir::Value count = loop.getRegionIterArgs()[0];
+    mlir::Value maxAbs = loop.getRegionIterArgs()[1];
+    mlir::Value maxRel = loop.getRegionIterArgs()[2];
+
+    // Row-major indices of the element
+    ArrayRef<int64_t> shape = gpuType.getShape();
+    SmallVector<mlir::Value, 6> idxs(shape.size());
+    mlir::Value linear = loop.getInductionVar();
+    for (size_t i = shape.size(); i > 0; --i) {
+      auto size = lb.create<arith::ConstantIndexOp>(loc, shape[i - 1]);
+      idxs[i - 1] = lb.create<arith::RemUIOp>(loc, linear, size);
+      linear = lb.create<arith::DivUIOp>(loc, linear, size);
+    }
+    mlir::Value gpuVal = lb.create<memref::LoadOp>(loc, gpuResults, idxs);
+    mlir::Value cpuVal = lb.create<memref::LoadOp>(loc, cpuResults, idxs);
+
+    // Lower cpu values to gpu precision, and compare in f32
+    auto toFloat = [&](mlir::Value value) -> mlir::Value {
+      mlir::Type type = value.getType();
+      if (type.isF32())
+        return value;
+      if (type.isa<IntegerType>())
+        return lb.create<arith::SIToFPOp>(loc, floatType, value);
+      if (type.isF64())
+        return lb.create<arith::TruncFOp>(loc, floatType, value);
+      return lb.create<arith::ExtFOp>(loc, floatType, value);
+    };
+    mlir::Value mismatch;
+    if (elemType.isa<IntegerType>())
+      mismatch = lb.create<arith::CmpIOp>(loc, arith::CmpIPredicate::ne,
+                                          cpuVal, gpuVal);
+    if (elemType.isF16() || elemType.isBF16())
+      cpuVal = lb.create<arith::TruncFOp>(loc, elemType, cpuVal);
+    cpuVal = toFloat(cpuVal);
+    gpuVal = toFloat(gpuVal);
+
+    auto abs = [&](mlir::Value value) -> mlir::Value {
+      auto negative = lb.create<arith::CmpFOp>(loc, arith::CmpFPredicate::OLT,
+                                               value, c0Float);
+      auto negated = lb.create<arith::NegFOp>(loc, value);
+      return lb.create<arith::SelectOp>(loc, negative, negated, value);
+    };
+    mlir::Value absCpu = abs(cpuVal);
+    mlir::Value absErr =
+        abs(lb.create<arith::SubFOp>(loc, cpuVal, gpuVal).getResult());
+    auto cpuNotZero = lb.create<arith::CmpFOp>(loc, arith::CmpFPredicate::UNE,
+                                               cpuVal, c0Float);
+    mlir::Value relErr = lb.create<arith::SelectOp>(
+        loc, cpuNotZero, lb.create<arith::DivFOp>(loc, absErr, absCpu),
+        absErr);
+
+    if (!mismatch) {
+      mismatch = lb.create<arith::CmpFOp>(loc, arith::CmpFPredicate::UNE,
+                                          cpuVal, gpuVal);
+      if (tolerance) {
+        auto maxPercentVal = lb.create<arith::ConstantFloatOp>(
+            loc, APFloat(maxPercent), floatType);
+        mismatch = lb.create<arith::AndIOp>(
+            loc, mismatch,
+            lb.create<arith::CmpFOp>(loc, arith::CmpFPredicate::UGT, relErr,
+                                     maxPercentVal));
+        if (usesReducedPrecision(elemType, xf32)) {
+          auto minCpuVal = lb.create<arith::ConstantFloatOp>(
+              loc, APFloat(0.001f), floatType);
+          mismatch = lb.create<arith::AndIOp>(
+              loc, mismatch,
+              lb.create<arith::CmpFOp>(loc, arith::CmpFPredicate::UGT, absCpu,
+                                       minCpuVal));
+        }
+      }
+    }
+
+    auto raise = [&](mlir::Value current, mlir::Value value) -> mlir::Value {
+      auto larger = lb.create<arith::CmpFOp>(loc, arith::CmpFPredicate::UGT,
+                                             value, current);
+      return lb.create<arith::SelectOp>(loc, larger, value, current);
+    };
+    mlir::Value newCount = lb.create<arith::AddIOp>(
+        loc, count, lb.create<arith::ExtUIOp>(loc, intType, mismatch));
+    lb.create<scf::YieldOp>(loc, ValueRange{newCount, raise(maxAbs, absErr),
+                                            raise(maxRel, relErr)});
+  }
+
+  // The errors are not negative, so their bits order like signed integers.
+  b.create<memref::AtomicRMWOp>(loc, intType, arith::AtomicRMWKind::addi,
+                                loop.getResult(0), summary,
+                                ValueRange{c0Index});
+  b.create<memref::AtomicRMWOp>(
+      loc, intType, arith::AtomicRMWKind::maxs,
+      b.create<arith::BitcastOp>(loc, intType, loop.getResult(1)), summary,
+      ValueRange{c1Index});
+  b.create<memref::AtomicRMWOp>(
+      loc, intType, arith::AtomicRMWKind::maxs,
+      b.create<arith::BitcastOp>(loc, intType, loop.getResult(2)), summary,
+      ValueRange{c2Index});
+  b.create<func::ReturnOp>(loc, ValueRange{});
+  return func;
+}
+
+// Emits in `b` the comparison of `gpuResults` and `cpuResults` by the kernel
+// of createVerifierKernel, storing 0 into `cmpResult` if they mismatch.
+static void emitDeviceVerification(OpBuilder &b, ModuleOp &module,
+                                   const KernelIF &kernel,
+                                   mlir::Value gpuResults,
+                                   mlir::Value cpuResults,
+                                   mlir::Value cmpResult, bool xf32) {
+  auto loc = b.getUnknownLoc();
+  auto floatType = b.getF32Type();
+  auto intType = b.getIntegerType(32);
+  auto verifierKernel = createVerifierKernel(
+      module, kernel, gpuResults.getType().cast<MemRefType>(),
+      cpuResults.getType().cast<MemRefType>(), xf32);
+  // Only the summary is copied back
+  auto verifierWrapper =
+      createGPUWrapper(module, KernelIF(verifierKernel), /*numReadOnly=*/2);
+
+  auto c0Index = b.create<arith::ConstantIndexOp>(loc, 0);
+  auto c1Index = b.create<arith::ConstantIndexOp>(loc, 1);
+  auto c2Index = b.create<arith::ConstantIndexOp>(loc, 2);
+  auto c0Int = b.create<arith::ConstantIntOp>(loc, 0, intType);
+  auto c1Int = b.create<arith::ConstantIntOp>(loc, 1, intType);
+  auto summary = b.create<memref::AllocOp>(loc, MemRefType::get({3}, intType));
+  for (mlir::Value index : {c0Index, c1Index, c2Index})
+    b.create<memref::StoreOp>(loc, c0Int, summary, ValueRange{index});
+  b.create<func::CallOp>(loc, verifierWrapper,
+                         ValueRange{gpuResults, cpuResults, summary});
+
+  mlir::Value count =
+      b.create<memref::LoadOp>(loc, summary, ValueRange{c0Index});
+  auto mismatch =
+      b.create<arith::CmpIOp>(loc, arith::CmpIPredicate::ne, count, c0Int);
+  b.create<memref::StoreOp>(
+      loc, b.create<arith::SelectOp>(loc, mismatch, c0Int, c1Int), cmpResult,
+      ValueRange{c0Index});
+
+  // On mismatch, print the number of mismatching elements and the largest
+  // errors
+  auto ifOp = b.create<scf::IfOp>(loc, mismatch, false);
+  auto thenBody = ifOp.getThenBodyBuilder();
+  auto printInt =
+      makeFuncDecl(module, "mcpuPrintInt32", {intType, intType});
+  auto printFloat =
+      makeFuncDecl(module, "mcpuPrintF32", {floatType, floatType});
+  auto numElements = thenBody.create<arith::ConstantIntOp>(
+      loc, gpuResults.getType().cast<MemRefType>().getNumElements(), intType);
+  thenBody.create<func::CallOp>(loc, printInt,
+                                ValueRange{count, numElements});
+  SmallVector<mlir::Value, 2> errors;
+  for (mlir::Value index : {c1Index, c2Index})
+    errors.push_back(thenBody.create<arith::BitcastOp>(
+        loc, floatType,
+        thenBody.create<memref::LoadOp>(loc, summary, ValueRange{index})));
+  thenBody.create<func::CallOp>(loc, printFloat, errors);
+  b.create<memref::DeallocOp>(loc, summary);
+}
+
+static func::FuncOp
+createVerifierFunc(ModuleOp &module, const KernelIF &kernel,
+                   const miopen::Conv2dGenerator::Config &genConfig) {
+  auto kfunc = kernel.func;
+  std::string funcName = kfunc.getName().str() + "_verify";
+  func::FuncOp func = module.lookupSymbol<func::FuncOp>(funcName);
+  if (func) // already exists
+    return func;
+
+  OpBuilder b(module.getContext());
+  auto loc = b.getUnknownLoc();
+  auto floatType = b.getF32Type();
+  auto intType = b.getIntegerType(32);
+
+  mlir::Type elemType, cpuElemType;
+  SmallVector<int64_t, 6> dims;
+  getVerifiedTypes(b, genConfig, elemType, cpuElemType, dims);
   auto cpuType = MemRefType::get(dims, cpuElemType);
   auto gpuType = MemRefType::get(dims, elemType);
 
@@ -1259,6 +2415,15 @@ createVerifierFunc(ModuleOp &module, const KernelIF &kernel,
   b.create<memref::StoreOp>(loc, c1ConstantInt32Op, cmpResultAllocOp,
                             ValueRange{c0IndexOp});
 
+  if (verifyOnDevice.getValue() && kfunc->hasAttr("kernel")) {
+    emitDeviceVerification(b, module, kernel, block->getArgument(0),
+                           block->getArgument(1), cmpResultAllocOp,
+                           genConfig.xf32);
+    emitPrintTensor(b, cmpResultAllocOp);
+    b.create<func::ReturnOp>(loc, ValueRange{});
+    return func;
+  }
+
   mlir::FloatType elemFType = floatType;
   if (elemType.isIntOrIndex()) { // i8, i32
   } else if (!elemType.isF32()) {
@@ -1266,6 +2431,8 @@ createVerifierFunc(ModuleOp &module, const KernelIF &kernel,
       elemFType = b.getBF16Type();
     } else if (elemType.isF16()) {
       elemFType = b.getF16Type();
+    } else if (elemType.isF64()) {
+      elemFType = b.getF64Type();
     }
   }
 
@@ -1278,20 +2445,22 @@ createVerifierFunc(ModuleOp &module, const KernelIF &kernel,
     } else if (elemFType.isBF16()) {
       apVal.convert(llvm::APFloat::BFloat(), APFloat::rmNearestTiesToEven,
                     &ignored);
+    } else if (elemFType.isF64()) {
+      apVal.convert(llvm::APFloat::IEEEdouble(), APFloat::rmNearestTiesToEven,
+                    &ignored);
     }
     return b.create<arith::ConstantFloatOp>(loc, apVal, elemFType);
   };
 
-  mlir::Value fval00, fval000001, fval001, fval025;
-  float f16_threshold = f16Threshold.getValue();
+  mlir::Value fval00, fval001, fvalMaxError;
   // Create constants needed for verification
   if ((randomSeed.getValue() != "none" &&
        randomDataType.getValue() == "float") ||
-      elemType.isF16() || elemType.isBF16()) {
+      elemType.isF16() || elemType.isBF16() || elemType.isF64() ||
+      genConfig.xf32) {
     fval00 = getFVal(0.0f);
-    fval000001 = getFVal(0.000001f);
     fval001 = getFVal(0.001f);
-    fval025 = getFVal(f16_threshold);
+    fvalMaxError = getFVal(getMaxRelativeError(elemType, genConfig.xf32));
   }
   // %%c1 = constant 1 : index
   auto c1IndexOp = b.create<arith::ConstantIndexOp>(loc, 1);
@@ -1348,13 +2517,15 @@ createVerifierFunc(ModuleOp &module, const KernelIF &kernel,
   if (elemType.isF16() || elemType.isBF16()) {
     cpuLoadVal = loopB.create<arith::TruncFOp>(loc, elemFType, cpuLoadVal);
     gpuPrintVal = loopB.create<arith::ExtFOp>(loc, floatType, gpuLoadVal);
+  } else if (elemType.isF64()) {
+    // Printed as f32.
+    gpuPrintVal = loopB.create<arith::TruncFOp>(loc, floatType, gpuLoadVal);
+    cpuPrintVal = loopB.create<arith::TruncFOp>(loc, floatType, cpuLoadVal);
   }
 
   mlir::Value percentDiffVal;
   mlir::Value cmpVal;
-  if ((randomSeed.getValue() != "none" && randomSeed.getValue() != "fixed" &&
-       randomDataType.getValue() == "float") ||
-      elemType.isF16() || elemType.isBF16()) {
+  if (usesTolerance(elemType, genConfig.xf32)) {
     // <test> = <cpu> != <gpu>
 
     auto cmpfOp = loopB.create<arith::CmpFOp>(loc, arith::CmpFPredicate::UNE,
@@ -1379,19 +2550,15 @@ createVerifierFunc(ModuleOp &module, const KernelIF &kernel,
 
     auto absCpuVal = testBody.create<math::AbsOp>(loc, cpuLoadVal);
 
-    mlir::Value maxPercentVal;
-    if (elemType.isF16()) {
-      // The threshold for f16 datatype is controlled by -threshold
-      // The default value is set to 0.25
-      maxPercentVal = fval025;
-    } else {
-      maxPercentVal = fval000001; // 0.0001 %
-    }
+    // The threshold for f16 datatype is controlled by -threshold, 0.25 by
+    // default, and that of xf32 ones by -xf32-threshold, 0.01 by default.
+    // Others tolerate 0.0001 %.
+    mlir::Value maxPercentVal = fvalMaxError;
 
     // <test> >= <max_percent>
     cmpVal = testBody.create<arith::CmpFOp>(loc, arith::CmpFPredicate::UGT,
                                             absfOp, maxPercentVal);
-    if (elemType.getIntOrFloatBitWidth() < 32) {
+    if (usesReducedPrecision(elemType, genConfig.xf32)) {
       // && <cpu> >= 0.001f
       auto cmp1Op = testBody.create<arith::CmpFOp>(
           loc, arith::CmpFPredicate::UGT, absCpuVal, fval001);
@@ -1428,6 +2595,9 @@ createVerifierFunc(ModuleOp &module, const KernelIF &kernel,
     if (elemType.getIntOrFloatBitWidth() < 32) { // f16, bf16
       percentDiffVal =
           thenBody.create<arith::ExtFOp>(loc, floatType, percentDiffVal);
+    } else if (elemType.isF64()) {
+      percentDiffVal =
+          thenBody.create<arith::TruncFOp>(loc, floatType, percentDiffVal);
     }
     thenBody.create<func::CallOp>(loc, printFunc,
                                   ValueRange{percentDiffVal, cpuPrintVal});
@@ -1443,16 +2613,22 @@ createVerifierFunc(ModuleOp &module, const KernelIF &kernel,
   return func;
 }
 
-static LogicalResult populateTensorFillLogic(mlir::OpBuilder &b,
-                                             mlir::Location loc,
-                                             mlir::Type elemType,
-                                             mlir::Value lv5D) {
+static LogicalResult
+populateTensorFillLogic(mlir::OpBuilder &b, mlir::Location loc,
+                        mlir::Type elemType, mlir::Value lv5D,
+                        Optional<miopen::Fp8Format> fp8Format = llvm::None) {
   auto lv5DType = lv5D.getType().template cast<mlir::MemRefType>();
+  bool isFp8 = fp8Format.hasValue() && elemType.isInteger(8);
   llvm::SmallVector<float, 3> pattern;
-  if (elemType.isIntOrIndex())
+  if (elemType.isIntOrIndex() && !isFp8)
     pattern = {1.0, -1.0, 2.0};
   else
     pattern = {0.5, -1, 0.75};
+  // The float pattern in the E4M3 and E5M2 formats of gfx940, for fp8
+  // tensors.
+  static const int8_t fp8Patterns[2][3] = {
+      {0x38, static_cast<int8_t>(0xC0), 0x3C},
+      {0x3C, static_cast<int8_t>(0xC0), 0x3E}};
   // TODO(kdrewnia) Refactor this to create the constant vector up front
   // TODO(kdrewnia) Factor out the anti-bf16 pass from GPU lowering, apply
   // it here
@@ -1476,6 +2652,10 @@ static LogicalResult populateTensorFillLogic(mlir::OpBuilder &b,
                  &losesInfo);
       llvm::APInt val = fl.bitcastToAPInt();
       vOp = b.create<arith::ConstantOp>(loc, b.getIntegerAttr(i16, val));
+    } else if (isFp8) {
+      vOp = mlir::miopen::createConstantIntOp(
+          b, loc, elemType, elemType,
+          fp8Patterns[static_cast<int>(fp8Format.getValue())][v.index()]);
     } else if (elemType.isIntOrIndex()) {
       vOp = mlir::miopen::createConstantIntOp(b, loc, elemType, elemType,
                                               static_cast<int64_t>(v.value()));
@@ -1577,18 +2757,26 @@ populateHostHarnessLogic(ModuleOp &module,
   auto root0 = *roots.begin();
   bool isCPUKernel = !root0.func->hasAttr("kernel");
   bool hasValidation = !validationType.empty();
+  Optional<miopen::Fp8Format> fp8Format =
+      miopen::Conv2dGenerator(genConfig).getFp8Format();
   SmallVector<mlir::Value, 5> localVars;
   SmallVector<mlir::Value, 5> valVars;
+  // Tensors the GPU wrappers page-lock start on pages of their own.
+  IntegerAttr hostAlignment;
+  if (pinHostBuffers.getValue())
+    hostAlignment = b.getI64IntegerAttr(4096);
   int32_t idx = 0;
   for (auto &paramType : root0.params) {
     auto paramMRType = paramType.template dyn_cast<MemRefType>();
     assert(paramMRType && "currently only supports memref types");
     auto elemType = paramMRType.getElementType();
     if (isCPUKernel) {
-      assert(elemType.isF32() || elemType.isInteger(8) ||
+      assert(elemType.isF32() || elemType.isF64() || elemType.isInteger(8) ||
              elemType.isInteger(32));
       if (genConfig.dataTypeStr == "f32")
         elemType = b.getF32Type();
+      else if (genConfig.dataTypeStr == "f64")
+        elemType = b.getF64Type();
       else if (genConfig.dataTypeStr == "f16")
         elemType = b.getF16Type();
       else if (genConfig.dataTypeStr == "bf16")
@@ -1598,16 +2786,30 @@ populateHostHarnessLogic(ModuleOp &module,
         if (idx == 2) {
           elemType = b.getIntegerType(32);
         }
+      } else if (fp8Format.hasValue()) {
+        elemType = idx == 2 ? b.getF32Type() : b.getI8Type();
       }
       paramMRType = MemRefType::get(paramMRType.getShape(), elemType);
     }
     auto mr5DUnkType = MemRefType::get({-1, -1, -1, -1, -1}, elemType);
-    auto lvar = b.create<memref::AllocOp>(loc, paramMRType);
+    auto lvar = b.create<memref::AllocOp>(loc, paramMRType, hostAlignment);
     localVars.push_back(lvar);
 
+    // Workgroups past the grid leave their rows of phase times at 0, and
+    // the counters of fused KBlock reductions and the outputs of fused sum
+    // reductions must start at 0.
+    if (!isCPUKernel &&
+        (root0.func.getArgAttr(idx, miopen::kPhaseTimesAttrName) ||
+         root0.func.getArgAttr(idx, miopen::kZeroInitAttrName) ||
+         root0.func.getArgAttr(idx, miopen::kZeroBeforeLaunchAttrName))) {
+      emitZeroFill(b, loc, lvar);
+      idx++;
+      continue;
+    }
+
     auto lv5D = makeNDMemRef(b, lvar, 5);
     if (randomSeed.getValue() == "fixed") {
-      if (failed(populateTensorFillLogic(b, loc, elemType, lv5D)))
+      if (failed(populateTensorFillLogic(b, loc, elemType, lv5D, fp8Format)))
         return failure();
     } else {
       auto lvU5D = b.create<memref::CastOp>(loc, mr5DUnkType, lv5D);
@@ -1617,7 +2819,7 @@ populateHostHarnessLogic(ModuleOp &module,
       std::tie(min, max, seed) = getRandomTestData(idx);
 
       b.create<func::CallOp>(
-          loc, getMemsetFunc(module, elemType),
+          loc, getMemsetFunc(module, elemType, fp8Format),
           ValueRange{lvU5D, getI16Val(min), getI16Val(max), getI32Val(seed)});
     }
 
@@ -1625,11 +2827,12 @@ populateHostHarnessLogic(ModuleOp &module,
         (isCPUKernel && (elemType.isF16() || elemType.isBF16()))) {
       // Emit validation var
       mlir::Type valElemType = floatType;
-      if (genConfig.dataTypeStr == "i8") {
+      if (genConfig.dataTypeStr == "i8" || genConfig.dataTypeStr == "f64" ||
+          fp8Format.hasValue()) {
         valElemType = elemType;
       }
       auto valType = MemRefType::get(paramMRType.getShape(), valElemType);
-      auto vvar = b.create<memref::AllocOp>(loc, valType);
+      auto vvar = b.create<memref::AllocOp>(loc, valType, hostAlignment);
       valVars.push_back(vvar);
 
       emitMemcpy(b, lvar, vvar);
@@ -1668,9 +2871,15 @@ populateHostHarnessLogic(ModuleOp &module,
 
   // Wrap the kernels and gather them to substitute in calls.
   llvm::SmallDenseMap<func::FuncOp, func::FuncOp> wrappedFuncs;
+  int32_t gpuKernelId = 0;
   for (auto &kernel : kernels) {
     if (kernel.func->hasAttr("kernel")) {
-      wrappedFuncs[kernel.func] = createGPUWrapper(module, kernel);
+      Optional<BenchmarkIF> benchmark;
+      if (benchmarkLaunches.getValue() > 0)
+        benchmark = BenchmarkIF{gpuKernelId, getConvFlops(genConfig)};
+      ++gpuKernelId;
+      wrappedFuncs[kernel.func] =
+          createGPUWrapper(module, kernel, /*numReadOnly=*/0, benchmark);
     } else {
       wrappedFuncs[kernel.func] = kernel.func;
     }
@@ -1698,55 +2907,50 @@ populateHostHarnessLogic(ModuleOp &module,
 
   // Run validation
   if (hasValidation) {
-    if (validationType == "gpu" &&
-        (genConfig.xdlops || genConfig.dataTypeStr == "f16" ||
-         genConfig.dataTypeStr == "bf16")) {
-      // generate generic kernels
-      miopen::Conv2dGenerator conv2dGenerator(genConfig);
-      // use non-xdlops kernels to verify xdlops kernels
-      if (genConfig.xdlops)
-        conv2dGenerator.flipXdlops();
-      if (!genConfig.xdlops || genConfig.dataTypeStr != "i8")
-        // use f32 data type to verify non-f32 or xdlops f32 kernels
-        // except that i8 xdlops is verified with i8 non-xdlops
-        conv2dGenerator.setDataType("f32");
-
-      int kernelStart = genConfig.kernelId;
-      int kernelCount = conv2dGenerator.getKernelCount(b);
-      if (kernelStart < 0) {
-        kernelStart = 0;
-      } else {
-        kernelCount = kernelStart + 1;
-      }
-      // generate all sub-kernels, and get corresponding gemmId
-      std::string kernelBaseName = genConfig.kernelBaseName;
-      for (int i = kernelStart; i < kernelCount; ++i) {
-        conv2dGenerator.setKernelName(kernelBaseName + "_" + std::to_string(i));
-        if (failed(conv2dGenerator.genConvModule(module, i, true,
-                                                 /*ignoreTuning=*/true))) {
-          llvm::errs() << "Module population failed.\n";
-          exit(1);
-        }
-        KernelIF kernel(conv2dGenerator.getKernelFunc());
-        miopen::Conv2dGenerator::Config newConfig = conv2dGenerator.getConfig();
-        auto kernelWrapperFunc = createGPUWrapper(module, kernel);
-
-        // Decide whether to trim the last workspace argument to the verifier
-        // GPU kernel.
-        miopen::Conv2dGenerator originalConv2dGenerator(genConfig);
-        bool originalHasWorkspace = originalConv2dGenerator.hasWorkspace(b);
-        bool verifierHasWorkspace = conv2dGenerator.hasWorkspace(b);
-        if (originalHasWorkspace && !verifierHasWorkspace) {
-          valVars.resize(valVars.size() - 1);
-        }
-
-        b.create<func::CallOp>(loc, kernelWrapperFunc, valVars);
-      }
-      conv2dGenerator.setKernelName(kernelBaseName);
+    if (validationType == "gpu") {
+      // The result of the convolution goes last, after its operands
+      int32_t resultIdx = 2;
+      if (genConfig.operation.getValue() == miopen::ConvOpType::BwdData)
+        resultIdx = 1;
+      else if (genConfig.operation.getValue() ==
+               miopen::ConvOpType::BwdWeight)
+        resultIdx = 0;
+      SmallVector<mlir::Value, 3> refArgs;
+      for (int32_t i = 0; i < 3; ++i)
+        if (i != resultIdx)
+          refArgs.push_back(valVars[i]);
+      refArgs.push_back(valVars[resultIdx]);
+
+      auto refKernel = createReferenceKernel(
+          module, root0, genConfig, refArgs[0].getType().cast<MemRefType>(),
+          refArgs[1].getType().cast<MemRefType>(),
+          refArgs[2].getType().cast<MemRefType>());
+      auto refWrapper = createGPUWrapper(module, KernelIF(refKernel),
+                                         /*numReadOnly=*/2);
+      b.create<func::CallOp>(loc, refWrapper, refArgs);
     } else { // if (validationType == "cpu")
       // Emit call to host_<conv>
       auto cpuConvFunc = createCPUConvFunc(module, genConfig);
-      b.create<func::CallOp>(loc, cpuConvFunc, valVars);
+      if (validationSample.getValue() > 0) {
+        // The slices the reference skips hold the results, which then
+        // compare equal
+        emitMemcpy(b, localVars[outIdx], valVars[outIdx]);
+        int seed = std::get<2>(getRandomTestData(outIdx));
+        auto sampleFunc = makeFuncDecl(module, "mcpuSampleSlices",
+                                       {b.getIntegerType(64),
+                                        b.getIntegerType(32)});
+        b.create<func::CallOp>(
+            loc, sampleFunc,
+            ValueRange{b.create<arith::ConstantIntOp>(
+                           loc, validationSample.getValue(), 64),
+                       getI32Val(seed)});
+      }
+      std::string cachePath = getReferenceCachePath(genConfig);
+      if (cachePath.empty())
+        b.create<func::CallOp>(loc, cpuConvFunc, valVars);
+      else
+        emitCachedReference(b, module, cpuConvFunc, valVars, outIdx,
+                            cachePath);
     }
 
     // Emit call to verifier
@@ -1784,35 +2988,217 @@ populateHostHarnessLogic(ModuleOp &module,
   return success();
 }
 
+static void loadDialects(MLIRContext &context) {
+  context.loadDialect<miopen::MIOpenDialect, func::FuncDialect, scf::SCFDialect,
+                      AffineDialect, memref::MemRefDialect, math::MathDialect,
+                      arith::ArithmeticDialect, vector::VectorDialect,
+                      gpu::GPUDialect>();
+}
+
+// Check that the problem `conv2dGenerator` was set up with can be generated
+// and validated as requested.
+static LogicalResult checkApplicable(miopen::Conv2dGenerator &conv2dGenerator) {
+  // TODO: Extract isApplicable check to be its own component
+  if (failed(conv2dGenerator.isApplicable())) {
+    llvm::errs() << "Convolution configuration not applicable\n";
+    return failure();
+  }
+  // The verifiers take the tensors of the convolution alone.
+  if (phaseTiming.getValue() && !genValidation.getValue().empty()) {
+    llvm::errs() << "-phase-timing cannot be combined with a verifier\n";
+    return failure();
+  }
+  // The reference kernel of -pv_with_gpu has no 8-bit float arithmetic.
+  if (conv2dGenerator.getFp8Format().hasValue() &&
+      genValidation.getValue() == "gpu") {
+    llvm::errs() << "fp8 convolutions can only be validated on the CPU\n";
+    return failure();
+  }
+  return success();
+}
+
+// Populate `module` with the kernels of `conv2dGenerator`, unless it holds
+// user kernels already, then with the host harness if requested.
+static LogicalResult populateModule(ModuleOp module,
+                                    miopen::Conv2dGenerator &conv2dGenerator,
+                                    bool hasUserKernel) {
+  OpBuilder builder(module.getContext());
+  SmallVector<KernelIF, 8> kernels;
+  auto testFuncNameVal = testFuncName.getValue();
+  const auto &genConfig = conv2dGenerator.getConfig();
+
+  if (!hasUserKernel) {
+    conv2dGenerator.selectSolver(builder);
+    if (genCPUKernel.getValue()) {
+      (void)createCPUConvFunc(module, genConfig);
+    } else {
+      // Populate the module.
+      int kernelStart = genConfig.kernelId;
+      int kernelCount = conv2dGenerator.getKernelCount(builder);
+      if (kernelStart < 0) {
+        kernelStart = 0;
+      } else {
+        kernelCount = kernelStart + 1;
+      }
+      // generate all sub-kernels, and get corresponding gemmId
+      std::string kernelBaseName = genConfig.kernelBaseName;
+      for (int i = kernelStart; i < kernelCount; ++i) {
+        conv2dGenerator.setKernelName(kernelBaseName + "_" + std::to_string(i));
+        if (failed(conv2dGenerator.genConvModule(module, i))) {
+          llvm::errs() << "Module population failed.\n";
+          return failure();
+        }
+      }
+      conv2dGenerator.setKernelName(kernelBaseName);
+    }
+  }
+
+  // Compute set of call-graph root nodes;  they're the ones we need to
+  // call from main().  Start with all nodes, then erase the ones that
+  // have edges to them.  Use SetVector because we want to preserve the
+  // order to match an older implementation.
+  CallGraph cg(module);
+  mlir::SetVector<CallGraphNode *> roots(cg.begin(), cg.end());
+  for (auto &node : roots)
+    for (auto &edge : *node)
+      roots.remove(edge.getTarget());
+
+  // Make KernelIFs for the roots, to pass to populateHostHarnessLogic().
+  SmallVector<KernelIF, 8> rootIFs;
+  for (auto node : roots) {
+    func::FuncOp func =
+        dyn_cast<func::FuncOp>(node->getCallableRegion()->getParentOp());
+    rootIFs.emplace_back(func);
+  }
+
+  if (testFuncNameVal.empty()) {
+    module.walk([&](func::FuncOp func) -> WalkResult {
+      if (func->hasAttr("kernel")) {
+        kernels.emplace_back(func);
+      }
+      return WalkResult::advance();
+    });
+  } else {
+    auto func = module.lookupSymbol<func::FuncOp>(testFuncName);
+    assert(func);
+    rootIFs.clear();
+    kernels.emplace_back(func);
+    rootIFs.emplace_back(func);
+  }
+
+  // populate host logic.
+  if (genHostHarness.getValue()) {
+    if (failed(populateHostHarnessLogic(module, kernels, rootIFs, genConfig))) {
+      llvm::errs() << "Host logic populated failed.\n";
+      return failure();
+    }
+  }
+  return success();
+}
+
+// Generate the problem of the --conv-config `arguments` into the file
+// `path`, in a context of its own so that problems can be generated in
+// parallel.
+static LogicalResult generateProblem(const DialectRegistry &registry,
+                                     const std::string &arguments,
+                                     StringRef path) {
+  MLIRContext context(registry, MLIRContext::Threading::DISABLED);
+  loadDialects(context);
+  OwningOpRef<ModuleOp> module = ModuleOp::create(UnknownLoc::get(&context));
+  miopen::Conv2dGenerator conv2dGenerator;
+  if (failed(conv2dGenerator.parseConvConfig(arguments.c_str())) ||
+      failed(checkApplicable(conv2dGenerator)) ||
+      failed(populateModule(*module, conv2dGenerator,
+                            /*hasUserKernel=*/false)))
+    return failure();
+
+  std::string errorMessage;
+  auto output = openOutputFile(path, &errorMessage);
+  if (!output) {
+    llvm::errs() << errorMessage << "\n";
+    return failure();
+  }
+  module->print(output->os());
+  output->keep();
+  return success();
+}
+
+// Generate each line of --conv-config-file into <n>.mlir in the -o
+// directory, n counting the problems of the file from 0, on a thread pool.
+// This saves a process, with its registrations, per problem.
+static int generateBatch(const DialectRegistry &registry) {
+  auto file = MemoryBuffer::getFile(convConfigFile, /*IsText=*/true);
+  if (!file) {
+    llvm::errs() << "Could not open " << convConfigFile << ": "
+                 << file.getError().message() << "\n";
+    return 1;
+  }
+  std::vector<std::string> problems;
+  SmallVector<StringRef, 16> lines;
+  (*file)->getBuffer().split(lines, '\n', -1, /*KeepEmpty=*/false);
+  for (StringRef line : lines) {
+    line = line.trim();
+    if (!line.empty() && !line.startswith("#"))
+      problems.push_back(line.str());
+  }
+  if (outputFilename.getValue() == "-") {
+    llvm::errs() << "--conv-config-file needs an output directory, pass -o\n";
+    return 1;
+  }
+  if (std::error_code error =
+          sys::fs::create_directories(outputFilename.getValue())) {
+    llvm::errs() << "Could not create " << outputFilename << ": "
+                 << error.message() << "\n";
+    return 1;
+  }
+
+  ThreadPool pool(hardware_concurrency(numThreads));
+  std::atomic<unsigned> numFailed(0);
+  for (auto &en : llvm::enumerate(problems)) {
+    SmallString<128> path(outputFilename.getValue());
+    sys::path::append(path, std::to_string(en.index()) + ".mlir");
+    pool.async([&registry, &numFailed, problem = en.value(),
+                path = std::string(path)]() {
+      if (failed(generateProblem(registry, problem, path))) {
+        llvm::errs() << "Could not generate " << problem << "\n";
+        ++numFailed;
+      }
+    });
+  }
+  pool.wait();
+
+  if (numFailed)
+    llvm::errs() << numFailed << " of " << problems.size()
+                 << " problems could not be generated\n";
+  return numFailed ? 1 : 0;
+}
+
 int main(int argc, char **argv) {
   DialectRegistry registry;
-  registerAllDialects(registry);
+  registerMIOpenFlowDialects(registry);
 #ifdef MLIR_INCLUDE_TESTS
   test::registerTestDialect(registry);
 #endif
-  MLIRContext context(registry);
-  context.loadDialect<miopen::MIOpenDialect, func::FuncDialect, scf::SCFDialect,
-                      AffineDialect, memref::MemRefDialect, math::MathDialect,
-                      arith::ArithmeticDialect, vector::VectorDialect,
-                      gpu::GPUDialect>();
 
   // Parse pass names in main to ensure static initialization completed.
   cl::ParseCommandLineOptions(argc, argv,
                               "MLIR MIOpen Dialect host generation\n");
 
-  OpBuilder builder(&context);
-  ModuleOp module;
-
   verifyLayout();
   correctParameters();
   populateDefaults();
 
-  miopen::Conv2dGenerator conv2dGenerator;
+  if (!convConfigFile.empty())
+    return generateBatch(registry);
 
-  SmallVector<KernelIF, 8> kernels;
+  MLIRContext context(registry);
+  loadDialects(context);
+  OpBuilder builder(&context);
+  ModuleOp module;
 
-  auto testFuncNameVal = testFuncName.getValue();
-  bool hasUserKernel = !testFuncNameVal.empty();
+  miopen::Conv2dGenerator conv2dGenerator;
+
+  bool hasUserKernel = !testFuncName.getValue().empty();
 
   std::string errorMessage;
   auto inputFilenameStr = inputFilename.getValue();
@@ -1877,90 +3263,37 @@ int main(int argc, char **argv) {
           paddingWidthLeft.getValue(), paddingWidthRight.getValue(),
           filterLayout.getValue(), inputLayout.getValue(),
           outputLayout.getValue());
+      conv2dGenerator.setSplitK(splitK.getValue());
+      conv2dGenerator.setWinogradTile(winogradTile.getValue());
+      conv2dGenerator.setSingleLaunch(singleLaunch.getValue());
+      conv2dGenerator.setDilationPhases(dilationPhases.getValue());
+      conv2dGenerator.setAutoSolver(autoSolver.getValue());
+      conv2dGenerator.setDeterministic(deterministic.getValue());
+      conv2dGenerator.setReduceKBlocks(reduceKBlocks.getValue());
+      conv2dGenerator.setFusedReduction(fusedReduction.getValue());
+      conv2dGenerator.setFp8Scale(fp8Scale.getValue());
+      conv2dGenerator.setXf32(xf32.getValue());
+      conv2dGenerator.setPhaseTiming(phaseTiming.getValue());
+      conv2dGenerator.setDepthParams(
+          dilationDepth.getValue(), strideDepth.getValue(),
+          paddingDepthLeft.getValue(), paddingDepthRight.getValue());
 
       status = conv2dGenerator.parseConvDims(
           batchSize, groupSize, inputChannel, inputHeight, inputWidth,
-          outputChannel, outputHeight, outputWidth, filterHeight, filterWidth);
+          outputChannel, outputHeight, outputWidth, filterHeight, filterWidth,
+          inputDepth, outputDepth, filterDepth);
       if (failed(status)) {
         llvm::errs() << "Could not parse convolution dimensions\n";
         exit(1);
       }
     }
 
-    // TODO: Extract isApplicable check to be its own component
-    if (failed(conv2dGenerator.isApplicable())) {
-      llvm::errs() << "Convolution configuration not applicable\n";
+    if (failed(checkApplicable(conv2dGenerator)))
       exit(1);
-    }
-  }
-
-  const auto &genConfig = conv2dGenerator.getConfig();
-
-  if (!hasUserKernel) {
-    if (genCPUKernel.getValue()) {
-      (void)createCPUConvFunc(module, genConfig);
-    } else {
-      // Populate the module.
-      int kernelStart = genConfig.kernelId;
-      int kernelCount = conv2dGenerator.getKernelCount(builder);
-      if (kernelStart < 0) {
-        kernelStart = 0;
-      } else {
-        kernelCount = kernelStart + 1;
-      }
-      // generate all sub-kernels, and get corresponding gemmId
-      std::string kernelBaseName = genConfig.kernelBaseName;
-      for (int i = kernelStart; i < kernelCount; ++i) {
-        conv2dGenerator.setKernelName(kernelBaseName + "_" + std::to_string(i));
-        if (failed(conv2dGenerator.genConvModule(module, i))) {
-          llvm::errs() << "Module population failed.\n";
-          exit(1);
-        }
-      }
-      conv2dGenerator.setKernelName(kernelBaseName);
-    }
-  }
-
-  // Compute set of call-graph root nodes;  they're the ones we need to
-  // call from main().  Start with all nodes, then erase the ones that
-  // have edges to them.  Use SetVector because we want to preserve the
-  // order to match an older implementation.
-  CallGraph cg(module);
-  mlir::SetVector<CallGraphNode *> roots(cg.begin(), cg.end());
-  for (auto &node : roots)
-    for (auto &edge : *node)
-      roots.remove(edge.getTarget());
-
-  // Make KernelIFs for the roots, to pass to populateHostHarnessLogic().
-  SmallVector<KernelIF, 8> rootIFs;
-  for (auto node : roots) {
-    func::FuncOp func =
-        dyn_cast<func::FuncOp>(node->getCallableRegion()->getParentOp());
-    rootIFs.emplace_back(func);
   }
 
-  if (testFuncNameVal.empty()) {
-    module.walk([&](func::FuncOp func) -> WalkResult {
-      if (func->hasAttr("kernel")) {
-        kernels.emplace_back(func);
-      }
-      return WalkResult::advance();
-    });
-  } else {
-    auto func = module.lookupSymbol<func::FuncOp>(testFuncName);
-    assert(func);
-    rootIFs.clear();
-    kernels.emplace_back(func);
-    rootIFs.emplace_back(func);
-  }
-
-  // populate host logic.
-  if (genHostHarness.getValue()) {
-    if (failed(populateHostHarnessLogic(module, kernels, rootIFs, genConfig))) {
-      llvm::errs() << "Host logic populated failed.\n";
-      exit(1);
-    }
-  }
+  if (failed(populateModule(module, conv2dGenerator, hasUserKernel)))
+    exit(1);
 
   // Set up the output file.
   auto output = openOutputFile(outputFilename, &errorMessage);
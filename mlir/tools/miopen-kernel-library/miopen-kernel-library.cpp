@@ -0,0 +1,101 @@
+//===- miopen-kernel-library.cpp - MIOpen kernel library builder ----------===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Builds the kernel library the MIOpen library reads from MIIR_KERNEL_LIBRARY
+// out of a list of problems, one miirCreateHandle options string per line,
+// for each of a list of targets. Every kernel of a problem is built, as
+// MIOpen asks for them by --kernel_id.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Miir.h"
+#include "mlir/Support/FileUtilities.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace mlir;
+
+static cl::opt<std::string> inputFilename(cl::Positional,
+                                          cl::desc("<problem list>"),
+                                          cl::init("-"));
+
+static cl::opt<std::string> outputFilename("o", cl::desc("Output filename"),
+                                           cl::value_desc("filename"),
+                                           cl::Required);
+
+static cl::list<std::string>
+    targets("target",
+            cl::desc("Options added to every problem for one target, such "
+                     "as \"--arch gfx908 --num_cu 120 --x2 1\". Without "
+                     "any, the problems are built as listed"),
+            cl::value_desc("options"), cl::ZeroOrMore);
+
+int main(int argc, char **argv) {
+  InitLLVM y(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "MIOpen prebuilt kernel library builder\n");
+
+  std::string errorMessage;
+  std::unique_ptr<MemoryBuffer> input =
+      openInputFile(inputFilename, &errorMessage);
+  if (!input) {
+    errs() << errorMessage << "\n";
+    return 1;
+  }
+
+  std::vector<std::string> targetOptions(targets.begin(), targets.end());
+  if (targetOptions.empty())
+    targetOptions.emplace_back();
+
+  SmallVector<StringRef> lines;
+  input->getBuffer().split(lines, '\n', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+  std::vector<std::string> problems;
+  for (StringRef line : lines) {
+    line = line.trim();
+    if (line.empty() || line.startswith("#"))
+      continue;
+    for (const std::string &target : targetOptions) {
+      std::string problem = line.str() + " " + target;
+      if (line.contains("--kernel_id")) {
+        problems.push_back(problem);
+        continue;
+      }
+      MiirHandle handle = miirCreateHandle(problem.c_str());
+      if (handle == nullptr) {
+        errs() << "invalid or inapplicable problem: " << problem << "\n";
+        return 1;
+      }
+      int kernelCount = miirGetKernelCount(handle);
+      miirDestroyHandle(handle);
+      for (int i = 0; i < kernelCount; ++i)
+        problems.push_back(problem + " --kernel_id " + std::to_string(i));
+    }
+  }
+
+  std::vector<const char *> options;
+  for (const std::string &problem : problems)
+    options.push_back(problem.c_str());
+  MiirStatus status =
+      miirBuildKernelLibrary(options.data(), static_cast<int>(options.size()),
+                             outputFilename.c_str());
+  if (status != MIIR_SUCCESS) {
+    errs() << "failed to build the kernel library of " << problems.size()
+           << " kernels\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,55 @@
+//===- miopen-perfdb-convert.cpp - MIOpen perf db converter ---------------===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Converts the MIOpen SQLite perf db into the binary perf db format read by
+// the tuning library in builds without SQLite. Given several SQLite perf dbs,
+// such as the user dbs of the nodes of a tuning cluster, merges them into one
+// binary perf db, keeping the fastest entry each tuner measured for each
+// problem and solver and, between untimed entries, that of the first db.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/MIOpen/Tuning/BinaryPerfDb.h"
+#include "mlir/Support/FileUtilities.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace mlir;
+
+static cl::list<std::string> inputFilenames(cl::Positional,
+                                            cl::desc("<sqlite perf db>..."),
+                                            cl::OneOrMore);
+
+static cl::opt<std::string> outputFilename("o", cl::desc("Output filename"),
+                                           cl::value_desc("filename"),
+                                           cl::init("-"));
+
+int main(int argc, char **argv) {
+  InitLLVM y(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "MIOpen SQLite to binary perf db converter and "
+                              "merger\n");
+
+  std::string errorMessage;
+  std::unique_ptr<ToolOutputFile> output =
+      openOutputFile(outputFilename, &errorMessage);
+  if (!output) {
+    errs() << errorMessage << "\n";
+    return 1;
+  }
+
+  if (failed(miopen::mergeSQLitePerfDbs(inputFilenames, output->os(), errs())))
+    return 1;
+
+  output->keep();
+  return 0;
+}
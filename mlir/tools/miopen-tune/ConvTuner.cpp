@@ -0,0 +1,435 @@
+//===- ConvTuner.cpp - Compile and time convolution candidates ------------===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "ConvTuner.h"
+
+#include "mlir/Dialect/GPU/Transforms/Passes.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
+#include "mlir/Dialect/MIOpen/MIOpen.h"
+#include "mlir/Dialect/MIOpen/Pipelines.h"
+#include "mlir/ExecutionEngine/DeviceInfo.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/InitMIOpenTargets.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <atomic>
+#include <thread>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#include "hip/hip_runtime.h"
+#pragma GCC diagnostic pop
+
+using namespace mlir;
+using namespace mlir::miopen;
+using namespace llvm;
+
+namespace {
+// One kernel of a compiled candidate.
+struct KernelBinary {
+  std::string name;
+  std::string hsaco;
+  uint32_t blockSize;
+  uint32_t gridSize;
+};
+
+struct CompiledCandidate {
+  std::string perfConfig;
+  std::vector<KernelBinary> kernels;
+  // The arguments of the kernels, which may differ from those of the problem
+  // by their workspace.
+  SmallVector<MemRefType, 4> argTypes;
+  bool valid = false;
+};
+} // namespace
+
+static bool checkHip(hipError_t status, StringRef what) {
+  if (status == hipSuccess)
+    return true;
+  errs() << what << " failed: " << hipGetErrorString(status) << "\n";
+  return false;
+}
+
+void mlir::miopen::initializeTunerTargets() { initializeMIOpenTargets(); }
+
+LogicalResult
+mlir::miopen::genConvKernels(const Conv2dGenerator::Config &config,
+                             ModuleOp module, bool ignoreTuning,
+                             int kernelId) {
+  Conv2dGenerator generator(config);
+  OpBuilder builder(module.getContext());
+  int kernelCount = generator.getKernelCount(builder);
+  if (kernelId >= kernelCount)
+    return failure();
+  for (int i = 0; i < kernelCount; ++i) {
+    if (kernelId >= 0 && i != kernelId)
+      continue;
+    generator.setKernelName(config.kernelBaseName + "_" + std::to_string(i));
+    if (failed(generator.genConvModule(module, i, /*is_verifier=*/false,
+                                       ignoreTuning)))
+      return failure();
+  }
+  return success();
+}
+
+Operation *
+mlir::miopen::findConvOp(ModuleOp module,
+                         SmallVectorImpl<MemRefType> &argTypes) {
+  Operation *convOp = nullptr;
+  module->walk([&](func::FuncOp func) {
+    if (convOp)
+      return;
+    func.walk([&](Operation *op) {
+      if (isa<Conv2DOp, Conv3DOp, Conv2DBwdDataOp, Conv2DBwdWeightOp,
+              GemmOp>(op))
+        convOp = op;
+    });
+    if (convOp)
+      for (Type type : func.getFunctionType().getInputs())
+        argTypes.push_back(type.cast<MemRefType>());
+  });
+  return convOp;
+}
+
+// Print the untuned kernels of the convolution, which are the same for all
+// GEMM candidates of a problem, for every candidate to start from. Returns
+// an empty string if the kernels could not be generated.
+static std::string snapshotConvKernels(const DialectRegistry &registry,
+                                       const Conv2dGenerator::Config &config,
+                                       int kernelId) {
+  MLIRContext context(registry, MLIRContext::Threading::DISABLED);
+  context.loadDialect<MIOpenDialect, func::FuncDialect>();
+  OwningOpRef<ModuleOp> module = ModuleOp::create(UnknownLoc::get(&context));
+  if (failed(genConvKernels(config, *module, /*ignoreTuning=*/true, kernelId)))
+    return "";
+  std::string snapshot;
+  llvm::raw_string_ostream os(snapshot);
+  module->print(os, OpPrintingFlags().printGenericOpForm());
+  return os.str();
+}
+
+// Whether `perfConfig` picks a Winograd algorithm, whose kernels differ from
+// those of the GEMM candidates.
+static bool isWinogradPerfConfig(StringRef perfConfig) {
+  return llvm::any_of(Conv2dGenerator::getWinogradTiles(), [&](int tile) {
+    return perfConfig == Conv2dGenerator::getWinogradPerfConfig(tile);
+  });
+}
+
+// The kernels of the convolution tuned with `perfConfig`: `snapshot` with the
+// perf_config attached the way the generator does, or newly generated ones
+// for Winograd candidates and when there is no snapshot.
+static OwningOpRef<ModuleOp>
+loadCandidateKernels(MLIRContext &context, StringRef snapshot,
+                     Conv2dGenerator::Config config,
+                     const std::string &perfConfig, int kernelId) {
+  if (snapshot.empty() || isWinogradPerfConfig(perfConfig)) {
+    OwningOpRef<ModuleOp> module = ModuleOp::create(UnknownLoc::get(&context));
+    config.perfConfig = perfConfig;
+    if (failed(genConvKernels(config, *module, /*ignoreTuning=*/false,
+                              kernelId)))
+      return nullptr;
+    return module;
+  }
+
+  OwningOpRef<ModuleOp> module =
+      parseSourceString<ModuleOp>(snapshot, &context);
+  if (!module || perfConfig.empty())
+    return module;
+  auto perfConfigAttr = StringAttr::get(&context, perfConfig);
+  module->walk([&](Operation *op) {
+    if (isa<Conv2DOp, Conv3DOp, Conv2DBwdDataOp, Conv2DBwdWeightOp>(op) &&
+        !op->hasAttr("winograd_tile"))
+      op->setAttr("perf_config", perfConfigAttr);
+  });
+  return module;
+}
+
+// Compile all kernels of the convolution with `perfConfig`, or only kernel
+// `kernelId` if not negative, starting from `snapshot` if not empty. Every
+// candidate gets its own context so candidates compile concurrently.
+static CompiledCandidate compileCandidate(const DialectRegistry &registry,
+                                          StringRef snapshot,
+                                          const Conv2dGenerator::Config &config,
+                                          const std::string &perfConfig,
+                                          int kernelId) {
+  CompiledCandidate result;
+  result.perfConfig = perfConfig;
+
+  MLIRContext context(registry, MLIRContext::Threading::DISABLED);
+  context.loadDialect<MIOpenDialect, func::FuncDialect>();
+  // Invalid candidates are expected; keep their diagnostics quiet.
+  context.getDiagEngine().registerHandler([](Diagnostic &) {});
+
+  OwningOpRef<ModuleOp> module =
+      loadCandidateKernels(context, snapshot, config, perfConfig, kernelId);
+  if (!module || !findConvOp(*module, result.argTypes))
+    return result;
+
+  PassManager pm(&context, PassManager::Nesting::Implicit);
+  buildKernelPipeline(pm);
+  BackendOptions opts;
+  opts.triple = config.triple;
+  opts.chip = config.chip;
+  opts.features = config.features;
+  buildBackendPipeline(pm, opts);
+  if (failed(pm.run(*module)))
+    return result;
+
+  module->walk([&](gpu::GPUModuleOp gpuModule) {
+    auto hsacoAttr = gpuModule->getAttrOfType<StringAttr>(
+        gpu::getDefaultGpuBinaryAnnotation());
+    if (!hsacoAttr)
+      return;
+    gpuModule.walk([&](LLVM::LLVMFuncOp func) {
+      auto blockSize = func->getAttrOfType<IntegerAttr>("block_size");
+      auto gridSize = func->getAttrOfType<IntegerAttr>("grid_size");
+      if (!blockSize || !gridSize)
+        return;
+      result.kernels.push_back(
+          {func.getName().str(), hsacoAttr.getValue().str(),
+           static_cast<uint32_t>(blockSize.getInt()),
+           static_cast<uint32_t>(gridSize.getInt())});
+    });
+  });
+  result.valid = !result.kernels.empty();
+  return result;
+}
+
+// Pack the kernel arguments: the ROCDL lowering expands every memref into
+// its allocated and aligned pointers followed by the 32-bit offset, sizes and
+// strides of a contiguous descriptor.
+static std::vector<char> packKernelArguments(ArrayRef<void *> buffers,
+                                             ArrayRef<MemRefType> types) {
+  std::vector<char> args;
+  auto append = [&](const void *data, size_t size) {
+    args.resize(alignTo(args.size(), size));
+    const char *bytes = static_cast<const char *>(data);
+    args.insert(args.end(), bytes, bytes + size);
+  };
+  for (auto it : llvm::zip(buffers, types)) {
+    void *ptr = std::get<0>(it);
+    ArrayRef<int64_t> shape = std::get<1>(it).getShape();
+    append(&ptr, sizeof(ptr));
+    append(&ptr, sizeof(ptr));
+    int32_t offset = 0;
+    append(&offset, sizeof(offset));
+    for (int64_t size : shape) {
+      int32_t size32 = size;
+      append(&size32, sizeof(size32));
+    }
+    int32_t stride = 1;
+    SmallVector<int32_t, 5> strides(shape.size());
+    for (size_t i = shape.size(); i > 0; --i) {
+      strides[i - 1] = stride;
+      stride *= shape[i - 1];
+    }
+    for (int32_t s : strides)
+      append(&s, sizeof(s));
+  }
+  return args;
+}
+
+// Average time in milliseconds of one run of all kernels of `candidate`, or
+// None if the kernels could not be launched.
+static Optional<double> benchmarkCandidate(const CompiledCandidate &candidate,
+                                           ArrayRef<char> kernelArgs,
+                                           hipStream_t stream,
+                                           const ConvTunerOptions &options) {
+  SmallVector<hipModule_t, 2> modules;
+  SmallVector<hipFunction_t, 2> functions;
+  auto unload = [&]() {
+    for (hipModule_t module : modules)
+      (void)hipModuleUnload(module);
+  };
+  for (const KernelBinary &kernel : candidate.kernels) {
+    hipModule_t module;
+    hipFunction_t function;
+    if (!checkHip(hipModuleLoadData(&module, kernel.hsaco.data()),
+                  "hipModuleLoadData")) {
+      unload();
+      return llvm::None;
+    }
+    modules.push_back(module);
+    if (!checkHip(hipModuleGetFunction(&function, module, kernel.name.c_str()),
+                  "hipModuleGetFunction")) {
+      unload();
+      return llvm::None;
+    }
+    functions.push_back(function);
+  }
+
+  std::vector<char> args(kernelArgs.begin(), kernelArgs.end());
+  size_t argsSize = args.size();
+  void *launchConfig[] = {HIP_LAUNCH_PARAM_BUFFER_POINTER, args.data(),
+                          HIP_LAUNCH_PARAM_BUFFER_SIZE, &argsSize,
+                          HIP_LAUNCH_PARAM_END};
+  auto launchAll = [&]() {
+    for (size_t i = 0, e = functions.size(); i < e; ++i) {
+      const KernelBinary &kernel = candidate.kernels[i];
+      if (!checkHip(hipModuleLaunchKernel(functions[i], kernel.gridSize, 1, 1,
+                                          kernel.blockSize, 1, 1, 0, stream,
+                                          nullptr, launchConfig),
+                    "hipModuleLaunchKernel"))
+        return false;
+    }
+    return true;
+  };
+
+  Optional<double> time;
+  hipEvent_t start, stop;
+  if (checkHip(hipEventCreate(&start), "hipEventCreate")) {
+    if (checkHip(hipEventCreate(&stop), "hipEventCreate")) {
+      bool ok = true;
+      for (unsigned i = 0; ok && i < options.warmupIterations; ++i)
+        ok = launchAll();
+      ok = ok && checkHip(hipEventRecord(start, stream), "hipEventRecord");
+      for (unsigned i = 0; ok && i < options.timedIterations; ++i)
+        ok = launchAll();
+      ok = ok && checkHip(hipEventRecord(stop, stream), "hipEventRecord") &&
+           checkHip(hipEventSynchronize(stop), "hipEventSynchronize");
+      float elapsedMs = 0.0f;
+      if (ok && checkHip(hipEventElapsedTime(&elapsedMs, start, stop),
+                         "hipEventElapsedTime"))
+        time = static_cast<double>(elapsedMs) /
+               std::max<unsigned>(options.timedIterations, 1);
+      (void)hipEventDestroy(stop);
+    }
+    (void)hipEventDestroy(start);
+  }
+  unload();
+  return time;
+}
+
+// Allocate a zero-filled device buffer for a memref of `type`.
+static void *allocateBuffer(MemRefType type) {
+  size_t bytes =
+      type.getNumElements() * divideCeil(type.getElementTypeBitWidth(), 8);
+  void *buffer = nullptr;
+  if (!checkHip(hipMalloc(&buffer, bytes), "hipMalloc"))
+    return nullptr;
+  if (!checkHip(hipMemset(buffer, 0, bytes), "hipMemset")) {
+    (void)hipFree(buffer);
+    return nullptr;
+  }
+  return buffer;
+}
+
+// Time the candidates on `device`, pulling the next one to measure from
+// `next` so several devices share the work.
+static void benchmarkOnDevice(int device,
+                              ArrayRef<std::shared_future<CompiledCandidate>>
+                                  candidates,
+                              ArrayRef<MemRefType> argTypes,
+                              std::atomic<size_t> &next,
+                              MutableArrayRef<Optional<double>> times,
+                              const ConvTunerOptions &options) {
+  if (!checkHip(hipSetDevice(device), "hipSetDevice"))
+    return;
+  hipStream_t stream;
+  if (!checkHip(hipStreamCreate(&stream), "hipStreamCreate"))
+    return;
+
+  // The problem fixes the arguments, so buffers are shared by all candidates.
+  // Timing does not depend on the data; zero-filled buffers are enough.
+  SmallVector<void *, 4> buffers;
+  bool ok = true;
+  for (MemRefType type : argTypes) {
+    void *buffer = allocateBuffer(type);
+    ok = buffer != nullptr;
+    if (!ok)
+      break;
+    buffers.push_back(buffer);
+  }
+
+  if (ok) {
+    for (size_t i = next++; i < candidates.size(); i = next++) {
+      const CompiledCandidate &candidate = candidates[i].get();
+      if (!candidate.valid)
+        continue;
+      // Arguments the problem does not have, such as the workspace of a
+      // Winograd candidate, get buffers of their own.
+      SmallVector<void *, 4> candidateBuffers;
+      SmallVector<void *, 1> ownBuffers;
+      for (auto it : llvm::enumerate(candidate.argTypes)) {
+        size_t j = it.index();
+        if (j < argTypes.size() && argTypes[j] == it.value()) {
+          candidateBuffers.push_back(buffers[j]);
+          continue;
+        }
+        void *buffer = allocateBuffer(it.value());
+        if (!buffer)
+          break;
+        ownBuffers.push_back(buffer);
+        candidateBuffers.push_back(buffer);
+      }
+      if (candidateBuffers.size() == candidate.argTypes.size())
+        times[i] = benchmarkCandidate(
+            candidate,
+            packKernelArguments(candidateBuffers, candidate.argTypes), stream,
+            options);
+      for (void *buffer : ownBuffers)
+        (void)hipFree(buffer);
+    }
+  }
+
+  for (void *buffer : buffers)
+    (void)hipFree(buffer);
+  (void)hipStreamDestroy(stream);
+}
+
+SmallVector<int, 4> mlir::miopen::getTuningDevices(StringRef chip,
+                                                   ArrayRef<int> deviceIds) {
+  SmallVector<int, 4> devices;
+  for (int device = 0, count = getDeviceCount(); device < count; ++device) {
+    if (!deviceIds.empty() && !llvm::is_contained(deviceIds, device))
+      continue;
+    const DeviceInfo *info = getDeviceInfo(device);
+    if (info && info->chip == chip)
+      devices.push_back(device);
+  }
+  return devices;
+}
+
+std::vector<Optional<double>> mlir::miopen::benchmarkPerfConfigs(
+    const DialectRegistry &registry, ThreadPool &pool,
+    const Conv2dGenerator::Config &config, ArrayRef<std::string> perfConfigs,
+    ArrayRef<MemRefType> argTypes, ArrayRef<int> devices,
+    const ConvTunerOptions &options) {
+  // The kernels are generated once for the problem; candidates only differ
+  // by their perf_config from there on.
+  int kernelId = options.kernelId;
+  std::string snapshot = snapshotConvKernels(registry, config, kernelId);
+  std::vector<std::shared_future<CompiledCandidate>> candidates;
+  candidates.reserve(perfConfigs.size());
+  for (const std::string &perfConfig : perfConfigs)
+    candidates.push_back(
+        pool.async([&registry, &snapshot, config, perfConfig, kernelId]() {
+          return compileCandidate(registry, snapshot, config, perfConfig,
+                                  kernelId);
+        }));
+
+  // Benchmark as candidates finish compiling, one thread per device.
+  std::atomic<size_t> next(0);
+  std::vector<Optional<double>> times(candidates.size());
+  std::vector<std::thread> workers;
+  for (int device : devices)
+    workers.emplace_back([&, device]() {
+      benchmarkOnDevice(device, candidates, argTypes, next, times, options);
+    });
+  for (std::thread &worker : workers)
+    worker.join();
+  // Candidates left behind by failing devices still read the snapshot.
+  for (const std::shared_future<CompiledCandidate> &candidate : candidates)
+    candidate.wait();
+  return times;
+}
@@ -0,0 +1,80 @@
+//===- ConvTuner.h - Compile and time convolution candidates ----*- C++ -*-===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the tuning machinery shared by miopen-tune and the
+// online tuning mode of the MIOpen library: compiling a convolution with a
+// given perf_config and timing its kernels on the GPUs of the target chip.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TOOLS_MIOPEN_TUNE_CONVTUNER_H
+#define MLIR_TOOLS_MIOPEN_TUNE_CONVTUNER_H
+
+#include "mlir/Dialect/MIOpen/Generator/Conv2dGenerator.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/BuiltinTypes.h"
+#include "mlir/IR/DialectRegistry.h"
+#include "mlir/Support/LogicalResult.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/ThreadPool.h"
+
+#include <string>
+#include <vector>
+
+namespace mlir {
+namespace miopen {
+
+struct ConvTunerOptions {
+  /// Untimed launches before measuring a candidate.
+  unsigned warmupIterations = 3;
+  /// Timed launches averaged for each candidate.
+  unsigned timedIterations = 10;
+  /// The only kernel of the problem compiled and timed, all of them if
+  /// negative.
+  int kernelId = -1;
+};
+
+/// Initialize the LLVM targets the backend pipeline needs.
+void initializeTunerTargets();
+
+/// Generate every kernel of the convolution described by `config` into
+/// `module`, or only kernel `kernelId` if it is not negative.
+LogicalResult genConvKernels(const Conv2dGenerator::Config &config,
+                             ModuleOp module, bool ignoreTuning,
+                             int kernelId = -1);
+
+/// The convolution of the first kernel in `module`, or nullptr if there is
+/// none. The argument types of that kernel are appended to `argTypes`.
+Operation *findConvOp(ModuleOp module,
+                      llvm::SmallVectorImpl<MemRefType> &argTypes);
+
+/// GPUs of `chip` to benchmark on, restricted to `deviceIds` unless empty.
+llvm::SmallVector<int, 4> getTuningDevices(llvm::StringRef chip,
+                                           llvm::ArrayRef<int> deviceIds = {});
+
+/// Compile each of `perfConfigs` for the convolution `config` on `pool` and
+/// time it on `devices` as soon as it is compiled. `argTypes` are the
+/// arguments of the problem; candidates with other arguments, such as a
+/// different workspace, get buffers of their own for those. Returns the
+/// average time in milliseconds of one run of all kernels of each candidate,
+/// or of the kernel `options` selects, None for the candidates that did not
+/// compile or run.
+std::vector<llvm::Optional<double>> benchmarkPerfConfigs(
+    const DialectRegistry &registry, llvm::ThreadPool &pool,
+    const Conv2dGenerator::Config &config,
+    llvm::ArrayRef<std::string> perfConfigs,
+    llvm::ArrayRef<MemRefType> argTypes, llvm::ArrayRef<int> devices,
+    const ConvTunerOptions &options);
+
+} // namespace miopen
+} // namespace mlir
+
+#endif // MLIR_TOOLS_MIOPEN_TUNE_CONVTUNER_H
@@ -0,0 +1,315 @@
+//===- miopen-tune.cpp - MIOpen exhaustive tuning driver ------------------===//
+//
+// Part of the MLIR Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Tunes convolutions exhaustively: every perf_config the tuning library
+// accepts for a problem is compiled on a thread pool, the resulting kernels
+// are timed on the available GPUs, and the fastest perf_config is written to
+// a user perf db in the schema SQLitePerfDb reads. The kernels of a strided
+// backward data convolution are tuned one by one, and so is the single kernel
+// that can replace them.
+//
+// Convolutions are described with the same arguments miopen-gen and
+// miirCreateHandle take, e.g.
+//
+//   miopen-tune --perf-db user.db --conv-config "--operation conv2d
+//     --arch gfx908 --num_cu 120 -x2 -t f16 --fil_layout kcyx ..."
+//
+//===----------------------------------------------------------------------===//
+
+#include "ConvTuner.h"
+
+#include "mlir/Dialect/MIOpen/Generator/Conv2dGenerator.h"
+#include "mlir/Dialect/MIOpen/MIOpen.h"
+#include "mlir/Dialect/MIOpen/Tuning/GridwiseGemmParams.h"
+#include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/InitMIOpenDialects.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <sstream>
+
+using namespace mlir;
+using namespace llvm;
+
+static cl::list<std::string>
+    convConfigs("conv-config",
+                cl::desc("Convolution to tune, in miopen-gen syntax"),
+                cl::value_desc("arguments"), cl::ZeroOrMore);
+
+static cl::opt<std::string>
+    convConfigFile("conv-config-file",
+                   cl::desc("File with one convolution to tune per line"),
+                   cl::value_desc("filename"), cl::init(""));
+
+static cl::opt<std::string>
+    perfDbPath("perf-db", cl::desc("User perf db receiving the winners"),
+               cl::value_desc("filename"), cl::Required);
+
+static cl::opt<unsigned>
+    numThreads("j", cl::desc("Number of compiler threads (0: one per core)"),
+               cl::init(0));
+
+static cl::list<int>
+    deviceIds("devices",
+              cl::desc("GPUs to benchmark on (default: all of the target "
+                       "chip)"),
+              cl::CommaSeparated, cl::ZeroOrMore);
+
+static cl::opt<unsigned>
+    warmupIterations("warmup",
+                     cl::desc("Untimed launches before measuring a config"),
+                     cl::init(3));
+
+static cl::opt<unsigned>
+    timedIterations("iterations",
+                    cl::desc("Timed launches averaged for each config"),
+                    cl::init(10));
+
+static cl::opt<bool> verbose("v", cl::desc("Print the time of every config"),
+                             cl::init(false));
+
+namespace {
+// The fastest candidate for some kernels of a problem.
+struct TuningResult {
+  std::string perfConfig;
+  double timeMs;
+  // The fastest Winograd candidate and its time, when it beats the GEMM one.
+  Optional<std::pair<std::string, double>> winograd;
+  size_t numMeasured;
+  size_t numCandidates;
+};
+} // namespace
+
+// Tunes the kernels of `config`, or only kernel `kernelId` if it is not
+// negative, and stores the fastest GEMM candidate for them in the perf db.
+// Where it applies, Winograd is timed against the GEMM candidates. Only the
+// latter go to the perf db, whose entries are GEMM parameters; a faster
+// Winograd is returned with the perf_config that selects it.
+static Optional<TuningResult>
+tuneKernels(const std::string &arguments,
+            const miopen::Conv2dGenerator::Config &config, int kernelId,
+            const DialectRegistry &registry, ThreadPool &pool,
+            ArrayRef<int> devices) {
+  // Enumerate the tuning space on the untuned kernels of the problem.
+  MLIRContext context(registry);
+  context.loadDialect<miopen::MIOpenDialect, func::FuncDialect>();
+  OwningOpRef<ModuleOp> module = ModuleOp::create(UnknownLoc::get(&context));
+  if (failed(miopen::genConvKernels(config, *module, /*ignoreTuning=*/true,
+                                    kernelId))) {
+    errs() << "Module population failed for " << arguments << "\n";
+    return llvm::None;
+  }
+  SmallVector<MemRefType, 4> argTypes;
+  Operation *convOp = miopen::findConvOp(*module, argTypes);
+  if (!convOp) {
+    errs() << "No convolution generated for " << arguments << "\n";
+    return llvm::None;
+  }
+
+  std::vector<std::string> perfConfigs;
+  auto addConfigs = [&](const auto &space) {
+    for (const auto &params : space) {
+      std::ostringstream os;
+      params.serialize(os);
+      perfConfigs.push_back(os.str());
+    }
+  };
+  if (config.xdlops)
+    addConfigs(miopen::PopulateParamsXDL().getTuningSpace(convOp));
+  else
+    addConfigs(miopen::PopulateParams().getTuningSpace(convOp));
+  if (perfConfigs.empty()) {
+    errs() << "No valid perf_config for " << arguments << "\n";
+    return llvm::None;
+  }
+  size_t numGemmConfigs = perfConfigs.size();
+  OpBuilder builder(&context);
+  if (miopen::Conv2dGenerator(config).supportsWinograd(builder))
+    for (int tile : miopen::Conv2dGenerator::getWinogradTiles())
+      perfConfigs.push_back(
+          miopen::Conv2dGenerator::getWinogradPerfConfig(tile));
+
+  miopen::ConvTunerOptions options;
+  options.warmupIterations = warmupIterations;
+  options.timedIterations = timedIterations;
+  options.kernelId = kernelId;
+  std::vector<Optional<double>> times = miopen::benchmarkPerfConfigs(
+      registry, pool, config, perfConfigs, argTypes, devices, options);
+
+  Optional<size_t> best, bestWinograd;
+  size_t numMeasured = 0;
+  for (size_t i = 0, e = times.size(); i < e; ++i) {
+    if (!times[i])
+      continue;
+    ++numMeasured;
+    if (verbose)
+      outs() << "  " << perfConfigs[i] << ": " << *times[i] << " ms\n";
+    Optional<size_t> &bestOfKind = i < numGemmConfigs ? best : bestWinograd;
+    if (!bestOfKind || *times[i] < *times[*bestOfKind])
+      bestOfKind = i;
+  }
+  if (!best) {
+    errs() << "None of the " << perfConfigs.size()
+           << " candidates could be run for " << arguments << "\n";
+    return llvm::None;
+  }
+  if (failed(miopen::storeTuningParameters(perfDbPath, convOp,
+                                           perfConfigs[*best], times[*best]))) {
+    errs() << "Could not store the result in " << perfDbPath << "\n";
+    return llvm::None;
+  }
+
+  TuningResult result{perfConfigs[*best], *times[*best], llvm::None,
+                      numMeasured, perfConfigs.size()};
+  if (bestWinograd && *times[*bestWinograd] < *times[*best])
+    result.winograd = std::make_pair(perfConfigs[*bestWinograd],
+                                     *times[*bestWinograd]);
+  return result;
+}
+
+// Tunes a strided backward data convolution as a whole. Its GEMMs, one per
+// phase of the input, differ in GemmK and so in the parameters that suit
+// them. Launched separately, they take the sum of their times, so each
+// kernel is tuned on its own and stored in the perf db entries of its GEMM.
+// The single kernel computing them all is tuned and stored as well, and the
+// faster launch mode for the whole convolution is reported.
+static LogicalResult tuneBackwardData(const std::string &arguments,
+                                      miopen::Conv2dGenerator::Config config,
+                                      int numGemms,
+                                      const DialectRegistry &registry,
+                                      ThreadPool &pool, ArrayRef<int> devices) {
+  outs() << arguments << "\n";
+  config.singleLaunch = false;
+  Optional<double> separateMs = 0.0;
+  for (int kernel = 0; kernel < numGemms; ++kernel) {
+    Optional<TuningResult> result =
+        tuneKernels(arguments, config, kernel, registry, pool, devices);
+    if (!result) {
+      separateMs = llvm::None;
+      continue;
+    }
+    outs() << "  kernel " << kernel << " best perf_config "
+           << result->perfConfig << ": " << result->timeMs << " ms ("
+           << result->numMeasured << " of " << result->numCandidates
+           << " candidates measured)\n";
+    if (separateMs)
+      *separateMs += result->timeMs;
+  }
+
+  config.singleLaunch = true;
+  Optional<TuningResult> single =
+      tuneKernels(arguments, config, /*kernelId=*/-1, registry, pool, devices);
+  if (single)
+    outs() << "  single launch best perf_config " << single->perfConfig
+           << ": " << single->timeMs << " ms (" << single->numMeasured
+           << " of " << single->numCandidates << " candidates measured)\n";
+  if (!separateMs && !single)
+    return failure();
+
+  if (separateMs)
+    outs() << "  " << numGemms << " separate launches: " << *separateMs
+           << " ms\n";
+  if (separateMs && single)
+    outs() << "  "
+           << (single->timeMs < *separateMs ? "single launch"
+                                             : "separate launches")
+           << " is faster\n";
+  // Kernels that could not be tuned keep whatever the perf db had.
+  return success(separateMs.hasValue() && single.hasValue());
+}
+
+static LogicalResult tuneProblem(const std::string &arguments,
+                                 const DialectRegistry &registry,
+                                 ThreadPool &pool) {
+  miopen::Conv2dGenerator generator;
+  if (failed(generator.parseConvConfig(arguments.c_str())) ||
+      failed(generator.isApplicable())) {
+    errs() << "Convolution configuration not applicable: " << arguments
+           << "\n";
+    return failure();
+  }
+  const miopen::Conv2dGenerator::Config &config = generator.getConfig();
+
+  SmallVector<int, 4> allowedDevices(deviceIds.begin(), deviceIds.end());
+  SmallVector<int, 4> devices =
+      miopen::getTuningDevices(config.chip, allowedDevices);
+  if (devices.empty()) {
+    errs() << "No " << config.chip << " GPU to tune " << arguments << "\n";
+    return failure();
+  }
+
+  if (config.operation == miopen::ConvOpType::BwdData && !config.kernelId) {
+    int numGemms =
+        miopen::populateBackwardDataGemmIds(
+            config.strideHeight, config.strideWidth, config.dilationHeight,
+            config.dilationWidth, config.filterHeight, config.filterWidth)
+            .size();
+    if (numGemms > 1)
+      return tuneBackwardData(arguments, config, numGemms, registry, pool,
+                              devices);
+  }
+
+  Optional<TuningResult> result = tuneKernels(
+      arguments, config, /*kernelId=*/-1, registry, pool, devices);
+  if (!result)
+    return failure();
+  outs() << arguments << "\n  best perf_config " << result->perfConfig
+         << ": " << result->timeMs << " ms (" << result->numMeasured << " of "
+         << result->numCandidates << " candidates measured)\n";
+  if (result->winograd)
+    outs() << "  Winograd is faster with perf_config "
+           << result->winograd->first << ": " << result->winograd->second
+           << " ms\n";
+  return success();
+}
+
+int main(int argc, char **argv) {
+  InitLLVM y(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "MIOpen exhaustive tuning driver\n");
+
+  std::vector<std::string> problems(convConfigs.begin(), convConfigs.end());
+  if (!convConfigFile.empty()) {
+    auto file = MemoryBuffer::getFile(convConfigFile, /*IsText=*/true);
+    if (!file) {
+      errs() << "Could not open " << convConfigFile << ": "
+             << file.getError().message() << "\n";
+      return 1;
+    }
+    SmallVector<StringRef, 16> lines;
+    (*file)->getBuffer().split(lines, '\n', -1, /*KeepEmpty=*/false);
+    for (StringRef line : lines) {
+      line = line.trim();
+      if (!line.empty() && !line.startswith("#"))
+        problems.push_back(line.str());
+    }
+  }
+  if (problems.empty()) {
+    errs() << "Nothing to tune, pass --conv-config or --conv-config-file\n";
+    return 1;
+  }
+
+  miopen::initializeTunerTargets();
+  DialectRegistry registry;
+  registerMIOpenFlowDialects(registry);
+
+  ThreadPool pool(hardware_concurrency(numThreads));
+  int numFailed = 0;
+  for (const std::string &problem : problems)
+    if (failed(tuneProblem(problem, registry, pool)))
+      ++numFailed;
+
+  if (numFailed)
+    errs() << numFailed << " of " << problems.size()
+           << " problems could not be tuned\n";
+  return numFailed ? 1 : 0;
+}
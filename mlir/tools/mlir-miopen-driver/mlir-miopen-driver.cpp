@@ -15,7 +15,9 @@
 #include "mlir/Dialect/Bufferization/IR/Bufferization.h"
 #include "mlir/Dialect/Func/IR/FuncOps.h"
 #include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/MIOpen/CompileProfile.h"
 #include "mlir/Dialect/MIOpen/Generator/Conv2dGenerator.h"
+#include "mlir/Dialect/MIOpen/KernelReport.h"
 #include "mlir/Dialect/MIOpen/MIOpen.h"
 #include "mlir/Dialect/MIOpen/Passes.h"
 #include "mlir/Dialect/MIOpen/Pipelines.h"
@@ -26,14 +28,17 @@
 #include "mlir/IR/Location.h"
 #include "mlir/IR/MLIRContext.h"
 #include "mlir/IR/Operation.h"
+#include "mlir/IR/OwningOpRef.h"
+#include "mlir/IR/SymbolTable.h"
 #include "mlir/IR/Types.h"
-#include "mlir/InitAllDialects.h"
 #include "mlir/InitAllPasses.h"
+#include "mlir/InitMIOpenDialects.h"
 #include "mlir/Parser/Parser.h"
 #include "mlir/Pass/Pass.h"
 #include "mlir/Pass/PassManager.h"
 #include "mlir/Support/FileUtilities.h"
 #include "mlir/Support/LogicalResult.h"
+#include "mlir/Translation/ModuleArchive.h"
 
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/InitLLVM.h"
@@ -69,6 +74,42 @@ static cl::opt<std::string>
                                 "partition,highlevel,execmodel or full"),
                  cl::init(""));
 
+static cl::opt<bool> horizontalFusion(
+    "horizontal-fusion",
+    cl::desc("Merge independent small kernels into one launch when "
+             "partitioning"),
+    cl::init(false));
+
+static cl::opt<bool> absorbHostOps(
+    "absorb-host-ops",
+    cl::desc("Move small ops left in host functions into adjacent kernels "
+             "when partitioning"),
+    cl::init(false));
+
+static cl::opt<std::string> mixedPrecision(
+    "mixed-precision",
+    cl::desc("Run f32 convolutions and matmuls in f16 or bf16 when "
+             "partitioning"),
+    cl::value_desc("f16 or bf16"), cl::init(""));
+
+static cl::opt<bool> memoryPlanning(
+    "memory-planning",
+    cl::desc("Share one arena among intermediate buffers of kernel launches"),
+    cl::init(true));
+
+static cl::opt<bool> fastMath(
+    "fast-math",
+    cl::desc("Approximate f32 square roots of elementwise ops when "
+             "bufferizing"),
+    cl::init(false));
+
+static cl::opt<bool> fusePooling(
+    "fuse-pooling",
+    cl::desc("Fuse non-overlapping average pooling into convolution kernels "
+             "when partitioning and bufferizing; their pooled results must "
+             "come in zeroed"),
+    cl::init(false));
+
 static cl::opt<bool> legacyMiopenPipeline("c", cl::Hidden, cl::init(false),
                                           cl::Optional,
                                           cl::cb<void, bool>([](bool v) {
@@ -98,6 +139,17 @@ static cl::opt<std::string> features("feature", cl::desc("target features"),
                                      cl::value_desc("AMDGPU target features"),
                                      cl::init(""));
 
+static cl::opt<bool> barePtrKernelArgs(
+    "bare-ptr-kernel-args",
+    cl::desc("Pass statically shaped memrefs to kernels as bare pointers"),
+    cl::init(false));
+
+static cl::opt<bool> stripKernels(
+    "strip-kernels",
+    cl::desc("Keep only the binary and kernel declarations of each compiled "
+             "gpu.module (false: keep its ROCDL IR for inspection)"),
+    cl::init(true));
+
 static cl::opt<int> blockSize("block_size",
                               cl::desc("Override block size for tuning"),
                               cl::value_desc("Block size"), cl::init(0));
@@ -106,6 +158,47 @@ static cl::opt<int> gridSize("grid_size",
                              cl::desc("Override grid size for tuning"),
                              cl::value_desc("Grid size"), cl::init(0));
 
+static cl::opt<int64_t> maxUnrolledOps(
+    "max-unrolled-ops",
+    cl::desc("Keep kernel loops rolled, or unroll them in part, where "
+             "unrolling them in full gives more ops than this, to compile "
+             "faster (0: no limit)"),
+    cl::value_desc("ops"), cl::init(0));
+
+static cl::opt<bool> fastCompile(
+    "fast-compile",
+    cl::desc("Build kernels for compile time over speed: unroll little, skip "
+             "optional optimizations and compile at -gO 1 at most"),
+    cl::init(false));
+
+static cl::opt<std::string> compileProfileFilename(
+    "compile-profile",
+    cl::desc("Write where the compile time goes, per phase, pass and kernel, "
+             "to the given file"),
+    cl::value_desc("filename"), cl::init(""));
+
+static cl::opt<std::string> compileProfileFormat(
+    "compile-profile-format",
+    cl::desc("Format of the compile profile: json, or trace for the Chrome "
+             "trace event format"),
+    cl::value_desc("format"), cl::init("json"));
+
+static cl::opt<std::string> kernelReportFilename(
+    "kernel-report",
+    cl::desc("Write the chip, perf config, tuning source and resources of "
+             "every kernel compiled, with the compiler revision, to the "
+             "given file as JSON"),
+    cl::value_desc("filename"), cl::init(""));
+
+static cl::opt<bool> emitModuleArchive(
+    "emit-module-archive",
+    cl::desc("Write the output as a module archive, which later stages read "
+             "faster and in part, rather than as MLIR"),
+    cl::init(false));
+
+// Profile of the pipelines run, when one is asked for.
+static std::unique_ptr<miopen::CompileProfile> compileProfile;
+
 namespace test {
 void registerTestDialect(DialectRegistry &);
 } // namespace test
@@ -134,54 +227,37 @@ parsePipeline(StringRef pipeline, llvm::SmallDenseSet<StringRef> &pipelineSet,
   return success();
 }
 
-static LogicalResult runMLIRPasses(ModuleOp &module,
-                                   mlir::PassPipelineCLParser &passPipeline) {
-  llvm::SmallDenseSet<StringRef> kernelPipelineOptions{"applicability", "gpu",
-                                                       "rocdl", "binary"};
-  llvm::SmallDenseSet<StringRef> kernelFullPipeline{"gpu", "binary"};
-  llvm::SmallDenseSet<StringRef> kernelPipelineSet;
-  if (failed(parsePipeline(kernelPipeline.getValue(), kernelPipelineSet,
-                           kernelPipelineOptions, kernelFullPipeline))) {
-    return failure();
-  }
-
-  llvm::SmallDenseSet<StringRef> hostPipelineOptions{"partition", "highlevel",
-                                                     "xmodel"};
-  llvm::SmallDenseSet<StringRef> hostPipelineSet;
-  if (failed(parsePipeline(hostPipeline.getValue(), hostPipelineSet,
-                           hostPipelineOptions, hostPipelineOptions))) {
-    return failure();
-  }
-
-  // Run partitioning pipeline.
-  if (hostPipelineSet.contains("partition")) {
-    PassManager pm(module.getContext(), PassManager::Nesting::Implicit);
-    applyPassManagerCLOptions(pm);
-
-    miopen::PartitionOptions opts;
-    opts.cloneToMIOpenModule = !cpuOnly.getValue();
-    miopen::buildPartitionPipeline(pm, opts);
-
-    if (failed(pm.run(module))) {
-      return failure();
-    }
-  }
-
-  // Find kernel module, defaults to top module
-  auto kernelModule =
-      module.lookupSymbol<ModuleOp>(miopen::MIOpenDialect::kKernelModuleName);
-  if (!kernelModule) {
-    kernelModule = module;
-  }
-
-  PassManager pm(kernelModule.getContext(), PassManager::Nesting::Implicit);
+// Set up `pm` to run `phase` of the lowering.
+static void setupPassManager(PassManager &pm, StringRef phase) {
   applyPassManagerCLOptions(pm);
+  if (compileProfile)
+    compileProfile->attach(pm, phase);
+}
+
+// Lower `kernelModule` through the kernel pipelines requested, for `chip`,
+// passing over the `skipHeuristicConfigs` best default configs.
+static LogicalResult
+runKernelPipelinesOnce(ModuleOp kernelModule, StringRef chip, bool isHighLevel,
+                       const llvm::SmallDenseSet<StringRef> &kernelPipelineSet,
+                       mlir::PassPipelineCLParser &passPipeline,
+                       int skipHeuristicConfigs) {
+  // Each phase runs in a pass manager of its own, for the compile profile to
+  // tell them apart.
+  MLIRContext *ctx = kernelModule.getContext();
+  PassManager bufferizePm(ctx, PassManager::Nesting::Implicit);
+  setupPassManager(bufferizePm, "bufferize");
+  PassManager kernelPm(ctx, PassManager::Nesting::Implicit);
+  setupPassManager(kernelPm, "kernel");
+  PassManager backendPm(ctx, PassManager::Nesting::Implicit);
+  setupPassManager(backendPm, "backend");
 
-  bool isHighLevel = hostPipelineSet.contains("highlevel");
   if (isHighLevel) {
     miopen::BufferizeOptions opts;
     opts.disableMIOpen = cpuOnly.getValue();
-    miopen::buildBufferizePipeline(pm, opts);
+    opts.memoryPlanning = memoryPlanning.getValue();
+    opts.fastMath = fastMath.getValue();
+    opts.fusePooling = fusePooling.getValue();
+    miopen::buildBufferizePipeline(bufferizePm, opts);
   }
 
   // Set up lowering pipeline.
@@ -216,16 +292,21 @@ static LogicalResult runMLIRPasses(ModuleOp &module,
     if (kernelPipelineSet.contains("applicability")) {
       miopen::KernelOptions opts;
       opts.enableApplicability = true;
-      miopen::buildKernelPipeline(pm, opts);
+      miopen::buildKernelPipeline(kernelPm, opts);
     }
     if (kernelPipelineSet.contains("gpu")) {
       // Set up the default lowering pipeline which goes down to GPU dialect.
-      miopen::buildKernelPipeline(pm);
+      miopen::KernelOptions opts;
+      opts.maxUnrolledOps = maxUnrolledOps.getValue();
+      opts.fastCompile = fastCompile.getValue();
+      opts.skipHeuristicConfigs = skipHeuristicConfigs;
+      miopen::buildKernelPipeline(kernelPm, opts);
     }
     if (kernelPipelineSet.contains("rocdl")) {
       // Set up the lowering pipeline which goes down to ROCDL dialect.
-      pm.addPass(createLowerGpuOpsToROCDLOpsPass(/*chipset=*/targetChip,
-                                                 /*indexBitWidth=*/32));
+      backendPm.addPass(createLowerGpuOpsToROCDLOpsPass(
+          /*chipset=*/chip.str(), /*indexBitWidth=*/32,
+          gpu::amd::Runtime::Unknown, barePtrKernelArgs));
     }
     if (kernelPipelineSet.contains("binary")) {
       // Set up the lowering pipeline which goes down to ELF Binary
@@ -237,10 +318,13 @@ static LogicalResult runMLIRPasses(ModuleOp &module,
 
       miopen::BackendOptions opts;
       opts.triple = tripleName.getValue();
-      opts.chip = targetChip.getValue();
+      opts.chip = chip.str();
       opts.features = features.getValue();
       opts.optLevel = optLevel;
-      miopen::buildBackendPipeline(pm, opts);
+      opts.barePtrCallConv = barePtrKernelArgs;
+      opts.fastCompile = fastCompile.getValue();
+      opts.stripKernels = stripKernels.getValue();
+      miopen::buildBackendPipeline(backendPm, opts);
     }
   } else {
     auto errorHandler = [&](const Twine &msg) {
@@ -249,19 +333,157 @@ static LogicalResult runMLIRPasses(ModuleOp &module,
     };
 
     // Use lowering pipeline specified at command line.
-    if (failed(passPipeline.addToPipeline(pm, errorHandler)))
+    if (failed(passPipeline.addToPipeline(kernelPm, errorHandler)))
       return failure();
   }
 
-  if (failed(pm.run(kernelModule))) {
+  for (PassManager *pm : {&bufferizePm, &kernelPm, &backendPm})
+    if (!pm->empty() && failed(pm->run(kernelModule)))
+      return failure();
+  return success();
+}
+
+// Lower `kernelModule` through the kernel pipelines requested, for `chip`.
+// When they go down to binaries, kernels whose default config spills are
+// rebuilt with the next ones the heuristics rank.
+static LogicalResult
+runKernelPipelines(ModuleOp kernelModule, StringRef chip, bool isHighLevel,
+                   const llvm::SmallDenseSet<StringRef> &kernelPipelineSet,
+                   mlir::PassPipelineCLParser &passPipeline) {
+  bool canRetry = kernelPipelineSet.contains("gpu") &&
+                  kernelPipelineSet.contains("binary");
+  OwningOpRef<ModuleOp> original;
+  if (canRetry)
+    original = kernelModule.clone();
+
+  if (failed(runKernelPipelinesOnce(kernelModule, chip, isHighLevel,
+                                    kernelPipelineSet, passPipeline, 0)))
     return failure();
+  if (!canRetry)
+    return success();
+
+  // Keep the last build once no default config is left to try.
+  for (int skip = 1; skip <= miopen::kMaxSpillRetries &&
+                     miopen::hasHeuristicSpills(kernelModule);
+       ++skip) {
+    OwningOpRef<ModuleOp> retry = original->clone();
+    if (failed(runKernelPipelinesOnce(*retry, chip, isHighLevel,
+                                      kernelPipelineSet, passPipeline, skip)))
+      break;
+    kernelModule->setAttrs(retry->getOperation()->getAttrDictionary());
+    kernelModule.getBody()->clear();
+    kernelModule.getBody()->getOperations().splice(
+        kernelModule.getBody()->end(), retry->getBody()->getOperations());
+  }
+  return success();
+}
+
+// Retarget the kernels of `kernelModule` to `chip`, dropping xdlops where
+// the chip has none.
+static void setTargetChip(ModuleOp kernelModule, StringRef chip) {
+  StringAttr chipAttr = StringAttr::get(kernelModule.getContext(), chip);
+  bool hasXdlops = chip.startswith("gfx908") || chip.startswith("gfx90a");
+  kernelModule.walk([&](Operation *op) {
+    bool isKernel = isa<func::FuncOp>(op) && op->hasAttr("kernel");
+    if (isKernel || op->hasAttr("arch"))
+      op->setAttr("arch", chipAttr);
+    auto xdlops = op->getAttrOfType<BoolAttr>("xdlopsV2");
+    if (xdlops && xdlops.getValue() && !hasXdlops)
+      op->setAttr("xdlopsV2", BoolAttr::get(op->getContext(), false));
+  });
+}
+
+static LogicalResult runMLIRPasses(ModuleOp &module,
+                                   mlir::PassPipelineCLParser &passPipeline) {
+  llvm::SmallDenseSet<StringRef> kernelPipelineOptions{"applicability", "gpu",
+                                                       "rocdl", "binary"};
+  llvm::SmallDenseSet<StringRef> kernelFullPipeline{"gpu", "binary"};
+  llvm::SmallDenseSet<StringRef> kernelPipelineSet;
+  if (failed(parsePipeline(kernelPipeline.getValue(), kernelPipelineSet,
+                           kernelPipelineOptions, kernelFullPipeline))) {
+    return failure();
+  }
+
+  llvm::SmallDenseSet<StringRef> hostPipelineOptions{"partition", "highlevel",
+                                                     "xmodel"};
+  llvm::SmallDenseSet<StringRef> hostPipelineSet;
+  if (failed(parsePipeline(hostPipeline.getValue(), hostPipelineSet,
+                           hostPipelineOptions, hostPipelineOptions))) {
+    return failure();
+  }
+
+  // Run partitioning pipeline.
+  if (hostPipelineSet.contains("partition")) {
+    PassManager pm(module.getContext(), PassManager::Nesting::Implicit);
+    setupPassManager(pm, "partition");
+
+    miopen::PartitionOptions opts;
+    opts.cloneToMIOpenModule = !cpuOnly.getValue();
+    opts.horizontalFusion = horizontalFusion.getValue();
+    opts.absorbHostOps = absorbHostOps.getValue();
+    opts.fusePooling = fusePooling.getValue();
+    opts.mixedPrecision = mixedPrecision.getValue();
+    miopen::buildPartitionPipeline(pm, opts);
+
+    if (failed(pm.run(module))) {
+      return failure();
+    }
+  }
+
+  // Find kernel module, defaults to top module
+  auto kernelModule =
+      module.lookupSymbol<ModuleOp>(miopen::MIOpenDialect::kKernelModuleName);
+  if (!kernelModule) {
+    kernelModule = module;
+  }
+
+  bool isHighLevel = hostPipelineSet.contains("highlevel");
+
+  // Kernels for several chips are each compiled from a copy of the kernel
+  // module taken before lowering, and gathered in the kernel module.
+  SmallVector<StringRef, 2> chips;
+  StringRef(targetChip.getValue())
+      .split(chips, ',', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+  if (chips.empty())
+    chips.push_back("");
+  SmallVector<OwningOpRef<ModuleOp>, 2> chipModules;
+  if (chips.size() > 1) {
+    if (kernelModule == module) {
+      llvm::errs() << "Several target chips need a partitioned kernel "
+                      "module\n";
+      return failure();
+    }
+    for (StringRef chip : llvm::drop_begin(chips)) {
+      chipModules.emplace_back(kernelModule.clone());
+      setTargetChip(*chipModules.back(), chip);
+    }
+    setTargetChip(kernelModule, chips.front());
+  }
+
+  if (failed(runKernelPipelines(kernelModule, chips.front(), isHighLevel,
+                                kernelPipelineSet, passPipeline)))
+    return failure();
+  for (auto pair : llvm::zip(llvm::drop_begin(chips), chipModules)) {
+    StringRef chip = std::get<0>(pair);
+    ModuleOp chipModule = *std::get<1>(pair);
+    if (failed(runKernelPipelines(chipModule, chip, isHighLevel,
+                                  kernelPipelineSet, passPipeline)))
+      return failure();
+    for (auto gpuMod :
+         llvm::make_early_inc_range(chipModule.getOps<gpu::GPUModuleOp>())) {
+      SymbolTable::setSymbolName(gpuMod,
+                                 (gpuMod.getName() + "_" + chip).str());
+      gpuMod->remove();
+      kernelModule.push_back(gpuMod);
+    }
   }
 
   if (isHighLevel && kernelModule != module) {
     PassManager pm(module.getContext(), PassManager::Nesting::Implicit);
-    applyPassManagerCLOptions(pm);
+    setupPassManager(pm, "host-bufferize");
     miopen::BufferizeOptions opts;
     opts.disableMIOpen = true;
+    opts.fastMath = fastMath.getValue();
     miopen::buildBufferizePipeline(pm, opts);
 
     if (failed(pm.run(module))) {
@@ -271,7 +493,7 @@ static LogicalResult runMLIRPasses(ModuleOp &module,
 
   if (hostPipelineSet.contains("xmodel")) {
     PassManager pm(module.getContext());
-    applyPassManagerCLOptions(pm);
+    setupPassManager(pm, "xmodel");
     pm.addPass(miopen::createMIOpenApplyImplPass());
     if (failed(pm.run(module))) {
       return failure();
@@ -283,7 +505,7 @@ static LogicalResult runMLIRPasses(ModuleOp &module,
 
 int main(int argc, char **argv) {
   DialectRegistry registry;
-  registerAllDialects(registry);
+  registerMIOpenFlowDialects(registry);
 #ifdef MLIR_INCLUDE_TESTS
   test::registerTestDialect(registry);
 #endif
@@ -319,21 +541,51 @@ int main(int argc, char **argv) {
     exit(1);
   }
 
-  // Parse the input file.
+  // Parse the input file, which may also be a module archive.
   sourceMgr.AddNewSourceBuffer(std::move(file), SMLoc());
-  moduleRef = parseSourceFile<mlir::ModuleOp>(sourceMgr, &context);
+  moduleRef = miopen::parseModuleOrArchive(sourceMgr, &context);
   if (!moduleRef) {
     llvm::errs() << "Parse host harness " << inputFilename << " failed.\n";
     exit(1);
   }
   module = moduleRef.get();
 
+  Optional<miopen::CompileProfile::Format> profileFormat =
+      miopen::CompileProfile::parseFormat(compileProfileFormat);
+  if (!profileFormat) {
+    llvm::errs() << "Invalid compile profile format: " << compileProfileFormat
+                 << "\n";
+    exit(1);
+  }
+  if (!compileProfileFilename.empty())
+    compileProfile = std::make_unique<miopen::CompileProfile>();
+
   // Run MLIR passes with passed in tuning parameters
   if (failed(runMLIRPasses(module, passPipeline))) {
     llvm::errs() << "Lowering failed.\n";
     exit(1);
   }
 
+  if (compileProfile) {
+    auto profileOutput = openOutputFile(compileProfileFilename, &errorMessage);
+    if (!profileOutput) {
+      llvm::errs() << errorMessage << "\n";
+      exit(1);
+    }
+    compileProfile->print(profileOutput->os(), *profileFormat);
+    profileOutput->keep();
+  }
+
+  if (!kernelReportFilename.empty()) {
+    auto reportOutput = openOutputFile(kernelReportFilename, &errorMessage);
+    if (!reportOutput) {
+      llvm::errs() << errorMessage << "\n";
+      exit(1);
+    }
+    miopen::printKernelReport(module, reportOutput->os());
+    reportOutput->keep();
+  }
+
   // Set up the output file.
   auto output = openOutputFile(outputFilename, &errorMessage);
   if (!output) {
@@ -341,7 +593,14 @@ int main(int argc, char **argv) {
     exit(1);
   }
 
-  module.print(output->os());
+  if (emitModuleArchive) {
+    if (failed(miopen::writeModuleArchive(module, output->os()))) {
+      llvm::errs() << "Writing the module archive failed.\n";
+      exit(1);
+    }
+  } else {
+    module.print(output->os());
+  }
   output->keep();
   return 0;
 }
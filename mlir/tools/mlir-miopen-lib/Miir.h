@@ -13,7 +13,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define MIIR_VERSION_FLAT 5
+#define MIIR_VERSION_FLAT 6
 
 enum MiirStatus {
   MIIR_SUCCESS = 0,
@@ -42,11 +42,112 @@ struct StridedMemRef5D {
 };
 
 /*! @brief Create the MLIR handle according to options string
+ *         In builds with HIP, setting MIIR_ONLINE_TUNING_DB to the path of a
+ *         user perf db enables online tuning: a problem with no entry in
+ *         that db is built with heuristic parameters, and the fastest of its
+ *         MIIR_ONLINE_TUNING_CANDIDATES (default 8) best ranked perf_configs
+ *         is searched in the background, stored in the db and used by later
+ *         handles of the problem.
+ *         Setting MIIR_SHARED_PERF_DBS to a colon-separated list of binary
+ *         perf dbs, such as those miopen-perfdb-convert merges from the user
+ *         dbs of several tuning nodes, looks problems up in them after the
+ *         online tuning db and before the system perf dbs, in list order.
+ *         The list is read once, by the first handle created.
+ *         Handles are built in a pool of MIIR_CONTEXT_POOL_SIZE (default 1)
+ *         MLIR contexts, or of one per hardware thread if it is 0. Calls on
+ *         handles of the same context are serialized, so a larger pool lets
+ *         independent handles be lowered on several threads at once.
+ *         As a context only grows, setting MIIR_CONTEXT_RECYCLE to N has a
+ *         context replaced by a fresh one once N handles were created in it
+ *         and none is left, bounding the memory of long-running processes.
+ *         Setting MIIR_BATCH_TILE to B builds forward and backward data
+ *         problems with the batch outermost in their input and output, and
+ *         a batch size N that B divides, as N / B launches of the kernels
+ *         of batch size B, so that every such batch size reuses the same
+ *         kernels and binaries. See miirGetBatchLaunches.
+ *         Such problems whose input or output exceeds the 2 GiB kernels
+ *         address with 32 bits are split the same way, into the fewest
+ *         launches over slices that fit, whatever MIIR_BATCH_TILE is.
+ *         Setting MIIR_BATCH_BUCKET_WASTE to a fraction W has such problems
+ *         padded to the batch size of their bucket, the next multiple of
+ *         MIIR_BATCH_TILE or else the next power of two, when their binary
+ *         is in neither the kernel library nor the binary cache and at most
+ *         W of the padded work is padding. See miirGetPaddedBatchSize.
+ *         Passing --auto_solver 1 has forward problems without a
+ *         perf_config lowered with the solver of the lowest estimated cost
+ *         among the implicit GEMM, split-K, Winograd and dilation phases,
+ *         instead of the one the split_k, winograd and dilation_phases
+ *         options ask for, which changes the kernel count and workspace.
+ *         Passing --phase_timing 1 gives the kernels a last argument, a
+ *         4096x5 buffer of i64 their gemms write clock readings to, and is
+ *         only meant for profiling. See kPhaseTimesAttrName.
+ *         All functions are reentrant and may be called concurrently from
+ *         any threads, without locking on the caller's side, except that a
+ *         handle must not be destroyed while it is still in use.
  *  @param options Command-line options as a string
  *  @return        MLIR handle
  */
 extern "C" MiirHandle miirCreateHandle(const char *options);
 
+/*! @brief Convolution problem, the structured form of the options of
+ *         miirCreateHandle. Strings are only read during handle creation.
+ *         Depth sizes and parameters only matter with 6-character layouts.
+ */
+struct MiirConvProblem {
+  /* "conv2d", "conv2d_bwd_data" or "conv2d_bwd_weight" */
+  const char *operation;
+  /* Target as for --arch, e.g. "amdgcn-amd-amdhsa:gfx908" */
+  const char *arch;
+  int numCu;
+  /* Nonzero to use XDLOPS */
+  int xdlops;
+  /* Element type of the tensors: "f32", "f64", "f16", "bf16", "i8", whose
+   * output is i32, or "fp8" or "bf8", whose output is fp32. f64 needs the f64
+   * MFMAs of gfx90a or gfx940. */
+  const char *dataType;
+  /* MIOpen layouts such as "NGCHW", or "NGCDHW" for 3D convolutions */
+  const char *inLayout;
+  const char *filLayout;
+  const char *outLayout;
+  int64_t batchSize;
+  int64_t groupSize;
+  int64_t inChannels;
+  int64_t outChannels;
+  int64_t inH, inW, inD;
+  int64_t outH, outW, outD;
+  int64_t filH, filW, filD;
+  int strideH, strideW, strideD;
+  int dilationH, dilationW, dilationD;
+  int paddingH, paddingW, paddingD;
+  /* Tuning parameters, or nullptr to look them up */
+  const char *perfConfig;
+  /* Kernel name, or nullptr for the default one */
+  const char *kernelName;
+  int kernelId;
+  int splitK;
+  int winogradTile;
+  int singleLaunch;
+  int deterministic;
+  int reduceKBlocks;
+  /* Nonzero to multiply f32 data with the reduced-precision xf32 XDLOPS of
+   * gfx940 */
+  int xf32;
+  /* Nonzero to have reduceKBlocks sum the partial filters in the kernel that
+   * writes them. Its workspace then ends with counters that must be zeroed
+   * once, after its allocation, and that the kernel leaves at zero. */
+  int fusedReduction;
+};
+typedef struct MiirConvProblem MiirConvProblem;
+
+/*! @brief Create the MLIR handle of a convolution problem
+ *         Same as miirCreateHandle, without formatting or parsing options.
+ *  @param problem Convolution problem
+ *  @return        MLIR handle, nullptr if the problem is invalid or not
+ *                 applicable
+ */
+extern "C" MiirHandle
+miirCreateHandleFromProblem(const MiirConvProblem *problem);
+
 /*! @brief Return the number of kernels required for operation
  *  @param handle  MLIR handle
  *  @return        Kernel count
@@ -55,22 +156,154 @@ extern "C" int miirGetKernelCount(MiirHandle handle);
 
 /*! @brief Return the size of workspace required in bytes
   + *         Currently the function will return 0 for most of cases.
-  + *         For fp16 backward weight convolutions, a workspace is required.
+  + *         For fp16 backward weight convolutions, and fp16 forward
+  + *         convolutions with split_k set, a workspace is required.
   + *  @param handle MLIR handle
   + *  @return       Size of workspace required in bytes
   + */
 extern "C" int miirGetWorkspaceSize(MiirHandle handle);
 
+/*! @brief How the workspace of a handle may be placed and shared
+ *         The kernels address the workspace only through their workspace
+ *         argument, so it may be any range of size bytes of a larger
+ *         buffer whose offset is a multiple of alignment: one arena can hold
+ *         the workspaces of all the handles of a model. Its contents only
+ *         matter from the launch of kernel firstKernel to the end of that of
+ *         lastKernel, over all the launches of miirGetBatchLaunches, which
+ *         leave nothing in it for later kernels to read: the handles whose
+ *         kernels run one after the other on a stream can have theirs at the
+ *         same offset. A persistent workspace instead keeps state from one
+ *         launch of the kernels to the next, must be zeroed once after its
+ *         allocation, and must not be shared. So must the workspace of a
+ *         Winograd problem whose filter transform, its first kernel, is
+ *         only run once for constant weights.
+ */
+struct MiirWorkspaceInfo {
+  /* Bytes, 0 without a workspace */
+  size_t size;
+  /* Bytes the offset of the workspace must be a multiple of */
+  size_t alignment;
+  /* Ids of the first and last kernels that use the workspace, -1 without
+   * one */
+  int firstKernel;
+  int lastKernel;
+  /* Nonzero for the counters of fused_reduction */
+  int persistent;
+};
+typedef struct MiirWorkspaceInfo MiirWorkspaceInfo;
+
+/*! @brief Get the size, alignment and lifetime of the workspace
+ *  @param handle MLIR handle
+ *  @param info   Pointer to the workspace information storage
+ */
+extern "C" MiirStatus miirGetWorkspaceInfo(MiirHandle handle,
+                                           MiirWorkspaceInfo *info);
+
 /*! @brief Lower the MLIR module to be able to obtain tuning parameters
+ *         Only the tuning parameters are worked out, without lowering the
+ *         module, which makes the call cheap enough to ask of every problem.
+ *         Fails with MIIR_BUILD_FAILURE when there are no valid tuning
+ *         parameters for the problem. Kernel count and workspace size are
+ *         known from miirCreateHandle on. After miirLowerBin, the execution
+ *         dimensions stay those of the binary it built, including when it
+ *         passed over default configs that spilled.
  *  @param handle MLIR handle
  */
 extern "C" MiirStatus miirLowerTuningParams(MiirHandle mlirHandle);
 
 /*! @brief Lower the MLIR module to binary code
+ *         When MIIR_KERNEL_CACHE_DIR names a directory, the binary and
+ *         execution dimensions of each problem are kept there, and a problem
+ *         lowered before by any process on the node is read back instead of
+ *         compiled. Entries are keyed on the options, the target, the perf
+ *         dbs and the MLIR version; clear the directory after upgrading the
+ *         library within one version.
+ *         Before either, the binary is looked up in the kernel library named
+ *         by MIIR_KERNEL_LIBRARY, if any, which is read once per process.
+ *         When MIIR_COMPILE_PROFILE is set to 1, where the compile time goes
+ *         is recorded for miirGetCompileProfile.
+ *         Setting MIIR_MAX_UNROLLED_OPS to N keeps loops that would unroll
+ *         to more than N ops rolled, or unrolls them in part, which trades
+ *         some kernel speed for compile time.
  *  @param handle MLIR handle
  */
 extern "C" MiirStatus miirLowerBin(MiirHandle handle);
 
+/*! @brief Called with the outcome of miirLowerBinAsync
+ *  @param handle   MLIR handle that was lowered, valid until the callback
+ *                  returns even if the caller destroyed it meanwhile
+ *  @param status   What miirLowerBin would have returned
+ *  @param userData Pointer given to miirLowerBinAsync
+ */
+typedef void (*MiirLowerBinCallback)(MiirHandle handle, MiirStatus status,
+                                     void *userData);
+
+/*! @brief Lower the MLIR module to binary code in the background
+ *         Queues the handle to be lowered as by miirLowerBin on the compile
+ *         pool and returns right away. The pool has MIIR_COMPILE_THREADS
+ *         threads, or one per hardware thread, and miirCreateHandles and
+ *         miirLowerBinBatch share it, so any number of pending compiles
+ *         never oversubscribe the machine. callback is called on a thread
+ *         of the pool once the handle is lowered, after which its results
+ *         are read as after miirLowerBin. Other calls on the handle block
+ *         while it is being lowered. The callback must not wait for later
+ *         asynchronous compiles, which may need its thread.
+ *  @param handle   MLIR handle
+ *  @param callback Function called with the outcome, not nullptr
+ *  @param userData Passed on to callback
+ *  @return         MIIR_SUCCESS if the handle was queued
+ */
+extern "C" MiirStatus miirLowerBinAsync(MiirHandle handle,
+                                        MiirLowerBinCallback callback,
+                                        void *userData);
+
+/*! @brief Create the MLIR handles of many problems at once, on all cores
+ *         Problems with identical options share one handle, which has to be
+ *         destroyed once per problem. A handle is nullptr when its options
+ *         are invalid or not applicable.
+ *  @param options Array of command-line options strings
+ *  @param count   Number of problems
+ *  @param handles Array of count handles to fill
+ *  @return        MIIR_SUCCESS if every handle could be created
+ */
+extern "C" MiirStatus miirCreateHandles(const char **options, int count,
+                                        MiirHandle *handles);
+
+/*! @brief Lower the MLIR modules of many handles to binary code in parallel
+ *         The handles are lowered on the compile pool of
+ *         miirLowerBinAsync, each handle once however often it appears.
+ *         As calls on handles of the same MLIR context are serialized, up
+ *         to MIIR_CONTEXT_POOL_SIZE of them are lowered at a time. The
+ *         results are read per handle as after miirLowerBin.
+ *  @param handles  Array of MLIR handles
+ *  @param count    Number of handles
+ *  @param statuses Array of count statuses of the handles to fill, or
+ *                  nullptr
+ *  @return         MIIR_SUCCESS if every handle was lowered
+ */
+extern "C" MiirStatus miirLowerBinBatch(MiirHandle *handles, int count,
+                                        MiirStatus *statuses);
+
+/*! @brief Build a kernel library of the binaries of many problems
+ *         Each problem is lowered as by miirLowerBin, in parallel, and its
+ *         binary and execution dimensions are written to one archive, keyed
+ *         on the options, the target and the MLIR version. Setting
+ *         MIIR_KERNEL_LIBRARY to the archive then has miirLowerBin take
+ *         those problems from it instead of compiling them, on any target
+ *         the archive was built for. A problem is only found when it is
+ *         created with the same options, in any order, and when the perf
+ *         dbs still give it the tuning parameters it was built with.
+ *  @param options Array of command-line options strings, each with its
+ *                 --arch and --kernel_id
+ *  @param count   Number of problems
+ *  @param path    File to write the archive to
+ *  @return        MIIR_INVALID_PARAM if a problem is invalid or the archive
+ *                 cannot be written, MIIR_BUILD_FAILURE if a problem fails
+ *                 to lower
+ */
+extern "C" MiirStatus miirBuildKernelLibrary(const char **options, int count,
+                                             const char *path);
+
 /*! @brief Populate Conv2d implicitgemm hsaco code object
  *         Client is responsible for the buffer allocation
  *         * First call: client invoke the API with buffer param set to nullptr
@@ -84,6 +317,49 @@ extern "C" MiirStatus miirLowerBin(MiirHandle handle);
 extern "C" MiirStatus miirBufferGet(MiirHandle handle, char *buffer,
                                     size_t *size);
 
+/*! @brief Get the hsaco code object of a lowered handle without copying it
+ *         The code object stays owned by the library and valid until the
+ *         handle is destroyed.
+ *  @param handle MLIR handle
+ *  @param buffer Set to the start of the code object
+ *  @param size   Set to the size of the code object
+ *  @return       MIIR_INVALID_MODULE if the handle was not lowered to binary
+ */
+extern "C" MiirStatus miirBufferView(MiirHandle handle, const char **buffer,
+                                     size_t *size);
+
+/*! @brief Formats of the profile of miirGetCompileProfile
+ */
+enum MiirProfileFormat {
+  /* Totals per phase, pass and kernel, followed by every pass run */
+  MIIR_PROFILE_JSON = 0,
+  /* Every pass run as a Chrome trace event, for chrome://tracing or Perfetto
+   */
+  MIIR_PROFILE_TRACE
+};
+typedef enum MiirProfileFormat MiirProfileFormat;
+
+/*! @brief Get where the compile time of a handle went
+ *         Only recorded by miirLowerBin with MIIR_COMPILE_PROFILE set to 1,
+ *         and only when the binary was compiled rather than read from the
+ *         kernel library or cache. Every pass run of the kernel and backend
+ *         pipelines is listed with its wall time, thread and the number of
+ *         IR ops before and after it, and every kernel with the time spent
+ *         translating to LLVM IR, optimizing, generating code and linking,
+ *         and the sizes of its ISA and binary.
+ *         Client is responsible for the buffer allocation, as with
+ *         miirBufferGet: a first call with buffer set to nullptr sets size,
+ *         a second call copies up to size bytes of the profile to buffer.
+ *  @param handle MLIR handle
+ *  @param format Format of the profile
+ *  @param buffer Buffer to copy the profile to, or nullptr
+ *  @param size   Size of the profile, or of the buffer
+ *  @return       MIIR_INVALID_MODULE if no profile was recorded
+ */
+extern "C" MiirStatus miirGetCompileProfile(MiirHandle handle,
+                                            MiirProfileFormat format,
+                                            char *buffer, size_t *size);
+
 /*! @brief Get the global and local size for Dispatch
  *  @param handle MLIR handle
  *  @param global_size Pointer to global size storage (1 dimension)
@@ -93,7 +369,99 @@ extern "C" MiirStatus miirGetExecutionDims(MiirHandle handle,
                                            size_t *global_size,
                                            size_t *local_size);
 
+/*! @brief Registers, LDS and occupancy of a lowered kernel, as recorded in
+ *         the metadata of its code object
+ */
+struct MiirKernelResources {
+  /* VGPRs, including the AGPRs on gfx90a and gfx94x */
+  int vgprs;
+  int agprs;
+  int sgprs;
+  /* Static LDS of a workgroup, in bytes */
+  size_t ldsSize;
+  /* Private memory of a lane, in bytes */
+  size_t scratchSize;
+  int waveSize;
+  /* Waves of the kernel that can be resident on a SIMD at once */
+  int wavesPerSimd;
+};
+typedef struct MiirKernelResources MiirKernelResources;
+
+/*! @brief Get the registers, LDS and occupancy of the kernel
+ *  @param handle MLIR handle, after miirLowerBin
+ *  @param resources Pointer to the resources storage
+ *  @return       MIIR_INVALID_MODULE before miirLowerBin or when the code
+ *                object has no metadata
+ */
+extern "C" MiirStatus miirGetKernelResources(MiirHandle handle,
+                                             MiirKernelResources *resources);
+
+/*! @brief Return the batch size the input and output must hold
+ *         Larger than the batch size of the problem when it was padded with
+ *         MIIR_BATCH_BUCKET_WASTE: the images past those of the problem
+ *         must then be zeros in the tensor the kernels read, and are left
+ *         undefined in the one they write.
+ *  @param handle MLIR handle
+ *  @return       Padded batch size
+ */
+extern "C" int miirGetPaddedBatchSize(MiirHandle handle);
+
+/*! @brief Get how the kernels of the problem are launched over its batch
+ *         With MIIR_BATCH_TILE, or when its input or output is too large
+ *         for 32-bit addressing, a problem may be built for a slice of its
+ *         batch: its kernels are then launched, in order, once for each of
+ *         launches consecutive slices, with the input and output pointers
+ *         moved forward by the given strides for each slice and the filter
+ *         and workspace left as they are. Otherwise launches is 1.
+ *  @param handle MLIR handle
+ *  @param launches Pointer to the number of launches over the batch
+ *  @param input_stride Pointer to the input bytes of one slice
+ *  @param output_stride Pointer to the output bytes of one slice
+ */
+extern "C" MiirStatus miirGetBatchLaunches(MiirHandle handle, int *launches,
+                                           size_t *input_stride,
+                                           size_t *output_stride);
+
+/*! @brief Where the tuning parameters of lowered kernels came from, counted
+ *         over the whole process. A kernel is counted each time it is lowered.
+ */
+struct MiirTuningStats {
+  /* Kernels tuned by an exact perf db entry */
+  uint64_t perfDbHits;
+  /* Kernels the perf db had no entry for, tuned by the entry of the problem
+   * on another number of CUs, by a nearby problem's entry or by the
+   * heuristics */
+  uint64_t perfDbMisses;
+  /* Kernels whose perf_config was invalid and fell back to the heuristics */
+  uint64_t fallbacks;
+  /* Kernels rebuilt with a lesser default config because the heuristics'
+   * choice spilled to scratch, counted once per rebuild */
+  uint64_t spillFallbacks;
+};
+typedef struct MiirTuningStats MiirTuningStats;
+
+/*! @brief Read the tuning statistics of the process
+ *  @param stats Pointer to the statistics storage
+ */
+extern "C" MiirStatus miirGetTuningStats(MiirTuningStats *stats);
+
+/*! @brief Reset the tuning statistics of the process to zero
+ */
+extern "C" MiirStatus miirResetTuningStats();
+
+/*! @brief Finish the background work of the library
+ *         Waits for the pending compiles of miirLowerBinAsync and stops
+ *         online tuning once the problem being tuned is stored. Problems
+ *         still queued for tuning are dropped. Call it before the process
+ *         exits or the library is unloaded: background threads are not
+ *         stopped by static destruction. Handles can still be created and
+ *         lowered afterwards, but no longer queue problems for tuning.
+ */
+extern "C" MiirStatus miirShutdown();
+
 /*! @brief Destroy MLIR handle
+ *         A handle shared by problems of miirCreateHandles goes away with
+ *         its last problem.
  *  @param handle MLIR handle
  */
 extern "C" MiirStatus miirDestroyHandle(MiirHandle handle);
@@ -1,7 +1,13 @@
 #include "Miir.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include <atomic>
+#include <cstdlib>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 
 using namespace llvm;
 static cl::opt<std::string> args(
@@ -16,10 +22,145 @@ static cl::opt<std::string> args(
 
 static cl::opt<std::string>
     option("option",
-           cl::desc("Code gen options: tuningparams/kernelcount/workspace/bin"),
+           cl::desc("Code gen options: "
+                    "tuningparams/kernelcount/workspace/bin/stress/profile/"
+                    "library"),
            cl::value_desc("Igemm convolution option string"),
            cl::init("tuningparams"));
 
+static cl::opt<unsigned>
+    threads("threads", cl::desc("Threads the stress option compiles on"),
+            cl::init(8));
+
+static cl::opt<unsigned>
+    iterations("iterations",
+               cl::desc("Problems each thread of the stress option compiles"),
+               cl::init(8));
+
+static cl::opt<bool>
+    traceProfile("trace",
+                 cl::desc("Print the profile option in the Chrome trace "
+                          "event format instead of JSON"),
+                 cl::init(false));
+
+// Lowers the problem `arguments` to its binary and execution dims, noting in
+// `compiled`, if given, whether it went through the pipelines, which is only
+// told with MIIR_COMPILE_PROFILE set.
+static MiirStatus lowerProblem(const std::string &arguments,
+                               std::string &binary,
+                               bool *compiled = nullptr) {
+  MiirHandle handle = miirCreateHandle(arguments.c_str());
+  if (handle == nullptr)
+    return MIIR_INVALID_PARAM;
+  MiirStatus status = miirLowerBin(handle);
+  if (status == MIIR_SUCCESS && compiled) {
+    size_t size = 0;
+    *compiled = miirGetCompileProfile(handle, MIIR_PROFILE_JSON, nullptr,
+                                      &size) == MIIR_SUCCESS;
+  }
+  const char *buffer = nullptr;
+  size_t size = 0;
+  if (status == MIIR_SUCCESS)
+    status = miirBufferView(handle, &buffer, &size);
+  size_t globalSize = 0, localSize = 0;
+  if (status == MIIR_SUCCESS)
+    status = miirGetExecutionDims(handle, &globalSize, &localSize);
+  if (status == MIIR_SUCCESS)
+    binary = std::to_string(globalSize) + "/" + std::to_string(localSize) +
+             ":" + std::string(buffer, size);
+  miirDestroyHandle(handle);
+  return status;
+}
+
+// Compiles the kernels of a few batch sizes of the problem `parameters` once
+// on one thread, then over and over on many threads at once, and checks that
+// every concurrent compilation matches the serial one.
+static MiirStatus stress(const std::string &parameters, int kernelCount) {
+  if (kernelCount < 1 || threads == 0)
+    return MIIR_INVALID_PARAM;
+  std::vector<std::string> problems;
+  for (int batchSize : {32, 64, 128, 256})
+    for (int i = 0; i < kernelCount; i++)
+      problems.push_back(parameters + " --batchsize " +
+                         std::to_string(batchSize) + " --kernel_id " +
+                         std::to_string(i));
+
+  std::vector<std::string> expected(problems.size());
+  for (size_t i = 0; i < problems.size(); i++) {
+    MiirStatus status = lowerProblem(problems[i], expected[i]);
+    if (status != MIIR_SUCCESS)
+      return status;
+  }
+
+  std::atomic<unsigned> failures{0};
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; t++)
+    workers.emplace_back([&, t]() {
+      for (unsigned i = 0; i < iterations; i++) {
+        size_t problem = (t + i * threads) % problems.size();
+        std::string binary;
+        if (lowerProblem(problems[problem], binary) != MIIR_SUCCESS ||
+            binary != expected[problem])
+          ++failures;
+      }
+    });
+  for (std::thread &worker : workers)
+    worker.join();
+
+  std::cout << "Stress - compilations=" << threads * iterations
+            << ", failures=" << failures << std::endl;
+  return failures == 0 ? MIIR_SUCCESS : MIIR_BUILD_FAILURE;
+}
+
+// Builds a kernel library of the kernels of the problem `parameters`, then
+// lowers them again with it, and checks that they all come from it, and
+// match the binaries and execution dims compiled without it.
+static MiirStatus libraryRoundTrip(const std::string &parameters,
+                                   int kernelCount) {
+  if (kernelCount < 1)
+    return MIIR_INVALID_PARAM;
+  std::vector<std::string> problems;
+  for (int i = 0; i < kernelCount; i++)
+    problems.push_back(parameters + " --kernel_id " + std::to_string(i));
+
+  std::vector<std::string> expected(problems.size());
+  for (size_t i = 0; i < problems.size(); i++) {
+    MiirStatus status = lowerProblem(problems[i], expected[i]);
+    if (status != MIIR_SUCCESS)
+      return status;
+  }
+
+  SmallString<128> path;
+  if (sys::fs::createTemporaryFile("miir-kernel-library", "lib", path))
+    return MIIR_INVALID_PARAM;
+  std::vector<const char *> options;
+  for (const std::string &problem : problems)
+    options.push_back(problem.c_str());
+  MiirStatus status = miirBuildKernelLibrary(
+      options.data(), static_cast<int>(options.size()), path.c_str());
+
+  unsigned failures = 0;
+  if (status == MIIR_SUCCESS) {
+    setenv("MIIR_KERNEL_LIBRARY", path.c_str(), /*overwrite=*/1);
+    setenv("MIIR_COMPILE_PROFILE", "1", /*overwrite=*/1);
+    for (size_t i = 0; i < problems.size(); i++) {
+      std::string binary;
+      bool compiled = true;
+      if (lowerProblem(problems[i], binary, &compiled) != MIIR_SUCCESS ||
+          compiled || binary != expected[i])
+        ++failures;
+    }
+    unsetenv("MIIR_COMPILE_PROFILE");
+    unsetenv("MIIR_KERNEL_LIBRARY");
+    std::cout << "Library - kernels=" << problems.size()
+              << ", failures=" << failures << std::endl;
+  }
+  sys::fs::remove(path);
+  if (status != MIIR_SUCCESS)
+    return status;
+  return failures == 0 ? MIIR_SUCCESS : MIIR_BUILD_FAILURE;
+}
+
 int main(int argc, char **argv) {
   // Parse pass names in main to ensure static initialization completed.
   cl::ParseCommandLineOptions(argc, argv, "MLIR MIOpen Dialect driver\n");
@@ -88,9 +229,34 @@ int main(int argc, char **argv) {
                 << std::endl;
       miirDestroyHandle(newHandle);
     }
+  } else if (option.getValue() == "stress") {
+    status = stress(parameters, miirGetKernelCount(handle));
+  } else if (option.getValue() == "library") {
+    status = libraryRoundTrip(parameters, miirGetKernelCount(handle));
+  } else if (option.getValue() == "profile") {
+    setenv("MIIR_COMPILE_PROFILE", "1", /*overwrite=*/1);
+    status = miirLowerBin(handle);
+    if (status != MIIR_SUCCESS) {
+      return status;
+    }
+
+    MiirProfileFormat format =
+        traceProfile ? MIIR_PROFILE_TRACE : MIIR_PROFILE_JSON;
+    size_t size = 0;
+    status = miirGetCompileProfile(handle, format, nullptr, &size);
+    if (status != MIIR_SUCCESS) {
+      return status;
+    }
+    std::string profile(size, '\0');
+    status = miirGetCompileProfile(handle, format, &profile[0], &size);
+    if (status != MIIR_SUCCESS) {
+      return status;
+    }
+    std::cout << profile;
   }
 
   miirDestroyHandle(handle);
+  miirShutdown();
 
   return status;
 }
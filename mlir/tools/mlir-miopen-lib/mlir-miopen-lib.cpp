@@ -1,34 +1,184 @@
 #include "Miir.h"
+#include "mlir/Dialect/MIOpen/CompileProfile.h"
 #include "mlir/Dialect/MIOpen/Generator/Conv2dGenerator.h"
 #include "mlir/Dialect/MIOpen/Pipelines.h"
+#include "mlir/Dialect/MIOpen/Tuning/BinaryPerfDb.h"
+#include "mlir/Dialect/MIOpen/Tuning/GridwiseGemmParams.h"
+#include "mlir/Dialect/MIOpen/utility/BinaryCompression.h"
+#include "mlir/Dialect/MIOpen/utility/KernelResources.h"
+#include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
 #include "mlir/IR/Builders.h"
 #include "mlir/IR/BuiltinOps.h"
 #include "mlir/InitMIOpenDialects.h"
+#include "mlir/InitMIOpenTargets.h"
 #include "mlir/Support/LogicalResult.h"
 
 #include "mlir/Dialect/GPU/Transforms/Passes.h"
 #include "mlir/ExecutionEngine/OptUtils.h"
-#include "mlir/InitAllDialects.h"
-#include "llvm/Support/TargetSelect.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
 
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <list>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <set>
 #include <sstream>
 #include <string>
+#include <tuple>
+#include <vector>
+
+#ifdef MIIR_ENABLE_ONLINE_TUNING
+#include "ConvTuner.h"
+#include "llvm/ADT/StringSet.h"
+
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#endif
 
 using namespace mlir;
 
 namespace {
+// Handles build their modules in the contexts of a pool of
+// MIIR_CONTEXT_POOL_SIZE contexts, 1 by default and one per hardware thread
+// for 0. Calls on handles of the same context are serialized, so with a
+// single context all handles share it and run one at a time, as they always
+// have. With more, a new handle goes to the context with the fewest live
+// handles, and handles of different contexts compile in parallel. The
+// contexts are made from one dialect registry and share one thread pool.
+//
+// Besides the pool, the state shared between handles is the one-time LLVM
+// target initialization of miirLazyInit, the kernel and perf db caches, which
+// lock, and the tuning statistics, which are atomic. Nothing parses or
+// changes cl::opt globals, so the library is reentrant.
+//
+// Attributes and types live as long as their context, so a context that
+// compiles problem after problem keeps growing. With MIIR_CONTEXT_RECYCLE
+// set to N, a context is replaced by a fresh one once N handles have been
+// created in it and the last of them is destroyed.
+class ContextPool {
+public:
+  struct Slot {
+    std::unique_ptr<MLIRContext> context;
+    // Held while a handle of the context is worked on
+    std::mutex mutex;
+    unsigned numHandles = 0;
+    // Handles created in the context
+    unsigned numServed = 0;
+  };
+
+  // Leaked, as handles may outlive static destruction
+  static ContextPool &get() {
+    static ContextPool *pool = new ContextPool();
+    return *pool;
+  }
+
+  Slot &acquire() {
+    const std::lock_guard<std::mutex> lock(mutex);
+    Slot *least = slots.front().get();
+    for (const std::unique_ptr<Slot> &slot : slots)
+      if (slot->numHandles < least->numHandles)
+        least = slot.get();
+    ++least->numHandles;
+    ++least->numServed;
+    return *least;
+  }
+
+  void release(Slot &slot) {
+    const std::lock_guard<std::mutex> lock(mutex);
+    if (--slot.numHandles > 0 || recycleAfter == 0 ||
+        slot.numServed < recycleAfter)
+      return;
+    const std::lock_guard<std::mutex> slotLock(slot.mutex);
+    slot.context = makeContext();
+    slot.numServed = 0;
+  }
+
+private:
+  ContextPool() {
+    registerMIOpenFlowDialects(registry);
+
+    unsigned size = 1;
+    if (const char *env = std::getenv("MIIR_CONTEXT_POOL_SIZE")) {
+      int envSize = std::atoi(env);
+      size = envSize == 0 && *env == '0'
+                 ? llvm::hardware_concurrency().compute_thread_count()
+                 : std::max(1, envSize);
+    }
+    if (const char *env = std::getenv("MIIR_CONTEXT_RECYCLE"))
+      recycleAfter = std::max(0, std::atoi(env));
+    if (size > 1)
+      threadPool = std::make_unique<llvm::ThreadPool>();
+    for (unsigned i = 0; i < size; ++i) {
+      auto slot = std::make_unique<Slot>();
+      slot->context = makeContext();
+      slots.push_back(std::move(slot));
+    }
+  }
+
+  std::unique_ptr<MLIRContext> makeContext() {
+    std::unique_ptr<MLIRContext> context;
+    if (threadPool) {
+      context = std::make_unique<MLIRContext>(
+          registry, MLIRContext::Threading::DISABLED);
+      context->setThreadPool(*threadPool);
+    } else {
+      context = std::make_unique<MLIRContext>(registry);
+    }
+    // Turn off all diagnotic printing on op and stacktrace
+    // Note: This is not necessary with below handler
+    context->printOpOnDiagnostic(false);
+    context->printStackTraceOnDiagnostic(false);
+    // Register a handler that swallows all diagnostic print
+    DiagnosticEngine &engine = context->getDiagEngine();
+    engine.registerHandler([](Diagnostic &diag) {});
+    context->loadDialect<miopen::MIOpenDialect, func::FuncDialect>();
+    return context;
+  }
+
+  DialectRegistry registry;
+  std::unique_ptr<llvm::ThreadPool> threadPool;
+  std::vector<std::unique_ptr<Slot>> slots;
+  unsigned recycleAfter = 0;
+  std::mutex mutex;
+};
+
+// A lowered kernel as kept in the binary cache.
+struct CachedBinary {
+  int32_t blockSize = 0;
+  int32_t gridSize = 0;
+  std::string hsaco;
+};
+
 struct MiirHandle_s {
-  MiirHandle_s() {
-    OpBuilder builder(&getContext());
+  MiirHandle_s() : slot(ContextPool::get().acquire()) {
+    const std::lock_guard<std::mutex> lock(slot.mutex);
+    OpBuilder builder(slot.context.get());
     module = ModuleOp::create(builder.getUnknownLoc());
   }
+  ~MiirHandle_s() { ContextPool::get().release(slot); }
   mlir::ModuleOp getModule() { return module.get(); }
+  // Held while working on the handle
+  std::mutex &getMutex() { return slot.mutex; }
   mlir::OwningOpRef<mlir::ModuleOp> module;
   std::string triple;
   std::string chip;
@@ -36,29 +186,33 @@ struct MiirHandle_s {
   std::string genTxt;
   int kernelCount = 0;
   int workspace = 0;
+  // Whether the workspace keeps state across launches, see
+  // MiirWorkspaceInfo
+  bool persistentWorkspace = false;
+  // The options in canonical order and the tuned parameters, which with the
+  // target decide the binary
+  std::string problem;
+  // The binary and its dimensions once lowered with the kernel library or
+  // the binary cache on
+  llvm::Optional<CachedBinary> binary;
+  // Best default configs miirLowerBin passed over because they spilled,
+  // which miirLowerTuningParams passes over as well
+  int skipHeuristicConfigs = 0;
+  // Where the compile time of miirLowerBin went, with MIIR_COMPILE_PROFILE
+  std::unique_ptr<miopen::CompileProfile> profile;
+  // Problems of miirCreateHandles the handle stands for
+  std::atomic<int> refCount{1};
+  // Batch size the input and output hold, larger than that of the problem
+  // when it was padded to its bucket with MIIR_BATCH_BUCKET_WASTE
+  int64_t paddedBatch = 0;
+  // Launches of the kernels the problem takes with MIIR_BATCH_TILE, and the
+  // bytes by which the input and output move from one launch to the next
+  int64_t batchLaunches = 1;
+  size_t inputBatchStride = 0;
+  size_t outputBatchStride = 0;
 
 private:
-  MLIRContext &getContext() {
-    auto getRegistry = []() {
-      DialectRegistry registry;
-      registerAllDialects(registry);
-      registerMIOpenDialects(registry);
-      return registry;
-    };
-    static MLIRContext context(getRegistry());
-    static std::once_flag once;
-    std::call_once(once, []() {
-      // Turn off all diagnotic printing on op and stacktrace
-      // Note: This is not necessary with below handler
-      context.printOpOnDiagnostic(false);
-      context.printStackTraceOnDiagnostic(false);
-      // Register a handler that swallows all diagnostic print
-      DiagnosticEngine &engine = context.getDiagEngine();
-      engine.registerHandler([](Diagnostic &diag) {});
-      context.loadDialect<miopen::MIOpenDialect, func::FuncDialect>();
-    });
-    return context;
-  }
+  ContextPool::Slot &slot;
 };
 
 // In multi-threaded context, static intialization is guaranteed to
@@ -68,23 +222,573 @@ private:
 // With this guarantee, we are protected from the possible race
 // condition of one thread doing intialization and another doing
 // lowering.
+//
+// MIIR_SHARED_PERF_DBS lists binary perf dbs, separated by colons, such as
+// those merged from the tuning runs of a cluster onto a shared file system.
+// They are layered under the online tuning db and over the system perf dbs,
+// in the order listed, and are read-only, so any number of processes map
+// them at once.
 void miirLazyInit() {
   static std::once_flag once;
   std::call_once(once, []() {
-    llvm::InitializeAllTargets();
-    llvm::InitializeAllTargetInfos();
-    llvm::InitializeAllTargetMCs();
-    llvm::InitializeAllAsmParsers();
-    llvm::InitializeAllAsmPrinters();
-
-    // Initialize LLVM AMDGPU backend.
-    LLVMInitializeAMDGPUTarget();
-    LLVMInitializeAMDGPUTargetInfo();
-    LLVMInitializeAMDGPUTargetMC();
-    LLVMInitializeAMDGPUAsmPrinter();
+    initializeMIOpenTargets();
+    if (const char *env = std::getenv("MIIR_SHARED_PERF_DBS")) {
+      llvm::SmallVector<llvm::StringRef, 4> paths;
+      llvm::StringRef(env).split(paths, ':', /*MaxSplit=*/-1,
+                                 /*KeepEmpty=*/false);
+      for (llvm::StringRef path : paths)
+        (void)miopen::BinaryPerfDb::addSharedDb(path);
+    }
   });
 }
 
+// Binary cache: when MIIR_KERNEL_CACHE_DIR names a directory, the binary of
+// every problem lowered by miirLowerBin is kept there together with its block
+// and grid size, so that the same problem skips both pipelines later in this
+// or any other process. Entries are keyed on the options in canonical order,
+// the target, the perf dbs and the compiler version. An entry holds the block
+// and grid size on its first line followed by the hsaco, compressed as
+// compressBinary stores it, and is written to a temporary file that is
+// renamed into place, so readers only ever see complete entries.
+static std::string getBinaryCacheDir() {
+  const char *env = std::getenv("MIIR_KERNEL_CACHE_DIR");
+  return env ? env : "";
+}
+
+// A problem as options, by key.
+using ArgMap = std::map<std::string, std::string>;
+
+// The options as the generator reads them, "--key value" pairs where the last
+// of repeated keys wins.
+static ArgMap tokenizeArguments(const char *arguments) {
+  ArgMap argMap;
+  std::istringstream iss(arguments);
+  std::string token;
+  std::string argKey;
+  while (iss >> token) {
+    auto pos = token.find("--");
+    if (pos != std::string::npos) {
+      argKey = token.substr(pos + 2);
+    } else if (!argKey.empty()) {
+      argMap[argKey] = token;
+      argKey.clear();
+    }
+  }
+  return argMap;
+}
+
+// The options in canonical order, for keying the binary cache.
+static std::string normalizeArguments(const ArgMap &argMap) {
+  std::string normalized;
+  for (const auto &arg : argMap)
+    normalized += arg.first + "=" + arg.second + "\n";
+  return normalized;
+}
+
+// The options as a command line the generator parses.
+static std::string formatArguments(const ArgMap &argMap) {
+  std::string arguments;
+  for (const auto &arg : argMap)
+    arguments += "--" + arg.first + " " + arg.second + " ";
+  return arguments;
+}
+
+// The element type of the output of a convolution of `dataType` data: i8
+// convolutions accumulate into i32 and fp8 or bf8 ones into fp32, which the
+// generator only accepts under that name.
+static llvm::StringRef getOutputDataType(llvm::StringRef dataType) {
+  return llvm::StringSwitch<llvm::StringRef>(dataType)
+      .Case("i8", "i32")
+      .Cases("fp8", "bf8", "fp32")
+      .Default(dataType);
+}
+
+// The options describing `problem`, as MIOpen would pass them.
+static ArgMap getArgMap(const MiirConvProblem &problem) {
+  ArgMap argMap;
+  auto setInt = [&](const char *key, int64_t value) {
+    argMap[key] = std::to_string(value);
+  };
+  auto setStr = [&](const char *key, const char *value) {
+    if (value != nullptr && *value != '\0')
+      argMap[key] = value;
+  };
+  setStr("operation", problem.operation);
+  setStr("arch", problem.arch);
+  setInt("num_cu", problem.numCu);
+  setInt("x2", problem.xdlops);
+  std::string dataType = problem.dataType;
+  setStr("in_type", dataType.c_str());
+  setStr("fil_type", dataType.c_str());
+  setStr("out_type", getOutputDataType(dataType).data());
+  setStr("in_layout", problem.inLayout);
+  setStr("fil_layout", problem.filLayout);
+  setStr("out_layout", problem.outLayout);
+  setInt("batchsize", problem.batchSize);
+  setInt("groupsize", problem.groupSize);
+  setInt("in_channels", problem.inChannels);
+  setInt("out_channels", problem.outChannels);
+  setInt("in_h", problem.inH);
+  setInt("in_w", problem.inW);
+  setInt("out_h", problem.outH);
+  setInt("out_w", problem.outW);
+  setInt("fil_h", problem.filH);
+  setInt("fil_w", problem.filW);
+  setInt("conv_stride_h", problem.strideH);
+  setInt("conv_stride_w", problem.strideW);
+  setInt("dilation_h", problem.dilationH);
+  setInt("dilation_w", problem.dilationW);
+  setInt("padding_h", problem.paddingH);
+  setInt("padding_w", problem.paddingW);
+  if (std::strlen(problem.inLayout) == 6) {
+    setInt("in_d", problem.inD);
+    setInt("out_d", problem.outD);
+    setInt("fil_d", problem.filD);
+    setInt("conv_stride_d", problem.strideD);
+    setInt("dilation_d", problem.dilationD);
+    setInt("padding_d", problem.paddingD);
+  }
+  setStr("perf_config", problem.perfConfig);
+  setStr("kernel_name", problem.kernelName);
+  setInt("kernel_id", problem.kernelId);
+  setInt("split_k", problem.splitK);
+  setInt("winograd", problem.winogradTile);
+  setInt("single_launch", problem.singleLaunch);
+  setInt("deterministic", problem.deterministic);
+  setInt("reduce_kblocks", problem.reduceKBlocks);
+  setInt("xf32", problem.xf32);
+  setInt("fused_reduction", problem.fusedReduction);
+  return argMap;
+}
+
+// The most ops MIIR_MAX_UNROLLED_OPS lets a loop unroll to in full, or 0
+// when loops are unrolled whatever their size.
+static int64_t getMaxUnrolledOps() {
+  static const int64_t maxUnrolledOps = [] {
+    const char *env = std::getenv("MIIR_MAX_UNROLLED_OPS");
+    return env ? std::max<int64_t>(0, std::atoll(env)) : int64_t(0);
+  }();
+  return maxUnrolledOps;
+}
+
+// The key of the binary of `problem` on a target in the binary cache, or in
+// the kernel library without the perf dbs.
+static std::string getBinaryKey(llvm::StringRef problem,
+                                llvm::StringRef triple, llvm::StringRef chip,
+                                llvm::StringRef features, bool withPerfDbs) {
+  llvm::SHA1 hasher;
+  auto add = [&](llvm::StringRef field) {
+    hasher.update(field);
+    hasher.update(llvm::StringRef("\0", 1));
+  };
+  add(problem);
+  add(triple);
+  add(chip);
+  add(features);
+  if (withPerfDbs)
+    add(miopen::getPerfDbVersion());
+  add(std::to_string(getMaxUnrolledOps()));
+  add(LLVM_VERSION_STRING);
+  add(std::to_string(MIIR_VERSION_FLAT));
+  return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+static std::string getBinaryKey(const MiirHandle_s &handle, bool withPerfDbs) {
+  return getBinaryKey(handle.problem, handle.triple, handle.chip,
+                      handle.features, withPerfDbs);
+}
+
+static llvm::SmallString<128> getBinaryCachePath(llvm::StringRef dir,
+                                                 llvm::StringRef key) {
+  llvm::SmallString<128> path(dir);
+  llvm::sys::path::append(path, key + ".miir");
+  return path;
+}
+
+static llvm::Optional<CachedBinary> lookupBinary(llvm::StringRef dir,
+                                                 llvm::StringRef key) {
+  auto bufferOrErr = llvm::MemoryBuffer::getFile(getBinaryCachePath(dir, key),
+                                                 /*IsText=*/false);
+  if (!bufferOrErr)
+    return llvm::None;
+  llvm::StringRef contents = (*bufferOrErr)->getBuffer();
+  size_t newline = contents.find('\n');
+  if (newline == llvm::StringRef::npos)
+    return llvm::None;
+  llvm::StringRef blockSize, gridSize;
+  std::tie(blockSize, gridSize) = contents.take_front(newline).split(' ');
+  CachedBinary binary;
+  if (blockSize.getAsInteger(10, binary.blockSize) ||
+      gridSize.getAsInteger(10, binary.gridSize) ||
+      newline + 1 == contents.size())
+    return llvm::None;
+  llvm::Optional<std::string> hsaco =
+      miopen::decompressBinary(contents.drop_front(newline + 1));
+  if (!hsaco)
+    return llvm::None;
+  binary.hsaco = std::move(*hsaco);
+  return binary;
+}
+
+// Failing to store only costs a recompilation later.
+static void storeBinary(llvm::StringRef dir, llvm::StringRef key,
+                        const CachedBinary &binary) {
+  if (llvm::sys::fs::create_directories(dir))
+    return;
+  std::string contents = std::to_string(binary.blockSize) + " " +
+                         std::to_string(binary.gridSize) + "\n" +
+                         miopen::compressBinary(binary.hsaco);
+  llvm::SmallString<128> path = getBinaryCachePath(dir, key);
+  if (llvm::Error error = llvm::writeFileAtomically(path + ".tmp-%%%%%%%%",
+                                                    path, contents))
+    llvm::consumeError(std::move(error));
+}
+
+// Kernel library: MIIR_KERNEL_LIBRARY names an archive of binaries built ahead
+// of time by miirBuildKernelLibrary, usually through the miopen-kernel-library
+// tool for a list of common problems on several targets. miirLowerBin looks
+// a problem up there before the binary cache and the compiler. Entries are
+// keyed like those of the binary cache but without the perf dbs, so that
+// changes to the perf dbs that leave a problem alone keep its entry. Each
+// entry rather records the perf_config the tuning passes picked for it,
+// before any spill retry, and is only used while they still pick it, so
+// newer perf db entries are never shadowed. The archive holds a "MIIRLIB3"
+// line followed by an entry per binary: a "key block grid perf_config size"
+// line, with "-" for kernels without a perf_config, and size bytes of hsaco,
+// compressed as compressBinary stores it. Binaries are decompressed on
+// lookup, and the last kLibraryCacheSize of them kept so that problems looked
+// up again skip decompressing. Older archives, without perf_configs, are not
+// read.
+static constexpr llvm::StringLiteral kKernelLibraryMagic = "MIIRLIB3\n";
+static constexpr llvm::StringLiteral kNoPerfConfig = "-";
+static constexpr size_t kLibraryCacheSize = 64;
+
+class KernelLibrary {
+public:
+  // A binary of the archive and the perf_config it was built with.
+  struct Binary {
+    CachedBinary binary;
+    std::string perfConfig;
+  };
+
+  // Read on the first use of each MIIR_KERNEL_LIBRARY and leaked like the
+  // context pool. nullptr without MIIR_KERNEL_LIBRARY or an archive that can
+  // be read.
+  static const KernelLibrary *get() {
+    const char *path = std::getenv("MIIR_KERNEL_LIBRARY");
+    if (path == nullptr || *path == '\0')
+      return nullptr;
+    static std::mutex mutex;
+    static llvm::StringMap<const KernelLibrary *> libraries;
+    const std::lock_guard<std::mutex> lock(mutex);
+    auto inserted = libraries.try_emplace(path, nullptr);
+    if (inserted.second)
+      inserted.first->second = load(path);
+    return inserted.first->second;
+  }
+
+  // The binary of `key`, if it was built with `perfConfig`.
+  llvm::Optional<CachedBinary> lookup(llvm::StringRef key,
+                                      llvm::StringRef perfConfig) const {
+    auto it = entries.find(key);
+    if (it == entries.end() ||
+        it->second.perfConfig !=
+            (perfConfig.empty() ? kNoPerfConfig : perfConfig))
+      return llvm::None;
+    CachedBinary binary;
+    binary.blockSize = it->second.blockSize;
+    binary.gridSize = it->second.gridSize;
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto cached = llvm::find_if(
+        recent, [&](const auto &entry) { return entry.first == key; });
+    if (cached != recent.end()) {
+      recent.splice(recent.begin(), recent, cached);
+      binary.hsaco = cached->second;
+      return binary;
+    }
+    llvm::Optional<std::string> hsaco =
+        miopen::decompressBinary(it->second.hsaco);
+    if (!hsaco)
+      return llvm::None;
+    binary.hsaco = *hsaco;
+    recent.emplace_front(key.str(), std::move(*hsaco));
+    if (recent.size() > kLibraryCacheSize)
+      recent.pop_back();
+    return binary;
+  }
+
+  // Whether `key` has a binary, without decompressing it.
+  bool contains(llvm::StringRef key) const { return entries.count(key); }
+
+  // Writes the archive of `binaries`, by key, to `path`.
+  static LogicalResult write(llvm::StringRef path,
+                             const std::map<std::string, Binary> &binaries) {
+    std::string contents = kKernelLibraryMagic.str();
+    for (const auto &entry : binaries) {
+      const CachedBinary &binary = entry.second.binary;
+      std::string hsaco = miopen::compressBinary(binary.hsaco);
+      llvm::StringRef perfConfig = entry.second.perfConfig;
+      contents += entry.first + " " + std::to_string(binary.blockSize) + " " +
+                  std::to_string(binary.gridSize) + " " +
+                  (perfConfig.empty() ? kNoPerfConfig : perfConfig).str() +
+                  " " + std::to_string(hsaco.size()) + "\n" + hsaco;
+    }
+    if (llvm::Error error = llvm::writeFileAtomically(
+            llvm::Twine(path) + ".tmp-%%%%%%%%", path, contents)) {
+      llvm::consumeError(std::move(error));
+      return failure();
+    }
+    return success();
+  }
+
+private:
+  struct Entry {
+    int32_t blockSize;
+    int32_t gridSize;
+    // Into the archive
+    llvm::StringRef perfConfig;
+    // Into the archive, compressed
+    llvm::StringRef hsaco;
+  };
+
+  // A truncated archive keeps the entries before the damage.
+  static const KernelLibrary *load(const char *path) {
+    auto bufferOrErr = llvm::MemoryBuffer::getFile(path, /*IsText=*/false);
+    if (!bufferOrErr)
+      return nullptr;
+    llvm::StringRef contents = (*bufferOrErr)->getBuffer();
+    if (!contents.consume_front(kKernelLibraryMagic))
+      return nullptr;
+
+    auto *library = new KernelLibrary;
+    library->archive = std::move(*bufferOrErr);
+    while (!contents.empty()) {
+      size_t newline = contents.find('\n');
+      if (newline == llvm::StringRef::npos)
+        break;
+      llvm::SmallVector<llvm::StringRef, 5> fields;
+      contents.take_front(newline).split(fields, ' ');
+      contents = contents.drop_front(newline + 1);
+      Entry entry;
+      size_t size = 0;
+      if (fields.size() != 5 || fields[1].getAsInteger(10, entry.blockSize) ||
+          fields[2].getAsInteger(10, entry.gridSize) ||
+          fields[4].getAsInteger(10, size) || size > contents.size())
+        break;
+      entry.perfConfig = fields[3];
+      entry.hsaco = contents.take_front(size);
+      contents = contents.drop_front(size);
+      library->entries[fields[0]] = entry;
+    }
+    return library;
+  }
+
+  std::unique_ptr<llvm::MemoryBuffer> archive;
+  llvm::StringMap<Entry> entries;
+  // The binaries decompressed last, most recent first, by key.
+  mutable std::mutex cacheMutex;
+  mutable std::list<std::pair<std::string, std::string>> recent;
+};
+
+// The block and grid size of the single kernel of `module`, whether it was
+// lowered by miirLowerTuningParams, still a func::FuncOp then, or by
+// miirLowerBin, a LLVM::LLVMFuncOp then.
+static LogicalResult getExecutionDims(ModuleOp module, int32_t &blockSize,
+                                      int32_t &gridSize) {
+  auto getSizeAttr = [](const Attribute &attr, int32_t &size) {
+    if (!attr) {
+      return failure();
+    }
+    size = attr.template dyn_cast<IntegerAttr>().getInt();
+    return success();
+  };
+
+  auto countKernels = [&](auto funcOp, int &count) {
+    int32_t block = 0;
+    int32_t grid = 0;
+    auto statusBlock = getSizeAttr(funcOp->getAttr("block_size"), block);
+    auto statusGrid = getSizeAttr(funcOp->getAttr("grid_size"), grid);
+    if (statusBlock.succeeded() && statusGrid.succeeded()) {
+      blockSize = block;
+      gridSize = grid;
+    }
+    ++count;
+  };
+
+  int count = 0;
+  module.walk([&](func::FuncOp funcOp) { countKernels(funcOp, count); });
+  if (count == 1)
+    return success();
+
+  count = 0;
+  module.walk([&](LLVM::LLVMFuncOp funcOp) { countKernels(funcOp, count); });
+  return success(count == 1);
+}
+
+// The binary of `module` once lowered by miirLowerBin, with its dimensions.
+static llvm::Optional<CachedBinary> readBinary(ModuleOp module) {
+  CachedBinary binary;
+  module.walk([&](gpu::GPUModuleOp gpuModule) {
+    if (auto hsacoAttr = gpuModule->getAttrOfType<StringAttr>(
+            gpu::getDefaultGpuBinaryAnnotation()))
+      binary.hsaco = hsacoAttr.getValue().str();
+  });
+  if (binary.hsaco.empty() ||
+      failed(getExecutionDims(module, binary.blockSize, binary.gridSize)))
+    return llvm::None;
+  return binary;
+}
+
+#ifdef MIIR_ENABLE_ONLINE_TUNING
+// Online tuning: when MIIR_ONLINE_TUNING_DB names a user perf db, a handle
+// of a problem with no tuned entry is built with the heuristic parameters
+// right away, and the problem is queued for a background thread that times
+// the best MIIR_ONLINE_TUNING_CANDIDATES candidates of the cost model. The
+// winner is stored in the perf db and used by every later handle of the
+// problem.
+//
+// The tuner is leaked rather than destroyed with the other statics: joining
+// its worker during static destruction could wait on a thread that uses the
+// MLIR and LLVM statics being destroyed. miirShutdown stops it instead.
+class OnlineTuner {
+public:
+  static OnlineTuner *get() {
+    static OnlineTuner *tuner = []() -> OnlineTuner * {
+      const char *dbPath = std::getenv("MIIR_ONLINE_TUNING_DB");
+      if (dbPath == nullptr || *dbPath == '\0')
+        return nullptr;
+      return new OnlineTuner(dbPath);
+    }();
+    return tuner;
+  }
+
+  // Stop the worker once the problem being tuned, if any, is finished, so
+  // that its winner is not lost. Problems still queued are dropped, and no
+  // more are queued.
+  void shutdown() {
+    {
+      const std::lock_guard<std::mutex> lock(queueMutex);
+      if (stopping)
+        return;
+      stopping = true;
+      queue.clear();
+    }
+    queueChanged.notify_one();
+    worker.join();
+  }
+
+  // The tuned perf_config of the problem `arguments` describes, whose
+  // convolution is `op`. If there is none yet, the problem is queued for
+  // tuning and None is returned.
+  llvm::Optional<std::string> lookup(const std::string &arguments,
+                                     Operation *op) {
+    {
+      const std::lock_guard<std::mutex> lock(queueMutex);
+      auto it = results.find(arguments);
+      if (it != results.end())
+        return it->second;
+      if (pending.contains(arguments))
+        return llvm::None;
+    }
+    if (llvm::Optional<std::string> stored =
+            miopen::lookupTuningParameters(dbPath, op))
+      return stored;
+
+    {
+      const std::lock_guard<std::mutex> lock(queueMutex);
+      if (stopping || !pending.insert(arguments).second)
+        return llvm::None;
+      queue.push_back(arguments);
+    }
+    queueChanged.notify_one();
+    return llvm::None;
+  }
+
+private:
+  explicit OnlineTuner(std::string dbPath) : dbPath(std::move(dbPath)) {
+    if (const char *candidates = std::getenv("MIIR_ONLINE_TUNING_CANDIDATES"))
+      numCandidates = std::max(std::atoi(candidates), 1);
+    worker = std::thread([this]() { run(); });
+  }
+
+  void run() {
+    miirLazyInit();
+    DialectRegistry registry;
+    registerMIOpenFlowDialects(registry);
+    llvm::ThreadPool pool;
+    while (true) {
+      std::string arguments;
+      {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueChanged.wait(lock, [&]() { return stopping || !queue.empty(); });
+        if (stopping)
+          return;
+        arguments = std::move(queue.front());
+        queue.pop_front();
+      }
+      tune(arguments, registry, pool);
+    }
+  }
+
+  void tune(const std::string &arguments, const DialectRegistry &registry,
+            llvm::ThreadPool &pool) {
+    miopen::Conv2dGenerator generator;
+    if (failed(generator.parseConvConfig(arguments.c_str())))
+      return;
+    const auto &config = generator.getConfig();
+    llvm::SmallVector<int, 4> devices = miopen::getTuningDevices(config.chip);
+    if (devices.empty())
+      return;
+
+    MLIRContext context(registry);
+    context.getDiagEngine().registerHandler([](Diagnostic &diag) {});
+    context.loadDialect<miopen::MIOpenDialect, func::FuncDialect>();
+    OwningOpRef<ModuleOp> module = ModuleOp::create(UnknownLoc::get(&context));
+    if (failed(miopen::genConvKernels(config, *module, /*ignoreTuning=*/true)))
+      return;
+    llvm::SmallVector<MemRefType, 4> argTypes;
+    Operation *convOp = miopen::findConvOp(*module, argTypes);
+    if (convOp == nullptr)
+      return;
+
+    std::vector<std::string> perfConfigs =
+        miopen::getRankedPerfConfigs(convOp, numCandidates);
+    std::vector<llvm::Optional<double>> times = miopen::benchmarkPerfConfigs(
+        registry, pool, config, perfConfigs, argTypes, devices,
+        miopen::ConvTunerOptions());
+    llvm::Optional<size_t> best;
+    for (size_t i = 0, e = times.size(); i < e; ++i)
+      if (times[i] && (!best || *times[i] < *times[*best]))
+        best = i;
+    if (!best)
+      return;
+
+    // Every kernel ran with the winner, and those of a strided backward data
+    // convolution each look for it in entries of their own.
+    module->walk([&](Operation *op) {
+      if (isa<miopen::Conv2DOp, miopen::Conv3DOp, miopen::Conv2DBwdDataOp,
+              miopen::Conv2DBwdWeightOp>(op))
+        (void)miopen::storeTuningParameters(dbPath, op, perfConfigs[*best],
+                                            times[*best]);
+    });
+    const std::lock_guard<std::mutex> lock(queueMutex);
+    results[arguments] = perfConfigs[*best];
+  }
+
+  std::string dbPath;
+  size_t numCandidates = 8;
+  std::mutex queueMutex;
+  std::condition_variable queueChanged;
+  std::deque<std::string> queue;
+  // Problems queued or tuned in this process, tuned ones with their winner.
+  llvm::StringSet<> pending;
+  llvm::StringMap<std::string> results;
+  bool stopping = false;
+  std::thread worker;
+};
+#endif // MIIR_ENABLE_ONLINE_TUNING
+
 LogicalResult MIOpenEnabled(const mlir::miopen::Conv2dGenerator::Config &conf) {
   const std::string& inLayout = conf.inputLayout;
   const std::string& filLayout = conf.filterLayout;
@@ -103,42 +807,296 @@ LogicalResult MIOpenEnabled(const mlir::miopen::Conv2dGenerator::Config &conf) {
 } // namespace
 
 typedef void *MiirHandle;
-static std::mutex mutex;
 
-extern "C" MiirHandle miirCreateHandle(const char *arguments) {
-  const std::lock_guard<std::mutex> lock(mutex);
+// The batch size of the problems split with MIIR_BATCH_TILE, or 0 when
+// problems are built whole.
+static int64_t getBatchTile() {
+  static const int64_t batchTile = [] {
+    const char *env = std::getenv("MIIR_BATCH_TILE");
+    return env ? std::max<int64_t>(0, std::atoll(env)) : int64_t(0);
+  }();
+  return batchTile;
+}
 
-  mlir::miopen::Conv2dGenerator conv2dGenerator;
-  if (failed(conv2dGenerator.parseConvConfig(arguments))) {
-    return nullptr;
-  }
+// The largest part of the work of a problem padded to the batch size of its
+// bucket that MIIR_BATCH_BUCKET_WASTE lets go to padding, or a negative value
+// when problems are not bucketed.
+static double getBucketWaste() {
+  static const double bucketWaste = [] {
+    const char *env = std::getenv("MIIR_BATCH_BUCKET_WASTE");
+    return env && *env ? std::atof(env) : -1.0;
+  }();
+  return bucketWaste;
+}
+
+// The batch size of the bucket of `batchSize`: the next multiple of
+// MIIR_BATCH_TILE when the batch is split, and the next power of two
+// otherwise.
+static int64_t getBatchBucket(int64_t batchSize) {
+  int64_t batchTile = getBatchTile();
+  if (batchTile > 0 && batchSize > batchTile)
+    return static_cast<int64_t>(llvm::alignTo(batchSize, batchTile));
+  return static_cast<int64_t>(llvm::PowerOf2Ceil(batchSize));
+}
+
+static int64_t getBatchSize(const miopen::Conv2dGenerator::Config &config) {
+  return config.inputDimension[config.inputLayout.find('n')];
+}
+
+// Whether the batch of `config` may be padded or split: that of a forward or
+// backward data convolution, outermost in its input and output. Backward
+// weight convolutions reduce over the batch.
+static bool hasOuterBatch(const miopen::Conv2dGenerator::Config &config) {
+  return config.operation.hasValue() &&
+         config.operation.getValue() != miopen::ConvOpType::BwdWeight &&
+         !config.inputLayout.empty() && config.inputLayout[0] == 'n' &&
+         !config.outputLayout.empty() && config.outputLayout[0] == 'n';
+}
+
+static miopen::Conv2dGenerator::Config
+withBatchSize(const miopen::Conv2dGenerator::Config &config,
+              int64_t batchSize) {
+  miopen::Conv2dGenerator::Config result = config;
+  result.inputDimension[0] = batchSize;
+  result.outputDimension[0] = batchSize;
+  return result;
+}
 
+// Whether the binary of the problem of `argMap` on the target of `config` is
+// already in the kernel library or the binary cache, so that building it
+// costs no compile.
+static bool hasBinaryAtHand(const ArgMap &argMap,
+                            const miopen::Conv2dGenerator::Config &config) {
+  std::string problem = normalizeArguments(argMap);
+  if (const KernelLibrary *library = KernelLibrary::get())
+    if (library->contains(getBinaryKey(problem, config.triple, config.chip,
+                                       config.features,
+                                       /*withPerfDbs=*/false)))
+      return true;
+  std::string cacheDir = getBinaryCacheDir();
+  return !cacheDir.empty() &&
+         llvm::sys::fs::exists(getBinaryCachePath(
+             cacheDir, getBinaryKey(problem, config.triple, config.chip,
+                                    config.features, /*withPerfDbs=*/true)));
+}
+
+static size_t getElementBytes(StringRef dataType) {
+  return llvm::StringSwitch<size_t>(dataType)
+      .Case("f64", 8)
+      .Cases("f32", "fp32", "i32", 4)
+      .Cases("f16", "bf16", 2)
+      .Cases("i8", "fp8", "bf8", 1)
+      .Default(0);
+}
+
+// The problem of `config` at a slice of its batch, if it may be run as
+// `launches` of it on consecutive slices of the input and output, which move
+// by `inputStride` and `outputStride` bytes from one launch to the next. The
+// slice is MIIR_BATCH_TILE, which only splits problems into whole tiles, or
+// else the largest one whose tensors the kernels can address with 32 bits,
+// for problems too large to be built whole.
+static llvm::Optional<miopen::Conv2dGenerator::Config>
+splitBatch(const miopen::Conv2dGenerator::Config &config, int64_t &launches,
+           size_t &inputStride, size_t &outputStride) {
+  if (!hasOuterBatch(config))
+    return llvm::None;
+  int64_t batchSize = config.inputDimension[0];
+
+  size_t inputBytes = getElementBytes(config.dataTypeStr);
+  size_t outputBytes =
+      getElementBytes(getOutputDataType(config.dataTypeStr));
+  if (inputBytes == 0 || outputBytes == 0)
+    return llvm::None;
+  for (int64_t dim : llvm::drop_begin(config.inputDimension))
+    inputBytes *= dim;
+  for (int64_t dim : llvm::drop_begin(config.outputDimension))
+    outputBytes *= dim;
+
+  int64_t batchTile = getBatchTile();
+  if (batchTile == 0 || batchSize <= batchTile || batchSize % batchTile != 0)
+    batchTile = batchSize;
+  int64_t tileLaunches = miopen::getMinBatchLaunches(
+      batchTile, {static_cast<int64_t>(inputBytes * batchTile),
+                  static_cast<int64_t>(outputBytes * batchTile)});
+  // Not even one image fits: the kernel pipeline reports it.
+  if (tileLaunches == 0)
+    return llvm::None;
+  batchTile /= tileLaunches;
+  if (batchTile == batchSize)
+    return llvm::None;
+
+  launches = batchSize / batchTile;
+  inputStride = inputBytes * batchTile;
+  outputStride = outputBytes * batchTile;
+  return withBatchSize(config, batchTile);
+}
+
+// Builds the handle of the problem `conv2dGenerator` is set up for.
+// `getOptions` gives the options of the problem, which are only worked out
+// for online tuning, the kernel library and the binary cache.
+static MiirHandle createHandle(miopen::Conv2dGenerator &conv2dGenerator,
+                               llvm::function_ref<ArgMap()> getOptions) {
+  // The perf dbs, shared ones included, decide the binary cache key of the
+  // problem and may be read to build it
+  miirLazyInit();
   if (failed(conv2dGenerator.isApplicable())) {
     return nullptr;
   }
 
-  const auto &config = conv2dGenerator.getConfig();
-  if (failed(MIOpenEnabled(config))) {
+  if (failed(MIOpenEnabled(conv2dGenerator.getConfig()))) {
     return nullptr;
   }
 
+  ArgMap argMap;
+  bool needsArgMap =
+      !getBinaryCacheDir().empty() || KernelLibrary::get() != nullptr;
+#ifdef MIIR_ENABLE_ONLINE_TUNING
+  OnlineTuner *tuner = OnlineTuner::get();
+  needsArgMap |= tuner != nullptr;
+#endif
+  if (needsArgMap)
+    argMap = getOptions();
+
+  // A problem whose binary is not at hand is padded to the batch size of its
+  // bucket, which all the batch sizes of the bucket share, when the padding
+  // costs less of the work than MIIR_BATCH_BUCKET_WASTE allows.
+  int64_t problemBatch = getBatchSize(conv2dGenerator.getConfig());
+  int64_t paddedBatch = problemBatch;
+  if (getBucketWaste() >= 0 && hasOuterBatch(conv2dGenerator.getConfig())) {
+    int64_t bucket = getBatchBucket(problemBatch);
+    double waste = static_cast<double>(bucket - problemBatch) / bucket;
+    if (bucket != problemBatch && waste <= getBucketWaste() &&
+        !(needsArgMap &&
+          hasBinaryAtHand(argMap, conv2dGenerator.getConfig()))) {
+      conv2dGenerator = miopen::Conv2dGenerator(
+          withBatchSize(conv2dGenerator.getConfig(), bucket));
+      if (failed(conv2dGenerator.isApplicable()))
+        return nullptr;
+      paddedBatch = bucket;
+    }
+  }
+
+  // The kernels of a split problem, and their binaries, are those of its
+  // batch tile, which all the batch sizes it divides share.
+  int64_t batchLaunches = 1;
+  size_t inputBatchStride = 0;
+  size_t outputBatchStride = 0;
+  if (llvm::Optional<miopen::Conv2dGenerator::Config> tileConfig =
+          splitBatch(conv2dGenerator.getConfig(), batchLaunches,
+                     inputBatchStride, outputBatchStride)) {
+    conv2dGenerator = miopen::Conv2dGenerator(*tileConfig);
+    if (failed(conv2dGenerator.isApplicable()))
+      return nullptr;
+  }
+  const auto &config = conv2dGenerator.getConfig();
+  if (needsArgMap && getBatchSize(config) != problemBatch)
+    argMap["batchsize"] = std::to_string(getBatchSize(config));
+
   MiirHandle_s *handle = new MiirHandle_s;
+  const std::lock_guard<std::mutex> lock(handle->getMutex());
 
   handle->triple = config.triple;
   handle->chip = config.chip;
   handle->features = config.features;
+  handle->problem = normalizeArguments(argMap);
+  handle->paddedBatch = paddedBatch;
+  handle->batchLaunches = batchLaunches;
+  handle->inputBatchStride = inputBatchStride;
+  handle->outputBatchStride = outputBatchStride;
 
   ModuleOp module = handle->getModule();
   OpBuilder builder(module.getContext());
+  conv2dGenerator.selectSolver(builder);
   handle->kernelCount = conv2dGenerator.getKernelCount(builder);
   handle->workspace = conv2dGenerator.getWorkspaceSize(module);
+  handle->persistentWorkspace = conv2dGenerator.hasPersistentWorkspace(builder);
 
   if (failed(conv2dGenerator.genConvModule(module, config.kernelId))) {
+    handle->module = nullptr;
+    delete handle;
     return nullptr;
   }
+
+#ifdef MIIR_ENABLE_ONLINE_TUNING
+  if (tuner) {
+    std::string arguments = formatArguments(argMap);
+    module.walk([&](Operation *op) {
+      if (!isa<miopen::Conv2DOp, miopen::Conv3DOp, miopen::Conv2DBwdDataOp,
+               miopen::Conv2DBwdWeightOp>(op) ||
+          op->hasAttr("perf_config"))
+        return;
+      if (llvm::Optional<std::string> perfConfig =
+              tuner->lookup(arguments, op)) {
+        op->setAttr("perf_config", builder.getStringAttr(*perfConfig));
+        handle->problem += "perf_config=" + *perfConfig + "\n";
+      }
+    });
+  }
+#endif
   return handle;
 }
 
+extern "C" MiirHandle miirCreateHandle(const char *arguments) {
+  mlir::miopen::Conv2dGenerator conv2dGenerator;
+  if (failed(conv2dGenerator.parseConvConfig(arguments))) {
+    return nullptr;
+  }
+  return createHandle(conv2dGenerator,
+                      [&]() { return tokenizeArguments(arguments); });
+}
+
+extern "C" MiirHandle
+miirCreateHandleFromProblem(const MiirConvProblem *problem) {
+  if (problem == nullptr || problem->operation == nullptr ||
+      problem->arch == nullptr || problem->dataType == nullptr ||
+      problem->inLayout == nullptr || problem->filLayout == nullptr ||
+      problem->outLayout == nullptr || problem->groupSize <= 0)
+    return nullptr;
+
+  llvm::Optional<miopen::ConvOpType> operation =
+      miopen::getConvOpTypeForName(problem->operation);
+  std::string dataType = problem->dataType;
+  // Only forward convolutions exist for int8
+  if (!operation.hasValue() ||
+      (operation.getValue() != miopen::ConvOpType::Fwd && dataType == "i8"))
+    return nullptr;
+
+  mlir::miopen::Conv2dGenerator conv2dGenerator(
+      "", "", "", problem->perfConfig ? problem->perfConfig : "",
+      problem->numCu, problem->xdlops, operation, dataType,
+      problem->dilationH, problem->dilationW, problem->strideH,
+      problem->strideW, problem->paddingH, problem->paddingH,
+      problem->paddingW, problem->paddingW, "", "", "",
+      problem->kernelName ? problem->kernelName : "");
+  if (failed(conv2dGenerator.parseArch(problem->arch)) ||
+      failed(conv2dGenerator.parseLayouts(
+          problem->inLayout, problem->filLayout, problem->outLayout)))
+    return nullptr;
+  conv2dGenerator.setKernelId(problem->kernelId);
+  conv2dGenerator.setSplitK(problem->splitK);
+  conv2dGenerator.setWinogradTile(problem->winogradTile);
+  conv2dGenerator.setSingleLaunch(problem->singleLaunch);
+  conv2dGenerator.setDeterministic(problem->deterministic);
+  conv2dGenerator.setReduceKBlocks(problem->reduceKBlocks);
+  conv2dGenerator.setXf32(problem->xf32);
+  conv2dGenerator.setFusedReduction(problem->fusedReduction);
+
+  // Filter sizes in the order parseConvConfig passes them
+  bool is3D = conv2dGenerator.isConv3D();
+  if (is3D)
+    conv2dGenerator.setDepthParams(problem->dilationD, problem->strideD,
+                                   problem->paddingD, problem->paddingD);
+  if (failed(conv2dGenerator.parseConvDims(
+          problem->batchSize, problem->groupSize, problem->inChannels,
+          problem->inH, problem->inW, problem->outChannels, problem->outH,
+          problem->outW, problem->filW, problem->filH, is3D ? problem->inD : 1,
+          is3D ? problem->outD : 1, is3D ? problem->filD : 1)))
+    return nullptr;
+
+  return createHandle(conv2dGenerator,
+                      [&]() { return getArgMap(*problem); });
+}
+
 extern "C" int miirGetKernelCount(MiirHandle mlirHandle) {
   MiirHandle_s *handle = static_cast<MiirHandle_s *>(mlirHandle);
   if (handle == nullptr)
@@ -155,12 +1113,40 @@ extern "C" int miirGetWorkspaceSize(MiirHandle mlirHandle) {
   return handle->workspace;
 }
 
+// The alignment of workspace offsets: that of a cache line, so that the
+// vector accesses of the kernels cover as few lines as in a buffer of their
+// own.
+static constexpr size_t kWorkspaceAlignment = 256;
+
+extern "C" MiirStatus miirGetWorkspaceInfo(MiirHandle mlirHandle,
+                                           MiirWorkspaceInfo *info) {
+  MiirHandle_s *handle = static_cast<MiirHandle_s *>(mlirHandle);
+  if (handle == nullptr || info == nullptr)
+    return MIIR_INVALID_PARAM;
+
+  // Every kernel of a problem with a workspace goes through it: the first
+  // one initializes it, by zeroing or transforming into it, and the last
+  // one reads the final results out of it.
+  info->size = handle->workspace;
+  info->alignment = kWorkspaceAlignment;
+  info->firstKernel = handle->workspace > 0 ? 0 : -1;
+  info->lastKernel = handle->workspace > 0 ? handle->kernelCount - 1 : -1;
+  info->persistent = handle->persistentWorkspace;
+  return MIIR_SUCCESS;
+}
+
 extern "C" MiirStatus miirDestroyHandle(MiirHandle mlirHandle) {
-  const std::lock_guard<std::mutex> lock(mutex);
   MiirHandle_s *handle = static_cast<MiirHandle_s *>(mlirHandle);
   if (handle == nullptr)
     return MIIR_INVALID_PARAM;
+  if (--handle->refCount > 0)
+    return MIIR_SUCCESS;
 
+  // The module goes away in the context, the handle after
+  {
+    const std::lock_guard<std::mutex> lock(handle->getMutex());
+    handle->module = nullptr;
+  }
   delete handle;
   return MIIR_SUCCESS;
 }
@@ -168,137 +1154,498 @@ extern "C" MiirStatus miirDestroyHandle(MiirHandle mlirHandle) {
 extern "C" MiirStatus miirGetExecutionDims(MiirHandle mlirHandle,
                                            size_t *globalSize,
                                            size_t *localSize) {
-  const std::lock_guard<std::mutex> lock(mutex);
   if (globalSize == nullptr || localSize == nullptr)
     return MIIR_INVALID_PARAM;
 
   MiirHandle_s *handle = static_cast<MiirHandle_s *>(mlirHandle);
   if (handle == nullptr)
     return MIIR_INVALID_PARAM;
+  const std::lock_guard<std::mutex> lock(handle->getMutex());
 
-  ModuleOp module = handle->getModule();
+  int32_t blockSize = 0;
+  int32_t gridSize = 0;
+  if (handle->binary) {
+    blockSize = handle->binary->blockSize;
+    gridSize = handle->binary->gridSize;
+  } else if (failed(
+                 getExecutionDims(handle->getModule(), blockSize, gridSize))) {
+    return MIIR_INVALID_MODULE;
+  }
 
-  auto getSizeAttr = [](const Attribute &attr, int32_t &size) {
-    if (!attr) {
-      return failure();
-    }
-    size = attr.template dyn_cast<IntegerAttr>().getInt();
-    return success();
-  };
+  *globalSize = gridSize * blockSize;
+  *localSize = blockSize;
+  return MIIR_SUCCESS;
+}
 
-  auto setReturn = [&](int32_t blockSize, int32_t gridSize) {
-    *globalSize = gridSize * blockSize;
-    *localSize = blockSize;
-  };
+// Read from the binary rather than from the module, as binaries from the
+// kernel library and the binary cache come without the module they were
+// lowered from.
+extern "C" MiirStatus miirGetKernelResources(MiirHandle mlirHandle,
+                                             MiirKernelResources *resources) {
+  if (resources == nullptr)
+    return MIIR_INVALID_PARAM;
 
-  int count = 0;
-  int32_t blockSize = 0;
-  int32_t gridSize = 0;
+  MiirHandle_s *handle = static_cast<MiirHandle_s *>(mlirHandle);
+  if (handle == nullptr)
+    return MIIR_INVALID_PARAM;
+  const std::lock_guard<std::mutex> lock(handle->getMutex());
 
-  // If mlirHandle contains result from miirLowerTuningParams(), it is still
-  // a mlir::func::FuncOp
-  module.walk([&](func::FuncOp funcOp) -> WalkResult {
-    auto statusBlock = getSizeAttr(funcOp->getAttr("block_size"), blockSize);
-    auto statusGrid = getSizeAttr(funcOp->getAttr("grid_size"), gridSize);
-    if (statusBlock.succeeded() && statusGrid.succeeded()) {
-      setReturn(blockSize, gridSize);
-    }
-    ++count;
-    return WalkResult::advance();
-  });
-  if (count == 1)
-    return MIIR_SUCCESS;
+  llvm::Optional<CachedBinary> lowered;
+  if (!handle->binary)
+    lowered = readBinary(handle->getModule());
+  const llvm::Optional<CachedBinary> &binary =
+      handle->binary ? handle->binary : lowered;
+  if (!binary)
+    return MIIR_INVALID_MODULE;
+  FailureOr<miopen::KernelResources> found = miopen::readKernelResources(
+      binary->hsaco, /*kernel=*/"", handle->chip, binary->blockSize);
+  if (failed(found))
+    return MIIR_INVALID_MODULE;
 
-  count = 0;
-  // If mlirHandle contains result from miirLowerTuningBin(), it is
-  // a LLVM::LLVMFuncOp
-  module.walk([&](LLVM::LLVMFuncOp funcOp) -> WalkResult {
-    auto statusBlock = getSizeAttr(funcOp->getAttr("block_size"), blockSize);
-    auto statusGrid = getSizeAttr(funcOp->getAttr("grid_size"), gridSize);
-    if (statusBlock.succeeded() && statusGrid.succeeded()) {
-      setReturn(blockSize, gridSize);
-    }
-    ++count;
-    return WalkResult::advance();
-  });
-  if (count == 1)
-    return MIIR_SUCCESS;
+  resources->vgprs = found->vgprCount;
+  resources->agprs = found->agprCount;
+  resources->sgprs = found->sgprCount;
+  resources->ldsSize = found->ldsSize;
+  resources->scratchSize = found->scratchSize;
+  resources->waveSize = found->waveSize;
+  resources->wavesPerSimd = found->wavesPerSimd;
+  return MIIR_SUCCESS;
+}
+
+extern "C" int miirGetPaddedBatchSize(MiirHandle mlirHandle) {
+  MiirHandle_s *handle = static_cast<MiirHandle_s *>(mlirHandle);
+  if (handle == nullptr)
+    return -1;
 
-  return MIIR_INVALID_MODULE;
+  return static_cast<int>(handle->paddedBatch);
 }
 
-extern "C" MiirStatus miirLowerTuningParams(MiirHandle mlirHandle) {
-  const std::lock_guard<std::mutex> lock(mutex);
+extern "C" MiirStatus miirGetBatchLaunches(MiirHandle mlirHandle,
+                                           int *launches,
+                                           size_t *inputStride,
+                                           size_t *outputStride) {
+  if (launches == nullptr || inputStride == nullptr ||
+      outputStride == nullptr)
+    return MIIR_INVALID_PARAM;
 
   MiirHandle_s *handle = static_cast<MiirHandle_s *>(mlirHandle);
   if (handle == nullptr)
     return MIIR_INVALID_PARAM;
 
-  miirLazyInit();
-  ModuleOp module = handle->getModule();
+  *launches = static_cast<int>(handle->batchLaunches);
+  *inputStride = handle->inputBatchStride;
+  *outputStride = handle->outputBatchStride;
+  return MIIR_SUCCESS;
+}
 
+// The options miirLowerBin builds kernels with, passing over the
+// `skipHeuristicConfigs` best default configs, and miirLowerTuningParams
+// derives their launch dimensions with.
+static miopen::KernelOptions getKernelOptions(int skipHeuristicConfigs) {
+  miopen::KernelOptions options;
+  options.skipHeuristicConfigs = skipHeuristicConfigs;
+  options.maxUnrolledOps = getMaxUnrolledOps();
+  return options;
+}
+
+// The perf_config the tuning passes pick for the kernel of `module` as the
+// perf dbs stand, empty if it takes none.
+static FailureOr<std::string> getTunedPerfConfig(ModuleOp module) {
+  OwningOpRef<ModuleOp> tuned = module.clone();
   PassManager pm(module.getContext(), PassManager::Nesting::Implicit);
+  miopen::buildTuningPipeline(pm, getKernelOptions(0));
+  if (failed(pm.run(*tuned)))
+    return failure();
+  std::string perfConfig;
+  tuned->walk([&](func::FuncOp func) {
+    if (auto attr = func->getAttrOfType<StringAttr>("perf_config"))
+      perfConfig = attr.getValue().str();
+  });
+  return perfConfig;
+}
 
-  miopen::KernelOptions opts;
-  opts.enableApplicability = true;
-  miopen::buildKernelPipeline(pm, opts);
+extern "C" MiirStatus miirLowerTuningParams(MiirHandle mlirHandle) {
+  MiirHandle_s *handle = static_cast<MiirHandle_s *>(mlirHandle);
+  if (handle == nullptr)
+    return MIIR_INVALID_PARAM;
+  const std::lock_guard<std::mutex> lock(handle->getMutex());
 
-  auto status = pm.run(module);
+  // Binaries of the kernel library and the binary cache come with the
+  // launch dimensions they were built for
+  if (handle->binary)
+    return MIIR_SUCCESS;
 
-  return status.succeeded() ? MIIR_SUCCESS : MIIR_BUILD_FAILURE;
+  // The launch dimensions follow from the tuning parameters alone, so they
+  // are worked out by the passes of miirLowerBin that pick them, with the
+  // same options and spill retries, on a copy of the module. They are only
+  // noted on its functions for miirGetExecutionDims.
+  miirLazyInit();
+  ModuleOp module = handle->getModule();
+  OwningOpRef<ModuleOp> tuned = module.clone();
+  PassManager pm(module.getContext(), PassManager::Nesting::Implicit);
+  miopen::buildTuningPipeline(pm,
+                              getKernelOptions(handle->skipHeuristicConfigs));
+  if (failed(pm.run(*tuned)))
+    return MIIR_BUILD_FAILURE;
+
+  SmallVector<func::FuncOp, 1> funcs, tunedFuncs;
+  module.walk([&](func::FuncOp func) { funcs.push_back(func); });
+  tuned->walk([&](func::FuncOp func) { tunedFuncs.push_back(func); });
+  bool found = false;
+  for (auto pair : llvm::zip(funcs, tunedFuncs)) {
+    Attribute blockSize = std::get<1>(pair)->getAttr("block_size");
+    Attribute gridSize = std::get<1>(pair)->getAttr("grid_size");
+    if (!blockSize || !gridSize)
+      continue;
+    std::get<0>(pair)->setAttr("block_size", blockSize);
+    std::get<0>(pair)->setAttr("grid_size", gridSize);
+    found = true;
+  }
+  return found ? MIIR_SUCCESS : MIIR_INVALID_MODULE;
 }
 
 extern "C" MiirStatus miirLowerBin(MiirHandle mlirHandle) {
-  const std::lock_guard<std::mutex> lock(mutex);
-
   MiirHandle_s *handle = static_cast<MiirHandle_s *>(mlirHandle);
   if (handle == nullptr)
     return MIIR_INVALID_PARAM;
+  const std::lock_guard<std::mutex> lock(handle->getMutex());
 
+  // The shared perf dbs are layered in before the binary cache key takes
+  // the version of the perf dbs
   miirLazyInit();
-  ModuleOp module = handle->getModule();
+  // Handles made before the kernel library or cache directory were set have
+  // no problem to key
+  const KernelLibrary *library =
+      handle->problem.empty() ? nullptr : KernelLibrary::get();
+  std::string libraryKey;
+  if (library)
+    libraryKey = getBinaryKey(*handle, /*withPerfDbs=*/false);
+  if (library && library->contains(libraryKey)) {
+    FailureOr<std::string> perfConfig =
+        getTunedPerfConfig(handle->getModule());
+    if (succeeded(perfConfig))
+      handle->binary = library->lookup(libraryKey, *perfConfig);
+    if (handle->binary)
+      return MIIR_SUCCESS;
+  }
+  std::string cacheDir =
+      handle->problem.empty() ? std::string() : getBinaryCacheDir();
+  std::string cacheKey;
+  if (!cacheDir.empty()) {
+    cacheKey = getBinaryKey(*handle, /*withPerfDbs=*/true);
+    handle->binary = lookupBinary(cacheDir, cacheKey);
+    if (handle->binary)
+      return MIIR_SUCCESS;
+  }
 
-  PassManager pm(module.getContext(), PassManager::Nesting::Implicit);
+  // Kept for rebuilding with a lesser default config if the heuristics pick
+  // one that spills
+  OwningOpRef<ModuleOp> original = handle->getModule().clone();
+
+  auto build = [&](ModuleOp module, int skipHeuristicConfigs) {
+    // The pipelines run in pass managers of their own for the compile
+    // profile to tell them apart
+    MLIRContext *context = module.getContext();
+    PassManager kernelPm(context, PassManager::Nesting::Implicit);
+    PassManager backendPm(context, PassManager::Nesting::Implicit);
+    const char *profileEnv = std::getenv("MIIR_COMPILE_PROFILE");
+    if (profileEnv && llvm::StringRef(profileEnv) == "1") {
+      handle->profile = std::make_unique<miopen::CompileProfile>();
+      handle->profile->attach(kernelPm, "kernel");
+      handle->profile->attach(backendPm, "backend");
+    }
 
-  miopen::buildKernelPipeline(pm);
+    miopen::buildKernelPipeline(kernelPm,
+                                getKernelOptions(skipHeuristicConfigs));
 
-  miopen::BackendOptions opts;
-  opts.triple = handle->triple;
-  opts.chip = handle->chip;
-  opts.features = handle->features;
-  miopen::buildBackendPipeline(pm, opts);
+    miopen::BackendOptions opts;
+    opts.triple = handle->triple;
+    opts.chip = handle->chip;
+    opts.features = handle->features;
+    // The kernel cache is opt-in, by naming the directory it persists to
+    opts.kernelCache = !getBinaryCacheDir().empty();
+    miopen::buildBackendPipeline(backendPm, opts);
 
-  auto status = pm.run(module);
+    return success(succeeded(kernelPm.run(module)) &&
+                   succeeded(backendPm.run(module)));
+  };
+
+  if (failed(build(handle->getModule(), 0)))
+    return MIIR_BUILD_FAILURE;
+
+  // Move down the ranking of the default configs while they spill, keeping
+  // the last build once there are none left to try
+  for (int skip = 1;
+       skip <= miopen::kMaxSpillRetries &&
+       miopen::hasHeuristicSpills(handle->getModule());
+       ++skip) {
+    OwningOpRef<ModuleOp> retry = original->clone();
+    if (failed(build(*retry, skip)))
+      break;
+    handle->module = std::move(retry);
+    handle->skipHeuristicConfigs = skip;
+  }
 
-  return status.succeeded() ? MIIR_SUCCESS : MIIR_BUILD_FAILURE;
+  if (!cacheDir.empty()) {
+    handle->binary = readBinary(handle->getModule());
+    if (handle->binary)
+      storeBinary(cacheDir, cacheKey, *handle->binary);
+  }
+  return MIIR_SUCCESS;
+}
+
+// Compile pool: the threads that miirCreateHandles, miirLowerBinBatch and
+// miirLowerBinAsync work on, MIIR_COMPILE_THREADS of them or one per
+// hardware thread. Sharing one pool keeps concurrent batches and
+// asynchronous compiles from oversubscribing the machine. Batches wait on
+// task groups of their own, which a task of the pool may do too. Leaked
+// like the context pool.
+static llvm::ThreadPool &getCompilePool() {
+  static llvm::ThreadPool *pool = [] {
+    llvm::ThreadPoolStrategy strategy = llvm::hardware_concurrency();
+    if (const char *env = std::getenv("MIIR_COMPILE_THREADS")) {
+      int threads = std::atoi(env);
+      if (threads > 0)
+        strategy = llvm::hardware_concurrency(threads);
+    }
+    return new llvm::ThreadPool(strategy);
+  }();
+  return *pool;
+}
+
+extern "C" MiirStatus miirLowerBinAsync(MiirHandle mlirHandle,
+                                        MiirLowerBinCallback callback,
+                                        void *userData) {
+  MiirHandle_s *handle = static_cast<MiirHandle_s *>(mlirHandle);
+  if (handle == nullptr || callback == nullptr)
+    return MIIR_INVALID_PARAM;
+
+  // The task holds a reference of its own, so the caller may destroy the
+  // handle before the callback ran
+  ++handle->refCount;
+  getCompilePool().async([handle, callback, userData]() {
+    MiirStatus status = miirLowerBin(handle);
+    callback(handle, status, userData);
+    miirDestroyHandle(handle);
+  });
+  return MIIR_SUCCESS;
+}
+
+extern "C" MiirStatus miirCreateHandles(const char **options, int count,
+                                        MiirHandle *handles) {
+  if (count < 0 || (count > 0 && (options == nullptr || handles == nullptr)))
+    return MIIR_INVALID_PARAM;
+
+  // Identical problems are created once, from the options of the first of
+  // them, however their options are ordered or repeated
+  std::map<std::string, std::pair<const char *, std::vector<int>>> problems;
+  for (int i = 0; i < count; ++i) {
+    if (options[i] == nullptr)
+      return MIIR_INVALID_PARAM;
+    auto &problem =
+        problems[normalizeArguments(tokenizeArguments(options[i]))];
+    if (problem.second.empty())
+      problem.first = options[i];
+    problem.second.push_back(i);
+  }
+
+  llvm::ThreadPoolTaskGroup group(getCompilePool());
+  for (auto &problem : problems)
+    group.async([&problem = problem.second, handles]() {
+      MiirHandle handle = miirCreateHandle(problem.first);
+      if (handle != nullptr)
+        static_cast<MiirHandle_s *>(handle)->refCount =
+            static_cast<int>(problem.second.size());
+      for (int i : problem.second)
+        handles[i] = handle;
+    });
+  group.wait();
+
+  bool created = std::none_of(handles, handles + count,
+                              [](MiirHandle handle) { return !handle; });
+  return created ? MIIR_SUCCESS : MIIR_INVALID_PARAM;
+}
+
+extern "C" MiirStatus miirLowerBinBatch(MiirHandle *handles, int count,
+                                        MiirStatus *statuses) {
+  if (count < 0 || (count > 0 && handles == nullptr))
+    return MIIR_INVALID_PARAM;
+
+  // A handle is lowered once, however often it appears
+  std::map<MiirHandle, MiirStatus> results;
+  for (int i = 0; i < count; ++i)
+    results.emplace(handles[i], MIIR_INVALID_PARAM);
+
+  llvm::ThreadPoolTaskGroup group(getCompilePool());
+  for (auto &result : results)
+    if (result.first != nullptr)
+      group.async(
+          [&result]() { result.second = miirLowerBin(result.first); });
+  group.wait();
+
+  MiirStatus status = MIIR_SUCCESS;
+  for (int i = 0; i < count; ++i) {
+    MiirStatus handleStatus = results[handles[i]];
+    if (statuses != nullptr)
+      statuses[i] = handleStatus;
+    if (handleStatus != MIIR_SUCCESS)
+      status = handleStatus;
+  }
+  return status;
+}
+
+extern "C" MiirStatus miirBuildKernelLibrary(const char **options, int count,
+                                             const char *path) {
+  if (path == nullptr || count < 0 || (count > 0 && options == nullptr))
+    return MIIR_INVALID_PARAM;
+
+  std::vector<MiirHandle> handles(count, nullptr);
+  MiirStatus status = miirCreateHandles(options, count, handles.data());
+
+  // The parameters each problem is built with, picked before lowering, for
+  // lookups to check the perf dbs still pick them
+  std::vector<std::string> perfConfigs(count);
+  if (status == MIIR_SUCCESS)
+    miirLazyInit();
+  for (int i = 0; i < count && status == MIIR_SUCCESS; ++i) {
+    MiirHandle_s *handle = static_cast<MiirHandle_s *>(handles[i]);
+    const std::lock_guard<std::mutex> lock(handle->getMutex());
+    FailureOr<std::string> perfConfig =
+        getTunedPerfConfig(handle->getModule());
+    if (failed(perfConfig))
+      status = MIIR_BUILD_FAILURE;
+    else
+      perfConfigs[i] = std::move(*perfConfig);
+  }
+  if (status == MIIR_SUCCESS)
+    status = miirLowerBinBatch(handles.data(), count, nullptr);
+
+  std::map<std::string, KernelLibrary::Binary> binaries;
+  for (int i = 0; i < count && status == MIIR_SUCCESS; ++i) {
+    MiirHandle_s *handle = static_cast<MiirHandle_s *>(handles[i]);
+    const std::lock_guard<std::mutex> lock(handle->getMutex());
+    // Without the kernel library or binary cache on, handles have no problem
+    if (handle->problem.empty())
+      handle->problem = normalizeArguments(tokenizeArguments(options[i]));
+    llvm::Optional<CachedBinary> binary =
+        handle->binary ? handle->binary : readBinary(handle->getModule());
+    if (!binary)
+      status = MIIR_BUILD_FAILURE;
+    else
+      binaries[getBinaryKey(*handle, /*withPerfDbs=*/false)] = {
+          std::move(*binary), perfConfigs[i]};
+  }
+  for (MiirHandle handle : handles)
+    if (handle != nullptr)
+      miirDestroyHandle(handle);
+
+  if (status == MIIR_SUCCESS && failed(KernelLibrary::write(path, binaries)))
+    status = MIIR_INVALID_PARAM;
+  return status;
+}
+
+// The hsaco of a lowered handle, empty if there is none. It lives in the
+// handle when read from the binary cache, and otherwise in the storage of the
+// binary attribute, which the context keeps for as long as it lives, so past
+// the handle.
+static llvm::StringRef getBinary(MiirHandle_s &handle) {
+  if (handle.binary)
+    return handle.binary->hsaco;
+  llvm::StringRef hsaco;
+  handle.getModule().walk([&](gpu::GPUModuleOp gpuModule) {
+    if (auto hsacoAttr = gpuModule->getAttrOfType<StringAttr>(
+            gpu::getDefaultGpuBinaryAnnotation()))
+      hsaco = hsacoAttr.getValue();
+  });
+  return hsaco;
 }
 
 extern "C" MiirStatus miirBufferGet(MiirHandle mlirHandle, char *buffer,
                                     size_t *size) {
-  const std::lock_guard<std::mutex> lock(mutex);
   if ((buffer == nullptr) && (size == nullptr))
     return MIIR_INVALID_PARAM;
 
   MiirHandle_s *handle = static_cast<MiirHandle_s *>(mlirHandle);
-  ModuleOp module = handle->getModule();
+  const std::lock_guard<std::mutex> lock(handle->getMutex());
+  llvm::StringRef hsaco = getBinary(*handle);
+  if (hsaco.empty())
+    return MIIR_SUCCESS;
 
   // 1st call: give client the size of buffer to allocate
-  if ((buffer == nullptr) && (size != nullptr)) {
-    module.walk([&](gpu::GPUModuleOp gpuModule) {
-      auto hsacoAttr = gpuModule->getAttrOfType<StringAttr>(gpu::getDefaultGpuBinaryAnnotation());
-      if (hsacoAttr) {
-        *size = hsacoAttr.getValue().size();
-      }
-    });
-    // 2nd call: copy the hsaco to the target buffer
-  } else {
-    module.walk([&](gpu::GPUModuleOp gpuModule) {
-      auto hsacoAttr = gpuModule->getAttrOfType<StringAttr>(gpu::getDefaultGpuBinaryAnnotation());
-      if (hsacoAttr) {
-        std::string hsaco = hsacoAttr.getValue().str();
-        std::copy(hsaco.begin(), hsaco.end(), buffer);
-      }
-    });
-  }
+  if (buffer == nullptr)
+    *size = hsaco.size();
+  // 2nd call: copy the hsaco to the target buffer
+  else
+    std::copy(hsaco.begin(), hsaco.end(), buffer);
+  return MIIR_SUCCESS;
+}
+
+extern "C" MiirStatus miirBufferView(MiirHandle mlirHandle,
+                                     const char **buffer, size_t *size) {
+  MiirHandle_s *handle = static_cast<MiirHandle_s *>(mlirHandle);
+  if (handle == nullptr || buffer == nullptr || size == nullptr)
+    return MIIR_INVALID_PARAM;
+
+  const std::lock_guard<std::mutex> lock(handle->getMutex());
+  llvm::StringRef hsaco = getBinary(*handle);
+  if (hsaco.empty())
+    return MIIR_INVALID_MODULE;
+  *buffer = hsaco.data();
+  *size = hsaco.size();
+  return MIIR_SUCCESS;
+}
+
+extern "C" MiirStatus miirGetCompileProfile(MiirHandle mlirHandle,
+                                            MiirProfileFormat format,
+                                            char *buffer, size_t *size) {
+  MiirHandle_s *handle = static_cast<MiirHandle_s *>(mlirHandle);
+  if (handle == nullptr || size == nullptr)
+    return MIIR_INVALID_PARAM;
+
+  const std::lock_guard<std::mutex> lock(handle->getMutex());
+  if (!handle->profile)
+    return MIIR_INVALID_MODULE;
+  std::string profile;
+  llvm::raw_string_ostream os(profile);
+  handle->profile->print(os, format == MIIR_PROFILE_TRACE
+                                 ? miopen::CompileProfile::Format::ChromeTrace
+                                 : miopen::CompileProfile::Format::JSON);
+  os.flush();
+
+  if (buffer == nullptr)
+    *size = profile.size();
+  else
+    std::copy_n(profile.begin(), std::min(*size, profile.size()), buffer);
+  return MIIR_SUCCESS;
+}
+
+extern "C" MiirStatus miirGetTuningStats(MiirTuningStats *stats) {
+  if (stats == nullptr)
+    return MIIR_INVALID_PARAM;
+
+  using miopen::TuningSource;
+  stats->perfDbHits = miopen::getTuningSourceCount(TuningSource::PerfDb);
+  stats->perfDbMisses =
+      miopen::getTuningSourceCount(TuningSource::PerfDbOtherCu) +
+      miopen::getTuningSourceCount(TuningSource::PerfDbNeighbor) +
+      miopen::getTuningSourceCount(TuningSource::Heuristic) +
+      miopen::getTuningSourceCount(TuningSource::Padding);
+  stats->fallbacks = miopen::getTuningSourceCount(TuningSource::Fallback);
+  stats->spillFallbacks =
+      miopen::getTuningSourceCount(TuningSource::SpillFallback);
+  return MIIR_SUCCESS;
+}
+
+extern "C" MiirStatus miirResetTuningStats() {
+  miopen::resetTuningSourceCounts();
+  return MIIR_SUCCESS;
+}
+
+extern "C" MiirStatus miirShutdown() {
+  getCompilePool().wait();
+#ifdef MIIR_ENABLE_ONLINE_TUNING
+  if (OnlineTuner *tuner = OnlineTuner::get())
+    tuner->shutdown();
+#endif
   return MIIR_SUCCESS;
 }
@@ -23,18 +23,18 @@
 #include "mlir/Dialect/MIOpen/MIOpen.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/InitLLVM.h"
-#include "llvm/Support/TargetSelect.h"
 
 #include "mlir/Dialect/LLVMIR/Transforms/Passes.h"
 #include "mlir/ExecutionEngine/JitRunner.h"
 #include "mlir/ExecutionEngine/OptUtils.h"
 #include "mlir/IR/BuiltinOps.h"
-#include "mlir/InitAllDialects.h"
+#include "mlir/InitMIOpenDialects.h"
+#include "mlir/InitMIOpenTargets.h"
 #include "mlir/Transforms/DialectConversion.h"
 
 #include "mlir/Conversion/GPUCommon/GPUCommonPass.h"
 #include "mlir/Dialect/GPU/Transforms/Passes.h"
-#include "mlir/Dialect/MIOpen/utility/IsaNameSplitter.h"
+#include "mlir/ExecutionEngine/DeviceInfo.h"
 #include "mlir/Pass/PassManager.h"
 #include "mlir/Support/FileUtilities.h"
 #include "mlir/Transforms/Passes.h"
@@ -42,11 +42,6 @@
 #include <cstdlib>
 #include <mutex>
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wpedantic"
-#include "hip/hip_runtime.h"
-#pragma GCC diagnostic pop
-
 using namespace mlir;
 using namespace llvm;
 
@@ -74,28 +69,30 @@ static cl::opt<bool>
 
 static constexpr const char kTargetTriple[] = "amdgcn-amd-amdhsa";
 
-// As per the coding standard of LLVM, anonymous namespace should only be used
-// for class declarations.
-// https://llvm.org/docs/CodingStandards.html#anonymous-namespaces
-// FIXME: avoid calling hipGetDeviceProperties in mlir-rocm-runner to prevent
-// the out-of-handle problem when running multiple rocm instances concurrently.
-static void getGpuGCNArchName(hipDevice_t device, std::string &gcnArchName) {
-  hipDeviceProp_t props;
-  hipError_t result = hipGetDeviceProperties(&props, device);
-  if (result != hipSuccess) {
-    gcnArchName = "";
-    llvm_unreachable("hipGetDeviceProperties() should never fail");
-    return;
-  }
-
-  const char *pArchName = props.gcnArchName;
-  gcnArchName.assign(pArchName);
-}
-
 namespace test {
 void registerTestDialect(DialectRegistry &);
 } // namespace test
 
+// Compile for the first device unless told otherwise.
+static LogicalResult detectTarget() {
+  if (!tripleName.empty() || !targetChip.empty() || !features.empty())
+    return success();
+  const miopen::DeviceInfo *device = miopen::getDeviceInfo(0);
+  if (!device)
+    return failure();
+  tripleName = kTargetTriple;
+  targetChip = device->chip;
+  features = device->features;
+  return success();
+}
+
+// The kernels compiled into the cached objects are for the target detected.
+static std::string getTargetKey() {
+  if (failed(detectTarget()))
+    return "";
+  return tripleName + ":" + targetChip + ":" + features;
+}
+
 static LogicalResult runMLIRPasses(ModuleOp m) {
   PassManager pm(m.getContext());
   applyPassManagerCLOptions(pm);
@@ -106,16 +103,8 @@ static LogicalResult runMLIRPasses(ModuleOp m) {
     return failure();
   }
 
-  if (tripleName.empty() && targetChip.empty() && features.empty()) {
-    tripleName = kTargetTriple;
-    std::string gcnArchName;
-    getGpuGCNArchName(0, gcnArchName);
-    auto status =
-        IsaNameSplitter::parseArchName(gcnArchName, targetChip, features);
-    if (status.failed()) {
-      llvm_unreachable("HIP ArchName parsing should never fail.");
-    }
-  }
+  if (failed(detectTarget()))
+    return failure();
 
   // Find MIOpen module and compile kernel funcs
   ModuleOp kernelModule = m;
@@ -159,29 +148,17 @@ static LogicalResult runMLIRPasses(ModuleOp m) {
 int main(int argc, char **argv) {
   registerPassManagerCLOptions();
   llvm::InitLLVM y(argc, argv);
-  llvm::InitializeAllTargets();
-  llvm::InitializeAllTargetInfos();
-  llvm::InitializeAllTargetMCs();
-  llvm::InitializeAllAsmParsers();
-  llvm::InitializeAllAsmPrinters();
-  llvm::InitializeNativeTarget();
-  llvm::InitializeNativeTargetAsmPrinter();
-  llvm::InitializeNativeTargetAsmParser();
-
-  // Initialize LLVM AMDGPU backend.
-  LLVMInitializeAMDGPUTarget();
-  LLVMInitializeAMDGPUTargetInfo();
-  LLVMInitializeAMDGPUTargetMC();
-  LLVMInitializeAMDGPUAsmPrinter();
+  initializeMIOpenHostTargets();
 
   DialectRegistry registry;
-  registerAllDialects(registry);
+  registerMIOpenFlowDialects(registry);
 #ifdef MLIR_INCLUDE_TESTS
   ::test::registerTestDialect(registry);
 #endif
 
   mlir::JitRunnerConfig jitRunnerConfig;
   jitRunnerConfig.mlirTransformer = runMLIRPasses;
+  jitRunnerConfig.cacheKey = getTargetKey;
 
   return mlir::JitRunnerMain(argc, argv, registry, jitRunnerConfig);
 }
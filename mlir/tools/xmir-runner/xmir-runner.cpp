@@ -26,17 +26,18 @@
 #include "mlir/InitAllTranslations.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/InitLLVM.h"
-#include "llvm/Support/TargetSelect.h"
 
 #include "mlir/Dialect/LLVMIR/Transforms/Passes.h"
 #include "mlir/ExecutionEngine/JitRunner.h"
 #include "mlir/ExecutionEngine/OptUtils.h"
 #include "mlir/IR/BuiltinOps.h"
-#include "mlir/InitAllDialects.h"
+#include "mlir/InitMIOpenDialects.h"
+#include "mlir/InitMIOpenTargets.h"
 #include "mlir/InitAllPasses.h"
 #include "mlir/Pass/PassManager.h"
 #include "mlir/Target/LLVMIR/Dialect/LLVMIR/LLVMToLLVMIRTranslation.h"
 #include "mlir/Target/LLVMIR/Dialect/ROCDL/ROCDLToLLVMIRTranslation.h"
+#include "mlir/Translation/ModuleArchive.h"
 #include "mlir/Transforms/DialectConversion.h"
 
 #include <cstdlib>
@@ -49,6 +50,18 @@ using namespace llvm;
 static cl::opt<bool> cpuOnly("cpu-only", cl::desc("Target CPU only"),
                              cl::init(false));
 
+static cl::opt<bool>
+    parallelCPULoops("parallel-cpu-loops",
+                     cl::desc("Run parallel loops of CPU-only code on all "
+                              "worker threads"),
+                     cl::init(false));
+
+static cl::opt<bool>
+    optimizeCPULoops("optimize-cpu-loops",
+                     cl::desc("Tile the loop nests of CPU-only code for the "
+                              "cache and vectorize their innermost loops"),
+                     cl::init(false));
+
 namespace test {
 void registerTestDialect(DialectRegistry &);
 } // namespace test
@@ -58,30 +71,28 @@ static LogicalResult runMLIRPasses(ModuleOp m) {
   PassManager pm(m.getContext());
   applyPassManagerCLOptions(pm);
 
-  xmir::buildRunnerPipeline(pm);
+  xmir::RunnerOptions opts;
+  opts.cpuOnly = cpuOnly;
+  opts.parallelCPULoops = parallelCPULoops;
+  opts.optimizeCPULoops = optimizeCPULoops;
+  xmir::buildRunnerPipeline(pm, opts);
   return pm.run(m);
 }
 
 int main(int argc, char **argv) {
   registerPassManagerCLOptions();
   llvm::InitLLVM y(argc, argv);
-  llvm::InitializeAllTargets();
-  llvm::InitializeAllTargetInfos();
-  llvm::InitializeAllTargetMCs();
-  llvm::InitializeAllAsmParsers();
-  llvm::InitializeAllAsmPrinters();
-  llvm::InitializeNativeTarget();
-  llvm::InitializeNativeTargetAsmPrinter();
-  llvm::InitializeNativeTargetAsmParser();
+  mlir::initializeMIOpenHostTargets();
 
   DialectRegistry registry;
-  mlir::registerAllDialects(registry);
+  mlir::registerMIOpenFlowDialects(registry);
   mlir::registerLLVMDialectTranslation(registry);
 #ifdef MLIR_INCLUDE_TESTS
   ::test::registerTestDialect(registry);
 #endif
 
   mlir::JitRunnerConfig jitRunnerConfig;
+  jitRunnerConfig.mlirParser = miopen::parseModuleOrArchive;
   jitRunnerConfig.mlirTransformer = runMLIRPasses;
 
   return mlir::JitRunnerMain(argc, argv, registry, jitRunnerConfig);
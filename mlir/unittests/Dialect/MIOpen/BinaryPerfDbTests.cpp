@@ -0,0 +1,128 @@
+//===- BinaryPerfDbTests.cpp - Tests for the MIOpen binary perf db --------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/MIOpen/Tuning/BinaryPerfDb.h"
+#include "mlir/Dialect/MIOpen/Tuning/GridwiseGemmParams.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::miopen;
+
+namespace {
+class BinaryPerfDbTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("perfdb", "bin", path));
+  }
+  void TearDown() override { llvm::sys::fs::remove(path); }
+
+  std::unique_ptr<BinaryPerfDb> writeAndOpen(BinaryPerfDbWriter &writer) {
+    std::error_code ec;
+    {
+      llvm::raw_fd_ostream os(path, ec);
+      EXPECT_FALSE(ec);
+      writer.write(os);
+    }
+    return BinaryPerfDb::open(path);
+  }
+
+  llvm::SmallString<128> path;
+};
+} // namespace
+
+TEST_F(BinaryPerfDbTest, RoundTrip) {
+  std::string keyA = BinaryPerfDb::makeKey("gfx908", 120, {"in_h", "layout"},
+                                           {"14", "NCHW"});
+  std::string keyB = BinaryPerfDb::makeKey("gfx908", 120, {"in_h", "layout"},
+                                           {"28", "NCHW"});
+  BinaryPerfDbWriter writer;
+  writer.add(keyB, "SolverX", "128,128,8,64,64,1,0,0");
+  writer.add(keyA, "SolverY", "64,64,4,32,32,4,1,1");
+  writer.add(keyA, "SolverX", "32,64,4,32,64,1,0,0");
+  // Later duplicates of a (key, solver) pair are dropped.
+  writer.add(keyA, "SolverX", "0,0,0,0,0,0,0,0");
+
+  std::unique_ptr<BinaryPerfDb> db = writeAndOpen(writer);
+  ASSERT_TRUE(db);
+  EXPECT_EQ(db->size(), 3u);
+  EXPECT_EQ(db->find(keyA, "SolverX"), llvm::StringRef("32,64,4,32,64,1,0,0"));
+  EXPECT_EQ(db->find(keyA, "SolverY"), llvm::StringRef("64,64,4,32,32,4,1,1"));
+  EXPECT_EQ(db->find(keyB, "SolverX"),
+            llvm::StringRef("128,128,8,64,64,1,0,0"));
+  EXPECT_FALSE(db->find(keyB, "SolverY"));
+  EXPECT_FALSE(db->find("gfx90a;110", "SolverX"));
+}
+
+TEST_F(BinaryPerfDbTest, NumCus) {
+  BinaryPerfDbWriter writer;
+  for (size_t numCu : {120, 60, 120})
+    for (llvm::StringRef inH : {"14", "28"})
+      writer.add(BinaryPerfDb::makeKey("gfx908", numCu, {"in_h"}, {inH.str()}),
+                 "SolverX", "64,64,4,32,32,4,1,1");
+  writer.add(BinaryPerfDb::makeKey("gfx90a", 104, {"in_h"}, {"14"}), "SolverX",
+             "64,64,4,32,32,4,1,1");
+
+  std::unique_ptr<BinaryPerfDb> db = writeAndOpen(writer);
+  ASSERT_TRUE(db);
+  EXPECT_EQ(db->getNumCus("gfx908").vec(), std::vector<size_t>({60, 120}));
+  EXPECT_EQ(db->getNumCus("gfx90a").vec(), std::vector<size_t>({104}));
+  EXPECT_TRUE(db->getNumCus("gfx906").empty());
+}
+
+TEST_F(BinaryPerfDbTest, FastestTimeWins) {
+  std::string key = BinaryPerfDb::makeKey("gfx908", 120, {"in_h"}, {"14"});
+  BinaryPerfDbWriter writer;
+  writer.add(key, "SolverX", "32,64,4,32,64,1,0,0");
+  writer.add(key, "SolverX", "64,64,4,32,32,4,1,1", 2.5);
+  writer.add(key, "SolverX", "128,128,8,64,64,1,0,0", 1.5);
+  writer.add(key, "SolverY", "32,64,4,32,64,1,0,0");
+  writer.add(key, "SolverY", "64,64,4,32,32,4,1,1");
+
+  std::unique_ptr<BinaryPerfDb> db = writeAndOpen(writer);
+  ASSERT_TRUE(db);
+  EXPECT_EQ(db->size(), 2u);
+  // A measured entry beats an unmeasured one, and a faster one a slower one.
+  EXPECT_EQ(db->find(key, "SolverX"),
+            llvm::StringRef("128,128,8,64,64,1,0,0"));
+  // Between unmeasured entries, the first added wins.
+  EXPECT_EQ(db->find(key, "SolverY"), llvm::StringRef("32,64,4,32,64,1,0,0"));
+}
+
+TEST_F(BinaryPerfDbTest, RejectsGarbage) {
+  std::error_code ec;
+  {
+    llvm::raw_fd_ostream os(path, ec);
+    ASSERT_FALSE(ec);
+    os << "not a perf db";
+  }
+  EXPECT_FALSE(BinaryPerfDb::open(path));
+}
+
+TEST(PerfConfigTest, OptionalLdsStages) {
+  InitParamsXDL params;
+  ASSERT_TRUE(params.deserialize("64,64,4,32,32,4,1,1"));
+  EXPECT_EQ(params.gemmKPack, 4);
+  EXPECT_EQ(params.ldsStages, 0);
+  std::ostringstream unpipelined;
+  params.serialize(unpipelined);
+  EXPECT_EQ(unpipelined.str(), "64,64,4,32,32,4,1,1");
+
+  ASSERT_TRUE(params.deserialize("64,64,4,32,32,4,1,1,3"));
+  EXPECT_EQ(params.ldsStages, 3);
+  std::ostringstream pipelined;
+  params.serialize(pipelined);
+  EXPECT_EQ(pipelined.str(), "64,64,4,32,32,4,1,1,3");
+
+  // A bad stage count leaves the params alone.
+  EXPECT_FALSE(params.deserialize("32,32,4,32,32,1,0,0,0"));
+  EXPECT_EQ(params.gemmMPerBlock, 64);
+  EXPECT_EQ(params.ldsStages, 3);
+}
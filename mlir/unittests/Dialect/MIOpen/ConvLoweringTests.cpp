@@ -0,0 +1,200 @@
+//===- ConvLoweringTests.cpp - Tests for the convolution solvers ----------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/Linalg/IR/Linalg.h"
+#include "mlir/Dialect/MIOpen/Generator/Conv2dGenerator.h"
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/MIOpen/Pipelines.h"
+#include "mlir/Dialect/MIOpen/Tuning/UtilityParams.h"
+#include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/InitMIOpenDialects.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "gtest/gtest.h"
+
+#include <string>
+
+using namespace mlir;
+using namespace mlir::miopen;
+
+namespace {
+/// Options of a forward fp32 convolution of `groups` groups of `channels`
+/// input and output channels each, with a 3x3 filter and unit strides.
+std::string convArguments(int64_t groups, int64_t channels,
+                          const std::string &extra) {
+  std::string total = std::to_string(groups * channels);
+  return " --operation conv2d --arch gfx908 --num_cu 120"
+         " --fil_layout GNCHW --in_layout NGCHW --out_layout NGCHW"
+         " --in_type fp32 --fil_type fp32 --out_type fp32"
+         " --batchsize 4 --groupsize " +
+         std::to_string(groups) + " --in_channels " + total +
+         " --out_channels " + total +
+         " --in_h 16 --in_w 16 --out_h 14 --out_w 14 --fil_h 3 --fil_w 3"
+         " --dilation_h 1 --dilation_w 1 --conv_stride_h 1"
+         " --conv_stride_w 1 --padding_h 0 --padding_w 0" +
+         extra;
+}
+
+/// A kernel of an i8 convolution whose output a tosa.rescale requantizes
+/// into i8 with one scale per output channel.
+const char *requantizedConvKernel = R"(
+func.func @requant(%in: tensor<1x8x8x16xi8>, %fil: tensor<16x3x3x16xi8>)
+    -> tensor<1x6x6x16xi8>
+    attributes {kernel, arch = "gfx908", num_cu = 120 : i64,
+                xdlopsV2 = true} {
+  %bias = "tosa.const"() {value = dense<0> : tensor<16xi32>}
+      : () -> tensor<16xi32>
+  %acc = "tosa.conv2d"(%in, %fil, %bias)
+      {dilation = [1, 1], pad = [0, 0, 0, 0], stride = [1, 1]}
+      : (tensor<1x8x8x16xi8>, tensor<16x3x3x16xi8>, tensor<16xi32>)
+      -> tensor<1x6x6x16xi32>
+  %out = "tosa.rescale"(%acc)
+      {input_zp = 0 : i32, output_zp = -3 : i32,
+       multiplier = [1073741824, 1073741824, 1073741824, 1073741824,
+                     1073741824, 1073741824, 1073741824, 1073741824,
+                     1518500250, 1518500250, 1518500250, 1518500250,
+                     1518500250, 1518500250, 1518500250, 1518500250],
+       shift = [36, 36, 36, 36, 36, 36, 36, 36,
+                37, 37, 37, 37, 37, 37, 37, 37],
+       scale32 = true, double_round = false, per_channel = true}
+      : (tensor<1x6x6x16xi32>) -> tensor<1x6x6x16xi8>
+  return %out : tensor<1x6x6x16xi8>
+}
+)";
+
+/// A kernel of a padded fp32 convolution whose output a tosa.reduce_sum sums
+/// over its rows.
+const char *reducedConvKernel = R"(
+func.func @reduced(%in: tensor<4x14x14x16xf32>, %fil: tensor<16x3x3x16xf32>)
+    -> tensor<4x1x14x16xf32>
+    attributes {kernel, arch = "gfx908", num_cu = 120 : i64,
+                xdlopsV2 = true} {
+  %bias = "tosa.const"() {value = dense<0.0> : tensor<16xf32>}
+      : () -> tensor<16xf32>
+  %conv = "tosa.conv2d"(%in, %fil, %bias)
+      {dilation = [1, 1], pad = [1, 1, 1, 1], stride = [1, 1]}
+      : (tensor<4x14x14x16xf32>, tensor<16x3x3x16xf32>, tensor<16xf32>)
+      -> tensor<4x14x14x16xf32>
+  %out = "tosa.reduce_sum"(%conv) {axis = 1 : i64}
+      : (tensor<4x14x14x16xf32>) -> tensor<4x1x14x16xf32>
+  return %out : tensor<4x1x14x16xf32>
+}
+)";
+
+/// Generate the kernels of `arguments`, check that they use `solver` and run
+/// them through the kernel pipeline.
+void checkLowering(const std::string &arguments, ConvSolver solver) {
+  DialectRegistry registry;
+  registerMIOpenFlowDialects(registry);
+  MLIRContext context(registry);
+  context.loadAllAvailableDialects();
+  OpBuilder builder(&context);
+
+  Conv2dGenerator generator;
+  ASSERT_TRUE(succeeded(generator.parseConvConfig(arguments.c_str())));
+  ASSERT_TRUE(succeeded(generator.isApplicable()));
+  EXPECT_EQ(generator.getSolver(builder), solver);
+
+  OwningOpRef<ModuleOp> module = ModuleOp::create(builder.getUnknownLoc());
+  ModuleOp moduleOp = module.get();
+  for (int i = 0, e = generator.getKernelCount(builder); i < e; ++i)
+    ASSERT_TRUE(succeeded(generator.genConvModule(moduleOp, i)));
+
+  PassManager pm(&context, PassManager::Nesting::Implicit);
+  buildKernelPipeline(pm);
+  EXPECT_TRUE(succeeded(pm.run(moduleOp)));
+  bool convLeft = false;
+  moduleOp.walk([&](Conv2DOp) { convLeft = true; });
+  EXPECT_FALSE(convLeft);
+}
+} // namespace
+
+TEST(ConvLoweringTest, DirectGrouped) {
+  checkLowering(convArguments(8, kDirectConvMaxChannelsPerGroup, ""),
+                ConvSolver::DirectGrouped);
+}
+
+TEST(ConvLoweringTest, Winograd) {
+  checkLowering(convArguments(1, 16, " --winograd 2"), ConvSolver::Winograd);
+}
+
+TEST(ConvLoweringTest, Requantized) {
+  DialectRegistry registry;
+  registerMIOpenFlowDialects(registry);
+  MLIRContext context(registry);
+  context.loadAllAvailableDialects();
+  OwningOpRef<ModuleOp> module =
+      parseSourceString<ModuleOp>(requantizedConvKernel, &context);
+  ASSERT_TRUE(module);
+
+  PassManager bufferizePm(&context, PassManager::Nesting::Implicit);
+  buildBufferizePipeline(bufferizePm);
+  ASSERT_TRUE(succeeded(bufferizePm.run(*module)));
+  SmallVector<Conv2DOp, 1> convs;
+  module->walk([&](Conv2DOp op) { convs.push_back(op); });
+  ASSERT_EQ(convs.size(), 1u);
+  EXPECT_TRUE(convs[0].requantScales());
+  auto zeroPoint = convs[0]->getAttrOfType<IntegerAttr>("requant_zero_point");
+  ASSERT_TRUE(zeroPoint);
+  EXPECT_EQ(zeroPoint.getInt(), -3);
+  bool rescaleLeft = false;
+  module->walk([&](Operation *op) {
+    rescaleLeft |= op->getName().getStringRef() == "tosa.rescale";
+  });
+  EXPECT_FALSE(rescaleLeft);
+
+  PassManager kernelPm(&context, PassManager::Nesting::Implicit);
+  buildKernelPipeline(kernelPm);
+  EXPECT_TRUE(succeeded(kernelPm.run(*module)));
+}
+
+TEST(ConvLoweringTest, FusedReduction) {
+  DialectRegistry registry;
+  registerMIOpenFlowDialects(registry);
+  MLIRContext context(registry);
+  context.loadAllAvailableDialects();
+  OwningOpRef<ModuleOp> module =
+      parseSourceString<ModuleOp>(reducedConvKernel, &context);
+  ASSERT_TRUE(module);
+
+  PassManager bufferizePm(&context, PassManager::Nesting::Implicit);
+  buildBufferizePipeline(bufferizePm);
+  ASSERT_TRUE(succeeded(bufferizePm.run(*module)));
+
+  // Stop right after the fusion into the writeback of the gemm.
+  PassManager alignPm(&context, PassManager::Nesting::Implicit);
+  OpPassManager &funcPm = alignPm.nest<func::FuncOp>();
+  funcPm.addPass(createAffixTuningParametersPass());
+  funcPm.addPass(createMIOpenConvToGemmPass());
+  funcPm.addPass(createMIOpenHorizontalDispatchPass());
+  funcPm.addPass(createMIOpenGridwiseGemmToBlockwisePass());
+  funcPm.addPass(createMIOpenLinalgToGpuPass());
+  funcPm.addPass(createMIOpenLinalgAlignPass());
+  ASSERT_TRUE(succeeded(alignPm.run(*module)));
+
+  // The reduction is summed with atomics into the output, which the
+  // caller zeroes instead of the kernel.
+  bool reductionLeft = false, fillLeft = false, atomicAdds = false;
+  module->walk([&](Operation *op) {
+    if (auto generic = dyn_cast<linalg::GenericOp>(op))
+      reductionLeft |= generic.getNumReductionLoops() > 0;
+    fillLeft |= isa<linalg::FillOp>(op);
+    if (auto copy = dyn_cast<ThreadwiseCopyV2Op>(op))
+      atomicAdds |= copy.storeMethod() == StoreMethod::AtomicAdd;
+  });
+  EXPECT_FALSE(reductionLeft);
+  EXPECT_FALSE(fillLeft);
+  EXPECT_TRUE(atomicAdds);
+  auto func = *module->getOps<func::FuncOp>().begin();
+  EXPECT_TRUE(func.getArgAttr(func.getNumArguments() - 1,
+                              kZeroBeforeLaunchAttrName));
+}
@@ -0,0 +1,112 @@
+//===- GemmLoweringTests.cpp - Tests for the miopen.gemm lowering ---------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/MIOpen/MIOpen.h"
+#include "mlir/Dialect/MIOpen/Pipelines.h"
+#include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/InitMIOpenDialects.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "gtest/gtest.h"
+
+#include <string>
+
+using namespace mlir;
+using namespace mlir::miopen;
+
+namespace {
+/// A kernel multiplying [2, m, 32] by [2, 32, n] fp32 matrices with
+/// tosa.matmul, on gfx908 with or without XDLOPS.
+std::string matmulKernel(int64_t m, int64_t n, bool xdlops) {
+  std::string a = "tensor<2x" + std::to_string(m) + "x32xf32>";
+  std::string b = "tensor<2x32x" + std::to_string(n) + "xf32>";
+  std::string c = "tensor<2x" + std::to_string(m) + "x" + std::to_string(n) +
+                  "xf32>";
+  return "func.func @matmul(%a: " + a + ", %b: " + b + ") -> " + c +
+         " attributes {kernel, arch = \"gfx908\", num_cu = 120 : i64,"
+         " xdlopsV2 = " +
+         (xdlops ? "true" : "false") + "} {\n" +
+         "  %c = \"tosa.matmul\"(%a, %b) : (" + a + ", " + b + ") -> " + c +
+         "\n  return %c : " + c + "\n}\n";
+}
+
+/// A kernel of an f64 miopen.gemm whose output has a single column, which
+/// TOSA cannot express, on gfx90a with its f64 MFMAs.
+const char *skinnyF64GemmKernel = R"(
+func.func @gemm(%a: memref<2x64x32xf64>, %b: memref<2x32x1xf64>,
+                %c: memref<2x64x1xf64>)
+    attributes {kernel, arch = "gfx90a", num_cu = 110 : i64} {
+  miopen.gemm(%a, %b, %c) {arch = "gfx90a", num_cu = 110 : i32,
+                           xdlopsV2 = true}
+      : memref<2x64x32xf64>, memref<2x32x1xf64>, memref<2x64x1xf64>
+  return
+}
+)";
+
+template <typename OpT>
+int64_t countOps(ModuleOp module) {
+  int64_t count = 0;
+  module.walk([&](OpT) { ++count; });
+  return count;
+}
+
+/// Check that the tosa.matmul of `source` becomes one miopen.gemm, lowered
+/// as a skinny gemm or not as `skinny` says, which the kernel pipeline then
+/// lowers.
+void checkLowering(const std::string &source, bool skinny = false) {
+  DialectRegistry registry;
+  registerMIOpenFlowDialects(registry);
+  MLIRContext context(registry);
+  context.loadAllAvailableDialects();
+
+  OwningOpRef<ModuleOp> module = parseSourceString<ModuleOp>(source, &context);
+  ASSERT_TRUE(module);
+
+  PassManager bufferizePm(&context, PassManager::Nesting::Implicit);
+  buildBufferizePipeline(bufferizePm);
+  ASSERT_TRUE(succeeded(bufferizePm.run(*module)));
+  EXPECT_EQ(countOps<GemmOp>(*module), 1);
+  module->walk([&](GemmOp op) { EXPECT_EQ(usesSkinnyGemm(op), skinny); });
+
+  PassManager kernelPm(&context, PassManager::Nesting::Implicit);
+  buildKernelPipeline(kernelPm);
+  EXPECT_TRUE(succeeded(kernelPm.run(*module)));
+  EXPECT_EQ(countOps<GemmOp>(*module), 0);
+}
+} // namespace
+
+TEST(GemmLoweringTest, Xdlops) { checkLowering(matmulKernel(64, 64, true)); }
+
+TEST(GemmLoweringTest, NonXdlops) {
+  checkLowering(matmulKernel(64, 64, false));
+}
+
+TEST(GemmLoweringTest, Skinny) {
+  checkLowering(matmulKernel(64, 1, false), /*skinny=*/true);
+}
+
+// The wave sums of skinny gemms are 32-bit, so f64 gemms of that shape go
+// through the f64 MFMAs instead, which accumulate in f64 as the CPU
+// reference of the validation wrappers does.
+TEST(GemmLoweringTest, SkinnyF64) {
+  DialectRegistry registry;
+  registerMIOpenFlowDialects(registry);
+  MLIRContext context(registry);
+  context.loadAllAvailableDialects();
+  OwningOpRef<ModuleOp> module =
+      parseSourceString<ModuleOp>(skinnyF64GemmKernel, &context);
+  ASSERT_TRUE(module);
+  module->walk([&](GemmOp op) { EXPECT_FALSE(usesSkinnyGemm(op)); });
+
+  PassManager kernelPm(&context, PassManager::Nesting::Implicit);
+  buildKernelPipeline(kernelPm);
+  EXPECT_TRUE(succeeded(kernelPm.run(*module)));
+  EXPECT_EQ(countOps<GemmOp>(*module), 0);
+}
@@ -231,3 +231,101 @@ TEST_F(TMBuilderTest, GemmOut) {
                      &context));
   EXPECT_EQ(resDown, resUp);
 }
+
+TEST_F(TMBuilderTest, UnblockChannels) {
+  // NCHW4c presented as NHWGC
+  TransformMapAttr res =
+      unblockChannels(b, {"n", "c", "h", "w", "cb"}, {2, 3, 5, 7, 4}, "c",
+                      "cb", {"n", "h", "w", "g", "c"}, b.getUnknownLoc());
+
+  SmallVector<int64_t> upperBounds = {2, 5, 7, 1, 12};
+  EXPECT_ARRAY_EQ(int64_t, res.getUpperBounds(), upperBounds);
+  EXPECT_EQ(res.getMap().getAffineMap(),
+            AffineMap::get(5, 0,
+                           {affD(0), affD(4).floorDiv(affC(4)), affD(1),
+                            affD(2), affD(4) % affC(4)},
+                           &context));
+}
+
+TEST_F(TMBuilderTest, FuseMergeUnmerge) {
+  auto buildMerge = makeTopDown({"m"}, {30});
+  buildMerge.merge({"x", "y", "z"}, {0, 1, 2}, "m", {2, 3, 5});
+  auto buildUnmerge = makeTopDown({"x", "y", "z"}, {2, 3, 5});
+  buildUnmerge.unmerge("a", 0, {"x", "y", "z"}, {2, 3, 5});
+  TransformMapAttr merge = buildMerge.get();
+  TransformMapAttr unmerge = buildUnmerge.get();
+
+  FailureOr<TransformMapAttr> fused = fuseTransformMaps(b, merge, unmerge);
+  ASSERT_TRUE(succeeded(fused));
+  EXPECT_EQ(fused->getMap().getAffineMap(),
+            AffineMap::get(1, 0, {affD(0)}, &context));
+  ArrayRef<TransformAttr> ops = fused->getOps();
+  ASSERT_EQ(ops.size(), 1UL);
+  EXPECT_EQ(ops[0], TransformAttr::get(&context, TransformType::PassThrough, {},
+                                       {"m"}, {0}, {"a"}, {0}));
+
+  ArrayAttr chain = simplifyTransformChain(b, b.getArrayAttr({merge, unmerge}));
+  EXPECT_TRUE(chain.empty());
+}
+
+TEST_F(TMBuilderTest, FuseLinear) {
+  auto buildUnmerge = makeTopDown({"i", "j"}, {4, 8});
+  buildUnmerge.unmerge("k", 0, {"i", "j"}, {4, 8});
+  auto buildEmbed = makeTopDown({"k"}, {32});
+  buildEmbed.embed("x", 0, 64, {"k"}, {2});
+
+  FailureOr<TransformMapAttr> fused =
+      fuseTransformMaps(b, buildUnmerge.get(), buildEmbed.get());
+  ASSERT_TRUE(succeeded(fused));
+  EXPECT_EQ(fused->getMap().getAffineMap(),
+            AffineMap::get(2, 0, {affD(0) * affC(16) + affD(1) * affC(2)},
+                           &context));
+  SmallVector<int64_t> upperBounds = {4, 8};
+  SmallVector<int64_t> lowerBounds = {64};
+  EXPECT_ARRAY_EQ(int64_t, fused->getUpperBounds(), upperBounds);
+  EXPECT_ARRAY_EQ(int64_t, fused->getLowerBounds(), lowerBounds);
+}
+
+TEST_F(TMBuilderTest, FusePassThroughAround) {
+  auto buildPad = makeTopDown({"a", "b"}, {6, 6});
+  buildPad.passThrough("a");
+  buildPad.pad({"b"}, {1, 1});
+  auto buildMerge = makeTopDown({"a", "b"}, {6, 4});
+  buildMerge.merge({"x", "y"}, {0, 1}, "a", {2, 3});
+  buildMerge.passThrough({"b"}, {2}, {"b"});
+
+  FailureOr<TransformMapAttr> fused =
+      fuseTransformMaps(b, buildPad.get(), buildMerge.get());
+  ASSERT_TRUE(succeeded(fused));
+  EXPECT_EQ(fused->getMap().getAffineMap(),
+            AffineMap::get(2, 0,
+                           {affD(0).floorDiv(affC(3)), affD(0) % affC(3),
+                            affD(1) - affC(1)},
+                           &context));
+}
+
+TEST_F(TMBuilderTest, CollapseMergeEmbed) {
+  // The unit y is dropped and x and z are read contiguously, so the chain is
+  // a single embed of m.
+  auto buildMerge = makeTopDown({"m"}, {10});
+  buildMerge.merge({"x", "y", "z"}, {0, 1, 2}, "m", {2, 1, 5});
+  auto buildEmbed = makeTopDown({"x", "y", "z"}, {2, 1, 5});
+  buildEmbed.embed("a", 0, 20, {"x", "y", "z"}, {10, 7, 2});
+
+  ArrayAttr chain = simplifyTransformChain(
+      b, b.getArrayAttr({buildMerge.get(), buildEmbed.get()}));
+  ASSERT_EQ(chain.size(), 1UL);
+  auto fused = chain[0].cast<TransformMapAttr>();
+  EXPECT_EQ(fused.getMap().getAffineMap(),
+            AffineMap::get(1, 0, {affD(0) * affC(2)}, &context));
+}
+
+TEST_F(TMBuilderTest, FuseMergeEmbedFails) {
+  auto buildMerge = makeTopDown({"m"}, {6});
+  buildMerge.merge({"x", "y"}, {0, 1}, "m", {2, 3});
+  auto buildEmbed = makeTopDown({"x", "y"}, {2, 3});
+  buildEmbed.embed("z", 0, 8, {"x", "y"}, {4, 1});
+
+  EXPECT_TRUE(
+      failed(fuseTransformMaps(b, buildMerge.get(), buildEmbed.get())));
+}
@@ -0,0 +1,204 @@
+//===- UniformValuesTests.cpp - Tests for the uniform values pass ---------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/AMDGPU/AMDGPUDialect.h"
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/MIOpen/Passes.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/InitMIOpenDialects.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "gtest/gtest.h"
+
+#include <string>
+
+using namespace mlir;
+
+namespace {
+/// A module holding the kernel with the body `body`, which takes an `%out`
+/// memref<4xindex> and a global `%buf` memref<4x64xf32>.
+std::string kernel(const std::string &body) {
+  return R"(
+module attributes {gpu.container_module} {
+  gpu.module @kernels {
+    gpu.func @kernel(%out: memref<4xindex>, %buf: memref<4x64xf32>) kernel {
+      %c0 = arith.constant 0 : index
+      %c1 = arith.constant 1 : index
+      %c7 = arith.constant 7 : index
+      %tid = gpu.thread_id x
+      %bid = gpu.block_id x
+)" + body + R"(
+    }
+  }
+}
+)";
+}
+
+/// The tail of a kernel storing %tid + %x + 7 to `%out`, where `%x` is
+/// uniform when the analysis says so. The pass then adds %x and 7 first.
+const char *storeSum = R"(
+      %s0 = arith.addi %tid, %x : index
+      %s = arith.addi %s0, %c7 : index
+      memref.store %s, %out[%c0] : memref<4xindex>
+)";
+
+/// `source` after the uniform values pass.
+OwningOpRef<ModuleOp> runPass(MLIRContext &context,
+                              const std::string &source) {
+  OwningOpRef<ModuleOp> module = parseSourceString<ModuleOp>(source, &context);
+  if (!module)
+    return module;
+  PassManager pm(&context);
+  pm.addNestedPass<gpu::GPUModuleOp>(miopen::createMIOpenUniformValuesPass());
+  if (failed(pm.run(*module)))
+    return nullptr;
+  return module;
+}
+
+/// Tell if the sum stored to `%out` was reassociated into the uniform terms
+/// plus %tid, which happens when the pass takes `%x` for uniform.
+bool sumIsReassociated(const std::string &source) {
+  DialectRegistry registry;
+  registerMIOpenFlowDialects(registry);
+  MLIRContext context(registry);
+  context.loadAllAvailableDialects();
+  OwningOpRef<ModuleOp> module = runPass(context, source);
+  EXPECT_TRUE(module);
+  if (!module)
+    return false;
+
+  bool reassociated = false;
+  module->walk([&](memref::StoreOp store) {
+    auto sum = store.value().getDefiningOp<arith::AddIOp>();
+    EXPECT_TRUE(sum);
+    reassociated = sum && sum.getRhs().getDefiningOp<gpu::ThreadIdOp>();
+  });
+  return reassociated;
+}
+} // namespace
+
+// Workgroup IDs are uniform and workitem IDs, and what is computed from
+// them, are not.
+TEST(UniformValuesTest, ThreadIdDerived) {
+  EXPECT_TRUE(sumIsReassociated(kernel(std::string(R"(
+      %x = arith.muli %bid, %c7 : index
+)") + storeSum + "      gpu.return")));
+  EXPECT_FALSE(sumIsReassociated(kernel(std::string(R"(
+      %x = arith.muli %tid, %c7 : index
+)") + storeSum + "      gpu.return")));
+}
+
+// The values joining after a branch on a workitem ID differ between the
+// workitems that went either way, while those after a uniform branch don't.
+TEST(UniformValuesTest, DivergentBranch) {
+  auto branchOn = [](const std::string &cond) {
+    return kernel(R"(
+      %cond = arith.cmpi ult, )" +
+                  cond + R"(, %c7 : index
+      cf.cond_br %cond, ^then, ^else
+    ^then:
+      cf.br ^join(%bid : index)
+    ^else:
+      cf.br ^join(%c7 : index)
+    ^join(%x: index):
+)" + storeSum + "      gpu.return");
+  };
+  EXPECT_TRUE(sumIsReassociated(branchOn("%bid")));
+  EXPECT_FALSE(sumIsReassociated(branchOn("%tid")));
+}
+
+// A loop counter stepping by a constant is uniform, one stepping by a
+// workitem ID is not.
+TEST(UniformValuesTest, LoopBlockArgument) {
+  auto loopBy = [](const std::string &step) {
+    return kernel(R"(
+      cf.br ^loop(%c0 : index)
+    ^loop(%x: index):
+)" + std::string(storeSum) +
+                  R"(
+      %next = arith.addi %x, )" +
+                  step + R"( : index
+      %more = arith.cmpi ult, %next, %c7 : index
+      cf.cond_br %more, ^loop(%next : index), ^exit
+    ^exit:
+      gpu.return)");
+  };
+  EXPECT_TRUE(sumIsReassociated(loopBy("%c1")));
+  EXPECT_FALSE(sumIsReassociated(loopBy("%tid")));
+}
+
+// The uniform term of a buffer index moves to the SGPR offset, scaled by the
+// stride of its dimension, and the lanes keep only their own term.
+TEST(UniformValuesTest, SgprOffset) {
+  DialectRegistry registry;
+  registerMIOpenFlowDialects(registry);
+  MLIRContext context(registry);
+  context.loadAllAvailableDialects();
+  OwningOpRef<ModuleOp> module = runPass(context, kernel(R"(
+      %c16 = arith.constant 16 : index
+      %base = arith.muli %bid, %c16 : index
+      %i = arith.addi %base, %tid : index
+      %i32 = arith.index_cast %i : index to i32
+      %row = arith.index_cast %bid : index to i32
+      %v = amdgpu.raw_buffer_load %buf[%row, %i32]
+          : memref<4x64xf32>, i32, i32 -> f32
+      amdgpu.raw_buffer_store %v -> %buf[%row, %i32]
+          : f32 -> memref<4x64xf32>, i32, i32
+      gpu.return)"));
+  ASSERT_TRUE(module);
+
+  auto checkOffsets = [](auto op) {
+    // Dimension 0 carries the out of bounds accesses and stays as it is.
+    auto row = op.getIndices()[0].template getDefiningOp<arith::IndexCastOp>();
+    ASSERT_TRUE(row);
+    EXPECT_TRUE(row.getIn().template getDefiningOp<gpu::BlockIdOp>());
+
+    auto lane = op.getIndices()[1].template getDefiningOp<arith::IndexCastOp>();
+    ASSERT_TRUE(lane);
+    EXPECT_TRUE(lane.getIn().template getDefiningOp<gpu::ThreadIdOp>());
+
+    ASSERT_TRUE(op.getSgprOffset());
+    auto scaled = op.getSgprOffset().template getDefiningOp<arith::MulIOp>();
+    ASSERT_TRUE(scaled);
+    auto base =
+        scaled.getLhs().template getDefiningOp<arith::IndexCastOp>();
+    ASSERT_TRUE(base);
+    EXPECT_TRUE(base.getIn().template getDefiningOp<arith::MulIOp>());
+  };
+  int64_t numOps = 0;
+  module->walk([&](amdgpu::RawBufferLoadOp op) {
+    checkOffsets(op);
+    ++numOps;
+  });
+  module->walk([&](amdgpu::RawBufferStoreOp op) {
+    checkOffsets(op);
+    ++numOps;
+  });
+  EXPECT_EQ(numOps, 2);
+}
+
+// Indices with no uniform term are left alone.
+TEST(UniformValuesTest, DivergentIndex) {
+  DialectRegistry registry;
+  registerMIOpenFlowDialects(registry);
+  MLIRContext context(registry);
+  context.loadAllAvailableDialects();
+  OwningOpRef<ModuleOp> module = runPass(context, kernel(R"(
+      %i32 = arith.index_cast %tid : index to i32
+      %row = arith.index_cast %bid : index to i32
+      %v = amdgpu.raw_buffer_load %buf[%row, %i32]
+          : memref<4x64xf32>, i32, i32 -> f32
+      gpu.return)"));
+  ASSERT_TRUE(module);
+  module->walk([&](amdgpu::RawBufferLoadOp op) {
+    EXPECT_FALSE(op.getSgprOffset());
+  });
+}
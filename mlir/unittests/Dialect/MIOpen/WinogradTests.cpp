@@ -0,0 +1,74 @@
+//===- WinogradTests.cpp - Tests for the Winograd transform matrices ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/MIOpen/utility/loweringUtils.h"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+
+using namespace mlir;
+using namespace mlir::miopen;
+
+namespace {
+/// out = lhs * x * rhs^T, with lhs p x q, x q x q, rhs r x q.
+std::vector<float> transform(ArrayRef<float> lhs, int64_t p,
+                             ArrayRef<float> x, int64_t q,
+                             ArrayRef<float> rhs, int64_t r) {
+  std::vector<float> tmp(p * q, 0.0f), out(p * r, 0.0f);
+  for (int64_t i = 0; i < p; ++i)
+    for (int64_t j = 0; j < q; ++j)
+      for (int64_t l = 0; l < q; ++l)
+        tmp[i * q + j] += lhs[i * q + l] * x[l * q + j];
+  for (int64_t i = 0; i < p; ++i)
+    for (int64_t j = 0; j < r; ++j)
+      for (int64_t l = 0; l < q; ++l)
+        out[i * r + j] += tmp[i * q + l] * rhs[j * q + l];
+  return out;
+}
+
+/// Check A^T [(G g G^T) . (B^T d B)] A against the direct 3x3 correlation of
+/// an alpha x alpha input tile.
+void checkTile(int64_t m) {
+  FailureOr<WinogradMatrices> mats = WinogradMatrices::get(m);
+  ASSERT_TRUE(succeeded(mats));
+  int64_t alpha = mats->alpha;
+  ASSERT_EQ(alpha, m + 2);
+
+  std::vector<float> filter(9), input(alpha * alpha);
+  for (int64_t i = 0; i < 9; ++i)
+    filter[i] = 0.25f * static_cast<float>(i % 5) - 0.5f;
+  for (int64_t i = 0, e = alpha * alpha; i < e; ++i)
+    input[i] = 0.125f * static_cast<float>((i * 7) % 11) - 0.5f;
+
+  std::vector<float> u = transform(mats->g, alpha, filter, 3, mats->g, alpha);
+  std::vector<float> v =
+      transform(mats->bt, alpha, input, alpha, mats->bt, alpha);
+  for (int64_t i = 0, e = alpha * alpha; i < e; ++i)
+    u[i] *= v[i];
+  std::vector<float> y = transform(mats->at, m, u, alpha, mats->at, m);
+
+  for (int64_t i = 0; i < m; ++i)
+    for (int64_t j = 0; j < m; ++j) {
+      float expected = 0.0f;
+      for (int64_t ky = 0; ky < 3; ++ky)
+        for (int64_t kx = 0; kx < 3; ++kx)
+          expected += filter[ky * 3 + kx] * input[(i + ky) * alpha + j + kx];
+      EXPECT_NEAR(y[i * m + j], expected, 1e-4f) << "at " << i << ", " << j;
+    }
+}
+} // namespace
+
+TEST(WinogradTest, F2x3) { checkTile(2); }
+
+TEST(WinogradTest, F4x3) { checkTile(4); }
+
+TEST(WinogradTest, Unsupported) {
+  EXPECT_TRUE(failed(WinogradMatrices::get(3)));
+  EXPECT_TRUE(failed(WinogradMatrices::get(6)));
+}
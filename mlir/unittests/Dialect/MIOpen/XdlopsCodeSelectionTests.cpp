@@ -0,0 +1,176 @@
+//===- XdlopsCodeSelectionTests.cpp - Tests for XDLOPS code selection -----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/MIOpen/XdlopsCodeSelection.h"
+#include "mlir/IR/MLIRContext.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+
+namespace {
+class XdlopsCodeSelectionTest : public ::testing::Test {
+protected:
+  amdgpu::MFMAInstr select(Type dataType, int64_t MPerWave, int64_t NPerWave,
+                           StringRef arch) {
+    FailureOr<XdlopsCodeSelection> xcs =
+        XdlopsCodeSelection::get(dataType, MPerWave, NPerWave, arch);
+    EXPECT_TRUE(succeeded(xcs));
+    return succeeded(xcs) ? xcs->instr : amdgpu::MFMAInstr::f32_32x32x1f32;
+  }
+
+  MLIRContext context;
+  Builder b{&context};
+};
+} // namespace
+
+TEST_F(XdlopsCodeSelectionTest, Gfx908) {
+  EXPECT_EQ(select(b.getF32Type(), 64, 64, "gfx908"),
+            amdgpu::MFMAInstr::f32_32x32x1f32);
+  EXPECT_EQ(select(b.getF16Type(), 32, 32, "gfx908:sramecc+:xnack-"),
+            amdgpu::MFMAInstr::f32_32x32x8f16);
+  EXPECT_EQ(select(b.getBF16Type(), 16, 64, "amdgcn-amd-amdhsa:gfx908"),
+            amdgpu::MFMAInstr::f32_16x16x2bf16);
+  EXPECT_EQ(select(b.getIntegerType(8), 16, 16, ""),
+            amdgpu::MFMAInstr::i32_16x16x16i8);
+}
+
+TEST_F(XdlopsCodeSelectionTest, FasterInstructionsOnNewerChips) {
+  EXPECT_EQ(select(b.getBF16Type(), 64, 64, "gfx90a"),
+            amdgpu::MFMAInstr::f32_32x32x4bf16_1k);
+  EXPECT_EQ(select(b.getBF16Type(), 16, 16, "gfx90a:sramecc+:xnack-"),
+            amdgpu::MFMAInstr::f32_16x16x16bf16_1k);
+  EXPECT_EQ(select(b.getIntegerType(8), 32, 32, "gfx940"),
+            amdgpu::MFMAInstr::i32_32x32x16_i8);
+  EXPECT_EQ(select(b.getF64Type(), 16, 16, "gfx90a"),
+            amdgpu::MFMAInstr::f64_16x16x4f64);
+}
+
+TEST_F(XdlopsCodeSelectionTest, Layout) {
+  FailureOr<XdlopsCodeSelection> xcs =
+      XdlopsCodeSelection::get(b.getF32Type(), 128, 64, "gfx908");
+  ASSERT_TRUE(succeeded(xcs));
+  EXPECT_EQ(xcs->MPerXdlops, 64);
+  EXPECT_EQ(xcs->MRepeats, 2);
+  EXPECT_EQ(xcs->vectorNumber, 4);
+  EXPECT_EQ(xcs->vectorType, VectorType::get({32}, b.getF32Type()));
+  EXPECT_EQ(xcs->num_input_blks, 2);
+
+  xcs = XdlopsCodeSelection::get(b.getIntegerType(8), 16, 16, "gfx940");
+  ASSERT_TRUE(succeeded(xcs));
+  EXPECT_EQ(xcs->k_base, 8);
+  EXPECT_EQ(xcs->argType, VectorType::get({8}, b.getIntegerType(8)));
+  EXPECT_EQ(xcs->vectorType, VectorType::get({4}, b.getI32Type()));
+
+  xcs = XdlopsCodeSelection::get(b.getF64Type(), 16, 16, "gfx90a");
+  ASSERT_TRUE(succeeded(xcs));
+  EXPECT_EQ(xcs->argType, b.getF64Type());
+  EXPECT_EQ(xcs->vectorType, VectorType::get({4}, b.getF64Type()));
+  EXPECT_EQ(xcs->group_size, 1);
+  EXPECT_EQ(xcs->num_groups_blk, 4);
+}
+
+TEST_F(XdlopsCodeSelectionTest, Unsupported) {
+  EXPECT_TRUE(failed(XdlopsCodeSelection::get(b.getF32Type(), 128, 128, "")));
+  EXPECT_TRUE(failed(XdlopsCodeSelection::get(b.getF64Type(), 16, 16, "")));
+  EXPECT_TRUE(
+      failed(XdlopsCodeSelection::get(b.getIntegerType(16), 32, 32, "")));
+}
+
+TEST_F(XdlopsCodeSelectionTest, Wmma) {
+  EXPECT_EQ(XdlopsCodeSelection::getWaveSize("gfx1100"), 32);
+  EXPECT_EQ(XdlopsCodeSelection::getWaveSize("gfx90a:sramecc+:xnack-"), 64);
+
+  FailureOr<XdlopsCodeSelection> xcs =
+      XdlopsCodeSelection::get(b.getF16Type(), 32, 64, "gfx1100");
+  ASSERT_TRUE(succeeded(xcs));
+  EXPECT_TRUE(xcs->isWmma);
+  EXPECT_FALSE(xcs->isKReduction);
+  EXPECT_EQ(xcs->MPerXdlops, 16);
+  EXPECT_EQ(xcs->MRepeats, 2);
+  EXPECT_EQ(xcs->NRepeats, 4);
+  EXPECT_EQ(xcs->vectorNumber, 8);
+  EXPECT_EQ(xcs->vectorType, VectorType::get({8}, b.getF32Type()));
+  EXPECT_EQ(xcs->argType, VectorType::get({16}, b.getF16Type()));
+
+  xcs = XdlopsCodeSelection::get(b.getIntegerType(8), 16, 16, "gfx1102");
+  ASSERT_TRUE(succeeded(xcs));
+  EXPECT_EQ(xcs->vectorType, VectorType::get({8}, b.getI32Type()));
+
+  EXPECT_TRUE(
+      failed(XdlopsCodeSelection::get(b.getF32Type(), 16, 16, "gfx1100")));
+  EXPECT_TRUE(
+      failed(XdlopsCodeSelection::get(b.getF16Type(), 64, 64, "gfx1100")));
+}
+
+TEST_F(XdlopsCodeSelectionTest, Fp8) {
+  FailureOr<XdlopsCodeSelection> xcs = XdlopsCodeSelection::get(
+      b.getIntegerType(8), 32, 32, "gfx940", miopen::Fp8Format::E4M3);
+  ASSERT_TRUE(succeeded(xcs));
+  EXPECT_EQ(xcs->instr, amdgpu::MFMAInstr::f32_32x32x16_fp8_fp8);
+  EXPECT_TRUE(xcs->isKReduction);
+  EXPECT_EQ(xcs->k_base, 8);
+  EXPECT_EQ(xcs->vectorType, VectorType::get({16}, b.getF32Type()));
+  EXPECT_EQ(xcs->argType, VectorType::get({8}, b.getIntegerType(8)));
+
+  xcs = XdlopsCodeSelection::get(b.getIntegerType(8), 16, 16, "gfx940",
+                                 miopen::Fp8Format::E5M2);
+  ASSERT_TRUE(succeeded(xcs));
+  EXPECT_EQ(xcs->instr, amdgpu::MFMAInstr::f32_16x16x32_bf8_bf8);
+
+  EXPECT_TRUE(failed(XdlopsCodeSelection::get(
+      b.getIntegerType(8), 32, 32, "gfx90a", miopen::Fp8Format::E4M3)));
+  EXPECT_TRUE(failed(XdlopsCodeSelection::get(b.getF16Type(), 32, 32, "gfx940",
+                                              miopen::Fp8Format::E4M3)));
+}
+
+TEST_F(XdlopsCodeSelectionTest, Xf32) {
+  FailureOr<XdlopsCodeSelection> xcs = XdlopsCodeSelection::get(
+      b.getF32Type(), 32, 32, "gfx940", llvm::None, /*xf32=*/true);
+  ASSERT_TRUE(succeeded(xcs));
+  EXPECT_EQ(xcs->instr, amdgpu::MFMAInstr::f32_32x32x4_xf32);
+  EXPECT_EQ(xcs->argType, VectorType::get({2}, b.getF32Type()));
+
+  xcs = XdlopsCodeSelection::get(b.getF32Type(), 16, 16, "gfx940", llvm::None,
+                                 /*xf32=*/true);
+  ASSERT_TRUE(succeeded(xcs));
+  EXPECT_EQ(xcs->instr, amdgpu::MFMAInstr::f32_16x16x8_xf32);
+
+  EXPECT_TRUE(failed(XdlopsCodeSelection::get(b.getF32Type(), 32, 32, "gfx90a",
+                                              llvm::None, /*xf32=*/true)));
+  EXPECT_TRUE(failed(XdlopsCodeSelection::get(b.getF16Type(), 32, 32, "gfx940",
+                                              llvm::None, /*xf32=*/true)));
+}
+
+TEST_F(XdlopsCodeSelectionTest, Sparse) {
+  FailureOr<XdlopsCodeSelection> xcs =
+      XdlopsCodeSelection::get(b.getF16Type(), 32, 32, "gfx940", llvm::None,
+                               /*xf32=*/false, /*sparse=*/true);
+  ASSERT_TRUE(succeeded(xcs));
+  EXPECT_TRUE(xcs->isSparse);
+  EXPECT_TRUE(xcs->isKReduction);
+  EXPECT_EQ(xcs->k, 16);
+  EXPECT_EQ(xcs->k_base, 8);
+  EXPECT_EQ(xcs->argType, VectorType::get({8}, b.getF16Type()));
+
+  xcs = XdlopsCodeSelection::get(b.getIntegerType(8), 16, 16, "gfx940",
+                                 llvm::None, /*xf32=*/false, /*sparse=*/true);
+  ASSERT_TRUE(succeeded(xcs));
+  EXPECT_EQ(xcs->k, 64);
+  EXPECT_EQ(xcs->vectorType, VectorType::get({4}, b.getI32Type()));
+
+  EXPECT_TRUE(failed(XdlopsCodeSelection::get(b.getF16Type(), 32, 32, "gfx90a",
+                                              llvm::None, /*xf32=*/false,
+                                              /*sparse=*/true)));
+  EXPECT_TRUE(failed(XdlopsCodeSelection::get(b.getF32Type(), 32, 32, "gfx940",
+                                              llvm::None, /*xf32=*/false,
+                                              /*sparse=*/true)));
+  EXPECT_TRUE(failed(XdlopsCodeSelection::get(b.getF16Type(), 64, 64, "gfx940",
+                                              llvm::None, /*xf32=*/false,
+                                              /*sparse=*/true)));
+}
@@ -0,0 +1,192 @@
+#!/usr/bin/env python3
+# ===- compare-results.py - Diff two runs of the performance suite ---------===#
+#
+# Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+# ===-----------------------------------------------------------------------===#
+#
+# Compares the results run-benchmarks.py -o wrote for two builds, such as
+# before and after an update of external/llvm-project, shape by shape on
+# every chip both ran on. A shape regressed when its median time grew by more
+# than the threshold, and improved when it shrank by more. For the shapes
+# whose times moved, the kernels whose perf config, tuning source or
+# resources changed are listed as well, which tells a change of tuning from
+# one of code generation. Example:
+#
+#   compare-results.py before.json after.json -o diff.json
+#
+# The exit code is 1 if any shape regressed.
+#
+# ===-----------------------------------------------------------------------===#
+
+import argparse
+import json
+import sys
+
+# The version of the layout of the results this script reads, RESULT_SCHEMA
+# of run-benchmarks.py.
+RESULT_SCHEMA = 1
+
+# The fields of a kernel that tell how it was built.
+BUILD_FIELDS = ("perf_config", "tuning_source", "conv_solver")
+
+
+def load(path):
+    with open(path) as file:
+        results = json.load(file)
+    schema = results.get("schema")
+    if schema != RESULT_SCHEMA:
+        sys.exit(
+            "%s has results of schema %s, not %d"
+            % (path, schema, RESULT_SCHEMA)
+        )
+    return results
+
+
+def get_compiler(results):
+    revisions = {target.get("compiler", "") for target in results["targets"]}
+    return ",".join(sorted(revision or "unknown" for revision in revisions))
+
+
+def diff_kernels(base, new):
+    """Returns what changed in how each kernel of a shape was built, as
+    (kernel, field, base value, new value) tuples."""
+    changes = []
+    if len(base) != len(new):
+        changes.append(("*", "kernels", len(base), len(new)))
+        return changes
+    for old, kernel in zip(base, new):
+        name = kernel.get("name") or str(kernel["kernel"])
+        for field in BUILD_FIELDS:
+            if old.get(field) != kernel.get(field):
+                changes.append((name, field, old.get(field), kernel.get(field)))
+        resources = old.get("resources", {})
+        for field, value in sorted(kernel.get("resources", {}).items()):
+            if resources.get(field) != value:
+                changes.append((name, field, resources.get(field), value))
+    return changes
+
+
+def diff_target(base, new, threshold):
+    """Returns the comparison of each shape `base` and `new` both ran."""
+    rows = []
+    for name in sorted(set(base["results"]) | set(new["results"])):
+        old = base["results"].get(name)
+        result = new["results"].get(name)
+        row = {"chip": new["chip"], "shape": name}
+        rows.append(row)
+        if old is None or result is None:
+            row["status"] = "added" if old is None else "removed"
+            continue
+        if old.get("problem") != result.get("problem"):
+            row["status"] = "changed problem"
+            continue
+        ratio = result["median_ms"] / old["median_ms"]
+        row["base_ms"] = old["median_ms"]
+        row["new_ms"] = result["median_ms"]
+        row["change"] = round(ratio - 1.0, 6)
+        if ratio > 1.0 + threshold:
+            row["status"] = "regressed"
+        elif ratio < 1.0 - threshold:
+            row["status"] = "improved"
+        else:
+            row["status"] = "unchanged"
+        row["builds"] = [
+            list(change)
+            for change in diff_kernels(old["kernels"], result["kernels"])
+        ]
+    return rows
+
+
+def print_rows(rows, show_all):
+    for row in rows:
+        status = row["status"]
+        if "change" not in row:
+            print("%-8s %-40s %s" % (row["chip"], row["shape"], status))
+            continue
+        if status == "unchanged" and not show_all:
+            continue
+        print(
+            "%-8s %-40s %10.4f ms -> %10.4f ms  %+6.1f%% %s"
+            % (
+                row["chip"],
+                row["shape"],
+                row["base_ms"],
+                row["new_ms"],
+                row["change"] * 100,
+                status.upper() if status == "regressed" else status,
+            )
+        )
+        for kernel, field, old, new in row["builds"]:
+            print("%-49s %s: %s %s -> %s" % ("", kernel, field, old, new))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Diffs two results of the performance regression suite."
+    )
+    parser.add_argument("base", help="results of the reference build")
+    parser.add_argument("new", help="results of the build to compare")
+    parser.add_argument(
+        "-threshold",
+        type=float,
+        default=0.05,
+        help="relative change of the median time counted as a regression "
+        "or an improvement",
+    )
+    parser.add_argument(
+        "-all", action="store_true", help="also list the unchanged shapes"
+    )
+    parser.add_argument(
+        "-o", dest="output", default=None, help="write the diff as JSON here"
+    )
+    args = parser.parse_args()
+
+    base = load(args.base)
+    new = load(args.new)
+    print("Compiler: %s -> %s" % (get_compiler(base), get_compiler(new)))
+    if base.get("version") != new.get("version"):
+        print(
+            "Corpus version: %s -> %s (shapes whose problem changed are "
+            "not compared)"
+            % (base.get("version"), new.get("version"))
+        )
+
+    base_targets = {target["chip"]: target for target in base["targets"]}
+    rows = []
+    for target in new["targets"]:
+        if target["chip"] in base_targets:
+            rows += diff_target(
+                base_targets[target["chip"]], target, args.threshold
+            )
+        else:
+            print("%-8s no results in %s" % (target["chip"], args.base))
+    print_rows(rows, args.all)
+
+    counts = {}
+    for row in rows:
+        counts[row["status"]] = counts.get(row["status"], 0) + 1
+    summary = sorted(counts.items())
+    print(", ".join("%d %s" % (count, status) for status, count in summary))
+
+    if args.output:
+        with open(args.output, "w") as file:
+            json.dump(
+                {
+                    "schema": RESULT_SCHEMA,
+                    "base": {"compiler": get_compiler(base)},
+                    "new": {"compiler": get_compiler(new)},
+                    "shapes": rows,
+                },
+                file,
+                indent=2,
+                sort_keys=True,
+            )
+            file.write("\n")
+    return 1 if counts.get("regressed") else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
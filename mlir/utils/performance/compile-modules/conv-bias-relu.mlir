@@ -0,0 +1,24 @@
+// The last 3x3 convolution of ResNet-50 with its bias and ReLU, which
+// tosa-partition fuses into the epilogue of the convolution kernel.
+func.func @conv_bias_relu(%input: tensor<64x7x7x512xf16>,
+                          %filter: tensor<512x3x3x512xf16>,
+                          %bias: tensor<512xf16>) -> tensor<64x7x7x512xf16>
+    attributes {arch = "amdgcn-amd-amdhsa:gfx908", num_cu = 120 : i64,
+                xdlopsV2 = true} {
+  %zero = "tosa.const"() {value = dense<0.0> : tensor<512xf16>}
+      : () -> tensor<512xf16>
+  %conv = "tosa.conv2d"(%input, %filter, %zero)
+      {dilation = [1, 1], pad = [1, 1, 1, 1], stride = [1, 1]}
+      : (tensor<64x7x7x512xf16>, tensor<512x3x3x512xf16>, tensor<512xf16>)
+      -> tensor<64x7x7x512xf16>
+  %bias4 = "tosa.reshape"(%bias) {new_shape = [1, 1, 1, 512]}
+      : (tensor<512xf16>) -> tensor<1x1x1x512xf16>
+  %sum = "tosa.add"(%conv, %bias4)
+      : (tensor<64x7x7x512xf16>, tensor<1x1x1x512xf16>)
+      -> tensor<64x7x7x512xf16>
+  %relu = "tosa.clamp"(%sum)
+      {min_int = 0 : i64, max_int = 2147483647 : i64, min_fp = 0.0 : f32,
+       max_fp = 65504.0 : f32}
+      : (tensor<64x7x7x512xf16>) -> tensor<64x7x7x512xf16>
+  return %relu : tensor<64x7x7x512xf16>
+}
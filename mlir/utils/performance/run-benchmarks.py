@@ -0,0 +1,546 @@
+#!/usr/bin/env python3
+# ===- run-benchmarks.py - Performance regression suite --------------------===#
+#
+# Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+# ===-----------------------------------------------------------------------===#
+#
+# Runs the shapes of benchmark-shapes.txt through miopen-gen -benchmark on
+# each target, and compares their median kernel times with the baselines
+# recorded for the chip of the target in baselines/<chip>.json. A shape is a
+# regression when it takes longer than its baseline by more than the
+# threshold. Shapes that compute with several kernels are timed as the sum of
+# the medians of their kernels.
+#
+# The GPU of the machine must be the chip of the targets, as kernels are run
+# where they are compiled. Example, from the build directory:
+#
+#   run-benchmarks.py -target "--arch gfx908 --num_cu 120 --x2 1"
+#
+# -update-baseline records the results as the new baselines instead.
+#
+# Every shape is also placed on the roofline of its chip: its arithmetic
+# intensity is its FLOPs over the bytes of its tensors, the least traffic it
+# can do, and its attainable throughput is the lesser of the peak compute and
+# that intensity times the peak bandwidth. -counters additionally runs the
+# shapes once more under rocprof to collect hardware counters per kernel,
+# such as LDS bank conflicts and the L2 hit rate, which tell whether a slow
+# kernel stalls on memory, on LDS or on its math.
+#
+# -o writes the results as JSON, in the layout of RESULT_SCHEMA: each shape
+# has its problem key, its times and, for each of its kernels, the perf
+# config, tuning source and resources mlir-miopen-driver -kernel-report
+# recorded, along with the revision of the compiler. compare-results.py diffs
+# two such files.
+#
+# ===-----------------------------------------------------------------------===#
+
+import argparse
+import csv
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# Version of the layout of the results written with -o, raised whenever a
+# field changes meaning or goes away. Kernel entries hold the fields of
+# mlir-miopen-driver -kernel-report besides their times.
+RESULT_SCHEMA = 1
+
+# Peak throughputs of a full chip of each architecture, in TFLOPs per data
+# type and whether the kernels use xdlops, and its DRAM bandwidth in GB/s.
+# Compute scales with the --num_cu of the target; -peak-tflops and
+# -peak-bandwidth override both for other clocks and memories.
+CHIP_PEAKS = {
+    "gfx906": {
+        "num_cu": 64,
+        "bandwidth_gbps": 1024.0,
+        "tflops": {"fp32": 14.7, "fp16": 29.5, "bf16": 14.7, "i8": 59.0},
+    },
+    "gfx908": {
+        "num_cu": 120,
+        "bandwidth_gbps": 1228.8,
+        "tflops": {"fp32": 23.1, "fp16": 46.1, "bf16": 23.1, "i8": 92.3},
+        "xdlops_tflops": {
+            "fp32": 46.1,
+            "fp16": 184.6,
+            "bf16": 92.3,
+            "i8": 184.6,
+        },
+    },
+    "gfx90a": {
+        "num_cu": 110,
+        "bandwidth_gbps": 1638.4,
+        "tflops": {"fp32": 23.9, "fp16": 47.9, "bf16": 23.9, "i8": 95.7},
+        "xdlops_tflops": {
+            "fp32": 47.9,
+            "fp16": 191.5,
+            "bf16": 191.5,
+            "i8": 191.5,
+        },
+    },
+    "gfx1030": {
+        "num_cu": 80,
+        "bandwidth_gbps": 512.0,
+        "tflops": {"fp32": 23.0, "fp16": 46.1, "bf16": 23.0, "i8": 92.2},
+    },
+}
+
+# The counters -counters collects by default, one rocprof pass per line as
+# not all of them can be sampled at once. FETCH_SIZE and WRITE_SIZE are in
+# KB, and the others are percentages except for the bank conflict cycles.
+DEFAULT_COUNTERS = [
+    "LDSBankConflict SQ_LDS_BANK_CONFLICT",
+    "VALUBusy VALUUtilization SQ_VALU_MFMA_BUSY_CYCLES",
+    "L2CacheHit FETCH_SIZE WRITE_SIZE MemUnitBusy",
+]
+
+
+def read_corpus(path):
+    """Returns the version of the corpus at `path` and its (name, config)
+    shapes."""
+    version = None
+    shapes = []
+    with open(path) as corpus:
+        for line in corpus:
+            line = line.strip()
+            match = re.match(r"#\s*version:\s*(\S+)", line)
+            if match:
+                version = match.group(1)
+            if not line or line.startswith("#"):
+                continue
+            name, config = line.split(None, 1)
+            shapes.append((name, config))
+    if version is None:
+        sys.exit("%s: missing '# version:' line" % path)
+    return version, shapes
+
+
+def get_chip(target):
+    match = re.search(r"--arch\s+(\S+)", target)
+    if not match:
+        sys.exit("target '%s' has no --arch" % target)
+    # gfx908:sramecc+:xnack- and amdgcn-amd-amdhsa:gfx908 both name gfx908
+    return next(p for p in match.group(1).split(":") if p.startswith("gfx"))
+
+
+def get_problem_key(config):
+    """Returns the options of `config` in a canonical order, which name the
+    problem whatever order the corpus lists them in."""
+    options = re.findall(r"(--?\S+)(?:\s+([^-\s]\S*))?", config)
+    return " ".join(
+        ("%s %s" % option).strip() for option in sorted(set(options))
+    )
+
+
+def join_report(kernels, report):
+    """Adds to the timed `kernels` how the compiler built each of them, from
+    the kernel `report` of mlir-miopen-driver, whose kernels are in the order
+    of their indices."""
+    compiled = report.get("kernels", [])
+    if len(compiled) != len(kernels):
+        return
+    for kernel in kernels:
+        entry = compiled[kernel["kernel"]]
+        for field in (
+            "name",
+            "arch",
+            "perf_config",
+            "tuning_source",
+            "conv_solver",
+        ):
+            kernel[field] = entry.get(field, "")
+        if "resources" in entry:
+            kernel["resources"] = entry["resources"]
+
+
+def run_shape(args, config, target, launches, warmup, profiler=None):
+    """Returns the benchmark statistics of the kernels of the shape, as
+    printed by its host harness, and the revision of the compiler, or None
+    if it failed. `profiler` is the command the kernels are run under, if
+    any."""
+    bin_dir = args.bin_dir
+    shared_libs = ",".join(
+        [
+            os.path.join(args.mlir_lib_dir, "libmlir_rocm_runtime.so"),
+            os.path.join(args.lib_dir, "libconv-validation-wrappers.so"),
+            os.path.join(args.mlir_lib_dir, "libmlir_runner_utils.so"),
+        ]
+    )
+    gen = [
+        os.path.join(bin_dir, "miopen-gen"),
+        "-conv-config",
+        config + " " + target,
+        "-ph",
+        "-benchmark=%d" % launches,
+        "-benchmark-warmup=%d" % warmup,
+    ]
+    tmp = tempfile.TemporaryDirectory()
+    report_path = os.path.join(tmp.name, "kernels.json")
+    driver = [
+        os.path.join(bin_dir, "mlir-miopen-driver"),
+        "-c",
+        "-kernel-report=" + report_path,
+    ]
+    runner = (profiler or []) + [
+        os.path.join(bin_dir, "mlir-rocm-runner"),
+        "--shared-libs=" + shared_libs,
+        "--entry-point-result=void",
+    ]
+
+    with tmp:
+        input = None
+        for command in (gen, driver, runner):
+            result = subprocess.run(
+                command, input=input, capture_output=True, timeout=args.timeout
+            )
+            if result.returncode != 0:
+                sys.stderr.write(result.stderr.decode(errors="replace"))
+                return None
+            input = result.stdout
+        report = {}
+        if os.path.exists(report_path):
+            with open(report_path) as file:
+                report = json.load(file)
+
+    kernels = []
+    for line in input.decode(errors="replace").splitlines():
+        if line.startswith('{"kernel"'):
+            kernels.append(json.loads(line))
+    if not kernels:
+        return None
+    join_report(kernels, report)
+    return kernels, report.get("compiler", "")
+
+
+def collect_counters(args, config, target):
+    """Returns the mean of each counter of `args.counters` over the launches
+    of each kernel of the shape, by kernel name, or None if rocprof
+    failed."""
+    with tempfile.TemporaryDirectory() as tmp:
+        input_path = os.path.join(tmp, "counters.txt")
+        output_path = os.path.join(tmp, "counters.csv")
+        with open(input_path, "w") as file:
+            for line in args.counters:
+                file.write("pmc: %s\n" % line)
+        profiler = [args.rocprof, "-i", input_path, "-o", output_path]
+        # A few launches suffice, as counters do not vary like times do.
+        if run_shape(args, config, target, 5, 1, profiler) is None:
+            return None
+        if not os.path.exists(output_path):
+            return None
+        names = {name for line in args.counters for name in line.split()}
+        sums = {}
+        counts = {}
+        with open(output_path) as file:
+            for row in csv.DictReader(file):
+                kernel = row.get("KernelName", "").split(" ")[0]
+                kernel = re.sub(r"\.kd$", "", kernel)
+                totals = sums.setdefault(kernel, {})
+                counts[kernel] = counts.get(kernel, 0) + 1
+                for name in names:
+                    try:
+                        value = float(row[name])
+                    except (KeyError, TypeError, ValueError):
+                        continue
+                    totals[name] = totals.get(name, 0.0) + value
+    return {
+        kernel: {
+            name: round(total / counts[kernel], 4)
+            for name, total in sorted(totals.items())
+        }
+        for kernel, totals in sums.items()
+    }
+
+
+def get_data_type(config):
+    match = re.search(r"--in_type\s+(\S+)", config)
+    return match.group(1) if match else "fp32"
+
+
+def get_peaks(args, config, target):
+    """Returns the peak TFLOPs and GB/s of the shape on `target`, or None if
+    they are not known."""
+    chip = CHIP_PEAKS.get(get_chip(target), {})
+    tflops = args.peak_tflops
+    if tflops is None and chip:
+        table = chip["tflops"]
+        if re.search(r"--x2\s+1", target) and "xdlops_tflops" in chip:
+            table = chip["xdlops_tflops"]
+        tflops = table.get(get_data_type(config))
+        match = re.search(r"--num_cu\s+(\d+)", target)
+        if tflops is not None and match:
+            tflops *= int(match.group(1)) / chip["num_cu"]
+    bandwidth = args.peak_bandwidth or chip.get("bandwidth_gbps")
+    if tflops is None or bandwidth is None:
+        return None
+    return tflops, bandwidth
+
+
+def roofline(result, peaks):
+    """Returns the position of `result` on the roofline of `peaks`."""
+    kernels = result["kernels"]
+    flops = kernels[0]["flops"]
+    # Each kernel of a shape reads and writes at least its tensors.
+    traffic = sum(kernel["bytes"] for kernel in kernels)
+    peak_tflops, peak_bandwidth = peaks
+    intensity = flops / traffic if traffic > 0 else 0.0
+    ridge = peak_tflops * 1e3 / peak_bandwidth
+    attainable = min(peak_tflops, intensity * peak_bandwidth * 1e-3)
+    return {
+        "intensity": round(intensity, 3),
+        "ridge": round(ridge, 3),
+        "bound": "memory" if intensity < ridge else "compute",
+        "attainable_tflops": round(attainable, 4),
+        "efficiency": round(result["tflops"] / attainable, 4)
+        if attainable > 0
+        else 0.0,
+    }
+
+
+def summarize(kernels):
+    median = sum(kernel["median_ms"] for kernel in kernels)
+    flops = kernels[0]["flops"]
+    return {
+        "median_ms": median,
+        "min_ms": sum(kernel["min_ms"] for kernel in kernels),
+        "p99_ms": sum(kernel["p99_ms"] for kernel in kernels),
+        "tflops": flops / (median * 1e-3) * 1e-12 if median > 0 else 0.0,
+        "kernels": kernels,
+    }
+
+
+def compare(name, result, baseline, threshold):
+    """Returns whether `result` regressed from `baseline`, printing the
+    comparison."""
+    if baseline is None:
+        print("%-40s %10.4f ms  (no baseline)" % (name, result["median_ms"]))
+        return False
+    ratio = result["median_ms"] / baseline["median_ms"]
+    limit = 1.0 + baseline.get("threshold", threshold)
+    status = "REGRESSED" if ratio > limit else ""
+    print(
+        "%-40s %10.4f ms  baseline %10.4f ms  %+6.1f%% %s"
+        % (
+            name,
+            result["median_ms"],
+            baseline["median_ms"],
+            (ratio - 1.0) * 100,
+            status,
+        )
+    )
+    return ratio > limit
+
+
+def run_target(args, version, shapes, target):
+    """Benchmarks `shapes` on `target`, returning whether none regressed."""
+    chip = get_chip(target)
+    baseline_path = os.path.join(args.baseline_dir, chip + ".json")
+    baselines = {}
+    if os.path.exists(baseline_path) and not args.update_baseline:
+        with open(baseline_path) as file:
+            recorded = json.load(file)
+        if recorded.get("version") != version:
+            sys.exit(
+                "%s records version %s of the corpus, not %s: "
+                "record it again with -update-baseline"
+                % (baseline_path, recorded.get("version"), version)
+            )
+        baselines = recorded["results"]
+
+    print("Target: %s" % target)
+    results = {}
+    compiler = ""
+    ok = True
+    for name, config in shapes:
+        run = run_shape(args, config, target, args.launches, args.warmup)
+        if run is None:
+            print("%-40s FAILED" % name)
+            ok = False
+            continue
+        kernels, compiler = run
+        results[name] = summarize(kernels)
+        results[name]["problem"] = get_problem_key(config)
+        if compare(name, results[name], baselines.get(name), args.threshold):
+            ok = False
+        peaks = get_peaks(args, config, target)
+        if peaks is not None:
+            position = roofline(results[name], peaks)
+            results[name]["roofline"] = position
+            print(
+                "%-40s %8.3f flop/byte  %6.1f%% of %.2f TFLOPs (%s bound)"
+                % (
+                    "",
+                    position["intensity"],
+                    position["efficiency"] * 100,
+                    position["attainable_tflops"],
+                    position["bound"],
+                )
+            )
+        if args.counters:
+            counters = collect_counters(args, config, target)
+            if counters is None:
+                print("%-40s counters FAILED" % "")
+                continue
+            results[name]["counters"] = counters
+            for kernel, values in sorted(counters.items()):
+                print(
+                    "%-40s %s: %s"
+                    % (
+                        "",
+                        kernel,
+                        ", ".join("%s=%g" % item for item in values.items()),
+                    )
+                )
+
+    if args.update_baseline:
+        # Thresholds tuned by hand for noisy shapes are kept.
+        previous = {}
+        if os.path.exists(baseline_path):
+            with open(baseline_path) as file:
+                previous = json.load(file).get("results", {})
+        recorded = {}
+        for name, result in results.items():
+            recorded[name] = {"median_ms": round(result["median_ms"], 6)}
+            if "threshold" in previous.get(name, {}):
+                recorded[name]["threshold"] = previous[name]["threshold"]
+        os.makedirs(args.baseline_dir, exist_ok=True)
+        with open(baseline_path, "w") as file:
+            json.dump(
+                {"version": version, "target": target, "results": recorded},
+                file,
+                indent=2,
+                sort_keys=True,
+            )
+            file.write("\n")
+        print("Recorded %d baselines in %s" % (len(recorded), baseline_path))
+    return ok, {
+        "chip": chip,
+        "target": target,
+        "compiler": compiler,
+        "results": results,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Runs the performance regression suite."
+    )
+    parser.add_argument(
+        "-target",
+        action="append",
+        required=True,
+        help="options added to every shape to select the target, such as "
+        '"--arch gfx908 --num_cu 120 --x2 1" (repeatable)',
+    )
+    parser.add_argument(
+        "-corpus",
+        default=os.path.join(SCRIPT_DIR, "benchmark-shapes.txt"),
+        help="the shapes to benchmark",
+    )
+    parser.add_argument(
+        "-baseline-dir",
+        default=os.path.join(SCRIPT_DIR, "baselines"),
+        help="directory of the baselines, one <chip>.json each",
+    )
+    parser.add_argument(
+        "-bin-dir", default="bin", help="directory of the tools"
+    )
+    parser.add_argument(
+        "-lib-dir", default="lib", help="directory of the validation wrappers"
+    )
+    parser.add_argument(
+        "-mlir-lib-dir",
+        default=os.path.join("external", "llvm-project", "llvm", "lib"),
+        help="directory of the MLIR runtime libraries",
+    )
+    parser.add_argument(
+        "-filter", default=None, help="only run the shapes matching this regex"
+    )
+    parser.add_argument("-launches", type=int, default=50)
+    parser.add_argument("-warmup", type=int, default=5)
+    parser.add_argument(
+        "-threshold",
+        type=float,
+        default=0.05,
+        help="relative slowdown of the median time counted as a regression, "
+        "unless the baseline of the shape has its own",
+    )
+    parser.add_argument(
+        "-timeout", type=int, default=600, help="seconds per step"
+    )
+    parser.add_argument(
+        "-peak-tflops",
+        type=float,
+        default=None,
+        help="peak TFLOPs of the roofline, instead of that of the chip",
+    )
+    parser.add_argument(
+        "-peak-bandwidth",
+        type=float,
+        default=None,
+        help="peak GB/s of the roofline, instead of that of the chip",
+    )
+    parser.add_argument(
+        "-counters",
+        nargs="?",
+        const=";".join(DEFAULT_COUNTERS),
+        default=None,
+        help="collect hardware counters with rocprof, as semicolon-separated "
+        "groups of space-separated counters sampled together (default: "
+        "LDS bank conflicts, VALU and MFMA busy, L2 hit rate and bytes "
+        "fetched and written)",
+    )
+    parser.add_argument(
+        "-rocprof", default="rocprof", help="the rocprof to collect counters"
+    )
+    parser.add_argument(
+        "-update-baseline",
+        action="store_true",
+        help="record the results as the baselines instead of comparing",
+    )
+    parser.add_argument(
+        "-o", dest="output", default=None, help="write all results as JSON here"
+    )
+    args = parser.parse_args()
+    if args.counters:
+        args.counters = [
+            group.strip() for group in args.counters.split(";") if group.strip()
+        ]
+
+    version, shapes = read_corpus(args.corpus)
+    if args.filter:
+        shapes = [shape for shape in shapes if re.search(args.filter, shape[0])]
+
+    ok = True
+    reports = []
+    for target in args.target:
+        target_ok, report = run_target(args, version, shapes, target)
+        ok = ok and target_ok
+        reports.append(report)
+
+    if args.output:
+        # Sorted keys keep the files of two runs diffable line by line.
+        with open(args.output, "w") as file:
+            json.dump(
+                {
+                    "schema": RESULT_SCHEMA,
+                    "version": version,
+                    "targets": reports,
+                },
+                file,
+                indent=2,
+                sort_keys=True,
+            )
+            file.write("\n")
+    return 0 if ok or args.update_baseline else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
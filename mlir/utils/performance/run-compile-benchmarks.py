@@ -0,0 +1,337 @@
+#!/usr/bin/env python3
+# ===- run-compile-benchmarks.py - Compile-time regression suite -----------===#
+#
+# Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+# ===-----------------------------------------------------------------------===#
+#
+# Compiles the problems of compile-shapes.txt down to binaries for each
+# target with mlir-miopen-driver -compile-profile, a few times each, and
+# reports the median wall time of every pipeline phase and the median time
+# of every pass within it. Convolutions are generated with miopen-gen first;
+# the canned modules of compile-modules/ also go through the partition and
+# bufferization pipelines. No GPU is needed. Example, from the build
+# directory:
+#
+#   run-compile-benchmarks.py -target "--arch gfx908 --num_cu 120 --x2 1"
+#
+# A problem regressed when its total compile time, the sum of its phases,
+# grew by more than the threshold from the baseline given with -baseline.
+# Passes that take long enough to be timed reliably are compared the same
+# way, which points at the pass responsible. Compile times depend on the
+# machine, so baselines are recorded per machine rather than checked in:
+# with -update-baseline, or by the first run given a -baseline that does not
+# exist yet.
+#
+# -o writes the results as JSON, in the layout of RESULT_SCHEMA, with the
+# times in milliseconds and keys sorted so that two runs diff line by line.
+#
+# ===-----------------------------------------------------------------------===#
+
+import argparse
+import json
+import os
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# Version of the layout of the results written with -o and of the baselines,
+# raised whenever a field changes meaning or goes away.
+RESULT_SCHEMA = 1
+
+# Passes faster than this, in milliseconds, are too noisy to flag on their
+# own; they still count in the totals.
+MIN_PASS_MS = 5.0
+
+# The triple the kernels are compiled to binaries for.
+TRIPLE = "amdgcn-amd-amdhsa"
+
+
+def read_corpus(path):
+    """Returns the version of the corpus at `path` and its (name, problem)
+    entries."""
+    version = None
+    problems = []
+    with open(path) as corpus:
+        for line in corpus:
+            line = line.strip()
+            match = re.match(r"#\s*version:\s*(\S+)", line)
+            if match:
+                version = match.group(1)
+            if not line or line.startswith("#"):
+                continue
+            name, problem = line.split(None, 1)
+            problems.append((name, problem))
+    if version is None:
+        sys.exit("%s: missing '# version:' line" % path)
+    return version, problems
+
+
+def get_chip(target):
+    match = re.search(r"--arch\s+(\S+)", target)
+    if not match:
+        sys.exit("target '%s' has no --arch" % target)
+    # gfx908:sramecc+:xnack- and amdgcn-amd-amdhsa:gfx908 both name gfx908
+    return next(p for p in match.group(1).split(":") if p.startswith("gfx"))
+
+
+def compile_once(args, problem, target):
+    """Compiles `problem` for `target` once, returning the compile profile
+    mlir-miopen-driver recorded, or None if it failed."""
+    driver = [
+        os.path.join(args.bin_dir, "mlir-miopen-driver"),
+        "-kernel-pipeline=full",
+        "-triple=" + TRIPLE,
+        "-target=" + get_chip(target),
+        "-compile-profile-format=json",
+        "-o",
+        os.devnull,
+    ]
+    commands = []
+    if problem.startswith("@"):
+        module = os.path.join(args.module_dir, problem[1:])
+        commands.append(driver + ["-host-pipeline=partition,highlevel", module])
+    else:
+        gen = [
+            os.path.join(args.bin_dir, "miopen-gen"),
+            "-conv-config",
+            problem + " " + target,
+        ]
+        commands += [gen, driver]
+
+    with tempfile.TemporaryDirectory() as tmp:
+        profile_path = os.path.join(tmp, "profile.json")
+        commands[-1].append("-compile-profile=" + profile_path)
+        input = None
+        for command in commands:
+            result = subprocess.run(
+                command, input=input, capture_output=True, timeout=args.timeout
+            )
+            if result.returncode != 0:
+                sys.stderr.write(result.stderr.decode(errors="replace"))
+                return None
+            input = result.stdout
+        with open(profile_path) as file:
+            return json.load(file)
+
+
+def summarize(profiles):
+    """Returns the median times, in milliseconds, of the phases and passes of
+    the compile `profiles` of a problem, and of the whole compile."""
+    def median_ms(values):
+        return round(statistics.median(values) / 1000.0, 3)
+
+    phases = {}
+    passes = {}
+    totals = []
+    for profile in profiles:
+        totals.append(sum(phase["us"] for phase in profile["phases"]))
+        for phase in profile["phases"]:
+            phases.setdefault(phase["phase"], []).append(phase["us"])
+        # A pass of a phase may run on many ops, whose times add up.
+        times = {}
+        for run in profile["passes"]:
+            key = "%s/%s" % (run["phase"], run["pass"])
+            times[key] = times.get(key, 0) + run["us"]
+        for key, us in times.items():
+            passes.setdefault(key, []).append(us)
+    return {
+        "total_ms": median_ms(totals),
+        "phases": {name: median_ms(us) for name, us in phases.items()},
+        "passes": {name: median_ms(us) for name, us in passes.items()},
+    }
+
+
+def compare(name, result, baseline, threshold):
+    """Returns whether `result` regressed from `baseline`, printing the
+    comparison of its total and of the passes that regressed."""
+    if baseline is None:
+        print("%-40s %10.1f ms  (no baseline)" % (name, result["total_ms"]))
+        return False
+    limit = 1.0 + baseline.get("threshold", threshold)
+    ratio = result["total_ms"] / baseline["total_ms"]
+    print(
+        "%-40s %10.1f ms  baseline %10.1f ms  %+6.1f%% %s"
+        % (
+            name,
+            result["total_ms"],
+            baseline["total_ms"],
+            (ratio - 1.0) * 100,
+            "REGRESSED" if ratio > limit else "",
+        )
+    )
+    regressed = ratio > limit
+    for key, ms in sorted(result["passes"].items()):
+        old = baseline.get("passes", {}).get(key)
+        if old is None or max(ms, old) < MIN_PASS_MS:
+            continue
+        pass_ratio = ms / old if old > 0 else float("inf")
+        if pass_ratio <= limit:
+            continue
+        print(
+            "%-40s %10.1f ms  baseline %10.1f ms  %+6.1f%% REGRESSED"
+            % ("  " + key, ms, old, (pass_ratio - 1.0) * 100)
+        )
+        regressed = True
+    return regressed
+
+
+def run_target(args, problems, baselines, target):
+    """Compiles `problems` for `target`, returning whether none regressed
+    and the results."""
+    chip = get_chip(target)
+    print("Target: %s" % target)
+    results = {}
+    ok = True
+    for name, problem in problems:
+        profiles = []
+        for _ in range(args.repeat):
+            profile = compile_once(args, problem, target)
+            if profile is None:
+                break
+            profiles.append(profile)
+        if len(profiles) != args.repeat:
+            print("%-40s FAILED" % name)
+            ok = False
+            continue
+        results[name] = summarize(profiles)
+        results[name]["problem"] = problem
+        if compare(name, results[name], baselines.get(name), args.threshold):
+            ok = False
+        if args.verbose:
+            for key, ms in sorted(
+                results[name]["passes"].items(), key=lambda item: -item[1]
+            ):
+                print("%-40s %10.1f ms" % ("  " + key, ms))
+    return ok, {"chip": chip, "target": target, "results": results}
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Runs the compile-time regression suite."
+    )
+    parser.add_argument(
+        "-target",
+        action="append",
+        required=True,
+        help="options added to every convolution to select the target, such "
+        'as "--arch gfx908 --num_cu 120 --x2 1" (repeatable)',
+    )
+    parser.add_argument(
+        "-corpus",
+        default=os.path.join(SCRIPT_DIR, "compile-shapes.txt"),
+        help="the problems to compile",
+    )
+    parser.add_argument(
+        "-module-dir",
+        default=os.path.join(SCRIPT_DIR, "compile-modules"),
+        help="directory of the modules the corpus names with @",
+    )
+    parser.add_argument(
+        "-bin-dir", default="bin", help="directory of the tools"
+    )
+    parser.add_argument(
+        "-filter",
+        default=None,
+        help="only compile the problems matching this regex",
+    )
+    parser.add_argument(
+        "-repeat",
+        type=int,
+        default=5,
+        help="compiles of each problem the medians are taken over",
+    )
+    parser.add_argument(
+        "-threshold",
+        type=float,
+        default=0.10,
+        help="relative slowdown of the compile time counted as a regression, "
+        "unless the baseline of the problem has its own",
+    )
+    parser.add_argument(
+        "-timeout", type=int, default=600, help="seconds per step"
+    )
+    parser.add_argument(
+        "-baseline",
+        default=None,
+        help="results of an earlier run, as written with -o or "
+        "-update-baseline, to compare with",
+    )
+    parser.add_argument(
+        "-update-baseline",
+        action="store_true",
+        help="record the results in -baseline instead of comparing, which "
+        "a -baseline that does not exist implies",
+    )
+    parser.add_argument(
+        "-v",
+        dest="verbose",
+        action="store_true",
+        help="print the time of every pass",
+    )
+    parser.add_argument(
+        "-o", dest="output", default=None, help="write all results as JSON here"
+    )
+    args = parser.parse_args()
+    if args.update_baseline and not args.baseline:
+        sys.exit("-update-baseline needs -baseline")
+    if args.baseline and not os.path.exists(args.baseline):
+        args.update_baseline = True
+
+    version, problems = read_corpus(args.corpus)
+    if args.filter:
+        problems = [p for p in problems if re.search(args.filter, p[0])]
+
+    baselines = {}
+    if args.baseline and not args.update_baseline:
+        with open(args.baseline) as file:
+            recorded = json.load(file)
+        if recorded.get("schema") != RESULT_SCHEMA or (
+            recorded.get("version") != version
+        ):
+            sys.exit(
+                "%s records schema %s of version %s of the corpus, not %d of "
+                "%s: record it again with -update-baseline"
+                % (
+                    args.baseline,
+                    recorded.get("schema"),
+                    recorded.get("version"),
+                    RESULT_SCHEMA,
+                    version,
+                )
+            )
+        baselines = {
+            target["target"]: target["results"]
+            for target in recorded["targets"]
+        }
+
+    ok = True
+    reports = []
+    for target in args.target:
+        target_ok, report = run_target(
+            args, problems, baselines.get(target, {}), target
+        )
+        ok = ok and target_ok
+        reports.append(report)
+
+    results = {"schema": RESULT_SCHEMA, "version": version, "targets": reports}
+    paths = [args.output] if args.output else []
+    if args.update_baseline:
+        paths.append(args.baseline)
+    for path in paths:
+        with open(path, "w") as file:
+            json.dump(results, file, indent=2, sort_keys=True)
+            file.write("\n")
+    if args.update_baseline:
+        print("Recorded the baselines in %s" % args.baseline)
+    return 0 if ok or args.update_baseline else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())